@@ -28,8 +28,10 @@ import os
 from . import base
 from . import renderer
 from . import material
+from . import exporter
 from .ui import ui_render
 from .ui import ui_particle
+from .ui import ui_volume
 from .ui import ui_world
 from .ui import ui_camera
 from .ui import ui_light
@@ -49,6 +51,13 @@ def register():
     # this is the place for initializing group node information saved last time
     bpy.app.handlers.load_post.append(material.node_groups_load_post)
 
+    # exported meshes are reused in the next rendering unless their geometry is changed
+    bpy.app.handlers.load_post.append(exporter.clear_export_cache)
+    bpy.app.handlers.depsgraph_update_post.append(exporter.track_geometry_updates)
+
 def unregister():
+    bpy.app.handlers.depsgraph_update_post.remove(exporter.track_geometry_updates)
+    bpy.app.handlers.load_post.remove(exporter.clear_export_cache)
+
     # unregister everything already registered
     base.unregister()
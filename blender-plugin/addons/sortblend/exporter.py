@@ -15,6 +15,9 @@
 
 import bpy
 import os
+import math
+import re
+import hashlib
 import mathutils
 import platform
 import tempfile
@@ -78,6 +81,73 @@ def get_intermediate_dir(force_debug=False):
         return return_path + '/'
     return return_path + '/'
 
+# the cache of the accelerator outlives the intermediate directory so that the next rendering can reuse it
+def get_accelerator_cache_path():
+    return_path = os.path.join( tempfile.gettempdir() , 'sort_accelerator.cache' )
+    if platform.system() == 'Windows':
+        return_path = return_path.replace( '\\' , '/' )
+    return return_path
+
+def get_sky_cache_path():
+    return_path = os.path.join( tempfile.gettempdir() , 'sort_sky.cache' )
+    if platform.system() == 'Windows':
+        return_path = return_path.replace( '\\' , '/' )
+    return return_path
+
+# Exported meshes are cached on disk during a Blender session. Blender tags the geometry that changes in the depsgraph,
+# a cached mesh is streamed again as long as neither its object nor its mesh is tagged and the rest of its key matches.
+export_cache = {}
+dirty_geometry = set()
+
+def get_export_cache_dir():
+    return_path = os.path.join( tempfile.gettempdir() , 'sort_export_cache' )
+    if not os.path.exists(return_path):
+        os.mkdir(return_path)
+    return return_path
+
+@bpy.app.handlers.persistent
+def track_geometry_updates(scene, depsgraph):
+    for update in depsgraph.updates:
+        if update.is_updated_geometry:
+            dirty_geometry.add((type(update.id.original).__name__, update.id.original.name))
+
+@bpy.app.handlers.persistent
+def clear_export_cache(dummy):
+    # a new file may have objects of the same names, nothing in the cache is valid any more
+    export_cache.clear()
+
+# export a mesh, or stream the one exported last time if nothing has changed since then
+def export_mesh_cached(scene, obj, mesh, fs, with_visual_name = True):
+    # volumes are baked per frame, meshes with them are not worth caching
+    if not scene.sort_data.export_cache or get_smoke_modifier(obj) is not None or get_nanovdb_file(obj):
+        return export_mesh(obj, mesh, fs, with_visual_name)
+
+    ids = (('Object', obj.original.name), ('Mesh', mesh.original.name if mesh.original else mesh.name))
+    # material ids are baked in the data and deformed meshes change over time without a geometry tag
+    material_ids = tuple(matname_to_id.get(name_compat(m.name if m else None), -1) for m in mesh.materials[:])
+    time_dependent = obj.is_modified(scene, 'RENDER') or obj.data.shape_keys is not None
+    key = (ids, with_visual_name, len(mesh.vertices), len(mesh.loops), len(mesh.polygons), bool(mesh.uv_layers),
+           material_ids, scene.frame_current_final if time_dependent else None)
+
+    entry = export_cache.get(ids)
+    if entry is not None and entry[0] == key and not any(i in dirty_geometry for i in ids) and os.path.exists(entry[1]):
+        with open(entry[1], 'rb') as f:
+            fs.serialize(f.read())
+        return entry[2]
+
+    ms = stream.MemoryStream()
+    stat = export_mesh(obj, mesh, ms, with_visual_name)
+    data = ms.getvalue()
+    fs.serialize(data)
+
+    path = os.path.join(get_export_cache_dir(), hashlib.sha1(repr(ids).encode('utf-8')).hexdigest() + '.mesh')
+    with open(path, 'wb') as f:
+        f.write(data)
+    export_cache[ids] = (key, path, stat)
+    for i in ids:
+        dirty_geometry.discard(i)
+    return stat
+
 # Coordinate transformation
 # Basically, the coordinate system of Blender and SORT is very different.
 # In Blender, the coordinate system is as below and this is a right handed system
@@ -165,17 +235,21 @@ def lookat_camera(camera):
     return (pos, target, up)
 
 # export blender information
-def export_blender(depsgraph, force_debug=False, is_preview=False):
+def export_blender(depsgraph, force_debug=False, is_preview=False, fs=None):
     scene = depsgraph.scene
 
-    # create intermediate resource path
-    sort_resource_path = create_path(scene, force_debug)
+    if fs is None:
+        # create intermediate resource path
+        sort_resource_path = create_path(scene, force_debug)
 
-    # initialize the file to be fed as main input for the renderer
-    # this will potentially be replaced with socket streaming in the future
-    sort_config_file = sort_resource_path + 'scene.sort'
-    fs = stream.FileStream( sort_config_file )
-    log("Exporting sort file %s" % sort_config_file)
+        # initialize the file to be fed as main input for the renderer
+        sort_config_file = sort_resource_path + 'scene.sort'
+        fs = stream.FileStream( sort_config_file )
+        log("Exporting sort file %s" % sort_config_file)
+    else:
+        # the scene is streamed straight to the renderer, the intermediate path is created before launching it
+        sort_resource_path = get_intermediate_dir(force_debug)
+        log("Streaming scene to SORT")
 
     # export global settings for the renderer
     current_time = time()
@@ -220,29 +294,54 @@ def get_smoke_modifier(obj: bpy.types.Object):
     return next((modifier for modifier in obj.modifiers if modifier.type == 'SMOKE' and modifier.smoke_type == 'DOMAIN'), None)
 
 # export scene
-def export_scene(depsgraph, is_preview, fs):
-    # helper function to convert a matrix to a tuple
-    def matrix_to_tuple(matrix):
-        return (matrix[0][0],matrix[0][1],matrix[0][2],matrix[0][3],matrix[1][0],matrix[1][1],matrix[1][2],matrix[1][3],
-                matrix[2][0],matrix[2][1],matrix[2][2],matrix[2][3],matrix[3][0],matrix[3][1],matrix[3][2],matrix[3][3])
-
-    # helper function to convert a vector to a tuple
-    def vec3_to_tuple(vec):
-        return (vec[0],vec[1],vec[2])
-
-    # get the scene object from dependency graph
-    scene = depsgraph.scene
-
-    # this is a special code for the render to identify that the serialized input is still valid.
-    vericiation_bits = SID('verification bits')
-    fs.serialize( vericiation_bits )
-
-    # camera node
+# helper function to convert a matrix to a tuple
+def matrix_to_tuple(matrix):
+    return (matrix[0][0],matrix[0][1],matrix[0][2],matrix[0][3],matrix[1][0],matrix[1][1],matrix[1][2],matrix[1][3],
+            matrix[2][0],matrix[2][1],matrix[2][2],matrix[2][3],matrix[3][0],matrix[3][1],matrix[3][2],matrix[3][3])
+
+# helper function to convert a vector to a tuple
+def vec3_to_tuple(vec):
+    return (vec[0],vec[1],vec[2])
+
+# the camera is always the first entity in the scene
+camera_entity_index = 0
+# mapping from the name of an object to the index of its entity in the renderer, it is used to move objects in server mode
+objname_to_entity = {}
+# mapping from the name of a light to the index of its entity in the renderer, it is used to edit lights in server mode
+lightname_to_entity = {}
+
+# number of moments in the shutter interval at which moving objects and the camera are exported
+MOTION_BLUR_KEY_CNT = 3
+
+# collect where the camera and the objects are at evenly spaced moments in the shutter interval, centered at the frame
+def collect_motion(scene, objs):
+    camera_keys = []
+    object_keys = {}
+    if not scene.render.use_motion_blur:
+        return camera_keys, object_keys
+
+    frame = scene.frame_current
+    subframe = scene.frame_subframe
+    shutter = scene.render.motion_blur_shutter
+    matrices = { obj.name : [] for obj in objs }
+    for i in range(MOTION_BLUR_KEY_CNT):
+        moment = frame + subframe + shutter * ( i / ( MOTION_BLUR_KEY_CNT - 1 ) - 0.5 )
+        scene.frame_set( int( moment // 1 ) , subframe = moment % 1 )
+        camera_keys.append( lookat_camera( scene.camera ) )
+        for obj in objs:
+            matrices[obj.name].append( MatrixBlenderToSort() @ bpy.data.objects[obj.name].matrix_world )
+    scene.frame_set( frame , subframe = subframe )
+
+    # objects not moving at all are not treated as moving ones
+    for name, keys in matrices.items():
+        if any( key != keys[0] for key in keys ):
+            object_keys[name] = keys
+    if all( key == camera_keys[0] for key in camera_keys ):
+        camera_keys = []
+    return camera_keys, object_keys
+
+def export_camera(scene, fs, camera_keys = []):
     camera = scene.camera
-    if camera is None:
-        print("There is no active camera.")
-        return
-
     pos, target, up = lookat_camera(camera)
     sensor_w = bpy.data.cameras[0].sensor_width
     sensor_h = bpy.data.cameras[0].sensor_height
@@ -256,37 +355,97 @@ def export_scene(depsgraph, is_preview, fs):
     aspect_ratio_y = scene.render.pixel_aspect_y
     fov_angle = bpy.data.cameras[0].angle
 
-    fs.serialize(SID('PerspectiveCameraEntity'))
     fs.serialize(vec3_to_tuple(pos))
     fs.serialize(vec3_to_tuple(up))
     fs.serialize(vec3_to_tuple(target))
     fs.serialize(camera.data.sort_data.lens_size)
+    fs.serialize(camera.data.dof.aperture_blades)
+    fs.serialize(camera.data.dof.aperture_rotation)
     fs.serialize((sensor_w,sensor_h))
     fs.serialize(int(sensor_fit))
     fs.serialize((aspect_ratio_x,aspect_ratio_y))
     fs.serialize(fov_angle)
+    fs.serialize(len(camera_keys))
+    for key_pos, key_target, key_up in camera_keys:
+        fs.serialize(vec3_to_tuple(key_pos))
+        fs.serialize(vec3_to_tuple(key_up))
+        fs.serialize(vec3_to_tuple(key_target))
+
+def export_scene(depsgraph, is_preview, fs):
+    # get the scene object from dependency graph
+    scene = depsgraph.scene
+
+    # this is a special code for the render to identify that the serialized input is still valid.
+    vericiation_bits = SID('verification bits')
+    fs.serialize( vericiation_bits )
+
+    # camera node
+    camera = scene.camera
+    if camera is None:
+        print("There is no active camera.")
+        return
 
     all_lights = [ ob for ob in depsgraph_objects(depsgraph) if ob.type == 'LIGHT' ]
     all_objs = [ ob for ob in depsgraph_objects(depsgraph) if ob.type == 'MESH' ]
+    camera_keys, object_keys = collect_motion(scene, all_objs)
+
+    # every entity is a chunk so that entities can be loaded in parallel in the renderer
+    fs.serialize(SID('PerspectiveCameraEntity'))
+    fs.begin_chunk()
+    export_camera(scene, fs, camera_keys)
+    fs.end_chunk()
+    entity_cnt = camera_entity_index + 1
+    objname_to_entity.clear()
+    lightname_to_entity.clear()
+
+    # meshes shared by more than one unmodified object are exported once and instanced by the rest of the objects,
+    # unmodified moving objects are instances as well since only instances carry the motion of their transforms.
+    mesh_users = {}
+    for obj in all_objs:
+        if not obj.is_modified(scene, 'RENDER'):
+            mesh_users[obj.data.name] = mesh_users.get(obj.data.name, 0) + ( 2 if obj.name in object_keys else 1 )
+    exported_meshes = set()
 
     total_vert_cnt = 0
     total_prim_cnt = 0
     # export meshes
     for obj in all_objs:
+        objname_to_entity[obj.name] = entity_cnt
+        entity_cnt += 1
+
         fs.serialize(SID('VisualEntity'))
+        fs.begin_chunk()
         fs.serialize( matrix_to_tuple( MatrixBlenderToSort() @ obj.matrix_world ) )
         fs.serialize( 1 )   # only one mesh for each mesh entity
         stat = None
         # apply the modifier if there is one
-        if obj.type != 'MESH' or obj.is_modified(scene, 'RENDER'):
+        subdivision = native_subdivision(scene, obj) if obj.type == 'MESH' else None
+        if subdivision:
+            stat = export_subdivision(obj, obj.data, subdivision[0], subdivision[1], fs)
+        elif obj.type != 'MESH' or obj.is_modified(scene, 'RENDER'):
             try:
                 evaluated_obj = obj.evaluated_get(depsgraph)
                 mesh = evaluated_obj.to_mesh()
-                stat = export_mesh(evaluated_obj, mesh, fs)
+                stat = export_mesh_cached(scene, evaluated_obj, mesh, fs)
             finally:
                 evaluated_obj.to_mesh_clear()
+        elif mesh_users[obj.data.name] > 1:
+            fs.serialize(SID('MeshInstanceVisual'))
+            fs.serialize(SID(obj.data.name))
+            if obj.data.name in exported_meshes:
+                fs.serialize(False)
+                stat = (0, 0)
+            else:
+                fs.serialize(True)
+                stat = export_mesh_cached(scene, obj, obj.data, fs, False)
+                exported_meshes.add(obj.data.name)
+            keys = object_keys.get(obj.name, [])
+            fs.serialize(len(keys))
+            for key in keys:
+                fs.serialize(matrix_to_tuple(key))
         else:
-            stat = export_mesh(obj, obj.data, fs)
+            stat = export_mesh_cached(scene, obj, obj.data, fs)
+        fs.end_chunk()
 
         total_vert_cnt += stat[0]
         total_prim_cnt += stat[1]
@@ -297,13 +456,16 @@ def export_scene(depsgraph, is_preview, fs):
 
         # output hair/fur information
         if len( evaluted_obj.particle_systems ) > 0:
+            entity_cnt += 1
             fs.serialize( SID('VisualEntity') )
+            fs.begin_chunk()
             fs.serialize( matrix_to_tuple( MatrixBlenderToSort() @ evaluted_obj.matrix_world ) )
             fs.serialize( len( evaluted_obj.particle_systems ) )
             for ps in evaluted_obj.particle_systems:
                 stat = export_hair( ps , evaluted_obj , scene , is_preview, fs )
                 total_vert_cnt += stat[0]
                 total_prim_cnt += stat[1]
+            fs.end_chunk()
 
     log( "Total vertices: %d." % total_vert_cnt )
     log( "Total primitives: %d." % total_prim_cnt )
@@ -320,8 +482,12 @@ def export_scene(depsgraph, is_preview, fs):
         # make sure the type of the light is supported
         assert( lamp.type in mapping )
 
+        lightname_to_entity[ob.name] = entity_cnt
+        entity_cnt += 1
+
         # name identifier of the light
         fs.serialize( SID(mapping[lamp.type]) )
+        fs.begin_chunk()
 
         # transformation of light source
         fs.serialize(matrix_to_tuple(world_matrix))
@@ -347,19 +513,72 @@ def export_scene(depsgraph, is_preview, fs):
                 fs.serialize(lamp.size_y)
             elif lamp.shape == 'DISK':
                 fs.serialize(lamp.size * 0.5)
+        fs.end_chunk()
 
-    hdr_sky_image = scene.sort_hdr_sky.hdr_image
-    if hdr_sky_image is not None:
+    sky = scene.sort_hdr_sky
+    hdr_sky_image = sky.hdr_image
+    if sky.sky_model == 'PREETHAM' or hdr_sky_image is not None:
         fs.serialize(SID('SkyLightEntity'))
+        fs.begin_chunk()
         global_matrix = mathutils.Matrix()
         fs.serialize(matrix_to_tuple(global_matrix))
         fs.serialize(( 1.0 , 1.0 , 1.0 ))   # light tint color
         fs.serialize( 1.0 )                 # sky light scaling, not supported since it is not pbs.
-        fs.serialize(bpy.path.abspath( hdr_sky_image.filepath ))
+        if sky.sky_model == 'PREETHAM':
+            # the sun direction in SORT coordinate, whose up axis is Y
+            cos_el = math.cos(sky.sun_elevation)
+            sun_dir = ( cos_el * math.cos(sky.sun_azimuth) , math.sin(sky.sun_elevation) , cos_el * math.sin(sky.sun_azimuth) )
+            fs.serialize(SID('PREETHAM'))
+            fs.serialize(sky.turbidity)
+            fs.serialize(sun_dir)
+            fs.serialize(sky.sun_size * 0.5)
+            fs.serialize(sky.sun_strength)
+        else:
+            fs.serialize(SID('HDR'))
+            fs.serialize(bpy.path.abspath( hdr_sky_image.filepath ))
+        fs.end_chunk()
 
     # to indicate the scene stream comes to an end
     fs.serialize(SID('End of Entities'))
 
+# the following commands are only understood by the renderer in server mode, they are sent after the scene is loaded
+# and before each frame is rendered.
+def update_camera(scene, fs):
+    fs.serialize(SID('Update Camera'))
+    fs.serialize(camera_entity_index)
+    export_camera(scene, fs)
+
+# only objects exported as a single visual entity can be moved, meshes with modifiers need to be exported again
+def update_transform(obj, fs):
+    if obj.name not in objname_to_entity:
+        return False
+    fs.serialize(SID('Update Transform'))
+    fs.serialize(objname_to_entity[obj.name])
+    fs.serialize(matrix_to_tuple( MatrixBlenderToSort() @ obj.matrix_world ))
+    return True
+
+# only the strength and the color of a light could be edited, they are applied without rendering again if relighting is enabled
+def update_light(ob, fs):
+    if ob.name not in lightname_to_entity:
+        return False
+    lamp = ob.data
+    fs.serialize(SID('Update Light'))
+    fs.serialize(lightname_to_entity[ob.name])
+    fs.serialize(lamp.energy)
+    fs.serialize(lamp.color[:])
+    return True
+
+def update_materials(depsgraph, materials, fs):
+    export_materials(depsgraph, fs, set( mat.name for mat in materials ))
+
+def request_frame(fs):
+    fs.serialize(SID('Render'))
+    fs.flush()
+
+def quit_server(fs):
+    fs.serialize(SID('Quit'))
+    fs.flush()
+
 # avoid having space in material name
 def name_compat(name):
     if name is None:
@@ -379,7 +598,7 @@ def export_global_config(scene, fs, sort_resource_path):
     integrator_type = sort_data.integrator_type_prop
     accelerator_type = sort_data.accelerator_type_prop
 
-    fs.serialize( 0 )
+    fs.serialize( 4 )
     fs.serialize( sort_resource_path )
     fs.serialize( sort_output_file )
     fs.serialize( 64 )    # tile size, hard-coded it until I need to update it throught exposed interface later.
@@ -388,11 +607,20 @@ def export_global_config(scene, fs, sort_resource_path):
     fs.serialize( int(xres) )
     fs.serialize( int(yres) )
     fs.serialize( sort_data.clampping )
+    fs.serialize( bool(sort_data.progressive_prop) )
+    fs.serialize( int(sort_data.sample_per_pass_prop) )
+    fs.serialize( float(sort_data.time_budget_prop) )
+    fs.serialize( bool(sort_data.adaptive_sampling_prop) )
+    fs.serialize( int(sort_data.min_sample_count_prop) )
+    fs.serialize( float(sort_data.noise_threshold_prop) )
+    fs.serialize( bool(sort_data.splat_film_prop) )
+    fs.serialize( SID(sort_data.sampler_type_prop) )
 
     if accelerator_type == "bvh":
         fs.serialize( SID('Bvh') )
         fs.serialize( int(sort_data.bvh_max_node_depth) )
         fs.serialize( int(sort_data.bvh_max_pri_in_leaf) )
+        fs.serialize( float(sort_data.bvh_spatial_split_budget) )
     elif accelerator_type == "KDTree":
         fs.serialize( SID('KDTree') )
         fs.serialize( int(sort_data.kdtree_max_node_depth) )
@@ -405,10 +633,30 @@ def export_global_config(scene, fs, sort_resource_path):
         fs.serialize( SID('Qbvh') )
         fs.serialize( int(sort_data.qbvh_max_node_depth) )
         fs.serialize( int(sort_data.qbvh_max_pri_in_leaf) )
+        fs.serialize( bool(sort_data.qbvh_compressed_node) )
+        fs.serialize( float(sort_data.qbvh_spatial_split_budget) )
+        fs.serialize( bool(sort_data.qbvh_compressed_leaf) )
     elif accelerator_type == "Obvh":
         fs.serialize( SID('Obvh') )
         fs.serialize( int(sort_data.obvh_max_node_depth) )
         fs.serialize( int(sort_data.obvh_max_pri_in_leaf) )
+        fs.serialize( bool(sort_data.obvh_compressed_node) )
+        fs.serialize( float(sort_data.obvh_spatial_split_budget) )
+        fs.serialize( bool(sort_data.obvh_compressed_leaf) )
+    elif accelerator_type == "Hbvh":
+        fs.serialize( SID('Hbvh') )
+        fs.serialize( int(sort_data.hbvh_max_node_depth) )
+        fs.serialize( int(sort_data.hbvh_max_pri_in_leaf) )
+        fs.serialize( bool(sort_data.hbvh_compressed_node) )
+        fs.serialize( float(sort_data.hbvh_spatial_split_budget) )
+        fs.serialize( bool(sort_data.hbvh_compressed_leaf) )
+    elif accelerator_type == "Fbvh":
+        fs.serialize( SID('Fbvh') )
+        fs.serialize( int(sort_data.fbvh_max_node_depth) )
+        fs.serialize( int(sort_data.fbvh_max_pri_in_leaf) )
+        fs.serialize( bool(sort_data.fbvh_compressed_node) )
+        fs.serialize( float(sort_data.fbvh_spatial_split_budget) )
+        fs.serialize( bool(sort_data.fbvh_compressed_leaf) )
     else:
         fs.serialize( SID('UniGrid') )
 
@@ -416,17 +664,59 @@ def export_global_config(scene, fs, sort_resource_path):
     fs.serialize( int(sort_data.inte_max_recur_depth) )
     if integrator_type == "PathTracing":
         fs.serialize( int(sort_data.max_bssrdf_bounces) )
+        fs.serialize( bool(sort_data.path_guiding) )
+        fs.serialize( int(sort_data.russian_roulette_depth) )
+        fs.serialize( int(sort_data.primary_splits) )
+        fs.serialize( float(sort_data.shadow_roulette) )
+        fs.serialize( bool(sort_data.coarse_shadow) )
+        fs.serialize( float(sort_data.path_regularization) )
+    if integrator_type == "DirectLight" or integrator_type == "WhittedRT":
+        fs.serialize( int(sort_data.light_candidates) )
+    if integrator_type == "ReSTIRDI":
+        fs.serialize( int(sort_data.restir_candidates) )
+        fs.serialize( int(sort_data.restir_spatial_neighbors) )
+        fs.serialize( float(sort_data.restir_spatial_radius) )
+        fs.serialize( bool(sort_data.restir_temporal_reuse) )
     if integrator_type == "AmbientOcclusion":
         fs.serialize( sort_data.ao_max_dist )
     if integrator_type == "BidirPathTracing" or integrator_type == "LightTracing":
         fs.serialize( bool(sort_data.bdpt_mis) )
+    if integrator_type == "VertexConnectionMerging":
+        fs.serialize( bool(sort_data.bdpt_mis) )
+        fs.serialize( sort_data.vcm_radius_factor )
+        fs.serialize( sort_data.vcm_radius_alpha )
+    if integrator_type == "MetropolisLightTransport":
+        fs.serialize( bool(sort_data.bdpt_mis) )
+        fs.serialize( int(sort_data.mlt_bootstrap_samples) )
+        fs.serialize( int(sort_data.mlt_chains) )
+        fs.serialize( float(sort_data.mlt_large_step_prob) )
+        fs.serialize( float(sort_data.mlt_sigma) )
     if integrator_type == "InstantRadiosity":
         fs.serialize( sort_data.ir_light_path_set_num )
         fs.serialize( sort_data.ir_light_path_num )
         fs.serialize( sort_data.ir_min_dist )
 
+# full path of the NanoVDB file of a mesh in the current frame, an empty string if there is none
+def get_nanovdb_file(obj):
+    sort_volume = getattr(obj.original, 'sort_volume', None)
+    if sort_volume is None or not sort_volume.nanovdb_file:
+        return ''
+    frame = bpy.context.scene.frame_current
+    filename = re.sub('#+', lambda m: str(frame).zfill(len(m.group())), sort_volume.nanovdb_file)
+    return bpy.path.abspath(filename)
+
 # export smoke information
 def export_smoke(obj, fs):
+    quantization = { 'Float' : 0 , 'Half' : 1 , 'Byte' : 2 }[bpy.context.scene.sort_data.volume_quantization_prop]
+
+    # the renderer loads the sparse tree of NanoVDB files directly, the density doesn't go through a dense grid here
+    nanovdb_file = get_nanovdb_file(obj)
+    if nanovdb_file:
+        fs.serialize( SID('has_vdb_volume') )
+        fs.serialize( nanovdb_file )
+        fs.serialize( quantization )
+        return
+
     smoke_modifier = get_smoke_modifier(obj)
     if not smoke_modifier:
         fs.serialize( SID('no_volume') )
@@ -439,44 +729,41 @@ def export_smoke(obj, fs):
         return
 
     fs.serialize( SID('has_volume') )
-    
+
     # dimension of the volume data
     x, y, z = domain.domain_resolution
     fs.serialize(x)
     fs.serialize(y)
     fs.serialize(z)
 
-    # the color itself, don't export it for now
-    # color_grid = np.fromiter(domain.color_grid, dtype=np.float32)
-    # fs.serialize(color_grid)
-
-    FLTFMT = struct.Struct('=f')
-
-    # the density itself
-    density_data = bytearray()
-    density_grid = np.fromiter(domain.density_grid, dtype=np.float32)
-    for density in density_grid:
-        density_data += FLTFMT.pack(density)
-
-    fs.serialize(density_data)
+    # the density is streamed in bricks of 8x8x8 texels, empty bricks are skipped, it needs to match the layout in
+    # src/texture/sparsetexture3d.h
+    BRICK_SIZE = 8
+    fs.serialize(quantization)
+
+    density_grid = np.fromiter(domain.density_grid, dtype=np.float32, count=x*y*z).reshape((z, y, x))
+    bx, by, bz = ( x + BRICK_SIZE - 1 ) // BRICK_SIZE, ( y + BRICK_SIZE - 1 ) // BRICK_SIZE, ( z + BRICK_SIZE - 1 ) // BRICK_SIZE
+    padded = np.zeros((bz * BRICK_SIZE, by * BRICK_SIZE, bx * BRICK_SIZE), dtype=np.float32)
+    padded[:z, :y, :x] = density_grid
+    bricks = padded.reshape((bz, BRICK_SIZE, by, BRICK_SIZE, bx, BRICK_SIZE)).transpose((0, 2, 4, 1, 3, 5))
+    brick_min = bricks.min(axis=(3, 4, 5))
+    brick_max = bricks.max(axis=(3, 4, 5))
+
+    # the texels of a brick are only needed if they are not the same
+    BRICKFMT = struct.Struct('=IIIff')
+    non_empty = np.argwhere( np.logical_or( brick_min != 0.0 , brick_max != 0.0 ) )
+    fs.serialize(len(non_empty))
+    brick_data = bytearray()
+    for k, j, i in non_empty:
+        brick_data += BRICKFMT.pack(int(i), int(j), int(k), float(brick_min[k, j, i]), float(brick_max[k, j, i]))
+        if brick_min[k, j, i] < brick_max[k, j, i]:
+            brick_data += np.ascontiguousarray(bricks[k, j, i]).tobytes()
+    fs.serialize(brick_data)
 
 # export a mesh
-def export_mesh(obj, mesh, fs):
+# the class name of the visual is skipped when the mesh is the data of an instanced visual
+def export_mesh(obj, mesh, fs, with_visual_name = True):
     LENFMT = struct.Struct('=i')
-    FLTFMT = struct.Struct('=f')
-    VERTFMT = struct.Struct('=ffffffff')
-    LINEFMT = struct.Struct('=iiffi')
-    POINTFMT = struct.Struct('=fff')
-    TRIFMT = struct.Struct('=iiii')
-
-    materials = mesh.materials[:]
-    material_names = [m.name if m else None for m in materials]
-
-    vert_cnt = 0
-    primitive_cnt = 0
-    verts = mesh.vertices
-    wo3_verts = bytearray()
-    wo3_tris = bytearray()
 
     global matname_to_id
 
@@ -500,73 +787,161 @@ def export_mesh(obj, mesh, fs):
     #if has_uv:
     #    mesh.calc_tangents( uvmap = uv_layer_name )
 
-    vert_cnt = 0
-    remapping = {}
+    # Everything is fetched with foreach_get into numpy arrays, looping through millions of loops in Python takes
+    # minutes. Every loop ends up being a vertex of its own, since its uv coordinate and normal may differ from
+    # the other loops sharing the same position.
+    vert_total = len(mesh.vertices)
+    loop_total = len(mesh.loops)
+    poly_total = len(mesh.polygons)
+
+    positions = np.empty(vert_total * 3, dtype=np.float32)
+    mesh.vertices.foreach_get('co', positions)
+    positions = positions.reshape((vert_total, 3))
+    vert_normals = np.empty(vert_total * 3, dtype=np.float32)
+    mesh.vertices.foreach_get('normal', vert_normals)
+    vert_normals = vert_normals.reshape((vert_total, 3))
+
+    loop_vids = np.empty(loop_total, dtype=np.int32)
+    mesh.loops.foreach_get('vertex_index', loop_vids)
+
+    loop_starts = np.empty(poly_total, dtype=np.int32)
+    mesh.polygons.foreach_get('loop_start', loop_starts)
+    loop_cnts = np.empty(poly_total, dtype=np.int32)
+    mesh.polygons.foreach_get('loop_total', loop_cnts)
+    smooth = np.empty(poly_total, dtype=bool)
+    mesh.polygons.foreach_get('use_smooth', smooth)
+    poly_normals = np.empty(poly_total * 3, dtype=np.float32)
+    mesh.polygons.foreach_get('normal', poly_normals)
+    poly_normals = poly_normals.reshape((poly_total, 3))
+    mat_indices = np.empty(poly_total, dtype=np.int32)
+    mesh.polygons.foreach_get('material_index', mat_indices)
+
+    # vertices are packed polygon by polygon, the first vertex of a polygon is at its offset
+    poly_offsets = np.cumsum(loop_cnts, dtype=np.int64) - loop_cnts
+    vert_cnt = int(loop_cnts.sum())
+    loops = np.repeat(loop_starts - poly_offsets, loop_cnts) + np.arange(vert_cnt, dtype=np.int64)
+    vids = loop_vids[loops]
+
+    # use smooth normal if necessary
+    loop_smooth = np.repeat(smooth, loop_cnts)
+    normals = np.where(loop_smooth[:, None], vert_normals[vids], np.repeat(poly_normals, loop_cnts, axis=0))
 
-    mesh_sid = SID( mesh.name )
+    if has_uv:
+        uvs = np.empty(loop_total * 2, dtype=np.float32)
+        uv_layer.foreach_get('uv', uvs)
+        uvs = uvs.reshape((loop_total, 2))[loops]
+    else:
+        uvs = np.zeros((vert_cnt, 2), dtype=np.float32)
+
+    # triangles go first and quads are split in two, no other primitive supported in mesh
+    tri_cnts = np.where(loop_cnts == 3, 1, np.where(loop_cnts == 4, 2, 0))
+    if np.any(tri_cnts == 0):
+        log("Warning, there is unsupported geometry. The exported scene may be incomplete.")
+    primitive_cnt = int(tri_cnts.sum())
+    tri_polys = np.repeat(np.arange(poly_total), tri_cnts)
+    second = np.arange(primitive_cnt) - np.repeat(np.cumsum(tri_cnts) - tri_cnts, tri_cnts)
+    base = poly_offsets[tri_polys]
+    tris = np.stack((base, base + 1 + second, base + 2 + second), axis=1)
+
+    # material slots are mapped to ids once, instead of once per polygon
+    material_names = [m.name if m else None for m in mesh.materials[:]]
+    mat_table = np.array([matname_to_id.get(name_compat(name), -1) for name in material_names] + [-1], dtype=np.int32)
+    mat_indices = np.where((mat_indices >= 0) & (mat_indices < len(material_names)), mat_indices, len(material_names))
+    mats = mat_table[mat_indices[tri_polys]]
+
+    wo3_positions = np.ascontiguousarray(positions[vids], dtype=np.float32).tobytes()
+    wo3_normals = np.ascontiguousarray(normals, dtype=np.float32).tobytes()
+    wo3_uvs = np.ascontiguousarray(uvs, dtype=np.float32).tobytes()
+    wo3_tris = np.ascontiguousarray(tris, dtype=np.int32).tobytes()
+    wo3_mats = np.ascontiguousarray(mats, dtype=np.int32).tobytes()
+
+    if with_visual_name:
+        fs.serialize(SID('MeshVisual'))
+    fs.serialize(bool(has_uv))
+    fs.serialize(LENFMT.pack(vert_cnt))
+    fs.serialize(wo3_positions)
+    fs.serialize(wo3_normals)
+    fs.serialize(wo3_uvs)
+    fs.serialize(LENFMT.pack(primitive_cnt))
+    fs.serialize(wo3_tris)
+    fs.serialize(wo3_mats)
 
-    for poly in mesh.polygons:
-        smooth = poly.use_smooth
-        normal = poly.normal[:]
+    # export smoke data if needed, this is for volumetric rendering
+    export_smoke(obj, fs)
 
-        oi = []
-        for loop_index in range(poly.loop_start, poly.loop_start + poly.loop_total):
-            # vertex index
-            vid = mesh.loops[loop_index].vertex_index
-            # vertex information
-            vert = verts[vid]
+    fs.serialize(SID('end of mesh'))
 
-            # uv coordinate
-            uvcoord = uv_layer[loop_index].uv[:] if has_uv else ( 0.0 , 0.0 )
+    return (vert_cnt, primitive_cnt)
 
-            # use smooth normal if necessary
-            if smooth:
-                normal = vert.normal[:]
+# objects with only a Catmull-Clark subdivision modifier, optionally followed by a displacement of an image along the
+# normal, are subdivided by the renderer on demand, it returns the two modifiers or None if the object doesn't qualify.
+def native_subdivision(scene, obj):
+    if not scene.sort_data.native_subdivision_prop:
+        return None
+    modifiers = [ modifier for modifier in obj.modifiers if modifier.show_render ]
+    if len(modifiers) == 0 or len(modifiers) > 2:
+        return None
+    subsurf = modifiers[0]
+    if subsurf.type != 'SUBSURF' or subsurf.subdivision_type != 'CATMULL_CLARK' or subsurf.render_levels < 1:
+        return None
+    if len(modifiers) == 1:
+        return (subsurf, None)
+    displace = modifiers[1]
+    if displace.type != 'DISPLACE' or displace.direction != 'NORMAL' or displace.texture_coords != 'UV':
+        return None
+    if displace.texture is None or displace.texture.type != 'IMAGE' or displace.texture.image is None:
+        return None
+    return (subsurf, displace)
 
-            #tangent = mesh.loops[loop_index].tangent
+# export the control mesh of a subdivision surface, faces are exported as they are without being triangulated
+def export_subdivision(obj, mesh, subsurf, displace, fs):
+    LENFMT = struct.Struct('=i')
+    POINTFMT = struct.Struct('=fff')
+    UVFMT = struct.Struct('=ff')
 
-            # an unique key to identify the vertex
-            key = (vid, loop_index, smooth)
+    materials = mesh.materials[:]
+    material_names = [m.name if m else None for m in materials]
 
-            # acquire the key if possible, otherwise pack one
-            out_idx = remapping.get(key)
-            if out_idx is None:
-                out_idx = vert_cnt
-                remapping[key] = out_idx
-                wo3_verts += VERTFMT.pack(vert.co[0], vert.co[1], vert.co[2], normal[0], normal[1], normal[2], uvcoord[0], uvcoord[1])
-                vert_cnt += 1
-            oi.append(out_idx)
+    global matname_to_id
 
-        matid = -1
-        matname = name_compat(material_names[poly.material_index]) if len( material_names ) > 0 else None
-        matid = matname_to_id[matname] if matname in matname_to_id else -1
-        if len(oi) == 3:
-            # triangle
-            wo3_tris += TRIFMT.pack(oi[0], oi[1], oi[2], matid)
-            primitive_cnt += 1
-        elif len(oi) == 4:
-            # quad
-            wo3_tris += TRIFMT.pack(oi[0], oi[1], oi[2], matid)
-            wo3_tris += TRIFMT.pack(oi[0], oi[2], oi[3], matid)
-            primitive_cnt += 2
-        else:
-            # no other primitive supported in mesh
-            # assert( False )
-            log("Warning, there is unsupported geometry. The exported scene may be incomplete.")
+    uv_layer = mesh.uv_layers.active.data if mesh.uv_layers and mesh.uv_layers.active else None
 
-    fs.serialize(SID('MeshVisual'))
-    fs.serialize(bool(has_uv))
-    fs.serialize(LENFMT.pack(vert_cnt))
-    fs.serialize(wo3_verts)
-    fs.serialize(LENFMT.pack(primitive_cnt))
-    fs.serialize(wo3_tris)
+    wo3_positions = bytearray()
+    for vert in mesh.vertices:
+        wo3_positions += POINTFMT.pack(vert.co[0], vert.co[1], vert.co[2])
 
-    # export smoke data if needed, this is for volumetric rendering
-    export_smoke(obj, fs)
+    wo3_sizes = bytearray()
+    wo3_indices = bytearray()
+    wo3_uvs = bytearray()
+    wo3_mats = bytearray()
+    for poly in mesh.polygons:
+        wo3_sizes += LENFMT.pack(poly.loop_total)
+        for loop_index in range(poly.loop_start, poly.loop_start + poly.loop_total):
+            wo3_indices += LENFMT.pack(mesh.loops[loop_index].vertex_index)
+            uvcoord = uv_layer[loop_index].uv[:] if uv_layer else ( 0.0 , 0.0 )
+            wo3_uvs += UVFMT.pack(uvcoord[0], uvcoord[1])
 
+        matname = name_compat(material_names[poly.material_index]) if len( material_names ) > 0 else None
+        matid = matname_to_id[matname] if matname in matname_to_id else -1
+        wo3_mats += LENFMT.pack(matid)
+
+    fs.serialize(SID('SubdivisionVisual'))
+    fs.serialize(LENFMT.pack(subsurf.render_levels))
+    fs.serialize(LENFMT.pack(len(mesh.vertices)))
+    fs.serialize(wo3_positions)
+    fs.serialize(LENFMT.pack(len(mesh.polygons)))
+    fs.serialize(wo3_sizes)
+    fs.serialize(wo3_indices)
+    fs.serialize(wo3_uvs)
+    fs.serialize(wo3_mats)
+    fs.serialize(displace is not None)
+    if displace:
+        fs.serialize(bpy.path.abspath(displace.texture.image.filepath))
+        fs.serialize(displace.strength)
+        fs.serialize(displace.mid_level)
     fs.serialize(SID('end of mesh'))
 
-    return (vert_cnt, primitive_cnt)
+    return (len(mesh.vertices), len(mesh.polygons))
 
 # export hair information
 def export_hair(ps, obj, scene, is_preview, fs):
@@ -589,6 +964,11 @@ def export_hair(ps, obj, scene, is_preview, fs):
     # for some unknown reason
     steps = 2 ** hair_step
 
+    # the renderer interpolates the key points with smooth curves, there is no need to export the whole
+    # subdivided path, key points at the resolution of the hair segments are good enough.
+    key_cnt = min( max( ps.settings.hair_step , 1 ) , steps )
+    key_steps = [ ( k * steps ) // key_cnt for k in range( key_cnt + 1 ) ]
+
     verts = bytearray()
 
     world2Local = obj.matrix_world.inverted()
@@ -601,7 +981,7 @@ def export_hair(ps, obj, scene, is_preview, fs):
     real_hair_cnt = 0
     for pindex in range(hair_cnt):
         hair = []
-        for step in range(0, steps + 1):
+        for step in key_steps:
             co = ps.co_hair(obj, particle_no = pindex, step = step)
 
             if co[0] == 0 and co[1] == 0 and co[2] == 0:
@@ -706,12 +1086,19 @@ def collect_shader_resources(depsgraph, scene, fs):
         fs.serialize( resource[1] ) # external file name
 
 matname_to_id = {}
-def export_materials(depsgraph, fs):
+def export_materials(depsgraph, fs, updated_materials=None):
+    # in server mode, only the updated materials are sent to the renderer with the index of each of them
+    is_update = updated_materials is not None
+
     # if we are in no-material mode, just skip outputting all materials
     if depsgraph.scene.sort_data.allUseDefaultMaterial is True:
-        fs.serialize( SID('End of Material') )
+        if not is_update:
+            fs.serialize( SID('End of Material') )
         return None
 
+    # shader unit templates are loaded by the renderer already when updating materials, they are simply dropped.
+    template_fs = stream.Stream() if is_update else fs
+
     # this is used to keep track of all visited nodes to avoid duplicated nodes exported.
     visited_shader_unit_types = set()
 
@@ -733,6 +1120,15 @@ def export_materials(depsgraph, fs):
         matname_to_id[compact_material_name] = i
         i += 1
 
+        # materials not updated still need to be visited to keep the indices of materials the same as the renderer's
+        material_fs = fs
+        if is_update:
+            if material.name not in updated_materials:
+                material_fs = stream.Stream()
+            else:
+                fs.serialize(SID('Update Material'))
+                fs.serialize(matname_to_id[compact_material_name])
+
         # whether the material has transparent node
         has_transparent_node = False
         # whether there is sss in the material
@@ -824,35 +1220,35 @@ def export_materials(depsgraph, fs):
                 collect_shader_unit(input_node, shader_group_node_visited, visited_types, shader_group_connections, shader_group_node_mapping)
 
                 # start serialization
-                fs.serialize(SID("ShaderGroupTemplate"))
-                fs.serialize(shader_node_type)
+                template_fs.serialize(SID("ShaderGroupTemplate"))
+                template_fs.serialize(shader_node_type)
 
-                fs.serialize(len(shader_group_node_mapping))
+                template_fs.serialize(len(shader_group_node_mapping))
                 for shader_node, shader_type in shader_group_node_mapping.items():
-                    fs.serialize(shader_node.getUniqueName())
-                    fs.serialize(shader_type)
-                    shader_node.serialize_prop(fs)
-                fs.serialize(len(shader_group_connections))
+                    template_fs.serialize(shader_node.getUniqueName())
+                    template_fs.serialize(shader_type)
+                    shader_node.serialize_prop(template_fs)
+                template_fs.serialize(len(shader_group_connections))
                 for connection in shader_group_connections:
-                    fs.serialize( connection[0] )
-                    fs.serialize( connection[1] )
-                    fs.serialize( connection[2] )
-                    fs.serialize( connection[3] )
+                    template_fs.serialize( connection[0] )
+                    template_fs.serialize( connection[1] )
+                    template_fs.serialize( connection[2] )
+                    template_fs.serialize( connection[3] )
                 
                 # indicate the exposed arguments
-                output_node.serialize_exposed_args(fs)
+                output_node.serialize_exposed_args(template_fs)
 
                 # if there is input node, exposed the inputs
                 input_node = sub_tree.nodes.get("Group Inputs")
                 if input_node is not None:
-                    input_node.serialize_exposed_args(fs)
+                    input_node.serialize_exposed_args(template_fs)
                 else:
-                    fs.serialize( "" )
+                    template_fs.serialize( "" )
             else:
-                fs.serialize(SID('ShaderUnitTemplate'))
-                fs.serialize(shader_node_type)
-                fs.serialize(shader_node.generate_osl_source())
-                shader_node.serialize_shader_resource(fs)
+                template_fs.serialize(SID('ShaderUnitTemplate'))
+                template_fs.serialize(shader_node_type)
+                template_fs.serialize(shader_node.generate_osl_source())
+                shader_node.serialize_shader_resource(template_fs)
 
         # this is the shader node connections
         surface_shader_node_connections = []
@@ -871,48 +1267,50 @@ def export_materials(depsgraph, fs):
         collect_shader_unit(output_node, visited_node_instances, visited_shader_unit_types, volume_shader_node_connections, volume_shader_node_type, 1)
 
         # serialize this material, it is a real material
-        fs.serialize(SID('Material'))
-        fs.serialize(compact_material_name)
+        if not is_update:
+            material_fs.serialize(SID('Material'))
+        material_fs.serialize(compact_material_name)
 
         if len(surface_shader_node_type) > 1:
-            fs.serialize(SID('Surface Shader'))
-            fs.serialize(len(surface_shader_node_type))
+            material_fs.serialize(SID('Surface Shader'))
+            material_fs.serialize(len(surface_shader_node_type))
             for shader_node, shader_type in surface_shader_node_type.items():
-                fs.serialize(shader_node.getUniqueName())
-                fs.serialize(shader_type)
-                shader_node.serialize_prop(fs)
-            fs.serialize(len(surface_shader_node_connections))
+                material_fs.serialize(shader_node.getUniqueName())
+                material_fs.serialize(shader_type)
+                shader_node.serialize_prop(material_fs)
+            material_fs.serialize(len(surface_shader_node_connections))
             for connection in surface_shader_node_connections:
-                fs.serialize( connection[0] )
-                fs.serialize( connection[1] )
-                fs.serialize( connection[2] )
-                fs.serialize( connection[3] )
+                material_fs.serialize( connection[0] )
+                material_fs.serialize( connection[1] )
+                material_fs.serialize( connection[2] )
+                material_fs.serialize( connection[3] )
         else:
-            fs.serialize( SID('Invalid Surface Shader') )
+            material_fs.serialize( SID('Invalid Surface Shader') )
 
         if len(volume_shader_node_type) > 1 :
-            fs.serialize(SID('Volume Shader'))
-            fs.serialize(len(volume_shader_node_type))
+            material_fs.serialize(SID('Volume Shader'))
+            material_fs.serialize(len(volume_shader_node_type))
             for shader_node, shader_type in volume_shader_node_type.items():
-                fs.serialize(shader_node.getUniqueName())
-                fs.serialize(shader_type)
-                shader_node.serialize_prop(fs)
-            fs.serialize(len(volume_shader_node_connections))
+                material_fs.serialize(shader_node.getUniqueName())
+                material_fs.serialize(shader_type)
+                shader_node.serialize_prop(material_fs)
+            material_fs.serialize(len(volume_shader_node_connections))
             for connection in volume_shader_node_connections:
-                fs.serialize( connection[0] )
-                fs.serialize( connection[1] )
-                fs.serialize( connection[2] )
-                fs.serialize( connection[3] )
+                material_fs.serialize( connection[0] )
+                material_fs.serialize( connection[1] )
+                material_fs.serialize( connection[2] )
+                material_fs.serialize( connection[3] )
         else:
-            fs.serialize( SID('Invalid Volume Shader') )
+            material_fs.serialize( SID('Invalid Volume Shader') )
 
         # mark whether there is transparent support in the material, this is very important because it will affect performance eventually.
-        fs.serialize( bool(has_transparent_node) )
-        fs.serialize( bool(has_sss_node) )
+        material_fs.serialize( bool(has_transparent_node) )
+        material_fs.serialize( bool(has_sss_node) )
 
         # volume step size and step count
-        fs.serialize( material.sort_material.volume_step )
-        fs.serialize( material.sort_material.volume_step_cnt )
+        material_fs.serialize( material.sort_material.volume_step )
+        material_fs.serialize( material.sort_material.volume_step_cnt )
 
     # indicate the end of material parsing
-    fs.serialize(SID('End of Material'))
\ No newline at end of file
+    if not is_update:
+        fs.serialize(SID('End of Material'))
\ No newline at end of file
@@ -1878,6 +1878,8 @@ class SORTNode_Material_MicrofacetReflection(SORTShadingNode):
         if self.distribution == 'Blinn':
             return self.tsl_shader_blinn
         return self.tsl_shader_beckmann
+    def type_identifier(self):
+        return self.bl_idname + self.distribution
 
 @SORTShaderNodeTree.register_node('Materials')
 class SORTNode_Material_MicrofacetRefraction(SORTShadingNode):
@@ -2951,20 +2953,24 @@ class SORTNodeHomogeneous(SORTShadingNode):
     scattering_coeffcient : bpy.props.FloatProperty( name='Scattering' , default=0.5 , min=0.0, max=float('inf') )
     emission_coefficient  : bpy.props.FloatProperty( name='Emission' , default=0.5 , min=0.0, max=float('inf') )
     anisotropy_coeffcient : bpy.props.FloatProperty( name='Anisotropy' , default=0.0 , min=-1.0, max=1.0 )
+    back_anisotropy_coeffcient : bpy.props.FloatProperty( name='Back Anisotropy' , default=0.0 , min=-1.0, max=1.0 )
+    back_lobe_weight : bpy.props.FloatProperty( name='Back Lobe Weight' , default=0.0 , min=0.0, max=1.0 )
     osl_shader = '''
         shader HomogenenousMedium( color absorption_color, 
                                    float emission_coefficient,
                                    float absorption_coeffcient,
                                    float scattering_coeffcient,
                                    float anisotropy_coeffcient,
+                                   float back_anisotropy_coeffcient,
+                                   float back_lobe_weight,
                                    out closure Result ){
-            Result = make_closure<medium_homogeneous>( absorption_color , emission_coefficient , absorption_coeffcient , scattering_coeffcient , anisotropy_coeffcient );
+            Result = make_closure<medium_homogeneous>( absorption_color , emission_coefficient , absorption_coeffcient , scattering_coeffcient , anisotropy_coeffcient , back_anisotropy_coeffcient , back_lobe_weight );
         }
     '''
     def init(self, context):
         self.outputs.new( 'SORTNodeSocketVolume' , 'Result' )
     def serialize_prop(self, fs):
-        fs.serialize( 5 )
+        fs.serialize( 7 )
         fs.serialize('absorption_color')
         fs.serialize(3)
         fs.serialize(self.absorption_color[:])
@@ -2980,6 +2986,12 @@ class SORTNodeHomogeneous(SORTShadingNode):
         fs.serialize('anisotropy_coeffcient')
         fs.serialize(1)
         fs.serialize(self.anisotropy_coeffcient)
+        fs.serialize('back_anisotropy_coeffcient')
+        fs.serialize(1)
+        fs.serialize(self.back_anisotropy_coeffcient)
+        fs.serialize('back_lobe_weight')
+        fs.serialize(1)
+        fs.serialize(self.back_lobe_weight)
 
     def draw_buttons(self, context, layout):
         layout.prop(self, 'absorption_color')
@@ -2987,6 +2999,8 @@ class SORTNodeHomogeneous(SORTShadingNode):
         layout.prop(self, 'absorption_coeffcient')
         layout.prop(self, 'scattering_coeffcient')
         layout.prop(self, 'anisotropy_coeffcient')
+        layout.prop(self, 'back_anisotropy_coeffcient')
+        layout.prop(self, 'back_lobe_weight')
 
 @SORTShaderNodeTree.register_node('Volume')
 class SORTNodeHeterogeneous(SORTShadingNode):
@@ -2998,8 +3012,10 @@ class SORTNodeHeterogeneous(SORTShadingNode):
                                     float Absorption ,
                                     float Scattering ,
                                     float Anisotropy ,
+                                    float BackAnisotropy ,
+                                    float BackLobeWeight ,
                                     out closure Result ){
-            Result = make_closure<medium_heterogeneous>(Color, Emission, Absorption, Scattering, Anisotropy );
+            Result = make_closure<medium_heterogeneous>(Color, Emission, Absorption, Scattering, Anisotropy, BackAnisotropy, BackLobeWeight );
         }
     '''
     def init(self, context):
@@ -3008,14 +3024,18 @@ class SORTNodeHeterogeneous(SORTShadingNode):
         self.inputs.new( 'SORTNodeSocketLargeFloat' , 'Absorption' )
         self.inputs.new( 'SORTNodeSocketLargeFloat' , 'Scattering' )
         self.inputs.new( 'SORTNodeSocketLargeFloat' , 'Anisotropy' )
+        self.inputs.new( 'SORTNodeSocketLargeFloat' , 'Back Anisotropy' )
+        self.inputs.new( 'SORTNodeSocketFloat' , 'Back Lobe Weight' )
         self.outputs.new( 'SORTNodeSocketVolume' , 'Result' )
     def serialize_prop(self, fs):
-        fs.serialize( 5 )
+        fs.serialize( 7 )
         self.inputs['Color'].serialize(fs)
         self.inputs['Emission'].serialize(fs)
         self.inputs['Absorption'].serialize(fs)
         self.inputs['Scattering'].serialize(fs)
         self.inputs['Anisotropy'].serialize(fs)
+        self.inputs['Back Anisotropy'].serialize(fs)
+        self.inputs['Back Lobe Weight'].serialize(fs)
 
 #------------------------------------------------------------------------------------#
 #                                 Volume Input Node                                  #
@@ -14,6 +14,7 @@
 #    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
 
 import bpy
+import bgl
 import os
 import subprocess
 import math
@@ -25,15 +26,62 @@ import threading
 import time
 from . import base
 from . import exporter
+from .log import log
+from .stream import stream
+
+# Shared memory protocol between SORT and the plugin, it needs to match the one in src/imagesensor/blenderimage.h.
+#   header : magic, version, tile size, tile count x, tile count y, ring capacity, sequence, progress, final buffer,
+#            rays per second, remaining seconds, utilization, tile pass count, peak memory
+#   ring   : dirty tile records of ( sequence , tile id , reserved )
+#   images : two image buffers of the same tile-major layout
+SORT_PROTOCOL_MAGIC = 0x54524F53
+SORT_PROTOCOL_VERSION = 2
+SORT_PROTOCOL_HEADER_FORMAT = '<IIIIIIQfIfffIQ'
+SORT_PROTOCOL_HEADER_SIZE = 64
+SORT_PROTOCOL_RECORD_FORMAT = '<QII'
+SORT_PROTOCOL_RECORD_SIZE = 16
+
+# Seconds between two checks of new tiles while the viewport is rendered.
+SORT_VIEWPORT_POLL_INTERVAL = 0.05
+
+# Read the dirty tile ring in the shared memory, it remembers the last record read.
+class SORT_DirtyTiles():
+    def __init__(self, engine):
+        self.render_engine = engine
+        self.read_sequence = 0
+
+    # indices of the tiles updated since the last call
+    def pick(self):
+        header = self.render_engine.readheader()
+        if header is None:
+            return []
+
+        sequence = header[6]
+        capacity = self.render_engine.image_ring_capacity
+        if sequence - self.read_sequence > capacity:
+            # the records are overwritten before being read, refresh all tiles
+            self.read_sequence = sequence
+            return range( self.render_engine.image_tile_count )
+
+        active_tiles = set()
+        for seq in range( self.read_sequence , sequence ):
+            offset = SORT_PROTOCOL_HEADER_SIZE + ( seq % capacity ) * SORT_PROTOCOL_RECORD_SIZE
+            record = struct.unpack_from( SORT_PROTOCOL_RECORD_FORMAT , self.render_engine.sharedmemory , offset )
+            if record[0] != seq:
+                # the record is overwritten while reading, refresh all tiles
+                self.read_sequence = sequence
+                return range( self.render_engine.image_tile_count )
+            active_tiles.add( record[1] )
+        self.read_sequence = sequence
+        return active_tiles
 
 class SORT_Thread():
     render_engine = None
-    shared_memory = None
-    float_shared_memory = None
 
     def __init__(self, engine):
         self.isTerminated = False
         self.render_engine = engine
+        self.dirty_tiles = SORT_DirtyTiles(engine)
         self.thread = threading.Thread(name="Rendering Thread", target=self.update)
 
     def start(self):
@@ -48,72 +96,70 @@ class SORT_Thread():
     def isAlive(self):
         return self.thread.isAlive()
 
-    def setsharedmemory(self,sm):
-        # setup shared memory
-        self.shared_memory = sm
-
-        # pack image content as float
-        self.float_shared_memory = struct.pack('%sf'%(self.render_engine.image_size_in_bytes), *sm[self.render_engine.image_header_size:self.render_engine.image_size_in_bytes + self.render_engine.image_header_size] )
-
     def update(self, final_update=False):
-        # total pixel count
-        mod = self.render_engine.image_tile_size - ( self.render_engine.image_size_h % self.render_engine.image_tile_size )
-        if mod is self.render_engine.image_tile_size:
-            mod = 0
-
         while self.isTerminated is False:
             # pick active tiles to update
-            active_tiles , all_done = self.picknewtiles()
-
+            active_tiles = self.dirty_tiles.pick()
             for i in active_tiles:
-                tile_x = i % self.render_engine.image_tile_count_x
-                tile_y = int(i / self.render_engine.image_tile_count_x)
-
-                tile_x_offset = tile_x * self.render_engine.image_tile_size
-                tile_y_offset = tile_y * self.render_engine.image_tile_size
-
-                tile_size_x = min( self.render_engine.image_tile_size , self.render_engine.image_size_w - tile_x_offset )
-                tile_size_y = self.render_engine.image_tile_size
-
-                # y offset
-                offset_y = max( mod - tile_y_offset , 0 )
-
-                # load shared memory
-                self.shared_memory.seek( self.render_engine.image_header_size + i * self.render_engine.image_tile_size_in_bytes + offset_y * tile_size_x * 16)
-                byptes = self.shared_memory.read(self.render_engine.image_tile_size_in_bytes - offset_y * tile_size_x * 16)
-
-                # convert binary to two dimensional array
-                tile_data = numpy.fromstring(byptes, dtype=numpy.float32)
-                tile_rect = tile_data.reshape( ( ( self.render_engine.image_tile_pixel_count - offset_y * tile_size_x ) , 4 ) )
-
-                # begin result
-                result = self.render_engine.begin_result(tile_x_offset, max(tile_y_offset - mod,0), tile_size_x, tile_size_y - offset_y)
-
-                # update image memmory
-                result.layers[0].passes[0].rect = tile_rect
-
-                # refresh the update
-                self.render_engine.end_result(result)
-
-                # update header info to make sure it is not processed again
-                self.shared_memory[i] = self.shared_memory[i] + 1
-
-            if all_done is True:
-                break
-
-        # close the shared memory if it is the last update
-        #if final_update:
-        #    self.shared_memory.close()
-
-    def picknewtiles(self):
-        active_tiles = []
-        all_done = True
-        for i in range( self.render_engine.image_header_size ):
-            if self.shared_memory[i] is 1:
-                active_tiles.append(i)
-            elif self.shared_memory[i] is 0:
-                all_done = False
-        return ( active_tiles , all_done )
+                self.render_engine.updatetile(i, 0)
+
+            # don't spin on the shared memory
+            if len(active_tiles) == 0:
+                time.sleep(0.01)
+
+# Texture of the image rendered in the viewport, only dirty tiles are uploaded to it.
+class SORT_ViewportImage():
+    def __init__(self, width, height):
+        self.width = width
+        self.height = height
+        self.texture = bgl.Buffer(bgl.GL_INT, 1)
+        bgl.glGenTextures(1, self.texture)
+        bgl.glActiveTexture(bgl.GL_TEXTURE0)
+        bgl.glBindTexture(bgl.GL_TEXTURE_2D, self.texture[0])
+        bgl.glTexImage2D(bgl.GL_TEXTURE_2D, 0, bgl.GL_RGBA16F, width, height, 0, bgl.GL_RGBA, bgl.GL_FLOAT, bgl.Buffer(bgl.GL_FLOAT, width * height * 4))
+        bgl.glTexParameteri(bgl.GL_TEXTURE_2D, bgl.GL_TEXTURE_MIN_FILTER, bgl.GL_LINEAR)
+        bgl.glTexParameteri(bgl.GL_TEXTURE_2D, bgl.GL_TEXTURE_MAG_FILTER, bgl.GL_LINEAR)
+        bgl.glBindTexture(bgl.GL_TEXTURE_2D, 0)
+
+    def __del__(self):
+        bgl.glDeleteTextures(1, self.texture)
+
+    # upload the pixels of a tile, rows are bottom-up like the texture
+    def upload(self, x, y, pixels):
+        h, w = pixels.shape[0], pixels.shape[1]
+        bgl.glBindTexture(bgl.GL_TEXTURE_2D, self.texture[0])
+        bgl.glTexSubImage2D(bgl.GL_TEXTURE_2D, 0, x, y, w, h, bgl.GL_RGBA, bgl.GL_FLOAT, bgl.Buffer(bgl.GL_FLOAT, w * h * 4, pixels.ravel().tolist()))
+        bgl.glBindTexture(bgl.GL_TEXTURE_2D, 0)
+
+    # draw the texture over the region with the display space shader bound by the engine
+    def draw(self, region_width, region_height):
+        shader_program = bgl.Buffer(bgl.GL_INT, 1)
+        bgl.glGetIntegerv(bgl.GL_CURRENT_PROGRAM, shader_program)
+
+        vertex_array = bgl.Buffer(bgl.GL_INT, 1)
+        bgl.glGenVertexArrays(1, vertex_array)
+        bgl.glBindVertexArray(vertex_array[0])
+
+        position = [0, 0, region_width, 0, region_width, region_height, 0, region_height]
+        texcoord = [0, 0, 1, 0, 1, 1, 0, 1]
+        vertex_buffer = bgl.Buffer(bgl.GL_INT, 2)
+        bgl.glGenBuffers(2, vertex_buffer)
+        for i, (name, data) in enumerate((("pos", position), ("texCoord", texcoord))):
+            location = bgl.glGetAttribLocation(shader_program[0], name)
+            bgl.glBindBuffer(bgl.GL_ARRAY_BUFFER, vertex_buffer[i])
+            bgl.glBufferData(bgl.GL_ARRAY_BUFFER, 32, bgl.Buffer(bgl.GL_FLOAT, len(data), data), bgl.GL_STATIC_DRAW)
+            bgl.glVertexAttribPointer(location, 2, bgl.GL_FLOAT, bgl.GL_FALSE, 0, None)
+            bgl.glEnableVertexAttribArray(location)
+
+        bgl.glActiveTexture(bgl.GL_TEXTURE0)
+        bgl.glBindTexture(bgl.GL_TEXTURE_2D, self.texture[0])
+        bgl.glDrawArrays(bgl.GL_TRIANGLE_FAN, 0, 4)
+        bgl.glBindTexture(bgl.GL_TEXTURE_2D, 0)
+
+        bgl.glBindBuffer(bgl.GL_ARRAY_BUFFER, 0)
+        bgl.glBindVertexArray(0)
+        bgl.glDeleteBuffers(2, vertex_buffer)
+        bgl.glDeleteVertexArrays(1, vertex_array)
 
 @base.register_class
 class SORTRenderEngine(bpy.types.RenderEngine):
@@ -131,10 +177,15 @@ class SORTRenderEngine(bpy.types.RenderEngine):
 
     # spawn new rendering thread
     def spawnnewthread(self):
+        self.createsharedmemory()
+        self.sort_thread.start()
+
+    # allocate the shared memory SORT writes the image to
+    def createsharedmemory(self):
         import mmap
 
         # setup shared memory size
-        self.sm_size = self.image_size_in_bytes * 2 + self.image_header_size + 2
+        self.sm_size = SORT_PROTOCOL_HEADER_SIZE + self.image_ring_capacity * SORT_PROTOCOL_RECORD_SIZE + self.image_size_in_bytes * 2
 
         intermediate_dir = exporter.get_intermediate_dir()
         sm_full_path = intermediate_dir + "sharedmem.bin"
@@ -153,8 +204,15 @@ class SORTRenderEngine(bpy.types.RenderEngine):
         elif platform.system() == "Windows":
             self.sharedmemory = mmap.mmap(0, self.sm_size , sm_full_path)
 
-        self.sort_thread.setsharedmemory(self.sharedmemory)
-        self.sort_thread.start()
+        # both image buffers are viewed in place, tiles are never copied out of the shared memory before Blender gets them
+        self.image_buffers = numpy.frombuffer(self.sharedmemory, dtype=numpy.float32, count=self.image_size_in_bytes // 2, offset=self.image_buffer_offset)
+        self.image_buffers = self.image_buffers.reshape( ( 2 , self.image_tile_count , self.image_tile_pixel_count * 4 ) )
+
+    # close the shared memory, views of it need to be released first
+    def closesharedmemory(self):
+        self.image_buffers = None
+        self.sharedmemory.close()
+        self.sharedmemory = None
 
     def __init__(self):
         self.sort_available = True
@@ -162,6 +220,11 @@ class SORTRenderEngine(bpy.types.RenderEngine):
         self.render_pass = None
         self.sort_thread = SORT_Thread(self)
         self.sharedmemory = None
+        self.image_buffers = None
+        self.viewport_process = None
+        self.viewport_image = None
+        self.viewport_tiles = None
+        self.viewport_final = False
 
         self.image_tile_size = 64
         self.image_size_w = int(bpy.data.scenes[0].render.resolution_x * bpy.data.scenes[0].render.resolution_percentage / 100)
@@ -169,10 +232,141 @@ class SORTRenderEngine(bpy.types.RenderEngine):
         self.image_pixel_count = self.image_size_w * self.image_size_h
         self.image_tile_count_x = math.ceil( self.image_size_w / self.image_tile_size )
         self.image_tile_count_y = math.ceil( self.image_size_h / self.image_tile_size )
-        self.image_header_size = self.image_tile_count_x * self.image_tile_count_y
+        self.image_tile_count = self.image_tile_count_x * self.image_tile_count_y
+        self.image_ring_capacity = max( 256 , 2 * self.image_tile_count )
         self.image_tile_pixel_count = self.image_tile_size * self.image_tile_size
         self.image_tile_size_in_bytes = self.image_tile_pixel_count * 16
-        self.image_size_in_bytes = self.image_tile_count_x * self.image_tile_count_y * self.image_tile_size_in_bytes
+        self.image_size_in_bytes = self.image_tile_count * self.image_tile_size_in_bytes
+        self.image_buffer_offset = SORT_PROTOCOL_HEADER_SIZE + self.image_ring_capacity * SORT_PROTOCOL_RECORD_SIZE
+        # the bottom row of tiles is not full if the height is not a multiple of the tile size, the rest is padded
+        self.image_tile_padding = ( self.image_tile_size - self.image_size_h % self.image_tile_size ) % self.image_tile_size
+
+    def __del__(self):
+        self.stopviewport()
+
+    # read the header of the shared memory, None if SORT hasn't initialized it yet
+    def readheader(self):
+        header = struct.unpack_from( SORT_PROTOCOL_HEADER_FORMAT , self.sharedmemory , 0 )
+        if header[0] != SORT_PROTOCOL_MAGIC or header[1] != SORT_PROTOCOL_VERSION:
+            return None
+        return header
+
+    # read the progress of rendering
+    def readprogress(self):
+        header = self.readheader()
+        return header[7] if header is not None else 0.0
+
+    # read the live telemetry as a line of text, None if SORT hasn't initialized the shared memory yet
+    def readtelemetry(self):
+        header = self.readheader()
+        if header is None:
+            return None
+        eta = 'Remaining %ds' % int(header[10]) if header[10] >= 0.0 else 'Remaining -'
+        return 'Mrays/s %.2f | %s | Utilization %d%% | Tile passes %d | Peak memory %.1f MB' % ( header[9] / 1e6 , eta , int(header[11] * 100.0) , header[12] , header[13] / ( 1024.0 * 1024.0 ) )
+
+    # view the pixels of a tile in one of the image buffers, it returns the bottom-left corner of the tile and its
+    # pixels in rows from the bottom, nothing is copied.
+    def readtile(self, i, buffer):
+        tile_x = i % self.image_tile_count_x
+        tile_y = i // self.image_tile_count_x
+
+        x = tile_x * self.image_tile_size
+        w = min( self.image_tile_size , self.image_size_w - x )
+        pixels = self.image_buffers[buffer, i, :self.image_tile_size * w * 4].reshape( ( self.image_tile_size , w , 4 ) )
+
+        # padded rows of the bottom row of tiles come first
+        y = tile_y * self.image_tile_size - self.image_tile_padding
+        if y < 0:
+            pixels = pixels[-y:]
+            y = 0
+        return x, y, pixels
+
+    # update a tile in the image from one of the image buffers
+    def updatetile(self, i, buffer):
+        x, y, pixels = self.readtile(i, buffer)
+        result = self.begin_result(x, y, pixels.shape[1], pixels.shape[0])
+
+        # the pixels go through the buffer protocol in one go if the array supports it, the views are contiguous
+        rect = result.layers[0].passes[0].rect
+        if hasattr(rect, 'foreach_set'):
+            rect.foreach_set(pixels.ravel())
+        else:
+            result.layers[0].passes[0].rect = pixels.reshape( ( -1 , 4 ) )
+
+        self.end_result(result)
+
+    # render the scene in the viewport, it is rendered again from scratch whenever something changes
+    def view_update(self, context, depsgraph):
+        sort_bin_path = exporter.get_sort_bin_path()
+        if sort_bin_path is None or not os.path.exists(sort_bin_path):
+            return
+
+        self.stopviewport()
+
+        # the shared memory is taken by a final render in progress, the viewport is left alone until the next update
+        if not SORTRenderEngine.render_lock.acquire(blocking=False):
+            return
+        try:
+            exporter.create_path(depsgraph.scene, False)
+            self.createsharedmemory()
+            self.cmd_argument = [sort_bin_path, '--input:-', '--blendermode', '--preview']
+            self.viewport_process = self.launch(depsgraph, False)
+        finally:
+            SORTRenderEngine.render_lock.release()
+        self.viewport_tiles = SORT_DirtyTiles(self)
+        self.viewport_final = False
+
+        # tiles are checked on the main thread, the viewport is only redrawn once there is something new
+        engine = self
+        def poll():
+            try:
+                if engine.viewport_process is None:
+                    return None
+                header = engine.readheader()
+                if header is not None and ( header[6] != engine.viewport_tiles.read_sequence or ( header[8] > 0 and not engine.viewport_final ) ):
+                    engine.tag_redraw()
+                return SORT_VIEWPORT_POLL_INTERVAL
+            except ReferenceError:
+                # the engine is freed by Blender
+                return None
+        bpy.app.timers.register(poll, first_interval=SORT_VIEWPORT_POLL_INTERVAL)
+
+    # draw the image rendered in the viewport, only tiles updated since the last draw are uploaded to the texture
+    def view_draw(self, context, depsgraph):
+        if self.sharedmemory is None:
+            return
+
+        if self.viewport_image is None:
+            self.viewport_image = SORT_ViewportImage(self.image_size_w, self.image_size_h)
+
+        header = self.readheader()
+        if header is not None:
+            if header[8] > 0 and not self.viewport_final:
+                # the final image could be in the back buffer
+                for i in range( self.image_tile_count ):
+                    self.viewport_image.upload( *self.readtile(i, header[8] - 1) )
+                self.viewport_final = True
+            elif not self.viewport_final:
+                for i in self.viewport_tiles.pick():
+                    self.viewport_image.upload( *self.readtile(i, 0) )
+
+        bgl.glEnable(bgl.GL_BLEND)
+        bgl.glBlendFunc(bgl.GL_ONE, bgl.GL_ONE_MINUS_SRC_ALPHA)
+        self.bind_display_space_shader(depsgraph.scene)
+        self.viewport_image.draw(context.region.width, context.region.height)
+        self.unbind_display_space_shader()
+        bgl.glDisable(bgl.GL_BLEND)
+
+    # stop rendering in the viewport, the texture goes with it
+    def stopviewport(self):
+        if self.viewport_process is None:
+            return
+        if subprocess.Popen.poll(self.viewport_process) is None:
+            subprocess.Popen.terminate(self.viewport_process)
+            self.viewport_process.wait()
+        self.viewport_process = None
+        self.closesharedmemory()
+        self.viewport_image = None
 
     # update frame
     def update(self, data, depsgraph):
@@ -191,8 +385,8 @@ class SORTRenderEngine(bpy.types.RenderEngine):
         if not self.sort_available:
             return
 
-        # export the scene
-        exporter.export_blender(depsgraph)
+        # the scene is streamed to SORT once it is launched, only the intermediate path is needed before rendering
+        exporter.create_path(depsgraph.scene, False)
 
     # render
     def render(self, depsgraph):
@@ -202,9 +396,29 @@ class SORTRenderEngine(bpy.types.RenderEngine):
 
         with SORTRenderEngine.render_lock:
             if scene.name == 'preview':
-                self.render_preview(scene)
+                self.render_preview(depsgraph)
             else:
-                self.render_scene(scene)
+                self.render_scene(depsgraph)
+
+    # launch SORT and stream the scene to its standard input, SORT parses the scene while it is being exported
+    def launch(self, depsgraph, is_preview):
+        binary_dir = exporter.get_sort_dir()
+        process = subprocess.Popen(self.cmd_argument,cwd=binary_dir,stdin=subprocess.PIPE)
+
+        fs = stream.PipeStream(process.stdin)
+        try:
+            exporter.export_blender(depsgraph, False, is_preview, fs)
+        except (BrokenPipeError, OSError) as exc:
+            # SORT quit before the whole scene is streamed
+            log("Failed to stream the scene to SORT: %s" % exc)
+        finally:
+            # closing the pipe signals the end of the scene
+            try:
+                del fs
+                process.stdin.close()
+            except (BrokenPipeError, OSError):
+                pass
+        return process
 
     # preview render
     def render_preview(self, depsgraph):
@@ -213,20 +427,20 @@ class SORTRenderEngine(bpy.types.RenderEngine):
         self.spawnnewthread()
 
         # start rendering process first
-        binary_dir = exporter.get_sort_dir()
         binary_path = exporter.get_sort_bin_path()
         intermediate_dir = exporter.get_intermediate_dir()
         # execute binary
         self.cmd_argument = [binary_path];
-        self.cmd_argument.append( intermediate_dir + 'scene.sort')
-        process = subprocess.Popen(self.cmd_argument,cwd=binary_dir)
+        self.cmd_argument.append( '--input:-' )
+        self.cmd_argument.append( '--preview' )
+        process = self.launch(depsgraph, True)
 
         # wait for the process to finish
         while subprocess.Popen.poll(process) is None:
             if self.test_break():
                 break
-            progress = self.sharedmemory[self.image_size_in_bytes * 2 + self.image_header_size]
-            self.update_progress(progress/100)
+            self.update_progress(self.readprogress())
+            time.sleep(0.1)
 
         # terminate the process by force
         if subprocess.Popen.poll(process) is None:
@@ -248,36 +462,59 @@ class SORTRenderEngine(bpy.types.RenderEngine):
             self.end_result(result)
 
             # close shared memory connection
-            self.sharedmemory.close()
+            self.closesharedmemory()
 
         # clear immediate directory
         shutil.rmtree(intermediate_dir)
 
     # scene render
-    def render_scene(self, scene):
+    def render_scene(self, depsgraph):
+        scene = depsgraph.scene
         #spawn new thread
         self.spawnnewthread()
 
         # start rendering process first
-        binary_dir = exporter.get_sort_dir()
         binary_path = exporter.get_sort_bin_path()
         intermediate_dir = exporter.get_intermediate_dir()
         # execute binary
         self.cmd_argument = [binary_path];
-        self.cmd_argument.append( '--input:' + intermediate_dir + 'scene.sort')
+        self.cmd_argument.append( '--input:-' )
         self.cmd_argument.append( '--blendermode' )
         if scene.sort_data.profilingEnabled is True:
             self.cmd_argument.append( '--profiling:on' )
         if scene.sort_data.allUseDefaultMaterial is True:
             self.cmd_argument.append( '--noMaterial' )
-        process = subprocess.Popen(self.cmd_argument,cwd=binary_dir)
+        if scene.sort_data.accelerator_cache is True:
+            self.cmd_argument.append( '--accelcache:' + exporter.get_accelerator_cache_path() )
+        if scene.sort_hdr_sky.sampling_cache is True:
+            self.cmd_argument.append( '--skycache:' + exporter.get_sky_cache_path() )
+        if scene.sort_data.denoise_prop is True:
+            self.cmd_argument.append( '--denoiser' )
+        if scene.sort_data.preview_quality_prop is True:
+            self.cmd_argument.append( '--preview' )
+            self.cmd_argument.append( '--pyramid' )
+        if scene.render.use_border is True:
+            # blender measures the border from the bottom-left corner, sort counts rows from the top
+            w = self.image_size_w
+            h = self.image_size_h
+            x0 = int(scene.render.border_min_x * w)
+            x1 = int(scene.render.border_max_x * w)
+            y0 = int((1.0 - scene.render.border_max_y) * h)
+            y1 = int((1.0 - scene.render.border_min_y) * h)
+            self.cmd_argument.append( '--region:%d,%d,%d,%d' % (x0, y0, x1, y1) )
+        process = self.launch(depsgraph, False)
 
         # wait for the process to finish
         while subprocess.Popen.poll(process) is None:
             if self.test_break():
                 break
-            progress = self.sharedmemory[self.image_size_in_bytes * 2 + self.image_header_size]
-            self.update_progress(progress/100)
+            self.update_progress(self.readprogress())
+            telemetry = self.readtelemetry()
+            if telemetry is not None:
+                self.update_stats('', telemetry)
+
+            # tiles are shown by the rendering thread, polling faster only takes the interpreter away from it
+            time.sleep(0.1)
 
         # terminate the process by force
         if subprocess.Popen.poll(process) is None:
@@ -287,26 +524,14 @@ class SORTRenderEngine(bpy.types.RenderEngine):
         self.sort_thread.stop()
         self.sort_thread.join()
 
-        # if final update is necessary
-        final_update = self.sharedmemory[self.image_size_in_bytes * 2 + self.image_header_size + 1]
-        if final_update:
-            # begin result
-            result = self.begin_result(0, 0, bpy.data.scenes[0].render.resolution_x, bpy.data.scenes[0].render.resolution_y)
-
-            self.sharedmemory.seek( self.image_header_size + self.image_size_in_bytes)
-            byptes = self.sharedmemory.read(self.image_pixel_count * 16)
-
-            tile_data = numpy.fromstring(byptes, dtype=numpy.float32)
-            tile_rect = tile_data.reshape( self.image_pixel_count , 4 )
-
-            # update image memory
-            result.layers[0].passes[0].rect = tile_rect
-
-            # refresh the update
-            self.end_result(result)
+        # if final update is necessary, the final image is in the published buffer
+        header = self.readheader()
+        if header is not None and header[8] > 0:
+            for i in range( self.image_tile_count ):
+                self.updatetile(i, header[8] - 1)
 
         # close shared memory connection
-        self.sharedmemory.close()
+        self.closesharedmemory()
 
         # clear immediate directory
         shutil.rmtree(intermediate_dir)
@@ -14,6 +14,7 @@
 #    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
 
 import bpy
+import io
 import struct
 
 class Stream():
@@ -24,11 +25,20 @@ class Stream():
     def serialize(self,data):
         pass
 
+    # Start a chunk of data, the size of the chunk goes before its data
+    def begin_chunk(self):
+        pass
+
+    # End the most recent chunk of data
+    def end_chunk(self):
+        pass
+
 # File stream will serialize data into a file.
 class FileStream(Stream):
     # Open a file by default
     def __init__(self,filename):
         self.file = open( filename , 'wb' )
+        self.chunks = []
 
     # Make sure we close the file
     def __del__(self):
@@ -38,6 +48,19 @@ class FileStream(Stream):
     def flush(self):
         self.file.flush()
 
+    # The size of the chunk is not known until the chunk ends, a place holder is written first and patched later.
+    # Knowing the size of each entity, the renderer can load entities in parallel.
+    def begin_chunk(self):
+        self.file.write(struct.pack( 'Q' , 0 ))
+        self.chunks.append(self.file.tell())
+
+    def end_chunk(self):
+        start = self.chunks.pop()
+        end = self.file.tell()
+        self.file.seek(start - 8)
+        self.file.write(struct.pack( 'Q' , end - start ))
+        self.file.seek(end)
+
     # Serialize data
     def serialize(self,data):
         def serialize_type(data):
@@ -60,3 +83,29 @@ class FileStream(Stream):
         else:
             serialize_type(data)
         self.file.flush()
+
+class PipeStream(FileStream):
+    # Stream to the standard input of SORT, it parses the scene while the rest of the scene is still being exported
+    def __init__(self,pipe):
+        self.file = pipe
+        self.chunks = []
+
+    # A pipe can't seek back to patch the size of a chunk, chunks are kept in memory until they end.
+    def begin_chunk(self):
+        self.chunks.append(self.file)
+        self.file = io.BytesIO()
+
+    def end_chunk(self):
+        data = self.file.getvalue()
+        self.file = self.chunks.pop()
+        self.file.write(struct.pack( 'Q' , len(data) ))
+        self.file.write(data)
+
+class MemoryStream(PipeStream):
+    # Serialize data into memory, exported data is cached this way so that it can be streamed again later
+    def __init__(self):
+        self.file = io.BytesIO()
+        self.chunks = []
+
+    def getvalue(self):
+        return self.file.getvalue()
@@ -33,7 +33,10 @@ class SORTRenderData(bpy.types.PropertyGroup):
                          ("InstantRadiosity", "Instant Radiosity", "", 4),
                          ("AmbientOcclusion", "Ambient Occlusion", "", 5),
                          ("DirectLight", "Direct Lighting", "", 6),
-                         ("WhittedRT", "Whitted", "", 7) ]
+                         ("WhittedRT", "Whitted", "", 7),
+                         ("VertexConnectionMerging", "Vertex Connection and Merging", "", 8),
+                         ("ReSTIRDI", "ReSTIR Direct Lighting", "", 9),
+                         ("MetropolisLightTransport", "Metropolis Light Transport", "", 10) ]
     integrator_type_prop : bpy.props.EnumProperty(items=integrator_types, name='Accelerator')
 
     # general integrator parameters
@@ -42,6 +45,25 @@ class SORTRenderData(bpy.types.PropertyGroup):
     # maxmum bounces supported in BSSRDF, exceeding the threshold will result in replacing BSSRDF with Lambert
     max_bssrdf_bounces : bpy.props.IntProperty(name='Maximum Bounces in SSS path', default=4, min=1)
 
+    # guide the bsdf sampling with the incident radiance learned during rendering
+    path_guiding : bpy.props.BoolProperty(name='Path Guiding', default=False, description='Learn the incident radiance during rendering to guide the sampling of indirect lighting')
+
+    # path termination and splitting
+    russian_roulette_depth : bpy.props.IntProperty(name='Russian Roulette Depth', default=3, min=0, description='Number of bounces before paths are randomly terminated by the energy they carry')
+    primary_splits : bpy.props.IntProperty(name='Primary Hit Splits', default=1, min=1, max=64, description='Number of branches a path is split into at the first hit, each branch samples its own lighting and bounces')
+    shadow_roulette : bpy.props.FloatProperty(name='Shadow Ray Roulette', default=0.0, min=0.0, max=1.0, description='Shadow rays bringing less than this portion of the radiance gathered by the path so far are randomly skipped, zero traces all of them')
+    coarse_shadow : bpy.props.BoolProperty(name='Coarse Indirect Shadows', default=False, description='In preview quality, shadow rays after the first bounce are tested against a coarse voxelized copy of the scene, which is biased but much faster')
+    path_regularization : bpy.props.FloatProperty(name='Path Regularization', default=0.0, min=0.0, max=10.0, description='Glossy and specular surfaces are blurred after rough bounces, which removes most caustic fireflies at the cost of some bias, zero disables it')
+
+    # direct lighting and whitted parameters
+    light_candidates : bpy.props.IntProperty(name='Light Candidates', default=0, min=0, description='Number of candidate lights resampled at each hit, all lights are evaluated if it is zero')
+
+    # ReSTIR direct lighting parameters
+    restir_candidates : bpy.props.IntProperty(name='Light Candidates', default=8, min=1, description='Number of candidate lights generated at each pixel')
+    restir_spatial_neighbors : bpy.props.IntProperty(name='Spatial Neighbors', default=3, min=0, description='Number of pixels nearby to reuse light samples from')
+    restir_spatial_radius : bpy.props.FloatProperty(name='Spatial Radius', default=16.0, min=1.0, description='Radius in pixels to look for neighbors')
+    restir_temporal_reuse : bpy.props.BoolProperty(name='Temporal Reuse', default=True, description='Reuse light samples of previous passes of the same pixel')
+
     # ao integrator parameters
     ao_max_dist : bpy.props.FloatProperty(name='Maximum Distance', default=3.0, min=0.01)
 
@@ -53,6 +75,16 @@ class SORTRenderData(bpy.types.PropertyGroup):
     # bidirectional path tracing parameters
     bdpt_mis : bpy.props.BoolProperty(name='Multiple Importance Sampling', default=True)
 
+    # vertex connection and merging parameters
+    vcm_radius_factor : bpy.props.FloatProperty(name='Merging Radius', default=0.003, min=0.0, description='Merging radius of the first pass relative to the radius of the scene')
+    vcm_radius_alpha : bpy.props.FloatProperty(name='Radius Reduction', default=0.75, min=0.0, max=1.0, description='How fast the merging radius shrinks with passes')
+
+    # metropolis light transport parameters
+    mlt_bootstrap_samples : bpy.props.IntProperty(name='Bootstrap Samples', default=100000, min=1, description='Number of samples estimating the brightness of the image before rendering')
+    mlt_chains : bpy.props.IntProperty(name='Markov Chains', default=1024, min=1, description='Number of independent Markov chains spread over all threads')
+    mlt_large_step_prob : bpy.props.FloatProperty(name='Large Step Probability', default=0.3, min=0.0, max=1.0, description='Probability of replacing the whole path instead of perturbing it')
+    mlt_sigma : bpy.props.FloatProperty(name='Small Step Size', default=0.01, min=0.0001, max=0.5, description='Standard deviation of small perturbations in the primary sample space')
+
     #------------------------------------------------------------------------------------#
     #                              Spatial Accelerator Settings                          #
     #------------------------------------------------------------------------------------#
@@ -62,20 +94,45 @@ class SORTRenderData(bpy.types.PropertyGroup):
                           ("bvh", "BVH", "Binary Bounding Volume Hierarchy", 2),
                           ("KDTree", "SAH KDTree", "K-dimentional Tree", 3),
                           ("UniGrid", "Uniform Grid", "This is not quite practical in all cases.", 4),
-                          ("OcTree" , "OcTree" , "This is not quite practical in all cases." , 5)]
+                          ("OcTree" , "OcTree" , "This is not quite practical in all cases." , 5),
+                          ("Hbvh", "HBVH", "SIMD(AVX-512) Optimized BVH" , 6 ),
+                          ("Fbvh", "Widest SIMD BVH", "The widest SIMD BVH supported by the CPU rendering the scene, falls back to OBVH or QBVH on older CPUs." , 7 )]
     accelerator_type_prop : bpy.props.EnumProperty(items=accelerator_types, name='Accelerator')
+    accelerator_cache : bpy.props.BoolProperty(name='Cache Accelerator',default=True,description='Reuse the accelerator built in the previous rendering if the geometry and accelerator settings are not changed.')
+    export_cache : bpy.props.BoolProperty(name='Cache Exported Meshes',default=True,description='Reuse meshes exported in the previous rendering if Blender reports no change to their geometry.')
 
     # bvh properties
     bvh_max_node_depth : bpy.props.IntProperty(name='Maximum Recursive Depth', default=28, min=8)
     bvh_max_pri_in_leaf : bpy.props.IntProperty(name='Maximum Primitives in Leaf Node.', default=8, min=8, max=64)
+    bvh_spatial_split_budget : bpy.props.FloatProperty(name='Spatial Split Budget',default=0.0,min=0.0,max=1.0,description='Maximum number of duplicated primitive references in spatial splits, relative to the number of primitives. Spatial splits are disabled if it is zero.')
 
     # qbvh properties
     qbvh_max_node_depth : bpy.props.IntProperty(name='Maximum Recursive Depth', default=28, min=8)
     qbvh_max_pri_in_leaf : bpy.props.IntProperty(name='Maximum Primitives in Leaf Node.', default=16, min=4, max=64)
+    qbvh_compressed_node : bpy.props.BoolProperty(name='Compressed Node',default=False,description='Quantize bounding boxes of nodes to reduce memory footprint.')
+    qbvh_compressed_leaf : bpy.props.BoolProperty(name='Compressed Leaf',default=False,description='Quantize vertices of triangles in leaves to reduce memory footprint.')
+    qbvh_spatial_split_budget : bpy.props.FloatProperty(name='Spatial Split Budget',default=0.0,min=0.0,max=1.0,description='Maximum number of duplicated primitive references in spatial splits, relative to the number of primitives. Spatial splits are disabled if it is zero.')
 
     # obvh properties
     obvh_max_node_depth : bpy.props.IntProperty(name='Maximum Recursive Depth', default=28, min=8)
     obvh_max_pri_in_leaf : bpy.props.IntProperty(name='Maximum Primitives in Leaf Node.', default=16, min=8, max=64)
+    obvh_compressed_node : bpy.props.BoolProperty(name='Compressed Node',default=False,description='Quantize bounding boxes of nodes to reduce memory footprint.')
+    obvh_compressed_leaf : bpy.props.BoolProperty(name='Compressed Leaf',default=False,description='Quantize vertices of triangles in leaves to reduce memory footprint.')
+    obvh_spatial_split_budget : bpy.props.FloatProperty(name='Spatial Split Budget',default=0.0,min=0.0,max=1.0,description='Maximum number of duplicated primitive references in spatial splits, relative to the number of primitives. Spatial splits are disabled if it is zero.')
+
+    # hbvh properties
+    hbvh_max_node_depth : bpy.props.IntProperty(name='Maximum Recursive Depth', default=28, min=8)
+    hbvh_max_pri_in_leaf : bpy.props.IntProperty(name='Maximum Primitives in Leaf Node.', default=16, min=16, max=64)
+    hbvh_compressed_node : bpy.props.BoolProperty(name='Compressed Node',default=False,description='Quantize bounding boxes of nodes to reduce memory footprint.')
+    hbvh_compressed_leaf : bpy.props.BoolProperty(name='Compressed Leaf',default=False,description='Quantize vertices of triangles in leaves to reduce memory footprint.')
+    hbvh_spatial_split_budget : bpy.props.FloatProperty(name='Spatial Split Budget',default=0.0,min=0.0,max=1.0,description='Maximum number of duplicated primitive references in spatial splits, relative to the number of primitives. Spatial splits are disabled if it is zero.')
+
+    # properties of the widest SIMD BVH picked at runtime
+    fbvh_max_node_depth : bpy.props.IntProperty(name='Maximum Recursive Depth', default=28, min=8)
+    fbvh_max_pri_in_leaf : bpy.props.IntProperty(name='Maximum Primitives in Leaf Node.', default=16, min=16, max=64)
+    fbvh_compressed_node : bpy.props.BoolProperty(name='Compressed Node',default=False,description='Quantize bounding boxes of nodes to reduce memory footprint.')
+    fbvh_compressed_leaf : bpy.props.BoolProperty(name='Compressed Leaf',default=False,description='Quantize vertices of triangles in leaves to reduce memory footprint.')
+    fbvh_spatial_split_budget : bpy.props.FloatProperty(name='Spatial Split Budget',default=0.0,min=0.0,max=1.0,description='Maximum number of duplicated primitive references in spatial splits, relative to the number of primitives. Spatial splits are disabled if it is zero.')
 
     # kdtree properties
     kdtree_max_node_depth : bpy.props.IntProperty(name='Maximum Recursive Depth', default=28, min=8)
@@ -94,11 +151,36 @@ class SORTRenderData(bpy.types.PropertyGroup):
     #                                 Sampling Settings                                  #
     #------------------------------------------------------------------------------------#
     sampler_count_prop : bpy.props.IntProperty(name='Count',default=1, min=1)
+    sampler_types = [ ("RandomSampler", "Random", "Independent random numbers", 1),
+                      ("SobolSampler", "Sobol", "Owen scrambled Sobol sequence, lower error at the same sample count", 2) ]
+    sampler_type_prop : bpy.props.EnumProperty(items=sampler_types, name='Sampler', default='SobolSampler')
+    progressive_prop : bpy.props.BoolProperty(name='Progressive',default=False,description='Render the whole image in multiple passes instead of tile by tile.')
+    sample_per_pass_prop : bpy.props.IntProperty(name='Samples per Pass',default=1, min=1)
+    time_budget_prop : bpy.props.FloatProperty(name='Time Budget (s)',default=0, min=0,description='Stop issuing new passes once the budget is exhausted, 0 means no limitation.')
+    adaptive_sampling_prop : bpy.props.BoolProperty(name='Adaptive Sampling',default=False,description='Stop sampling pixels once their noise is below the threshold, sample count above is the maximum.')
+    min_sample_count_prop : bpy.props.IntProperty(name='Minimum Count',default=4, min=1)
+    noise_threshold_prop : bpy.props.FloatProperty(name='Noise Threshold',default=0.01, min=0.0001, max=1.0,description='Relative standard error of a pixel below which it is considered converged.')
+    denoise_prop : bpy.props.BoolProperty(name='Denoise',default=False,description='Denoise the image guided by albedo and normal, passes of progressive rendering are denoised as previews.')
+    preview_quality_prop : bpy.props.BoolProperty(name='Preview Quality',default=False,description='Trade accuracy for speed, indirect illumination on diffuse surfaces comes from a radiance cache after the first bounce. It is biased, only meant for previews.')
+
+    #------------------------------------------------------------------------------------#
+    #                                  Volume Settings                                   #
+    #------------------------------------------------------------------------------------#
+    volume_quantization_types = [ ("Float", "Float", "32 bits floating point, lossless", 0),
+                                  ("Half", "Half", "16 bits floating point", 1),
+                                  ("Byte", "Byte", "8 bits quantized in the range of each brick", 2) ]
+    volume_quantization_prop : bpy.props.EnumProperty(items=volume_quantization_types, name='Volume Storage', default='Float', description='How density of smoke volumes is stored in memory')
+
+    #------------------------------------------------------------------------------------#
+    #                                 Geometry Settings                                  #
+    #------------------------------------------------------------------------------------#
+    native_subdivision_prop : bpy.props.BoolProperty(name='Native Subdivision',default=False,description='Meshes with only a Catmull-Clark subdivision modifier, optionally followed by an image displacement, are subdivided by the renderer on demand.')
 
     #------------------------------------------------------------------------------------#
     #                                 Threading Settings                                 #
     #------------------------------------------------------------------------------------#
     thread_num_prop : bpy.props.IntProperty(name='Thread Num', default=8, min=1, max=32)
+    splat_film_prop : bpy.props.BoolProperty(name='Per-Thread Splat Film',default=True,description='Each thread splats radiance into its own image replica, only used by light tracing and bidirectional path tracing.')
 
     #------------------------------------------------------------------------------------#
     #                                 Debugging Settings                                 #
@@ -148,14 +230,37 @@ class RENDER_PT_IntegratorPanel(SORTRenderPanel,bpy.types.Panel):
         data = context.scene.sort_data
         self.layout.prop(data,"integrator_type_prop")
         integrator_type = data.integrator_type_prop
-        if integrator_type != "WhittedRT" and integrator_type != "DirectLight" and integrator_type != "AmbientOcclusion":
+        if integrator_type != "WhittedRT" and integrator_type != "DirectLight" and integrator_type != "AmbientOcclusion" and integrator_type != "ReSTIRDI":
             self.layout.prop(data,"inte_max_recur_depth")
         if integrator_type == "PathTracing":
             self.layout.prop(data,"max_bssrdf_bounces" )
+            self.layout.prop(data,"path_guiding" )
+            self.layout.prop(data,"russian_roulette_depth" )
+            self.layout.prop(data,"primary_splits" )
+            self.layout.prop(data,"shadow_roulette" )
+            self.layout.prop(data,"coarse_shadow" )
+            self.layout.prop(data,"path_regularization" )
+        if integrator_type == "DirectLight" or integrator_type == "WhittedRT":
+            self.layout.prop(data,"light_candidates")
+        if integrator_type == "ReSTIRDI":
+            self.layout.prop(data,"restir_candidates")
+            self.layout.prop(data,"restir_spatial_neighbors")
+            self.layout.prop(data,"restir_spatial_radius")
+            self.layout.prop(data,"restir_temporal_reuse")
         if integrator_type == "AmbientOcclusion":
             self.layout.prop(data,"ao_max_dist")
         if integrator_type == "BidirPathTracing":
             self.layout.prop(data,"bdpt_mis")
+        if integrator_type == "VertexConnectionMerging":
+            self.layout.prop(data,"bdpt_mis")
+            self.layout.prop(data,"vcm_radius_factor")
+            self.layout.prop(data,"vcm_radius_alpha")
+        if integrator_type == "MetropolisLightTransport":
+            self.layout.prop(data,"bdpt_mis")
+            self.layout.prop(data,"mlt_bootstrap_samples")
+            self.layout.prop(data,"mlt_chains")
+            self.layout.prop(data,"mlt_large_step_prob")
+            self.layout.prop(data,"mlt_sigma")
         if integrator_type == "InstantRadiosity":
             self.layout.prop(data,"ir_light_path_set_num")
             self.layout.prop(data,"ir_light_path_num")
@@ -167,16 +272,37 @@ class RENDER_PT_AcceleratorPanel(SORTRenderPanel,bpy.types.Panel):
     def draw(self, context):
         data = context.scene.sort_data
         self.layout.prop(data,"accelerator_type_prop")
+        self.layout.prop(data,"accelerator_cache")
+        self.layout.prop(data,"export_cache")
         accelerator_type = data.accelerator_type_prop
         if accelerator_type == "bvh":
             self.layout.prop(data,"bvh_max_node_depth")
             self.layout.prop(data,"bvh_max_pri_in_leaf")
+            self.layout.prop(data,"bvh_spatial_split_budget")
         elif accelerator_type == "Qbvh":
             self.layout.prop(data,"qbvh_max_node_depth")
             self.layout.prop(data,"qbvh_max_pri_in_leaf")
+            self.layout.prop(data,"qbvh_compressed_node")
+            self.layout.prop(data,"qbvh_compressed_leaf")
+            self.layout.prop(data,"qbvh_spatial_split_budget")
         elif accelerator_type == "Obvh":
             self.layout.prop(data,"obvh_max_node_depth")
             self.layout.prop(data,"obvh_max_pri_in_leaf")
+            self.layout.prop(data,"obvh_compressed_node")
+            self.layout.prop(data,"obvh_compressed_leaf")
+            self.layout.prop(data,"obvh_spatial_split_budget")
+        elif accelerator_type == "Hbvh":
+            self.layout.prop(data,"hbvh_max_node_depth")
+            self.layout.prop(data,"hbvh_max_pri_in_leaf")
+            self.layout.prop(data,"hbvh_compressed_node")
+            self.layout.prop(data,"hbvh_compressed_leaf")
+            self.layout.prop(data,"hbvh_spatial_split_budget")
+        elif accelerator_type == "Fbvh":
+            self.layout.prop(data,"fbvh_max_node_depth")
+            self.layout.prop(data,"fbvh_max_pri_in_leaf")
+            self.layout.prop(data,"fbvh_compressed_node")
+            self.layout.prop(data,"fbvh_compressed_leaf")
+            self.layout.prop(data,"fbvh_spatial_split_budget")
         elif accelerator_type == "KDTree":
             self.layout.prop(data,"kdtree_max_node_depth")
             self.layout.prop(data,"kdtree_max_pri_in_leaf")
@@ -191,17 +317,42 @@ class RENDER_PT_ClamppingPanel(SORTRenderPanel,bpy.types.Panel):
         data = context.scene.sort_data
         self.layout.prop(data,"clampping")
 
+@base.register_class
+class RENDER_PT_VolumePanel(SORTRenderPanel, bpy.types.Panel):
+    bl_label = 'Volume'
+    def draw(self, context):
+        self.layout.prop(context.scene.sort_data,"volume_quantization_prop")
+
+@base.register_class
+class RENDER_PT_GeometryPanel(SORTRenderPanel, bpy.types.Panel):
+    bl_label = 'Geometry'
+    def draw(self, context):
+        self.layout.prop(context.scene.sort_data,"native_subdivision_prop")
+
 @base.register_class
 class RENDER_PT_MultiThreadPanel(SORTRenderPanel, bpy.types.Panel):
     bl_label = 'MultiThread'
     def draw(self, context):
         self.layout.prop(context.scene.sort_data,"thread_num_prop")
+        self.layout.prop(context.scene.sort_data,"splat_film_prop")
 
 @base.register_class
 class RENDER_PT_SamplerPanel(SORTRenderPanel, bpy.types.Panel):
     bl_label = 'Sample'
     def draw(self, context):
-        self.layout.prop(context.scene.sort_data,"sampler_count_prop")
+        data = context.scene.sort_data
+        self.layout.prop(data,"sampler_type_prop")
+        self.layout.prop(data,"sampler_count_prop")
+        self.layout.prop(data,"progressive_prop")
+        if data.progressive_prop:
+            self.layout.prop(data,"sample_per_pass_prop")
+            self.layout.prop(data,"time_budget_prop")
+        self.layout.prop(data,"adaptive_sampling_prop")
+        if data.adaptive_sampling_prop:
+            self.layout.prop(data,"min_sample_count_prop")
+            self.layout.prop(data,"noise_threshold_prop")
+        self.layout.prop(data,"denoise_prop")
+        self.layout.prop(data,"preview_quality_prop")
 
 @base.register_class
 class SORT_export_debug_scene(bpy.types.Operator):
@@ -0,0 +1,43 @@
+#    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+#    platform physically based renderer.
+#
+#    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+#
+#    SORT is a free software written for educational purpose. Anyone can distribute
+#    or modify it under the the terms of the GNU General Public License Version 3 as
+#    published by the Free Software Foundation. However, there is NO warranty that
+#    all components are functional in a perfect manner. Without even the implied
+#    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+#    General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License along with
+#    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+
+import bpy
+from .. import base
+
+# attach customized properties to objects, a mesh with a NanoVDB file is the boundary of the volume in the file
+@base.register_class
+class SORTVolumeData(bpy.types.PropertyGroup):
+    nanovdb_file : bpy.props.StringProperty( name='NanoVDB File', default='', subtype='FILE_PATH', description='Density loaded by the renderer directly instead of the smoke domain, # is replaced by the frame number. The grid is stretched to the bounding box of the mesh.')
+    @classmethod
+    def register(cls):
+        bpy.types.Object.sort_volume = bpy.props.PointerProperty(name="SORT Volume", type=cls)
+    @classmethod
+    def unregister(cls):
+        del bpy.types.Object.sort_volume
+
+@base.register_class
+class PHYSICS_PT_SORTVolumePanel(bpy.types.Panel):
+    bl_label = 'SORT Volume'
+    bl_space_type = "PROPERTIES"
+    bl_region_type = "WINDOW"
+    bl_context = "physics"
+    COMPAT_ENGINES = {'SORT'}
+
+    @classmethod
+    def poll(cls, context):
+        return context.object is not None and context.object.type == 'MESH' and context.scene.render.engine in cls.COMPAT_ENGINES
+
+    def draw(self, context):
+        self.layout.prop(context.object.sort_volume, "nanovdb_file")
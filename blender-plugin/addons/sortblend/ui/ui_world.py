@@ -47,8 +47,15 @@ class SORTHDRSky(bpy.types.PropertyGroup):
         item.previews = enum_items
         return item.previews
 
+    sky_model : bpy.props.EnumProperty(name='Sky Model',items=[('HDR','Image','Lat-long image of the environment'),('PREETHAM','Preetham','Analytic daylight model with a sun disk')],default='HDR',description='Where the radiance of the sky comes from.')
     hdr_image : bpy.props.PointerProperty(type=bpy.types.Image)
     preview : bpy.props.EnumProperty(items=generate_preview)
+    sampling_cache : bpy.props.BoolProperty(name='Cache Sampling Tables',default=True,description='Reuse the sampling tables of the sky built in the previous rendering if the image is not changed.')
+    turbidity : bpy.props.FloatProperty(name='Turbidity',default=3.0,min=2.0,max=10.0,description='Haziness of the atmosphere, 2 is a very clear sky and 10 is hazy.')
+    sun_elevation : bpy.props.FloatProperty(name='Sun Elevation',default=0.785398,min=-1.570796,max=1.570796,subtype='ANGLE',description='Angle between the sun and the horizon.')
+    sun_azimuth : bpy.props.FloatProperty(name='Sun Azimuth',default=0.0,subtype='ANGLE',description='Angle of the sun around the up axis, starting from the X axis.')
+    sun_size : bpy.props.FloatProperty(name='Sun Size',default=0.0093,min=0.0001,max=0.5,subtype='ANGLE',description='Angular diameter of the sun disk.')
+    sun_strength : bpy.props.FloatProperty(name='Sun Strength',default=1.0,min=0.0,description='Scaling of the radiance of the sun disk, zero removes the sun.')
     @classmethod
     def register(cls):
         bpy.types.Scene.sort_hdr_sky = bpy.props.PointerProperty(name="SORT HDR Sky", type=cls)
@@ -69,5 +76,15 @@ class HDRSKY_PT_SORTPanel(bpy.types.Panel):
         return context.scene.render.engine in cls.COMPAT_ENGINES
 
     def draw(self, context):
-        self.layout.template_ID(context.scene.sort_hdr_sky, 'hdr_image', open='image.open')
-        self.layout.template_icon_view(context.scene.sort_hdr_sky, 'preview', show_labels=True)
+        sky = context.scene.sort_hdr_sky
+        self.layout.prop(sky, 'sky_model')
+        if sky.sky_model == 'PREETHAM':
+            self.layout.prop(sky, 'turbidity')
+            self.layout.prop(sky, 'sun_elevation')
+            self.layout.prop(sky, 'sun_azimuth')
+            self.layout.prop(sky, 'sun_size')
+            self.layout.prop(sky, 'sun_strength')
+            return
+        self.layout.template_ID(sky, 'hdr_image', open='image.open')
+        self.layout.template_icon_view(sky, 'preview', show_labels=True)
+        self.layout.prop(sky, 'sampling_cache')
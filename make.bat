@@ -32,6 +32,7 @@ set BUILD_RELWITHDEBINFO=
 set REGISTER_SYS_ENV=
 set FORCE_UPDATE_DEP=
 set GENERATE_SRC=
+set BENCHMARK=
 
 rem parse arguments
 :argv_loop
@@ -75,6 +76,9 @@ if NOT "%1" == "" (
     ) else if "%1" == "generate_src" (
         set GENERATE_SRC=1
         goto EOF
+    ) else if "%1" == "benchmark" (
+        set BENCHMARK=1
+        goto EOF
     ) else (
         echo Unrecognized Command
         goto EOF
@@ -190,6 +194,11 @@ if "%GENERATE_SRC%" == "1" (
     py .\scripts\generate_src.py
 )
 
+if "%BENCHMARK%" == "1" (
+    echo Running performance benchmark
+    py .\scripts\benchmark.py
+)
+
 :EOF
 exit /b 0
 :BUILD_ERR
@@ -0,0 +1,177 @@
+#
+#    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+#    platform physically based renderer.
+#
+#    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+#
+#    SORT is a free software written for educational purpose. Anyone can distribute
+#    or modify it under the the terms of the GNU General Public License Version 3 as
+#    published by the Free Software Foundation. However, there is NO warranty that
+#    all components are functional in a perfect manner. Without even the implied
+#    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+#    General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License along with
+#    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+#
+
+# Performance benchmark of SORT.
+#
+# Each scene listed in the configuration file is rendered in all configurations, which override the threads,
+# accelerator, integrator, sampler and sample count of the scene in the command line. Every run exports the stats
+# of SORT in a JSON file, the median of the repetitions is reported after the warmup runs are dropped.
+#
+# Scene files are the streams exported by the Blender plugin, they are not shipped with the source code. Scenes
+# missing on the disk are skipped.
+#
+# Usage:
+#   python3 ./scripts/benchmark.py [--config <file>] [--bin <sort binary>] [--output <file>]
+#                                  [--baseline <file>] [--tolerance <ratio>]
+#
+# With a baseline, the script fails if any scene renders slower than the baseline by more than the tolerance.
+
+import argparse
+import json
+import os
+import platform
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+sort_dir = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+def default_binary():
+    binary = 'sort_r.exe' if platform.system() == 'Windows' else 'sort_r'
+    return os.path.join(sort_dir, 'bin', binary)
+
+# the numbers of interest in the stats exported by SORT, missing ones are reported as None
+def parse_stats(stats):
+    counters = stats.get('counters', {})
+    performance = counters.get('Performance', {})
+
+    result = {}
+    result['preprocess_ms'] = performance.get('Pre-processing Time')
+    result['render_ms'] = performance.get('Rendering Time')
+    result['peak_rss_bytes'] = performance.get('Peak Resident Memory (Bytes)')
+    rays = performance.get('Number of rays per second')
+    if rays and rays['denominator'] > 0:
+        result['mrays_per_second'] = rays['nominator'] / rays['denominator'] * 0.001
+    else:
+        result['mrays_per_second'] = None
+
+    # traversal stats of whatever spatial structure is used
+    for category, items in counters.items():
+        if category.startswith('Spatial-Structure'):
+            result['accelerator'] = category
+            result['traversal'] = items
+    result['scopes'] = stats.get('scopes', {})
+    return result
+
+def run_once(binary, scene, args):
+    handle, stats_file = tempfile.mkstemp(suffix='.json')
+    os.close(handle)
+    try:
+        command = [binary, '--input:' + scene, '--stats:' + stats_file] + args
+        start = time.perf_counter()
+        completed = subprocess.run(command, cwd=os.path.dirname(binary), stdout=subprocess.DEVNULL)
+        wall_ms = (time.perf_counter() - start) * 1000.0
+        if completed.returncode != 0:
+            print('  "%s" failed with %d.' % (' '.join(command), completed.returncode))
+            return None
+        with open(stats_file) as f:
+            result = parse_stats(json.load(f))
+        result['wall_ms'] = wall_ms
+        return result
+    except (OSError, ValueError) as e:
+        print('  Failed to run "%s": %s' % (binary, e))
+        return None
+    finally:
+        os.remove(stats_file)
+
+def median_of(runs, key):
+    values = [run[key] for run in runs if run.get(key) is not None]
+    return statistics.median(values) if values else None
+
+def benchmark(binary, config):
+    warmup = config.get('warmup', 1)
+    repetitions = config.get('repetitions', 3)
+    results = []
+    for scene in config['scenes']:
+        scene_file = scene['file'] if os.path.isabs(scene['file']) else os.path.join(sort_dir, scene['file'])
+        if not os.path.isfile(scene_file):
+            print('Scene "%s" is skipped, %s does not exist.' % (scene['name'], scene_file))
+            continue
+        for configuration in config['configurations']:
+            print('Benchmarking %s with %s.' % (scene['name'], configuration['name']))
+            args = configuration.get('args', [])
+            for _ in range(warmup):
+                run_once(binary, scene_file, args)
+            runs = [run_once(binary, scene_file, args) for _ in range(repetitions)]
+            runs = [run for run in runs if run is not None]
+            if not runs:
+                continue
+            results.append({
+                'scene': scene['name'],
+                'configuration': configuration['name'],
+                'args': args,
+                'repetitions': len(runs),
+                'wall_ms': median_of(runs, 'wall_ms'),
+                'preprocess_ms': median_of(runs, 'preprocess_ms'),
+                'render_ms': median_of(runs, 'render_ms'),
+                'mrays_per_second': median_of(runs, 'mrays_per_second'),
+                'peak_rss_bytes': median_of(runs, 'peak_rss_bytes'),
+                'runs': runs,
+            })
+    return results
+
+# a run regresses if it is slower than the baseline by more than the tolerance, either in ray throughput or total time
+def find_regressions(results, baseline, tolerance):
+    previous = {(r['scene'], r['configuration']): r for r in baseline.get('results', [])}
+    regressions = []
+    for result in results:
+        base = previous.get((result['scene'], result['configuration']))
+        if base is None:
+            continue
+        if result['mrays_per_second'] and base.get('mrays_per_second') and \
+                result['mrays_per_second'] < base['mrays_per_second'] * (1.0 - tolerance):
+            regressions.append('%s/%s: %.2f MRays/s, it was %.2f.' % (result['scene'], result['configuration'],
+                               result['mrays_per_second'], base['mrays_per_second']))
+        if result['wall_ms'] and base.get('wall_ms') and result['wall_ms'] > base['wall_ms'] * (1.0 + tolerance):
+            regressions.append('%s/%s: %.0f ms, it was %.0f.' % (result['scene'], result['configuration'],
+                               result['wall_ms'], base['wall_ms']))
+    return regressions
+
+def main():
+    parser = argparse.ArgumentParser(description='Performance benchmark of SORT.')
+    parser.add_argument('--config', default=os.path.join(sort_dir, 'scripts', 'benchmark.json'))
+    parser.add_argument('--bin', default=default_binary())
+    parser.add_argument('--output', default=os.path.join(sort_dir, 'benchmark_result.json'))
+    parser.add_argument('--baseline', default=None)
+    parser.add_argument('--tolerance', type=float, default=0.05)
+    args = parser.parse_args()
+
+    if not os.path.isfile(args.bin):
+        print('SORT binary %s does not exist, build it first.' % args.bin)
+        return 1
+
+    with open(args.config) as f:
+        config = json.load(f)
+
+    results = benchmark(os.path.abspath(args.bin), config)
+    with open(args.output, 'w') as f:
+        json.dump({'platform': platform.platform(), 'processor': platform.processor(), 'results': results}, f, indent=2)
+    print('Benchmark result: %s' % args.output)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            regressions = find_regressions(results, json.load(f), args.tolerance)
+        for regression in regressions:
+            print('Regression %s' % regression)
+        if regressions:
+            return 1
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
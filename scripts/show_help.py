@@ -39,6 +39,10 @@ Available commands
         Introduction about SORT and myself.
     * dep_info
         Introduction about the third party libraries used in SORT.
+    * benchmark
+        Render the benchmark scenes in fixed configurations and report the
+        performance in benchmark_result.json. Scenes are listed in
+        scripts/benchmark.json.
 
 Convenience targets
 
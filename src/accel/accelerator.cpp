@@ -15,54 +15,185 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <stdio.h>
+#include <fstream>
 #include "accelerator.h"
 #include "core/primitive.h"
+#include "stream/fstream.h"
+#include "core/cpuinfo.h"
+
+// Layout of a cache file : magic, version, topology key, geometry key, data of the acceleration structure, magic
+static constexpr unsigned int ACCELERATOR_CACHE_MAGIC   = 0x43434153;
+static constexpr unsigned int ACCELERATOR_CACHE_VERSION = 2;
 
 SORT_STATS_DEFINE_COUNTER(sRayCount)
 SORT_STATS_DEFINE_COUNTER(sShadowRayCount)
 SORT_STATS_DEFINE_COUNTER(sIntersectionTest)
+SORT_STATS_DEFINE_HISTOGRAM(sTraversalSteps)
+SORT_STATS_DEFINE_HISTOGRAM(sLeafVisits)
+SORT_STATS_DEFINE_HISTOGRAM(sShadowTraversalSteps)
+SORT_STATS_DEFINE_HISTOGRAM(sShadowLeafVisits)
+
+StringID ResolveAcceleratorType( const StringID type ){
+    const auto is_fbvh = SID("Fbvh") == type;
+    if( !is_fbvh && SID("Hbvh") != type && SID("Obvh") != type )
+        return type;
+
+    // the widest SIMD BVH that has SIMD kernels compiled in and can run on this CPU
+    const auto isa = GetSupportedSimdIsa();
+    auto widest = SID("Qbvh");
+#ifdef AVX_ENABLED
+    if( isa >= SIMD_ISA::AVX )
+        widest = SID("Obvh");
+#endif
+#ifdef AVX512_ENABLED
+    if( isa >= SIMD_ISA::AVX512 )
+        widest = SID("Hbvh");
+#endif
+
+    auto resolved = type;
+    if( is_fbvh ){
+        resolved = widest;
+    }else{
+        // A type without its SIMD kernels compiled in is a plain C++ implementation, it runs anywhere.
+#ifdef AVX512_ENABLED
+        if( SID("Hbvh") == type && SID("Hbvh") != widest )
+            resolved = widest;
+#endif
+#ifdef AVX_ENABLED
+        if( SID("Obvh") == type && SID("Qbvh") == widest )
+            resolved = widest;
+#endif
+        if( resolved != type )
+            slog( WARNING , SPATIAL_ACCELERATOR , "The requested accelerator is not supported by the CPU, falling back to a narrower one." );
+    }
+
+    slog( INFO , SPATIAL_ACCELERATOR , "Widest SIMD instruction set of the CPU is %s, %s is picked." , GetSimdIsaName( isa ) ,
+          SID("Hbvh") == resolved ? "HBVH" : ( SID("Obvh") == resolved ? "OBVH" : "QBVH" ) );
+    return resolved;
+}
+
+void Accelerator::GetIntersect( const Ray* rays , SurfaceInteraction* intersects , unsigned int cnt ) const{
+    for( auto i = 0u ; i < cnt ; ++i )
+        GetIntersect( rays[i] , intersects[i] );
+}
+
+void Accelerator::GetIntersectIncoherent( const Ray* rays , SurfaceInteraction* intersects , unsigned int cnt ) const{
+    for( auto i = 0u ; i < cnt ; ++i )
+        GetIntersect( rays[i] , intersects[i] );
+}
+
+bool Accelerator::IsOccluded( const Ray& r , const Primitive*& occluder ) const{
+    occluder = nullptr;
+    return IsOccluded( r );
+}
+
+void Accelerator::IsOccluded( const Ray* rays , bool* occluded , unsigned int cnt ) const{
+    for( auto i = 0u ; i < cnt ; ++i )
+        occluded[i] = IsOccluded( rays[i] );
+}
+
+Ray RayBatch::GetRay( const unsigned int i ) const{
+    const auto ray_ori = Point( ori[0][i] , ori[1][i] , ori[2][i] );
+    const auto ray_dir = Vector( dir[0][i] , dir[1][i] , dir[2][i] );
+    return Ray( ray_ori , ray_dir , 0 , tmin ? tmin[i] : 0.0f , tmax ? tmax[i] : FLT_MAX );
+}
+
+void Accelerator::IntersectBatch( const RayBatch& rays , HitRecord* hits ) const{
+    for( auto i = 0u ; i < rays.cnt ; ++i ){
+        hits[i] = HitRecord();
+        if( !rays.IsActive( i ) )
+            continue;
+
+        SurfaceInteraction intersect;
+        if( GetIntersect( rays.GetRay( i ) , intersect ) ){
+            hits[i].t = intersect.t;
+            hits[i].primitive = intersect.primitive;
+        }
+    }
+}
+
+void Accelerator::OccludedBatch( const RayBatch& rays , bool* occluded ) const{
+    for( auto i = 0u ; i < rays.cnt ; ++i )
+        occluded[i] = rays.IsActive( i ) && IsOccluded( rays.GetRay( i ) );
+}
 
 #ifdef ENABLE_TRANSPARENT_SHADOW
-bool Accelerator::GetAttenuation( Ray& ray , Spectrum& attenuation , MediumStack* ms ) const {
-    SurfaceInteraction intersection;
+void Accelerator::GetIntersect( const Ray& ray , ShadowIntersections& intersect ) const {
+    auto& intersection = intersect.intersections[0];
+    intersection.Reset();
     intersection.query_shadow = true;
-    if (!GetIntersect(ray, intersection)) {
-        if (ms)
-            attenuation *= ms->Tr(ray, ray.m_fMax);
-        return false;
-    }
+    if( !GetIntersect( ray , intersection ) )
+        return;
 
     // primitive being null is a special coding meaning the ray is blocked by an opaque primitive.
     if( IS_PTR_INVALID( intersection.primitive ) ){
-        attenuation = 0.0f;
-        return true;
+        intersect.blocked = true;
+        return;
+    }
+
+    // there could be more intersections behind the nearest one.
+    intersect.cnt = 1;
+    intersect.complete = false;
+}
+
+bool Accelerator::GetAttenuation( Ray& ray , Spectrum& attenuation , MediumStack* ms ) const {
+    ShadowIntersections intersect;
+    GetIntersect( ray , intersect );
+
+    attenuation = intersect.blocked ? 0.0f : 1.0f;
+    if( intersect.blocked || 0 == intersect.cnt )
+        return false;
+
+    // intersections are recorded in no particular order, sort them so that the medium stack is updated in the right order.
+    unsigned order[TOTAL_SHADOW_INTERSECTION_CNT];
+    for( auto i = 0u ; i < intersect.cnt ; ++i ){
+        auto j = i;
+        for( ; j > 0 && intersect.intersections[order[j-1]].t > intersect.intersections[i].t ; --j )
+            order[j] = order[j-1];
+        order[j] = i;
     }
 
-    // get the material of the intersected primitive
-    const MaterialBase* material = intersection.primitive->GetMaterial();
-    sAssert( IS_PTR_VALID( material ) , SPATIAL_ACCELERATOR );
+    auto segment = ray;
+    auto t = 0.0f;
+    for( auto i = 0u ; i < intersect.cnt ; ++i ){
+        const auto& intersection = intersect.intersections[order[i]];
 
-    // evaluate the transparency first in case it is fully opaque.
-    attenuation = material->EvaluateTransparency(intersection);
+        // get the material of the intersected primitive
+        const MaterialBase* material = intersection.primitive->GetMaterial();
+        sAssert( IS_PTR_VALID( material ) , SPATIAL_ACCELERATOR );
 
-    // consider beam transmittance during ray traversal if medium is presented.
-    if (ms && !attenuation.IsBlack() ) {
-        attenuation *= ms->Tr(ray, intersection.t);
+        // evaluate the transparency first in case it is fully opaque.
+        attenuation *= material->EvaluateTransparency(intersection);
+        if( attenuation.IsBlack() )
+            return false;
 
-        const auto theta_wi = dot(ray.m_Dir, intersection.gnormal);
-        const auto theta_wo = -theta_wi;
-        const auto interaction_flag = update_interaction_flag(theta_wi, theta_wo);
+        // consider beam transmittance during ray traversal if medium is presented.
+        if( ms ){
+            attenuation *= ms->Tr(segment, intersection.t - t);
 
-        // at this point, we know for sure the ray pass through the surface.
-        MediumInteraction mi;
-        mi.intersect = intersection.intersect;
-        mi.mesh = intersection.primitive->GetMesh();
-        material->UpdateMediumStack(mi, interaction_flag, *ms);
+            const auto theta_wi = dot(ray.m_Dir, intersection.gnormal);
+            const auto theta_wo = -theta_wi;
+            const auto interaction_flag = update_interaction_flag(theta_wi, theta_wo);
+
+            // at this point, we know for sure the ray pass through the surface.
+            MediumInteraction mi;
+            mi.intersect = intersection.intersect;
+            mi.mesh = intersection.primitive->GetMesh();
+            material->UpdateMediumStack(mi, interaction_flag, *ms);
+        }
+
+        segment.m_Ori = intersection.intersect;
+        segment.m_fMin = 0.001f;              // avoid self collision again.
+        t = intersection.t;
     }
 
-    ray.m_Ori = intersection.intersect;
-    ray.m_fMin = 0.001f;              // avoid self collision again.
-    ray.m_fMax -= intersection.t;
+    if( intersect.complete )
+        return false;
+
+    ray.m_Ori = segment.m_Ori;
+    ray.m_fMin = 0.001f;
+    ray.m_fMax -= t;
 
     return true;
 }
@@ -113,4 +244,63 @@ bool Accelerator::UpdateMediumStack( Ray& ray , MediumStack& ms , const bool rev
 	ray.m_fMax -= intersection.t;
 
 	return true;
-}
\ No newline at end of file
+}
+
+bool SaveAcceleratorCache( const Accelerator& accelerator , const std::string& filename , std::uint64_t topology , std::uint64_t geometry ){
+    SORT_PROFILE("Save Accelerator Cache");
+
+    const auto tmp_filename = filename + ".tmp";
+    auto saved = false;
+    {
+        OFileStream stream( tmp_filename );
+        stream << ACCELERATOR_CACHE_MAGIC << ACCELERATOR_CACHE_VERSION;
+        stream << (unsigned int)( topology & 0xffffffff ) << (unsigned int)( topology >> 32 );
+        stream << (unsigned int)( geometry & 0xffffffff ) << (unsigned int)( geometry >> 32 );
+        saved = accelerator.SaveCache( stream );
+        stream << ACCELERATOR_CACHE_MAGIC;
+    }
+
+    // the previous cache is only replaced once the new one is fully written
+    remove( filename.c_str() );
+    if( !saved || 0 != rename( tmp_filename.c_str() , filename.c_str() ) ){
+        remove( tmp_filename.c_str() );
+        return false;
+    }
+    return true;
+}
+
+bool LoadAcceleratorCache( Accelerator& accelerator , const std::string& filename , std::uint64_t topology , std::uint64_t geometry , const std::vector<const Primitive*>& primitives , const BBox& bbox , bool& refitted ){
+    SORT_PROFILE("Load Accelerator Cache");
+
+    refitted = false;
+
+    // IFileStream complains about missing files, a missing cache is totally expected though.
+    if( !std::ifstream( filename ).good() )
+        return false;
+
+    IFileStream stream( filename );
+    unsigned int magic = 0 , version = 0 , topology_lo = 0 , topology_hi = 0 , geometry_lo = 0 , geometry_hi = 0;
+    stream >> magic >> version >> topology_lo >> topology_hi >> geometry_lo >> geometry_hi;
+    if( magic != ACCELERATOR_CACHE_MAGIC || version != ACCELERATOR_CACHE_VERSION )
+        return false;
+    if( topology_lo != (unsigned int)( topology & 0xffffffff ) || topology_hi != (unsigned int)( topology >> 32 ) )
+        return false;
+
+    if( !accelerator.LoadCache( stream , primitives , bbox ) )
+        return false;
+
+    // a truncated file doesn't end with the magic number
+    magic = 0;
+    stream >> magic;
+    if( magic != ACCELERATOR_CACHE_MAGIC )
+        return false;
+
+    // primitives are moved, but the topology is the same, the loaded structure is refitted instead of being built again
+    if( geometry_lo != (unsigned int)( geometry & 0xffffffff ) || geometry_hi != (unsigned int)( geometry >> 32 ) ){
+        SORT_PROFILE("Refit Accelerator");
+        if( !accelerator.Refit() )
+            return false;
+        refitted = true;
+    }
+    return true;
+}
@@ -18,6 +18,7 @@
 #pragma once
 
 #include <vector>
+#include <cstdint>
 #include "core/define.h"
 #include "math/bbox.h"
 #include "core/rtti.h"
@@ -29,10 +30,64 @@
 class Ray;
 struct SurfaceInteraction;
 struct BSSRDFIntersections;
+struct ShadowIntersections;
+
+//! @brief  Distribution of the rays traced the most, it skews the cost model of BVH builds towards them.
+/**
+ * SAH assumes rays coming uniformly from all directions, a node is hit with the probability proportional to its surface
+ * area. Camera rays and shadow rays at their first hits make up a large share of all rays and they only ever see what
+ * is in front of the camera. Geometry far away or off-screen is rarely visited by them, nodes of it are cheaper than
+ * their surface areas suggest.
+ */
+struct RayDistribution{
+    Point   origin;                 /**< Where camera rays start from. */
+    Vector  dir;                    /**< Center direction of the cone covering all camera rays. */
+    float   cosHalfAngle = 1.0f;    /**< Cosine of the half angle of the cone covering all camera rays. */
+    float   weight = 0.0f;          /**< Weight of camera rays relative to uniformly distributed rays, zero means plain SAH. */
+};
+
+//! @brief  A batch of rays laid out as structure of arrays.
+/**
+ * Wavefront integrators keep the rays of all paths in flat arrays of floats, one array per component, so that every
+ * stage of the wavefront streams through memory and vectorizes. The batch only refers to those arrays, nothing is copied
+ * until the rays are traced.
+ */
+struct RayBatch{
+    const float*            ori[3] = { nullptr , nullptr , nullptr };   /**< Components of the origins of the rays. */
+    const float*            dir[3] = { nullptr , nullptr , nullptr };   /**< Components of the directions of the rays. */
+    const float*            tmin = nullptr;         /**< Nearest distances of interest along the rays, zero if nullptr. */
+    const float*            tmax = nullptr;         /**< Farthest distances of interest along the rays, unbounded if nullptr. */
+    const unsigned char*    mask = nullptr;         /**< Rays with a zero mask are skipped, all rays are active if nullptr. */
+    unsigned int            cnt = 0;                /**< Number of rays in the batch. */
+    bool                    coherent = false;       /**< Whether the rays are coherent, like camera rays of a tile. */
+
+    //! @brief  Whether a ray in the batch needs to be traced.
+    SORT_FORCEINLINE bool IsActive( const unsigned int i ) const {
+        return IS_PTR_INVALID( mask ) || mask[i];
+    }
+
+    //! @brief  Gather a ray in the batch.
+    //!
+    //! @param  i           Index of the ray in the batch.
+    //! @return             The ray at the index.
+    Ray     GetRay( const unsigned int i ) const;
+};
+
+//! @brief  The nearest hit of a ray in a batch.
+/**
+ * Only the distance and the primitive are reported, attributes of the surface are not evaluated. Most rays of a wavefront
+ * are shaded in a later stage after being sorted by material, evaluating attributes right after traversal would only
+ * pull in cache lines that are evicted again by then.
+ */
+struct HitRecord{
+    float               t = FLT_MAX;            /**< Distance to the hit along the ray, FLT_MAX if there is no hit. */
+    const Primitive*    primitive = nullptr;    /**< The primitive being hit, nullptr if there is no hit. */
+};
 
 #ifdef ENABLE_TRANSPARENT_SHADOW
 SORT_FORCEINLINE bool isShadowRay( const SurfaceInteraction* intersection ){
-    return intersection->query_shadow;
+    // occlusion queries don't have any intersection to fill
+    return IS_PTR_INVALID( intersection ) || intersection->query_shadow;
 }
 #else
 SORT_FORCEINLINE bool isShadowRay( const SurfaceInteraction* intersection ){
@@ -70,26 +125,97 @@ public:
     //!                     it returns false.
     virtual bool GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const = 0;
 
-#ifndef ENABLE_TRANSPARENT_SHADOW
+    //! @brief Get intersections of a packet of rays.
+    //!
+    //! Rays in a packet are expected to be coherent, like camera rays of a tile, so that traversing them together
+    //! amortizes the cost of fetching nodes. The default implementation simply traces the rays one by one.
+    //! None of the rays in the packet should be shadow rays.
+    //!
+    //! @param rays         The packet of rays to be tested.
+    //! @param intersects   The intersection results, one for each ray. 't' of each of them needs to be initialized.
+    //! @param cnt          Number of rays in the packet.
+    virtual void GetIntersect( const Ray* rays , SurfaceInteraction* intersects , unsigned int cnt ) const;
+
+    //! @brief Get intersections of a batch of incoherent rays.
+    //!
+    //! Unlike packets, rays in the batch barely share any nodes, like secondary rays of different paths. It is up to
+    //! the accelerator to hide the latency of fetching nodes by working on several rays at a time. The default
+    //! implementation simply traces the rays one by one. None of the rays in the batch should be shadow rays.
+    //!
+    //! @param rays         The batch of rays to be tested.
+    //! @param intersects   The intersection results, one for each ray. 't' of each of them needs to be initialized.
+    //! @param cnt          Number of rays in the batch.
+    virtual void GetIntersectIncoherent( const Ray* rays , SurfaceInteraction* intersects , unsigned int cnt ) const;
+
     //! @brief This is a dedicated interface for detecting shadow rays.
     //!
     //! Instead of merging the interface with 'GetIntersect', this is a separate interface purely for occlusion detection.
     //! There is a need for it so that we can achieve better performance. There will be less branch in this interfaces and
     //! most importantly the traversed node doesn't need to be sorted.
+    //! With transparent shadow, every primitive hit blocks the ray, it is only used for scenes without any transparency.
     //!
     //! @param r            The ray to be tested.
     //! @return             Whether the ray is occluded by anything.
     virtual bool IsOccluded( const Ray& r ) const = 0;
-#else
+
+    //! @brief Detect occlusion and tell what blocks the ray.
+    //!
+    //! Consecutive shadow rays toward the same light are often blocked by the same primitive, callers could test it first
+    //! next time. The default implementation can't tell the occluder, it is nullptr even if the ray is occluded.
+    //!
+    //! @param r            The ray to be tested.
+    //! @param occluder     The primitive blocking the ray if it is known, nullptr otherwise.
+    //! @return             Whether the ray is occluded by anything.
+    virtual bool IsOccluded( const Ray& r , const Primitive*& occluder ) const;
+
+    //! @brief Detect occlusion of a batch of shadow rays.
+    //!
+    //! Shadow rays of a shading point share the same origin, testing them together amortizes the cost of fetching nodes
+    //! just like a packet of camera rays. The default implementation simply tests the rays one by one.
+    //!
+    //! @param rays         The shadow rays to be tested.
+    //! @param occluded     Whether each of the rays is occluded by anything.
+    //! @param cnt          Number of rays in the batch.
+    virtual void IsOccluded( const Ray* rays , bool* occluded , unsigned int cnt ) const;
+
+    //! @brief Get the nearest hits of a batch of rays laid out as structure of arrays.
+    //!
+    //! Rays with a zero mask are skipped and reported as misses. The default implementation gathers and traces the active
+    //! rays one by one.
+    //!
+    //! @param rays         The batch of rays to be tested.
+    //! @param hits         The nearest hit of each ray in the batch.
+    virtual void IntersectBatch( const RayBatch& rays , HitRecord* hits ) const;
+
+    //! @brief Detect occlusion of a batch of rays laid out as structure of arrays.
+    //!
+    //! Rays with a zero mask are skipped and reported as not occluded. The default implementation gathers and tests the
+    //! active rays one by one.
+    //!
+    //! @param rays         The batch of rays to be tested.
+    //! @param occluded     Whether each of the rays is occluded by anything.
+    virtual void OccludedBatch( const RayBatch& rays , bool* occluded ) const;
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
+    //! @brief Get the nearest intersections along a shadow ray.
+    //!
+    //! Semi-transparent surfaces along a shadow ray are collected in one traversal so that the ray doesn't need to be traced
+    //! again past every single one of them. The default implementation only reports the nearest intersection, spatial data
+    //! structures could do better with a dedicated traversal.
+    //!
+    //! @param r            The shadow ray to be tested.
+    //! @param intersect    The intersections along the ray.
+    virtual void GetIntersect( const Ray& r , ShadowIntersections& intersect ) const;
+
     //! @brief  Evaluate attenuation along a ray segment.
     //!
-    //! This function just returned the attenuation of the first intersection. It is not responsible for evaluating all attenuations
-    //! along the ray.
+    //! This function returns the attenuation of the intersections found in one traversal, which is not necessarily all of
+    //! them along the ray. It needs to be called again until it returns false.
     //!
-    //! @param r            The ray to be tested. Its origin will be updated upon intersection.
+    //! @param r            The ray to be tested. Its origin will be updated past the intersections evaluated.
     //! @param attenuation  The occlusion along the ray.
     //! @param ms           The medium stack used to evaluate shadow attenuation.
-    //! @return             Whether there is an intersection along the ray.
+    //! @return             Whether there could be more intersections further along the ray.
     bool         GetAttenuation( Ray& r , Spectrum& attenuation , MediumStack* ms = nullptr ) const;
 #endif
 
@@ -116,6 +242,7 @@ public:
     //! @param  r           The input ray to be tested.
     //! @param  intersect   The intersection result that holds all intersection.
     //! @param  matID       We are only interested in intersection with the same material, whose material id should be set to matID.
+    //!                     INVALID_SID accepts intersections with any material.
     virtual void GetIntersect( const Ray& r , BSSRDFIntersections& intersect , const StringID matID = INVALID_SID ) const = 0;
 
     //! @brief Build the acceleration structure.
@@ -138,6 +265,36 @@ public:
         return m_isValid;
     }
 
+    //! @brief  Build BVHs with the linear builder instead of the SAH one.
+    //!
+    //! Linear BVHs are built in a fraction of the time by sorting primitives along a Morton curve, at the cost of slower
+    //! traversal. It suits previews and meshes deforming every frame. Acceleration structures other than BVHs ignore it.
+    //!
+    //! @param  linear      Whether the linear builder is used.
+    SORT_FORCEINLINE void SetLinearBuild( const bool linear ) {
+        m_linearBuild = linear;
+    }
+
+    //! @brief  Build QBVH/OBVH with the optimized builder, which is slower to build but faster to trace.
+    //!
+    //! A binary BVH is built with SAH, restructured treelet by treelet and collapsed into wide nodes minimizing SAH cost.
+    //! It suits final renders where the construction is a small fraction of the time. Other acceleration structures ignore
+    //! it, so do linear builds and builds with spatial splits.
+    //!
+    //! @param  optimized   Whether the optimized builder is used.
+    SORT_FORCEINLINE void SetOptimizedBuild( const bool optimized ) {
+        m_optimizedBuild = optimized;
+    }
+
+    //! @brief  Weight the cost model of BVH builds by the distribution of camera rays.
+    //!
+    //! Acceleration structures other than BVHs ignore it, so do linear builds.
+    //!
+    //! @param  rays        The distribution of camera rays, plain SAH is used if its weight is zero.
+    SORT_FORCEINLINE void SetRayDistribution( const RayDistribution& rays ) {
+        m_rayDistribution = rays;
+    }
+
 	//! @brief	Clone the accelerator.
 	//!
 	//! Only configuration will be cloned, not the data inside the accelerator, this is for primitives that has volumes attached.
@@ -145,6 +302,43 @@ public:
 	//! @return		Cloned accelerator.
 	virtual std::unique_ptr<Accelerator>	Clone() const = 0;
 
+    //! @brief Save the constructed acceleration structure so that it can be loaded later without being built again.
+    //!
+    //! The configuration, the nodes and the order of primitives are saved in flat arrays. Primitives are referred by their
+    //! indices in the primitive list passed in 'Build', which needs to be the same when loading it back.
+    //!
+    //! @param stream           Stream to save the acceleration structure to.
+    //! @return                 Whether the acceleration structure supports caching.
+    virtual bool    SaveCache( OStreamBase& stream ) const { return false; }
+
+    //! @brief Load an acceleration structure saved by 'SaveCache' instead of building it.
+    //!
+    //! It fails if the configuration in the cache doesn't match the current one or the cached data is broken, in which
+    //! case the acceleration structure needs to be built again.
+    //!
+    //! @param stream           Stream to load the acceleration structure from.
+    //! @param primitives       A vector holding all primitives, it needs to be the same one used to build the cached data.
+    //! @param bbox             The bounding box of the scene.
+    //! @return                 Whether the acceleration structure is loaded.
+    virtual bool    LoadCache( IStreamBase& stream , const std::vector<const Primitive*>& primitives , const BBox& bbox ) { return false; }
+
+    //! @brief Refit the acceleration structure to primitives that are moved after it is built or loaded.
+    //!
+    //! The topology of the acceleration structure is kept, bounding boxes of nodes are evaluated again from bottom to top.
+    //! It is a lot cheaper than building it again, while the quality of the structure degrades as primitives move further.
+    //!
+    //! @return                 Whether the refitted acceleration structure is still good enough, it needs to be built again if not.
+    virtual bool    Refit() { return false; }
+
+    //! @brief Refit the acceleration structure to primitives that are moved, along with the new bounding box of the scene.
+    //!
+    //! @param bbox             The new bounding box of the scene.
+    //! @return                 Whether the refitted acceleration structure is still good enough, it needs to be built again if not.
+    SORT_FORCEINLINE bool   RefitScene( const BBox& bbox ) {
+        m_bbox = bbox;
+        return Refit();
+    }
+
 protected:
     /**< The vector holding all primitive pointers. */
     const std::vector<const Primitive*>*    m_primitives = nullptr;
@@ -152,4 +346,53 @@ protected:
     BBox                                    m_bbox;
     /**< Whether the spatial structure is constructed before. */
     bool                                    m_isValid = false;
+    /**< Whether BVHs are built by sorting primitives along a Morton curve instead of evaluating SAH. */
+    bool                                    m_linearBuild = false;
+    /**< Whether wide BVHs are collapsed from an optimized binary BVH instead of being split top-down. */
+    bool                                    m_optimizedBuild = false;
+    /**< Distribution of camera rays weighting the cost model of BVH builds. */
+    RayDistribution                         m_rayDistribution;
+
+    //! @brief  The distribution of camera rays to weight SAH with, nullptr if plain SAH is used.
+    SORT_FORCEINLINE const RayDistribution* rayDistribution() const {
+        return m_rayDistribution.weight > 0.0f ? &m_rayDistribution : nullptr;
+    }
 };
+
+//! @brief Pick the accelerator to instantiate for the CPU running the process.
+//!
+//! 'Fbvh' is resolved to the widest SIMD BVH that is both compiled in and supported by the CPU, HBVH with AVX-512, OBVH with
+//! AVX and QBVH otherwise. An explicitly requested HBVH or OBVH falls back to a narrower one if the CPU can't run it, so that
+//! the same resource file renders on all nodes of a heterogeneous farm. Other types are returned as they are.
+//!
+//! @param type             Type of the accelerator in the resource file.
+//! @return                 Type of the accelerator to instantiate.
+StringID    ResolveAcceleratorType( const StringID type );
+
+//! @brief Save an acceleration structure to a cache file.
+//!
+//! The file is written to a temporary file first and then renamed, a broken cache file is never left behind.
+//!
+//! @param accelerator      The constructed acceleration structure.
+//! @param filename         Name of the cache file.
+//! @param topology         Hash of the topology of the geometry the acceleration structure is built from.
+//! @param geometry         Hash of the geometry the acceleration structure is built from.
+//! @return                 Whether the cache file is written.
+bool    SaveAcceleratorCache( const Accelerator& accelerator , const std::string& filename , std::uint64_t topology , std::uint64_t geometry );
+
+//! @brief Load an acceleration structure from a cache file.
+//!
+//! @param accelerator      The acceleration structure to be loaded.
+//! @param filename         Name of the cache file.
+//! A cached acceleration structure with the same topology but different geometry, like a deforming mesh in an animation,
+//! is refitted to the current geometry once loaded.
+//!
+//! @param accelerator      The acceleration structure to be loaded.
+//! @param filename         Name of the cache file.
+//! @param topology         Hash of the topology of the geometry, nothing is loaded if it doesn't match the one in the file.
+//! @param geometry         Hash of the geometry, the loaded acceleration structure is refitted if it doesn't match the one in the file.
+//! @param primitives       A vector holding all primitives.
+//! @param bbox             The bounding box of the scene.
+//! @param refitted         Whether the loaded acceleration structure is refitted, the cache file is outdated if so.
+//! @return                 Whether the acceleration structure is loaded, it needs to be built if not.
+bool    LoadAcceleratorCache( Accelerator& accelerator , const std::string& filename , std::uint64_t topology , std::uint64_t geometry , const std::vector<const Primitive*>& primitives , const BBox& bbox , bool& refitted );
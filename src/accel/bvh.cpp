@@ -17,7 +17,9 @@
 
 #include <string.h>
 #include <algorithm>
+#include <functional>
 #include "bvh.h"
+#include "scalar_query.h"
 #include "math/ray.h"
 #include "math/interaction.h"
 #include "scatteringevent/scatteringevent.h"
@@ -46,31 +48,62 @@ void Bvh::Build(const std::vector<const Primitive*>& primitives, const BBox& bbo
 	if (primitives.empty())
 		return;
 
-    m_bvhpri = std::make_unique<Bvh_Primitive[]>(m_primitives->size());
-
     m_bbox = bbox;
 
-    // generate BVH primitives
-    const auto primitive_cnt = m_primitives->size();
-    for (auto i = 0u; i < primitive_cnt; ++i)
-        m_bvhpri[i].SetPrimitive((*m_primitives)[i]);
+    const auto primitive_cnt = (unsigned)m_primitives->size();
+    const auto budget = m_linearBuild ? 0u : (unsigned)( primitive_cnt * m_spatialSplitBudget );
+
+    // leaves may hold more references than primitives if spatial splits are enabled
+    m_bvhpri = make_large_array<Bvh_Primitive>( primitive_cnt + budget );
 
-    // recursively split node
+    // recursively split node, sub-trees are split in parallel
     m_root = std::make_unique<Bvh_Node>();
-    splitNode( m_root.get() , 0u , (unsigned)m_primitives->size() , 1u );
+    if( budget > 0 ){
+        Bvh_References refs( primitive_cnt );
+        setupBvhPrimitives( refs.data() , *m_primitives );
+
+        Bvh_Spatial_Split_Context context( budget , bbox );
+        TaskGroup group;
+        splitNodeSpatial( m_root.get() , refs , 1u , context , group );
+        group.Join();
+
+        m_bvhpriCnt = context.offset;
+        SORT_STATS(sBvhPrimitiveCount=context.offset);
+    }else{
+        // generate BVH primitives
+        setupBvhPrimitives( m_bvhpri.get() , *m_primitives );
+        if( m_linearBuild )
+            m_mortonCodes = sortBvhPrimitivesByMortonCode( m_bvhpri.get() , primitive_cnt );
+
+        TaskGroup group;
+        splitNode( m_root.get() , 0u , primitive_cnt , 1u , group );
+        group.Join();
 
+        std::vector<unsigned>().swap( m_mortonCodes );
+
+        m_bvhpriCnt = primitive_cnt;
+        SORT_STATS(sBvhPrimitiveCount=primitive_cnt);
+    }
+
+    m_buildSahCost = evaluateSahCost();
     m_isValid = true;
+    updateMemory( primitive_cnt + budget );
 
     SORT_STATS(++sBvhNodeCount);
-    SORT_STATS(sBvhPrimitiveCount=primitive_cnt);
 }
 
-void Bvh::splitNode( Bvh_Node* node , unsigned start , unsigned end , unsigned depth ){
+void Bvh::updateMemory( unsigned bvhpri_cnt ){
+    std::function<size_t( const Bvh_Node* )> count_nodes = [&]( const Bvh_Node* node ) -> size_t {
+        return node ? 1 + count_nodes( node->left.get() ) + count_nodes( node->right.get() ) : 0;
+    };
+    m_memory.Set( sizeof(Bvh_Primitive) * bvhpri_cnt + sizeof(Bvh_Node) * count_nodes( m_root.get() ) );
+}
+
+void Bvh::splitNode( Bvh_Node* node , unsigned start , unsigned end , unsigned depth , TaskGroup& group ){
     SORT_STATS(sBVHDepth = std::max( sBVHDepth , (StatsInt)depth ) );
 
     // generate the bounding box for the node
-    for( auto i = start ; i < end ; i++ )
-        node->bbox.Union( m_bvhpri[i].GetBBox() );
+    node->bbox = calcBoundingBox( m_bvhpri.get() , start , end );
 
     auto primitive_num = end - start;
     if( primitive_num <= m_maxPriInLeaf || depth == m_maxNodeDepth ){
@@ -78,19 +111,25 @@ void Bvh::splitNode( Bvh_Node* node , unsigned start , unsigned end , unsigned d
         return;
     }
 
-    // pick best split plane
-    unsigned    split_axis;
-    float       split_pos;
-    const auto sah = pickBestSplit( split_axis , split_pos , m_bvhpri.get() , node->bbox , start , end );
-    if( sah >= primitive_num ){
-        makeLeaf( node , start , end );
-        return;
-    }
+    unsigned mid;
+    if( m_linearBuild ){
+        // primitives are already sorted, the split is where the Morton codes flip their highest differing bit
+        mid = findMortonSplit( m_mortonCodes.data() , start , end );
+    }else{
+        // pick best split plane
+        unsigned    split_axis;
+        float       split_pos;
+        const auto sah = pickBestSplit( split_axis , split_pos , m_bvhpri.get() , node->bbox , start , end , rayDistribution() );
+        if( sah >= primitive_num ){
+            makeLeaf( node , start , end );
+            return;
+        }
 
-    // partition the data
-    auto compare = [split_pos,split_axis](const Bvh_Primitive& pri){return pri.m_centroid[split_axis] < split_pos;};
-    auto middle = std::partition( m_bvhpri.get() + start , m_bvhpri.get() + end, compare );
-    auto mid = (unsigned)(middle - m_bvhpri.get());
+        // partition the data
+        auto compare = [split_pos,split_axis](const Bvh_Primitive& pri){return pri.m_centroid[split_axis] < split_pos;};
+        auto middle = std::partition( m_bvhpri.get() + start , m_bvhpri.get() + end, compare );
+        mid = (unsigned)(middle - m_bvhpri.get());
+    }
 
     // To avoid degenerated node that has nothing in it.
     // Technically, this shouldn't happen. Unlike KD-Tree implementation, there is only 16 split plane candidate, it is
@@ -100,11 +139,53 @@ void Bvh::splitNode( Bvh_Node* node , unsigned start , unsigned end , unsigned d
         return;
     }
 
+    // children own disjoint ranges of primitives, large ones are split in other tasks.
+    const auto split_child = [&]( Bvh_Node* child , unsigned s , unsigned e ){
+        if( e - s > BVH_PARALLEL_BUILD_THRESHOLD )
+            group.Fork( [this, child, s, e, depth, &group](){ splitNode( child , s , e , depth + 1 , group ); } , "Split Bvh Node" );
+        else
+            splitNode( child , s , e , depth + 1 , group );
+    };
+
     node->left = std::make_unique<Bvh_Node>();
-    splitNode( node->left.get() , start , mid , depth + 1 );
+    split_child( node->left.get() , start , mid );
 
     node->right = std::make_unique<Bvh_Node>();
-    splitNode( node->right.get() , mid , end , depth + 1 );
+    split_child( node->right.get() , mid , end );
+
+    SORT_STATS(sBvhNodeCount+=2);
+}
+
+void Bvh::splitNodeSpatial( Bvh_Node* node , Bvh_References& refs , unsigned depth , Bvh_Spatial_Split_Context& context , TaskGroup& group ){
+    SORT_STATS(sBVHDepth = std::max( sBVHDepth , (StatsInt)depth ) );
+
+    // generate the bounding box for the node
+    const auto primitive_num = (unsigned)refs.size();
+    node->bbox = calcBoundingBox( refs.data() , 0 , primitive_num );
+
+    Bvh_References left, right;
+    if( primitive_num <= m_maxPriInLeaf || depth == m_maxNodeDepth || !splitReferences( refs , node->bbox , left , right , context ) ){
+        const auto offset = commitReferences( m_bvhpri.get() , refs , context );
+        makeLeaf( node , offset , offset + primitive_num );
+        return;
+    }
+
+    // references of the node are not needed anymore
+    Bvh_References().swap( refs );
+
+    // children own their references, large ones are split in other tasks.
+    const auto split_child = [&]( Bvh_Node* child , Bvh_References& child_refs ){
+        if( child_refs.size() > BVH_PARALLEL_BUILD_THRESHOLD )
+            group.Fork( [this, child, r = std::move(child_refs), depth, &context, &group]() mutable { splitNodeSpatial( child , r , depth + 1 , context , group ); } , "Split Bvh Node" );
+        else
+            splitNodeSpatial( child , child_refs , depth + 1 , context , group );
+    };
+
+    node->left = std::make_unique<Bvh_Node>();
+    split_child( node->left.get() , left );
+
+    node->right = std::make_unique<Bvh_Node>();
+    split_child( node->right.get() , right );
 
     SORT_STATS(sBvhNodeCount+=2);
 }
@@ -117,6 +198,54 @@ void Bvh::makeLeaf( Bvh_Node* node , unsigned start , unsigned end ){
     SORT_STATS(sBvhMaxPriCountInLeaf = std::max( sBvhMaxPriCountInLeaf , (StatsInt)node->pri_num) );
 }
 
+bool Bvh::Refit(){
+    SORT_PROFILE("Refit Bvh");
+
+    if( !m_isValid || !m_root )
+        return false;
+
+    refitNode( m_root.get() , 1u );
+
+    // the topology is kept no matter how far primitives move, it is not worth tracing rays against a degraded BVH.
+    return evaluateSahCost() <= m_buildSahCost * BVH_REFIT_SAH_DEGRADATION;
+}
+
+void Bvh::refitNode( Bvh_Node* node , unsigned depth ){
+    if( node->pri_num ){
+        node->bbox = refitBvhPrimitives( m_bvhpri.get() , node->pri_offset , node->pri_offset + node->pri_num );
+        return;
+    }
+
+    // both children need to be refitted before their parent
+    if( depth < BVH_PARALLEL_REFIT_DEPTH ){
+        TaskGroup group;
+        group.Fork( [this, node, depth](){ refitNode( node->left.get() , depth + 1 ); } , "Refit Bvh Node" );
+        refitNode( node->right.get() , depth + 1 );
+        group.Join();
+    }else{
+        refitNode( node->left.get() , depth + 1 );
+        refitNode( node->right.get() , depth + 1 );
+    }
+
+    node->bbox = node->left->bbox;
+    node->bbox.Union( node->right->bbox );
+}
+
+float Bvh::evaluateSahCost() const{
+    const auto scene_area = m_bbox.HalfSurfaceArea();
+    if( !m_root || scene_area <= 0.0f )
+        return 0.0f;
+
+    // interior nodes cost one traversal step, leaves cost one intersection test per primitive
+    std::function<float(const Bvh_Node*)> evaluate = [&]( const Bvh_Node* node ){
+        const auto area = node->bbox.HalfSurfaceArea();
+        if( node->pri_num )
+            return area * (float)node->pri_num;
+        return area + evaluate( node->left.get() ) + evaluate( node->right.get() );
+    };
+    return evaluate( m_root.get() ) / scene_area;
+}
+
 bool Bvh::GetIntersect(const Ray& ray, SurfaceInteraction& intersect) const{
     SORT_PROFILE("Traverse Bvh");
     SORT_STATS(++sRayCount);
@@ -131,7 +260,9 @@ bool Bvh::GetIntersect(const Ray& ray, SurfaceInteraction& intersect) const{
     if (fmin < 0.0f)
         return false;
 
-    if( traverseNode(m_root.get(), ray, &intersect, fmin) ){
+    if( traverseNode<Closest_Hit_Query>(m_root.get(), ray, &intersect, fmin) ){
+        // attributes are only evaluated for the nearest hit
+        FinalizeInteraction( ray , intersect );
 #ifdef ENABLE_TRANSPARENT_SHADOW
         return intersect.query_shadow || (IS_PTR_VALID(intersect.primitive));
 #else
@@ -141,7 +272,6 @@ bool Bvh::GetIntersect(const Ray& ray, SurfaceInteraction& intersect) const{
     return false;
 }
 
-#ifndef ENABLE_TRANSPARENT_SHADOW
 bool Bvh::IsOccluded( const Ray& ray ) const{
     SORT_PROFILE("Traverse Bvh");
     SORT_STATS(++sRayCount);
@@ -153,11 +283,15 @@ bool Bvh::IsOccluded( const Ray& ray ) const{
     if (fmin < 0.0f)
         return false;
 
-    return traverseNode(m_root.get(), ray, nullptr, fmin);
+    return traverseNode<Any_Hit_Query>(m_root.get(), ray, nullptr, fmin);
 }
-#endif
 
+template<class Query>
 bool Bvh::traverseNode( const Bvh_Node* node , const Ray& ray , SurfaceInteraction* intersect , float fmin ) const{
+    // occlusion queries never have an intersection to fill, it is known during compilation.
+    if( Query::ANY_HIT )
+        intersect = nullptr;
+
     if( fmin < 0.0f )
         return false;
 
@@ -172,15 +306,14 @@ bool Bvh::traverseNode( const Bvh_Node* node , const Ray& ray , SurfaceInteracti
         auto found = false;
         for(auto i = _start ; i < _end ; i++ ){
             SORT_STATS(++sIntersectionTest);
-            found |= m_bvhpri[i].primitive->GetIntersect( ray , intersect );
+            found |= intersectPrimitive( m_bvhpri[i].primitive , ray , intersect );
             
             // a quick branching out if a shadow ray is hit by an opaque object
-            const auto is_shadow_ray_blocked = isShadowRay( intersect ) && found;
+            const auto is_shadow_ray_blocked = Query::IsShadowRay( intersect ) && found;
             if( is_shadow_ray_blocked ){
 #ifdef ENABLE_TRANSPARENT_SHADOW
-                sAssert(IS_PTR_VALID(intersect->primitive), SPATIAL_ACCELERATOR);
-                sAssert(IS_PTR_VALID(intersect->primitive->GetMaterial()), SPATIAL_ACCELERATOR);
-                if( !intersect->primitive->GetMaterial()->HasTransparency() ){
+                // occlusion queries don't have any intersection to mark
+                if( IS_PTR_VALID(intersect) && !intersect->primitive->HasTransparency() ){
                     // setting primitive to be nullptr and return true at the same time is a special 'code' 
                     // that the above level logic will take advantage of.
                     intersect->primitive = nullptr;
@@ -200,13 +333,13 @@ bool Bvh::traverseNode( const Bvh_Node* node , const Ray& ray , SurfaceInteracti
 
     auto inter = false;
     if( fmin1 > fmin0 ){
-        inter |= traverseNode( left , ray , intersect , fmin0 );
-        if( inter && isShadowRay( intersect ) ) return true;
-        inter |= traverseNode( right , ray , intersect , fmin1 );
+        inter |= traverseNode<Query>( left , ray , intersect , fmin0 );
+        if( inter && Query::IsShadowRay( intersect ) ) return true;
+        inter |= traverseNode<Query>( right , ray , intersect , fmin1 );
     }else{
-        inter |= traverseNode( right , ray , intersect , fmin1 );
-        if( inter && isShadowRay( intersect ) ) return true;
-        inter |= traverseNode( left , ray , intersect , fmin0 );
+        inter |= traverseNode<Query>( right , ray , intersect , fmin1 );
+        if( inter && Query::IsShadowRay( intersect ) ) return true;
+        inter |= traverseNode<Query>( left , ray , intersect , fmin0 );
     }
 
     return inter;
@@ -240,32 +373,16 @@ void Bvh::traverseNode( const Bvh_Node* node , const Ray& ray , BSSRDFIntersecti
 
         SurfaceInteraction intersection;
         for(auto i = _start ; i < _end ; i++ ){
-            if( matID != m_bvhpri[i].primitive->GetMaterial()->GetUniqueID() )
+            if( ( matID != INVALID_SID && matID != m_bvhpri[i].primitive->GetMaterial()->GetUniqueID() ) || intersect.IsRecorded( m_bvhpri[i].primitive ) )
                 continue;
             SORT_STATS(++sIntersectionTest);
         
             intersection.Reset();
-            const auto intersected = m_bvhpri[i].primitive->GetIntersect( ray , &intersection );
+            intersection.t = intersect.maxt;
+            const auto intersected = intersectPrimitive( m_bvhpri[i].primitive , ray , &intersection );
             if( intersected ){
-                if( intersect.cnt < TOTAL_SSS_INTERSECTION_CNT ){
-                    intersect.intersections[intersect.cnt] = SORT_MALLOC(BSSRDFIntersection)();
-                    intersect.intersections[intersect.cnt++]->intersection = intersection;
-                }else{
-                    auto picked_i = -1;
-                    auto t = 0.0f;
-                    for( auto i = 0 ; i < TOTAL_SSS_INTERSECTION_CNT ; ++i ){
-                        if( t < intersect.intersections[i]->intersection.t ){
-                            t = intersect.intersections[i]->intersection.t;
-                            picked_i = i;
-                        }
-                    }
-                    if( picked_i >= 0 )
-                        intersect.intersections[picked_i]->intersection = intersection;
-
-                    intersect.maxt = 0.0f;
-                    for( auto i = 0u ; i < intersect.cnt ; ++i )
-                        intersect.maxt = std::max( intersect.maxt , intersect.intersections[i]->intersection.t );
-                }
+                FinalizeInteraction( ray , intersection );
+                intersect.Add( intersection );
             }
         }
 
@@ -295,6 +412,115 @@ std::unique_ptr<Accelerator> Bvh::Clone() const {
 	auto ret = std::make_unique<Bvh>();
 	ret->m_maxNodeDepth = m_maxNodeDepth;
 	ret->m_maxPriInLeaf = m_maxPriInLeaf;
+	ret->m_spatialSplitBudget = m_spatialSplitBudget;
+	ret->m_linearBuild = m_linearBuild;
 
 	return ret;
-}
\ No newline at end of file
+}
+
+namespace {
+    // Nodes are saved in depth first order, the left child of an interior node is right after it.
+    struct Bvh_Cache_Node {
+        BBox        bbox;               /**< Bounding box of the BVH node. */
+        unsigned    pri_num = 0;        /**< Number of primitives in the BVH node, 0 for interior nodes. */
+        unsigned    pri_offset = 0;     /**< Offset in the primitive buffer. */
+    };
+}
+
+bool Bvh::SaveCache( OStreamBase& stream ) const {
+    SORT_PROFILE("Save Bvh Cache");
+
+    stream << SID("Bvh");
+    stream << m_maxNodeDepth << m_maxPriInLeaf << m_spatialSplitBudget;
+    stream << m_buildSahCost;
+
+    std::vector<Bvh_Cache_Node> nodes;
+    std::function<void(const Bvh_Node*)> flatten = [&]( const Bvh_Node* node ){
+        Bvh_Cache_Node cache_node;
+        cache_node.bbox = node->bbox;
+        cache_node.pri_num = node->pri_num;
+        cache_node.pri_offset = node->pri_offset;
+        nodes.push_back( cache_node );
+
+        if( 0 == node->pri_num ){
+            flatten( node->left.get() );
+            flatten( node->right.get() );
+        }
+    };
+    if( m_root )
+        flatten( m_root.get() );
+
+    stream << (unsigned)nodes.size();
+    stream.Write( (char*)nodes.data() , (int)( sizeof( Bvh_Cache_Node ) * nodes.size() ) );
+
+    saveBvhPrimitives( stream , m_bvhpri.get() , m_bvhpriCnt , *m_primitives );
+    return true;
+}
+
+bool Bvh::LoadCache( IStreamBase& stream , const std::vector<const Primitive*>& primitives , const BBox& bbox ){
+    SORT_PROFILE("Load Bvh Cache");
+
+    StringID    type;
+    unsigned    max_node_depth = 0 , max_pri_in_leaf = 0;
+    float       spatial_split_budget = -1.0f;
+    stream >> type >> max_node_depth >> max_pri_in_leaf >> spatial_split_budget;
+    if( type != SID("Bvh") || max_node_depth != m_maxNodeDepth || max_pri_in_leaf != m_maxPriInLeaf || spatial_split_budget != m_spatialSplitBudget )
+        return false;
+
+    // the cost of the BVH right after its construction is kept, so that degradation doesn't accumulate across refits
+    auto build_sah_cost = 0.0f;
+    stream >> build_sah_cost;
+
+    const auto max_pri_cnt = (unsigned)( primitives.size() * ( 1.0f + m_spatialSplitBudget ) ) + 1;
+
+    auto node_cnt = 0u;
+    stream >> node_cnt;
+    if( node_cnt == 0 || node_cnt > 2 * max_pri_cnt )
+        return false;
+    std::vector<Bvh_Cache_Node> nodes( node_cnt );
+    stream.Load( (char*)nodes.data() , (int)( sizeof( Bvh_Cache_Node ) * node_cnt ) );
+
+    auto pri_cnt = 0u;
+    auto bvhpri = loadBvhPrimitives( stream , pri_cnt , max_pri_cnt , primitives );
+    if( !bvhpri )
+        return false;
+
+    // the tree is rebuilt from the flat array, nothing is trusted in the cached data
+    auto cur = 0u;
+    std::function<bool(Bvh_Node*, unsigned)> unflatten = [&]( Bvh_Node* node , unsigned depth ){
+        if( cur >= node_cnt || depth > m_maxNodeDepth )
+            return false;
+
+        const auto& cache_node = nodes[cur++];
+        node->bbox = cache_node.bbox;
+        if( cache_node.pri_num ){
+            if( cache_node.pri_offset + cache_node.pri_num > pri_cnt || cache_node.pri_offset + cache_node.pri_num < cache_node.pri_offset )
+                return false;
+            makeLeaf( node , cache_node.pri_offset , cache_node.pri_offset + cache_node.pri_num );
+            return true;
+        }
+
+        node->left = std::make_unique<Bvh_Node>();
+        node->right = std::make_unique<Bvh_Node>();
+        SORT_STATS(sBvhNodeCount+=2);
+        SORT_STATS(sBVHDepth = std::max( sBVHDepth , (StatsInt)depth + 1 ) );
+        return unflatten( node->left.get() , depth + 1 ) && unflatten( node->right.get() , depth + 1 );
+    };
+
+    auto root = std::make_unique<Bvh_Node>();
+    if( !unflatten( root.get() , 1u ) || cur != node_cnt )
+        return false;
+
+    m_primitives = &primitives;
+    m_bbox = bbox;
+    m_bvhpri = std::move( bvhpri );
+    m_bvhpriCnt = pri_cnt;
+    m_root = std::move( root );
+    m_buildSahCost = build_sah_cost;
+    m_isValid = true;
+    updateMemory( pri_cnt );
+
+    SORT_STATS(++sBvhNodeCount);
+    SORT_STATS(sBvhPrimitiveCount=pri_cnt);
+    return true;
+}
@@ -51,6 +51,12 @@ class Bvh : public Accelerator{
 public:
     DEFINE_RTTI( Bvh , Accelerator );
 
+    //! @brief Constructor.
+    //!
+    //! @param maxNodeDepth     Maximum depth of node in BVH.
+    //! @param maxPriInLeaf     Maximum primitives in a leaf node.
+    Bvh( unsigned maxNodeDepth = 16 , unsigned maxPriInLeaf = 8 ) : m_maxPriInLeaf(maxPriInLeaf) , m_maxNodeDepth(maxNodeDepth) {}
+
     //! @brief Get intersection between the ray and the primitive set using BVH.
     //!
     //! It will return true if there is intersection between the ray and the primitive set.
@@ -68,7 +74,6 @@ public:
     //!                     it returns false.
     bool    GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const override;
 
-#ifndef ENABLE_TRANSPARENT_SHADOW
     //! @brief This is a dedicated interface for detecting shadow rays.
     //!
     //! Instead of merging the interface with 'GetIntersect', this is a separate interface purely for occlusion detection.
@@ -78,7 +83,6 @@ public:
     //! @param r            The ray to be tested.
     //! @return             Whether the ray is occluded by anything.
     bool IsOccluded( const Ray& r ) const override;
-#endif
 
     //! @brief Get multiple intersections between the ray and the primitive set using spatial data structure.
     //!
@@ -100,6 +104,7 @@ public:
     //! The BVH construction algorithm is in O(N*lg(N)). Please refer to this paper
     //! <a href = "http://www.sci.utah.edu/~wald/Publications/2007/ParallelBVHBuild/fastbuild.pdf">
     //! On fast Construction of SAH - based Bounding Volume Hierarchies< / a> for further details.
+    //! The linear builder splits primitives sorted along a Morton curve instead, spatial splits are disabled then.
     //!
     //! @param primitives       A vector holding all primitives.
     //! @param bbox             The bounding box of the scene.
@@ -112,6 +117,7 @@ public:
     void    Serialize( IStreamBase& stream ) override{
         stream >> m_maxNodeDepth;
         stream >> m_maxPriInLeaf;
+        stream >> m_spatialSplitBudget;
     }
 
 	//! @brief	Clone the accelerator.
@@ -121,15 +127,52 @@ public:
 	//! @return		Cloned accelerator.
 	std::unique_ptr<Accelerator>	Clone() const override;
 
+    //! @brief Save the constructed BVH so that it can be loaded later without being built again.
+    //!
+    //! @param stream           Stream to save the BVH to.
+    //! @return                 It always returns true since BVH supports caching.
+    bool    SaveCache( OStreamBase& stream ) const override;
+
+    //! @brief Load a BVH saved by 'SaveCache' instead of building it.
+    //!
+    //! @param stream           Stream to load the BVH from.
+    //! @param primitives       A vector holding all primitives, it needs to be the same one used to build the cached BVH.
+    //! @param bbox             The bounding box of the scene.
+    //! @return                 Whether the BVH is loaded.
+    bool    LoadCache( IStreamBase& stream , const std::vector<const Primitive*>& primitives , const BBox& bbox ) override;
+
+    //! @brief Refit the BVH to primitives that are moved after it is built or loaded.
+    //!
+    //! Sub-trees are refitted in parallel. The SAH cost of the refitted BVH is compared with the one right after its
+    //! construction, it is not worth keeping if it degrades too much.
+    //!
+    //! @return                 Whether the refitted BVH is still good enough, it needs to be built again if not.
+    bool    Refit() override;
+
 private:
     /**< Primitive list during BVH construction. */
-    std::unique_ptr<Bvh_Primitive[]>        m_bvhpri = nullptr;
+    LargeArray<Bvh_Primitive>               m_bvhpri = nullptr;
+    /**< Number of references to primitives in leaves, it could be more than the number of primitives with spatial splits. */
+    unsigned                                m_bvhpriCnt = 0;
     /**< Root node of the BVH structure. */
     std::unique_ptr<Bvh_Node>               m_root = nullptr;
     /**< Maximum primitives in a leaf node. During BVH construction, a node with less primitives will be marked as a leaf node. */
     unsigned                                m_maxPriInLeaf = 8;
     /**< Maximum depth of node in BVH. */
     unsigned                                m_maxNodeDepth = 16;
+    /**< Maximum number of duplicated references in spatial splits, relative to the number of primitives. Spatial splits are disabled if it is zero. */
+    float                                   m_spatialSplitBudget = 0.0f;
+    /**< SAH cost of the BVH right after its construction, relative to the surface area of the scene. */
+    float                                   m_buildSahCost = 0.0f;
+    /**< Sorted Morton codes of primitives, it only lives during a linear build. */
+    std::vector<unsigned>                   m_mortonCodes;
+    /**< Memory of the BVH accounted in the memory of acceleration structures. */
+    TrackedMemory                           m_memory = TrackedMemory( MemoryCategory::Accelerator );
+
+    //! @brief Account the memory of nodes and primitives in the memory of acceleration structures.
+    //!
+    //! @param bvhpri_cnt   Number of BVH primitives allocated.
+    void    updateMemory( unsigned bvhpri_cnt );
 
     //! @brief Split current BVH node.
     //!
@@ -137,7 +180,17 @@ private:
     //! @param start        The start offset of primitives that the node holds.
     //! @param end          The end offset of primitives that the node holds.
     //! @param depth        The current depth of the node. Starting from 1 for root node.
-    void    splitNode( Bvh_Node* node , unsigned start , unsigned end , unsigned depth );
+    //! @param group        Large children are split in tasks forked in this group.
+    void    splitNode( Bvh_Node* node , unsigned start , unsigned end , unsigned depth , TaskGroup& group );
+
+    //! @brief Split current BVH node with spatial splits taken into account.
+    //!
+    //! @param node         The BVH node to be split.
+    //! @param refs         References to primitives that the node holds.
+    //! @param depth        The current depth of the node. Starting from 1 for root node.
+    //! @param context      The shared states of the construction.
+    //! @param group        Large children are split in tasks forked in this group.
+    void    splitNodeSpatial( Bvh_Node* node , Bvh_References& refs , unsigned depth , Bvh_Spatial_Split_Context& context , TaskGroup& group );
 
     //! @brief Mark the current node as leaf node.
     //!
@@ -146,15 +199,27 @@ private:
     //! @param end          The end offset of primitives that the node holds.
     void    makeLeaf( Bvh_Node* node , unsigned start , unsigned end );
 
+    //! @brief Refit the bounding box of a BVH node and all of its children.
+    //!
+    //! @param node         The root node of the (sub)tree to be refitted.
+    //! @param depth        The current depth of the node. Starting from 1 for root node.
+    void    refitNode( Bvh_Node* node , unsigned depth );
+
+    //! @brief Evaluate the SAH cost of the BVH.
+    //!
+    //! @return             SAH cost of the BVH relative to the surface area of the scene.
+    float   evaluateSahCost() const;
+
     //! @brief A recursive function that traverses the BVH node.
     //!
     //! @param node         The root node of the (sub)tree to be traversed.
     //! @param ray          The ray to be tested.
-    //! @param intersect    The structure holding the intersection information. If empty pointer is passed,
-    //!                     it will return as long as one intersection is found and it won't be necessary to be
+    //! @param intersect    The structure holding the intersection information. It is ignored by occlusion queries,
+    //!                     which return as long as one intersection is found and it won't be necessary to be
     //!                     the nearest one.
     //! @param fmin         The minimum range along the ray.
     //! @return             True if there is intersection, otherwise it will return false.
+    template<class Query>
     bool    traverseNode( const Bvh_Node* node , const Ray& ray , SurfaceInteraction* intersect , float fmin ) const;
 
     //! @brief A recursive helper function that traverse the BVH to find all intersections.
@@ -0,0 +1,336 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <float.h>
+#include <vector>
+#include <memory>
+#include <functional>
+#include "bvh_utils.h"
+
+//! Binary BVHs to be collapsed are not split deeper than this, primitives left in deeper nodes stay in one leaf.
+static constexpr unsigned BVH_BINARY_MAX_DEPTH              = 64;
+//! Number of leaves of a treelet restructured at once, the optimal topology is searched among all subsets of them.
+static constexpr unsigned BVH_TREELET_SIZE                  = 7;
+//! Maximum number of children of a wide node that a binary BVH can be collapsed into.
+static constexpr unsigned BVH_MAX_COLLAPSE_WIDTH            = 16;
+
+struct Bvh_Binary_Node;
+using Bvh_Binary_Node_Ptr = std::unique_ptr<Bvh_Binary_Node>;
+
+//! @brief  Node of an intermediate binary BVH.
+/**
+ * Wide BVHs split top-down are not SAH optimal, a node is filled with whatever its first few binary splits produce. With
+ * the optimized build, a binary BVH is built first and split down to single primitives, its treelets are restructured
+ * and it is collapsed into wide nodes with dynamic programming, which decides which binary nodes are kept as interior
+ * nodes, which are pulled up into their parents and which become leaves.
+ */
+struct Bvh_Binary_Node {
+    BBox                    bbox;               /**< Bounding box of the node. */
+    unsigned                pri_offset = 0;     /**< Offset of the first primitive in the sub-tree. */
+    unsigned                pri_cnt = 0;        /**< Number of primitives in the sub-tree. */
+    float                   cost = 0.0f;        /**< SAH cost of the sub-tree, it is not normalized by the area of the root. */
+    unsigned                index = 0;          /**< Index of the node in the table of collapsing costs. */
+    bool                    collapse_leaf = false;  /**< Whether the node becomes a leaf once collapsed. */
+    unsigned char           collapse_left = 0;  /**< Number of slots of a wide node given to the left child, if the node is an interior node. */
+    Bvh_Binary_Node_Ptr     left;               /**< Left child, it is null for leaves. */
+    Bvh_Binary_Node_Ptr     right;              /**< Right child, it is null for leaves. */
+
+    //! @brief  Whether the node is a leaf of the binary BVH.
+    bool IsLeaf() const {
+        return !left;
+    }
+};
+
+//! @brief  The cheapest way to represent a sub-tree with at most a number of children slots in its wide parent.
+struct Bvh_Collapse_Choice {
+    float           cost = FLT_MAX;     /**< SAH cost of the choice, it is not normalized by the area of the root. */
+    unsigned char   left = 0;           /**< Slots taken by the left sub-tree, zero means the node takes one slot by itself. */
+    unsigned char   right = 0;          /**< Slots taken by the right sub-tree. */
+};
+
+//! @brief  Costs of representing every binary node with 1 to 'width' slots, indexed by 'index * width + slots - 1'.
+using Bvh_Collapse_Table = std::vector<Bvh_Collapse_Choice>;
+
+//! @brief  SAH cost of a leaf of the binary BVH, one intersection test per primitive.
+SORT_FORCEINLINE float binaryLeafCost( const Bvh_Binary_Node* const node ){
+    return node->bbox.HalfSurfaceArea() * (float)node->pri_cnt;
+}
+
+//! @brief  Split a node of the binary BVH recursively with SAH, primitives are split until they can't be separated.
+//!
+//! @param node         The node to be split, its range of primitives needs to be filled.
+//! @param primitives   The buffer holding all primitives.
+//! @param depth        Depth of the node, starting from 1 for the root.
+//! @param group        Large children are split in tasks forked in this group.
+inline void splitBinaryNode( Bvh_Binary_Node* const node , Bvh_Primitive* const primitives , const unsigned depth , TaskGroup& group ){
+    const auto start = node->pri_offset;
+    const auto end = start + node->pri_cnt;
+    node->bbox = calcBoundingBox( primitives , start , end );
+    if( node->pri_cnt <= 1 || depth == BVH_BINARY_MAX_DEPTH )
+        return;
+
+    unsigned    split_axis;
+    float       split_pos;
+    if( FLT_MAX == pickBestSplit( split_axis , split_pos , primitives , node->bbox , start , end ) )
+        return;
+
+    const auto compare = [split_pos, split_axis](const Bvh_Primitive& pri) {return pri.m_centroid[split_axis] < split_pos; };
+    const auto mid = (unsigned)( std::partition( primitives + start , primitives + end , compare ) - primitives );
+    if( mid == start || mid == end )
+        return;
+
+    node->left = std::make_unique<Bvh_Binary_Node>();
+    node->left->pri_offset = start;
+    node->left->pri_cnt = mid - start;
+    node->right = std::make_unique<Bvh_Binary_Node>();
+    node->right->pri_offset = mid;
+    node->right->pri_cnt = end - mid;
+
+    for( auto child : { node->left.get() , node->right.get() } ){
+        if( child->pri_cnt > BVH_PARALLEL_BUILD_THRESHOLD )
+            group.Fork( [=, &group](){ splitBinaryNode( child , primitives , depth + 1 , group ); } , "Split Binary Bvh Node" );
+        else
+            splitBinaryNode( child , primitives , depth + 1 , group );
+    }
+}
+
+//! @brief  Restructure the treelet rooted at a node into the topology with the lowest SAH cost.
+/**
+ * The treelet is grown from the node by expanding its largest leaf until it has BVH_TREELET_SIZE leaves, the optimal binary
+ * tree over these leaves is found by dynamic programming over all subsets of them, as proposed in 'Fast Parallel Construction
+ * of High-Quality Bounding Volume Hierarchies' by Karras and Aila. SAH costs of the sub-trees below the treelet leaves need
+ * to be evaluated already, the cost of the node itself is filled afterward.
+ *
+ * @param node          The root of the treelet.
+ */
+inline void restructureTreelet( Bvh_Binary_Node* const node ){
+    if( node->IsLeaf() ){
+        node->cost = binaryLeafCost( node );
+        return;
+    }
+
+    // interior nodes inside the treelet are detached and reused for the new topology
+    Bvh_Binary_Node_Ptr leaves[BVH_TREELET_SIZE];
+    Bvh_Binary_Node_Ptr spares[BVH_TREELET_SIZE - 2];
+    auto leaf_cnt = 2u , spare_cnt = 0u;
+    leaves[0] = std::move( node->left );
+    leaves[1] = std::move( node->right );
+    while( leaf_cnt < BVH_TREELET_SIZE ){
+        auto largest = leaf_cnt;
+        auto largest_area = -1.0f;
+        for( auto i = 0u ; i < leaf_cnt ; ++i ){
+            const auto area = leaves[i]->bbox.HalfSurfaceArea();
+            if( !leaves[i]->IsLeaf() && area > largest_area ){
+                largest = i;
+                largest_area = area;
+            }
+        }
+        if( largest == leaf_cnt )
+            break;
+
+        auto inner = std::move( leaves[largest] );
+        leaves[largest] = std::move( inner->left );
+        leaves[leaf_cnt++] = std::move( inner->right );
+        spares[spare_cnt++] = std::move( inner );
+    }
+
+    // the optimal cost of every subset of leaves, subsets are always visited after all of their proper subsets
+    const auto full = ( 1u << leaf_cnt ) - 1;
+    BBox        bbox[1u << BVH_TREELET_SIZE];
+    float       cost[1u << BVH_TREELET_SIZE];
+    unsigned    count[1u << BVH_TREELET_SIZE];
+    unsigned    split[1u << BVH_TREELET_SIZE];
+    for( auto mask = 1u ; mask <= full ; ++mask ){
+        const auto lowest = mask & ( 0u - mask );
+        if( mask == lowest ){
+            const auto& leaf = leaves[__builtin_ctz( mask )];
+            bbox[mask] = leaf->bbox;
+            cost[mask] = leaf->cost;
+            count[mask] = leaf->pri_cnt;
+            continue;
+        }
+
+        bbox[mask] = Union( bbox[mask ^ lowest] , bbox[lowest] );
+        count[mask] = count[mask ^ lowest] + count[lowest];
+
+        // each partition is only visited once by keeping the lowest leaf on the left side
+        auto best = FLT_MAX;
+        for( auto sub = ( mask - 1 ) & mask ; sub ; sub = ( sub - 1 ) & mask ){
+            if( 0 == ( sub & lowest ) )
+                continue;
+            const auto c = cost[sub] + cost[mask ^ sub];
+            if( c < best ){
+                best = c;
+                split[mask] = sub;
+            }
+        }
+        cost[mask] = bbox[mask].HalfSurfaceArea() + best;
+    }
+
+    std::function<void(Bvh_Binary_Node*, unsigned)> assemble = [&]( Bvh_Binary_Node* const inner , const unsigned mask ){
+        inner->bbox = bbox[mask];
+        inner->cost = cost[mask];
+        inner->pri_cnt = count[mask];
+        const auto make_child = [&]( const unsigned sub ){
+            if( sub == ( sub & ( 0u - sub ) ) )
+                return std::move( leaves[__builtin_ctz( sub )] );
+            auto child = std::move( spares[--spare_cnt] );
+            assemble( child.get() , sub );
+            return child;
+        };
+        inner->left = make_child( split[mask] );
+        inner->right = make_child( mask ^ split[mask] );
+    };
+    assemble( node , full );
+}
+
+//! @brief  Restructure treelets of a binary BVH bottom-up, sub-trees are restructured in parallel.
+//!
+//! @param node         The root of the (sub)tree to be restructured.
+inline void restructureBinaryBvh( Bvh_Binary_Node* const node ){
+    if( !node->IsLeaf() ){
+        if( node->pri_cnt > BVH_PARALLEL_BUILD_THRESHOLD ){
+            TaskGroup group;
+            const auto left = node->left.get();
+            group.Fork( [left](){ restructureBinaryBvh( left ); } , "Restructure Treelets" );
+            restructureBinaryBvh( node->right.get() );
+            group.Join();
+        }else{
+            restructureBinaryBvh( node->left.get() );
+            restructureBinaryBvh( node->right.get() );
+        }
+    }
+    restructureTreelet( node );
+}
+
+//! @brief  Reorder primitives so that every sub-tree of a restructured binary BVH holds a contiguous range of them.
+//!
+//! Nodes are indexed in depth first order at the same time.
+//!
+//! @param root         The root of the binary BVH.
+//! @param primitives   The buffer holding all primitives.
+//! @param cnt          Number of primitives in the buffer.
+//! @return             Number of nodes in the binary BVH.
+inline unsigned reorderBinaryBvh( Bvh_Binary_Node* const root , Bvh_Primitive* const primitives , const unsigned cnt ){
+    auto reordered = make_large_array<Bvh_Primitive>( cnt );
+    auto offset = 0u , index = 0u;
+    std::function<void(Bvh_Binary_Node*)> reorder = [&]( Bvh_Binary_Node* const node ){
+        node->index = index++;
+        if( node->IsLeaf() ){
+            std::copy( primitives + node->pri_offset , primitives + node->pri_offset + node->pri_cnt , reordered.get() + offset );
+            node->pri_offset = offset;
+            offset += node->pri_cnt;
+            return;
+        }
+        reorder( node->left.get() );
+        reorder( node->right.get() );
+        node->pri_offset = node->left->pri_offset;
+    };
+    reorder( root );
+    std::copy( reordered.get() , reordered.get() + cnt , primitives );
+    return index;
+}
+
+//! @brief  Evaluate the cheapest way to collapse every sub-tree of a binary BVH into wide nodes.
+/**
+ * A node either takes one slot of its wide parent, as a leaf or as a wide interior node, or gives its slots to its own
+ * children so that they are pulled up into the parent. This is the dynamic programming proposed in 'Efficient Incoherent
+ * Ray Traversal on GPUs Through Compressed Wide BVHs' by Ylitie et al. Sub-trees are evaluated in parallel.
+ *
+ * @param node          The root of the (sub)tree to be evaluated.
+ * @param table         Collapsing costs of all nodes, they need to be indexed already.
+ * @param width         Maximum number of children of wide nodes.
+ * @param maxPriInLeaf  Maximum number of primitives in a leaf of the wide BVH.
+ */
+inline void evaluateCollapseCost( Bvh_Binary_Node* const node , Bvh_Collapse_Table& table , const unsigned width , const unsigned maxPriInLeaf ){
+    auto* const choices = table.data() + (std::size_t)node->index * width;
+    if( node->IsLeaf() ){
+        // leaves that can't be split any further are kept no matter how many primitives they have
+        node->collapse_leaf = true;
+        for( auto i = 0u ; i < width ; ++i )
+            choices[i].cost = binaryLeafCost( node );
+        return;
+    }
+
+    if( node->pri_cnt > BVH_PARALLEL_BUILD_THRESHOLD ){
+        TaskGroup group;
+        const auto left = node->left.get();
+        group.Fork( [left, &table, width, maxPriInLeaf](){ evaluateCollapseCost( left , table , width , maxPriInLeaf ); } , "Evaluate Collapse Cost" );
+        evaluateCollapseCost( node->right.get() , table , width , maxPriInLeaf );
+        group.Join();
+    }else{
+        evaluateCollapseCost( node->left.get() , table , width , maxPriInLeaf );
+        evaluateCollapseCost( node->right.get() , table , width , maxPriInLeaf );
+    }
+
+    const auto* const left = table.data() + (std::size_t)node->left->index * width;
+    const auto* const right = table.data() + (std::size_t)node->right->index * width;
+
+    // the cheapest distribution of 'slots' children slots among the two children
+    const auto distribute = [&]( const unsigned slots , unsigned& left_slots ){
+        auto best = FLT_MAX;
+        for( auto k = 1u ; k < slots ; ++k ){
+            const auto c = left[k - 1].cost + right[slots - k - 1].cost;
+            if( c < best ){
+                best = c;
+                left_slots = k;
+            }
+        }
+        return best;
+    };
+
+    // taking one slot by itself, as a leaf or as a wide interior node whose children are the distributed sub-trees
+    unsigned wide_left = 1;
+    const auto interior_cost = node->bbox.HalfSurfaceArea() + distribute( width , wide_left );
+    const auto leaf_cost = node->pri_cnt <= maxPriInLeaf ? binaryLeafCost( node ) : FLT_MAX;
+    node->collapse_leaf = leaf_cost <= interior_cost;
+    node->collapse_left = (unsigned char)wide_left;
+    choices[0].cost = std::min( leaf_cost , interior_cost );
+
+    // more slots in the parent allow the node to be pulled up, its children take the slots instead
+    for( auto i = 1u ; i < width ; ++i ){
+        unsigned left_slots = 1;
+        const auto c = distribute( i + 1 , left_slots );
+        if( c < choices[i - 1].cost ){
+            choices[i].cost = c;
+            choices[i].left = (unsigned char)left_slots;
+            choices[i].right = (unsigned char)( i + 1 - left_slots );
+        }else{
+            choices[i] = choices[i - 1];
+        }
+    }
+}
+
+//! @brief  Gather the binary nodes filling the children slots of a wide node, following the choices of the collapse.
+//!
+//! @param node         The binary node given a number of slots.
+//! @param slots        Number of slots given to the node.
+//! @param table        Collapsing costs of all nodes.
+//! @param width        Maximum number of children of wide nodes.
+//! @param children     The binary nodes taking one slot each are appended to it.
+//! @param cnt          Number of binary nodes in 'children'.
+inline void gatherCollapsedChildren( Bvh_Binary_Node* const node , const unsigned slots , const Bvh_Collapse_Table& table , const unsigned width , Bvh_Binary_Node** children , unsigned& cnt ){
+    const auto& choice = table[(std::size_t)node->index * width + slots - 1];
+    if( node->IsLeaf() || 0 == choice.left ){
+        children[cnt++] = node;
+        return;
+    }
+    gatherCollapsedChildren( node->left.get() , choice.left , table , width , children , cnt );
+    gatherCollapsedChildren( node->right.get() , choice.right , table , width , children , cnt );
+}
@@ -18,9 +18,27 @@
 #pragma once
 
 #include <string.h>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
 #include "core/define.h"
+#include "core/memory.h"
 #include "math/point.h"
 #include "math/bbox.h"
+#include "task/task.h"
+#include "accel/accelerator.h"
+
+//! Nodes with more primitives than this are split in forked tasks during BVH construction.
+static constexpr unsigned BVH_PARALLEL_BUILD_THRESHOLD      = 16 * 1024;
+//! Bounding boxes and bins of nodes with more primitives than this are evaluated in parallel, it is also the size of each chunk.
+static constexpr unsigned BVH_PARALLEL_REDUCTION_THRESHOLD  = 128 * 1024;
+//! Sub-trees of nodes shallower than this are refitted in forked tasks, it is the depth in a binary BVH.
+static constexpr unsigned BVH_PARALLEL_REFIT_DEPTH          = 6;
+//! A refitted BVH is built again if its SAH cost grows by more than this ratio relative to the one right after construction.
+static constexpr float    BVH_REFIT_SAH_DEGRADATION         = 1.5f;
 
 class Primitive;
 
@@ -28,23 +46,247 @@ class Primitive;
 struct Bvh_Primitive {
     const Primitive*    primitive;              /**< Primitive lists for this node. */
     Point               m_centroid;             /**< Center point of the BVH node. */
+    BBox                m_bbox;                 /**< Bounding box of the primitive, it only covers part of the primitive if it is clipped by spatial splits. */
 
     //! @brief Set primitive.
     //!
     //! @param p    Primitive list holding all primitives in the node.
     void SetPrimitive(const Primitive* p){
+        SetReference( p , p->GetBBox() );
+    }
+
+    //! @brief Set a reference to part of a primitive.
+    //!
+    //! @param p    The referenced primitive.
+    //! @param bbox The bounding box of the referenced part of the primitive.
+    void SetReference(const Primitive* p, const BBox& bbox){
         primitive = p;
-        m_centroid = (p->GetBBox().m_Max + p->GetBBox().m_Min) * 0.5f;
+        m_bbox = bbox;
+        m_centroid = (bbox.m_Max + bbox.m_Min) * 0.5f;
     }
 
     //! Get bounding box of this primitive set.
     //!
     //! @return     Axis-Aligned bounding box holding all the primitives.
     const BBox& GetBBox() const {
-        return primitive->GetBBox();
+        return m_bbox;
     }
 };
 
+//! @brief References to primitives of a node during the construction of BVH with spatial splits.
+using Bvh_References = std::vector<Bvh_Primitive>;
+
+//! Number of bins evaluated for spatial splits.
+static constexpr unsigned   BVH_SPATIAL_SPLIT_BIN_COUNT     = 16;
+//! Spatial splits are only evaluated if children of the best object split overlap more than this fraction of the surface area of the root.
+static constexpr float      BVH_SPATIAL_SPLIT_OVERLAP_RATIO = 1e-5f;
+
+//! @brief Shared states of a BVH construction with spatial splits.
+/**
+ * Spatial Splits in Bounding Volume Hierarchies
+ * https://www.nvidia.com/docs/IO/77714/sbvh.pdf
+ *
+ * Instead of only partitioning primitives, a spatial split clips primitives straddling the split plane, references to the
+ * same primitive end up in both children. The number of duplicated references is limited by a budget, once it is used up,
+ * only object splits are allowed. Leaves of the whole tree are committed to one buffer, which is allocated with the budget
+ * taken into account.
+ */
+struct Bvh_Spatial_Split_Context{
+    std::atomic<int>        budget;         /**< Number of references that can still be duplicated. */
+    std::atomic<unsigned>   offset;         /**< Number of references committed to leaves so far. */
+    float                   root_area;      /**< Half surface area of the root node. */
+
+    //! @brief Constructor.
+    //!
+    //! @param budget       Maximum number of duplicated references.
+    //! @param root_bbox    Bounding box of the root node.
+    Bvh_Spatial_Split_Context( unsigned budget , const BBox& root_bbox ) : budget( (int)budget ) , offset( 0 ) , root_area( root_bbox.HalfSurfaceArea() ) {}
+};
+
+//! @brief Evaluate the bounding box of a range of primitives, large ranges are evaluated in parallel.
+//!
+//! @param primitives   The buffer hold all primitives.
+//! @param start        The start offset of the primitives.
+//! @param end          The end offset of the primitives.
+//! @return             Axis-Aligned bounding box holding all the primitives in the range.
+SORT_FORCEINLINE BBox calcBoundingBox( const Bvh_Primitive* const primitives , const unsigned start , const unsigned end ){
+    BBox ret;
+    if( end - start <= BVH_PARALLEL_REDUCTION_THRESHOLD ){
+        for( auto i = start ; i < end ; i++ )
+            ret.Union( primitives[i].GetBBox() );
+        return ret;
+    }
+
+    std::vector<BBox> chunk_bbox( ( end - start + BVH_PARALLEL_REDUCTION_THRESHOLD - 1 ) / BVH_PARALLEL_REDUCTION_THRESHOLD );
+    ParallelFor( start , end , BVH_PARALLEL_REDUCTION_THRESHOLD , [&]( unsigned s , unsigned e ){
+        auto& chunk = chunk_bbox[( s - start ) / BVH_PARALLEL_REDUCTION_THRESHOLD];
+        for( auto i = s ; i < e ; i++ )
+            chunk.Union( primitives[i].GetBBox() );
+    } );
+    for( const auto& chunk : chunk_bbox )
+        ret.Union( chunk );
+    return ret;
+}
+
+//! @brief Refresh the bounding boxes of a range of BVH primitives from the primitives they refer to.
+//!
+//! Clipped references of spatial splits are replaced with the whole bounding boxes of their primitives, which is
+//! conservative since they may be moved anywhere.
+//!
+//! @param primitives   The buffer hold all primitives.
+//! @param start        The start offset of the primitives.
+//! @param end          The end offset of the primitives.
+//! @return             Axis-Aligned bounding box holding all the refreshed primitives in the range.
+SORT_FORCEINLINE BBox refitBvhPrimitives( Bvh_Primitive* const primitives , const unsigned start , const unsigned end ){
+    for( auto i = start ; i < end ; i++ )
+        primitives[i].SetPrimitive( primitives[i].primitive );
+    return calcBoundingBox( primitives , start , end );
+}
+
+//! @brief Setup BVH primitives from primitives, it is done in parallel.
+//!
+//! @param bvhPrimitives    The BVH primitives to be setup.
+//! @param primitives       All primitives in the scene.
+SORT_FORCEINLINE void setupBvhPrimitives( Bvh_Primitive* const bvhPrimitives , const std::vector<const Primitive*>& primitives ){
+    ParallelFor( 0u , (unsigned)primitives.size() , BVH_PARALLEL_REDUCTION_THRESHOLD , [&]( unsigned s , unsigned e ){
+        for( auto i = s ; i < e ; ++i )
+            bvhPrimitives[i].SetPrimitive( primitives[i] );
+    } );
+}
+
+//! Number of bits of each axis in Morton codes of linear BVH builds, three of them fit in 32 bits.
+static constexpr unsigned BVH_MORTON_BITS_PER_AXIS          = 10;
+//! Number of bits sorted in each pass of the radix sort of Morton codes.
+static constexpr unsigned BVH_RADIX_BITS                    = 8;
+
+//! @brief Insert two zero bits between each of the lower ten bits of a value.
+//!
+//! @param v            The value to be expanded, only the lower ten bits are taken.
+//! @return             The expanded value, which takes 30 bits.
+SORT_FORCEINLINE unsigned expandMortonBits( unsigned v ){
+    v = ( v * 0x00010001u ) & 0xFF0000FFu;
+    v = ( v * 0x00000101u ) & 0x0F00F00Fu;
+    v = ( v * 0x00000011u ) & 0xC30C30C3u;
+    v = ( v * 0x00000005u ) & 0x49249249u;
+    return v;
+}
+
+//! @brief Sort BVH primitives along a Morton curve through their centroids, it is the first step of a linear BVH build.
+/**
+ * Fast BVH Construction on GPUs
+ * http://luebke.us/publications/eg09.pdf
+ *
+ * Maximizing Parallelism in the Construction of BVHs, Octrees, and k-d Trees
+ * https://research.nvidia.com/sites/default/files/pubs/2012-06_Maximizing-Parallelism-in/karras2012hpg_paper.pdf
+ *
+ * Centroids are quantized in their bounding box and the bits of the three axes are interleaved. Codes are evaluated in
+ * parallel and sorted by a parallel radix sort, each chunk of primitives counts and scatters its own digits. Once sorted,
+ * primitives close in space are close in the buffer, the hierarchy is emitted by 'findMortonSplit' without any partition.
+ *
+ * @param primitives    The BVH primitives to be sorted, they are reordered in place.
+ * @param cnt           Number of BVH primitives.
+ * @return              The sorted Morton codes, the i-th one is the code of the i-th primitive after sorting.
+ */
+inline std::vector<unsigned> sortBvhPrimitivesByMortonCode( Bvh_Primitive* const primitives , const unsigned cnt ){
+    static constexpr unsigned BUCKET_CNT = 1u << BVH_RADIX_BITS;
+    static constexpr unsigned CODE_BITS = 3 * BVH_MORTON_BITS_PER_AXIS;
+
+    const auto grain = BVH_PARALLEL_REDUCTION_THRESHOLD;
+    const auto chunk_cnt = ( cnt + grain - 1 ) / grain;
+
+    // the codes are quantized in the bounding box of centroids, which is tighter than the one of primitives
+    std::vector<BBox> chunk_bbox( chunk_cnt );
+    ParallelFor( 0u , cnt , grain , [&]( unsigned s , unsigned e ){
+        auto& chunk = chunk_bbox[s / grain];
+        for( auto i = s ; i < e ; ++i )
+            chunk.Union( primitives[i].m_centroid );
+    } );
+    BBox centroid_bbox;
+    for( const auto& chunk : chunk_bbox )
+        centroid_bbox.Union( chunk );
+
+    // a code is in the upper half of a key, the index of the primitive in the lower half rides along with it
+    const auto scale = (float)( ( 1u << BVH_MORTON_BITS_PER_AXIS ) - 1 );
+    Vector inv_extent;
+    for( auto k = 0 ; k < 3 ; ++k )
+        inv_extent[k] = centroid_bbox.Delta( k ) > 0.0f ? scale / centroid_bbox.Delta( k ) : 0.0f;
+
+    std::vector<std::uint64_t> keys( cnt ) , swap( cnt );
+    ParallelFor( 0u , cnt , grain , [&]( unsigned s , unsigned e ){
+        for( auto i = s ; i < e ; ++i ){
+            const auto p = primitives[i].m_centroid - centroid_bbox.m_Min;
+            const auto quantize = [&]( int k ){ return expandMortonBits( std::min( (unsigned)( p[k] * inv_extent[k] ) , ( 1u << BVH_MORTON_BITS_PER_AXIS ) - 1 ) ); };
+            const auto x = quantize( 0 );
+            const auto y = quantize( 1 );
+            const auto z = quantize( 2 );
+            keys[i] = ( (std::uint64_t)( ( x << 2 ) | ( y << 1 ) | z ) << 32 ) | i;
+        }
+    } );
+
+    // least significant digit first, each pass is stable so that the order of lower digits is kept
+    std::vector<unsigned> histogram( chunk_cnt * BUCKET_CNT );
+    for( auto shift = 32u ; shift < 32u + CODE_BITS ; shift += BVH_RADIX_BITS ){
+        std::fill( histogram.begin() , histogram.end() , 0u );
+        ParallelFor( 0u , cnt , grain , [&]( unsigned s , unsigned e ){
+            auto* bucket = histogram.data() + ( s / grain ) * BUCKET_CNT;
+            for( auto i = s ; i < e ; ++i )
+                ++bucket[( keys[i] >> shift ) & ( BUCKET_CNT - 1 )];
+        } );
+
+        // keys of a digit are placed after all smaller digits and, within the same digit, after all previous chunks
+        auto offset = 0u;
+        for( auto d = 0u ; d < BUCKET_CNT ; ++d ){
+            for( auto c = 0u ; c < chunk_cnt ; ++c ){
+                const auto n = histogram[c * BUCKET_CNT + d];
+                histogram[c * BUCKET_CNT + d] = offset;
+                offset += n;
+            }
+        }
+
+        ParallelFor( 0u , cnt , grain , [&]( unsigned s , unsigned e ){
+            auto* bucket = histogram.data() + ( s / grain ) * BUCKET_CNT;
+            for( auto i = s ; i < e ; ++i )
+                swap[bucket[( keys[i] >> shift ) & ( BUCKET_CNT - 1 )]++] = keys[i];
+        } );
+        keys.swap( swap );
+    }
+
+    // gather the primitives in the sorted order
+    std::vector<Bvh_Primitive> sorted( cnt );
+    std::vector<unsigned> codes( cnt );
+    ParallelFor( 0u , cnt , grain , [&]( unsigned s , unsigned e ){
+        for( auto i = s ; i < e ; ++i ){
+            sorted[i] = primitives[keys[i] & 0xFFFFFFFFu];
+            codes[i] = (unsigned)( keys[i] >> 32 );
+        }
+    } );
+    ParallelFor( 0u , cnt , grain , [&]( unsigned s , unsigned e ){
+        std::copy( sorted.begin() + s , sorted.begin() + e , primitives + s );
+    } );
+    return codes;
+}
+
+//! @brief Find where a range of primitives sorted by Morton codes is split in a linear BVH build.
+//!
+//! The range is split where the highest bit differing between its first and last codes flips, which is the same split
+//! as the one of the radix tree of Karras. Ranges of identical codes are split in the middle.
+//!
+//! @param codes        The sorted Morton codes of all primitives.
+//! @param start        The start offset of the primitives in the range.
+//! @param end          The end offset of the primitives in the range.
+//! @return             The offset of the first primitive of the right child, it is always inside (start, end).
+SORT_FORCEINLINE unsigned findMortonSplit( const unsigned* const codes , const unsigned start , const unsigned end ){
+    auto diff = codes[start] ^ codes[end - 1];
+    if( 0 == diff )
+        return ( start + end ) >> 1;
+
+    // keep only the highest differing bit, codes in the range share all bits above it
+    while( diff & ( diff - 1 ) )
+        diff &= diff - 1;
+    const auto split = std::partition_point( codes + start , codes + end , [diff]( unsigned code ){ return 0 == ( code & diff ); } );
+    return (unsigned)( split - codes );
+}
+
 //! @brief Evaluate the SAH value of a specific splitting.
 //!
 //! @param left         The number of primitives in the left node to be split.
@@ -57,6 +299,66 @@ SORT_FORCEINLINE float sah( unsigned left , unsigned right , const BBox& lbox ,
     return (left * lbox.HalfSurfaceArea() + right * rbox.HalfSurfaceArea()) / box.HalfSurfaceArea();
 }
 
+//! @brief Whether a bounding box is valid, clipped bounding boxes are inverted if nothing is left.
+SORT_FORCEINLINE bool isValidBBox( const BBox& bbox ){
+    return bbox.m_Min.x <= bbox.m_Max.x && bbox.m_Min.y <= bbox.m_Max.y && bbox.m_Min.z <= bbox.m_Max.z;
+}
+
+//! @brief Estimate the portion of camera rays hitting a bounding box.
+//!
+//! The box is bounded by a sphere, the ratio of the solid angle it covers to the one of the cone of camera rays is taken.
+//! Partial overlaps with the cone are not clipped, it only needs to rank boxes against each other.
+//!
+//! @param rays         The distribution of camera rays.
+//! @param box          The bounding box.
+//! @return             The estimated portion of camera rays hitting the box, it is between zero and one.
+SORT_FORCEINLINE float cameraRayPortion( const RayDistribution& rays , const BBox& box ){
+    if( !isValidBBox( box ) )
+        return 0.0f;
+
+    const auto center = ( box.m_Min + box.m_Max ) * 0.5f;
+    const auto sqr_radius = ( box.m_Max - center ).SquaredLength();
+    const auto to_center = center - rays.origin;
+    const auto sqr_dist = to_center.SquaredLength();
+    if( sqr_dist <= sqr_radius )
+        return 1.0f;
+
+    // the angle between the cone axis and the center, minus the angular radius of the sphere, has to be inside the cone
+    const auto dist = sqrt( sqr_dist );
+    const auto cos_theta = dot( to_center , rays.dir ) / dist;
+    const auto cos_beta = sqrt( 1.0f - sqr_radius / sqr_dist );
+    const auto sin_theta = sqrt( std::max( 0.0f , 1.0f - cos_theta * cos_theta ) );
+    const auto sin_beta = sqrt( sqr_radius / sqr_dist );
+    const auto cos_nearest = cos_theta * cos_beta + sin_theta * sin_beta;
+    if( cos_theta < cos_beta && cos_nearest < rays.cosHalfAngle )
+        return 0.0f;
+
+    return std::min( 1.0f , ( 1.0f - cos_beta ) / std::max( 1.0f - rays.cosHalfAngle , 1e-6f ) );
+}
+
+//! @brief Evaluate the SAH value of a specific splitting, with the cost weighted by the distribution of camera rays.
+//!
+//! Each child is visited by uniform rays with the probability proportional to its surface area and by camera rays with
+//! the portion of them hitting it. The result is normalized the same way as plain SAH, it falls back to plain SAH for
+//! nodes out of view.
+//!
+//! @param left         The number of primitives in the left node to be split.
+//! @param right        The number of primitives in the right node to be split.
+//! @param lbox         Bounding box of the left node to be split.
+//! @param rbox         Bounding box of the right node to be split.
+//! @param box          Bounding box of the current node.
+//! @param box_portion  Portion of camera rays hitting the current node.
+//! @param rays         The distribution of camera rays.
+//! @return             SAH value of the specific split plane.
+SORT_FORCEINLINE float sah( unsigned left , unsigned right , const BBox& lbox , const BBox& rbox , const BBox& box , float box_portion , const RayDistribution& rays ){
+    const auto uniform = sah( left , right , lbox , rbox , box );
+    if( box_portion <= 0.0f )
+        return uniform;
+    const auto lp = std::min( 1.0f , cameraRayPortion( rays , lbox ) / box_portion );
+    const auto rp = std::min( 1.0f , cameraRayPortion( rays , rbox ) / box_portion );
+    return ( uniform + rays.weight * ( left * lp + right * rp ) ) / ( 1.0f + rays.weight );
+}
+
 //! @brief Pick the best split among all possible splits.
 //!
 //! @param axis         The selected axis id of the picked split plane.
@@ -65,14 +367,30 @@ SORT_FORCEINLINE float sah( unsigned left , unsigned right , const BBox& lbox ,
 //! @param node         The node to be split.
 //! @param start        The start offset of primitives that the node holds.
 //! @param end          The end offset of primitives that the node holds.
+//! @param rays         The distribution of camera rays weighting SAH, nullptr for plain SAH.
 //! @return             The SAH value of the selected best split plane.
-SORT_FORCEINLINE float pickBestSplit( unsigned& axis , float& splitPos , const Bvh_Primitive* const primitives , const BBox& node_bbox , const unsigned start , const unsigned end ){
+SORT_FORCEINLINE float pickBestSplit( unsigned& axis , float& splitPos , const Bvh_Primitive* const primitives , const BBox& node_bbox , const unsigned start , const unsigned end , const RayDistribution* rays = nullptr ){
     static constexpr unsigned   BVH_SPLIT_COUNT         = 16;
     static constexpr float      BVH_INV_SPLIT_COUNT     = 1.0f / (float)BVH_SPLIT_COUNT;
 
+    // Nodes close to the root hold most of the primitives, evaluating them in a single thread would serialize the build.
+    const auto parallel = end - start > BVH_PARALLEL_REDUCTION_THRESHOLD;
+    const auto chunk_cnt = ( end - start + BVH_PARALLEL_REDUCTION_THRESHOLD - 1 ) / BVH_PARALLEL_REDUCTION_THRESHOLD;
+
     BBox inner;
-    for(auto i = start ; i < end ; i++ )
-        inner.Union( primitives[i].m_centroid );
+    if( parallel ){
+        std::vector<BBox> chunk_inner( chunk_cnt );
+        ParallelFor( start , end , BVH_PARALLEL_REDUCTION_THRESHOLD , [&]( unsigned s , unsigned e ){
+            auto& chunk = chunk_inner[( s - start ) / BVH_PARALLEL_REDUCTION_THRESHOLD];
+            for( auto i = s ; i < e ; i++ )
+                chunk.Union( primitives[i].m_centroid );
+        } );
+        for( const auto& chunk : chunk_inner )
+            inner.Union( chunk );
+    }else{
+        for(auto i = start ; i < end ; i++ )
+            inner.Union( primitives[i].m_centroid );
+    }
 
     auto primitive_num = end - start;
     axis = inner.MaxAxisId();
@@ -88,22 +406,46 @@ SORT_FORCEINLINE float pickBestSplit( unsigned& axis , float& splitPos , const B
     if( split_delta == 0.0f )
         return FLT_MAX;
     auto inv_split_delta = 1.0f / split_delta;
-    for(auto i = start ; i < end ; i++ ){
-        auto index = (int)((primitives[i].m_centroid[axis] - split_start) * inv_split_delta);
-        index = std::min( index , (int)(BVH_SPLIT_COUNT - 1) );
-        ++bin[index];
-        bbox[index].Union( primitives[i].GetBBox() );
+    const auto binning = [&]( unsigned s , unsigned e , unsigned* bin , BBox* bbox ){
+        for(auto i = s ; i < e ; i++ ){
+            auto index = (int)((primitives[i].m_centroid[axis] - split_start) * inv_split_delta);
+            index = std::min( index , (int)(BVH_SPLIT_COUNT - 1) );
+            ++bin[index];
+            bbox[index].Union( primitives[i].GetBBox() );
+        }
+    };
+    if( parallel ){
+        // each chunk has its own bins, they are merged afterward, the result is exactly the same as the serial one.
+        struct Bins{
+            unsigned    bin[BVH_SPLIT_COUNT] = { 0 };
+            BBox        bbox[BVH_SPLIT_COUNT];
+        };
+        std::vector<Bins> chunk_bins( chunk_cnt );
+        ParallelFor( start , end , BVH_PARALLEL_REDUCTION_THRESHOLD , [&]( unsigned s , unsigned e ){
+            auto& chunk = chunk_bins[( s - start ) / BVH_PARALLEL_REDUCTION_THRESHOLD];
+            binning( s , e , chunk.bin , chunk.bbox );
+        } );
+        for( const auto& chunk : chunk_bins ){
+            for( auto i = 0u ; i < BVH_SPLIT_COUNT ; ++i ){
+                bin[i] += chunk.bin[i];
+                bbox[i].Union( chunk.bbox[i] );
+            }
+        }
+    }else{
+        binning( start , end , bin , bbox );
     }
 
     rbox[BVH_SPLIT_COUNT-2].Union( bbox[BVH_SPLIT_COUNT-1] );
     for( int i = BVH_SPLIT_COUNT-3; i >= 0 ; i-- )
         rbox[i] = Union( rbox[i+1] , bbox[i+1] );
 
+    const auto node_portion = rays ? cameraRayPortion( *rays , node_bbox ) : 0.0f;
     auto    left = bin[0];
     auto    lbox = bbox[0];
     auto    pos = split_delta + split_start ;
     for(auto i = 0 ; i < BVH_SPLIT_COUNT - 1 ; i++ ){
-        auto sah_value = sah( left , primitive_num - left , lbox , rbox[i] , node_bbox );
+        auto sah_value = rays ? sah( left , primitive_num - left , lbox , rbox[i] , node_bbox , node_portion , *rays ) :
+                                sah( left , primitive_num - left , lbox , rbox[i] , node_bbox );
         if( sah_value < min_sah ){
             min_sah = sah_value;
             splitPos = pos;
@@ -114,4 +456,242 @@ SORT_FORCEINLINE float pickBestSplit( unsigned& axis , float& splitPos , const B
     }
 
     return min_sah;
-}
\ No newline at end of file
+}
+
+//! @brief Pick the best spatial split plane among all candidates.
+//!
+//! The bins are along the longest axis of the bounding box of the references. Each reference is clipped against all bins
+//! it overlaps so that the bounding boxes of the bins are tight.
+//!
+//! @param axis         The selected axis id of the picked split plane.
+//! @param splitPos     Position of the selected split plane.
+//! @param refs         References to be split.
+//! @param refs_bbox    Bounding box of the references.
+//! @param node_bbox    Bounding box of the current node, the SAH value is relative to it.
+//! @return             The SAH value of the selected best split plane.
+SORT_FORCEINLINE float pickBestSpatialSplit( unsigned& axis , float& splitPos , const Bvh_References& refs , const BBox& refs_bbox , const BBox& node_bbox ){
+    axis = refs_bbox.MaxAxisId();
+
+    const auto split_start = refs_bbox.m_Min[axis];
+    const auto split_delta = refs_bbox.Delta(axis) / (float)BVH_SPATIAL_SPLIT_BIN_COUNT;
+    if( split_delta == 0.0f )
+        return FLT_MAX;
+    const auto inv_split_delta = 1.0f / split_delta;
+
+    unsigned    enter[BVH_SPATIAL_SPLIT_BIN_COUNT] = { 0 };
+    unsigned    exit[BVH_SPATIAL_SPLIT_BIN_COUNT] = { 0 };
+    BBox        bbox[BVH_SPATIAL_SPLIT_BIN_COUNT];
+
+    const auto bin_id = [&]( float v ){
+        return std::min( std::max( (int)( ( v - split_start ) * inv_split_delta ) , 0 ) , (int)BVH_SPATIAL_SPLIT_BIN_COUNT - 1 );
+    };
+    for( const auto& ref : refs ){
+        const auto b0 = bin_id( ref.m_bbox.m_Min[axis] );
+        const auto b1 = bin_id( ref.m_bbox.m_Max[axis] );
+        if( b0 == b1 ){
+            bbox[b0].Union( ref.m_bbox );
+        }else{
+            for( auto b = b0 ; b <= b1 ; ++b ){
+                BBox slab = ref.m_bbox;
+                if( b > b0 )
+                    slab.m_Min[axis] = split_start + b * split_delta;
+                if( b < b1 )
+                    slab.m_Max[axis] = split_start + ( b + 1 ) * split_delta;
+
+                const auto clipped = ref.primitive->ClipBBox( slab );
+                if( isValidBBox( clipped ) )
+                    bbox[b].Union( clipped );
+            }
+        }
+        ++enter[b0];
+        ++exit[b1];
+    }
+
+    BBox        rbox[BVH_SPATIAL_SPLIT_BIN_COUNT];
+    unsigned    rcnt[BVH_SPATIAL_SPLIT_BIN_COUNT];
+    rbox[BVH_SPATIAL_SPLIT_BIN_COUNT-1] = bbox[BVH_SPATIAL_SPLIT_BIN_COUNT-1];
+    rcnt[BVH_SPATIAL_SPLIT_BIN_COUNT-1] = exit[BVH_SPATIAL_SPLIT_BIN_COUNT-1];
+    for( int i = BVH_SPATIAL_SPLIT_BIN_COUNT-2 ; i >= 0 ; i-- ){
+        rbox[i] = Union( rbox[i+1] , bbox[i] );
+        rcnt[i] = rcnt[i+1] + exit[i];
+    }
+
+    auto min_sah = FLT_MAX;
+    auto left = 0u;
+    BBox lbox;
+    for( auto i = 0u ; i < BVH_SPATIAL_SPLIT_BIN_COUNT - 1 ; i++ ){
+        left += enter[i];
+        lbox.Union( bbox[i] );
+
+        const auto right = rcnt[i+1];
+        if( 0 == left || 0 == right || !isValidBBox( lbox ) || !isValidBBox( rbox[i+1] ) )
+            continue;
+
+        const auto sah_value = sah( left , right , lbox , rbox[i+1] , node_bbox );
+        if( sah_value < min_sah ){
+            min_sah = sah_value;
+            splitPos = split_start + ( i + 1 ) * split_delta;
+        }
+    }
+
+    return min_sah;
+}
+
+//! @brief Split references with a spatial split plane, references straddling the plane are clipped and duplicated.
+//!
+//! @param refs         References to be split.
+//! @param axis         Axis of the split plane.
+//! @param splitPos     Position of the split plane.
+//! @param left         References on the left side of the plane.
+//! @param right        References on the right side of the plane.
+//! @param context      The shared states of the construction, the duplicated references are taken from its budget.
+//! @return             Whether the references are split, it fails if there is not enough budget left.
+SORT_FORCEINLINE bool splitSpatially( const Bvh_References& refs , unsigned axis , float splitPos , Bvh_References& left , Bvh_References& right , Bvh_Spatial_Split_Context& context ){
+    auto straddling = 0;
+    for( const auto& ref : refs )
+        straddling += ( ref.m_bbox.m_Min[axis] < splitPos && ref.m_bbox.m_Max[axis] > splitPos );
+
+    if( context.budget.fetch_sub( straddling , std::memory_order_relaxed ) < straddling ){
+        context.budget.fetch_add( straddling , std::memory_order_relaxed );
+        return false;
+    }
+
+    Bvh_Primitive clipped_ref;
+    for( const auto& ref : refs ){
+        if( ref.m_bbox.m_Max[axis] <= splitPos ){
+            left.push_back( ref );
+        }else if( ref.m_bbox.m_Min[axis] >= splitPos ){
+            right.push_back( ref );
+        }else{
+            BBox lbox = ref.m_bbox;
+            lbox.m_Max[axis] = splitPos;
+            const auto lclipped = ref.primitive->ClipBBox( lbox );
+            if( isValidBBox( lclipped ) ){
+                clipped_ref.SetReference( ref.primitive , lclipped );
+                left.push_back( clipped_ref );
+            }
+
+            BBox rbox = ref.m_bbox;
+            rbox.m_Min[axis] = splitPos;
+            const auto rclipped = ref.primitive->ClipBBox( rbox );
+            if( isValidBBox( rclipped ) ){
+                clipped_ref.SetReference( ref.primitive , rclipped );
+                right.push_back( clipped_ref );
+            }
+        }
+    }
+
+    if( left.empty() || right.empty() ){
+        left.clear();
+        right.clear();
+        context.budget.fetch_add( straddling , std::memory_order_relaxed );
+        return false;
+    }
+    return true;
+}
+
+//! @brief Split references of a node with either an object split or a spatial split, whichever is cheaper.
+//!
+//! @param refs         References to be split.
+//! @param node_bbox    Bounding box of the current node, SAH values are relative to it.
+//! @param left         References of the left child.
+//! @param right        References of the right child.
+//! @param context      The shared states of the construction.
+//! @return             Whether the references are split, it returns false if it is cheaper to keep them in a leaf.
+SORT_FORCEINLINE bool splitReferences( Bvh_References& refs , const BBox& node_bbox , Bvh_References& left , Bvh_References& right , Bvh_Spatial_Split_Context& context ){
+    const auto primitive_num = (unsigned)refs.size();
+    const auto refs_bbox = calcBoundingBox( refs.data() , 0 , primitive_num );
+
+    unsigned    object_axis;
+    float       object_pos;
+    const auto object_sah = pickBestSplit( object_axis , object_pos , refs.data() , node_bbox , 0 , primitive_num );
+    const auto object_compare = [object_pos, object_axis](const Bvh_Primitive& pri) {return pri.m_centroid[object_axis] < object_pos; };
+
+    // spatial splits only pay off if children of the object split overlap a lot
+    auto try_spatial = context.budget.load( std::memory_order_relaxed ) > 0;
+    if( try_spatial && object_sah < FLT_MAX ){
+        BBox lbox, rbox;
+        for( const auto& ref : refs )
+            ( object_compare( ref ) ? lbox : rbox ).Union( ref.m_bbox );
+
+        const auto overlap = Overlap( lbox , rbox );
+        try_spatial = isValidBBox( overlap ) && overlap.HalfSurfaceArea() > BVH_SPATIAL_SPLIT_OVERLAP_RATIO * context.root_area;
+    }
+
+    unsigned    spatial_axis;
+    float       spatial_pos;
+    const auto spatial_sah = try_spatial ? pickBestSpatialSplit( spatial_axis , spatial_pos , refs , refs_bbox , node_bbox ) : FLT_MAX;
+
+    if( spatial_sah < object_sah && spatial_sah < primitive_num ){
+        if( splitSpatially( refs , spatial_axis , spatial_pos , left , right , context ) )
+            return true;
+    }
+
+    if( object_sah >= primitive_num )
+        return false;
+
+    const auto middle = std::partition( refs.begin() , refs.end() , object_compare );
+    if( middle == refs.begin() || middle == refs.end() )
+        return false;
+
+    left.assign( refs.begin() , middle );
+    right.assign( middle , refs.end() );
+    return true;
+}
+
+//! @brief Commit references of a leaf to the final primitive buffer.
+//!
+//! @param primitives   The buffer holding references of all leaves.
+//! @param refs         References of the leaf.
+//! @param context      The shared states of the construction.
+//! @return             Offset of the first reference of the leaf in the buffer.
+SORT_FORCEINLINE unsigned commitReferences( Bvh_Primitive* const primitives , const Bvh_References& refs , Bvh_Spatial_Split_Context& context ){
+    const auto offset = context.offset.fetch_add( (unsigned)refs.size() , std::memory_order_relaxed );
+    std::copy( refs.begin() , refs.end() , primitives + offset );
+    return offset;
+}
+
+//! @brief Save references to primitives in leaves, primitives are saved as their indices in the primitive list.
+//!
+//! @param stream       Stream to save the references to.
+//! @param references   References in leaves.
+//! @param cnt          Number of references.
+//! @param primitives   The primitive list that the acceleration structure is built from.
+SORT_FORCEINLINE void saveBvhPrimitives( OStreamBase& stream , const Bvh_Primitive* const references , const unsigned cnt , const std::vector<const Primitive*>& primitives ){
+    std::unordered_map<const Primitive*, unsigned> indices;
+    indices.reserve( primitives.size() );
+    for( auto i = 0u ; i < (unsigned)primitives.size() ; ++i )
+        indices[primitives[i]] = i;
+
+    std::vector<unsigned> order( cnt );
+    for( auto i = 0u ; i < cnt ; ++i )
+        order[i] = indices[references[i].primitive];
+
+    stream << cnt;
+    stream.Write( (char*)order.data() , (int)( sizeof( unsigned ) * cnt ) );
+}
+
+//! @brief Load references to primitives saved by 'saveBvhPrimitives'.
+//!
+//! @param stream       Stream to load the references from.
+//! @param cnt          Number of references loaded.
+//! @param max_cnt      Maximum number of references allowed, anything more than it means the data is broken.
+//! @param primitives   The primitive list that the acceleration structure is built from.
+//! @return             The loaded references, nullptr if the data is broken.
+SORT_FORCEINLINE LargeArray<Bvh_Primitive> loadBvhPrimitives( IStreamBase& stream , unsigned& cnt , const unsigned max_cnt , const std::vector<const Primitive*>& primitives ){
+    cnt = 0;
+    stream >> cnt;
+    if( cnt > max_cnt )
+        return nullptr;
+
+    std::vector<unsigned> order( cnt );
+    stream.Load( (char*)order.data() , (int)( sizeof( unsigned ) * cnt ) );
+
+    auto references = make_large_array<Bvh_Primitive>( cnt );
+    for( auto i = 0u ; i < cnt ; ++i ){
+        if( order[i] >= primitives.size() )
+            return nullptr;
+        references[i].SetPrimitive( primitives[order[i]] );
+    }
+    return references;
+}
@@ -19,24 +19,42 @@
 
 #include "accelerator.h"
 #include "bvh_utils.h"
+#include "bvh_collapse.h"
 #include "core/primitive.h"
 
-#if defined(SIMD_SSE_IMPLEMENTATION) && defined(SIMD_AVX_IMPLEMENTATION)
+#if ( defined(SIMD_SSE_IMPLEMENTATION) + defined(SIMD_AVX_IMPLEMENTATION) + defined(SIMD_AVX512_IMPLEMENTATION) ) > 1
 static_assert(false, "More than one SIMD version is defined before including fast_bvh.h");
 #endif
 
-#if defined(QBVH_IMPLEMENTATION) || defined(OBVH_IMPLEMENTATION)
+#if defined(QBVH_IMPLEMENTATION) || defined(OBVH_IMPLEMENTATION) || defined(HBVH_IMPLEMENTATION)
 
 #if defined(QBVH_IMPLEMENTATION)
-#define Fast_Bvh_Node   Qbvh_Node
+#define Fast_Bvh_Node               Qbvh_Node
+#define Fast_Bvh_Leaf               Qbvh_Leaf
+#define Fast_Bvh_Compressed_Node    Qbvh_Compressed_Node
+#define Fast_Bvh_Quantized_Triangle Qbvh_Quantized_Triangle
+#define Fast_Bvh_Quantized_Leaf     Qbvh_Quantized_Leaf
 #define FBVH_CHILD_CNT  4
 #endif
 
 #if defined(OBVH_IMPLEMENTATION)
-#define Fast_Bvh_Node   Obvh_Node
+#define Fast_Bvh_Node               Obvh_Node
+#define Fast_Bvh_Leaf               Obvh_Leaf
+#define Fast_Bvh_Compressed_Node    Obvh_Compressed_Node
+#define Fast_Bvh_Quantized_Triangle Obvh_Quantized_Triangle
+#define Fast_Bvh_Quantized_Leaf     Obvh_Quantized_Leaf
 #define FBVH_CHILD_CNT  8
 #endif
 
+#if defined(HBVH_IMPLEMENTATION)
+#define Fast_Bvh_Node               Hbvh_Node
+#define Fast_Bvh_Leaf               Hbvh_Leaf
+#define Fast_Bvh_Compressed_Node    Hbvh_Compressed_Node
+#define Fast_Bvh_Quantized_Triangle Hbvh_Quantized_Triangle
+#define Fast_Bvh_Quantized_Leaf     Hbvh_Quantized_Leaf
+#define FBVH_CHILD_CNT  16
+#endif
+
 #ifdef SIMD_BVH_IMPLEMENTATION
 struct Fast_Bvh_Node_Deallocator{
     void operator()(void* p){
@@ -47,6 +65,39 @@ struct Fast_Bvh_Node_Deallocator{
 struct Fast_Bvh_Node;
 using Fast_Bvh_Node_Ptr = std::unique_ptr<Fast_Bvh_Node,Fast_Bvh_Node_Deallocator>;
 
+/**< Maximum number of distinct vertices in a leaf with quantized triangles, triangles refer to them with 8 bits indices. */
+#define FBVH_QUANTIZED_VERTEX_CNT   256
+
+//! @brief  Vertex of a leaf quantized to 16 bits per axis relative to the minimum corner of the leaf, it is the cell the vertex falls in.
+struct Fast_Bvh_Quantized_Vertex {
+    unsigned short  x , y , z;
+};
+
+//! @brief  Four/eight triangles of a leaf with quantized vertices, they are decoded into conservative boxes when tested.
+struct Fast_Bvh_Quantized_Triangle {
+    const Primitive*    primitives[SIMD_CHANNEL] = { nullptr };     /**< Original primitives, empty lanes are nullptr. */
+    unsigned char       indices[3][SIMD_CHANNEL] = { { 0 } };       /**< Indices of the three vertices of each lane in the vertices of the leaf. */
+};
+
+//! @brief  Triangles of a leaf with quantized vertices.
+/**
+ * Each leaf lays a grid over its vertices, starting at their minimum corner with a power of two cell size small enough for the
+ * leaf to span no more than 16 bits of it. A vertex is stored as the cell it falls in, decoding the cell gives a box that is
+ * guaranteed to contain the vertex even after rounding. Vertices shared by triangles of the leaf are stored only once, triangles
+ * refer to them by indices like meshlets do.
+ *
+ * Dequantization is conservative, the cells of the three vertices bound each triangle. Rays are tested against these boxes of
+ * all lanes at once and only the lanes they hit are tested against the original triangles, so results are exactly the same as
+ * with triangles in full precision, watertight edges included. Nothing about the traversal changes, node boxes still bound the
+ * original triangles.
+ */
+struct Fast_Bvh_Quantized_Leaf {
+    float                                   base[3];                /**< Minimum corner of the grid of the leaf. */
+    float                                   step = 0.0f;            /**< Size of a grid cell, it is a power of two. */
+    const Fast_Bvh_Quantized_Vertex*        vertices = nullptr;     /**< Distinct vertices of the leaf. */
+    const Fast_Bvh_Quantized_Triangle*      triangles = nullptr;    /**< Triangles of the leaf, there are 'tri_cnt' of them. */
+};
+
 #else
 struct Fast_Bvh_Node;
 using Fast_Bvh_Node_Ptr = std::unique_ptr<Fast_Bvh_Node>;
@@ -54,13 +105,17 @@ using Fast_Bvh_Node_Ptr = std::unique_ptr<Fast_Bvh_Node>;
 
 struct Fast_Bvh_Node {
 #ifdef SIMD_BVH_IMPLEMENTATION
-    using Simd_Triangle_Container   = std::unique_ptr<Simd_Triangle[]>;
-    using Simd_Line_Container       = std::unique_ptr<Simd_Line[]>;
+    using Simd_Triangle_Container   = const Simd_Triangle*;
+    using Simd_Line_Container       = const Simd_Line*;
+    using Simd_Planar_Container     = const Simd_Planar*;
     Simd_BBox                       bbox;                       /**< Bounding boxes of its four children. */
-    Simd_Triangle_Container         tri_list;
-    Simd_Line_Container             line_list;
+    Simd_Triangle_Container         tri_list = nullptr;         /**< Packed triangles of the leaf, it points into the array shared by all leaves. */
+    Simd_Line_Container             line_list = nullptr;        /**< Packed lines of the leaf, it points into the array shared by all leaves. */
+    Simd_Planar_Container           planar_list = nullptr;      /**< Packed quads and disks of the leaf, it points into the array shared by all leaves. */
+    const Fast_Bvh_Quantized_Leaf*  tri_quantized = nullptr;    /**< Triangles of the leaf with quantized vertices, 'tri_list' is nullptr if it is set. */
     unsigned int                    tri_cnt = 0;
     unsigned int                    line_cnt = 0;
+    unsigned int                    planar_cnt = 0;
     std::vector<const Primitive*>   other_list;
 #else
     BBox                            bbox[FBVH_CHILD_CNT];       /**< Bounding boxes of its children. */
@@ -84,6 +139,51 @@ struct Fast_Bvh_Node {
 
 #ifdef SIMD_BVH_IMPLEMENTATION
     static_assert( sizeof( Fast_Bvh_Node ) % SIMD_ALIGNMENT == 0 , "Incorrect size of Fast_Bvh_Node." );
+
+//! @brief  Primitives of a leaf node in a compressed QBVH/OBVH.
+struct Fast_Bvh_Leaf {
+    Fast_Bvh_Node::Simd_Triangle_Container  tri_list = nullptr;
+    Fast_Bvh_Node::Simd_Line_Container      line_list = nullptr;
+    Fast_Bvh_Node::Simd_Planar_Container    planar_list = nullptr;
+    const Fast_Bvh_Quantized_Leaf*          tri_quantized = nullptr;
+    unsigned int                            tri_cnt = 0;
+    unsigned int                            line_cnt = 0;
+    unsigned int                            planar_cnt = 0;
+    std::vector<const Primitive*>           other_list;
+    unsigned int                            pri_cnt = 0;    /**< Number of primitives in the leaf. */
+    unsigned int                            pri_offset = 0; /**< Offset of primitives in the buffer. */
+};
+
+/**< Compressed nodes are aligned to cache lines. */
+#define FBVH_COMPRESSED_NODE_ALIGNMENT  64
+
+/**< Child index with this bit set refers to a leaf instead of an interior node in a compressed QBVH/OBVH. */
+constexpr unsigned int FBVH_COMPRESSED_LEAF = 0x80000000;
+
+//! @brief  Interior node of a compressed QBVH/OBVH.
+/**
+ * Bounding boxes of children are quantized to 8 bits per plane relative to the bounding box of the node itself. The quantized
+ * boxes are conservative, they always contain the original ones. A QBVH node fits in a single cache line, an OBVH node takes
+ * less than half of the memory of an uncompressed one. All interior nodes live in one contiguous array and refer to their
+ * children by indices.
+ * Empty child slots are marked with an inverted box, whose minimum is larger than its maximum.
+ */
+struct Fast_Bvh_Compressed_Node {
+    float           origin[3];                  /**< Minimum corner of the bounding box of the node. */
+    float           scale[3];                   /**< Size of a quantization step along each axis. */
+    unsigned char   qmin_x[FBVH_CHILD_CNT];     /**< Quantized minimum x of children. */
+    unsigned char   qmin_y[FBVH_CHILD_CNT];     /**< Quantized minimum y of children. */
+    unsigned char   qmin_z[FBVH_CHILD_CNT];     /**< Quantized minimum z of children. */
+    unsigned char   qmax_x[FBVH_CHILD_CNT];     /**< Quantized maximum x of children. */
+    unsigned char   qmax_y[FBVH_CHILD_CNT];     /**< Quantized maximum y of children. */
+    unsigned char   qmax_z[FBVH_CHILD_CNT];     /**< Quantized maximum z of children. */
+    unsigned int    children[FBVH_CHILD_CNT];   /**< Indices of children, leaves are marked with FBVH_COMPRESSED_LEAF. */
+};
+
+using Fast_Bvh_Compressed_Node_Array = std::unique_ptr<Fast_Bvh_Compressed_Node[],LargeArrayDeallocator>;
+using Fast_Bvh_Triangle_Array = std::unique_ptr<Simd_Triangle[],LargeArrayDeallocator>;
+using Fast_Bvh_Line_Array = std::unique_ptr<Simd_Line[],LargeArrayDeallocator>;
+using Fast_Bvh_Planar_Array = std::unique_ptr<Simd_Planar[],LargeArrayDeallocator>;
 #endif
 
 #endif
@@ -97,6 +197,7 @@ struct Fast_Bvh_Node {
  * a binary tree. It easily opens the door for SSE/AVX optimization during BVH traversal since we can do ray-AABB intersection 
  * four/eight times more efficient. And also we can do the same to primitive ray intersection, instead of doing it one at a time,
  * QBVH/OBVH will check four/eight primitives at a time, boosting the performance of ray intersection test.
+ * HBVH is the sixteen-wide version for AVX-512.
  */
 class Fbvh : public Accelerator{
 public:
@@ -106,6 +207,12 @@ public:
 #ifdef OBVH_IMPLEMENTATION
     DEFINE_RTTI( Obvh , Accelerator );
 #endif
+#ifdef HBVH_IMPLEMENTATION
+    DEFINE_RTTI( Hbvh , Accelerator );
+#endif
+
+    //! @brief Destructor, nodes living in the contiguous node array are released with it.
+    ~Fbvh() override;
 
     //! @brief Get intersection between the ray and the primitive set using QBVH/OBVH.
     //!
@@ -122,7 +229,29 @@ public:
     //! @return             It will return true if there is an intersection, otherwise it returns false.
     bool    GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const override;
 
-#ifndef ENABLE_TRANSPARENT_SHADOW
+    //! @brief Get intersections of a packet of coherent rays.
+    //!
+    //! All rays in the packet traverse the tree together, each node is fetched once for all the rays that reach it,
+    //! which is a lot more cache friendly than tracing camera rays one by one. Rays that either miss a node or already
+    //! have a closer intersection are filtered out of the packet as it goes down the tree.
+    //!
+    //! @param rays         The packet of rays to be tested.
+    //! @param intersects   The intersection results, one for each ray.
+    //! @param cnt          Number of rays in the packet.
+    void    GetIntersect( const Ray* rays , SurfaceInteraction* intersects , unsigned int cnt ) const override;
+
+    //! @brief Get intersections of a batch of incoherent rays.
+    //!
+    //! Incoherent rays barely share nodes, tracing them one by one stalls on a cache miss at almost every node in scenes
+    //! too large for the cache. Several rays are in flight at a time instead, each of them keeps its own traversal stack.
+    //! Once a ray is done with a node, the next node it is going to visit is prefetched and the traversal switches to
+    //! another ray, by the time it comes back to the ray the node is hopefully in the cache already.
+    //!
+    //! @param rays         The batch of rays to be tested.
+    //! @param intersects   The intersection results, one for each ray.
+    //! @param cnt          Number of rays in the batch.
+    void    GetIntersectIncoherent( const Ray* rays , SurfaceInteraction* intersects , unsigned int cnt ) const override;
+
     //! @brief This is a dedicated interface for detecting shadow rays.
     //!
     //! Instead of merging the interface with 'GetIntersect', this is a separate interface purely for occlusion detection.
@@ -132,6 +261,49 @@ public:
     //! @param r            The ray to be tested.
     //! @return             Whether the ray is occluded by anything.
     bool    IsOccluded(const Ray& r) const override;
+
+    //! @brief Detect occlusion and tell what blocks the ray.
+    //!
+    //! @param r            The ray to be tested.
+    //! @param occluder     The primitive blocking the ray, nullptr if it is not occluded.
+    //! @return             Whether the ray is occluded by anything.
+    bool    IsOccluded( const Ray& r , const Primitive*& occluder ) const override;
+
+    //! @brief Detect occlusion of a batch of shadow rays sharing the same origin.
+    //!
+    //! The batch traverses the tree together like a packet of camera rays, except that children don't need to be sorted
+    //! and rays are dropped from the batch as soon as they are occluded.
+    //!
+    //! @param rays         The shadow rays to be tested.
+    //! @param occluded     Whether each of the rays is occluded by anything.
+    //! @param cnt          Number of rays in the batch.
+    void    IsOccluded( const Ray* rays , bool* occluded , unsigned int cnt ) const override;
+
+    //! @brief Get the nearest hits of a batch of rays laid out as structure of arrays.
+    //!
+    //! Active rays are gathered into a compact array first, coherent batches are traced as a packet and the rest are
+    //! interleaved. Attributes of the hits are never evaluated.
+    //!
+    //! @param rays         The batch of rays to be tested.
+    //! @param hits         The nearest hit of each ray in the batch.
+    void    IntersectBatch( const RayBatch& rays , HitRecord* hits ) const override;
+
+    //! @brief Detect occlusion of a batch of rays laid out as structure of arrays.
+    //!
+    //! Active rays are gathered into a compact array and tested together like a batch of shadow rays.
+    //!
+    //! @param rays         The batch of rays to be tested.
+    //! @param occluded     Whether each of the rays is occluded by anything.
+    void    OccludedBatch( const RayBatch& rays , bool* occluded ) const override;
+#ifdef ENABLE_TRANSPARENT_SHADOW
+    //! @brief Get the nearest intersections along a shadow ray.
+    //!
+    //! Unlike the nearest intersection, all semi-transparent intersections nearer than the farthest recorded one are of interest,
+    //! the traversal only prunes nodes beyond it. It stops as soon as an opaque primitive is found along the ray.
+    //!
+    //! @param r            The shadow ray to be tested.
+    //! @param intersect    The intersections along the ray.
+    void    GetIntersect( const Ray& r , ShadowIntersections& intersect ) const override;
 #endif
 
     //! @brief Get multiple intersections between the ray and the primitive set using spatial data structure.
@@ -148,6 +320,9 @@ public:
 
     //! @brief Build BVH structure in O(N*lg(N)).
     //!
+    //! With the linear builder, a binary hierarchy is emitted from primitives sorted along a Morton curve and collapsed into
+    //! QBVH/OBVH nodes on the fly, spatial splits are disabled then.
+    //!
     //! @param primitives       A vector holding all primitives.
     //! @param bbox             The bounding box of the scene.
     void    Build(const std::vector<const Primitive*>& primitives, const BBox& bbox) override;
@@ -158,7 +333,11 @@ public:
     //!             it could come from different places.
     void    Serialize( IStreamBase& stream ) override{
         stream >> m_maxNodeDepth;
+        m_maxNodeDepth = std::min( m_maxNodeDepth , MAX_NODE_DEPTH );
         stream >> m_maxPriInLeaf;
+        stream >> m_compressNodes;
+        stream >> m_spatialSplitBudget;
+        stream >> m_compressLeaves;
     }
 
 	//! @brief	Clone the accelerator.
@@ -168,12 +347,52 @@ public:
 	//! @return		Cloned accelerator.
 	std::unique_ptr<Accelerator>	Clone() const override;
 
+    //! @brief Save the constructed QBVH/OBVH so that it can be loaded later without being built again.
+    //!
+    //! Compressed nodes are saved as they are in memory, uncompressed ones are saved as flat records.
+    //!
+    //! @param stream           Stream to save the QBVH/OBVH to.
+    //! @return                 It always returns true since QBVH/OBVH supports caching.
+    bool    SaveCache( OStreamBase& stream ) const override;
+
+    //! @brief Load a QBVH/OBVH saved by 'SaveCache' instead of building it.
+    //!
+    //! @param stream           Stream to load the QBVH/OBVH from.
+    //! @param primitives       A vector holding all primitives, it needs to be the same one used to build the cached data.
+    //! @param bbox             The bounding box of the scene.
+    //! @return                 Whether the QBVH/OBVH is loaded.
+    bool    LoadCache( IStreamBase& stream , const std::vector<const Primitive*>& primitives , const BBox& bbox ) override;
+
+    //! @brief Refit the QBVH/OBVH to primitives that are moved after it is built or loaded.
+    //!
+    //! Sub-trees are refitted in parallel, compressed nodes are quantized again. Triangles, lines, quads and disks in leaves are
+    //! packed again from the moved primitives, the packed arrays are reused since the topology doesn't change. The SAH cost of the
+    //! refitted tree is compared with the one right after its construction, it is not worth keeping if it degrades too much.
+    //!
+    //! @return                 Whether the refitted QBVH/OBVH is still good enough, it needs to be built again if not.
+    bool    Refit() override;
+
 private:
+    /**< Maximum depth of node in QBVH/OBVH, traversal stacks live on the stack and are large enough for trees of this depth. */
+    static constexpr unsigned           MAX_NODE_DEPTH = 64;
+    /**< Number of entries in traversal stacks, each visited interior node takes one entry and pushes all of its children. */
+    static constexpr unsigned           STACK_SIZE = MAX_NODE_DEPTH * ( FBVH_CHILD_CNT - 1 ) + 1;
+    /**< Number of rays in flight in interleaved traversal, it needs to be large enough to cover the latency of a cache miss with the work on the other rays. */
+    static constexpr unsigned           INTERLEAVED_RAY_CNT = 8;
+    /**< Sub-trees of nodes shallower than this are refitted in forked tasks, a 4/8-wide node is worth two/three levels of a binary BVH. */
+    static constexpr unsigned           PARALLEL_REFIT_DEPTH = BVH_PARALLEL_REFIT_DEPTH / ( FBVH_CHILD_CNT == 4 ? 2 : ( FBVH_CHILD_CNT == 8 ? 3 : 4 ) );
+
     /**< Primitive list during QBVH/OBVH construction. */
-    std::unique_ptr<Bvh_Primitive[]>    m_bvhpri = nullptr;
+    LargeArray<Bvh_Primitive>           m_bvhpri = nullptr;
+    /**< Number of references to primitives in leaves, it could be more than the number of primitives with spatial splits. */
+    unsigned                            m_bvhpriCnt = 0;
 
     /**< Root node of the BVH. */
     Fast_Bvh_Node_Ptr                   m_root;
+    /**< All nodes of the uncompressed QBVH/OBVH in one contiguous array in depth first order, children still point into it. */
+    std::unique_ptr<Fast_Bvh_Node[],LargeArrayDeallocator>  m_nodeArray;
+    /**< Number of nodes in the contiguous array. */
+    unsigned                            m_nodeArrayCnt = 0;
 
     /**< Maximum primitives in a leaf node. During BVH construction, a node with less primitives will be marked as a leaf node. */
     unsigned                            m_maxPriInLeaf = 8;
@@ -181,14 +400,122 @@ private:
     unsigned                            m_maxNodeDepth = 16;
 
     /**< Depth of the QBVH/OBVH. */
-    unsigned                            m_depth = 0;
+    std::atomic<unsigned>               m_depth = 0;
+
+    /**< Whether to quantize the bounding boxes of nodes, this is only supported with SIMD. */
+    bool                                m_compressNodes = false;
+
+    /**< Whether to quantize vertices of triangles in leaves, this is only supported with SIMD. */
+    bool                                m_compressLeaves = false;
+
+    /**< Maximum number of duplicated references in spatial splits, relative to the number of primitives. Spatial splits are disabled if it is zero. */
+    float                               m_spatialSplitBudget = 0.0f;
+
+    /**< SAH cost of the QBVH/OBVH right after its construction, relative to the surface area of the scene. */
+    float                               m_buildSahCost = 0.0f;
+
+    /**< Sorted Morton codes of primitives, it only lives during a linear build. */
+    std::vector<unsigned>               m_mortonCodes;
+
+    /**< Memory of the QBVH/OBVH accounted in the memory of acceleration structures. */
+    TrackedMemory                       m_memory = TrackedMemory( MemoryCategory::Accelerator );
+
+    struct Uncompressed_Tree;
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+    /**< Interior nodes of the compressed QBVH/OBVH, nullptr if the nodes are not compressed. */
+    Fast_Bvh_Compressed_Node_Array      m_compressedNodes;
+    /**< Leaves of the compressed QBVH/OBVH. */
+    std::vector<Fast_Bvh_Leaf>          m_compressedLeaves;
+    /**< Index of the root node of the compressed QBVH/OBVH. */
+    unsigned int                        m_compressedRoot = 0;
+    /**< Number of interior nodes of the compressed QBVH/OBVH. */
+    unsigned int                        m_compressedNodeCnt = 0;
+
+    /**< Packed triangles of all leaves in one contiguous array in depth first order, leaves refer to ranges of it. */
+    Fast_Bvh_Triangle_Array             m_packedTriangles;
+    /**< Packed lines of all leaves in one contiguous array in depth first order, leaves refer to ranges of it. */
+    Fast_Bvh_Line_Array                 m_packedLines;
+    /**< Packed quads and disks of all leaves in one contiguous array in depth first order, leaves refer to ranges of it. */
+    Fast_Bvh_Planar_Array               m_packedPlanars;
+    /**< Number of packed triangles shared by all leaves. */
+    unsigned int                        m_packedTriangleCnt = 0;
+    /**< Number of packed lines shared by all leaves. */
+    unsigned int                        m_packedLineCnt = 0;
+    /**< Number of packed quads and disks shared by all leaves. */
+    unsigned int                        m_packedPlanarCnt = 0;
+
+    /**< Leaves with quantized triangles, in depth first order. */
+    std::vector<Fast_Bvh_Quantized_Leaf>    m_quantizedLeaves;
+    /**< Quantized vertices of all leaves, leaves refer to ranges of it. */
+    std::vector<Fast_Bvh_Quantized_Vertex>  m_quantizedVertices;
+    /**< Quantized triangles of all leaves, leaves refer to ranges of it. */
+    std::vector<Fast_Bvh_Quantized_Triangle>    m_quantizedTriangles;
+
+    struct Compressed_Tree;
+#endif
+
+    //! @brief Get the nearest intersection by traversing the nodes through the tree accessor.
+    template<class Tree>
+    bool    getIntersect( const Ray& r , SurfaceInteraction& intersect ) const;
+
+    //! @brief Get intersections of a packet of rays by traversing the nodes through the tree accessor.
+    template<class Tree>
+    void    getIntersect( const Ray* rays , SurfaceInteraction* intersects , unsigned int cnt ) const;
+
+    //! @brief Get intersections of incoherent rays interleaved with each other by traversing the nodes through the tree accessor.
+    template<class Tree>
+    void    getIntersectInterleaved( const Ray* rays , SurfaceInteraction* intersects , unsigned int cnt ) const;
+
+    //! @brief Check occlusion by traversing the nodes through the tree accessor, the occluder is reported if it is not nullptr.
+    template<class Tree>
+    bool    isOccluded( const Ray& r , const Primitive** occluder ) const;
+
+    //! @brief Check occlusion of a batch of rays by traversing the nodes through the tree accessor.
+    template<class Tree>
+    void    isOccluded( const Ray* rays , bool* occluded , unsigned int cnt ) const;
+#ifdef ENABLE_TRANSPARENT_SHADOW
+    //! @brief Get the nearest intersections along a shadow ray by traversing the nodes through the tree accessor.
+    template<class Tree>
+    void    getIntersect( const Ray& r , ShadowIntersections& intersect ) const;
+#endif
+
+    //! @brief Get multiple intersections for SSS by traversing the nodes through the tree accessor.
+    template<class Tree>
+    void    getIntersect( const Ray& r , BSSRDFIntersections& intersect , const StringID matID ) const;
 
     //! @brief Split current QBVH/OBVH node.
     //!
     //! @param node         The QBVH/OBVH node to be split.
     //! @param node_bbox    The bounding box of the node.
     //! @param depth        The current depth of the node. Starting from 1 for root node.
-    void    splitNode( Fbvh_Node* const node , const BBox& node_bbox , unsigned depth );
+    //! @param group        Large children are split in tasks forked in this group.
+    void    splitNode( Fbvh_Node* const node , const BBox& node_bbox , unsigned depth , TaskGroup& group );
+
+    //! @brief Collapse a sub-tree of an optimized binary BVH into QBVH/OBVH nodes.
+    //!
+    //! @param node         The QBVH/OBVH node to be filled.
+    //! @param binary       The binary node it corresponds to, the sub-tree needs to hold a contiguous range of primitives.
+    //! @param table        Collapsing costs of all binary nodes.
+    //! @param depth        The current depth of the node. Starting from 1 for root node.
+    //! @param group        Large children are collapsed in tasks forked in this group.
+    void    collapseNode( Fbvh_Node* const node , Bvh_Binary_Node* const binary , const Bvh_Collapse_Table& table , unsigned depth , TaskGroup& group );
+
+    //! @brief Split current QBVH/OBVH node with spatial splits taken into account.
+    //!
+    //! @param node         The QBVH/OBVH node to be split.
+    //! @param node_bbox    The bounding box of the node.
+    //! @param refs         References to primitives that the node holds.
+    //! @param depth        The current depth of the node. Starting from 1 for root node.
+    //! @param context      The shared states of the construction.
+    //! @param group        Large children are split in tasks forked in this group.
+    void    splitNodeSpatial( Fbvh_Node* const node , const BBox& node_bbox , Bvh_References& refs , unsigned depth , Bvh_Spatial_Split_Context& context , TaskGroup& group );
+
+    //! @brief Fill the bounding boxes of children in a node.
+    //!
+    //! @param node         The QBVH/OBVH node whose children are populated.
+    //! @param child_bbox   Bounding boxes of the children.
+    void    setChildrenBBox( Fbvh_Node* const node , const BBox* child_bbox ) const;
 
     //! @brief Mark the current node as leaf node.
     //!
@@ -198,12 +525,133 @@ private:
     //! @param depth        Depth of the current node.
     void    makeLeaf( Fbvh_Node* const node , unsigned start , unsigned end , unsigned depth );
 
+    //! @brief Get the bounding box of a child in a node.
+    //!
+    //! @param node         The QBVH/OBVH node.
+    //! @param k            Index of the child.
+    //! @return             The bounding box of the child.
+    BBox    getChildBBox( const Fbvh_Node* const node , unsigned k ) const;
+
+    //! @brief Sort children of a node and all of its sub-trees so that the ones with larger surface area come first.
+    //!
+    //! Children with larger surface area are more likely to be hit by rays. Since nodes are laid out in depth first order,
+    //! the child most likely to be visited next ends up right after its parent in memory, in both node formats.
+    //!
+    //! @param node         The root node of the (sub)tree to be sorted.
+    void    orderChildren( Fbvh_Node* const node );
+
+    //! @brief Move all nodes of the uncompressed tree into one contiguous array in depth first order.
+    //!
+    //! Nodes are allocated one by one during the construction, in whatever order the tasks splitting them happen to run.
+    //! Once they are all in one array in the order of traversal, sub-trees occupy contiguous ranges of memory, which means
+    //! fewer cache and TLB misses when tracing rays.
+    void    relayoutNodes();
+
+    //! @brief Release all uncompressed nodes, whether they are in the contiguous array or not.
+    void    releaseNodes();
+
+    //! @brief Account the memory of nodes and primitives in the memory of acceleration structures.
+    //!
+    //! @param bvhpri_cnt   Number of BVH primitives allocated.
+    void    updateMemory( unsigned bvhpri_cnt );
+
+    //! @brief Refit the bounding boxes of children in a node and all of its sub-trees.
+    //!
+    //! @param node         The root node of the (sub)tree to be refitted.
+    //! @param depth        The current depth of the node. Starting from 1 for root node.
+    //! @return             The bounding box of the node.
+    BBox    refitNode( Fbvh_Node* const node , unsigned depth );
+
+    //! @brief Evaluate the SAH cost of the QBVH/OBVH.
+    //!
+    //! @return             SAH cost of the QBVH/OBVH relative to the surface area of the scene.
+    float   evaluateSahCost() const;
+
 #ifdef SIMD_BVH_IMPLEMENTATION
     //! @brief A helper function calculating bounding box of a node.
     //!
-    //! @param children     The children nodes
+    //! @param child_bbox   Bounding boxes of the children.
+    //! @param child_cnt    Number of children.
     //! @return             The 4/8 bounding box of the node, there could be degenerated ones if there is no four children.
-    Simd_BBox   calcBoundingBoxSIMD(const Fast_Bvh_Node_Ptr* children) const;
+    Simd_BBox   calcBoundingBoxSIMD(const BBox* child_bbox, unsigned child_cnt) const;
+
+    //! @brief Pack triangles, lines, quads and disks of all leaves into the arrays shared by all leaves.
+    //!
+    //! Leaves only count their packed primitives when they are made, which could happen in different tasks at the same time.
+    //! All of them are packed here once the tree is complete. Leaves are packed in depth first order so that leaves close to each
+    //! other in the tree are also close to each other in memory.
+    void        packPrimitives();
+
+    //! @brief Pack triangles, lines, quads and disks of a leaf.
+    //!
+    //! @param leaf         The leaf to be packed, either an uncompressed leaf node or a compressed leaf.
+    //! @param tri_offset   Offset of the first packed triangle of the leaf, it is advanced past the leaf.
+    //! @param line_offset  Offset of the first packed line of the leaf, it is advanced past the leaf.
+    //! @param planar_offset    Offset of the first packed quads and disks of the leaf, it is advanced past the leaf.
+    template<class Leaf>
+    void        packLeaf( Leaf& leaf , unsigned& tri_offset , unsigned& line_offset , unsigned& planar_offset );
+
+    //! @brief Quantize vertices of triangles of a leaf.
+    //!
+    //! The quantized data is appended to the shared arrays, the caller sets up the pointers in the leaf once all leaves are done.
+    //! A leaf having too many distinct vertices keeps its triangles in full precision.
+    //!
+    //! @param leaf         The leaf to be quantized, either an uncompressed leaf node or a compressed leaf.
+    //! @return             Whether the triangles of the leaf are quantized.
+    template<class Leaf>
+    bool        quantizeLeaf( Leaf& leaf );
+
+    //! @brief Quantize vertices of triangles of all leaves.
+    //!
+    //! @param leaf_cnt     Number of leaves in the tree.
+    //! @param tri_cnt      Number of packed triangles in full precision, triangles of quantized leaves are subtracted from it.
+    void        quantizeTriangles( unsigned leaf_cnt , unsigned& tri_cnt );
+
+    //! @brief Visit all leaves in depth first order, either uncompressed leaf nodes or compressed leaves.
+    //!
+    //! @param func         The visitor taking a reference to a leaf.
+    template<class Func>
+    void        visitLeaves( Func&& func );
+
+    //! @brief Count the interior nodes of a sub-tree.
+    //!
+    //! @param node         The root of the sub-tree.
+    //! @return             Number of interior nodes in the sub-tree, including the root itself.
+    unsigned    countInteriorNodes( const Fbvh_Node* node ) const;
+
+    //! @brief Convert a sub-tree to compressed nodes, the uncompressed nodes are released along the way.
+    //!
+    //! @param node         The root of the sub-tree to be compressed.
+    //! @param node_cnt     Number of compressed nodes allocated so far.
+    //! @return             Index of the compressed node, leaves are marked with FBVH_COMPRESSED_LEAF.
+    unsigned    compressNode( Fast_Bvh_Node_Ptr& node , unsigned& node_cnt );
+
+    //! @brief Move the primitives of a leaf node to the leaves of the compressed QBVH/OBVH, the leaf node is released.
+    //!
+    //! @param node         The leaf node.
+    //! @return             Index of the compressed leaf, marked with FBVH_COMPRESSED_LEAF.
+    unsigned    compressLeaf( Fast_Bvh_Node_Ptr& node );
+
+    //! @brief Quantize the bounding boxes of children relative to their union, empty slots are marked with inverted boxes.
+    //!
+    //! @param node         The compressed node.
+    //! @param child_bbox   Bounding boxes of the children.
+    //! @param child_cnt    Number of children.
+    void        quantizeChildren( Fast_Bvh_Compressed_Node& node , const BBox* child_bbox , unsigned child_cnt ) const;
+
+    //! @brief Get the dequantized bounding box of a child in a compressed node.
+    //!
+    //! @param node         The compressed node.
+    //! @param k            Index of the child.
+    //! @return             The conservative bounding box of the child.
+    BBox        getChildBBox( const Fast_Bvh_Compressed_Node& node , unsigned k ) const;
+
+    //! @brief Refit a compressed node and all of its sub-trees.
+    //!
+    //! @param index        Index of the compressed node, leaves are marked with FBVH_COMPRESSED_LEAF.
+    //! @param depth        The current depth of the node. Starting from 1 for root node.
+    //! @return             The bounding box of the node.
+    BBox        refitCompressedNode( unsigned index , unsigned depth );
 #endif
 
 #ifdef QBVH_IMPLEMENTATION
@@ -212,4 +660,7 @@ private:
 #ifdef OBVH_IMPLEMENTATION
     SORT_STATS_ENABLE( "Spatial-Structure(OBVH)" )
 #endif
+#ifdef HBVH_IMPLEMENTATION
+    SORT_STATS_ENABLE( "Spatial-Structure(HBVH)" )
+#endif
 };
@@ -16,8 +16,14 @@
  */
 
 #include <queue>
+#include <functional>
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include "core/memory.h"
 #include "core/stats.h"
+#include "core/cpuinfo.h"
+#include "core/log.h"
 #include "scatteringevent/bssrdf/bssrdf.h"
 
 SORT_STATIC_FORCEINLINE Fast_Bvh_Node_Ptr makeFastBvhNode( unsigned int start , unsigned int end ){
@@ -30,17 +36,7 @@ SORT_STATIC_FORCEINLINE Fast_Bvh_Node_Ptr makeFastBvhNode( unsigned int start ,
 #endif
 }
 
-template<class T>
-SORT_STATIC_FORCEINLINE std::unique_ptr<T[]> makePrimitiveList( unsigned int cnt ){
-#ifdef SIMD_BVH_IMPLEMENTATION
-    auto* address = malloc_aligned( sizeof(T) * cnt , SIMD_ALIGNMENT );
-    return std::move(std::unique_ptr<T[]>((T*)address));
-#else
-    return std::move(std::unique_ptr<T[]>(cnt));
-#endif
-}
-
-#if defined(SIMD_SSE_IMPLEMENTATION) && defined(SIMD_AVX_IMPLEMENTATION)
+#if ( defined(SIMD_SSE_IMPLEMENTATION) + defined(SIMD_AVX_IMPLEMENTATION) + defined(SIMD_AVX512_IMPLEMENTATION) ) > 1
 static_assert(false, "More than one SIMD version is defined before including fast_bvh.hpp");
 #endif
 
@@ -51,6 +47,9 @@ SORT_STATS_DEFINE_COUNTER(sQbvhLeafNodeCount)
 SORT_STATS_DEFINE_COUNTER(sQbvhDepth)
 SORT_STATS_DEFINE_COUNTER(sQbvhMaxPriCountInLeaf)
 SORT_STATS_DEFINE_COUNTER(sQbvhPrimitiveCount)
+SORT_STATS_DEFINE_COUNTER(sQbvhCompressedNodeMemory)
+SORT_STATS_DEFINE_COUNTER(sQbvhPackedPrimitiveMemory)
+SORT_STATS_DEFINE_COUNTER(sQbvhQuantizedLeafCount)
 
 SORT_STATS_COUNTER("Spatial-Structure(QBVH)", "Total Ray Count", sRayCount);
 SORT_STATS_COUNTER("Spatial-Structure(QBVH)", "Shadow Ray Count", sShadowRayCount);
@@ -61,12 +60,22 @@ SORT_STATS_COUNTER("Spatial-Structure(QBVH)", "BVH Depth", sQbvhDepth);
 SORT_STATS_COUNTER("Spatial-Structure(QBVH)", "Maximum Primitive in Leaf", sQbvhMaxPriCountInLeaf);
 SORT_STATS_AVG_COUNT("Spatial-Structure(QBVH)", "Average Primitive Count in Leaf", sQbvhPrimitiveCount , sQbvhLeafNodeCount );
 SORT_STATS_AVG_COUNT("Spatial-Structure(QBVH)", "Average Primitive Tested per Ray", sIntersectionTest, sRayCount);
+SORT_STATS_HISTOGRAM("Spatial-Structure(QBVH)", "Nodes Visited per Ray", sTraversalSteps);
+SORT_STATS_HISTOGRAM("Spatial-Structure(QBVH)", "Leaves Visited per Ray", sLeafVisits);
+SORT_STATS_HISTOGRAM("Spatial-Structure(QBVH)", "Nodes Visited per Shadow Ray", sShadowTraversalSteps);
+SORT_STATS_HISTOGRAM("Spatial-Structure(QBVH)", "Leaves Visited per Shadow Ray", sShadowLeafVisits);
+SORT_STATS_COUNTER("Spatial-Structure(QBVH)", "Compressed Node Memory (Bytes)", sQbvhCompressedNodeMemory);
+SORT_STATS_COUNTER("Spatial-Structure(QBVH)", "Packed Primitive Memory (Bytes)", sQbvhPackedPrimitiveMemory);
+SORT_STATS_COUNTER("Spatial-Structure(QBVH)", "Leaves with Quantized Triangles", sQbvhQuantizedLeafCount);
 
 #define sFbvhNodeCount          sQbvhNodeCount
 #define sFbvhLeafNodeCount      sQbvhLeafNodeCount
 #define sFbvhDepth              sQbvhDepth
 #define sFbvhMaxPriCountInLeaf  sQbvhMaxPriCountInLeaf
 #define sFbvhPrimitiveCount     sQbvhPrimitiveCount
+#define sFbvhCompressedNodeMemory   sQbvhCompressedNodeMemory
+#define sFbvhPackedPrimitiveMemory  sQbvhPackedPrimitiveMemory
+#define sFbvhQuantizedLeafCount     sQbvhQuantizedLeafCount
 
 #endif
 
@@ -77,6 +86,9 @@ SORT_STATS_DEFINE_COUNTER(sObvhLeafNodeCount)
 SORT_STATS_DEFINE_COUNTER(sObvhDepth)
 SORT_STATS_DEFINE_COUNTER(sObvhMaxPriCountInLeaf)
 SORT_STATS_DEFINE_COUNTER(sObvhPrimitiveCount)
+SORT_STATS_DEFINE_COUNTER(sObvhCompressedNodeMemory)
+SORT_STATS_DEFINE_COUNTER(sObvhPackedPrimitiveMemory)
+SORT_STATS_DEFINE_COUNTER(sObvhQuantizedLeafCount)
 
 SORT_STATS_COUNTER("Spatial-Structure(OBVH)", "Total Ray Count", sRayCount);
 SORT_STATS_COUNTER("Spatial-Structure(OBVH)", "Shadow Ray Count", sShadowRayCount);
@@ -87,23 +99,157 @@ SORT_STATS_COUNTER("Spatial-Structure(OBVH)", "BVH Depth", sObvhDepth);
 SORT_STATS_COUNTER("Spatial-Structure(OBVH)", "Maximum Primitive in Leaf", sObvhMaxPriCountInLeaf);
 SORT_STATS_AVG_COUNT("Spatial-Structure(OBVH)", "Average Primitive Count in Leaf", sObvhPrimitiveCount , sObvhLeafNodeCount );
 SORT_STATS_AVG_COUNT("Spatial-Structure(OBVH)", "Average Primitive Tested per Ray", sIntersectionTest, sRayCount);
+SORT_STATS_HISTOGRAM("Spatial-Structure(OBVH)", "Nodes Visited per Ray", sTraversalSteps);
+SORT_STATS_HISTOGRAM("Spatial-Structure(OBVH)", "Leaves Visited per Ray", sLeafVisits);
+SORT_STATS_HISTOGRAM("Spatial-Structure(OBVH)", "Nodes Visited per Shadow Ray", sShadowTraversalSteps);
+SORT_STATS_HISTOGRAM("Spatial-Structure(OBVH)", "Leaves Visited per Shadow Ray", sShadowLeafVisits);
+SORT_STATS_COUNTER("Spatial-Structure(OBVH)", "Compressed Node Memory (Bytes)", sObvhCompressedNodeMemory);
+SORT_STATS_COUNTER("Spatial-Structure(OBVH)", "Packed Primitive Memory (Bytes)", sObvhPackedPrimitiveMemory);
+SORT_STATS_COUNTER("Spatial-Structure(OBVH)", "Leaves with Quantized Triangles", sObvhQuantizedLeafCount);
 
 #define sFbvhNodeCount          sObvhNodeCount
 #define sFbvhLeafNodeCount      sObvhLeafNodeCount
 #define sFbvhDepth              sObvhDepth
 #define sFbvhMaxPriCountInLeaf  sObvhMaxPriCountInLeaf
 #define sFbvhPrimitiveCount     sObvhPrimitiveCount
+#define sFbvhCompressedNodeMemory   sObvhCompressedNodeMemory
+#define sFbvhPackedPrimitiveMemory  sObvhPackedPrimitiveMemory
+#define sFbvhQuantizedLeafCount     sObvhQuantizedLeafCount
+
+#endif
+
+#ifdef HBVH_IMPLEMENTATION
+
+SORT_STATS_DEFINE_COUNTER(sHbvhNodeCount)
+SORT_STATS_DEFINE_COUNTER(sHbvhLeafNodeCount)
+SORT_STATS_DEFINE_COUNTER(sHbvhDepth)
+SORT_STATS_DEFINE_COUNTER(sHbvhMaxPriCountInLeaf)
+SORT_STATS_DEFINE_COUNTER(sHbvhPrimitiveCount)
+SORT_STATS_DEFINE_COUNTER(sHbvhCompressedNodeMemory)
+SORT_STATS_DEFINE_COUNTER(sHbvhPackedPrimitiveMemory)
+SORT_STATS_DEFINE_COUNTER(sHbvhQuantizedLeafCount)
+
+SORT_STATS_COUNTER("Spatial-Structure(HBVH)", "Total Ray Count", sRayCount);
+SORT_STATS_COUNTER("Spatial-Structure(HBVH)", "Shadow Ray Count", sShadowRayCount);
+SORT_STATS_COUNTER("Spatial-Structure(HBVH)", "Intersection Test", sIntersectionTest );
+SORT_STATS_COUNTER("Spatial-Structure(HBVH)", "Node Count", sHbvhNodeCount);
+SORT_STATS_COUNTER("Spatial-Structure(HBVH)", "Leaf Node Count", sHbvhLeafNodeCount);
+SORT_STATS_COUNTER("Spatial-Structure(HBVH)", "BVH Depth", sHbvhDepth);
+SORT_STATS_COUNTER("Spatial-Structure(HBVH)", "Maximum Primitive in Leaf", sHbvhMaxPriCountInLeaf);
+SORT_STATS_AVG_COUNT("Spatial-Structure(HBVH)", "Average Primitive Count in Leaf", sHbvhPrimitiveCount , sHbvhLeafNodeCount );
+SORT_STATS_AVG_COUNT("Spatial-Structure(HBVH)", "Average Primitive Tested per Ray", sIntersectionTest, sRayCount);
+SORT_STATS_HISTOGRAM("Spatial-Structure(HBVH)", "Nodes Visited per Ray", sTraversalSteps);
+SORT_STATS_HISTOGRAM("Spatial-Structure(HBVH)", "Leaves Visited per Ray", sLeafVisits);
+SORT_STATS_HISTOGRAM("Spatial-Structure(HBVH)", "Nodes Visited per Shadow Ray", sShadowTraversalSteps);
+SORT_STATS_HISTOGRAM("Spatial-Structure(HBVH)", "Leaves Visited per Shadow Ray", sShadowLeafVisits);
+SORT_STATS_COUNTER("Spatial-Structure(HBVH)", "Compressed Node Memory (Bytes)", sHbvhCompressedNodeMemory);
+SORT_STATS_COUNTER("Spatial-Structure(HBVH)", "Packed Primitive Memory (Bytes)", sHbvhPackedPrimitiveMemory);
+SORT_STATS_COUNTER("Spatial-Structure(HBVH)", "Leaves with Quantized Triangles", sHbvhQuantizedLeafCount);
+
+#define sFbvhNodeCount          sHbvhNodeCount
+#define sFbvhLeafNodeCount      sHbvhLeafNodeCount
+#define sFbvhDepth              sHbvhDepth
+#define sFbvhMaxPriCountInLeaf  sHbvhMaxPriCountInLeaf
+#define sFbvhPrimitiveCount     sHbvhPrimitiveCount
+#define sFbvhCompressedNodeMemory   sHbvhCompressedNodeMemory
+#define sFbvhPackedPrimitiveMemory  sHbvhPackedPrimitiveMemory
+#define sFbvhQuantizedLeafCount     sHbvhQuantizedLeafCount
 
 #endif
 
 SORT_STATIC_FORCEINLINE BBox calcBoundingBox(const Fbvh_Node* const node , const Bvh_Primitive* const primitives ) {
-    BBox node_bbox;
     if (!node)
-        return node_bbox;
-    for (auto i = node->pri_offset; node && i < node->pri_offset + node->pri_cnt; i++)
-        node_bbox.Union(primitives[i].GetBBox());
-    return node_bbox;
+        return BBox();
+    return calcBoundingBox(primitives, node->pri_offset, node->pri_offset + node->pri_cnt);
+}
+
+// Children hit by a ray are sorted by keys mixing their entry distances with their indices. Entry distances are never negative,
+// their bits are ordered the same way as unsigned integers. The lowest bits of the mantissa are replaced with the index of the
+// child, which moves the entry distance a few ulps closer at most, it is still conservative for culling.
+static constexpr unsigned int FBVH_CHILD_INDEX_MASK = FBVH_CHILD_CNT - 1;
+
+SORT_STATIC_FORCEINLINE void compareExchange( unsigned int& a , unsigned int& b ){
+    const auto lo = std::min( a , b );
+    b = std::max( a , b );
+    a = lo;
+}
+
+//! @brief  Sort children hit by a ray from the nearest to the farthest one with a sorting network.
+//!
+//! @param  f_min       Entry distances of children.
+//! @param  mask        Bit mask of children hit by the ray.
+//! @param  fmax        Children farther than this are discarded.
+//! @param  keys        Sorted keys of children, discarded ones are at the end.
+//! @return             Number of sorted children that are not discarded.
+template<class T>
+SORT_STATIC_FORCEINLINE unsigned int sortChildren( const T& f_min , int mask , float fmax , unsigned int* keys ){
+    auto cnt = 0u;
+    for( auto k = 0u ; k < (unsigned)FBVH_CHILD_CNT ; ++k ){
+        keys[k] = 0xffffffff;
+        if( ( ( mask >> k ) & 1 ) && f_min[k] <= fmax ){
+            const float t = f_min[k];
+            unsigned int bits;
+            memcpy( &bits , &t , sizeof( bits ) );
+            keys[k] = ( bits & ~FBVH_CHILD_INDEX_MASK ) | k;
+            ++cnt;
+        }
+    }
+
+#if FBVH_CHILD_CNT == 4
+    compareExchange( keys[0] , keys[1] ); compareExchange( keys[2] , keys[3] );
+    compareExchange( keys[0] , keys[2] ); compareExchange( keys[1] , keys[3] );
+    compareExchange( keys[1] , keys[2] );
+#elif FBVH_CHILD_CNT == 16
+    // a sorting network gets too long, children that are hit are only a few of them most of the time anyway
+    std::sort( keys , keys + FBVH_CHILD_CNT );
+#else
+    // Batcher's odd-even merge sort of 8 elements
+    compareExchange( keys[0] , keys[1] ); compareExchange( keys[2] , keys[3] ); compareExchange( keys[4] , keys[5] ); compareExchange( keys[6] , keys[7] );
+    compareExchange( keys[0] , keys[2] ); compareExchange( keys[1] , keys[3] ); compareExchange( keys[4] , keys[6] ); compareExchange( keys[5] , keys[7] );
+    compareExchange( keys[1] , keys[2] ); compareExchange( keys[5] , keys[6] );
+    compareExchange( keys[0] , keys[4] ); compareExchange( keys[1] , keys[5] ); compareExchange( keys[2] , keys[6] ); compareExchange( keys[3] , keys[7] );
+    compareExchange( keys[2] , keys[4] ); compareExchange( keys[3] , keys[5] );
+    compareExchange( keys[1] , keys[2] ); compareExchange( keys[3] , keys[4] ); compareExchange( keys[5] , keys[6] );
+#endif
+
+    return cnt;
+}
+
+SORT_STATIC_FORCEINLINE unsigned int childIndex( unsigned int key ){
+    return key & FBVH_CHILD_INDEX_MASK;
+}
+
+SORT_STATIC_FORCEINLINE float childDistance( unsigned int key ){
+    const unsigned int bits = key & ~FBVH_CHILD_INDEX_MASK;
+    float t;
+    memcpy( &t , &bits , sizeof( t ) );
+    return t;
+}
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
+// Record the intersection between a shadow ray and a primitive, it returns true if the ray is blocked by the primitive.
+SORT_STATIC_FORCEINLINE bool intersectShadow( const Ray& ray , const Primitive* primitive , ShadowIntersections& intersect ){
+    if( intersect.IsRecorded( primitive ) )
+        return false;
+
+    SurfaceInteraction intersection;
+    intersection.t = intersect.maxt;
+    if( !primitive->GetIntersect( ray , &intersection ) )
+        return false;
+
+    // an instance fills the primitive of its prototype, whose material is the one of interest.
+    sAssert(IS_PTR_VALID(intersection.primitive), SPATIAL_ACCELERATOR );
+    if( !intersection.primitive->HasTransparency() ){
+        intersect.blocked = true;
+        return true;
+    }
+
+    // only the nearest intersection with a sphere, an instance or a subdivision patch is reported, there could be more behind it.
+    const auto type = primitive->GetShapeType();
+    intersect.Add( intersection , SHAPE_SPHERE != type && SHAPE_INSTANCE != type && SHAPE_SUBDIVISION != type );
+    return false;
 }
+#endif
 
 void Fbvh::Build(const std::vector<const Primitive*>& primitives, const BBox& bbox){
     SORT_PROFILE("Build Fbvh");
@@ -112,27 +258,109 @@ void Fbvh::Build(const std::vector<const Primitive*>& primitives, const BBox& bb
 	if( primitives.empty() )
 		return;
 
-    m_bvhpri = std::make_unique<Bvh_Primitive[]>(m_primitives->size());
-
     m_bbox = bbox;
+    m_depth = 0;
+    releaseNodes();
 
-    // generate BVH primitives
-    const auto primitive_cnt = m_primitives->size();
-    for (auto i = 0u; i < primitive_cnt; ++i)
-        m_bvhpri[i].SetPrimitive((*m_primitives)[i]);
-    
-    // recursively split node
-    m_root = makeFastBvhNode( 0 , (unsigned)m_primitives->size() );
-    splitNode( m_root.get() , m_bbox , 1u );
+    const auto primitive_cnt = (unsigned)m_primitives->size();
+    const auto budget = m_linearBuild ? 0u : (unsigned)( primitive_cnt * m_spatialSplitBudget );
+
+    // leaves may hold more references than primitives if spatial splits are enabled
+    m_bvhpri = make_large_array<Bvh_Primitive>( primitive_cnt + budget );
+
+    // recursively split node, sub-trees are split in parallel
+    m_root = makeFastBvhNode( 0 , primitive_cnt );
+    if( budget > 0 ){
+        Bvh_References refs( primitive_cnt );
+        setupBvhPrimitives( refs.data() , *m_primitives );
+
+        Bvh_Spatial_Split_Context context( budget , bbox );
+        TaskGroup group;
+        splitNodeSpatial( m_root.get() , m_bbox , refs , 1u , context , group );
+        group.Join();
+
+        m_bvhpriCnt = context.offset;
+        SORT_STATS(sFbvhPrimitiveCount += (StatsInt)context.offset);
+    }else{
+        // generate BVH primitives
+        setupBvhPrimitives( m_bvhpri.get() , *m_primitives );
+        if( m_linearBuild )
+            m_mortonCodes = sortBvhPrimitivesByMortonCode( m_bvhpri.get() , primitive_cnt );
+
+        if( m_optimizedBuild && !m_linearBuild ){
+            // a binary BVH split down to single primitives, restructured and then collapsed into wide nodes
+            Bvh_Binary_Node binary;
+            binary.pri_cnt = primitive_cnt;
+            {
+                TaskGroup group;
+                splitBinaryNode( &binary , m_bvhpri.get() , 1u , group );
+                group.Join();
+            }
+            restructureBinaryBvh( &binary );
+
+            const auto node_cnt = reorderBinaryBvh( &binary , m_bvhpri.get() , primitive_cnt );
+            Bvh_Collapse_Table table( (std::size_t)node_cnt * FBVH_CHILD_CNT );
+            evaluateCollapseCost( &binary , table , FBVH_CHILD_CNT , m_maxPriInLeaf );
+
+            TaskGroup group;
+            collapseNode( m_root.get() , &binary , table , 1u , group );
+            group.Join();
+        }else{
+            TaskGroup group;
+            splitNode( m_root.get() , m_bbox , 1u , group );
+            group.Join();
+        }
+
+        std::vector<unsigned>().swap( m_mortonCodes );
+
+        m_bvhpriCnt = primitive_cnt;
+        SORT_STATS(sFbvhPrimitiveCount += (StatsInt)primitive_cnt);
+    }
+
+    orderChildren( m_root.get() );
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+    // quantized nodes take a fraction of the memory, they are the fallback once the memory budget runs out
+    if( !m_compressNodes ){
+        const auto node_memory = (unsigned long long)countInteriorNodes( m_root.get() ) * sizeof(Fast_Bvh_Node);
+        if( node_memory > GetMemoryBudgetLeft( MemoryCategory::Accelerator ) ){
+            slog( WARNING , SPATIAL_ACCELERATOR , "Nodes of the BVH exceed the memory budget of acceleration structures, they are compressed." );
+            m_compressNodes = true;
+        }
+    }
+
+    if( m_compressNodes ){
+        // all interior nodes are packed in one contiguous array in depth first order
+        const auto node_cnt = countInteriorNodes( m_root.get() );
+        if( node_cnt > 0 )
+            m_compressedNodes = Fast_Bvh_Compressed_Node_Array( (Fast_Bvh_Compressed_Node*)malloc_large( sizeof(Fast_Bvh_Compressed_Node) * node_cnt , FBVH_COMPRESSED_NODE_ALIGNMENT ) );
+
+        auto compressed_cnt = 0u;
+        m_compressedLeaves.clear();
+        m_compressedRoot = compressNode( m_root , compressed_cnt );
+        m_compressedNodeCnt = compressed_cnt;
+        sAssert( compressed_cnt == node_cnt , SPATIAL_ACCELERATOR );
+
+        SORT_STATS(sFbvhCompressedNodeMemory += (StatsInt)( sizeof(Fast_Bvh_Compressed_Node) * node_cnt + sizeof(Fast_Bvh_Leaf) * m_compressedLeaves.size() ));
+    }else
+#endif
+    relayoutNodes();
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+    packPrimitives();
+#endif
+
+    m_buildSahCost = evaluateSahCost();
+
+    updateMemory( primitive_cnt + budget );
 
     // if the algorithm reaches here, it is a valid QBVH
     m_isValid = true;
 
     SORT_STATS(++sFbvhNodeCount);
-    SORT_STATS(sFbvhPrimitiveCount += (StatsInt)primitive_cnt);
 }
 
-void Fbvh::splitNode( Fbvh_Node* const node , const BBox& node_bbox , unsigned depth ){
+void Fbvh::splitNode( Fbvh_Node* const node , const BBox& node_bbox , unsigned depth , TaskGroup& group ){
     SORT_STATS(sFbvhDepth = std::max( sFbvhDepth , (StatsInt)depth ) );
 
     const auto start    = node->pri_offset;
@@ -154,9 +382,21 @@ void Fbvh::splitNode( Fbvh_Node* const node , const BBox& node_bbox , unsigned d
         const auto end      = cur_split.second;
         const auto prim_cnt = end - start;
 
+        // binary splits of a linear build are collapsed into wide nodes the same way as the ones of SAH
+        if( m_linearBuild ){
+            if( prim_cnt <= m_maxPriInLeaf ){
+                done_splitting.push( std::make_pair( start , end ) );
+            }else{
+                const auto mid = findMortonSplit( m_mortonCodes.data() , start , end );
+                to_split.push( std::make_pair( start , mid ) );
+                to_split.push( std::make_pair( mid , end ) );
+            }
+            continue;
+        }
+
         unsigned    split_axis;
         float       split_pos;
-        const auto sah = pickBestSplit(split_axis, split_pos, m_bvhpri.get(), node_bbox, start, end);
+        const auto sah = pickBestSplit(split_axis, split_pos, m_bvhpri.get(), node_bbox, start, end, rayDistribution());
         if (sah >= prim_cnt || prim_cnt <= m_maxPriInLeaf )
             done_splitting.push( std::make_pair( start , end ) );
         else{
@@ -189,22 +429,245 @@ void Fbvh::splitNode( Fbvh_Node* const node , const BBox& node_bbox , unsigned d
         populate_child( node , done_splitting );
     }
 
-    // split children if needed.
+    // Bounding boxes only depend on the ranges of children, they need to be evaluated before any child is split in other tasks.
+    BBox child_bbox[FBVH_CHILD_CNT];
+    for( auto j = 0u ; j < node->child_cnt ; ++j )
+        child_bbox[j] = calcBoundingBox( node->children[j].get() , m_bvhpri.get() );
+    setChildrenBBox( node , child_bbox );
+
+    // split children if needed, children own disjoint ranges of primitives, large ones are split in other tasks.
+    for( auto j = 0u ; j < node->child_cnt ; ++j ){
+        const auto child = node->children[j].get();
+        const auto& bbox = child_bbox[j];
+        if( child->pri_cnt > BVH_PARALLEL_BUILD_THRESHOLD )
+            group.Fork( [this, child, bbox, depth, &group](){ splitNode( child , bbox , depth + 1 , group ); } , "Split Fbvh Node" );
+        else
+            splitNode( child , bbox , depth + 1 , group );
+    }
+
+    SORT_STATS(sFbvhNodeCount+=node->child_cnt);
+}
+
+void Fbvh::collapseNode( Fbvh_Node* const node , Bvh_Binary_Node* const binary , const Bvh_Collapse_Table& table , unsigned depth , TaskGroup& group ){
+    SORT_STATS(sFbvhDepth = std::max( sFbvhDepth , (StatsInt)depth ) );
+
+    const auto start = binary->pri_offset;
+    const auto end = start + binary->pri_cnt;
+    if( binary->collapse_leaf || depth == m_maxNodeDepth ){
+        makeLeaf( node , start , end , depth );
+        return;
+    }
+
+    Bvh_Binary_Node* binary_children[FBVH_CHILD_CNT];
+    gatherCollapsedChildren( binary->left.get() , binary->collapse_left , table , FBVH_CHILD_CNT , binary_children , node->child_cnt );
+    gatherCollapsedChildren( binary->right.get() , FBVH_CHILD_CNT - binary->collapse_left , table , FBVH_CHILD_CNT , binary_children , node->child_cnt );
+
+    BBox child_bbox[FBVH_CHILD_CNT];
+    for( auto j = 0u ; j < node->child_cnt ; ++j ){
+        node->children[j] = makeFastBvhNode( binary_children[j]->pri_offset , binary_children[j]->pri_cnt );
+        child_bbox[j] = binary_children[j]->bbox;
+    }
+    setChildrenBBox( node , child_bbox );
+
+    for( auto j = 0u ; j < node->child_cnt ; ++j ){
+        const auto child = node->children[j].get();
+        const auto child_binary = binary_children[j];
+        if( child->pri_cnt > BVH_PARALLEL_BUILD_THRESHOLD )
+            group.Fork( [this, child, child_binary, &table, depth, &group](){ collapseNode( child , child_binary , table , depth + 1 , group ); } , "Collapse Fbvh Node" );
+        else
+            collapseNode( child , child_binary , table , depth + 1 , group );
+    }
+
+    SORT_STATS(sFbvhNodeCount+=node->child_cnt);
+}
+
+void Fbvh::splitNodeSpatial( Fbvh_Node* const node , const BBox& node_bbox , Bvh_References& refs , unsigned depth , Bvh_Spatial_Split_Context& context , TaskGroup& group ){
+    SORT_STATS(sFbvhDepth = std::max( sFbvhDepth , (StatsInt)depth ) );
+
+    const auto make_leaf = [&]( Bvh_References& leaf_refs ){
+        const auto offset = commitReferences( m_bvhpri.get() , leaf_refs , context );
+        makeLeaf( node , offset , offset + (unsigned)leaf_refs.size() , depth );
+    };
+
+    if( refs.size() <= m_maxPriInLeaf || depth == m_maxNodeDepth ){
+        make_leaf( refs );
+        return;
+    }
+
+    std::queue<Bvh_References> to_split, done_splitting;
+    to_split.push( std::move( refs ) );
+
+    while( !to_split.empty() && to_split.size() + done_splitting.size() < (unsigned int)FBVH_CHILD_CNT ){
+        auto cur_split = std::move( to_split.front() );
+        to_split.pop();
+
+        Bvh_References left, right;
+        if( cur_split.size() <= m_maxPriInLeaf || !splitReferences( cur_split , node_bbox , left , right , context ) ){
+            done_splitting.push( std::move( cur_split ) );
+        }else{
+            to_split.push( std::move( left ) );
+            to_split.push( std::move( right ) );
+        }
+    }
+
+    if( to_split.size() + done_splitting.size() == 1 ){
+        make_leaf( to_split.empty() ? done_splitting.front() : to_split.front() );
+        return;
+    }
+
+    // children own their references
+    Bvh_References  child_refs[FBVH_CHILD_CNT];
+    BBox            child_bbox[FBVH_CHILD_CNT];
+    const auto populate_child = [&] ( std::queue<Bvh_References>& q ){
+        while (!q.empty()) {
+            const auto k = node->child_cnt++;
+            child_refs[k] = std::move( q.front() );
+            q.pop();
+
+            child_bbox[k] = calcBoundingBox( child_refs[k].data() , 0 , (unsigned)child_refs[k].size() );
+            node->children[k] = makeFastBvhNode( 0 , (unsigned)child_refs[k].size() );
+        }
+    };
+    populate_child( to_split );
+    populate_child( done_splitting );
+
+    // Bounding boxes need to be evaluated before any child is split in other tasks.
+    setChildrenBBox( node , child_bbox );
+
+    // split children if needed, large ones are split in other tasks.
     for( auto j = 0u ; j < node->child_cnt ; ++j ){
+        const auto child = node->children[j].get();
+        const auto bbox = child_bbox[j];
+        if( child_refs[j].size() > BVH_PARALLEL_BUILD_THRESHOLD )
+            group.Fork( [this, child, bbox, r = std::move(child_refs[j]), depth, &context, &group]() mutable { splitNodeSpatial( child , bbox , r , depth + 1 , context , group ); } , "Split Fbvh Node" );
+        else
+            splitNodeSpatial( child , bbox , child_refs[j] , depth + 1 , context , group );
+    }
+
+    SORT_STATS(sFbvhNodeCount+=node->child_cnt);
+}
+
+void Fbvh::setChildrenBBox( Fbvh_Node* const node , const BBox* child_bbox ) const {
+#ifdef SIMD_BVH_IMPLEMENTATION
+    node->bbox = calcBoundingBoxSIMD( child_bbox , node->child_cnt );
+#else
+    for( auto j = 0u ; j < node->child_cnt ; ++j )
+        node->bbox[j] = child_bbox[j];
+#endif
+}
+
+BBox Fbvh::getChildBBox( const Fbvh_Node* const node , unsigned k ) const {
 #ifdef SIMD_BVH_IMPLEMENTATION
-        const auto bbox = calcBoundingBox(node->children[j].get(), m_bvhpri.get());
-        splitNode(node->children[j].get(), bbox, depth + 1);
+    BBox bbox;
+    bbox.m_Min = Point( node->bbox.m_min_x[k] , node->bbox.m_min_y[k] , node->bbox.m_min_z[k] );
+    bbox.m_Max = Point( node->bbox.m_max_x[k] , node->bbox.m_max_y[k] , node->bbox.m_max_z[k] );
+    return bbox;
 #else
-        node->bbox[j] = calcBoundingBox( node->children[j].get() , m_bvhpri.get() );
-        splitNode( node->children[j].get() , node->bbox[j] , depth + 1 );
+    return node->bbox[k];
 #endif
+}
+
+void Fbvh::orderChildren( Fbvh_Node* const node ){
+    if( 0 == node->child_cnt )
+        return;
+
+    BBox child_bbox[FBVH_CHILD_CNT];
+    float child_area[FBVH_CHILD_CNT];
+    unsigned order[FBVH_CHILD_CNT];
+    for( auto k = 0u ; k < node->child_cnt ; ++k ){
+        child_bbox[k] = getChildBBox( node , k );
+        child_area[k] = child_bbox[k].HalfSurfaceArea();
+        order[k] = k;
     }
+    std::stable_sort( order , order + node->child_cnt , [&]( unsigned a , unsigned b ){ return child_area[a] > child_area[b]; } );
+
+    // children and their bounding boxes are permuted together, the traversal doesn't care which slot a child is in
+    Fast_Bvh_Node_Ptr children[FBVH_CHILD_CNT];
+    BBox sorted_bbox[FBVH_CHILD_CNT];
+    for( auto k = 0u ; k < node->child_cnt ; ++k ){
+        children[k] = std::move( node->children[order[k]] );
+        sorted_bbox[k] = child_bbox[order[k]];
+    }
+    for( auto k = 0u ; k < node->child_cnt ; ++k )
+        node->children[k] = std::move( children[k] );
+    setChildrenBBox( node , sorted_bbox );
+
+    for( auto k = 0u ; k < node->child_cnt ; ++k )
+        orderChildren( node->children[k].get() );
+}
+
+void Fbvh::relayoutNodes(){
+    if( !m_root )
+        return;
+
+    std::function<unsigned(const Fbvh_Node*)> count_node = [&]( const Fbvh_Node* node ){
+        auto cnt = 1u;
+        for( auto k = 0u ; k < node->child_cnt ; ++k )
+            cnt += count_node( node->children[k].get() );
+        return cnt;
+    };
+    const auto node_cnt = count_node( m_root.get() );
 
 #ifdef SIMD_BVH_IMPLEMENTATION
-    node->bbox = calcBoundingBoxSIMD( node->children );
+    const auto alignment = (unsigned)SIMD_ALIGNMENT;
+#else
+    const auto alignment = (unsigned)alignof(Fast_Bvh_Node);
 #endif
+    std::unique_ptr<Fast_Bvh_Node[],LargeArrayDeallocator> nodes( (Fast_Bvh_Node*)malloc_large( sizeof(Fast_Bvh_Node) * node_cnt , alignment ) );
+    if( IS_PTR_INVALID( nodes ) )
+        return;
 
-    SORT_STATS(sFbvhNodeCount+=node->child_cnt);
+    // Nodes are moved in pre-order, the pointers to children are replaced by the ones in the array as it goes. The
+    // original nodes are released right after being moved.
+    auto cur = 0u;
+    std::function<Fast_Bvh_Node*(Fast_Bvh_Node_Ptr&)> move_node = [&]( Fast_Bvh_Node_Ptr& node ){
+        auto* moved = new ( &nodes[cur++] ) Fast_Bvh_Node( std::move( *node ) );
+        node.reset();
+        for( auto k = 0u ; k < moved->child_cnt ; ++k ){
+            auto* child = move_node( moved->children[k] );
+            moved->children[k].reset( child );
+        }
+        return moved;
+    };
+    auto* root = move_node( m_root );
+    m_root.reset( root );
+    sAssert( cur == node_cnt , SPATIAL_ACCELERATOR );
+
+    m_nodeArray = std::move( nodes );
+    m_nodeArrayCnt = node_cnt;
+}
+
+void Fbvh::updateMemory( unsigned bvhpri_cnt ){
+    auto memory = sizeof(Bvh_Primitive) * bvhpri_cnt + sizeof(Fast_Bvh_Node) * m_nodeArrayCnt;
+#ifdef SIMD_BVH_IMPLEMENTATION
+    memory += sizeof(Fast_Bvh_Compressed_Node) * m_compressedNodeCnt + sizeof(Fast_Bvh_Leaf) * m_compressedLeaves.size();
+    memory += sizeof(Simd_Triangle) * m_packedTriangleCnt + sizeof(Simd_Line) * m_packedLineCnt + sizeof(Simd_Planar) * m_packedPlanarCnt;
+    memory += sizeof(Fast_Bvh_Quantized_Leaf) * m_quantizedLeaves.size() + sizeof(Fast_Bvh_Quantized_Vertex) * m_quantizedVertices.size() +
+              sizeof(Fast_Bvh_Quantized_Triangle) * m_quantizedTriangles.size();
+#endif
+    m_memory.Set( memory );
+}
+
+void Fbvh::releaseNodes(){
+    if( IS_PTR_INVALID( m_nodeArray ) ){
+        m_root = nullptr;
+        return;
+    }
+
+    // nodes in the array are not owned by their parents, they are destructed in place and released with the array
+    for( auto i = 0u ; i < m_nodeArrayCnt ; ++i ){
+        for( auto& child : m_nodeArray[i].children )
+            child.release();
+    }
+    m_root.release();
+    for( auto i = 0u ; i < m_nodeArrayCnt ; ++i )
+        m_nodeArray[i].~Fast_Bvh_Node();
+    m_nodeArray = nullptr;
+    m_nodeArrayCnt = 0;
+}
+
+Fbvh::~Fbvh(){
+    releaseNodes();
 }
 
 void Fbvh::makeLeaf( Fbvh_Node* const node , unsigned start , unsigned end , unsigned depth ){
@@ -212,54 +675,32 @@ void Fbvh::makeLeaf( Fbvh_Node* const node , unsigned start , unsigned end , uns
     node->pri_offset = start;
     node->child_cnt = 0;
 
-    m_depth = fmax( m_depth , depth );
+    // leaves could be made in different tasks at the same time
+    auto cur_depth = m_depth.load( std::memory_order_relaxed );
+    while( cur_depth < depth && !m_depth.compare_exchange_weak( cur_depth , depth , std::memory_order_relaxed ) );
 
 #ifdef SIMD_BVH_IMPLEMENTATION
-    Simd_Triangle   sind_tri;
-    Simd_Line       simd_line;
-    std::vector<Simd_Triangle>  tri_list;
-    std::vector<Simd_Line>      line_list;
-    const auto _start = node->pri_offset;
-    const auto _end = _start + node->pri_cnt;
-    for(auto i = _start ; i < _end ; i++ ){
+    // packed primitives are only counted here, they are packed once all leaves are made.
+    auto tri_cnt = 0u , line_cnt = 0u , planar_cnt = 0u;
+    for(auto i = start ; i < end ; i++ ){
         const Primitive* primitive = m_bvhpri[i].primitive;
         const auto shape_type = primitive->GetShapeType();
-        if( SHAPE_TRIANGLE == shape_type ){
-            if( sind_tri.PushTriangle( primitive ) ){
-                if( sind_tri.PackData() ){
-                    tri_list.push_back( sind_tri );
-                    sind_tri.Reset();
-                }
-            }
-        }else if( SHAPE_LINE == shape_type ){
-            if( simd_line.PushLine( primitive ) ){
-                if( simd_line.PackData() ){
-                    line_list.push_back( simd_line );
-                    simd_line.Reset();
-                }
-            }
-        }else{
-            // line will also be specially treated in the future.
+        // triangles tested against alpha masks can't be packed, the mask is looked up for each of them.
+        if( SHAPE_TRIANGLE == shape_type && !primitive->GetShape()->HasAlphaMask() )
+            ++tri_cnt;
+        else if( SHAPE_LINE == shape_type )
+            ++line_cnt;
+        else if( SHAPE_QUAD == shape_type || SHAPE_DISK == shape_type )
+            ++planar_cnt;
+        else
             node->other_list.push_back( primitive );
-        }
-    }
-    if (sind_tri.PackData())
-        tri_list.push_back(sind_tri);
-    if (simd_line.PackData())
-        line_list.push_back(simd_line);
-    
-    if( tri_list.size() ){
-        node->tri_list = makePrimitiveList<Simd_Triangle>( (unsigned int)tri_list.size() );
-        node->tri_cnt = (unsigned int)tri_list.size();
-        for( auto i = 0u ; i < tri_list.size() ; ++i )
-            node->tri_list[i] = tri_list[i];
-    }
-    if( line_list.size() ){
-        node->line_list = makePrimitiveList<Simd_Line>( (unsigned int)line_list.size() );
-        node->line_cnt = (unsigned int)line_list.size();
-        for( auto i = 0u ; i < line_list.size() ; ++i )
-            node->line_list[i] = line_list[i];
     }
+    node->tri_cnt = ( tri_cnt + SIMD_CHANNEL - 1 ) / SIMD_CHANNEL;
+    node->line_cnt = ( line_cnt + SIMD_CHANNEL - 1 ) / SIMD_CHANNEL;
+    node->planar_cnt = ( planar_cnt + SIMD_CHANNEL - 1 ) / SIMD_CHANNEL;
+    node->tri_list = nullptr;
+    node->line_list = nullptr;
+    node->planar_list = nullptr;
 #endif
 
     SORT_STATS(++sFbvhLeafNodeCount);
@@ -267,14 +708,14 @@ void Fbvh::makeLeaf( Fbvh_Node* const node , unsigned start , unsigned end , uns
 }
 
 #ifdef SIMD_BVH_IMPLEMENTATION
-Simd_BBox Fbvh::calcBoundingBoxSIMD(const Fast_Bvh_Node_Ptr* children) const {
+Simd_BBox Fbvh::calcBoundingBoxSIMD(const BBox* child_bbox, unsigned child_cnt) const {
     Simd_BBox node_bbox;
 
     float   min_x[SIMD_CHANNEL] , min_y[SIMD_CHANNEL] , min_z[SIMD_CHANNEL];
     float   max_x[SIMD_CHANNEL] , max_y[SIMD_CHANNEL] , max_z[SIMD_CHANNEL];
     bool    bb_valid[SIMD_CHANNEL] = { false };
-    for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
-        const auto bb = calcBoundingBox( children[i].get() , m_bvhpri.get() );
+    for( auto i = 0u ; i < (unsigned)SIMD_CHANNEL ; ++i ){
+        const auto bb = i < child_cnt ? child_bbox[i] : BBox();
         min_x[i] = bb.m_Min.x;
         min_y[i] = bb.m_Min.y;
         min_z[i] = bb.m_Min.z;
@@ -282,7 +723,7 @@ Simd_BBox Fbvh::calcBoundingBoxSIMD(const Fast_Bvh_Node_Ptr* children) const {
         max_y[i] = bb.m_Max.y;
         max_z[i] = bb.m_Max.z;
 
-        bb_valid[i] = (IS_PTR_VALID(children[i].get()));
+        bb_valid[i] = i < child_cnt;
     }
 
     node_bbox.m_min_x = simd_set_ps( min_x );
@@ -297,104 +738,928 @@ Simd_BBox Fbvh::calcBoundingBoxSIMD(const Fast_Bvh_Node_Ptr* children) const {
 
     return node_bbox;
 }
-#endif
 
-bool Fbvh::GetIntersect( const Ray& ray , SurfaceInteraction& intersect ) const{
-    // std::stack is by no means an option here due to its overhead under the hood.
-    static thread_local std::unique_ptr<std::pair<Fbvh_Node*, float>[]> bvh_stack = nullptr;
-    if (UNLIKELY(IS_PTR_INVALID(bvh_stack)))
-        bvh_stack = std::make_unique<std::pair<Fbvh_Node*, float>[]>(m_depth * FBVH_CHILD_CNT);
+void Fbvh::packPrimitives(){
+    // leaves of a compressed tree are already in depth first order
+    auto tri_cnt = 0u , line_cnt = 0u , planar_cnt = 0u , leaf_cnt = (unsigned)m_compressedLeaves.size();
+    std::function<void(Fbvh_Node*)> count_node = [&]( Fbvh_Node* node ){
+        tri_cnt += node->tri_cnt;
+        line_cnt += node->line_cnt;
+        planar_cnt += node->planar_cnt;
+        leaf_cnt += ( 0 == node->child_cnt );
+        for( auto k = 0u ; k < node->child_cnt ; ++k )
+            count_node( node->children[k].get() );
+    };
+    for( const auto& leaf : m_compressedLeaves ){
+        tri_cnt += leaf.tri_cnt;
+        line_cnt += leaf.line_cnt;
+        planar_cnt += leaf.planar_cnt;
+    }
+    if( m_root )
+        count_node( m_root.get() );
+
+    m_quantizedLeaves.clear();
+    m_quantizedVertices.clear();
+    m_quantizedTriangles.clear();
+
+#ifndef SIMD_TRI_BALDWIN_WEBER
+    // quantized triangles take a fraction of the memory, they are the fallback once the memory budget runs out
+    if( !m_compressLeaves && (unsigned long long)tri_cnt * sizeof(Simd_Triangle) > GetMemoryBudgetLeft( MemoryCategory::Accelerator ) ){
+        slog( WARNING , SPATIAL_ACCELERATOR , "Triangles of the BVH exceed the memory budget of acceleration structures, they are quantized." );
+        m_compressLeaves = true;
+    }
 
-#ifdef QBVH_IMPLEMENTATION
-    SORT_PROFILE("Traverse Qbvh");
-#endif
-#ifdef OBVH_IMPLEMENTATION
-    SORT_PROFILE("Traverse Obvh");
+    if( m_compressLeaves )
+        quantizeTriangles( leaf_cnt , tri_cnt );
 #endif
 
-    SORT_STATS(++sRayCount);
+    // the arrays are reused if nothing changes, which is the case of refitting
+    if( tri_cnt != m_packedTriangleCnt || IS_PTR_INVALID( m_packedTriangles ) )
+        m_packedTriangles = Fast_Bvh_Triangle_Array( tri_cnt ? (Simd_Triangle*)malloc_large( sizeof(Simd_Triangle) * tri_cnt , SIMD_ALIGNMENT ) : nullptr );
+    if( line_cnt != m_packedLineCnt || IS_PTR_INVALID( m_packedLines ) )
+        m_packedLines = Fast_Bvh_Line_Array( line_cnt ? (Simd_Line*)malloc_large( sizeof(Simd_Line) * line_cnt , SIMD_ALIGNMENT ) : nullptr );
+    if( planar_cnt != m_packedPlanarCnt || IS_PTR_INVALID( m_packedPlanars ) )
+        m_packedPlanars = Fast_Bvh_Planar_Array( planar_cnt ? (Simd_Planar*)malloc_large( sizeof(Simd_Planar) * planar_cnt , SIMD_ALIGNMENT ) : nullptr );
+    m_packedTriangleCnt = tri_cnt;
+    m_packedLineCnt = line_cnt;
+    m_packedPlanarCnt = planar_cnt;
+
+    auto tri_offset = 0u , line_offset = 0u , planar_offset = 0u;
+    std::function<void(Fbvh_Node*)> pack_node = [&]( Fbvh_Node* node ){
+        if( 0 == node->child_cnt ){
+            packLeaf( *node , tri_offset , line_offset , planar_offset );
+            return;
+        }
+        for( auto k = 0u ; k < node->child_cnt ; ++k )
+            pack_node( node->children[k].get() );
+    };
+    for( auto& leaf : m_compressedLeaves )
+        packLeaf( leaf , tri_offset , line_offset , planar_offset );
+    if( m_root )
+        pack_node( m_root.get() );
+
+    sAssert( tri_offset == tri_cnt && line_offset == line_cnt && planar_offset == planar_cnt , SPATIAL_ACCELERATOR );
+
+    // every worker reads the nodes and packed primitives, they are spread across NUMA nodes instead of living on the one
+    // of the thread that happens to build the tree
+    InterleaveMemory( m_compressedNodes.get() , sizeof(Fast_Bvh_Compressed_Node) * m_compressedNodeCnt );
+    InterleaveMemory( m_packedTriangles.get() , sizeof(Simd_Triangle) * tri_cnt );
+    InterleaveMemory( m_packedLines.get() , sizeof(Simd_Line) * line_cnt );
+    InterleaveMemory( m_packedPlanars.get() , sizeof(Simd_Planar) * planar_cnt );
+
+    SORT_STATS(sFbvhPackedPrimitiveMemory = (StatsInt)( sizeof(Simd_Triangle) * tri_cnt + sizeof(Simd_Line) * line_cnt + sizeof(Simd_Planar) * planar_cnt +
+                                                        sizeof(Fast_Bvh_Quantized_Vertex) * m_quantizedVertices.size() +
+                                                        sizeof(Fast_Bvh_Quantized_Triangle) * m_quantizedTriangles.size() ));
+}
 
-#ifdef ENABLE_TRANSPARENT_SHADOW
-    SORT_STATS(sShadowRayCount += intersect.query_shadow);
-#endif
+//! @brief  Triangles of a leaf that are packed, in the order they are packed.
+template<class Leaf>
+static std::vector<const Primitive*> gatherTriangles( const Bvh_Primitive* bvhpri , const Leaf& leaf ){
+    std::vector<const Primitive*> triangles;
+    for( auto i = leaf.pri_offset ; i < leaf.pri_offset + leaf.pri_cnt ; ++i ){
+        const Primitive* primitive = bvhpri[i].primitive;
+        if( SHAPE_TRIANGLE == primitive->GetShapeType() && !primitive->GetShape()->HasAlphaMask() )
+            triangles.push_back( primitive );
+    }
+    return triangles;
+}
 
-    ray.Prepare();
+template<class Leaf>
+void Fbvh::packLeaf( Leaf& leaf , unsigned& tri_offset , unsigned& line_offset , unsigned& planar_offset ){
+    // quantized triangles are not packed in full precision
+    const auto packed_tri_cnt = IS_PTR_VALID( leaf.tri_quantized ) ? 0u : leaf.tri_cnt;
+    auto* tri_list = m_packedTriangles.get() + tri_offset;
+    auto* line_list = m_packedLines.get() + line_offset;
+    auto* planar_list = m_packedPlanars.get() + planar_offset;
+    leaf.tri_list = packed_tri_cnt ? tri_list : nullptr;
+    leaf.line_list = leaf.line_cnt ? line_list : nullptr;
+    leaf.planar_list = leaf.planar_cnt ? planar_list : nullptr;
+
+    Simd_Triangle   simd_tri;
+    Simd_Line       simd_line;
+    Simd_Planar     simd_planar;
+    const auto _start = leaf.pri_offset;
+    const auto _end = _start + leaf.pri_cnt;
+    for(auto i = _start ; i < _end ; i++ ){
+        const Primitive* primitive = m_bvhpri[i].primitive;
+        const auto shape_type = primitive->GetShapeType();
+        if( SHAPE_TRIANGLE == shape_type && !primitive->GetShape()->HasAlphaMask() ){
+            if( 0 == packed_tri_cnt )
+                continue;
+            if( simd_tri.PushTriangle( primitive ) && simd_tri.PackData() ){
+                new ( tri_list++ ) Simd_Triangle( simd_tri );
+                simd_tri.Reset();
+            }
+        }else if( SHAPE_LINE == shape_type ){
+            if( simd_line.PushLine( primitive ) && simd_line.PackData() ){
+                new ( line_list++ ) Simd_Line( simd_line );
+                simd_line.Reset();
+            }
+        }else if( SHAPE_QUAD == shape_type || SHAPE_DISK == shape_type ){
+            if( simd_planar.PushPlanar( primitive ) && simd_planar.PackData() ){
+                new ( planar_list++ ) Simd_Planar( simd_planar );
+                simd_planar.Reset();
+            }
+        }
+    }
+    if( simd_tri.PackData() )
+        new ( tri_list++ ) Simd_Triangle( simd_tri );
+    if( simd_line.PackData() )
+        new ( line_list++ ) Simd_Line( simd_line );
+    if( simd_planar.PackData() )
+        new ( planar_list++ ) Simd_Planar( simd_planar );
+
+    sAssert( tri_list == m_packedTriangles.get() + tri_offset + packed_tri_cnt , SPATIAL_ACCELERATOR );
+    sAssert( line_list == m_packedLines.get() + line_offset + leaf.line_cnt , SPATIAL_ACCELERATOR );
+    sAssert( planar_list == m_packedPlanars.get() + planar_offset + leaf.planar_cnt , SPATIAL_ACCELERATOR );
+    tri_offset += packed_tri_cnt;
+    line_offset += leaf.line_cnt;
+    planar_offset += leaf.planar_cnt;
+}
 
-#ifdef SIMD_BVH_IMPLEMENTATION
-    Simd_Ray_Data   simd_ray;
-    resolveRayData( ray , simd_ray );
-#endif
+template<class Func>
+void Fbvh::visitLeaves( Func&& func ){
+    // leaves of a compressed tree are already in depth first order
+    for( auto& leaf : m_compressedLeaves )
+        func( leaf );
 
-    const auto fmin = Intersect(ray, m_bbox);
-    if (fmin < 0.0f)
-        return false;
+    std::function<void(Fbvh_Node*)> visit_node = [&]( Fbvh_Node* node ){
+        if( 0 == node->child_cnt ){
+            func( *node );
+            return;
+        }
+        for( auto k = 0u ; k < node->child_cnt ; ++k )
+            visit_node( node->children[k].get() );
+    };
+    if( m_root )
+        visit_node( m_root.get() );
+}
 
-    // stack index
-    auto si = 0;
-    bvh_stack[si++] = std::make_pair( m_root.get() , fmin );
+template<class Leaf>
+bool Fbvh::quantizeLeaf( Leaf& leaf ){
+    leaf.tri_quantized = nullptr;
+    if( 0 == leaf.tri_cnt )
+        return false;
 
-    while( si > 0 ){
-        const auto top = bvh_stack[--si];
+    // triangles are grouped into lanes in the same order as they are packed in full precision
+    const auto triangles = gatherTriangles( m_bvhpri.get() , leaf );
+    sAssert( ( triangles.size() + SIMD_CHANNEL - 1 ) / SIMD_CHANNEL == leaf.tri_cnt , SPATIAL_ACCELERATOR );
 
-        const auto node = top.first;
-        const auto fmin = top.second;
-        if( intersect.t < fmin )
-            continue;
+    std::vector<Point> positions( triangles.size() * 3 );
+    BBox bbox;
+    for( auto i = 0u ; i < triangles.size() ; ++i ){
+        static_cast<const Triangle*>( triangles[i]->GetShape() )->GetVertices( positions[i * 3] , positions[i * 3 + 1] , positions[i * 3 + 2] );
+        for( auto k = 0 ; k < 3 ; ++k )
+            bbox.Union( positions[i * 3 + k] );
+    }
 
-#ifdef SIMD_BVH_IMPLEMENTATION
-        // check if it is a leaf node
-        if( 0 == node->child_cnt ){
-            for( auto i = 0u ; i < node->tri_cnt ; ++i ){
-                const auto blocked = intersectTriangle_SIMD( ray , simd_ray , node->tri_list[i] , &intersect );
+    // the cell size is a power of two so that offsets scaled by it are exact, the leaf spans no more than 16 bits of the grid
+    Fast_Bvh_Quantized_Leaf quantized;
+    auto exponent = 0;
+    std::frexp( std::max( std::max( bbox.Delta( 0 ) , std::max( bbox.Delta( 1 ) , bbox.Delta( 2 ) ) ) / (float)( 0xffff - 1 ) , FLT_MIN ) , &exponent );
+    quantized.step = std::ldexp( 1.0f , exponent );
+    for( auto axis = 0 ; axis < 3 ; ++axis )
+        quantized.base[axis] = bbox.m_Min[axis];
+
+    // A vertex is stored as the cell it falls in. The cell is picked with the same arithmetic as decoding, so that rounding can't
+    // move the vertex out of it. Vertices falling in the same cell are merged.
+    using Grid_Point = std::array<int,3>;
+    std::vector<Grid_Point> corners( positions.size() );
+    for( auto i = 0u ; i < positions.size() ; ++i ){
+        for( auto axis = 0 ; axis < 3 ; ++axis ){
+            const auto v = positions[i][axis];
+            const auto base = quantized.base[axis];
+            auto q = std::max( 0 , (int)std::floor( ( (double)v - (double)base ) / (double)quantized.step ) );
+            while( q > 0 && base + (float)q * quantized.step > v )
+                --q;
+            while( base + (float)( q + 1 ) * quantized.step < v )
+                ++q;
+            if( q + 1 > 0xffff )
+                return false;
+            corners[i][axis] = q;
+        }
+    }
 
-#ifdef ENABLE_TRANSPARENT_SHADOW
-                // A quick branching out for shadow ray if there is no semi-transparent shadow
-                // There is still possibility for false positives to survive this branch since only the nearest among four/eight possible intersections
-                // will be tested here. If the nearest intersection happens to have transparency while not the others, it won't branch out, leading to
-                // some potential defficiency. However, testing every single intersection in all possible intersections among all SIMD channels also 
-                // comes at a cost and given the chance of mixing transparent primitive and non-transparent primitives in one BVH node is not fairly high, 
-                // it makes sense to just check the nearest one. It should work pretty well for fully opaque scene.
-                // With C++ 17 compile time if, this branch can totally be resolved during compilation, which may further reduce a bit of overhead, which
-                // might not be very obvious. there could be ways to achieve it in C++ 11. Since it won't boost the performance, I will keep it this way
-                // until I have C++ 17 updated.
-                if( intersect.query_shadow && blocked ){
-                    sAssert(IS_PTR_VALID(intersect.primitive), SPATIAL_ACCELERATOR );
-                    sAssert(IS_PTR_VALID(intersect.primitive->GetMaterial()) , SPATIAL_ACCELERATOR );
-                    if( !intersect.primitive->GetMaterial()->HasTransparency() ){
-                        SORT_STATS(sIntersectionTest += ( i + 1 ) * 4);
+    auto vertices = corners;
+    std::sort( vertices.begin() , vertices.end() );
+    vertices.erase( std::unique( vertices.begin() , vertices.end() ) , vertices.end() );
+    if( vertices.size() > FBVH_QUANTIZED_VERTEX_CNT )
+        return false;
 
-                        // setting primitive to be nullptr and return true at the same time is a special 'code' 
-                        // that the above level logic will take advantage of.
-                        intersect.primitive = nullptr;
-                        return true;
-                    }
-                }
-#endif
+    m_quantizedLeaves.push_back( quantized );
+    for( const auto& v : vertices )
+        m_quantizedVertices.push_back( { (unsigned short)v[0] , (unsigned short)v[1] , (unsigned short)v[2] } );
+
+    for( auto i = 0u ; i < triangles.size() ; i += SIMD_CHANNEL ){
+        Fast_Bvh_Quantized_Triangle block;
+        for( auto j = 0u ; j < SIMD_CHANNEL && i + j < triangles.size() ; ++j ){
+            block.primitives[j] = triangles[i + j];
+            for( auto k = 0u ; k < 3 ; ++k ){
+                const auto& corner = corners[( i + j ) * 3 + k];
+                block.indices[k][j] = (unsigned char)( std::lower_bound( vertices.begin() , vertices.end() , corner ) - vertices.begin() );
             }
-            for( auto i = 0u ; i < node->line_cnt ; ++i ){
-                const auto blocked = intersectLine_SIMD( ray , simd_ray , node->line_list[i] , &intersect );
+        }
+        m_quantizedTriangles.push_back( block );
+    }
+    return true;
+}
 
-#ifdef ENABLE_TRANSPARENT_SHADOW
-                if( intersect.query_shadow && blocked ){
-                    SORT_STATS(sIntersectionTest += (i + 1 + node->tri_cnt) * 4);
-                    if( LIKELY(!intersect.primitive->GetMaterial()->HasTransparency()) ){
-                        SORT_STATS(sIntersectionTest += i + 1 + ( node->tri_cnt ) * 4);
-                        intersect.primitive = nullptr;
-                    }
-                    return true;
-                }
+#ifndef SIMD_TRI_BALDWIN_WEBER
+void Fbvh::quantizeTriangles( unsigned leaf_cnt , unsigned& tri_cnt ){
+    // headers are never reallocated, vertices and triangles are hooked up once all leaves are quantized
+    m_quantizedLeaves.reserve( leaf_cnt );
+    std::vector<std::pair<unsigned,unsigned>> offsets;
+    std::vector<const Fast_Bvh_Quantized_Leaf**> hooks;
+    visitLeaves( [&]( auto& leaf ){
+        const auto vertex_offset = (unsigned)m_quantizedVertices.size();
+        const auto triangle_offset = (unsigned)m_quantizedTriangles.size();
+        if( !quantizeLeaf( leaf ) )
+            return;
+        offsets.push_back( std::make_pair( vertex_offset , triangle_offset ) );
+        hooks.push_back( &leaf.tri_quantized );
+        tri_cnt -= leaf.tri_cnt;
+    } );
+    for( auto i = 0u ; i < m_quantizedLeaves.size() ; ++i ){
+        m_quantizedLeaves[i].vertices = m_quantizedVertices.data() + offsets[i].first;
+        m_quantizedLeaves[i].triangles = m_quantizedTriangles.data() + offsets[i].second;
+        *hooks[i] = &m_quantizedLeaves[i];
+    }
+
+    SORT_STATS(sFbvhQuantizedLeafCount += (StatsInt)m_quantizedLeaves.size());
+}
 #endif
-            }
-            if( UNLIKELY(!node->other_list.empty()) ){
-                for( auto i = 0u ; i < node->other_list.size() ; ++i ){
-                    const auto blocked = node->other_list[i]->GetIntersect( ray , &intersect );
 
-#ifdef ENABLE_TRANSPARENT_SHADOW
-                    if( intersect.query_shadow && blocked ){
-                        sAssert(IS_PTR_VALID(intersect.primitive), SPATIAL_ACCELERATOR );
-                        sAssert(IS_PTR_VALID(intersect.primitive->GetMaterial()), SPATIAL_ACCELERATOR );
-                        if( !intersect.primitive->GetMaterial()->HasTransparency() ){
-                            SORT_STATS(sIntersectionTest += i + 1 + ( node->tri_cnt + node->line_cnt ) * 4);
+//! @brief  Get the packed triangles of a leaf to be tested, quantized ones are decoded into the lanes of 'decoded'.
+//!
+//! Quantized triangles are first tested as the boxes bounding the cells of their vertices, the lanes whose boxes are hit by the ray
+//! are filled with the original vertices and the rest of them are masked out. The triangles are then tested as usual.
+//!
+//! @param  ray         The ray to be tested against the triangles.
+//! @param  simd_ray    Resolved simd ray data.
+//! @param  leaf        The leaf, either an uncompressed leaf node or a compressed leaf.
+//! @param  i           Index of the packed triangles in the leaf.
+//! @param  decoded     The triangles decoded from quantized vertices, it is untouched if the leaf is not quantized.
+//! @return             The triangles to be tested.
+template<class Leaf>
+static SORT_FORCEINLINE const Simd_Triangle& fetchTriangles( const Ray& ray , const Simd_Ray_Data& simd_ray , const Leaf* leaf , unsigned i , Simd_Triangle& decoded ){
+#ifndef SIMD_TRI_BALDWIN_WEBER
+    const auto* quantized = leaf->tri_quantized;
+    if( IS_PTR_INVALID( quantized ) )
+        return leaf->tri_list[i];
+
+    // the offsets scaled by the power of two cell size are exact, there is only one rounding in decoding, which the cells account for
+    const auto& block = quantized->triangles[i];
+    const auto step = quantized->step;
+    bool    valid[SIMD_CHANNEL];
+    float   box[2][3][SIMD_CHANNEL];
+    for( auto j = 0 ; j < SIMD_CHANNEL ; ++j ){
+        valid[j] = IS_PTR_VALID( block.primitives[j] );
+        const auto& v0 = quantized->vertices[block.indices[0][j]];
+        const auto& v1 = quantized->vertices[block.indices[1][j]];
+        const auto& v2 = quantized->vertices[block.indices[2][j]];
+        const unsigned short lo[3] = { std::min( { v0.x , v1.x , v2.x } ) , std::min( { v0.y , v1.y , v2.y } ) , std::min( { v0.z , v1.z , v2.z } ) };
+        const unsigned short hi[3] = { std::max( { v0.x , v1.x , v2.x } ) , std::max( { v0.y , v1.y , v2.y } ) , std::max( { v0.z , v1.z , v2.z } ) };
+        for( auto axis = 0 ; axis < 3 ; ++axis ){
+            box[0][axis][j] = quantized->base[axis] + (float)lo[axis] * step;
+            box[1][axis][j] = quantized->base[axis] + (float)( hi[axis] + 1 ) * step;
+        }
+    }
+
+    Simd_BBox bb;
+    bb.m_min_x = simd_set_ps( box[0][0] );
+    bb.m_min_y = simd_set_ps( box[0][1] );
+    bb.m_min_z = simd_set_ps( box[0][2] );
+    bb.m_max_x = simd_set_ps( box[1][0] );
+    bb.m_max_y = simd_set_ps( box[1][1] );
+    bb.m_max_z = simd_set_ps( box[1][2] );
+    bb.m_mask = simd_set_mask( valid );
+    simd_data f_min;
+    const auto hit = IntersectBBox_SIMD( ray , simd_ray , bb , f_min );
+
+    // only the triangles that could be hit touch the mesh, they are tested exactly the same way as full precision ones
+    bool    mask[SIMD_CHANNEL];
+    float   p[3][3][SIMD_CHANNEL] = { { { 0.0f } } };
+    for( auto j = 0 ; j < SIMD_CHANNEL ; ++j ){
+        decoded.m_ori_pri[j] = block.primitives[j];
+        mask[j] = ( hit >> j ) & 1;
+        if( !mask[j] )
+            continue;
+
+        Point v[3];
+        static_cast<const Triangle*>( block.primitives[j]->GetShape() )->GetVertices( v[0] , v[1] , v[2] );
+        for( auto k = 0 ; k < 3 ; ++k ){
+            p[k][0][j] = v[k].x;
+            p[k][1][j] = v[k].y;
+            p[k][2][j] = v[k].z;
+        }
+    }
+
+    decoded.m_p0_x = simd_set_ps( p[0][0] );
+    decoded.m_p0_y = simd_set_ps( p[0][1] );
+    decoded.m_p0_z = simd_set_ps( p[0][2] );
+    decoded.m_p1_x = simd_set_ps( p[1][0] );
+    decoded.m_p1_y = simd_set_ps( p[1][1] );
+    decoded.m_p1_z = simd_set_ps( p[1][2] );
+    decoded.m_p2_x = simd_set_ps( p[2][0] );
+    decoded.m_p2_y = simd_set_ps( p[2][1] );
+    decoded.m_p2_z = simd_set_ps( p[2][2] );
+    decoded.m_mask = simd_set_mask( mask );
+    return decoded;
+#else
+    return leaf->tri_list[i];
+#endif
+}
+#endif
+
+// Accessors hiding the layout of nodes from the traversal, the same traversal code works on both uncompressed and compressed nodes.
+struct Fbvh::Uncompressed_Tree{
+    using Node = const Fbvh_Node*;
+
+    static SORT_FORCEINLINE Node Root( const Fbvh& bvh ){
+        return bvh.m_root.get();
+    }
+    static SORT_FORCEINLINE const Fbvh_Node* Leaf( const Fbvh& bvh , Node node ){
+        return 0 == node->child_cnt ? node : nullptr;
+    }
+    static SORT_FORCEINLINE Node Child( const Fbvh& bvh , Node node , int k ){
+        return node->children[k].get();
+    }
+    static SORT_FORCEINLINE unsigned ChildCnt( const Fbvh& bvh , Node node ){
+        return node->child_cnt;
+    }
+    static SORT_FORCEINLINE void Prefetch( const Fbvh& bvh , Node node ){
+        // the bounding boxes take most of the node, the rest of it is only touched by leaves
+        for( auto offset = 0u ; offset < sizeof( Fbvh_Node ) ; offset += 64 )
+            SORT_PREFETCH( (const char*)node + offset );
+    }
+#ifdef SIMD_BVH_IMPLEMENTATION
+    static SORT_FORCEINLINE int IntersectChildren( const Fbvh& bvh , Node node , const Ray& ray , const Simd_Ray_Data& simd_ray , simd_data& f_min ){
+        return IntersectBBox_SIMD( ray , simd_ray , node->bbox , f_min );
+    }
+#endif
+};
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+struct Fbvh::Compressed_Tree{
+    using Node = unsigned int;
+
+    static SORT_FORCEINLINE Node Root( const Fbvh& bvh ){
+        return bvh.m_compressedRoot;
+    }
+    static SORT_FORCEINLINE const Fast_Bvh_Leaf* Leaf( const Fbvh& bvh , Node node ){
+        return ( node & FBVH_COMPRESSED_LEAF ) ? &bvh.m_compressedLeaves[node & ~FBVH_COMPRESSED_LEAF] : nullptr;
+    }
+    static SORT_FORCEINLINE Node Child( const Fbvh& bvh , Node node , int k ){
+        return bvh.m_compressedNodes[node].children[k];
+    }
+    static SORT_FORCEINLINE unsigned ChildCnt( const Fbvh& bvh , Node node ){
+        // empty slots never pass the ray/box test since they are masked out
+        return FBVH_CHILD_CNT;
+    }
+    static SORT_FORCEINLINE void Prefetch( const Fbvh& bvh , Node node ){
+        if( node & FBVH_COMPRESSED_LEAF ){
+            const auto& leaf = bvh.m_compressedLeaves[node & ~FBVH_COMPRESSED_LEAF];
+            SORT_PREFETCH( &leaf );
+            return;
+        }
+        for( auto offset = 0u ; offset < sizeof( Fast_Bvh_Compressed_Node ) ; offset += FBVH_COMPRESSED_NODE_ALIGNMENT )
+            SORT_PREFETCH( (const char*)&bvh.m_compressedNodes[node] + offset );
+    }
+    static SORT_FORCEINLINE int IntersectChildren( const Fbvh& bvh , Node node , const Ray& ray , const Simd_Ray_Data& simd_ray , simd_data& f_min ){
+        const auto& n = bvh.m_compressedNodes[node];
+
+        const auto qmin_x = simd_set_u8_ps( n.qmin_x );
+        const auto qmax_x = simd_set_u8_ps( n.qmax_x );
+
+        Simd_BBox bb;
+        bb.m_min_x = simd_mad_ps( qmin_x , simd_set_ps1( n.scale[0] ) , simd_set_ps1( n.origin[0] ) );
+        bb.m_max_x = simd_mad_ps( qmax_x , simd_set_ps1( n.scale[0] ) , simd_set_ps1( n.origin[0] ) );
+        bb.m_min_y = simd_mad_ps( simd_set_u8_ps( n.qmin_y ) , simd_set_ps1( n.scale[1] ) , simd_set_ps1( n.origin[1] ) );
+        bb.m_max_y = simd_mad_ps( simd_set_u8_ps( n.qmax_y ) , simd_set_ps1( n.scale[1] ) , simd_set_ps1( n.origin[1] ) );
+        bb.m_min_z = simd_mad_ps( simd_set_u8_ps( n.qmin_z ) , simd_set_ps1( n.scale[2] ) , simd_set_ps1( n.origin[2] ) );
+        bb.m_max_z = simd_mad_ps( simd_set_u8_ps( n.qmax_z ) , simd_set_ps1( n.scale[2] ) , simd_set_ps1( n.origin[2] ) );
+        bb.m_mask  = simd_cmple_ps( qmin_x , qmax_x );
+
+        return IntersectBBox_SIMD( ray , simd_ray , bb , f_min );
+    }
+};
+#endif
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+unsigned Fbvh::countInteriorNodes( const Fbvh_Node* node ) const{
+    if( 0 == node->child_cnt )
+        return 0;
+
+    auto cnt = 1u;
+    for( auto i = 0u ; i < node->child_cnt ; ++i )
+        cnt += countInteriorNodes( node->children[i].get() );
+    return cnt;
+}
+
+unsigned Fbvh::compressLeaf( Fast_Bvh_Node_Ptr& node ){
+    Fast_Bvh_Leaf leaf;
+    leaf.tri_list = node->tri_list;
+    leaf.line_list = node->line_list;
+    leaf.planar_list = node->planar_list;
+    leaf.tri_quantized = node->tri_quantized;
+    leaf.tri_cnt = node->tri_cnt;
+    leaf.line_cnt = node->line_cnt;
+    leaf.planar_cnt = node->planar_cnt;
+    leaf.other_list = std::move( node->other_list );
+    leaf.pri_cnt = node->pri_cnt;
+    leaf.pri_offset = node->pri_offset;
+    m_compressedLeaves.push_back( std::move( leaf ) );
+
+    node.reset();
+    return FBVH_COMPRESSED_LEAF | (unsigned)( m_compressedLeaves.size() - 1 );
+}
+
+unsigned Fbvh::compressNode( Fast_Bvh_Node_Ptr& node , unsigned& node_cnt ){
+    if( 0 == node->child_cnt )
+        return compressLeaf( node );
+
+    const auto index = node_cnt++;
+    auto& compressed = *new ( &m_compressedNodes[index] ) Fast_Bvh_Compressed_Node();
+
+    // children don't always own contiguous ranges of primitives with spatial splits, their bounding boxes are read from the node instead.
+    BBox child_bbox[FBVH_CHILD_CNT];
+    for( auto k = 0u ; k < node->child_cnt ; ++k )
+        child_bbox[k] = getChildBBox( node.get() , k );
+    quantizeChildren( compressed , child_bbox , node->child_cnt );
+
+    for( auto k = 0u ; k < FBVH_CHILD_CNT ; ++k )
+        compressed.children[k] = k < node->child_cnt ? compressNode( node->children[k] , node_cnt ) : 0;
+
+    // the uncompressed node is not needed anymore
+    node.reset();
+    return index;
+}
+
+void Fbvh::quantizeChildren( Fast_Bvh_Compressed_Node& compressed , const BBox* child_bbox , unsigned child_cnt ) const{
+    // children are quantized relative to the bounding box of the node
+    BBox frame;
+    for( auto k = 0u ; k < child_cnt ; ++k )
+        frame.Union( child_bbox[k] );
+
+    for( auto axis = 0 ; axis < 3 ; ++axis ){
+        auto scale = ( frame.m_Max[axis] - frame.m_Min[axis] ) / 255.0f;
+
+        // make sure the largest quantized value still covers the whole node after rounding
+        while( frame.m_Min[axis] + 255.0f * scale < frame.m_Max[axis] )
+            scale = std::nextafter( scale , FLT_MAX );
+
+        compressed.origin[axis] = frame.m_Min[axis];
+        compressed.scale[axis] = scale;
+    }
+
+    // quantized boxes need to be conservative, rounding errors during decompression are taken into account too
+    const auto quantize = [&]( float v , int axis , bool is_max ) -> unsigned char {
+        const auto origin = compressed.origin[axis];
+        const auto scale = compressed.scale[axis];
+        if( scale <= 0.0f )
+            return 0;
+
+        const auto q = ( v - origin ) / scale;
+        auto i = std::min( 255 , std::max( 0 , (int)( is_max ? std::ceil( q ) : std::floor( q ) ) ) );
+        if( is_max ){
+            while( i < 255 && origin + (float)i * scale < v )
+                ++i;
+        }else{
+            while( i > 0 && origin + (float)i * scale > v )
+                --i;
+        }
+        return (unsigned char)i;
+    };
+
+    unsigned char* qmin[3] = { compressed.qmin_x , compressed.qmin_y , compressed.qmin_z };
+    unsigned char* qmax[3] = { compressed.qmax_x , compressed.qmax_y , compressed.qmax_z };
+    for( auto k = 0u ; k < FBVH_CHILD_CNT ; ++k ){
+        for( auto axis = 0 ; axis < 3 ; ++axis ){
+            // empty slots are inverted boxes
+            qmin[axis][k] = k < child_cnt ? quantize( child_bbox[k].m_Min[axis] , axis , false ) : 255;
+            qmax[axis][k] = k < child_cnt ? quantize( child_bbox[k].m_Max[axis] , axis , true ) : 0;
+        }
+    }
+}
+
+BBox Fbvh::getChildBBox( const Fast_Bvh_Compressed_Node& node , unsigned k ) const{
+    BBox bbox;
+    bbox.m_Min = Point( node.origin[0] + (float)node.qmin_x[k] * node.scale[0] , node.origin[1] + (float)node.qmin_y[k] * node.scale[1] , node.origin[2] + (float)node.qmin_z[k] * node.scale[2] );
+    bbox.m_Max = Point( node.origin[0] + (float)node.qmax_x[k] * node.scale[0] , node.origin[1] + (float)node.qmax_y[k] * node.scale[1] , node.origin[2] + (float)node.qmax_z[k] * node.scale[2] );
+    return bbox;
+}
+
+BBox Fbvh::refitCompressedNode( unsigned index , unsigned depth ){
+    if( index & FBVH_COMPRESSED_LEAF ){
+        const auto& leaf = m_compressedLeaves[index & ~FBVH_COMPRESSED_LEAF];
+        return refitBvhPrimitives( m_bvhpri.get() , leaf.pri_offset , leaf.pri_offset + leaf.pri_cnt );
+    }
+
+    // used slots always come first, empty ones are inverted boxes
+    auto& node = m_compressedNodes[index];
+    auto child_cnt = 0u;
+    while( child_cnt < (unsigned)FBVH_CHILD_CNT && node.qmin_x[child_cnt] <= node.qmax_x[child_cnt] )
+        ++child_cnt;
+
+    // all children need to be refitted before the node is quantized again
+    BBox child_bbox[FBVH_CHILD_CNT];
+    if( depth < PARALLEL_REFIT_DEPTH ){
+        TaskGroup group;
+        for( auto k = 1u ; k < child_cnt ; ++k ){
+            const auto child = node.children[k];
+            auto& bbox = child_bbox[k];
+            group.Fork( [this, child, depth, &bbox](){ bbox = refitCompressedNode( child , depth + 1 ); } , "Refit Fbvh Node" );
+        }
+        if( child_cnt > 0 )
+            child_bbox[0] = refitCompressedNode( node.children[0] , depth + 1 );
+        group.Join();
+    }else{
+        for( auto k = 0u ; k < child_cnt ; ++k )
+            child_bbox[k] = refitCompressedNode( node.children[k] , depth + 1 );
+    }
+
+    quantizeChildren( node , child_bbox , child_cnt );
+
+    BBox bbox;
+    for( auto k = 0u ; k < child_cnt ; ++k )
+        bbox.Union( child_bbox[k] );
+    return bbox;
+}
+#endif
+
+bool Fbvh::Refit(){
+    SORT_PROFILE("Refit Fbvh");
+
+    if( !m_isValid )
+        return false;
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+    if( IS_PTR_VALID( m_compressedNodes ) || !m_compressedLeaves.empty() )
+        refitCompressedNode( m_compressedRoot , 1u );
+    else
+#endif
+    if( m_root )
+        refitNode( m_root.get() , 1u );
+    else
+        return false;
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+    // packed primitives keep the positions they had, they need to be packed again after moving
+    packPrimitives();
+#endif
+
+    // the topology is kept no matter how far primitives move, it is not worth tracing rays against a degraded tree.
+    return evaluateSahCost() <= m_buildSahCost * BVH_REFIT_SAH_DEGRADATION;
+}
+
+BBox Fbvh::refitNode( Fbvh_Node* const node , unsigned depth ){
+    if( 0 == node->child_cnt )
+        return refitBvhPrimitives( m_bvhpri.get() , node->pri_offset , node->pri_offset + node->pri_cnt );
+
+    // all children need to be refitted before their bounding boxes are filled in the node
+    BBox child_bbox[FBVH_CHILD_CNT];
+    if( depth < PARALLEL_REFIT_DEPTH ){
+        TaskGroup group;
+        for( auto k = 1u ; k < node->child_cnt ; ++k ){
+            const auto child = node->children[k].get();
+            auto& bbox = child_bbox[k];
+            group.Fork( [this, child, depth, &bbox](){ bbox = refitNode( child , depth + 1 ); } , "Refit Fbvh Node" );
+        }
+        child_bbox[0] = refitNode( node->children[0].get() , depth + 1 );
+        group.Join();
+    }else{
+        for( auto k = 0u ; k < node->child_cnt ; ++k )
+            child_bbox[k] = refitNode( node->children[k].get() , depth + 1 );
+    }
+
+    setChildrenBBox( node , child_bbox );
+
+    BBox bbox;
+    for( auto k = 0u ; k < node->child_cnt ; ++k )
+        bbox.Union( child_bbox[k] );
+    return bbox;
+}
+
+float Fbvh::evaluateSahCost() const{
+    const auto scene_area = m_bbox.HalfSurfaceArea();
+    if( scene_area <= 0.0f )
+        return 0.0f;
+
+    // the root costs one traversal step, interior children cost one more, leaves cost one intersection test per primitive
+    auto cost = scene_area;
+#ifdef SIMD_BVH_IMPLEMENTATION
+    if( IS_PTR_VALID( m_compressedNodes ) || !m_compressedLeaves.empty() ){
+        std::function<void(unsigned)> evaluate = [&]( unsigned index ){
+            if( index & FBVH_COMPRESSED_LEAF )
+                return;
+
+            const auto& node = m_compressedNodes[index];
+            for( auto k = 0u ; k < (unsigned)FBVH_CHILD_CNT && node.qmin_x[k] <= node.qmax_x[k] ; ++k ){
+                const auto child = node.children[k];
+                const auto area = getChildBBox( node , k ).HalfSurfaceArea();
+                cost += ( child & FBVH_COMPRESSED_LEAF ) ? area * (float)m_compressedLeaves[child & ~FBVH_COMPRESSED_LEAF].pri_cnt : area;
+                evaluate( child );
+            }
+        };
+        if( m_compressedRoot & FBVH_COMPRESSED_LEAF )
+            cost *= (float)m_compressedLeaves[m_compressedRoot & ~FBVH_COMPRESSED_LEAF].pri_cnt;
+        else
+            evaluate( m_compressedRoot );
+        return cost / scene_area;
+    }
+#endif
+
+    if( !m_root )
+        return 0.0f;
+
+    std::function<void(const Fbvh_Node*)> evaluate = [&]( const Fbvh_Node* node ){
+        for( auto k = 0u ; k < node->child_cnt ; ++k ){
+            const auto child = node->children[k].get();
+            const auto area = getChildBBox( node , k ).HalfSurfaceArea();
+            cost += child->child_cnt ? area : area * (float)child->pri_cnt;
+            evaluate( child );
+        }
+    };
+    if( 0 == m_root->child_cnt )
+        cost *= (float)m_root->pri_cnt;
+    else
+        evaluate( m_root.get() );
+    return cost / scene_area;
+}
+
+bool Fbvh::GetIntersect( const Ray& ray , SurfaceInteraction& intersect ) const{
+#ifdef SIMD_BVH_IMPLEMENTATION
+    const auto found = m_compressNodes ? getIntersect<Compressed_Tree>( ray , intersect ) : getIntersect<Uncompressed_Tree>( ray , intersect );
+#else
+    const auto found = getIntersect<Uncompressed_Tree>( ray , intersect );
+#endif
+
+    // attributes are only evaluated for the nearest hit
+    FinalizeInteraction( ray , intersect );
+    return found;
+}
+
+void Fbvh::GetIntersect( const Ray* rays , SurfaceInteraction* intersects , unsigned int cnt ) const{
+#ifdef SIMD_BVH_IMPLEMENTATION
+    if( m_compressNodes )
+        getIntersect<Compressed_Tree>( rays , intersects , cnt );
+    else
+#endif
+        getIntersect<Uncompressed_Tree>( rays , intersects , cnt );
+
+    for( auto i = 0u ; i < cnt ; ++i )
+        FinalizeInteraction( rays[i] , intersects[i] );
+}
+
+void Fbvh::GetIntersectIncoherent( const Ray* rays , SurfaceInteraction* intersects , unsigned int cnt ) const{
+#ifdef SIMD_BVH_IMPLEMENTATION
+    if( m_compressNodes )
+        getIntersectInterleaved<Compressed_Tree>( rays , intersects , cnt );
+    else
+#endif
+        getIntersectInterleaved<Uncompressed_Tree>( rays , intersects , cnt );
+
+    for( auto i = 0u ; i < cnt ; ++i )
+        FinalizeInteraction( rays[i] , intersects[i] );
+}
+
+bool Fbvh::IsOccluded( const Ray& ray ) const{
+#ifdef SIMD_BVH_IMPLEMENTATION
+    if( m_compressNodes )
+        return isOccluded<Compressed_Tree>( ray , nullptr );
+#endif
+    return isOccluded<Uncompressed_Tree>( ray , nullptr );
+}
+
+bool Fbvh::IsOccluded( const Ray& ray , const Primitive*& occluder ) const{
+    occluder = nullptr;
+#ifdef SIMD_BVH_IMPLEMENTATION
+    if( m_compressNodes )
+        return isOccluded<Compressed_Tree>( ray , &occluder );
+#endif
+    return isOccluded<Uncompressed_Tree>( ray , &occluder );
+}
+
+void Fbvh::IsOccluded( const Ray* rays , bool* occluded , unsigned int cnt ) const{
+#ifdef SIMD_BVH_IMPLEMENTATION
+    if( m_compressNodes )
+        return isOccluded<Compressed_Tree>( rays , occluded , cnt );
+#endif
+    isOccluded<Uncompressed_Tree>( rays , occluded , cnt );
+}
+
+void Fbvh::IntersectBatch( const RayBatch& rays , HitRecord* hits ) const{
+    static thread_local std::vector<Ray>                    active_rays;
+    static thread_local std::vector<SurfaceInteraction>     active_hits;
+    static thread_local std::vector<unsigned int>           active_ids;
+
+    active_rays.clear();
+    active_ids.clear();
+    for( auto i = 0u ; i < rays.cnt ; ++i ){
+        hits[i] = HitRecord();
+        if( !rays.IsActive( i ) )
+            continue;
+        active_rays.push_back( rays.GetRay( i ) );
+        active_ids.push_back( i );
+    }
+
+    const auto cnt = (unsigned int)active_rays.size();
+    if( 0 == cnt )
+        return;
+
+    // interactions are reused across batches, only the fields written by the traversal need to be reset
+    if( active_hits.size() < cnt )
+        active_hits.resize( cnt );
+    for( auto i = 0u ; i < cnt ; ++i ){
+        active_hits[i].t = FLT_MAX;
+        active_hits[i].primitive = nullptr;
+    }
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+    if( m_compressNodes ){
+        if( rays.coherent )
+            getIntersect<Compressed_Tree>( active_rays.data() , active_hits.data() , cnt );
+        else
+            getIntersectInterleaved<Compressed_Tree>( active_rays.data() , active_hits.data() , cnt );
+    }else
+#endif
+    if( rays.coherent )
+        getIntersect<Uncompressed_Tree>( active_rays.data() , active_hits.data() , cnt );
+    else
+        getIntersectInterleaved<Uncompressed_Tree>( active_rays.data() , active_hits.data() , cnt );
+
+    for( auto i = 0u ; i < cnt ; ++i ){
+        if( IS_PTR_INVALID( active_hits[i].primitive ) )
+            continue;
+        hits[active_ids[i]].t = active_hits[i].t;
+        hits[active_ids[i]].primitive = active_hits[i].primitive;
+    }
+}
+
+void Fbvh::OccludedBatch( const RayBatch& rays , bool* occluded ) const{
+    static thread_local std::vector<Ray>            active_rays;
+    static thread_local std::vector<unsigned int>   active_ids;
+
+    active_rays.clear();
+    active_ids.clear();
+    for( auto i = 0u ; i < rays.cnt ; ++i ){
+        occluded[i] = false;
+        if( !rays.IsActive( i ) )
+            continue;
+        active_rays.push_back( rays.GetRay( i ) );
+        active_ids.push_back( i );
+    }
+
+    const auto cnt = (unsigned int)active_rays.size();
+    if( 0 == cnt )
+        return;
+
+    // Results of the compacted rays land in the front of the output, since 'active_ids[i] >= i' they can be scattered
+    // in place from back to front without overwriting any result yet to be moved.
+    IsOccluded( active_rays.data() , occluded , cnt );
+    for( auto i = cnt ; i > 0 ; --i ){
+        const auto blocked = occluded[i-1];
+        occluded[i-1] = false;
+        occluded[active_ids[i-1]] = blocked;
+    }
+}
+#ifdef ENABLE_TRANSPARENT_SHADOW
+void Fbvh::GetIntersect( const Ray& ray , ShadowIntersections& intersect ) const{
+#ifdef SIMD_BVH_IMPLEMENTATION
+    if( m_compressNodes )
+        return getIntersect<Compressed_Tree>( ray , intersect );
+#endif
+    getIntersect<Uncompressed_Tree>( ray , intersect );
+}
+#endif
+
+void Fbvh::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , const StringID matID ) const{
+#ifdef SIMD_BVH_IMPLEMENTATION
+    if( m_compressNodes )
+        return getIntersect<Compressed_Tree>( ray , intersect , matID );
+#endif
+    getIntersect<Uncompressed_Tree>( ray , intersect , matID );
+}
+
+template<class Tree>
+bool Fbvh::getIntersect( const Ray& ray , SurfaceInteraction& intersect ) const{
+    // std::stack is by no means an option here due to its overhead under the hood, neither is a thread local stack on the heap.
+    // The depth of the tree is limited, the stack takes a few kilobytes at most, entries are not initialized.
+    struct Stack_Entry{
+        typename Tree::Node node;
+        float               fmin;
+    };
+    Stack_Entry bvh_stack[STACK_SIZE];
+
+#ifdef QBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Qbvh");
+#endif
+#ifdef OBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Obvh");
+#endif
+#ifdef HBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Hbvh");
+#endif
+
+    SORT_STATS(++sRayCount);
+    SORT_STATS(StatsHistogramSample traversal_steps(sTraversalSteps));
+    SORT_STATS(StatsHistogramSample leaf_visits(sLeafVisits));
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
+    SORT_STATS(sShadowRayCount += intersect.query_shadow);
+#endif
+
+    ray.Prepare();
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+    Simd_Ray_Data   simd_ray;
+    resolveRayData( ray , simd_ray );
+#endif
+
+    const auto fmin = Intersect(ray, m_bbox);
+    if (fmin < 0.0f)
+        return false;
+
+    // stack index
+    auto si = 0;
+    bvh_stack[si++] = { Tree::Root( *this ) , fmin };
+
+    while( si > 0 ){
+        const auto top = bvh_stack[--si];
+
+        const auto node = top.node;
+        const auto fmin = top.fmin;
+        if( intersect.t < fmin )
+            continue;
+        SORT_STATS(++traversal_steps);
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+        // check if it is a leaf node
+        const auto leaf = Tree::Leaf( *this , node );
+        if( leaf ){
+            Simd_Triangle decoded;
+            SORT_STATS(++leaf_visits);
+            for( auto i = 0u ; i < leaf->tri_cnt ; ++i ){
+                const auto blocked = intersectTriangle_SIMD( ray , simd_ray , fetchTriangles( ray , simd_ray , leaf , i , decoded ) , &intersect );
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
+                // A quick branching out for shadow ray if there is no semi-transparent shadow
+                // There is still possibility for false positives to survive this branch since only the nearest among four/eight possible intersections
+                // will be tested here. If the nearest intersection happens to have transparency while not the others, it won't branch out, leading to
+                // some potential defficiency. However, testing every single intersection in all possible intersections among all SIMD channels also 
+                // comes at a cost and given the chance of mixing transparent primitive and non-transparent primitives in one BVH node is not fairly high, 
+                // it makes sense to just check the nearest one. It should work pretty well for fully opaque scene.
+                // With C++ 17 compile time if, this branch can totally be resolved during compilation, which may further reduce a bit of overhead, which
+                // might not be very obvious. there could be ways to achieve it in C++ 11. Since it won't boost the performance, I will keep it this way
+                // until I have C++ 17 updated.
+                if( intersect.query_shadow && blocked ){
+                    sAssert(IS_PTR_VALID(intersect.primitive), SPATIAL_ACCELERATOR );
+                    if( !intersect.primitive->HasTransparency() ){
+                        SORT_STATS(sIntersectionTest += ( i + 1 ) * 4);
+
+                        // setting primitive to be nullptr and return true at the same time is a special 'code' 
+                        // that the above level logic will take advantage of.
+                        intersect.primitive = nullptr;
+                        return true;
+                    }
+                }
+#endif
+            }
+            for( auto i = 0u ; i < leaf->line_cnt ; ++i ){
+                const auto blocked = intersectLine_SIMD( ray , simd_ray , leaf->line_list[i] , &intersect );
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
+                if( intersect.query_shadow && blocked ){
+                    SORT_STATS(sIntersectionTest += (i + 1 + leaf->tri_cnt) * 4);
+                    if( LIKELY(!intersect.primitive->HasTransparency()) ){
+                        SORT_STATS(sIntersectionTest += i + 1 + ( leaf->tri_cnt ) * 4);
+                        intersect.primitive = nullptr;
+                    }
+                    return true;
+                }
+#endif
+            }
+            for( auto i = 0u ; i < leaf->planar_cnt ; ++i ){
+                const auto blocked = intersectPlanar_SIMD( ray , simd_ray , leaf->planar_list[i] , &intersect );
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
+                if( intersect.query_shadow && blocked ){
+                    SORT_STATS(sIntersectionTest += (i + 1 + leaf->tri_cnt + leaf->line_cnt) * 4);
+                    if( LIKELY(!intersect.primitive->HasTransparency()) )
+                        intersect.primitive = nullptr;
+                    return true;
+                }
+#endif
+            }
+            if( UNLIKELY(!leaf->other_list.empty()) ){
+                for( auto i = 0u ; i < leaf->other_list.size() ; ++i ){
+                    const auto blocked = leaf->other_list[i]->GetIntersect( ray , &intersect );
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
+                    if( intersect.query_shadow && blocked ){
+                        sAssert(IS_PTR_VALID(intersect.primitive), SPATIAL_ACCELERATOR );
+                        if( !intersect.primitive->HasTransparency() ){
+                            SORT_STATS(sIntersectionTest += i + 1 + ( leaf->tri_cnt + leaf->line_cnt + leaf->planar_cnt ) * 4);
                             intersect.primitive = nullptr;
                             return true;
                         }
@@ -402,122 +1667,385 @@ bool Fbvh::GetIntersect( const Ray& ray , SurfaceInteraction& intersect ) const{
 #endif
                 }
             }
-            SORT_STATS(sIntersectionTest+=node->pri_cnt);
+            SORT_STATS(sIntersectionTest+=leaf->pri_cnt);
             continue;
         }
 
         simd_data sse_f_min;
-        auto m = IntersectBBox_SIMD( ray , simd_ray , node->bbox , sse_f_min );
+        const auto m = Tree::IntersectChildren( *this , node , ray , simd_ray , sse_f_min );
         if( 0 == m )
             continue;
 
-        const int k0 = __bsf( m );
-        const auto t0 = sse_f_min[k0];
-        m &= m - 1;
-        if( LIKELY( 0 == m ) ){
-            sAssert( t0 >= 0.0f , SPATIAL_ACCELERATOR );
-            bvh_stack[si++] = std::make_pair( node->children[k0].get() , t0 );
+        // the nearest child is pushed last so that it is visited first
+        if( LIKELY( 0 == ( m & ( m - 1 ) ) ) ){
+            const int k0 = __bsf( m );
+            sAssert( sse_f_min[k0] >= 0.0f , SPATIAL_ACCELERATOR );
+            bvh_stack[si++] = { Tree::Child( *this , node , k0 ) , sse_f_min[k0] };
         }else{
-            const int k1 = __bsf( m );
-            m &= m - 1;
+            unsigned int keys[FBVH_CHILD_CNT];
+            const auto cnt = sortChildren( sse_f_min , m , intersect.t , keys );
+            for( auto i = cnt ; i > 0 ; --i )
+                bvh_stack[si++] = { Tree::Child( *this , node , childIndex( keys[i - 1] ) ) , childDistance( keys[i - 1] ) };
+        }
+#else
+        // check if it is a leaf node
+        const auto leaf = Tree::Leaf( *this , node );
+        if( leaf ){
+            SORT_STATS(++leaf_visits);
+            const auto _start = leaf->pri_offset;
+            const auto _end = _start + leaf->pri_cnt;
 
-            if( LIKELY( 0 == m ) ){
-                const auto t1 = sse_f_min[k1];
-                sAssert( t1 >= 0.0f , SPATIAL_ACCELERATOR );
+            for(auto i = _start ; i < _end ; i++ ){
+                const auto blocked = m_bvhpri[i].primitive->GetIntersect( ray , &intersect );
 
-                if( t0 < t1 ){
-                    bvh_stack[si++] = std::make_pair(node->children[k1].get(), t1 );
-                    bvh_stack[si++] = std::make_pair(node->children[k0].get(), t0 );
-                }else{
-                    bvh_stack[si++] = std::make_pair(node->children[k0].get(), t0);
-                    bvh_stack[si++] = std::make_pair(node->children[k1].get(), t1);
-                }
-            }else{
-                for (auto i = 0u; i < node->child_cnt; ++i) {
-                    auto k = -1;
-                    auto maxDist = -1.0f;
-                    for (auto j = 0u; j < node->child_cnt; ++j) {
-                        if (sse_f_min[j] > maxDist) {
-                            maxDist = sse_f_min[j];
-                            k = j;
-                        }
+#ifdef ENABLE_TRANSPARENT_SHADOW
+                if( intersect.query_shadow && blocked ){
+                    sAssert(IS_PTR_VALID(intersect.primitive), SPATIAL_ACCELERATOR );
+                    if( !intersect.primitive->HasTransparency() ){
+                        SORT_STATS(sIntersectionTest += i - _start + 1);
+                        intersect.primitive = nullptr;
+                        return true;
                     }
+                }
+#endif
+            }
+            SORT_STATS(sIntersectionTest+=leaf->pri_cnt);
+            continue;
+        }
+
+        float f_min[FBVH_CHILD_CNT];
+        auto m = 0;
+        for( auto i = 0u ; i < Tree::ChildCnt( *this , node ) ; ++i ){
+            f_min[i] = Intersect( ray , node->bbox[i] );
+            m |= ( f_min[i] >= 0.0f ) << i;
+        }
+
+        // the nearest child is pushed last so that it is visited first
+        unsigned int keys[FBVH_CHILD_CNT];
+        const auto cnt = sortChildren( f_min , m , intersect.t , keys );
+        for( auto i = cnt ; i > 0 ; --i )
+            bvh_stack[si++] = { Tree::Child( *this , node , childIndex( keys[i - 1] ) ) , childDistance( keys[i - 1] ) };
+#endif
+    }
+    return intersect.primitive;
+}
+
+template<class Tree>
+void Fbvh::getIntersect( const Ray* rays , SurfaceInteraction* intersects , unsigned int cnt ) const{
+#ifndef SIMD_BVH_IMPLEMENTATION
+    // Without SIMD, there is barely anything to share among rays in the same node.
+    Accelerator::GetIntersect( rays , intersects , cnt );
+#else
+    // A node to be visited along with the range of rays in 'ray_list' reaching it.
+    struct Packet_Entry{
+        typename Tree::Node node;
+        unsigned int        offset;
+        unsigned int        cnt;
+    };
+
+    // Rays reaching a node are recorded by their indices and distances to the node. The range of a pushed node is always
+    // allocated after the ones pushed before, the top of the stack is always the range at the end of the list.
+    static thread_local std::vector<std::pair<unsigned int, float>> ray_list;
+    static thread_local std::vector<Packet_Entry>                   packet_stack;
+    static thread_local std::vector<Simd_Ray_Data>                  simd_rays;
+    static thread_local std::vector<simd_data>                      child_fmin;
+    static thread_local std::vector<int>                            child_mask;
+
+#ifdef QBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Qbvh (Packet)");
+#endif
+#ifdef OBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Obvh (Packet)");
+#endif
+#ifdef HBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Hbvh (Packet)");
+#endif
+
+    SORT_STATS(sRayCount += cnt);
+
+    if( simd_rays.size() < cnt )
+        simd_rays.resize( cnt );
+
+    ray_list.clear();
+    for( auto i = 0u ; i < cnt ; ++i ){
+#ifdef ENABLE_TRANSPARENT_SHADOW
+        sAssert( !intersects[i].query_shadow , SPATIAL_ACCELERATOR );
+#endif
+        rays[i].Prepare();
+        resolveRayData( rays[i] , simd_rays[i] );
+
+        const auto fmin = Intersect( rays[i] , m_bbox );
+        if( fmin >= 0.0f )
+            ray_list.push_back( std::make_pair( i , fmin ) );
+    }
+    if( ray_list.empty() )
+        return;
+
+    packet_stack.clear();
+    packet_stack.push_back( { Tree::Root( *this ) , 0u , (unsigned int)ray_list.size() } );
+
+    while( !packet_stack.empty() ){
+        const auto top = packet_stack.back();
+        packet_stack.pop_back();
+
+        // ranges of nodes visited after this one have been popped already
+        ray_list.resize( top.offset + top.cnt );
+
+        const auto node = top.node;
+
+        // check if it is a leaf node
+        const auto leaf = Tree::Leaf( *this , node );
+        if( leaf ){
+            Simd_Triangle decoded;
+            for( auto r = top.offset ; r < top.offset + top.cnt ; ++r ){
+                const auto ri = ray_list[r].first;
+                auto& intersect = intersects[ri];
+                if( intersect.t < ray_list[r].second )
+                    continue;
+
+                for( auto i = 0u ; i < leaf->tri_cnt ; ++i )
+                    intersectTriangle_SIMD( rays[ri] , simd_rays[ri] , fetchTriangles( rays[ri] , simd_rays[ri] , leaf , i , decoded ) , &intersect );
+                for( auto i = 0u ; i < leaf->line_cnt ; ++i )
+                    intersectLine_SIMD( rays[ri] , simd_rays[ri] , leaf->line_list[i] , &intersect );
+                for( auto i = 0u ; i < leaf->planar_cnt ; ++i )
+                    intersectPlanar_SIMD( rays[ri] , simd_rays[ri] , leaf->planar_list[i] , &intersect );
+                for( auto i = 0u ; i < leaf->other_list.size() ; ++i )
+                    leaf->other_list[i]->GetIntersect( rays[ri] , &intersect );
+
+                SORT_STATS(sIntersectionTest+=leaf->pri_cnt);
+            }
+            continue;
+        }
 
-                    if (k == -1)
-                        break;
+        // test all rays still alive against the children
+        unsigned int child_ray_cnt[FBVH_CHILD_CNT] = { 0 };
+        float child_dist[FBVH_CHILD_CNT];
+        for( auto k = 0u ; k < FBVH_CHILD_CNT ; ++k )
+            child_dist[k] = FLT_MAX;
+
+        child_fmin.resize( top.cnt );
+        child_mask.resize( top.cnt );
+        for( auto r = 0u ; r < top.cnt ; ++r ){
+            const auto& entry = ray_list[top.offset + r];
+            const auto ri = entry.first;
+
+            auto m = 0;
+            if( intersects[ri].t >= entry.second )
+                m = Tree::IntersectChildren( *this , node , rays[ri] , simd_rays[ri] , child_fmin[r] );
+            child_mask[r] = m;
+
+            while( m ){
+                const int k = __bsf( m );
+                m &= m - 1;
+                ++child_ray_cnt[k];
+                child_dist[k] = std::min( child_dist[k] , child_fmin[r][k] );
+            }
+        }
 
-                    sse_f_min[k] = -1.0f;
-                    bvh_stack[si++] = std::make_pair(node->children[k].get(), maxDist);
+        // the nearest child is visited first, which is the last one to be pushed
+        int  order[FBVH_CHILD_CNT];
+        auto order_cnt = 0u;
+        for( auto i = 0u ; i < Tree::ChildCnt( *this , node ) ; ++i ){
+            auto k = -1;
+            auto maxDist = -1.0f;
+            for( auto j = 0u ; j < Tree::ChildCnt( *this , node ) ; ++j ){
+                if( child_ray_cnt[j] > 0 && child_dist[j] > maxDist ){
+                    maxDist = child_dist[j];
+                    k = j;
                 }
             }
+
+            if( k == -1 )
+                break;
+
+            child_dist[k] = -1.0f;
+            order[order_cnt++] = k;
+        }
+
+        // allocate ranges in the order of pushing
+        unsigned int child_offset[FBVH_CHILD_CNT];
+        auto offset = (unsigned int)ray_list.size();
+        for( auto i = 0u ; i < order_cnt ; ++i ){
+            const auto k = order[i];
+            child_offset[k] = offset;
+            packet_stack.push_back( { Tree::Child( *this , node , k ) , offset , child_ray_cnt[k] } );
+            offset += child_ray_cnt[k];
+        }
+        ray_list.resize( offset );
+
+        for( auto r = 0u ; r < top.cnt ; ++r ){
+            const auto ri = ray_list[top.offset + r].first;
+            auto m = child_mask[r];
+            while( m ){
+                const int k = __bsf( m );
+                m &= m - 1;
+                ray_list[child_offset[k]++] = std::make_pair( ri , child_fmin[r][k] );
+            }
         }
+    }
+#endif
+}
+
+template<class Tree>
+void Fbvh::getIntersectInterleaved( const Ray* rays , SurfaceInteraction* intersects , unsigned int cnt ) const{
+#ifndef SIMD_BVH_IMPLEMENTATION
+    // Without SIMD, a node is small enough that there is not much latency to hide.
+    Accelerator::GetIntersectIncoherent( rays , intersects , cnt );
 #else
-        // check if it is a leaf node
-        if( 0 == node->child_cnt ){
-            const auto _start = node->pri_offset;
-            const auto _end = _start + node->pri_cnt;
+    struct Stack_Entry{
+        typename Tree::Node node;
+        float               fmin;
+    };
+
+    // Everything a ray needs to resume its traversal, it is suspended whenever it is about to fetch a new node.
+    struct Ray_Context{
+        Stack_Entry         stack[STACK_SIZE];
+        Simd_Ray_Data       simd_ray;
+        unsigned int        ri = 0;
+        unsigned int        si = 0;
+    };
+
+    // Contexts are a few kilobytes each, they don't fit on the stack.
+    static thread_local std::vector<Ray_Context> contexts( INTERLEAVED_RAY_CNT );
+
+#ifdef QBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Qbvh (Interleaved)");
+#endif
+#ifdef OBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Obvh (Interleaved)");
+#endif
+#ifdef HBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Hbvh (Interleaved)");
+#endif
 
-            for(auto i = _start ; i < _end ; i++ ){
-                const auto blocked = m_bvhpri[i].primitive->GetIntersect( ray , &intersect );
+    SORT_STATS(sRayCount += cnt);
 
+    // Pick up the next ray in the batch, rays missing the whole scene are done right away.
+    auto next = 0u;
+    const auto start = [&]( Ray_Context& ctx ){
+        while( next < cnt ){
+            const auto ri = next++;
 #ifdef ENABLE_TRANSPARENT_SHADOW
-                if( intersect.query_shadow && blocked ){
-                    sAssert(IS_PTR_VALID(intersect.primitive), SPATIAL_ACCELERATOR );
-                    sAssert(IS_PTR_VALID(intersect.primitive->GetMaterial()), SPATIAL_ACCELERATOR );
-                    if( !intersect.primitive->GetMaterial()->HasTransparency() ){
-                        SORT_STATS(sIntersectionTest += i - _start + 1);
-                        intersect.primitive = nullptr;
-                        return true;
-                    }
-                }
+            sAssert( !intersects[ri].query_shadow , SPATIAL_ACCELERATOR );
 #endif
-            }
-            SORT_STATS(sIntersectionTest+=node->pri_cnt);
-            continue;
+            rays[ri].Prepare();
+            const auto fmin = Intersect( rays[ri] , m_bbox );
+            if( fmin < 0.0f )
+                continue;
+
+            resolveRayData( rays[ri] , ctx.simd_ray );
+            ctx.ri = ri;
+            ctx.si = 0;
+            ctx.stack[ctx.si++] = { Tree::Root( *this ) , fmin };
+            return true;
         }
+        return false;
+    };
+
+    // Visit nodes of a ray until it is about to fetch a new node, which is prefetched before switching to another ray.
+    const auto step = [&]( Ray_Context& ctx ){
+        const auto& ray = rays[ctx.ri];
+        auto& intersect = intersects[ctx.ri];
+        while( ctx.si > 0 ){
+            const auto top = ctx.stack[--ctx.si];
+            if( intersect.t < top.fmin )
+                continue;
+
+            const auto node = top.node;
+            const auto leaf = Tree::Leaf( *this , node );
+            if( leaf ){
+                Simd_Triangle decoded;
+                for( auto i = 0u ; i < leaf->tri_cnt ; ++i )
+                    intersectTriangle_SIMD( ray , ctx.simd_ray , fetchTriangles( ray , ctx.simd_ray , leaf , i , decoded ) , &intersect );
+                for( auto i = 0u ; i < leaf->line_cnt ; ++i )
+                    intersectLine_SIMD( ray , ctx.simd_ray , leaf->line_list[i] , &intersect );
+                for( auto i = 0u ; i < leaf->planar_cnt ; ++i )
+                    intersectPlanar_SIMD( ray , ctx.simd_ray , leaf->planar_list[i] , &intersect );
+                for( auto i = 0u ; i < leaf->other_list.size() ; ++i )
+                    leaf->other_list[i]->GetIntersect( ray , &intersect );
+                SORT_STATS(sIntersectionTest+=leaf->pri_cnt);
+            }else{
+                simd_data sse_f_min;
+                const auto m = Tree::IntersectChildren( *this , node , ray , ctx.simd_ray , sse_f_min );
+                if( 0 == m )
+                    continue;
 
-        float f_min[FBVH_CHILD_CNT] = { FLT_MAX };
-        for( auto i = 0u ; i < node->child_cnt ; ++i )
-            f_min[i] = Intersect( ray , node->bbox[i] );
-
-        for( auto i = 0u ; i < node->child_cnt ; ++i ){
-            auto k = -1;
-            auto maxDist = -1.0f;
-            for( auto j = 0u ; j < node->child_cnt ; ++j ){
-                if( f_min[j] > maxDist ){
-                    maxDist = f_min[j];
-                    k = j;
+                // the nearest child is pushed last so that it is visited first
+                if( LIKELY( 0 == ( m & ( m - 1 ) ) ) ){
+                    const int k0 = __bsf( m );
+                    ctx.stack[ctx.si++] = { Tree::Child( *this , node , k0 ) , sse_f_min[k0] };
+                }else{
+                    unsigned int keys[FBVH_CHILD_CNT];
+                    const auto child_cnt = sortChildren( sse_f_min , m , intersect.t , keys );
+                    for( auto i = child_cnt ; i > 0 ; --i )
+                        ctx.stack[ctx.si++] = { Tree::Child( *this , node , childIndex( keys[i - 1] ) ) , childDistance( keys[i - 1] ) };
                 }
             }
 
-            if( k == -1 )
-                break;
-
-            f_min[k] = -1.0f;
-            bvh_stack[si++] = std::make_pair( node->children[k].get() , maxDist );
+            if( ctx.si > 0 ){
+                Tree::Prefetch( *this , ctx.stack[ctx.si - 1].node );
+                return true;
+            }
+        }
+        return false;
+    };
+
+    // Rays in flight are visited round robin, a finished ray hands its slot over to the next one in the batch.
+    auto active = 0u;
+    while( active < INTERLEAVED_RAY_CNT && start( contexts[active] ) )
+        ++active;
+
+    auto s = 0u;
+    while( active > 0 ){
+        auto& ctx = contexts[s];
+        if( !step( ctx ) && !start( ctx ) ){
+            // there is no ray left to start, the last slot in flight takes its place
+            --active;
+            if( s != active )
+                std::swap( ctx , contexts[active] );
+            else
+                s = 0;
+            continue;
         }
+        s = s + 1 < active ? s + 1 : 0;
+    }
 #endif
+}
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+//! @brief  Find which primitive in a SIMD pack blocks the ray.
+//!
+//! SIMD tests only tell whether any of the primitives blocks the ray. This is only needed by callers caching occluders, the
+//! primitives of the pack are tested again one by one.
+template<class T>
+static SORT_FORCEINLINE const Primitive* findOccluder( const Ray& ray , const T& simd_pack ){
+    for( auto i = 0u ; i < SIMD_CHANNEL && IS_PTR_VALID(simd_pack.m_ori_pri[i]) ; ++i ){
+        if( simd_pack.m_ori_pri[i]->GetIntersect( ray , nullptr ) )
+            return simd_pack.m_ori_pri[i];
     }
-    return intersect.primitive;
+    return nullptr;
 }
+#endif
 
-#ifndef ENABLE_TRANSPARENT_SHADOW
-bool  Fbvh::IsOccluded(const Ray& ray) const{
-    // std::stack is by no means an option here due to its overhead under the hood.
-    using Fbvh_Node_Ptr = Fbvh_Node*;
-    static thread_local std::unique_ptr<Fbvh_Node_Ptr[]> bvh_stack = nullptr;
-    if (UNLIKELY(IS_PTR_INVALID(bvh_stack)))
-        bvh_stack = std::make_unique<Fbvh_Node_Ptr[]>(m_depth * FBVH_CHILD_CNT);
+template<class Tree>
+bool Fbvh::isOccluded( const Ray& ray , const Primitive** occluder ) const{
+    // std::stack is by no means an option here due to its overhead under the hood, neither is a thread local stack on the heap.
+    typename Tree::Node bvh_stack[STACK_SIZE];
 
 #ifdef QBVH_IMPLEMENTATION
     SORT_PROFILE("Traverse Qbvh");
 #endif
-#ifdef QBVH_IMPLEMENTATION
+#ifdef OBVH_IMPLEMENTATION
     SORT_PROFILE("Traverse Obvh");
 #endif
+#ifdef HBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Hbvh");
+#endif
 
     SORT_STATS(++sRayCount);
     SORT_STATS(++sShadowRayCount);
+    SORT_STATS(StatsHistogramSample traversal_steps(sShadowTraversalSteps));
+    SORT_STATS(StatsHistogramSample leaf_visits(sShadowLeafVisits));
 
     ray.Prepare();
 #ifdef SIMD_BVH_IMPLEMENTATION
@@ -531,140 +2059,371 @@ bool  Fbvh::IsOccluded(const Ray& ray) const{
 
     // stack index
     auto si = 0;
-    bvh_stack[si++] = m_root.get();
+    bvh_stack[si++] = Tree::Root( *this );
 
     while (si > 0) {
         const auto node = bvh_stack[--si];
+        SORT_STATS(++traversal_steps);
 
 #ifdef SIMD_BVH_IMPLEMENTATION
         // check if it is a leaf node
-        if (0 == node->child_cnt) {
-            for (auto i = 0u; i < node->tri_cnt; ++i) {
-                if (intersectTriangleFast_SIMD(ray, simd_ray , node->tri_list[i])) {
+        const auto leaf = Tree::Leaf( *this , node );
+        if( leaf ){
+            Simd_Triangle decoded;
+            SORT_STATS(++leaf_visits);
+            for (auto i = 0u; i < leaf->tri_cnt; ++i) {
+                if (intersectTriangleFast_SIMD(ray, simd_ray , fetchTriangles( ray , simd_ray , leaf , i , decoded ))) {
                     SORT_STATS(sIntersectionTest += ( i + 1 ) * 4);
+                    if( occluder )
+                        *occluder = findOccluder( ray , fetchTriangles( ray , simd_ray , leaf , i , decoded ) );
+                    return true;
+                }
+            }
+            for (auto i = 0u; i < leaf->line_cnt; ++i) {
+                if (intersectLineFast_SIMD(ray, simd_ray , leaf->line_list[i])) {
+                    SORT_STATS(sIntersectionTest += (i + 1 + leaf->tri_cnt) * 4);
+                    if( occluder )
+                        *occluder = findOccluder( ray , leaf->line_list[i] );
                     return true;
                 }
             }
-            for (auto i = 0u; i < node->line_cnt; ++i) {
-                if (intersectLineFast_SIMD(ray, simd_ray , node->line_list[i])) {
-                    SORT_STATS(sIntersectionTest += (i + 1 + node->tri_cnt) * 4);
+            for (auto i = 0u; i < leaf->planar_cnt; ++i) {
+                if (intersectPlanarFast_SIMD(ray, simd_ray , leaf->planar_list[i])) {
+                    SORT_STATS(sIntersectionTest += (i + 1 + leaf->tri_cnt + leaf->line_cnt) * 4);
+                    if( occluder )
+                        *occluder = findOccluder( ray , leaf->planar_list[i] );
                     return true;
                 }
             }
-            if (UNLIKELY(!node->other_list.empty())) {
-                for (auto i = 0u; i < node->other_list.size(); ++i) {
-                    if (node->other_list[i]->GetIntersect(ray, nullptr)) {
-                        SORT_STATS(sIntersectionTest += i + 1 + ( node->tri_cnt + node->line_cnt ) * 4);
+            if (UNLIKELY(!leaf->other_list.empty())) {
+                for (auto i = 0u; i < leaf->other_list.size(); ++i) {
+                    if (leaf->other_list[i]->GetIntersect(ray, nullptr)) {
+                        SORT_STATS(sIntersectionTest += i + 1 + ( leaf->tri_cnt + leaf->line_cnt + leaf->planar_cnt ) * 4);
+                        if( occluder )
+                            *occluder = leaf->other_list[i];
                         return true;
                     }
                 }
             }
-            SORT_STATS(sIntersectionTest += node->pri_cnt);
+            SORT_STATS(sIntersectionTest += leaf->pri_cnt);
             continue;
         }
 
         simd_data sse_f_min;
-        auto m = IntersectBBox_SIMD(ray, simd_ray, node->bbox, sse_f_min);
-        if (0 == m)
+        auto m = Tree::IntersectChildren( *this , node , ray , simd_ray , sse_f_min );
+
+        // any intersection is good enough for shadow rays, there is no need to sort children
+        while( m ){
+            const int k = __bsf( m );
+            m &= m - 1;
+            sAssert( sse_f_min[k] >= 0.0f , SPATIAL_ACCELERATOR );
+            bvh_stack[si++] = Tree::Child( *this , node , k );
+        }
+#else
+        // check if it is a leaf node
+        const auto leaf = Tree::Leaf( *this , node );
+        if( leaf ){
+            SORT_STATS(++leaf_visits);
+            const auto _start = leaf->pri_offset;
+            const auto _end = _start + leaf->pri_cnt;
+
+            for (auto i = _start; i < _end; i++) {
+                if (m_bvhpri[i].primitive->GetIntersect(ray, nullptr)) {
+                    SORT_STATS(sIntersectionTest += i - _start + 1);
+                    if( occluder )
+                        *occluder = m_bvhpri[i].primitive;
+                    return true;
+                }
+            }
+            SORT_STATS(sIntersectionTest += leaf->pri_cnt);
             continue;
+        }
+
+        float f_min[FBVH_CHILD_CNT] = { FLT_MAX };
+        for (auto i = 0u; i < Tree::ChildCnt( *this , node ); ++i)
+            f_min[i] = Intersect(ray, node->bbox[i]);
+
+        for (auto i = 0u; i < Tree::ChildCnt( *this , node ); ++i)
+            if( f_min[i] >= 0.0f )
+                bvh_stack[si++] = Tree::Child( *this , node , i );
+#endif
+    }
+    return false;
+}
+
+template<class Tree>
+void Fbvh::isOccluded( const Ray* rays , bool* occluded , unsigned int cnt ) const{
+#ifndef SIMD_BVH_IMPLEMENTATION
+    Accelerator::IsOccluded( rays , occluded , cnt );
+#else
+    // A node to be visited along with the range of rays in 'ray_list' reaching it.
+    struct Packet_Entry{
+        typename Tree::Node node;
+        unsigned int        offset;
+        unsigned int        cnt;
+    };
+
+    // Same layout as the packet of camera rays, except that there is no need to keep the distances to nodes.
+    static thread_local std::vector<unsigned int>   ray_list;
+    static thread_local std::vector<Packet_Entry>   packet_stack;
+    static thread_local std::vector<Simd_Ray_Data>  simd_rays;
+    static thread_local std::vector<int>            child_mask;
+
+#ifdef QBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Qbvh (Shadow Packet)");
+#endif
+#ifdef OBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Obvh (Shadow Packet)");
+#endif
+#ifdef HBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Hbvh (Shadow Packet)");
+#endif
+
+    SORT_STATS(sRayCount += cnt);
+    SORT_STATS(sShadowRayCount += cnt);
+
+    if( simd_rays.size() < cnt )
+        simd_rays.resize( cnt );
+
+    ray_list.clear();
+    for( auto i = 0u ; i < cnt ; ++i ){
+        occluded[i] = false;
+        rays[i].Prepare();
+        resolveRayData( rays[i] , simd_rays[i] );
+
+        if( Intersect( rays[i] , m_bbox ) >= 0.0f )
+            ray_list.push_back( i );
+    }
+    if( ray_list.empty() )
+        return;
+
+    packet_stack.clear();
+    packet_stack.push_back( { Tree::Root( *this ) , 0u , (unsigned int)ray_list.size() } );
+
+    while( !packet_stack.empty() ){
+        const auto top = packet_stack.back();
+        packet_stack.pop_back();
+
+        // ranges of nodes visited after this one have been popped already
+        ray_list.resize( top.offset + top.cnt );
+
+        const auto node = top.node;
+
+        // check if it is a leaf node
+        const auto leaf = Tree::Leaf( *this , node );
+        if( leaf ){
+            Simd_Triangle decoded;
+            for( auto r = top.offset ; r < top.offset + top.cnt ; ++r ){
+                const auto ri = ray_list[r];
+                if( occluded[ri] )
+                    continue;
 
-        const int k0 = __bsf(m);
-        m &= m - 1;
-        if (LIKELY(0 == m)) {
-            sAssert(sse_f_min[k0] >= 0.0f, SPATIAL_ACCELERATOR);
-            bvh_stack[si++] = node->children[k0].get();
+                auto blocked = false;
+                for( auto i = 0u ; i < leaf->tri_cnt && !blocked ; ++i )
+                    blocked = intersectTriangleFast_SIMD( rays[ri] , simd_rays[ri] , fetchTriangles( rays[ri] , simd_rays[ri] , leaf , i , decoded ) );
+                for( auto i = 0u ; i < leaf->line_cnt && !blocked ; ++i )
+                    blocked = intersectLineFast_SIMD( rays[ri] , simd_rays[ri] , leaf->line_list[i] );
+                for( auto i = 0u ; i < leaf->planar_cnt && !blocked ; ++i )
+                    blocked = intersectPlanarFast_SIMD( rays[ri] , simd_rays[ri] , leaf->planar_list[i] );
+                for( auto i = 0u ; i < leaf->other_list.size() && !blocked ; ++i )
+                    blocked = leaf->other_list[i]->GetIntersect( rays[ri] , nullptr );
+                occluded[ri] = blocked;
+
+                SORT_STATS(sIntersectionTest+=leaf->pri_cnt);
+            }
+            continue;
         }
-        else {
-            const int k1 = __bsf(m);
-            m &= m - 1;
 
-            sAssert(sse_f_min[k1] >= 0.0f, SPATIAL_ACCELERATOR);
+        // test all rays that are not occluded yet against the children
+        unsigned int child_ray_cnt[FBVH_CHILD_CNT] = { 0 };
+        child_mask.resize( top.cnt );
+        for( auto r = 0u ; r < top.cnt ; ++r ){
+            const auto ri = ray_list[top.offset + r];
 
-            if (LIKELY(0 == m)) {
-                bvh_stack[si++] = node->children[k1].get();
-                bvh_stack[si++] = node->children[k0].get();
-            } else {
-                const int k2 = __bsf(m);
-                sAssert(sse_f_min[k2] >= 0.0f, SPATIAL_ACCELERATOR);
+            auto m = 0;
+            if( !occluded[ri] ){
+                simd_data f_min;
+                m = Tree::IntersectChildren( *this , node , rays[ri] , simd_rays[ri] , f_min );
+            }
+            child_mask[r] = m;
 
+            while( m ){
+                const int k = __bsf( m );
                 m &= m - 1;
+                ++child_ray_cnt[k];
+            }
+        }
 
-                if( LIKELY(0==m) ){
-                    bvh_stack[si++] = node->children[k2].get();
-                    bvh_stack[si++] = node->children[k1].get();
-                    bvh_stack[si++] = node->children[k0].get();
-                }else{
-#if defined(SIMD_AVX_IMPLEMENTATION)
-                    for (auto i = 0u; i < node->child_cnt; ++i) {
-                        auto k = -1;
-                        auto maxDist = -1.0f;
-                        for (auto j = 0u; j < node->child_cnt; ++j) {
-                            if (sse_f_min[j] > maxDist) {
-                                maxDist = sse_f_min[j];
-                                k = j;
-                            }
-                        }
+        // any intersection is good enough for shadow rays, there is no need to sort children
+        unsigned int child_offset[FBVH_CHILD_CNT];
+        auto offset = (unsigned int)ray_list.size();
+        for( auto k = 0u ; k < Tree::ChildCnt( *this , node ) ; ++k ){
+            if( 0 == child_ray_cnt[k] )
+                continue;
+            child_offset[k] = offset;
+            packet_stack.push_back( { Tree::Child( *this , node , k ) , offset , child_ray_cnt[k] } );
+            offset += child_ray_cnt[k];
+        }
+        ray_list.resize( offset );
 
-                        if (k == -1)
-                            break;
+        for( auto r = 0u ; r < top.cnt ; ++r ){
+            const auto ri = ray_list[top.offset + r];
+            auto m = child_mask[r];
+            while( m ){
+                const int k = __bsf( m );
+                m &= m - 1;
+                ray_list[child_offset[k]++] = ri;
+            }
+        }
+    }
+#endif
+}
+#ifdef ENABLE_TRANSPARENT_SHADOW
+template<class Tree>
+void Fbvh::getIntersect( const Ray& ray , ShadowIntersections& intersect ) const{
+    // the same stack on the stack as the one for the nearest intersection.
+    struct Stack_Entry{
+        typename Tree::Node node;
+        float               fmin;
+    };
+    Stack_Entry bvh_stack[STACK_SIZE];
 
-                        sse_f_min[k] = -1.0f;
-                        bvh_stack[si++] = node->children[k].get();
-                    }
+#ifdef QBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Qbvh");
+#endif
+#ifdef OBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Obvh");
+#endif
+#ifdef HBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Hbvh");
 #endif
-#if defined(SIMD_SSE_IMPLEMENTATION)
-                    const int k3 = __bsf(m);
-                    sAssert(sse_f_min[k3] >= 0.0f, SPATIAL_ACCELERATOR);
 
-                    bvh_stack[si++] = node->children[k3].get();
-                    bvh_stack[si++] = node->children[k2].get();
-                    bvh_stack[si++] = node->children[k1].get();
-                    bvh_stack[si++] = node->children[k0].get();
+    SORT_STATS(++sRayCount);
+    SORT_STATS(++sShadowRayCount);
+
+    ray.Prepare();
+#ifdef SIMD_BVH_IMPLEMENTATION
+    Simd_Ray_Data   simd_ray;
+    resolveRayData( ray , simd_ray );
 #endif
+
+    const auto fmin = Intersect(ray, m_bbox);
+    if (fmin < 0.0f)
+        return;
+
+    // stack index
+    auto si = 0;
+    bvh_stack[si++] = { Tree::Root( *this ) , fmin };
+
+    while (si > 0) {
+        const auto top = bvh_stack[--si];
+
+        const auto node = top.node;
+        const auto fmin = top.fmin;
+        if (intersect.maxt < fmin)
+            continue;
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+        const auto leaf = Tree::Leaf( *this , node );
+        if( leaf ){
+            Simd_Triangle decoded;
+            for( auto i = 0u ; i < leaf->tri_cnt ; ++i ){
+                if( intersectTriangleShadow_SIMD( ray , simd_ray , fetchTriangles( ray , simd_ray , leaf , i , decoded ) , intersect ) ){
+                    SORT_STATS(sIntersectionTest += ( i + 1 ) * 4);
+                    return;
+                }
+            }
+            for( auto i = 0u ; i < leaf->line_cnt ; ++i ){
+                if( intersectLineShadow_SIMD( ray , simd_ray , leaf->line_list[i] , intersect ) ){
+                    SORT_STATS(sIntersectionTest += (i + 1 + leaf->tri_cnt) * 4);
+                    return;
+                }
+            }
+            for( auto i = 0u ; i < leaf->planar_cnt ; ++i ){
+                if( intersectPlanarShadow_SIMD( ray , simd_ray , leaf->planar_list[i] , intersect ) ){
+                    SORT_STATS(sIntersectionTest += (i + 1 + leaf->tri_cnt + leaf->line_cnt) * 4);
+                    return;
+                }
+            }
+            if( UNLIKELY(!leaf->other_list.empty()) ){
+                for( auto i = 0u ; i < leaf->other_list.size() ; ++i ){
+                    if( intersectShadow( ray , leaf->other_list[i] , intersect ) ){
+                        SORT_STATS(sIntersectionTest += i + 1 + ( leaf->tri_cnt + leaf->line_cnt + leaf->planar_cnt ) * 4);
+                        return;
+                    }
                 }
             }
+            SORT_STATS(sIntersectionTest += leaf->pri_cnt);
+            continue;
+        }
+
+        simd_data sse_f_min;
+        const auto m = Tree::IntersectChildren( *this , node , ray , simd_ray , sse_f_min );
+        if( 0 == m )
+            continue;
+
+        // the nearest child is visited first so that the farthest recorded intersection gets closer sooner
+        if( LIKELY( 0 == ( m & ( m - 1 ) ) ) ){
+            const int k0 = __bsf( m );
+            sAssert( sse_f_min[k0] >= 0.0f , SPATIAL_ACCELERATOR );
+            bvh_stack[si++] = { Tree::Child( *this , node , k0 ) , sse_f_min[k0] };
+        }else{
+            unsigned int keys[FBVH_CHILD_CNT];
+            const auto cnt = sortChildren( sse_f_min , m , intersect.maxt , keys );
+            for( auto i = cnt ; i > 0 ; --i )
+                bvh_stack[si++] = { Tree::Child( *this , node , childIndex( keys[i - 1] ) ) , childDistance( keys[i - 1] ) };
         }
 #else
-        // check if it is a leaf node
-        if (0 == node->child_cnt) {
-            const auto _start = node->pri_offset;
-            const auto _end = _start + node->pri_cnt;
+        const auto leaf = Tree::Leaf( *this , node );
+        if( leaf ){
+            const auto _start = leaf->pri_offset;
+            const auto _end = _start + leaf->pri_cnt;
 
-            for (auto i = _start; i < _end; i++) {
-                if (m_bvhpri[i].primitive->GetIntersect(ray, nullptr)) {
+            for( auto i = _start ; i < _end ; i++ ){
+                if( intersectShadow( ray , m_bvhpri[i].primitive , intersect ) ){
                     SORT_STATS(sIntersectionTest += i - _start + 1);
-                    return true;
+                    return;
                 }
             }
-            SORT_STATS(sIntersectionTest += node->pri_cnt);
+            SORT_STATS(sIntersectionTest += leaf->pri_cnt);
             continue;
         }
 
-        float f_min[FBVH_CHILD_CNT] = { FLT_MAX };
-        for (auto i = 0u; i < node->child_cnt; ++i)
-            f_min[i] = Intersect(ray, node->bbox[i]);
+        float f_min[FBVH_CHILD_CNT];
+        auto m = 0;
+        for( auto i = 0u ; i < Tree::ChildCnt( *this , node ) ; ++i ){
+            f_min[i] = Intersect( ray , node->bbox[i] );
+            m |= ( f_min[i] >= 0.0f ) << i;
+        }
 
-        for (auto i = 0u; i < node->child_cnt; ++i)
-            if( f_min[i] >= 0.0f )
-                bvh_stack[si++] = node->children[i].get();
+        // the nearest child is visited first so that the farthest recorded intersection gets closer sooner
+        unsigned int keys[FBVH_CHILD_CNT];
+        const auto cnt = sortChildren( f_min , m , intersect.maxt , keys );
+        for( auto i = cnt ; i > 0 ; --i )
+            bvh_stack[si++] = { Tree::Child( *this , node , childIndex( keys[i - 1] ) ) , childDistance( keys[i - 1] ) };
 #endif
     }
-    return false;
 }
 #endif
 
-void Fbvh::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , const StringID matID ) const{
-    // std::stack is by no means an option here due to its overhead under the hood.
-    static thread_local std::unique_ptr<std::pair<Fbvh_Node*, float>[]> bvh_stack = nullptr;
-    if ( UNLIKELY(IS_PTR_INVALID(bvh_stack) ) )
-        bvh_stack = std::make_unique<std::pair<Fbvh_Node*, float>[]>(m_depth * FBVH_CHILD_CNT);
+template<class Tree>
+void Fbvh::getIntersect( const Ray& ray , BSSRDFIntersections& intersect , const StringID matID ) const{
+    // the same stack on the stack as the one for the nearest intersection.
+    struct Stack_Entry{
+        typename Tree::Node node;
+        float               fmin;
+    };
+    Stack_Entry bvh_stack[STACK_SIZE];
 
 #ifdef QBVH_IMPLEMENTATION
     SORT_PROFILE("Traverse Qbvh");
 #endif
-#ifdef QBVH_IMPLEMENTATION
+#ifdef OBVH_IMPLEMENTATION
     SORT_PROFILE("Traverse Obvh");
 #endif
+#ifdef HBVH_IMPLEMENTATION
+    SORT_PROFILE("Traverse Hbvh");
+#endif
 
     SORT_STATS(++sRayCount);
 
@@ -683,138 +2442,83 @@ void Fbvh::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , const
 
     // stack index
     auto si = 0;
-    bvh_stack[si++] = std::make_pair(m_root.get(), fmin);
+    bvh_stack[si++] = { Tree::Root( *this ) , fmin };
 
     while (si > 0) {
         const auto top = bvh_stack[--si];
 
-        const auto node = top.first;
-        const auto fmin = top.second;
+        const auto node = top.node;
+        const auto fmin = top.fmin;
         if (intersect.maxt < fmin)
             continue;
 
 #ifdef SIMD_BVH_IMPLEMENTATION
-        if (0 == node->child_cnt) {
+        const auto leaf = Tree::Leaf( *this , node );
+        if( leaf ){
+            Simd_Triangle decoded;
             // Note, only triangle shape support SSS here. This is the only big difference between AVX and non-AVX version implementation.
             // There are only two major primitives in SORT, line and triangle.
             // Line is usually used for hair, which has its own hair shader.
             // Triangle is the only major primitive that has SSS.
-            for ( auto i = 0u ; i < node->tri_cnt ; ++i )
-                intersectTriangleMulti_SIMD(ray, simd_ray, node->tri_list[i] , matID, intersect);
-            SORT_STATS(sIntersectionTest += node->tri_cnt);
+            for ( auto i = 0u ; i < leaf->tri_cnt ; ++i )
+                intersectTriangleMulti_SIMD(ray, simd_ray, fetchTriangles( ray , simd_ray , leaf , i , decoded ) , matID, intersect);
+            SORT_STATS(sIntersectionTest += leaf->tri_cnt);
             continue;
         }
 
         simd_data sse_f_min;
-        auto m = IntersectBBox_SIMD(ray, simd_ray, node->bbox, sse_f_min);
-        if (0 == m)
+        const auto m = Tree::IntersectChildren( *this , node , ray , simd_ray , sse_f_min );
+        if( 0 == m )
             continue;
 
-        const int k0 = __bsf(m);
-        const auto t0 = sse_f_min[k0];
-        m &= m - 1;
-        if (LIKELY(0 == m)) {
-            sAssert(t0 >= 0.0f, SPATIAL_ACCELERATOR);
-            bvh_stack[si++] = std::make_pair(node->children[k0].get(), t0);
-        }
-        else {
-            const int k1 = __bsf(m);
-            m &= m - 1;
-
-            if (LIKELY(0 == m)) {
-                const auto t1 = sse_f_min[k1];
-                sAssert(t1 >= 0.0f, SPATIAL_ACCELERATOR);
-
-                if (t0 < t1) {
-                    bvh_stack[si++] = std::make_pair(node->children[k1].get(), t1);
-                    bvh_stack[si++] = std::make_pair(node->children[k0].get(), t0);
-                }
-                else {
-                    bvh_stack[si++] = std::make_pair(node->children[k0].get(), t0);
-                    bvh_stack[si++] = std::make_pair(node->children[k1].get(), t1);
-                }
-            }
-            else {
-                // fall back to the worst case
-                for (auto i = 0u; i < node->child_cnt; ++i) {
-                    auto k = -1;
-                    auto maxDist = -1.0f;
-                    for (auto j = 0u; j < node->child_cnt; ++j) {
-                        if (sse_f_min[j] > maxDist) {
-                            maxDist = sse_f_min[j];
-                            k = j;
-                        }
-                    }
-
-                    if (k == -1)
-                        break;
-
-                    sse_f_min[k] = -1.0f;
-                    bvh_stack[si++] = std::make_pair(node->children[k].get(), maxDist);
-                }
-            }
+        // the nearest child is pushed last so that it is visited first
+        if( LIKELY( 0 == ( m & ( m - 1 ) ) ) ){
+            const int k0 = __bsf( m );
+            sAssert( sse_f_min[k0] >= 0.0f , SPATIAL_ACCELERATOR );
+            bvh_stack[si++] = { Tree::Child( *this , node , k0 ) , sse_f_min[k0] };
+        }else{
+            unsigned int keys[FBVH_CHILD_CNT];
+            const auto cnt = sortChildren( sse_f_min , m , intersect.maxt , keys );
+            for( auto i = cnt ; i > 0 ; --i )
+                bvh_stack[si++] = { Tree::Child( *this , node , childIndex( keys[i - 1] ) ) , childDistance( keys[i - 1] ) };
         }
 #else
         // check if it is a leaf node, to be optimized by SSE/AVX
-        if (0 == node->child_cnt) {
-            auto _start = node->pri_offset;
-            auto _pri = node->pri_cnt;
+        const auto leaf = Tree::Leaf( *this , node );
+        if( leaf ){
+            auto _start = leaf->pri_offset;
+            auto _pri = leaf->pri_cnt;
             auto _end = _start + _pri;
 
             SurfaceInteraction intersection;
             for (auto i = _start; i < _end; i++) {
-                if (matID != m_bvhpri[i].primitive->GetMaterial()->GetUniqueID())
+                if (( matID != INVALID_SID && matID != m_bvhpri[i].primitive->GetMaterial()->GetUniqueID() ) || intersect.IsRecorded(m_bvhpri[i].primitive))
                     continue;
 
                 SORT_STATS(++sIntersectionTest);
 
                 intersection.Reset();
+                intersection.t = intersect.maxt;
                 const auto intersected = m_bvhpri[i].primitive->GetIntersect(ray, &intersection);
-                if (intersected) {
-                    if (intersect.cnt < TOTAL_SSS_INTERSECTION_CNT) {
-                        intersect.intersections[intersect.cnt] = SORT_MALLOC(BSSRDFIntersection)();
-                        intersect.intersections[intersect.cnt++]->intersection = intersection;
-                    }
-                    else {
-                        auto picked_i = -1;
-                        auto t = 0.0f;
-                        for (auto i = 0; i < TOTAL_SSS_INTERSECTION_CNT; ++i) {
-                            if (t < intersect.intersections[i]->intersection.t) {
-                                t = intersect.intersections[i]->intersection.t;
-                                picked_i = i;
-                            }
-                        }
-                        if (picked_i >= 0)
-                            intersect.intersections[picked_i]->intersection = intersection;
-
-                        intersect.ResolveMaxDepth();
-                    }
-                }
+                if (intersected)
+                    intersect.Add(intersection);
             }
 
             continue;
         }
 
-        float f_min[FBVH_CHILD_CNT] = { FLT_MAX };
-        for (auto i = 0u; i < node->child_cnt; ++i)
-            f_min[i] = Intersect(ray, node->bbox[i]);
-
-        for (auto i = 0u; i < node->child_cnt; ++i) {
-            int k = -1;
-            float maxDist = -1.0f;
-            for (auto j = 0u; j < node->child_cnt; ++j) {
-                if (f_min[j] > maxDist) {
-                    maxDist = f_min[j];
-                    k = j;
-                }
-            }
-
-            if (k == -1)
-                break;
-
-            f_min[k] = -1.0f;
-            bvh_stack[si++] = std::make_pair(node->children[k].get(), maxDist);
+        float f_min[FBVH_CHILD_CNT];
+        auto m = 0;
+        for( auto i = 0u ; i < Tree::ChildCnt( *this , node ) ; ++i ){
+            f_min[i] = Intersect( ray , node->bbox[i] );
+            m |= ( f_min[i] >= 0.0f ) << i;
         }
+
+        // the nearest child is pushed last so that it is visited first
+        unsigned int keys[FBVH_CHILD_CNT];
+        const auto cnt = sortChildren( f_min , m , intersect.maxt , keys );
+        for( auto i = cnt ; i > 0 ; --i )
+            bvh_stack[si++] = { Tree::Child( *this , node , childIndex( keys[i - 1] ) ) , childDistance( keys[i - 1] ) };
 #endif
     }
 }
@@ -823,6 +2527,251 @@ std::unique_ptr<Accelerator> Fbvh::Clone() const {
 	auto ret = std::make_unique<Fbvh>();
 	ret->m_maxNodeDepth = m_maxNodeDepth;
 	ret->m_maxPriInLeaf = m_maxPriInLeaf;
+	ret->m_compressNodes = m_compressNodes;
+	ret->m_compressLeaves = m_compressLeaves;
+	ret->m_spatialSplitBudget = m_spatialSplitBudget;
+	ret->m_linearBuild = m_linearBuild;
+	ret->m_optimizedBuild = m_optimizedBuild;
 
 	return ret;
-}
\ No newline at end of file
+}
+
+namespace {
+    // Uncompressed nodes are saved in depth first order, children of an interior node are right after it.
+    struct Fbvh_Cache_Node {
+        BBox        bbox[FBVH_CHILD_CNT];   /**< Bounding boxes of its children. */
+        unsigned    child_cnt = 0;          /**< 0 means it is a leaf node. */
+        unsigned    pri_cnt = 0;            /**< Number of primitives in the leaf. */
+        unsigned    pri_offset = 0;         /**< Offset of primitives in the buffer. */
+    };
+
+    // Leaves of compressed nodes only need the range of primitives, the packed primitives are regenerated after loading.
+    struct Fbvh_Cache_Leaf {
+        unsigned    pri_cnt = 0;            /**< Number of primitives in the leaf. */
+        unsigned    pri_offset = 0;         /**< Offset of primitives in the buffer. */
+    };
+}
+
+bool Fbvh::SaveCache( OStreamBase& stream ) const {
+    SORT_PROFILE("Save Fbvh Cache");
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+    const auto compressed = IS_PTR_VALID( m_compressedNodes ) || !m_compressedLeaves.empty();
+#else
+    const auto compressed = false;
+#endif
+
+    stream << SID("Fbvh") << (unsigned)FBVH_CHILD_CNT;
+    stream << m_maxNodeDepth << m_maxPriInLeaf << m_spatialSplitBudget << compressed;
+    stream << m_depth.load() << m_buildSahCost;
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+    if( compressed ){
+        // compressed nodes don't hold any pointer, they are saved as they are in memory.
+        stream << m_compressedRoot << m_compressedNodeCnt;
+        stream.Write( (char*)m_compressedNodes.get() , (int)( sizeof( Fast_Bvh_Compressed_Node ) * m_compressedNodeCnt ) );
+
+        std::vector<Fbvh_Cache_Leaf> leaves( m_compressedLeaves.size() );
+        for( auto i = 0u ; i < leaves.size() ; ++i ){
+            leaves[i].pri_cnt = m_compressedLeaves[i].pri_cnt;
+            leaves[i].pri_offset = m_compressedLeaves[i].pri_offset;
+        }
+        stream << (unsigned)leaves.size();
+        stream.Write( (char*)leaves.data() , (int)( sizeof( Fbvh_Cache_Leaf ) * leaves.size() ) );
+
+        saveBvhPrimitives( stream , m_bvhpri.get() , m_bvhpriCnt , *m_primitives );
+        return true;
+    }
+#endif
+
+    std::vector<Fbvh_Cache_Node> nodes;
+    std::function<void(const Fbvh_Node*)> flatten = [&]( const Fbvh_Node* node ){
+        Fbvh_Cache_Node cache_node;
+        cache_node.child_cnt = node->child_cnt;
+        cache_node.pri_cnt = node->pri_cnt;
+        cache_node.pri_offset = node->pri_offset;
+        for( auto k = 0u ; k < node->child_cnt ; ++k )
+            cache_node.bbox[k] = getChildBBox( node , k );
+        nodes.push_back( cache_node );
+
+        for( auto k = 0u ; k < node->child_cnt ; ++k )
+            flatten( node->children[k].get() );
+    };
+    if( m_root )
+        flatten( m_root.get() );
+
+    stream << (unsigned)nodes.size();
+    stream.Write( (char*)nodes.data() , (int)( sizeof( Fbvh_Cache_Node ) * nodes.size() ) );
+
+    saveBvhPrimitives( stream , m_bvhpri.get() , m_bvhpriCnt , *m_primitives );
+    return true;
+}
+
+bool Fbvh::LoadCache( IStreamBase& stream , const std::vector<const Primitive*>& primitives , const BBox& bbox ){
+    SORT_PROFILE("Load Fbvh Cache");
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+    const auto compress = m_compressNodes;
+#else
+    const auto compress = false;
+#endif
+
+    StringID    type;
+    unsigned    child_cnt = 0 , max_node_depth = 0 , max_pri_in_leaf = 0 , depth = 0;
+    float       spatial_split_budget = -1.0f , build_sah_cost = 0.0f;
+    bool        compressed = !compress;
+    stream >> type >> child_cnt;
+    stream >> max_node_depth >> max_pri_in_leaf >> spatial_split_budget >> compressed;
+    stream >> depth >> build_sah_cost;
+    if( type != SID("Fbvh") || child_cnt != (unsigned)FBVH_CHILD_CNT || max_node_depth != m_maxNodeDepth || max_pri_in_leaf != m_maxPriInLeaf ||
+        spatial_split_budget != m_spatialSplitBudget || compressed != compress || depth > m_maxNodeDepth )
+        return false;
+
+    const auto max_pri_cnt = (unsigned)( primitives.size() * ( 1.0f + m_spatialSplitBudget ) ) + 1;
+
+    m_depth = 0;
+    m_bvhpri = nullptr;
+    releaseNodes();
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+    if( compressed ){
+        auto root = 0u , node_cnt = 0u;
+        stream >> root >> node_cnt;
+        if( node_cnt > max_pri_cnt )
+            return false;
+
+        Fast_Bvh_Compressed_Node_Array nodes;
+        if( node_cnt > 0 ){
+            nodes = Fast_Bvh_Compressed_Node_Array( (Fast_Bvh_Compressed_Node*)malloc_large( sizeof(Fast_Bvh_Compressed_Node) * node_cnt , FBVH_COMPRESSED_NODE_ALIGNMENT ) );
+            stream.Load( (char*)nodes.get() , (int)( sizeof( Fast_Bvh_Compressed_Node ) * node_cnt ) );
+        }
+
+        auto leaf_cnt = 0u;
+        stream >> leaf_cnt;
+        if( leaf_cnt > max_pri_cnt )
+            return false;
+        std::vector<Fbvh_Cache_Leaf> leaves( leaf_cnt );
+        stream.Load( (char*)leaves.data() , (int)( sizeof( Fbvh_Cache_Leaf ) * leaf_cnt ) );
+
+        auto pri_cnt = 0u;
+        m_bvhpri = loadBvhPrimitives( stream , pri_cnt , max_pri_cnt , primitives );
+        if( !m_bvhpri )
+            return false;
+
+        // children always come after their parents, a broken file can't make the traversal loop forever.
+        const auto valid_child = [&]( unsigned parent , unsigned child ){
+            if( child & FBVH_COMPRESSED_LEAF )
+                return ( child & ~FBVH_COMPRESSED_LEAF ) < leaf_cnt;
+            return child < node_cnt && child > parent;
+        };
+        if( !valid_child( 0 , root ) && !( root == 0 && node_cnt > 0 ) )
+            return false;
+        for( auto i = 0u ; i < node_cnt ; ++i ){
+            for( auto k = 0u ; k < (unsigned)FBVH_CHILD_CNT ; ++k ){
+                const auto used = nodes[i].qmin_x[k] <= nodes[i].qmax_x[k];
+                if( used && !valid_child( i , nodes[i].children[k] ) )
+                    return false;
+            }
+        }
+
+        // leaves need to be made again since they hold pointers to primitives
+        m_compressedLeaves.clear();
+        m_compressedLeaves.reserve( leaf_cnt );
+        for( const auto& leaf : leaves ){
+            if( leaf.pri_offset + leaf.pri_cnt > pri_cnt || leaf.pri_offset + leaf.pri_cnt < leaf.pri_offset )
+                return false;
+
+            auto node = makeFastBvhNode( leaf.pri_offset , leaf.pri_cnt );
+            makeLeaf( node.get() , leaf.pri_offset , leaf.pri_offset + leaf.pri_cnt , 1u );
+            compressLeaf( node );
+        }
+
+        m_compressedNodes = std::move( nodes );
+        m_compressedNodeCnt = node_cnt;
+        m_compressedRoot = root;
+        packPrimitives();
+        m_bvhpriCnt = pri_cnt;
+        m_depth = depth;
+        m_buildSahCost = build_sah_cost;
+        m_primitives = &primitives;
+        m_bbox = bbox;
+        m_isValid = true;
+        updateMemory( pri_cnt );
+
+        SORT_STATS(sFbvhNodeCount += node_cnt + leaf_cnt);
+        SORT_STATS(sFbvhDepth = std::max( sFbvhDepth , (StatsInt)depth ) );
+        SORT_STATS(sFbvhPrimitiveCount += (StatsInt)pri_cnt);
+        SORT_STATS(sFbvhCompressedNodeMemory += (StatsInt)( sizeof(Fast_Bvh_Compressed_Node) * node_cnt + sizeof(Fast_Bvh_Leaf) * leaf_cnt ));
+        return true;
+    }
+#endif
+
+    auto node_cnt = 0u;
+    stream >> node_cnt;
+    if( node_cnt == 0 || node_cnt > 2 * max_pri_cnt )
+        return false;
+    std::vector<Fbvh_Cache_Node> nodes( node_cnt );
+    stream.Load( (char*)nodes.data() , (int)( sizeof( Fbvh_Cache_Node ) * node_cnt ) );
+
+    auto pri_cnt = 0u;
+    m_bvhpri = loadBvhPrimitives( stream , pri_cnt , max_pri_cnt , primitives );
+    if( !m_bvhpri )
+        return false;
+
+    // the tree is rebuilt from the flat array, leaves are packed again since they hold pointers to primitives
+    auto cur = 0u;
+    std::function<bool(Fbvh_Node*, unsigned)> unflatten = [&]( Fbvh_Node* node , unsigned depth ){
+        if( cur >= node_cnt || depth > m_maxNodeDepth )
+            return false;
+
+        const auto& cache_node = nodes[cur++];
+        if( 0 == cache_node.child_cnt ){
+            if( cache_node.pri_offset + cache_node.pri_cnt > pri_cnt || cache_node.pri_offset + cache_node.pri_cnt < cache_node.pri_offset )
+                return false;
+            makeLeaf( node , cache_node.pri_offset , cache_node.pri_offset + cache_node.pri_cnt , depth );
+            return true;
+        }
+
+        if( cache_node.child_cnt < 2 || cache_node.child_cnt > (unsigned)FBVH_CHILD_CNT )
+            return false;
+
+        node->pri_cnt = cache_node.pri_cnt;
+        node->pri_offset = cache_node.pri_offset;
+        node->child_cnt = cache_node.child_cnt;
+        for( auto k = 0u ; k < node->child_cnt ; ++k )
+            node->children[k] = makeFastBvhNode( 0 , 0 );
+        setChildrenBBox( node , cache_node.bbox );
+
+        SORT_STATS(sFbvhNodeCount+=node->child_cnt);
+        SORT_STATS(sFbvhDepth = std::max( sFbvhDepth , (StatsInt)depth + 1 ) );
+        for( auto k = 0u ; k < node->child_cnt ; ++k ){
+            if( !unflatten( node->children[k].get() , depth + 1 ) )
+                return false;
+        }
+        return true;
+    };
+
+    m_root = makeFastBvhNode( 0 , 0 );
+    if( !unflatten( m_root.get() , 1u ) || cur != node_cnt ){
+        m_root = nullptr;
+        return false;
+    }
+
+    // children are already sorted when the tree is cached
+    relayoutNodes();
+#ifdef SIMD_BVH_IMPLEMENTATION
+    packPrimitives();
+#endif
+
+    m_bvhpriCnt = pri_cnt;
+    m_buildSahCost = build_sah_cost;
+    m_primitives = &primitives;
+    m_bbox = bbox;
+    m_isValid = true;
+    updateMemory( pri_cnt );
+
+    SORT_STATS(++sFbvhNodeCount);
+    SORT_STATS(sFbvhPrimitiveCount += (StatsInt)pri_cnt);
+    return true;
+}
+
@@ -17,6 +17,7 @@
 
 #include <algorithm>
 #include "kdtree.h"
+#include "scalar_query.h"
 #include "core/primitive.h"
 #include "math/interaction.h"
 #include "scatteringevent/scatteringevent.h"
@@ -38,6 +39,19 @@ SORT_STATS_COUNTER("Spatial-Structure(KDTree)", "Maximum Primitive in Leaf", sKD
 SORT_STATS_AVG_COUNT("Spatial-Structure(KDTree)", "Average Primitive Count in Leaf", sKDTreePrimitiveCount , sKDTreeLeafNodeCount );
 SORT_STATS_AVG_COUNT("Spatial-Structure(KDTree)", "Average Primitive Tested per Ray", sIntersectionTest, sRayCount);
 
+//! @brief  Mark the intersection of a shadow ray with an opaque primitive.
+//!
+//! @param  intersect   The intersection of the shadow ray, it is nullptr for occlusion queries.
+SORT_STATIC_FORCEINLINE void resolveShadowHit( SurfaceInteraction* intersect ){
+#ifdef ENABLE_TRANSPARENT_SHADOW
+    if( IS_PTR_VALID( intersect ) && !intersect->primitive->HasTransparency() ){
+        // setting primitive to be nullptr and return true at the same time is a special 'code' 
+        // that the above level logic will take advantage of.
+        intersect->primitive = nullptr;
+    }
+#endif
+}
+
 void KDTree::Build( const std::vector<const Primitive*>& primitives, const BBox& bbox){
     SORT_PROFILE("Build KdTree");
 
@@ -55,10 +69,10 @@ void KDTree::Build( const std::vector<const Primitive*>& primitives, const BBox&
     Splits splits;
     for(auto i = 0 ; i < 3 ; i++ )
         splits.split[i] = std::make_unique<Split[]>(2*count);
-    for(auto k = 0 ; k < 3 ; k++ ){
-        for(auto i = 0u ; i < count ; i++ ){
-            auto pri = (*m_primitives)[i];
-            auto box = pri->GetBBox();
+    for(auto i = 0u ; i < count ; i++ ){
+        auto pri = (*m_primitives)[i];
+        const auto box = pri->GetBBox();
+        for(auto k = 0 ; k < 3 ; k++ ){
             splits.split[k][2*i] = Split(box.m_Min[k], Split_Type::Split_Start, i, pri);
             splits.split[k][2*i+1] = Split(box.m_Max[k], Split_Type::Split_End, i, pri);
         }
@@ -208,14 +222,47 @@ float KDTree::pickSplitting( const Splits& splits , unsigned prinum , const BBox
 
 void KDTree::makeLeaf( Kd_Node* node , Splits& splits , unsigned prinum ){
     node->flag = 3;
+
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
+    Triangle4   simd_tri;
+    Line4       simd_line;
+#endif
+
     for(auto i = 0u ; i < prinum * 2; i++ ){
         if( splits.split[0][i].type == Split_Type::Split_Start ){
             const auto primitive = splits.split[0][i].primitive;
-            if( primitive->GetIntersect( node->bbox ) )
-                node->primitivelist.push_back(primitive);
+            if( !primitive->GetIntersect( node->bbox ) )
+                continue;
+
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
+            const auto shape_type = primitive->GetShapeType();
+            if( SHAPE_TRIANGLE == shape_type && !primitive->GetShape()->HasAlphaMask() ){
+                if( simd_tri.PushTriangle( primitive ) && simd_tri.PackData() ){
+                    node->tri_list.push_back( simd_tri );
+                    simd_tri.Reset();
+                }
+                continue;
+            }
+            if( SHAPE_LINE == shape_type ){
+                if( simd_line.PushLine( primitive ) && simd_line.PackData() ){
+                    node->line_list.push_back( simd_line );
+                    simd_line.Reset();
+                }
+                continue;
+            }
+#endif
+
+            node->primitivelist.push_back(primitive);
         }
     }
 
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
+    if( simd_tri.PackData() )
+        node->tri_list.push_back( simd_tri );
+    if( simd_line.PackData() )
+        node->line_list.push_back( simd_line );
+#endif
+
     SORT_STATS(++sKDTreeLeafNodeCount);
     SORT_STATS(++sKDTreeNodeCount);
     SORT_STATS(sKDTreePrimitiveCount += prinum);
@@ -237,10 +284,18 @@ bool KDTree::GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const{
     if( fmin < 0.0f )
         return false;
 
-    return traverse( m_root.get() , r , &intersect , fmin , fmax );
+    Kd_Ray_Data ray_data;
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
+    resolveRayData( r , ray_data );
+#endif
+
+    const auto found = traverse<Closest_Hit_Query>( m_root.get() , r , ray_data , &intersect , fmin , fmax );
+
+    // attributes are only evaluated for the nearest hit
+    FinalizeInteraction( r , intersect );
+    return found;
 }
 
-#ifndef ENABLE_TRANSPARENT_SHADOW
 bool KDTree::IsOccluded( const Ray& r ) const{
     SORT_PROFILE("Traverse KD-Tree");
     SORT_STATS(++sRayCount);
@@ -253,11 +308,20 @@ bool KDTree::IsOccluded( const Ray& r ) const{
     if( fmin < 0.0f )
         return false;
 
-    return traverse( m_root.get() , r , nullptr , fmin , fmax );
-}
+    Kd_Ray_Data ray_data;
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
+    resolveRayData( r , ray_data );
 #endif
 
-bool KDTree::traverse( const Kd_Node* node , const Ray& ray , SurfaceInteraction* intersect , float fmin , float fmax ) const{
+    return traverse<Any_Hit_Query>( m_root.get() , r , ray_data , nullptr , fmin , fmax );
+}
+
+template<class Query>
+bool KDTree::traverse( const Kd_Node* node , const Ray& ray , const Kd_Ray_Data& ray_data , SurfaceInteraction* intersect , float fmin , float fmax ) const{
+    // occlusion queries never have an intersection to fill, it is known during compilation.
+    if( Query::ANY_HIT )
+        intersect = nullptr;
+
     static const auto       mask = 0x00000003u;
     static const auto       delta = 0.001f;
 
@@ -269,22 +333,37 @@ bool KDTree::traverse( const Kd_Node* node , const Ray& ray , SurfaceInteraction
     // it's a leaf node
     if( (node->flag & mask) == 3 ){
         auto inter = false;
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
+        for( const auto& tri : node->tri_list ){
+            SORT_STATS(sIntersectionTest += 4);
+            inter |= intersect ? intersectTriangle_SIMD( ray , ray_data , tri , intersect ) : intersectTriangleFast_SIMD( ray , ray_data , tri );
+            if( Query::IsShadowRay( intersect ) && inter ){
+                resolveShadowHit( intersect );
+                return true;
+            }
+        }
+        for( const auto& line : node->line_list ){
+            SORT_STATS(sIntersectionTest += 4);
+            inter |= intersect ? intersectLine_SIMD( ray , ray_data , line , intersect ) : intersectLineFast_SIMD( ray , ray_data , line );
+            if( Query::IsShadowRay( intersect ) && inter ){
+                resolveShadowHit( intersect );
+                return true;
+            }
+        }
+#endif
         for( auto primitive : node->primitivelist ){
             SORT_STATS(++sIntersectionTest);
-            inter |= primitive->GetIntersect( ray , intersect );
-            if( isShadowRay( intersect ) && inter ){
-#ifdef ENABLE_TRANSPARENT_SHADOW
-                sAssert(IS_PTR_VALID( intersect->primitive ), SPATIAL_ACCELERATOR );
-                sAssert(IS_PTR_VALID( intersect->primitive->GetMaterial() ), SPATIAL_ACCELERATOR );
-                if( !intersect->primitive->GetMaterial()->HasTransparency() ){
-                    // setting primitive to be nullptr and return true at the same time is a special 'code' 
-                    // that the above level logic will take advantage of.
-                    intersect->primitive = nullptr;
-                }
-#endif
+            inter |= intersectPrimitive( primitive , ray , intersect );
+            if( Query::IsShadowRay( intersect ) && inter ){
+                resolveShadowHit( intersect );
                 return true;
             }
         }
+        // Unlike the scalar version, SSE intersection tests won't accept an intersection at the same distance again, an intersection
+        // found beyond this leaf earlier needs to be accepted here.
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
+        inter = IS_PTR_VALID( intersect ) && IS_PTR_VALID( intersect->primitive );
+#endif
         return inter && ( intersect->t < ( fmax + delta ) && intersect->t > ( fmin - delta ) );
     }
 
@@ -300,12 +379,12 @@ bool KDTree::traverse( const Kd_Node* node , const Ray& ray , SurfaceInteraction
 
     auto inter = false;
     if( t > fmin - delta ){
-        inter = traverse( first , ray , intersect , fmin , std::min( fmax , t ) );
-        if( isShadowRay(intersect) && inter )
+        inter = traverse<Query>( first , ray , ray_data , intersect , fmin , std::min( fmax , t ) );
+        if( Query::IsShadowRay(intersect) && inter )
             return true;
     }
     if( !inter && ( fmax + delta ) > t )
-        return traverse( second , ray , intersect , std::max( t , fmin ) , fmax );
+        return traverse<Query>( second , ray , ray_data , intersect , std::max( t , fmin ) , fmax );
     return inter;
 }
 
@@ -323,10 +402,15 @@ void KDTree::GetIntersect( const Ray& ray , BSSRDFIntersections& intersect , con
     if( fmin < 0.0f )
         return;
 
-    traverse( m_root.get() , ray , intersect , fmin , fmax , matID );
+    Kd_Ray_Data ray_data;
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
+    resolveRayData( ray , ray_data );
+#endif
+
+    traverse( m_root.get() , ray , ray_data , intersect , fmin , fmax , matID );
 }
 
-void KDTree::traverse( const Kd_Node* node , const Ray& ray , BSSRDFIntersections& intersect , float fmin , float fmax , const StringID matID ) const{
+void KDTree::traverse( const Kd_Node* node , const Ray& ray , const Kd_Ray_Data& ray_data , BSSRDFIntersections& intersect , float fmin , float fmax , const StringID matID ) const{
     static const auto       mask = 0x00000003u;
     static const auto       delta = 0.001f;
 
@@ -338,10 +422,18 @@ void KDTree::traverse( const Kd_Node* node , const Ray& ray , BSSRDFIntersection
 
     // it's a leaf node
     if( (node->flag & mask) == 3 ){
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
+        for( const auto& tri : node->tri_list ){
+            SORT_STATS(sIntersectionTest += 4);
+            intersectTriangleMulti_SIMD( ray , ray_data , tri , matID , intersect );
+        }
+        // Same as QBVH, lines are skipped here since they are usually hair with its own shader, which has no SSS.
+#endif
+
         SurfaceInteraction intersection;
         
         for( auto primitive : node->primitivelist ){
-            if( matID != primitive->GetMaterial()->GetUniqueID() )
+            if( matID != INVALID_SID && matID != primitive->GetMaterial()->GetUniqueID() )
                 continue;
             
             // make sure the primitive is not checked before
@@ -358,27 +450,11 @@ void KDTree::traverse( const Kd_Node* node , const Ray& ray , BSSRDFIntersection
             SORT_STATS(++sIntersectionTest);
         
             intersection.Reset();
-            const auto intersected = primitive->GetIntersect( ray , &intersection );
+            intersection.t = intersect.maxt;
+            const auto intersected = intersectPrimitive( primitive , ray , &intersection );
             if( intersected ){
-                if( intersect.cnt < TOTAL_SSS_INTERSECTION_CNT ){
-                    intersect.intersections[intersect.cnt] = SORT_MALLOC(BSSRDFIntersection)();
-                    intersect.intersections[intersect.cnt++]->intersection = intersection;
-                }else{
-                    auto picked_i = -1;
-                    auto t = 0.0f;
-                    for( auto i = 0 ; i < TOTAL_SSS_INTERSECTION_CNT ; ++i ){
-                        if( t < intersect.intersections[i]->intersection.t ){
-                            t = intersect.intersections[i]->intersection.t;
-                            picked_i = i;
-                        }
-                    }
-                    if( picked_i >= 0 )
-                        intersect.intersections[picked_i]->intersection = intersection;
-
-                    intersect.maxt = 0.0f;
-                    for( auto i = 0u ; i < intersect.cnt ; ++i )
-                        intersect.maxt = std::max( intersect.maxt , intersect.intersections[i]->intersection.t );
-                }
+                FinalizeInteraction( ray , intersection );
+                intersect.Add( intersection );
             }
         }
 
@@ -396,9 +472,9 @@ void KDTree::traverse( const Kd_Node* node , const Ray& ray , BSSRDFIntersection
         std::swap(first, second);
 
     if( t > fmin - delta )
-        traverse( first , ray , intersect , fmin , std::min( fmax , t ) , matID );
+        traverse( first , ray , ray_data , intersect , fmin , std::min( fmax , t ) , matID );
     if( ( fmax + delta ) > t )
-        traverse( second , ray , intersect , std::max( t , fmin ) , fmax , matID );
+        traverse( second , ray , ray_data , intersect , std::max( t , fmin ) , fmax , matID );
 }
 
 std::unique_ptr<Accelerator> KDTree::Clone() const {
@@ -19,6 +19,21 @@
 
 #include "accelerator.h"
 
+// Leaves of KD-Tree have only a handful of primitives, which fits SSE better than AVX.
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
+#define SIMD_SSE_IMPLEMENTATION
+#define SIMD_BVH_IMPLEMENTATION
+#endif
+
+#include "simd/simd_ray_utils.h"
+#include "simd/sse_triangle.h"
+#include "simd/sse_line.h"
+
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
+#undef SIMD_BVH_IMPLEMENTATION
+#undef SIMD_SSE_IMPLEMENTATION
+#endif
+
 //! @brief K-Dimensional Tree or KD-Tree.
 /**
  * A KD-Tree is a spatial partitioning data structure for organizing primitives in a
@@ -43,8 +58,15 @@ class KDTree : public Accelerator{
         std::unique_ptr<Kd_Node>                        rightChild = nullptr;
         /**< Bounding box of the KD-Tree node. */
         BBox                            bbox;
-        /**< Vector holding all primitives in the node. It should be empty for interior nodes. */
+        /**< Vector holding all primitives in the node. It should be empty for interior nodes. With SSE enabled,
+        triangles and lines are packed in the following lists and only the rest of primitives are left here. */
         std::vector<const Primitive*>   primitivelist;
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
+        /**< Triangles in the leaf node, four of them are tested at the cost of one. */
+        std::vector<Triangle4>          tri_list;
+        /**< Lines in the leaf node, four of them are tested at the cost of one. */
+        std::vector<Line4>              line_list;
+#endif
         /**< Special mask used for nodes. The node is a leaf node if it is 3. For interior
         nodes, it will be the corresponding id of the split axis.*/
         unsigned                        flag = 0;
@@ -95,6 +117,14 @@ class KDTree : public Accelerator{
         std::unique_ptr<Split[]>        split[3] = { nullptr , nullptr , nullptr };
     };
 
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
+    /**< Ray data resolved once for SSE intersection tests in all leaves along the ray. */
+    using Kd_Ray_Data = Ray4_Data;
+#else
+    /**< There is nothing to resolve for rays without SSE. */
+    struct Kd_Ray_Data {};
+#endif
+
 public:
     DEFINE_RTTI( KDTree , Accelerator );
 
@@ -111,7 +141,6 @@ public:
     //!                     it returns false.
     bool GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const override;
 
-#ifndef ENABLE_TRANSPARENT_SHADOW
     //! @brief This is a dedicated interface for detecting shadow rays.
     //!
     //! Instead of merging the interface with 'GetIntersect', this is a separate interface purely for occlusion detection.
@@ -121,7 +150,6 @@ public:
     //! @param r            The ray to be tested.
     //! @return             Whether the ray is occluded by anything.
     bool IsOccluded( const Ray& r ) const override;
-#endif
 
     //! @brief Get multiple intersections between the ray and the primitive set using spatial data structure.
     //!
@@ -217,23 +245,26 @@ private:
     //!
     //! @param node         The node to be traversed.
     //! @param ray          The ray to be tested.
-    //! @param intersect    The structure holding the intersection information. If empty
-    //!                     pointer is passed, it will return as long as one intersection
+    //! @param ray_data     The resolved data of the ray for SSE intersection tests.
+    //! @param intersect    The structure holding the intersection information. It is ignored
+    //!                     by occlusion queries, which return as long as one intersection
     //!                     is found and it won't be necessary to be the nearest one.
     //! @param fmin         The minimum range along the ray.
     //! @param fmax         The maximum range along the ray.
     //! @return             True if there is intersection, otherwise it will return false.
-    bool traverse( const Kd_Node* node , const Ray& ray , SurfaceInteraction* intersect , float fmin , float fmax ) const;
+    template<class Query>
+    bool traverse( const Kd_Node* node , const Ray& ray , const Kd_Ray_Data& ray_data , SurfaceInteraction* intersect , float fmin , float fmax ) const;
 
     //! @brief  A recursive function that traverses the KD-Tree node.
     //!
     //! @param node         The node to be traversed.
     //! @param ray          The ray to be tested.
+    //! @param ray_data     The resolved data of the ray for SSE intersection tests.
     //! @param intersect    The data structure holds all intersections.
     //! @param fmin         The minimum range along the ray.
     //! @param fmax         The maximum range along the ray.
     //! @param matID        Material ID to avoid if it is not invalid.
-    void traverse( const Kd_Node* node , const Ray& ray , BSSRDFIntersections& intersect , float fmin , float fmax , const StringID matID ) const;
+    void traverse( const Kd_Node* node , const Ray& ray , const Kd_Ray_Data& ray_data , BSSRDFIntersections& intersect , float fmin , float fmax , const StringID matID ) const;
 
     //! @brief  Delete all sub tree originating from node.
     //!
@@ -32,6 +32,7 @@
 #include "simd/avx_bbox.h"
 #include "simd/avx_triangle.h"
 #include "simd/avx_line.h"
+#include "simd/avx_planar.h"
 #include "fast_bvh.h"
 
 #ifdef AVX_ENABLED
@@ -16,6 +16,7 @@
  */
 
 #include "octree.h"
+#include "scalar_query.h"
 #include "core/primitive.h"
 #include "core/log.h"
 #include "scatteringevent/scatteringevent.h"
@@ -45,6 +46,7 @@ void OcTree::Build(const std::vector<const Primitive*>& primitives, const BBox&
 		return;
 
     m_bbox = bbox;
+    m_leafPrimitives.clear();
 
     // initialize a primitive container
     std::unique_ptr<NodePrimitiveContainer> container = std::make_unique<NodePrimitiveContainer>();
@@ -134,8 +136,9 @@ void OcTree::makeLeaf( OcTreeNode* node , NodePrimitiveContainer* container ){
     SORT_STATS(sOcTreeMaxPriCountInLeaf = std::max( sOcTreeMaxPriCountInLeaf , (StatsInt)container->primitives.size()) );
     SORT_STATS(sOcTreePrimitiveCount += (StatsInt)container->primitives.size());
 
-    for( auto primitive : container->primitives )
-        node->primitives.push_back( primitive );
+    node->pri_offset = (unsigned)m_leafPrimitives.size();
+    node->pri_cnt = (unsigned)container->primitives.size();
+    m_leafPrimitives.insert( m_leafPrimitives.end() , container->primitives.begin() , container->primitives.end() );
 }
 
 bool OcTree::GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const{
@@ -153,10 +156,13 @@ bool OcTree::GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const{
     if( fmin < 0.0f )
         return false;
 
-    return traverseOcTree( m_root.get() , r , &intersect , fmin , fmax );
+    const auto found = traverseOcTree<Closest_Hit_Query>( m_root.get() , r , &intersect , fmin , fmax , Ray_Mailbox::Get().NewRay() );
+
+    // attributes are only evaluated for the nearest hit
+    FinalizeInteraction( r , intersect );
+    return found;
 }
 
-#ifndef ENABLE_TRANSPARENT_SHADOW
 bool OcTree::IsOccluded( const Ray& r ) const{
     SORT_PROFILE("Traverse OcTree");
     SORT_STATS(++sRayCount);
@@ -169,11 +175,15 @@ bool OcTree::IsOccluded( const Ray& r ) const{
     if( fmin < 0.0f )
         return false;
 
-    return traverseOcTree( m_root.get() , r , nullptr , fmin , fmax );
+    return traverseOcTree<Any_Hit_Query>( m_root.get() , r , nullptr , fmin , fmax , Ray_Mailbox::Get().NewRay() );
 }
-#endif
 
-bool OcTree::traverseOcTree( const OcTreeNode* node , const Ray& ray , SurfaceInteraction* intersect , float fmin , float fmax ) const{
+template<class Query>
+bool OcTree::traverseOcTree( const OcTreeNode* node , const Ray& ray , SurfaceInteraction* intersect , float fmin , float fmax , unsigned rayId ) const{
+    // occlusion queries never have an intersection to fill, it is known during compilation.
+    if( Query::ANY_HIT )
+        intersect = nullptr;
+
     constexpr auto   delta = 0.001f;
     auto found = false;
 
@@ -185,17 +195,21 @@ bool OcTree::traverseOcTree( const OcTreeNode* node , const Ray& ray , SurfaceIn
 
     // Iterate if there is primitives in the node. Since it is not allowed to store primitives in non-leaf node, there is no need to proceed.
     if(IS_PTR_INVALID(node->child[0])){
-        for( auto primitive : node->primitives ){
+        auto& mailbox = Ray_Mailbox::Get();
+        for( auto i = node->pri_offset ; i < node->pri_offset + node->pri_cnt ; ++i ){
+            const auto primitive = m_leafPrimitives[i];
+            if( mailbox.Tested( primitive , rayId ) )
+                continue;
+
             SORT_STATS(++sIntersectionTest);
-            found |= primitive->GetIntersect( ray , intersect );
+            found |= intersectPrimitive( primitive , ray , intersect );
 
             // a quick branching out if a shadow ray is hit by an opaque object
-            const auto is_shadow_ray_blocked = isShadowRay( intersect ) && found;
+            const auto is_shadow_ray_blocked = Query::IsShadowRay( intersect ) && found;
             if( is_shadow_ray_blocked ){
 #ifdef ENABLE_TRANSPARENT_SHADOW
-                sAssert(IS_PTR_VALID(intersect->primitive), SPATIAL_ACCELERATOR );
-                sAssert(IS_PTR_VALID(intersect->primitive->GetMaterial()), SPATIAL_ACCELERATOR );
-                if( !intersect->primitive->GetMaterial()->HasTransparency() ){
+                // occlusion queries don't have any intersection to mark
+                if( IS_PTR_VALID(intersect) && !intersect->primitive->HasTransparency() ){
                     // setting primitive to be nullptr and return true at the same time is a special 'code' 
                     // that the above level logic will take advantage of.
                     intersect->primitive = nullptr;
@@ -204,7 +218,8 @@ bool OcTree::traverseOcTree( const OcTreeNode* node , const Ray& ray , SurfaceIn
                 return true;
             }
         }
-        return found && ( intersect->t < ( fmax + delta ) && intersect->t > ( fmin - delta ) );
+        // primitives skipped by the mailbox could have been hit in an earlier leaf beyond its range, the hit counts once the ray reaches it.
+        return IS_PTR_VALID(intersect) && IS_PTR_VALID(intersect->primitive) && ( intersect->t < ( fmax + delta ) && intersect->t > ( fmin - delta ) );
     }
 
     const auto contact = ray(fmin);
@@ -230,7 +245,7 @@ bool OcTree::traverseOcTree( const OcTreeNode* node , const Ray& ray , SurfaceIn
         nextAxis = (_next[nextAxis] <= _next[2]) ? nextAxis : 2;
 
         // check if there is intersection in the current grid
-        if( traverseOcTree( node->child[node_index].get() , ray , intersect , _curt , _next[nextAxis] ) )
+        if( traverseOcTree<Query>( node->child[node_index].get() , ray , intersect , _curt , _next[nextAxis] , rayId ) )
             return true;
 
         // get to the next node based on distance
@@ -279,8 +294,9 @@ void OcTree::traverseOcTree( const OcTreeNode* node , const Ray& ray , BSSRDFInt
     // iterate if there is primitives in the node. Since it is not allowed to store primitives in non-leaf node, there is no need to proceed.
     if(IS_PTR_INVALID(node->child[0])){
         SurfaceInteraction intersection;
-        for( auto primitive : node->primitives ){
-            if( matID != primitive->GetMaterial()->GetUniqueID() )
+        for( auto k = node->pri_offset ; k < node->pri_offset + node->pri_cnt ; ++k ){
+            const auto primitive = m_leafPrimitives[k];
+            if( matID != INVALID_SID && matID != primitive->GetMaterial()->GetUniqueID() )
                 continue;
             
             // make sure the primitive is not checked before
@@ -297,27 +313,11 @@ void OcTree::traverseOcTree( const OcTreeNode* node , const Ray& ray , BSSRDFInt
             SORT_STATS(++sIntersectionTest);
         
             intersection.Reset();
-            const auto intersected = primitive->GetIntersect( ray , &intersection );
+            intersection.t = intersect.maxt;
+            const auto intersected = intersectPrimitive( primitive , ray , &intersection );
             if( intersected ){
-                if( intersect.cnt < TOTAL_SSS_INTERSECTION_CNT ){
-                    intersect.intersections[intersect.cnt] = SORT_MALLOC(BSSRDFIntersection)();
-                    intersect.intersections[intersect.cnt++]->intersection = intersection;
-                }else{
-                    auto picked_i = -1;
-                    auto t = 0.0f;
-                    for( auto i = 0 ; i < TOTAL_SSS_INTERSECTION_CNT ; ++i ){
-                        if( t < intersect.intersections[i]->intersection.t ){
-                            t = intersect.intersections[i]->intersection.t;
-                            picked_i = i;
-                        }
-                    }
-                    if( picked_i >= 0 )
-                        intersect.intersections[picked_i]->intersection = intersection;
-
-                    intersect.maxt = 0.0f;
-                    for( auto i = 0u ; i < intersect.cnt ; ++i )
-                        intersect.maxt = std::max( intersect.maxt , intersect.intersections[i]->intersection.t );
-                }
+                FinalizeInteraction( ray , intersection );
+                intersect.Add( intersection );
             }
         }
         return;
@@ -24,14 +24,19 @@
  * OcTree is a popular data structure in scene management, which is commonly seen in game engines.
  * Instead of scene visibility management, it can also serves for the purpose of accelerating ray
  * tracer applications.
+ *
+ * Primitives of all leaves are stored in one array, a leaf only keeps a range in it. Since a primitive
+ * could overlap multiple leaves, a per-ray mailbox prevents testing it against the same ray again.
  */
 class OcTree : public Accelerator{
     //! @brief      OcTree node structure
     struct OcTreeNode{
         /**< Child node pointers, all will be NULL if current node is a leaf.*/
         std::unique_ptr<OcTreeNode>     child[8] = {nullptr};
-        /**< Primitives buffer.*/
-        std::vector<const Primitive*>   primitives;
+        /**< Offset of the first primitive of this leaf in the shared primitive array.*/
+        unsigned                        pri_offset = 0;
+        /**< Number of primitives in this leaf.*/
+        unsigned                        pri_cnt = 0;
         /**< Bounding box for this OcTree node.*/
         BBox                            bb;
     };
@@ -55,7 +60,6 @@ public:
     //!                     it returns false.
     bool GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const override;
 
-#ifndef ENABLE_TRANSPARENT_SHADOW
     //! @brief This is a dedicated interface for detecting shadow rays.
     //!
     //! Instead of merging the interface with 'GetIntersect', this is a separate interface purely for occlusion detection.
@@ -65,7 +69,6 @@ public:
     //! @param r            The ray to be tested.
     //! @return             Whether the ray is occluded by anything.
     bool IsOccluded( const Ray& r ) const override;
-#endif
 
     //! @brief Get multiple intersections between the ray and the primitive set using spatial data structure.
     //!
@@ -110,6 +113,8 @@ public:
 private:
     /**< Pointer to the root node of this OcTree.*/
     std::unique_ptr<OcTreeNode> m_root = nullptr;
+    /**< Primitives of all leaf nodes, each leaf owns a contiguous range.*/
+    std::vector<const Primitive*>   m_leafPrimitives;
     /**< Maximum number of primitives allowed in a leaf node, 16 is the default value.*/
     unsigned    m_maxPriInLeaf = 16;
     /**< Maximum depth of the OcTree, 16 is the default value.*/
@@ -136,15 +141,16 @@ private:
     //!
     //! @param node         Sub-tree belongs to this node will be visited in a depth first manner.
     //! @param ray          The input ray to be tested.
-    //! @param intersect    A pointer to the result intersection information. If empty is passed,
-    //!                     it will return as long as an intersection is detected and it is not
+    //! @param intersect    A pointer to the result intersection information. It is ignored by occlusion
+    //!                     queries, which return as long as an intersection is detected and it is not
     //!                     necessarily to be the nearest one.
     //! @param fmin         Current minimum value along the ray
     //! @param fmax         Current maximum value along the ray.
-    //! @param matID        Material ID to avoid if it is not invalid.
+    //! @param rayId        Id of the ray in the mailbox, primitives already tested against it are skipped.
     //! @return             Whether the ray intersects anything in the primitive set
+    template<class Query>
     bool traverseOcTree( const OcTreeNode* node , const Ray& ray , SurfaceInteraction* intersect ,
-                         float fmin , float fmax ) const;
+                         float fmin , float fmax , unsigned rayId ) const;
 
     //! @brief  Traverse OcTree recursively and return if there is intersection.
     //!
@@ -0,0 +1,231 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "offload.h"
+#include "core/define.h"
+#include "core/primitive.h"
+#include "core/timer.h"
+#include "core/log.h"
+#include "shape/triangle.h"
+
+#ifdef SORT_IN_WINDOWS
+    #include <Windows.h>
+#else
+    #include <dlfcn.h>
+#endif
+
+// Batches smaller than this are traced on the CPU, the latency of the device is not worth it.
+static constexpr unsigned int OFFLOAD_MIN_BATCH = 256;
+
+SORT_STATS_DEFINE_COUNTER(sOffloadedBatchCount)
+SORT_STATS_DEFINE_COUNTER(sOffloadedRayCount)
+
+SORT_STATS_COUNTER("Spatial-Structure(Offload)", "Offloaded Batches", sOffloadedBatchCount);
+SORT_STATS_COUNTER("Spatial-Structure(Offload)", "Offloaded Rays", sOffloadedRayCount);
+
+static void unloadLibrary( void* library ){
+#ifdef SORT_IN_WINDOWS
+    FreeLibrary( (HMODULE)library );
+#else
+    dlclose( library );
+#endif
+}
+
+std::shared_ptr<RayDevice> RayDevice::Load( const std::string& path ){
+#ifdef SORT_IN_WINDOWS
+    auto library = (void*)LoadLibraryA( path.c_str() );
+#else
+    auto library = dlopen( path.c_str() , RTLD_NOW | RTLD_LOCAL );
+#endif
+    if( IS_PTR_INVALID( library ) ){
+        slog( WARNING , SPATIAL_ACCELERATOR , "Failed to load the ray device '%s', rays are traced on the CPU." , path.c_str() );
+        return nullptr;
+    }
+
+    std::shared_ptr<RayDevice> device( new RayDevice() );
+    device->m_library = library;
+
+#ifdef SORT_IN_WINDOWS
+    const auto entry = (SortRayDeviceEntry)GetProcAddress( (HMODULE)library , "SortRayDeviceApi" );
+#else
+    const auto entry = (SortRayDeviceEntry)dlsym( library , "SortRayDeviceApi" );
+#endif
+    device->m_api = entry ? entry() : nullptr;
+    if( IS_PTR_INVALID( device->m_api ) || SORT_RAY_DEVICE_VERSION != device->m_api->version ){
+        slog( WARNING , SPATIAL_ACCELERATOR , "'%s' is not a compatible ray device, rays are traced on the CPU." , path.c_str() );
+        return nullptr;
+    }
+
+    device->m_device = device->m_api->create();
+    if( IS_PTR_INVALID( device->m_device ) ){
+        slog( WARNING , SPATIAL_ACCELERATOR , "There is no device capable of running %s, rays are traced on the CPU." , device->m_api->name );
+        return nullptr;
+    }
+
+    slog( INFO , SPATIAL_ACCELERATOR , "Rays are offloaded to %s." , device->m_api->name );
+    return device;
+}
+
+RayDevice::~RayDevice(){
+    if( m_device )
+        m_api->destroy( m_device );
+    if( m_library )
+        unloadLibrary( m_library );
+}
+
+void Offload::Build( const std::vector<const Primitive*>& primitives , const BBox& bbox ){
+    m_cpu->Build( primitives , bbox );
+
+    m_primitives = &primitives;
+    m_bbox = bbox;
+    m_isValid = m_cpu->GetIsValid();
+    upload();
+}
+
+bool Offload::LoadCache( IStreamBase& stream , const std::vector<const Primitive*>& primitives , const BBox& bbox ){
+    if( !m_cpu->LoadCache( stream , primitives , bbox ) )
+        return false;
+
+    m_primitives = &primitives;
+    m_bbox = bbox;
+    m_isValid = m_cpu->GetIsValid();
+    upload();
+    return true;
+}
+
+bool Offload::Refit(){
+    // a structure refitted badly is built again, which uploads the triangles too
+    if( !m_cpu->RefitScene( m_bbox ) )
+        return false;
+
+    upload();
+    return true;
+}
+
+void Offload::upload(){
+    m_deviceReady = false;
+    if( IS_PTR_INVALID( m_primitives ) || m_primitives->empty() )
+        return;
+
+    std::vector<float> vertices;
+    vertices.reserve( m_primitives->size() * 9 );
+    for( const auto* primitive : *m_primitives ){
+        if( SHAPE_TRIANGLE != primitive->GetShapeType() || primitive->GetShape()->HasAlphaMask() ){
+            slog( WARNING , SPATIAL_ACCELERATOR , "Only triangles without alpha masks can be traced on the ray device, rays are traced on the CPU." );
+            return;
+        }
+
+        Point p[3];
+        static_cast<const Triangle*>( primitive->GetShape() )->GetVertices( p[0] , p[1] , p[2] );
+        for( const auto& v : p ){
+            vertices.push_back( v.x );
+            vertices.push_back( v.y );
+            vertices.push_back( v.z );
+        }
+    }
+
+    m_deviceReady = m_device->Build( vertices.data() , (unsigned int)m_primitives->size() );
+    if( !m_deviceReady )
+        slog( WARNING , SPATIAL_ACCELERATOR , "Failed to build the acceleration structure on the ray device, rays are traced on the CPU." );
+}
+
+unsigned int Offload::beginOffload( const Ray* rays , unsigned int cnt , bool anyHit , std::vector<SortDeviceRay>& deviceRays ,
+                                    std::vector<SortDeviceHit>& hits , void*& job ) const{
+    if( !m_deviceReady || cnt < OFFLOAD_MIN_BATCH )
+        return 0;
+
+    const auto offloaded = std::min( cnt , (unsigned int)( cnt * m_deviceShare.load( std::memory_order_relaxed ) ) );
+    if( 0 == offloaded )
+        return 0;
+
+    deviceRays.resize( offloaded );
+    hits.resize( offloaded );
+    for( auto i = 0u ; i < offloaded ; ++i ){
+        const auto& r = rays[i];
+        deviceRays[i] = { { r.m_Ori.x , r.m_Ori.y , r.m_Ori.z } , r.m_fMin , { r.m_Dir.x , r.m_Dir.y , r.m_Dir.z } , r.m_fMax };
+    }
+    job = m_device->Trace( deviceRays.data() , hits.data() , offloaded , anyHit );
+
+    SORT_STATS(++sOffloadedBatchCount);
+    SORT_STATS(sOffloadedRayCount += offloaded);
+    return offloaded;
+}
+
+void Offload::endOffload( void* job , float cpuTime ) const{
+    Timer timer;
+    m_device->Wait( job );
+    const auto wait_time = timer.GetElapsedTimeInMicroseconds();
+
+    // Give the device less of the next batches if the CPU is kept waiting, more if it is done first.
+    // Threads racing on the share don't matter, it only needs to converge roughly.
+    const auto share = m_deviceShare.load( std::memory_order_relaxed );
+    const auto adapted = wait_time > 0.1f * cpuTime ? share * 0.95f : share * 1.05f;
+    m_deviceShare.store( std::min( 0.95f , std::max( 0.05f , adapted ) ) , std::memory_order_relaxed );
+}
+
+void Offload::getIntersect( const Ray* rays , SurfaceInteraction* intersects , unsigned int cnt , bool coherent ) const{
+    static thread_local std::vector<SortDeviceRay>  device_rays;
+    static thread_local std::vector<SortDeviceHit>  hits;
+
+    const auto trace_on_cpu = [&]( const Ray* cpu_rays , SurfaceInteraction* cpu_intersects , unsigned int cpu_cnt ){
+        if( coherent )
+            m_cpu->GetIntersect( cpu_rays , cpu_intersects , cpu_cnt );
+        else
+            m_cpu->GetIntersectIncoherent( cpu_rays , cpu_intersects , cpu_cnt );
+    };
+
+    void* job = nullptr;
+    const auto offloaded = beginOffload( rays , cnt , false , device_rays , hits , job );
+    if( 0 == offloaded ){
+        trace_on_cpu( rays , intersects , cnt );
+        return;
+    }
+
+    Timer timer;
+    trace_on_cpu( rays + offloaded , intersects + offloaded , cnt - offloaded );
+    endOffload( job , timer.GetElapsedTimeInMicroseconds() );
+
+    // Set up the intersections with the triangles found by the device.
+    for( auto i = 0u ; i < offloaded ; ++i ){
+        if( SORT_DEVICE_MISS == hits[i].triangle )
+            continue;
+
+        // The device doesn't test triangles the watertight way, a ray grazing an edge could hit the neighbour on the CPU.
+        const auto* primitive = (*m_primitives)[hits[i].triangle];
+        if( !primitive->GetIntersect( rays[i] , &intersects[i] ) )
+            m_cpu->GetIntersect( rays[i] , intersects[i] );
+    }
+}
+
+void Offload::IsOccluded( const Ray* rays , bool* occluded , unsigned int cnt ) const{
+    static thread_local std::vector<SortDeviceRay>  device_rays;
+    static thread_local std::vector<SortDeviceHit>  hits;
+
+    void* job = nullptr;
+    const auto offloaded = beginOffload( rays , cnt , true , device_rays , hits , job );
+    if( 0 == offloaded ){
+        m_cpu->IsOccluded( rays , occluded , cnt );
+        return;
+    }
+
+    Timer timer;
+    m_cpu->IsOccluded( rays + offloaded , occluded + offloaded , cnt - offloaded );
+    endOffload( job , timer.GetElapsedTimeInMicroseconds() );
+
+    for( auto i = 0u ; i < offloaded ; ++i )
+        occluded[i] = SORT_DEVICE_MISS != hits[i].triangle;
+}
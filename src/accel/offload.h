@@ -0,0 +1,182 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <atomic>
+#include <string>
+#include "accelerator.h"
+#include "raydevice.h"
+
+//! @brief  A ray traversal device loaded from a shared library.
+/**
+ * The shared library is kept loaded as long as the device is alive.
+ */
+class RayDevice{
+public:
+    //! @brief  Load the device from a shared library.
+    //!
+    //! @param  path        Full path of the shared library.
+    //! @return             The device, nullptr if the library can't be loaded or there is no capable device.
+    static std::shared_ptr<RayDevice>   Load( const std::string& path );
+
+    //! @brief  Release the device context and unload the library.
+    ~RayDevice();
+
+    //! @brief  Build the acceleration structure of a triangle soup on the device.
+    //!
+    //! @param  vertices        Three vertices of three floats each per triangle.
+    //! @param  triangleCnt     Number of triangles.
+    //! @return                 Whether the acceleration structure is built.
+    bool    Build( const float* vertices , unsigned int triangleCnt ) const {
+        return 0 != m_api->build( m_device , vertices , triangleCnt );
+    }
+
+    //! @brief  Start tracing a batch of rays asynchronously.
+    void*   Trace( const SortDeviceRay* rays , SortDeviceHit* hits , unsigned int cnt , bool anyHit ) const {
+        return m_api->trace( m_device , rays , hits , cnt , anyHit ? 1 : 0 );
+    }
+
+    //! @brief  Wait for a batch of rays to be traced.
+    void    Wait( void* job ) const {
+        m_api->wait( m_device , job );
+    }
+
+private:
+    RayDevice() = default;
+
+    void*                       m_library = nullptr;    /**< Handle of the shared library. */
+    const SortRayDeviceApi*     m_api = nullptr;        /**< Functions exported by the library. */
+    void*                       m_device = nullptr;     /**< Context of the device. */
+};
+
+//! @brief  Accelerator offloading large batches of rays to a ray traversal device.
+/**
+ * It wraps an accelerator on the CPU, which traces single rays, shadow rays with transparency and SSS probe rays on its
+ * own. A batch of rays large enough is split in two, a share of it is traced on the device asynchronously while the calling
+ * thread traces the rest on the CPU. The share is adapted to keep both of them busy for about the same time.
+ *
+ * The device only reports the nearest triangle and its distance, the intersection is set up again on the CPU by testing
+ * the ray against the triangle, so that shading sees exactly the same data no matter where the ray is traced. Scenes with
+ * primitives other than triangles, like instances, curves or subdivision surfaces, are traced on the CPU entirely.
+ */
+class Offload : public Accelerator{
+public:
+    //! @brief Constructor.
+    //!
+    //! @param cpu          The accelerator tracing rays on the CPU.
+    //! @param device       The device rays are offloaded to.
+    Offload( std::unique_ptr<Accelerator> cpu , std::shared_ptr<RayDevice> device ) : m_cpu(std::move(cpu)) , m_device(device) {}
+
+    //! @brief Get intersection between the ray and the primitive set on the CPU.
+    bool GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const override {
+        return m_cpu->GetIntersect( r , intersect );
+    }
+
+    //! @brief Get intersections of a packet of rays, part of them is traced on the device if the packet is large enough.
+    //!
+    //! @param rays         The packet of rays to be tested.
+    //! @param intersects   The intersection results, one for each ray. 't' of each of them needs to be initialized.
+    //! @param cnt          Number of rays in the packet.
+    void GetIntersect( const Ray* rays , SurfaceInteraction* intersects , unsigned int cnt ) const override {
+        getIntersect( rays , intersects , cnt , true );
+    }
+
+    //! @brief Get intersections of a batch of incoherent rays, part of them is traced on the device if the batch is large enough.
+    //!
+    //! @param rays         The batch of rays to be tested.
+    //! @param intersects   The intersection results, one for each ray. 't' of each of them needs to be initialized.
+    //! @param cnt          Number of rays in the batch.
+    void GetIntersectIncoherent( const Ray* rays , SurfaceInteraction* intersects , unsigned int cnt ) const override {
+        getIntersect( rays , intersects , cnt , false );
+    }
+
+    //! @brief Detect occlusion of a shadow ray on the CPU.
+    bool IsOccluded( const Ray& r ) const override {
+        return m_cpu->IsOccluded( r );
+    }
+
+    //! @brief Detect occlusion of a shadow ray on the CPU and tell what blocks it.
+    bool IsOccluded( const Ray& r , const Primitive*& occluder ) const override {
+        return m_cpu->IsOccluded( r , occluder );
+    }
+
+    //! @brief Detect occlusion of a batch of shadow rays, part of them is tested on the device if the batch is large enough.
+    //!
+    //! @param rays         The shadow rays to be tested.
+    //! @param occluded     Whether each of the rays is occluded by anything.
+    //! @param cnt          Number of rays in the batch.
+    void IsOccluded( const Ray* rays , bool* occluded , unsigned int cnt ) const override;
+#ifdef ENABLE_TRANSPARENT_SHADOW
+    //! @brief Get the nearest intersections along a shadow ray on the CPU.
+    void GetIntersect( const Ray& r , ShadowIntersections& intersect ) const override {
+        m_cpu->GetIntersect( r , intersect );
+    }
+#endif
+
+    //! @brief Get multiple intersections between the ray and the primitive set on the CPU.
+    void GetIntersect( const Ray& r , BSSRDFIntersections& intersect , const StringID matID = INVALID_SID ) const override {
+        m_cpu->GetIntersect( r , intersect , matID );
+    }
+
+    //! @brief Build the accelerator on the CPU and upload the triangles to the device.
+    //!
+    //! @param primitives       A vector holding all primitives.
+    //! @param bbox             The bounding box of the scene.
+    void Build( const std::vector<const Primitive*>& primitives , const BBox& bbox ) override;
+
+    //! @brief Clone the accelerator on the CPU, primitives with volumes are not worth offloading.
+    std::unique_ptr<Accelerator> Clone() const override {
+        return m_cpu->Clone();
+    }
+
+    //! @brief Settings of the accelerator on the CPU are serialized before it is wrapped, there is nothing else to serialize.
+    void Serialize( IStreamBase& stream ) override {}
+
+    //! @brief Save the accelerator on the CPU to a cache file.
+    bool SaveCache( OStreamBase& stream ) const override {
+        return m_cpu->SaveCache( stream );
+    }
+
+    //! @brief Load the accelerator on the CPU from a cache file and upload the triangles to the device.
+    bool LoadCache( IStreamBase& stream , const std::vector<const Primitive*>& primitives , const BBox& bbox ) override;
+
+    //! @brief Refit the accelerator on the CPU and upload the moved triangles to the device.
+    bool Refit() override;
+
+private:
+    std::unique_ptr<Accelerator>    m_cpu;                      /**< The accelerator tracing rays on the CPU. */
+    std::shared_ptr<RayDevice>      m_device;                   /**< The device rays are offloaded to. */
+    bool                            m_deviceReady = false;      /**< Whether the triangles of the scene are on the device. */
+    mutable std::atomic<float>      m_deviceShare = { 0.5f };   /**< Share of a batch traced on the device. */
+
+    //! @brief Upload the triangles of the scene to the device, it fails if there is any other type of primitive.
+    void    upload();
+
+    //! @brief Get intersections of a batch of rays, the part left on the CPU is traced as a packet or interleaved.
+    void    getIntersect( const Ray* rays , SurfaceInteraction* intersects , unsigned int cnt , bool coherent ) const;
+
+    //! @brief Start tracing the first part of a batch on the device.
+    //!
+    //! @return     Number of rays traced on the device, 0 if the batch is traced on the CPU entirely.
+    unsigned int    beginOffload( const Ray* rays , unsigned int cnt , bool anyHit , std::vector<SortDeviceRay>& deviceRays ,
+                                  std::vector<SortDeviceHit>& hits , void*& job ) const;
+
+    //! @brief Wait for the device and adapt the share of the device by how long the CPU waits for it.
+    void            endOffload( void* job , float cpuTime ) const;
+};
@@ -21,14 +21,14 @@
 #define Fbvh        Qbvh
 #define Fbvh_Node   Qbvh_Node
 
-#ifdef SSE_ENABLED
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
 #define SIMD_SSE_IMPLEMENTATION
 #define SIMD_BVH_IMPLEMENTATION
 #endif
 
 #include "fast_bvh.hpp"
 
-#ifdef SSE_ENABLED
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
 #undef SIMD_BVH_IMPLEMENTATION
 #undef SIMD_SSE_IMPLEMENTATION
 #endif
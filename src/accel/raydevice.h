@@ -0,0 +1,67 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+// Interface between SORT and a ray traversal device living in a shared library, like a CUDA/OptiX or a Vulkan ray tracing
+// backend. The library exports 'SortRayDeviceApi' with C linkage, returning a table of the functions below. Nothing else of
+// SORT is needed to build a device, so that it can be built with the toolchain of the GPU vendor.
+//
+// All functions except 'create' and 'destroy' are called from all rendering threads at the same time.
+
+#define SORT_RAY_DEVICE_VERSION     1
+
+extern "C" {
+
+//! @brief  A ray to be traced on the device.
+struct SortDeviceRay{
+    float           origin[3];      /**< Origin of the ray. */
+    float           tmin;           /**< Minimum distance along the ray. */
+    float           dir[3];         /**< Direction of the ray, it is normalized. */
+    float           tmax;           /**< Maximum distance along the ray. */
+};
+
+//! @brief  The nearest hit of a ray found on the device.
+struct SortDeviceHit{
+    float           t;              /**< Distance from the origin of the ray to the hit. */
+    unsigned int    triangle;       /**< Index of the triangle hit, SORT_DEVICE_MISS if nothing is hit. */
+};
+
+#define SORT_DEVICE_MISS            0xffffffffu
+
+//! @brief  Functions exported by a ray traversal device.
+struct SortRayDeviceApi{
+    //! Version of the interface the device is built against, it needs to be SORT_RAY_DEVICE_VERSION.
+    unsigned int    version;
+    //! Name of the device for logging.
+    const char*     name;
+    //! Create a device context, nullptr if there is no capable device.
+    void*           (*create)();
+    //! Destroy a device context.
+    void            (*destroy)( void* device );
+    //! Build the acceleration structure of a triangle soup, three vertices of three floats each per triangle.
+    int             (*build)( void* device , const float* vertices , unsigned int triangle_cnt );
+    //! Start tracing a batch of rays asynchronously, 'any_hit' stops at any hit for occlusion queries. It returns a job handle.
+    void*           (*trace)( void* device , const SortDeviceRay* rays , SortDeviceHit* hits , unsigned int cnt , int any_hit );
+    //! Wait for a job to be done, the hits are filled once it returns.
+    void            (*wait)( void* device , void* job );
+};
+
+//! @brief  Type of the function exported by the shared library as 'SortRayDeviceApi'.
+typedef const SortRayDeviceApi* (*SortRayDeviceEntry)();
+
+}
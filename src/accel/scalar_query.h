@@ -0,0 +1,144 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+#pragma once
+
+#include <cstdint>
+#include "core/define.h"
+#include "core/primitive.h"
+#include "shape/triangle.h"
+#include "shape/line.h"
+#include "accelerator.h"
+
+//! @brief  Scalar traversal kernels looking for the nearest intersection.
+/**
+ * Scalar traversals of BVH, KD-Tree, OcTree and uniform grid are templates of the query kind. Each kind gets its own copy
+ * of the traversal so that the checks of the kind of the query are resolved during compilation instead of being branches
+ * in the inner loops.
+ * Shadow rays with transparent shadow also go through this kernel, they still stop at the first intersection.
+ */
+struct Closest_Hit_Query{
+    static constexpr bool ANY_HIT = false;
+
+    //! @brief  Whether the query stops at the first intersection found.
+    //!
+    //! @param  intersect   The intersection of the query.
+    //! @return             Whether the query stops at the first intersection found.
+    static SORT_FORCEINLINE bool IsShadowRay( const SurfaceInteraction* intersect ){
+        return isShadowRay( intersect );
+    }
+};
+
+//! @brief  Scalar traversal kernels for occlusion queries, there is no intersection to fill at all.
+struct Any_Hit_Query{
+    static constexpr bool ANY_HIT = true;
+
+    //! @brief  Whether the query stops at the first intersection found.
+    //!
+    //! @return             Any intersection is good enough for occlusion queries.
+    static SORT_FORCEINLINE bool IsShadowRay( const SurfaceInteraction* ){
+        return true;
+    }
+};
+
+//! @brief  Intersection between a ray and a primitive, shapes are dispatched by their type tags.
+//!
+//! Triangles and lines are the vast majority of primitives in scalar traversals. They are tested through direct calls
+//! instead of the virtual interface of shapes, everything else still goes through the primitive. Hits on triangles and
+//! lines are left pending, the accelerator evaluates the attributes of the nearest one after the traversal.
+//!
+//! @param  primitive   The primitive to be tested.
+//! @param  ray         The ray to be tested.
+//! @param  intersect   The intersection to be filled, nullptr for occlusion queries.
+//! @return             Whether the ray hits the primitive.
+SORT_FORCEINLINE bool intersectPrimitive( const Primitive* primitive , const Ray& ray , SurfaceInteraction* intersect ){
+    auto hit = false;
+    switch( primitive->GetShapeType() ){
+        case SHAPE_TRIANGLE:
+            hit = static_cast<const Triangle*>( primitive->GetShape() )->Triangle::GetIntersectDeferred( ray , intersect );
+            break;
+        case SHAPE_LINE:
+            hit = static_cast<const Line*>( primitive->GetShape() )->Line::GetIntersectDeferred( ray , intersect );
+            break;
+        default:
+            return primitive->GetIntersect( ray , intersect );
+    }
+
+    if( hit && intersect )
+        intersect->primitive = primitive;
+    return hit;
+}
+
+/**< Number of slots in the mailbox of each thread, it needs to be a power of two. */
+static constexpr unsigned RAY_MAILBOX_SIZE = 64;
+
+//! @brief  Primitives recently tested by the ray being traced in a thread.
+/**
+ * Uniform grids and OcTrees reference a primitive in every cell it overlaps, a ray crossing many cells would test the same
+ * large primitive again and again. Each thread keeps a small direct mapped cache of the primitives tested. Entries are tagged
+ * with the id of the ray that tested them so that starting a new ray doesn't need to clear anything. Colliding primitives
+ * simply evict each other, which costs nothing but a redundant test.
+ */
+class Ray_Mailbox{
+public:
+    //! @brief  Get the mailbox of the current thread.
+    //!
+    //! @return     The mailbox of the current thread.
+    static Ray_Mailbox& Get(){
+        static thread_local Ray_Mailbox mailbox;
+        return mailbox;
+    }
+
+    //! @brief  Start tracing a new ray.
+    //!
+    //! Traversals could be nested, like the one of an instance, the id is kept by the caller instead of the mailbox.
+    //!
+    //! @return     Id of the new ray.
+    unsigned NewRay(){
+        // entries tagged long ago could look valid again once the id wraps around
+        if( 0 == ++m_rayId ){
+            for( auto& slot : m_slots )
+                slot = Slot();
+            m_rayId = 1;
+        }
+        return m_rayId;
+    }
+
+    //! @brief  Check whether a primitive is already tested by a ray, it is marked as tested if not.
+    //!
+    //! @param  primitive   The primitive to be tested.
+    //! @param  ray_id      Id of the ray returned by 'NewRay'.
+    //! @return             Whether the primitive is already tested by the ray.
+    bool Tested( const Primitive* primitive , const unsigned ray_id ){
+        const auto key = (unsigned)( (uintptr_t)primitive >> 4 );
+        auto& slot = m_slots[( key ^ ( key >> 16 ) ) & ( RAY_MAILBOX_SIZE - 1 )];
+        if( slot.ray_id == ray_id && slot.primitive == primitive )
+            return true;
+        slot.primitive = primitive;
+        slot.ray_id = ray_id;
+        return false;
+    }
+
+private:
+    //! @brief  A slot in the mailbox.
+    struct Slot{
+        const Primitive*    primitive = nullptr;    /**< The primitive tested. */
+        unsigned            ray_id = 0;             /**< Id of the ray that tested the primitive. */
+    };
+
+    Slot        m_slots[RAY_MAILBOX_SIZE];  /**< Slots of the mailbox. */
+    unsigned    m_rayId = 0;                /**< Id of the latest ray. */
+};
@@ -15,7 +15,9 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <cfloat>
 #include "unigrid.h"
+#include "scalar_query.h"
 #include "core/primitive.h"
 #include "math/interaction.h"
 #include "core/log.h"
@@ -55,28 +57,31 @@ void UniGrid::Build( const std::vector<const Primitive*>& primitives , const BBo
     // get the total number of primitives
     auto count = (unsigned)m_primitives->size();
 
-    // grid per distance
-    auto gridPerDistance = 3 * powf( (float)count , 0.333f ) / extent ;
+    // The resolution follows the density of primitives so that each voxel holds a few of them no matter how the scene is
+    // shaped. Flat scenes would have no volume at all, thin axes are clamped to the size of the finest voxel.
+    auto volume = 1.0f;
+    for( auto i = 0 ; i < 3 ; ++i )
+        volume *= std::max( delta[i] , extent / UNIGRID_MAX_RESOLUTION );
+    const auto gridPerDistance = powf( UNIGRID_VOXELS_PER_PRIMITIVE * count / volume , 1.0f / 3.0f );
 
     // the grid size
     for(auto i = 0 ; i < 3 ; i++ ){
-        m_voxelNum[i] = (unsigned)(std::min( 256.0f , gridPerDistance * delta[i] ));
-        m_voxelInvExtent[i] = m_voxelNum[i] / delta[i];
-        m_voxelExtent[i] = 1.0f / m_voxelInvExtent[i];
+        m_voxelNum[i] = std::max( 1u , std::min( UNIGRID_MAX_RESOLUTION , (unsigned)ceilf( gridPerDistance * delta[i] ) ) );
+        m_voxelExtent[i] = std::max( delta[i] , FLT_MIN ) / m_voxelNum[i];
+        m_voxelInvExtent[i] = 1.0f / m_voxelExtent[i];
     }
 
     m_voxelCount = m_voxelNum[0] * m_voxelNum[1] * m_voxelNum[2];
 
-    // allocate the memory
-    m_voxels.resize( m_voxelCount );
-
-    // distribute the primitives
+    // distribute the primitives, references are gathered first and then sorted by voxels in one pass
+    std::vector<std::pair<unsigned,const Primitive*>> references;
     for( auto& primitive : *m_primitives ){
         unsigned maxGridId[3];
         unsigned minGridId[3];
+        const auto box = primitive->GetBBox();
         for(auto i = 0 ; i < 3 ; i++ ){
-            minGridId[i] = point2VoxelId(primitive->GetBBox().m_Min , i );
-            maxGridId[i] = point2VoxelId(primitive->GetBBox().m_Max , i );
+            minGridId[i] = point2VoxelId(box.m_Min , i );
+            maxGridId[i] = point2VoxelId(box.m_Max , i );
         }
 
         for(auto i = minGridId[2] ; i <= maxGridId[2] ; i++ )
@@ -88,10 +93,21 @@ void UniGrid::Build( const std::vector<const Primitive*>& primitives , const BBo
 
                     // only add the primitives if it is actually intersected
                     if( primitive->GetIntersect( bb ) )
-                        m_voxels[offset( k , j , i )].push_back(primitive);
+                        references.push_back( std::make_pair( offset( k , j , i ) , primitive ) );
                 }
     }
 
+    m_voxelOffsets.assign( m_voxelCount + 1 , 0 );
+    for( const auto& reference : references )
+        ++m_voxelOffsets[reference.first + 1];
+    for( auto i = 0u ; i < m_voxelCount ; ++i )
+        m_voxelOffsets[i + 1] += m_voxelOffsets[i];
+
+    std::vector<unsigned> cursor( m_voxelOffsets.begin() , m_voxelOffsets.end() - 1 );
+    m_voxelPrimitives.resize( references.size() );
+    for( const auto& reference : references )
+        m_voxelPrimitives[cursor[reference.first]++] = reference.second;
+
     m_isValid = true;
 
     SORT_STATS(sUniformGridX = m_voxelNum[0]);
@@ -119,7 +135,7 @@ bool UniGrid::GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const
 
     r.Prepare();
 
-    static const auto voxelId2Point = [&]( int id[3] ){
+    const auto voxelId2Point = [&]( int id[3] ){
         Point p;
         p.x = m_bbox.m_Min.x + id[0] * m_voxelExtent[0];
         p.y = m_bbox.m_Min.y + id[1] * m_voxelExtent[1];
@@ -132,7 +148,6 @@ bool UniGrid::GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const
     auto cur_t = Intersect( r , m_bbox , &maxt );
     if( cur_t < 0.0f )
         return false;
-    intersect.t = std::min( intersect.t , maxt );
 
     int     curGrid[3] , dir[3];
     float   delta[3] , next[3];
@@ -154,6 +169,7 @@ bool UniGrid::GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const
     }
 
     // traverse the uniform grid
+    const auto rayId = Ray_Mailbox::Get().NewRay();
     const unsigned idArray[] = { 0 , 0 , 1 , 0 , 2 , 2 , 1 , 0  };// [0] and [7] is impossible
     while( cur_t < intersect.t ){
         // current voxel id
@@ -164,23 +180,27 @@ bool UniGrid::GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const
         nextAxis = idArray[nextAxis];
 
         // check if there is intersection in the current grid
-        if( traverse( r , &intersect , voxelId , next[nextAxis] ) )
+        if( traverse<Closest_Hit_Query>( r , &intersect , voxelId , next[nextAxis] , rayId ) ){
+            FinalizeInteraction( r , intersect );
             return true;
+        }
 
         // get to the next voxel
         curGrid[nextAxis] += dir[nextAxis];
 
         if( curGrid[nextAxis] < 0 || (unsigned)curGrid[nextAxis] >= m_voxelNum[nextAxis] )
-            return intersect.t < maxt && intersect.primitive;
+            break;
 
         // update next
         cur_t = next[nextAxis];
         next[nextAxis] += delta[nextAxis];
     }
-    return intersect.t < maxt && IS_PTR_VALID(intersect.primitive);
+
+    // attributes are only evaluated for the nearest hit
+    FinalizeInteraction( r , intersect );
+    return IS_PTR_VALID(intersect.primitive);
 }
 
-#ifndef ENABLE_TRANSPARENT_SHADOW
 bool UniGrid::IsOccluded( const Ray& r ) const{
     SORT_PROFILE("Traverse Uniform Grid");
     SORT_STATS(++sRayCount);
@@ -188,7 +208,7 @@ bool UniGrid::IsOccluded( const Ray& r ) const{
 
     r.Prepare();
 
-    static const auto voxelId2Point = [&]( int id[3] ){
+    const auto voxelId2Point = [&]( int id[3] ){
         Point p;
         p.x = m_bbox.m_Min.x + id[0] * m_voxelExtent[0];
         p.y = m_bbox.m_Min.y + id[1] * m_voxelExtent[1];
@@ -222,6 +242,7 @@ bool UniGrid::IsOccluded( const Ray& r ) const{
     }
 
     // traverse the uniform grid
+    const auto rayId = Ray_Mailbox::Get().NewRay();
     const unsigned idArray[] = { 0 , 0 , 1 , 0 , 2 , 2 , 1 , 0  };// [0] and [7] is impossible
     while( true ){
         // current voxel id
@@ -232,7 +253,7 @@ bool UniGrid::IsOccluded( const Ray& r ) const{
         nextAxis = idArray[nextAxis];
 
         // check if there is intersection in the current grid
-        if( traverse( r , nullptr , voxelId , next[nextAxis] ) )
+        if( traverse<Any_Hit_Query>( r , nullptr , voxelId , next[nextAxis] , rayId ) )
             return true;
 
         // get to the next voxel
@@ -248,24 +269,32 @@ bool UniGrid::IsOccluded( const Ray& r ) const{
 
     return false;
 }
-#endif
 
-bool UniGrid::traverse( const Ray& r , SurfaceInteraction* intersect , unsigned voxelId , float nextT ) const{
+template<class Query>
+bool UniGrid::traverse( const Ray& r , SurfaceInteraction* intersect , unsigned voxelId , float nextT , unsigned rayId ) const{
+    // occlusion queries never have an intersection to fill, it is known during compilation.
+    if( Query::ANY_HIT )
+        intersect = nullptr;
+
     sAssertMsg( voxelId < m_voxelCount , SPATIAL_ACCELERATOR , "Invalid voxel id." );
 
+    auto& mailbox = Ray_Mailbox::Get();
     auto inter = false;
-    for( auto voxel : m_voxels[voxelId] ){
+    for( auto i = m_voxelOffsets[voxelId] ; i < m_voxelOffsets[voxelId + 1] ; ++i ){
+        const auto primitive = m_voxelPrimitives[i];
+        if( mailbox.Tested( primitive , rayId ) )
+            continue;
+
         SORT_STATS(++sIntersectionTest);
         // get intersection
-        inter |= voxel->GetIntersect( r , intersect );
+        inter |= intersectPrimitive( primitive , r , intersect );
 
         // a quick branching out if a shadow ray is hit by an opaque object
-        const auto is_shadow_ray_blocked = isShadowRay( intersect ) && inter;
+        const auto is_shadow_ray_blocked = Query::IsShadowRay( intersect ) && inter;
         if( is_shadow_ray_blocked ){
 #ifdef ENABLE_TRANSPARENT_SHADOW
-            sAssert(IS_PTR_VALID(intersect->primitive), SPATIAL_ACCELERATOR );
-            sAssert(IS_PTR_VALID(intersect->primitive->GetMaterial()), SPATIAL_ACCELERATOR );
-            if( !intersect->primitive->GetMaterial()->HasTransparency() ){
+            // occlusion queries don't have any intersection to mark
+            if( IS_PTR_VALID(intersect) && !intersect->primitive->HasTransparency() ){
                 // setting primitive to be nullptr and return true at the same time is a special 'code' 
                 // that the above level logic will take advantage of.
                 intersect->primitive = nullptr;
@@ -275,7 +304,8 @@ bool UniGrid::traverse( const Ray& r , SurfaceInteraction* intersect , unsigned
         }
     }
 
-    return inter && ( intersect->t < nextT + 0.00001f );
+    // primitives skipped by the mailbox could have been hit in an earlier voxel beyond its range, the hit counts once the ray reaches it.
+    return IS_PTR_VALID( intersect ) && IS_PTR_VALID( intersect->primitive ) && ( intersect->t < nextT + 0.00001f );
 }
 
 void UniGrid::GetIntersect( const Ray& r , BSSRDFIntersections& intersect , const StringID matID ) const{
@@ -287,7 +317,7 @@ void UniGrid::GetIntersect( const Ray& r , BSSRDFIntersections& intersect , cons
     intersect.cnt = 0;
     intersect.maxt = FLT_MAX;
 
-    static const auto voxelId2Point = [&]( int id[3] ){
+    const auto voxelId2Point = [&]( int id[3] ){
         Point p;
         p.x = m_bbox.m_Min.x + id[0] * m_voxelExtent[0];
         p.y = m_bbox.m_Min.y + id[1] * m_voxelExtent[1];
@@ -349,8 +379,9 @@ void UniGrid::traverse( const Ray& ray , BSSRDFIntersections& intersect , unsign
     sAssertMsg( voxelId < m_voxelCount , SPATIAL_ACCELERATOR , "Invalid voxel id." );
 
     SurfaceInteraction intersection;
-    for( auto primitive : m_voxels[voxelId] ){
-        if( matID != primitive->GetMaterial()->GetUniqueID() )
+    for( auto k = m_voxelOffsets[voxelId] ; k < m_voxelOffsets[voxelId + 1] ; ++k ){
+        const auto primitive = m_voxelPrimitives[k];
+        if( matID != INVALID_SID && matID != primitive->GetMaterial()->GetUniqueID() )
             continue;
 
         // make sure the primitive is not checked before
@@ -367,27 +398,11 @@ void UniGrid::traverse( const Ray& ray , BSSRDFIntersections& intersect , unsign
         SORT_STATS(++sIntersectionTest);
 
         intersection.Reset();
-        const auto intersected = primitive->GetIntersect( ray , &intersection );
+        intersection.t = intersect.maxt;
+        const auto intersected = intersectPrimitive( primitive , ray , &intersection );
         if( intersected ){
-            if( intersect.cnt < TOTAL_SSS_INTERSECTION_CNT ){
-                intersect.intersections[intersect.cnt] = SORT_MALLOC(BSSRDFIntersection)();
-                intersect.intersections[intersect.cnt++]->intersection = intersection;
-            }else{
-                auto picked_i = -1;
-                auto t = 0.0f;
-                for( auto i = 0 ; i < TOTAL_SSS_INTERSECTION_CNT ; ++i ){
-                    if( t < intersect.intersections[i]->intersection.t ){
-                        t = intersect.intersections[i]->intersection.t;
-                        picked_i = i;
-                    }
-                }
-                if( picked_i >= 0 )
-                    intersect.intersections[picked_i]->intersection = intersection;
-
-                intersect.maxt = 0.0f;
-                for( auto i = 0u ; i < intersect.cnt ; ++i )
-                    intersect.maxt = std::max( intersect.maxt , intersect.intersections[i]->intersection.t );
-            }
+            FinalizeInteraction( ray , intersection );
+            intersect.Add( intersection );
         }
     }
 }
@@ -19,12 +19,20 @@
 
 #include "accelerator.h"
 
+/**< Number of voxels per primitive, the resolution of the grid is derived from the density of primitives in the scene. */
+static constexpr float      UNIGRID_VOXELS_PER_PRIMITIVE    = 8.0f;
+/**< Maximum number of voxels along each axis. */
+static constexpr unsigned   UNIGRID_MAX_RESOLUTION          = 256;
+
 //! @brief Uniform Grid.
 /**
  * Uniform grid is the simplest spatial acceleration structure in a ray tracer.
  * Unlike other complex data structure, like KD-Tree, uniform grid takes linear
  * time complexity to build. However the traversal efficiency may be lower than
  * its peers.
+ * Primitives of all voxels live in one array, each voxel refers to a range of it.
+ * A primitive overlapping many voxels is only tested once by a ray thanks to the
+ * mailbox of the thread.
  */
 class UniGrid : public Accelerator{
 public:
@@ -46,7 +54,6 @@ public:
     //!                     it returns false.
     bool GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const override;
 
-#ifndef ENABLE_TRANSPARENT_SHADOW
     //! @brief This is a dedicated interface for detecting shadow rays.
     //!
     //! Instead of merging the interface with 'GetIntersect', this is a separate interface purely for occlusion detection.
@@ -56,7 +63,6 @@ public:
     //! @param r            The ray to be tested.
     //! @return             Whether the ray is occluded by anything.
     bool IsOccluded( const Ray& r ) const override;
-#endif
 
     //! @brief Get multiple intersections between the ray and the primitive set using spatial data structure.
     //!
@@ -101,8 +107,10 @@ private:
     Vector                                      m_voxelExtent;
     /**< Inverse of extent of one voxel along each axis. */
     Vector                                      m_voxelInvExtent;
-    /**< Vector holding all voxels. */
-    std::vector<std::vector<const Primitive*>>  m_voxels;
+    /**< Offset of the first primitive of each voxel, the last one is the total number of references. */
+    std::vector<unsigned>                       m_voxelOffsets;
+    /**< Primitives of all voxels, voxels refer to ranges of it. */
+    std::vector<const Primitive*>               m_voxelPrimitives;
 
     //! @brief      Locate the id of the voxel that the point belongs to along a specific axis.
     //!
@@ -120,14 +128,16 @@ private:
 
     //! @brief      Get the nearest intersection between a ray and the primitive set.
     //! @param r            The ray to be tested.
-    //! @param intersect    A pointer to the intersection information. If it is empty, it will return
-    //!                     true as long as there is an intersection detected, which is not necessarily
-    //!                     the nearest one.
+    //! @param intersect    A pointer to the intersection information. It is ignored by occlusion queries,
+    //!                     which return true as long as there is an intersection detected, which is not
+    //!                     necessarily the nearest one.
     //! @param voxelId      ID of the voxel to be tested.
     //! @param nextT        The intersected position of the ray and the next to-be-traversed voxel along
     //!                     the ray.
+    //! @param rayId        Id of the ray in the mailbox of the thread.
     //! @return             It will return true if there is an intersection, otherwise it returns false.
-    bool traverse( const Ray& r , SurfaceInteraction* intersect , unsigned voxelId , float nextT ) const;
+    template<class Query>
+    bool traverse( const Ray& r , SurfaceInteraction* intersect , unsigned voxelId , float nextT , unsigned rayId ) const;
 
     //! @brief      Get the nearest intersection between a ray and the primitive set.
     //! @param r            The ray to be tested.
@@ -0,0 +1,162 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include "bake.h"
+#include "core/scene.h"
+#include "core/mesh.h"
+#include "core/primitive.h"
+#include "core/globalconfig.h"
+#include "core/log.h"
+#include "imagesensor/imagesensor.h"
+#include "sampler/sample.h"
+#include "shape/shape.h"
+
+// Texture coordinate of a vertex in the image, rows go downwards while v goes upwards.
+static SORT_FORCEINLINE Vector2f texelCoord( const Mesh& mesh , int id ){
+    const auto uv = mesh.GetTexCoord( id );
+    return Vector2f( uv.x * (float)g_resultResollutionWidth , ( 1.0f - uv.y ) * (float)g_resultResollutionHeight );
+}
+
+// Twice the signed area of the triangle of three points.
+static SORT_FORCEINLINE float cross2( const Vector2f& a , const Vector2f& b , const Vector2f& c ){
+    return ( b.x - a.x ) * ( c.y - a.y ) - ( b.y - a.y ) * ( c.x - a.x );
+}
+
+Ray BakeCamera::GenerateRay( float x , float y , const PixelSample& ps ) const{
+    const auto face = m_mesh ? m_texels[(int)y * g_resultResollutionWidth + (int)x] : -1;
+    if( face < 0 )
+        return Ray( Point() , Vector( 0.0f , 1.0f , 0.0f ) , 0 , 0.0f , 0.0f );
+
+    x += ps.img_u;
+    y += ps.img_v;
+
+    // the geometric normal faces the same side as the shading normals, which tells where the outside of the mesh is
+    const auto& index = m_mesh->m_indices[face];
+    const auto& p0 = m_mesh->m_positions[index.m_id[0]];
+    auto n = normalize( cross( m_mesh->m_positions[index.m_id[1]] - p0 , m_mesh->m_positions[index.m_id[2]] - p0 ) );
+    const auto ns = m_mesh->GetVertex( index.m_id[0] ).m_normal + m_mesh->GetVertex( index.m_id[1] ).m_normal + m_mesh->GetVertex( index.m_id[2] ).m_normal;
+    if( dot( n , ns ) < 0.0f )
+        n = -n;
+
+    const auto p = position( face , x , y , true );
+    Ray r( p + n * m_offset , -n );
+
+    // the auxiliary rays hit the surface one texel away, texture lookups are filtered over the footprint of a texel
+    r.m_hasDifferentials = true;
+    r.m_rxOri = position( face , x + 1.0f , y , false ) + n * m_offset;
+    r.m_ryOri = position( face , x , y + 1.0f , false ) + n * m_offset;
+    r.m_rxDir = r.m_ryDir = -n;
+    return r;
+}
+
+Vector2i BakeCamera::GetScreenCoord( const SurfaceInteraction& inter , float* pdfw , float* pdfa , float& cosAtCamera , Spectrum* we ,
+                                     Point* eyeP , Visibility* visibility ) const{
+    if( pdfw )
+        *pdfw = 0.0f;
+    if( pdfa )
+        *pdfa = 0.0f;
+    cosAtCamera = 0.0f;
+    return Vector2i( -1 , -1 );
+}
+
+void BakeCamera::Prepare( const Scene& scene ){
+    // triangles of the same mesh are next to each other in the scene
+    m_mesh = nullptr;
+    const Mesh* last = nullptr;
+    auto mesh_cnt = 0u;
+    for( const auto primitive : scene.GetPrimitives() ){
+        if( primitive->GetShapeType() != SHAPE_TRIANGLE || primitive->GetMesh() == last )
+            continue;
+        last = primitive->GetMesh();
+        if( mesh_cnt++ == m_target ){
+            m_mesh = last;
+            break;
+        }
+    }
+
+    const auto w = (int)g_resultResollutionWidth;
+    const auto h = (int)g_resultResollutionHeight;
+    m_texels.assign( (std::size_t)w * h , -1 );
+    m_coverage = std::make_shared<std::vector<std::uint8_t>>( (std::size_t)w * h , 0 );
+    g_imageSensor->EnableDilation( m_coverage , m_padding );
+
+    if( !m_mesh ){
+        slog( WARNING , CAMERA , "The mesh to bake is not found, nothing is baked." );
+        return;
+    }
+    if( !m_mesh->m_hasUV )
+        slog( WARNING , CAMERA , "The mesh to bake has no UV, the generated ones are used." );
+
+    // a texel belongs to the face covering its center, overlapping UV charts are resolved by the order of faces
+    auto& coverage = *m_coverage;
+    for( auto f = 0 ; f < (int)m_mesh->m_indices.size() ; ++f ){
+        const auto& index = m_mesh->m_indices[f];
+        const auto t0 = texelCoord( *m_mesh , index.m_id[0] );
+        const auto t1 = texelCoord( *m_mesh , index.m_id[1] );
+        const auto t2 = texelCoord( *m_mesh , index.m_id[2] );
+        const auto area = cross2( t0 , t1 , t2 );
+        if( area == 0.0f )
+            continue;
+
+        const auto x0 = std::max( 0 , (int)floor( std::min( { t0.x , t1.x , t2.x } ) ) );
+        const auto x1 = std::min( w - 1 , (int)ceil( std::max( { t0.x , t1.x , t2.x } ) ) );
+        const auto y0 = std::max( 0 , (int)floor( std::min( { t0.y , t1.y , t2.y } ) ) );
+        const auto y1 = std::min( h - 1 , (int)ceil( std::max( { t0.y , t1.y , t2.y } ) ) );
+        for( auto y = y0 ; y <= y1 ; ++y ){
+            for( auto x = x0 ; x <= x1 ; ++x ){
+                const Vector2f c( (float)x + 0.5f , (float)y + 0.5f );
+                const auto b0 = cross2( c , t1 , t2 ) / area;
+                const auto b1 = cross2( t0 , c , t2 ) / area;
+                const auto b2 = 1.0f - b0 - b1;
+                if( b0 < 0.0f || b1 < 0.0f || b2 < 0.0f )
+                    continue;
+                m_texels[y * w + x] = f;
+                coverage[y * w + x] = 1;
+            }
+        }
+    }
+}
+
+Point BakeCamera::position( int face , float x , float y , bool clamp ) const{
+    const auto& index = m_mesh->m_indices[face];
+    const auto t0 = texelCoord( *m_mesh , index.m_id[0] );
+    const auto t1 = texelCoord( *m_mesh , index.m_id[1] );
+    const auto t2 = texelCoord( *m_mesh , index.m_id[2] );
+
+    const Vector2f c( x , y );
+    const auto area = cross2( t0 , t1 , t2 );
+    auto b0 = cross2( c , t1 , t2 ) / area;
+    auto b1 = cross2( t0 , c , t2 ) / area;
+    auto b2 = 1.0f - b0 - b1;
+
+    // jittered points close to the edges of the face could be slightly outside of it
+    if( clamp ){
+        b0 = std::max( 0.0f , b0 );
+        b1 = std::max( 0.0f , b1 );
+        b2 = std::max( 0.0f , b2 );
+        const auto sum = b0 + b1 + b2;
+        b0 /= sum;
+        b1 /= sum;
+        b2 /= sum;
+    }
+
+    const auto& p0 = m_mesh->m_positions[index.m_id[0]];
+    const auto& p1 = m_mesh->m_positions[index.m_id[1]];
+    const auto& p2 = m_mesh->m_positions[index.m_id[2]];
+    return Point( p0.x * b0 + p1.x * b1 + p2.x * b2 , p0.y * b0 + p1.y * b1 + p2.y * b2 , p0.z * b0 + p1.z * b1 + p2.z * b2 );
+}
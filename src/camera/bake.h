@@ -0,0 +1,87 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "camera.h"
+
+class Mesh;
+class Scene;
+
+//! @brief  Camera baking the radiance leaving the surface of a mesh into its texture space.
+/**
+ * Each pixel of the image is a texel of the mesh. UV charts of the mesh are rasterized into the image once the scene is
+ * loaded, a texel covered by a triangle generates a ray hitting the triangle right above its surface against the normal.
+ * The integrator evaluates the radiance leaving the surface at the texel without knowing it is baking, ambient occlusion,
+ * direct light and path tracing all work the same way. Texels are rendered in tiles like any other image.
+ *
+ * Texels not covered by any triangle are filled by dilating the covered ones a few texels outwards in post process, so
+ * that bilinear filtering and mip-mapping don't bleed the background into the edges of UV charts.
+ *
+ * Only triangle meshes with UVs baked in world space could be the target, instanced meshes are not supported. Light
+ * paths can't connect to the camera, integrators splatting radiance don't work with it.
+ */
+class BakeCamera : public Camera{
+public:
+    //! @brief  Generate the ray hitting the surface at a texel.
+    //!
+    //! @param  x       Horizontal coordinate of the texel.
+    //! @param  y       Vertical coordinate of the texel.
+    //! @param  ps      Pixel sample jittering the position inside the texel.
+    //! @return         The ray hitting the surface against the normal, it misses everything if the texel is not covered.
+    Ray GenerateRay( float x , float y , const PixelSample& ps ) const override;
+
+    //! @brief  There is no viewing direction in texture space.
+    Vector GetForward() const override {
+        return Vector( 0.0f , 0.0f , 1.0f );
+    }
+
+    //! @brief  Light paths can't connect to texels, there is no pinhole to go through.
+    Vector2i GetScreenCoord( const SurfaceInteraction& inter , float* pdfw , float* pdfa , float& cosAtCamera , Spectrum* we ,
+                             Point* eyeP , Visibility* visibility ) const override;
+
+    //! @brief  Rasterize the UV charts of the target mesh into the image.
+    //!
+    //! @param  scene   The scene with the target mesh, meshes are in world space already.
+    void Prepare( const Scene& scene ) override;
+
+private:
+    unsigned int    m_target = 0;           /**< Index of the target among triangle meshes in the order they are in the scene. */
+    unsigned int    m_padding = 4;          /**< Number of texels to dilate UV charts by. */
+    float           m_offset = 0.001f;      /**< Distance above the surface where rays start. */
+
+    /**< The target mesh, nullptr if it is not found. */
+    const Mesh*                                     m_mesh = nullptr;
+    /**< Index of the face covering each texel, -1 if no face covers it. */
+    std::vector<int>                                m_texels;
+    /**< Whether each texel is covered by the target mesh, it is shared with the image sensor dilating the image. */
+    std::shared_ptr<std::vector<std::uint8_t>>      m_coverage;
+
+    //! @brief  Position of a point inside a texel on the surface, extrapolated from the face if it is outside.
+    //!
+    //! @param  face    Index of the face.
+    //! @param  x       Horizontal coordinate in the image.
+    //! @param  y       Vertical coordinate in the image.
+    //! @param  clamp   Whether to clamp the point in the face.
+    //! @return         Position of the point in world space.
+    Point   position( int face , float x , float y , bool clamp ) const;
+
+    friend class BakeCameraEntity;
+};
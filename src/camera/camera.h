@@ -22,11 +22,19 @@
 #include "spectrum/spectrum.h"
 #include "math/vector2.h"
 #include "math/matrix.h"
+#include "math/bbox.h"
 
 class PixelSample;
 class Visibility;
 struct SurfaceInteraction;
 
+//! @brief Where a camera looks from and at, views of a multi-view job only differ in it.
+struct CameraView {
+    Point           eye;        /**< Viewing point of the camera. */
+    Point           target;     /**< Viewing target of the camera. */
+    Vector          up;         /**< Up direction of the camera. */
+};
+
 //! @brief Abstract camera
 /**
  * This class serves as an abstract interface for different camera model.
@@ -43,6 +51,13 @@ public:
     //! Camera will do some pre-processing after camera intialization once all properties have been set.
     virtual void PreProcess() {}
 
+    //! @brief Camera setup depending on the scene.
+    //!
+    //! It is called before each frame is rendered, once the scene is loaded and its spatial data structure is built.
+    //!
+    //! @param scene    The scene to be rendered.
+    virtual void Prepare( const class Scene& scene ) {}
+
     //! @brief Generating a primary ray.
     //! @param x    Coordinate along horizontal axis on the image sensor, it could be a float value.
     //! @param y    Coordinate along vertical axis on the image sensor, it could be a float value.
@@ -67,6 +82,55 @@ public:
     virtual Vector2i GetScreenCoord(const SurfaceInteraction& inter, float* pdfw, float* pdfa, float& cosAtCamera , Spectrum* we ,
                                     Point* eyeP , Visibility* visibility) const = 0;
 
+    //! @brief  Whether the camera has a lens with finite aperture.
+    //!
+    //! @return     'True' if points out of the focal plane are blurred.
+    virtual bool HasDepthOfField() const {
+        return false;
+    }
+
+    //! @brief  Size in world space covered by a pixel at the part of a bounding box closest to the camera.
+    //!
+    //! @param  bbox    A bounding box in world space.
+    //! @return         Size of a pixel in world space, 0 if it is unknown or the camera is inside the box.
+    virtual float GetPixelFootprint( const BBox& bbox ) const {
+        return 0.0f;
+    }
+
+    //! @brief  Cone covering all rays generated by the camera.
+    //!
+    //! @param  origin      Where the rays start from.
+    //! @param  dir         Center direction of the cone.
+    //! @param  cosHalfAngle Cosine of the half angle of the cone.
+    //! @return             'False' if the rays don't start from a single point.
+    virtual bool GetRayCone( Point& origin , Vector& dir , float& cosHalfAngle ) const {
+        return false;
+    }
+
+    //! @brief  Radius of the circle of confusion of a point in world space.
+    //!
+    //! @param  p   A point in world space in front of the camera.
+    //! @return     Radius of the blurred spot of the point on the image in pixels, 0 for cameras without a lens.
+    virtual float GetDefocusRadius( const Point& p ) const {
+        return 0.0f;
+    }
+
+    //! @brief  Get where the camera looks from and at.
+    //!
+    //! @param  view    The view of the camera.
+    //! @return         'False' if the camera can't be moved between views.
+    virtual bool GetView( CameraView& view ) const {
+        return false;
+    }
+
+    //! @brief  Move the camera to another view, everything else of the camera stays the same.
+    //!
+    //! @param  view    The new view of the camera.
+    //! @return         'False' if the camera can't be moved between views.
+    virtual bool SetView( const CameraView& view ) {
+        return false;
+    }
+
 protected:
     Point           m_eye;                      /**< Viewing point of the camera. */
     float           m_sensorW = 0.0f;           /**< Image sensor width. */
@@ -30,10 +30,18 @@ Ray EnvironmentCamera::GenerateRay( float x , float y , const PixelSample& ps )
     y += ps.img_v;
 
     // generate ray
-    float theta = PI * y / (float)g_resultResollutionHeight;
-    float phi = 2 * PI * x / (float)g_resultResollutionWidth;
-    Vector dir( sinf( theta ) * cosf( phi ) , cosf( theta ) , sinf( theta ) * sinf( phi ) );
-    Ray r( m_eye , dir );
+    const auto direction = []( float x , float y ){
+        float theta = PI * y / (float)g_resultResollutionHeight;
+        float phi = 2 * PI * x / (float)g_resultResollutionWidth;
+        return Vector( sinf( theta ) * cosf( phi ) , cosf( theta ) , sinf( theta ) * sinf( phi ) );
+    };
+    Ray r( m_eye , direction( x , y ) );
+
+    // the auxiliary rays through the neighbour pixels
+    r.m_hasDifferentials = true;
+    r.m_rxOri = r.m_ryOri = m_eye;
+    r.m_rxDir = direction( x + 1.0f , y );
+    r.m_ryDir = direction( x , y + 1.0f );
 
     // transform the ray
     r = m_transform(r);
@@ -34,7 +34,15 @@ Ray OrthoCamera::GenerateRay( float x, float y, const PixelSample &ps) const{
     const auto ori = world2camera.TransformPoint( Point( x , y , 0.0f ) );
     const auto dir = world2camera.TransformVector( Vector( 0.0f , 0.0f , 1.0f ) );
 
-    return Ray( ori , dir );
+    Ray r( ori , dir );
+
+    // the auxiliary rays are parallel to the ray, offset by one pixel on the image plane
+    r.m_hasDifferentials = true;
+    r.m_rxOri = world2camera.TransformPoint( Point( x + m_camWidth / w , y , 0.0f ) );
+    r.m_ryOri = world2camera.TransformPoint( Point( x , y - m_camHeight / h , 0.0f ) );
+    r.m_rxDir = r.m_ryDir = dir;
+
+    return r;
 }
 
 // set the camera range
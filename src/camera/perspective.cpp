@@ -60,7 +60,8 @@ void PerspectiveCamera::PreProcess()
     m_cameraToRaster = m_clipToRaster * m_cameraToClip;
     m_worldToCamera = ViewLookat( m_eye , m_forward , m_up );
     m_worldToRaster = m_cameraToRaster * m_worldToCamera;
-    m_inverseApartureSize = (m_lensRadius==0)? 1.0f : (1.0f / ( m_lensRadius * m_lensRadius * PI));
+    const auto aperture_area = m_apertureBlades >= 3 ? PolygonArea( m_apertureBlades ) : PI;
+    m_inverseApartureSize = (m_lensRadius==0)? 1.0f : (1.0f / ( m_lensRadius * m_lensRadius * aperture_area));
 }
 
 // generate ray
@@ -71,24 +72,39 @@ Ray PerspectiveCamera::GenerateRay( float x , float y , const PixelSample& ps )
     Ray r;
     r.m_Dir = view_dir.Normalize();
 
+    // directions of the auxiliary rays through the neighbour pixels
+    const Vector view_dir_x = m_cameraToRaster.invMatrix.TransformPoint( rastP + Vector( 1.0f , 0.0f , 0.0f ) );
+    const Vector view_dir_y = m_cameraToRaster.invMatrix.TransformPoint( rastP + Vector( 0.0f , 1.0f , 0.0f ) );
+    r.m_hasDifferentials = true;
+    r.m_rxDir = normalize( view_dir_x );
+    r.m_ryDir = normalize( view_dir_y );
+
     // Handle DOF camera ray adaption
     if( m_lensRadius != 0 )
     {
         Point target = r(m_focalDistance / view_dir.z);
 
+        // the lens sample comes from its own dimensions of the sampler, the mapping keeps their stratification
         float s , t;
-        UniformSampleDisk( ps.dof_u , ps.dof_v , s , t );
+        sampleAperture( ps.dof_u , ps.dof_v , s , t );
 
         r.m_Ori.x = s * m_lensRadius;
         r.m_Ori.y = t * m_lensRadius;
         r.m_Dir = normalize( target - r.m_Ori );
+
+        // the auxiliary rays share the same point on the lens and converge on the focal plane as well
+        const auto target_x = Point() + view_dir_x * ( m_focalDistance / view_dir_x.z );
+        const auto target_y = Point() + view_dir_y * ( m_focalDistance / view_dir_y.z );
+        r.m_rxDir = normalize( target_x - r.m_Ori );
+        r.m_ryDir = normalize( target_y - r.m_Ori );
     }
+    r.m_rxOri = r.m_ryOri = r.m_Ori;
 
     // transform the ray from camera space to world space
-    r = m_worldToCamera.invMatrix( r );
+    const auto forward = cameraToWorld( r , ps.time );
 
     // calculate the pdf for camera ray
-    const float cosAtCamera = dot( m_forward , r.m_Dir );
+    const float cosAtCamera = dot( forward , r.m_Dir );
     const float imagePointToCameraDist = m_imagePlaneDist / cosAtCamera;
     const float imageToSolidAngleFactor = imagePointToCameraDist * imagePointToCameraDist / cosAtCamera;
 
@@ -106,6 +122,76 @@ Ray PerspectiveCamera::GenerateRay( float x , float y , const PixelSample& ps )
     return r;
 }
 
+float PerspectiveCamera::GetDefocusRadius( const Point& p ) const{
+    if( m_lensRadius <= 0.0f )
+        return 0.0f;
+
+    // the spot on the focal plane scaled to pixels on the image plane
+    const auto z = m_worldToCamera.TransformPoint( p ).z;
+    if( z <= 0.0f )
+        return 0.0f;
+    return m_lensRadius * fabs( z - m_focalDistance ) / z * m_imagePlaneDist / m_focalDistance;
+}
+
+float PerspectiveCamera::GetPixelFootprint( const BBox& bbox ) const{
+    if( m_imagePlaneDist <= 0.0f )
+        return 0.0f;
+
+    const auto distance = [&]( const Point& eye ){
+        auto sqr_dist = 0.0f;
+        for( auto i = 0 ; i < 3 ; ++i ){
+            const auto d = std::max( std::max( bbox.m_Min[i] - eye[i] , eye[i] - bbox.m_Max[i] ) , 0.0f );
+            sqr_dist += d * d;
+        }
+        return sqrt( sqr_dist );
+    };
+
+    auto dist = distance( m_eye );
+    for( const auto& key : m_motionKeys )
+        dist = std::min( dist , distance( key.invMatrix.TransformPoint( Point() ) ) );
+
+    // a pixel is exactly one unit on the image plane
+    return dist / m_imagePlaneDist;
+}
+
+void PerspectiveCamera::sampleAperture( float u , float v , float& s , float& t ) const{
+    if( m_apertureBlades >= 3 )
+        UniformSamplePolygon( u , v , m_apertureBlades , m_apertureRotation , s , t );
+    else
+        UniformSampleDisk( u , v , s , t );
+}
+
+Vector PerspectiveCamera::cameraToWorld( Ray& r , float time ) const{
+    r.m_time = time;
+    if( m_motionKeys.size() < 2 ){
+        r = m_worldToCamera.invMatrix( r );
+        return m_forward;
+    }
+
+    // the camera moves along straight lines between two moments, just like moving instances
+    const auto segment_cnt = (unsigned int)m_motionKeys.size() - 1;
+    const auto x = clamp( time , 0.0f , 1.0f ) * segment_cnt;
+    const auto i = std::min( (unsigned int)x , segment_cnt - 1 );
+    const auto t = x - (float)i;
+    const auto& m0 = m_motionKeys[i].invMatrix;
+    const auto& m1 = m_motionKeys[i+1].invMatrix;
+
+    const auto r0 = m0( r );
+    const auto r1 = m1( r );
+    r = r0;
+    r.m_Ori = slerp( r0.m_Ori , r1.m_Ori , t );
+    r.m_Dir = normalize( slerp( r0.m_Dir , r1.m_Dir , t ) );
+    if( r.m_hasDifferentials ){
+        r.m_rxOri = slerp( r0.m_rxOri , r1.m_rxOri , t );
+        r.m_ryOri = slerp( r0.m_ryOri , r1.m_ryOri , t );
+        r.m_rxDir = normalize( slerp( r0.m_rxDir , r1.m_rxDir , t ) );
+        r.m_ryDir = normalize( slerp( r0.m_ryDir , r1.m_ryDir , t ) );
+    }
+
+    const Vector forward( 0.0f , 0.0f , 1.0f );
+    return normalize( slerp( m0.TransformVector( forward ) , m1.TransformVector( forward ) , t ) );
+}
+
 // get camera coordinate according to a view direction in world space
 Vector2i PerspectiveCamera::GetScreenCoord( const SurfaceInteraction& inter, float* pdfw, float* pdfa, float& cosAtCamera , Spectrum* we ,
                                             Point* eyeP , Visibility* visibility) const{
@@ -122,7 +208,7 @@ Vector2i PerspectiveCamera::GetScreenCoord( const SurfaceInteraction& inter, flo
         Point view_target = m_worldToCamera.TransformPoint( inter.intersect );
 
         float s , t;
-        UniformSampleDisk( sort_canonical() , sort_canonical() , s , t );
+        sampleAperture( sort_canonical() , sort_canonical() , s , t );
 
         Ray shadow_ray;
         shadow_ray.m_Ori = Point( s , t , 0.0f ) * m_lensRadius;
@@ -160,3 +246,35 @@ Vector2i PerspectiveCamera::GetScreenCoord( const SurfaceInteraction& inter, flo
 
     return Vector2i( (int)rastP.x , (int)rastP.y );
 }
+
+bool PerspectiveCamera::GetRayCone( Point& origin , Vector& dir , float& cosHalfAngle ) const{
+    if( m_imagePlaneDist <= 0.0f )
+        return false;
+
+    // the corners of the image are the farthest from the center, a pixel is exactly one unit on the image plane
+    const auto w = (float)g_resultResollutionWidth;
+    const auto h = (float)g_resultResollutionHeight;
+    const auto sqr_corner = 0.25f * ( w * w + h * h );
+    origin = m_eye;
+    dir = m_forward;
+    cosHalfAngle = m_imagePlaneDist / sqrt( m_imagePlaneDist * m_imagePlaneDist + sqr_corner );
+    return true;
+}
+
+bool PerspectiveCamera::GetView( CameraView& view ) const{
+    view.eye = m_eye;
+    view.target = m_target;
+    view.up = m_up;
+    return true;
+}
+
+bool PerspectiveCamera::SetView( const CameraView& view ){
+    m_eye = view.eye;
+    m_target = view.target;
+    m_up = view.up;
+
+    // motion keys belong to the view in the scene, the focal distance follows the new target
+    m_motionKeys.clear();
+    PreProcess();
+    return true;
+}
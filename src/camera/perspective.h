@@ -17,6 +17,7 @@
 
 #pragma once
 
+#include <vector>
 #include "camera.h"
 #include "math/transform.h"
 
@@ -24,6 +25,12 @@
 /**
  * This is the most commonly used type of camera. It simulates the way
  * human eye and cameras see things.
+ *
+ * A moving camera generates each ray at the moment of the pixel sample in the shutter interval. Connections from
+ * light paths to the camera always see it where it is in the frame.
+ *
+ * Depth of field follows the thin lens model, the aperture is either round or a regular polygon made of the blades
+ * of the diaphragm, which is what shapes the bokeh of out of focus highlights.
  */
 class   PerspectiveCamera : public Camera
 {
@@ -56,6 +63,49 @@ public:
         return m_forward;
     }
 
+    //! @brief  Whether the camera has a lens with finite aperture.
+    //!
+    //! @return     'True' if points out of the focal plane are blurred.
+    bool HasDepthOfField() const override {
+        return m_lensRadius > 0.0f;
+    }
+
+    //! @brief  Radius of the circle of confusion of a point in world space.
+    //!
+    //! @param  p   A point in world space in front of the camera.
+    //! @return     Radius of the blurred spot of the point on the image in pixels.
+    float GetDefocusRadius( const Point& p ) const override;
+
+    //! @brief  Size in world space covered by a pixel at the part of a bounding box closest to the camera.
+    //!
+    //! A moving camera takes the closest position in the shutter interval.
+    //!
+    //! @param  bbox    A bounding box in world space.
+    //! @return         Size of a pixel in world space, 0 if the camera is inside the box.
+    float GetPixelFootprint( const BBox& bbox ) const override;
+
+    //! @brief  Cone covering all rays generated by the camera.
+    //!
+    //! Rays start from the eye, the lens and the motion of the camera are small enough to be ignored here.
+    //!
+    //! @param  origin      Where the rays start from.
+    //! @param  dir         Center direction of the cone.
+    //! @param  cosHalfAngle Cosine of the half angle of the cone.
+    //! @return             'True' once the camera is pre-processed.
+    bool GetRayCone( Point& origin , Vector& dir , float& cosHalfAngle ) const override;
+
+    //! @brief  Get where the camera looks from and at.
+    //!
+    //! @param  view    The view of the camera.
+    //! @return         'True' since perspective cameras can be moved between views.
+    bool GetView( CameraView& view ) const override;
+
+    //! @brief  Move the camera to another view, it stops moving in the shutter interval if it did.
+    //!
+    //! @param  view    The new view of the camera.
+    //! @return         'True' since perspective cameras can be moved between views.
+    bool SetView( const CameraView& view ) override;
+
 protected:
     Point   m_target;                       /**< Viewing target of the camera. */
     Vector  m_up;                           /**< Up direction of the camera. */
@@ -63,6 +113,8 @@ protected:
 
     float   m_fov = 0.25f;                  /**< Field of view for the camera. */
     float   m_lensRadius = 0.0f;            /**< Radius of the camera lens. */
+    int     m_apertureBlades = 0;           /**< Number of blades of the diaphragm, the aperture is round if there are less than three. */
+    float   m_apertureRotation = 0.0f;      /**< Rotation of the polygonal aperture in radian. */
     float   m_imagePlaneDist = 0.0f;        /**< Distance to the image plane with each pixel equals to exactly one. */
     float   m_focalDistance = 0.0f;         /**< The focal distance for DOF effect. */
     float   m_inverseApartureSize = 0.0f;   /**< Reciprocal of the aperture size. */
@@ -73,5 +125,22 @@ protected:
     Transform   m_worldToCamera;        /**< Transformation from world space to camera space. */
     Transform   m_worldToRaster;        /**< Transformation from world space to screen space. */
 
+    std::vector<Transform>  m_motionKeys;   /**< Transformation from world space to camera space at evenly spaced moments in the shutter interval, empty if the camera doesn't move. */
+
+    //! @brief  Transform a ray from camera space to world space at a moment in the shutter interval.
+    //!
+    //! @param  r       The ray in camera space, it is transformed in place.
+    //! @param  time    The moment in the shutter interval.
+    //! @return         Forward direction of the camera at the moment.
+    Vector  cameraToWorld( Ray& r , float time ) const;
+
+    //! @brief  Sample a point on the aperture of the lens in camera space, the radius of the lens is not applied.
+    //!
+    //! @param  u       A canonical random variable.
+    //! @param  v       A canonical random variable.
+    //! @param  s       X position on the aperture.
+    //! @param  t       Y position on the aperture.
+    void    sampleAperture( float u , float v , float& s , float& t ) const;
+
     friend class PerspectiveCameraEntity;
 };
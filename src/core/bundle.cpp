@@ -0,0 +1,69 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <fstream>
+#include <filesystem>
+#include "bundle.h"
+#include "core/log.h"
+
+// Bump the version once anything cached in the bundle changes its format.
+static constexpr unsigned int BUNDLE_VERSION = 1;
+
+// Name of the manifest in the bundle.
+static constexpr const char* BUNDLE_MANIFEST = "manifest.txt";
+
+std::string BundleFilePath( const std::string& dir , const char* name ){
+    return ( std::filesystem::path( dir ) / name ).string();
+}
+
+bool PrepareBundleDir( const std::string& dir ){
+    std::error_code err;
+    std::filesystem::create_directories( dir , err );
+    std::filesystem::remove( BundleFilePath( dir , BUNDLE_MANIFEST ) , err );
+    return std::filesystem::is_directory( dir , err );
+}
+
+bool WriteBundleManifest( const std::string& dir , std::uint64_t sceneHash ){
+    std::ofstream file( BundleFilePath( dir , BUNDLE_MANIFEST ) );
+    if( !file.is_open() )
+        return false;
+    file << "SORT scene bundle\nversion " << BUNDLE_VERSION << "\nscene " << std::hex << sceneHash << "\n";
+    return (bool)file;
+}
+
+bool CheckBundleManifest( const std::string& dir , std::uint64_t sceneHash ){
+    std::ifstream file( BundleFilePath( dir , BUNDLE_MANIFEST ) );
+    if( !file.is_open() ){
+        slog( WARNING , GENERAL , "There is no scene bundle in %s." , dir.c_str() );
+        return false;
+    }
+
+    std::string line , key;
+    unsigned int version = 0;
+    std::uint64_t hash = 0;
+    std::getline( file , line );
+    file >> key >> version >> key >> std::hex >> hash;
+    if( !file || line != "SORT scene bundle" || version != BUNDLE_VERSION ){
+        slog( WARNING , GENERAL , "The scene bundle in %s is compiled by another version of SORT." , dir.c_str() );
+        return false;
+    }
+    if( hash != sceneHash ){
+        slog( WARNING , GENERAL , "The scene bundle in %s is compiled from another scene." , dir.c_str() );
+        return false;
+    }
+    return true;
+}
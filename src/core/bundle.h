@@ -0,0 +1,61 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+// A scene bundle is a directory holding everything that is preprocessed for a scene file, so that rendering the same
+// scene on other machines, like nodes of a render farm, doesn't repeat the work. It is created by '--compile' and
+// picked up by '--bundle'. The scene file itself is memory mapped already, meshes and textures are read straight from
+// it, the bundle holds what is built from it:
+//  - The spatial acceleration structure.
+//  - The sampling tables of the sky light.
+// A manifest records the version of the bundle and the hash of the scene file, a bundle of another scene or another
+// version of the renderer is ignored as a whole instead of relying on each cache to notice it.
+
+// Names of the caches in a bundle.
+#define BUNDLE_ACCELERATOR_CACHE    "accelerator.cache"
+#define BUNDLE_SKY_CACHE            "sky.cache"
+
+//! @brief  Full path of a file in a scene bundle.
+//!
+//! @param  dir         Directory of the bundle.
+//! @param  name        Name of the file in the bundle.
+//! @return             Full path of the file.
+std::string BundleFilePath( const std::string& dir , const char* name );
+
+//! @brief  Create the directory of a bundle, the manifest of a previous bundle in it is removed.
+//!
+//! @param  dir         Directory of the bundle.
+//! @return             Whether the directory exists.
+bool        PrepareBundleDir( const std::string& dir );
+
+//! @brief  Write the manifest of a bundle, it should be written once everything in the bundle is ready.
+//!
+//! @param  dir         Directory of the bundle.
+//! @param  sceneHash   Hash of the scene file the bundle is compiled from.
+//! @return             Whether the manifest is written.
+bool        WriteBundleManifest( const std::string& dir , std::uint64_t sceneHash );
+
+//! @brief  Check whether a bundle is compiled from a scene file with the current version of the renderer.
+//!
+//! @param  dir         Directory of the bundle.
+//! @param  sceneHash   Hash of the scene file to be rendered.
+//! @return             Whether the bundle could be used.
+bool        CheckBundleManifest( const std::string& dir , std::uint64_t sceneHash );
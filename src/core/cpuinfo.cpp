@@ -0,0 +1,254 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <atomic>
+#include "cpuinfo.h"
+
+#if defined(SORT_IN_LINUX)
+    #include <pthread.h>
+    #include <sched.h>
+    #include <unistd.h>
+    #include <sys/syscall.h>
+#elif defined(SORT_IN_WINDOWS)
+    #include <windows.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    #define SORT_X86_CPU
+    #ifdef SORT_IN_WINDOWS
+        #include <intrin.h>
+    #else
+        #include <cpuid.h>
+    #endif
+#endif
+
+#ifdef SORT_X86_CPU
+namespace {
+    // leaf 1, ecx
+    constexpr unsigned int CPUID_SSE41      = 1u << 19;
+    constexpr unsigned int CPUID_OSXSAVE    = 1u << 27;
+    constexpr unsigned int CPUID_AVX        = 1u << 28;
+    // leaf 7, ebx
+    constexpr unsigned int CPUID_AVX512F    = 1u << 16;
+
+    // states enabled by the operating system in XCR0
+    constexpr unsigned long long XCR0_AVX_STATE     = 0x06;     /**< XMM and YMM registers. */
+    constexpr unsigned long long XCR0_AVX512_STATE  = 0xe6;     /**< Opmask registers and ZMM registers on top of the AVX state. */
+
+    void cpuid( const unsigned int leaf , unsigned int regs[4] ){
+    #ifdef SORT_IN_WINDOWS
+        int r[4];
+        __cpuidex( r , (int)leaf , 0 );
+        for( auto i = 0 ; i < 4 ; ++i )
+            regs[i] = (unsigned int)r[i];
+    #else
+        regs[0] = regs[1] = regs[2] = regs[3] = 0;
+        __cpuid_count( leaf , 0 , regs[0] , regs[1] , regs[2] , regs[3] );
+    #endif
+    }
+
+    unsigned long long xcr0(){
+    #ifdef SORT_IN_WINDOWS
+        return _xgetbv( 0 );
+    #else
+        // the instruction is used directly, the intrinsic needs the whole file to be compiled with xsave support.
+        unsigned int eax = 0 , edx = 0;
+        __asm__ volatile ( "xgetbv" : "=a"(eax) , "=d"(edx) : "c"(0) );
+        return ( (unsigned long long)edx << 32 ) | eax;
+    #endif
+    }
+
+    SIMD_ISA detectSimdIsa(){
+        unsigned int regs[4];
+        cpuid( 0 , regs );
+        const auto max_leaf = regs[0];
+
+        cpuid( 1 , regs );
+        const auto ecx = regs[2];
+        if( !( ecx & CPUID_SSE41 ) )
+            return SIMD_ISA::SCALAR;
+
+        if( !( ecx & CPUID_OSXSAVE ) || !( ecx & CPUID_AVX ) )
+            return SIMD_ISA::SSE;
+        const auto xcr = xcr0();
+        if( ( xcr & XCR0_AVX_STATE ) != XCR0_AVX_STATE )
+            return SIMD_ISA::SSE;
+
+        if( max_leaf < 7 )
+            return SIMD_ISA::AVX;
+        cpuid( 7 , regs );
+        if( !( regs[1] & CPUID_AVX512F ) || ( xcr & XCR0_AVX512_STATE ) != XCR0_AVX512_STATE )
+            return SIMD_ISA::AVX;
+
+        return SIMD_ISA::AVX512;
+    }
+}
+#endif
+
+SIMD_ISA GetSupportedSimdIsa(){
+#ifdef SORT_X86_CPU
+    static const SIMD_ISA isa = detectSimdIsa();
+    return isa;
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    // NEON is mandatory on 64 bits ARM CPUs, it provides the same four-wide operations as SSE4.1.
+    return SIMD_ISA::SSE;
+#else
+    return SIMD_ISA::SCALAR;
+#endif
+}
+
+const char* GetSimdIsaName( const SIMD_ISA isa ){
+    switch( isa ){
+        case SIMD_ISA::SSE:
+#ifdef SORT_X86_CPU
+            return "SSE4.1";
+#else
+            return "NEON";
+#endif
+        case SIMD_ISA::AVX:
+            return "AVX";
+        case SIMD_ISA::AVX512:
+            return "AVX-512";
+        default:
+            return "None";
+    }
+}
+
+namespace {
+    // Logical CPUs of each NUMA node.
+    using NumaTopology = std::vector<std::vector<unsigned int>>;
+
+#if defined(SORT_IN_LINUX)
+    // Parse a list of CPUs like '0-7,16-23' in sysfs.
+    std::vector<unsigned int> parseCpuList( const std::string& list ){
+        std::vector<unsigned int> cpus;
+        std::size_t pos = 0;
+        while( pos < list.size() ){
+            auto end = list.find( ',' , pos );
+            if( end == std::string::npos )
+                end = list.size();
+            const auto range = list.substr( pos , end - pos );
+            const auto dash = range.find( '-' );
+            const auto first = (unsigned int)std::stoul( range.substr( 0 , dash ) );
+            const auto last = dash == std::string::npos ? first : (unsigned int)std::stoul( range.substr( dash + 1 ) );
+            for( auto cpu = first ; cpu <= last ; ++cpu )
+                cpus.push_back( cpu );
+            pos = end + 1;
+        }
+        return cpus;
+    }
+#endif
+
+    NumaTopology detectNumaTopology(){
+        NumaTopology topology;
+#if defined(SORT_IN_LINUX)
+        for( auto node = 0u ; ; ++node ){
+            std::ifstream file( "/sys/devices/system/node/node" + std::to_string( node ) + "/cpulist" );
+            if( !file.is_open() )
+                break;
+            std::string list;
+            std::getline( file , list );
+            try{
+                auto cpus = parseCpuList( list );
+                if( !cpus.empty() )
+                    topology.push_back( std::move( cpus ) );
+            }catch( ... ){
+                // a malformed list is ignored, it is just a node without CPUs
+            }
+        }
+#elif defined(SORT_IN_WINDOWS)
+        ULONG highest = 0;
+        if( GetNumaHighestNodeNumber( &highest ) ){
+            for( auto node = 0u ; node <= highest ; ++node ){
+                ULONGLONG mask = 0;
+                if( !GetNumaNodeProcessorMask( (UCHAR)node , &mask ) || !mask )
+                    continue;
+                std::vector<unsigned int> cpus;
+                for( auto cpu = 0u ; cpu < 64u ; ++cpu ){
+                    if( mask & ( 1ull << cpu ) )
+                        cpus.push_back( cpu );
+                }
+                topology.push_back( std::move( cpus ) );
+            }
+        }
+#endif
+        return topology;
+    }
+
+    const NumaTopology& numaTopology(){
+        static const NumaTopology topology = detectNumaTopology();
+        return topology;
+    }
+
+    std::atomic<bool> g_numaAware = { false };
+}
+
+void SetNumaAware( bool enabled ){
+    g_numaAware = enabled && !numaTopology().empty();
+}
+
+unsigned int GetNumaNodeCnt(){
+    return std::max( 1u , (unsigned int)numaTopology().size() );
+}
+
+unsigned int GetWorkerNumaNode( unsigned int tid ){
+    // workers are spread across nodes in a round robin way, so that any number of workers keeps all nodes busy
+    return g_numaAware ? tid % GetNumaNodeCnt() : 0u;
+}
+
+void PinWorkerThread( unsigned int tid ){
+    if( !g_numaAware )
+        return;
+
+    const auto& topology = numaTopology();
+    const auto& cpus = topology[GetWorkerNumaNode( tid )];
+    const auto cpu = cpus[( tid / (unsigned int)topology.size() ) % cpus.size()];
+#if defined(SORT_IN_LINUX)
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    CPU_SET( cpu , &set );
+    pthread_setaffinity_np( pthread_self() , sizeof( set ) , &set );
+#elif defined(SORT_IN_WINDOWS)
+    SetThreadAffinityMask( GetCurrentThread() , (DWORD_PTR)1 << cpu );
+#endif
+}
+
+void InterleaveMemory( const void* data , std::size_t size ){
+#if defined(SORT_IN_LINUX)
+    const auto node_cnt = GetNumaNodeCnt();
+    if( !g_numaAware || node_cnt < 2 || IS_PTR_INVALID(data) )
+        return;
+
+    // the flags are the ones in numaif.h, the system call is used directly so that there is no dependency on libnuma
+    constexpr int           MPOL_INTERLEAVE_MODE = 3;
+    constexpr unsigned int  MPOL_MF_MOVE_PAGES = 1u << 1;
+
+    const auto page = (std::size_t)sysconf( _SC_PAGESIZE );
+    const auto begin = ( (std::size_t)data + page - 1 ) / page * page;
+    const auto end = ( (std::size_t)data + size ) / page * page;
+    if( begin >= end )
+        return;
+
+    unsigned long mask = 0;
+    for( auto node = 0u ; node < node_cnt && node < sizeof( mask ) * 8 ; ++node )
+        mask |= 1ul << node;
+    syscall( SYS_mbind , (void*)begin , end - begin , MPOL_INTERLEAVE_MODE , &mask , sizeof( mask ) * 8 , MPOL_MF_MOVE_PAGES );
+#endif
+}
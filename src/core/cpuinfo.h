@@ -0,0 +1,81 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include "core/define.h"
+
+//! @brief  SIMD instruction sets SORT has kernels for, from the narrowest to the widest.
+enum class SIMD_ISA : unsigned int {
+    SCALAR = 0,     /**< No SIMD instruction set is available. */
+    SSE,            /**< SSE 4.1, or NEON on ARM, it is what QBVH needs. */
+    AVX,            /**< AVX, it is what OBVH needs. */
+    AVX512,         /**< AVX-512F, it is what HBVH needs. */
+};
+
+//! @brief  Widest SIMD instruction set supported by the CPU running the process.
+//!
+//! Both the CPU and the operating system need to support it, the operating system has to save the wider registers during
+//! context switches. It is only detected once when called the first time, the result never changes afterward.
+//!
+//! @return     The widest supported instruction set.
+SIMD_ISA    GetSupportedSimdIsa();
+
+//! @brief  Human readable name of an instruction set, it is for logging.
+//!
+//! @param  isa     The instruction set.
+//! @return         Name of the instruction set.
+const char* GetSimdIsaName( const SIMD_ISA isa );
+
+//! @brief  Enable or disable NUMA awareness, it is off by default.
+//!
+//! With NUMA awareness, worker threads are pinned to logical CPUs spread evenly across all NUMA nodes. Workers on the same
+//! node steal tasks from each other before stealing from the other nodes and read-only data that every worker touches,
+//! like the spatial acceleration structure, is interleaved across all nodes. It needs to be set before workers start.
+//!
+//! @param  enabled     Whether to enable NUMA awareness.
+void            SetNumaAware( bool enabled );
+
+//! @brief  Number of NUMA nodes of the machine, it is only detected on Linux and Windows, it is 1 everywhere else.
+//!
+//! @return     Number of NUMA nodes.
+unsigned int    GetNumaNodeCnt();
+
+//! @brief  The NUMA node a worker thread is placed on, it is always 0 without NUMA awareness.
+//!
+//! @param  tid     Id of the worker thread, 0 is the main thread.
+//! @return         The NUMA node of the worker thread.
+unsigned int    GetWorkerNumaNode( unsigned int tid );
+
+//! @brief  Pin the calling thread to its logical CPU, it does nothing without NUMA awareness.
+//!
+//! Consecutive workers on the same node get consecutive logical CPUs, so that they share cores and last level caches
+//! before spreading to the rest of the node.
+//!
+//! @param  tid     Id of the worker thread, 0 is the main thread.
+void            PinWorkerThread( unsigned int tid );
+
+//! @brief  Interleave the pages of a chunk of memory across all NUMA nodes, it does nothing without NUMA awareness.
+//!
+//! Data read by all workers ends up on the node of the thread writing it first, interleaving it spreads the traffic
+//! evenly instead of having all nodes read from a single one. Only whole pages inside the chunk are interleaved, it is
+//! only supported on Linux.
+//!
+//! @param  data    The memory to be interleaved.
+//! @param  size    Size of the memory in bytes.
+void            InterleaveMemory( const void* data , std::size_t size );
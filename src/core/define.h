@@ -55,6 +55,14 @@
 
 #define SORT_STATIC_FORCEINLINE     static SORT_FORCEINLINE
 
+// Software prefetch of the cache line holding an address, it is only a hint and never faults.
+#ifdef _MSC_VER
+    #include <xmmintrin.h>
+    #define SORT_PREFETCH(p)        _mm_prefetch( (const char*)(p) , _MM_HINT_T0 )
+#else
+    #define SORT_PREFETCH(p)        __builtin_prefetch( (const void*)(p) , 0 , 3 )
+#endif
+
 #define IS_PTR_INVALID(p)           (nullptr == p)
 #define IS_PTR_VALID(p)             (nullptr != p)
 
@@ -97,8 +105,7 @@
 // This is disabled since it is significantly slower on my 2015 Macbook.
 // #define ENABLE_MULTI_THREAD_SHADER_COMPILATION_CHEAP
 
-// This is a temporary quick solution to enable multi-thread texture loading. It is by no means a very good idea to 
-// parallel a bunch of IO bound threads. However, my newly planned job system is far from being ready yet, I'll live 
-// with it for now. This async loading eventually will be less useful since I'm planning to implement a texture cache
-// system in the future to do lazy texture loading in the future.
+// Resources, like textures and measured BRDFs, are loaded in tasks of the task system. They keep loading while the
+// entities of the scene are being loaded and are only waited for at the end of scene loading. This async loading
+// eventually will be less useful since I'm planning to implement a texture cache system to do lazy texture loading.
 #define ENABLE_ASYNC_TEXTURE_LOADING
\ No newline at end of file
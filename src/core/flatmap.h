@@ -0,0 +1,147 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <utility>
+#include "core/define.h"
+#include "core/strid.h"
+
+//! @brief  Hash table keyed by StringID with open addressing.
+/**
+ * Names of resources, shader units and classes are interned as StringID, the CRC hash is already computed by the time
+ * the table is queried. All slots live in one flat array and collisions are resolved by linear probing, a lookup is
+ * mostly one cache line instead of chasing the node of a bucket as std::unordered_map does.
+ *
+ * Two different strings sharing the same CRC hash are treated as the same key, this is what StringID implies anyway.
+ * Elements can't be erased, none of the tables in the renderer needs it. Pointers to values are invalidated once the
+ * table grows.
+ */
+template<class T>
+class FlatSidMap{
+public:
+    //! @brief  Find the value of a key.
+    //!
+    //! @param  sid     The key to look for.
+    //! @return         Pointer to the value, nullptr if the key is not in the table.
+    T* Find( const StringID sid ){
+        const auto i = locate( sid );
+        return m_slots[i].used ? &m_slots[i].value : nullptr;
+    }
+
+    //! @brief  Find the value of a key.
+    //!
+    //! @param  sid     The key to look for.
+    //! @return         Pointer to the value, nullptr if the key is not in the table.
+    const T* Find( const StringID sid ) const{
+        const auto i = locate( sid );
+        return m_slots[i].used ? &m_slots[i].value : nullptr;
+    }
+
+    //! @brief  Whether a key is in the table.
+    //!
+    //! @param  sid     The key to look for.
+    //! @return         Whether the key is in the table.
+    bool Contains( const StringID sid ) const{
+        return m_slots[locate( sid )].used;
+    }
+
+    //! @brief  Get the value of a key, a default constructed value is inserted if the key is not in the table.
+    //!
+    //! @param  sid     The key of the value.
+    //! @return         Reference to the value.
+    T& operator []( const StringID sid ){
+        // keep the load factor below a half so that probing sequences stay short
+        if( 2 * ( m_size + 1 ) > m_slots.size() )
+            grow();
+
+        auto& slot = m_slots[locate( sid )];
+        if( !slot.used ){
+            slot.used = true;
+            slot.key = sid.m_sid;
+            ++m_size;
+        }
+        return slot.value;
+    }
+
+    //! @brief  Number of keys in the table.
+    //!
+    //! @return         Number of keys in the table.
+    unsigned Size() const{
+        return m_size;
+    }
+
+    //! @brief  Visit all keys and values in the table, in no specific order.
+    //!
+    //! @param  func    The visitor taking a StringID and a reference to the value.
+    template<class F>
+    void ForEach( F&& func ) const{
+        for( const auto& slot : m_slots )
+            if( slot.used )
+                func( StringID( slot.key ) , slot.value );
+    }
+
+    //! @brief  Visit all keys and values in the table, in no specific order.
+    //!
+    //! @param  func    The visitor taking a StringID and a reference to the value, which could be modified.
+    template<class F>
+    void ForEach( F&& func ){
+        for( auto& slot : m_slots )
+            if( slot.used )
+                func( StringID( slot.key ) , slot.value );
+    }
+
+private:
+    //! @brief  A slot in the table.
+    struct Slot{
+        sid_t   key = INVALID_SID;  /**< The key, empty strings end up with INVALID_SID too, 'used' tells empty slots. */
+        bool    used = false;       /**< Whether the slot holds a value. */
+        T       value = T();        /**< The value of the key. */
+    };
+
+    /**< All slots in the table, the size is always a power of two. */
+    std::vector<Slot>   m_slots = std::vector<Slot>( FLAT_SID_MAP_INIT_SIZE );
+    /**< Number of keys in the table. */
+    unsigned            m_size = 0;
+
+    static constexpr unsigned FLAT_SID_MAP_INIT_SIZE = 16;
+
+    //! @brief  Find the slot of a key, or the empty slot where the key would be inserted.
+    unsigned locate( const StringID sid ) const{
+        // CRC is not great at spreading similar strings in the low bits, Fibonacci hashing mixes all bits in.
+        const auto mask = (unsigned)m_slots.size() - 1;
+        auto i = (unsigned)( ( sid.m_sid * 2654435769u ) >> 7 ) & mask;
+        while( m_slots[i].used && m_slots[i].key != sid.m_sid )
+            i = ( i + 1 ) & mask;
+        return i;
+    }
+
+    //! @brief  Double the number of slots and insert all keys again.
+    void grow(){
+        std::vector<Slot> slots( m_slots.size() * 2 );
+        std::swap( slots , m_slots );
+        for( auto& slot : slots ){
+            if( !slot.used )
+                continue;
+            auto& dst = m_slots[locate( StringID( slot.key ) )];
+            dst.used = true;
+            dst.key = slot.key;
+            dst.value = std::move( slot.value );
+        }
+    }
+};
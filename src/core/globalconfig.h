@@ -18,18 +18,44 @@
 #pragma once
 
 #include <string.h>
+#include <stdlib.h>
 #include <regex>
+#include <algorithm>
+#include <cmath>
+#include <climits>
+#include <cstdio>
 #include "core/log.h"
 #include "stream/stream.h"
 #include "core/singleton.h"
+#include "core/memory.h"
+#include "core/bundle.h"
 #include "accel/accelerator.h"
+#include "accel/offload.h"
 #include "integrator/integrator.h"
 #include "core/rtti.h"
 #include "imagesensor/blenderimage.h"
 #include "imagesensor/rendertargetimage.h"
+#include "imagesensor/remoteimage.h"
+#include "imagesensor/bucketimage.h"
 
 //! @brief  This needs to be update every time the content of GlobalConfiguration changes.
-constexpr unsigned int GLOBAL_CONFIGURATION_VERSION = 0;
+constexpr unsigned int GLOBAL_CONFIGURATION_VERSION = 4;
+
+//! @brief  Order of pixels and samples traced in a tile.
+enum class PixelOrder{
+    Scanline,       /**< Pixels are traced row by row, all samples of a pixel are taken back-to-back. */
+    Morton,         /**< Pixels are traced along a Morton curve, all samples of a pixel are taken back-to-back. */
+    Interleaved,    /**< Pixels are traced along a Morton curve, one sample of each pixel at a time. */
+};
+
+//! @brief  Number of tiles each thread takes on average when the tile size is picked automatically.
+constexpr unsigned int AUTO_TILE_PER_THREAD = 8;
+
+//! @brief  Number of buckets of robust accumulation if it is enabled without a count.
+constexpr unsigned int ROBUST_DEFAULT_BUCKET_CNT = 8;
+
+//! @brief  Number of I/O workers on top of the compute workers by default.
+constexpr unsigned int IO_DEFAULT_THREAD_CNT = 4;
 
 //! @brief  GlobalConfiguration saves some global state.
 class GlobalConfiguration : public Singleton<GlobalConfiguration> , SerializableObject {
@@ -41,6 +67,13 @@ public:
         return m_tileSize;
     }
 
+    //! @brief  Whether running tiles could hand part of their rows to idle workers.
+    //!
+    //! @return     Whether tile splitting is enabled.
+    bool            GetTileSplitting() const {
+        return m_tileSplitting;
+    }
+
     //! @brief  Whether SORT is ran in Blender mode.
     //!
     //! Blender mode will stream the result directly to shared memory through IPC.
@@ -48,6 +81,40 @@ public:
         return m_blenderMode;
     }
 
+    //! @brief  Whether SORT is ran in server mode.
+    //!
+    //! In server mode, the scene stays resident after rendering a frame. Updates of the scene keep coming from the
+    //! input stream and a new frame is rendered whenever it is requested.
+    bool            GetServerMode() const {
+        return m_serverMode;
+    }
+
+    //! @brief  Port to listen to for workers of distributed rendering.
+    //!
+    //! A non-zero port makes SORT a coordinator, it hands out tiles to workers instead of rendering them itself.
+    unsigned int    GetCoordinatorPort() const {
+        return m_coordinatorPort;
+    }
+
+    //! @brief  Port serving live telemetry as JSON through HTTP.
+    //!
+    //! 0 means there is no HTTP endpoint, Blender still gets telemetry through the shared memory.
+    unsigned int    GetTelemetryPort() const {
+        return m_telemetryPort;
+    }
+
+    //! @brief  Address of the coordinator in the form of 'host:port'.
+    //!
+    //! A non-empty address makes SORT a worker of distributed rendering, the scene file comes from the coordinator.
+    const std::string& GetCoordinatorAddress() const {
+        return m_coordinatorAddress;
+    }
+
+    //! @brief  Time in seconds before a worker not responding is considered dead.
+    float           GetWorkerTimeOut() const {
+        return m_workerTimeOut;
+    }
+
     //! @brief  Whether SORT is in unit test mode.
     //!
     //! @return     Whether the current running instance is in unit test mode.
@@ -94,6 +161,16 @@ public:
         return m_threadCnt;
     }
 
+    //! @brief      Get the number of I/O worker threads.
+    //!
+    //! They are spawned on top of the worker threads and only execute tasks blocked on disk or network, like loading
+    //! resources. Zero leaves I/O tasks to the worker threads.
+    //!
+    //! @return     Number of I/O worker threads.
+    unsigned int                    GetIOThreadCnt() const {
+        return m_ioThreadCnt;
+    }
+
     //! @brief      Get sampler per pixel.
     //!
     //! @return     Number of sample per pixel.
@@ -122,6 +199,25 @@ public:
         return Vector2i( m_resWidth , m_resHeight );
     }
 
+    //! @brief      Get the region of the image to be rendered, pixels out of it are not rendered at all.
+    //!
+    //! Radiance splatted from light paths lands anywhere in the image, integrators splatting radiance always render
+    //! the whole image.
+    //!
+    //! @param      rmin    Top-left corner of the region, inclusive.
+    //! @param      rmax    Bottom-right corner of the region, exclusive.
+    //! @return     Whether only a part of the image is rendered, the region covers the whole image otherwise.
+    bool                            GetRenderRegion( Vector2i& rmin , Vector2i& rmax ) const {
+        rmin = Vector2i( std::max( 0 , m_regionMin.x ) , std::max( 0 , m_regionMin.y ) );
+        rmax = Vector2i( std::min( (int)m_resWidth , m_regionMax.x ) , std::min( (int)m_resHeight , m_regionMax.y ) );
+        const auto splatting = IS_PTR_VALID(m_integrator) && m_integrator->NeedSplatting();
+        if( !splatting && rmin.x < rmax.x && rmin.y < rmax.y && ( rmin.x > 0 || rmin.y > 0 || rmax.x < (int)m_resWidth || rmax.y < (int)m_resHeight ) )
+            return true;
+        rmin = Vector2i( 0 , 0 );
+        rmax = Vector2i( m_resWidth , m_resHeight );
+        return false;
+    }
+
     //! @brief      Get full path to the input file.
     //!
     //! @return     Full path to the input file.
@@ -129,6 +225,88 @@ public:
         return m_inputFile;
     }
 
+    //! @brief      Get full path to the cache file of the spatial acceleration structure.
+    //!
+    //! The spatial acceleration structure is loaded from the cache file instead of being built if the geometry and the
+    //! configuration of it match the cached ones. The cache file is updated otherwise. Empty path disables caching.
+    //!
+    //! @return     Full path to the cache file of the spatial acceleration structure.
+    const std::string&              GetAcceleratorCacheFilePath() const{
+        return m_acceleratorCacheFile;
+    }
+
+    //! @brief      Get full path to the cache file of the sampling tables of the sky light.
+    //!
+    //! The sampling tables of the sky are loaded from the cache file if it is generated from the same image. The cache
+    //! file is updated otherwise. Empty path disables caching.
+    //!
+    //! @return     Full path to the cache file of the sampling tables of the sky light.
+    const std::string&              GetSkyCacheFilePath() const{
+        return m_skyCacheFile;
+    }
+
+    //! @brief      Get the directory of read-only data shared by all processes on the same machine.
+    //!
+    //! Data like decoded textures is published in the directory by the first process loading it, other processes map
+    //! it instead of keeping a copy of their own. A directory on tmpfs, like '/dev/shm', is preferred. Empty path
+    //! disables sharing.
+    //!
+    //! @return     Directory of the shared data.
+    const std::string&              GetSharedCacheDir() const{
+        return m_sharedCacheDir;
+    }
+
+    //! @brief      Get the directory where structures learned during rendering are kept for the next rendering.
+    //!
+    //! Structures like the path guiding tree and the radiance cache are saved once rendering is done, and the next
+    //! rendering of the same scene starts with them instead of learning everything from scratch. Empty path disables it.
+    //!
+    //! @return     Directory of the learned structures.
+    const std::string&              GetWarmStartDir() const{
+        return m_warmStartDir;
+    }
+
+    //! @brief      Get how much the learned structures are trusted less each time they are carried over.
+    //!
+    //! @return     Fraction of the trust that is left after a structure is carried over.
+    float                           GetWarmStartDecay() const{
+        return m_warmStartDecay;
+    }
+
+    //! @brief      Get the directory of the scene bundle, empty means there is no bundle.
+    //!
+    //! Caches not specified explicitly go to the bundle.
+    //!
+    //! @return     Directory of the scene bundle.
+    const std::string&              GetBundleDir() const{
+        return m_bundleDir;
+    }
+
+    //! @brief      Whether the scene is only compiled into the bundle without being rendered.
+    bool                            GetCompileBundle() const{
+        return m_compileBundle;
+    }
+
+    //! @brief      Stop using the scene bundle, caches in the bundle are neither read nor written.
+    //!
+    //! This is for bundles compiled from other scenes, or by other versions of the renderer.
+    void                            DiscardBundle(){
+        if( m_bundleDir.empty() )
+            return;
+        if( m_acceleratorCacheFile == BundleFilePath( m_bundleDir , BUNDLE_ACCELERATOR_CACHE ) )
+            m_acceleratorCacheFile.clear();
+        if( m_skyCacheFile == BundleFilePath( m_bundleDir , BUNDLE_SKY_CACHE ) )
+            m_skyCacheFile.clear();
+        m_bundleDir.clear();
+    }
+
+    //! @brief      Change the name of the output file, each view of a multi-view job is saved in a file of its own.
+    //!
+    //! @param      name        Name of the output file.
+    void                            SetOutputFileName( const std::string& name ){
+        m_outputFile = name;
+    }
+
     //! @brief      Get image sensor.
     //!
     //! @return     Image sensor.
@@ -143,6 +321,208 @@ public:
         return m_noMaterialSupport;
     }
 
+    //! @brief      Whether the transparency of cut-out materials is baked in binary alpha masks.
+    //!
+    //! @return     'True' if rays pass through cut-outs by their alpha masks without executing any shader.
+    bool            GetAlphaMask() const{
+        return m_alphaMask;
+    }
+
+    //! @brief      Whether coated surfaces evaluate one of their layers picked randomly instead of all of them.
+    //!
+    //! @return     'True' if layers of coated surfaces are evaluated stochastically.
+    bool            GetStochasticCoat() const{
+        return m_stochasticCoat;
+    }
+
+    //! @brief      Whether subsurface scattering walks through the interior of objects instead of taking the diffusion profile.
+    //!
+    //! @return     'True' if subsurface scattering is traced by random walks.
+    bool            GetRandomWalkSSS() const{
+        return m_randomWalkSSS;
+    }
+
+    //! @brief      Whether shading attributes of meshes are kept in the compact format.
+    //!
+    //! @return     'True' if meshes are compacted after they are loaded.
+    bool            GetCompactMesh() const{
+        return m_compactMesh;
+    }
+
+    //! @brief      Whether meshes are cleaned up and reordered along a Morton curve once they are loaded.
+    //!
+    //! @return     'True' if degenerate triangles are dropped, identical vertices are welded and meshes are reordered.
+    bool            GetCleanMesh() const{
+        return m_cleanMesh;
+    }
+
+    //! @brief      Whether textures in shaders fetch a single texel picked by its filter weight instead of filtering.
+    //!
+    //! @return     'True' if texture lookups are filtered stochastically across samples.
+    bool            GetStochasticTexture() const{
+        return m_stochasticTexture;
+    }
+
+    //! @brief      Whether frames are recorded so that edits of lights could be applied without rendering again.
+    //!
+    //! @return     'True' if the radiance of each pixel is kept split by lights in server mode.
+    bool            GetRelight() const{
+        return m_relight;
+    }
+
+    //! @brief      Error in pixels allowed when meshes far away from the camera are simplified.
+    //!
+    //! @return     The error in pixels, meshes are never simplified if it is zero.
+    float           GetLodError() const{
+        return m_lodError;
+    }
+
+    //! @brief      Whether identical meshes are shared as instances of one mesh.
+    //!
+    //! @return     'True' if identical meshes are deduplicated.
+    bool            GetDedupMesh() const{
+        return m_dedupMesh;
+    }
+
+    //! @brief      Whether the BVH of the whole scene is built with the linear builder.
+    //!
+    //! @return     'True' if the top level BVH is built by sorting primitives along a Morton curve.
+    bool            GetLinearBvhScene() const{
+        return m_linearBvhScene;
+    }
+
+    //! @brief      Whether BVHs of instanced meshes are built with the linear builder.
+    //!
+    //! @return     'True' if BVHs of instanced meshes are built by sorting primitives along a Morton curve.
+    bool            GetLinearBvhObjects() const{
+        return m_linearBvhObjects;
+    }
+
+    //! @brief      Whether the BVH of the whole scene is collapsed from an optimized binary BVH.
+    //!
+    //! @return     'True' if QBVH/OBVH nodes minimize SAH cost at the price of a slower construction.
+    bool            GetOptimizedBvh() const{
+        return m_optimizedBvh;
+    }
+
+    //! @brief      Weight of camera rays in the cost model of the BVH of the whole scene.
+    //!
+    //! SAH assumes rays coming from everywhere. With a positive weight, nodes out of view are cheaper than their surface
+    //! areas suggest, the hierarchy is refined where camera rays and shadow rays of their first hits are traced.
+    //!
+    //! @return     Weight of camera rays relative to uniformly distributed rays, zero means plain SAH.
+    float           GetCameraSah() const{
+        return m_cameraSah;
+    }
+
+    //! @brief      Whether tiles are streamed to a tiled exr file as soon as they are rendered.
+    //!
+    //! No buffer covering the whole image is allocated then, it is meant for images too large to fit in memory.
+    //!
+    //! @return     'True' if tiles are streamed to the file.
+    bool            GetBucketOutput() const{
+        return m_bucketOutput;
+    }
+
+    //! @brief      Memory budget of the tessellations of subdivision surfaces.
+    //!
+    //! @return     The budget in mega bytes.
+    unsigned int    GetSubdivisionCacheSize() const{
+        return m_subdivisionCacheSize;
+    }
+
+    //! @brief      Memory budget of the vertices and the BVH of instanced meshes, the rest of them are paged out.
+    //!
+    //! @return     The budget in mega bytes, 0 means all of them stay in memory.
+    unsigned int    GetGeometryBudget() const{
+        return m_geometryBudget;
+    }
+
+    //! @brief      Memory budget of image textures, textures are loaded at lower resolutions once it runs out.
+    //!
+    //! @return     The budget in mega bytes, 0 means unlimited.
+    unsigned int    GetTextureBudget() const{
+        return m_textureBudget;
+    }
+
+    //! @brief      Whether image textures of 8 bits per channel are kept in compressed blocks.
+    //!
+    //! @return     Whether texture compression is enabled.
+    bool            GetTextureCompression() const{
+        return m_textureCompression;
+    }
+
+    //! @brief      Memory budget of spatial acceleration structures, nodes are compressed once it runs out.
+    //!
+    //! @return     The budget in mega bytes, 0 means unlimited.
+    unsigned int    GetAcceleratorBudget() const{
+        return m_acceleratorBudget;
+    }
+
+    //! @brief      Whether to place worker threads and shared data across NUMA nodes.
+    //!
+    //! @return     Whether NUMA awareness is enabled.
+    bool            GetNumaAware() const{
+        return m_numaAware;
+    }
+
+    //! @brief      Whether the cost of tiles is estimated in a prepass to decide the order of rendering them.
+    //!
+    //! @return     Whether the cost prepass is enabled.
+    bool            GetCostPrepass() const{
+        return m_costPrepass;
+    }
+
+    //! @brief      Whether secondary bounces of camera ray packets are traced in sorted batches.
+    //!
+    //! @return     Whether deferred bounces are enabled.
+    bool            GetDeferredBounces() const{
+        return m_deferredBounces;
+    }
+
+    //! @brief      Whether batches of secondary rays are traced interleaved instead of as packets.
+    //!
+    //! @return     Whether interleaved traversal is enabled.
+    bool            GetInterleavedTraversal() const{
+        return m_interleavedTraversal;
+    }
+
+    //! @brief      Whether to trade accuracy for speed, it is meant for previews.
+    //!
+    //! Path tracing takes indirect illumination on diffuse surfaces from a radiance cache after the first bounce, shadow
+    //! rays after the first bounce could also be answered by a coarse occlusion grid.
+    //!
+    //! @return     Whether preview quality is enabled.
+    bool            GetPreviewQuality() const{
+        return m_previewQuality;
+    }
+
+    //! @brief      Whether to render coarse passes of the image before the first full pass, it is meant for previews.
+    //!
+    //! Pixels are traced at 1/8, 1/4 and 1/2 of the resolution first, samples taken by them are kept by the image.
+    //!
+    //! @return     Whether the resolution pyramid is enabled.
+    bool            GetResolutionPyramid() const{
+        return m_resolutionPyramid;
+    }
+
+    //! @brief      Order of pixels and samples traced in a tile.
+    //!
+    //! Consecutive camera rays along a Morton curve stay close to each other, nodes of the acceleration structure and
+    //! texels fetched by one of them are likely still in the cache for the next one.
+    //!
+    //! @return     The order of pixels in a tile.
+    PixelOrder      GetPixelOrder() const{
+        return m_pixelOrder;
+    }
+
+    //! @brief      How large read-mostly structures are placed on huge pages.
+    //!
+    //! @return     The huge page policy.
+    HugePagePolicy  GetHugePagePolicy() const{
+        return m_hugePagePolicy;
+    }
+
     //! @brief      Get clampping of radiance value.
     //!
     //! Before there is a better firefly cancelling solution, clampping is the easy low hanging fruit.
@@ -153,6 +533,153 @@ public:
         return m_clampping;
     }
 
+    //! @brief      Whether progressive rendering is enabled.
+    //!
+    //! Instead of rendering all samples of a tile at once, progressive rendering renders the whole image in multiple
+    //! passes with a few samples in each pass. It gives a full-frame preview much earlier.
+    //!
+    //! @return     'True' if progressive rendering is enabled.
+    bool            GetProgressive() const{
+        return m_progressive;
+    }
+
+    //! @brief      Get the number of samples per pixel in each pass of progressive rendering.
+    //!
+    //! @return     Number of samples per pixel in each pass.
+    unsigned int    GetSamplePerPass() const{
+        return m_progressive ? std::max( 1u , std::min( m_samplePerPass , m_samplePerPixel ) ) : m_samplePerPixel;
+    }
+
+    //! @brief      Get the wall clock budget of rendering in seconds.
+    //!
+    //! Once the budget is exhausted, no more pass will be issued in progressive rendering. The pass being rendered
+    //! will still be finished so that there is no tile left with less samples than the others in the same pass.
+    //! It has no effect if progressive rendering is disabled. Budget of 0 means there is no time limitation.
+    //!
+    //! @return     Rendering budget in seconds.
+    float           GetTimeBudget() const{
+        return m_timeBudget;
+    }
+
+    //! @brief      Whether adaptive sampling is enabled.
+    //!
+    //! With adaptive sampling, a pixel stops taking samples once the relative standard error of its luminance drops
+    //! below the noise threshold. Sample per pixel is the maximum number of samples a pixel could take in this case.
+    //!
+    //! @return     'True' if adaptive sampling is enabled.
+    bool            GetAdaptiveSampling() const{
+        return m_adaptiveSampling;
+    }
+
+    //! @brief      Get the minimum number of samples per pixel before a pixel could be considered converged.
+    //!
+    //! @return     Minimum number of samples per pixel in adaptive sampling.
+    unsigned int    GetMinSamplePerPixel() const{
+        return std::max( 2u , std::min( m_minSamplePerPixel , m_samplePerPixel ) );
+    }
+
+    //! @brief      Get the noise threshold of adaptive sampling.
+    //!
+    //! @return     Relative standard error below which a pixel is considered converged.
+    float           GetNoiseThreshold() const{
+        return m_noiseThreshold;
+    }
+
+    //! @brief      Get the type of sampler drawing samples of each pixel.
+    //!
+    //! @return     Name of the sampler class.
+    StringID        GetSamplerType() const{
+        return m_samplerType;
+    }
+
+    //! @brief      Whether each thread splats radiance into its own replica of the image.
+    //!
+    //! This only matters for integrators splatting radiance to arbitrary pixels, like light tracing. Splatting into
+    //! per-thread replicas avoids contention on hot pixels at the cost of extra memory.
+    //!
+    //! @return     'True' if per-thread splat film is enabled.
+    bool            GetSplatFilm() const{
+        return m_splatFilm;
+    }
+
+    //! @brief      Get the AOVs rendered along with the beauty image.
+    //!
+    //! All AOVs come from the same camera rays as the beauty image, they are written as layers of one exr file.
+    //!
+    //! @return     A mask with a bit set for each AOV to be written, 0 means there is no AOV.
+    unsigned int    GetAovMask() const{
+        return m_aovMask;
+    }
+
+    //! @brief      Get the class name of the denoiser applied in post process.
+    //!
+    //! @return     Class name of the denoiser, empty means there is no denoising.
+    const std::string&  GetDenoiserType() const{
+        return m_denoiserType;
+    }
+
+    //! @brief      Get the number of buckets the samples of each pixel are split into by robust accumulation.
+    //!
+    //! Each pixel takes the median of the means of its buckets, fireflies are rejected without clamping the radiance.
+    //!
+    //! @return     Number of buckets, 0 means samples are averaged in each pixel.
+    unsigned int    GetRobustBucketCnt() const{
+        return m_robustBucketCnt;
+    }
+
+    //! @brief      Get the class name of the filter weighting samples in the pixels around them.
+    //!
+    //! @return     Class name of the pixel filter, empty means samples are averaged in each pixel.
+    const std::string&  GetPixelFilterType() const{
+        return m_pixelFilterType;
+    }
+
+    //! @brief      Get full path to the checkpoint file.
+    //!
+    //! The image being rendered is saved in the checkpoint file periodically, empty path disables checkpoints.
+    //!
+    //! @return     Full path to the checkpoint file.
+    const std::string&  GetCheckpointFilePath() const{
+        return m_checkpointFile;
+    }
+
+    //! @brief      Get the interval between two checkpoints in seconds.
+    float           GetCheckpointInterval() const{
+        return m_checkpointInterval;
+    }
+
+    //! @brief      Whether rendering resumes from the checkpoint file.
+    //!
+    //! Rendering starts from scratch if the checkpoint file doesn't exist or doesn't match the scene.
+    bool            GetResume() const{
+        return m_resume;
+    }
+
+    //! @brief      Get the full path of the JSON file stats are exported to, empty means stats are only printed.
+    const std::string& GetStatsFilePath() const{
+        return m_statsFile;
+    }
+
+    //! @brief      Get the full path of the Chrome trace file the timeline of tasks is exported to, empty means no timeline.
+    const std::string& GetTraceFilePath() const{
+        return m_traceFile;
+    }
+
+    //! @brief      Get the full path of the file listing the views of a multi-view job, empty means there is no such file.
+    const std::string& GetViewsFilePath() const{
+        return m_viewsFile;
+    }
+
+    //! @brief      Get the number of frames of a turntable around the target of the camera, 0 means there is no turntable.
+    unsigned int    GetTurntableFrames() const{
+        return m_turntableFrames;
+    }
+
+    //! @brief      Whether several views of the scene are rendered in one job, sharing everything but the camera.
+    bool            IsMultiView() const{
+        return !m_viewsFile.empty() || m_turntableFrames > 0;
+    }
+
     //! @brief      Parse command line.
     //!
     //! This is not a perfect way to parse command line arguments. If there is a space in the path,
@@ -189,6 +716,17 @@ public:
                 com_arg_valid = true;
             }else if (key_str == "blendermode"){
                 m_blenderMode = true;
+            }else if (key_str == "server"){
+                m_serverMode = true;
+            }else if (key_str == "coordinator"){
+                m_coordinatorPort = (unsigned int)atoi( value_str.c_str() );
+            }else if (key_str == "telemetry"){
+                m_telemetryPort = (unsigned int)atoi( value_str.c_str() );
+            }else if (key_str == "worker"){
+                m_coordinatorAddress = value_str;
+                com_arg_valid = true;
+            }else if (key_str == "workertimeout"){
+                m_workerTimeOut = std::max( 1.0f , (float)atof( value_str.c_str() ) );
             }else if (key_str == "unittest") {
                 m_unitTestMode = true;
                 com_arg_valid = true;
@@ -196,9 +734,141 @@ public:
                 m_profilingEnalbed = value_str == "on";
             }else if (key_str == "nomaterial" ){
                 m_noMaterialSupport = true;
+            }else if (key_str == "alphamask" ){
+                m_alphaMask = true;
+            }else if (key_str == "stochasticcoat" ){
+                m_stochasticCoat = true;
+            }else if (key_str == "randomwalksss" ){
+                m_randomWalkSSS = true;
+            }else if (key_str == "compactmesh" ){
+                m_compactMesh = true;
+            }else if (key_str == "cleanmesh" ){
+                m_cleanMesh = true;
+            }else if (key_str == "stochastictexture" ){
+                m_stochasticTexture = true;
+            }else if (key_str == "relight" ){
+                m_relight = true;
+            }else if (key_str == "dedupmesh" ){
+                m_dedupMesh = true;
+            }else if (key_str == "lbvh" ){
+                // the top level BVH, the ones of instanced meshes, or both if nothing is specified
+                m_linearBvhScene = value_str != "objects";
+                m_linearBvhObjects = value_str != "scene";
+            }else if (key_str == "optbvh" ){
+                m_optimizedBvh = true;
+            }else if (key_str == "camerasah" ){
+                m_cameraSah = std::max( 0.0f , (float)atof( value_str.c_str() ) );
+            }else if (key_str == "bucket" ){
+                m_bucketOutput = true;
+            }else if (key_str == "lod" ){
+                m_lodError = std::max( 0.0f , (float)atof( value_str.c_str() ) );
+            }else if (key_str == "subdcache" ){
+                m_subdivisionCacheSize = (unsigned int)std::max( 1 , atoi( value_str.c_str() ) );
+            }else if (key_str == "geometrybudget" ){
+                m_geometryBudget = (unsigned int)std::max( 0 , atoi( value_str.c_str() ) );
+            }else if (key_str == "texturebudget" ){
+                m_textureBudget = (unsigned int)std::max( 0 , atoi( value_str.c_str() ) );
+            }else if (key_str == "texturecompression" ){
+                m_textureCompression = true;
+            }else if (key_str == "accelbudget" ){
+                m_acceleratorBudget = (unsigned int)std::max( 0 , atoi( value_str.c_str() ) );
+            }else if (key_str == "numa" ){
+                m_numaAware = true;
+            }else if (key_str == "costprepass" ){
+                m_costPrepass = true;
+            }else if (key_str == "deferredbounces" ){
+                m_deferredBounces = true;
+            }else if (key_str == "interleaved" ){
+                m_interleavedTraversal = true;
+            }else if (key_str == "preview" ){
+                m_previewQuality = true;
+            }else if (key_str == "pyramid" ){
+                m_resolutionPyramid = true;
+            }else if (key_str == "region" ){
+                int x0 = 0 , y0 = 0 , x1 = 0 , y1 = 0;
+                if( sscanf( value_str.c_str() , "%d,%d,%d,%d" , &x0 , &y0 , &x1 , &y1 ) == 4 ){
+                    m_regionMin = Vector2i( x0 , y0 );
+                    m_regionMax = Vector2i( x1 , y1 );
+                }
+            }else if (key_str == "pixelorder" ){
+                if( value_str == "morton" )
+                    m_pixelOrder = PixelOrder::Morton;
+                else if( value_str == "interleaved" )
+                    m_pixelOrder = PixelOrder::Interleaved;
+                else
+                    m_pixelOrder = PixelOrder::Scanline;
+            }else if (key_str == "hugepages" ){
+                if( value_str == "off" )
+                    m_hugePagePolicy = HugePagePolicy::Off;
+                else if( value_str == "explicit" )
+                    m_hugePagePolicy = HugePagePolicy::Explicit;
+                else
+                    m_hugePagePolicy = HugePagePolicy::Transparent;
+            }else if (key_str == "accelcache" ){
+                m_acceleratorCacheFile = value_str;
+            }else if (key_str == "skycache" ){
+                m_skyCacheFile = value_str;
+            }else if (key_str == "sharedcache" ){
+                m_sharedCacheDir = value_str;
+            }else if (key_str == "warmstart" ){
+                m_warmStartDir = value_str;
+            }else if (key_str == "warmdecay" ){
+                m_warmStartDecay = std::min( 1.0f , std::max( 0.0f , (float)atof( value_str.c_str() ) ) );
+            }else if (key_str == "aov" ){
+                m_aovMask = ParseAovMask( value_str );
+            }else if (key_str == "checkpoint" ){
+                m_checkpointFile = value_str;
+            }else if (key_str == "checkpointinterval" ){
+                m_checkpointInterval = std::max( 1.0f , (float)atof( value_str.c_str() ) );
+            }else if (key_str == "resume" ){
+                m_resume = true;
+            }else if (key_str == "stats" ){
+                m_statsFile = value_str;
+            }else if (key_str == "trace" ){
+                m_traceFile = value_str;
+            }else if (key_str == "views" ){
+                m_viewsFile = value_str;
+            }else if (key_str == "turntable" ){
+                m_turntableFrames = (unsigned int)std::max( 0 , atoi( value_str.c_str() ) );
+            }else if (key_str == "denoiser" ){
+                m_denoiserType = value_str.empty() ? "BilateralDenoiser" : value_str;
+            }else if (key_str == "pixelfilter" ){
+                m_pixelFilterType = value_str.empty() ? "GaussianFilter" : value_str;
+            }else if (key_str == "robust" ){
+                m_robustBucketCnt = value_str.empty() ? ROBUST_DEFAULT_BUCKET_CNT : (unsigned int)std::max( 0 , atoi( value_str.c_str() ) );
+            }else if (key_str == "threads" ){
+                m_threadCntOverride = (unsigned int)std::max( 0 , atoi( value_str.c_str() ) );
+            }else if (key_str == "iothreads" ){
+                m_ioThreadCnt = (unsigned int)std::max( 0 , atoi( value_str.c_str() ) );
+            }else if (key_str == "spp" ){
+                m_samplePerPixelOverride = (unsigned int)std::max( 0 , atoi( value_str.c_str() ) );
+            }else if (key_str == "tilesize" ){
+                m_autoTileSize = value_str == "auto";
+                m_tileSizeOverride = m_autoTileSize ? 0u : (unsigned int)std::max( 0 , atoi( value_str.c_str() ) );
+            }else if (key_str == "accelerator" ){
+                m_acceleratorOverride = value_str;
+            }else if (key_str == "raydevice" ){
+                m_rayDevicePath = value_str;
+            }else if (key_str == "integrator" ){
+                m_integratorOverride = value_str;
+            }else if (key_str == "sampler" ){
+                m_samplerOverride = value_str;
+            }else if (key_str == "compile" ){
+                m_bundleDir = value_str;
+                m_compileBundle = true;
+            }else if (key_str == "bundle" ){
+                m_bundleDir = value_str;
             }
         }
 
+        // caches not specified explicitly go to the bundle
+        if( !m_bundleDir.empty() ){
+            if( m_acceleratorCacheFile.empty() )
+                m_acceleratorCacheFile = BundleFilePath( m_bundleDir , BUNDLE_ACCELERATOR_CACHE );
+            if( m_skyCacheFile.empty() )
+                m_skyCacheFile = BundleFilePath( m_bundleDir , BUNDLE_SKY_CACHE );
+        }
+
         return com_arg_valid;
     }
 
@@ -218,22 +888,177 @@ public:
         stream >> m_samplePerPixel;
         stream >> m_resWidth >> m_resHeight;
         stream >> m_clampping;
+        stream >> m_progressive >> m_samplePerPass >> m_timeBudget;
+        stream >> m_adaptiveSampling >> m_minSamplePerPixel >> m_noiseThreshold;
+        stream >> m_splatFilm;
+        stream >> m_samplerType;
+
+        // settings overridden in the command line, they make it possible to measure one scene in different configurations
+        if( m_threadCntOverride > 0 )
+            m_threadCnt = m_threadCntOverride;
+        if( m_samplePerPixelOverride > 0 )
+            m_samplePerPixel = m_samplePerPixelOverride;
+        if( !m_samplerOverride.empty() )
+            m_samplerType = StringID( m_samplerOverride );
+
+        // workers render exactly the passes handed out by the coordinator, pixel statistics of adaptive sampling
+        // would be scattered across machines.
+        const auto is_worker = !m_coordinatorAddress.empty();
+        if( is_worker )
+            m_progressive = false;
+        if( ( is_worker || m_coordinatorPort > 0 ) && m_adaptiveSampling ){
+            slog( WARNING , GENERAL , "Adaptive sampling is not supported in distributed rendering, it is disabled." );
+            m_adaptiveSampling = false;
+        }
+
+        // the plugin in Blender and machines of distributed rendering lay out tiles with the tile size in the scene
+        if( m_autoTileSize || m_tileSizeOverride > 0 ){
+            if( is_worker || m_coordinatorPort > 0 || m_blenderMode )
+                slog( WARNING , GENERAL , "Tile size can't be overridden with this configuration, the one in the scene is used." );
+            else
+                m_tileSize = m_autoTileSize ? autoTileSize() : m_tileSizeOverride;
+        }
         StringID accelType , integratorType;
         stream >> accelType;
-        m_accelerator = MakeUniqueInstance<Accelerator>(accelType);
+        m_accelerator = MakeUniqueInstance<Accelerator>(ResolveAcceleratorType(accelType));
         if( m_accelerator )
             m_accelerator->Serialize( stream );
+        // the exported settings still need to be consumed, an overriding accelerator takes its default settings
+        if( !m_acceleratorOverride.empty() ){
+            auto accelerator = MakeUniqueInstance<Accelerator>(ResolveAcceleratorType(StringID(m_acceleratorOverride)));
+            if( IS_PTR_VALID(accelerator) )
+                m_accelerator = std::move(accelerator);
+            else
+                slog( WARNING , GENERAL , "Unknown accelerator '%s', the one in the scene is used." , m_acceleratorOverride.c_str() );
+        }
+        m_accelerator->SetLinearBuild( m_linearBvhScene );
+        m_accelerator->SetOptimizedBuild( m_optimizedBvh );
 		m_acceleratorVol = std::move(m_accelerator->Clone());
+        // large batches of rays are shared with the ray device, volumes are always traced on the CPU
+        if( !m_rayDevicePath.empty() ){
+            if( auto device = RayDevice::Load( m_rayDevicePath ) )
+                m_accelerator = std::make_unique<Offload>( std::move(m_accelerator) , device );
+        }
 
         stream >> integratorType;
         m_integrator = MakeUniqueInstance<Integrator>(integratorType);
         if(IS_PTR_VALID(m_integrator))
             m_integrator->Serialize( stream );
+        if( !m_integratorOverride.empty() ){
+            auto integrator = MakeUniqueInstance<Integrator>(StringID(m_integratorOverride));
+            if( IS_PTR_VALID(integrator) )
+                m_integrator = std::move(integrator);
+            else
+                slog( WARNING , GENERAL , "Unknown integrator '%s', the one in the scene is used." , m_integratorOverride.c_str() );
+        }
 
-        if( m_blenderMode )
+        // views of a multi-view job are rendered one after another locally, each of them restarts the image from scratch
+        if( IsMultiView() && ( is_worker || m_coordinatorPort > 0 || m_blenderMode || m_serverMode ) ){
+            slog( WARNING , GENERAL , "Multiple views are only supported when rendering locally, only the camera in the scene is rendered." );
+            m_viewsFile.clear();
+            m_turntableFrames = 0;
+        }
+        // only frames rendered again and again in server mode could be relit, nothing else keeps the scene around
+        if( m_relight && ( is_worker || m_coordinatorPort > 0 || !m_serverMode ) ){
+            slog( WARNING , GENERAL , "Relighting is only supported when rendering locally in server mode, it is disabled." );
+            m_relight = false;
+        }
+        if( IsMultiView() && !m_checkpointFile.empty() ){
+            slog( WARNING , GENERAL , "Checkpoints are disabled when rendering multiple views." );
+            m_checkpointFile.clear();
+        }
+
+        // tiles are streamed to a tiled exr file of a single frame rendered locally, splatted radiance lands anywhere
+        const auto splatting = IS_PTR_VALID(m_integrator) && m_integrator->NeedSplatting();
+        const std::regex exr_reg( ".*\\.exr$" , std::regex_constants::icase );
+        if( m_bucketOutput && ( is_worker || m_coordinatorPort > 0 || m_blenderMode || m_serverMode || IsMultiView() || splatting || !std::regex_match( m_outputFile , exr_reg ) ) ){
+            slog( WARNING , GENERAL , "Streaming tiles is only supported when rendering an exr file locally without splatting, it is disabled." );
+            m_bucketOutput = false;
+        }
+        // each tile is written once its only pass is done, nothing covering all pixels is kept
+        if( m_bucketOutput ){
+            if( m_progressive || m_adaptiveSampling || m_aovMask || !m_checkpointFile.empty() || m_resolutionPyramid || !m_pixelFilterType.empty() || !m_denoiserType.empty() )
+                slog( WARNING , GENERAL , "Progressive rendering, adaptive sampling, AOVs, checkpoints, the resolution pyramid, pixel filters and denoising are disabled when streaming tiles." );
+            m_progressive = false;
+            m_adaptiveSampling = false;
+            m_aovMask = 0;
+            m_checkpointFile.clear();
+            m_resolutionPyramid = false;
+            m_pixelFilterType.clear();
+            m_denoiserType.clear();
+        }
+
+        if( is_worker )
+            m_imageSensor = std::make_unique<RemoteImage>( m_resWidth , m_resHeight );
+        else if( m_blenderMode )
             m_imageSensor = std::make_unique<BlenderImage>( m_resWidth , m_resHeight );
+        else if( m_bucketOutput )
+            m_imageSensor = std::make_unique<BucketImage>( m_resWidth , m_resHeight , m_tileSize );
         else
             m_imageSensor = std::make_unique<RenderTargetImage>( m_resWidth , m_resHeight );
+        if( splatting )
+            m_imageSensor->EnableSplatting( m_samplePerPixel , ( m_splatFilm || m_integrator->NeedSplatFilm() ) ? m_threadCnt : 0 );
+        if( m_adaptiveSampling )
+            m_imageSensor->EnableAdaptiveSampling();
+        if( m_aovMask && ( is_worker || m_coordinatorPort > 0 || m_blenderMode ) ){
+            slog( WARNING , GENERAL , "AOVs are only supported when rendering to a file locally, they are disabled." );
+            m_aovMask = 0;
+        }
+        if( m_aovMask )
+            m_imageSensor->EnableAov( m_aovMask );
+        // checkpoints only save the image of a single frame rendered locally, splatted radiance is not saved either
+        if( !m_checkpointFile.empty() && ( is_worker || m_coordinatorPort > 0 || m_blenderMode || m_serverMode || splatting ) ){
+            slog( WARNING , GENERAL , "Checkpoints are not supported with this configuration, they are disabled." );
+            m_checkpointFile.clear();
+        }
+        if( !m_checkpointFile.empty() )
+            m_imageSensor->EnableCheckpoint( m_tileSize );
+        // workers and the coordinator render tiles handed out one at a time, splatted radiance lands anywhere
+        if( m_resolutionPyramid && ( is_worker || m_coordinatorPort > 0 || splatting ) ){
+            slog( WARNING , GENERAL , "Resolution pyramid is not supported with this configuration, it is disabled." );
+            m_resolutionPyramid = false;
+        }
+        if( m_resolutionPyramid )
+            m_imageSensor->EnableResolutionPyramid();
+        // checkpoints keep track of samples per tile and the coordinator keeps track of tiles handed out, both need
+        // every pass of a tile to be done as a whole. So does streaming tiles to the file.
+        m_tileSplitting = !is_worker && m_checkpointFile.empty() && !m_bucketOutput;
+        // tiles of workers only carry the average of each pixel, checkpoints don't save the filtered samples either
+        if( !m_pixelFilterType.empty() && ( is_worker || m_coordinatorPort > 0 || !m_checkpointFile.empty() ) ){
+            slog( WARNING , GENERAL , "Pixel filters are not supported with this configuration, they are disabled." );
+            m_pixelFilterType.clear();
+        }
+        if( !m_pixelFilterType.empty() ){
+            auto filter = MakeUniqueInstance<PixelFilter>( StringID( m_pixelFilterType ) );
+            if( IS_PTR_INVALID(filter) )
+                slog( WARNING , GENERAL , "Unknown pixel filter '%s', samples are averaged in each pixel." , m_pixelFilterType.c_str() );
+            else
+                m_imageSensor->EnablePixelFilter( std::move( filter ) );
+        }
+        // buckets of a pixel are only kept by the machine rendering it, they are not saved in checkpoints either. Filtered
+        // samples reach other pixels and splatted radiance never goes through tiles.
+        if( m_robustBucketCnt > 0 && ( is_worker || m_coordinatorPort > 0 || m_bucketOutput || !m_checkpointFile.empty() || !m_pixelFilterType.empty() || splatting ) ){
+            slog( WARNING , GENERAL , "Robust accumulation is not supported with this configuration, it is disabled." );
+            m_robustBucketCnt = 0;
+        }
+        if( m_robustBucketCnt > 0 ){
+            if( m_clampping > 0.0f ){
+                slog( INFO , GENERAL , "Clamping is replaced by robust accumulation." );
+                m_clampping = 0.0f;
+            }
+            m_imageSensor->EnableRobustAccumulation( m_robustBucketCnt );
+        }else if( m_aovMask & ( 1u << AOV_OUTLIER ) ){
+            slog( WARNING , GENERAL , "The outlier AOV stays black without robust accumulation." );
+        }
+        if( !m_denoiserType.empty() && !is_worker ){
+            auto denoiser = MakeUniqueInstance<Denoiser>( StringID( m_denoiserType ) );
+            if( IS_PTR_INVALID(denoiser) )
+                slog( WARNING , GENERAL , "Unknown denoiser '%s', the image is not denoised." , m_denoiserType.c_str() );
+            else{
+                // tiles rendered by workers come without AOVs, the coordinator only denoises the color
+                m_imageSensor->EnableDenoiser( std::move( denoiser ) , m_coordinatorPort == 0 );
+            }
+        }
         m_imageSensor->PreProcess();
     };
 
@@ -241,8 +1066,11 @@ private:
     std::string                     m_resourcePath = "";            /**< Full path of the resource files. */
     std::string                     m_outputFile;                   /**< Name of the output file. */
     unsigned int                    m_tileSize = 64;                /**< Size of tile for tasks to render each time. */
+    bool                            m_tileSplitting = true;         /**< Whether running tiles hand part of their rows to idle workers. */
     unsigned int                    m_resWidth = 1024;              /**< Width of the result resolution. */
     unsigned int                    m_resHeight = 1024;             /**< Height of the result resolution. */
+    Vector2i                        m_regionMin = Vector2i( 0 , 0 );                /**< Top-left corner of the region to render. */
+    Vector2i                        m_regionMax = Vector2i( INT_MAX , INT_MAX );    /**< Bottom-right corner of the region to render, exclusive. */
     unsigned int                    m_threadCnt = 16;               /**< Number of worker thread ( including the main thread as a woker thread ). */
     unsigned int                    m_samplePerPixel = 4;           /**< Sample of per-pixel. Default value is 4 for fast iteration. */
     std::unique_ptr<Accelerator>    m_accelerator = nullptr;        /**< Spatial accelerator for accelerating primitive/ray intersection test. */
@@ -251,11 +1079,88 @@ private:
     std::unique_ptr<ImageSensor>    m_imageSensor = nullptr;        /**< Image sensor to hold the result of ray tracing. */
 
     bool                            m_blenderMode = false;          /**< Whether the current running instance is attached with Blender. */
+    bool                            m_serverMode = false;           /**< Whether the scene stays resident to render more frames. */
+    unsigned int                    m_coordinatorPort = 0;          /**< Port to listen to for workers, 0 means no distributed rendering. */
+    unsigned int                    m_telemetryPort = 0;            /**< Port serving live telemetry through HTTP, 0 means there is none. */
+    std::string                     m_coordinatorAddress;           /**< Address of the coordinator, empty means it is not a worker. */
+    float                           m_workerTimeOut = 300.0f;       /**< Time in seconds before a worker not responding is considered dead. */
     bool                            m_unitTestMode = false;         /**< Whether the current running instance is in unit test mode. */
     bool                            m_profilingEnalbed = false;     /**< Whether profiling is enabled in SORT. Since there is a big performance issue during rendering, it is turned off by default.*/
     bool                            m_noMaterialSupport = false;    /**< Disable material support in SORT. */
+    bool                            m_alphaMask = false;            /**< Whether cut-out materials are traced with binary alpha masks. */
+    bool                            m_stochasticCoat = false;       /**< Whether coated surfaces evaluate a randomly picked layer at a time. */
+    bool                            m_randomWalkSSS = false;        /**< Whether subsurface scattering is traced by random walks. */
+    bool                            m_compactMesh = false;          /**< Whether meshes keep their shading attributes in the compact format. */
+    bool                            m_cleanMesh = false;            /**< Whether meshes are cleaned up and reordered for locality once loaded. */
+    bool                            m_stochasticTexture = false;    /**< Whether texture lookups in shaders fetch one texel picked by its filter weight. */
+    bool                            m_relight = false;              /**< Whether frames are recorded split by lights so that they could be relit. */
+    float                           m_lodError = 0.0f;              /**< Error in pixels allowed when simplifying meshes far away, zero disables it. */
+    bool                            m_dedupMesh = false;            /**< Whether identical meshes are shared as instances of one mesh. */
+    bool                            m_linearBvhScene = false;       /**< Whether the top level BVH is built with the linear builder. */
+    bool                            m_linearBvhObjects = false;     /**< Whether BVHs of instanced meshes are built with the linear builder. */
+    bool                            m_optimizedBvh = false;         /**< Whether the top level QBVH/OBVH is collapsed from an optimized binary BVH. */
+    float                           m_cameraSah = 0.0f;             /**< Weight of camera rays in the cost model of the top level BVH, zero means plain SAH. */
+    bool                            m_bucketOutput = false;         /**< Whether tiles are streamed to a tiled exr file as soon as they are rendered. */
+    unsigned int                    m_subdivisionCacheSize = 1024;  /**< Memory budget of the tessellations of subdivision surfaces in mega bytes. */
+    unsigned int                    m_geometryBudget = 0;           /**< Memory budget of the vertices and the BVH of instanced meshes in mega bytes. */
+    unsigned int                    m_textureBudget = 0;            /**< Memory budget of image textures in mega bytes. */
+    bool                            m_textureCompression = false;   /**< Whether image textures of 8 bits per channel are kept in BC1/BC3 blocks. */
+    unsigned int                    m_acceleratorBudget = 0;        /**< Memory budget of spatial acceleration structures in mega bytes. */
+    bool                            m_numaAware = false;            /**< Whether to pin workers and interleave shared data across NUMA nodes. */
+    bool                            m_costPrepass = false;          /**< Whether to render expensive tiles first, the cost is estimated in a prepass. */
+    bool                            m_deferredBounces = false;      /**< Whether paths of a camera ray packet are traced bounce by bounce in sorted batches. */
+    bool                            m_interleavedTraversal = false; /**< Whether batches of secondary rays are traced interleaved to hide the latency of fetching nodes. */
+    bool                            m_previewQuality = false;       /**< Whether to render with biased approximations for faster previews. */
+    bool                            m_resolutionPyramid = false;    /**< Whether to render coarse passes before the first full pass. */
+    HugePagePolicy                  m_hugePagePolicy = HugePagePolicy::Transparent; /**< How large read-mostly structures are placed on huge pages. */
+    PixelOrder                      m_pixelOrder = PixelOrder::Scanline;            /**< Order of pixels and samples traced in a tile. */
     std::string                     m_inputFile;                    /**< Full path of the input file. */
+    std::string                     m_acceleratorCacheFile;         /**< Full path of the cache file of the spatial acceleration structure, empty means no caching. */
+    std::string                     m_skyCacheFile;                 /**< Full path of the cache file of the sampling tables of the sky light, empty means no caching. */
+    std::string                     m_sharedCacheDir;               /**< Directory of read-only data shared by processes on the same machine, empty means no sharing. */
+    std::string                     m_warmStartDir;                 /**< Directory of structures learned in previous renderings, empty means starting from scratch. */
+    float                           m_warmStartDecay = 0.5f;        /**< Fraction of the trust in learned structures left after they are carried over. */
+    std::string                     m_bundleDir;                    /**< Directory of the scene bundle, empty means there is no bundle. */
+    bool                            m_compileBundle = false;        /**< Whether the scene is only compiled into the bundle without being rendered. */
     float                           m_clampping = 0.0f;             /**< Clapping value of evaluated radiance. */
+    bool                            m_progressive = false;          /**< Whether to render the image in multiple passes. */
+    unsigned int                    m_samplePerPass = 1;            /**< Sample per pixel in each pass of progressive rendering. */
+    float                           m_timeBudget = 0.0f;            /**< Wall clock budget of progressive rendering in seconds, 0 means no limitation. */
+    bool                            m_adaptiveSampling = false;     /**< Whether pixels stop taking samples once converged. */
+    unsigned int                    m_minSamplePerPixel = 4;        /**< Minimum sample per pixel in adaptive sampling. */
+    float                           m_noiseThreshold = 0.01f;       /**< Relative standard error below which a pixel is converged. */
+    bool                            m_splatFilm = false;            /**< Whether each thread splats radiance into its own replica. */
+    unsigned int                    m_aovMask = 0;                  /**< A bit is set for each AOV rendered along with the beauty image. */
+    std::string                     m_denoiserType;                 /**< Class name of the denoiser, empty means no denoising. */
+    std::string                     m_pixelFilterType;              /**< Class name of the pixel filter, empty means samples are averaged in each pixel. */
+    unsigned int                    m_robustBucketCnt = 0;          /**< Number of buckets of robust accumulation, 0 means samples are averaged. */
+    std::string                     m_checkpointFile;               /**< Full path of the checkpoint file, empty means no checkpoint. */
+    float                           m_checkpointInterval = 600.0f;  /**< Seconds between two checkpoints. */
+    bool                            m_resume = false;               /**< Whether rendering resumes from the checkpoint file. */
+    std::string                     m_statsFile;                    /**< Full path of the JSON file stats are exported to. */
+    std::string                     m_traceFile;                    /**< Full path of the Chrome trace file the timeline of tasks is exported to. */
+    std::string                     m_viewsFile;                    /**< Full path of the file listing the views of a multi-view job. */
+    unsigned int                    m_turntableFrames = 0;          /**< Number of frames of a turntable around the target of the camera. */
+    unsigned int                    m_threadCntOverride = 0;        /**< Number of threads overriding the scene, 0 means no override. */
+    unsigned int                    m_ioThreadCnt = IO_DEFAULT_THREAD_CNT;  /**< Number of I/O worker threads on top of the worker threads. */
+    unsigned int                    m_samplePerPixelOverride = 0;   /**< Sample per pixel overriding the scene, 0 means no override. */
+    unsigned int                    m_tileSizeOverride = 0;         /**< Tile size overriding the scene, 0 means no override. */
+    bool                            m_autoTileSize = false;         /**< Whether to pick the tile size from the resolution and the number of threads. */
+    std::string                     m_acceleratorOverride;          /**< Class name of the accelerator overriding the scene. */
+    std::string                     m_rayDevicePath;                /**< Full path of the shared library of the ray device, empty means no offloading. */
+    std::string                     m_integratorOverride;           /**< Class name of the integrator overriding the scene. */
+    std::string                     m_samplerOverride;              /**< Class name of the sampler overriding the scene. */
+    StringID                        m_samplerType = SID("RandomSampler");   /**< Sampler drawing samples of each pixel. */
+
+    //! @brief  Pick a tile size so that every thread takes a few tiles, which keeps the tail of rendering short.
+    //!
+    //! @return     Tile size between 16 and 64, rounded down to a multiple of 8.
+    unsigned int autoTileSize() const {
+        const auto pixel_cnt = (double)m_resWidth * (double)m_resHeight;
+        const auto tile_cnt = (double)( std::max( 1u , m_threadCnt ) * AUTO_TILE_PER_THREAD );
+        const auto size = (unsigned int)std::sqrt( pixel_cnt / tile_cnt );
+        return std::max( 16u , std::min( 64u , size / 8u * 8u ) );
+    }
 
     //! @brief  Make constructor private
     GlobalConfiguration(){}
@@ -266,11 +1171,18 @@ private:
 };
 
 #define g_tileSize                  GlobalConfiguration::GetSingleton().GetTileSize()
+#define g_tileSplitting             GlobalConfiguration::GetSingleton().GetTileSplitting()
 #define g_blenderMode               GlobalConfiguration::GetSingleton().GetBlenderMode()
+#define g_serverMode                GlobalConfiguration::GetSingleton().GetServerMode()
+#define g_coordinatorPort           GlobalConfiguration::GetSingleton().GetCoordinatorPort()
+#define g_telemetryPort             GlobalConfiguration::GetSingleton().GetTelemetryPort()
+#define g_coordinatorAddress        GlobalConfiguration::GetSingleton().GetCoordinatorAddress()
+#define g_workerTimeOut             GlobalConfiguration::GetSingleton().GetWorkerTimeOut()
 #define g_accelerator               GlobalConfiguration::GetSingleton().GetAccelerator()
 #define g_acceleratorVol            GlobalConfiguration::GetSingleton().GetAcceleratorVol()
 #define g_integrator                GlobalConfiguration::GetSingleton().GetIntegrator()
 #define g_threadCnt                 GlobalConfiguration::GetSingleton().GetThreadCnt()
+#define g_ioThreadCnt               GlobalConfiguration::GetSingleton().GetIOThreadCnt()
 #define g_samplePerPixel            GlobalConfiguration::GetSingleton().GetSamplePerPixel()
 #define g_resourcePath              GlobalConfiguration::GetSingleton().GetResourcePath()
 #define g_outputFileName            GlobalConfiguration::GetSingleton().GetOutputFileName()
@@ -279,7 +1191,60 @@ private:
 #define g_resultResollutionHeight   GlobalConfiguration::GetSingleton().GetResultResolution().y
 #define g_unitTestMode              GlobalConfiguration::GetSingleton().GetIsUnitTestMode()
 #define g_inputFilePath             GlobalConfiguration::GetSingleton().GetInputFilePath()
+#define g_acceleratorCacheFilePath  GlobalConfiguration::GetSingleton().GetAcceleratorCacheFilePath()
+#define g_skyCacheFilePath          GlobalConfiguration::GetSingleton().GetSkyCacheFilePath()
+#define g_sharedCacheDir            GlobalConfiguration::GetSingleton().GetSharedCacheDir()
+#define g_warmStartDir              GlobalConfiguration::GetSingleton().GetWarmStartDir()
+#define g_warmStartDecay            GlobalConfiguration::GetSingleton().GetWarmStartDecay()
+#define g_bundleDir                 GlobalConfiguration::GetSingleton().GetBundleDir()
+#define g_compileBundle             GlobalConfiguration::GetSingleton().GetCompileBundle()
 #define g_imageSensor               GlobalConfiguration::GetSingleton().GetImageSensor()
 #define g_profilingEnabled          GlobalConfiguration::GetSingleton().GetIsProfilingEnabled()
 #define g_noMaterial                GlobalConfiguration::GetSingleton().GetNoMaterial()
-#define g_clammping                 GlobalConfiguration::GetSingleton().GetClampping()
\ No newline at end of file
+#define g_alphaMask                 GlobalConfiguration::GetSingleton().GetAlphaMask()
+#define g_stochasticCoat            GlobalConfiguration::GetSingleton().GetStochasticCoat()
+#define g_randomWalkSSS             GlobalConfiguration::GetSingleton().GetRandomWalkSSS()
+#define g_compactMesh               GlobalConfiguration::GetSingleton().GetCompactMesh()
+#define g_cleanMesh                 GlobalConfiguration::GetSingleton().GetCleanMesh()
+#define g_stochasticTexture         GlobalConfiguration::GetSingleton().GetStochasticTexture()
+#define g_relight                   GlobalConfiguration::GetSingleton().GetRelight()
+#define g_lodError                  GlobalConfiguration::GetSingleton().GetLodError()
+#define g_dedupMesh                 GlobalConfiguration::GetSingleton().GetDedupMesh()
+#define g_linearBvhScene            GlobalConfiguration::GetSingleton().GetLinearBvhScene()
+#define g_linearBvhObjects          GlobalConfiguration::GetSingleton().GetLinearBvhObjects()
+#define g_optimizedBvh              GlobalConfiguration::GetSingleton().GetOptimizedBvh()
+#define g_cameraSah                 GlobalConfiguration::GetSingleton().GetCameraSah()
+#define g_bucketOutput              GlobalConfiguration::GetSingleton().GetBucketOutput()
+#define g_subdivisionCacheSize      GlobalConfiguration::GetSingleton().GetSubdivisionCacheSize()
+#define g_geometryBudget            GlobalConfiguration::GetSingleton().GetGeometryBudget()
+#define g_textureBudget             GlobalConfiguration::GetSingleton().GetTextureBudget()
+#define g_textureCompression        GlobalConfiguration::GetSingleton().GetTextureCompression()
+#define g_acceleratorBudget         GlobalConfiguration::GetSingleton().GetAcceleratorBudget()
+#define g_numaAware                 GlobalConfiguration::GetSingleton().GetNumaAware()
+#define g_costPrepass               GlobalConfiguration::GetSingleton().GetCostPrepass()
+#define g_deferredBounces           GlobalConfiguration::GetSingleton().GetDeferredBounces()
+#define g_interleavedTraversal      GlobalConfiguration::GetSingleton().GetInterleavedTraversal()
+#define g_previewQuality            GlobalConfiguration::GetSingleton().GetPreviewQuality()
+#define g_resolutionPyramid         GlobalConfiguration::GetSingleton().GetResolutionPyramid()
+#define g_hugePagePolicy            GlobalConfiguration::GetSingleton().GetHugePagePolicy()
+#define g_pixelOrder                GlobalConfiguration::GetSingleton().GetPixelOrder()
+#define g_clammping                 GlobalConfiguration::GetSingleton().GetClampping()
+#define g_progressive               GlobalConfiguration::GetSingleton().GetProgressive()
+#define g_samplePerPass             GlobalConfiguration::GetSingleton().GetSamplePerPass()
+#define g_timeBudget                GlobalConfiguration::GetSingleton().GetTimeBudget()
+#define g_adaptiveSampling          GlobalConfiguration::GetSingleton().GetAdaptiveSampling()
+#define g_minSamplePerPixel         GlobalConfiguration::GetSingleton().GetMinSamplePerPixel()
+#define g_noiseThreshold            GlobalConfiguration::GetSingleton().GetNoiseThreshold()
+#define g_splatFilm                 GlobalConfiguration::GetSingleton().GetSplatFilm()
+#define g_checkpointFilePath        GlobalConfiguration::GetSingleton().GetCheckpointFilePath()
+#define g_checkpointInterval        GlobalConfiguration::GetSingleton().GetCheckpointInterval()
+#define g_resume                    GlobalConfiguration::GetSingleton().GetResume()
+#define g_statsFilePath             GlobalConfiguration::GetSingleton().GetStatsFilePath()
+#define g_traceFilePath             GlobalConfiguration::GetSingleton().GetTraceFilePath()
+#define g_viewsFilePath             GlobalConfiguration::GetSingleton().GetViewsFilePath()
+#define g_turntableFrames           GlobalConfiguration::GetSingleton().GetTurntableFrames()
+#define g_multiView                 GlobalConfiguration::GetSingleton().IsMultiView()
+#define g_denoiserType              GlobalConfiguration::GetSingleton().GetDenoiserType()
+#define g_robustBucketCnt           GlobalConfiguration::GetSingleton().GetRobustBucketCnt()
+#define g_aovMask                   GlobalConfiguration::GetSingleton().GetAovMask()
+#define g_samplerType               GlobalConfiguration::GetSingleton().GetSamplerType()
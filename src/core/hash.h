@@ -0,0 +1,56 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include "core/define.h"
+
+// Fowler-Noll-Vo hash function
+// https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function
+//
+// Unlike the CRC hashing in StringID, it is not used to intern strings. It is only for detecting changes of big chunks
+// of data, like the geometry in the scene, 64 bits makes collisions unlikely enough for this purpose.
+
+constexpr std::uint64_t FNV_OFFSET_BASIS    = 0xcbf29ce484222325ull;
+constexpr std::uint64_t FNV_PRIME           = 0x100000001b3ull;
+
+//! @brief  Accumulate raw bytes into a FNV-1a hash.
+//!
+//! @param  data    Data to be hashed.
+//! @param  size    Size of the data in bytes.
+//! @param  hash    The hash value accumulated so far.
+//! @return         The accumulated hash value.
+SORT_FORCEINLINE std::uint64_t HashBytes( const void* data , std::size_t size , std::uint64_t hash = FNV_OFFSET_BASIS ){
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    while( size-- ){
+        hash ^= *bytes++;
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+//! @brief  Accumulate a value into a FNV-1a hash, the value needs to be trivially copyable without any padding in it.
+//!
+//! @param  v       Value to be hashed.
+//! @param  hash    The hash value accumulated so far.
+//! @return         The accumulated hash value.
+template<class T>
+SORT_FORCEINLINE std::uint64_t HashValue( const T& v , std::uint64_t hash = FNV_OFFSET_BASIS ){
+    return HashBytes( &v , sizeof( T ) , hash );
+}
@@ -17,10 +17,16 @@
 
 #include <iostream>
 #include <vector>
+#include <map>
 #include <ctime>
 #include <chrono>
 #include <string>
+#include <cstring>
 #include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <algorithm>
 #include "core/define.h"
 #include "core/path.h"
 #include "log.h"
@@ -32,30 +38,288 @@ static bool g_logTime = true;
 static bool g_logLineInfo = false;
 static LOG_LEVEL logDefaultLevel = LOG_LEVEL::LOG_DEBUG;     // By default, debug information is avoided.
 
+// Threads logging messages never wait for each other. Each thread copies its messages in a ring buffer of its own, a
+// background thread drains all of them periodically and dispatches the messages in the order they are logged. The
+// threads logging don't format anything other than the message itself, neither do they touch any file or the console.
+//
+// A thread logging faster than the logger thread drains its buffer drains all buffers itself once its buffer is full, no
+// message is ever lost. Repeated messages and messages from a place of the code logging too often are only counted.
+
+static constexpr unsigned int   LOG_RING_SIZE = 256;        // Messages in the ring buffer of each thread.
+static constexpr unsigned int   LOG_RATE_LIMIT = 32;        // Messages from a single place of the code in each second.
+static constexpr auto           LOG_DRAIN_INTERVAL = std::chrono::milliseconds( 20 );
+
+namespace {
+    struct LogEntry{
+        LOG_LEVEL       level;
+        LOG_TYPE        type;
+        const char*     file;
+        int             line;
+        std::time_t     time;
+        std::uint64_t   sequence;
+        char            message[SORT_LOG_MESSAGE_SIZE];
+    };
+
+    // Single producer single consumer ring buffer, the owner thread writes and the logger thread reads.
+    struct LogRing{
+        LogEntry                    entries[LOG_RING_SIZE];
+        std::atomic<unsigned int>   head = { 0 };           // The next entry to be written by the owner thread.
+        std::atomic<unsigned int>   tail = { 0 };           // The next entry to be read by the logger thread.
+        std::atomic<bool>           retired = { false };    // Whether the owner thread has exited.
+    };
+
+    // How often a place of the code logs messages.
+    struct LogSite{
+        std::time_t     second = 0;
+        unsigned int    cnt = 0;
+        unsigned int    suppressed = 0;
+    };
+
+    // Consecutive messages that are exactly the same are only dispatched once.
+    struct LogRepeat{
+        LogEntry        entry;
+        unsigned int    cnt = 0;
+        bool            valid = false;
+    };
+
+    std::mutex                              g_ringMutex;        // Protects the list of ring buffers.
+    std::vector<std::shared_ptr<LogRing>>   g_rings;
+    std::atomic<std::uint64_t>              g_logSequence = { 0 };
+
+    std::mutex                              g_drainMutex;       // Only one thread drains the ring buffers at a time.
+    std::map<std::pair<const char*, int>, LogSite> g_logSites;
+    LogRepeat                               g_logRepeat;
+
+    // The ring buffer of a thread lives as long as the thread, it is released once it is drained after the thread exits.
+    struct LogRingOwner{
+        std::shared_ptr<LogRing>    ring = std::make_shared<LogRing>();
+
+        LogRingOwner(){
+            std::lock_guard<std::mutex> lock( g_ringMutex );
+            g_rings.push_back( ring );
+        }
+        ~LogRingOwner(){
+            ring->retired.store( true , std::memory_order_release );
+        }
+    };
+
+    LogRing& threadRing(){
+        static thread_local LogRingOwner owner;
+        return *owner.ring;
+    }
+
+    void fillEntry( LogEntry& entry , LOG_LEVEL level , LOG_TYPE type , const char* str , const char* file , const int line ){
+        entry.level = level;
+        entry.type = type;
+        entry.file = file;
+        entry.line = line;
+        entry.time = std::time( nullptr );
+        entry.sequence = g_logSequence.fetch_add( 1 , std::memory_order_relaxed );
+        strncpy( entry.message , str , SORT_LOG_MESSAGE_SIZE - 1 );
+        entry.message[SORT_LOG_MESSAGE_SIZE - 1] = 0;
+    }
+
+    void dispatchEntry( const LogEntry& entry ){
+        for( const auto& it : g_logDispatcher )
+            it->Dispatch( entry.level , entry.type , entry.message , entry.file , entry.line , entry.time );
+    }
+
+    void dispatchNote( const LogEntry& entry , const std::string& note ){
+        for( const auto& it : g_logDispatcher )
+            it->Dispatch( entry.level , entry.type , note.c_str() , entry.file , entry.line , entry.time );
+    }
+
+    void flushRepeat(){
+        if( g_logRepeat.valid && g_logRepeat.cnt > 0 )
+            dispatchNote( g_logRepeat.entry , "The last message is repeated " + std::to_string( g_logRepeat.cnt ) + " more times." );
+        g_logRepeat.valid = false;
+        g_logRepeat.cnt = 0;
+    }
+
+    // The drain mutex needs to be locked before calling it.
+    void filterAndDispatch( const LogEntry& entry ){
+        // messages from the same place of the code, only the first few of them in each second are dispatched
+        auto& site = g_logSites[std::make_pair( entry.file , entry.line )];
+        if( site.second != entry.time ){
+            if( site.suppressed > 0 ){
+                flushRepeat();
+                dispatchNote( entry , std::to_string( site.suppressed ) + " messages from the same place were suppressed." );
+            }
+            site.second = entry.time;
+            site.cnt = 0;
+            site.suppressed = 0;
+        }
+        if( ++site.cnt > LOG_RATE_LIMIT && entry.level < LOG_LEVEL::LOG_CRITICAL ){
+            ++site.suppressed;
+            return;
+        }
+
+        if( g_logRepeat.valid && g_logRepeat.entry.file == entry.file && g_logRepeat.entry.line == entry.line &&
+            0 == strcmp( g_logRepeat.entry.message , entry.message ) ){
+            ++g_logRepeat.cnt;
+            return;
+        }
+
+        flushRepeat();
+        dispatchEntry( entry );
+        g_logRepeat.entry = entry;
+        g_logRepeat.valid = true;
+    }
+
+    // Report the messages suppressed by the rate limiting that are not reported yet, it is done before quitting.
+    void flushSuppressed(){
+        for( auto& it : g_logSites ){
+            if( it.second.suppressed == 0 )
+                continue;
+            LogEntry entry;
+            fillEntry( entry , LOG_LEVEL::LOG_WARNING , LOG_TYPE::LOG_GENERAL , "" , it.first.first , it.first.second );
+            dispatchNote( entry , std::to_string( it.second.suppressed ) + " messages from the same place were suppressed." );
+            it.second.suppressed = 0;
+        }
+    }
+
+    // The drain mutex needs to be locked before calling it.
+    void drain(){
+        std::vector<std::shared_ptr<LogRing>> rings;
+        {
+            std::lock_guard<std::mutex> lock( g_ringMutex );
+            rings = g_rings;
+        }
+
+        std::vector<LogEntry> pending;
+        for( auto& ring : rings ){
+            // the owner may still be writing, anything after the head is not ready yet
+            const auto retired = ring->retired.load( std::memory_order_acquire );
+            const auto tail = ring->tail.load( std::memory_order_relaxed );
+            const auto head = ring->head.load( std::memory_order_acquire );
+            for( auto i = tail ; i != head ; ++i )
+                pending.push_back( ring->entries[i % LOG_RING_SIZE] );
+            ring->tail.store( head , std::memory_order_release );
+
+            if( retired ){
+                std::lock_guard<std::mutex> lock( g_ringMutex );
+                g_rings.erase( std::remove( g_rings.begin() , g_rings.end() , ring ) , g_rings.end() );
+            }
+        }
+
+        std::sort( pending.begin() , pending.end() , []( const LogEntry& e0 , const LogEntry& e1 ){ return e0.sequence < e1.sequence; } );
+        for( const auto& entry : pending )
+            filterAndDispatch( entry );
+        flushRepeat();
+    }
+
+    // The background thread draining all ring buffers.
+    class Logger{
+    public:
+        ~Logger(){
+            Stop();
+        }
+
+        void Start(){
+            std::lock_guard<std::mutex> lock( m_mutex );
+            if( m_running )
+                return;
+            m_running = true;
+            m_thread = std::thread( [this](){
+                std::unique_lock<std::mutex> lock( m_mutex );
+                while( m_running ){
+                    m_cv.wait_for( lock , LOG_DRAIN_INTERVAL , [this](){ return !m_running; } );
+                    lock.unlock();
+                    {
+                        std::lock_guard<std::mutex> drain_lock( g_drainMutex );
+                        drain();
+                    }
+                    lock.lock();
+                }
+            } );
+        }
+
+        void Stop(){
+            {
+                std::lock_guard<std::mutex> lock( m_mutex );
+                if( !m_running )
+                    return;
+                m_running = false;
+            }
+            m_cv.notify_all();
+            m_thread.join();
+
+            std::lock_guard<std::mutex> drain_lock( g_drainMutex );
+            drain();
+            flushSuppressed();
+        }
+
+        bool IsRunning(){
+            std::lock_guard<std::mutex> lock( m_mutex );
+            return m_running;
+        }
+
+    private:
+        std::thread             m_thread;
+        std::mutex              m_mutex;
+        std::condition_variable m_cv;
+        bool                    m_running = false;
+    };
+
+    // It is defined after the dispatchers so that it stops before they are destroyed.
+    Logger  g_logger;
+}
+
+bool isLogEnabled( LOG_LEVEL level ){
+    return level >= logDefaultLevel;
+}
+
 void addLogDispatcher( std::unique_ptr<LogDispatcher> logDispatcher ){
-    g_logDispatcher.push_back( std::move(logDispatcher) );
+    {
+        std::lock_guard<std::mutex> lock( g_drainMutex );
+        g_logDispatcher.push_back( std::move(logDispatcher) );
+    }
+    g_logger.Start();
+}
+
+void flushLog(){
+    std::lock_guard<std::mutex> lock( g_drainMutex );
+    drain();
 }
 
-void sortLog( LOG_LEVEL level , LOG_TYPE type , const std::string& str , const char* file , const int line ){
-    if( level < logDefaultLevel )
+void sortLog( LOG_LEVEL level , LOG_TYPE type , const char* str , const char* file , const int line ){
+    if( !isLogEnabled( level ) )
         return;
-    for( const auto& it : g_logDispatcher )
-        it->Dispatch( level , type , str.c_str() , file , line );
+
+    // without the logger thread, messages are dispatched right away
+    if( !g_logger.IsRunning() ){
+        LogEntry entry;
+        fillEntry( entry , level , type , str , file , line );
+        std::lock_guard<std::mutex> lock( g_drainMutex );
+        filterAndDispatch( entry );
+        flushRepeat();
+        return;
+    }
+
+    auto& ring = threadRing();
+    const auto head = ring.head.load( std::memory_order_relaxed );
+    if( head - ring.tail.load( std::memory_order_acquire ) >= LOG_RING_SIZE )
+        flushLog();
+    fillEntry( ring.entries[head % LOG_RING_SIZE] , level , type , str , file , line );
+    ring.head.store( head + 1 , std::memory_order_release );
+
+    // the program is usually about to crash after a critical message
+    if( level == LOG_LEVEL::LOG_CRITICAL )
+        flushLog();
 }
 
-void LogDispatcher::Dispatch( LOG_LEVEL level , LOG_TYPE type , const char* str , const char* file , const int line ){
-    const auto header = formatHead( level , type , file , line );
+void LogDispatcher::Dispatch( LOG_LEVEL level , LOG_TYPE type , const char* str , const char* file , const int line , const std::time_t time ){
+    const auto header = formatHead( level , type , file , line , time );
     const auto info = std::string( str );
     static std::mutex mutex;
     std::lock_guard<std::mutex> lock(mutex);
     output(level,header,info);
 }
 
-const std::string logTimeString(){
+const std::string logTimeString( std::time_t now ){
     if( !g_logTime )
         return "";
 
-    std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
     char s[128] = { 0 };
 
 #ifdef SORT_IN_WINDOWS
@@ -114,12 +378,12 @@ const std::string lineInfoString( const char* file , int line , LOG_LEVEL level
     return "[File:" + std::string(file) + "  Line:" + std::to_string(line) + "]";
 }
 
-const std::string LogDispatcher::formatHead( LOG_LEVEL level , LOG_TYPE type , const char* file , const int line ) const{
-    return logTimeString() + levelToString(level) + typeToString( type ) + lineInfoString( file , line , level ) + "\t";
+const std::string LogDispatcher::formatHead( LOG_LEVEL level , LOG_TYPE type , const char* file , const int line , const std::time_t time ) const{
+    return logTimeString( time ) + levelToString(level) + typeToString( type ) + lineInfoString( file , line , level ) + "\t";
 }
 
-const std::string LogDispatcher::format( LOG_LEVEL level , LOG_TYPE type , const char* str , const char* file , const int line ) const{
-    return formatHead( level , type , file , line ) + std::string(str);
+const std::string LogDispatcher::format( LOG_LEVEL level , LOG_TYPE type , const char* str , const char* file , const int line , const std::time_t time ) const{
+    return formatHead( level , type , file , line , time ) + std::string(str);
 }
 
 void StdOutLogDispatcher::output( const LOG_LEVEL level , const std::string& header , const std::string& info ){
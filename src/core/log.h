@@ -20,14 +20,20 @@
 #include "core/define.h"
 #include <fstream>
 #include <memory>
+#include <ctime>
 
+//! @brief  Size of the buffer on the stack to format a message, longer messages are truncated.
+#define SORT_LOG_MESSAGE_SIZE   512
+
+// Messages are formatted on the stack of the thread logging them, nothing is formatted for levels that are filtered out.
 #define slog( level , type , ... ) \
 [&]() \
 { \
-    const std::size_t size = snprintf(nullptr, 0, __VA_ARGS__) + 1; \
-    std::unique_ptr<char[]> buf = std::make_unique<char[]>(size); \
-    snprintf(buf.get(), size, __VA_ARGS__); \
-    sortLog( LOG_LEVEL::LOG_##level , LOG_TYPE::LOG_##type , buf.get() , __FILE__ , __LINE__ );\
+    if( !isLogEnabled( LOG_LEVEL::LOG_##level ) ) \
+        return; \
+    char buf[SORT_LOG_MESSAGE_SIZE]; \
+    snprintf(buf, SORT_LOG_MESSAGE_SIZE, __VA_ARGS__); \
+    sortLog( LOG_LEVEL::LOG_##level , LOG_TYPE::LOG_##type , buf , __FILE__ , __LINE__ );\
 }()
 
 enum class LOG_LEVEL {
@@ -69,7 +75,8 @@ public:
     //! @param  str         The message to be logged.
     //! @param  file        The name of the file where the logging happens.
     //! @param  line        The number of the line in the file where the logging happens.
-    void Dispatch( LOG_LEVEL level , LOG_TYPE type , const char* str , const char* file , const int line );
+    //! @param  time        The time when the message is logged.
+    void Dispatch( LOG_LEVEL level , LOG_TYPE type , const char* str , const char* file , const int line , const std::time_t time );
 
 private:
     //! @brief  Output the log message.
@@ -86,7 +93,8 @@ private:
     //! @param  str         The message to be logged.
     //! @param  file        The name of the file where the logging happens.
     //! @param  line        The number of the line in the file where the logging happens.
-    const std::string format( LOG_LEVEL level , LOG_TYPE type , const char* str , const char* file , const int line ) const;
+    //! @param  time        The time when the message is logged.
+    const std::string format( LOG_LEVEL level , LOG_TYPE type , const char* str , const char* file , const int line , const std::time_t time ) const;
 
     //! @brief  Format the message header.
     //!
@@ -94,7 +102,8 @@ private:
     //! @param  type        Type of the message.
     //! @param  file        The name of the file where the logging happens.
     //! @param  line        The number of the line in the file where the logging happens.
-    const std::string formatHead( LOG_LEVEL level , LOG_TYPE type , const char* file , const int line ) const;
+    //! @param  time        The time when the message is logged.
+    const std::string formatHead( LOG_LEVEL level , LOG_TYPE type , const char* file , const int line , const std::time_t time ) const;
 };
 
 //! @brief  FileLogDispatcher dispatch logs to a file to be viewed afterward.
@@ -129,16 +138,29 @@ class StdOutLogDispatcher : public LogDispatcher {
     void output( const LOG_LEVEL level , const std::string& header , const std::string& info ) override ;
 };
 
-//! @brief  Format the message.
+//! @brief  Log a message.
+//!
+//! The message is only copied in a ring buffer of the calling thread, it is dispatched later by the logger thread.
+//! Critical messages are dispatched right away along with everything logged before them, since the program is
+//! usually about to crash.
 //!
 //! @param  level       Level of the message.
 //! @param  type        Type of the message.
 //! @param  str         The message to be logged.
 //! @param  file        The name of the file where the logging happens.
 //! @param  line        The number of the line in the file where the logging happens.
-void sortLog( LOG_LEVEL level , LOG_TYPE type , const std::string& str , const char* file , const int line );
+void sortLog( LOG_LEVEL level , LOG_TYPE type , const char* str , const char* file , const int line );
+
+//! @brief  Whether messages of a level are logged at all.
+//!
+//! @param  level       Level of the message.
+//! @return             False if messages of the level are filtered out.
+bool isLogEnabled( LOG_LEVEL level );
 
-//! @brief  Add a dispatcher to the log system.
+//! @brief  Add a dispatcher to the log system, the logger thread is started with the first one.
 //!
 //! @param  logDispatcher   Dispatcher to add in the log system.
 void addLogDispatcher( std::unique_ptr<LogDispatcher> logDispatcher );
+
+//! @brief  Dispatch all messages logged so far in the calling thread.
+void flushLog();
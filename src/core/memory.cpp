@@ -0,0 +1,303 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <mutex>
+#include <atomic>
+#include <climits>
+#include <unordered_map>
+#include "memory.h"
+
+#ifdef SORT_IN_WINDOWS
+    #include <windows.h>
+    #include <psapi.h>
+#else
+    #include <sys/resource.h>
+    #include <sys/mman.h>
+#endif
+
+SORT_STATS_DEFINE_COUNTER(sPeakMemoryPoolSize)
+SORT_STATS_DEFINE_COUNTER(sLargeMemoryAllocation)
+
+SORT_STATS_COUNTER("Statistics", "Peak Memory Pool Size (Bytes)", sPeakMemoryPoolSize);
+SORT_STATS_COUNTER("Statistics", "Large Memory Pool Allocation", sLargeMemoryAllocation);
+
+SORT_STATS_DEFINE_COUNTER(sHugePageMemory)
+SORT_STATS_DEFINE_COUNTER(sHugePageFallback)
+
+SORT_STATS_COUNTER("Statistics", "Huge Page Memory (Bytes)", sHugePageMemory);
+SORT_STATS_COUNTER("Statistics", "Huge Page Fallback", sHugePageFallback);
+
+SORT_STATS_DEFINE_COUNTER(sPeakAcceleratorMemory)
+SORT_STATS_DEFINE_COUNTER(sPeakGeometryMemory)
+SORT_STATS_DEFINE_COUNTER(sPeakTextureMemory)
+SORT_STATS_DEFINE_COUNTER(sPeakVolumeMemory)
+SORT_STATS_DEFINE_COUNTER(sPeakMeasuredBxdfMemory)
+SORT_STATS_DEFINE_COUNTER(sPeakTaskGraphMemory)
+SORT_STATS_DEFINE_COUNTER(sPeakThreadArenaMemory)
+
+SORT_STATS_COUNTER("Memory", "Peak Accelerator Memory (Bytes)", sPeakAcceleratorMemory);
+SORT_STATS_COUNTER("Memory", "Peak Geometry Memory (Bytes)", sPeakGeometryMemory);
+SORT_STATS_COUNTER("Memory", "Peak Texture Memory (Bytes)", sPeakTextureMemory);
+SORT_STATS_COUNTER("Memory", "Peak Volume Memory (Bytes)", sPeakVolumeMemory);
+SORT_STATS_COUNTER("Memory", "Peak Measured BXDF Memory (Bytes)", sPeakMeasuredBxdfMemory);
+SORT_STATS_COUNTER("Memory", "Peak Task Graph Memory (Bytes)", sPeakTaskGraphMemory);
+SORT_STATS_COUNTER("Memory", "Peak Thread Arena Memory (Bytes)", sPeakThreadArenaMemory);
+
+namespace {
+    constexpr auto MEMORY_CATEGORY_CNT = (unsigned)MemoryCategory::Count;
+
+    // Usage of each subsystem, they are global as memory is allocated and released by whatever thread owns the data.
+    std::atomic<long long>              g_trackedMemory[MEMORY_CATEGORY_CNT] = {};
+    std::atomic<long long>              g_peakTrackedMemory[MEMORY_CATEGORY_CNT] = {};
+    std::atomic<unsigned long long>     g_memoryBudget[MEMORY_CATEGORY_CNT] = {};
+
+    std::atomic<HugePagePolicy> g_hugePagePolicy = { HugePagePolicy::Transparent };
+
+    // Explicit huge pages are mapped by the OS directly, they need their sizes to be released.
+    std::mutex                                  g_explicitMutex;
+    std::unordered_map<void*,std::size_t>       g_explicitAllocations;
+    std::atomic<std::size_t>                    g_explicitCnt = { 0 };
+
+    void* allocateExplicit( std::size_t size ){
+        void* ret = nullptr;
+#if defined(SORT_IN_LINUX)
+        ret = mmap( nullptr , size , PROT_READ | PROT_WRITE , MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB , -1 , 0 );
+        if( MAP_FAILED == ret )
+            ret = nullptr;
+#elif defined(SORT_IN_WINDOWS)
+        const auto page = GetLargePageMinimum();
+        if( page > 0 && 0 == size % page )
+            ret = VirtualAlloc( nullptr , size , MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES , PAGE_READWRITE );
+#endif
+        if( IS_PTR_INVALID(ret) )
+            return nullptr;
+
+        std::lock_guard<std::mutex> lock( g_explicitMutex );
+        g_explicitAllocations[ret] = size;
+        ++g_explicitCnt;
+        return ret;
+    }
+
+    void* allocateTransparent( std::size_t size ){
+#if defined(SORT_IN_LINUX)
+        // huge page aligned so that the whole range could be backed by huge pages
+        void* ret = nullptr;
+        if( 0 != posix_memalign( &ret , MEM_HUGE_PAGE_SIZE , size ) )
+            return nullptr;
+        if( 0 != madvise( ret , size , MADV_HUGEPAGE ) ){
+            // it is still valid memory, just without huge pages
+            free( ret );
+            return nullptr;
+        }
+        return ret;
+#else
+        return nullptr;
+#endif
+    }
+}
+
+void TrackMemory( MemoryCategory category , long long bytes ){
+    const auto i = (unsigned)category;
+    const auto current = g_trackedMemory[i].fetch_add( bytes , std::memory_order_relaxed ) + bytes;
+
+    auto peak = g_peakTrackedMemory[i].load( std::memory_order_relaxed );
+    while( current > peak && !g_peakTrackedMemory[i].compare_exchange_weak( peak , current , std::memory_order_relaxed ) );
+}
+
+long long GetTrackedMemory( MemoryCategory category ){
+    return g_trackedMemory[(unsigned)category].load( std::memory_order_relaxed );
+}
+
+long long GetPeakTrackedMemory( MemoryCategory category ){
+    return g_peakTrackedMemory[(unsigned)category].load( std::memory_order_relaxed );
+}
+
+void SetMemoryBudget( MemoryCategory category , unsigned long long bytes ){
+    g_memoryBudget[(unsigned)category] = bytes;
+}
+
+unsigned long long GetMemoryBudgetLeft( MemoryCategory category ){
+    const auto budget = g_memoryBudget[(unsigned)category].load();
+    if( 0 == budget )
+        return ULLONG_MAX;
+    const auto used = GetTrackedMemory( category );
+    return used <= 0 ? budget : ( budget > (unsigned long long)used ? budget - (unsigned long long)used : 0 );
+}
+
+void RecordMemoryStats(){
+    SORT_STATS(sPeakAcceleratorMemory = (StatsInt)GetPeakTrackedMemory( MemoryCategory::Accelerator ));
+    SORT_STATS(sPeakGeometryMemory = (StatsInt)GetPeakTrackedMemory( MemoryCategory::Geometry ));
+    SORT_STATS(sPeakTextureMemory = (StatsInt)GetPeakTrackedMemory( MemoryCategory::Texture ));
+    SORT_STATS(sPeakVolumeMemory = (StatsInt)GetPeakTrackedMemory( MemoryCategory::Volume ));
+    SORT_STATS(sPeakMeasuredBxdfMemory = (StatsInt)GetPeakTrackedMemory( MemoryCategory::MeasuredBxdf ));
+    SORT_STATS(sPeakTaskGraphMemory = (StatsInt)GetPeakTrackedMemory( MemoryCategory::TaskGraph ));
+    SORT_STATS(sPeakThreadArenaMemory = (StatsInt)GetPeakTrackedMemory( MemoryCategory::ThreadArena ));
+}
+
+void SetHugePagePolicy( HugePagePolicy policy ){
+    g_hugePagePolicy = policy;
+}
+
+void* malloc_large( std::size_t size , unsigned int alignment ){
+    const auto policy = g_hugePagePolicy.load();
+    if( 0 == size || size < MEM_HUGE_PAGE_SIZE || HugePagePolicy::Off == policy || alignment > MEM_HUGE_PAGE_SIZE )
+        return malloc_aligned( size , alignment );
+
+    // the tail is rounded up to a whole huge page, otherwise the last part of the memory is on regular pages
+    const auto rounded = ( size + MEM_HUGE_PAGE_SIZE - 1 ) / MEM_HUGE_PAGE_SIZE * MEM_HUGE_PAGE_SIZE;
+
+    void* ret = nullptr;
+    if( HugePagePolicy::Explicit == policy )
+        ret = allocateExplicit( rounded );
+    if( IS_PTR_INVALID(ret) )
+        ret = allocateTransparent( rounded );
+
+    if( IS_PTR_INVALID(ret) ){
+        SORT_STATS(++sHugePageFallback);
+        return malloc_aligned( size , alignment );
+    }
+
+    SORT_STATS(sHugePageMemory += (StatsInt)rounded);
+    return ret;
+}
+
+void free_large( void* p ){
+    if( IS_PTR_INVALID(p) )
+        return;
+
+    if( g_explicitCnt.load() > 0 ){
+        std::size_t size = 0;
+        {
+            std::lock_guard<std::mutex> lock( g_explicitMutex );
+            auto it = g_explicitAllocations.find( p );
+            if( it != g_explicitAllocations.end() ){
+                size = it->second;
+                g_explicitAllocations.erase( it );
+                --g_explicitCnt;
+            }
+        }
+        if( size > 0 ){
+#if defined(SORT_IN_LINUX)
+            munmap( p , size );
+#elif defined(SORT_IN_WINDOWS)
+            VirtualFree( p , 0 , MEM_RELEASE );
+#endif
+            return;
+        }
+    }
+
+    // transparent huge pages are allocated with posix_memalign, which is what free_aligned releases too
+    free_aligned( p );
+}
+
+void* MemoryAllocator::allocateSlow( unsigned int size , unsigned int alignment ){
+    // large allocations and over-aligned ones don't fit in memory blocks
+    if( size > MEM_LARGE_ALLOCATION_SIZE || alignment > MEM_BLOCK_ALIGNMENT ){
+        auto ret = malloc_aligned( std::max( size , 1u ) , std::max( alignment , (unsigned int)sizeof(void*) ) );
+        m_largeAllocations.push_back( std::make_pair( ret , size ) );
+        m_consumedSize += size;
+        SORT_STATS(m_peakSize = std::max( m_peakSize , m_consumedSize + ( m_currentBlock < m_blocks.size() ? m_blocks[m_currentBlock]->m_start : 0 ) ));
+        TrackMemory( MemoryCategory::ThreadArena , size );
+        SORT_STATS(++sLargeMemoryAllocation);
+        return ret;
+    }
+
+    // move on to the next block that could hold the memory, blocks too small are skipped for this round
+    if( m_currentBlock < m_blocks.size() )
+        m_consumedSize += m_blocks[m_currentBlock]->m_start;
+    while( ++m_currentBlock < m_blocks.size() ){
+        if( size <= m_blocks[m_currentBlock]->m_size )
+            return Allocate( size , alignment );
+    }
+
+    // there is no block available, allocate a new one twice as large as the last one
+    auto block_size = m_blocks.empty() ? (unsigned int)MEM_BLOCK_SIZE : std::min( m_blocks.back()->m_size * 2 , (unsigned int)MEM_BLOCK_MAX_SIZE );
+    block_size = std::max( block_size , size );
+    m_blocks.push_back( std::make_unique<MemoryBlock>( block_size ) );
+    m_currentBlock = m_blocks.size() - 1;
+    return Allocate( size , alignment );
+}
+
+void MemoryAllocator::updatePeakUsage() const{
+#ifdef SORT_ENABLE_STATS_COLLECTION
+    sPeakMemoryPoolSize = std::max( sPeakMemoryPoolSize , (StatsInt)m_peakSize );
+#endif
+}
+
+void MemoryAllocator::rewindSlow( const Marker& marker ){
+    sAssert( marker.m_block <= m_currentBlock && marker.m_largeAllocationCnt <= m_largeAllocations.size() , MEMORY );
+
+    updatePeakUsage();
+
+    // blocks after the marked one are empty again, the ones consumed are not counted as used any more
+    for( auto i = marker.m_block ; i < m_currentBlock && i < m_blocks.size() ; ++i )
+        m_consumedSize -= m_blocks[i]->m_start;
+    for( auto i = marker.m_block + 1 ; i <= m_currentBlock && i < m_blocks.size() ; ++i )
+        m_blocks[i]->m_start = 0;
+    m_currentBlock = marker.m_block;
+    if( m_currentBlock < m_blocks.size() )
+        m_blocks[m_currentBlock]->m_start = marker.m_start;
+
+    // release large allocations after the marker
+    while( m_largeAllocations.size() > marker.m_largeAllocationCnt ){
+        m_consumedSize -= m_largeAllocations.back().second;
+        free_aligned( m_largeAllocations.back().first );
+        TrackMemory( MemoryCategory::ThreadArena , -(long long)m_largeAllocations.back().second );
+        m_largeAllocations.pop_back();
+    }
+}
+
+void MemoryAllocator::Reset(){
+    updatePeakUsage();
+
+    for( auto& block : m_blocks )
+        block->m_start = 0;
+    m_currentBlock = 0;
+    m_consumedSize = 0;
+
+    for( const auto& allocation : m_largeAllocations ){
+        free_aligned( allocation.first );
+        TrackMemory( MemoryCategory::ThreadArena , -(long long)allocation.second );
+    }
+    m_largeAllocations.clear();
+}
+
+MemoryAllocator::~MemoryAllocator(){
+    for( const auto& allocation : m_largeAllocations ){
+        free_aligned( allocation.first );
+        TrackMemory( MemoryCategory::ThreadArena , -(long long)allocation.second );
+    }
+}
+
+unsigned long long GetPeakResidentMemory(){
+#ifdef SORT_IN_WINDOWS
+    PROCESS_MEMORY_COUNTERS counters;
+    if( !K32GetProcessMemoryInfo( GetCurrentProcess() , &counters , sizeof( counters ) ) )
+        return 0;
+    return (unsigned long long)counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if( 0 != getrusage( RUSAGE_SELF , &usage ) )
+        return 0;
+    #ifdef SORT_IN_MAC
+        return (unsigned long long)usage.ru_maxrss;
+    #else
+        // it is in kilobytes on Linux
+        return (unsigned long long)usage.ru_maxrss * 1024ull;
+    #endif
+#endif
+}
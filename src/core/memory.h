@@ -17,21 +17,227 @@
 
 #pragma once
 
-#include <list>
+#include <vector>
 #include <memory>
+#include <algorithm>
+#include <type_traits>
 #include "core/sassert.h"
+#include "core/stats.h"
+#include "core/workercontext.h"
 
-// 32KB memory for each memory block by default.
+// 32KB memory for the first memory block by default.
 #define MEM_BLOCK_SIZE                  32768
-// Memory alignment size
+// Blocks grow geometrically until they reach this size.
+#define MEM_BLOCK_MAX_SIZE              ( 1024 * 1024 )
+// Allocations larger than this don't go through memory blocks.
+#define MEM_LARGE_ALLOCATION_SIZE       ( MEM_BLOCK_MAX_SIZE / 4 )
+// Minimum memory alignment size
 #define MEM_ALIGN_SIZE                  4u
-#define MEM_SIZE_ALIGNED(s)             (((s+MEM_ALIGN_SIZE-1)/MEM_ALIGN_SIZE) * MEM_ALIGN_SIZE)
+// Alignment of the memory blocks, it is also the maximum alignment memory blocks could respect.
+#define MEM_BLOCK_ALIGNMENT             64u
+// Size of huge pages, allocations smaller than this never go to huge pages.
+#define MEM_HUGE_PAGE_SIZE              ( 2u * 1024u * 1024u )
+
+//! @brief  A helper utility function that allocate memory with alignment.
+//!
+//! @param size         The size of the memory to be allocated.
+//! @param alignment    The bytes to be aligned.
+//! @return             The returned pointer pointing to allocated memory.
+SORT_FORCEINLINE void* malloc_aligned( std::size_t size , unsigned int alignment ){
+    void* ret = nullptr;
+    if( 0 == size )
+        return ret;
+
+#ifdef SORT_IN_WINDOWS
+    ret = _aligned_malloc( size , alignment );
+#else
+    if( 0 != posix_memalign( &ret , alignment , size ) )
+        return nullptr;
+#endif
+
+    sAssert( ( ((uintptr_t)ret) & (alignment-1) ) == 0 , MEMORY );
+    
+    return ret;
+}
+
+//! @brief  A helper function that frees the memory allocated with the interface defined above.
+//!
+//! @param  p           The address of memory allocated.
+SORT_FORCEINLINE void free_aligned( void* p ){
+    if( p ){
+#ifdef SORT_IN_WINDOWS
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+    }
+}
+
+//! @brief  How large read-mostly allocations are placed in memory.
+enum class HugePagePolicy{
+    Off,            /**< Regular pages, it is the same as malloc_aligned. */
+    Transparent,    /**< Transparent huge pages, the OS backs the memory with huge pages when it can. */
+    Explicit,       /**< Huge pages reserved by the OS, it falls back to transparent huge pages if there is none left. */
+};
+
+//! @brief  Set the policy of allocations through malloc_large, it is transparent huge pages by default.
+//!
+//! @param  policy      The policy of later allocations, memory already allocated is not touched.
+void    SetHugePagePolicy( HugePagePolicy policy );
+
+//! @brief  Allocate memory for large structures that are mostly read once built.
+//!
+//! Random access across a structure of gigabytes, like traversing the nodes of a BVH, misses the TLB all the time with
+//! regular pages. Allocations of at least one huge page are placed on huge pages depending on the policy, each TLB entry
+//! then covers 512 times as much memory. Transparent huge pages are only available on Linux, explicit huge pages are
+//! available on Linux and on Windows with the 'Lock pages in memory' privilege. It falls back to regular pages if huge
+//! pages are not available, whatever happens is reported in the stats.
+//!
+//! @param  size        The size of the memory to be allocated.
+//! @param  alignment   The bytes to be aligned.
+//! @return             The pointer pointing to allocated memory, it needs to be freed with free_large.
+void*   malloc_large( std::size_t size , unsigned int alignment );
+
+//! @brief  Free the memory allocated with malloc_large.
+//!
+//! @param  p           The address of memory allocated.
+void    free_large( void* p );
+
+//! @brief  Deleter of arrays allocated through malloc_large.
+struct LargeArrayDeallocator{
+    void operator()( void* p ){
+        free_large( p );
+    }
+};
+
+template<class T>
+using LargeArray = std::unique_ptr<T[],LargeArrayDeallocator>;
+
+//! @brief  Allocate an array of value initialized elements through malloc_large.
+//!
+//! Elements are never destructed, only trivially destructible types are allowed.
+//!
+//! @param  cnt         Number of elements in the array.
+//! @return             The array allocated.
+template<class T>
+LargeArray<T> make_large_array( std::size_t cnt ){
+    static_assert( std::is_trivially_destructible<T>::value , "Elements of large arrays are never destructed." );
+    auto* ret = (T*)malloc_large( sizeof(T) * cnt , std::max( (unsigned int)alignof(T) , (unsigned int)sizeof(void*) ) );
+    for( std::size_t i = 0 ; i < cnt && ret ; ++i )
+        new ( ret + i ) T();
+    return LargeArray<T>( ret );
+}
+
+//! @brief  Subsystems whose memory is accounted separately.
+enum class MemoryCategory{
+    Accelerator,    /**< Nodes and primitives of spatial acceleration structures. */
+    Geometry,       /**< Vertices and indices of meshes. */
+    Texture,        /**< Texels of image textures. */
+    Volume,         /**< Voxels of volumes. */
+    MeasuredBxdf,   /**< Tables of measured BRDFs, MERL and Fourier. */
+    TaskGraph,      /**< Memory of tasks in the scheduler. */
+    ThreadArena,    /**< Memory blocks of per-thread allocators. */
+    Count
+};
+
+//! @brief  Record memory allocated or released by a subsystem.
+//!
+//! It is thread safe, the current usage and the high-water mark of each category are kept.
+//!
+//! @param  category    The subsystem owning the memory.
+//! @param  bytes       Bytes allocated, it is negative if memory is released.
+void    TrackMemory( MemoryCategory category , long long bytes );
+
+//! @brief  Memory currently used by a subsystem.
+//!
+//! @param  category    The subsystem.
+//! @return             Bytes currently used.
+long long   GetTrackedMemory( MemoryCategory category );
+
+//! @brief  Peak memory used by a subsystem so far.
+//!
+//! @param  category    The subsystem.
+//! @return             The high-water mark in bytes.
+long long   GetPeakTrackedMemory( MemoryCategory category );
+
+//! @brief  Set the memory budget of a subsystem.
+//!
+//! Budgets are not enforced by the allocation itself, subsystems that could degrade query how much is left before
+//! committing to large allocations, e.g. textures are loaded at a lower resolution.
+//!
+//! @param  category    The subsystem.
+//! @param  bytes       The budget in bytes, 0 means unlimited.
+void    SetMemoryBudget( MemoryCategory category , unsigned long long bytes );
+
+//! @brief  Memory a subsystem could still allocate within its budget.
+//!
+//! @param  category    The subsystem.
+//! @return             Bytes left in the budget, it is never negative. It is the largest value if there is no budget.
+unsigned long long  GetMemoryBudgetLeft( MemoryCategory category );
+
+//! @brief  Record the high-water marks of all subsystems in the stats.
+//!
+//! Stats are merged from all threads at the end, this is supposed to be called once on the main thread before exiting.
+void    RecordMemoryStats();
+
+//! @brief  Memory of an object accounted in a subsystem, it is released once the object is destroyed.
+/**
+ * It is meant to be a member of the object owning the memory. A copy of the object doesn't own the memory of the
+ * original one until it updates the size itself.
+ */
+class TrackedMemory{
+public:
+    //! @brief  Constructor.
+    //!
+    //! @param  category    The subsystem owning the memory.
+    explicit TrackedMemory( MemoryCategory category ) : m_category( category ) {}
+
+    TrackedMemory( const TrackedMemory& other ) : m_category( other.m_category ) {}
+
+    TrackedMemory& operator = ( const TrackedMemory& other ){
+        Set( 0 );
+        m_category = other.m_category;
+        return *this;
+    }
+
+    //! @brief  Destructor releasing the memory from the subsystem.
+    ~TrackedMemory(){
+        Set( 0 );
+    }
+
+    //! @brief  Update the memory owned by the object.
+    //!
+    //! @param  bytes       The total bytes owned by the object now.
+    void Set( std::size_t bytes ){
+        TrackMemory( m_category , (long long)bytes - (long long)m_bytes );
+        m_bytes = bytes;
+    }
+
+private:
+    MemoryCategory  m_category;     /**< The subsystem owning the memory. */
+    std::size_t     m_bytes = 0;    /**< Bytes owned by the object. */
+};
 
 //! @brief  Memory block allocated in MemoryAllocator.
 class MemoryBlock {
 public:
+    //! @brief  Constructor allocating the memory of the block.
+    //!
+    //! @param  size    Size of the memory block in bytes.
+    explicit MemoryBlock( unsigned int size ) : m_data( (char*)malloc_aligned( size , MEM_BLOCK_ALIGNMENT ) ) , m_size( size ) {
+        TrackMemory( MemoryCategory::ThreadArena , size );
+    }
+
+    //! @brief  Destructor releasing the memory of the block.
+    ~MemoryBlock(){
+        free_aligned( m_data );
+        TrackMemory( MemoryCategory::ThreadArena , -(long long)m_size );
+    }
+
     /**< Real data of the memory block. */
-    std::unique_ptr<char[]> m_data = std::make_unique<char[]>(MEM_BLOCK_SIZE);
+    char*                   m_data = nullptr;
+    /**< Size of the memory block. */
+    unsigned int            m_size = 0;
     /**< Current position of available memory. */
     unsigned int            m_start = 0;
 };
@@ -46,6 +252,10 @@ public:
  * memory protected by std::unique_ptrs, there is still a possibility for it to leak memory if
  * a std::unique_ptr is allocated through this memory allocator. It is up to the higher level
  * code to make sure it doesn't happen.
+ *
+ * Memory blocks grow geometrically so that deep paths don't keep allocating small blocks, very
+ * large allocations are served separately and released in the next reset. Every allocation
+ * respects the alignment of the type, including SIMD data.
  */
 class MemoryAllocator {
 public:
@@ -55,83 +265,134 @@ public:
     //! @return         The pointer pointing to memory that could hold the instance(s).
     template<class T>
     T*  Allocate(unsigned int cnt = 1u) {
-        unsigned int size_to_allocate = (unsigned int)(sizeof(T) * cnt);
-        sAssert( size_to_allocate <= MEM_BLOCK_SIZE , MEMORY );
-        MemoryBlock* currentBlock = m_availableBlocks.size() ? m_availableBlocks.front().get() : nullptr;
-        if (IS_PTR_INVALID(currentBlock) || (currentBlock->m_start + size_to_allocate > MEM_BLOCK_SIZE)) {
-            if (currentBlock) {
-                auto block = std::move(m_availableBlocks.front());
-                m_availableBlocks.pop_front();
-                m_usedBlocks.push_back(std::move(block));
+        return (T*)Allocate( (unsigned int)(sizeof(T) * cnt) , std::max( (unsigned int)alignof(T) , MEM_ALIGN_SIZE ) );
+    }
+
+    //! @brief  Allocate raw memory from memory pool.
+    //!
+    //! @param  size        Size of the memory in bytes.
+    //! @param  alignment   Alignment of the memory, it needs to be power of two.
+    //! @return             The pointer pointing to the allocated memory.
+    SORT_FORCEINLINE void* Allocate( unsigned int size , unsigned int alignment ) {
+        sAssert( ( alignment & ( alignment - 1 ) ) == 0 , MEMORY );
+        if( m_currentBlock < m_blocks.size() && alignment <= MEM_BLOCK_ALIGNMENT ){
+            auto& block = *m_blocks[m_currentBlock];
+            const auto start = ( block.m_start + alignment - 1 ) & ~( alignment - 1 );
+            if( start + size <= block.m_size ){
+                block.m_start = start + size;
+                SORT_STATS(m_peakSize = std::max( m_peakSize , m_consumedSize + block.m_start ));
+                return block.m_data + start;
             }
+        }
+        return allocateSlow( size , alignment );
+    }
+
+    //! @brief  Watermark of the memory allocator.
+    struct Marker{
+        size_t          m_block = 0;            /**< Index of the block being used. */
+        unsigned int    m_start = 0;            /**< Position of available memory in the block. */
+        size_t          m_largeAllocationCnt = 0;   /**< Number of large allocations. */
+    };
 
-            if( m_availableBlocks.empty() )
-                m_availableBlocks.push_front(std::make_unique<MemoryBlock>());
-            currentBlock = m_availableBlocks.front().get();
+    //! @brief  Get the current watermark of the allocator.
+    //!
+    //! @return         The watermark to rewind to later.
+    SORT_FORCEINLINE Marker GetMarker() const {
+        Marker marker;
+        marker.m_block = m_currentBlock;
+        marker.m_start = m_currentBlock < m_blocks.size() ? m_blocks[m_currentBlock]->m_start : 0;
+        marker.m_largeAllocationCnt = m_largeAllocations.size();
+        return marker;
+    }
+
+    //! @brief  Release all memory allocated after the watermark.
+    //!
+    //! Markers need to be rewound in the reverse order they are taken. It only touches the blocks consumed
+    //! after the marker, which makes it O(1) in most cases.
+    //!
+    //! @param  marker  The watermark taken earlier.
+    SORT_FORCEINLINE void Rewind( const Marker& marker ) {
+        if( m_currentBlock == marker.m_block && m_largeAllocations.size() == marker.m_largeAllocationCnt ){
+            if( m_currentBlock < m_blocks.size() )
+                m_blocks[m_currentBlock]->m_start = marker.m_start;
+            return;
         }
-        auto ret = currentBlock->m_data.get() + currentBlock->m_start;
-        currentBlock->m_start += MEM_SIZE_ALIGNED(size_to_allocate);
-        return (T*)ret;
+        rewindSlow( marker );
     }
 
     //! @brief  Reset the memory allocator.
-    void Reset() {
-        m_availableBlocks.splice(m_availableBlocks.begin(), m_usedBlocks);
-        for (auto& block : m_availableBlocks)
-            block->m_start = 0;
-    }
+    //!
+    //! All memory blocks are kept for later allocations, large allocations are released.
+    void Reset();
+
+    //! @brief  Destructor releasing large allocations.
+    ~MemoryAllocator();
 
 private:
-    /**< Currently availably blocks, the front one is the one being used. */
-    std::list<std::unique_ptr<MemoryBlock>>  m_availableBlocks;
-    /**< Blocks that has been consumed. */
-    std::list<std::unique_ptr<MemoryBlock>>  m_usedBlocks;
+    /**< Memory blocks, the ones before the current one are consumed. */
+    std::vector<std::unique_ptr<MemoryBlock>>   m_blocks;
+    /**< Index of the block being used. */
+    size_t                                      m_currentBlock = 0;
+    /**< Large allocations not going through memory blocks, along with their sizes. */
+    std::vector<std::pair<void*,unsigned int>>  m_largeAllocations;
+    /**< Memory used by the blocks before the current one and large allocations. */
+    unsigned long long                          m_consumedSize = 0;
+    /**< High-water mark of the memory used, it is only tracked with stats enabled. */
+    unsigned long long                          m_peakSize = 0;
+
+    //! @brief  Allocate memory when the current block can't hold it.
+    void* allocateSlow( unsigned int size , unsigned int alignment );
+
+    //! @brief  Rewind the allocator when more than the current block is consumed since the marker.
+    void rewindSlow( const Marker& marker );
+
+    //! @brief  Record the high-water mark tracked so far in the stats.
+    void updatePeakUsage() const;
 };
 
+//! @brief  Peak physical memory used by the process so far.
+//!
+//! @return Peak resident set size in bytes, 0 if it is not available on the platform.
+unsigned long long GetPeakResidentMemory();
+
 //! @brief Get static allocator.
 //!
 //! @return Thread based memory allocator.
 SORT_FORCEINLINE ::MemoryAllocator& GetStaticAllocator() {
-    // Each thread has their own memory allocator.
-    static thread_local ::MemoryAllocator memoryAllocator;
-    return memoryAllocator;
+    // Each thread has their own memory allocator, it lives in the context of the thread.
+    return *GetWorkerContext().allocator;
 }
 
-#define SORT_MALLOC(T)              new (GetStaticAllocator().Allocate<T>()) T
-#define SORT_MALLOC_ARRAY(T,cnt)    new (GetStaticAllocator().Allocate<T>(cnt)) T
-#define SORT_CLEAR_MEMPOOL()        GetStaticAllocator().Reset()
+//! @brief  MemoryScope releases all memory allocated during its life time.
+/**
+ * The watermark of the allocator is taken when the scope is created and rewound when it is destroyed.
+ * Scopes could be nested, e.g. a sample scope could have nested scopes for evaluating probe rays.
+ * Nothing allocated inside the scope should outlive it.
+ */
+class MemoryScope {
+public:
+    //! @brief  Constructor taking the watermark of the allocator.
+    //!
+    //! @param  allocator   The memory allocator to be rewound.
+    explicit MemoryScope( MemoryAllocator& allocator = GetStaticAllocator() ) : m_allocator( allocator ) , m_marker( allocator.GetMarker() ) {}
 
-//! @brief  A helper utility function that allocate memory with alignment.
-//!
-//! @param size         The size of the memory to be allocated.
-//! @param alignment    The bytes to be aligned.
-//! @return             The returned pointer pointing to allocated memory.
-SORT_FORCEINLINE void* malloc_aligned( unsigned int size , unsigned int alignment ){
-    void* ret = nullptr;
-    if( 0 == size )
-        return ret;
+    //! @brief  Destructor releasing the memory allocated during the scope.
+    ~MemoryScope(){
+        m_allocator.Rewind( m_marker );
+    }
 
-#ifdef SORT_IN_WINDOWS
-    ret = _aligned_malloc( size , alignment );
-#else
-    if( 0 != posix_memalign( &ret , alignment , size ) )
-        return nullptr;
-#endif
+    MemoryScope( const MemoryScope& ) = delete;
+    MemoryScope& operator = ( const MemoryScope& ) = delete;
 
-    sAssert( ( ((uintptr_t)ret) & (alignment-1) ) == 0 , MEMORY );
-    
-    return ret;
-}
+private:
+    MemoryAllocator&                m_allocator;    /**< The allocator to be rewound. */
+    const MemoryAllocator::Marker   m_marker;       /**< Watermark when the scope is created. */
+};
 
-//! @brief  A helper function that frees the memory allocated with the interface defined above.
-//!
-//! @param  p           The address of memory allocated.
-SORT_FORCEINLINE void free_aligned( void* p ){
-    if( p ){
-#ifdef SORT_IN_WINDOWS
-        _aligned_free(p);
-#else
-        free(p);
-#endif
-    }
-}
\ No newline at end of file
+#define SORT_MEMORY_SCOPE_NAME_PROXY(v0, v1)    v0 ## v1
+#define SORT_MEMORY_SCOPE_NAME(v0, v1)          SORT_MEMORY_SCOPE_NAME_PROXY(v0, v1)
+
+#define SORT_MALLOC(T)              new (GetStaticAllocator().Allocate<T>()) T
+#define SORT_MALLOC_ARRAY(T,cnt)    new (GetStaticAllocator().Allocate<T>(cnt)) T
+#define SORT_CLEAR_MEMPOOL()        GetStaticAllocator().Reset()
+#define SORT_MEMORY_SCOPE()         MemoryScope SORT_MEMORY_SCOPE_NAME(sort_memory_scope_, __LINE__)
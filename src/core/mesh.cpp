@@ -15,6 +15,8 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <string.h>
+#include <unordered_map>
 #include "mesh.h"
 #include "entity/visual.h"
 #include "stream/stream.h"
@@ -22,56 +24,357 @@
 #include "entity/entity.h"
 #include "stream/stream.h"
 #include "scatteringevent/bsdf/bxdf_utils.h"
+#include "core/hash.h"
+#include "task/task.h"
+#include "core/stats.h"
+#include "accel/bvh_utils.h"
 
-void Mesh::ApplyTransform( const Transform& transform ){
-    for (MeshVertex& mv : m_vertices) {
-        mv.m_position = transform.TransformPoint(mv.m_position);
-        mv.m_normal = transform.TransformNormal((mv.m_normal).Normalize());
-
-        // Warning this function seems to cause quite some trouble on MacOS during the first renderer somehow.
-        // And this problem only exists on MacOS not the other two OS.
-        // Since there is not a low hanging fruit solution for now, it is disabled by default
-        // generate tangent if there is UV, there seems to always be true in Blender 2.8, but not in 2.7x
-        //if(m_hasUV)
-        //    mv.m_tangent = transform(mv.m_tangent).Normalize();
+SORT_STATS_DEFINE_COUNTER(sDegenerateTriangleCount)
+SORT_STATS_DEFINE_COUNTER(sWeldedVertexCount)
+
+SORT_STATS_COUNTER("Mesh", "Degenerate Triangles Dropped", sDegenerateTriangleCount);
+SORT_STATS_COUNTER("Mesh", "Vertices Welded", sWeldedVertexCount);
+
+// Vertices and faces are processed in chunks of this size in parallel, small meshes are done in one go.
+static constexpr unsigned MESH_PARALLEL_GRAIN = 16384;
+
+// Cells of mesh simplification are keyed by 21 bits along each axis.
+static constexpr unsigned MESH_CELL_MASK = ( 1u << 21 ) - 1;
+
+// Hashes of preprocessed meshes are salted with it, they don't match the ones of the meshes streamed in.
+static constexpr std::uint64_t MESH_PREPROCESS_TAG = 0x9e3779b97f4a7c15ull;
+
+namespace {
+    static_assert( sizeof( Point ) == 3 * sizeof( float ) , "Positions are loaded as a raw array of floats." );
+    static_assert( sizeof( Vector ) == 3 * sizeof( float ) , "Normals are loaded as a raw array of floats." );
+    static_assert( sizeof( Vector2f ) == 2 * sizeof( float ) , "Texture coordinates are loaded as a raw array of floats." );
+
+    // Get the address of an array in the stream, it points to the stream directly if it is backed by memory.
+    const char* fetchArray( IStreamBase& stream , const std::size_t size , std::vector<char>& cache ){
+        if( const auto data = stream.Fetch( size ) )
+            return data;
+        cache.resize( size );
+        stream.LoadBulk( cache.data() , size );
+        return cache.data();
     }
+}
+
+void Mesh::ApplyTransform( const Transform& transform ){
+    ParallelFor(0u, (unsigned)m_positions.size(), MESH_PARALLEL_GRAIN, [&](unsigned s, unsigned e) {
+        transform.TransformPoints(m_positions.data() + s, e - s);
+    });
+    ParallelFor(0u, (unsigned)m_vertices.size(), MESH_PARALLEL_GRAIN, [&](unsigned s, unsigned e) {
+        for (auto i = s; i < e; ++i) {
+            m_vertices[i].m_normal.Normalize();
+
+            // Warning this function seems to cause quite some trouble on MacOS during the first renderer somehow.
+            // And this problem only exists on MacOS not the other two OS.
+            // Since there is not a low hanging fruit solution for now, it is disabled by default
+            // generate tangent if there is UV, there seems to always be true in Blender 2.8, but not in 2.7x
+            //if(m_hasUV)
+            //    mv.m_tangent = transform(mv.m_tangent).Normalize();
+        }
+        transform.TransformNormals(&m_vertices[s].m_normal, e - s, sizeof(MeshVertex));
+    });
 
     m_world2Volume = m_local2Volume * transform.invMatrix;
+    if (!m_world2Volume.Inverse(m_volume2World))
+        m_volume2World = Matrix();
 }
 
 void Mesh::GenSmoothTagent(){
+    const auto vertex_cnt = (unsigned)m_vertices.size();
+    const auto face_cnt = (unsigned)m_indices.size();
+
     // generate tangent for each triangle
-    std::vector<std::vector<Vector>> tangent(m_vertices.size());
-    for (auto mi : m_indices) {
-        const auto t = genTagentForTri(mi);
+    std::vector<Vector> face_tangents(face_cnt);
+    ParallelFor(0u, face_cnt, MESH_PARALLEL_GRAIN, [&](unsigned s, unsigned e) {
+        for (auto i = s; i < e; ++i)
+            face_tangents[i] = genTagentForTri(m_indices[i]);
+    });
 
-        tangent[mi.m_id[0]].push_back(t);
-        tangent[mi.m_id[1]].push_back(t);
-        tangent[mi.m_id[2]].push_back(t);
-    }
-    for (auto i = 0u; i < m_vertices.size(); ++i) {
-        Vector t;
-        for (auto v : tangent[i])
-            t += v;
-        m_vertices[i].m_tangent = t.Normalize();
-    }
+    // Faces adjacent to each vertex in compressed rows, so that each vertex gathers the tangents of its own faces without
+    // any synchronization. Faces are listed in their original order, the sums are the same as accumulating them serially.
+    std::vector<unsigned> offsets(vertex_cnt + 1, 0);
+    for (const auto& mi : m_indices)
+        for (auto id : mi.m_id)
+            ++offsets[id + 1];
+    for (auto i = 0u; i < vertex_cnt; ++i)
+        offsets[i + 1] += offsets[i];
+    std::vector<unsigned> adjacent_faces(offsets[vertex_cnt]);
+    std::vector<unsigned> cursor(offsets.begin(), offsets.end() - 1);
+    for (auto i = 0u; i < face_cnt; ++i)
+        for (auto id : m_indices[i].m_id)
+            adjacent_faces[cursor[id]++] = i;
+
+    ParallelFor(0u, vertex_cnt, MESH_PARALLEL_GRAIN, [&](unsigned s, unsigned e) {
+        for (auto i = s; i < e; ++i) {
+            Vector t;
+            for (auto j = offsets[i]; j < offsets[i + 1]; ++j)
+                t += face_tangents[adjacent_faces[j]];
+            m_vertices[i].m_tangent = t.Normalize();
+        }
+    });
 }
 
 void Mesh::GenUV(){
-    if (m_hasUV || m_vertices.empty())
+    if (m_hasUV || m_positions.empty())
         return;
 
+    // partial sums of each chunk are added up in order, the center doesn't depend on the scheduling of the chunks
+    const auto vertex_cnt = (unsigned)m_positions.size();
+    std::vector<Point> partial_sums((vertex_cnt + MESH_PARALLEL_GRAIN - 1) / MESH_PARALLEL_GRAIN);
+    ParallelFor(0u, vertex_cnt, MESH_PARALLEL_GRAIN, [&](unsigned s, unsigned e) {
+        Point sum;
+        for (auto i = s; i < e; ++i)
+            sum = sum + m_positions[i];
+        partial_sums[s / MESH_PARALLEL_GRAIN] = sum;
+    });
+
     Point center;
-    for( const MeshVertex& mv : m_vertices )
-        center = center + mv.m_position;
-    center /= (float)m_vertices.size();
-
-    for (MeshVertex& mv : m_vertices) {
-        Vector diff = mv.m_position - center;
-        diff.Normalize();
-        mv.m_texCoord.x = sphericalTheta(diff) * INV_PI;
-        mv.m_texCoord.y = sphericalPhi(diff) * INV_TWOPI;
+    for( const auto& sum : partial_sums )
+        center = center + sum;
+    center /= (float)vertex_cnt;
+
+    ParallelFor(0u, vertex_cnt, MESH_PARALLEL_GRAIN, [&](unsigned s, unsigned e) {
+        for (auto i = s; i < e; ++i) {
+            Vector diff = m_positions[i] - center;
+            diff.Normalize();
+            m_vertices[i].m_texCoord.x = sphericalTheta(diff) * INV_PI;
+            m_vertices[i].m_texCoord.y = sphericalPhi(diff) * INV_TWOPI;
+        }
+    });
+}
+
+void Mesh::Compact(){
+    if (m_vertices.empty())
+        return;
+
+    m_compactVertices.resize(m_vertices.size());
+    ParallelFor(0u, (unsigned)m_vertices.size(), MESH_PARALLEL_GRAIN, [&](unsigned s, unsigned e) {
+        for (auto i = s; i < e; ++i) {
+            const auto& mv = m_vertices[i];
+            auto& cv = m_compactVertices[i];
+            cv.m_normal = encodeOctahedral(mv.m_normal);
+            cv.m_tangent = encodeOctahedral(mv.m_tangent);
+            cv.m_texCoord[0] = floatToHalf(mv.m_texCoord.x);
+            cv.m_texCoord[1] = floatToHalf(mv.m_texCoord.y);
+        }
+    });
+
+    // release the memory, clearing the vector doesn't
+    std::vector<MeshVertex>().swap(m_vertices);
+    updateMemory();
+}
+
+void Mesh::Expand(){
+    if (!IsCompact())
+        return;
+
+    m_vertices.resize(m_compactVertices.size());
+    ParallelFor(0u, (unsigned)m_vertices.size(), MESH_PARALLEL_GRAIN, [&](unsigned s, unsigned e) {
+        for (auto i = s; i < e; ++i)
+            m_vertices[i] = m_compactVertices[i].Decode();
+    });
+    std::vector<CompactMeshVertex>().swap(m_compactVertices);
+    updateMemory();
+}
+
+bool Mesh::Simplify(float cell_size){
+    if (cell_size <= 0.0f || m_positions.empty())
+        return false;
+
+    BBox bbox;
+    for (const auto& position : m_positions)
+        bbox.Union(position);
+
+    // assign vertices to cells first, there is no point touching anything else if the mesh is hardly reduced
+    const auto inv_cell_size = 1.0f / cell_size;
+    const auto vertex_cnt = (unsigned)m_positions.size();
+    std::unordered_map<std::uint64_t, unsigned> cells;
+    std::vector<unsigned> remap(vertex_cnt);
+    for (auto i = 0u; i < vertex_cnt; ++i) {
+        const auto d = (m_positions[i] - bbox.m_Min) * inv_cell_size;
+        const auto cell = [](float v) { return std::min((std::uint64_t)v, (std::uint64_t)MESH_CELL_MASK); };
+        const auto key = cell(d.x) | (cell(d.y) << 21) | (cell(d.z) << 42);
+        remap[i] = cells.emplace(key, (unsigned)cells.size()).first->second;
+    }
+    const auto cell_cnt = (unsigned)cells.size();
+    if (cell_cnt * 2 > vertex_cnt)
+        return false;
+
+    Expand();
+
+    std::vector<Vector> position_sum(cell_cnt);
+    std::vector<unsigned> counts(cell_cnt, 0);
+    std::vector<MeshVertex> vertices(cell_cnt);
+    for (auto i = 0u; i < vertex_cnt; ++i) {
+        const auto c = remap[i];
+        position_sum[c] += Vector(m_positions[i].x, m_positions[i].y, m_positions[i].z);
+        if (0 == counts[c]++) {
+            vertices[c] = m_vertices[i];
+        } else {
+            vertices[c].m_normal += m_vertices[i].m_normal;
+        }
     }
+
+    std::vector<Point> positions(cell_cnt);
+    for (auto c = 0u; c < cell_cnt; ++c) {
+        const auto p = position_sum[c] / (float)counts[c];
+        positions[c] = Point(p.x, p.y, p.z);
+        if (vertices[c].m_normal.SquaredLength() > 0.0f)
+            vertices[c].m_normal = normalize(vertices[c].m_normal);
+    }
+
+    std::vector<MeshFaceIndex> indices;
+    indices.reserve(m_indices.size());
+    for (const auto& mi : m_indices) {
+        MeshFaceIndex index = mi;
+        for (auto k = 0; k < 3; ++k)
+            index.m_id[k] = (int)remap[mi.m_id[k]];
+        if (index.m_id[0] != index.m_id[1] && index.m_id[1] != index.m_id[2] && index.m_id[2] != index.m_id[0])
+            indices.push_back(index);
+    }
+
+    m_positions.swap(positions);
+    m_vertices.swap(vertices);
+    m_indices.swap(indices);
+
+    // the simplified mesh is the same as long as the source and the cells are the same
+    m_topologyHash = HashValue(cell_size, m_topologyHash);
+    m_geometryHash = HashValue(cell_size, m_geometryHash);
+
+    updateMemory();
+    return true;
+}
+
+bool Mesh::Preprocess(){
+    if (m_positions.empty() || m_indices.empty())
+        return false;
+
+    Expand();
+
+    // Triangles with zero area are never hit, they only take space in leaves. Triangles with duplicated indices have
+    // zero area too.
+    const auto face_cnt = (unsigned)m_indices.size();
+    std::vector<unsigned char> valid(face_cnt);
+    ParallelFor(0u, face_cnt, MESH_PARALLEL_GRAIN, [&](unsigned s, unsigned e) {
+        for (auto i = s; i < e; ++i) {
+            const auto& p0 = m_positions[m_indices[i].m_id[0]];
+            const auto& p1 = m_positions[m_indices[i].m_id[1]];
+            const auto& p2 = m_positions[m_indices[i].m_id[2]];
+            valid[i] = cross(p1 - p0, p2 - p0).SquaredLength() > 0.0f;
+        }
+    });
+
+    // only vertices of the remaining triangles are kept
+    const auto vertex_cnt = (unsigned)m_positions.size();
+    std::vector<unsigned char> referenced(vertex_cnt, 0);
+    for (auto i = 0u; i < face_cnt; ++i)
+        if (valid[i])
+            for (auto id : m_indices[i].m_id)
+                referenced[id] = 1;
+
+    BBox bbox;
+    for (auto i = 0u; i < vertex_cnt; ++i)
+        if (referenced[i])
+            bbox.Union(m_positions[i]);
+
+    const auto scale = (float)((1u << BVH_MORTON_BITS_PER_AXIS) - 1);
+    Vector inv_extent;
+    for (auto k = 0; k < 3; ++k)
+        inv_extent[k] = bbox.Delta(k) > 0.0f ? scale / bbox.Delta(k) : 0.0f;
+    const auto morton_code = [&](const Point& position) {
+        const auto p = position - bbox.m_Min;
+        const auto quantize = [&](int k) { return expandMortonBits(std::min((unsigned)std::max(p[k] * inv_extent[k], 0.0f), (1u << BVH_MORTON_BITS_PER_AXIS) - 1)); };
+        return (quantize(0) << 2) | (quantize(1) << 1) | quantize(2);
+    };
+
+    std::vector<unsigned> codes(vertex_cnt);
+    ParallelFor(0u, vertex_cnt, MESH_PARALLEL_GRAIN, [&](unsigned s, unsigned e) {
+        for (auto i = s; i < e; ++i)
+            codes[i] = morton_code(m_positions[i]);
+    });
+
+    // Vertices are sorted by their Morton codes first and then by the bits of their attributes, identical vertices end
+    // up next to each other. Ties are broken by the indices so that the order doesn't depend on the sorting algorithm.
+    std::vector<unsigned> order;
+    order.reserve(vertex_cnt);
+    for (auto i = 0u; i < vertex_cnt; ++i)
+        if (referenced[i])
+            order.push_back(i);
+    const auto compare = [&](unsigned a, unsigned b) {
+        if (codes[a] != codes[b])
+            return codes[a] < codes[b] ? -1 : 1;
+        if (const auto c = memcmp(&m_positions[a], &m_positions[b], sizeof(Point)))
+            return c;
+        if (const auto c = memcmp(&m_vertices[a].m_normal, &m_vertices[b].m_normal, sizeof(Vector)))
+            return c;
+        return memcmp(&m_vertices[a].m_texCoord, &m_vertices[b].m_texCoord, sizeof(Vector2f));
+    };
+    std::sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+        const auto c = compare(a, b);
+        return c != 0 ? c < 0 : a < b;
+    });
+
+    std::vector<int> remap(vertex_cnt, -1);
+    std::vector<Point> positions;
+    std::vector<MeshVertex> vertices;
+    positions.reserve(order.size());
+    vertices.reserve(order.size());
+    for (auto i = 0u; i < order.size(); ++i) {
+        const auto v = order[i];
+        if (i == 0 || compare(order[i - 1], v) != 0) {
+            positions.push_back(m_positions[v]);
+            vertices.push_back(m_vertices[v]);
+        }
+        remap[v] = (int)positions.size() - 1;
+    }
+
+    // triangles are sorted by the Morton codes of their centroids, with the same ties breaking rule
+    std::vector<std::uint64_t> keys;
+    keys.reserve(face_cnt);
+    for (auto i = 0u; i < face_cnt; ++i)
+        if (valid[i])
+            keys.push_back(i);
+    ParallelFor(0u, (unsigned)keys.size(), MESH_PARALLEL_GRAIN, [&](unsigned s, unsigned e) {
+        for (auto i = s; i < e; ++i) {
+            const auto& mi = m_indices[keys[i]];
+            const auto centroid = (m_positions[mi.m_id[0]] + m_positions[mi.m_id[1]] + m_positions[mi.m_id[2]]) / 3.0f;
+            keys[i] |= (std::uint64_t)morton_code(centroid) << 32;
+        }
+    });
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<MeshFaceIndex> indices(keys.size());
+    ParallelFor(0u, (unsigned)keys.size(), MESH_PARALLEL_GRAIN, [&](unsigned s, unsigned e) {
+        for (auto i = s; i < e; ++i) {
+            indices[i] = m_indices[(unsigned)keys[i]];
+            for (auto& id : indices[i].m_id)
+                id = remap[id];
+        }
+    });
+
+    const auto dropped_cnt = face_cnt - (unsigned)indices.size();
+    const auto welded_cnt = (unsigned)(order.size() - positions.size());
+    SORT_STATS(sDegenerateTriangleCount += (StatsInt)dropped_cnt);
+    SORT_STATS(sWeldedVertexCount += (StatsInt)welded_cnt);
+
+    m_positions.swap(positions);
+    m_vertices.swap(vertices);
+    m_indices.swap(indices);
+
+    // the order of triangles differs from the one streamed in, cached acceleration structures of it don't fit
+    m_topologyHash = HashValue(MESH_PREPROCESS_TAG, m_topologyHash);
+    m_geometryHash = HashValue(MESH_PREPROCESS_TAG, m_geometryHash);
+
+    updateMemory();
+    return dropped_cnt > 0 || welded_cnt > 0;
+}
+
+void Mesh::updateMemory(){
+    m_memory.Set( sizeof(Point) * m_positions.capacity() + sizeof(MeshVertex) * m_vertices.capacity() +
+                  sizeof(CompactMeshVertex) * m_compactVertices.capacity() + sizeof(MeshFaceIndex) * m_indices.capacity() );
 }
 
 Vector Mesh::genTagentForTri( const MeshFaceIndex& mi ) const{
@@ -80,9 +383,9 @@ Vector Mesh::genTagentForTri( const MeshFaceIndex& mi ) const{
     const auto& _v2 = m_vertices[mi.m_id[2]];
 
     // get three vertexes
-    const auto& p0 = _v0.m_position ;
-    const auto& p1 = _v1.m_position ;
-    const auto& p2 = _v2.m_position ;
+    const auto& p0 = m_positions[mi.m_id[0]];
+    const auto& p1 = m_positions[mi.m_id[1]];
+    const auto& p2 = m_positions[mi.m_id[2]];
 
     const auto u0 = _v0.m_texCoord.x;
     const auto u1 = _v1.m_texCoord.x;
@@ -112,20 +415,42 @@ void Mesh::Serialize(IStreamBase& stream) {
     stream >> m_hasUV;
     unsigned int vb_cnt, ib_cnt;
     stream >> vb_cnt;
+    m_positions.resize(vb_cnt);
     m_vertices.resize(vb_cnt);
-    for (MeshVertex& mv : m_vertices)
-        stream >> mv.m_position >> mv.m_normal >> mv.m_texCoord;
+
+    // Vertex attributes come in separate arrays. Positions have the same layout in memory and are loaded in one go,
+    // the other attributes are scattered into the vertices straight from the stream if it is memory mapped.
+    std::vector<char> cache;
+    stream.LoadBulk(reinterpret_cast<char*>(m_positions.data()), sizeof(Point) * vb_cnt);
+    const auto normals = fetchArray(stream, sizeof(Vector) * vb_cnt, cache);
+    for (auto i = 0u; i < vb_cnt; ++i)
+        memcpy(&m_vertices[i].m_normal, normals + sizeof(Vector) * i, sizeof(Vector));
+    const auto uvs = fetchArray(stream, sizeof(Vector2f) * vb_cnt, cache);
+    for (auto i = 0u; i < vb_cnt; ++i)
+        memcpy(&m_vertices[i].m_texCoord, uvs + sizeof(Vector2f) * i, sizeof(Vector2f));
 
     // mapping from original material to material proxy
     std::unordered_map<const MaterialBase*, const MaterialBase*> mapping;
 
     stream >> ib_cnt;
     m_indices.resize(ib_cnt);
-    for (auto& mi : m_indices) {
-        stream >> mi.m_id[0] >> mi.m_id[1] >> mi.m_id[2];
+    const auto indices = fetchArray(stream, sizeof(MeshFaceIndex::m_id) * ib_cnt, cache);
+    for (auto i = 0u; i < ib_cnt; ++i)
+        memcpy(m_indices[i].m_id, indices + sizeof(MeshFaceIndex::m_id) * i, sizeof(MeshFaceIndex::m_id));
+
+    // faces sharing a material are usually next to each other, there is no need to look up the material again for them.
+    const auto mat_ids = fetchArray(stream, sizeof(int) * ib_cnt, cache);
+    auto prev_mat_id = -1;
+    const MaterialBase* prev_mat = nullptr;
+    for (auto i = 0u; i < ib_cnt; ++i) {
+        auto& mi = m_indices[i];
         int mat_id = -1;
-        stream >> mat_id;
-        mi.m_mat = MatManager::GetSingleton().GetMaterial(mat_id);
+        memcpy(&mat_id, mat_ids + sizeof(int) * i, sizeof(int));
+        if (IS_PTR_INVALID(prev_mat) || mat_id != prev_mat_id) {
+            prev_mat = MatManager::GetSingleton().GetMaterial(mat_id);
+            prev_mat_id = mat_id;
+        }
+        mi.m_mat = prev_mat;
 
         // If there is SSS in the material or volume is attached to the material, it is necessary to create a material proxy to
         // prevent the same material used in multiple places being recognized as the same one.
@@ -144,21 +469,30 @@ void Mesh::Serialize(IStreamBase& stream) {
 
     static const StringID has_volume_sid("has_volume");
     static const StringID no_volume_sid("no_volume");
+    static const StringID has_vdb_volume_sid("has_vdb_volume");
 
     // serialize volume data if needed
     StringID volume_sid;
     stream >> volume_sid;
-    if (volume_sid == has_volume_sid){
+    if (volume_sid == has_volume_sid || volume_sid == has_vdb_volume_sid){
         m_volumeDensity = std::make_unique<MediumDensity>();
-        m_volumeDensity->Serialize(stream);
+        if (volume_sid == has_vdb_volume_sid) {
+            // the density is loaded from a NanoVDB file directly, it doesn't go through a dense grid in the exporter
+            std::string filename;
+            unsigned quantization = VOLUME_QUANTIZATION_FLOAT;
+            stream >> filename >> quantization;
+            m_volumeDensity->LoadNanoVDB(filename, quantization <= VOLUME_QUANTIZATION_BYTE ? (VolumeQuantization)quantization : VOLUME_QUANTIZATION_FLOAT);
+        } else {
+            m_volumeDensity->Serialize(stream);
+        }
 
         m_volumeColor = std::make_unique<MediumColor>();
         m_volumeColor->Serialize(stream);
 
         // this doesn't need to be done if there is no volume data
         BBox bbox;
-        for (const auto& v : m_vertices)
-            bbox.Union(v.m_position);
+        for (const auto& position : m_positions)
+            bbox.Union(position);
         const auto extent = bbox.m_Max - bbox.m_Min;
         const auto ie_x = 1.0f / extent[0];
         const auto ie_y = 1.0f / extent[1];
@@ -171,10 +505,36 @@ void Mesh::Serialize(IStreamBase& stream) {
         sAssert(volume_sid == no_volume_sid, VOLUME);
     }
 
+    // cached acceleration structures are keyed by the geometry, there is no need to hash the other attributes.
+    // Topology is hashed separately so that a cached acceleration structure can be refitted if only vertices are moved.
+    m_topologyHash = HashValue( (unsigned int)m_positions.size() );
+    for (const auto& mi : m_indices)
+        m_topologyHash = HashValue( mi.m_id , m_topologyHash );
+    m_geometryHash = FNV_OFFSET_BASIS;
+    for (const auto& position : m_positions)
+        m_geometryHash = HashValue( position , m_geometryHash );
+
+    // Identical meshes could be shared by instances, the shading attributes and materials need to match too. Materials with
+    // SSS or volume are already replaced by proxies unique to this mesh. Volumes are mapped to the bounding box of each
+    // mesh and light up the scene separately, meshes with volume are never shared.
+    m_contentHash = 0;
+    if (!m_volumeDensity) {
+        m_contentHash = HashValue( m_hasUV , HashValue( m_topologyHash , m_geometryHash ) );
+        for (const auto& vertex : m_vertices) {
+            m_contentHash = HashValue( vertex.m_normal , m_contentHash );
+            m_contentHash = HashValue( vertex.m_texCoord , m_contentHash );
+        }
+        for (const auto& mi : m_indices)
+            m_contentHash = HashValue( mi.m_mat , m_contentHash );
+        m_contentHash = std::max( m_contentHash , (std::uint64_t)1 );
+    }
+
     static const StringID end_of_mesh("end of mesh");
     StringID eom_sid;
     stream >> eom_sid;
     sAssert(eom_sid == end_of_mesh, GENERAL);
+
+    updateMemory();
 }
 
 float Mesh::SampleVolumeDensity(const Point& pos) const {
@@ -184,6 +544,25 @@ float Mesh::SampleVolumeDensity(const Point& pos) const {
     return m_volumeDensity->Sample(uvw);
 }
 
+const MajorantGrid* Mesh::GetVolumeMajorantGrid() const {
+    if (IS_PTR_INVALID(m_volumeDensity) || !m_volumeDensity->GetMajorantGrid().IsValid())
+        return nullptr;
+    return &m_volumeDensity->GetMajorantGrid();
+}
+
+void Mesh::TransformToVolume(const Ray& ray, Point& ori, Vector& dir) const {
+    ori = m_world2Volume.TransformPoint(ray.m_Ori);
+    dir = m_world2Volume.TransformVector(ray.m_Dir);
+}
+
+Point Mesh::TransformFromVolume(const Point& uvw) const {
+    return m_volume2World.TransformPoint(uvw);
+}
+
+float Mesh::GetVolumeScale() const {
+    return fabs(m_volume2World.Determinant());
+}
+
 Spectrum Mesh::SampleVolumeColor(const Point& pos) const {
     if (IS_PTR_INVALID(m_volumeColor))
         return 0.0f;
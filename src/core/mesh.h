@@ -20,22 +20,42 @@
 #include "core/define.h"
 #include <vector>
 #include <memory>
+#include <cstdint>
 #include "math/point.h"
 #include "math/vector3.h"
 #include "math/transform.h"
+#include "math/quantization.h"
+#include "core/memory.h"
 #include "stream/stream.h"
 #include "medium/mediumdata.h"
 
 class MaterialBase;
 
-//! @brief  MeshVertex defines the basic information for a vertex in mesh.
+//! @brief  MeshVertex defines the shading attributes of a vertex in mesh, its position lives in a separate stream.
 struct MeshVertex {
-    Point       m_position;     /**< The position of the vertex in world space. */
     Vector      m_normal;       /**< The normal of the vertex in world space. */
     Vector      m_tangent;      /**< The tangent of the vertex in world space. */
     Vector2f    m_texCoord;     /**< The only channel of texture coordinate of the vertex. */
 };
 
+//! @brief  Shading attributes of a vertex in compact meshes, 12 bytes instead of the 32 bytes of MeshVertex.
+//!
+//! Normals and tangents are encoded with the octahedral mapping, texture coordinates are in half precision.
+struct CompactMeshVertex {
+    std::uint32_t   m_normal = 0;           /**< Octahedral encoded normal of the vertex in world space. */
+    std::uint32_t   m_tangent = 0;          /**< Octahedral encoded tangent of the vertex in world space. */
+    std::uint16_t   m_texCoord[2] = { 0 };  /**< Texture coordinate in half precision. */
+
+    //! @brief  Decode the shading attributes in full precision.
+    SORT_FORCEINLINE MeshVertex Decode() const {
+        MeshVertex mv;
+        mv.m_normal = decodeOctahedral( m_normal );
+        mv.m_tangent = decodeOctahedral( m_tangent );
+        mv.m_texCoord = Vector2f( halfToFloat( m_texCoord[0] ) , halfToFloat( m_texCoord[1] ) );
+        return mv;
+    }
+};
+
 //! @brief  MeshFaceIndex defines the indices of the three vertices and also the material index of the face.
 struct MeshFaceIndex {
     int                     m_id[3] = { -1 };   /**< Indices for one triangle. */
@@ -45,16 +65,21 @@ struct MeshFaceIndex {
 //! @brief  A wrapper for mesh information.
 //!
 //! Instead of using obj style memory layout, an approach that is similar to vertex buffer and index buffer
-//! in real time rendering is used here. An array of struct is used here for better cache performance during
-//! rendering.
-//! The old solution was to isolate the position, normal and texture coordinate buffers so that we can try
-//! saving minimal information without duplicating unnecessary data. However, the effort to generate such a
-//! layout of date requires quite some time in Blender, due to which reason, it was deprecated.
+//! in real time rendering is used here. Both buffers share the same indices, there is no need to duplicate
+//! any data for it.
+//! Positions are kept in their own stream, apart from the rest of the vertex attributes. Intersection tests
+//! and packing triangles for SIMD only touch the compact position stream, the other attributes are only
+//! fetched once an intersection is found and needs to be shaded.
 class Mesh : public SerializableObject{
 public:
-    std::vector<MeshVertex>     m_vertices;         /**< Vertex information including position, normal and etc.*/
+    std::vector<Point>          m_positions;        /**< Positions of vertices in world space. */
+    std::vector<MeshVertex>     m_vertices;         /**< Shading attributes of vertices, normal, tangent and etc, in the same order of positions. */
+    std::vector<CompactMeshVertex> m_compactVertices; /**< Shading attributes of vertices once the mesh is compacted, 'm_vertices' is empty then. */
     std::vector<MeshFaceIndex>  m_indices;          /**< Index information of the mesh, there is also material id in it. */
     bool                        m_hasUV = false;    /**< Whether the mesh has UV information. */
+    std::uint64_t               m_topologyHash = 0; /**< Hash of the number of vertices and the indices streamed in. */
+    std::uint64_t               m_geometryHash = 0; /**< Hash of the vertex positions streamed in, in local space. */
+    std::uint64_t               m_contentHash = 0;  /**< Hash of everything streamed in, in local space, zero if the mesh can't be shared. */
 
     //! @brief      Generate UV coordinate for the vertices.
     void    GenUV();
@@ -68,6 +93,61 @@ public:
     //! @brief      Generate tangent for the triangle mesh.
     void    GenSmoothTagent();
 
+    //! @brief      Encode the shading attributes of vertices in the compact format and release the full precision ones.
+    //!
+    //! It is meant for huge meshes like scanned ones, where memory matters more than the precision of shading
+    //! attributes. Vertices are decoded one by one only when an intersection is shaded.
+    void    Compact();
+
+    //! @brief      Decode the compact shading attributes back to full precision, so that the mesh can be processed again.
+    void    Expand();
+
+    //! @brief      Simplify the mesh by merging all vertices in each cell of a uniform grid.
+    //!
+    //! It is meant for meshes far away from the camera, where a cell covers no more than a few pixels. The position and
+    //! the normal of a merged vertex are averaged, the rest of the attributes are from one of the vertices. Triangles
+    //! with two vertices in the same cell are dropped.
+    //!
+    //! @param  cell_size   Size of the cells in world space.
+    //! @return             Whether the mesh is simplified, it is kept as it is if the vertices are not reduced by half.
+    bool    Simplify( float cell_size );
+
+    //! @brief      Clean up the mesh and reorder it for locality before primitives are created from it.
+    //!
+    //! Triangles with zero area are dropped, vertices with exactly the same position and shading attributes are welded
+    //! and vertices that are no longer referenced are removed. Both vertices and triangles are then sorted along a Morton
+    //! curve, triangles close in space end up close in memory, so do their vertices. Nothing is moved, the mesh looks
+    //! the same as before.
+    //!
+    //! @return             Whether anything is dropped or welded, the mesh is reordered either way.
+    bool    Preprocess();
+
+    //! @brief      Whether the shading attributes of vertices are in the compact format.
+    bool    IsCompact() const {
+        return m_vertices.empty() && !m_compactVertices.empty();
+    }
+
+    //! @brief      Get the shading attributes of a vertex, no matter whether the mesh is compacted.
+    //!
+    //! @param  id      Index of the vertex.
+    //! @return         Shading attributes of the vertex in full precision.
+    SORT_FORCEINLINE MeshVertex GetVertex( const int id ) const {
+        if( LIKELY( !m_vertices.empty() ) )
+            return m_vertices[id];
+        return m_compactVertices[id].Decode();
+    }
+
+    //! @brief      Get the texture coordinate of a vertex without decoding the rest of its shading attributes.
+    //!
+    //! @param  id      Index of the vertex.
+    //! @return         Texture coordinate of the vertex.
+    SORT_FORCEINLINE Vector2f GetTexCoord( const int id ) const {
+        if( LIKELY( !m_vertices.empty() ) )
+            return m_vertices[id].m_texCoord;
+        const auto& cv = m_compactVertices[id];
+        return Vector2f( halfToFloat( cv.m_texCoord[0] ) , halfToFloat( cv.m_texCoord[1] ) );
+    }
+
     //! @brief      Serializing data from stream.
     //!
     //! @param      Stream where the serialization data comes from. Depending on different situation,
@@ -89,12 +169,54 @@ public:
     //! @return         The color of the volume.
     Spectrum    SampleVolumeColor(const Point& pos) const;
 
+    //! @brief      Get the coarse grid of the maximum volume density.
+    //!
+    //! @return     The majorant grid of the volume density, null if there is no volume data.
+    const MajorantGrid* GetVolumeMajorantGrid() const;
+
+    //! @brief      Transform a ray from world space to volume texture space, where the volume is in the unit cube.
+    //!
+    //! The direction is not normalized so that the ray parameter stays the same in both spaces.
+    //!
+    //! @param  ray     Ray in world space.
+    //! @param  ori     Origin of the ray in volume texture space.
+    //! @param  dir     Direction of the ray in volume texture space.
+    void        TransformToVolume(const Ray& ray, Point& ori, Vector& dir) const;
+
+    //! @brief      Transform a point from volume texture space back to world space.
+    //!
+    //! @param  uvw     Position in volume texture space.
+    //! @return         Position in world space.
+    Point       TransformFromVolume(const Point& uvw) const;
+
+    //! @brief      Volume in world space covered by a unit volume in volume texture space.
+    //!
+    //! @return     The scale of volume from volume texture space to world space.
+    float       GetVolumeScale() const;
+
+    //! @brief      Attach the light that samples the emission of the volume inside this mesh.
+    //!
+    //! @param  light   The light of the volume.
+    void        SetVolumeLight(const class Light* light) {
+        m_volumeLight = light;
+    }
+
+    //! @brief      Get the light that samples the emission of the volume inside this mesh.
+    //!
+    //! @return     The light of the volume, null if the emission of the volume is not sampled as a light.
+    const class Light* GetVolumeLight() const {
+        return m_volumeLight;
+    }
+
 private:
     //! @brief      Generate tangent for the triangles.
     //!
     //! @return     Generated tangent.
     Vector      genTagentForTri( const MeshFaceIndex& ) const;
 
+    //! @brief      Account the memory of vertices and indices in the memory of geometry.
+    void        updateMemory();
+
     /**< Transformation from world space to local volume space. */
     mutable float   m_world2LocalVolume[16] = { 0.0f };
 
@@ -102,6 +224,8 @@ private:
     Matrix          m_local2Volume;
     /**< Tranfrom from world space to volume texture space. */
     Matrix          m_world2Volume;
+    /**< Tranfrom from volume texture space to world space. */
+    Matrix          m_volume2World;
 
     /**< Whether the world2localvolume matrix is cached or not. */
     mutable bool    m_w2lvCached = false;
@@ -110,4 +234,9 @@ private:
     std::unique_ptr<MediumDensity>  m_volumeDensity;
     /**< The color of the volume data inside this mesh. */
     std::unique_ptr<MediumColor>    m_volumeColor;
+    /**< The light that samples the emission of the volume, if there is any. */
+    const class Light*              m_volumeLight = nullptr;
+
+    /**< Memory of vertices and indices accounted in the memory of geometry. */
+    TrackedMemory                   m_memory = TrackedMemory( MemoryCategory::Geometry );
 };
\ No newline at end of file
@@ -42,7 +42,7 @@ public:
     //! @param  shape   Shape of the material.
     //! @param  light   Light source attached to the material.
     Primitive(const Mesh* mesh, const MaterialBase* mat , const Shape* shape , class Light* light = nullptr ):
-        m_mesh(mesh), m_mat(mat), m_shape(shape), m_light(light){}
+        m_mesh(mesh), m_mat(mat), m_shape(shape), m_light(light), m_transparent(GetMaterial()->HasTransparency() && !shape->HasAlphaMask()), m_shapeType(shape->GetShapeType()){}
 
     //! @brief  Get the intersection between a ray and the primitive.
     //!
@@ -53,7 +53,11 @@ public:
     SORT_FORCEINLINE bool GetIntersect( const Ray& r , SurfaceInteraction* intersect ) const{
         auto ret = m_shape->GetIntersect( r , intersect );
         if( ret && intersect ){
-            intersect->primitive = this;
+            // an instance fills the primitive of the intersected triangle in the shared mesh
+            if( m_shapeType != SHAPE_INSTANCE )
+                intersect->primitive = this;
+            // the attributes are complete, a hit recorded before could have left the flag set
+            intersect->pending = false;
             return true;
         }
         return ret;
@@ -73,10 +77,18 @@ public:
     //! @brief  Get the axis aligned bounding box of the primitive in world space.
     //!
     //! @return         AABB in world space.
-    SORT_FORCEINLINE const BBox&  GetBBox() const {
+    SORT_FORCEINLINE BBox  GetBBox() const {
         return m_shape->GetBBox();
     }
 
+    //! @brief  Get the bounding box of the part of the primitive inside a box.
+    //!
+    //! @param  box     The box to clip the primitive against, it is in world space.
+    //! @return         The bounding box of the clipped primitive, it is inverted if nothing of the primitive is inside the box.
+    SORT_FORCEINLINE BBox ClipBBox( const BBox& box ) const {
+        return m_shape->ClipBBox( box );
+    }
+
     //! @brief  Get the surface area of the primitive.
     //!
     //! @return         Surface area of the primitive.
@@ -93,6 +105,17 @@ public:
         return IS_PTR_INVALID(m_mat) ? MatManager::GetSingleton().GetDefaultMat() : m_mat;
     }
 
+    //! @brief  Whether the material of the primitive has transparency.
+    //!
+    //! It is asked by every shadow ray hitting the primitive, the answer is cached when the primitive is created so that
+    //! opaque hits don't need to go through the virtual interface of the material.
+    //! Shapes tested against alpha masks are opaque wherever rays hit them.
+    //!
+    //! @return         Whether shadow rays could pass through the primitive.
+    SORT_FORCEINLINE bool HasTransparency() const {
+        return m_transparent;
+    }
+
     //! @brief  Get the light source of the primitive if there is one.
     //!
     //! Most primitives doesn't have light attached to it.
@@ -104,9 +127,11 @@ public:
     
     //! @brief  Get the type of the shape attached to the primitive.
     //!
+    //! Spatial structures dispatch primitive tests by the type, it is cached so that asking for it is not a virtual call.
+    //!
     //! @return         Type of the attached shape.
     SORT_FORCEINLINE SHAPE_TYPE GetShapeType() const {
-        return m_shape->GetShapeType();
+        return m_shapeType;
     }
 
     //! @brief  Get the shape of the primitive.
@@ -131,4 +156,19 @@ private:
     const Shape*            m_shape;    /**< The shape of the primitive. */
     class Light*            m_light;    /**< Light source attached to the primitive. */
     const Mesh*             m_mesh;     /**< The mesh that owns this primitive. */
-};
\ No newline at end of file
+    bool                    m_transparent;  /**< Whether the material of the primitive has transparency. */
+    SHAPE_TYPE              m_shapeType;    /**< Type of the shape of the primitive. */
+};
+//! @brief  Evaluate the attributes of the nearest hit found by a traversal.
+//!
+//! Triangles and lines only record the distance, the primitive and the barycentric coordinate while a traversal is still
+//! looking for the nearest hit, normals, tangents and texture coordinates of the hits being replaced later are never
+//! evaluated. Accelerators call this once the traversal of a ray is done.
+//!
+//! @param  ray         The ray that is traced.
+//! @param  intersect   The nearest intersection of the ray.
+SORT_FORCEINLINE void FinalizeInteraction( const Ray& ray , SurfaceInteraction& intersect ){
+    if( intersect.pending && IS_PTR_VALID(intersect.primitive) )
+        intersect.primitive->GetShape()->FinalizeInteraction( ray , &intersect );
+    intersect.pending = false;
+}
@@ -15,117 +15,109 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <cstring>
+#include <time.h>
 #include "rand.h"
 #include "core/define.h"
 #include "core/thread.h"
+#include "core/workercontext.h"
 
-#if defined(SORT_IN_LINUX)
-#elif defined(SORT_IN_WINDOWS)
-#include <time.h>
+#ifdef SSE_ENABLED
+#include <smmintrin.h>
 #endif
 
-#include <random>
-
-// different implementation of the random generator on different platforms could cause problems, switched to old solution until I have time to work on it later.
-// #define HIDE_OLD_RANDDOM_GENERATOR
-
-#ifndef HIDE_OLD_RANDDOM_GENERATOR
-// Random Number Method Definitions
-#define M 397
-#define MATRIX_A 0x9908b0dfUL   /* constant vector a */
-#define UPPER_MASK 0x80000000UL /* most significant w-r bits */
-#define LOWER_MASK 0x7fffffffUL /* least significant r bits */
-
-// variables used for random number generation
-static const int N = 624;
-static thread_local unsigned long mt[N]; /* the array for the state vector  */
-static thread_local int mti;
-static thread_local bool seed_setup = false;
+// 32 bits integer hash with low bias
+// https://nullprogram.com/blog/2018/07/31/
+SORT_STATIC_FORCEINLINE unsigned lowbias32( unsigned x ){
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
 
-#else
+// two rounds of hashing keyed by both halves of the key, streams of different keys don't overlap with a simple shift
+SORT_STATIC_FORCEINLINE unsigned counterHash( const unsigned counter , const unsigned key0 , const unsigned key1 ){
+    return lowbias32( lowbias32( counter ^ key0 ) + key1 );
+}
 
-static thread_local std::default_random_engine  re;
+// only 24 bits are kept so that the result is strictly smaller than one
+SORT_STATIC_FORCEINLINE float toCanonical( const unsigned x ){
+    return ( x >> 8 ) * ( 1.0f / float( 1 << 24 ) );
+}
 
-static thread_local std::uniform_int_distribution<unsigned>    dist_uint;
-static thread_local std::uniform_real_distribution<float>      dist_float( 0.0f , 1.0f );
+// set the seed
+void sort_seed(){
+    auto& rs = GetWorkerContext().random;
+    const auto seed = ( ThreadId() + 1 ) * (unsigned)time(0);
+    rs.key0 = lowbias32( seed );
+    rs.key1 = lowbias32( rs.key0 ^ 0x5bd1e995u );
+    rs.counter = 0;
+    rs.seeded = true;
+}
 
-#endif
+void sort_seed( unsigned x , unsigned y , unsigned sample , unsigned stream ){
+    // the state of the generator lives in the context of each thread
+    auto& rs = GetWorkerContext().random;
+    rs.key0 = lowbias32( lowbias32( x ) ^ y ) ^ stream * 0x9e3779b9u;
+    rs.key1 = lowbias32( rs.key0 ^ sample );
+    rs.counter = 0;
+    rs.seeded = true;
+}
 
-// set the seed
-void sort_seed()
-{
-    unsigned _seed = ( ThreadId() + 1 ) * (unsigned)time(0);
-
-#ifndef HIDE_OLD_RANDDOM_GENERATOR
-    mt[0]= _seed & 0xffffffffUL;
-    for (mti=1; mti<N; mti++) {
-        mt[mti] =
-        (1812433253UL * (mt[mti-1] ^ (mt[mti-1] >> 30)) + mti);
-        /* See Knuth TAOCP Vol2. 3rd Ed. P.106 for multiplier. */
-        /* In the previous versions, MSBs of the seed affect   */
-        /* only MSBs of the array mt[].                        */
-        /* 2002/01/09 modified by Makoto Matsumoto             */
-        mt[mti] &= 0xffffffffUL;
-        /* for >32 bit machines */
-    }
+RandomState sort_get_state(){
+    return GetWorkerContext().random;
+}
 
-    seed_setup = true;
-#else
-    re.seed( _seed );
-#endif
+void sort_set_state( const RandomState& state ){
+    GetWorkerContext().random = state;
 }
 
 // generate a unsigned integer
-unsigned sort_rand()
-{
-#ifndef HIDE_OLD_RANDDOM_GENERATOR
-    unsigned long y;
-    {
-        static thread_local unsigned long mag01[2]={0x0UL, MATRIX_A};
-        /* mag01[x] = x * MATRIX_A  for x=0,1 */
-
-        if( seed_setup == false )
-            sort_seed();
-
-        if (mti >= N) { /* generate N words at one time */
-            int kk;
-
-            if (mti == N+1)   /* if Seed() has not been called, */
-                sort_seed(); /* default initial seed */
-
-            for (kk=0;kk<N-M;kk++) {
-                y = (mt[kk]&UPPER_MASK)|(mt[kk+1]&LOWER_MASK);
-                mt[kk] = mt[kk+M] ^ (y >> 1) ^ mag01[y & 0x1UL];
-            }
-            for (;kk<N-1;kk++) {
-                y = (mt[kk]&UPPER_MASK)|(mt[kk+1]&LOWER_MASK);
-                mt[kk] = mt[kk+(M-N)] ^ (y >> 1) ^ mag01[y & 0x1UL];
-            }
-            y = (mt[N-1]&UPPER_MASK)|(mt[0]&LOWER_MASK);
-            mt[N-1] = mt[M-1] ^ (y >> 1) ^ mag01[y & 0x1UL];
-
-            mti = 0;
-        }
-
-        y = mt[mti++];
-
-        /* Tempering */
-        y ^= (y >> 11);
-        y ^= (y << 7) & 0x9d2c5680UL;
-        y ^= (y << 15) & 0xefc60000UL;
-        y ^= (y >> 18);
-    }
-    return y;
-#else
-    return dist_uint(re);
-#endif
+unsigned sort_rand(){
+    auto& rs = GetWorkerContext().random;
+    if( UNLIKELY( !rs.seeded ) )
+        sort_seed();
+    return counterHash( rs.counter++ , rs.key0 , rs.key1 );
 }
 
 // generate a canonical random number
 float sort_canonical(){
-#ifndef HIDE_OLD_RANDDOM_GENERATOR
-    return (sort_rand() & 0xffffff) / float(1 << 24);
-#else
-    return dist_float(re);
+    return toCanonical( sort_rand() );
+}
+
+#ifdef SSE_ENABLED
+SORT_STATIC_FORCEINLINE __m128i lowbias32( __m128i x ){
+    x = _mm_xor_si128( x , _mm_srli_epi32( x , 16 ) );
+    x = _mm_mullo_epi32( x , _mm_set1_epi32( 0x7feb352d ) );
+    x = _mm_xor_si128( x , _mm_srli_epi32( x , 15 ) );
+    x = _mm_mullo_epi32( x , _mm_set1_epi32( (int)0x846ca68bu ) );
+    x = _mm_xor_si128( x , _mm_srli_epi32( x , 16 ) );
+    return x;
+}
+#endif
+
+void sort_canonical( float* values , unsigned cnt ){
+    auto& rs = GetWorkerContext().random;
+    if( UNLIKELY( !rs.seeded ) )
+        sort_seed();
+
+    auto i = 0u;
+#ifdef SSE_ENABLED
+    // four numbers are generated in each iteration
+    const auto key0 = _mm_set1_epi32( (int)rs.key0 );
+    const auto key1 = _mm_set1_epi32( (int)rs.key1 );
+    const auto scale = _mm_set1_ps( 1.0f / float( 1 << 24 ) );
+    auto counter = _mm_add_epi32( _mm_set1_epi32( (int)rs.counter ) , _mm_set_epi32( 3 , 2 , 1 , 0 ) );
+    for( ; i + 4 <= cnt ; i += 4 ){
+        const auto h = lowbias32( _mm_add_epi32( lowbias32( _mm_xor_si128( counter , key0 ) ) , key1 ) );
+        const auto f = _mm_mul_ps( _mm_cvtepi32_ps( _mm_srli_epi32( h , 8 ) ) , scale );
+        _mm_storeu_ps( values + i , f );
+        counter = _mm_add_epi32( counter , _mm_set1_epi32( 4 ) );
+    }
+    rs.counter += i;
 #endif
+    for( ; i < cnt ; ++i )
+        values[i] = sort_canonical();
 }
@@ -21,13 +21,50 @@
 description :
     Random number generation method, the default 'rand' function provided by c++ standard library is not so good,
     another random number generation method is adapted here.
+    The generator is counter based, each number is a hash of a key and a counter. There is no state other than the
+    two integers per thread. Keying it with a pixel sample makes the result independent of which thread renders the
+    pixel and in what order, renders are reproducible with any thread count.
 */
 
+//! @brief  The state of the random number generator of a thread.
+struct RandomState{
+    unsigned    key0 = 0;
+    unsigned    key1 = 0;
+    unsigned    counter = 0;
+    bool        seeded = false;
+};
+
 // set the seed
 void        sort_seed();
 
+//! @brief  Key the random number generator of the current thread with a pixel sample.
+//!
+//! @param  x           Horizontal coordinate of the pixel.
+//! @param  y           Vertical coordinate of the pixel.
+//! @param  sample      Index of the sample in the pixel.
+//! @param  stream      Different streams of the same pixel sample are independent of each other.
+void        sort_seed( unsigned x , unsigned y , unsigned sample , unsigned stream );
+
 // generate a unsigned integer
 unsigned    sort_rand();
 
 // generate a canonical random number
 float       sort_canonical();
+
+//! @brief  Generate multiple canonical random numbers at once.
+//!
+//! It generates exactly the same numbers as calling 'sort_canonical' for 'cnt' times, only faster.
+//!
+//! @param  values      The memory to save the random numbers.
+//! @param  cnt         Number of random numbers to generate.
+void        sort_canonical( float* values , unsigned cnt );
+
+//! @brief  Get the state of the random number generator of the current thread.
+//!
+//! @return             The state, numbers drawn after restoring it are the same as the ones drawn right after this call.
+RandomState sort_get_state();
+
+//! @brief  Restore the random number generator of the current thread.
+//!
+//! @param  state       The state returned by 'sort_get_state', possibly from another thread.
+void        sort_set_state( const RandomState& state );
@@ -34,4 +34,14 @@ public:
     //! @param  filename        Name of the external file holding the data.
     //! @return                 Whether the file has been loaded successfully.
     virtual bool LoadResource(const std::string filename) = 0;
+
+    //! @brief  Share the data of a loaded resource of identical content, instead of loading the same file again.
+    //!
+    //! Resources that don't support sharing load their own copy of the data.
+    //!
+    //! @param  other           The resource that has already been loaded from a file of the same content.
+    //! @return                 Whether the data is shared.
+    virtual bool ShareResource(const Resource& other) {
+        return false;
+    }
 };
\ No newline at end of file
@@ -17,11 +17,12 @@
 
 #pragma once
 
-#include <unordered_map>
+#include <memory>
 #include <algorithm>
 #include "core/singleton.h"
 #include "core/log.h"
 #include "core/strid.h"
+#include "core/flatmap.h"
 
 //! @brief  This class has no member field. Its only purpose is to instancing class object.
 template<class T>
@@ -34,23 +35,23 @@ public:
 //! @brief      Class Factory is responsible for creating instances based on names.
 template<class T>
 class Factory : public Singleton<Factory<T>>{
-    using FACTORY_MAP = std::unordered_map<StringID,FactoryMethod<T>*>;
+    using FACTORY_MAP = FlatSidMap<FactoryMethod<T>*>;
 
 public:
     //! @brief  Create a shared instance of a specific type based on class name.
     //!
     //! @return     Return a reference of a newly created instance.
     auto CreateSharedType( const StringID sid ) const{
-        auto it = m_factoryMap.find(sid);
-        return it == m_factoryMap.end() ? nullptr : it->second->CreateSharedInstance();
+        auto method = m_factoryMap.Find(sid);
+        return method ? (*method)->CreateSharedInstance() : nullptr;
     }
 
     //! @brief  Create an unique instance of a specific type based on class name.
     //!
     //! @return     Return a reference of a newly created instance.
     auto CreateUniqueType( const StringID sid ) const{
-        auto it = m_factoryMap.find(sid);
-        return it == m_factoryMap.end() ? nullptr : it->second->CreateUniqueInstance();
+        auto method = m_factoryMap.Find(sid);
+        return method ? (*method)->CreateUniqueInstance() : nullptr;
     }
 
     //! @brief  Get the container mapping from string to factory method.
@@ -98,7 +99,7 @@ std::unique_ptr<T> MakeUniqueInstance( const StringID sid ) {
     T##FactoryMethod(){\
         StringID sid(#T);\
         auto& factoryMap = Factory<B>::GetSingleton().GetFactoryMap();\
-        if( factoryMap.count(sid) ){\
+        if( factoryMap.Contains(sid) ){\
             slog( WARNING , GENERAL , "The class with specific name of %s already exxisted." , #T );\
             return;\
         }\
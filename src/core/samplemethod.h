@@ -22,6 +22,7 @@
 #include "core/define.h"
 #include "texture/texturebase.h"
 #include "core/sassert.h"
+#include "stream/stream.h"
 #include "scatteringevent/bsdf/bxdf_utils.h"
 
 /*
@@ -29,6 +30,38 @@ description :
     There are some basic sampling methods used for Monte Carlo ray tracing.
 */
 
+//! @brief  Sample a point uniformly in a regular polygon inscribed in the unit circle.
+//!
+//! The polygon is made of wedges of the same area between its center and its edges, 'u' picks the wedge and is
+//! reused to sample a point in it so that stratified samples stay stratified in the polygon.
+//!
+//! @param  u           A canonical random variable.
+//! @param  v           A canonical random variable.
+//! @param  n           Number of edges of the polygon, at least three.
+//! @param  rotation    Rotation of the polygon in radian, the first corner is on the x axis without rotation.
+//! @param  x           X position in the polygon.
+//! @param  y           Y position in the polygon.
+SORT_FORCEINLINE void UniformSamplePolygon( float u , float v , int n , float rotation , float& x , float& y ){
+    const auto fu = u * (float)n;
+    const auto k = std::min( (int)fu , n - 1 );
+    const auto su = sqrt( fu - (float)k );
+
+    const auto theta0 = rotation + TWO_PI * (float)k / (float)n;
+    const auto theta1 = theta0 + TWO_PI / (float)n;
+    const auto b0 = su * ( 1.0f - v );
+    const auto b1 = su * v;
+    x = b0 * cos( theta0 ) + b1 * cos( theta1 );
+    y = b0 * sin( theta0 ) + b1 * sin( theta1 );
+}
+
+//! @brief  Area of a regular polygon inscribed in the unit circle.
+//!
+//! @param  n           Number of edges of the polygon, at least three.
+//! @return             Area of the polygon.
+SORT_FORCEINLINE float PolygonArea( int n ){
+    return 0.5f * (float)n * sin( TWO_PI / (float)n );
+}
+
 // sampling a point on unit disk uniformly using Shirley's Mapping
 // para 'u' : a canonical random variable
 // para 'v' : a canonical random variable
@@ -125,6 +158,63 @@ SORT_FORCEINLINE float UniformSpherePdf(){
     return INV_TWOPI * 0.5f;
 }
 
+// solid angle of a spherical triangle, which is the projection of a triangle on the unit sphere
+// para 'a' , 'b' , 'c' : normalized directions to the vertices of the triangle
+SORT_FORCEINLINE float SphericalTriangleArea( const Vector& a , const Vector& b , const Vector& c ){
+    return fabs( 2.0f * atan2( dot( a , cross( b , c ) ) , 1.0f + dot( a , b ) + dot( a , c ) + dot( b , c ) ) );
+}
+
+// sampling a direction in spherical triangle uniformly, this is Arvo's method
+// para 'a' , 'b' , 'c' : normalized directions to the vertices of the triangle
+// para 'u' : a canonical random variable
+// para 'v' : a canonical random variable
+// para 'pdf' : pdf w.r.t solid angle of the sampled direction, it is zero if the triangle is degenerated
+SORT_FORCEINLINE Vector UniformSampleSphericalTriangle( const Vector& a , const Vector& b , const Vector& c , float u , float v , float* pdf ){
+    if( pdf )
+        *pdf = 0.0f;
+
+    // normals of the great circles through the edges
+    auto n_ab = cross( a , b );
+    auto n_bc = cross( b , c );
+    auto n_ca = cross( c , a );
+    if( n_ab.SquaredLength() == 0.0f || n_bc.SquaredLength() == 0.0f || n_ca.SquaredLength() == 0.0f )
+        return a;
+    n_ab = normalize( n_ab );
+    n_bc = normalize( n_bc );
+    n_ca = normalize( n_ca );
+
+    // interior angles of the spherical triangle
+    const auto alpha = acos( clamp( dot( n_ab , -n_ca ) , -1.0f , 1.0f ) );
+    const auto beta = acos( clamp( dot( n_bc , -n_ab ) , -1.0f , 1.0f ) );
+    const auto gamma = acos( clamp( dot( n_ca , -n_bc ) , -1.0f , 1.0f ) );
+    const auto area = alpha + beta + gamma - PI;
+    if( area <= 0.0f )
+        return a;
+
+    // pick the area of the sub-triangle plus pi, which determines the third vertex on the edge between 'a' and 'c'
+    const auto sub_area_pi = PI + u * area;
+    const auto sin_phi = sin( sub_area_pi ) * cos( alpha ) - cos( sub_area_pi ) * sin( alpha );
+    const auto cos_phi = cos( sub_area_pi ) * cos( alpha ) + sin( sub_area_pi ) * sin( alpha );
+    const auto k1 = cos_phi + cos( alpha );
+    const auto k2 = sin_phi - sin( alpha ) * dot( a , b );
+    const auto denom = ( k2 * sin_phi + k1 * cos_phi ) * sin( alpha );
+    const auto cos_bp = denom != 0.0f ? clamp( ( k2 + ( k2 * cos_phi - k1 * sin_phi ) * cos( alpha ) ) / denom , -1.0f , 1.0f ) : 1.0f;
+    const auto sin_bp = sqrt( std::max( 0.0f , 1.0f - cos_bp * cos_bp ) );
+    const auto c_perp = c - a * dot( c , a );
+    const auto cp = c_perp.SquaredLength() > 0.0f ? normalize( a * cos_bp + normalize( c_perp ) * sin_bp ) : a;
+
+    // pick a direction on the arc between 'b' and the third vertex
+    const auto cos_theta = 1.0f - v * ( 1.0f - dot( cp , b ) );
+    const auto sin_theta = sqrt( std::max( 0.0f , 1.0f - cos_theta * cos_theta ) );
+    const auto cp_perp = cp - b * dot( cp , b );
+    if( cp_perp.SquaredLength() == 0.0f )
+        return b;
+
+    if( pdf )
+        *pdf = 1.0f / area;
+    return normalize( b * cos_theta + normalize( cp_perp ) * sin_theta );
+}
+
 // one dimensional distribution
 class Distribution1D{
 public:
@@ -223,9 +313,153 @@ private:
     float                       sum;
 };
 
+// alias table for sampling a discrete distribution in constant time, this is Vose's method
+class AliasTable{
+public:
+    // a bin in the table, it is shared by at most two units
+    struct Bin{
+        float       q = 0.0f;       /**< Probability of picking the bin itself instead of its alias. */
+        float       p = 0.0f;       /**< Probability of the unit. */
+        unsigned    alias = 0;      /**< The unit sharing the bin. */
+    };
+
+    // constructor
+    AliasTable( const float* f , unsigned n ){
+        if( f == 0 || n == 0 )
+            return;
+
+        bins.resize( n );
+        sum = Build( f , n , bins.data() );
+    }
+
+    // fill the bins of a table, this can be used to build tables in memory owned by someone else
+    // para 'f'    : weights of the units
+    // para 'n'    : number of units
+    // para 'bins' : output bins, there needs to be 'n' of them
+    // result      : sum of the weights
+    static float Build( const float* f , unsigned n , Bin* bins ){
+        auto sum = 0.0f;
+        for( unsigned i = 0 ; i < n ; i++ )
+            sum += f[i];
+        for( unsigned i = 0 ; i < n ; i++ )
+            bins[i] = Bin{ 0.0f , sum != 0.0f ? f[i] / sum : 1.0f / (float)n , i };
+
+        // bins with less than average probability are filled up with the ones with more than that
+        std::vector<std::pair<unsigned, float>> under , over;
+        for( unsigned i = 0 ; i < n ; i++ ){
+            const auto q = bins[i].p * (float)n;
+            if( q < 1.0f )
+                under.push_back( std::make_pair( i , q ) );
+            else
+                over.push_back( std::make_pair( i , q ) );
+        }
+        while( !under.empty() && !over.empty() ){
+            const auto u = under.back();
+            under.pop_back();
+            auto o = over.back();
+            over.pop_back();
+
+            bins[u.first].q = u.second;
+            bins[u.first].alias = o.first;
+
+            o.second -= 1.0f - u.second;
+            if( o.second < 1.0f )
+                under.push_back( o );
+            else
+                over.push_back( o );
+        }
+
+        // the rest of them are all close to average because of the floating point error
+        for( const auto& o : over )
+            bins[o.first].q = 1.0f;
+        for( const auto& u : under )
+            bins[u.first].q = 1.0f;
+
+        return sum;
+    }
+
+    // pick a unit from bins
+    // para 'bins' : bins of the table
+    // para 'n'    : number of bins
+    // para 'u'    : a canonical random variable
+    // para 'du'   : the canonical random variable left after the pick, it is uniformly distributed in [0, 1)
+    // result      : index of the picked unit
+    static SORT_FORCEINLINE unsigned Pick( const Bin* bins , unsigned n , float u , float* du = nullptr ){
+        // the random variable is used to pick a bin first, the rest of it is used to pick between the bin and its alias
+        const auto offset = std::min( (unsigned)( u * (float)n ) , n - 1 );
+        const auto up = std::min( u * (float)n - (float)offset , 1.0f - FLT_EPSILON );
+        const auto& bin = bins[offset];
+        if( up < bin.q ){
+            if( du ) *du = std::min( up / bin.q , 1.0f - FLT_EPSILON );
+            return offset;
+        }
+        if( du ) *du = std::min( ( up - bin.q ) / ( 1.0f - bin.q ) , 1.0f - FLT_EPSILON );
+        return bin.alias;
+    }
+
+    // get a discrete sample
+    // para 'u' : a canonical random variable
+    // para 'pdf' : probability of the sample
+    // result   : index of the sample, -1 if there is no data in the table
+    int SampleDiscrete( float u , float* pdf ) const{
+        sAssert( u <= 1.0f && u >= 0.0f , SAMPLING );
+        if( bins.empty() ){
+            if( pdf ) *pdf = 0.0f;
+            return -1;
+        }
+
+        const auto ret = Pick( bins.data() , (unsigned)bins.size() , u );
+        if( pdf )
+            *pdf = bins[ret].p;
+        return (int)ret;
+    }
+
+    // get a continuous sample, the distribution is piecewise constant
+    // para 'u' : a canonical random variable
+    // para 'pdf' : property density function value for the sample
+    float SampleContinuous( float u , float* pdf ) const{
+        sAssert( u <= 1.0f && u >= 0.0f , SAMPLING );
+        if( bins.empty() ){
+            if( pdf ) *pdf = 0.0f;
+            return 0.0f;
+        }
+
+        const auto n = (unsigned)bins.size();
+        auto du = 0.0f;
+        const auto ret = Pick( bins.data() , n , u , &du );
+        if( pdf )
+            *pdf = bins[ret].p * (float)n;
+        return ( (float)ret + du ) / (float)n;
+    }
+
+    // get the sum of the original data
+    float GetSum() const{
+        return sum;
+    }
+
+    // get the count
+    unsigned GetCount() const{
+        return (unsigned)bins.size();
+    }
+
+    // get property of the unit
+    float GetProperty( unsigned i ) const{
+        sAssert( i < bins.size() , GENERAL );
+        return bins[i].p;
+    }
+
+private:
+    std::vector<Bin>    bins;
+    float               sum = 0.0f;
+};
+
 // two dimensional distribution
+// All conditional distributions live in one contiguous array of alias table bins, row after row, so that
+// sampling takes constant time without chasing pointers.
 class Distribution2D{
 public:
+    // empty distribution, it is supposed to be filled by 'LoadCache'
+    Distribution2D() = default;
     // default constructor
     Distribution2D( const float* data , unsigned nu , unsigned nv ){
         _init( data , nu , nv );
@@ -245,46 +479,89 @@ public:
     }
 
     // get a sample point
-    void SampleContinuous( float u , float v , float uv[2] , float* pdf ){
-        float pdf0 , pdf1;
-        uv[1] = marginal->SampleContinuous( v , &pdf1 );
-        int vi = (int)(uv[1] * m_nv);
-        if( vi > (int)(m_nv - 1) )
-            vi = (int)(m_nv - 1);
-        uv[0] = pConditions[vi]->SampleContinuous( u , &pdf0 );
+    void SampleContinuous( float u , float v , float uv[2] , float* pdf ) const{
+        sAssert( u <= 1.0f && u >= 0.0f , SAMPLING );
+        sAssert( v <= 1.0f && v >= 0.0f , SAMPLING );
+
+        auto du = 0.0f , dv = 0.0f;
+        const auto iv = AliasTable::Pick( m_marginal.data() , m_nv , v , &dv );
+        const auto* row = m_conditionals.data() + iv * m_nu;
+        const auto iu = AliasTable::Pick( row , m_nu , u , &du );
+
+        uv[0] = ( (float)iu + du ) / (float)m_nu;
+        uv[1] = ( (float)iv + dv ) / (float)m_nv;
 
         if( pdf )
-            *pdf = pdf0 * pdf1;
+            *pdf = ( m_marginalSum == 0.0f ) ? 0.0f : row[iu].p * m_marginal[iv].p * (float)( m_nu * m_nv );
     }
     // get pdf
     float Pdf( float u , float v ) const{
         u = clamp( u , 0.0f , 1.0f );
         v = clamp( v , 0.0f , 1.0f );
 
-        int iu = (int)( u * m_nu );
-        int iv = (int)( v * m_nv );
-        if( pConditions[iv]->GetSum() * marginal->GetSum() == 0.0f )
+        const auto iu = std::min( (unsigned)( u * m_nu ) , m_nu - 1 );
+        const auto iv = std::min( (unsigned)( v * m_nv ) , m_nv - 1 );
+        if( m_marginalSum == 0.0f )
             return 0.0f;
-        return pConditions[iv]->GetProperty( iu ) * m_nu * marginal->GetProperty( iv ) * m_nv ;// ( pConditions[iv]->GetSum() * marginal->GetSum() );
+        return m_conditionals[iv * m_nu + iu].p * m_marginal[iv].p * (float)( m_nu * m_nv );
+    }
+
+    // save the sampling tables in a stream
+    void SaveCache( OStreamBase& stream ) const{
+        stream << m_nu << m_nv << m_marginalSum;
+        for( const auto& bin : m_conditionals )
+            stream << bin.q << bin.p << bin.alias;
+        for( const auto& bin : m_marginal )
+            stream << bin.q << bin.p << bin.alias;
+    }
+
+    // load the sampling tables saved by 'SaveCache', it fails if the resolution doesn't match
+    bool LoadCache( IStreamBase& stream , unsigned nu , unsigned nv ){
+        unsigned cached_nu = 0 , cached_nv = 0;
+        stream >> cached_nu >> cached_nv >> m_marginalSum;
+        if( cached_nu != nu || cached_nv != nv || nu == 0 || nv == 0 )
+            return false;
+
+        m_nu = nu;
+        m_nv = nv;
+        m_conditionals.resize( nu * nv );
+        for( auto& bin : m_conditionals )
+            stream >> bin.q >> bin.p >> bin.alias;
+        m_marginal.resize( nv );
+        for( auto& bin : m_marginal )
+            stream >> bin.q >> bin.p >> bin.alias;
+
+        // alias of a bin outside the table means the file is corrupted
+        for( const auto& bin : m_conditionals )
+            if( bin.alias >= nu )
+                return false;
+        for( const auto& bin : m_marginal )
+            if( bin.alias >= nv )
+                return false;
+        return true;
     }
 
 private:
-    // the distribution in each row
-    std::vector<std::unique_ptr<Distribution1D>>    pConditions;
-    // the marginal sampling distribution
-    std::unique_ptr<Distribution1D> marginal;
+    // bins of the conditional distributions of all rows
+    std::vector<AliasTable::Bin>    m_conditionals;
+    // bins of the marginal sampling distribution
+    std::vector<AliasTable::Bin>    m_marginal;
+    // sum of all data
+    float m_marginalSum = 0.0f;
     // the size for the two dimensions
-    unsigned m_nu , m_nv;
+    unsigned m_nu = 0 , m_nv = 0;
 
     // initialize data
     void _init( const float* data , unsigned nu , unsigned nv ){
-        for( unsigned i = 0 ; i < nv ; i++ )
-            pConditions.push_back( std::make_unique<Distribution1D>( &data[i*nu] , nu ) );
-        std::unique_ptr<float[]> m = std::make_unique<float[]>(nv);
-        for( unsigned i = 0 ; i < nv ; i++ )
-            m[i] = pConditions[i]->GetSum();
-        marginal = std::make_unique<Distribution1D>( m.get() , nv );
         m_nu = nu;
         m_nv = nv;
+
+        m_conditionals.resize( nu * nv );
+        std::vector<float> m( nv );
+        for( unsigned i = 0 ; i < nv ; i++ )
+            m[i] = AliasTable::Build( &data[i*nu] , nu , m_conditionals.data() + i * nu );
+
+        m_marginal.resize( nv );
+        m_marginalSum = AliasTable::Build( m.data() , nv , m_marginal.data() );
     }
 };
@@ -16,6 +16,8 @@
  */
 
 #include <memory>
+#include <atomic>
+#include <algorithm>
 #include "scene.h"
 #include "math/interaction.h"
 #include "accel/accelerator.h"
@@ -31,14 +33,38 @@
 #include "entity/visual_entity.h"
 #include "entity/visual.h"
 #include "stream/fstream.h"
+#include "stream/mapstream.h"
 #include "light/light.h"
+#include "task/task.h"
 #include "shape/shape.h"
+#include "task/task.h"
+#include "medium/medium.h"
+#include "material/material.h"
+#include "imagesensor/aov.h"
+#include "scatteringevent/bssrdf/bssrdf.h"
 
 SORT_STATS_DEFINE_COUNTER(sScenePrimitiveCount)
 SORT_STATS_DEFINE_COUNTER(sSceneLightCount)
+SORT_STATS_DEFINE_COUNTER(sSceneSSSAcceleratorCount)
+SORT_STATS_DEFINE_COUNTER(sOccluderCacheQuery)
+SORT_STATS_DEFINE_COUNTER(sOccluderCacheHit)
 
 SORT_STATS_COUNTER("Statistics", "Total Primitive Count", sScenePrimitiveCount);
 SORT_STATS_COUNTER("Statistics", "Total Light Count", sSceneLightCount);
+SORT_STATS_COUNTER("Statistics", "SSS Material Accelerator Count", sSceneSSSAcceleratorCount);
+SORT_STATS_COUNTER("Statistics", "Occluder Cache Query", sOccluderCacheQuery);
+SORT_STATS_RATIO("Statistics", "Occluder Cache Hit Rate", sOccluderCacheHit, sOccluderCacheQuery);
+
+// A material covering more than this portion of the scene doesn't get its own accelerator for SSS probe rays.
+static constexpr float SSS_ACCELERATOR_MAX_PORTION = 0.5f;
+
+// Every scene gets a unique id, caches keyed by it don't mistake a new scene allocated at the same address for an old one.
+static std::atomic<std::uint64_t> g_sceneCnt( 0 );
+
+Scene::Scene() : m_uid( ++g_sceneCnt ){
+}
+
+Scene::~Scene() = default;
 
 bool Scene::LoadScene( IStreamBase& stream ){
     const StringID verificationBit( "verification bits" );
@@ -47,18 +73,33 @@ bool Scene::LoadScene( IStreamBase& stream ){
     stream >> checkingBit;
     sAssertMsg( checkingBit == verificationBit , RESOURCE , "Serialization is broken." );
 
+    // Each entity comes with the size of its data, if the stream is memory mapped, entities are deserialized in parallel
+    // from their own part of the memory. The order of entities is kept so that the scene is filled the same way.
+    TaskGroup group;
     while( true ){
         StringID class_id;
         stream >> class_id;
         if( SID("End of Entities") == class_id )
             break;
 
+        std::uint64_t size = 0;
+        stream.Load( reinterpret_cast<char*>( &size ) , sizeof( size ) );
+
         auto entity = MakeUniqueInstance<Entity>( class_id );
         sAssertMsg( entity , RESOURCE , "Serialization is broken." );
 
-        entity->Serialize(stream);
+        if( const auto data = stream.Fetch( (std::size_t)size ) ){
+            auto e = entity.get();
+            group.Fork( [e, data, size](){
+                IMemoryViewStream view( data , (std::size_t)size );
+                e->Serialize( view );
+            } , "Loading Entity" );
+        }else{
+            entity->Serialize(stream);
+        }
         m_entities.push_back(std::move(entity));
     }
+    group.Join();
 
     // generate triangle buffer after parsing from stream
     generatePriBuf();
@@ -71,27 +112,128 @@ bool Scene::LoadScene( IStreamBase& stream ){
 }
 
 bool Scene::GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const{
+    RecordRayAov();
+    Scheduler::GetSingleton().CountRays( 1 );
     intersect.t = FLT_MAX;
-    return g_accelerator->GetIntersect( r , intersect );
+    const auto hit = g_accelerator->GetIntersect( r , intersect );
+    if( hit && r.m_hasDifferentials )
+        intersect.ComputeDifferentials( r );
+    return hit;
+}
+
+void Scene::GetIntersect( const Ray* rays , SurfaceInteraction* intersects , unsigned int cnt ) const{
+    for( auto i = 0u ; i < cnt ; ++i )
+        intersects[i].t = FLT_MAX;
+    Scheduler::GetSingleton().CountRays( cnt );
+    g_accelerator->GetIntersect( rays , intersects , cnt );
+    for( auto i = 0u ; i < cnt ; ++i ){
+        if( IS_PTR_VALID(intersects[i].primitive) && rays[i].m_hasDifferentials )
+            intersects[i].ComputeDifferentials( rays[i] );
+    }
+}
+
+void Scene::GetIntersectIncoherent( const Ray* rays , SurfaceInteraction* intersects , unsigned int cnt ) const{
+    for( auto i = 0u ; i < cnt ; ++i )
+        intersects[i].t = FLT_MAX;
+    Scheduler::GetSingleton().CountRays( cnt );
+    g_accelerator->GetIntersectIncoherent( rays , intersects , cnt );
+    for( auto i = 0u ; i < cnt ; ++i ){
+        if( IS_PTR_VALID(intersects[i].primitive) && rays[i].m_hasDifferentials )
+            intersects[i].ComputeDifferentials( rays[i] );
+    }
 }
 
-#ifndef ENABLE_TRANSPARENT_SHADOW
 bool Scene::IsOccluded(const Ray& r) const{
+    RecordRayAov();
+    Scheduler::GetSingleton().CountRays( 1 );
     return g_accelerator->IsOccluded(r);
 }
-#else
-Spectrum Scene::GetAttenuation( const Ray& const_ray , MediumStack* ms ) const{
+
+void Scene::IsOccluded( const Ray* rays , bool* occluded , unsigned int cnt ) const{
+    for( auto i = 0u ; i < cnt ; ++i )
+        RecordRayAov();
+    Scheduler::GetSingleton().CountRays( cnt );
+    g_accelerator->IsOccluded( rays , occluded , cnt );
+}
+
+//! @brief  Number of rays in a batch that are actually traced.
+static unsigned int activeRayCount( const RayBatch& rays ){
+    if( IS_PTR_INVALID( rays.mask ) )
+        return rays.cnt;
+    return (unsigned int)std::count_if( rays.mask , rays.mask + rays.cnt , []( unsigned char m ){ return m != 0; } );
+}
+
+void Scene::IntersectBatch( const RayBatch& rays , HitRecord* hits ) const{
+    Scheduler::GetSingleton().CountRays( activeRayCount( rays ) );
+    g_accelerator->IntersectBatch( rays , hits );
+}
+
+void Scene::OccludedBatch( const RayBatch& rays , bool* occluded ) const{
+    const auto cnt = activeRayCount( rays );
+    for( auto i = 0u ; i < cnt ; ++i )
+        RecordRayAov();
+    Scheduler::GetSingleton().CountRays( cnt );
+    g_accelerator->OccludedBatch( rays , occluded );
+}
+
+//! @brief  The primitive that blocked the last shadow ray toward a light.
+struct OccluderCacheEntry{
+    std::uint64_t       scene = 0;              /**< Unique id of the scene the occluder belongs to. */
+    const Light*        light = nullptr;        /**< The light the shadow ray went toward. */
+    const Primitive*    occluder = nullptr;     /**< The primitive that blocked the shadow ray. */
+};
+
+// Number of lights whose occluders are cached in each thread, it needs to be a power of two.
+static constexpr unsigned OCCLUDER_CACHE_SIZE = 16;
+
+// Lights colliding in the cache simply evict each other.
+static thread_local OccluderCacheEntry g_occluderCache[OCCLUDER_CACHE_SIZE];
+
+bool Scene::IsOccluded( const Ray& r , const Light* light ) const{
+    if( IS_PTR_INVALID(light) )
+        return IsOccluded( r );
+
+    RecordRayAov();
+    Scheduler::GetSingleton().CountRays( 1 );
+    SORT_STATS(++sOccluderCacheQuery);
+
+    auto& entry = g_occluderCache[( (std::uintptr_t)light >> 4 ) & ( OCCLUDER_CACHE_SIZE - 1 )];
+    if( entry.scene == m_uid && entry.light == light && IS_PTR_VALID(entry.occluder) ){
+        r.Prepare();
+        if( entry.occluder->GetIntersect( r , nullptr ) ){
+            SORT_STATS(++sOccluderCacheHit);
+            return true;
+        }
+    }
+
+    const Primitive* occluder = nullptr;
+    const auto occluded = g_accelerator->IsOccluded( r , occluder );
+
+    // the last known occluder is kept if the ray is not occluded, the next shadow ray may well be blocked by it again.
+    if( occluded ){
+        entry.scene = m_uid;
+        entry.light = light;
+        entry.occluder = occluder;
+    }
+    return occluded;
+}
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
+Spectrum Scene::GetAttenuation( const Ray& const_ray , MediumStack* ms , const Light* light ) const{
+    // nothing but opaque surfaces could be hit, the medium stack is never touched either since it is only updated at
+    // transparent surfaces the ray passes through.
+    if( IsOpaque() )
+        return IsOccluded( const_ray , light ) ? 0.0f : 1.0f;
+
     auto ray = const_ray;
 
     Spectrum attenuation( 1.0f );
-    while( !attenuation.IsBlack() ){
+    auto more = true;
+    while( more && !attenuation.IsBlack() ){
         Spectrum att;
-        if( !g_accelerator->GetAttenuation(ray, att, ms) )
-            break;
-
-        if( att.IsBlack() )
-            return att;
-
+        RecordRayAov();
+        Scheduler::GetSingleton().CountRays( 1 );
+        more = g_accelerator->GetAttenuation(ray, att, ms);
         attenuation *= att;
     }
     
@@ -99,27 +241,159 @@ Spectrum Scene::GetAttenuation( const Ray& const_ray , MediumStack* ms ) const{
 }
 #endif
 
+//! @brief  Boundaries crossed into the mediums that surround a point.
+//!
+//! Mediums are allocated in the per-sample memory pool, they can't outlive the sample. What is cached instead is the boundary
+//! through which each surviving medium is entered, replaying them rebuilds the same medium stack.
+struct MediumStackCache{
+    const Scene*        scene = nullptr;                        /**< Scene the crossings belong to. */
+    Point               origin;                                 /**< Point the medium stack is restored at. */
+    const MaterialBase* materials[MEDIUM_MAX_CNT] = { nullptr };/**< Materials of the entered boundaries. */
+    MediumInteraction   interactions[MEDIUM_MAX_CNT];           /**< Where the boundaries are crossed. */
+    unsigned            cnt = 0;                                /**< Number of entered boundaries. */
+};
+
+// All primary rays of a pinhole camera start from the same point, the medium stack at it only needs to be restored once per thread.
+static thread_local MediumStackCache g_mediumStackCache;
+
 void Scene::RestoreMediumStack( const Point& p , MediumStack& ms ) const{
 	// check if there is volume in the scene, early return if there isn't.
 	if (!g_acceleratorVol->GetIsValid())
 		return;
 
+    auto& cache = g_mediumStackCache;
+    if( cache.scene == this && cache.origin == p ){
+        for( auto i = 0u ; i < cache.cnt ; ++i )
+            cache.materials[i]->UpdateMediumStack( cache.interactions[i] , SE_ENTERING , ms );
+        return;
+    }
+    cache.scene = this;
+    cache.origin = p;
+    cache.cnt = 0;
+
 	Ray ray;
 	ray.m_Ori = p;
 	ray.m_Dir = Vector( 0.0f , 1.0f , 0.0f );		// shoot the ray through a random direction.
-	while (g_accelerator->UpdateMediumStack(ray, ms, true)) {}
+
+    // Only the volume primitives are of interest here, all boundaries along the ray are gathered in one traversal unless
+    // there are more of them than what one query holds, in which case the query resumes behind the farthest one.
+    auto more = true;
+    while( more ){
+        BSSRDFIntersections intersections;
+        g_acceleratorVol->GetIntersect( ray , intersections , INVALID_SID );
+        more = intersections.cnt == TOTAL_SSS_INTERSECTION_CNT;
+
+        std::sort( intersections.intersections , intersections.intersections + intersections.cnt ,
+                   []( const BSSRDFIntersection* i0 , const BSSRDFIntersection* i1 ){ return i0->intersection.t < i1->intersection.t; } );
+
+        for( auto i = 0u ; i < intersections.cnt ; ++i ){
+            const auto& intersection = intersections.intersections[i]->intersection;
+            const auto material = intersection.primitive->GetMaterial();
+            sAssert( IS_PTR_VALID( material ) , SPATIAL_ACCELERATOR );
+
+            // the medium stack is restored in the reversed order, see Accelerator::UpdateMediumStack for detail.
+            const auto interaction_flag = ( dot( ray.m_Dir , intersection.gnormal ) > 0.0f ) ? SE_ENTERING : SE_LEAVING;
+
+            MediumInteraction mi;
+            mi.intersect = intersection.intersect;
+            mi.mesh = intersection.primitive->GetMesh();
+
+            const auto medium_cnt = ms.m_mediumCnt;
+            material->UpdateMediumStack( mi , interaction_flag , ms );
+
+            // keep track of the boundaries whose mediums are still in the stack
+            if( ms.m_mediumCnt > medium_cnt && cache.cnt < MEDIUM_MAX_CNT ){
+                cache.materials[cache.cnt] = material;
+                cache.interactions[cache.cnt++] = mi;
+            }else if( ms.m_mediumCnt < medium_cnt ){
+                for( auto j = 0u ; j < cache.cnt ; ++j ){
+                    if( cache.materials[j]->GetUniqueID() == material->GetUniqueID() ){
+                        --cache.cnt;
+                        cache.materials[j] = cache.materials[cache.cnt];
+                        cache.interactions[j] = cache.interactions[cache.cnt];
+                        break;
+                    }
+                }
+            }
+        }
+
+        if( more ){
+            ray.m_Ori = intersections.intersections[intersections.cnt - 1]->intersection.intersect;
+            ray.m_fMin = 0.001f;              // avoid self collision again.
+        }
+    }
 }
 
 void Scene::GetIntersect( const Ray& r , BSSRDFIntersections& intersect , const StringID matID ) const{
     // no brute force support in BSSRDF
+    RecordRayAov();
+    Scheduler::GetSingleton().CountRays( 1 );
+
+    const auto group = ( matID != INVALID_SID ) ? m_sssGroups.Find( matID ) : nullptr;
+    if( group && group->accelerator ){
+        group->accelerator->GetIntersect( r , intersect , matID );
+        return;
+    }
+
     if(IS_PTR_VALID(g_accelerator))
         g_accelerator->GetIntersect( r , intersect , matID );
 }
 
+void Scene::BuildSSSAccelerators(){
+    sAssert( g_accelerator , SPATIAL_ACCELERATOR );
+
+    SORT_STATS(sSceneSSSAcceleratorCount = 0);
+
+    // primitives are grouped again since they could be different after the scene is updated
+    m_sssGroups.ForEach( []( const StringID , SSSGroup& group ){
+        group.primitives.clear();
+    } );
+    for( const auto primitive : m_primitives ){
+        const auto material = primitive->GetMaterial();
+        if( material->HasSSS() )
+            m_sssGroups[material->GetUniqueID()].primitives.push_back( primitive );
+    }
+
+    const auto max_cnt = (std::size_t)( SSS_ACCELERATOR_MAX_PORTION * m_primitives.size() );
+    m_sssGroups.ForEach( [&]( const StringID , SSSGroup& group ){
+        group.accelerator = nullptr;
+        if( group.primitives.empty() )
+            return;
+        if( group.primitives.size() > max_cnt )
+            return;
+
+        BBox bbox;
+        for( const auto primitive : group.primitives )
+            bbox.Union( primitive->GetBBox() );
+
+        // same as the scene, the bounding box is enlarged a little
+        const auto delta = ( bbox.m_Max - bbox.m_Min ) * 0.001f;
+        bbox.m_Min -= delta;
+        bbox.m_Max += delta;
+
+        group.accelerator = g_accelerator->Clone();
+        group.accelerator->Build( group.primitives , bbox );
+        SORT_STATS(++sSceneSSSAcceleratorCount);
+    } );
+}
+
 void Scene::generatePriBuf(){
+    // identical meshes need to be counted before the first of them fills the scene
+    for( auto& entity : m_entities )
+        entity->PrepareScene( *this );
     for( auto& entity : m_entities )
         entity->FillScene( *this );
-    
+
+    genBBox();
+
+    // transformation and order of primitives are not covered in the hash of meshes
+    for (const auto& primitive : m_primitives) {
+        m_topologyHash = HashValue( primitive->GetShapeType() , m_topologyHash );
+        m_geometryHash = HashValue( primitive->GetBBox() , m_geometryHash );
+    }
+}
+
+void Scene::genBBox(){
     auto generate_bbox = [](const std::vector<const Primitive*>& primitives) {
         BBox bbox;
 
@@ -140,6 +414,31 @@ void Scene::generatePriBuf(){
     m_bboxVol   = generate_bbox(m_volPrimitives);
 }
 
+bool Scene::UpdateTransform( unsigned int index , const Transform& transform ){
+    if( index >= m_entities.size() )
+        return false;
+
+    m_entities[index]->UpdateTransform( transform );
+    genBBox();
+    return true;
+}
+
+bool Scene::UpdateLight( unsigned int index , float energy , const Spectrum& color ){
+    if( index >= m_entities.size() || !m_entities[index]->UpdateLight( energy , color ) )
+        return false;
+
+    genLightDistribution();
+    return true;
+}
+
+bool Scene::UpdateEntity( unsigned int index , IStreamBase& stream ){
+    if( index >= m_entities.size() )
+        return false;
+
+    m_entities[index]->Serialize( stream );
+    return true;
+}
+
 void Scene::genLightDistribution(){
     unsigned count = (unsigned)m_lights.size();
     if( count == 0 )
@@ -156,7 +455,19 @@ void Scene::genLightDistribution(){
     for( unsigned i = 0 ; i < count ; i++ )
         m_lights[i]->SetPickPDF( pdf[i] / total_pdf );
 
-    m_lightsDis = std::make_unique<Distribution1D>( pdf.get() , count );
+    m_lightsDis = std::make_unique<AliasTable>( pdf.get() , count );
+
+    // lights that can't be bounded are picked without the light tree
+    std::vector<const Light*> bounded_lights;
+    m_infiniteLights.clear();
+    for( const auto light : m_lights ){
+        LightBounds bounds;
+        if( light->GetBounds( bounds ) )
+            bounded_lights.push_back( light );
+        else
+            m_infiniteLights.push_back( light );
+    }
+    m_lightTree.Build( bounded_lights );
 }
 
 const Light* Scene::SampleLight( float u , float* pdf ) const{
@@ -177,6 +488,42 @@ float Scene::LightProperbility( unsigned i ) const{
     return m_lightsDis->GetProperty( i );
 }
 
+const Light* Scene::SampleLight( const Point& p , const Vector& n , float u , float* pdf ) const{
+    sAssert( u >= 0.0f && u <= 1.0f , SAMPLING );
+    if( pdf )
+        *pdf = 0.0f;
+
+    const auto infinite_cnt = (unsigned)m_infiniteLights.size();
+    const auto candidate_cnt = infinite_cnt + ( m_lightTree.IsEmpty() ? 0 : 1 );
+    if( 0 == candidate_cnt )
+        return nullptr;
+
+    const auto pick_infinite = (float)infinite_cnt / (float)candidate_cnt;
+    if( u < pick_infinite ){
+        const auto id = std::min( (unsigned)( u / pick_infinite * infinite_cnt ) , infinite_cnt - 1 );
+        if( pdf )
+            *pdf = pick_infinite / (float)infinite_cnt;
+        return m_infiniteLights[id];
+    }
+
+    auto tree_pdf = 0.0f;
+    const auto light = m_lightTree.Sample( p , n , std::min( ( u - pick_infinite ) / ( 1.0f - pick_infinite ) , 1.0f - FLT_EPSILON ) , &tree_pdf );
+    if( pdf )
+        *pdf = ( 1.0f - pick_infinite ) * tree_pdf;
+    return light;
+}
+
+float Scene::LightProperbility( const Point& p , const Vector& n , const Light* light ) const{
+    const auto infinite_cnt = (unsigned)m_infiniteLights.size();
+    const auto candidate_cnt = infinite_cnt + ( m_lightTree.IsEmpty() ? 0 : 1 );
+    if( 0 == candidate_cnt || IS_PTR_INVALID(light) )
+        return 0.0f;
+
+    if( std::find( m_infiniteLights.begin() , m_infiniteLights.end() , light ) != m_infiniteLights.end() )
+        return 1.0f / (float)candidate_cnt;
+    return ( 1.0f - (float)infinite_cnt / (float)candidate_cnt ) * m_lightTree.Pdf( p , n , light );
+}
+
 Spectrum Scene::Le( const Ray& ray ) const{
     if( m_skyLight ){
         Spectrum r;
@@ -191,4 +538,32 @@ void Scene::AddLight( Light* light ){
         m_lights.push_back( light );
         light->SetupScene( this );
     }
-}
\ No newline at end of file
+}
+const InstancePrototype* Scene::AddInstancePrototype( const StringID& name , const InstancePrototype* prototype ){
+    auto& registered = m_prototypes[name];
+    sAssertMsg( !registered , RESOURCE , "Instanced mesh is registered more than once." );
+    if( !registered ){
+        registered = prototype;
+        m_hasTransparency |= prototype->HasTransparency();
+        m_hasSSS |= prototype->HasSSS();
+        m_hasVolume |= prototype->HasVolume();
+    }
+    return registered;
+}
+
+void Scene::AddSharedMesh( const std::uint64_t hash , const InstancePrototype* prototype , const Transform& transform ){
+    auto& shared = m_sharedMeshes[hash];
+    sAssertMsg( !shared.prototype , RESOURCE , "Shared mesh is registered more than once." );
+    shared.prototype = prototype;
+    shared.transform = transform;
+
+    // the primitives of instances don't carry the materials of the prototype
+    m_hasTransparency |= prototype->HasTransparency();
+    m_hasSSS |= prototype->HasSSS();
+    m_hasVolume |= prototype->HasVolume();
+}
+
+const InstancePrototype* Scene::GetInstancePrototype( const StringID& name ) const{
+    const auto it = m_prototypes.find( name );
+    return it == m_prototypes.end() ? nullptr : it->second;
+}
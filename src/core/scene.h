@@ -19,6 +19,7 @@
 
 #include "core/define.h"
 #include <vector>
+#include <unordered_map>
 #include "core/sassert.h"
 #include "math/bbox.h"
 #include "spectrum/spectrum.h"
@@ -28,9 +29,17 @@
 #include "entity/entity.h"
 #include "core/primitive.h"
 #include "core/samplemethod.h"
+#include "core/strid.h"
+#include "core/hash.h"
+#include "core/flatmap.h"
+#include "shape/instance.h"
+#include "light/lighttree.h"
 
 class Light;
+class Accelerator;
 struct BSSRDFIntersections;
+struct RayBatch;
+struct HitRecord;
 
 //! @brief  Data structure representing the whole scene.
 /**
@@ -38,12 +47,46 @@ struct BSSRDFIntersections;
  */
 class   Scene{
 public:
+    //! @brief  Default constructor.
+    Scene();
+
+    //! @brief  Destructor, it is defined where the accelerators of materials are complete types.
+    ~Scene();
+
     //! @brief Serialize scene from stream.
     //!
     //! @param  stream      The streaming source where scene information is loaded from.
     //! @return             Whether the scene is loaded correctly.
     bool    LoadScene( class IStreamBase& stream );
 
+    //! @brief  Move an entity of the scene to a new place.
+    //!
+    //! The bounding box of the scene is updated, while the spatial acceleration structure needs to be refitted after this.
+    //!
+    //! @param  index       Index of the entity in the order of the stream.
+    //! @param  transform   The new transform of the entity.
+    //! @return             Whether there is such an entity.
+    bool    UpdateTransform( unsigned int index , const Transform& transform );
+
+    //! @brief  Change the strength and color of the light in an entity of the scene.
+    //!
+    //! Lights are picked by their new power from now on.
+    //!
+    //! @param  index       Index of the entity in the order of the stream.
+    //! @param  energy      The new strength of the light.
+    //! @param  color       The new color of the light.
+    //! @return             Whether there is such an entity with a light in it.
+    bool    UpdateLight( unsigned int index , float energy , const Spectrum& color );
+
+    //! @brief  Load an entity again from the stream.
+    //!
+    //! It only works for entities that could be serialized more than once, like cameras.
+    //!
+    //! @param  index       Index of the entity in the order of the stream.
+    //! @param  stream      The streaming source where the entity is loaded from.
+    //! @return             Whether there is such an entity.
+    bool    UpdateEntity( unsigned int index , class IStreamBase& stream );
+
     //! @brief  Find the first intersection between a ray and the whole scene.
     //!
     //! @param  intersect   Intersection information at exitant point.
@@ -52,7 +95,25 @@ public:
     //! @return             Whether there is an intersection between the ray and the scene.
     bool    GetIntersect( const Ray& r , SurfaceInteraction& intersect ) const;
 
-#ifndef ENABLE_TRANSPARENT_SHADOW
+    //! @brief  Find the first intersections between a packet of coherent rays and the whole scene.
+    //!
+    //! @param  rays        The rays to be tested.
+    //! @param  intersects  The results where the intersected information is to be returned, one for each ray.
+    //!                     A ray misses the scene if the primitive of its intersection is nullptr.
+    //! @param  cnt         Number of rays in the packet.
+    void    GetIntersect( const Ray* rays , SurfaceInteraction* intersects , unsigned int cnt ) const;
+
+    //! @brief  Find the first intersections between a batch of incoherent rays and the whole scene.
+    //!
+    //! Rays are interleaved with each other during traversal to hide the latency of fetching nodes, it pays off for
+    //! secondary rays in scenes too large for the cache.
+    //!
+    //! @param  rays        The rays to be tested.
+    //! @param  intersects  The results where the intersected information is to be returned, one for each ray.
+    //!                     A ray misses the scene if the primitive of its intersection is nullptr.
+    //! @param  cnt         Number of rays in the batch.
+    void    GetIntersectIncoherent( const Ray* rays , SurfaceInteraction* intersects , unsigned int cnt ) const;
+
     //! @brief  This is a dedicated interface for detecting shadow rays.
     //!
     //! Instead of merging the interface with 'GetIntersect', this is a separate interface purely for occlusion detection.
@@ -62,7 +123,43 @@ public:
     //! @param r            The ray to be tested.
     //! @return             Whether the ray is occluded by anything.
     bool    IsOccluded(const Ray& r) const;
-#else
+
+    //! @brief  Detect occlusion of a shadow ray toward a light.
+    //!
+    //! Each thread remembers the primitive that blocked the last shadow ray toward a light, it is tested first before
+    //! traversing the spatial data structure. Neighboring shading points usually have their lights blocked by the same
+    //! wall or ceiling.
+    //!
+    //! @param r            The ray to be tested.
+    //! @param light        The light the ray goes toward, nothing is cached if it is nullptr.
+    //! @return             Whether the ray is occluded by anything.
+    bool    IsOccluded( const Ray& r , const Light* light ) const;
+
+    //! @brief  Detect occlusion of a batch of shadow rays.
+    //!
+    //! Shadow rays from the same shading point, like the ones toward all lights in the scene, are better to be tested
+    //! together so that the spatial data structure is traversed once for all of them.
+    //!
+    //! @param rays         The shadow rays to be tested.
+    //! @param occluded     Whether each of the rays is occluded by anything.
+    //! @param cnt          Number of rays in the batch.
+    void    IsOccluded( const Ray* rays , bool* occluded , unsigned int cnt ) const;
+
+    //! @brief  Find the nearest hits of a batch of rays laid out as structure of arrays.
+    //!
+    //! It is meant for wavefront style integrators, only the distances and the primitives being hit are reported.
+    //!
+    //! @param  rays        The rays to be tested, the ones with a zero mask are skipped.
+    //! @param  hits        The nearest hit of each ray in the batch.
+    void    IntersectBatch( const RayBatch& rays , HitRecord* hits ) const;
+
+    //! @brief  Detect occlusion of a batch of rays laid out as structure of arrays.
+    //!
+    //! @param  rays        The rays to be tested, the ones with a zero mask are skipped.
+    //! @param  occluded    Whether each of the rays is occluded by anything.
+    void    OccludedBatch( const RayBatch& rays , bool* occluded ) const;
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
     //! @brief  Evaluate occlusion along a ray segment.
     //!
     //! This doesn't normally happen in real life. But with the introduction of transparent BSDF, it is inevitable to support
@@ -72,12 +169,17 @@ public:
     //!
     //! @param  r           The ray to be tested.
     //! @param  ms          The medium stack to be passed in. Medium aware integrator needs to pass non-empty pointer.
+    //! @param  light       The light the ray goes toward, it is used to cache occluders in scenes without transparency.
     //! @return             The occlusion along the ray.
-    Spectrum    GetAttenuation( const Ray& r , MediumStack* ms = nullptr ) const;
+    Spectrum    GetAttenuation( const Ray& r , MediumStack* ms = nullptr , const Light* light = nullptr ) const;
 #endif
 
 	//! @brief	Restore the medium stack at a specific point.
 	//!
+	//! All volume boundaries along a ray starting from the point are gathered with one traversal of the volume accelerator.
+	//! The result is cached per thread, restoring the stack at the same point again, like the origin of a pinhole camera,
+	//! doesn't touch the accelerator at all.
+	//!
 	//! @param	p			The point where the evaluation is done.
 	//! @param	ms			The medium stack to be populated.
 	void		RestoreMediumStack( const Point& p , MediumStack& ms ) const ;
@@ -88,10 +190,12 @@ public:
     //! above one to acquire all intersections in a brute force way, which obviously introduces quite some duplicated work.
     //! The intersection returned doesn't guarrantee the order of the intersection of the results, but it does guarrantee to get the
     //! nearest N intersections.
+    //! Probe rays of a material with its own accelerator only traverse the primitives of that material.
     //!
     //! @param  r           The input ray to be tested.
     //! @param  intersect   The intersection result that holds all intersection.
     //! @param  matID       We are only interested in intersection with the same material, whose material id should be set to matID.
+    //!                     INVALID_SID accepts intersections with any material.
     void    GetIntersect( const Ray& r , BSSRDFIntersections& intersect , const StringID matID = INVALID_SID ) const;
 
     // get light
@@ -113,6 +217,28 @@ public:
     const Light* SampleLight( float u , float* pdf ) const;
     // get the properbility of the sample
     float LightProperbility( unsigned i ) const;
+
+    //! @brief  Pick a light for a shading point.
+    //!
+    //! Unlike the above one, lights that contribute more to the shading point are more likely to be picked. Bounded lights are
+    //! picked through the light tree, infinite lights are picked uniformly with the light tree as one more candidate.
+    //!
+    //! @param  p           The position of the shading point.
+    //! @param  n           The normal at the shading point, it is a zero vector if the shading point is in a medium.
+    //! @param  u           The canonical random number to pick a light.
+    //! @param  pdf         The pdf of picking the light.
+    //! @return             The picked light, nullptr if there is no light that could lit the shading point.
+    const Light* SampleLight( const Point& p , const Vector& n , float u , float* pdf ) const;
+
+    //! @brief  The pdf of picking a light for a shading point.
+    //!
+    //! It matches the pdf returned by the above 'SampleLight', it is needed by MIS when a light is hit by a ray sampled from BSDF.
+    //!
+    //! @param  p           The position of the shading point.
+    //! @param  n           The normal at the shading point, it is a zero vector if the shading point is in a medium.
+    //! @param  light       The light to be evaluated.
+    //! @return             The pdf of picking the light.
+    float LightProperbility( const Point& p , const Vector& n , const Light* light ) const;
     // get the number of lights
     unsigned LightNum() const{
         return (unsigned)m_lights.size();
@@ -139,6 +265,34 @@ public:
 		const auto material = primitive->GetMaterial();
 		if( material->HasVolumeAttached() )
 			m_volPrimitives.push_back( primitive );
+
+        m_hasTransparency |= primitive->HasTransparency();
+        m_hasSSS |= material->HasSSS();
+        m_hasVolume |= material->HasVolumeAttached();
+    }
+
+    //! @brief  Whether shadow rays are blocked by whatever they hit in the scene.
+    //!
+    //! Shadow rays in a scene without any transparent material only need to know whether there is anything in between, the
+    //! any-hit traversal is good enough for them even if transparent shadow is enabled.
+    //!
+    //! @return     Whether no material in the scene has transparency.
+    bool    IsOpaque() const {
+        return !m_hasTransparency;
+    }
+
+    //! @brief  Whether any material in the scene has SSS.
+    //!
+    //! @return     Whether any material in the scene has SSS.
+    bool    HasSSS() const {
+        return m_hasSSS;
+    }
+
+    //! @brief  Whether any material in the scene has volume attached.
+    //!
+    //! @return     Whether any material in the scene has volume attached.
+    bool    HasVolume() const {
+        return m_hasVolume;
     }
     
     //! @brief  Get all of the primitives in the scene.
@@ -155,6 +309,85 @@ public:
 		return m_volPrimitives;
 	}
 
+    //! @brief  Build a dedicated accelerator for each material with SSS.
+    //!
+    //! Probe rays of SSS only care about the primitives sharing the material of the shading point, traversing the whole scene for
+    //! them is mostly wasted. Materials covering a large part of the scene are left to the accelerator of the scene since there
+    //! is little to gain. It needs to be called again once primitives are moved.
+    void    BuildSSSAccelerators();
+
+    //! @brief  Mix the hashes of some geometry in the scene into the hashes of the scene.
+    //!
+    //! @param  topology    Hash of the topology of the geometry, like the indices of a mesh.
+    //! @param  geometry    Hash of the positions of the geometry, like the vertices of a mesh.
+    void    AddGeometryHash( std::uint64_t topology , std::uint64_t geometry ){
+        m_topologyHash = HashValue( topology , m_topologyHash );
+        m_geometryHash = HashValue( geometry , m_geometryHash );
+    }
+
+    //! @brief  Get the hash of the topology of the scene.
+    //!
+    //! It covers the number and shapes of all primitives in the order they are added to the scene. A cached acceleration
+    //! structure with the same topology could be refitted instead of being built again.
+    //!
+    //! @return     Hash of the topology of the scene.
+    std::uint64_t   GetTopologyHash() const {
+        return m_topologyHash;
+    }
+
+    //! @brief  Get the hash of all geometry in the scene.
+    //!
+    //! Acceleration structures cached on disk are keyed by it, it covers the positions and bounding boxes of all primitives
+    //! in the order they are added to the scene.
+    //!
+    //! @return     Hash of the geometry in the scene.
+    std::uint64_t   GetGeometryHash() const {
+        return m_geometryHash;
+    }
+
+    //! @brief  Register a mesh shared by multiple instances.
+    //!
+    //! @param  name        Name of the shared mesh.
+    //! @param  prototype   The prototype of the shared mesh with its BVH built, it needs to stay alive for the life time of the scene.
+    //! @return             The prototype of the shared mesh.
+    const InstancePrototype*    AddInstancePrototype( const StringID& name , const InstancePrototype* prototype );
+
+    //! @brief  Get a mesh shared by multiple instances.
+    //!
+    //! @param  name    Name of the shared mesh.
+    //! @return         The prototype of the shared mesh, nullptr if it is not registered yet.
+    const InstancePrototype*    GetInstancePrototype( const StringID& name ) const;
+
+    //! @brief  Meshes with identical content in their local space, they could be shared as instances of one of them.
+    struct SharedMesh{
+        unsigned int                count = 0;                  /**< Number of the identical meshes in the scene. */
+        const InstancePrototype*    prototype = nullptr;        /**< The prototype of the meshes, nullptr until the first of them fills the scene. */
+        Transform                   transform;                  /**< The transform the prototype is baked with. */
+    };
+
+    //! @brief  Count a mesh that could be shared with identical meshes.
+    //!
+    //! @param  hash    Hash of the content of the mesh in its local space.
+    void                        CountSharedMesh( const std::uint64_t hash ){
+        ++m_sharedMeshes[hash].count;
+    }
+
+    //! @brief  Register the prototype of identical meshes, the first of them bakes its mesh in world space for it.
+    //!
+    //! @param  hash        Hash of the content of the meshes in their local space.
+    //! @param  prototype   The prototype with its BVH built, it needs to stay alive for the life time of the scene.
+    //! @param  transform   The transform the mesh of the prototype is baked with.
+    void                        AddSharedMesh( const std::uint64_t hash , const InstancePrototype* prototype , const Transform& transform );
+
+    //! @brief  Get the meshes sharing the same content.
+    //!
+    //! @param  hash    Hash of the content of the mesh in its local space.
+    //! @return         The meshes sharing the content, nullptr if the mesh is not counted.
+    const SharedMesh*           GetSharedMesh( const std::uint64_t hash ) const{
+        const auto it = m_sharedMeshes.find( hash );
+        return it == m_sharedMeshes.end() ? nullptr : &it->second;
+    }
+
     // Evaluate sky
     Spectrum    Le( const Ray& ray ) const;
 
@@ -173,20 +406,44 @@ private:
 
     std::vector<const Primitive*>               m_primitives;           /**< A list holding all primitives. */
     std::vector<const Primitive*>               m_volPrimitives;        /**< A list holding all primitives that has volume attached to it. */
+    std::unordered_map<StringID, const InstancePrototype*>  m_prototypes;   /**< Meshes shared by multiple instances. */
+    std::unordered_map<std::uint64_t, SharedMesh>           m_sharedMeshes; /**< Identical meshes found in the scene, keyed by the hash of their content. */
+
+    //! @brief  Primitives of a material with SSS and the accelerator built for them.
+    struct SSSGroup{
+        std::vector<const Primitive*>   primitives;             /**< Primitives with the material. */
+        std::unique_ptr<Accelerator>    accelerator;            /**< Accelerator of the primitives, nullptr if it is not worth one. */
+    };
+    FlatSidMap<SSSGroup>                        m_sssGroups;            /**< Primitives of each material with SSS. */
+    bool                                        m_hasTransparency = false;  /**< Whether any primitive in the scene has transparency. */
+    bool                                        m_hasSSS = false;           /**< Whether any primitive in the scene has SSS. */
+    bool                                        m_hasVolume = false;        /**< Whether any primitive in the scene has volume attached. */
+    const std::uint64_t                         m_uid;                  /**< Unique id of the scene. */
 
     Light*                  m_skyLight = nullptr;   /**< Sky light if available. */
     Camera*                 m_camera = nullptr;     /**< Camera of the scene. */
 
     /**< distribution of light power */
-    std::unique_ptr<Distribution1D>             m_lightsDis = nullptr;
+    std::unique_ptr<AliasTable>                 m_lightsDis = nullptr;
+    /**< Light tree of all bounded lights. */
+    LightTree                                   m_lightTree;
+    /**< Lights that are not in the light tree. */
+    std::vector<const Light*>                   m_infiniteLights;
 
     // bounding box for the scene
     BBox    m_bbox;
     BBox    m_bboxVol;
+    /**< Hash of the topology of the scene. */
+    std::uint64_t   m_topologyHash = FNV_OFFSET_BASIS;
+    /**< Hash of all geometry in the scene. */
+    std::uint64_t   m_geometryHash = FNV_OFFSET_BASIS;
 
     // generate primitive buffer
     void    generatePriBuf();
 
+    // evaluate the bounding boxes of the scene from its primitives
+    void    genBBox();
+
     // compute light cdf
     void    genLightDistribution();
 
@@ -0,0 +1,131 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include "sharedblob.h"
+#include "core/log.h"
+#include "core/profile.h"
+
+static constexpr unsigned int SHARED_BLOB_MAGIC     = 0x424C4253;
+static constexpr unsigned int SHARED_BLOB_VERSION   = 1;
+
+// The header of a blob, the data follows it.
+struct SharedBlobHeader{
+    unsigned int    magic;
+    unsigned int    version;
+    std::uint64_t   key;
+    std::uint64_t   size;
+};
+static_assert( sizeof( SharedBlobHeader ) <= SharedBlob::SHARED_BLOB_ALIGNMENT , "The header of a shared blob needs to fit in an aligned block." );
+
+static std::string blobFilePath( const std::string& dir , std::uint64_t key ){
+    char name[32];
+    snprintf( name , sizeof( name ) , "%016llx.blob" , (unsigned long long)key );
+    return ( std::filesystem::path( dir ) / name ).string();
+}
+
+static std::size_t alignUp( std::size_t offset ){
+    return ( offset + SharedBlob::SHARED_BLOB_ALIGNMENT - 1 ) & ~( SharedBlob::SHARED_BLOB_ALIGNMENT - 1 );
+}
+
+std::size_t SharedBlob::ChunkOffset( const std::vector<Chunk>& chunks , std::size_t index ){
+    auto offset = (std::size_t)0;
+    for( auto i = (std::size_t)0 ; i < index ; ++i )
+        offset = alignUp( offset + chunks[i].size );
+    return offset;
+}
+
+std::shared_ptr<const SharedBlob> SharedBlob::Open( const std::string& dir , std::uint64_t key ){
+    // IMappedFileStream complains about missing files, a blob not published yet is totally expected though.
+    const auto filename = blobFilePath( dir , key );
+    if( dir.empty() || !std::ifstream( filename ).good() )
+        return nullptr;
+
+    // lookups of shared data are random, reading ahead doesn't help
+    auto file = std::make_unique<IMappedFileStream>( filename , false );
+    if( !file->IsValid() || file->GetSize() < SHARED_BLOB_HEADER_SIZE + sizeof( unsigned int ) )
+        return nullptr;
+
+    SharedBlobHeader header;
+    memcpy( &header , file->GetData() , sizeof( header ) );
+    if( header.magic != SHARED_BLOB_MAGIC || header.version != SHARED_BLOB_VERSION || header.key != key )
+        return nullptr;
+    if( header.size != file->GetSize() - SHARED_BLOB_HEADER_SIZE - sizeof( unsigned int ) )
+        return nullptr;
+
+    // a truncated file doesn't end with the magic number
+    unsigned int magic = 0;
+    memcpy( &magic , file->GetData() + file->GetSize() - sizeof( magic ) , sizeof( magic ) );
+    if( magic != SHARED_BLOB_MAGIC )
+        return nullptr;
+
+    auto ret = std::make_shared<SharedBlob>();
+    ret->m_file = std::move( file );
+    ret->m_size = (std::size_t)header.size;
+    return ret;
+}
+
+std::shared_ptr<const SharedBlob> SharedBlob::Publish( const std::string& dir , std::uint64_t key , const std::vector<Chunk>& chunks ){
+    SORT_PROFILE("Publish Shared Blob");
+
+    if( dir.empty() )
+        return nullptr;
+
+    std::error_code err;
+    std::filesystem::create_directories( dir , err );
+
+    // processes publishing the same blob at the same time write different temporary files
+    const auto filename = blobFilePath( dir , key );
+    const auto tmp_filename = filename + "." + std::to_string( std::chrono::steady_clock::now().time_since_epoch().count() ) + ".tmp";
+    {
+        std::ofstream file( tmp_filename , std::ios::binary );
+        if( !file )
+            return nullptr;
+
+        const auto size = chunks.empty() ? 0 : ChunkOffset( chunks , chunks.size() - 1 ) + chunks.back().size;
+        SharedBlobHeader header = { SHARED_BLOB_MAGIC , SHARED_BLOB_VERSION , key , (std::uint64_t)size };
+        char block[SHARED_BLOB_HEADER_SIZE] = { 0 };
+        memcpy( block , &header , sizeof( header ) );
+        file.write( block , SHARED_BLOB_HEADER_SIZE );
+
+        auto offset = (std::size_t)0;
+        for( const auto& chunk : chunks ){
+            const char zeros[SHARED_BLOB_ALIGNMENT] = { 0 };
+            file.write( zeros , alignUp( offset ) - offset );
+            file.write( (const char*)chunk.data , chunk.size );
+            offset = alignUp( offset ) + chunk.size;
+        }
+        file.write( (const char*)&SHARED_BLOB_MAGIC , sizeof( SHARED_BLOB_MAGIC ) );
+        if( !file ){
+            file.close();
+            remove( tmp_filename.c_str() );
+            return nullptr;
+        }
+    }
+
+    // another process may have published it already, the one mapped by it stays valid after it is replaced
+    std::filesystem::rename( tmp_filename , filename , err );
+    if( err ){
+        remove( tmp_filename.c_str() );
+        slog( WARNING , GENERAL , "Failed to publish shared data in %s." , filename.c_str() );
+    }
+    return Open( dir , key );
+}
@@ -0,0 +1,90 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "core/define.h"
+#include "stream/mapstream.h"
+
+//! @brief  Read-only data shared by all SORT processes on the same machine.
+/**
+ * Several SORT processes on a node, like different frames of a sequence, load the same read-only data, like decoded
+ * textures. Instead of each process keeping a private copy, the first process decoding the data publishes it as a file
+ * in the shared cache directory and every process maps the file in read-only mode. Pages of the file live in the page
+ * cache of the OS, all processes share one physical copy of them. A directory on tmpfs, like '/dev/shm', keeps them off
+ * the disk.
+ *
+ * A blob is written to a temporary file first and renamed once it is complete, others never see a partial blob.
+ * Processes publishing the same blob at the same time simply race on the rename, the content is identical anyway, and
+ * a mapped file stays valid even if it is replaced. Blobs are never removed, like the other caches.
+ */
+class SharedBlob{
+public:
+    //! @brief  A block of data to be published.
+    struct Chunk{
+        const void*     data;   /**< Address of the data. */
+        std::size_t     size;   /**< Size of the data in bytes. */
+    };
+
+    //! @brief  Map the blob published by some process.
+    //!
+    //! @param  dir         The shared cache directory.
+    //! @param  key         The key identifying the blob.
+    //! @return             The mapped blob, nullptr if it is not published yet.
+    static std::shared_ptr<const SharedBlob> Open( const std::string& dir , std::uint64_t key );
+
+    //! @brief  Publish a blob and map it.
+    //!
+    //! Each chunk starts at an offset aligned to SHARED_BLOB_ALIGNMENT in the blob.
+    //!
+    //! @param  dir         The shared cache directory.
+    //! @param  key         The key identifying the blob.
+    //! @param  chunks      Blocks of data making up the blob.
+    //! @return             The mapped blob, nullptr if it can't be published.
+    static std::shared_ptr<const SharedBlob> Publish( const std::string& dir , std::uint64_t key , const std::vector<Chunk>& chunks );
+
+    //! @brief  Offset of a chunk in the blob.
+    //!
+    //! @param  chunks      Blocks of data making up the blob.
+    //! @param  index       Index of the chunk.
+    //! @return             Offset of the chunk in bytes.
+    static std::size_t  ChunkOffset( const std::vector<Chunk>& chunks , std::size_t index );
+
+    //! @brief  Get the address of the data in the blob.
+    const char*     GetData() const {
+        return m_file->GetData() + SHARED_BLOB_HEADER_SIZE;
+    }
+
+    //! @brief  Get the size of the data in the blob in bytes.
+    std::size_t     GetSize() const {
+        return m_size;
+    }
+
+    //! @brief  Chunks are aligned for SIMD types and cache lines.
+    static constexpr std::size_t SHARED_BLOB_ALIGNMENT      = 64;
+
+private:
+    std::unique_ptr<IMappedFileStream>  m_file;         /**< The mapped file. */
+    std::size_t                         m_size = 0;     /**< Size of the data in bytes. */
+
+    //! @brief  The header takes a whole aligned block so that the data after it is aligned.
+    static constexpr std::size_t SHARED_BLOB_HEADER_SIZE    = SHARED_BLOB_ALIGNMENT;
+};
@@ -16,7 +16,10 @@
  */
 
 #include <string>
+#include <chrono>
+#include <fstream>
 #include "stats.h"
+#include "core/log.h"
 
 #ifdef SORT_ENABLE_STATS_COLLECTION
 
@@ -42,6 +45,51 @@ private:
 
 static StatsSummary             g_StatsSummary;
 
+// Time spent in each scope by this thread, it is flushed to StatsSummary with other stats at the end of the thread.
+struct StatsScopeData{
+    StatsInt count = 0;
+    StatsInt timeUs = 0;
+};
+static thread_local std::string                                     g_ScopePath;
+static thread_local std::unordered_map<std::string, StatsScopeData> g_ScopeData;
+
+static StatsInt scopeClockUs(){
+    return std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+StatsScope::StatsScope( const std::string& name ) : parentLength( g_ScopePath.size() ) {
+    if( parentLength )
+        g_ScopePath += '/';
+    g_ScopePath += name;
+    start = scopeClockUs();
+}
+
+StatsScope::~StatsScope(){
+    auto& data = g_ScopeData[g_ScopePath];
+    ++data.count;
+    data.timeUs += scopeClockUs() - start;
+    g_ScopePath.resize( parentLength );
+}
+
+static void flushScopes(){
+    for( const auto& scope : g_ScopeData )
+        g_StatsSummary.FlushScope( scope.first , scope.second.count , scope.second.timeUs );
+    g_ScopeData.clear();
+}
+
+// Escape a string so that it could be written in a JSON file.
+static std::string jsonString( const std::string& s ){
+    std::string ret = "\"";
+    for( const auto c : s ){
+        if( c == '"' || c == '\\' )
+            ret += '\\';
+        if( (unsigned char)c < 0x20 )
+            continue;
+        ret += c;
+    }
+    return ret + "\"";
+}
+
 // It is not a global variable because the order of intialization won't be correct if it were one.
 // Static variable in a function will gets intialized the first time it gets executed.
 static auto  GetStatsItemContainer(){
@@ -74,9 +122,55 @@ void StatsSummary::PrintStats() const {
                 slog(INFO, GENERAL, "    %-44s %s", counterItem.first.c_str() , counterItem.second.c_str());
             }
     }
+
+    if( !scopes.empty() ){
+        slog(INFO, GENERAL, "Scopes");
+        for (const auto& scope : scopes)
+            slog(INFO, GENERAL, "    %-44s %s in %s calls", scope.first.c_str(), StatsFormatter_ElaspedTime::ToString( scope.second.timeUs / 1000 ).c_str(), StatsFormatter_Int::ToString( scope.second.count ).c_str());
+    }
     slog(INFO, GENERAL, "----------------------------------------------------------------");
 }
 
+bool StatsSummary::ExportJson(const std::string& filename) const {
+    std::ofstream file( filename , std::ios::out | std::ios::trunc );
+    if( !file.is_open() ){
+        slog(WARNING, GENERAL, "Failed to export stats to %s.", filename.c_str());
+        return false;
+    }
+
+    // raw numbers are exported instead of the formatted strings, so that runs could be compared by tools
+    file << "{\n  \"counters\": {";
+    auto firstCat = true;
+    for (const auto& counterCat : counters) {
+        if( categories.count( counterCat.first ) == 0 )
+            continue;
+        file << ( firstCat ? "\n" : ",\n" ) << "    " << jsonString( counterCat.first ) << ": {";
+        firstCat = false;
+        auto firstItem = true;
+        for (const auto& counterItem : counterCat.second) {
+            file << ( firstItem ? "\n" : ",\n" ) << "      " << jsonString( counterItem.first ) << ": " << counterItem.second->ToJson();
+            firstItem = false;
+        }
+        file << "\n    }";
+    }
+    file << "\n  },\n  \"scopes\": {";
+    auto firstScope = true;
+    for (const auto& scope : scopes) {
+        file << ( firstScope ? "\n" : ",\n" ) << "    " << jsonString( scope.first ) << ": { \"count\": " << scope.second.count << ", \"time_us\": " << scope.second.timeUs << " }";
+        firstScope = false;
+    }
+    file << "\n  }\n}\n";
+    return file.good();
+}
+
+void StatsSummary::FlushScope(const std::string& path, StatsInt count, StatsInt timeUs) {
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& scope = scopes[path];
+    scope.count += count;
+    scope.timeUs += timeUs;
+}
+
 void StatsSummary::FlushCounter(const std::string& category, const std::string& varname, const StatsItemBase* var) {
     static std::mutex mutex;
     std::lock_guard<std::mutex> lock(mutex);
@@ -105,6 +199,10 @@ void StatsItemRegister::FlushData() const
     func(g_StatsSummary);
 }
 
+std::string StatsFormatter_Int::ToJson(StatsInt v){
+    return std::to_string(v);
+}
+
 std::string StatsFormatter_Int::ToString(StatsInt v){
     auto s = std::to_string(v);
     if( s.size() < 5 )
@@ -128,10 +226,23 @@ std::string StatsFormatter_ElaspedTime::ToString(StatsInt v ){
     return stringFormat( "%d(d)%d(h)%d(m)" , v / 1440 , ( v % 1440 ) / 60 , v % 60 );
 }
 
+std::string StatsFormatter_ElaspedTime::ToJson(StatsInt v ){
+    return std::to_string(v);
+}
+
 std::string StatsFormatter_Float::ToString(StatsFloat v ){
     return stringFormat("%.2f",v);
 }
 
+std::string StatsFormatter_Float::ToJson(StatsFloat v ){
+    return stringFormat("%g",v);
+}
+
+// ratios are exported with both operands, the denominator could be zero which is not representable in JSON otherwise
+static std::string ratioToJson( const StatsData_Ratio& ratio ){
+    return stringFormat("{ \"nominator\": %lld, \"denominator\": %lld }", ratio.nominator, ratio.denominator);
+}
+
 std::string StatsFormatter_Ratio::ToString( StatsData_Ratio ratio ){
     StatsFloat r = (StatsFloat)ratio.nominator / (StatsFloat)ratio.denominator;
     return stringFormat("%.2f%%",r * 100);
@@ -147,11 +258,47 @@ std::string StatsFormatter_RayPerSecond::ToString( StatsData_Ratio ratio ){
     return stringFormat("%.2f(MRay/s)",r);
 }
 
+std::string StatsFormatter_Ratio::ToJson( StatsData_Ratio ratio ){
+    return ratioToJson(ratio);
+}
+
+std::string StatsFormatter_FloatRatio::ToJson( StatsData_Ratio ratio ){
+    return ratioToJson(ratio);
+}
+
+std::string StatsFormatter_RayPerSecond::ToJson( StatsData_Ratio ratio ){
+    return ratioToJson(ratio);
+}
+
+// only buckets with samples are printed, each one is labeled with the largest value it holds
+std::string StatsFormatter_Histogram::ToString( const StatsHistogram& h ){
+    if( h.count == 0 )
+        return "no sample";
+    auto ret = stringFormat("avg %.2f, max %lld |", (StatsFloat)h.sum / (StatsFloat)h.count, h.maximum);
+    for( auto i = 0u ; i < StatsHistogram::BUCKET_CNT ; ++i ){
+        if( h.buckets[i] == 0 )
+            continue;
+        if( i == StatsHistogram::BUCKET_CNT - 1 )
+            ret += stringFormat(" >=%lld:%lld", 1ll << ( i - 1 ), h.buckets[i]);
+        else
+            ret += stringFormat(" <=%lld:%lld", ( 1ll << i ) - 1, h.buckets[i]);
+    }
+    return ret;
+}
+
+std::string StatsFormatter_Histogram::ToJson( const StatsHistogram& h ){
+    auto ret = stringFormat("{ \"count\": %lld, \"sum\": %lld, \"max\": %lld, \"buckets\": [", h.count, h.sum, h.maximum);
+    for( auto i = 0u ; i < StatsHistogram::BUCKET_CNT ; ++i )
+        ret += stringFormat( i ? ", %lld" : "%lld", h.buckets[i]);
+    return ret + "] }";
+}
+
 #endif
 
 void SortStatsFlushData( bool mainThread ){
 #ifdef SORT_ENABLE_STATS_COLLECTION
     GetStatsItemContainer()->FlushData();
+    flushScopes();
 #endif
 }
 void SortStatsPrintData(){
@@ -160,3 +307,11 @@ void SortStatsPrintData(){
 void SortStatsEnableCategory( const std::string& s ){
     SORT_STATS(g_StatsSummary.EnableCategory(s));
 }
+bool SortStatsExportJson( const std::string& filename ){
+#ifdef SORT_ENABLE_STATS_COLLECTION
+    return g_StatsSummary.ExportJson( filename );
+#else
+    slog(WARNING, GENERAL, "Stats collection is disabled in this build, nothing is exported to %s.", filename.c_str());
+    return false;
+#endif
+}
@@ -25,6 +25,8 @@ void SortStatsFlushData( bool mainThread = false );
 void SortStatsPrintData();
 // Enable specific category
 void SortStatsEnableCategory( const std::string& s );
+// Export Stats Result as a JSON file, this should be called in main thread after all rendering thread is done
+bool SortStatsExportJson( const std::string& filename );
 
 #define StatsInt                            long long
 #define StatsFloat                          float
@@ -55,21 +57,83 @@ struct StatsData_Ratio{
     StatsData_Ratio(StatsInt& v0 , StatsInt& v1 ) : nominator( v0 ) , denominator( v1 ) {}
 };
 
+// StatsHistogram keeps the distribution of a per-event value, like the number of nodes visited by each ray.
+// Bucket 0 counts zeros, bucket i counts values in [2^(i-1), 2^i), the last bucket counts everything beyond.
+struct StatsHistogram{
+    static constexpr unsigned int BUCKET_CNT = 24;
+
+    StatsInt buckets[BUCKET_CNT] = { 0 };
+    StatsInt count = 0;
+    StatsInt sum = 0;
+    StatsInt maximum = 0;
+
+    void Add( StatsInt v ){
+        ++count;
+        sum += v;
+        maximum = v > maximum ? v : maximum;
+        auto bucket = 0u;
+        while( v > 0 && bucket < BUCKET_CNT - 1 ){
+            v >>= 1;
+            ++bucket;
+        }
+        ++buckets[bucket];
+    }
+    StatsHistogram& operator += ( const StatsHistogram& h ){
+        for( auto i = 0u ; i < BUCKET_CNT ; ++i )
+            buckets[i] += h.buckets[i];
+        count += h.count;
+        sum += h.sum;
+        maximum = h.maximum > maximum ? h.maximum : maximum;
+        return *this;
+    }
+};
+
+// StatsHistogramSample counts a value of a single event, it is added to the histogram once it goes out of scope.
+// This keeps functions with many exits from adding the value before each of them.
+class StatsHistogramSample{
+public:
+    StatsHistogramSample( StatsHistogram& h ) : histogram(h) {}
+    ~StatsHistogramSample(){ histogram.Add( value ); }
+    StatsHistogramSample& operator ++ (){ ++value; return *this; }
+    StatsHistogramSample& operator += ( StatsInt v ){ value += v; return *this; }
+
+private:
+    StatsHistogram& histogram;
+    StatsInt        value = 0;
+};
+
+// StatsScope measures the time spent in a scope. Scopes are nested, a scope is identified by its path from the outer
+// most one, like 'render task/Denoising'. Each scope takes a hash lookup, it is meant for coarse work like tasks.
+class StatsScope{
+public:
+    StatsScope( const std::string& name );
+    ~StatsScope();
+
+private:
+    size_t      parentLength;
+    long long   start;
+};
+
 class StatsItemBase{
 public:
     virtual ~StatsItemBase(){}
     virtual std::string ToString() const = 0;
+    virtual std::string ToJson() const = 0;
     virtual void Merge( const StatsItemBase* item ) = 0;
     virtual std::unique_ptr<StatsItemBase> MakeItem() const = 0;
 };
 
 #define SORT_STATS(eva) eva
 
+#define SORT_STATS_SCOPE(name) StatsScope SORT_CAT(stats_scope_, __LINE__)(name);
+
 #define SORT_STATS_DEFINE_COUNTER( var ) thread_local StatsInt var = 0l;
 #define SORT_STATS_DEFINE_FCOUNTER( var ) thread_local StatsFloat var = 0.0f;
+#define SORT_STATS_DEFINE_HISTOGRAM( var ) thread_local StatsHistogram var;
 
 #define SORT_STATS_DECLARE_COUNTER( var ) extern thread_local StatsInt var;
 #define SORT_STATS_DECLARE_FCOUNTER( var ) extern thread_local StatsFloat var;
+#define SORT_STATS_DECLARE_HISTOGRAM( var ) extern thread_local StatsHistogram var;
 
 #define SORT_STATS_ENABLE(category) \
     class StatsCategoryEnabler{ \
@@ -86,6 +150,9 @@ public:\
     std::string ToString() const override{\
         return T::ToString(data);\
     }\
+    std::string ToJson() const override{\
+        return T::ToJson(data);\
+    }\
     void Merge( const StatsItemBase* item ) override{\
         auto p = (const NAME*)(item);\
         sAssertMsg(IS_PTR_VALID(p), GENERAL , "Merging incorrect stats data." );\
@@ -117,6 +184,13 @@ public:\
         SORT_STATS_BASE_TYPE( cat , name , var , formatter , StatsItemFloat , StatsFloat );\
     }
 
+#define SORT_STATS_HISTOGRAM_TYPE( cat , name , var , formatter ) \
+    extern thread_local StatsHistogram var;\
+    namespace SORT_STATS_UNIQUE_NAMESPACE(var){\
+        static StatsHistogram g_Global_Default;\
+        SORT_STATS_BASE_TYPE( cat , name , var , formatter , StatsItemHistogram , StatsHistogram );\
+    }
+
 #define SORT_STATS_RATIO_TYPE( cat , name , var0 , var1 , formatter ) \
     extern thread_local StatsInt var0;\
     extern thread_local StatsInt var1;\
@@ -134,24 +208,34 @@ public:\
 #define SORT_STATS_RATIO( cat , name , var0 , var1 ) SORT_STATS_RATIO_TYPE( cat , name , var0 , var1 , StatsFormatter_Ratio )
 #define SORT_STATS_AVG_COUNT( cat , name , var0 , var1 ) SORT_STATS_RATIO_TYPE( cat , name , var0 , var1 , StatsFormatter_FloatRatio )
 #define SORT_STATS_AVG_RAY_SECOND( cat , name , var0 , var1 ) SORT_STATS_RATIO_TYPE( cat , name , var0 , var1 , StatsFormatter_RayPerSecond )
+#define SORT_STATS_HISTOGRAM( cat , name , var ) SORT_STATS_HISTOGRAM_TYPE( cat , name , var , StatsFormatter_Histogram )
 
-#define SORT_STATS_FORMATTER( name , type ) class name{ public: static std::string ToString( type v ); };
+#define SORT_STATS_FORMATTER( name , type ) class name{ public: static std::string ToString( type v ); static std::string ToJson( type v ); };
 SORT_STATS_FORMATTER( StatsFormatter_ElaspedTime , StatsInt )
 SORT_STATS_FORMATTER( StatsFormatter_Int , StatsInt )
 SORT_STATS_FORMATTER( StatsFormatter_Float , StatsFloat )
 SORT_STATS_FORMATTER( StatsFormatter_FloatRatio , StatsData_Ratio  )
 SORT_STATS_FORMATTER( StatsFormatter_Ratio , StatsData_Ratio )
 SORT_STATS_FORMATTER( StatsFormatter_RayPerSecond , StatsData_Ratio  )
+SORT_STATS_FORMATTER( StatsFormatter_Histogram , const StatsHistogram& )
 
 // StatsSummary keeps all stats data after the rendering is done
 class StatsSummary {
 public:
     void FlushCounter(const std::string& category, const std::string& varname, const StatsItemBase* var);
+    void FlushScope(const std::string& path, StatsInt count, StatsInt timeUs);
     void PrintStats() const;
+    bool ExportJson(const std::string& filename) const;
     void EnableCategory(const std::string& s);
 
 private:
+    struct ScopeData{
+        StatsInt count = 0;
+        StatsInt timeUs = 0;
+    };
+
     std::map<std::string, std::map<std::string, std::unique_ptr<StatsItemBase>>> counters;
+    std::map<std::string, ScopeData> scopes;
     std::unordered_set<std::string> categories = { "Performance" , "Statistics" };
 };
 
@@ -170,6 +254,7 @@ private:
 
 #else
 #define SORT_STATS(eva)
+#define SORT_STATS_SCOPE(name)
 #define SORT_STATS_ENABLE(eva)
 #define SORT_STATS_COUNTER( cat , name , var )
 #define SORT_STATS_FCOUNTER( cat , name , var )
@@ -177,8 +262,11 @@ private:
 #define SORT_STATS_RATIO( cat , name , var0 , var1 )
 #define SORT_STATS_AVG_COUNT( cat , name , var0 , var1 )
 #define SORT_STATS_AVG_RAY_SECOND( cat , name , var0 , var1 )
+#define SORT_STATS_HISTOGRAM( cat , name , var )
 #define SORT_STATS_DEFINE_COUNTER( var )
 #define SORT_STATS_DEFINE_FCOUNTER( var )
+#define SORT_STATS_DEFINE_HISTOGRAM( var )
 #define SORT_STATS_DECLARE_COUNTER( var )
 #define SORT_STATS_DECLARE_FCOUNTER( var )
+#define SORT_STATS_DECLARE_HISTOGRAM( var )
 #endif
@@ -25,22 +25,35 @@
 #include "task/task.h"
 #include "core/profile.h"
 #include "core/define.h"
+#include "core/cpuinfo.h"
+#include "core/workercontext.h"
 
-static thread_local int g_ThreadId = 0;
 int ThreadId(){
-    return g_ThreadId;
+    return GetWorkerContext().tid;
 }
 
 void WorkerThread::BeginThread(){
     m_thread = std::thread([&]() {
-        g_ThreadId = m_tid;
+        // I/O workers outnumber the cores, they are left to the OS instead of sharing the cores of compute workers
+        if( !m_io )
+            PinWorkerThread( m_tid );
         RunThread();
     });
 }
 
 void WorkerThread::RunThread(){
-    static thread_local std::string thread_name = "Thread " + std::to_string( ThreadId() );
+    // everything the thread owns while rendering is created here and released once there is no more task
+    WorkerContext context( (int)m_tid );
+    context.ioWorker = m_io;
+    BindWorkerContext( &context );
+
+    static thread_local std::string thread_name = ( m_io ? "I/O Thread " : "Thread " ) + std::to_string( ThreadId() );
     SORT_PROFILE(thread_name.c_str())
-    EXECUTING_TASKS();
+    if( m_io )
+        EXECUTING_IO_TASKS();
+    else
+        EXECUTING_TASKS();
     SortStatsFlushData();
+
+    BindWorkerContext( nullptr );
 }
@@ -17,18 +17,39 @@
 
 #pragma once
 
-#include <emmintrin.h>
 #include <thread>
 #include <atomic>
 #include "core/define.h"
 
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    #include <emmintrin.h>
+#elif defined(_M_ARM64) || defined(_M_ARM)
+    #include <intrin.h>
+#endif
+
 // get the thread id
 int ThreadId();
 
+//! @brief  Hint the CPU that the thread is spinning on a busy loop.
+//!
+//! It is 'pause' on x86 and 'yield' on ARM, both give other hardware threads on the same core a chance to proceed without
+//! giving up the time slice of the thread. Other CPUs yield the thread to the scheduler.
+SORT_STATIC_FORCEINLINE void SpinPause(){
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    _mm_pause();
+#elif defined(_M_ARM64) || defined(_M_ARM)
+    __yield();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#else
+    std::this_thread::yield();
+#endif
+}
+
 class WorkerThread{
 public:
-    // Constructor
-    WorkerThread( unsigned tid ) : m_tid(tid) {}
+    // Constructor, I/O workers only execute I/O tasks
+    WorkerThread( unsigned tid , bool io = false ) : m_tid(tid) , m_io(io) {}
 
     // Begin thread
     void BeginThread();
@@ -44,6 +65,7 @@ public:
 private:
     std::thread m_thread;
     unsigned    m_tid = 0;
+    bool        m_io = false;
 };
 
 class spinlock_mutex{
@@ -56,7 +78,7 @@ public:
             // they consume CPU cycles all the time. This instruction could allow delaying CPU instructions for a few cycles in
             // some cases to allow other threads to take ownership of hardware resources.
             // https://software.intel.com/en-us/comment/1134767
-            _mm_pause(); 
+            SpinPause();
         }
     }
     void unlock() {
@@ -52,6 +52,15 @@ public:
         return (unsigned int)std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - m_start).count();
     }
 
+    //! @brief  Get elapsed time in microseconds since last time the timer is reset.
+    //!
+    //! It is precise enough for timing a single pixel sample.
+    //!
+    //! @return Get the elapsed time in microseconds.
+    SORT_FORCEINLINE float GetElapsedTimeInMicroseconds() const {
+        return std::chrono::duration<float, std::micro>(clock::now() - m_start).count();
+    }
+
 private:
     std::chrono::time_point<clock>  m_start;        /**< Start point of last time timer is triggered. */
 };
@@ -0,0 +1,38 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "workercontext.h"
+#include "core/memory.h"
+
+thread_local WorkerContext* g_workerContext = nullptr;
+
+WorkerContext::WorkerContext( int tid ) : tid( tid ) , allocator( std::make_unique<MemoryAllocator>() ) {}
+
+WorkerContext::~WorkerContext(){
+    if( g_workerContext == this )
+        g_workerContext = nullptr;
+}
+
+void BindWorkerContext( WorkerContext* context ){
+    g_workerContext = context;
+}
+
+WorkerContext& BindThreadWorkerContext(){
+    static thread_local WorkerContext context;
+    g_workerContext = &context;
+    return context;
+}
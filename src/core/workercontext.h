@@ -0,0 +1,84 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <memory>
+#include "core/define.h"
+#include "core/rand.h"
+
+class MemoryAllocator;
+class Sampler;
+struct AovSample;
+struct RelightSample;
+class TextureFeedback;
+
+//! @brief  WorkerContext holds the state a thread owns while rendering.
+/**
+ * The scratch memory, the random number generator, the sampler and AOV sample of the pixel sample being rendered and
+ * the shading context used to live in their own thread local variables, each access paid for its own TLS lookup. They
+ * are all reached through one pointer to the context of the thread now.
+ *
+ * Worker threads create their context once they start running tasks and it goes away when they are done. Any other
+ * thread, like the main thread, gets one the first time it asks for it, which lives as long as the thread.
+ */
+struct WorkerContext{
+    //! @brief  Constructor.
+    //!
+    //! @param  tid     Id of the thread owning the context.
+    explicit WorkerContext( int tid = 0 );
+
+    //! @brief  Destructor, the scratch memory of the thread is released.
+    ~WorkerContext();
+
+    WorkerContext( const WorkerContext& ) = delete;
+    WorkerContext& operator =( const WorkerContext& ) = delete;
+
+    int                                 tid;                    /**< Id of the thread, 0 for threads not spawned by the scheduler. */
+    bool                                ioWorker = false;       /**< Whether the thread is an I/O worker, which only executes I/O tasks. */
+    std::unique_ptr<MemoryAllocator>    allocator;              /**< Scratch memory of the thread. */
+    RandomState                         random;                 /**< State of the random number generator. */
+    Sampler*                            sampler = nullptr;      /**< Sampler of the pixel sample being rendered, nullptr if there is none. */
+    AovSample*                          aovSample = nullptr;    /**< AOVs recorded by the pixel sample being rendered, nullptr if there is none. */
+    RelightSample*                      relightSample = nullptr;    /**< Radiance of the pixel sample split by lights, nullptr if it is not recorded. */
+    float                               rayTime = 0.0f;         /**< Moment of the pixel sample being rendered. */
+    TextureFeedback*                    textureFeedback = nullptr;  /**< Records texture tiles not resident during prepasses, nullptr otherwise. */
+    std::shared_ptr<void>               shadingContext;         /**< Shading context of TSL, core doesn't know its type. */
+};
+
+//! @brief  Context bound to the current thread, nullptr until it is bound or asked for.
+extern thread_local WorkerContext* g_workerContext;
+
+//! @brief  Bind a context to the current thread.
+//!
+//! @param  context     The context to bind, it needs to outlive the binding. nullptr falls back to the context owned by
+//!                     the thread itself the next time it is asked for.
+void BindWorkerContext( WorkerContext* context );
+
+//! @brief  Create the context owned by the current thread and bind it, it is called the first time a thread that never
+//!         had a context bound asks for one.
+//!
+//! @return             The context of the current thread.
+WorkerContext& BindThreadWorkerContext();
+
+//! @brief  Get the context of the current thread, it takes a single TLS lookup.
+//!
+//! @return             The context of the current thread.
+SORT_FORCEINLINE WorkerContext& GetWorkerContext(){
+    const auto context = g_workerContext;
+    return LIKELY( context != nullptr ) ? *context : BindThreadWorkerContext();
+}
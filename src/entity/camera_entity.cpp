@@ -23,13 +23,35 @@ void PerspectiveCameraEntity::Serialize(IStreamBase& stream) {
     stream >> m_camera->m_up;
     stream >> m_camera->m_target;
     stream >> m_camera->m_lensRadius;
+    stream >> m_camera->m_apertureBlades >> m_camera->m_apertureRotation;
     stream >> m_camera->m_sensorW >> m_camera->m_sensorH >> m_camera->m_aspectFit;
     stream >> m_camera->m_aspectRatioW >> m_camera->m_aspectRatioH;
     stream >> m_camera->m_fov;
 
+    // a moving camera comes with where it looks at evenly spaced moments in the shutter interval
+    auto key_cnt = 0u;
+    stream >> key_cnt;
+    m_camera->m_motionKeys.clear();
+    for( auto i = 0u ; i < key_cnt ; ++i ){
+        Point eye , target;
+        Vector up;
+        stream >> eye >> up >> target;
+        m_camera->m_motionKeys.push_back( ViewLookat( eye , normalize( target - eye ) , up ) );
+    }
+
     m_camera->PreProcess();
 }
 
 void PerspectiveCameraEntity::FillScene(class Scene& scene) {
     scene.SetupCamera(m_camera.get());
+}
+
+void BakeCameraEntity::Serialize(IStreamBase& stream) {
+    stream >> m_camera->m_target;
+    stream >> m_camera->m_padding;
+    stream >> m_camera->m_offset;
+}
+
+void BakeCameraEntity::FillScene(class Scene& scene) {
+    scene.SetupCamera(m_camera.get());
 }
\ No newline at end of file
@@ -19,6 +19,7 @@
 
 #include "entity.h"
 #include "camera/perspective.h"
+#include "camera/bake.h"
 
 //! @brief Camera entity definition.
 /**
@@ -49,4 +50,25 @@ public:
 
 private:
     std::unique_ptr<PerspectiveCamera>  m_camera = std::make_unique<PerspectiveCamera>();   /**< Perspective camera. */
+};
+
+//! @brief Camera baking the radiance on the surface of a mesh into its texture space.
+class BakeCameraEntity : public CameraEntity {
+public:
+    DEFINE_RTTI( BakeCameraEntity , Entity );
+
+    //! @brief  Serialization interface. Loading data from stream.
+    //!
+    //! The index of the target mesh, the padding in texels and the offset of rays above the surface are loaded.
+    //!
+    //! @param  stream      Input stream for data.
+    void    Serialize(IStreamBase& stream) override;
+
+    //! @brief  Setup the scene's camera.
+    //!
+    //! @param  scene       The scene to be filled.
+    void    FillScene(class Scene& scene) override;
+
+private:
+    std::unique_ptr<BakeCamera>         m_camera = std::make_unique<BakeCamera>();          /**< Baking camera. */
 };
\ No newline at end of file
@@ -42,6 +42,30 @@ public:
     //! @param  scene       The scene to be filled.
     virtual void   FillScene( class Scene& scene ) {};
 
+    //! @brief  Prepare for filling the scene, it happens to all entities before any of them fills the scene.
+    //!
+    //! @param  scene       The scene to be filled.
+    virtual void   PrepareScene( class Scene& scene ) {
+        for( auto& visual : m_visuals )
+            visual->PrepareScene( scene );
+    }
+
+    //! @brief  Move the entity after the scene is filled.
+    //!
+    //! Base entity has nothing to be moved.
+    //!
+    //! @param  transform   The new transform of the entity from local space to world space.
+    virtual void   UpdateTransform( const Transform& transform ) {}
+
+    //! @brief  Change the strength and color of the light in the entity after the scene is filled.
+    //!
+    //! Base entity has no light in it.
+    //!
+    //! @param  energy      The new strength of the light, in the unit the entity is loaded with.
+    //! @param  color       The new color of the light.
+    //! @return             Whether there is a light in the entity.
+    virtual bool   UpdateLight( float energy , const Spectrum& color ) { return false; }
+
 protected:
     Transform                           m_transform;    /**< Transform of the entity from local space to world space. */
     std::list<std::unique_ptr<Visual>>  m_visuals;      /**< Visual attached to this entity. */
@@ -20,13 +20,22 @@
 #include "shape/quad.h"
 #include "shape/disk.h"
 #include "core/primitive.h"
+#include "core/scene.h"
+#include "entity/visual.h"
+#include "core/globalconfig.h"
+
+bool LightEntity::UpdateLight( float energy , const Spectrum& color ){
+    getLight()->SetIntensity( color * ( energy * m_intensityScale ) );
+    return true;
+}
 
 void PointLightEntity::Serialize( IStreamBase& stream ){
     stream >> m_light->m_light2world;
     auto energy = 0.0f;
     stream >> energy;
     stream >> m_light->intensity;
-    m_light->intensity *= energy / FOUR_PI;
+    m_intensityScale = 1.0f / FOUR_PI;
+    m_light->intensity *= energy * m_intensityScale;
 }
 
 void PointLightEntity::FillScene(class Scene& scene) {
@@ -52,7 +61,8 @@ void SpotLightEntity::Serialize(IStreamBase& stream) {
     auto energy = 0.0f;
     stream >> energy;
     stream >> m_light->intensity;
-    m_light->intensity *= energy / FOUR_PI;
+    m_intensityScale = 1.0f / FOUR_PI;
+    m_light->intensity *= energy * m_intensityScale;
     
     float cos_falloff_start, cos_total_range;
     stream >> cos_falloff_start;
@@ -71,10 +81,19 @@ void SkyLightEntity::Serialize(IStreamBase& stream) {
     stream >> energy >> m_light->intensity;
     m_light->intensity *= energy;
 
-    // the following code needs to be changed later.
+    // the sky is either an image or the analytic daylight model
+    StringID sky_type;
+    stream >> sky_type;
+    if( sky_type == SID("PREETHAM") ){
+        SkyModel model;
+        stream >> model.turbidity >> model.sunDir >> model.sunRadius >> model.sunStrength;
+        m_light->sky.Bake(model);
+        return;
+    }
+
     std::string filename;
     stream >> filename;
-    m_light->sky.Load(filename);
+    m_light->sky.Load(filename, g_skyCacheFilePath);
 }
 
 void SkyLightEntity::FillScene(class Scene& scene) {
@@ -107,7 +126,7 @@ void AreaLightEntity::Serialize(IStreamBase& stream) {
         m_light->m_shape = std::move(rect);
         
         // The 0.8 factor is purely just to stick the same power with cycles in Blender so that it is easier to compare results with Cycles.
-        m_light->intensity *= 0.8f * energy / ( SQR(size) * sx * sy * PI );
+        m_intensityScale = 0.8f / ( SQR(size) * sx * sy * PI );
 
     }else if( area_type == SID("RECTANGLE") ){
         auto rect = std::make_unique<Quad>();
@@ -119,7 +138,7 @@ void AreaLightEntity::Serialize(IStreamBase& stream) {
         m_light->m_shape = std::move(rect);
 
         // The 0.8 factor is purely just to stick the same power with cycles in Blender so that it is easier to compare results with Cycles.
-        m_light->intensity *= 0.8f * energy / ( sizeX * sx * sizeY * sy * PI );
+        m_intensityScale = 0.8f / ( sizeX * sx * sizeY * sy * PI );
     }else if( area_type == SID("DISK") ){
         // scaling is not supported for now
         auto rect = std::make_unique<Disk>();
@@ -130,10 +149,11 @@ void AreaLightEntity::Serialize(IStreamBase& stream) {
         m_light->m_shape = std::move(rect);
 
         // The 0.8 factor is purely just to stick the same power with cycles in Blender so that it is easier to compare results with Cycles.
-        m_light->intensity *= 0.8f * energy / ( SQR(radius * PI) * sx * sy );
+        m_intensityScale = 0.8f / ( SQR(radius * PI) * sx * sy );
     }else{
         slog( WARNING , LIGHT , "Unrecognized area light type (%u)." , area_type.m_sid );
     }
+    m_light->intensity *= energy * m_intensityScale;
 
     m_primitive = std::make_unique<Primitive>(nullptr, nullptr, m_light->m_shape.get(), m_light.get());
 }
@@ -141,4 +161,35 @@ void AreaLightEntity::Serialize(IStreamBase& stream) {
 void AreaLightEntity::FillScene(class Scene& scene) {
     scene.AddLight(m_light.get());
     scene.AddPrimitive(m_primitive.get());
+}
+
+MeshLightEntity::~MeshLightEntity() {
+}
+
+void MeshLightEntity::Serialize(IStreamBase& stream) {
+    Transform transform;
+    stream >> transform;
+    stream >> m_energy;
+    stream >> m_light->intensity;
+
+    m_visual = std::make_unique<MeshVisual>();
+    m_visual->Serialize( stream );
+    m_visual->ApplyTransform( transform );
+}
+
+void MeshLightEntity::FillScene(class Scene& scene) {
+    const auto& primitives = m_visual->CreatePrimitives( m_light.get() );
+    m_light->Build( *m_visual->m_memory , primitives );
+
+    // the energy is spread over the surface of the mesh the same way as area lights.
+    const auto area = m_light->GetSurfaceArea();
+    if( area > 0.0f ){
+        m_intensityScale = 1.0f / ( area * PI );
+        m_light->intensity *= m_energy * m_intensityScale;
+    }
+
+    scene.AddGeometryHash( m_visual->m_memory->m_topologyHash , m_visual->m_memory->m_geometryHash );
+    for( const auto& primitive : primitives )
+        scene.AddPrimitive( &primitive );
+    scene.AddLight( m_light.get() );
 }
\ No newline at end of file
@@ -23,6 +23,9 @@
 #include "light/spot.h"
 #include "light/skylight.h"
 #include "light/area.h"
+#include "light/meshlight.h"
+
+class MeshVisual;
 
 //! @brief Light entity definition.
 /**
@@ -30,6 +33,21 @@
  * area light, directional light, spot light and sky light.
  */
 class LightEntity : public Entity{
+public:
+    //! @brief  Change the strength and color of the light after the scene is filled.
+    //!
+    //! @param  energy      The new strength of the light, in the unit the entity is loaded with.
+    //! @param  color       The new color of the light.
+    //! @return             Always true.
+    bool    UpdateLight( float energy , const Spectrum& color ) override;
+
+protected:
+    float   m_intensityScale = 1.0f;    /**< Converts the energy loaded with the entity to the intensity of the light. */
+
+    //! @brief  Get the light in the entity.
+    //!
+    //! @return             The light in the entity.
+    virtual Light*  getLight() const = 0;
 };
 
 //! @brief  Point light entity.
@@ -52,6 +70,9 @@ public:
     void    FillScene(class Scene& scene) override;
 
 protected:
+    //! @brief  Get the light in the entity.
+    Light*  getLight() const override { return m_light.get(); }
+
     std::unique_ptr<PointLight>  m_light = std::make_unique<PointLight>();    /**< Light in the entity. */
 };
 
@@ -75,6 +96,9 @@ public:
     void    FillScene(class Scene& scene) override;
 
 protected:
+    //! @brief  Get the light in the entity.
+    Light*  getLight() const override { return m_light.get(); }
+
     std::unique_ptr<SpotLight>  m_light = std::make_unique<SpotLight>();    /**< Light in the entity. */
 };
 
@@ -98,6 +122,9 @@ public:
     void    FillScene(class Scene& scene) override;
 
 protected:
+    //! @brief  Get the light in the entity.
+    Light*  getLight() const override { return m_light.get(); }
+
     std::unique_ptr<DistantLight>  m_light = std::make_unique<DistantLight>();    /**< Light in the entity. */
 };
 
@@ -121,10 +148,45 @@ public:
     void    FillScene(class Scene& scene) override;
 
 protected:
+    //! @brief  Get the light in the entity.
+    Light*  getLight() const override { return m_light.get(); }
+
     std::unique_ptr<Primitive>  m_primitive;                                /**< The primitive of the area light source. */
     std::unique_ptr<AreaLight>  m_light = std::make_unique<AreaLight>();    /**< Light in the entity. */
 };
 
+//! @brief  Mesh light entity.
+/**
+ * The triangles of the emissive mesh are primitives in the scene, all of them share one mesh light.
+ */
+class MeshLightEntity : public LightEntity {
+public:
+    DEFINE_RTTI( MeshLightEntity , Entity );
+
+    //! @brief  Destructor.
+    ~MeshLightEntity() override;
+
+    //! @brief  Serialization interface. Loading data from stream.
+    //!
+    //! Serialize the entity. Loading from an IStreamBase, which could be coming from file, memory or network.
+    //!
+    //! @param  stream      Input stream for data.
+    void    Serialize(IStreamBase& stream) override;
+
+    //! @brief  Fill the scene with primitives.
+    //!
+    //! @param  scene       The scene to be filled.
+    void    FillScene(class Scene& scene) override;
+
+protected:
+    //! @brief  Get the light in the entity.
+    Light*  getLight() const override { return m_light.get(); }
+
+    std::unique_ptr<MeshVisual> m_visual;                                   /**< The emissive mesh. */
+    std::unique_ptr<MeshLight>  m_light = std::make_unique<MeshLight>();    /**< Light in the entity. */
+    float                       m_energy = 0.0f;                            /**< Total energy emitted by the mesh. */
+};
+
 //! @brief  Sky light entity.
 class SkyLightEntity : public LightEntity {
 public:
@@ -145,5 +207,8 @@ public:
     void    FillScene(class Scene& scene) override;
 
 protected:
+    //! @brief  Get the light in the entity.
+    Light*  getLight() const override { return m_light.get(); }
+
     std::unique_ptr<SkyLight>  m_light = std::make_unique<SkyLight>();    /**< Light in the entity. */
 };
\ No newline at end of file
@@ -19,30 +19,238 @@
 #include "visual.h"
 #include "material/matmanager.h"
 #include "core/scene.h"
+#include "shape/instance.h"
+#include "core/globalconfig.h"
+#include "texture/imagetexture2d.h"
+#include "light/volumelight.h"
+#include "core/stats.h"
+
+MeshVisual::MeshVisual(){
+}
+
+MeshVisual::~MeshVisual(){
+}
+
+SORT_STATS_DEFINE_COUNTER(sSimplifiedMeshCount)
+SORT_STATS_DEFINE_COUNTER(sSimplifiedTriangleCount)
+
+SORT_STATS_COUNTER("Mesh", "Simplified Meshes", sSimplifiedMeshCount);
+SORT_STATS_COUNTER("Mesh", "Triangles Removed by LOD", sSimplifiedTriangleCount);
+
+SORT_STATS_DEFINE_COUNTER(sSharedMeshCount)
+SORT_STATS_COUNTER("Mesh", "Meshes Shared as Instances", sSharedMeshCount);
+
+// Meshes needing cells finer than this fraction of their size are close enough to keep all details, while tiny meshes
+// keep a few cells across so that they don't collapse entirely.
+static constexpr int MESH_LOD_MAX_LEVEL = 10;
+static constexpr int MESH_LOD_MIN_LEVEL = 2;
 
 void MeshVisual::FillScene( Scene& scene ){
+    if( fillShared( scene ) )
+        return;
+
+    if( g_lodError > 0.0f && IS_PTR_VALID(scene.GetCamera()) )
+        selectLod( *scene.GetCamera() );
+
+    scene.AddGeometryHash( m_memory->m_topologyHash , m_memory->m_geometryHash );
+    for (const auto& primitive : CreatePrimitives())
+        scene.AddPrimitive(&primitive);
+
+    // emissive heterogeneous volumes are lights too, so that whatever they light up gets direct illumination from them
+    m_memory->SetVolumeLight(nullptr);
+    if (m_memory->GetVolumeMajorantGrid()) {
+        m_volumeLight = std::make_unique<VolumeLight>();
+        if (m_volumeLight->Build(*m_memory)) {
+            scene.AddLight(m_volumeLight.get());
+            m_memory->SetVolumeLight(m_volumeLight.get());
+        } else {
+            m_volumeLight.reset();
+        }
+    }
+}
+
+void MeshVisual::PrepareScene( Scene& scene ){
+    if( g_dedupMesh && m_memory->m_contentHash )
+        scene.CountSharedMesh( m_memory->m_contentHash );
+}
+
+bool MeshVisual::fillShared( Scene& scene ){
+    if( !g_dedupMesh || !m_memory->m_contentHash )
+        return false;
+
+    // meshes without identical ones are filled as usual, they could still be simplified.
+    const auto hash = m_memory->m_contentHash;
+    const auto shared = scene.GetSharedMesh( hash );
+    if( IS_PTR_INVALID(shared) || shared->count < 2 )
+        return false;
+
+    if( IS_PTR_INVALID(shared->prototype) ){
+        scene.AddGeometryHash( m_memory->m_topologyHash , m_memory->m_geometryHash );
+        m_sharedPrototype = std::make_unique<InstancePrototype>( *this );
+        m_sharedPrototype->Build();
+        scene.AddSharedMesh( hash , m_sharedPrototype.get() , m_transform );
+    }else{
+        // the prototype has a copy of the mesh already
+        m_memory = std::make_unique<Mesh>();
+        SORT_STATS(++sSharedMeshCount);
+    }
+
+    m_prototypeTransform = shared->transform;
+    m_sharedInstance = std::make_unique<Instance>( *shared->prototype , m_transform * Inverse( m_prototypeTransform ) );
+    m_primitives.push_back( std::make_unique<Primitive>( nullptr , nullptr , m_sharedInstance.get() ) );
+    scene.AddPrimitive( m_primitives.back().get() );
+    return true;
+}
+
+void MeshVisual::selectLod( const Camera& camera ){
+    // volumes are mapped to the bounding box of the mesh, simplifying it would move the volume
+    if( m_memory->GetVolumeMajorantGrid() )
+        return;
+
+    BBox bbox;
+    for( const auto& position : m_memory->m_positions )
+        bbox.Union( position );
+    const auto size = ( bbox.m_Max - bbox.m_Min ).Length();
+    const auto max_cell_size = camera.GetPixelFootprint( bbox ) * g_lodError;
+    if( size <= 0.0f || max_cell_size <= 0.0f )
+        return;
+
+    // levels are powers of two so that the same mesh seen from about the same distance ends up with the same geometry
+    const auto level = (int)ceil( log2( size / max_cell_size ) );
+    if( level > MESH_LOD_MAX_LEVEL )
+        return;
+
+    const auto triangle_cnt = m_memory->m_indices.size();
+    if( !m_memory->Simplify( size / (float)( 1 << std::max( level , MESH_LOD_MIN_LEVEL ) ) ) )
+        return;
+
+    if( g_compactMesh )
+        m_memory->Compact();
+
+    SORT_STATS(++sSimplifiedMeshCount);
+    SORT_STATS(sSimplifiedTriangleCount += (StatsInt)( triangle_cnt - m_memory->m_indices.size() ));
+}
+
+const std::vector<Primitive>& MeshVisual::CreatePrimitives( Light* light ){
+    // the scene, lights and instances keep pointers in both arrays, they are only created once so that nothing moves
+    if( !m_trianglePrimitives.empty() ){
+        sAssertMsg( m_trianglePrimitives.front().GetLight() == light , GENERAL , "Primitives of a mesh are created again with another light." );
+        return m_trianglePrimitives;
+    }
+
+    // primitives point to the triangles, both arrays are reserved up front
+    const auto cnt = m_memory->m_indices.size();
+    m_triangles.reserve( cnt );
+    m_trianglePrimitives.reserve( cnt );
     for (const auto& mi : m_memory->m_indices){
-        m_triangles.push_back( std::make_unique<Triangle>( this , mi ) );
-        m_primitives.push_back(std::make_unique<Primitive>(m_memory.get(), mi.m_mat, m_triangles.back().get()));
-        scene.AddPrimitive(m_primitives.back().get());
+        m_triangles.emplace_back( this , mi );
+        m_trianglePrimitives.emplace_back( m_memory.get(), mi.m_mat, &m_triangles.back(), light );
+    }
+    return m_trianglePrimitives;
+}
+
+void MeshInstanceVisual::FillScene( Scene& scene ){
+    // the first instance registers the shared mesh, it always comes before the others in the stream.
+    auto prototype = m_prototypeBvh ? scene.AddInstancePrototype( m_prototypeName , m_prototypeBvh.get() ) : scene.GetInstancePrototype( m_prototypeName );
+    sAssertMsg( IS_PTR_VALID(prototype) , RESOURCE , "Instanced mesh is not found." );
+    if( IS_PTR_INVALID(prototype) )
+        return;
+
+    if( m_motionKeys.size() < 2 ){
+        m_instances.push_back( std::make_unique<Instance>( *prototype , m_transform ) );
+    }else{
+        const auto segment_cnt = (unsigned int)m_motionKeys.size() - 1;
+        for( auto i = 0u ; i < segment_cnt ; ++i ){
+            const auto time_begin = (float)i / (float)segment_cnt;
+            const auto time_end = (float)( i + 1 ) / (float)segment_cnt;
+            m_instances.push_back( std::make_unique<Instance>( *prototype , m_motionKeys[i] , m_motionKeys[i+1] , time_begin , time_end ) );
+        }
+    }
+
+    for( const auto& instance : m_instances ){
+        m_primitives.push_back( std::make_unique<Primitive>( nullptr , nullptr , instance.get() ) );
+        scene.AddPrimitive( m_primitives.back().get() );
+    }
+}
+
+void MeshInstanceVisual::Serialize( IStreamBase& stream ){
+    auto has_data = false;
+    stream >> m_prototypeName >> has_data;
+    if( has_data ){
+        m_prototype = std::make_unique<MeshVisual>();
+        m_prototype->Serialize( stream );
+
+        // the shared mesh stays in its local space
+        m_prototype->ApplyTransform( Transform() );
+
+        m_prototypeBvh = std::make_unique<InstancePrototype>( *m_prototype );
+        m_prototypeBvh->Build();
     }
+
+    auto key_cnt = 0u;
+    stream >> key_cnt;
+    m_motionKeys.resize( key_cnt );
+    for( auto& key : m_motionKeys )
+        stream >> key;
+}
+
+void MeshInstanceVisual::ApplyTransform( const Transform& transform ){
+    m_transform = transform;
+}
+
+void MeshInstanceVisual::Move( const Transform& transform ){
+    m_transform = transform * m_transform;
+    for( auto& key : m_motionKeys )
+        key = transform * key;
+
+    if( m_motionKeys.size() < 2 ){
+        for( auto& instance : m_instances )
+            instance->SetTransform( m_transform );
+        return;
+    }
+    for( auto i = 0u ; i < m_instances.size() ; ++i )
+        m_instances[i]->SetMotion( m_motionKeys[i] , m_motionKeys[i+1] );
 }
 
 void MeshVisual::Serialize( IStreamBase& stream ){
     m_memory = std::make_unique<Mesh>();
     m_memory->Serialize(stream);
+
+    // primitives are created from the cleaned up mesh, so that the BVH is built from triangles in a coherent order
+    if( g_cleanMesh )
+        m_memory->Preprocess();
 }
 
 void MeshVisual::ApplyTransform( const Transform& transform ){
+    // a mesh moved after it is compacted is processed in full precision again
+    m_memory->Expand();
+
+    m_transform = transform * m_transform;
     m_memory->ApplyTransform( transform );
     m_memory->GenUV();
     m_memory->GenSmoothTagent();
+
+    if( g_compactMesh )
+        m_memory->Compact();
+}
+
+void MeshVisual::Move( const Transform& transform ){
+    // the prototype is shared by other meshes, only the instance is moved
+    if( m_sharedInstance ){
+        m_transform = transform * m_transform;
+        m_sharedInstance->SetTransform( m_transform * Inverse( m_prototypeTransform ) );
+        return;
+    }
+
+    ApplyTransform( transform );
+    for( auto& triangle : m_triangles )
+        triangle.ResetBBox();
 }
 
 void HairVisual::FillScene( Scene& scene ){
-    for( const auto& line : m_lines ){
-        auto mat = MatManager::GetSingleton().GetMaterial(line->GetMaterialId());
-        m_primitives.push_back(std::make_unique<Primitive>(nullptr, mat, line.get()));
+    for( const auto& curve : m_curves ){
+        auto mat = MatManager::GetSingleton().GetMaterial(curve->GetMaterialId());
+        m_primitives.push_back(std::make_unique<Primitive>(nullptr, mat, curve.get()));
         scene.AddPrimitive(m_primitives.back().get());
     }
 }
@@ -54,7 +262,15 @@ void HairVisual::Serialize( IStreamBase& stream ){
     stream >> width_tip >> width_bottom;
     auto mat_id = -1;
     stream >> mat_id;
-    
+
+    // Curves keep a reference of the control points, the offsets of the curves are recorded before creating them.
+    struct CurveDesc{
+        unsigned int    offset;
+        unsigned int    seg_cnt;
+        float           v[CURVE_MAX_SEGMENTS + 1];
+    };
+    std::vector<CurveDesc>  curves;
+
     for( auto i = 0u ; i < hair_cnt ; ++i ){
         auto hair_step = 0u;
         stream >> hair_step;
@@ -62,7 +278,7 @@ void HairVisual::Serialize( IStreamBase& stream ){
         if (UNLIKELY(0u == hair_step))
             continue;
 
-        // There is no guarrantee that the line segements will be the same length.
+        // There is no guarrantee that the key points will be evenly distributed.
         // It is necessary to evaluate the total length of the hair before pushing them into the list to get correct UV and width data.
         std::vector<Point>  point_cache;
         std::vector<float>  len_cache(hair_step);
@@ -79,28 +295,115 @@ void HairVisual::Serialize( IStreamBase& stream ){
         if (UNLIKELY(total_length <= 0.0f))
             continue;
 
-        auto prev_v = 0.0f;
-        auto prev_w = width_bottom;
+        // Catmull-Rom tangents, one sided at both ends of the strand.
+        std::vector<Vector> tangents(hair_step + 1);
+        for (auto j = 0u; j <= hair_step; ++j) {
+            const auto& prevP = point_cache[j > 0 ? j - 1 : j];
+            const auto& nextP = point_cache[j < hair_step ? j + 1 : j];
+            tangents[j] = (nextP - prevP) * ((j > 0 && j < hair_step) ? 0.5f : 1.0f);
+        }
+
+        // Convert the spline into Bezier segments, the first control point of a segment is the last one of the previous segment.
+        const auto strand_offset = (unsigned int)m_points.size();
+        m_points.push_back(point_cache[0]);
+        for (auto j = 0u; j < hair_step; ++j) {
+            m_points.push_back(point_cache[j] + tangents[j] / 3.0f);
+            m_points.push_back(point_cache[j + 1] - tangents[j + 1] / 3.0f);
+            m_points.push_back(point_cache[j + 1]);
+        }
+
         auto cur_len = 0.0f;
-        for (auto j = 1u; j <= hair_step; ++j) {
-            cur_len += len_cache[j-1];
+        for (auto j = 0u; j < hair_step; j += CURVE_MAX_SEGMENTS) {
+            CurveDesc desc;
+            desc.offset = strand_offset + 3 * j;
+            desc.seg_cnt = std::min(CURVE_MAX_SEGMENTS, hair_step - j);
+            desc.v[0] = cur_len / total_length;
+            for (auto k = 0u; k < desc.seg_cnt; ++k) {
+                cur_len += len_cache[j + k];
+                desc.v[k + 1] = cur_len / total_length;
+            }
+            curves.push_back(desc);
+        }
+    }
 
-            const auto& prevP = point_cache[j - 1];
-            const auto& curP  = point_cache[j];
+    for( const auto& desc : curves )
+        m_curves.push_back(std::make_unique<Curve>(m_points, desc.offset, desc.seg_cnt, desc.v, width_bottom, width_tip, mat_id));
+}
 
-            const auto t = cur_len / total_length;
-            const auto cur_w = slerp(width_bottom, width_tip, t);
-            const auto cur_v = slerp(0.0f, 1.0f, t);
+void HairVisual::ApplyTransform( const Transform& transform ){
+    // Control points are shared by curves, they are transformed only once.
+    for( auto& point : m_points )
+        point = transform.TransformPoint( point );
+    for( auto& curve : m_curves )
+        curve->SetTransform( transform );
+}
 
-            m_lines.push_back(std::make_unique<Line>(prevP, curP, prev_v, cur_v, prev_w, cur_w, mat_id));
+void SubdivisionVisual::FillScene( Scene& scene ){
+    // bounding boxes of patches only depend on the control points and the largest displacement
+    auto topology = HashValue( (unsigned int)m_mesh.m_positions.size() );
+    topology = HashBytes( m_mesh.m_faceVertices.data() , sizeof( unsigned int ) * m_mesh.m_faceVertices.size() , topology );
+    auto geometry = HashBytes( m_mesh.m_positions.data() , sizeof( Point ) * m_mesh.m_positions.size() );
+    geometry = HashValue( m_mesh.DisplacementBound() , geometry );
+    scene.AddGeometryHash( topology , geometry );
 
-            prev_w = cur_w;
-            prev_v = cur_v;
-        }
+    for( auto f = 0u ; f < m_matIds.size() ; ++f ){
+        // degenerated faces are dropped
+        if( m_mesh.FaceSize( f ) < 3 )
+            continue;
+        m_patches.push_back( std::make_unique<SubdivisionPatch>( m_mesh , f ) );
+        auto mat = MatManager::GetSingleton().GetMaterial( m_matIds[f] );
+        m_primitives.push_back( std::make_unique<Primitive>( nullptr , mat , m_patches.back().get() ) );
+        scene.AddPrimitive( m_primitives.back().get() );
     }
 }
 
-void HairVisual::ApplyTransform( const Transform& transform ){
-    for( auto& line : m_lines )
-        line->SetTransform( transform );
+void SubdivisionVisual::Serialize( IStreamBase& stream ){
+    auto vertex_cnt = 0u , face_cnt = 0u;
+    stream >> m_mesh.m_level;
+    stream >> vertex_cnt;
+    m_mesh.m_positions.resize( vertex_cnt );
+    stream.LoadBulk( reinterpret_cast<char*>( m_mesh.m_positions.data() ) , sizeof( Point ) * vertex_cnt );
+
+    stream >> face_cnt;
+    std::vector<unsigned int> face_sizes( face_cnt );
+    stream.LoadBulk( reinterpret_cast<char*>( face_sizes.data() ) , sizeof( unsigned int ) * face_cnt );
+    m_mesh.m_faceOffsets.resize( face_cnt + 1 );
+    m_mesh.m_faceOffsets[0] = 0;
+    for( auto i = 0u ; i < face_cnt ; ++i )
+        m_mesh.m_faceOffsets[i + 1] = m_mesh.m_faceOffsets[i] + face_sizes[i];
+
+    const auto corner_cnt = m_mesh.m_faceOffsets.back();
+    m_mesh.m_faceVertices.resize( corner_cnt );
+    stream.LoadBulk( reinterpret_cast<char*>( m_mesh.m_faceVertices.data() ) , sizeof( unsigned int ) * corner_cnt );
+    m_mesh.m_faceUVs.resize( corner_cnt );
+    stream.LoadBulk( reinterpret_cast<char*>( m_mesh.m_faceUVs.data() ) , sizeof( Vector2f ) * corner_cnt );
+    m_matIds.resize( face_cnt );
+    stream.LoadBulk( reinterpret_cast<char*>( m_matIds.data() ) , sizeof( int ) * face_cnt );
+
+    auto has_displacement = false;
+    stream >> has_displacement;
+    if( has_displacement ){
+        std::string filename;
+        stream >> filename;
+        stream >> m_mesh.m_displacementScale >> m_mesh.m_displacementMidLevel;
+
+        m_mesh.m_displacement = std::make_unique<ImageTexture2D>();
+        if( !m_mesh.m_displacement->LoadResource( filename ) )
+            slog( WARNING , GENERAL , "Failed to load displacement map %s." , filename.c_str() );
+    }
+
+    m_mesh.BuildAdjacency();
+
+    static const StringID end_of_mesh("end of mesh");
+    StringID eom_sid;
+    stream >> eom_sid;
+    sAssert(eom_sid == end_of_mesh, GENERAL);
+}
+
+void SubdivisionVisual::ApplyTransform( const Transform& transform ){
+    transform.TransformPoints( m_mesh.m_positions.data() , (unsigned)m_mesh.m_positions.size() );
+
+    // patches created already are moved as well, they are tessellated again once rays get to them
+    for( auto& patch : m_patches )
+        patch->Reset();
 }
@@ -21,8 +21,13 @@
 #include "core/mesh.h"
 #include "shape/triangle.h"
 #include "shape/line.h"
+#include "shape/curve.h"
+#include "shape/instance.h"
+#include "shape/subdivision.h"
 #include "core/primitive.h"
 
+class VolumeLight;
+
 //! @brief Visual is the container for a specific type of shape that can be seen in SORT.
 /**
  * Visual could be a single shape, like sphere, triangle. It could also be a set of triangles,
@@ -35,11 +40,21 @@ public:
     //! @param  scene       The scene to be filled.
     virtual void        FillScene( class Scene& scene ) = 0;
 
+    //! @brief  Register what the visual could share with others, it happens to all visuals before any of them fills the scene.
+    //!
+    //! @param  scene       The scene to be filled.
+    virtual void        PrepareScene( class Scene& scene ) {}
+
     //! @brief  Some visual will apply transformation earlier for better performance.
     //!
     //! @param  transform   The transform of the visual to be applied.
     virtual void        ApplyTransform( const Transform& transform ) = 0;
 
+    //! @brief  Move the visual after the scene is filled, the spatial data structure needs to be refitted after this.
+    //!
+    //! @param  transform   The transform from the current place of the visual to the new one.
+    virtual void        Move( const Transform& transform ) { ApplyTransform( transform ); }
+
 protected:
     /*< Primitives that shape the visual. */
     std::vector<std::unique_ptr<Primitive>>  m_primitives;
@@ -54,11 +69,22 @@ class MeshVisual : public Visual{
 public:
     DEFINE_RTTI( MeshVisual , Visual );
 
+    //! @brief  Constructor.
+    MeshVisual();
+
+    //! @brief  Destructor.
+    ~MeshVisual() override;
+
     //! @brief  Fill the scene with triangles.
     //!
     //! @param  scene       The scene to be filled.
     void        FillScene( class Scene& scene ) override;
 
+    //! @brief  Count the mesh in the scene so that identical meshes could be shared as instances.
+    //!
+    //! @param  scene       The scene to be filled.
+    void        PrepareScene( class Scene& scene ) override;
+
     //! @brief  Serialization interface. Loading data from stream.
     //!
     //! Serialize the visual. Loading from an IStreamBase, which could be coming from file, memory or network.
@@ -71,23 +97,122 @@ public:
     //! @param  transform   The transform of the visual to be applied.
     void        ApplyTransform( const Transform& transform ) override;
 
+    //! @brief  Move the vertices of the mesh, cached bounding boxes of triangles are dropped.
+    //!
+    //! @param  transform   The transform from the current place of the mesh to the new one.
+    void        Move( const Transform& transform ) override;
+
+    //! @brief  Create the triangles of the mesh without adding them in the scene.
+    //!
+    //! Triangles and their primitives are only created by the first call, later calls return the same ones since others
+    //! keep pointers to them.
+    //!
+    //! @param  light       The light attached to all triangles, it is only needed by emissive meshes.
+    //! @return             Primitives of all triangles in the mesh, in the same order as the faces of the mesh.
+    const std::vector<Primitive>&  CreatePrimitives( class Light* light = nullptr );
+
+private:
+    //! @brief  Simplify the mesh if it covers few pixels, the cells are no larger than the allowed error in pixels.
+    //!
+    //! @param  camera      The camera of the scene.
+    void        selectLod( const class Camera& camera );
+
+    //! @brief  Fill the scene with an instance of the mesh if there are identical meshes in the scene.
+    //!
+    //! The first of the identical meshes becomes the prototype, it stays where it is in world space. The rest of them
+    //! are instances of it and drop their own copy of the mesh.
+    //!
+    //! @param  scene       The scene to be filled.
+    //! @return             Whether the mesh is filled as an instance.
+    bool        fillShared( class Scene& scene );
+
 public:
     /**< Memory for the mesh. */
     std::unique_ptr<Mesh>                 m_memory;
-    /**< This is to make sure the memory of triangles will be properly cleared. */
-    std::vector<std::unique_ptr<Triangle>>      m_triangles;
+    /**< Triangles of the mesh in one contiguous array, instead of being allocated one by one. */
+    std::vector<Triangle>                 m_triangles;
+    /**< Primitives of the triangles, they refer to the triangles so that neither array could grow once created. */
+    std::vector<Primitive>                m_trianglePrimitives;
+    /**< Light sampling the emission of the volume inside the mesh, if there is any. */
+    std::unique_ptr<VolumeLight>          m_volumeLight;
+
+private:
+    /**< Transform applied to the mesh since it is loaded. */
+    Transform                             m_transform;
+    /**< Prototype shared by the identical meshes, only the first of them owns it. */
+    std::unique_ptr<InstancePrototype>    m_sharedPrototype;
+    /**< Instance of the shared prototype if the mesh is identical to others. */
+    std::unique_ptr<Instance>             m_sharedInstance;
+    /**< Transform of the shared prototype, the mesh of the first identical mesh is baked with it. */
+    Transform                             m_prototypeTransform;
+};
+
+//! @brief Instance of a triangle mesh shared by multiple visuals.
+/**
+ * Instead of baking the mesh in world space, the mesh is kept in its local space and shared by all of its instances.
+ * The first instance in the stream carries the data of the mesh, the rest of them only reference it by name.
+ * Each instance appears as a single primitive in the scene, the triangles live in the BVH of the shared mesh.
+ *
+ * An instance could also carry the transforms at evenly spaced moments in the shutter interval, it is split into one
+ * primitive per interval between two of them so that each primitive is bounded tightly.
+ */
+class MeshInstanceVisual : public Visual{
+public:
+    DEFINE_RTTI( MeshInstanceVisual , Visual );
+
+    //! @brief  Fill the scene with the instance.
+    //!
+    //! @param  scene       The scene to be filled.
+    void        FillScene( class Scene& scene ) override;
+
+    //! @brief  Serialization interface. Loading data from stream.
+    //!
+    //! The bottom level BVH of the shared mesh is built right after the mesh is loaded, it doesn't need to wait
+    //! for the rest of the scene if entities are loaded in parallel. Transforms of a moving instance come right
+    //! after the mesh, they are in world space already.
+    //!
+    //! @param  stream      Input stream for data.
+    void        Serialize( IStreamBase& stream ) override;
+
+    //! @brief  The transform is kept in the instance instead of being applied to the shared mesh.
+    //!
+    //! The transform of a moving instance is ignored since its transforms are in world space.
+    //!
+    //! @param  transform   The transform of the visual.
+    void        ApplyTransform( const Transform& transform ) override;
+
+    //! @brief  Move the instance, the shared mesh is not touched at all.
+    //!
+    //! @param  transform   The transform from the current place of the instance to the new one.
+    void        Move( const Transform& transform ) override;
+
+private:
+    /**< Name of the shared mesh. */
+    StringID                        m_prototypeName;
+    /**< The shared mesh, only the first instance of the mesh owns it. */
+    std::unique_ptr<MeshVisual>     m_prototype;
+    /**< BVH of the shared mesh, it is owned by the same instance that owns the mesh. */
+    std::unique_ptr<InstancePrototype>  m_prototypeBvh;
+    /**< Transform from the local space of the mesh to world space. */
+    Transform                       m_transform;
+    /**< Transforms from the local space of the mesh to world space at evenly spaced moments in the shutter interval, empty if it doesn't move. */
+    std::vector<Transform>          m_motionKeys;
+    /**< The shapes of the instance, one for each segment in time if it moves. */
+    std::vector<std::unique_ptr<Instance>>  m_instances;
 };
 
-//! HairVisual has a bunch of lines.
+//! HairVisual has a bunch of curves.
 /**
- * Just like MeshVisual may have lots of triangles, HairVisual has loads of line shape in it.
- * This visual is usually used to represent things like fur or hair.
+ * Just like MeshVisual may have lots of triangles, HairVisual has loads of curve shape in it.
+ * This visual is usually used to represent things like fur or hair. Each strand is exported as
+ * a list of key points, which are interpolated by a smooth Catmull-Rom spline converted to cubic
+ * Bezier segments. Every CURVE_MAX_SEGMENTS consecutive segments of a strand share one primitive.
  */
 class HairVisual : public Visual{
 public:
     DEFINE_RTTI( HairVisual , Visual );
 
-    //! @brief  Fill the scene with triangles.
+    //! @brief  Fill the scene with curves.
     //!
     //! @param  scene       The scene to be filled.
     void        FillScene( class Scene& scene ) override;
@@ -105,6 +230,44 @@ public:
     void        ApplyTransform( const Transform& transform ) override;
 
 private:
-    /**< Memory container holding the lines. */
-    std::vector<std::unique_ptr<Line>>  m_lines;
-};
\ No newline at end of file
+    /**< Bezier control points of all strands, consecutive segments of a strand share their end points. */
+    std::vector<Point>                  m_points;
+    /**< Memory container holding the curves. */
+    std::vector<std::unique_ptr<Curve>> m_curves;
+};
+
+//! @brief Catmull-Clark subdivision surface.
+/**
+ * Only the control mesh is loaded, each face of it is a patch that is subdivided the first time a ray gets close to
+ * it. This keeps the memory of heavily subdivided meshes under control, the tessellations of patches no ray reaches
+ * are never generated and the rest of them live in a cache with a bounded size.
+ */
+class SubdivisionVisual : public Visual{
+public:
+    DEFINE_RTTI( SubdivisionVisual , Visual );
+
+    //! @brief  Fill the scene with subdivision patches.
+    //!
+    //! @param  scene       The scene to be filled.
+    void        FillScene( class Scene& scene ) override;
+
+    //! @brief  Serialization interface. Loading data from stream.
+    //!
+    //! Serialize the visual. Loading from an IStreamBase, which could be coming from file, memory or network.
+    //!
+    //! @param  stream      Input stream for data.
+    void        Serialize( IStreamBase& stream ) override;
+
+    //! @brief  Transform the control points, patches are tessellated again if they are already tessellated.
+    //!
+    //! @param  transform   The transform of the visual to be applied.
+    void        ApplyTransform( const Transform& transform ) override;
+
+private:
+    /**< The control mesh shared by all patches. */
+    SubdivisionMesh                                 m_mesh;
+    /**< Material id of each face. */
+    std::vector<int>                                m_matIds;
+    /**< A patch for each face of the control mesh. */
+    std::vector<std::unique_ptr<SubdivisionPatch>>  m_patches;
+};
@@ -63,4 +63,15 @@ public:
             m_visuals.push_back( std::move(visual) );
         }
     }
+
+    //! @brief  Move all visuals of the entity to its new place.
+    //!
+    //! @param  transform   The new transform of the entity from local space to world space.
+    void    UpdateTransform( const Transform& transform ) override {
+        // visuals are already in the old place, only the difference is applied.
+        const auto delta = transform * Inverse( m_transform );
+        for( auto& visual : m_visuals )
+            visual->Move( delta );
+        m_transform = transform;
+    }
 };
\ No newline at end of file
@@ -0,0 +1,142 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <sstream>
+#include <algorithm>
+#include "aov.h"
+#include "core/log.h"
+#include "core/sassert.h"
+#include "core/workercontext.h"
+
+namespace {
+    struct AovDesc{
+        const char*     name;
+        unsigned int    channelCnt;
+        unsigned int    offset;
+        const char*     channelNames;
+    };
+
+    // the order has to match the definition of AOV_TYPE
+    constexpr AovDesc g_aovDescs[AOV_CNT] = {
+        { "albedo"      , 3 , 0  , "RGB" } ,
+        { "normal"      , 3 , 3  , "XYZ" } ,
+        { "depth"       , 1 , 6  , "Z" } ,
+        { "direct"      , 3 , 7  , "RGB" } ,
+        { "indirect"    , 3 , 10 , "RGB" } ,
+        { "samplecount" , 1 , 13 , "Y" } ,
+        { "time"        , 1 , 14 , "Y" } ,
+        { "raycount"    , 1 , 15 , "Y" } ,
+        { "pathdepth"   , 1 , 16 , "Y" } ,
+        { "outlier"     , 3 , 17 , "RGB" } ,
+    };
+    static_assert( g_aovDescs[AOV_CNT-1].offset + g_aovDescs[AOV_CNT-1].channelCnt == AOV_CHANNEL_CNT , "Channel count of AOVs doesn't match." );
+}
+
+const char* AovName( AOV_TYPE type ){
+    return g_aovDescs[type].name;
+}
+
+unsigned int AovChannelCnt( AOV_TYPE type ){
+    return g_aovDescs[type].channelCnt;
+}
+
+char AovChannelName( AOV_TYPE type , unsigned int channel ){
+    sAssert( channel < g_aovDescs[type].channelCnt , IMAGE );
+    return g_aovDescs[type].channelNames[channel];
+}
+
+unsigned int AovChannelOffset( AOV_TYPE type ){
+    return g_aovDescs[type].offset;
+}
+
+unsigned int ParseAovMask( const std::string& str ){
+    unsigned int mask = 0;
+    std::stringstream ss( str );
+    std::string name;
+    while( std::getline( ss , name , ',' ) ){
+        std::transform( name.begin() , name.end() , name.begin() , ::tolower );
+        if( name == "all" ){
+            mask = ( 1u << AOV_CNT ) - 1u;
+            continue;
+        }
+        if( name == "cost" ){
+            mask |= ( 1u << AOV_TIME ) | ( 1u << AOV_RAY_COUNT ) | ( 1u << AOV_PATH_DEPTH );
+            continue;
+        }
+
+        auto found = false;
+        for( auto i = 0u ; i < AOV_CNT ; ++i ){
+            if( name == g_aovDescs[i].name ){
+                mask |= 1u << i;
+                found = true;
+            }
+        }
+        if( !found && !name.empty() )
+            slog( WARNING , IMAGE , "Unknown AOV '%s' is ignored." , name.c_str() );
+    }
+    return mask;
+}
+
+void BindAovSample( AovSample* sample ){
+    // the AOV sample of the pixel sample being rendered lives in the context of the thread
+    GetWorkerContext().aovSample = sample;
+}
+
+bool IsRecordingAov(){
+    return GetWorkerContext().aovSample != nullptr;
+}
+
+void RecordPrimaryHitAov( const Spectrum& albedo , const Vector& normal , float depth ){
+    const auto sample = GetWorkerContext().aovSample;
+    if( !sample )
+        return;
+    sample->Set( AOV_ALBEDO , albedo );
+    auto n = sample->channels + AovChannelOffset( AOV_NORMAL );
+    n[0] = normal.x;
+    n[1] = normal.y;
+    n[2] = normal.z;
+    sample->channels[AovChannelOffset( AOV_DEPTH )] = depth;
+}
+
+void RecordLightingAov( const Spectrum& direct , const Spectrum& indirect ){
+    const auto sample = GetWorkerContext().aovSample;
+    if( !sample )
+        return;
+    sample->Set( AOV_DIRECT , direct );
+    sample->Set( AOV_INDIRECT , indirect );
+}
+
+void RecordRayAov(){
+    const auto sample = GetWorkerContext().aovSample;
+    if( !sample )
+        return;
+    sample->channels[AovChannelOffset( AOV_RAY_COUNT )] += 1.0f;
+}
+
+void RecordPathDepthAov( unsigned int depth ){
+    const auto sample = GetWorkerContext().aovSample;
+    if( !sample )
+        return;
+    sample->channels[AovChannelOffset( AOV_PATH_DEPTH )] = (float)depth;
+}
+
+void RecordTimeAov( float us ){
+    const auto sample = GetWorkerContext().aovSample;
+    if( !sample )
+        return;
+    sample->channels[AovChannelOffset( AOV_TIME )] += us;
+}
@@ -0,0 +1,139 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <string>
+#include "spectrum/spectrum.h"
+#include "math/vector3.h"
+
+//! @brief  Arbitrary output variables, extra channels rendered along with the beauty image.
+//!
+//! They are mainly used for compositing and denoising, all of them come from the same camera rays as the beauty
+//! image so that there is no need to render the image again for each of them.
+enum AOV_TYPE : unsigned int {
+    AOV_ALBEDO = 0,         /**< Albedo of the surface hit by camera rays. */
+    AOV_NORMAL,             /**< Shading normal of the surface hit by camera rays in world space. */
+    AOV_DEPTH,              /**< Distance from the camera to the surface hit by camera rays. */
+    AOV_DIRECT,             /**< Radiance scattered by the first surface towards the camera. */
+    AOV_INDIRECT,           /**< Radiance of the rest of the path. */
+    AOV_SAMPLE_COUNT,       /**< Number of samples taken by the pixel. */
+    AOV_TIME,               /**< Average time taken by a sample of the pixel in microseconds. */
+    AOV_RAY_COUNT,          /**< Average number of rays traced by a sample of the pixel. */
+    AOV_PATH_DEPTH,         /**< Average number of bounces of the paths of the pixel. */
+    AOV_OUTLIER,            /**< Radiance rejected by robust accumulation, the plain average minus the robust estimate. */
+    AOV_CNT
+};
+
+//! @brief  Number of floats needed to keep all AOVs of a pixel.
+constexpr unsigned int AOV_CHANNEL_CNT = 20;
+
+//! @brief  Get the name of the layer of an AOV in the output image.
+//!
+//! @param  type    The type of the AOV.
+//! @return         Name of the layer.
+const char*     AovName( AOV_TYPE type );
+
+//! @brief  Get the number of channels of an AOV.
+//!
+//! @param  type    The type of the AOV.
+//! @return         Number of channels, either 1 or 3.
+unsigned int    AovChannelCnt( AOV_TYPE type );
+
+//! @brief  Get the name of a channel of an AOV in the output image, like 'R' or 'X'.
+//!
+//! @param  type    The type of the AOV.
+//! @param  channel Index of the channel in the AOV.
+//! @return         Name of the channel.
+char            AovChannelName( AOV_TYPE type , unsigned int channel );
+
+//! @brief  Get the offset of the first channel of an AOV in the channels of a pixel.
+//!
+//! @param  type    The type of the AOV.
+//! @return         Offset of the first channel.
+unsigned int    AovChannelOffset( AOV_TYPE type );
+
+//! @brief  Parse a comma separated list of AOV names, 'all' enables every AOV.
+//!
+//! 'cost' is short for the AOVs showing how expensive each pixel is, 'time,raycount,pathdepth'.
+//!
+//! @param  str     The list of AOV names, like 'albedo,normal'.
+//! @return         A mask with a bit set for each AOV in the list.
+unsigned int    ParseAovMask( const std::string& str );
+
+//! @brief  Values of AOVs recorded by a single pixel sample.
+struct AovSample{
+    float       channels[AOV_CHANNEL_CNT] = { 0.0f };       /**< Value of all channels. */
+
+    //! @brief  Reset all channels before a new sample is traced.
+    SORT_FORCEINLINE void Clear(){
+        for( auto& c : channels )
+            c = 0.0f;
+    }
+
+    //! @brief  Set a color channel.
+    //!
+    //! @param  type    The type of the AOV, it needs to have three channels.
+    //! @param  value   The value to be set.
+    SORT_FORCEINLINE void Set( AOV_TYPE type , const Spectrum& value ){
+        auto c = channels + AovChannelOffset( type );
+        c[0] = value.r;
+        c[1] = value.g;
+        c[2] = value.b;
+    }
+};
+
+//! @brief  Bind the AOV sample recorded by integrators to the current thread.
+//!
+//! Integrators record AOVs of the sample being traced by the thread, there is no need to pass it through all the
+//! interfaces. Each render task binds its own sample, there is no lock needed anywhere.
+//!
+//! @param  sample      The sample to be bound, nullptr disables recording AOVs.
+void    BindAovSample( AovSample* sample );
+
+//! @brief  Whether AOVs are recorded for the sample traced by the thread.
+//!
+//! Integrators could skip evaluating anything only needed by AOVs if this returns 'false'.
+//!
+//! @return     'True' if there is an AOV sample bound to the thread.
+bool    IsRecordingAov();
+
+//! @brief  Record the AOVs of the surface hit by a camera ray.
+//!
+//! @param  albedo      Albedo of the surface.
+//! @param  normal      Shading normal of the surface.
+//! @param  depth       Distance from the camera to the surface.
+void    RecordPrimaryHitAov( const Spectrum& albedo , const Vector& normal , float depth );
+
+//! @brief  Record the radiance of a path separated into direct and indirect illumination.
+//!
+//! @param  direct      Radiance scattered by the first surface towards the camera, including its emission.
+//! @param  indirect    Radiance of the rest of the path.
+void    RecordLightingAov( const Spectrum& direct , const Spectrum& indirect );
+
+//! @brief  Count a ray traced for the sample.
+void    RecordRayAov();
+
+//! @brief  Record the number of bounces of the path of the sample.
+//!
+//! @param  depth       Number of bounces.
+void    RecordPathDepthAov( unsigned int depth );
+
+//! @brief  Add time spent on the sample.
+//!
+//! @param  us          Time in microseconds.
+void    RecordTimeAov( float us );
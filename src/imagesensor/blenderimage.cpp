@@ -16,87 +16,216 @@
  */
 
 #include <mutex>
+#include <atomic>
+#include <algorithm>
 #include "blenderimage.h"
 #include "core/globalconfig.h"
 #include "core/path.h"
+#include "task/telemetry.h"
+
+static_assert( std::atomic<std::uint64_t>::is_always_lock_free , "Sequence counter in shared memory needs to be lock free." );
+
+void BlenderImage::writeTile( float* buffer , const RenderTarget& image , int tile_x , int tile_y , const Vector2i& tl , const Vector2i& size ) const{
+    // the region could be a piece of a split tile, pixels are laid out relative to the whole tile
+    const Vector2i tile_tl( tl.x / g_tileSize * g_tileSize , tl.y / g_tileSize * g_tileSize );
+    int tile_w = std::min( (int)g_tileSize , m_width - tile_tl.x );
+    int offset = 4 * ( tile_y * m_tilenum_x + tile_x ) * g_tileSize * g_tileSize;
+
+    const auto rb = tl + size;
+    for( auto y = tl.y ; y < rb.y ; ++y ){
+        for( auto x = tl.x ; x < rb.x ; ++x ){
+            int inner_offset = offset + 4 * (x - tile_tl.x + (g_tileSize - 1 - (y - tile_tl.y)) * tile_w);
+            const auto color = image.GetColor( x , y );
+            buffer[ inner_offset ] = color.r;
+            buffer[ inner_offset + 1 ] = color.g;
+            buffer[ inner_offset + 2 ] = color.b;
+            buffer[ inner_offset + 3 ] = 1.0f;
+        }
+    }
+}
 
-static std::mutex g_cntLock;
+void BlenderImage::writeImage( float* buffer , const RenderTarget& image ) const{
+    for( auto y = 0 ; y < m_tilenum_y ; ++y ){
+        for( auto x = 0 ; x < m_tilenum_x ; ++x ){
+            const Vector2i tl( x * g_tileSize , y * g_tileSize );
+            const Vector2i size( std::min( (int)g_tileSize , m_width - tl.x ) , std::min( (int)g_tileSize , m_height - tl.y ) );
+            writeTile( buffer , image , x , ( m_height - 1 - tl.y ) / g_tileSize , tl , size );
+        }
+    }
+}
 
-void BlenderImage::StorePixel( int x , int y , const Spectrum& color , const Render_Task& rt ){
-    if (!m_sharedMemory.sharedmemory.bytes)
-        return;
+void BlenderImage::FinishTile( int tile_x , int tile_y , const RenderedTile& rt ){
+    ImageSensor::FinishTile( tile_x , tile_y , rt );
 
-    int tile_w = rt.GetTileSize().x;
-    int tile_size = g_tileSize * g_tileSize;
-    int x_off = (int)(rt.GetTopLeft().x / g_tileSize);
-    int y_off = (int)(floor((m_height - 1 - rt.GetTopLeft().y) / (float)g_tileSize));
-    int tile_offset = y_off * m_tilenum_x + x_off;
-    int offset = 4 * tile_offset * tile_size;
+    if( !m_header )
+        return;
 
-    // get the data pointer
-    float* data = (float*)(m_sharedMemory.sharedmemory.bytes + m_header_offset);
+    // the first buffer always holds the latest result of all tiles, raw tiles are not shown anymore once a denoised
+    // preview replaces them.
+    const auto raw = !m_previewPublished.load( std::memory_order_acquire );
+    if( raw )
+        writeTile( m_buffers[0] , m_rendertarget , tile_x , tile_y , rt.GetTopLeft() , rt.GetTileSize() );
 
-    // get offset
-    int inner_offset = offset + 4 * (x - rt.GetTopLeft().x + (g_tileSize - 1 - (y - rt.GetTopLeft().y)) * tile_w);
+    auto pass_done = false;
+    {
+        std::lock_guard<std::mutex> lock(m_publishLock);
+
+        // tiles are written before the sequence counter is bumped, the plugin reads the counter first.
+        auto& sequence = *reinterpret_cast<std::atomic<std::uint64_t>*>( &m_header->sequence );
+        if( raw && g_integrator->NeedRefreshTile() ){
+            const auto seq = sequence.load( std::memory_order_relaxed );
+            auto& record = m_ring[ seq % m_ringCapacity ];
+            record.sequence = seq;
+            record.tile_id = tile_y * m_tilenum_x + tile_x;
+            sequence.store( seq + 1 , std::memory_order_release );
+        }
 
-    // copy data
-    data[ inner_offset ] = color.r;
-    data[ inner_offset + 1 ] = color.g;
-    data[ inner_offset + 2 ] = color.b;
-    data[ inner_offset + 3 ] = 1.0f;
+        // progress is counted in pixels since tiles could be split into pieces, only pixels in the region are rendered
+        Vector2i region_min , region_max;
+        GlobalConfiguration::GetSingleton().GetRenderRegion( region_min , region_max );
+        const auto pixel_cnt = (long long)( region_max.x - region_min.x ) * ( region_max.y - region_min.y );
+        const auto finished = m_finishedPixelCnt;
+        m_finishedPixelCnt += (long long)rt.size.x * rt.size.y;
+        m_header->progress = std::min( 1.0f , (float)( (double)m_finishedPixelCnt / (double)( pixel_cnt * m_passCnt ) ) );
 
-    // for final update
-    {
-        std::lock_guard<spinlock_mutex> lock(m_mutex[y*m_width+x]);
-        Spectrum _color = m_rendertarget.GetColor(x,y);
-        m_rendertarget.SetColor(x, y, color+_color);
+        // the last pass is denoised in post process
+        pass_done = m_preview && finished / pixel_cnt != m_finishedPixelCnt / pixel_cnt && m_finishedPixelCnt < pixel_cnt * m_passCnt;
     }
+
+    if( pass_done )
+        publishPreview();
+}
+
+void BlenderImage::FinishDraft( int tile_x , int tile_y , const Vector2i& tl , const Vector2i& size , int level ){
+    ImageSensor::FinishDraft( tile_x , tile_y , tl , size , level );
+
+    if( !m_header || !g_integrator->NeedRefreshTile() )
+        return;
+
+    // coarse passes are done before the first full pass of the tile, nothing is counted in the progress
+    writeTile( m_buffers[0] , m_rendertarget , tile_x , tile_y , tl , size );
+
+    std::lock_guard<std::mutex> lock(m_publishLock);
+    auto& sequence = *reinterpret_cast<std::atomic<std::uint64_t>*>( &m_header->sequence );
+    const auto seq = sequence.load( std::memory_order_relaxed );
+    auto& record = m_ring[ seq % m_ringCapacity ];
+    record.sequence = seq;
+    record.tile_id = tile_y * m_tilenum_x + tile_x;
+    sequence.store( seq + 1 , std::memory_order_release );
 }
 
-void BlenderImage::FinishTile( int tile_x , int tile_y , const Render_Task& rt ){
-    if (!m_sharedMemory.sharedmemory.bytes)
+void BlenderImage::publishPreview(){
+    // skip the preview if the last one is still being denoised, rendering is not held back by previews
+    if( m_previewBusy.exchange( true , std::memory_order_acquire ) )
         return;
 
-    m_sharedMemory.sharedmemory.bytes[tile_y * m_tilenum_x + tile_x] = 1;
+    // tiles of the next pass keep being blended into the render target in the mean time, pixels of a later pass
+    // leaking into the preview are harmless.
+    m_denoiser->Denoise( m_rendertarget , m_aov.get() , *m_preview );
+    writeImage( m_buffers[0] , *m_preview );
+
+    {
+        std::lock_guard<std::mutex> lock(m_publishLock);
+
+        auto& sequence = *reinterpret_cast<std::atomic<std::uint64_t>*>( &m_header->sequence );
+        auto seq = sequence.load( std::memory_order_relaxed );
+        for( auto i = 0 ; i < m_tilenum_x * m_tilenum_y ; ++i , ++seq ){
+            auto& record = m_ring[ seq % m_ringCapacity ];
+            record.sequence = seq;
+            record.tile_id = i;
+        }
+        sequence.store( seq , std::memory_order_release );
+        m_previewPublished.store( true , std::memory_order_release );
+    }
 
-    std::lock_guard<std::mutex> lock(g_cntLock);
-    m_sharedMemory.sharedmemory.bytes[m_sharedMemory.sharedmemory.size - 2] = (int)((++m_finishedTileCnt) / (float)( m_tilenum_x * m_tilenum_y ) * 100.0f);
+    m_previewBusy.store( false , std::memory_order_release );
 }
 
 void BlenderImage::PreProcess(){
     // create shared memory
     m_tilenum_x = (int)(ceil(g_resultResollutionWidth / (float)g_tileSize));
     m_tilenum_y = (int)(ceil(g_resultResollutionHeight / (float)g_tileSize));
-    m_header_offset = m_tilenum_x * m_tilenum_y;
-    m_final_update_flag_offset = m_header_offset * g_tileSize * g_tileSize * 4 * sizeof(float) * 2 + m_header_offset + 1;
+    m_passCnt = ( g_samplePerPixel + g_samplePerPass - 1 ) / g_samplePerPass;
+
+    const auto tile_cnt = m_tilenum_x * m_tilenum_y;
+    m_ringCapacity = std::max( 256 , 2 * tile_cnt );
 
-    int size = m_header_offset * g_tileSize * g_tileSize * 4 * sizeof(float) * 2    // image size
-             + m_header_offset                                                      // header size
-             + 2;                                                                   // progress data and final update flag
+    const auto image_size = tile_cnt * g_tileSize * g_tileSize * 4 * sizeof(float);
+    int size = sizeof(BlenderSharedMemoryHeader)                // header
+             + m_ringCapacity * sizeof(BlenderDirtyTile)        // dirty tile ring
+             + image_size * 2;                                  // double buffered image
 
     m_sharedMemory.CreateSharedMemory(GetFilePathInResourceFolder("sharedmem.bin"), size, SharedMmeory_All);
     auto& sm = m_sharedMemory.sharedmemory;
+    if (!sm.bytes)
+        return;
+
     // clear the memory first
-    if (sm.bytes)
-        memset(sm.bytes, 0, sm.size);
+    memset(sm.bytes, 0, sm.size);
+
+    m_header = (BlenderSharedMemoryHeader*)sm.bytes;
+    m_ring = (BlenderDirtyTile*)(sm.bytes + sizeof(BlenderSharedMemoryHeader));
+    m_buffers[0] = (float*)(sm.bytes + sizeof(BlenderSharedMemoryHeader) + m_ringCapacity * sizeof(BlenderDirtyTile));
+    m_buffers[1] = (float*)((char*)m_buffers[0] + image_size);
+
+    m_header->tile_size = g_tileSize;
+    m_header->tile_cnt_x = m_tilenum_x;
+    m_header->tile_cnt_y = m_tilenum_y;
+    m_header->ring_capacity = m_ringCapacity;
+    m_header->version = BLENDER_PROTOCOL_VERSION;
+    m_header->remaining_time = -1.0f;
+
+    // intermediate passes of progressive rendering are denoised as previews
+    if( m_denoiser && m_passCnt > 1 )
+        m_preview = std::make_unique<RenderTarget>( m_width , m_height );
+
+    // the magic number goes last so that the plugin never sees a half initialized header
+    std::atomic_thread_fence( std::memory_order_release );
+    m_header->magic = BLENDER_PROTOCOL_MAGIC;
 }
 
-void BlenderImage::PostProcess(){
-    // perform a copy from render target to shared memory
-    float* data = (float*)(m_sharedMemory.sharedmemory.bytes + m_header_offset + m_header_offset * g_tileSize * g_tileSize * 4 * sizeof(float));
-
-    auto offset = 0;
-    for (auto i = 0; i < m_rendertarget.GetHeight(); ++i)
-        for (auto j = 0; j < m_rendertarget.GetWidth(); ++j){
-            const Spectrum& c = m_rendertarget.GetColor(j, m_rendertarget.GetHeight() - i - 1);
-            data[offset++] = c.r;
-            data[offset++] = c.g;
-            data[offset++] = c.b;
-            data[offset++] = 1.0f;
-        }
+void BlenderImage::Restart(){
+    ImageSensor::Restart();
+    m_finishedPixelCnt = 0;
+    m_previewPublished = false;
 
-    // signal a final update
-    m_sharedMemory.sharedmemory.bytes[m_final_update_flag_offset] = 1;
+    if( !m_header )
+        return;
 
+    // the sequence counter keeps growing so that no dirty tile of the new frame is missed by the plugin
+    m_header->final_buffer = 0;
+    m_header->progress = 0.0f;
+    std::atomic_thread_fence( std::memory_order_release );
+}
+
+void BlenderImage::UpdateTelemetry( const TelemetrySnapshot& snapshot ){
+    if( !m_header )
+        return;
+
+    m_header->ray_per_second = snapshot.rayPerSecond;
+    m_header->remaining_time = snapshot.remainingTime;
+    m_header->utilization = snapshot.utilization;
+    m_header->tile_pass_cnt = snapshot.tilePassCnt;
+    m_header->peak_memory = snapshot.peakMemory;
+}
+
+void BlenderImage::PostProcess(){
+    // merge splatted radiance and denoise the image first
     ImageSensor::PostProcess();
+
+    if( !m_header )
+        return;
+
+    // without splatting or denoising, the first buffer already holds the final image. Otherwise the final image
+    // goes to the back buffer, which is published by swapping.
+    auto final_buffer = 0u;
+    if( m_splatTarget || m_splatFilm || m_denoiser ){
+        final_buffer = 1u;
+        writeImage( m_buffers[1] , m_rendertarget );
+    }
+
+    // signal a final update
+    std::atomic_thread_fence( std::memory_order_release );
+    m_header->progress = 1.0f;
+    m_header->final_buffer = final_buffer + 1;
 }
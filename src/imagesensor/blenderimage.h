@@ -17,10 +17,56 @@
 
 #pragma once
 
+#include <cstdint>
+#include <mutex>
+#include <atomic>
 #include "imagesensor.h"
 #include "texture/rendertarget.h"
 #include "platform/sharedmemory/sharedmemory.h"
 
+//! @brief  Version of the shared memory protocol between SORT and the Blender plugin.
+constexpr std::uint32_t BLENDER_PROTOCOL_VERSION = 2;
+//! @brief  Magic number at the very beginning of the shared memory, 'SORT' in little endian.
+constexpr std::uint32_t BLENDER_PROTOCOL_MAGIC = 0x54524F53;
+
+//! @brief  Header at the beginning of the shared memory.
+/**
+ * The shared memory is laid out as the header, a ring of dirty tile records and two image buffers of
+ * the same tile-major layout. Whenever a tile is done, SORT writes it to the first image buffer, appends
+ * its index to the ring and bumps the sequence counter. The plugin only reads the tiles recorded since
+ * the last sequence it has seen, if it falls behind more than the ring capacity, it reads all tiles.
+ * The final image is published by setting the index of the buffer holding it, there is no copy unless
+ * splatted radiance has to be merged into a different buffer. Live telemetry is written in the rest of the header,
+ * the plugin shows it as it is, a torn read only lasts until the next snapshot.
+ *
+ * The layout needs to match the one in blender-plugin/addons/sortblend/renderer.py.
+ */
+struct BlenderSharedMemoryHeader{
+    std::uint32_t   magic;              /**< BLENDER_PROTOCOL_MAGIC. */
+    std::uint32_t   version;            /**< BLENDER_PROTOCOL_VERSION. */
+    std::uint32_t   tile_size;          /**< Size of a tile in pixels. */
+    std::uint32_t   tile_cnt_x;         /**< Number of tiles in a row. */
+    std::uint32_t   tile_cnt_y;         /**< Number of tiles in a column. */
+    std::uint32_t   ring_capacity;      /**< Number of records in the dirty tile ring. */
+    std::uint64_t   sequence;           /**< Number of dirty tile records published so far. */
+    float           progress;           /**< Progress of the rendering, from 0 to 1. */
+    std::uint32_t   final_buffer;       /**< 0 if rendering is not done, otherwise index of the buffer holding the final image plus one. */
+    float           ray_per_second;     /**< Rays traced per second recently. */
+    float           remaining_time;     /**< Estimated seconds to finish the frame, negative if it is unknown yet. */
+    float           utilization;        /**< Average busy fraction of all workers recently. */
+    std::uint32_t   tile_pass_cnt;      /**< Passes of tiles merged in the frame so far. */
+    std::uint64_t   peak_memory;        /**< Peak resident memory in bytes. */
+};
+static_assert( sizeof(BlenderSharedMemoryHeader) == 64 , "Header of the Blender shared memory protocol needs to be 64 bytes." );
+
+//! @brief  A record in the dirty tile ring.
+struct BlenderDirtyTile{
+    std::uint64_t   sequence;           /**< Sequence number of the record, so that the plugin can detect overwritten records. */
+    std::uint32_t   tile_id;            /**< Index of the dirty tile. */
+    std::uint32_t   reserved;           /**< Not used for now. */
+};
+static_assert( sizeof(BlenderDirtyTile) == 16 , "Dirty tile record of the Blender shared memory protocol needs to be 16 bytes." );
+
 // generate output
 class BlenderImage : public ImageSensor
 {
@@ -28,25 +74,49 @@ public:
     // constructor
     BlenderImage( int w , int h ) : ImageSensor( w , h ) {}
 
-    // store pixel information
-    void StorePixel( int x , int y , const Spectrum& color , const Render_Task& rt ) override;
-
     // finish image tile
-    void FinishTile( int tile_x , int tile_y , const Render_Task& rt ) override;
+    void FinishTile( int tile_x , int tile_y , const RenderedTile& rt ) override;
+
+    // finish a tile of a coarse pass, the blocks are shown right away
+    void FinishDraft( int tile_x , int tile_y , const Vector2i& tl , const Vector2i& size , int level ) override;
 
     // pre process
     void PreProcess() override;
 
+    // restart rendering a new frame, the plugin keeps reading dirty tiles of the new frame
+    void Restart() override;
+
+    // publish live telemetry in the header
+    void UpdateTelemetry( const TelemetrySnapshot& snapshot ) override;
+
     // post process
     void PostProcess() override;
 
 private:
-    int             m_header_offset;
-    int             m_final_update_flag_offset;
     int             m_tilenum_x;
     int             m_tilenum_y;
+    int             m_ringCapacity;
+
+    long long       m_finishedPixelCnt = 0;
+    int             m_passCnt = 1;
+
+    PlatformSharedMemory        m_sharedMemory;
+    BlenderSharedMemoryHeader*  m_header = nullptr;
+    BlenderDirtyTile*           m_ring = nullptr;
+    float*                      m_buffers[2] = { nullptr , nullptr };
+
+    std::mutex                  m_publishLock;      /**< Serialize publishing dirty tiles so that records show up in order. */
+
+    std::unique_ptr<RenderTarget>   m_preview;                      /**< Denoised preview of progressive rendering, only allocated with a denoiser. */
+    std::atomic<bool>               m_previewPublished = { false }; /**< Whether raw tiles are replaced by denoised previews. */
+    std::atomic<bool>               m_previewBusy = { false };      /**< Whether a preview is being denoised. */
+
+    // copy a tile from an image to an image buffer in shared memory
+    void writeTile( float* buffer , const RenderTarget& image , int tile_x , int tile_y , const Vector2i& tl , const Vector2i& size ) const;
 
-    int             m_finishedTileCnt = 0;
+    // copy all tiles from an image to an image buffer in shared memory
+    void writeImage( float* buffer , const RenderTarget& image ) const;
 
-    PlatformSharedMemory    m_sharedMemory;
+    // denoise the image rendered so far and publish it as a preview
+    void publishPreview();
 };
@@ -0,0 +1,208 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cstring>
+#include "bucketimage.h"
+#include "core/globalconfig.h"
+#include "core/path.h"
+#include "core/stats.h"
+#include "math/quantization.h"
+
+SORT_STATS_DEFINE_COUNTER(sStreamedTileCount)
+SORT_STATS_COUNTER("Performance", "Tiles Streamed to Disk", sStreamedTileCount);
+
+namespace {
+    // Channels of the file sorted by their names as readers expect, all of them are in half precision.
+    const char* const BUCKET_CHANNELS[] = { "B" , "G" , "R" };
+    constexpr int BUCKET_CHANNEL_CNT = 3;
+
+    // The chunk of a tile starts with the coordinates of the tile and its level, followed by the size of its pixels.
+    constexpr int TILE_CHUNK_HEADER_SIZE = 5 * sizeof( std::int32_t );
+
+    // Magic number of exr files and the version with the flag of tiled images set.
+    constexpr std::int32_t EXR_MAGIC = 20000630;
+    constexpr std::int32_t EXR_TILED_VERSION = 2 | 0x200;
+
+    // values are appended in the byte order of the machine, all supported platforms are little endian like exr files
+    template<class T>
+    void append( std::vector<char>& buf , const T& v ){
+        const auto p = reinterpret_cast<const char*>( &v );
+        buf.insert( buf.end() , p , p + sizeof( T ) );
+    }
+
+    // strings are appended with the terminating null character
+    void append( std::vector<char>& buf , const char* str ){
+        buf.insert( buf.end() , str , str + strlen( str ) + 1 );
+    }
+
+    // an attribute of the header is its name and type followed by the size of its value
+    void appendAttribute( std::vector<char>& buf , const char* name , const char* type , const std::vector<char>& value ){
+        append( buf , name );
+        append( buf , type );
+        append( buf , (std::int32_t)value.size() );
+        buf.insert( buf.end() , value.begin() , value.end() );
+    }
+
+    // header of an uncompressed tiled exr file with a single level
+    std::vector<char> exrHeader( int w , int h , int tileSize ){
+        std::vector<char> header;
+        append( header , EXR_MAGIC );
+        append( header , EXR_TILED_VERSION );
+
+        std::vector<char> value;
+        for( const auto channel : BUCKET_CHANNELS ){
+            append( value , channel );
+            append( value , (std::int32_t)1 );          // half
+            append( value , (std::int32_t)0 );          // linear flag and reserved bytes
+            append( value , (std::int32_t)1 );          // x sampling
+            append( value , (std::int32_t)1 );          // y sampling
+        }
+        value.push_back( 0 );
+        appendAttribute( header , "channels" , "chlist" , value );
+
+        appendAttribute( header , "compression" , "compression" , { 0 } );
+
+        value.clear();
+        append( value , (std::int32_t)0 );
+        append( value , (std::int32_t)0 );
+        append( value , (std::int32_t)( w - 1 ) );
+        append( value , (std::int32_t)( h - 1 ) );
+        appendAttribute( header , "dataWindow" , "box2i" , value );
+        appendAttribute( header , "displayWindow" , "box2i" , value );
+
+        appendAttribute( header , "lineOrder" , "lineOrder" , { 0 } );
+
+        value.clear();
+        append( value , 1.0f );
+        appendAttribute( header , "pixelAspectRatio" , "float" , value );
+        appendAttribute( header , "screenWindowWidth" , "float" , value );
+
+        value.clear();
+        append( value , 0.0f );
+        append( value , 0.0f );
+        appendAttribute( header , "screenWindowCenter" , "v2f" , value );
+
+        // one level of tiles, the rounding mode doesn't matter then
+        value.clear();
+        append( value , (std::uint32_t)tileSize );
+        append( value , (std::uint32_t)tileSize );
+        value.push_back( 0 );
+        appendAttribute( header , "tiles" , "tiledesc" , value );
+
+        header.push_back( 0 );
+        return header;
+    }
+}
+
+BucketImage::BucketImage( int w , int h , unsigned int tileSize ) : ImageSensor( w , h , false ) ,
+    m_tileSize( (int)tileSize ) , m_tileCntX( ( w + (int)tileSize - 1 ) / (int)tileSize ) , m_tileCntY( ( h + (int)tileSize - 1 ) / (int)tileSize ){
+}
+
+void BucketImage::PreProcess(){
+    const auto name = GetFilePathInExeFolder( g_outputFileName );
+    m_file.open( name , std::ios::binary | std::ios::trunc );
+    if( !m_file ){
+        slog( WARNING , IMAGE , "Fail to open image file %s." , name.c_str() );
+        return;
+    }
+
+    // tiles are laid out row by row after the table of their offsets
+    const auto header = exrHeader( m_width , m_height , m_tileSize );
+    const auto tile_cnt = (size_t)m_tileCntX * m_tileCntY;
+    m_tileOffsets.resize( tile_cnt );
+    m_tileWritten.assign( tile_cnt , 0 );
+    auto offset = (std::uint64_t)header.size() + tile_cnt * sizeof( std::uint64_t );
+    for( auto ty = 0 ; ty < m_tileCntY ; ++ty ){
+        const auto th = std::min( m_tileSize , m_height - ty * m_tileSize );
+        for( auto tx = 0 ; tx < m_tileCntX ; ++tx ){
+            const auto tw = std::min( m_tileSize , m_width - tx * m_tileSize );
+            m_tileOffsets[ (size_t)ty * m_tileCntX + tx ] = offset;
+            offset += TILE_CHUNK_HEADER_SIZE + (std::uint64_t)tw * th * BUCKET_CHANNEL_CNT * sizeof( std::uint16_t );
+        }
+    }
+
+    m_file.write( header.data() , header.size() );
+    m_file.write( reinterpret_cast<const char*>( m_tileOffsets.data() ) , tile_cnt * sizeof( std::uint64_t ) );
+}
+
+void BucketImage::FinishTile( int tile_x , int tile_y , const RenderedTile& rt ){
+    m_finishedTilePassCnt.fetch_add( 1 , std::memory_order_relaxed );
+    if( !m_file.is_open() )
+        return;
+
+    // pieces of tiles clipped by the render region still belong to the tiles they come from
+    const auto tl = rt.GetTopLeft();
+    writeTile( tl.x / m_tileSize , tl.y / m_tileSize , &rt );
+}
+
+void BucketImage::PostProcess(){
+    if( m_coverage )
+        slog( WARNING , IMAGE , "Texels are not dilated when tiles are streamed to the file." );
+    if( !m_file.is_open() )
+        return;
+
+    for( auto ty = 0 ; ty < m_tileCntY ; ++ty )
+        for( auto tx = 0 ; tx < m_tileCntX ; ++tx )
+            if( !m_tileWritten[ (size_t)ty * m_tileCntX + tx ] )
+                writeTile( tx , ty , nullptr );
+
+    m_file.close();
+    if( m_file.fail() )
+        slog( WARNING , IMAGE , "Fail to save image file %s." , GetFilePathInExeFolder( g_outputFileName ).c_str() );
+}
+
+void BucketImage::writeTile( int tx , int ty , const RenderedTile* rt ){
+    const auto x0 = tx * m_tileSize , y0 = ty * m_tileSize;
+    const auto tw = std::min( m_tileSize , m_width - x0 );
+    const auto th = std::min( m_tileSize , m_height - y0 );
+
+    // each row of the tile has all pixels of the first channel, followed by the ones of the other channels
+    const auto data_size = (std::int32_t)( tw * th * BUCKET_CHANNEL_CNT * sizeof( std::uint16_t ) );
+    std::vector<char> chunk;
+    chunk.reserve( TILE_CHUNK_HEADER_SIZE + data_size );
+    append( chunk , (std::int32_t)tx );
+    append( chunk , (std::int32_t)ty );
+    append( chunk , (std::int32_t)0 );
+    append( chunk , (std::int32_t)0 );
+    append( chunk , data_size );
+    chunk.resize( TILE_CHUNK_HEADER_SIZE + data_size , 0 );
+
+    if( rt ){
+        const auto tl = rt->GetTopLeft();
+        const auto rb = tl + rt->GetTileSize();
+        auto pixels = chunk.data() + TILE_CHUNK_HEADER_SIZE;
+        for( auto i = tl.y ; i < rb.y ; ++i ){
+            auto row = pixels + (size_t)( i - y0 ) * tw * BUCKET_CHANNEL_CNT * sizeof( std::uint16_t );
+            for( auto j = tl.x ; j < rb.x ; ++j ){
+                // pixels not sampled at all stay black
+                if( rt->GetTileWeight( j , i ) <= 0.0f )
+                    continue;
+                const auto& color = rt->GetTileRadiance( j , i );
+                const std::uint16_t rgb[] = { floatToHalf( color.b ) , floatToHalf( color.g ) , floatToHalf( color.r ) };
+                for( auto c = 0 ; c < BUCKET_CHANNEL_CNT ; ++c )
+                    memcpy( row + ( (size_t)c * tw + j - x0 ) * sizeof( std::uint16_t ) , &rgb[c] , sizeof( std::uint16_t ) );
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    const auto id = (size_t)ty * m_tileCntX + tx;
+    m_file.seekp( (std::streamoff)m_tileOffsets[id] );
+    m_file.write( chunk.data() , chunk.size() );
+    m_tileWritten[id] = 1;
+    SORT_STATS(++sStreamedTileCount);
+}
@@ -0,0 +1,62 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <fstream>
+#include "imagesensor.h"
+
+// image sensor of ultra-high-resolution images, nothing is kept for all pixels. Each tile is written in a tiled exr
+// file once its only pass is done, the framebuffer only takes the tiles being rendered.
+//
+// Pixels are stored without compression, the size of every tile in the file is known before anything is rendered.
+// Tiles land in their own places of the file in whatever order they are finished, none of them waits for another.
+class BucketImage : public ImageSensor{
+public:
+    // constructor, tiles of the file are as large as the tiles rendered
+    BucketImage( int w , int h , unsigned int tileSize );
+
+    // open the file, the header and the offsets of all tiles are written first
+    void PreProcess() override;
+
+    // finish image tile, the tile is written in the file right away
+    void FinishTile( int tile_x , int tile_y , const RenderedTile& rt ) override;
+
+    // tiles not rendered, like the ones out of the render region, are written as black and the file is closed
+    void PostProcess() override;
+
+private:
+    // write a tile in the file, pixels not in the rendered tile are left black. 'rt' is nullptr if there is nothing.
+    void writeTile( int tx , int ty , const RenderedTile* rt );
+
+    // the file being written
+    std::ofstream               m_file;
+
+    // tiles are finished in parallel, only one of them is written in the file at a time
+    std::mutex                  m_mutex;
+
+    // size of tiles and the number of them along each axis
+    const int                   m_tileSize;
+    const int                   m_tileCntX;
+    const int                   m_tileCntY;
+
+    // offset of each tile in the file and whether it is written already
+    std::vector<std::uint64_t>  m_tileOffsets;
+    std::vector<std::uint8_t>   m_tileWritten;
+};
@@ -0,0 +1,222 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <fstream>
+#include <vector>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include "checkpoint.h"
+#include "imagesensor.h"
+#include "stream/fstream.h"
+#include "core/log.h"
+#include "core/profile.h"
+
+static constexpr unsigned int CHECKPOINT_MAGIC      = 0x504B4353;   // 'SCKP' in little endian
+static constexpr unsigned int CHECKPOINT_VERSION    = 3;
+
+namespace {
+    // size of a pixel in the checkpoint file, radiance first, followed by AOVs and the statistics if there are any
+    size_t pixelSize( bool aov , bool stats ){
+        return 3 * sizeof(float) + ( aov ? AOV_CHANNEL_CNT * sizeof(float) : 0 ) + ( stats ? sizeof(PixelStats) : 0 );
+    }
+}
+
+Checkpoint::Checkpoint( ImageSensor& sensor , const std::string& filename , std::uint64_t sceneHash , float interval ):
+    m_sensor(sensor), m_filename(filename), m_sceneHash(sceneHash), m_interval(std::max( 1.0f , interval )){
+}
+
+Checkpoint::~Checkpoint(){
+    Stop();
+}
+
+void Checkpoint::Start(){
+    m_stop = false;
+    m_thread = std::thread( [this](){
+        const auto interval = std::chrono::milliseconds( (long long)( m_interval * 1000.0f ) );
+        std::unique_lock<std::mutex> lock( m_mutex );
+        while( !m_cv.wait_for( lock , interval , [this](){ return m_stop; } ) ){
+            lock.unlock();
+            if( save() )
+                slog( INFO , IMAGE , "Checkpoint is saved in %s." , m_filename.c_str() );
+            else
+                slog( WARNING , IMAGE , "Failed to save checkpoint in %s." , m_filename.c_str() );
+            lock.lock();
+        }
+    });
+}
+
+void Checkpoint::Stop(){
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    if( m_thread.joinable() )
+        m_thread.join();
+}
+
+bool Checkpoint::save() const{
+    SORT_PROFILE("Save Checkpoint");
+
+    auto& sensor = m_sensor;
+    const auto aov = IS_PTR_VALID( sensor.m_aov );
+    const auto stats = IS_PTR_VALID( sensor.m_pixelStats );
+    const auto pixel_size = pixelSize( aov , stats );
+    const auto tile_cnt_y = ( sensor.m_height + sensor.m_tileSize - 1 ) / sensor.m_tileSize;
+
+    const auto tmp_filename = m_filename + ".tmp";
+    {
+        OFileStream stream( tmp_filename );
+        stream << CHECKPOINT_MAGIC << CHECKPOINT_VERSION;
+        stream << (unsigned int)( m_sceneHash & 0xffffffff ) << (unsigned int)( m_sceneHash >> 32 );
+        stream << sensor.m_width << sensor.m_height << sensor.m_tileSize << aov << stats;
+
+        std::vector<char> buffer;
+        for( auto ty = 0 ; ty < tile_cnt_y ; ++ty ){
+            for( auto tx = 0 ; tx < sensor.m_tileCntX ; ++tx ){
+                const Vector2i tl( tx * sensor.m_tileSize , ty * sensor.m_tileSize );
+                const Vector2i rb( std::min( sensor.m_width , tl.x + sensor.m_tileSize ) , std::min( sensor.m_height , tl.y + sensor.m_tileSize ) );
+                const auto tile_id = sensor.getTileId( tl );
+                buffer.resize( (size_t)( rb.x - tl.x ) * ( rb.y - tl.y ) * pixel_size );
+
+                // only the copy happens under the lock, the file is written afterward
+                unsigned int sample_cnt = 0;
+                {
+                    std::lock_guard<spinlock_mutex> lock( sensor.m_tileLocks[tile_id] );
+                    sample_cnt = sensor.m_tileSampleCnt[tile_id];
+                    auto dst = buffer.data();
+                    for( auto y = tl.y ; y < rb.y ; ++y ){
+                        for( auto x = tl.x ; x < rb.x ; ++x ){
+                            const auto color = sensor.m_rendertarget.GetColor( x , y );
+                            const float rgb[] = { color.r , color.g , color.b };
+                            memcpy( dst , rgb , sizeof( rgb ) );
+                            dst += sizeof( rgb );
+                            const auto pixel_id = (size_t)y * sensor.m_width + x;
+                            if( aov ){
+                                memcpy( dst , sensor.m_aov.get() + pixel_id * AOV_CHANNEL_CNT , AOV_CHANNEL_CNT * sizeof(float) );
+                                dst += AOV_CHANNEL_CNT * sizeof(float);
+                            }
+                            if( stats ){
+                                memcpy( dst , &sensor.m_pixelStats[pixel_id] , sizeof(PixelStats) );
+                                dst += sizeof(PixelStats);
+                            }
+                        }
+                    }
+                }
+
+                stream << sample_cnt;
+                if( sample_cnt > 0 )
+                    stream.Write( buffer.data() , (int)buffer.size() );
+            }
+        }
+        stream << CHECKPOINT_MAGIC;
+    }
+
+    // the previous checkpoint is only replaced once the new one is fully written
+    remove( m_filename.c_str() );
+    if( 0 != rename( tmp_filename.c_str() , m_filename.c_str() ) ){
+        remove( tmp_filename.c_str() );
+        return false;
+    }
+    return true;
+}
+
+bool Checkpoint::Load(){
+    SORT_PROFILE("Load Checkpoint");
+
+    // IFileStream complains about missing files, there is nothing to resume from in the first run though.
+    if( !std::ifstream( m_filename ).good() )
+        return false;
+
+    IFileStream stream( m_filename );
+    unsigned int magic = 0 , version = 0 , hash_lo = 0 , hash_hi = 0 , tile_size = 0;
+    int w = 0 , h = 0;
+    bool aov = false , stats = false;
+    stream >> magic >> version >> hash_lo >> hash_hi >> w >> h >> tile_size >> aov >> stats;
+    if( magic != CHECKPOINT_MAGIC || version != CHECKPOINT_VERSION )
+        return false;
+    if( hash_lo != (unsigned int)( m_sceneHash & 0xffffffff ) || hash_hi != (unsigned int)( m_sceneHash >> 32 ) ){
+        slog( WARNING , IMAGE , "Checkpoint %s is taken from a different scene." , m_filename.c_str() );
+        return false;
+    }
+
+    auto& sensor = m_sensor;
+    if( w != sensor.m_width || h != sensor.m_height || (int)tile_size != sensor.m_tileSize ||
+        aov != IS_PTR_VALID( sensor.m_aov ) || stats != IS_PTR_VALID( sensor.m_pixelStats ) ){
+        slog( WARNING , IMAGE , "Checkpoint %s doesn't match the rendering settings." , m_filename.c_str() );
+        return false;
+    }
+
+    // tiles are loaded in a separate buffer first, a truncated checkpoint leaves the image sensor untouched
+    const auto pixel_size = pixelSize( aov , stats );
+    const auto tile_cnt_y = ( h + sensor.m_tileSize - 1 ) / sensor.m_tileSize;
+    const auto tile_cnt = sensor.m_tileCntX * tile_cnt_y;
+    std::vector<unsigned int> sample_cnts( tile_cnt );
+    std::vector<std::vector<char>> tiles( tile_cnt );
+    for( auto ty = 0 ; ty < tile_cnt_y ; ++ty ){
+        for( auto tx = 0 ; tx < sensor.m_tileCntX ; ++tx ){
+            const Vector2i tl( tx * sensor.m_tileSize , ty * sensor.m_tileSize );
+            const Vector2i rb( std::min( w , tl.x + sensor.m_tileSize ) , std::min( h , tl.y + sensor.m_tileSize ) );
+            const auto tile_id = sensor.getTileId( tl );
+            stream >> sample_cnts[tile_id];
+            if( sample_cnts[tile_id] == 0 )
+                continue;
+            tiles[tile_id].resize( (size_t)( rb.x - tl.x ) * ( rb.y - tl.y ) * pixel_size );
+            stream.Load( tiles[tile_id].data() , (int)tiles[tile_id].size() );
+        }
+    }
+
+    // a truncated file doesn't end with the magic number
+    magic = 0;
+    stream >> magic;
+    if( magic != CHECKPOINT_MAGIC ){
+        slog( WARNING , IMAGE , "Checkpoint %s is truncated." , m_filename.c_str() );
+        return false;
+    }
+
+    for( auto ty = 0 ; ty < tile_cnt_y ; ++ty ){
+        for( auto tx = 0 ; tx < sensor.m_tileCntX ; ++tx ){
+            const Vector2i tl( tx * sensor.m_tileSize , ty * sensor.m_tileSize );
+            const Vector2i rb( std::min( w , tl.x + sensor.m_tileSize ) , std::min( h , tl.y + sensor.m_tileSize ) );
+            const auto tile_id = sensor.getTileId( tl );
+            sensor.m_tileSampleCnt[tile_id] = sample_cnts[tile_id];
+            if( sample_cnts[tile_id] == 0 )
+                continue;
+
+            auto src = tiles[tile_id].data();
+            for( auto y = tl.y ; y < rb.y ; ++y ){
+                for( auto x = tl.x ; x < rb.x ; ++x ){
+                    float rgb[3];
+                    memcpy( rgb , src , sizeof( rgb ) );
+                    src += sizeof( rgb );
+                    sensor.m_rendertarget.SetColor( x , y , Spectrum( rgb[0] , rgb[1] , rgb[2] ) );
+                    const auto pixel_id = (size_t)y * w + x;
+                    if( aov ){
+                        memcpy( sensor.m_aov.get() + pixel_id * AOV_CHANNEL_CNT , src , AOV_CHANNEL_CNT * sizeof(float) );
+                        src += AOV_CHANNEL_CNT * sizeof(float);
+                    }
+                    if( stats ){
+                        memcpy( &sensor.m_pixelStats[pixel_id] , src , sizeof(PixelStats) );
+                        src += sizeof(PixelStats);
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
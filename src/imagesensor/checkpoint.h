@@ -0,0 +1,75 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <cstdint>
+#include <condition_variable>
+
+class ImageSensor;
+
+//! @brief  Checkpoint periodically saves the image being rendered, so that rendering could resume after a crash.
+/**
+ * A checkpoint holds the number of samples taken by each tile, along with the radiance, AOVs and pixel statistics of
+ * all pixels. Random numbers only depend on the pixel and the index of the sample, resuming from the sample count of
+ * a tile draws exactly the same samples as the interrupted rendering would do.
+ * Checkpoints are written on a background thread. Tiles are copied one by one under their own locks, a worker
+ * finishing a tile only waits for the copy of that tile, never for the file system.
+ */
+class Checkpoint{
+public:
+    //! @brief  Constructor.
+    //!
+    //! @param  sensor      The image sensor to be saved, checkpoints need to be enabled in it already.
+    //! @param  filename    Full path of the checkpoint file.
+    //! @param  sceneHash   Hash of the scene file, a checkpoint of a different scene is never resumed.
+    //! @param  interval    Seconds between two checkpoints.
+    Checkpoint( ImageSensor& sensor , const std::string& filename , std::uint64_t sceneHash , float interval );
+
+    //! @brief  Destructor stops the background thread.
+    ~Checkpoint();
+
+    //! @brief  Restore the image sensor from the checkpoint file.
+    //!
+    //! @return     Whether the checkpoint is resumed, the image sensor is left untouched otherwise.
+    bool    Load();
+
+    //! @brief  Start writing checkpoints periodically on a background thread.
+    void    Start();
+
+    //! @brief  Stop writing checkpoints, it waits for the checkpoint being written.
+    void    Stop();
+
+private:
+    //! @brief  Write a checkpoint, the previous one is only replaced once the new one is fully written.
+    //!
+    //! @return     Whether the checkpoint is written.
+    bool    save() const;
+
+    ImageSensor&                m_sensor;           /**< The image sensor to be saved. */
+    const std::string           m_filename;         /**< Full path of the checkpoint file. */
+    const std::uint64_t         m_sceneHash;        /**< Hash of the scene file. */
+    const float                 m_interval;         /**< Seconds between two checkpoints. */
+
+    std::thread                 m_thread;           /**< The thread writing checkpoints. */
+    std::mutex                  m_mutex;            /**< Mutex protecting the stop flag. */
+    std::condition_variable     m_cv;               /**< Wakes up the thread once it needs to stop. */
+    bool                        m_stop = false;     /**< Whether the thread needs to stop. */
+};
@@ -0,0 +1,139 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "denoiser.h"
+#include "task/task.h"
+#include "core/profile.h"
+
+// Size of the tiles filtered in parallel tasks.
+static constexpr int    DENOISER_TILE_SIZE      = 32;
+// Radius of the filter window in pixels.
+static constexpr int    DENOISER_RADIUS         = 6;
+// Standard deviation of the spatial gaussian in pixels.
+static constexpr float  DENOISER_SIGMA_SPATIAL  = 3.0f;
+// Standard deviation of the color term, relative to the brightness of the pixels being compared.
+static constexpr float  DENOISER_SIGMA_COLOR    = 0.35f;
+// Standard deviation of the albedo term.
+static constexpr float  DENOISER_SIGMA_ALBEDO   = 0.1f;
+// Standard deviation of the normal term, measured with one minus the cosine between the normals.
+static constexpr float  DENOISER_SIGMA_NORMAL   = 0.15f;
+// Albedo below this is not divided out, it would amplify the noise instead.
+static constexpr float  DENOISER_MIN_ALBEDO     = 0.01f;
+
+namespace {
+    // albedo used to demodulate a pixel, dark channels are kept as they are
+    SORT_FORCEINLINE Spectrum demodulationAlbedo( const float* aov ){
+        const auto a = aov + AovChannelOffset( AOV_ALBEDO );
+        return Spectrum( a[0] > DENOISER_MIN_ALBEDO ? a[0] : 1.0f ,
+                         a[1] > DENOISER_MIN_ALBEDO ? a[1] : 1.0f ,
+                         a[2] > DENOISER_MIN_ALBEDO ? a[2] : 1.0f );
+    }
+}
+
+void BilateralDenoiser::Denoise( const RenderTarget& src , const float* aov , RenderTarget& dst ) const{
+    SORT_PROFILE("Denoising");
+
+    const auto w = src.GetWidth();
+    const auto h = src.GetHeight();
+
+    // the illumination to be filtered, textures are divided out if the albedo is available
+    std::vector<Spectrum> illum( (size_t)w * h );
+    ParallelFor( 0u , (unsigned)h , 16u , [&]( unsigned s , unsigned e ){
+        for( auto y = (int)s ; y < (int)e ; ++y ){
+            for( auto x = 0 ; x < w ; ++x ){
+                const auto id = (size_t)y * w + x;
+                const auto color = src.GetColor( x , y );
+                illum[id] = aov ? color / demodulationAlbedo( aov + id * AOV_CHANNEL_CNT ) : color;
+            }
+        }
+    });
+
+    // brightness of the 3x3 patch around each pixel, it is far less noisy than the pixel itself
+    std::vector<float> guide( (size_t)w * h );
+    ParallelFor( 0u , (unsigned)h , 16u , [&]( unsigned s , unsigned e ){
+        for( auto y = (int)s ; y < (int)e ; ++y ){
+            for( auto x = 0 ; x < w ; ++x ){
+                auto sum = 0.0f;
+                auto cnt = 0;
+                for( auto j = std::max( 0 , y - 1 ) ; j <= std::min( h - 1 , y + 1 ) ; ++j ){
+                    for( auto i = std::max( 0 , x - 1 ) ; i <= std::min( w - 1 , x + 1 ) ; ++i ){
+                        sum += illum[(size_t)j * w + i].GetIntensity();
+                        ++cnt;
+                    }
+                }
+                guide[(size_t)y * w + x] = sum / (float)cnt;
+            }
+        }
+    });
+
+    const auto tile_cnt_x = ( w + DENOISER_TILE_SIZE - 1 ) / DENOISER_TILE_SIZE;
+    const auto tile_cnt_y = ( h + DENOISER_TILE_SIZE - 1 ) / DENOISER_TILE_SIZE;
+    const auto inv_spatial = 1.0f / ( 2.0f * DENOISER_SIGMA_SPATIAL * DENOISER_SIGMA_SPATIAL );
+    const auto inv_albedo = 1.0f / ( 2.0f * DENOISER_SIGMA_ALBEDO * DENOISER_SIGMA_ALBEDO );
+    const auto inv_normal = 1.0f / DENOISER_SIGMA_NORMAL;
+    const auto sigma_color2 = DENOISER_SIGMA_COLOR * DENOISER_SIGMA_COLOR;
+
+    // tiles only read the shared buffers and write their own pixels, no lock is needed
+    ParallelFor( 0u , (unsigned)( tile_cnt_x * tile_cnt_y ) , 1u , [&]( unsigned s , unsigned e ){
+        for( auto t = (int)s ; t < (int)e ; ++t ){
+            const auto x0 = ( t % tile_cnt_x ) * DENOISER_TILE_SIZE;
+            const auto y0 = ( t / tile_cnt_x ) * DENOISER_TILE_SIZE;
+            const auto x1 = std::min( w , x0 + DENOISER_TILE_SIZE );
+            const auto y1 = std::min( h , y0 + DENOISER_TILE_SIZE );
+            for( auto y = y0 ; y < y1 ; ++y ){
+                for( auto x = x0 ; x < x1 ; ++x ){
+                    const auto p = (size_t)y * w + x;
+                    const auto gp = guide[p];
+                    const auto fp = aov ? aov + p * AOV_CHANNEL_CNT : nullptr;
+
+                    Spectrum sum;
+                    auto total_weight = 0.0f;
+                    for( auto j = std::max( 0 , y - DENOISER_RADIUS ) ; j <= std::min( h - 1 , y + DENOISER_RADIUS ) ; ++j ){
+                        for( auto i = std::max( 0 , x - DENOISER_RADIUS ) ; i <= std::min( w - 1 , x + DENOISER_RADIUS ) ; ++i ){
+                            const auto q = (size_t)j * w + i;
+                            const auto d2 = (float)( ( i - x ) * ( i - x ) + ( j - y ) * ( j - y ) );
+                            const auto gd = gp - guide[q];
+                            auto exponent = d2 * inv_spatial + gd * gd / ( sigma_color2 * ( gp * gp + guide[q] * guide[q] ) + 1e-4f );
+
+                            if( fp ){
+                                const auto fq = aov + q * AOV_CHANNEL_CNT;
+                                const auto ap = fp + AovChannelOffset( AOV_ALBEDO );
+                                const auto aq = fq + AovChannelOffset( AOV_ALBEDO );
+                                const auto np = fp + AovChannelOffset( AOV_NORMAL );
+                                const auto nq = fq + AovChannelOffset( AOV_NORMAL );
+                                const auto da = ( ap[0] - aq[0] ) * ( ap[0] - aq[0] ) + ( ap[1] - aq[1] ) * ( ap[1] - aq[1] ) + ( ap[2] - aq[2] ) * ( ap[2] - aq[2] );
+                                const auto dn = 1.0f - ( np[0] * nq[0] + np[1] * nq[1] + np[2] * nq[2] );
+                                exponent += da * inv_albedo + std::max( 0.0f , dn ) * inv_normal;
+                            }
+
+                            const auto weight = std::exp( -exponent );
+                            sum += illum[q] * weight;
+                            total_weight += weight;
+                        }
+                    }
+
+                    // the pixel itself always has a positive weight
+                    const auto filtered = sum / total_weight;
+                    dst.SetColor( x , y , fp ? filtered * demodulationAlbedo( fp ) : filtered );
+                }
+            }
+        }
+    });
+}
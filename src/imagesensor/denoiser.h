@@ -0,0 +1,62 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "core/rtti.h"
+#include "texture/rendertarget.h"
+#include "aov.h"
+
+//! @brief  Denoiser removes the noise of the rendered image as a post process.
+/**
+ * Denoisers are created by their class names, an external denoising library could be hooked up by registering a
+ * denoiser wrapping it with 'DEFINE_RTTI' and picking it with '--denoiser:<class name>' in the command line.
+ */
+class Denoiser{
+public:
+    //! @brief  Virtual destructor.
+    virtual ~Denoiser() {}
+
+    //! @brief  Denoise an image.
+    //!
+    //! It could be called in the middle of rendering for previews, it is up to the caller to make sure both images
+    //! stay alive until it returns.
+    //!
+    //! @param  src     The noisy image.
+    //! @param  aov     AOVs of all pixels, 'AOV_CHANNEL_CNT' floats per pixel. Albedo and normal are used as features
+    //!                 to preserve details, nullptr means there is no feature available.
+    //! @param  dst     The denoised image, it has the same size as the noisy one and it can't be the same image.
+    virtual void    Denoise( const RenderTarget& src , const float* aov , RenderTarget& dst ) const = 0;
+};
+
+//! @brief  A joint bilateral filter guided by the albedo and the normal.
+/**
+ * The albedo is divided out before filtering so that textures are not blurred, only the illumination is filtered.
+ * Instead of the noisy color of a single pixel, the color term compares the average of a small patch around the
+ * pixels, similar to non-local means. Tiles of the image are filtered in parallel tasks.
+ */
+class BilateralDenoiser : public Denoiser{
+public:
+    DEFINE_RTTI( BilateralDenoiser , Denoiser );
+
+    //! @brief  Denoise an image.
+    //!
+    //! @param  src     The noisy image.
+    //! @param  aov     AOVs of all pixels, nullptr means only the color is available.
+    //! @param  dst     The denoised image.
+    void    Denoise( const RenderTarget& src , const float* aov , RenderTarget& dst ) const override;
+};
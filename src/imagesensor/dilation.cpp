@@ -0,0 +1,66 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "dilation.h"
+#include "task/task.h"
+#include "core/profile.h"
+
+void DilateImage( RenderTarget& rt , const std::vector<std::uint8_t>& coverage , unsigned int padding ){
+    SORT_PROFILE("Dilation");
+
+    const auto w = rt.GetWidth();
+    const auto h = rt.GetHeight();
+
+    // pixels only read the coverage of the last iteration, the ones being filled are not read by their neighbors
+    auto covered = coverage;
+    auto next = coverage;
+    for( auto k = 0u ; k < padding ; ++k ){
+        ParallelFor( 0u , (unsigned)h , 16u , [&]( unsigned s , unsigned e ){
+            for( auto y = (int)s ; y < (int)e ; ++y ){
+                for( auto x = 0 ; x < w ; ++x ){
+                    if( covered[y * w + x] )
+                        continue;
+
+                    Spectrum sum;
+                    auto cnt = 0;
+                    for( auto dy = -1 ; dy <= 1 ; ++dy ){
+                        for( auto dx = -1 ; dx <= 1 ; ++dx ){
+                            const auto nx = x + dx;
+                            const auto ny = y + dy;
+                            if( nx < 0 || ny < 0 || nx >= w || ny >= h || !covered[ny * w + nx] )
+                                continue;
+                            sum += rt.GetColor( nx , ny );
+                            ++cnt;
+                        }
+                    }
+                    if( cnt == 0 )
+                        continue;
+                    rt.SetColor( x , y , sum / (float)cnt );
+                    next[y * w + x] = 1;
+                }
+            }
+        });
+        covered = next;
+    }
+
+    ParallelFor( 0u , (unsigned)h , 16u , [&]( unsigned s , unsigned e ){
+        for( auto y = (int)s ; y < (int)e ; ++y )
+            for( auto x = 0 ; x < w ; ++x )
+                if( !covered[y * w + x] )
+                    rt.SetColor( x , y , 0.0f );
+    });
+}
@@ -0,0 +1,32 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "texture/rendertarget.h"
+
+//! @brief  Fill the pixels not covered by anything with the ones covered nearby, used to pad UV charts of baked textures.
+//!
+//! Each iteration grows the covered area by one pixel, a pixel next to the covered area takes the average of its covered
+//! neighbors. Rows are processed in parallel tasks. Pixels still not covered after all iterations are black.
+//!
+//! @param  rt          The image to be dilated.
+//! @param  coverage    Whether each pixel is covered, row by row.
+//! @param  padding     Number of pixels to grow the covered area by.
+void DilateImage( RenderTarget& rt , const std::vector<std::uint8_t>& coverage , unsigned int padding );
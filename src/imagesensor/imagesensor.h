@@ -21,24 +21,118 @@
 #include "texture/rendertarget.h"
 #include "task/render_task.h"
 #include "core/thread.h"
+#include "pixelstats.h"
+#include "splatfilm.h"
+#include "pixelfilter.h"
+#include "robustfilm.h"
+#include "denoiser.h"
+#include "dilation.h"
 #include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+
+struct TelemetrySnapshot;
 
 // generate output
 class ImageSensor{
 public:
-    ImageSensor( int w , int h ) : m_width(w) , m_height(h) , m_rendertarget( w , h ) {
-        m_mutex = std::make_unique<spinlock_mutex[]>( m_width * m_height );
-    }
+    ImageSensor( int w , int h ) : m_width(w) , m_height(h) , m_rendertarget( w , h ) {}
     virtual ~ImageSensor(){}
 
     // pre process
     virtual void PreProcess() {}
 
-    // finish image tile
-    virtual void FinishTile( int tile_x , int tile_y , const Render_Task& rt ){}
+    // start rendering a new frame of the same image, everything accumulated in the last frame is dropped.
+    // The render target is not cleared since the first pass of every tile overwrites it.
+    virtual void Restart(){
+        if( m_splatTarget )
+            m_splatTarget = std::make_unique<RenderTarget>( m_width , m_height );
+        if( m_splatFilm )
+            m_splatFilm->Clear();
+        if( m_pixelStats )
+            m_pixelStats = std::make_unique<PixelStats[]>( m_width * m_height );
+        if( m_draftTraced )
+            std::fill( m_draftTraced.get() , m_draftTraced.get() + (size_t)m_width * m_height , 0 );
+        if( m_filteredFilm )
+            m_filteredFilm->Clear();
+        if( m_robustFilm )
+            m_robustFilm->Clear();
+        m_tracedSampleCnt = 0;
+        m_finishedTilePassCnt = 0;
+    }
+
+    // finish image tile, the tile rendered in a pass is blended into the render target.
+    // Tiles never overlap and passes of a tile are executed one after another, pixels of the tile are only written here.
+    // Aprons of filtered tiles reach into the neighbours, they are merged into the film atomically and only the tile
+    // itself is resolved, the pixels of the neighbours are left to their own tiles and to PostProcess.
+    virtual void FinishTile( int tile_x , int tile_y , const RenderedTile& rt ){
+        const auto tl = rt.GetTopLeft();
+        const auto rb = tl + rt.GetTileSize();
+
+        // checkpoints take a snapshot of the tile under the same lock, so that pixels always match the sample count
+        std::unique_lock<spinlock_mutex> lock;
+        if( m_tileSampleCnt ){
+            const auto tile_id = getTileId( tl );
+            lock = std::unique_lock<spinlock_mutex>( m_tileLocks[tile_id] );
+            m_tileSampleCnt[tile_id] = rt.sampleOffset + rt.sampleCnt;
+        }
+        m_finishedTilePassCnt.fetch_add( 1 , std::memory_order_relaxed );
+
+        // filtered samples keep accumulating in the film, the tile is resolved again for the preview
+        const auto filtered = m_filteredFilm && rt.filtered;
+        if( filtered ){
+            m_filteredFilm->Merge( *rt.filtered , tl , rt.GetTileSize() );
+            m_filteredFilm->Resolve( m_rendertarget , tl , rt.GetTileSize() );
+        }
+
+        // buckets keep accumulating in the film, pixels touched in this pass take the median of their bucket means
+        const auto robust = m_robustFilm && rt.buckets;
+        if( robust )
+            m_robustFilm->Merge( *rt.buckets , tl , rt.GetTileSize() );
+
+        for( auto i = tl.y ; i < rb.y ; ++i ){
+            for( auto j = tl.x ; j < rb.x ; ++j ){
+                const auto w = rt.GetTileWeight( j , i );
+                if( w <= 0.0f )
+                    continue;
+                const auto& color = rt.GetTileRadiance( j , i );
+                Spectrum mean;
+                if( robust )
+                    m_rendertarget.SetColor( j , i , m_robustFilm->Resolve( j , i , &mean ) );
+                else if( !filtered )
+                    m_rendertarget.SetColor( j , i , w >= 1.0f ? color : m_rendertarget.GetColor( j , i ) * ( 1.0f - w ) + color * w );
+
+                if( !m_aov || !rt.aov )
+                    continue;
+                auto dst = m_aov.get() + ( (size_t)i * m_width + j ) * AOV_CHANNEL_CNT;
+                const auto src = rt.GetTileAov( j , i );
+                for( auto c = 0u ; c < AOV_CHANNEL_CNT ; ++c )
+                    dst[c] = w >= 1.0f ? src[c] : dst[c] * ( 1.0f - w ) + src[c] * w;
+                dst[AovChannelOffset( AOV_SAMPLE_COUNT )] = src[AovChannelOffset( AOV_SAMPLE_COUNT )];
+                if( robust ){
+                    auto outlier = dst + AovChannelOffset( AOV_OUTLIER );
+                    const auto rejected = mean - m_rendertarget.GetColor( j , i );
+                    outlier[0] = rejected.r;
+                    outlier[1] = rejected.g;
+                    outlier[2] = rejected.b;
+                }
+            }
+        }
+    }
 
-    // store pixel information
-    virtual void StorePixel( int x , int y , const Spectrum& color , const Render_Task& rt ) = 0;
+    // finish a tile of a coarse pass of the resolution pyramid, each block of 'level' pixels is filled with the pixel
+    // traced at its top-left corner. The first full pass of the tile overwrites all of them.
+    virtual void FinishDraft( int tile_x , int tile_y , const Vector2i& tl , const Vector2i& size , int level ){
+        const auto rb = tl + size;
+        for( auto i = tl.y ; i < rb.y ; ++i ){
+            const auto y = tl.y + ( i - tl.y ) / level * level;
+            for( auto j = tl.x ; j < rb.x ; ++j ){
+                const auto x = tl.x + ( j - tl.x ) / level * level;
+                m_rendertarget.SetColor( j , i , m_draft[ (size_t)y * m_width + x ] );
+            }
+        }
+    }
 
     // get width
     SORT_FORCEINLINE int GetWidth() const {
@@ -50,23 +144,269 @@ public:
         return m_height;
     }
 
-    // post process
-    virtual void PostProcess(){}
+    // post process, splatted radiance is merged into the render target and the result is denoised here
+    virtual void PostProcess(){
+        // aprons of neighboring tiles could land after a tile is resolved, the whole image is resolved once more
+        if( m_filteredFilm )
+            m_filteredFilm->Resolve( m_rendertarget , Vector2i( 0 , 0 ) , Vector2i( m_width , m_height ) );
+
+        mergeSplats();
+
+        // uncovered texels are filled before denoising, the filter would otherwise pull them into the edges of charts
+        if( m_coverage )
+            DilateImage( m_rendertarget , *m_coverage , m_padding );
+
+        if( !m_denoiser )
+            return;
+        RenderTarget denoised( m_width , m_height );
+        m_denoiser->Denoise( m_rendertarget , m_aov.get() , denoised );
+        for( auto i = 0 ; i < m_height ; ++i )
+            for( auto j = 0 ; j < m_width ; ++j )
+                m_rendertarget.SetColor( j , i , denoised.GetColor( j , i ) );
+    }
+
+    // allocate a separate target for radiance splatted from light paths, spp is the targeted sample count per pixel.
+    // With a non-zero thread count, each thread splats into its own replica instead of locking pixels.
+    void EnableSplatting( unsigned int spp , unsigned int threadCnt = 0 ){
+        m_samplePerPixel = spp;
+        if( threadCnt > 0 ){
+            m_splatFilm = std::make_unique<SplatFilm>( m_width , m_height , threadCnt );
+            return;
+        }
+        m_splatTarget = std::make_unique<RenderTarget>( m_width , m_height );
+        m_mutex = std::make_unique<spinlock_mutex[]>( m_width * m_height );
+    }
+
+    // allocate the per-pixel statistics needed by adaptive sampling
+    void EnableAdaptiveSampling(){
+        m_pixelStats = std::make_unique<PixelStats[]>( m_width * m_height );
+    }
+
+    // allocate the framebuffer of AOVs, the mask has a bit set for each AOV to be written
+    void EnableAov( unsigned int mask ){
+        m_aovMask = mask;
+        if( !m_aov )
+            m_aov = std::make_unique<float[]>( (size_t)m_width * m_height * AOV_CHANNEL_CNT );
+    }
+
+    // denoise the image in post process, albedo and normal AOVs are recorded as its features if requested
+    void EnableDenoiser( std::unique_ptr<Denoiser> denoiser , bool features ){
+        m_denoiser = std::move( denoiser );
+        if( features && !m_aov )
+            m_aov = std::make_unique<float[]>( (size_t)m_width * m_height * AOV_CHANNEL_CNT );
+    }
+
+    // weight samples with a pixel filter reaching the pixels around them instead of averaging the samples in each pixel
+    void EnablePixelFilter( std::unique_ptr<PixelFilter> filter ){
+        m_filteredFilm = std::make_unique<FilteredFilm>( m_width , m_height , std::move( filter ) );
+    }
+
+    // split the samples of each pixel into buckets and take the median of their means instead of averaging all samples
+    void EnableRobustAccumulation( unsigned int bucketCnt ){
+        m_robustFilm = std::make_unique<RobustFilm>( m_width , m_height , bucketCnt );
+    }
+
+    // number of buckets render tasks split the samples of each pixel into, 0 if samples are averaged
+    SORT_FORCEINLINE unsigned int GetRobustBucketCnt() const {
+        return m_robustFilm ? m_robustFilm->GetBucketCnt() : 0u;
+    }
+
+    // the pixel filter render tasks weight samples with, nullptr if samples are averaged in each pixel
+    SORT_FORCEINLINE const PixelFilter* GetPixelFilter() const {
+        return m_filteredFilm ? &m_filteredFilm->GetFilter() : nullptr;
+    }
+
+    // render coarse passes of the resolution pyramid before the first full pass of tiles
+    void EnableResolutionPyramid(){
+        m_draft = std::make_unique<Spectrum[]>( (size_t)m_width * m_height );
+        m_draftTraced = std::make_unique<std::uint8_t[]>( (size_t)m_width * m_height );
+    }
+
+    // whether coarse passes of the resolution pyramid are rendered
+    SORT_FORCEINLINE bool HasDraft() const {
+        return IS_PTR_VALID( m_draft );
+    }
+
+    // keep the sample traced at a pixel by the resolution pyramid
+    SORT_FORCEINLINE void SetDraftSample( int x , int y , const Spectrum& radiance ){
+        const auto i = (size_t)y * m_width + x;
+        m_draft[i] = radiance;
+        m_draftTraced[i] = 1;
+    }
+
+    // whether the resolution pyramid has traced a sample at the pixel
+    SORT_FORCEINLINE bool HasDraftSample( int x , int y ) const {
+        return m_draftTraced && m_draftTraced[ (size_t)y * m_width + x ];
+    }
+
+    // the sample traced at a pixel by the resolution pyramid
+    SORT_FORCEINLINE const Spectrum& GetDraftSample( int x , int y ) const {
+        return m_draft[ (size_t)y * m_width + x ];
+    }
+
+    // dilate the pixels covered by something into the uncovered ones around in post process, used by texture baking
+    void EnableDilation( std::shared_ptr<const std::vector<std::uint8_t>> coverage , unsigned int padding ){
+        m_coverage = std::move( coverage );
+        m_padding = padding;
+    }
+
+    // keep track of the samples taken by each tile so that checkpoints could be taken while tiles are being rendered
+    void EnableCheckpoint( unsigned int tileSize ){
+        m_tileSize = (int)tileSize;
+        m_tileCntX = ( m_width + m_tileSize - 1 ) / m_tileSize;
+        const auto tile_cnt = m_tileCntX * ( ( m_height + m_tileSize - 1 ) / m_tileSize );
+        m_tileSampleCnt = std::make_unique<unsigned int[]>( tile_cnt );
+        m_tileLocks = std::make_unique<spinlock_mutex[]>( tile_cnt );
+    }
+
+    // number of samples per pixel already taken by the tile, it is only tracked with checkpoints
+    SORT_FORCEINLINE unsigned int GetTileSampleCnt( const Vector2i& tl ) const {
+        return m_tileSampleCnt ? m_tileSampleCnt[getTileId( tl )] : 0u;
+    }
+
+    // whether render tasks need to record AOVs, they could be written in the image or only used by the denoiser
+    SORT_FORCEINLINE bool HasAov() const {
+        return IS_PTR_VALID( m_aov );
+    }
+
+    // get the statistics of a pixel, only available with adaptive sampling
+    SORT_FORCEINLINE PixelStats& GetPixelStats( int x , int y ){
+        sAssert( m_pixelStats , IMAGE );
+        return m_pixelStats[ y * m_width + x ];
+    }
 
     // add radiance
     virtual void UpdatePixel(int x, int y, const Spectrum& color){
+        if( m_splatFilm ){
+            m_splatFilm->Splat( ThreadId() , x , y , color );
+            return;
+        }
+        sAssert( m_splatTarget , IMAGE );
         std::lock_guard<spinlock_mutex> lock(m_mutex[y * m_width + x]);
-        Spectrum _color = m_rendertarget.GetColor(x, y);
-        m_rendertarget.SetColor(x, y, _color + color);
+        Spectrum _color = m_splatTarget->GetColor(x, y);
+        m_splatTarget->SetColor(x, y, _color + color);
+    }
+
+    // count the pixel samples traced so far
+    SORT_FORCEINLINE void AddTracedSamples( unsigned long long cnt ){
+        m_tracedSampleCnt += cnt;
+    }
+
+    // number of pixel samples traced in the frame so far
+    SORT_FORCEINLINE unsigned long long GetTracedSampleCnt() const {
+        return m_tracedSampleCnt.load( std::memory_order_relaxed );
+    }
+
+    // number of passes of tiles merged in the frame so far, pieces of split tiles are counted on their own
+    SORT_FORCEINLINE unsigned int GetFinishedTilePassCnt() const {
+        return m_finishedTilePassCnt.load( std::memory_order_relaxed );
+    }
+
+    // publish a snapshot of live telemetry, it is called periodically on the telemetry thread
+    virtual void UpdateTelemetry( const TelemetrySnapshot& snapshot ) {}
+
+    // get the render target, it holds the whole image unless tiles are handed out as soon as they are finished
+    SORT_FORCEINLINE const RenderTarget& GetRenderTarget() const {
+        return m_rendertarget;
+    }
+
+    // set the function called once a pass of a tile is merged, it is called by the workers, possibly at the same time
+    void SetTileCallback( std::function<void( const Vector2i& , const Vector2i& )> callback ){
+        m_tileCallback = std::move( callback );
+    }
+
+    // notify the embedding application that a pass of the tile at the top-left corner with the size is merged
+    SORT_FORCEINLINE void NotifyTileFinished( const Vector2i& tl , const Vector2i& size ) const {
+        if( m_tileCallback )
+            m_tileCallback( tl , size );
     }
 
 protected:
+    // sensors handing tiles out as soon as they are finished never hold the whole image, the render target is empty
+    ImageSensor( int w , int h , bool fullTarget ) : m_width(w) , m_height(h) , m_rendertarget( fullTarget ? w : 0 , fullTarget ? h : 0 ) {}
+
+    // index of the tile starting at the pixel
+    SORT_FORCEINLINE int getTileId( const Vector2i& tl ) const {
+        return ( tl.y / m_tileSize ) * m_tileCntX + tl.x / m_tileSize;
+    }
+
+    // merge radiance splatted from light paths into the render target
+    void mergeSplats(){
+        if( !m_splatTarget && !m_splatFilm )
+            return;
+
+        // splats are normalized against the full sample budget, rescale them in case rendering stopped earlier
+        const auto traced = m_tracedSampleCnt.load();
+        const auto expected = (unsigned long long)m_width * m_height * m_samplePerPixel;
+        const auto scale = traced > 0 ? (float)( (double)expected / (double)traced ) : 0.0f;
+        if( m_splatFilm ){
+            m_splatFilm->Resolve( m_rendertarget , scale );
+            return;
+        }
+        for( auto i = 0 ; i < m_height ; ++i )
+            for( auto j = 0 ; j < m_width ; ++j )
+                m_rendertarget.SetColor( j , i , m_rendertarget.GetColor( j , i ) + m_splatTarget->GetColor( j , i ) * scale );
+    }
+
     const int m_width;
     const int m_height;
 
-    // the mutex
+    // the mutex protecting splats, only allocated when the integrator splats radiance
     std::unique_ptr<spinlock_mutex[]>   m_mutex;
 
     // the render target
     RenderTarget m_rendertarget;
-};
+
+    // radiance splatted from light paths, only allocated when the integrator needs it
+    std::unique_ptr<RenderTarget>       m_splatTarget;
+
+    // per-thread replicas of splatted radiance, used instead of the splat target if enabled
+    std::unique_ptr<SplatFilm>          m_splatFilm;
+
+    // filtered samples of all tiles, only allocated with a pixel filter
+    std::unique_ptr<FilteredFilm>       m_filteredFilm;
+
+    // samples of each pixel split into buckets, only allocated with robust accumulation
+    std::unique_ptr<RobustFilm>         m_robustFilm;
+
+    // targeted sample count per pixel that splats are normalized against
+    unsigned int                        m_samplePerPixel = 1;
+
+    // running luminance statistics of each pixel, only allocated with adaptive sampling
+    std::unique_ptr<PixelStats[]>       m_pixelStats;
+
+    // samples traced by the resolution pyramid and whether each pixel has one, only allocated with the pyramid
+    std::unique_ptr<Spectrum[]>         m_draft;
+    std::unique_ptr<std::uint8_t[]>     m_draftTraced;
+
+    // AOVs of all pixels, 'AOV_CHANNEL_CNT' floats per pixel, only allocated if there is any AOV
+    std::unique_ptr<float[]>            m_aov;
+
+    // a bit is set for each AOV to be written
+    unsigned int                        m_aovMask = 0;
+
+    // the denoiser applied in post process, nullptr if denoising is disabled
+    std::unique_ptr<Denoiser>           m_denoiser;
+
+    // whether each pixel is covered and the number of pixels to dilate them by, nullptr if there is no dilation
+    std::shared_ptr<const std::vector<std::uint8_t>>    m_coverage;
+    unsigned int                                        m_padding = 0;
+
+    // samples per pixel taken by each tile and the locks protecting tiles from being saved in the middle of an update,
+    // both are only allocated with checkpoints
+    std::unique_ptr<unsigned int[]>     m_tileSampleCnt;
+    std::unique_ptr<spinlock_mutex[]>   m_tileLocks;
+    int                                 m_tileSize = 1;
+    int                                 m_tileCntX = 0;
+
+    // number of pixel samples traced so far
+    std::atomic<unsigned long long>     m_tracedSampleCnt = { 0 };
+
+    // number of passes of tiles merged in the frame so far
+    std::atomic<unsigned int>           m_finishedTilePassCnt = { 0 };
+
+    // called once a pass of a tile is merged, only set when the renderer is embedded in another application
+    std::function<void( const Vector2i& , const Vector2i& )>    m_tileCallback;
+
+    friend class Checkpoint;
+};
\ No newline at end of file
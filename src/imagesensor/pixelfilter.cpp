@@ -0,0 +1,123 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cmath>
+#include <algorithm>
+#include "pixelfilter.h"
+#include "math/utils.h"
+
+// Falloff of the Gaussian filter, larger values make it sharper.
+static constexpr float GAUSSIAN_FILTER_ALPHA = 2.0f;
+
+float GaussianFilter::evaluate( float d ) const{
+    return std::max( 0.0f , std::exp( -GAUSSIAN_FILTER_ALPHA * d * d ) - std::exp( -GAUSSIAN_FILTER_ALPHA * m_radius * m_radius ) );
+}
+
+float BlackmanHarrisFilter::evaluate( float d ) const{
+    // the window spans twice the radius, it peaks at the center of the pixel
+    const auto t = TWO_PI * ( d / ( 2.0f * m_radius ) + 0.5f );
+    return 0.35875f - 0.48829f * std::cos( t ) + 0.14128f * std::cos( 2.0f * t ) - 0.01168f * std::cos( 3.0f * t );
+}
+
+void FilteredTile::Reset( const Vector2i& tl , const Vector2i& ts , const PixelFilter& filter ){
+    // samples are within the pixel, the filter reaches the pixels whose centers are within its radius
+    apron = (int)std::ceil( filter.GetRadius() - 0.5f );
+    coord = Vector2i( tl.x - apron , tl.y - apron );
+    size = Vector2i( ts.x + 2 * apron , ts.y + 2 * apron );
+    radiance.assign( (size_t)size.x * size.y , Spectrum() );
+    weight.assign( (size_t)size.x * size.y , 0.0f );
+}
+
+void FilteredTile::AddSample( float x , float y , const Spectrum& li , const PixelFilter& filter ){
+    const auto radius = filter.GetRadius();
+    const auto x0 = std::max( coord.x , (int)std::ceil( x - radius - 0.5f ) );
+    const auto x1 = std::min( coord.x + size.x - 1 , (int)std::floor( x + radius - 0.5f ) );
+    const auto y0 = std::max( coord.y , (int)std::ceil( y - radius - 0.5f ) );
+    const auto y1 = std::min( coord.y + size.y - 1 , (int)std::floor( y + radius - 0.5f ) );
+    for( auto py = y0 ; py <= y1 ; ++py ){
+        for( auto px = x0 ; px <= x1 ; ++px ){
+            const auto w = filter.Evaluate( px + 0.5f - x , py + 0.5f - y );
+            if( w == 0.0f )
+                continue;
+            const auto i = (size_t)( py - coord.y ) * size.x + px - coord.x;
+            radiance[i] += li * w;
+            weight[i] += w;
+        }
+    }
+}
+
+// Add to a float shared by multiple threads.
+static SORT_FORCEINLINE void atomicAdd( std::atomic<float>& v , float delta ){
+    auto cur = v.load( std::memory_order_relaxed );
+    while( !v.compare_exchange_weak( cur , cur + delta , std::memory_order_relaxed ) );
+}
+
+FilteredFilm::FilteredFilm( int w , int h , std::unique_ptr<PixelFilter> filter ) : m_width(w) , m_height(h) , m_filter( std::move( filter ) ){
+    m_sum = std::make_unique<std::atomic<float>[]>( (size_t)w * h * 4 );
+    Clear();
+}
+
+void FilteredFilm::Clear(){
+    const auto cnt = (size_t)m_width * m_height * 4;
+    for( auto i = (size_t)0 ; i < cnt ; ++i )
+        m_sum[i].store( 0.0f , std::memory_order_relaxed );
+}
+
+void FilteredFilm::Merge( const FilteredTile& tile , const Vector2i& tl , const Vector2i& ts ){
+    const auto apron = tile.apron;
+    const auto x0 = std::max( 0 , tl.x - apron ) , x1 = std::min( m_width , tl.x + ts.x + apron );
+    const auto y0 = std::max( 0 , tl.y - apron ) , y1 = std::min( m_height , tl.y + ts.y + apron );
+
+    // pixels of other tiles could be reached by this apron, and the other way around for pixels in this one
+    for( auto y = y0 ; y < y1 ; ++y ){
+        const auto inner_y = y >= tl.y + apron && y < tl.y + ts.y - apron;
+        for( auto x = x0 ; x < x1 ; ++x ){
+            const auto i = (size_t)( y - tile.coord.y ) * tile.size.x + x - tile.coord.x;
+            const auto w = tile.weight[i];
+            if( w == 0.0f )
+                continue;
+
+            const auto& l = tile.radiance[i];
+            const float add[] = { l.r , l.g , l.b , w };
+            auto dst = m_sum.get() + ( (size_t)y * m_width + x ) * 4;
+            const auto inner = inner_y && x >= tl.x + apron && x < tl.x + ts.x - apron;
+            for( auto c = 0 ; c < 4 ; ++c ){
+                if( inner )
+                    dst[c].store( dst[c].load( std::memory_order_relaxed ) + add[c] , std::memory_order_relaxed );
+                else
+                    atomicAdd( dst[c] , add[c] );
+            }
+        }
+    }
+}
+
+void FilteredFilm::Resolve( RenderTarget& rt , const Vector2i& tl , const Vector2i& size ) const{
+    const auto x0 = std::max( 0 , tl.x ) , x1 = std::min( m_width , tl.x + size.x );
+    const auto y0 = std::max( 0 , tl.y ) , y1 = std::min( m_height , tl.y + size.y );
+    for( auto y = y0 ; y < y1 ; ++y ){
+        for( auto x = x0 ; x < x1 ; ++x ){
+            const auto src = m_sum.get() + ( (size_t)y * m_width + x ) * 4;
+            const auto w = src[3].load( std::memory_order_relaxed );
+            if( w <= 0.0f )
+                continue;
+            const auto inv = 1.0f / w;
+            rt.SetColor( x , y , Spectrum( src[0].load( std::memory_order_relaxed ) * inv ,
+                                           src[1].load( std::memory_order_relaxed ) * inv ,
+                                           src[2].load( std::memory_order_relaxed ) * inv ) );
+        }
+    }
+}
@@ -0,0 +1,155 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "core/rtti.h"
+#include "math/vector2.h"
+#include "spectrum/spectrum.h"
+#include "texture/rendertarget.h"
+
+//! @brief  PixelFilter weights samples by their distance to the centers of the pixels around them.
+/**
+ * Without a filter each pixel averages the samples landing in it, which is a box filter. Filters with a wider and
+ * smoother footprint take fewer samples for clean edges. Filters are created by their class names, picked with
+ * '--pixelfilter:<class name>' in the command line.
+ */
+class PixelFilter{
+public:
+    //! @brief  Virtual destructor.
+    virtual ~PixelFilter() {}
+
+    //! @brief  Get the radius of the filter in pixels.
+    //!
+    //! @return         Samples further than this from the center of a pixel along either axis don't count in it.
+    SORT_FORCEINLINE float GetRadius() const {
+        return m_radius;
+    }
+
+    //! @brief  Evaluate the filter, it is separable.
+    //!
+    //! @param  dx      Horizontal offset from the center of the pixel.
+    //! @param  dy      Vertical offset from the center of the pixel.
+    //! @return         Weight of the sample in the pixel.
+    SORT_FORCEINLINE float Evaluate( float dx , float dy ) const {
+        return evaluate( dx ) * evaluate( dy );
+    }
+
+protected:
+    //! @brief  Evaluate the filter along one axis, the offset is within the radius.
+    virtual float evaluate( float d ) const = 0;
+
+    float   m_radius = 1.5f;    /**< Radius of the filter in pixels. */
+};
+
+//! @brief  Truncated Gaussian, shifted down so that it reaches zero at the radius.
+class GaussianFilter : public PixelFilter{
+public:
+    DEFINE_RTTI( GaussianFilter , PixelFilter );
+
+protected:
+    float evaluate( float d ) const override;
+};
+
+//! @brief  Four term Blackman-Harris window, it is sharper than the Gaussian with less ringing than windowed sinc.
+class BlackmanHarrisFilter : public PixelFilter{
+public:
+    DEFINE_RTTI( BlackmanHarrisFilter , PixelFilter );
+
+protected:
+    float evaluate( float d ) const override;
+};
+
+//! @brief  Filtered samples of a tile rendered in one pass.
+/**
+ * Samples near the border of a tile land in pixels of the neighboring tiles as well, the tile buffer covers an apron
+ * of pixels around the tile for them. Render tasks accumulate in their own tile buffer without any synchronization.
+ */
+struct FilteredTile{
+    Vector2i                coord;          /**< Top-left corner of the buffer, the apron included. */
+    Vector2i                size;           /**< Size of the buffer, the apron included. */
+    int                     apron = 0;      /**< Number of pixels around the tile. */
+    std::vector<Spectrum>   radiance;       /**< Weighted sum of the radiance of each pixel. */
+    std::vector<float>      weight;         /**< Sum of the weights of each pixel. */
+
+    //! @brief  Clear the buffer and cover a tile with the apron needed by a filter.
+    //!
+    //! @param  tl      Top-left corner of the tile.
+    //! @param  ts      Size of the tile.
+    //! @param  filter  The filter samples are weighted with.
+    void    Reset( const Vector2i& tl , const Vector2i& ts , const PixelFilter& filter );
+
+    //! @brief  Add a sample to all pixels in the footprint of the filter.
+    //!
+    //! @param  x       Horizontal position of the sample in the image, in pixels.
+    //! @param  y       Vertical position of the sample in the image, in pixels.
+    //! @param  li      Radiance of the sample.
+    //! @param  filter  The filter samples are weighted with.
+    void    AddSample( float x , float y , const Spectrum& li , const PixelFilter& filter );
+};
+
+//! @brief  FilteredFilm accumulates the filtered samples of all tiles.
+/**
+ * Each pixel keeps the weighted sum of the radiance of the samples around it along with the sum of the weights, it is
+ * only normalized when the image is resolved. Pixels in the middle of a tile are only touched by the tile itself, only
+ * the pixels within the apron of the tile border are shared with other tiles and added atomically.
+ */
+class FilteredFilm{
+public:
+    //! @brief  Constructor.
+    //!
+    //! @param  w           Width of the image.
+    //! @param  h           Height of the image.
+    //! @param  filter      The filter samples are weighted with.
+    FilteredFilm( int w , int h , std::unique_ptr<PixelFilter> filter );
+
+    //! @brief  Get the filter samples are weighted with.
+    //!
+    //! @return             The filter.
+    SORT_FORCEINLINE const PixelFilter& GetFilter() const {
+        return *m_filter;
+    }
+
+    //! @brief  Add the samples of a tile.
+    //!
+    //! Pieces of the same tile could be merged at the same time, the buffer of a split tile could cover more than the
+    //! piece it ends up with, so the piece is passed in separately.
+    //!
+    //! @param  tile        Filtered samples of the tile.
+    //! @param  tl          Top-left corner of the tile, the apron excluded.
+    //! @param  ts          Size of the tile, the apron excluded.
+    void    Merge( const FilteredTile& tile , const Vector2i& tl , const Vector2i& ts );
+
+    //! @brief  Write the normalized radiance of a region in a render target.
+    //!
+    //! @param  rt          The render target to write to.
+    //! @param  tl          Top-left corner of the region, it is clipped by the image.
+    //! @param  size        Size of the region.
+    void    Resolve( RenderTarget& rt , const Vector2i& tl , const Vector2i& size ) const;
+
+    //! @brief  Drop all samples.
+    void    Clear();
+
+private:
+    const int                               m_width;    /**< Width of the image. */
+    const int                               m_height;   /**< Height of the image. */
+    std::unique_ptr<PixelFilter>            m_filter;   /**< The filter samples are weighted with. */
+    std::unique_ptr<std::atomic<float>[]>   m_sum;      /**< Weighted radiance and weight of each pixel, four floats per pixel. */
+};
@@ -0,0 +1,101 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <cmath>
+#include "core/define.h"
+
+//! @brief  PixelStats keeps track of the running mean and variance of the luminance of a pixel.
+/**
+ * Welford's online algorithm is used so that samples could be accumulated one by one across
+ * multiple passes without keeping them around, it is also numerically more stable than
+ * accumulating the sum of squares.
+ */
+class PixelStats{
+public:
+    //! @brief  Accumulate a new sample.
+    //!
+    //! @param  x       Luminance of the new sample.
+    SORT_FORCEINLINE void Add( float x ){
+        ++m_cnt;
+        const auto delta = x - m_mean;
+        m_mean += delta / (float)m_cnt;
+        m_m2 += delta * ( x - m_mean );
+    }
+
+    //! @brief  Get the number of samples accumulated so far.
+    //!
+    //! @return Number of samples accumulated.
+    SORT_FORCEINLINE unsigned int GetCnt() const {
+        return m_cnt;
+    }
+
+    //! @brief  Get the mean of the samples.
+    //!
+    //! @return The running mean.
+    SORT_FORCEINLINE float GetMean() const {
+        return m_mean;
+    }
+
+    //! @brief  Get the unbiased sample variance.
+    //!
+    //! @return The sample variance, 0 if there are less than two samples.
+    SORT_FORCEINLINE float GetVariance() const {
+        return m_cnt > 1 ? m_m2 / (float)( m_cnt - 1 ) : 0.0f;
+    }
+
+    //! @brief  Whether the estimated pixel value has converged.
+    //!
+    //! The standard error of the mean is compared against the mean itself. A small offset is added to the
+    //! mean so that dark pixels don't take forever to converge.
+    //!
+    //! @param  minCnt      Minimum number of samples before a pixel could be considered converged.
+    //! @param  threshold   Relative standard error below which the pixel is converged.
+    //! @return             'True' if the pixel has converged.
+    SORT_FORCEINLINE bool IsConverged( unsigned int minCnt , float threshold ) const {
+        if( m_defocused )
+            minCnt *= DEFOCUS_MIN_CNT_SCALE;
+        if( m_cnt < minCnt || m_cnt < 2 )
+            return false;
+        return std::sqrt( GetVariance() / (float)m_cnt ) <= threshold * ( m_mean + 0.001f );
+    }
+
+    //! @brief  Flag the pixel as strongly defocused.
+    //!
+    //! Noise of a blurred pixel is made of whatever the lens sees around, the first few samples tend to underestimate
+    //! it badly. Such pixels take more samples before their variance is trusted.
+    SORT_FORCEINLINE void FlagDefocused(){
+        m_defocused = true;
+    }
+
+    //! @brief  Whether the pixel is flagged as strongly defocused.
+    //!
+    //! @return 'True' if the pixel is flagged.
+    SORT_FORCEINLINE bool IsDefocused() const {
+        return m_defocused;
+    }
+
+private:
+    // The minimum number of samples of a strongly defocused pixel is scaled by this factor.
+    static constexpr unsigned int DEFOCUS_MIN_CNT_SCALE = 4;
+
+    unsigned int    m_cnt = 0;          /**< Number of samples accumulated. */
+    float           m_mean = 0.0f;      /**< Running mean of the samples. */
+    float           m_m2 = 0.0f;        /**< Sum of squared differences from the running mean. */
+    bool            m_defocused = false;    /**< Whether the pixel is strongly defocused. */
+};
@@ -0,0 +1,147 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+#include "relightcache.h"
+#include "imagesensor.h"
+#include "core/scene.h"
+#include "core/log.h"
+#include "core/globalconfig.h"
+#include "core/workercontext.h"
+#include "light/light.h"
+#include "integrator/integrator.h"
+#include "task/task.h"
+#include "task/render_task.h"
+
+void RelightCache::Reset( const Scene& scene , int width , int height ){
+    m_recording = false;
+    m_complete = false;
+    m_lights.clear();
+    m_recordedIntensity.clear();
+    m_radiance = nullptr;
+    m_lightRadiance = nullptr;
+    m_sampleCnt = nullptr;
+
+    if( !g_relight )
+        return;
+
+    // a relit pixel is the plain average of its own samples, anything spreading or reshaping samples breaks it
+    if( IS_PTR_INVALID(g_integrator) || !g_integrator->SupportRelighting() || g_integrator->NeedSplatting() ||
+        g_imageSensor->GetPixelFilter() || g_imageSensor->GetRobustBucketCnt() > 0 || g_clammping > 0.0f ){
+        slog( WARNING , IMAGE , "Relighting is not supported by the integrator or the image sensor, it is disabled." );
+        return;
+    }
+
+    const auto& lights = scene.GetLights();
+    if( lights.size() > RELIGHT_MAX_LIGHTS )
+        slog( WARNING , IMAGE , "Only the first %u lights of the scene could be relit." , RELIGHT_MAX_LIGHTS );
+    for( auto i = 0u ; i < lights.size() && i < RELIGHT_MAX_LIGHTS ; ++i ){
+        m_lights.push_back( lights[i] );
+        m_recordedIntensity.push_back( lights[i]->GetIntensity() );
+    }
+
+    const auto pixel_cnt = (size_t)width * height;
+    m_radiance = std::make_unique<Spectrum[]>( pixel_cnt );
+    m_lightRadiance = std::make_unique<Spectrum[]>( pixel_cnt * m_lights.size() );
+    m_sampleCnt = std::make_unique<unsigned[]>( pixel_cnt );
+    m_width = width;
+    m_height = height;
+    m_recording = true;
+}
+
+void RelightCache::Finish(){
+    m_complete = m_recording;
+}
+
+void RelightCache::AddSample( int x , int y , const Spectrum& radiance , const RelightSample& sample ){
+    const auto pixel_id = (size_t)y * m_width + x;
+    const auto light_cnt = m_lights.size();
+    m_radiance[pixel_id] += radiance;
+    for( auto i = 0u ; i < light_cnt ; ++i )
+        m_lightRadiance[pixel_id * light_cnt + i] += sample.lights[i];
+    ++m_sampleCnt[pixel_id];
+}
+
+int RelightCache::GetLightSlot( const Light* light ) const{
+    for( auto i = 0u ; i < m_lights.size() ; ++i ){
+        if( m_lights[i] == light )
+            return (int)i;
+    }
+    return -1;
+}
+
+void RelightCache::Relight( ImageSensor& sensor ) const{
+    if( !m_complete )
+        return;
+
+    // the share of a light is scaled by how much its intensity changes, channels that used to be black stay black
+    const auto light_cnt = m_lights.size();
+    std::vector<Spectrum> delta( light_cnt );
+    for( auto i = 0u ; i < light_cnt ; ++i ){
+        const auto& current = m_lights[i]->GetIntensity();
+        const auto& recorded = m_recordedIntensity[i];
+        const auto ratio = []( float c , float r ){ return r != 0.0f ? c / r - 1.0f : 0.0f; };
+        delta[i] = Spectrum( ratio( current.r , recorded.r ) , ratio( current.g , recorded.g ) , ratio( current.b , recorded.b ) );
+    }
+
+    // tiles are handed to the image sensor the same way render tasks do, so that the relit image streams out as usual
+    const auto tile_size = (int)g_tileSize;
+    const auto tile_cnt_x = ( m_width + tile_size - 1 ) / tile_size;
+    const auto tile_cnt_y = ( m_height + tile_size - 1 ) / tile_size;
+    ParallelFor( 0u , (unsigned)( tile_cnt_x * tile_cnt_y ) , 1u , [&]( unsigned s , unsigned e ){
+        for( auto t = s ; t < e ; ++t ){
+            const auto tl = Vector2i( (int)t % tile_cnt_x * tile_size , (int)t / tile_cnt_x * tile_size );
+            const auto size = Vector2i( std::min( tile_size , m_width - tl.x ) , std::min( tile_size , m_height - tl.y ) );
+            auto radiance = std::make_unique<Spectrum[]>( size.x * size.y );
+            auto weight = std::make_unique<float[]>( size.x * size.y );
+            for( auto i = 0 ; i < size.y ; ++i ){
+                for( auto j = 0 ; j < size.x ; ++j ){
+                    const auto pixel_id = (size_t)( tl.y + i ) * m_width + tl.x + j;
+                    const auto cnt = m_sampleCnt[pixel_id];
+                    if( 0 == cnt )
+                        continue;
+
+                    auto color = m_radiance[pixel_id];
+                    for( auto l = 0u ; l < light_cnt ; ++l )
+                        color += delta[l] * m_lightRadiance[pixel_id * light_cnt + l];
+                    radiance[i * size.x + j] = color / (float)cnt;
+                    weight[i * size.x + j] = 1.0f;
+                }
+            }
+
+            RenderedTile tile;
+            tile.coord = tl;
+            tile.size = size;
+            tile.sampleCnt = g_samplePerPixel;
+            tile.radiance = radiance.get();
+            tile.weight = weight.get();
+            sensor.FinishTile( tl.x / tile_size , ( m_height - 1 - tl.y ) / tile_size , tile );
+            sensor.NotifyTileFinished( tl , size );
+        }
+    } );
+}
+
+void BindRelightSample( RelightSample* sample ){
+    GetWorkerContext().relightSample = sample;
+}
+
+void RecordLightContribution( const Light* light , const Spectrum& radiance ){
+    const auto sample = GetWorkerContext().relightSample;
+    if( !sample )
+        return;
+    const auto slot = RelightCache::GetSingleton().GetLightSlot( light );
+    if( slot >= 0 )
+        sample->lights[slot] += radiance;
+}
@@ -0,0 +1,125 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+#pragma once
+
+#include <vector>
+#include <memory>
+#include "core/define.h"
+#include "core/singleton.h"
+#include "spectrum/spectrum.h"
+
+class Scene;
+class Light;
+class ImageSensor;
+
+//! Maximum number of lights whose contributions are kept apart, the rest of the lights can't be relit.
+static constexpr unsigned int RELIGHT_MAX_LIGHTS = 8;
+
+//! @brief  Radiance of a pixel sample split by the lights it comes from.
+struct RelightSample{
+    Spectrum    lights[RELIGHT_MAX_LIGHTS];     /**< Radiance coming from each of the tracked lights. */
+
+    //! @brief  Reset all lights before a new sample is traced.
+    SORT_FORCEINLINE void Clear(){
+        for( auto& l : lights )
+            l = 0.0f;
+    }
+};
+
+//! @brief  Pixels broken down by lights, so that edits of the strength and color of lights don't need to trace again.
+/**
+ * The radiance carried by a path is linear in the emission of the light at its end, no matter how many times it bounces
+ * before reaching the light. Integrators supporting relighting attribute what they gather from lights, through next
+ * event estimation or hitting an emitter, to the light it comes from. Each pixel keeps the average of all its samples
+ * along with the share of each light. Once the color or the strength of lights are changed, every share is scaled by
+ * the ratio between the new and the recorded intensity of its light and the image is composed again in no time, there
+ * is no ray traced and no shader executed.
+ *
+ * Anything else of the scene, the camera, geometry, materials and the placement of lights, needs a new frame. Radiance
+ * not attributed to any light, like emission of volumes, is kept as it is. It only works with box filtered pixels that
+ * are an average of their own samples, pixel filters, robust accumulation and splatting integrators disable it.
+ */
+class RelightCache : public Singleton<RelightCache>{
+public:
+    //! @brief  Start recording a new frame, everything recorded so far is dropped.
+    //!
+    //! Nothing is recorded if relighting is not supported by the integrator or the image sensor.
+    //!
+    //! @param  scene       The scene to be rendered, the intensities of its lights are recorded.
+    //! @param  width       Width of the image.
+    //! @param  height      Height of the image.
+    void    Reset( const Scene& scene , int width , int height );
+
+    //! @brief  Mark the frame being recorded as complete, it can be relit from now on.
+    void    Finish();
+
+    //! @brief  Whether samples of the frame being rendered need to be recorded.
+    SORT_FORCEINLINE bool IsRecording() const {
+        return m_recording;
+    }
+
+    //! @brief  Whether a complete frame is recorded and ready to be relit.
+    SORT_FORCEINLINE bool IsComplete() const {
+        return m_complete;
+    }
+
+    //! @brief  Record a sample of a pixel.
+    //!
+    //! Pixels are only touched by the task rendering them, there is no lock needed.
+    //!
+    //! @param  x           Horizontal coordinate of the pixel.
+    //! @param  y           Vertical coordinate of the pixel.
+    //! @param  radiance    Radiance of the sample.
+    //! @param  sample      Radiance of the sample split by lights.
+    void    AddSample( int x , int y , const Spectrum& radiance , const RelightSample& sample );
+
+    //! @brief  Slot of a light in relight samples.
+    //!
+    //! @param  light       The light of interest.
+    //! @return             Index of the slot, -1 if the light is not tracked.
+    int     GetLightSlot( const Light* light ) const;
+
+    //! @brief  Compose the recorded frame again with the current intensities of lights and hand it to the image sensor.
+    //!
+    //! @param  sensor      The image sensor taking the relit image.
+    void    Relight( ImageSensor& sensor ) const;
+
+private:
+    std::vector<const Light*>       m_lights;               /**< Lights whose contributions are tracked. */
+    std::vector<Spectrum>           m_recordedIntensity;    /**< Intensities of the tracked lights when the frame is recorded. */
+    std::unique_ptr<Spectrum[]>     m_radiance;             /**< Sum of the radiance of all samples of each pixel. */
+    std::unique_ptr<Spectrum[]>     m_lightRadiance;        /**< Sum of the radiance from each tracked light, per pixel. */
+    std::unique_ptr<unsigned[]>     m_sampleCnt;            /**< Number of samples of each pixel. */
+    int                             m_width = 0;            /**< Width of the image. */
+    int                             m_height = 0;           /**< Height of the image. */
+    bool                            m_recording = false;    /**< Whether the frame being rendered is recorded. */
+    bool                            m_complete = false;     /**< Whether a complete frame is recorded. */
+
+    RelightCache() = default;
+    friend class Singleton<RelightCache>;
+};
+
+//! @brief  Bind the relight sample recorded by integrators to the current thread.
+//!
+//! @param  sample      The sample to be bound, nullptr disables recording.
+void    BindRelightSample( RelightSample* sample );
+
+//! @brief  Attribute radiance gathered by the sample traced by the thread to a light.
+//!
+//! @param  light       The light the radiance comes from.
+//! @param  radiance    The radiance reaching the camera from the light.
+void    RecordLightContribution( const Light* light , const Spectrum& radiance );
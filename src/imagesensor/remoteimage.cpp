@@ -0,0 +1,57 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "remoteimage.h"
+#include "stream/sstream.h"
+#include "core/strid.h"
+#include "core/globalconfig.h"
+
+void RemoteImage::FinishTile( int tile_x , int tile_y , const RenderedTile& rt ){
+    m_finishedTilePassCnt.fetch_add( 1 , std::memory_order_relaxed );
+    if( !m_stream )
+        return;
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    SendTile( *m_stream , rt );
+    m_stream->Flush();
+    if( !m_stream->IsValid() )
+        slog( WARNING , STREAM , "Failed to send tile (%d, %d) to the coordinator." , tile_x , tile_y );
+}
+
+void RemoteImage::SendTile( OStreamBase& stream , const RenderedTile& rt ){
+    stream << SID("Tile");
+    stream << rt.coord.x << rt.coord.y << rt.size.x << rt.size.y << rt.sampleOffset << rt.sampleCnt;
+
+    const auto rb = rt.coord + rt.size;
+    for( auto i = rt.coord.y ; i < rb.y ; ++i )
+        for( auto j = rt.coord.x ; j < rb.x ; ++j )
+            stream << rt.GetTileRadiance( j , i ) << rt.GetTileWeight( j , i );
+}
+
+bool RemoteImage::ReceiveTile( IStreamBase& stream , Vector2i& coord , Vector2i& size , unsigned int& sampleOffset , unsigned int& sampleCnt ,
+                               std::vector<Spectrum>& radiance , std::vector<float>& weight ){
+    stream >> coord.x >> coord.y >> size.x >> size.y >> sampleOffset >> sampleCnt;
+    if( size.x <= 0 || size.y <= 0 || size.x > (int)g_tileSize || size.y > (int)g_tileSize )
+        return false;
+
+    const auto cnt = size.x * size.y;
+    radiance.resize( cnt );
+    weight.resize( cnt );
+    for( auto i = 0 ; i < cnt ; ++i )
+        stream >> radiance[i] >> weight[i];
+    return true;
+}
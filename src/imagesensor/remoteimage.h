@@ -0,0 +1,59 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include "imagesensor.h"
+
+class OSocketStream;
+class OStreamBase;
+class IStreamBase;
+
+// image sensor of a worker in distributed rendering, tiles are sent back to the coordinator instead of being kept.
+class RemoteImage : public ImageSensor{
+public:
+    // constructor
+    RemoteImage( int w , int h ) : ImageSensor( w , h , false ) {}
+
+    // bind the stream connected to the coordinator
+    void SetStream( OSocketStream* stream ){
+        m_stream = stream;
+    }
+
+    // finish image tile, the tile is sent to the coordinator right away so that it can hand out more work.
+    void FinishTile( int tile_x , int tile_y , const RenderedTile& rt ) override;
+
+    // nothing is written by a worker, the coordinator outputs the image
+    void PostProcess() override {}
+
+    // send a rendered tile, it is the message the coordinator receives with 'ReceiveTile'.
+    static void SendTile( OStreamBase& stream , const RenderedTile& rt );
+
+    // receive the radiance and weight of a tile sent by 'SendTile', the tile needs to be big enough.
+    // It returns false if the message is broken.
+    static bool ReceiveTile( IStreamBase& stream , Vector2i& coord , Vector2i& size , unsigned int& sampleOffset , unsigned int& sampleCnt ,
+                             std::vector<Spectrum>& radiance , std::vector<float>& weight );
+
+private:
+    // the stream connected to the coordinator
+    OSocketStream*  m_stream = nullptr;
+
+    // render tasks finish tiles in parallel, messages can't be interleaved
+    std::mutex      m_mutex;
+};
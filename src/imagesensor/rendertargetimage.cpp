@@ -15,17 +15,178 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <regex>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <atomic>
 #include "rendertargetimage.h"
 #include "core/globalconfig.h"
 #include "core/path.h"
+#include "math/quantization.h"
+#include "thirdparty/tiny_exr/tinyexr.h"
 
-void RenderTargetImage::StorePixel( int x , int y , const Spectrum& color , const Render_Task& rt ){
-    std::lock_guard<spinlock_mutex> lock(m_mutex[y*m_width + x]);
-    Spectrum _color = m_rendertarget.GetColor(x, y);
-    m_rendertarget.SetColor(x, y, color + _color);
+namespace {
+    // a channel of the output exr file, pixels are stored in scanline order. Half precision channels are converted
+    // while the image is copied, the copy kept until the file is written is half as large then.
+    struct ExrChannel{
+        std::string                 name;
+        bool                        half;
+        std::vector<float>          data;
+        std::vector<std::uint16_t>  halfData;
+
+        ExrChannel( std::string n , bool h , size_t total ) : name( std::move( n ) ) , half( h ){
+            if( half )
+                halfData.resize( total );
+            else
+                data.resize( total );
+        }
+
+        SORT_FORCEINLINE void Set( size_t i , float v ){
+            if( half )
+                halfData[i] = floatToHalf( v );
+            else
+                data[i] = v;
+        }
+    };
+
+    // Number of rows converted at a time when the image is copied for output.
+    constexpr int OUTPUT_ROW_BLOCK = 16;
+
+    // rows of the image are converted by all threads, blocks of rows are picked up by whichever thread is free
+    template<class Func>
+    void forEachRowBlock( int h , const Func& func ){
+        std::atomic<int> next_row( 0 );
+        auto convert = [&](){
+            for( auto y = next_row.fetch_add( OUTPUT_ROW_BLOCK ) ; y < h ; y = next_row.fetch_add( OUTPUT_ROW_BLOCK ) )
+                func( y , std::min( h , y + OUTPUT_ROW_BLOCK ) );
+        };
+
+        std::vector<std::thread> threads;
+        for( auto i = 1u ; i < g_threadCnt ; ++i )
+            threads.emplace_back( convert );
+        convert();
+        for( auto& thread : threads )
+            thread.join();
+    }
+
+    // tiled and multi-part images can't be written by tinyexr yet, layers are distinguished by channel names instead.
+    void writeExr( const std::string& name , int w , int h , std::vector<ExrChannel>& channels ){
+        // readers expect channels sorted by their names
+        std::sort( channels.begin() , channels.end() , []( const ExrChannel& c0 , const ExrChannel& c1 ){ return c0.name < c1.name; } );
+
+        const auto cnt = channels.size();
+        std::vector<EXRChannelInfo> infos( cnt );
+        std::vector<int>            pixel_types( cnt );
+        std::vector<int>            requested_types( cnt );
+        std::vector<unsigned char*> images( cnt );
+        for( auto i = 0u ; i < cnt ; ++i ){
+            const auto len = channels[i].name.copy( infos[i].name , sizeof( infos[i].name ) - 1 );
+            infos[i].name[len] = '\0';
+            pixel_types[i] = requested_types[i] = channels[i].half ? TINYEXR_PIXELTYPE_HALF : TINYEXR_PIXELTYPE_FLOAT;
+            images[i] = channels[i].half ? reinterpret_cast<unsigned char*>( channels[i].halfData.data() ) : reinterpret_cast<unsigned char*>( channels[i].data.data() );
+        }
+
+        EXRImage image;
+        InitEXRImage( &image );
+        image.images = images.data();
+        image.width = w;
+        image.height = h;
+        image.num_channels = (int)cnt;
+
+        EXRHeader header;
+        InitEXRHeader( &header );
+        header.num_channels = (int)cnt;
+        header.channels = infos.data();
+        header.pixel_types = pixel_types.data();
+        header.requested_pixel_types = requested_types.data();
+        header.compression_type = TINYEXR_COMPRESSIONTYPE_ZIP;
+
+        const char* err = nullptr;
+        if( SaveEXRImageToFile( &image , &header , name.c_str() , &err ) != TINYEXR_SUCCESS ){
+            slog( WARNING , IMAGE , "Fail to save image file %s, %s" , name.c_str() , err ? err : "" );
+            if( err )
+                FreeEXRErrorMessage( err );
+        }
+    }
+}
+
+RenderTargetImage::~RenderTargetImage(){
+    if( m_outputThread.joinable() )
+        m_outputThread.join();
 }
 
 void RenderTargetImage::PostProcess(){
     ImageSensor::PostProcess();
-    m_rendertarget.Output(GetFilePathInExeFolder(g_outputFileName));
+
+    // a render session embedded in another application keeps the image in memory
+    if( g_outputFileName.empty() )
+        return;
+
+    // exr files are written from a half precision copy of the image, AOVs are written as layers in the same file
+    const auto name = GetFilePathInExeFolder(g_outputFileName);
+    std::regex exr_reg(".*\\.exr$", std::regex_constants::icase);
+    if( std::regex_match( name , exr_reg ) ){
+        outputLayers( name );
+        return;
+    }
+    if( m_aovMask )
+        slog( WARNING , IMAGE , "AOVs are only written in exr files, they are dropped." );
+
+    // like the layered image, the image is written from a copy on the background thread
+    auto image = std::make_shared<RenderTarget>( m_width , m_height );
+    for( auto i = 0 ; i < m_height ; ++i )
+        for( auto j = 0 ; j < m_width ; ++j )
+            image->SetColor( j , i , m_rendertarget.GetColor( j , i ) );
+
+    if( m_outputThread.joinable() )
+        m_outputThread.join();
+    m_outputThread = std::thread( [ name , image ](){
+        image->Output( name );
+    });
+}
+
+void RenderTargetImage::outputLayers( const std::string& name ){
+    // the framebuffer is copied so that the next frame could be rendered while the file is being written
+    const auto total = (size_t)m_width * m_height;
+    std::vector<ExrChannel> channels;
+    const char* beauty[] = { "R" , "G" , "B" };
+    for( auto c = 0u ; c < 3u ; ++c )
+        channels.emplace_back( beauty[c] , true , total );
+
+    // AOV channels are filled along with the beauty image, 'AOV_CHANNEL_CNT' means the channel is a beauty one
+    std::vector<unsigned int> sources = { AOV_CHANNEL_CNT , AOV_CHANNEL_CNT , AOV_CHANNEL_CNT };
+    for( auto t = 0u ; t < AOV_CNT ; ++t ){
+        if( !( m_aovMask & ( 1u << t ) ) )
+            continue;
+
+        // colors are kept in half precision like the beauty image, geometric data needs the full precision
+        const auto type = (AOV_TYPE)t;
+        const auto half = type == AOV_ALBEDO || type == AOV_DIRECT || type == AOV_INDIRECT;
+        const auto offset = AovChannelOffset( type );
+        for( auto c = 0u ; c < AovChannelCnt( type ) ; ++c ){
+            channels.emplace_back( std::string( AovName( type ) ) + "." + AovChannelName( type , c ) , half , total );
+            sources.push_back( offset + c );
+        }
+    }
+
+    forEachRowBlock( m_height , [&]( int y0 , int y1 ){
+        for( auto i = (size_t)y0 * m_width ; i < (size_t)y1 * m_width ; ++i ){
+            const auto color = m_rendertarget.GetColor( (int)( i % m_width ) , (int)( i / m_width ) );
+            channels[0].Set( i , color.r );
+            channels[1].Set( i , color.g );
+            channels[2].Set( i , color.b );
+            for( auto c = 3u ; c < channels.size() ; ++c )
+                channels[c].Set( i , m_aov[ i * AOV_CHANNEL_CNT + sources[c] ] );
+        }
+    });
+
+    // files are written one after another
+    if( m_outputThread.joinable() )
+        m_outputThread.join();
+
+    const auto w = m_width , h = m_height;
+    m_outputThread = std::thread( [ name , w , h , channels = std::move( channels ) ]() mutable {
+        writeExr( name , w , h , channels );
+    });
 }
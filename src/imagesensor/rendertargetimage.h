@@ -17,6 +17,7 @@
 
 #pragma once
 
+#include <thread>
 #include "imagesensor.h"
 
 // generate output
@@ -25,9 +26,17 @@ public:
     // constructor
     RenderTargetImage( int w , int h ):ImageSensor(w,h){}
 
-    // store pixel information
-    void StorePixel( int x , int y , const Spectrum& color , const Render_Task& rt ) override;
+    // the image being written in the background is finished before the sensor goes away
+    ~RenderTargetImage() override;
 
     // post process
     void PostProcess() override;
+
+private:
+    // the beauty image and all AOVs are written in one multi-layer exr file on a background thread,
+    // rendering of the next frame doesn't need to wait for it.
+    void outputLayers( const std::string& name );
+
+    // the thread writing the last image
+    std::thread     m_outputThread;
 };
@@ -0,0 +1,89 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include "robustfilm.h"
+#include "core/sassert.h"
+
+// The most buckets a pixel could have, the means of a pixel are sorted on the stack.
+static constexpr unsigned int ROBUST_FILM_MAX_BUCKET_CNT = 64;
+
+void BucketTile::Reset( const Vector2i& tl , const Vector2i& ts , unsigned int bucketCnt ){
+    coord = tl;
+    size = ts;
+    this->bucketCnt = bucketCnt;
+    radiance.assign( (size_t)ts.x * ts.y * bucketCnt , Spectrum() );
+    cnt.assign( (size_t)ts.x * ts.y * bucketCnt , 0.0f );
+}
+
+Spectrum MedianOfMeans( const Spectrum* radiance , const float* cnt , unsigned int bucketCnt , Spectrum* mean ){
+    sAssert( bucketCnt <= ROBUST_FILM_MAX_BUCKET_CNT , IMAGE );
+
+    Spectrum means[ROBUST_FILM_MAX_BUCKET_CNT];
+    Spectrum sum;
+    auto total = 0.0f;
+    auto n = 0u;
+    for( auto b = 0u ; b < bucketCnt ; ++b ){
+        sum += radiance[b];
+        total += cnt[b];
+        if( cnt[b] > 0.0f )
+            means[n++] = radiance[b] / cnt[b];
+    }
+    if( mean )
+        *mean = total > 0.0f ? sum / total : Spectrum();
+    if( 0 == n )
+        return Spectrum();
+
+    // only the middle of the buckets matters, there is no need to sort all of them
+    const auto intensity_less = []( const Spectrum& a , const Spectrum& b ){ return a.GetIntensity() < b.GetIntensity(); };
+    const auto mid = means + n / 2;
+    std::nth_element( means , mid , means + n , intensity_less );
+    if( n & 1 )
+        return *mid;
+    return ( *std::max_element( means , mid , intensity_less ) + *mid ) * 0.5f;
+}
+
+RobustFilm::RobustFilm( int w , int h , unsigned int bucketCnt ) : m_width(w) , m_height(h) ,
+    m_bucketCnt( std::min( std::max( 1u , bucketCnt ) , ROBUST_FILM_MAX_BUCKET_CNT ) ){
+    m_radiance = std::make_unique<Spectrum[]>( (size_t)w * h * m_bucketCnt );
+    m_cnt = std::make_unique<float[]>( (size_t)w * h * m_bucketCnt );
+}
+
+void RobustFilm::Clear(){
+    const auto cnt = (size_t)m_width * m_height * m_bucketCnt;
+    std::fill( m_radiance.get() , m_radiance.get() + cnt , Spectrum() );
+    std::fill( m_cnt.get() , m_cnt.get() + cnt , 0.0f );
+}
+
+void RobustFilm::Merge( const BucketTile& tile , const Vector2i& tl , const Vector2i& ts ){
+    sAssert( tile.bucketCnt == m_bucketCnt , IMAGE );
+    for( auto y = tl.y ; y < tl.y + ts.y ; ++y ){
+        for( auto x = tl.x ; x < tl.x + ts.x ; ++x ){
+            const auto src = ( (size_t)( y - tile.coord.y ) * tile.size.x + x - tile.coord.x ) * m_bucketCnt;
+            const auto dst = ( (size_t)y * m_width + x ) * m_bucketCnt;
+            for( auto b = 0u ; b < m_bucketCnt ; ++b ){
+                m_radiance[dst + b] += tile.radiance[src + b];
+                m_cnt[dst + b] += tile.cnt[src + b];
+            }
+        }
+    }
+}
+
+Spectrum RobustFilm::Resolve( int x , int y , Spectrum* mean ) const{
+    const auto i = ( (size_t)y * m_width + x ) * m_bucketCnt;
+    return MedianOfMeans( m_radiance.get() + i , m_cnt.get() + i , m_bucketCnt , mean );
+}
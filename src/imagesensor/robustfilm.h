@@ -0,0 +1,120 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "math/vector2.h"
+#include "spectrum/spectrum.h"
+
+//! @brief  Samples of a tile rendered in one pass, split into buckets by the index of each sample in its pixel.
+/**
+ * Sample k of a pixel always lands in bucket 'k % bucketCnt', no matter which pass takes it, so that the buckets of a
+ * pixel stay balanced across passes. Render tasks accumulate in their own tile buffer without any synchronization.
+ */
+struct BucketTile{
+    Vector2i                coord;          /**< Top-left corner of the tile. */
+    Vector2i                size;           /**< Size of the tile. */
+    unsigned int            bucketCnt = 0;  /**< Number of buckets of each pixel. */
+    std::vector<Spectrum>   radiance;       /**< Sum of the radiance in each bucket, buckets of a pixel are next to each other. */
+    std::vector<float>      cnt;            /**< Number of samples in each bucket. */
+
+    //! @brief  Clear the buffer and cover a tile.
+    //!
+    //! @param  tl          Top-left corner of the tile.
+    //! @param  ts          Size of the tile.
+    //! @param  bucketCnt   Number of buckets of each pixel.
+    void    Reset( const Vector2i& tl , const Vector2i& ts , unsigned int bucketCnt );
+
+    //! @brief  Add a sample to the bucket it belongs to.
+    //!
+    //! @param  x       Horizontal coordinate of the pixel in the image.
+    //! @param  y       Vertical coordinate of the pixel in the image.
+    //! @param  index   Index of the sample in the pixel.
+    //! @param  li      Radiance of the sample.
+    SORT_FORCEINLINE void AddSample( int x , int y , unsigned int index , const Spectrum& li ){
+        const auto i = ( (size_t)( y - coord.y ) * size.x + x - coord.x ) * bucketCnt + index % bucketCnt;
+        radiance[i] += li;
+        cnt[i] += 1.0f;
+    }
+};
+
+//! @brief  Combine the buckets of a pixel with median-of-means.
+//!
+//! Buckets are ordered by the intensity of their means, the median one is taken, or the average of the two in the
+//! middle if there is an even number of them. Empty buckets are skipped.
+//!
+//! @param  radiance    Sum of the radiance in each bucket.
+//! @param  cnt         Number of samples in each bucket.
+//! @param  bucketCnt   Number of buckets.
+//! @param  mean        Plain average of all samples, it is written if it is not nullptr.
+//! @return             The robust estimate of the pixel.
+Spectrum MedianOfMeans( const Spectrum* radiance , const float* cnt , unsigned int bucketCnt , Spectrum* mean = nullptr );
+
+//! @brief  RobustFilm accumulates the samples of each pixel in a few buckets instead of a single sum.
+/**
+ * A rare sample carrying a huge amount of energy, a firefly, drags the average of the pixel far away for a long time.
+ * Clamping the radiance of samples hides it at the cost of darkening highlights no matter how many samples are taken.
+ * Taking the median of the means of a few buckets rejects such outliers, the firefly only shifts one bucket, while the
+ * estimate converges to the same value as the average once all buckets see the rare paths often enough.
+ *
+ * Tiles never overlap and passes of a tile are merged one after another, no synchronization is needed.
+ */
+class RobustFilm{
+public:
+    //! @brief  Constructor.
+    //!
+    //! @param  w           Width of the image.
+    //! @param  h           Height of the image.
+    //! @param  bucketCnt   Number of buckets of each pixel.
+    RobustFilm( int w , int h , unsigned int bucketCnt );
+
+    //! @brief  Get the number of buckets of each pixel.
+    //!
+    //! @return             Number of buckets.
+    SORT_FORCEINLINE unsigned int GetBucketCnt() const {
+        return m_bucketCnt;
+    }
+
+    //! @brief  Add the samples of a tile.
+    //!
+    //! The buffer of a split tile could cover more than the piece it ends up with, so the piece is passed in separately.
+    //!
+    //! @param  tile        Samples of the tile.
+    //! @param  tl          Top-left corner of the piece.
+    //! @param  ts          Size of the piece.
+    void    Merge( const BucketTile& tile , const Vector2i& tl , const Vector2i& ts );
+
+    //! @brief  Get the robust estimate of a pixel.
+    //!
+    //! @param  x           Horizontal coordinate of the pixel.
+    //! @param  y           Vertical coordinate of the pixel.
+    //! @param  mean        Plain average of all samples of the pixel, it is written if it is not nullptr.
+    //! @return             Median-of-means of the buckets of the pixel.
+    Spectrum    Resolve( int x , int y , Spectrum* mean = nullptr ) const;
+
+    //! @brief  Drop all samples.
+    void    Clear();
+
+private:
+    const int                       m_width;        /**< Width of the image. */
+    const int                       m_height;       /**< Height of the image. */
+    const unsigned int              m_bucketCnt;    /**< Number of buckets of each pixel. */
+    std::unique_ptr<Spectrum[]>     m_radiance;     /**< Sum of the radiance in each bucket of each pixel. */
+    std::unique_ptr<float[]>        m_cnt;          /**< Number of samples in each bucket of each pixel. */
+};
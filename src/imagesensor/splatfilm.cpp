@@ -0,0 +1,64 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include "splatfilm.h"
+
+SplatFilm::SplatFilm( int w , int h , unsigned int threadCnt ) : m_width(w) , m_height(h) ,
+    m_blockCntX( ( w + BLOCK_SIZE - 1 ) >> BLOCK_SHIFT ) , m_blockCntY( ( h + BLOCK_SIZE - 1 ) >> BLOCK_SHIFT ) ,
+    m_threadCnt( std::max( 1u , threadCnt ) ){
+    m_replicas = std::make_unique<Replica[]>( m_threadCnt );
+    for( auto i = 0u ; i < m_threadCnt ; ++i )
+        m_replicas[i].m_blocks.resize( m_blockCntX * m_blockCntY );
+}
+
+void SplatFilm::Clear(){
+    for( auto i = 0u ; i < m_threadCnt ; ++i )
+        for( auto& block : m_replicas[i].m_blocks )
+            block = nullptr;
+}
+
+void SplatFilm::Resolve( RenderTarget& rt , float scale ) const{
+    // each block is owned by one thread during merging, there is no need to synchronize pixels
+    std::atomic<int> next_block( 0 );
+    const auto block_cnt = m_blockCntX * m_blockCntY;
+    auto merge = [&](){
+        for( auto b = next_block++ ; b < block_cnt ; b = next_block++ ){
+            const auto bx = ( b % m_blockCntX ) << BLOCK_SHIFT;
+            const auto by = ( b / m_blockCntX ) << BLOCK_SHIFT;
+            const auto ex = std::min( bx + BLOCK_SIZE , m_width );
+            const auto ey = std::min( by + BLOCK_SIZE , m_height );
+            for( auto t = 0u ; t < m_threadCnt ; ++t ){
+                const auto& block = m_replicas[t].m_blocks[b];
+                if( !block )
+                    continue;
+                for( auto y = by ; y < ey ; ++y )
+                    for( auto x = bx ; x < ex ; ++x )
+                        rt.SetColor( x , y , rt.GetColor( x , y ) + block[ ( y - by ) * BLOCK_SIZE + x - bx ] * scale );
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for( auto i = 1u ; i < m_threadCnt ; ++i )
+        threads.emplace_back( merge );
+    merge();
+    for( auto& thread : threads )
+        thread.join();
+}
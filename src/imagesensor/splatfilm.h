@@ -0,0 +1,85 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "spectrum/spectrum.h"
+#include "texture/rendertarget.h"
+
+//! @brief  SplatFilm keeps a sparse replica of the image for each worker thread.
+/**
+ * Integrators like light tracing and bidirectional path tracing splat radiance to arbitrary
+ * pixels. Instead of locking the pixel for every single splat, each thread accumulates splats
+ * in its own replica, which is merged into the final image at the end. To avoid allocating a
+ * full image for each thread, the replica is divided into small blocks and a block is only
+ * allocated once a splat lands in it.
+ */
+class SplatFilm{
+public:
+    //! @brief  Constructor.
+    //!
+    //! @param  w           Width of the image.
+    //! @param  h           Height of the image.
+    //! @param  threadCnt   Number of threads that could splat radiance.
+    SplatFilm( int w , int h , unsigned int threadCnt );
+
+    //! @brief  Splat radiance to a pixel.
+    //!
+    //! This is not thread-safe across threads sharing the same thread id, every thread is supposed
+    //! to have its own id.
+    //!
+    //! @param  tid         Id of the thread splatting the radiance.
+    //! @param  x           Horizontal coordinate of the pixel.
+    //! @param  y           Vertical coordinate of the pixel.
+    //! @param  color       Radiance to splat.
+    SORT_FORCEINLINE void Splat( unsigned int tid , int x , int y , const Spectrum& color ){
+        auto& block = m_replicas[tid].m_blocks[ ( y >> BLOCK_SHIFT ) * m_blockCntX + ( x >> BLOCK_SHIFT ) ];
+        if( !block )
+            block = std::make_unique<Spectrum[]>( BLOCK_SIZE * BLOCK_SIZE );
+        block[ ( y & BLOCK_MASK ) * BLOCK_SIZE + ( x & BLOCK_MASK ) ] += color;
+    }
+
+    //! @brief  Merge all replicas and add them to a render target.
+    //!
+    //! Blocks are merged in parallel. No splat is allowed while merging.
+    //!
+    //! @param  rt          Render target to add the splats to.
+    //! @param  scale       Scaling factor applied to the splats.
+    void Resolve( RenderTarget& rt , float scale ) const;
+
+    //! @brief  Drop all splats, blocks are allocated again once splats land in them.
+    void Clear();
+
+private:
+    static constexpr int BLOCK_SHIFT = 5;
+    static constexpr int BLOCK_SIZE = 1 << BLOCK_SHIFT;
+    static constexpr int BLOCK_MASK = BLOCK_SIZE - 1;
+
+    //! @brief  Splats taken by a single thread.
+    struct alignas(64) Replica{
+        std::vector<std::unique_ptr<Spectrum[]>>    m_blocks;   /**< Blocks of the replica, null if no splat lands in it. */
+    };
+
+    const int                       m_width;        /**< Width of the image. */
+    const int                       m_height;       /**< Height of the image. */
+    const int                       m_blockCntX;    /**< Number of blocks in a row. */
+    const int                       m_blockCntY;    /**< Number of blocks in a column. */
+    std::unique_ptr<Replica[]>      m_replicas;     /**< Replicas of all threads. */
+    const unsigned int              m_threadCnt;    /**< Number of replicas. */
+};
@@ -36,14 +36,16 @@ struct BDPT_Vertex{
     SurfaceInteraction  inter;              // intersection
 
     // For further detail, please refer to the paper "Implementing Vertex Connection and Merging"
-    // MIS factors
+    // MIS factors, they accumulate the partial MIS quantities of the sub-path so that the weight of any connection is O(1)
     double      vc = 0.0f;
     double      vcm = 0.0f;
+    double      vm = 0.0f;
 
     // depth of the vertex
     int         depth = 0;
 };
 
+// radiance reaching a pixel, it is not splatted to the image sensor yet
 struct Pending_Sample{
     Vector2i    coord;
     Spectrum    radiance;
@@ -76,6 +78,11 @@ public:
     //! @brief  The samples generated in this interface is not well used in this integrator for now.
     void RequestSample( Sampler* sampler , PixelSample* ps , unsigned ps_num ) override;
 
+    //! @brief  Light paths connecting to the camera splat radiance to the image sensor.
+    bool NeedSplatting() const override {
+        return true;
+    }
+
     //! @brief      Serializing data from stream
     //!
     //! @param      Stream where the serialization data comes from. Depending on different situation, it could come from different places.
@@ -95,14 +102,49 @@ protected:
     Spectrum    _ConnectLight(const BDPT_Vertex& eye_vertex, const Light* light , const Scene& scene ) const;
 
     // connect camera point
-    void        _ConnectCamera(const BDPT_Vertex& light_vertex , int len , const Light* light , const Scene& scene ) const;
+    void        _ConnectCamera(const BDPT_Vertex& light_vertex , const Light* light , const Scene& scene ) const;
 
     // connect vertices
     Spectrum    _ConnectVertices( const BDPT_Vertex& light_vertex , const BDPT_Vertex& eye_vertex , const Light* light , const Scene& scene ) const;
 
-private:
-    // use multiple importance sampling to sample direct illumination
-    bool    m_bMIS = true;
+    //! @brief  Splat the radiance of a light vertex connected to the camera.
+    //!
+    //! @param  x               Horizontal coordinate of the pixel.
+    //! @param  y               Vertical coordinate of the pixel.
+    //! @param  radiance        The radiance reaching the pixel, it is normalized against the full sample budget already.
+    virtual void _SplatRadiance( int x , int y , const Spectrum& radiance ) const;
+
+    //! @brief  Trace a path from a light source.
+    //!
+    //! @param  scene           The scene to be evaluated.
+    //! @param  light           The light source where the path starts.
+    //! @param  light_pick_pdf  The pdf of picking the light source.
+    //! @param  light_path      Vertices of the path, it needs to hold at least 'max_recursive_depth' vertices.
+    //! @param  connectCamera   Whether to connect each vertex to the camera, which is light tracing.
+    //! @return                 The number of vertices in the path.
+    unsigned    _TraceLightPath( const Scene& scene , const Light* light , float light_pick_pdf , BDPT_Vertex* light_path , bool connectCamera ) const;
+
+    //! @brief  Weight of vertex merging relative to vertex connection in the partial MIS quantities.
+    //!
+    //! @return                 The weight, zero if there is no vertex merging.
+    virtual double      _VmWeightFactor() const {
+        return 0.0;
+    }
+
+    //! @brief  Weight of vertex connection relative to vertex merging in the partial MIS quantities.
+    //!
+    //! @return                 The weight, zero if there is no vertex merging.
+    virtual double      _VcWeightFactor() const {
+        return 0.0;
+    }
+
+    //! @brief  Merge an eye vertex with light vertices nearby.
+    //!
+    //! @param  eye_vertex      The vertex on the path from the eye.
+    //! @return                 The radiance from merging vertices, zero if there is no vertex merging.
+    virtual Spectrum    _MergeVertices( const BDPT_Vertex& eye_vertex ) const {
+        return 0.0f;
+    }
 
     // mis factor
     SORT_FORCEINLINE double MIS(double t) const {
@@ -112,5 +154,9 @@ private:
         return m_bMIS ? t * t : 1.0f;
     }
 
+private:
+    // use multiple importance sampling to sample direct illumination
+    bool    m_bMIS = true;
+
     SORT_STATS_ENABLE( "Bi-directional Path Tracing" )
 };
@@ -22,6 +22,9 @@
 #include "light/light.h"
 #include "core/memory.h"
 #include "sampler/sampler.h"
+#include "core/primitive.h"
+#include "material/material.h"
+#include "scatteringevent/scatteringevent.h"
 
 SORT_STATS_DECLARE_COUNTER(sPrimaryRayCount)
 
@@ -41,12 +44,16 @@ Spectrum DirectLight::Li( const Ray& r , const PixelSample& ps , const Scene& sc
 
     auto li = ip.Le( -r.m_Dir );
 
-    // evaluate direct light
-    auto light_num = scene.LightNum();
-    for( auto i = 0u ; i < light_num ; ++i ){
-        const auto light = scene.GetLight(i);
-        li += EvaluateDirect( r , scene , light , ip , LightSample(true) , BsdfSample(true) , true );
+    // evaluate direct light, shadow rays toward all lights are tested together
+    if( m_lightCandidates <= 0 ){
+        li += EvaluateAllLights( r , scene , ip , true );
+        return li;
     }
 
+    // with many lights, only the one resampled out of a few candidates is evaluated
+    ScatteringEvent se( ip , SE_EVALUATE_ALL_NO_SSS );
+    ip.primitive->GetMaterial()->UpdateScatteringEvent( se );
+    li += EvaluateLightCandidates( se , r , scene , (unsigned)m_lightCandidates );
+
     return li;
 }
\ No newline at end of file
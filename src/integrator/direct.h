@@ -41,8 +41,12 @@ public:
     //! @param      Stream where the serialization data comes from. Depending on different situation, it could come from different places.
     void    Serialize( IStreamBase& stream ) override {
         Integrator::Serialize( stream );
+        stream >> m_lightCandidates;
     }
 
 private:
+    /**< Number of candidate lights resampled at each hit, all lights are evaluated if it is zero. */
+    int             m_lightCandidates = 0;
+
     SORT_STATS_ENABLE( "Direct Illumination" )
 };
@@ -0,0 +1,55 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "hashgrid.h"
+
+void HashGrid::Reset( const BBox& bbox , float radius , unsigned cnt ){
+    m_bbox = bbox;
+    m_radius = radius;
+    m_invCellSize = 1.0f / ( 2.0f * radius );
+
+    // roughly one bucket for each point
+    auto bucket_cnt = 1u;
+    while( bucket_cnt < cnt )
+        bucket_cnt <<= 1;
+    m_bucketMask = bucket_cnt - 1;
+
+    m_cursor = std::make_unique<std::atomic<unsigned>[]>( bucket_cnt );
+    for( auto i = 0u ; i < bucket_cnt ; ++i )
+        m_cursor[i].store( 0 , std::memory_order_relaxed );
+    m_bucketStart.assign( bucket_cnt + 1 , 0 );
+    m_indices.clear();
+}
+
+void HashGrid::Count( const Point& p ){
+    m_cursor[bucket( p )].fetch_add( 1 , std::memory_order_relaxed );
+}
+
+void HashGrid::FinishCounting(){
+    auto total = 0u;
+    for( auto i = 0u ; i <= m_bucketMask ; ++i ){
+        m_bucketStart[i] = total;
+        total += m_cursor[i].load( std::memory_order_relaxed );
+        m_cursor[i].store( m_bucketStart[i] , std::memory_order_relaxed );
+    }
+    m_bucketStart[m_bucketMask + 1] = total;
+    m_indices.resize( total );
+}
+
+void HashGrid::Insert( const Point& p , unsigned index ){
+    m_indices[m_cursor[bucket( p )].fetch_add( 1 , std::memory_order_relaxed )] = index;
+}
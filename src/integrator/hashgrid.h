@@ -0,0 +1,120 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "math/bbox.h"
+
+//! @brief  Hashed uniform grid for finding points within a fixed radius.
+/**
+ * Cells are twice as large as the radius so that a query only needs to visit the 2x2x2 cells around the point. Cells are
+ * hashed into a table with a fixed number of buckets, there is no need to allocate memory for empty cells. Points are
+ * counted first and inserted later, both can be done in parallel, points in the same bucket end up in a continuous range.
+ */
+class HashGrid{
+public:
+    //! @brief  Reset the grid, all points inserted before are removed.
+    //!
+    //! @param  bbox        Bounding box of the points, points outside it are also allowed.
+    //! @param  radius      Radius of queries.
+    //! @param  cnt         Number of points to be inserted, it also decides the number of buckets.
+    void        Reset( const BBox& bbox , float radius , unsigned cnt );
+
+    //! @brief  Count a point before inserting it, it is thread-safe.
+    //!
+    //! @param  p           Position of the point.
+    void        Count( const Point& p );
+
+    //! @brief  All points are counted, it needs to be called before inserting any point.
+    void        FinishCounting();
+
+    //! @brief  Insert a point counted before, it is thread-safe.
+    //!
+    //! @param  p           Position of the point.
+    //! @param  index       Index of the point.
+    void        Insert( const Point& p , unsigned index );
+
+    //! @brief  Visit all points that could be within the radius of a position.
+    //!
+    //! Points in the buckets of the 2x2x2 cells around the position are visited, including the ones in other cells falling
+    //! in the same bucket. It is up to the caller to check the distance.
+    //!
+    //! @param  p           The position of the query.
+    //! @param  func        Function taking the index of a point.
+    template<typename Func>
+    void        Query( const Point& p , const Func& func ) const;
+
+    //! @brief  Radius of queries.
+    float       GetRadius() const {
+        return m_radius;
+    }
+
+private:
+    BBox        m_bbox;                     /**< Bounding box of the points. */
+    float       m_radius = 0.0f;            /**< Radius of queries. */
+    float       m_invCellSize = 0.0f;       /**< Reciprocal of the size of cells. */
+    unsigned    m_bucketMask = 0;           /**< Number of buckets minus one, the number of buckets is a power of two. */
+
+    /**< Number of points in each bucket while counting, the position to insert the next point in each bucket afterwards. */
+    std::unique_ptr<std::atomic<unsigned>[]>    m_cursor;
+    /**< Index of the first point of each bucket, along with the number of points at the end. */
+    std::vector<unsigned>                       m_bucketStart;
+    /**< Indices of points sorted by buckets. */
+    std::vector<unsigned>                       m_indices;
+
+    //! @brief  Bucket of a cell.
+    SORT_FORCEINLINE unsigned bucket( int x , int y , int z ) const {
+        return ( ( (unsigned)x * 73856093u ) ^ ( (unsigned)y * 19349663u ) ^ ( (unsigned)z * 83492791u ) ) & m_bucketMask;
+    }
+
+    //! @brief  Bucket of the cell where a point is.
+    SORT_FORCEINLINE unsigned bucket( const Point& p ) const {
+        const auto d = ( p - m_bbox.m_Min ) * m_invCellSize;
+        return bucket( (int)floor( d.x ) , (int)floor( d.y ) , (int)floor( d.z ) );
+    }
+};
+
+template<typename Func>
+void HashGrid::Query( const Point& p , const Func& func ) const{
+    if( m_indices.empty() )
+        return;
+
+    // the 2x2x2 cells start from the cell closer to the point on each axis
+    const auto d = ( p - m_bbox.m_Min ) * m_invCellSize;
+    int start[3];
+    for( auto i = 0 ; i < 3 ; ++i ){
+        const auto c = floor( d[i] );
+        start[i] = (int)c - ( d[i] - c < 0.5f ? 1 : 0 );
+    }
+
+    // neighbor cells may fall in the same bucket, each bucket is only visited once
+    unsigned visited[8];
+    auto visited_cnt = 0u;
+    for( auto i = 0 ; i < 8 ; ++i ){
+        const auto b = bucket( start[0] + ( i & 1 ) , start[1] + ( ( i >> 1 ) & 1 ) , start[2] + ( i >> 2 ) );
+        if( std::find( visited , visited + visited_cnt , b ) != visited + visited_cnt )
+            continue;
+        visited[visited_cnt++] = b;
+
+        for( auto k = m_bucketStart[b] ; k < m_bucketStart[b + 1] ; ++k )
+            func( m_indices[k] );
+    }
+}
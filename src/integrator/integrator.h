@@ -30,6 +30,9 @@
 
 class   Ray;
 
+//! @brief  Default number of light paths traced in each light path task.
+constexpr unsigned int LIGHT_PATH_BATCH_SIZE = 4096;
+
 //! @brief  Integrator is for esitimating radiance in rendering equation.
 /**
  * This is the core of ray tracing rendering in SORT. There are different integrators supported in SORT.
@@ -62,42 +65,112 @@ public:
     //! @brief  Some integrator have a post process step.
     virtual void PostProcess() {}
 
+    //! @brief  A tile is about to take the samples of a pass.
+    //!
+    //! Tiles of the same pass call it independently, tiles of different passes could be rendered at the same time.
+    //! It is always called on the thread rendering the tile, along with all samples of the tile in the pass.
+    //!
+    //! @param  sampleOffset    Number of samples per pixel taken by previous passes of the tile.
+    //! @param  scene           The rendering scene.
+    virtual void BeginPass( unsigned int sampleOffset , const Scene& scene ) {}
+
+    //! @brief  A tile is done with the samples of a pass.
+    //!
+    //! @param  sampleOffset    Number of samples per pixel taken by previous passes of the tile.
+    virtual void EndPass( unsigned int sampleOffset ) {}
+
     //! @brief  Though most integrators do support live update in Blender, some doesn't, like light tracing.
     virtual bool NeedRefreshTile() const {
         return true;
     }
 
-    //! @brief      Serializing data from stream
+    //! @brief  Whether the integrator attributes the radiance it gathers to the lights it comes from.
     //!
-    //! @param      Stream where the serialization data comes from. Depending on different situation, it could come from different places.
-    void    Serialize( IStreamBase& stream ) override {
-        stream >> max_recursive_depth;
+    //! Only these integrators could record frames to be relit, check RelightCache for details.
+    virtual bool SupportRelighting() const {
+        return false;
     }
 
-    //! @brief  This interface is not well supported in SORT for now.
-    virtual void GenerateSample(const Sampler* sampler, PixelSample* samples, unsigned ps, const Scene& scene) const {
-        auto data = std::make_unique<float[]>(2 * ps);
-        sampler->Generate2D(data.get(), ps, true);
-        for (unsigned i = 0; i < ps; ++i)
-        {
-            samples[i].img_u = data[2 * i];
-            samples[i].img_v = data[2 * i + 1];
-        }
+    //! @brief  Whether the integrator splats radiance to arbitrary pixels through the image sensor.
+    virtual bool NeedSplatting() const {
+        return false;
+    }
+
+    //! @brief  Whether the whole image is made of splats, each thread splats into its own replica of the image then.
+    virtual bool NeedSplatFilm() const {
+        return false;
+    }
+
+    //! @brief  Number of light paths traced in light path tasks, independently of the tiles.
+    //!
+    //! Light paths have no affinity to any pixel, they are traced in batches of a fixed size instead of being driven by
+    //! the camera rays of tiles.
+    //!
+    //! @return         Number of light paths of the whole image, 0 means there is no light path task.
+    virtual unsigned long long GetLightPathCnt() const {
+        return 0;
+    }
+
+    //! @brief  Number of light paths traced in each light path task.
+    //!
+    //! @return         Number of light paths in a batch.
+    virtual unsigned int GetLightPathBatchSize() const {
+        return LIGHT_PATH_BATCH_SIZE;
+    }
 
-        auto shuffle = std::make_unique<unsigned[]>(ps);
-        for (unsigned i = 0; i < ps; i++)
-            shuffle[i] = i;
-        std::shuffle(shuffle.get(), shuffle.get() + ps, std::default_random_engine(sort_rand()));
-
-        sampler->Generate2D(data.get(), ps);
-        for (unsigned i = 0; i < ps; ++i)
-        {
-            unsigned sid = 2 * shuffle[i];
-            samples[i].dof_u = data[sid];
-            samples[i].dof_v = data[sid + 1];
+    //! @brief  Trace a light path and splat its radiance to the image sensor.
+    //!
+    //! @param  scene   The rendering scene.
+    //! @param  index   Index of the light path in the whole image.
+    virtual void TraceLightPath( const Scene& scene , unsigned long long index ) const {}
+
+    //! @brief  Whether the integrator takes the first intersection of camera rays traced in packets.
+    virtual bool SupportPrimaryRayPacket() const {
+        return false;
+    }
+
+    //! @brief  Evaluate the radiance along the opposite direction of a camera ray whose first intersection is found already.
+    //!
+    //! Camera rays of a tile are coherent, tracing them in packets is cheaper than tracing them one by one.
+    //! The default implementation ignores the intersection and traces the ray again.
+    //!
+    //! @param  ray     The extent ray in rendering equation.
+    //! @param  ps      The pixel samples.
+    //! @param  scene   The rendering scene.
+    //! @param  primary The first intersection of the ray, its primitive is nullptr if the ray misses the scene.
+    //! @return         The spectrum of the radiance along the opposite direction of the ray.
+    virtual Spectrum LiWithPrimaryHit( const Ray& ray , const PixelSample& ps , const Scene& scene , const SurfaceInteraction& primary ) const {
+        return Li( ray , ps , scene );
+    }
+
+    //! @brief  Evaluate the radiance of a batch of camera rays whose first intersections are found already.
+    //!
+    //! Integrators could trace the paths of a batch bounce by bounce all together, so that rays of the same bounce are
+    //! traced in packets too. Each path draws its samples through its own cursor, the result doesn't depend on the order
+    //! of tracing. The default implementation traces the paths one after another.
+    //!
+    //! @param  rays        Camera rays of the batch.
+    //! @param  ps          Pixel samples of the rays.
+    //! @param  scene       The rendering scene.
+    //! @param  primary     The first intersections of the rays.
+    //! @param  cursors     Where the pixel samples of the rays are left off once the camera takes its dimensions.
+    //! @param  cnt         Number of rays in the batch.
+    //! @param  radiance    The radiance along the opposite directions of the rays to be returned.
+    virtual void LiDeferred( const Ray* rays , const PixelSample* const* ps , const Scene& scene , const SurfaceInteraction* primary ,
+                             const SampleCursor* cursors , unsigned int cnt , Spectrum* radiance ) const {
+        for( auto i = 0u ; i < cnt ; ++i ){
+            ResumeSample( cursors[i] );
+            radiance[i] = LiWithPrimaryHit( rays[i] , *ps[i] , scene , primary[i] );
         }
     }
 
+    //! @brief      Serializing data from stream
+    //!
+    //! @param      Stream where the serialization data comes from. Depending on different situation, it could come from different places.
+    void    Serialize( IStreamBase& stream ) override {
+        stream >> max_recursive_depth;
+    }
+
     //! @brief  This is not well supported in SORT for now.
     virtual void RequestSample(Sampler* sampler, PixelSample* ps, unsigned ps_num) {}
 
@@ -24,72 +24,108 @@
 #include "material/material.h"
 #include "light/light.h"
 #include "medium/phasefunction.h"
+#include "core/memory.h"
+#include "core/stats.h"
+
+SORT_STATS_DEFINE_COUNTER(sShadowRouletteCount)
+SORT_STATS_DEFINE_COUNTER(sShadowRouletteSkipCount)
+
+SORT_STATS_COUNTER("Performance", "Shadow Rays in Russian Roulette", sShadowRouletteCount);
+SORT_STATS_COUNTER("Performance", "Shadow Rays Skipped by Russian Roulette", sShadowRouletteSkipCount);
 
 SORT_FORCEINLINE float MisFactor( float f, float g ){
     return (f*f) / (f*f + g*g);
 }
 
-Spectrum    EvaluateDirect( const ScatteringEvent& se , const Ray& r , const Scene& scene , const Light* light , const LightSample& ls ,const BsdfSample& bs ){
+// Lights sampling the product of their emission and the bsdf get the most likely picked glossy lobe as a hint.
+SORT_STATIC_FORCEINLINE const VMFLobe* bsdfLobe( const ScatteringEvent& se , const Vector& wo , const Light* light , VMFLobe& lobe ){
+    return ( light->UsesBsdfLobe() && se.GetVMFLobe( wo , lobe ) ) ? &lobe : nullptr;
+}
+
+SORT_STATIC_FORCEINLINE Spectrum sampleLight( const Light* light , const Point& p , const LightSample& ls , const VMFLobe* lobe , Vector& wi , float* pdf , Visibility& visibility ){
+    return lobe ? light->sample_l( p , &ls , *lobe , wi , pdf , visibility ) : light->sample_l( p , &ls , wi , 0 , pdf , 0 , 0 , visibility );
+}
+
+SORT_STATIC_FORCEINLINE float lightPdf( const Light* light , const Point& p , const Vector& wi , const VMFLobe* lobe ){
+    return lobe ? light->Pdf( p , wi , *lobe ) : light->Pdf( p , wi );
+}
+
+// Russian roulette of a shadow ray by the radiance it would bring to the pixel, it returns the factor that the
+// contribution of a surviving ray is scaled by, zero if the ray is not traced at all.
+SORT_STATIC_FORCEINLINE float shadowRoulette( const ShadowRoulette* roulette , const Spectrum& unoccluded ){
+    if( !roulette || roulette->threshold <= 0.0f )
+        return 1.0f;
+
+    const auto contribution = ( unoccluded * roulette->scale ).GetIntensity();
+    if( contribution >= roulette->threshold )
+        return 1.0f;
+
+    SORT_STATS(++sShadowRouletteCount);
+    const auto survival = contribution / roulette->threshold;
+    if( survival <= 0.0f || sort_canonical() >= survival ){
+        SORT_STATS(++sShadowRouletteSkipCount);
+        return 0.0f;
+    }
+    return 1.0f / survival;
+}
+
+Spectrum    EvaluateDirect( const ScatteringEvent& se , const Ray& r , const Scene& scene , const Light* light , const LightSample& ls ,const BsdfSample& bs , const ShadowRoulette* roulette ){
     const auto& ip = se.GetInteraction();
     Spectrum radiance;
     Visibility visibility(scene);
+    visibility.coarse = roulette ? roulette->coarse : nullptr;
     float light_pdf;
     float bsdf_pdf;
     const auto wo = -r.m_Dir;
     Vector wi;
-    const auto li = light->sample_l( ip.intersect , &ls , wi , 0 , &light_pdf , 0 , 0 , visibility );
+    VMFLobe lobe_storage;
+    const auto lobe = bsdfLobe( se , wo , light , lobe_storage );
+    const auto li = sampleLight( light , ip.intersect , ls , lobe , wi , &light_pdf , visibility );
     if( light_pdf > 0.0f && !li.IsBlack() ){
-        Spectrum f = se.Evaluate_BSDF( wo , wi );
+        // the bsdf pdf is only needed for MIS, evaluate it together with the bsdf
+        Spectrum f = se.Evaluate_BSDF( wo , wi , light->IsDelta() ? nullptr : &bsdf_pdf );
 
+        if( !f.IsBlack() ){
+            const auto weight = light->IsDelta() ? 1.0f : MisFactor( light_pdf , bsdf_pdf );
+            const auto unoccluded = li * f * weight / light_pdf;
+            const auto survival = shadowRoulette( roulette , unoccluded );
 #ifndef ENABLE_TRANSPARENT_SHADOW
-        if( !f.IsBlack() && visibility.IsVisible() ){
-            if( light->IsDelta() ){
-                radiance += li * f / light_pdf;
-            }else{
-                bsdf_pdf = se.Pdf_BSDF( wo , wi );
-                const auto weight = MisFactor( light_pdf , bsdf_pdf );
-                radiance = li * f * weight / light_pdf;
-            }
-        }
+            if( survival > 0.0f && visibility.IsVisible() )
+                radiance += unoccluded * survival;
 #else
-		if( !f.IsBlack() ){
-			const auto attenuation = visibility.GetAttenuation();
-			if (!attenuation.IsBlack()) {
-				if (light->IsDelta()) {
-					radiance += attenuation * li * f / light_pdf;
-				} else {
-					bsdf_pdf = se.Pdf_BSDF(wo, wi);
-					const auto weight = MisFactor(light_pdf, bsdf_pdf);
-					radiance = attenuation * li * f * weight / light_pdf;
-				}
-			}
-		}
+            if( survival > 0.0f )
+                radiance += visibility.GetAttenuation() * unoccluded * survival;
 #endif
+        }
     }
 
     if( !light->IsDelta() ){
         const auto f = se.Sample_BSDF( wo , wi , bs , bsdf_pdf );
         if( !f.IsBlack() && bsdf_pdf != 0.0f ){
-            const auto light_pdf = light->Pdf( ip.intersect , wi );
+            const auto light_pdf = lightPdf( light , ip.intersect , wi , lobe );
             if( light_pdf <= 0.0f )
                 return radiance;
             const auto weight = MisFactor( bsdf_pdf , light_pdf );
 
             Spectrum li;
             SurfaceInteraction _ip;
-            if( false == light->Le( Ray( ip.intersect , wi ) , &_ip , li ) )
+            // the solid angle covered by a bsdf sample is roughly the inverse of its pdf, rough surfaces see a filtered sky
+            Ray ray( ip.intersect , wi );
+            ray.m_fFootprint = 1.0f / bsdf_pdf;
+            if( false == light->Le( ray , &_ip , li ) || li.IsBlack() )
+                return radiance;
+
+            const auto unoccluded = li * f * weight / bsdf_pdf;
+            const auto survival = shadowRoulette( roulette , unoccluded );
+            if( survival <= 0.0f )
                 return radiance;
 
             visibility.ray = Ray( ip.intersect , wi , 0 , 0.001f , _ip.t - 0.001f );
 #ifndef ENABLE_TRANSPARENT_SHADOW
-            if( !li.IsBlack() && visibility.IsVisible() )
-                radiance += li * f * weight / bsdf_pdf;
+            if( visibility.IsVisible() )
+                radiance += unoccluded * survival;
 #else
-			if( !li.IsBlack() ){
-				const auto attenuation = visibility.GetAttenuation();
-				if (!attenuation.IsBlack())
-					radiance += attenuation * li * f * weight / bsdf_pdf;
-			}
+            radiance += visibility.GetAttenuation() * unoccluded * survival;
 #endif
         }
     }
@@ -97,76 +133,76 @@ Spectrum    EvaluateDirect( const ScatteringEvent& se , const Ray& r , const Sce
     return radiance;
 }
 
-Spectrum    EvaluateDirect(const ScatteringEvent& se, const Ray& r, const Scene& scene, const Light* light, const LightSample& ls, const BsdfSample& bs, const MaterialBase* material , const MediumStack& ms ) {
+Spectrum    EvaluateDirect(const ScatteringEvent& se, const Ray& r, const Scene& scene, const Light* light, const LightSample& ls, const BsdfSample& bs, const MaterialBase* material , const MediumStack& ms , const ShadowRoulette* roulette ) {
     const auto& ip = se.GetInteraction();
     Spectrum radiance;
     Visibility visibility(scene);
+    visibility.coarse = roulette ? roulette->coarse : nullptr;
     float light_pdf;
     float bsdf_pdf;
     const auto wo = -r.m_Dir;
     Vector wi;
-    const auto li = light->sample_l(ip.intersect, &ls, wi, 0, &light_pdf, 0, 0, visibility);
+    VMFLobe lobe_storage;
+    const auto lobe = bsdfLobe(se, wo, light, lobe_storage);
+    const auto li = sampleLight(light, ip.intersect, ls, lobe, wi, &light_pdf, visibility);
     if (light_pdf > 0.0f && !li.IsBlack()) {
-        Spectrum f = se.Evaluate_BSDF(wo, wi);
+        // the bsdf pdf is only needed for MIS, evaluate it together with the bsdf
+        Spectrum f = se.Evaluate_BSDF(wo, wi, light->IsDelta() ? nullptr : &bsdf_pdf);
 
+        if (!f.IsBlack()) {
+            const auto weight = light->IsDelta() ? 1.0f : MisFactor(light_pdf, bsdf_pdf);
+            const auto unoccluded = li * f * weight / light_pdf;
+            const auto survival = shadowRoulette(roulette, unoccluded);
 #ifndef ENABLE_TRANSPARENT_SHADOW
-        if (!f.IsBlack() && visibility.IsVisible()) {
-            if (light->IsDelta()) {
-                radiance += li * f / light_pdf;
-            } else {
-                bsdf_pdf = se.Pdf_BSDF(wo, wi);
-                const auto weight = MisFactor(light_pdf, bsdf_pdf);
-                radiance = li * f * weight / light_pdf;
-            }
-        }
+            if (survival > 0.0f && visibility.IsVisible())
+                radiance += unoccluded * survival;
 #else
-        // as long as the ray is passing through the surface, it is necessary to update the medium stack.
-        // make sure a copy, instead of the original data is updated to avoid data pollution.
-        MediumStack ms_copy = ms;
-        const auto interaction_flag = update_interaction_flag(dot(wi, se.GetInteraction().gnormal), dot(wo, se.GetInteraction().gnormal));
-        if (SE_Interaction::SE_REFLECTION != interaction_flag) {
-            MediumInteraction mi;
-            mi.intersect = se.GetInteraction().intersect;
-            mi.mesh = se.GetInteraction().primitive->GetMesh();
-            material->UpdateMediumStack(mi, interaction_flag, ms_copy);
-        }
-
-        if (!f.IsBlack()) {
-            const auto attenuation = visibility.GetAttenuation( &ms_copy );
-            if (!attenuation.IsBlack()) {
-                if (light->IsDelta()) {
-                    radiance += attenuation * li * f / light_pdf;
-                }
-                else {
-                    bsdf_pdf = se.Pdf_BSDF(wo, wi);
-                    const auto weight = MisFactor(light_pdf, bsdf_pdf);
-                    radiance = attenuation * li * f * weight / light_pdf;
+            if (survival > 0.0f) {
+                // as long as the ray is passing through the surface, it is necessary to update the medium stack.
+                // make sure a copy, instead of the original data is updated to avoid data pollution.
+                MediumStack ms_copy = ms;
+                const auto interaction_flag = update_interaction_flag(dot(wi, se.GetInteraction().gnormal), dot(wo, se.GetInteraction().gnormal));
+                if (SE_Interaction::SE_REFLECTION != interaction_flag) {
+                    MediumInteraction mi;
+                    mi.intersect = se.GetInteraction().intersect;
+                    mi.mesh = se.GetInteraction().primitive->GetMesh();
+                    material->UpdateMediumStack(mi, interaction_flag, ms_copy);
                 }
+
+                radiance += visibility.GetAttenuation( &ms_copy ) * unoccluded * survival;
             }
-        }
 #endif
+        }
     }
 
     if (!light->IsDelta()) {
         const auto f = se.Sample_BSDF(wo, wi, bs, bsdf_pdf);
         if (!f.IsBlack() && bsdf_pdf != 0.0f) {
             float light_pdf;
-            light_pdf = light->Pdf(ip.intersect, wi);
+            light_pdf = lightPdf(light, ip.intersect, wi, lobe);
             if (light_pdf <= 0.0f)
                 return radiance;
             const auto weight = MisFactor(bsdf_pdf, light_pdf);
 
             Spectrum li;
             SurfaceInteraction _ip;
-            if (false == light->Le(Ray(ip.intersect, wi), &_ip, li))
+            // the solid angle covered by a bsdf sample is roughly the inverse of its pdf, rough surfaces see a filtered sky
+            Ray ray(ip.intersect, wi);
+            ray.m_fFootprint = 1.0f / bsdf_pdf;
+            if (false == light->Le(ray, &_ip, li) || li.IsBlack())
+                return radiance;
+
+            const auto unoccluded = li * f * weight / bsdf_pdf;
+            const auto survival = shadowRoulette(roulette, unoccluded);
+            if (survival <= 0.0f)
                 return radiance;
 
             // Make sure the ray starts from the surface instead of the light because the state of medium stack is known at the surface intersection,
             // while the medium state at the light is totaly unknown. The medium state will be evaluated during shadow ray traversal.
             visibility.ray = Ray(ip.intersect, wi, 0, 0.001f, _ip.t - 0.001f);
 #ifndef ENABLE_TRANSPARENT_SHADOW
-            if (!li.IsBlack() && visibility.IsVisible())
-                radiance += li * f * weight / bsdf_pdf;
+            if (visibility.IsVisible())
+                radiance += unoccluded * survival;
 #else
             // as long as the ray is passing through the surface, it is necessary to update the medium stack.
             // make sure a copy, instead of the original data is updated to avoid data pollution.
@@ -179,11 +215,7 @@ Spectrum    EvaluateDirect(const ScatteringEvent& se, const Ray& r, const Scene&
                 material->UpdateMediumStack(mi, interaction_flag, ms_copy);
             }
 
-            if (!li.IsBlack()) {
-                const auto attenuation = visibility.GetAttenuation(&ms_copy);
-                if (!attenuation.IsBlack())
-                    radiance += attenuation * li * f * weight / bsdf_pdf;
-            }
+            radiance += visibility.GetAttenuation(&ms_copy) * unoccluded * survival;
 #endif
         }
     }
@@ -191,9 +223,10 @@ Spectrum    EvaluateDirect(const ScatteringEvent& se, const Ray& r, const Scene&
     return radiance;
 }
 
-Spectrum    EvaluateDirect(const Point& ip, const PhaseFunction* ph, const Vector& wo, const Scene& scene, const Light* light, MediumStack ms) {
+Spectrum    EvaluateDirect(const Point& ip, const PhaseFunction* ph, const Vector& wo, const Scene& scene, const Light* light, MediumStack ms, const ShadowRoulette* roulette) {
     Spectrum radiance;
     Visibility visibility(scene);
+    visibility.coarse = roulette ? roulette->coarse : nullptr;
     float light_pdf;
     Vector wi;
     const LightSample ls(true);
@@ -201,14 +234,14 @@ Spectrum    EvaluateDirect(const Point& ip, const PhaseFunction* ph, const Vecto
     if (light_pdf > 0.0f && !li.IsBlack() ) {
         const auto f = ph->P(wo, wi);
         if (f > 0.0f) {
+            const auto unoccluded = li * f / light_pdf;
+            const auto survival = shadowRoulette(roulette, unoccluded);
 #ifdef ENABLE_TRANSPARENT_SHADOW
-            const auto attenuation = visibility.GetAttenuation(&ms);
-            if (!attenuation.IsBlack())
-                radiance = attenuation * li * f / light_pdf;
+            if (survival > 0.0f)
+                radiance = visibility.GetAttenuation(&ms) * unoccluded * survival;
 #else
-            const auto occluded = visibility.IsVisible();
-            if (!occluded)
-                radiance = li * f / light_pdf;
+            if (survival > 0.0f && visibility.IsVisible())
+                radiance = unoccluded * survival;
 #endif
         }
     }
@@ -217,15 +250,18 @@ Spectrum    EvaluateDirect(const Point& ip, const PhaseFunction* ph, const Vecto
 }
 
 // This is only used by SSS for now, since it is a smooth BRDF, there is no need to do MIS.
-Spectrum SampleOneLight( const ScatteringEvent& se , const Ray& r, const SurfaceInteraction& inter, const Scene& scene, const MaterialBase* material, const MediumStack& ms) {
-    // Uniformly choose a light, this may not be the optimal solution in case of more lights, need more research in this topic later.
+Spectrum SampleOneLight( const ScatteringEvent& se , const Ray& r, const SurfaceInteraction& inter, const Scene& scene, const MaterialBase* material, const MediumStack& ms, const ShadowRoulette* roulette, const Light** picked) {
+    // Pick a light through the light tree so that lights close to the shading point are more likely to be picked.
     float light_pick_pdf = 0.0f;
-    const auto light = scene.SampleLight( sort_canonical() , &light_pick_pdf );
-    if(IS_PTR_INVALID(light))
+    const auto light = scene.SampleLight( inter.intersect , inter.gnormal , sort_canonical() , &light_pick_pdf );
+    if( picked )
+        *picked = light;
+    if(IS_PTR_INVALID(light) || light_pick_pdf <= 0.0f)
         return 0.0f;
 
     Spectrum radiance;
     Visibility visibility(scene);
+    visibility.coarse = roulette ? roulette->coarse : nullptr;
     const auto wo = -r.m_Dir;
     Vector wi;
     LightSample ls(true);
@@ -233,10 +269,17 @@ Spectrum SampleOneLight( const ScatteringEvent& se , const Ray& r, const Surface
     const auto li = light->sample_l( inter.intersect , &ls , wi , 0 , &light_pdf , 0 , 0 , visibility );
     if( light_pdf > 0.0f && !li.IsBlack() ){
         Spectrum f = se.Evaluate_BSDF( wo , wi );
+        if( f.IsBlack() )
+            return radiance;
+
+        const auto unoccluded = li * f / light_pdf / light_pick_pdf;
+        const auto survival = shadowRoulette( roulette , unoccluded );
+        if( survival <= 0.0f )
+            return radiance;
 
 #ifndef ENABLE_TRANSPARENT_SHADOW
-        if( !f.IsBlack() && visibility.IsVisible() )
-            radiance += li * f / light_pdf / light_pick_pdf;
+        if( visibility.IsVisible() )
+            radiance += unoccluded * survival;
 #else
         // as long as the ray is passing through the surface, it is necessary to update the medium stack.
         // make sure a copy, instead of the original data is updated to avoid data pollution.
@@ -249,11 +292,7 @@ Spectrum SampleOneLight( const ScatteringEvent& se , const Ray& r, const Surface
             material->UpdateMediumStack(mi, interaction_flag, ms_copy);
         }
 
-		if( !f.IsBlack() ){
-			const auto attenuation = visibility.GetAttenuation( &ms_copy );
-			if( !attenuation.IsBlack() )
-				radiance += attenuation * li * f / light_pdf / light_pick_pdf;
-        }
+        radiance += visibility.GetAttenuation( &ms_copy ) * unoccluded * survival;
 #endif
     }
     return radiance;
@@ -264,4 +303,137 @@ Spectrum    EvaluateDirect( const Ray& r , const Scene& scene , const Light* lig
     ScatteringEvent se( ip , replaceSSS ? SE_EVALUATE_ALL_NO_SSS : SE_EVALUATE_ALL );
     ip.primitive->GetMaterial()->UpdateScatteringEvent( se );
     return EvaluateDirect( se , r , scene , light , ls , bs );
-}
\ No newline at end of file
+}
+
+Spectrum    EvaluateAllLights( const Ray& r , const Scene& scene , const SurfaceInteraction& ip , bool replaceSSS ){
+    ScatteringEvent se( ip , replaceSSS ? SE_EVALUATE_ALL_NO_SSS : SE_EVALUATE_ALL );
+    ip.primitive->GetMaterial()->UpdateScatteringEvent( se );
+
+    const auto light_cnt = scene.LightNum();
+#ifdef ENABLE_TRANSPARENT_SHADOW
+    // attenuation along shadow rays can't be evaluated in a batch, occlusion in an opaque scene can.
+    if( !scene.IsOpaque() ){
+        Spectrum radiance;
+        for( auto i = 0u ; i < light_cnt ; ++i )
+            radiance += EvaluateDirect( se , r , scene , scene.GetLight(i) , LightSample(true) , BsdfSample(true) );
+        return radiance;
+    }
+#endif
+
+    if( 0 == light_cnt )
+        return 0.0f;
+
+    // Each light casts up to two shadow rays, one from light sampling and the other from bsdf sampling. Contributions are
+    // exactly the same as the ones in 'EvaluateDirect', except that they are only accumulated after all rays are tested.
+    SORT_MEMORY_SCOPE();
+    auto& allocator = GetStaticAllocator();
+    auto shadow_rays = allocator.Allocate<Ray>( light_cnt * 2 );
+    auto contributions = allocator.Allocate<Spectrum>( light_cnt * 2 );
+    auto occluded = allocator.Allocate<bool>( light_cnt * 2 );
+
+    auto cnt = 0u;
+    const auto wo = -r.m_Dir;
+    for( auto i = 0u ; i < light_cnt ; ++i ){
+        const auto light = scene.GetLight(i);
+        const LightSample ls(true);
+        const BsdfSample bs(true);
+
+        Visibility visibility(scene);
+        float light_pdf;
+        float bsdf_pdf;
+        Vector wi;
+        VMFLobe lobe_storage;
+        const auto lobe = bsdfLobe( se , wo , light , lobe_storage );
+        const auto li = sampleLight( light , ip.intersect , ls , lobe , wi , &light_pdf , visibility );
+        if( light_pdf > 0.0f && !li.IsBlack() ){
+            const auto f = se.Evaluate_BSDF( wo , wi , light->IsDelta() ? nullptr : &bsdf_pdf );
+            if( !f.IsBlack() ){
+                const auto weight = light->IsDelta() ? 1.0f : MisFactor( light_pdf , bsdf_pdf );
+                new ( shadow_rays + cnt ) Ray( visibility.ray );
+                new ( contributions + cnt++ ) Spectrum( li * f * weight / light_pdf );
+            }
+        }
+
+        if( light->IsDelta() )
+            continue;
+
+        const auto f = se.Sample_BSDF( wo , wi , bs , bsdf_pdf );
+        if( f.IsBlack() || bsdf_pdf == 0.0f )
+            continue;
+        const auto pdf = lightPdf( light , ip.intersect , wi , lobe );
+        if( pdf <= 0.0f )
+            continue;
+
+        Spectrum le;
+        SurfaceInteraction _ip;
+        Ray ray( ip.intersect , wi );
+        ray.m_fFootprint = 1.0f / bsdf_pdf;
+        if( false == light->Le( ray , &_ip , le ) || le.IsBlack() )
+            continue;
+
+        new ( shadow_rays + cnt ) Ray( ip.intersect , wi , 0 , 0.001f , _ip.t - 0.001f );
+        new ( contributions + cnt++ ) Spectrum( le * f * MisFactor( bsdf_pdf , pdf ) / bsdf_pdf );
+    }
+
+    scene.IsOccluded( shadow_rays , occluded , cnt );
+
+    Spectrum radiance;
+    for( auto i = 0u ; i < cnt ; ++i ){
+        if( !occluded[i] )
+            radiance += contributions[i];
+    }
+    return radiance;
+}
+
+// This is resampled importance sampling with a single entry weighted reservoir. Candidates are drawn from the light tree,
+// each of them is weighted by its unshadowed contribution over its pdf. The one kept in the reservoir is the only one
+// that needs a shadow ray, the estimation is still unbiased with the resampling weight applied.
+Spectrum    EvaluateLightCandidates( const ScatteringEvent& se , const Ray& r , const Scene& scene , unsigned candidate_cnt , bool delta_only ){
+    const auto& ip = se.GetInteraction();
+    const auto wo = -r.m_Dir;
+
+    Spectrum    picked;             // unshadowed contribution of the picked sample
+    float       picked_target = 0.0f;
+    float       weight_sum = 0.0f;
+    Visibility  visibility(scene);
+
+    for( auto i = 0u ; i < candidate_cnt ; ++i ){
+        float light_pick_pdf = 0.0f;
+        const auto light = scene.SampleLight( ip.intersect , ip.gnormal , sort_canonical() , &light_pick_pdf );
+        if( IS_PTR_INVALID(light) || light_pick_pdf <= 0.0f || ( delta_only && !light->IsDelta() ) )
+            continue;
+
+        Visibility candidate_visibility(scene);
+        LightSample ls(true);
+        Vector wi;
+        auto light_pdf = 0.0f;
+        const auto li = light->sample_l( ip.intersect , &ls , wi , 0 , &light_pdf , 0 , 0 , candidate_visibility );
+        if( light_pdf <= 0.0f || li.IsBlack() )
+            continue;
+
+        const auto contribution = li * se.Evaluate_BSDF( wo , wi );
+        const auto target = contribution.GetIntensity();
+        if( target <= 0.0f )
+            continue;
+
+        const auto weight = target / ( light_pdf * light_pick_pdf );
+        weight_sum += weight;
+        if( sort_canonical() * weight_sum < weight ){
+            picked = contribution;
+            picked_target = target;
+            visibility.ray = candidate_visibility.ray;
+        }
+    }
+
+    if( picked_target <= 0.0f )
+        return 0.0f;
+
+    const auto resampling_weight = weight_sum / ( picked_target * candidate_cnt );
+#ifndef ENABLE_TRANSPARENT_SHADOW
+    if( !visibility.IsVisible() )
+        return 0.0f;
+    return picked * resampling_weight;
+#else
+    return visibility.GetAttenuation() * picked * resampling_weight;
+#endif
+}
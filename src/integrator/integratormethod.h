@@ -22,16 +22,36 @@
 struct	SurfaceInteraction;
 class	Light;
 class   MediumStack;
+class   OcclusionGrid;
+
+//! @brief  Russian roulette of shadow rays carrying little radiance.
+//!
+//! A shadow ray whose unoccluded contribution to the pixel is below the threshold is only traced with a probability
+//! proportional to the contribution, the ones traced are scaled up by the inverse of it. It stays unbiased.
+//!
+//! Shadow rays surviving the roulette could further be answered by a coarse occlusion grid instead of being traced,
+//! which is biased and only meant for previews.
+struct ShadowRoulette{
+    Spectrum    scale = 1.0f;       /**< Factor turning the radiance returned by the light sample into the radiance of the pixel. */
+    float       threshold = 0.0f;   /**< Contribution to the pixel below which shadow rays are in russian roulette, zero disables it. */
+    const OcclusionGrid* coarse = nullptr;  /**< Coarse occupancy answering shadow rays approximately, they are traced if it is null. */
+};
 
 // evaluate direct lighting
-Spectrum    EvaluateDirect(const ScatteringEvent& se, const Ray& r, const Scene& scene, const Light* light, const LightSample& ls, const BsdfSample& bs, const MaterialBase* material, const MediumStack& ms);
-Spectrum    EvaluateDirect(const ScatteringEvent& se, const Ray& r, const Scene& scene, const Light* light, const LightSample& ls, const BsdfSample& bs);
+Spectrum    EvaluateDirect(const ScatteringEvent& se, const Ray& r, const Scene& scene, const Light* light, const LightSample& ls, const BsdfSample& bs, const MaterialBase* material, const MediumStack& ms, const ShadowRoulette* roulette = nullptr);
+Spectrum    EvaluateDirect(const ScatteringEvent& se, const Ray& r, const Scene& scene, const Light* light, const LightSample& ls, const BsdfSample& bs, const ShadowRoulette* roulette = nullptr);
 
-Spectrum    EvaluateDirect(const Point& ip, const PhaseFunction* ph, const Vector& wo, const Scene& scene, const Light* light, MediumStack ms);
+Spectrum    EvaluateDirect(const Point& ip, const PhaseFunction* ph, const Vector& wo, const Scene& scene, const Light* light, MediumStack ms, const ShadowRoulette* roulette = nullptr);
 
-// uniformly evaluate direct illumination from one light
-Spectrum    SampleOneLight( const ScatteringEvent& se , const Ray& r, const SurfaceInteraction& inter, const Scene& scene, const MaterialBase* material, const MediumStack& ms);
+// uniformly evaluate direct illumination from one light, the light picked is returned through 'picked' if it is not nullptr
+Spectrum    SampleOneLight( const ScatteringEvent& se , const Ray& r, const SurfaceInteraction& inter, const Scene& scene, const MaterialBase* material, const MediumStack& ms, const ShadowRoulette* roulette = nullptr, const Light** picked = nullptr);
 
 // helper function to evaluate light contribution
 Spectrum    EvaluateDirect( const Ray& r , const Scene& scene , const Light* light , const SurfaceInteraction& ip ,
-                            const LightSample& ls , const BsdfSample& bs , bool replaceSSS = false );
\ No newline at end of file
+                            const LightSample& ls , const BsdfSample& bs , bool replaceSSS = false );
+
+// evaluate direct illumination from all lights in the scene, shadow rays toward all of them are tested in one batch
+Spectrum    EvaluateAllLights( const Ray& r , const Scene& scene , const SurfaceInteraction& ip , bool replaceSSS = false );
+
+// evaluate direct illumination by resampling one light sample out of a few candidates, the cost doesn't grow with lights
+Spectrum    EvaluateLightCandidates( const ScatteringEvent& se , const Ray& r , const Scene& scene , unsigned candidate_cnt , bool delta_only = false );
\ No newline at end of file
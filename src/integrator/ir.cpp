@@ -21,6 +21,8 @@
 #include "core/scene.h"
 #include "light/light.h"
 #include "scatteringevent/scatteringevent.h"
+#include "core/memory.h"
+#include "task/task.h"
 
 SORT_STATS_DECLARE_COUNTER(sPrimaryRayCount)
 SORT_STATS_DEFINE_COUNTER(sVPLCount)
@@ -28,66 +30,94 @@ SORT_STATS_DEFINE_COUNTER(sVPLCount)
 SORT_STATS_COUNTER("Instant Radiosity", "Primary Ray Count" , sPrimaryRayCount);
 SORT_STATS_COUNTER("Instant Radiosity", "Virtual Point Lights Count" , sVPLCount);
 
+// Light paths traced in a single task when generating virtual light sources.
+static constexpr unsigned   IR_LIGHT_PATH_GRAIN         = 64;
+// Clusters with error bounds lower than this ratio of the total radiance are not refined in light cuts.
+static constexpr float      IR_LIGHT_CUT_ERROR_RATIO    = 0.02f;
+// Maximum number of clusters evaluated for a shading point.
+static constexpr unsigned   IR_LIGHT_CUT_MAX_SIZE       = 1000;
+
 // Preprocess
 void InstantRadiosity::PreProcess( const Scene& scene )
 {
     SORT_PROFILE("Instant Radiosity (LPV distribution stage)");
 
-    m_pVirtualLightSources = std::make_unique<std::list<VirtualLightSource>[]>(m_nLightPathSet);
+    m_virtualLightSources.clear();
+    m_virtualLightSources.resize( m_nLightPathSet );
+    m_vplTrees.clear();
+    m_vplTrees.resize( m_nLightPathSet );
 
+    // light paths are traced in parallel, virtual light sources of each chunk are appended in order afterwards
+    const auto path_cnt = (unsigned)m_nLightPaths;
+    const auto chunk_cnt = ( path_cnt + IR_LIGHT_PATH_GRAIN - 1 ) / IR_LIGHT_PATH_GRAIN;
     for( int k = 0 ; k < m_nLightPathSet ; ++k ){
-        for( int i = 0 ; i < m_nLightPaths ; ++i ){
-            // pick a light first
-            float light_pick_pdf;
-            const Light* light = scene.SampleLight( sort_canonical() , &light_pick_pdf );
-
-            // sample a ray from the light source
-            float   light_emission_pdf = 0.0f;
-            float   light_pdfa = 0.0f;
-            Ray     ray;
-            float   cosAtLight = 1.0f;
-            Spectrum le = light->sample_l( LightSample(true) , ray , &light_emission_pdf , &light_pdfa , &cosAtLight );
-
-            Spectrum throughput = le * cosAtLight / ( light_pick_pdf * light_emission_pdf );
-
-            int current_depth = 0;
-            SurfaceInteraction intersect;
-            while( true ){
-                if (false == scene.GetIntersect(ray, intersect))
-                    break;
-
-                VirtualLightSource ls;
-                ls.power = throughput;
-                ls.intersect = intersect;
-                ls.wi = -ray.m_Dir;
-                ls.depth = ++current_depth;
-                m_pVirtualLightSources[k].push_back( ls );
-
-                float bsdf_pdf;
-                Vector wo;
-                
-                ScatteringEvent se( intersect , SE_EVALUATE_ALL_NO_SSS );
-                intersect.primitive->GetMaterial()->UpdateScatteringEvent(se);
-                Spectrum bsdf_value = se.Sample_BSDF( ls.wi , wo, BsdfSample(true) , bsdf_pdf );
-
-                if( bsdf_pdf == 0.0f )
-                    break;
-
-                // apply russian roulette
-                float continueProperbility = std::min( 1.0f , throughput.GetIntensity() );
-                if( sort_canonical() > continueProperbility )
-                    break;
-                throughput /= continueProperbility;
-
-                // update throughput
-                throughput *= bsdf_value / bsdf_pdf;
-
-                // update next ray
-                ray = Ray(intersect.intersect, wo, 0, 0.001f);
-            }
-        }
+        std::vector<VirtualLightSources> chunks( chunk_cnt );
+        ParallelFor( 0u , path_cnt , IR_LIGHT_PATH_GRAIN , [&]( unsigned s , unsigned e ){
+            traceLightPaths( scene , s , e , chunks[s / IR_LIGHT_PATH_GRAIN] );
+        });
+
+        auto& vpls = m_virtualLightSources[k];
+        for( const auto& chunk : chunks )
+            vpls.Append( chunk );
+        m_vplTrees[k].Build( vpls );
 
-        SORT_STATS(sVPLCount+=m_pVirtualLightSources[k].size());
+        SORT_STATS(sVPLCount+=vpls.Size());
+    }
+}
+
+void InstantRadiosity::traceLightPaths( const Scene& scene , unsigned start , unsigned end , VirtualLightSources& vpls ) const{
+    for( auto i = start ; i < end ; ++i ){
+        // pick a light first
+        float light_pick_pdf;
+        const Light* light = scene.SampleLight( sort_canonical() , &light_pick_pdf );
+        if( IS_PTR_INVALID(light) )
+            continue;
+
+        // sample a ray from the light source
+        float   light_emission_pdf = 0.0f;
+        float   light_pdfa = 0.0f;
+        Ray     ray;
+        float   cosAtLight = 1.0f;
+        Spectrum le = light->sample_l( LightSample(true) , ray , &light_emission_pdf , &light_pdfa , &cosAtLight );
+        if( light_emission_pdf == 0.0f )
+            continue;
+
+        Spectrum throughput = le * cosAtLight / ( light_pick_pdf * light_emission_pdf );
+
+        int current_depth = 0;
+        SurfaceInteraction intersect;
+        while( true ){
+            // scattering event of each bounce is not needed after the bounce
+            SORT_MEMORY_SCOPE();
+
+            if (false == scene.GetIntersect(ray, intersect))
+                break;
+
+            const auto wi = -ray.m_Dir;
+            vpls.Add( intersect , wi , throughput , ++current_depth );
+
+            float bsdf_pdf;
+            Vector wo;
+
+            ScatteringEvent se( intersect , SE_EVALUATE_ALL_NO_SSS );
+            intersect.primitive->GetMaterial()->UpdateScatteringEvent(se);
+            Spectrum bsdf_value = se.Sample_BSDF( wi , wo, BsdfSample(true) , bsdf_pdf );
+
+            if( bsdf_pdf == 0.0f )
+                break;
+
+            // apply russian roulette
+            float continueProperbility = std::min( 1.0f , throughput.GetIntensity() );
+            if( sort_canonical() > continueProperbility )
+                break;
+            throughput /= continueProperbility;
+
+            // update throughput
+            throughput *= bsdf_value / bsdf_pdf;
+
+            // update next ray
+            ray = Ray(intersect.intersect, wo, 0, 0.001f);
+        }
     }
 }
 
@@ -110,60 +140,52 @@ Spectrum InstantRadiosity::_li( const Ray& r , const Scene& scene , bool ignoreL
 
     // evaluate light path less than two vertices
     Spectrum radiance = ignoreLe?0.0f:ip.Le( -r.m_Dir );
-    unsigned light_num = scene.LightNum();
-    for( unsigned i = 0 ; i < light_num ; ++i ){
-        const auto light = scene.GetLight(i);
-        radiance += EvaluateDirect( r , scene , light , ip , LightSample(true) , BsdfSample(true) , true );
-    }
+    radiance += EvaluateAllLights( r , scene , ip , true );
 
     if( first_intersect_dist )
         *first_intersect_dist = ip.t;
 
-    // pick a virtual light source randomly
-    const unsigned lps_id = std::min( m_nLightPathSet - 1 , (int)(sort_canonical() * m_nLightPathSet) );
-    std::list<VirtualLightSource> vps = m_pVirtualLightSources[lps_id];
-
     ScatteringEvent se( ip , SE_EVALUATE_ALL_NO_SSS );
     ip.primitive->GetMaterial()->UpdateScatteringEvent(se);
 
-    // evaluate indirect illumination
-    Spectrum indirectIllum;
-    std::list<VirtualLightSource>::const_iterator it = vps.begin();
-    while( it != vps.end() ){
-        if( r.m_Depth + it->depth > max_recursive_depth ){
-            ++it;
-            continue;
-        }
+    // pick a light path set randomly
+    const unsigned lps_id = std::min( m_nLightPathSet - 1 , (int)(sort_canonical() * m_nLightPathSet) );
+    const auto& vpls = m_virtualLightSources[lps_id];
+
+    // contribution of a virtual light source excluding its power
+    const auto evaluate = [&]( unsigned i ) -> Spectrum {
+        // scattering event of the virtual light source is not needed after the evaluation
+        SORT_MEMORY_SCOPE();
 
-        const auto  delta = ip.intersect - it->intersect.intersect;
+        const auto& vpl_inter = vpls.interaction[i];
+        const auto  delta = ip.intersect - vpl_inter.intersect;
         const auto  sqrLen = delta.SquaredLength();
         const auto  len = sqrt( sqrLen );
         const auto  n_delta = delta / len;
 
-        ScatteringEvent se1( it->intersect , SE_EVALUATE_ALL_NO_SSS );
-        it->intersect.primitive->GetMaterial()->UpdateScatteringEvent(se1);
+        ScatteringEvent se1( vpl_inter , SE_EVALUATE_ALL_NO_SSS );
+        vpl_inter.primitive->GetMaterial()->UpdateScatteringEvent(se1);
 
         const auto    gterm = 1.0f / std::max( m_fMinSqrDist , sqrLen );
         const auto    f0 = se.Evaluate_BSDF( -r.m_Dir , -n_delta );
-        const auto    f1 = se1.Evaluate_BSDF( n_delta , it->wi );
+        const auto    f1 = se1.Evaluate_BSDF( n_delta , vpls.wi[i] );
 
-        Spectrum    contr = gterm * f0 * f1 * it->power;
-        if( !contr.IsBlack() ){
-            Visibility vis(scene);
-            vis.ray = Ray( it->intersect.intersect , n_delta , 0 , 0.001f , len - 0.001f );
+        const Spectrum contr = gterm * f0 * f1;
+        if( contr.IsBlack() )
+            return 0.0f;
+
+        Visibility vis(scene);
+        vis.ray = Ray( vpl_inter.intersect , n_delta , 0 , 0.001f , len - 0.001f );
 
 #ifndef ENABLE_TRANSPARENT_SHADOW
-            if( vis.IsVisible() )
-                indirectIllum += contr;
+        return vis.IsVisible() ? contr : Spectrum( 0.0f );
 #else
-            const auto attenuation = vis.GetAttenuation();
-            if( !attenuation.IsBlack() )
-                indirectIllum += contr * attenuation;
+        return contr * vis.GetAttenuation();
 #endif
-        }
+    };
 
-        ++it;
-    }
+    // evaluate indirect illumination through a light cut
+    const auto indirectIllum = m_vplTrees[lps_id].Evaluate( ip.intersect , max_recursive_depth - r.m_Depth , m_fMinSqrDist , IR_LIGHT_CUT_ERROR_RATIO , IR_LIGHT_CUT_MAX_SIZE , evaluate );
     radiance += indirectIllum / (float)m_nLightPaths;
 
     if( m_fMinDist > 0.0f ){
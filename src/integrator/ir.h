@@ -17,16 +17,9 @@
 
 #pragma once
 
-#include <list>
 #include "integrator.h"
 #include "math/interaction.h"
-
-struct VirtualLightSource{
-    SurfaceInteraction  intersect;
-    Vector              wi;
-    Spectrum            power;
-    int                 depth;
-};
+#include "vpltree.h"
 
 //! @brief  Instant radiosity integrator.
 /**
@@ -34,6 +27,8 @@ struct VirtualLightSource{
  * First pass generates virtual light sources along the path tracing from light sources.
  * Second pass will use those virtual light source to evaluate indirect illuimination.
  * Direct illumination is handled the same way in directlight integrator.
+ * Virtual light sources of each light path set are clustered in a light cut tree, shading points only evaluate the clusters
+ * in their cuts instead of all virtual light sources.
  */
 class   InstantRadiosity : public Integrator{
 public:
@@ -62,6 +57,7 @@ public:
         stream >> m_nLightPathSet;
         stream >> m_nLightPaths;
         stream >> m_fMinDist;
+        m_fMinSqrDist = m_fMinDist * m_fMinDist;
     }
 
 private:
@@ -75,8 +71,18 @@ private:
     float   m_fMinDist      = 1.0f;
     float   m_fMinSqrDist   = 1.0f;
 
-    /**< container for light sources. */
-    std::unique_ptr<std::list<VirtualLightSource>[]>    m_pVirtualLightSources;
+    /**< virtual light sources of each light path set. */
+    std::vector<VirtualLightSources>    m_virtualLightSources;
+    /**< light cut trees of each light path set. */
+    std::vector<VPLTree>                m_vplTrees;
+
+    //! @brief  Trace light paths and record virtual light sources along them.
+    //!
+    //! @param  scene           The scene to be evaluated.
+    //! @param  start           Index of the first light path.
+    //! @param  end             Index after the last light path.
+    //! @param  vpls            Container of the virtual light sources.
+    void    traceLightPaths( const Scene& scene , unsigned start , unsigned end , VirtualLightSources& vpls ) const;
 
     Spectrum _li( const Ray& ray , const Scene& scene , bool ignoreLe = false , float* first_intersect_dist = 0 ) const;
 
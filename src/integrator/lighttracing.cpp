@@ -0,0 +1,55 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include "lighttracing.h"
+#include "core/scene.h"
+#include "core/memory.h"
+#include "core/globalconfig.h"
+#include "core/stats.h"
+
+SORT_STATS_DEFINE_COUNTER(sLightPathCount)
+SORT_STATS_COUNTER("Light Tracing", "Light Path Count", sLightPathCount);
+
+Spectrum LightTracing::Li( const Ray& ray , const PixelSample& ps , const Scene& scene ) const{
+    SurfaceInteraction inter;
+    if( !scene.GetIntersect( ray , inter ) )
+        return scene.Le( ray );
+    return inter.Le( -ray.m_Dir );
+}
+
+void LightTracing::PreProcess( const Scene& scene ){
+    // light path tasks could be done before any render task requests samples
+    sample_per_pixel = g_samplePerPixel;
+}
+
+unsigned long long LightTracing::GetLightPathCnt() const{
+    return (unsigned long long)g_resultResollutionWidth * (unsigned long long)g_resultResollutionHeight * g_samplePerPixel;
+}
+
+void LightTracing::TraceLightPath( const Scene& scene , unsigned long long index ) const{
+    SORT_STATS(++sLightPathCount);
+
+    float pdf = 0.0f;
+    const auto light = scene.SampleLight( sort_canonical() , &pdf );
+    if( IS_PTR_INVALID(light) || pdf == 0.0f )
+        return;
+
+    // vertices of the light path live in the memory of the path, which is released once the path is done
+    auto light_path = GetStaticAllocator().Allocate<BDPT_Vertex>( std::max( 1 , max_recursive_depth ) );
+    _TraceLightPath( scene , light , pdf , light_path , true );
+}
@@ -25,6 +25,9 @@
  * algorithm implemented in this integration, but only one parameter to drive the
  * differences.
  * The actual implementation is actually hidden in bidirectional path tracing integrator.
+ *
+ * Light paths are traced in light path tasks of a fixed size instead of render tasks, one light path for each sample
+ * of each pixel. Camera rays of tiles only gather the emission of lights seen directly.
  */
 class LightTracing : public BidirPathTracing{
 public:
@@ -35,6 +38,30 @@ public:
         light_tracing_only = true;
     }
 
+    //! @brief  Evaluate the emission seen directly along a camera ray, light paths are traced in their own tasks.
+    //!
+    //! @param  ray             The ray to be tested with.
+    //! @param  ps              Pixel sample used to evaluate Monte Carlo method.
+    //! @param  scene           The scene to be evaluated.
+    //! @return                 The emission along the opposite direction that the ray points to.
+    Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene ) const override;
+
+    //! @brief  Splats of light paths are normalized against the full sample budget.
+    //!
+    //! @param  scene           The scene to be evaluated.
+    void        PreProcess( const Scene& scene ) override;
+
+    //! @brief  One light path for each sample of each pixel.
+    //!
+    //! @return                 Number of light paths of the whole image.
+    unsigned long long GetLightPathCnt() const override;
+
+    //! @brief  Trace a light path from a light picked randomly and connect each vertex to the camera.
+    //!
+    //! @param  scene           The scene to be evaluated.
+    //! @param  index           Index of the light path, it is not needed as the path is seeded by its task already.
+    void        TraceLightPath( const Scene& scene , unsigned long long index ) const override;
+
     //! @brief  Whether to refreshtile in Blender user interface.
     //!
     //! Since there is no specific order of rendering, there is no way to support live refresh.
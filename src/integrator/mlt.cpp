@@ -0,0 +1,272 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include "mlt.h"
+#include "core/scene.h"
+#include "core/globalconfig.h"
+#include "camera/camera.h"
+#include "task/task.h"
+#include "math/utils.h"
+
+SORT_STATS_DEFINE_COUNTER(sBootstrapSampleCnt)
+SORT_STATS_DEFINE_COUNTER(sMutationCnt)
+SORT_STATS_DEFINE_COUNTER(sAcceptedMutationCnt)
+
+SORT_STATS_COUNTER("Metropolis Light Transport", "Bootstrap Samples", sBootstrapSampleCnt);
+SORT_STATS_COUNTER("Metropolis Light Transport", "Mutations", sMutationCnt);
+SORT_STATS_RATIO("Metropolis Light Transport", "Acceptance Rate", sAcceptedMutationCnt, sMutationCnt);
+
+// Number of bootstrap samples evaluated in one forked task.
+static constexpr unsigned int MLT_BOOTSTRAP_BATCH = 1024;
+
+// Streams keyed by the same index don't correlate with each other.
+static constexpr unsigned int MLT_BOOTSTRAP_STREAM = 3;
+static constexpr unsigned int MLT_CHAIN_STREAM = 4;
+static constexpr unsigned int MLT_PATH_STREAM = 5;
+
+// The state being evaluated on the current thread, radiance of light vertices connected to the camera goes here.
+static thread_local std::vector<Pending_Sample>* g_contribution = nullptr;
+
+void MLTSampler::Reseed( unsigned long long seed , unsigned stream ){
+    const auto state = sort_get_state();
+    sort_seed( (unsigned)seed , (unsigned)( seed >> 32 ) , 0 , stream );
+    m_random = sort_get_state();
+    sort_set_state( state );
+}
+
+float MLTSampler::canonical(){
+    const auto state = sort_get_state();
+    sort_set_state( m_random );
+    const auto ret = sort_canonical();
+    m_random = sort_get_state();
+    sort_set_state( state );
+    return ret;
+}
+
+void MLTSampler::StartIteration(){
+    ++m_iteration;
+    m_largeStep = canonical() < m_largeStepProb;
+    m_dimension = 0;
+}
+
+void MLTSampler::Accept(){
+    if( m_largeStep )
+        m_lastLargeStep = m_iteration;
+}
+
+void MLTSampler::Reject(){
+    for( auto& sample : m_samples ){
+        if( sample.modified == m_iteration ){
+            sample.value = sample.backup;
+            sample.modified = sample.modifiedBackup;
+        }
+    }
+    --m_iteration;
+}
+
+float MLTSampler::Get1D(){
+    const auto i = m_dimension++;
+    ensureReady( i );
+    return m_samples[i].value;
+}
+
+void MLTSampler::Generate1D( float* sample , unsigned num , bool accept_uniform ) const{
+    auto& sampler = const_cast<MLTSampler&>( *this );
+    for( auto i = 0u ; i < num ; ++i )
+        sample[i] = sampler.Get1D();
+}
+
+void MLTSampler::Generate2D( float* sample , unsigned num , bool accept_uniform ) const{
+    Generate1D( sample , 2 * num , accept_uniform );
+}
+
+void MLTSampler::ensureReady( unsigned i ){
+    if( i >= m_samples.size() )
+        m_samples.resize( i + 1 );
+    auto& sample = m_samples[i];
+
+    // a large step accepted since the last time the dimension was drawn replaced it with a fresh random number
+    if( sample.modified < m_lastLargeStep ){
+        sample.value = canonical();
+        sample.modified = m_lastLargeStep;
+    }
+
+    sample.backup = sample.value;
+    sample.modifiedBackup = sample.modified;
+    if( m_largeStep ){
+        sample.value = canonical();
+    }else{
+        // all small steps missed by the dimension add up to a single normal distribution with a wider spread
+        const auto steps = (float)( m_iteration - sample.modified );
+        const auto normal = 1.41421356f * ErfInv( 2.0f * canonical() - 1.0f );
+        sample.value += normal * m_sigma * sqrt( steps );
+        sample.value -= floor( sample.value );
+    }
+    sample.modified = m_iteration;
+}
+
+void MetropolisLightTransport::PreProcess( const Scene& scene ){
+    // splats are normalized against the full sample budget
+    sample_per_pixel = g_samplePerPixel;
+
+    m_bootstrapCdf.clear();
+    m_normalization = 0.0f;
+    if( IS_PTR_INVALID( scene.GetCamera() ) )
+        return;
+
+    // bootstrap samples are independent of each other, they are evaluated by all workers
+    const auto cnt = (unsigned int)std::max( 1 , m_bootstrapCnt );
+    std::vector<float> brightness( cnt , 0.0f );
+    TaskGroup group;
+    for( auto first = 0u ; first < cnt ; first += MLT_BOOTSTRAP_BATCH ){
+        const auto last = std::min( cnt , first + MLT_BOOTSTRAP_BATCH );
+        group.Fork( [&, first, last](){
+            std::vector<Pending_Sample> contribution;
+            for( auto i = first ; i < last ; ++i ){
+                MLTSampler sampler( m_sigma , m_largeStepProb );
+                sampler.Reseed( i , MLT_BOOTSTRAP_STREAM );
+                BindSampler( &sampler );
+                sort_seed( i , 0 , 0 , MLT_PATH_STREAM );
+                brightness[i] = evaluate( scene , contribution );
+            }
+            BindSampler( nullptr );
+            SORT_STATS(sBootstrapSampleCnt += last - first);
+        } , "MLT Bootstrap" );
+    }
+    group.Join();
+
+    m_bootstrapCdf.resize( cnt );
+    auto sum = 0.0;
+    for( auto i = 0u ; i < cnt ; ++i ){
+        sum += brightness[i];
+        m_bootstrapCdf[i] = sum;
+    }
+    m_normalization = (float)( sum / cnt );
+
+    // the same number of samples as path tracing with the same settings, spread over all chains
+    const auto chain_cnt = (unsigned long long)std::max( 1 , m_chainCnt );
+    const auto sample_cnt = (unsigned long long)g_resultResollutionWidth * g_resultResollutionHeight * g_samplePerPixel;
+    m_mutationCnt = std::max( 1ull , sample_cnt / chain_cnt );
+    m_splatScale = (float)( (double)m_normalization * sample_cnt / (double)( chain_cnt * m_mutationCnt ) );
+}
+
+unsigned long long MetropolisLightTransport::GetLightPathCnt() const{
+    return (unsigned long long)std::max( 1 , m_chainCnt );
+}
+
+void MetropolisLightTransport::TraceLightPath( const Scene& scene , unsigned long long index ) const{
+    if( m_normalization <= 0.0f || m_bootstrapCdf.empty() )
+        return;
+
+    // chains start from bootstrap samples picked proportionally to their brightness, stratified over all chains
+    const auto target = ( (double)index + 0.5 ) / (double)GetLightPathCnt() * m_bootstrapCdf.back();
+    const auto start = (unsigned int)std::min<std::size_t>( std::upper_bound( m_bootstrapCdf.begin() , m_bootstrapCdf.end() , target ) - m_bootstrapCdf.begin() , m_bootstrapCdf.size() - 1 );
+
+    // reproduce the bootstrap sample as the first state
+    MLTSampler sampler( m_sigma , m_largeStepProb );
+    sampler.Reseed( start , MLT_BOOTSTRAP_STREAM );
+    BindSampler( &sampler );
+    sort_seed( start , 0 , 0 , MLT_PATH_STREAM );
+    std::vector<Pending_Sample> current , proposed;
+    auto current_brightness = evaluate( scene , current );
+
+    // chains starting from the same bootstrap sample don't mutate the same way
+    sampler.Reseed( index , MLT_CHAIN_STREAM );
+
+    auto& scheduler = Scheduler::GetSingleton();
+    for( auto k = 0ull ; k < m_mutationCnt ; ++k ){
+        // a chain takes a while, it stops halfway once rendering is cancelled
+        if( UNLIKELY( scheduler.IsFlushing() ) )
+            break;
+
+        sampler.StartIteration();
+        sort_seed( (unsigned)index , (unsigned)k , (unsigned)( k >> 32 ) , MLT_CHAIN_STREAM );
+        const auto proposed_brightness = evaluate( scene , proposed );
+
+        // both states are splatted by the odds of being the next state, which is known as expected value splatting
+        const auto accept = current_brightness > 0.0f ? std::min( 1.0f , proposed_brightness / current_brightness ) : 1.0f;
+        if( accept > 0.0f && proposed_brightness > 0.0f )
+            splat( proposed , accept * m_splatScale / proposed_brightness );
+        if( accept < 1.0f && current_brightness > 0.0f )
+            splat( current , ( 1.0f - accept ) * m_splatScale / current_brightness );
+
+        SORT_STATS(++sMutationCnt);
+        if( sort_canonical() < accept ){
+            std::swap( current , proposed );
+            current_brightness = proposed_brightness;
+            sampler.Accept();
+            SORT_STATS(++sAcceptedMutationCnt);
+        }else{
+            sampler.Reject();
+        }
+    }
+
+    BindSampler( nullptr );
+}
+
+void MetropolisLightTransport::_SplatRadiance( int x , int y , const Spectrum& radiance ) const{
+    if( IS_PTR_INVALID( g_contribution ) ){
+        BidirPathTracing::_SplatRadiance( x , y , radiance );
+        return;
+    }
+    if( radiance.IsValid() && !radiance.IsBlack() )
+        g_contribution->push_back( { Vector2i( x , y ) , radiance } );
+}
+
+float MetropolisLightTransport::evaluate( const Scene& scene , std::vector<Pending_Sample>& contribution ) const{
+    contribution.clear();
+
+    // memory allocated for the state is released once it is evaluated
+    SORT_MEMORY_SCOPE();
+
+    // the first dimensions pick a point on the whole image instead of a pixel
+    const auto width = (int)g_resultResollutionWidth;
+    const auto height = (int)g_resultResollutionHeight;
+    PixelSample ps;
+    float u , v;
+    sort_sample_2d( u , v );
+    ps.pixel_x = std::min( (int)( u * width ) , width - 1 );
+    ps.pixel_y = std::min( (int)( v * height ) , height - 1 );
+    ps.img_u = u * width - ps.pixel_x;
+    ps.img_v = v * height - ps.pixel_y;
+    sort_sample_2d( ps.dof_u , ps.dof_v );
+    ps.time = sort_sample_1d();
+    SetRayTime( ps.time );
+
+    auto ray = scene.GetCamera()->GenerateRay( (float)ps.pixel_x , (float)ps.pixel_y , ps );
+    ray.ScaleDifferentials( 1.0f / sqrt( (float)sample_per_pixel ) );
+
+    // light vertices connected to the camera bring radiance to other pixels along the way
+    g_contribution = &contribution;
+    const auto li = BidirPathTracing::Li( ray , ps , scene );
+    g_contribution = nullptr;
+
+    // radiance of the camera ray is averaged over all samples of the pixel, the same as the splats
+    if( li.IsValid() && !li.IsBlack() )
+        contribution.push_back( { Vector2i( ps.pixel_x , ps.pixel_y ) , li / (float)sample_per_pixel } );
+
+    auto brightness = 0.0f;
+    for( const auto& c : contribution )
+        brightness += c.radiance.GetIntensity();
+    return brightness;
+}
+
+void MetropolisLightTransport::splat( const std::vector<Pending_Sample>& contribution , float weight ) const{
+    for( const auto& c : contribution )
+        g_imageSensor->UpdatePixel( c.coord.x , c.coord.y , c.radiance * weight );
+}
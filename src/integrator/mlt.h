@@ -0,0 +1,226 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <vector>
+#include "bidirpath.h"
+
+//! @brief  Sampler drawing primary samples of a Markov chain.
+/**
+ * A path is a function of the canonical numbers drawn to construct it, which are called its primary samples. The sampler
+ * keeps the primary samples of the current state of the chain and mutates them. A large step replaces all of them with
+ * fresh random numbers, a small step perturbs each one slightly. Dimensions are mutated lazily, they only catch up with
+ * the steps they missed once they are drawn, paths of different lengths don't pay for the dimensions they don't touch.
+ * A rejected mutation restores all the dimensions it touched.
+ *
+ * Random numbers for mutating the samples come from the sampler's own stream, they don't interfere with any other
+ * random number drawn on the thread.
+ */
+class MLTSampler : public Sampler{
+public:
+    //! @brief  Constructor.
+    //!
+    //! @param  sigma           Standard deviation of small steps.
+    //! @param  largeStepProb   Probability of taking a large step.
+    MLTSampler( float sigma , float largeStepProb ) : m_sigma( sigma ) , m_largeStepProb( largeStepProb ) {}
+
+    //! @brief  Key the stream mutating the samples, primary samples not drawn yet are drawn from it too.
+    //!
+    //! @param  seed            The key of the stream.
+    //! @param  stream          Streams with the same key but different indices are independent of each other.
+    void        Reseed( unsigned long long seed , unsigned stream );
+
+    //! @brief  Start a new mutation, dimensions drawn afterward are mutated.
+    //!
+    //! Each dimension is drawn at most once in an iteration.
+    void        StartIteration();
+
+    //! @brief  Keep the mutation as the current state of the chain.
+    void        Accept();
+
+    //! @brief  Restore the state before the mutation.
+    void        Reject();
+
+    //! @brief  Draw the next dimension of the current state.
+    //!
+    //! @return     A canonical number in [0,1).
+    float       Get1D() override;
+
+    //! @brief  Draw the next two dimensions of the current state.
+    //!
+    //! @param  u   The first canonical number in [0,1).
+    //! @param  v   The second canonical number in [0,1).
+    void        Get2D( float& u , float& v ) override {
+        u = Get1D();
+        v = Get1D();
+    }
+
+    //! @brief  Get the next dimension of the current state to be drawn.
+    //!
+    //! @return     The dimension.
+    unsigned    GetDimension() const override {
+        return m_dimension;
+    }
+
+    //! @brief  Samples are drawn from the current state of the chain, not from any pixel.
+    void        StartPixelSample( int x , int y , unsigned index , unsigned dimension = 0 ) override {
+        m_dimension = dimension;
+    }
+
+    //! @brief  The array based interface draws dimensions one after another.
+    void        Generate1D( float* sample , unsigned num , bool accept_uniform = false ) const override;
+
+    //! @brief  The array based interface draws dimensions one after another.
+    void        Generate2D( float* sample , unsigned num , bool accept_uniform = false ) const override;
+
+private:
+    //! @brief  A dimension of the primary samples.
+    struct PrimarySample{
+        float               value = 0.0f;           /**< The canonical number. */
+        unsigned long long  modified = 0;           /**< The iteration of the last mutation. */
+        float               backup = 0.0f;          /**< The value before the current mutation. */
+        unsigned long long  modifiedBackup = 0;     /**< The iteration of the last mutation before the current one. */
+    };
+
+    //! @brief  Draw a canonical number from the stream of the sampler.
+    float       canonical();
+
+    //! @brief  Catch up with the steps a dimension missed and mutate it in the current iteration.
+    //!
+    //! @param  i           The dimension.
+    void        ensureReady( unsigned i );
+
+    std::vector<PrimarySample>  m_samples;                  /**< Primary samples of the current state. */
+    RandomState                 m_random;                   /**< Stream mutating the samples. */
+    const float                 m_sigma;                    /**< Standard deviation of small steps. */
+    const float                 m_largeStepProb;            /**< Probability of taking a large step. */
+    unsigned long long          m_iteration = 0;            /**< The current iteration. */
+    unsigned long long          m_lastLargeStep = 0;        /**< The iteration of the last large step accepted. */
+    bool                        m_largeStep = true;         /**< Whether the current iteration is a large step. */
+    unsigned                    m_dimension = 0;            /**< The next dimension to be drawn. */
+};
+
+//! @brief  Primary sample space Metropolis light transport.
+/**
+ * This is the algorithm from 'A Simple and Robust Mutation Strategy for the Metropolis Light Transport Algorithm' on top
+ * of bidirectional path tracing. A state of the Markov chain is the set of primary samples driving a bidirectional
+ * sample, which starts with a point on the whole image instead of a pixel. The chain visits states proportionally to
+ * the brightness of all radiance they bring to the image, paths through narrow openings are found once and explored
+ * around afterward instead of being hit by chance over and over.
+ *
+ * The normalization factor, the average brightness over the primary sample space, is estimated by bootstrap samples
+ * evaluated in parallel before rendering. Chains start from bootstrap samples picked proportionally to their brightness,
+ * so there is no start-up bias. Many independent chains are run in light path tasks spread over all workers. Both the
+ * current and the proposed state are splatted weighted by the acceptance probability, which is known as expected value
+ * splatting. The whole image is made of splats, camera rays of tiles bring nothing.
+ *
+ * Random numbers drawn directly by materials instead of through the sampler are not part of the state, they only add a
+ * bit of noise to the mutations.
+ */
+class MetropolisLightTransport : public BidirPathTracing{
+public:
+    DEFINE_RTTI( MetropolisLightTransport , Integrator );
+
+    //! @brief  Camera rays of tiles bring nothing, all radiance is splatted by the chains.
+    //!
+    //! @return                 Always zero.
+    Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene ) const override {
+        return 0.0f;
+    }
+
+    //! @brief  Estimate the normalization factor and pick the starting states of the chains.
+    //!
+    //! @param  scene           The scene to be evaluated.
+    void        PreProcess( const Scene& scene ) override;
+
+    //! @brief  Each chain is a light path, the chains of the whole image are spread over the light path tasks.
+    //!
+    //! @return                 Number of chains.
+    unsigned long long GetLightPathCnt() const override;
+
+    //! @brief  Chains are long enough to be tasks on their own.
+    //!
+    //! @return                 Number of chains in a light path task.
+    unsigned int GetLightPathBatchSize() const override {
+        return 1;
+    }
+
+    //! @brief  Run a Markov chain and splat all states it visits.
+    //!
+    //! @param  scene           The scene to be evaluated.
+    //! @param  index           Index of the chain.
+    void        TraceLightPath( const Scene& scene , unsigned long long index ) const override;
+
+    //! @brief  The whole image is made of splats.
+    bool NeedSplatFilm() const override {
+        return true;
+    }
+
+    //! @brief  There is no specific order of rendering, there is no way to support live refresh.
+    bool NeedRefreshTile() const override {
+        return false;
+    }
+
+    //! @brief  Nothing is requested from the sampler of tiles.
+    void RequestSample( Sampler* sampler , PixelSample* ps , unsigned ps_num ) override {}
+
+    //! @brief      Serializing data from stream
+    //!
+    //! @param      Stream where the serialization data comes from. Depending on different situation, it could come from different places.
+    void    Serialize( IStreamBase& stream ) override {
+        BidirPathTracing::Serialize( stream );
+        stream >> m_bootstrapCnt;
+        stream >> m_chainCnt;
+        stream >> m_largeStepProb;
+        stream >> m_sigma;
+    }
+
+protected:
+    //! @brief  Radiance of light vertices connected to the camera is part of the state being evaluated.
+    //!
+    //! @param  x               Horizontal coordinate of the pixel.
+    //! @param  y               Vertical coordinate of the pixel.
+    //! @param  radiance        The radiance reaching the pixel.
+    void        _SplatRadiance( int x , int y , const Spectrum& radiance ) const override;
+
+private:
+    //! @brief  Evaluate the state of a chain, which is the bidirectional sample driven by the bound sampler.
+    //!
+    //! @param  scene           The scene to be evaluated.
+    //! @param  contribution    All radiance the state brings to the image.
+    //! @return                 The brightness of the state, it is the target density of the chain up to a constant.
+    float       evaluate( const Scene& scene , std::vector<Pending_Sample>& contribution ) const;
+
+    //! @brief  Splat the radiance of a state.
+    //!
+    //! @param  contribution    All radiance the state brings to the image.
+    //! @param  weight          Weight of the state.
+    void        splat( const std::vector<Pending_Sample>& contribution , float weight ) const;
+
+    int         m_bootstrapCnt = 100000;    /**< Number of bootstrap samples estimating the normalization factor. */
+    int         m_chainCnt = 1024;          /**< Number of independent Markov chains. */
+    float       m_largeStepProb = 0.3f;     /**< Probability of a large step. */
+    float       m_sigma = 0.01f;            /**< Standard deviation of small steps. */
+
+    std::vector<double>     m_bootstrapCdf;         /**< Running sum of the brightness of bootstrap samples. */
+    float                   m_normalization = 0.0f; /**< Average brightness over the primary sample space. */
+    unsigned long long      m_mutationCnt = 0;      /**< Number of mutations of each chain. */
+    float                   m_splatScale = 0.0f;    /**< Normalization factor spread over all mutations. */
+
+    SORT_STATS_ENABLE( "Metropolis Light Transport" )
+};
@@ -0,0 +1,169 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include "occlusiongrid.h"
+#include "core/scene.h"
+#include "core/primitive.h"
+#include "core/stats.h"
+#include "math/ray.h"
+#include "shape/instance.h"
+
+SORT_STATS_DEFINE_COUNTER(sOcclusionGridQuery)
+SORT_STATS_DEFINE_COUNTER(sOcclusionGridOccluded)
+SORT_STATS_DEFINE_COUNTER(sOcclusionGridCell)
+SORT_STATS_DEFINE_COUNTER(sOcclusionGridOccupiedCell)
+
+SORT_STATS_COUNTER("Occlusion Grid", "Shadow Rays", sOcclusionGridQuery);
+SORT_STATS_RATIO("Occlusion Grid", "Occluded Shadow Rays", sOcclusionGridOccluded, sOcclusionGridQuery);
+SORT_STATS_COUNTER("Occlusion Grid", "Cells", sOcclusionGridCell);
+SORT_STATS_RATIO("Occlusion Grid", "Occupied Cells", sOcclusionGridOccupiedCell, sOcclusionGridCell);
+
+void OcclusionGrid::Build( const Scene& scene , unsigned resolution ){
+    // cells are cubes, the grid is slightly larger than the scene on the shorter axes
+    m_bbox = scene.GetBBox();
+    const auto extent = m_bbox.m_Max - m_bbox.m_Min;
+    const auto cell_size = std::max( { extent.x , extent.y , extent.z , 1e-4f } ) / std::max( resolution , 1u );
+    for( auto i = 0 ; i < 3 ; ++i ){
+        m_res[i] = std::max( 1 , (int)std::ceil( extent[i] / cell_size ) );
+        m_cellSize[i] = cell_size;
+        m_invCellSize[i] = 1.0f / cell_size;
+        m_bbox.m_Max[i] = m_bbox.m_Min[i] + m_res[i] * cell_size;
+    }
+
+    // the cells holding the ends of a shadow ray and their neighbors around the diagonal
+    m_skip = cell_size * 1.733f;
+
+    const auto cell_cnt = (std::size_t)m_res[0] * m_res[1] * m_res[2];
+    m_occupancy.assign( ( cell_cnt + 63 ) / 64 , 0 );
+
+    for( const auto primitive : scene.GetPrimitives() ){
+        if( primitive->GetShapeType() != SHAPE_INSTANCE ){
+            mark( primitive->GetBBox() , [&]( const BBox& cell ){ return primitive->GetIntersect( cell ); } );
+            continue;
+        }
+
+        // instances are voxelized by the boxes of the triangles of their prototypes, which is tight enough for small
+        // triangles. Moving instances only occupy the cells at the beginning of their segments.
+        const auto instance = static_cast<const Instance*>( primitive->GetShape() );
+        const auto& transform = instance->GetTransform();
+        for( const auto local : instance->GetPrototype().GetPrimitives() )
+            mark( transform.TransformBBox( local->GetBBox() ) , []( const BBox& ){ return true; } );
+    }
+
+    SORT_STATS(sOcclusionGridCell += cell_cnt);
+    for( const auto bits : m_occupancy )
+        SORT_STATS(sOcclusionGridOccupiedCell += std::bitset<64>( bits ).count());
+}
+
+bool OcclusionGrid::IsOccluded( const Ray& ray ) const{
+    if( m_occupancy.empty() )
+        return false;
+    SORT_STATS(++sOcclusionGridQuery);
+
+    const auto len = ray.m_Dir.Length();
+    if( len <= 0.0f )
+        return false;
+
+    // only the part of the ray away from both ends and inside the grid is walked through
+    auto t0 = ray.m_fMin + m_skip / len;
+    auto t1 = ray.m_fMax - m_skip / len;
+    for( auto i = 0 ; i < 3 ; ++i ){
+        const auto inv = 1.0f / ray.m_Dir[i];
+        auto t_near = ( m_bbox.m_Min[i] - ray.m_Ori[i] ) * inv;
+        auto t_far = ( m_bbox.m_Max[i] - ray.m_Ori[i] ) * inv;
+        if( t_near > t_far )
+            std::swap( t_near , t_far );
+        // NaN from axis aligned rays on the boundary of the grid doesn't clip anything
+        t0 = std::max( t0 , t_near );
+        t1 = std::min( t1 , t_far );
+    }
+    if( t0 > t1 )
+        return false;
+
+    // 3D-DDA from the first cell
+    const auto p = ray( t0 );
+    int cell[3] , step[3];
+    float t_max[3] , t_delta[3];
+    for( auto i = 0 ; i < 3 ; ++i ){
+        cell[i] = std::min( std::max( (int)std::floor( ( p[i] - m_bbox.m_Min[i] ) * m_invCellSize[i] ) , 0 ) , m_res[i] - 1 );
+        if( ray.m_Dir[i] > 0.0f ){
+            step[i] = 1;
+            t_max[i] = t0 + ( m_bbox.m_Min[i] + ( cell[i] + 1 ) * m_cellSize[i] - p[i] ) / ray.m_Dir[i];
+            t_delta[i] = m_cellSize[i] / ray.m_Dir[i];
+        }else if( ray.m_Dir[i] < 0.0f ){
+            step[i] = -1;
+            t_max[i] = t0 + ( m_bbox.m_Min[i] + cell[i] * m_cellSize[i] - p[i] ) / ray.m_Dir[i];
+            t_delta[i] = -m_cellSize[i] / ray.m_Dir[i];
+        }else{
+            step[i] = 0;
+            t_max[i] = FLT_MAX;
+            t_delta[i] = FLT_MAX;
+        }
+    }
+
+    while( true ){
+        if( IsOccupied( cell[0] , cell[1] , cell[2] ) ){
+            SORT_STATS(++sOcclusionGridOccluded);
+            return true;
+        }
+
+        const auto axis = t_max[0] < t_max[1] ? ( t_max[0] < t_max[2] ? 0 : 2 ) : ( t_max[1] < t_max[2] ? 1 : 2 );
+        if( t_max[axis] > t1 )
+            return false;
+        cell[axis] += step[axis];
+        if( cell[axis] < 0 || cell[axis] >= m_res[axis] )
+            return false;
+        t_max[axis] += t_delta[axis];
+    }
+}
+
+bool OcclusionGrid::IsOccupied( int x , int y , int z ) const{
+    if( x < 0 || y < 0 || z < 0 || x >= m_res[0] || y >= m_res[1] || z >= m_res[2] )
+        return false;
+    const auto index = ( (std::size_t)z * m_res[1] + y ) * m_res[0] + x;
+    return ( m_occupancy[index >> 6] >> ( index & 63 ) ) & 1;
+}
+
+template<class Overlap>
+void OcclusionGrid::mark( const BBox& bbox , Overlap&& overlap ){
+    int lo[3] , hi[3];
+    for( auto i = 0 ; i < 3 ; ++i ){
+        if( !( bbox.m_Min[i] <= bbox.m_Max[i] ) )
+            return;
+        lo[i] = std::min( std::max( (int)std::floor( ( bbox.m_Min[i] - m_bbox.m_Min[i] ) * m_invCellSize[i] ) , 0 ) , m_res[i] - 1 );
+        hi[i] = std::min( std::max( (int)std::floor( ( bbox.m_Max[i] - m_bbox.m_Min[i] ) * m_invCellSize[i] ) , 0 ) , m_res[i] - 1 );
+    }
+
+    for( auto z = lo[2] ; z <= hi[2] ; ++z ){
+        for( auto y = lo[1] ; y <= hi[1] ; ++y ){
+            for( auto x = lo[0] ; x <= hi[0] ; ++x ){
+                const auto index = ( (std::size_t)z * m_res[1] + y ) * m_res[0] + x;
+                auto& bits = m_occupancy[index >> 6];
+                const auto bit = std::uint64_t(1) << ( index & 63 );
+                if( bits & bit )
+                    continue;
+
+                const auto min = m_bbox.m_Min + Vector( x * m_cellSize.x , y * m_cellSize.y , z * m_cellSize.z );
+                if( overlap( BBox( min , min + m_cellSize ) ) )
+                    bits |= bit;
+            }
+        }
+    }
+}
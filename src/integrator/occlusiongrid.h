@@ -0,0 +1,69 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "math/bbox.h"
+
+class Scene;
+class Ray;
+
+//! @brief  Coarse voxelized occupancy of the scene, it answers shadow rays approximately for fast previews.
+/**
+ * The bounding box of the scene is split into cells, a cell is occupied if any primitive overlaps it. A shadow ray is
+ * occluded if it walks through any occupied cell, which is a 3D-DDA through a bit array instead of a full traversal of
+ * the accelerator.
+ *
+ * The cells around both ends of a shadow ray are always occupied by the surfaces the ray connects, they are skipped.
+ * Occluders close to either end are missed and thin gaps between occluders are closed, shadows in corners are
+ * lighter and light leaking through small holes is lost. It is only accurate enough for lighting that is already
+ * blurred by a bounce or two.
+ */
+class OcclusionGrid{
+public:
+    //! @brief  Voxelize all primitives in the scene.
+    //!
+    //! @param  scene       The scene to be voxelized, its accelerator doesn't need to be built.
+    //! @param  resolution  Number of cells along the longest axis of the scene.
+    void    Build( const Scene& scene , unsigned resolution );
+
+    //! @brief  Whether the ray is blocked by any occupied cell.
+    //!
+    //! @param  ray         The shadow ray, only the part between its minimum and maximum distance is tested.
+    //! @return             Whether the ray is considered occluded.
+    bool    IsOccluded( const Ray& ray ) const;
+
+    //! @brief  Whether a cell is occupied, cells outside the grid are empty.
+    bool    IsOccupied( int x , int y , int z ) const;
+
+private:
+    BBox                        m_bbox;                 /**< Bounding box of the grid. */
+    int                         m_res[3] = { 0 , 0 , 0 };   /**< Number of cells along each axis. */
+    Vector                      m_cellSize;             /**< Size of a cell. */
+    Vector                      m_invCellSize;          /**< Inverse of the size of a cell. */
+    float                       m_skip = 0.0f;          /**< Distance around both ends of shadow rays where cells are skipped. */
+    std::vector<std::uint64_t>  m_occupancy;            /**< One bit per cell, x goes first, then y and z. */
+
+    //! @brief  Mark the cells inside a box that overlap a primitive.
+    //!
+    //! @param  bbox        Bounding box of the primitive in world space.
+    //! @param  overlap     Whether the primitive overlaps the box of a cell.
+    template<class Overlap>
+    void    mark( const BBox& bbox , Overlap&& overlap );
+};
@@ -0,0 +1,546 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include "pathguiding.h"
+#include "math/utils.h"
+#include "math/vector2.h"
+#include "core/profile.h"
+#include "stream/fstream.h"
+
+static constexpr unsigned int PATH_GUIDING_CACHE_MAGIC      = 0x43475053;
+static constexpr unsigned int PATH_GUIDING_CACHE_VERSION    = 1;
+// Cached trees larger than this are treated as corrupted instead of being allocated.
+static constexpr unsigned int PATH_GUIDING_CACHE_MAX_NODES  = 1u << 24;
+
+// map a direction to the unit square with cylindrical mapping, which preserves area
+static SORT_FORCEINLINE Vector2f dirToSquare( const Vector& dir ){
+    const auto cos_theta = clamp( dir.y , -1.0f , 1.0f );
+    auto phi = std::atan2( dir.z , dir.x );
+    if( phi < 0.0f )
+        phi += TWO_PI;
+    return Vector2f( clamp( ( cos_theta + 1.0f ) * 0.5f , 0.0f , 1.0f ) , clamp( phi * INV_TWOPI , 0.0f , 1.0f ) );
+}
+
+// map a point in the unit square back to a direction
+static SORT_FORCEINLINE Vector squareToDir( const Vector2f& p ){
+    const auto cos_theta = 2.0f * p.x - 1.0f;
+    const auto sin_theta = std::sqrt( std::max( 0.0f , 1.0f - cos_theta * cos_theta ) );
+    const auto phi = TWO_PI * p.y;
+    return Vector( sin_theta * std::cos( phi ) , cos_theta , sin_theta * std::sin( phi ) );
+}
+
+// pick the quadrant covering a point and map the point to the unit square of the quadrant
+static SORT_FORCEINLINE unsigned pickQuadrant( Vector2f& p ){
+    const auto qu = p.x >= 0.5f ? 1u : 0u;
+    const auto qv = p.y >= 0.5f ? 1u : 0u;
+    p.x = std::min( p.x * 2.0f - (float)qu , 1.0f );
+    p.y = std::min( p.y * 2.0f - (float)qv , 1.0f );
+    return qu | ( qv << 1 );
+}
+
+// there is no atomic add for float before C++20
+static SORT_FORCEINLINE void atomicAdd( std::atomic<float>& v , float delta ){
+    auto cur = v.load( std::memory_order_relaxed );
+    while( !v.compare_exchange_weak( cur , cur + delta , std::memory_order_relaxed ) );
+}
+
+DTree::DTree_Node::DTree_Node(){
+    for( auto i = 0 ; i < 4 ; ++i )
+        sum[i].store( 0.0f , std::memory_order_relaxed );
+}
+
+DTree::DTree_Node::DTree_Node( const DTree_Node& node ){
+    *this = node;
+}
+
+DTree::DTree_Node& DTree::DTree_Node::operator = ( const DTree_Node& node ){
+    for( auto i = 0 ; i < 4 ; ++i ){
+        sum[i].store( node.sum[i].load( std::memory_order_relaxed ) , std::memory_order_relaxed );
+        child[i] = node.child[i];
+    }
+    return *this;
+}
+
+DTree::DTree() : m_nodes( 1 ) , m_sampleCnt( 0 ){
+}
+
+DTree::DTree( const DTree& tree ) : m_sampleCnt( 0 ){
+    *this = tree;
+}
+
+DTree& DTree::operator = ( const DTree& tree ){
+    m_nodes = tree.m_nodes;
+    m_sampleCnt.store( tree.m_sampleCnt.load( std::memory_order_relaxed ) , std::memory_order_relaxed );
+    m_sum = tree.m_sum;
+    return *this;
+}
+
+void DTree::Record( const Vector& dir , float value ){
+    m_sampleCnt.fetch_add( 1 , std::memory_order_relaxed );
+    if( !( value > 0.0f ) || !std::isfinite( value ) )
+        return;
+
+    // only the leaf quadrant is touched, interior quadrants are summed up once training is done
+    auto p = dirToSquare( dir );
+    auto node = 0u;
+    while( true ){
+        const auto q = pickQuadrant( p );
+        const auto child = m_nodes[node].child[q];
+        if( 0 == child ){
+            atomicAdd( m_nodes[node].sum[q] , value );
+            return;
+        }
+        node = child;
+    }
+}
+
+void DTree::Build(){
+    // children always come after their parents, iterating backward visits children first
+    for( auto i = (int)m_nodes.size() - 1 ; i >= 0 ; --i ){
+        auto& node = m_nodes[i];
+        for( auto q = 0 ; q < 4 ; ++q ){
+            if( 0 == node.child[q] )
+                continue;
+            const auto& child = m_nodes[node.child[q]];
+            auto sum = 0.0f;
+            for( auto k = 0 ; k < 4 ; ++k )
+                sum += child.sum[k].load( std::memory_order_relaxed );
+            node.sum[q].store( sum , std::memory_order_relaxed );
+        }
+    }
+
+    m_sum = 0.0f;
+    for( auto q = 0 ; q < 4 ; ++q )
+        m_sum += m_nodes[0].sum[q].load( std::memory_order_relaxed );
+}
+
+Vector DTree::Sample( float u , float v , float* pdf ) const{
+    // nothing is learned, fall back to uniform sampling
+    if( m_sum <= 0.0f ){
+        if( pdf )
+            *pdf = INV_FOUR_PI;
+        return squareToDir( Vector2f( u , v ) );
+    }
+
+    Vector2f origin( 0.0f , 0.0f );
+    auto scale = 1.0f;
+    auto pdf_square = 1.0f;
+    auto node = 0u;
+    while( true ){
+        const auto& n = m_nodes[node];
+        float s[4];
+        for( auto q = 0 ; q < 4 ; ++q )
+            s[q] = n.sum[q].load( std::memory_order_relaxed );
+        const auto total = s[0] + s[1] + s[2] + s[3];
+        if( total <= 0.0f )
+            break;
+
+        // pick the column first, then the quadrant in the column, each pick reuses what is left in the random number
+        const auto p_low_u = ( s[0] + s[2] ) / total;
+        auto qu = 0u;
+        if( u < p_low_u ){
+            u = u / p_low_u;
+        }else{
+            u = ( u - p_low_u ) / ( 1.0f - p_low_u );
+            qu = 1u;
+        }
+        const auto column = s[qu] + s[qu + 2];
+        const auto p_low_v = column > 0.0f ? s[qu] / column : 0.5f;
+        auto qv = 0u;
+        if( v < p_low_v ){
+            v = v / p_low_v;
+        }else{
+            v = ( v - p_low_v ) / ( 1.0f - p_low_v );
+            qv = 1u;
+        }
+        u = std::min( u , 1.0f - FLT_EPSILON );
+        v = std::min( v , 1.0f - FLT_EPSILON );
+
+        const auto q = qu | ( qv << 1 );
+        pdf_square *= 4.0f * s[q] / total;
+
+        scale *= 0.5f;
+        origin.x += (float)qu * scale;
+        origin.y += (float)qv * scale;
+
+        if( 0 == n.child[q] )
+            break;
+        node = n.child[q];
+    }
+
+    if( pdf )
+        *pdf = pdf_square * INV_FOUR_PI;
+    return squareToDir( Vector2f( origin.x + u * scale , origin.y + v * scale ) );
+}
+
+float DTree::Pdf( const Vector& dir ) const{
+    if( m_sum <= 0.0f )
+        return INV_FOUR_PI;
+
+    auto p = dirToSquare( dir );
+    auto pdf_square = 1.0f;
+    auto node = 0u;
+    while( true ){
+        const auto& n = m_nodes[node];
+        auto total = 0.0f;
+        for( auto q = 0 ; q < 4 ; ++q )
+            total += n.sum[q].load( std::memory_order_relaxed );
+        if( total <= 0.0f )
+            break;
+
+        const auto q = pickQuadrant( p );
+        const auto s = n.sum[q].load( std::memory_order_relaxed );
+        if( s <= 0.0f )
+            return 0.0f;
+        pdf_square *= 4.0f * s / total;
+
+        if( 0 == n.child[q] )
+            break;
+        node = n.child[q];
+    }
+    return pdf_square * INV_FOUR_PI;
+}
+
+DTree DTree::Refine() const{
+    DTree ret;
+    if( m_sum <= 0.0f )
+        return ret;
+
+    // quadrants turned into leaves in this tree are subdivided virtually, their energy is evenly distributed in the new quadrants
+    struct StackItem{
+        unsigned    node;           /**< Node in the new tree. */
+        int         source;         /**< Node in this tree covering the same region, -1 if the region is a leaf quadrant in this tree. */
+        float       fraction;       /**< Energy fraction of the region. */
+        unsigned    depth;          /**< Depth of the node. */
+    };
+    std::vector<StackItem> stack;
+    stack.push_back( { 0u , 0 , 1.0f , 1u } );
+    while( !stack.empty() ){
+        const auto item = stack.back();
+        stack.pop_back();
+
+        for( auto q = 0u ; q < 4u ; ++q ){
+            auto source = -1;
+            auto fraction = item.fraction * 0.25f;
+            if( item.source >= 0 ){
+                const auto& n = m_nodes[item.source];
+                fraction = n.sum[q].load( std::memory_order_relaxed ) / m_sum;
+                source = n.child[q] ? (int)n.child[q] : -1;
+            }
+
+            if( item.depth >= DTREE_MAX_DEPTH || fraction <= DTREE_SUBDIVISION_THRESHOLD )
+                continue;
+
+            const auto child = (unsigned)ret.m_nodes.size();
+            ret.m_nodes.emplace_back();
+            ret.m_nodes[item.node].child[q] = child;
+            stack.push_back( { child , source , fraction , item.depth + 1 } );
+        }
+    }
+    return ret;
+}
+
+void DTree::Save( OStreamBase& stream ) const{
+    stream << GetSampleCount() << (unsigned)m_nodes.size();
+    for( const auto& node : m_nodes ){
+        for( auto q = 0 ; q < 4 ; ++q )
+            stream << node.sum[q].load( std::memory_order_relaxed ) << node.child[q];
+    }
+}
+
+bool DTree::Load( IStreamBase& stream ){
+    auto sample_cnt = 0u , node_cnt = 0u;
+    stream >> sample_cnt >> node_cnt;
+    if( 0 == node_cnt || node_cnt > PATH_GUIDING_CACHE_MAX_NODES )
+        return false;
+
+    // children always come after their parents, so that 'Build' works and no lookup loops forever
+    std::vector<DTree_Node> nodes( node_cnt );
+    for( auto i = 0u ; i < node_cnt ; ++i ){
+        for( auto q = 0 ; q < 4 ; ++q ){
+            auto sum = 0.0f;
+            auto child = 0u;
+            stream >> sum >> child;
+            if( !( sum >= 0.0f ) || !std::isfinite( sum ) )
+                return false;
+            if( child != 0 && ( child <= i || child >= node_cnt ) )
+                return false;
+            nodes[i].sum[q].store( sum , std::memory_order_relaxed );
+            nodes[i].child[q] = child;
+        }
+    }
+
+    m_nodes = std::move( nodes );
+    m_sampleCnt.store( sample_cnt , std::memory_order_relaxed );
+    Build();
+    return true;
+}
+
+SDTree::SDTree( const BBox& bbox ) : m_bbox( bbox ) , m_nodes( 1 ) , m_dtrees( 1 ){
+}
+
+void SDTree::Record( const Point& p , const Vector& dir , float value ){
+    const_cast<DTree&>( locate( p ) ).Record( dir , value );
+}
+
+void SDTree::Build(){
+    for( auto& dtree : m_dtrees )
+        dtree.Build();
+}
+
+Vector SDTree::Sample( const Point& p , float u , float v , float* pdf ) const{
+    return locate( p ).Sample( u , v , pdf );
+}
+
+float SDTree::Pdf( const Point& p , const Vector& dir ) const{
+    return locate( p ).Pdf( dir );
+}
+
+std::unique_ptr<SDTree> SDTree::Refine( unsigned iteration ) const{
+    SORT_PROFILE("Refine Guiding Tree");
+
+    auto ret = std::make_unique<SDTree>( m_bbox );
+    ret->m_nodes.clear();
+    ret->m_dtrees.clear();
+
+    const auto threshold = (unsigned)( (float)SDTREE_SPLIT_THRESHOLD * std::sqrt( (float)( 1u << std::min( iteration , 31u ) ) ) );
+
+    // leaves with enough samples are split until each part is expected to have less than the threshold, all parts inherit the same directional tree
+    std::function<unsigned( const DTree& , unsigned , unsigned )> split_leaf = [&]( const DTree& dtree , unsigned sample_cnt , unsigned depth ){
+        const auto node = (unsigned)ret->m_nodes.size();
+        ret->m_nodes.emplace_back();
+        if( sample_cnt > threshold && depth < SDTREE_MAX_DEPTH ){
+            const auto c0 = split_leaf( dtree , sample_cnt / 2 , depth + 1 );
+            const auto c1 = split_leaf( dtree , sample_cnt / 2 , depth + 1 );
+            ret->m_nodes[node].child[0] = c0;
+            ret->m_nodes[node].child[1] = c1;
+        }else{
+            ret->m_nodes[node].dtree = (unsigned)ret->m_dtrees.size();
+            ret->m_dtrees.push_back( dtree );
+        }
+        return node;
+    };
+
+    std::function<unsigned( unsigned , unsigned )> copy_node = [&]( unsigned source , unsigned depth ){
+        const auto& n = m_nodes[source];
+        if( 0 == n.child[0] ){
+            const auto& dtree = m_dtrees[n.dtree];
+            return split_leaf( dtree.Refine() , dtree.GetSampleCount() , depth );
+        }
+
+        const auto node = (unsigned)ret->m_nodes.size();
+        ret->m_nodes.emplace_back();
+        const auto c0 = copy_node( n.child[0] , depth + 1 );
+        const auto c1 = copy_node( n.child[1] , depth + 1 );
+        ret->m_nodes[node].child[0] = c0;
+        ret->m_nodes[node].child[1] = c1;
+        return node;
+    };
+    copy_node( 0 , 0 );
+
+    return ret;
+}
+
+void SDTree::Save( OStreamBase& stream ) const{
+    stream << m_bbox.m_Min << m_bbox.m_Max;
+    stream << (unsigned)m_nodes.size();
+    for( const auto& node : m_nodes )
+        stream << node.child[0] << node.child[1] << node.dtree;
+    stream << (unsigned)m_dtrees.size();
+    for( const auto& dtree : m_dtrees )
+        dtree.Save( stream );
+}
+
+bool SDTree::Load( IStreamBase& stream ){
+    BBox bbox;
+    stream >> bbox.m_Min >> bbox.m_Max;
+
+    auto node_cnt = 0u;
+    stream >> node_cnt;
+    if( 0 == node_cnt || node_cnt > PATH_GUIDING_CACHE_MAX_NODES )
+        return false;
+    std::vector<SDTree_Node> nodes( node_cnt );
+    for( auto& node : nodes )
+        stream >> node.child[0] >> node.child[1] >> node.dtree;
+
+    auto dtree_cnt = 0u;
+    stream >> dtree_cnt;
+    if( 0 == dtree_cnt || dtree_cnt > node_cnt )
+        return false;
+
+    // interior nodes have both children after them, leaves point to a valid directional tree
+    for( auto i = 0u ; i < node_cnt ; ++i ){
+        const auto& node = nodes[i];
+        if( 0 == node.child[0] && 0 == node.child[1] ){
+            if( node.dtree >= dtree_cnt )
+                return false;
+            continue;
+        }
+        for( const auto child : node.child )
+            if( child <= i || child >= node_cnt )
+                return false;
+    }
+
+    std::vector<DTree> dtrees( dtree_cnt );
+    for( auto& dtree : dtrees )
+        if( !dtree.Load( stream ) )
+            return false;
+
+    m_bbox = bbox;
+    m_nodes = std::move( nodes );
+    m_dtrees = std::move( dtrees );
+    return true;
+}
+
+const DTree& SDTree::locate( const Point& p ) const{
+    auto bbox = m_bbox;
+    auto node = 0u;
+    auto axis = 0u;
+    while( 0 != m_nodes[node].child[0] ){
+        const auto mid = ( bbox.m_Min[axis] + bbox.m_Max[axis] ) * 0.5f;
+        if( p[axis] < mid ){
+            bbox.m_Max[axis] = mid;
+            node = m_nodes[node].child[0];
+        }else{
+            bbox.m_Min[axis] = mid;
+            node = m_nodes[node].child[1];
+        }
+        axis = ( axis + 1 ) % 3;
+    }
+    return m_dtrees[m_nodes[node].dtree];
+}
+
+void PathGuiding::Initialize( const BBox& bbox , unsigned long long samplePerIter ){
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    m_trees.clear();
+    m_trees.push_back( std::make_unique<SDTree>( bbox ) );
+    m_trainingTree.store( m_trees.back().get() , std::memory_order_release );
+    m_samplingTree.store( nullptr , std::memory_order_release );
+
+    m_samplePerIter = std::max( 1ull , samplePerIter );
+    m_iteration = 0;
+    m_samplingSpp = 0.0f;
+    m_sampleCnt.store( 0 , std::memory_order_relaxed );
+    m_iterationEnd.store( m_samplePerIter , std::memory_order_relaxed );
+}
+
+void PathGuiding::FinishSample(){
+    // exactly one thread counts the last sample of the iteration
+    const auto cnt = m_sampleCnt.fetch_add( 1 , std::memory_order_relaxed ) + 1;
+    if( cnt != m_iterationEnd.load( std::memory_order_relaxed ) )
+        return;
+
+    SORT_PROFILE("Path Guiding Iteration");
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    // other threads may still record in the training tree, the copy is built instead so that it is consistent
+    auto sampling = std::make_unique<SDTree>( *m_trainingTree.load( std::memory_order_acquire ) );
+    sampling->Build();
+
+    m_samplingSpp = (float)( 1u << std::min( m_iteration , 16u ) );
+    ++m_iteration;
+    auto training = sampling->Refine( m_iteration );
+
+    m_samplingTree.store( sampling.get() , std::memory_order_release );
+    m_trainingTree.store( training.get() , std::memory_order_release );
+    m_trees.push_back( std::move( sampling ) );
+    m_trees.push_back( std::move( training ) );
+
+    // each iteration takes twice as many samples as the previous one
+    m_iterationEnd.store( cnt + ( m_samplePerIter << std::min( m_iteration , 16u ) ) , std::memory_order_relaxed );
+}
+
+bool PathGuiding::LoadCache( const std::string& filename , std::uint64_t key , float decay ){
+    SORT_PROFILE("Load Path Guiding Cache");
+
+    // IFileStream complains about missing files, a missing cache is totally expected though.
+    if( !std::ifstream( filename ).good() )
+        return false;
+
+    IFileStream stream( filename );
+    unsigned int magic = 0 , version = 0 , key_lo = 0 , key_hi = 0;
+    stream >> magic >> version >> key_lo >> key_hi;
+    if( magic != PATH_GUIDING_CACHE_MAGIC || version != PATH_GUIDING_CACHE_VERSION )
+        return false;
+    if( key_lo != (unsigned int)( key & 0xffffffff ) || key_hi != (unsigned int)( key >> 32 ) )
+        return false;
+
+    auto spp = 0.0f;
+    stream >> spp;
+    auto tree = std::make_unique<SDTree>( BBox() );
+    if( !tree->Load( stream ) )
+        return false;
+
+    // a truncated file doesn't end with the magic number
+    magic = 0;
+    stream >> magic;
+    if( magic != PATH_GUIDING_CACHE_MAGIC )
+        return false;
+
+    // the loaded tree counts as fewer samples each time it is carried over, it is replaced sooner if nothing keeps refreshing it
+    spp *= clamp( decay , 0.0f , 1.0f );
+    if( !( spp > 0.0f ) )
+        return false;
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+
+    // iterations shorter than the samples of the loaded tree are skipped, their trees would not be any better
+    m_iteration = std::min( (unsigned)std::max( 0.0f , std::ceil( std::log2( spp ) ) ) , 16u );
+    m_samplingSpp = spp;
+    auto training = tree->Refine( m_iteration );
+    m_samplingTree.store( tree.get() , std::memory_order_release );
+    m_trainingTree.store( training.get() , std::memory_order_release );
+    m_trees.push_back( std::move( tree ) );
+    m_trees.push_back( std::move( training ) );
+
+    m_sampleCnt.store( 0 , std::memory_order_relaxed );
+    m_iterationEnd.store( m_samplePerIter << m_iteration , std::memory_order_relaxed );
+    return true;
+}
+
+bool PathGuiding::SaveCache( const std::string& filename , std::uint64_t key ) const{
+    SORT_PROFILE("Save Path Guiding Cache");
+
+    // the training tree of an unfinished iteration is dropped, it is not built
+    const auto tree = GetSamplingTree();
+    if( !tree )
+        return false;
+
+    const auto tmp_filename = filename + ".tmp";
+    {
+        OFileStream stream( tmp_filename );
+        stream << PATH_GUIDING_CACHE_MAGIC << PATH_GUIDING_CACHE_VERSION;
+        stream << (unsigned int)( key & 0xffffffff ) << (unsigned int)( key >> 32 );
+        stream << m_samplingSpp;
+        tree->Save( stream );
+        stream << PATH_GUIDING_CACHE_MAGIC;
+    }
+
+    // the previous cache is only replaced once the new one is fully written
+    remove( filename.c_str() );
+    if( 0 != rename( tmp_filename.c_str() , filename.c_str() ) ){
+        remove( tmp_filename.c_str() );
+        return false;
+    }
+    return true;
+}
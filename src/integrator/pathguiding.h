@@ -0,0 +1,260 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "math/bbox.h"
+#include "math/vector3.h"
+#include "math/point.h"
+#include "stream/stream.h"
+
+//! @brief  Energy fraction above which a quadrant of a directional tree is subdivided in the next iteration.
+constexpr float     DTREE_SUBDIVISION_THRESHOLD     = 0.01f;
+//! @brief  Maximum depth of a directional tree.
+constexpr unsigned  DTREE_MAX_DEPTH                 = 20;
+//! @brief  Scaling of the number of samples a spatial leaf needs before it is split, it grows with the square root of the iteration.
+constexpr unsigned  SDTREE_SPLIT_THRESHOLD          = 12000;
+//! @brief  Maximum depth of the spatial tree.
+constexpr unsigned  SDTREE_MAX_DEPTH                = 48;
+
+//! @brief  Directional quad-tree learning the distribution of incident radiance at a region in the scene.
+/**
+ * Directions are mapped to the unit square with the cylindrical mapping, which preserves area, the pdf w.r.t solid angle is
+ * the pdf in the unit square divided by 4 * PI. Each node splits its part of the square into four quadrants, the energy of
+ * each quadrant is recorded in the node. During training, radiance is only accumulated in the leaf quadrants with atomic
+ * operations so that all threads can record into the same tree without locks. 'Build' sums the energy of interior quadrants
+ * afterwards, only then the tree can be sampled.
+ */
+class DTree{
+public:
+    //! @brief  The tree starts with one node of four quadrants.
+    DTree();
+
+    //! @brief  Copy a tree, the values are copied while nobody writes to the source tree.
+    DTree( const DTree& tree );
+
+    //! @brief  Copy a tree, the values are copied while nobody writes to the source tree.
+    DTree& operator = ( const DTree& tree );
+
+    //! @brief  Record the radiance coming from a direction, it is safe to call it from multiple threads.
+    //!
+    //! @param  dir         The direction where the radiance comes from, in world space.
+    //! @param  value       The radiance divided by the pdf of sampling the direction.
+    void        Record( const Vector& dir , float value );
+
+    //! @brief  Sum the energy of interior quadrants, the tree can only be sampled after it is built.
+    void        Build();
+
+    //! @brief  Sample a direction proportional to the learned radiance.
+    //!
+    //! @param  u           A canonical random number.
+    //! @param  v           Another canonical random number.
+    //! @param  pdf         The pdf w.r.t solid angle of sampling the direction.
+    //! @return             The sampled direction in world space.
+    Vector      Sample( float u , float v , float* pdf ) const;
+
+    //! @brief  The pdf w.r.t solid angle of sampling a direction.
+    //!
+    //! @param  dir         The direction in world space.
+    //! @return             The pdf w.r.t solid angle.
+    float       Pdf( const Vector& dir ) const;
+
+    //! @brief  Generate a tree for the next iteration, it follows the distribution of this tree without any energy in it.
+    //!
+    //! Quadrants with enough energy are subdivided, the rest of them are merged. This tree needs to be built already.
+    //!
+    //! @return             The empty tree for the next training iteration.
+    DTree       Refine() const;
+
+    //! @brief  Save the tree, nobody should be recording in it.
+    //!
+    //! @param  stream      The stream to save the tree in.
+    void        Save( OStreamBase& stream ) const;
+
+    //! @brief  Load a tree saved by 'Save', the tree is built once it is loaded.
+    //!
+    //! @param  stream      The stream to load the tree from.
+    //! @return             Whether the tree is valid, nothing in the stream is trusted.
+    bool        Load( IStreamBase& stream );
+
+    //! @brief  The number of samples recorded in the tree.
+    unsigned    GetSampleCount() const {
+        return m_sampleCnt.load( std::memory_order_relaxed );
+    }
+
+    //! @brief  The number of nodes in the tree.
+    unsigned    GetNodeCount() const {
+        return (unsigned)m_nodes.size();
+    }
+
+private:
+    //! @brief  Node of the directional tree, children always come after their parents.
+    struct DTree_Node{
+        std::atomic<float>  sum[4];                     /**< Energy of the four quadrants. */
+        unsigned            child[4] = { 0 , 0 , 0 , 0 };   /**< Index of the node subdividing each quadrant, zero for leaf quadrants. */
+
+        DTree_Node();
+        DTree_Node( const DTree_Node& node );
+        DTree_Node& operator = ( const DTree_Node& node );
+    };
+
+    std::vector<DTree_Node>     m_nodes;            /**< Nodes of the tree, the first one is the root. */
+    std::atomic<unsigned>       m_sampleCnt;        /**< Number of recorded samples. */
+    float                       m_sum = 0.0f;       /**< Total energy of the tree, it is only valid after the tree is built. */
+};
+
+//! @brief  Spatial binary tree whose leaves hold directional trees.
+/**
+ * This is the guiding structure from 'Practical Path Guiding for Efficient Light-Transport Simulation'. Each node splits its box in
+ * half along the axis that cycles through the three dimensions with depth. Leaves are split between iterations once they receive
+ * enough samples, so the structure adapts to where paths actually go.
+ */
+class SDTree{
+public:
+    //! @brief  The tree starts with one leaf covering the whole box.
+    //!
+    //! @param  bbox        The bounding box of the scene.
+    SDTree( const BBox& bbox );
+
+    //! @brief  Record the radiance coming from a direction at a position, it is safe to call it from multiple threads.
+    //!
+    //! @param  p           The position where the radiance is recorded.
+    //! @param  dir         The direction where the radiance comes from.
+    //! @param  value       The radiance divided by the pdf of sampling the direction.
+    void        Record( const Point& p , const Vector& dir , float value );
+
+    //! @brief  Build all directional trees. The tree can only be sampled after it is built.
+    void        Build();
+
+    //! @brief  Sample a direction proportional to the learned radiance at a position.
+    //!
+    //! @param  p           The position to be shaded.
+    //! @param  u           A canonical random number.
+    //! @param  v           Another canonical random number.
+    //! @param  pdf         The pdf w.r.t solid angle of sampling the direction.
+    //! @return             The sampled direction in world space.
+    Vector      Sample( const Point& p , float u , float v , float* pdf ) const;
+
+    //! @brief  The pdf w.r.t solid angle of sampling a direction at a position.
+    //!
+    //! @param  p           The position to be shaded.
+    //! @param  dir         The direction in world space.
+    //! @return             The pdf w.r.t solid angle.
+    float       Pdf( const Point& p , const Vector& dir ) const;
+
+    //! @brief  Generate a tree for the next iteration, this tree needs to be built already.
+    //!
+    //! @param  iteration   The index of the next iteration, leaves need more samples to be split in later iterations.
+    //! @return             The empty tree for the next training iteration.
+    std::unique_ptr<SDTree> Refine( unsigned iteration ) const;
+
+    //! @brief  Save the tree, nobody should be recording in it.
+    //!
+    //! @param  stream      The stream to save the tree in.
+    void        Save( OStreamBase& stream ) const;
+
+    //! @brief  Load a tree saved by 'Save', the tree is built once it is loaded.
+    //!
+    //! @param  stream      The stream to load the tree from.
+    //! @return             Whether the tree is valid, nothing in the stream is trusted.
+    bool        Load( IStreamBase& stream );
+
+    //! @brief  The number of spatial leaves.
+    unsigned    GetLeafCount() const {
+        return (unsigned)m_dtrees.size();
+    }
+
+private:
+    //! @brief  Node of the spatial tree.
+    struct SDTree_Node{
+        unsigned    child[2] = { 0 , 0 };       /**< Index of the two children, zero for leaves. */
+        unsigned    dtree = 0;                  /**< Index of the directional tree of a leaf. */
+    };
+
+    BBox                        m_bbox;         /**< Bounding box of the tree. */
+    std::vector<SDTree_Node>    m_nodes;        /**< Nodes of the tree, the first one is the root. */
+    std::vector<DTree>          m_dtrees;       /**< Directional trees of all leaves. */
+
+    //! @brief  Search for the directional tree covering a position.
+    const DTree&    locate( const Point& p ) const;
+};
+
+//! @brief  Online training of the guiding structure during rendering.
+/**
+ * Training happens in iterations, each one takes twice as many samples as the previous one. All threads record into the training tree
+ * of the current iteration. Once the last sample of an iteration is counted, the thread counting it builds the tree, publishes it as the
+ * new sampling tree and refines it into the training tree of the next iteration. Trees are never modified once they are published and
+ * are only released once rendering is done, threads holding an old tree in the middle of a path are always safe.
+ */
+class PathGuiding{
+public:
+    //! @brief  Setup the first training iteration.
+    //!
+    //! @param  bbox            The bounding box of the scene.
+    //! @param  samplePerIter   Number of samples taken in the first iteration, usually one sample per pixel.
+    void            Initialize( const BBox& bbox , unsigned long long samplePerIter );
+
+    //! @brief  The tree to sample directions from, nullptr before the first iteration is done.
+    const SDTree*   GetSamplingTree() const {
+        return m_samplingTree.load( std::memory_order_acquire );
+    }
+
+    //! @brief  The tree to record radiance in.
+    SDTree*         GetTrainingTree() const {
+        return m_trainingTree.load( std::memory_order_acquire );
+    }
+
+    //! @brief  Count a finished camera sample, the training iteration is finished once it takes enough samples.
+    void            FinishSample();
+
+    //! @brief  Warm start from the sampling tree learned in a previous rendering of the same scene.
+    //!
+    //! The loaded tree is sampled right away, and iterations shorter than what it is trained with are skipped, so the
+    //! first tree trained from scratch replaces it only when it has at least as many samples. The loaded tree is trusted
+    //! less each time it is carried over, the number of samples it is trained with is scaled by the decay. It has to be
+    //! called after 'Initialize'.
+    //!
+    //! @param  filename        The file saved by 'SaveCache'.
+    //! @param  key             Hash of the scene, the cache is dropped if it is saved for another scene.
+    //! @param  decay           Fraction of the samples of the loaded tree that still counts.
+    //! @return                 Whether the guiding structure is loaded.
+    bool            LoadCache( const std::string& filename , std::uint64_t key , float decay );
+
+    //! @brief  Save the sampling tree so that the next rendering of the same scene could start with it.
+    //!
+    //! @param  filename        The file to save the sampling tree in.
+    //! @param  key             Hash of the scene.
+    //! @return                 Whether the sampling tree is saved, nothing is saved before the first iteration is done.
+    bool            SaveCache( const std::string& filename , std::uint64_t key ) const;
+
+private:
+    std::atomic<const SDTree*>              m_samplingTree = { nullptr };   /**< Tree built in the previous iteration. */
+    std::atomic<SDTree*>                    m_trainingTree = { nullptr };   /**< Tree being trained in the current iteration. */
+    std::atomic<unsigned long long>         m_sampleCnt = { 0 };            /**< Number of camera samples taken so far. */
+    std::atomic<unsigned long long>         m_iterationEnd = { 0 };         /**< Number of camera samples at which the current iteration ends. */
+    unsigned long long                      m_samplePerIter = 0;            /**< Number of samples in the first iteration. */
+    unsigned                                m_iteration = 0;                /**< Index of the current iteration. */
+    float                                   m_samplingSpp = 0.0f;           /**< Samples per pixel the sampling tree is trained with. */
+    std::mutex                              m_mutex;                        /**< Only one thread can finish an iteration. */
+    std::vector<std::unique_ptr<SDTree>>    m_trees;                        /**< All trees, they are kept alive until rendering is done. */
+};
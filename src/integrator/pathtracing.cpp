@@ -27,163 +27,600 @@
 #include "scatteringevent/scatteringevent.h"
 #include "medium/medium.h"
 #include "medium/phasefunction.h"
+#include "light/light.h"
+#include "core/globalconfig.h"
+#include "imagesensor/aov.h"
+#include "imagesensor/relightcache.h"
+#include <filesystem>
+#include <algorithm>
 
 SORT_STATS_DEFINE_COUNTER(sTotalPathLength)
 SORT_STATS_DECLARE_COUNTER(sPrimaryRayCount)
 
 SORT_STATS_COUNTER("Path Tracing", "Primary Ray Count" , sPrimaryRayCount);
 SORT_STATS_AVG_COUNT("Path Tracing", "Average Length of Path", sTotalPathLength , sPrimaryRayCount);    // This also counts the case where ray hits sky
+SORT_STATS_DEFINE_HISTOGRAM(sPathBounces)
+SORT_STATS_HISTOGRAM("Path Tracing", "Bounces per Path", sPathBounces);
+
+SORT_STATS_DEFINE_HISTOGRAM(sRouletteDepth)
+SORT_STATS_HISTOGRAM("Path Tracing", "Bounces of Paths Killed by Russian Roulette", sRouletteDepth);
+SORT_STATS_DEFINE_COUNTER(sMaxDepthCount)
+SORT_STATS_COUNTER("Path Tracing", "Paths Cut at Maximum Depth", sMaxDepthCount);
+SORT_STATS_DEFINE_COUNTER(sSplitPathCount)
+SORT_STATS_COUNTER("Path Tracing", "Paths Split at First Hit", sSplitPathCount);
+
+SORT_STATS_DEFINE_COUNTER(sGuidedSampleCount)
+SORT_STATS_COUNTER("Path Tracing", "Guided Sample Count", sGuidedSampleCount);
+
+SORT_STATS_DEFINE_COUNTER(sDeferredBatchCount)
+SORT_STATS_DEFINE_COUNTER(sDeferredRayCount)
+SORT_STATS_COUNTER("Path Tracing", "Deferred Bounce Batches", sDeferredBatchCount);
+SORT_STATS_AVG_COUNT("Path Tracing", "Average Rays per Deferred Batch", sDeferredRayCount , sDeferredBatchCount);
+
+// Probability of sampling the bsdf instead of the guiding structure, the bsdf keeps the whole hemisphere covered.
+static constexpr float      GUIDING_BSDF_SAMPLING_FRACTION  = 0.5f;
+// Vertices beyond this in a path are not recorded in the guiding structure.
+static constexpr unsigned   GUIDING_MAX_PATH_VERTEX         = 32;
+// Lower bound of the survival probability in russian roulette, it bounds the variance introduced by terminating paths.
+static constexpr float      RUSSIAN_ROULETTE_MIN_SURVIVAL   = 0.05f;
+// Number of cells along the longest axis of the scene in the coarse occlusion grid.
+static constexpr unsigned   OCCLUSION_GRID_RESOLUTION       = 128;
+// Names of the files of learned structures in the warm start directory.
+static constexpr const char* WARM_START_PATH_GUIDING        = "guiding.cache";
+static constexpr const char* WARM_START_RADIANCE_CACHE      = "radiance.cache";
+
+static std::string warmStartFilePath( const std::string& dir , const char* name ){
+    return ( std::filesystem::path( dir ) / name ).string();
+}
+
+// Vertices of a path whose incident radiance is recorded in the guiding structure once the path is done.
+class PathTracing::GuidingRecorder{
+public:
+    GuidingRecorder( SDTree* tree = nullptr ) : m_tree( tree ){}
+
+    // the radiance arriving at a vertex is whatever is accumulated after it, divided by the throughput up to it
+    void Record( const Spectrum& L ){
+        for( auto i = 0u ; i < m_cnt ; ++i ){
+            const auto& v = m_vertices[i];
+            const auto delta = L - v.L;
+            const auto li = Spectrum( v.throughput.r > 0.0f ? delta.r / v.throughput.r : 0.0f ,
+                                      v.throughput.g > 0.0f ? delta.g / v.throughput.g : 0.0f ,
+                                      v.throughput.b > 0.0f ? delta.b / v.throughput.b : 0.0f );
+            m_tree->Record( v.p , v.dir , li.GetIntensity() / v.pdf );
+        }
+        m_cnt = 0;
+    }
+
+    // record a vertex right after its next direction is picked, along with the radiance accumulated so far
+    void Add( const Point& p , const Vector& dir , const Spectrum& L , const Spectrum& throughput , float pdf ){
+        if( IS_PTR_INVALID(m_tree) || m_cnt == GUIDING_MAX_PATH_VERTEX )
+            return;
+        m_vertices[m_cnt++] = { p , dir , L , throughput , pdf };
+    }
+
+private:
+    struct Vertex{
+        Point       p;
+        Vector      dir;
+        Spectrum    L;              /**< Radiance accumulated before the vertex. */
+        Spectrum    throughput;     /**< Throughput including the scattering at the vertex. */
+        float       pdf;            /**< Pdf of picking the direction. */
+    };
+
+    SDTree*         m_tree;
+    Vertex          m_vertices[GUIDING_MAX_PATH_VERTEX];
+    unsigned        m_cnt = 0;
+};
+
+// Spread the lowest ten bits of an integer to every third bit.
+static unsigned expandBits( unsigned x ){
+    x = ( x * 0x00010001u ) & 0xFF0000FFu;
+    x = ( x * 0x00000101u ) & 0x0F00F00Fu;
+    x = ( x * 0x00000011u ) & 0xC30C30C3u;
+    x = ( x * 0x00000005u ) & 0x49249249u;
+    return x;
+}
+
+// Rays are grouped by the octant of their directions first, rays in the same octant are then ordered along the Morton
+// curve of their origins in the scene. Rays next to each other in this order tend to visit the same nodes.
+static unsigned long long rayCoherenceKey( const Ray& r , const BBox& bbox ){
+    auto code = 0u;
+    for( auto k = 0u ; k < 3u ; ++k ){
+        const auto extent = bbox.m_Max[k] - bbox.m_Min[k];
+        const auto t = extent > 0.0f ? ( r.m_Ori[k] - bbox.m_Min[k] ) / extent : 0.0f;
+        const auto q = (unsigned)std::min( 1023.0f , std::max( 0.0f , t * 1024.0f ) );
+        code |= expandBits( q ) << ( 2u - k );
+    }
+    const auto octant = ( r.m_Dir.x < 0.0f ? 1u : 0u ) | ( r.m_Dir.y < 0.0f ? 2u : 0u ) | ( r.m_Dir.z < 0.0f ? 4u : 0u );
+    return ( (unsigned long long)octant << 30 ) | code;
+}
+
+void PathTracing::PreProcess( const Scene& scene ){
+    static const BounceKernel kernels[] = {
+        &PathTracing::bounceKernel<0> , &PathTracing::bounceKernel<1> , &PathTracing::bounceKernel<2> , &PathTracing::bounceKernel<3> ,
+        &PathTracing::bounceKernel<4> , &PathTracing::bounceKernel<5> , &PathTracing::bounceKernel<6> , &PathTracing::bounceKernel<7> ,
+    };
+    static_assert( sizeof( kernels ) / sizeof( kernels[0] ) == PATH_FEATURE_ALL + 1 , "A kernel is needed for every combination of features." );
+
+    auto features = 0u;
+    if( scene.HasVolume() )
+        features |= PATH_FEATURE_VOLUME;
+    if( scene.HasSSS() )
+        features |= PATH_FEATURE_SSS;
+    if( IS_PTR_VALID( scene.GetSkyLight() ) )
+        features |= PATH_FEATURE_SKY;
+    m_bounce = kernels[features];
+
+    // learned structures only depend on the geometry, the camera could move freely between renderings
+    m_sceneHash = HashValue( scene.GetTopologyHash() , scene.GetGeometryHash() );
+    const auto& warm_start = g_warmStartDir;
+
+    m_radianceCache = nullptr;
+    if( g_previewQuality ){
+        m_radianceCache = std::make_unique<RadianceCache>();
+        m_radianceCache->Reset( scene );
+
+        const auto filename = warmStartFilePath( warm_start , WARM_START_RADIANCE_CACHE );
+        if( !warm_start.empty() && m_radianceCache->LoadCache( filename , m_sceneHash , g_warmStartDecay ) )
+            slog( INFO , INTEGRATOR , "Radiance cache is warm started from %s." , filename.c_str() );
+    }
+
+    // shadow rays in indirect bounces only need to be roughly right in previews, the grid is far cheaper than the accelerator
+    m_occlusionGrid = nullptr;
+    if( g_previewQuality && m_coarseShadow ){
+        m_occlusionGrid = std::make_unique<OcclusionGrid>();
+        m_occlusionGrid->Build( scene , OCCLUSION_GRID_RESOLUTION );
+    }
+
+    m_guiding = nullptr;
+    if( !m_pathGuiding )
+        return;
+
+    // the first iteration takes one sample per pixel
+    m_guiding = std::make_unique<PathGuiding>();
+    m_guiding->Initialize( scene.GetBBox() , (unsigned long long)g_resultResollutionWidth * (unsigned long long)g_resultResollutionHeight );
+
+    const auto filename = warmStartFilePath( warm_start , WARM_START_PATH_GUIDING );
+    if( !warm_start.empty() && m_guiding->LoadCache( filename , m_sceneHash , g_warmStartDecay ) )
+        slog( INFO , INTEGRATOR , "Path guiding is warm started from %s." , filename.c_str() );
+}
+
+void PathTracing::PostProcess(){
+    const auto& warm_start = g_warmStartDir;
+    if( warm_start.empty() || ( !m_radianceCache && !m_guiding ) )
+        return;
+
+    std::error_code err;
+    std::filesystem::create_directories( warm_start , err );
+
+    // a cache of the other structure saved by a previous rendering is left untouched
+    if( m_radianceCache && !m_radianceCache->SaveCache( warmStartFilePath( warm_start , WARM_START_RADIANCE_CACHE ) , m_sceneHash ) )
+        slog( WARNING , INTEGRATOR , "Failed to save the radiance cache in %s." , warm_start.c_str() );
+    if( m_guiding )
+        m_guiding->SaveCache( warmStartFilePath( warm_start , WARM_START_PATH_GUIDING ) , m_sceneHash );
+}
 
 Spectrum PathTracing::Li( const Ray& ray , const PixelSample& ps , const Scene& scene) const{
 	MediumStack ms;
 	scene.RestoreMediumStack(ray.m_Ori, ms);
 
-    return li( ray , ps , scene , 0 , false , 0 , false , ms );
+    PathState state;
+    state.ray = ray;
+    const auto radiance = li( state , scene , ms );
+    if( m_guiding )
+        m_guiding->FinishSample();
+    return radiance;
 }
 
-Spectrum PathTracing::li( const Ray& ray , const PixelSample& ps , const Scene& scene , int bounces , bool indirectOnly , int bssrdfBounces , bool replaceSSS , MediumStack& ms ) const{
+Spectrum PathTracing::LiWithPrimaryHit( const Ray& ray , const PixelSample& ps , const Scene& scene , const SurfaceInteraction& primary ) const{
+	MediumStack ms;
+	scene.RestoreMediumStack(ray.m_Ori, ms);
+
+    PathState state;
+    state.ray = ray;
+    const auto radiance = li( state , scene , ms , &primary );
+    if( m_guiding )
+        m_guiding->FinishSample();
+    return radiance;
+}
+
+Spectrum PathTracing::li( PathState& state , const Scene& scene , MediumStack& ms , const SurfaceInteraction* primary ) const{
     SORT_PROFILE("Path tracing");
     SORT_STATS(++sPrimaryRayCount);
 
-    Spectrum    L = 0.0f;
-    Spectrum    throughput = 1.0f;
+    if( m_primarySplits > 1 )
+        return liSplit( state , scene , ms , primary );
 
-    int local_bounce = 0;
-    auto    r = ray;
-    while(true){
-        // This introduces bias in the algorithm. 'max_recursive_depth' could be set very large to reduce the side-effect.
-        if( bounces >= max_recursive_depth )
-            return L;
+    PathRadiance radiance;
+    GuidingRecorder recorder( m_guiding ? m_guiding->GetTrainingTree() : nullptr );
+    trace( state , radiance , scene , ms , recorder , primary );
+    finishPath( state , radiance , recorder );
+    return radiance.L;
+}
 
-        SORT_STATS(++sTotalPathLength);
+Spectrum PathTracing::liSplit( PathState& state , const Scene& scene , MediumStack& ms , const SurfaceInteraction* primary ) const{
+    const auto tree = m_guiding ? m_guiding->GetTrainingTree() : nullptr;
+
+    // the camera ray is shared by all branches, a ray missing the scene has nothing to be split
+    SurfaceInteraction inter;
+    if( IS_PTR_VALID(primary) )
+        inter = *primary;
+    else
+        scene.GetIntersect( state.ray , inter );
+    if( IS_PTR_INVALID(inter.primitive) ){
+        PathRadiance radiance;
+        GuidingRecorder recorder( tree );
+        trace( state , radiance , scene , ms , recorder , &inter );
+        finishPath( state , radiance , recorder );
+        return radiance.L;
+    }
+    SORT_STATS(++sSplitPathCount);
+
+    // each branch carries an equal share of the sample, the radiance of the path is the average of its branches
+    const auto weight = state.weight / (float)m_primarySplits;
+    PathRadiance total;
+    auto bounces = 0;
+    for( auto i = 0 ; i < m_primarySplits ; ++i ){
+        auto branch = state;
+        branch.throughput *= weight / state.weight;
+        branch.weight = weight;
+        auto branch_ms = ms;
+
+        PathRadiance radiance;
+        GuidingRecorder recorder( tree );
+        trace( branch , radiance , scene , branch_ms , recorder , &inter );
+        finishPath( branch , radiance , recorder , false );
+
+        total.L += radiance.L;
+        total.direct += radiance.directDone ? radiance.direct : radiance.L;
+        bounces = std::max( bounces , branch.bounces );
+    }
+    total.directDone = true;
+    state.bounces = bounces;
+
+    if( IsRecordingAov() ){
+        RecordLightingAov( total.direct , total.L - total.direct );
+        RecordPathDepthAov( bounces );
+    }
+    return total.L;
+}
 
-        // get the intersection between the ray and the scene if it's a light , accumulate the radiance and break
+void PathTracing::trace( PathState& state , PathRadiance& radiance , const Scene& scene , MediumStack& ms , GuidingRecorder& recorder , const SurfaceInteraction* primary ) const{
+    while( beginBounce( state , radiance ) ){
+        // get the intersection between the ray and the scene
+        // the intersection of the first ray may have been found already
         SurfaceInteraction inter;
-        if( !scene.GetIntersect( r , inter ) ){
-            if( 0 == local_bounce )
-                return !indirectOnly ? scene.Le( r ) : 0.0f;
+        auto hit = false;
+        if( IS_PTR_VALID(primary) ){
+            inter = *primary;
+            hit = IS_PTR_VALID(inter.primitive);
+            primary = nullptr;
+        }else{
+            hit = scene.GetIntersect( state.ray , inter );
+        }
+        if( !bounce( state , radiance , scene , ms , hit ? &inter : nullptr , recorder ) )
             break;
+    }
+}
+
+void PathTracing::LiDeferred( const Ray* rays , const PixelSample* const* ps , const Scene& scene , const SurfaceInteraction* primary ,
+                              const SampleCursor* cursors , unsigned int cnt , Spectrum* radiance ) const{
+    SORT_PROFILE("Deferred path tracing");
+
+    // branches of split paths are not suspended in between bounces, the paths are traced one by one instead
+    if( m_primarySplits > 1 ){
+        Integrator::LiDeferred( rays , ps , scene , primary , cursors , cnt , radiance );
+        return;
+    }
+
+    // everything needed to resume a path at its next bounce
+    struct DeferredPath{
+        PathState           state;
+        PathRadiance        radiance;
+        MediumStack         ms;
+        SampleCursor        cursor;
+        GuidingRecorder     recorder;
+    };
+
+    const auto tree = m_guiding ? m_guiding->GetTrainingTree() : nullptr;
+    const auto finish = [&]( DeferredPath& path ){
+        finishPath( path.state , path.radiance , path.recorder );
+        if( m_guiding )
+            m_guiding->FinishSample();
+    };
+
+    auto paths = std::make_unique<DeferredPath[]>( cnt );
+    std::vector<unsigned int> alive , next;
+    alive.reserve( cnt );
+    next.reserve( cnt );
+    for( auto i = 0u ; i < cnt ; ++i ){
+        SORT_STATS(++sPrimaryRayCount);
+
+        auto& path = paths[i];
+        path.state.ray = rays[i];
+        path.cursor = cursors[i];
+        path.recorder = GuidingRecorder( tree );
+        scene.RestoreMediumStack( rays[i].m_Ori , path.ms );
+        if( beginBounce( path.state , path.radiance ) )
+            alive.push_back( i );
+        else
+            finish( path );
+    }
+
+    // rays of the same bounce are traced all together, the first bounce takes the intersections of the camera rays
+    auto batch_rays = std::make_unique<Ray[]>( cnt );
+    auto intersects = std::make_unique<SurfaceInteraction[]>( cnt );
+    std::vector<std::pair<unsigned long long,unsigned int>> keys;
+    keys.reserve( cnt );
+    auto camera_bounce = true;
+    while( !alive.empty() ){
+        const auto alive_cnt = (unsigned int)alive.size();
+        if( camera_bounce ){
+            for( auto i = 0u ; i < alive_cnt ; ++i )
+                intersects[i] = primary[alive[i]];
+        }else{
+            // sorting the rays makes the packets traced by the accelerator coherent
+            keys.clear();
+            for( const auto id : alive )
+                keys.push_back( std::make_pair( rayCoherenceKey( paths[id].state.ray , scene.GetBBox() ) , id ) );
+            std::sort( keys.begin() , keys.end() );
+            for( auto i = 0u ; i < alive_cnt ; ++i ){
+                alive[i] = keys[i].second;
+                batch_rays[i] = paths[alive[i]].state.ray;
+                intersects[i] = SurfaceInteraction();
+            }
+            // past the first few bounces, sorted rays still barely share nodes in large scenes, interleaving them hides the cache misses
+            if( g_interleavedTraversal )
+                scene.GetIntersectIncoherent( batch_rays.get() , intersects.get() , alive_cnt );
+            else
+                scene.GetIntersect( batch_rays.get() , intersects.get() , alive_cnt );
+            SORT_STATS(++sDeferredBatchCount);
+            SORT_STATS(sDeferredRayCount += alive_cnt);
+        }
+
+        // each path picks up its samples where it left off in the last bounce
+        next.clear();
+        for( auto i = 0u ; i < alive_cnt ; ++i ){
+            auto& path = paths[alive[i]];
+            auto& inter = intersects[i];
+            ResumeSample( path.cursor );
+            if( bounce( path.state , path.radiance , scene , path.ms , IS_PTR_VALID(inter.primitive) ? &inter : nullptr , path.recorder ) &&
+                beginBounce( path.state , path.radiance ) ){
+                SuspendSample( path.cursor );
+                next.push_back( alive[i] );
+            }else{
+                finish( path );
+            }
+        }
+        alive.swap( next );
+        camera_bounce = false;
+    }
+
+    for( auto i = 0u ; i < cnt ; ++i )
+        radiance[i] = paths[i].radiance.L;
+}
+
+bool PathTracing::beginBounce( PathState& state , PathRadiance& radiance ) const{
+    if( state.bounces > 0 && !radiance.directDone ){
+        radiance.direct = radiance.L;
+        radiance.directDone = true;
+    }
+
+    // This introduces bias in the algorithm. 'max_recursive_depth' could be set very large to reduce the side-effect.
+    // Russian roulette takes care of terminating most paths way before it, it is only a hard cap of the cost of a path.
+    if( state.bounces >= max_recursive_depth ){
+        SORT_STATS(++sMaxDepthCount);
+        return false;
+    }
+
+    SORT_STATS(++sTotalPathLength);
+    return true;
+}
+
+template<unsigned Features>
+bool PathTracing::bounceKernel( PathState& state , PathRadiance& radiance , const Scene& scene , MediumStack& ms , SurfaceInteraction* hit , GuidingRecorder& recorder ) const{
+    auto&       L = radiance.L;
+    auto&       r = state.ray;
+    auto&       throughput = state.throughput;
+
+    // if the ray hits nothing, accumulate the radiance from the sky and terminate the path
+    if( IS_PTR_INVALID(hit) ){
+        if( ( Features & PATH_FEATURE_SKY ) && ( state.flags & PATH_EMISSION ) ){
+            const auto sky = throughput * scene.Le( r );
+            L += sky;
+            RecordLightContribution( scene.GetSkyLight() , sky );
+        }
+        return false;
+    }
+    auto& inter = *hit;
+
+    // the medium stack stays empty if there is no volume in the scene
+    MediumInteraction* pMi = nullptr;
+    if( Features & PATH_FEATURE_VOLUME ){
+        // scattering points are sampled toward a light too, fog close to point and spot lights converges much faster this way
+        Point target;
+        const Point* p_target = nullptr;
+        float target_pdf = 0.0f;
+        LightBounds target_bounds;
+        const auto target_light = ms.m_mediumCnt ? scene.SampleLight(r.m_Ori, Vector(), sort_canonical(), &target_pdf) : nullptr;
+        if( target_light && target_pdf > 0.0f && !target_light->IsInfinite() && target_light->GetBounds( target_bounds ) ){
+            target = ( target_bounds.bbox.m_Min + target_bounds.bbox.m_Max ) * 0.5f;
+            p_target = &target;
         }
 
         Spectrum emission;
-        MediumInteraction* pMi = nullptr;
-        const auto medium_attenuation = ms.Sample(r, inter.t, pMi, emission);
+        const auto medium_attenuation = ms.Sample(r, inter.t, pMi, emission, p_target, ( state.flags & PATH_EMISSION ) != 0);
 
         L += emission * throughput;
 
         // update the through put based on the medium attenuation due to particle scattering and absorption.
         throughput *= medium_attenuation;
+    }
 
-        if (pMi && pMi->phaseFunction) {
-            Vector wi;
-            float pdf = 0.0f;
-            const auto pf = pMi->phaseFunction->Sample(-r.m_Dir, wi, pdf);
-
-            if ( UNLIKELY(pdf == 0.0f) )
-                break;
+    if ( ( Features & PATH_FEATURE_VOLUME ) && pMi && pMi->phaseFunction) {
+        Vector wi;
+        float pdf = 0.0f;
+        const auto pf = pMi->phaseFunction->Sample(-r.m_Dir, wi, pdf);
+
+        if ( UNLIKELY(pdf == 0.0f) )
+            return false;
+
+        // evaluate direct light illumination, there is no normal in medium
+        float light_pdf = 0.0f;
+        const auto  light = scene.SampleLight(pMi->intersect, Vector(), sort_canonical(), &light_pdf);
+        if( light_pdf > 0.0f ){
+            const ShadowRoulette roulette = { throughput / light_pdf , m_shadowRoulette * L.GetIntensity() , state.bounces > 0 ? m_occlusionGrid.get() : nullptr };
+            const auto direct = throughput * EvaluateDirect(pMi->intersect, pMi->phaseFunction, -r.m_Dir, scene, light, ms, &roulette) / light_pdf;
+            L += direct;
+            RecordLightContribution( light , direct );
+        }
 
-            // evaluate direct light illumination
-            float light_pdf = 0.0f;
-            const auto  light = scene.SampleLight(sort_canonical(), &light_pdf);
-            L += throughput * EvaluateDirect(pMi->intersect, pMi->phaseFunction, -r.m_Dir, scene, light, ms) / light_pdf;
+        // update path weight
+        throughput *= pf / pdf;
 
-            // update path weight
-            throughput *= pf / pdf;
+        if (0.0f == throughput.GetIntensity())
+            return false;
 
-            if (0.0f == throughput.GetIntensity())
-                break;
+        r.m_Ori = pMi->intersect;
+        r.m_Dir = wi;
+        r.m_fMin = 0.0f;    // no need for bias anymore since there is no geometry
+        r.m_hasDifferentials = false;   // there is no surface to propagate differentials through
+        state.pdf = pdf;
+        state.flags &= ~PATH_EMISSION;
 
-            r.m_Ori = pMi->intersect;
-            r.m_Dir = wi;
-            r.m_fMin = 0.0f;    // no need for bias anymore since there is no geometry
+        // apply Prussian Roulette in volume scattering too
+        if( russianRoulette( state ) )
+            return false;
 
-            // apply Prussian Roulette in volume scattering too
-            if (bounces > 3 && throughput.GetMaxComponent() < 0.1f) {
-                auto continueProperbility = std::max(0.05f, 1.0f - throughput.GetMaxComponent());
-                if (sort_canonical() < continueProperbility)
-                    break;
-                throughput /= 1 - continueProperbility;
-            }
+        ++state.bounces;
+        return true;
+    }
 
-            ++bounces;
-            ++local_bounce;
+    if( state.flags & PATH_EMISSION ){
+        const auto le = inter.Le(-r.m_Dir);
+        L += le;
+        RecordLightContribution( inter.primitive ? inter.primitive->GetLight() : nullptr , le );
+    }
 
-            continue;
+    // make sure there is intersected primitive
+    sAssert(IS_PTR_VALID(inter.primitive), INTEGRATOR );
+
+    // the lack of multiple bounces between different BSSRDF surfaces does introduce a bias.
+    const auto replaceSSS = ( Features & PATH_FEATURE_SSS ) &&
+                            ( ( state.flags & PATH_REPLACE_SSS ) || ( state.bssrdfBounces > m_maxBouncesInBSSRDFPath - 1 ) );
+    state.flags &= ~( PATH_EMISSION | PATH_REPLACE_SSS );
+
+    const MaterialBase* material = inter.primitive->GetMaterial();
+    sAssert(IS_PTR_VALID(material), INTEGRATOR);
+
+    // Parse the material and populate the results into a scatteringEvent.
+    SE_Flag seFlag = replaceSSS ? SE_Flag( SE_EVALUATE_ALL | SE_REPLACE_BSSRDF ) : SE_EVALUATE_ALL;
+    ScatteringEvent se(inter, seFlag);
+
+    // once the path went through a rough bounce, near-specular lobes are blurred so that caustics seen through them are
+    // picked up by bsdf sampling instead of ending up as fireflies, the lower the pdf so far the blurrier they get
+    const auto blur_pdf = m_pathRegularization * state.minPdf;
+    if( m_pathRegularization > 0.0f && blur_pdf < 1.0f )
+        se.SetRoughnessFloor( sqrt( 1.0f - blur_pdf ) * 0.5f );
+
+    material->UpdateScatteringEvent(se);
+
+    if( state.bounces == 0 && IsRecordingAov() )
+        RecordPrimaryHitAov( se.EstimateAlbedo( -r.m_Dir ) , inter.normal , inter.t );
+
+    SE_Flag scattering_type_flag;
+    auto pdf_scattering_type = se.SampleScatteringType(scattering_type_flag);
+
+    if( scattering_type_flag & SE_EVALUATE_BXDF ){
+        // evaluate the light
+        auto        light_pdf = 0.0f;
+        const auto  light_sample = LightSample(true);
+        const auto  bsdf_sample = BsdfSample(true);
+        const auto  light = scene.SampleLight( inter.intersect , inter.gnormal , light_sample.t , &light_pdf );
+        if( light_pdf > 0.0f ){
+            // shadow rays carrying little compared with what the path gathered so far are in russian roulette, the ones
+            // after the first bounce are answered by the coarse occlusion grid in previews
+            const ShadowRoulette roulette = { throughput / light_pdf / pdf_scattering_type , m_shadowRoulette * L.GetIntensity() , state.bounces > 0 ? m_occlusionGrid.get() : nullptr };
+            const auto direct = throughput * EvaluateDirect( se , r , scene, light , light_sample , bsdf_sample , material , ms , &roulette ) / light_pdf / pdf_scattering_type;
+            L += direct;
+            RecordLightContribution( light , direct );
         }
-
-        if( local_bounce == 0 && !indirectOnly ) 
-            L += inter.Le(-r.m_Dir);
-        
-        // make sure there is intersected primitive
-        sAssert(IS_PTR_VALID(inter.primitive), INTEGRATOR );
-
-        // the lack of multiple bounces between different BSSRDF surfaces does introduce a bias.
-        replaceSSS |= ( bssrdfBounces > m_maxBouncesInBSSRDFPath - 1 );
-
-        const MaterialBase* material = inter.primitive->GetMaterial();
-        sAssert(IS_PTR_VALID(material), INTEGRATOR);
-
-        // Parse the material and populate the results into a scatteringEvent.
-        SE_Flag seFlag = replaceSSS ? SE_Flag( SE_EVALUATE_ALL | SE_REPLACE_BSSRDF ) : SE_EVALUATE_ALL;
-        ScatteringEvent se(inter, seFlag);
-        material->UpdateScatteringEvent(se);
-
-        SE_Flag scattering_type_flag;
-        auto pdf_scattering_type = se.SampleScatteringType(scattering_type_flag);
-
-        if( scattering_type_flag & SE_EVALUATE_BXDF ){
-            // evaluate the light
-            auto        light_pdf = 0.0f;
-            const auto  light_sample = LightSample(true);
-            const auto  bsdf_sample = BsdfSample(true);
-            const auto  light = scene.SampleLight( light_sample.t , &light_pdf );
-            if( light_pdf > 0.0f )
-                L += throughput * EvaluateDirect( se , r , scene, light , light_sample , bsdf_sample , material , ms ) / light_pdf / pdf_scattering_type;
-        }else if(scattering_type_flag & SE_EVALUATE_BSSRDF) {
-            BSSRDFIntersections bssrdf_inter;
-            float               bssrdf_pdf = 0.0f;
-            se.Sample_BSSRDF( scene, -r.m_Dir, se.GetInteraction().intersect, bssrdf_inter , bssrdf_pdf);
-
-            // Accumulate the contribution from direct illumination
-            if( bssrdf_inter.cnt > 0 ){
-                Spectrum total_bssrdf;
-
-                for( auto i = 0u ; i < bssrdf_inter.cnt ; ++i ){
-                    const auto& pInter = bssrdf_inter.intersections[i];
-                    const auto& intersection = pInter->intersection;
-
-                    // Create a temporary lambert model to account the cos factor
-                    // Fresnel is totally ignored here due to two reasons, the lack of visual differences and most importantly,
-                    // there will be a discontinuity introduced when mean free path approaches zero.
-                    ScatteringEvent se(pInter->intersection);
-                    se.AddBxdf( SORT_MALLOC(Lambert)( WHITE_SPECTRUM , FULL_WEIGHT , DIR_UP ) );
-
-                    // Accumulate the contribution from direct illumination
-                    total_bssrdf += SampleOneLight( se , r , intersection , scene , material , ms ) * pInter->weight;
-                }
-                
-                L += total_bssrdf * throughput / pdf_scattering_type / bssrdf_pdf;
+    }else if( ( Features & PATH_FEATURE_SSS ) && ( scattering_type_flag & SE_EVALUATE_BSSRDF ) ) {
+        BSSRDFIntersections bssrdf_inter;
+        float               bssrdf_pdf = 0.0f;
+        se.Sample_BSSRDF( scene, -r.m_Dir, se.GetInteraction().intersect, bssrdf_inter , bssrdf_pdf);
+
+        // Accumulate the contribution from direct illumination
+        if( bssrdf_inter.cnt > 0 ){
+            Spectrum total_bssrdf;
+
+            for( auto i = 0u ; i < bssrdf_inter.cnt ; ++i ){
+                const auto& pInter = bssrdf_inter.intersections[i];
+                const auto& intersection = pInter->intersection;
+
+                // Create a temporary lambert model to account the cos factor
+                // Fresnel is totally ignored here due to two reasons, the lack of visual differences and most importantly,
+                // there will be a discontinuity introduced when mean free path approaches zero.
+                ScatteringEvent se(pInter->intersection);
+                se.AddBxdf( SORT_MALLOC(Lambert)( WHITE_SPECTRUM , FULL_WEIGHT , DIR_UP ) );
+
+                // Accumulate the contribution from direct illumination
+                const ShadowRoulette roulette = { pInter->weight * throughput / pdf_scattering_type / bssrdf_pdf , m_shadowRoulette * L.GetIntensity() , state.bounces > 0 ? m_occlusionGrid.get() : nullptr };
+                const Light* light = nullptr;
+                const auto direct = SampleOneLight( se , r , intersection , scene , material , ms , &roulette , &light ) * pInter->weight;
+                total_bssrdf += direct;
+                RecordLightContribution( light , direct * throughput / pdf_scattering_type / bssrdf_pdf );
             }
-        }
 
-        // pick another time for the next path
-        pdf_scattering_type = se.SampleScatteringType(scattering_type_flag);
+            L += total_bssrdf * throughput / pdf_scattering_type / bssrdf_pdf;
+        }
+    }
 
-        if( pdf_scattering_type == 0.0f )
-            break;
+    // in preview quality, diffuse surfaces after the first bounce take the indirect illumination from the radiance cache,
+    // the path ends here. Only one more bounce is accounted, the darkening is accepted for faster convergence.
+    if( m_radianceCache && state.bounces > 0 && ( scattering_type_flag & SE_EVALUATE_BXDF ) && !se.HasDeltaBxdf() ){
+        const auto n = dot( inter.normal , r.m_Dir ) < 0.0f ? inter.normal : -inter.normal;
+        const auto irradiance = m_radianceCache->GetIrradiance( scene , inter.intersect + n * 0.0001f , n );
+        L += throughput * se.EstimateAlbedo( -r.m_Dir ) * irradiance * INV_PI / pdf_scattering_type;
+        return false;
+    }
 
-        throughput /= pdf_scattering_type;
-        if( scattering_type_flag & SE_EVALUATE_BXDF ){
-            // sample the next direction using bsdf
-            float       path_pdf;
-            Vector      wi;
-            Spectrum f;
-            BsdfSample  _bsdf_sample = BsdfSample(true);
-            f = se.Sample_BSDF( -r.m_Dir , wi , _bsdf_sample , path_pdf);
-            if( ( f.IsBlack() || path_pdf == 0.0f ) )
-                break;
+    // pick another time for the next path
+    pdf_scattering_type = se.SampleScatteringType(scattering_type_flag);
+
+    if( pdf_scattering_type == 0.0f )
+        return false;
+
+    throughput /= pdf_scattering_type;
+    if( scattering_type_flag & SE_EVALUATE_BXDF ){
+        // sample the next direction using bsdf
+        float       path_pdf;
+        Vector      wi;
+        Spectrum f;
+        BsdfSample  _bsdf_sample = BsdfSample(true);
+        auto        delta = false;
+
+        // directions of delta bxdfs can't be picked by the guiding structure
+        const auto guided = m_guiding && !se.HasDeltaBxdf();
+        const auto guiding_tree = guided ? m_guiding->GetSamplingTree() : nullptr;
+        if( guiding_tree && sort_canonical() >= GUIDING_BSDF_SAMPLING_FRACTION ){
+            // one-sample MIS between the bsdf and the learned incident radiance
+            auto guiding_pdf = 0.0f;
+            wi = guiding_tree->Sample( inter.intersect , sort_canonical() , sort_canonical() , &guiding_pdf );
+            auto bsdf_pdf = 0.0f;
+            f = se.Evaluate_BSDF( -r.m_Dir , wi , &bsdf_pdf );
+            path_pdf = GUIDING_BSDF_SAMPLING_FRACTION * bsdf_pdf + ( 1.0f - GUIDING_BSDF_SAMPLING_FRACTION ) * guiding_pdf;
+            SORT_STATS(++sGuidedSampleCount);
+        }else{
+            f = se.Sample_BSDF( -r.m_Dir , wi , _bsdf_sample , path_pdf , &delta );
+            if( guiding_tree && path_pdf > 0.0f )
+                path_pdf = GUIDING_BSDF_SAMPLING_FRACTION * path_pdf + ( 1.0f - GUIDING_BSDF_SAMPLING_FRACTION ) * guiding_tree->Pdf( inter.intersect , wi );
+        }
+        if( ( f.IsBlack() || path_pdf == 0.0f ) )
+            return false;
 
-            // as long as the ray is passing through the surface, it is necessary to update the medium stack.
+        // as long as the ray is passing through the surface, it is necessary to update the medium stack.
+        if( Features & PATH_FEATURE_VOLUME ){
             const auto interaction_flag = update_interaction_flag(dot(wi,inter.gnormal), dot(-r.m_Dir,inter.gnormal));
             if (SE_Interaction::SE_REFLECTION != interaction_flag) {
                 MediumInteraction mi;
@@ -191,68 +628,120 @@ Spectrum PathTracing::li( const Ray& ray , const PixelSample& ps , const Scene&
                 mi.mesh = inter.primitive->GetMesh();
                 material->UpdateMediumStack(mi, interaction_flag, ms);
             }
+        }
 
-            // update path weight
-            throughput *= f / path_pdf;
-
-            if( 0.0f == throughput.GetIntensity() )
+        // update path weight
+        throughput *= f / path_pdf;
+
+        if( 0.0f == throughput.GetIntensity() )
+            return false;
+
+        if( guided )
+            recorder.Add( inter.intersect , wi , L , throughput , path_pdf );
+
+        const auto in = r;
+        r.m_Ori = inter.intersect;
+        r.m_Dir = wi;
+        r.m_fMin = 0.0001f;
+        inter.SpawnDifferentials( in , r , path_pdf , delta );
+        state.pdf = path_pdf;
+        if( !delta )
+            state.minPdf = std::min( state.minPdf , path_pdf );
+    }else if( Features & PATH_FEATURE_SSS ){
+        // Strictly speaking, it should consider the possibility of crossing a volume when exit from the other point of the SSS object.
+        // This is not handled properly in SORT because it is considered ill-defined scene in this case.
+        // In a nutshell, content creator should avoid putting SSS object across volumes.
+        // It is totally possible to reconstruct the volume stack after exiting from the SSS surface, which will most likely incur more costs.
+
+        BSSRDFIntersections bssrdf_inter;
+        float               bssrdf_pdf = 0.0f;
+        se.Sample_BSSRDF( scene, -r.m_Dir, se.GetInteraction().intersect, bssrdf_inter , bssrdf_pdf);
+        if( 0 == bssrdf_inter.cnt )
+            return false;
+
+        // Instead of branching the path at every exit point, only one of them is picked to continue the path, it keeps
+        // the path a single chain of vertices.
+        auto total_weight = 0.0f;
+        for( auto i = 0u ; i < bssrdf_inter.cnt ; ++i )
+            total_weight += bssrdf_inter.intersections[i]->weight.GetIntensity();
+        if( total_weight <= 0.0f )
+            return false;
+
+        auto u = sort_canonical() * total_weight;
+        auto picked = bssrdf_inter.cnt - 1;
+        for( auto i = 0u ; i < bssrdf_inter.cnt ; ++i ){
+            const auto weight = bssrdf_inter.intersections[i]->weight.GetIntensity();
+            if( u < weight && weight > 0.0f ){
+                picked = i;
                 break;
-            
-            r.m_Ori = inter.intersect;
-            r.m_Dir = wi;
-            r.m_fMin = 0.0001f;
-        }else{
-            // Strictly speaking, it should consider the possibility of crossing a volume when exit from the other point of the SSS object.
-            // This is not handled properly in SORT because it is considered ill-defined scene in this case.
-            // In a nutshell, content creator should avoid putting SSS object across volumes.
-            // It is totally possible to reconstruct the volume stack after exiting from the SSS surface, which will most likely incur more costs.
-
-            BSSRDFIntersections bssrdf_inter;
-            float               bssrdf_pdf = 0.0f;
-            se.Sample_BSSRDF( scene, -r.m_Dir, se.GetInteraction().intersect, bssrdf_inter , bssrdf_pdf);
-
-            // Accumulate the contribution from direct illumination
-            if( bssrdf_inter.cnt > 0 ){
-                Spectrum total_bssrdf;
-
-                for( auto i = 0u ; i < bssrdf_inter.cnt ; ++i ){
-                    const auto& pInter = bssrdf_inter.intersections[i];
-                    const auto& intersection = pInter->intersection;
-
-                    // Create a temporary lambert model to account the cos factor
-                    // Fresnel is totally ignored here due to two reasons
-                    //  - the lack of visual differences 
-                    //  - more importantly, there will be a discontinuity introduced when mean free path approaches zero.
-                    ScatteringEvent se(pInter->intersection, SE_Flag( SE_EVALUATE_ALL | SE_REPLACE_BSSRDF ));
-                    se.AddBxdf( SORT_MALLOC(Lambert)( WHITE_SPECTRUM , FULL_WEIGHT , DIR_UP ) );
-
-                    // Counts the light from indirect illumination recursively
-                    float pdf = 0.0f;
-                    Vector wi;
-                    Spectrum f = se.Sample_BSDF( -r.m_Dir, wi, BsdfSample(true), pdf);
-                    if (!f.IsBlack() && pdf > 0.0f && !pInter->weight.IsBlack()) {
-                        MediumStack ms_copy = ms;
-                        total_bssrdf += li(Ray(intersection.intersect, wi, 0, 0.0001f), PixelSample(), scene, bounces + 1, true, bssrdfBounces + 1, true, ms_copy) * f * pInter->weight / pdf;
-                    }
-                }
-                
-                L += total_bssrdf * throughput / bssrdf_pdf;
             }
-            return L;
+            u -= weight;
         }
+        const auto& pInter = bssrdf_inter.intersections[picked];
+        const auto& intersection = pInter->intersection;
+        const auto pick_pdf = pInter->weight.GetIntensity() / total_weight;
+        if( pick_pdf <= 0.0f )
+            return false;
+
+        // Create a temporary lambert model to account the cos factor
+        // Fresnel is totally ignored here due to two reasons
+        //  - the lack of visual differences 
+        //  - more importantly, there will be a discontinuity introduced when mean free path approaches zero.
+        ScatteringEvent exit_se(intersection, SE_Flag( SE_EVALUATE_ALL | SE_REPLACE_BSSRDF ));
+        exit_se.AddBxdf( SORT_MALLOC(Lambert)( WHITE_SPECTRUM , FULL_WEIGHT , DIR_UP ) );
+
+        // Counts the light from indirect illumination in the rest of the path
+        float pdf = 0.0f;
+        Vector wi;
+        const auto f = exit_se.Sample_BSDF( -r.m_Dir, wi, BsdfSample(true), pdf);
+        if( f.IsBlack() || pdf == 0.0f )
+            return false;
+
+        throughput *= f * pInter->weight / ( pdf * bssrdf_pdf * pick_pdf );
+        if( 0.0f == throughput.GetIntensity() )
+            return false;
+
+        r = Ray( intersection.intersect, wi, 0, 0.0001f );
+        state.pdf = pdf;
+        state.flags |= PATH_REPLACE_SSS;
+        ++state.bssrdfBounces;
+    }else{
+        // nothing but BSSRDF could be picked here, which a scene without SSS doesn't have
+        return false;
+    }
 
-        if( bounces > 3 && throughput.GetMaxComponent() < 0.1f ){
-            auto continueProperbility = std::max( 0.05f , 1.0f - throughput.GetMaxComponent() );
-            if( sort_canonical() < continueProperbility )
-                break;
-            throughput /= 1 - continueProperbility;
-        }
+    if( russianRoulette( state ) )
+        return false;
 
-        ++bounces;
-        ++local_bounce;
+    ++state.bounces;
+    return true;
+}
 
-        replaceSSS = false;
+void PathTracing::finishPath( const PathState& state , const PathRadiance& radiance , GuidingRecorder& recorder , bool aov ) const{
+    if( aov && IsRecordingAov() ){
+        RecordLightingAov( radiance.directDone ? radiance.direct : radiance.L , radiance.directDone ? radiance.L - radiance.direct : Spectrum( 0.0f ) );
+        RecordPathDepthAov( state.bounces );
     }
 
-    return L;
+    SORT_STATS(sPathBounces.Add( state.bounces ));
+    recorder.Record( radiance.L );
+}
+
+bool PathTracing::russianRoulette( PathState& state ) const{
+    // the first few bounces are always kept, they take most of the energy
+    if( state.bounces < m_rouletteDepth )
+        return false;
+
+    // paths carrying most of their energy survive, the rest are kept with the chance of the energy they carry
+    // the energy is relative to the share of the sample the path carries, branches of a split path are not penalized
+    const auto energy = state.throughput.GetMaxComponent() / state.weight;
+    const auto survive_probability = std::max( RUSSIAN_ROULETTE_MIN_SURVIVAL , std::min( 1.0f , energy ) );
+    if( survive_probability >= 1.0f )
+        return false;
+    if( sort_canonical() >= survive_probability ){
+        SORT_STATS(sRouletteDepth.Add( state.bounces ));
+        return true;
+    }
+    state.throughput /= survive_probability;
+    return false;
 }
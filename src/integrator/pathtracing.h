@@ -17,11 +17,15 @@
 
 #pragma once
 
+#include <algorithm>
 #include "integrator.h"
+#include "pathguiding.h"
+#include "radiancecache.h"
+#include "occlusiongrid.h"
 
 //! @brief  The core of path tracing algorithm, the most commonly used algorithm in SORT.
 /**
- * A path tracing algorithm works by tracing rays recursively to converge to the correct approximation of rendering equation.
+ * A path tracing algorithm works by tracing rays bounce by bounce to converge to the correct approximation of rendering equation.
  * It doesn't solve all corner cases well, but it is a pretty solid algorithm.
  */
 class   PathTracing : public Integrator{
@@ -36,12 +40,63 @@ public:
     //! @return                 The radiance along the opposite direction that the ray points to.
     Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene) const override;
 
+    //! @brief  Setup path guiding and the radiance cache if they are enabled, pick the bounce kernel for the features of the scene.
+    //!
+    //! @param  scene           The scene to be evaluated.
+    void        PreProcess( const Scene& scene ) override;
+
+    //! @brief  Save the structures learned during rendering for the next rendering of the same scene.
+    void        PostProcess() override;
+
+    //! @brief  Path tracing takes camera rays traced in packets.
+    bool        SupportPrimaryRayPacket() const override {
+        return true;
+    }
+
+    //! @brief  Path tracing records the share of each light in the radiance of its samples.
+    bool        SupportRelighting() const override {
+        return true;
+    }
+
+    //! @brief  Evaluate the radiance along a specific direction with its first intersection found already.
+    //!
+    //! @param  ray             The ray to be tested with.
+    //! @param  ps              Pixel sample used to evaluate Monte Carlo method.
+    //! @param  scene           The scene to be evaluated.
+    //! @param  primary         The first intersection of the ray, its primitive is nullptr if the ray misses the scene.
+    //! @return                 The radiance along the opposite direction that the ray points to.
+    Spectrum    LiWithPrimaryHit( const Ray& ray , const PixelSample& ps , const Scene& scene , const SurfaceInteraction& primary ) const override;
+
+    //! @brief  Trace the paths of a batch of camera rays bounce by bounce.
+    //!
+    //! Paths alive after each bounce are sorted by the directions and origins of their next rays before they are traced
+    //! in packets. Each path is suspended in between, the result is exactly the same as tracing the paths one by one.
+    //!
+    //! @param  rays        Camera rays of the batch.
+    //! @param  ps          Pixel samples of the rays.
+    //! @param  scene       The scene to be evaluated.
+    //! @param  primary     The first intersections of the rays.
+    //! @param  cursors     Where the pixel samples of the rays are left off once the camera takes its dimensions.
+    //! @param  cnt         Number of rays in the batch.
+    //! @param  radiance    The radiance along the opposite directions of the rays to be returned.
+    void        LiDeferred( const Ray* rays , const PixelSample* const* ps , const Scene& scene , const SurfaceInteraction* primary ,
+                            const SampleCursor* cursors , unsigned int cnt , Spectrum* radiance ) const override;
+
     //! @brief      Serializing data from stream
     //!
     //! @param      Stream where the serialization data comes from. Depending on different situation, it could come from different places.
     void    Serialize( IStreamBase& stream ) override {
         Integrator::Serialize( stream );
         stream >> m_maxBouncesInBSSRDFPath;
+        stream >> m_pathGuiding;
+        stream >> m_rouletteDepth;
+        stream >> m_primarySplits;
+        m_primarySplits = std::max( 1 , m_primarySplits );
+        stream >> m_shadowRoulette;
+        m_shadowRoulette = std::max( 0.0f , m_shadowRoulette );
+        stream >> m_coarseShadow;
+        stream >> m_pathRegularization;
+        m_pathRegularization = std::max( 0.0f , m_pathRegularization );
     }
 
     SORT_STATS_ENABLE( "Path Tracing" )
@@ -52,16 +107,159 @@ private:
     // Most importantly, it kills the performance and introduces quite some fireflies with bounces more than 2.
     int     m_maxBouncesInBSSRDFPath;
 
-    //! @brief  Evaluate the radiance along a specific direction.
+    /**< Whether to guide the bsdf sampling with the incident radiance learned during rendering. */
+    bool                            m_pathGuiding = false;
+    /**< The guiding structure that is trained online, nullptr if path guiding is disabled. */
+    std::unique_ptr<PathGuiding>    m_guiding;
+    /**< Irradiance cached for diffuse surfaces after the first bounce in preview quality, nullptr otherwise. */
+    std::unique_ptr<RadianceCache>  m_radianceCache;
+    /**< Whether shadow rays after the first bounce are answered by a coarse occlusion grid in preview quality. */
+    bool                            m_coarseShadow = false;
+    /**< Coarse occupancy of the scene for shadow rays after the first bounce in preview quality, nullptr otherwise. */
+    std::unique_ptr<OcclusionGrid>  m_occlusionGrid;
+    /**< Hash of the scene, the learned structures are only carried over to renderings of the same scene. */
+    std::uint64_t                   m_sceneHash = 0;
+
+    /**< Number of bounces before russian roulette kicks in, the first few bounces take most of the energy. */
+    int     m_rouletteDepth = 3;
+    /**< Number of branches a path is split into at its first hit, one means no splitting. */
+    int     m_primarySplits = 1;
+    /**< Shadow rays bringing less than this portion of the radiance gathered by the path so far are in russian roulette. */
+    float   m_shadowRoulette = 0.0f;
+    /**< Strength of path regularization, glossy lobes are blurred after bounces of low pdf. Zero disables it. */
+    float   m_pathRegularization = 0.0f;
+
+    //! @brief  Features of the scene that need to be handled at every bounce.
+    /**
+     * The bounce kernel is specialized for each combination of them, a scene without any of them doesn't pay for checking
+     * them at every bounce. It is picked once per render based on the scene.
+     */
+    enum PathFeature : unsigned {
+        PATH_FEATURE_VOLUME = 0x01,     /**< Some material has volume attached, rays could scatter in mediums. */
+        PATH_FEATURE_SSS    = 0x02,     /**< Some material has SSS. */
+        PATH_FEATURE_SKY    = 0x04,     /**< There is a sky light, rays missing the scene gather radiance from it. */
+        PATH_FEATURE_ALL    = 0x07,     /**< All features, used if the scene is not known. */
+    };
+
+    class GuidingRecorder;
+    struct PathState;
+    struct PathRadiance;
+
+    //! @brief  Bounce kernel specialized for a set of scene features.
+    using BounceKernel = bool (PathTracing::*)( PathState& , PathRadiance& , const Scene& , MediumStack& , SurfaceInteraction* , GuidingRecorder& ) const;
+
+    /**< The bounce kernel picked for the scene being rendered, the one handling all features until the scene is known. */
+    BounceKernel    m_bounce = &PathTracing::bounceKernel<PATH_FEATURE_ALL>;
+
+    //! @brief  Flags of a path.
+    enum PathFlag : unsigned {
+        PATH_EMISSION       = 0x01,     /**< Emission at the next intersection is accounted, only camera rays count it, the rest is taken by NEE. */
+        PATH_REPLACE_SSS    = 0x02,     /**< BSSRDF at the next intersection is replaced with lambert. */
+    };
+
+    //! @brief  Compact state of a path, it holds everything needed to resume tracing the path from its last vertex.
+    /**
+     * The medium stack of the path is not part of the state, it is mutated in place by the one tracing the path, a batch of
+     * paths keeps one stack per path instead.
+     */
+    struct PathState{
+        Ray         ray;                        /**< The ray to be traced next. */
+        Spectrum    throughput = 1.0f;          /**< Throughput of the path from the camera to the origin of the ray. */
+        float       pdf = 1.0f;                 /**< Pdf of picking the direction of the ray. */
+        int         bounces = 0;                /**< Number of bounces in the path. */
+        int         bssrdfBounces = 0;          /**< Number of bounces on BSSRDF surfaces in the path. */
+        unsigned    flags = PATH_EMISSION;      /**< Flags of the path. */
+        float       weight = 1.0f;              /**< Share of the camera sample carried by the path, branches split at the first hit carry less. */
+        float       minPdf = FLT_MAX;           /**< Lowest pdf of the non-delta bsdf samples in the path, it drives path regularization. */
+    };
+
+    //! @brief  Radiance gathered by a path so far.
+    struct PathRadiance{
+        Spectrum    L;                          /**< Radiance carried by the path. */
+        Spectrum    direct;                     /**< Radiance gathered at the first vertex, the rest is indirect illumination. */
+        bool        directDone = false;         /**< Whether the first vertex is done. */
+    };
+
+    //! @brief  Trace a path iteratively until it is terminated.
     //!
-    //! @param  ray             The ray to be tested with.
-    //! @param  ps              Pixel sample used to evaluate Monte Carlo method.
+    //! @param  state           State of the path, it is updated as the path is traced.
     //! @param  scene           The scene to be evaluated.
-    //! @param  bounces         The current number of bounces considered.
-    //! @param  indirectOnly    Whether just to evaluate the indirect light, default value is false.
-    //! @param  bssrdfBounces   Bounces on BSSRDF surfaces in the path.
-    //! @param  replaceSSS      Whether to replace SSS with lambert.
-    //! @param  ms              Medium stack during radiance evaluation.
-    //! @return                 The radiance along the opposite direction that the ray points to.
-    Spectrum    li( const Ray& ray , const PixelSample& ps , const Scene& scene , int bounces , bool indirectOnly , int bssrdfBounces , bool replaceSSS , MediumStack& ms ) const;
-};
+    //! @param  ms              Medium stack of the path.
+    //! @param  primary         The intersection of the first ray if it is found already.
+    //! @return                 The radiance carried by the path.
+    Spectrum    li( PathState& state , const Scene& scene , MediumStack& ms , const SurfaceInteraction* primary = nullptr ) const;
+
+    //! @brief  Trace a path that is split into multiple branches at its first hit.
+    //!
+    //! The camera ray is traced only once, each branch shades the first hit on its own, taking its own light sample and
+    //! picking its own bounce. Expensive first hits, like the ones on SSS or hair, are amortized over more samples.
+    //!
+    //! @param  state           State of the path, it is updated with the longest branch.
+    //! @param  scene           The scene to be evaluated.
+    //! @param  ms              Medium stack of the path, each branch starts with a copy of it.
+    //! @param  primary         The intersection of the first ray if it is found already.
+    //! @return                 The radiance carried by all branches of the path.
+    Spectrum    liSplit( PathState& state , const Scene& scene , MediumStack& ms , const SurfaceInteraction* primary ) const;
+
+    //! @brief  Trace the bounces of a path until it is terminated.
+    //!
+    //! @param  state           State of the path, it is updated as the path is traced.
+    //! @param  radiance        Radiance gathered by the path.
+    //! @param  scene           The scene to be evaluated.
+    //! @param  ms              Medium stack of the path.
+    //! @param  recorder        Vertices of the path to be recorded in the guiding structure.
+    //! @param  primary         The intersection of the first ray if it is found already.
+    void        trace( PathState& state , PathRadiance& radiance , const Scene& scene , MediumStack& ms , GuidingRecorder& recorder , const SurfaceInteraction* primary ) const;
+
+    //! @brief  Check whether a path is going to trace another ray.
+    //!
+    //! @param  state           State of the path.
+    //! @param  radiance        Radiance gathered by the path so far.
+    //! @return                 Whether the next ray of the path is to be traced.
+    bool        beginBounce( PathState& state , PathRadiance& radiance ) const;
+
+    //! @brief  Shade the intersection of the last ray of a path and pick the next ray.
+    //!
+    //! @param  state           State of the path, its ray is replaced with the next one.
+    //! @param  radiance        Radiance gathered by the path so far.
+    //! @param  scene           The scene to be evaluated.
+    //! @param  ms              Medium stack of the path.
+    //! @param  hit             The intersection of the last ray, nullptr if the ray misses the scene.
+    //! @param  recorder        Vertices of the path to be recorded in the guiding structure.
+    //! @return                 Whether the path continues.
+    bool        bounce( PathState& state , PathRadiance& radiance , const Scene& scene , MediumStack& ms , SurfaceInteraction* hit , GuidingRecorder& recorder ) const{
+        return ( this->*m_bounce )( state , radiance , scene , ms , hit , recorder );
+    }
+
+    //! @brief  Shade the intersection of the last ray of a path and pick the next ray, specialized for a set of scene features.
+    //!
+    //! Features that are not in the set are skipped, the result is only correct if the scene doesn't have them.
+    //!
+    //! @param  state           State of the path, its ray is replaced with the next one.
+    //! @param  radiance        Radiance gathered by the path so far.
+    //! @param  scene           The scene to be evaluated.
+    //! @param  ms              Medium stack of the path.
+    //! @param  hit             The intersection of the last ray, nullptr if the ray misses the scene.
+    //! @param  recorder        Vertices of the path to be recorded in the guiding structure.
+    //! @return                 Whether the path continues.
+    template<unsigned Features>
+    bool        bounceKernel( PathState& state , PathRadiance& radiance , const Scene& scene , MediumStack& ms , SurfaceInteraction* hit , GuidingRecorder& recorder ) const;
+
+    //! @brief  Record what is needed once a path is terminated.
+    //!
+    //! @param  state           State of the path.
+    //! @param  radiance        Radiance gathered by the path.
+    //! @param  recorder        Vertices of the path to be recorded in the guiding structure.
+    //! @param  aov             Whether the path fills the AOVs of the sample, branches of a split path don't.
+    void        finishPath( const PathState& state , const PathRadiance& radiance , GuidingRecorder& recorder , bool aov = true ) const;
+
+    //! @brief  Russian roulette based on the throughput of the path.
+    //!
+    //! The survival probability is the throughput relative to the share of the camera sample the path carries. A branch of
+    //! a split path is not killed more often only because it is one of many, otherwise the splitting would be undone by
+    //! the roulette right away.
+    //!
+    //! @param  state           State of the path, its throughput is scaled up if it survives.
+    //! @return                 Whether the path is terminated.
+    bool        russianRoulette( PathState& state ) const;
+};
\ No newline at end of file
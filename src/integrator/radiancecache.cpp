@@ -0,0 +1,282 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include "radiancecache.h"
+#include "integratormethod.h"
+#include "core/scene.h"
+#include "core/samplemethod.h"
+#include "core/rand.h"
+#include "core/stats.h"
+#include "core/profile.h"
+#include "material/material.h"
+#include "medium/medium.h"
+#include "scatteringevent/scatteringevent.h"
+#include "stream/fstream.h"
+
+SORT_STATS_DEFINE_COUNTER(sRadianceCacheQuery)
+SORT_STATS_DEFINE_COUNTER(sRadianceCacheHit)
+SORT_STATS_DEFINE_COUNTER(sRadianceCacheRecord)
+SORT_STATS_DEFINE_COUNTER(sRadianceCacheLoadedRecord)
+
+SORT_STATS_COUNTER("Radiance Cache", "Queries", sRadianceCacheQuery);
+SORT_STATS_RATIO("Radiance Cache", "Hit Rate", sRadianceCacheHit, sRadianceCacheQuery);
+SORT_STATS_COUNTER("Radiance Cache", "Records", sRadianceCacheRecord);
+SORT_STATS_COUNTER("Radiance Cache", "Records Carried Over", sRadianceCacheLoadedRecord);
+
+static constexpr unsigned int RADIANCE_CACHE_MAGIC      = 0x43435253;
+static constexpr unsigned int RADIANCE_CACHE_VERSION    = 1;
+
+// Number of cosine weighted rays gathering the irradiance of a record.
+static constexpr unsigned   RADIANCE_CACHE_GATHER_RAY_CNT   = 16;
+// Largest radius of records relative to the diagonal of the scene.
+static constexpr float      RADIANCE_CACHE_MAX_RADIUS       = 0.02f;
+// Smallest radius of records relative to the largest one, it stops records from piling up in corners.
+static constexpr float      RADIANCE_CACHE_MIN_RADIUS       = 0.1f;
+// Radius of a record relative to the harmonic mean distance to the surfaces around it, smaller is more accurate.
+static constexpr float      RADIANCE_CACHE_ACCURACY         = 0.5f;
+// Records with normals deviating more than this from the one of the query are not reused.
+static constexpr float      RADIANCE_CACHE_MIN_COS          = 0.9f;
+// Records carried over from previous renderings are dropped once their trust falls below this.
+static constexpr float      RADIANCE_CACHE_MIN_TRUST        = 0.2f;
+
+void RadianceCache::Reset( const Scene& scene ){
+    m_bbox = scene.GetBBox();
+    m_maxRadius = std::max( RADIANCE_CACHE_MAX_RADIUS * ( m_bbox.m_Max - m_bbox.m_Min ).Length() , 1e-4f );
+    m_minRadius = RADIANCE_CACHE_MIN_RADIUS * m_maxRadius;
+    m_invCellSize = 1.0f / ( 2.0f * m_maxRadius );
+
+    m_buckets = std::make_unique<Bucket[]>( RADIANCE_CACHE_BUCKET_CNT );
+    for( auto i = 0u ; i < RADIANCE_CACHE_BUCKET_CNT ; ++i )
+        m_buckets[i].cnt.store( 0 , std::memory_order_relaxed );
+}
+
+Spectrum RadianceCache::GetIrradiance( const Scene& scene , const Point& p , const Vector& n ){
+    SORT_STATS(++sRadianceCacheQuery);
+
+    Spectrum irradiance;
+    if( lookup( p , n , irradiance ) ){
+        SORT_STATS(++sRadianceCacheHit);
+        return irradiance;
+    }
+
+    // threads missing the same area at the same time may all create records there, it only costs a bit more memory
+    const auto record = gather( scene , p , n );
+    const auto d = ( p - m_bbox.m_Min ) * m_invCellSize;
+    auto& b = m_buckets[bucket( (int)floor( d.x ) , (int)floor( d.y ) , (int)floor( d.z ) )];
+    {
+        std::lock_guard<spinlock_mutex> lock( b.lock );
+        const auto cnt = b.cnt.load( std::memory_order_relaxed );
+        if( cnt < sizeof( b.records ) / sizeof( b.records[0] ) ){
+            b.records[cnt] = record;
+            b.cnt.store( cnt + 1 , std::memory_order_release );
+            SORT_STATS(++sRadianceCacheRecord);
+        }
+    }
+    return record.irradiance;
+}
+
+bool RadianceCache::lookup( const Point& p , const Vector& n , Spectrum& irradiance ) const{
+    // the 2x2x2 cells start from the cell closer to the point on each axis
+    const auto d = ( p - m_bbox.m_Min ) * m_invCellSize;
+    int start[3];
+    for( auto i = 0 ; i < 3 ; ++i ){
+        const auto c = floor( d[i] );
+        start[i] = (int)c - ( d[i] - c < 0.5f ? 1 : 0 );
+    }
+
+    // neighbor cells may fall in the same bucket, each bucket is only visited once
+    unsigned visited[8];
+    auto visited_cnt = 0u;
+    auto total_weight = 0.0f;
+    Spectrum total;
+    for( auto i = 0 ; i < 8 ; ++i ){
+        const auto b = bucket( start[0] + ( i & 1 ) , start[1] + ( ( i >> 1 ) & 1 ) , start[2] + ( i >> 2 ) );
+        if( std::find( visited , visited + visited_cnt , b ) != visited + visited_cnt )
+            continue;
+        visited[visited_cnt++] = b;
+
+        const auto& records = m_buckets[b];
+        const auto cnt = records.cnt.load( std::memory_order_acquire );
+        for( auto k = 0u ; k < cnt ; ++k ){
+            const auto& record = records.records[k];
+            const auto cos = dot( record.n , n );
+            if( cos < RADIANCE_CACHE_MIN_COS )
+                continue;
+            const auto dist = ( p - record.p ).Length();
+            if( dist >= record.radius )
+                continue;
+
+            const auto weight = ( 1.0f - dist / record.radius ) * cos * record.trust;
+            total += record.irradiance * weight;
+            total_weight += weight;
+        }
+    }
+
+    if( total_weight <= 0.0f )
+        return false;
+    irradiance = total / total_weight;
+    return true;
+}
+
+RadianceCache::Record RadianceCache::gather( const Scene& scene , const Point& p , const Vector& n ) const{
+    Vector t , s;
+    coordinateSystem( n , t , s );
+
+    Spectrum    radiance;
+    auto        inv_dist = 0.0f;
+    for( auto i = 0u ; i < RADIANCE_CACHE_GATHER_RAY_CNT ; ++i ){
+        const auto local = CosSampleHemisphere( sort_canonical() , sort_canonical() );
+        const Ray ray( p , t * local.x + n * local.y + s * local.z , 0 , 0.0001f );
+
+        // rays escaping the scene see surfaces infinitely far away, emission and the sky are taken by light sampling
+        SurfaceInteraction inter;
+        if( !scene.GetIntersect( ray , inter ) )
+            continue;
+        inv_dist += 1.0f / std::max( inter.t , m_minRadius );
+
+        // direct illumination leaving the surface towards the point, volumes and SSS are ignored
+        const auto material = inter.primitive->GetMaterial();
+        ScatteringEvent se( inter , SE_Flag( SE_EVALUATE_ALL | SE_REPLACE_BSSRDF ) );
+        material->UpdateScatteringEvent( se );
+        radiance += SampleOneLight( se , ray , inter , scene , material , MediumStack() );
+    }
+
+    // with cosine weighted rays, the irradiance is PI times the average radiance
+    Record record;
+    record.p = p;
+    record.n = n;
+    record.irradiance = radiance * ( PI / RADIANCE_CACHE_GATHER_RAY_CNT );
+
+    // harmonic mean distance to the surfaces around, the same as in 'A Ray Tracing Solution for Diffuse Interreflection'
+    const auto mean_dist = inv_dist > 0.0f ? RADIANCE_CACHE_GATHER_RAY_CNT / inv_dist : FLT_MAX;
+    record.radius = std::min( m_maxRadius , std::max( m_minRadius , RADIANCE_CACHE_ACCURACY * mean_dist ) );
+    return record;
+}
+
+bool RadianceCache::LoadCache( const std::string& filename , std::uint64_t key , float decay ){
+    SORT_PROFILE("Load Radiance Cache");
+
+    // IFileStream complains about missing files, a missing cache is totally expected though.
+    if( !std::ifstream( filename ).good() )
+        return false;
+
+    IFileStream file( filename );
+    IStreamBase& stream = file;
+    unsigned int magic = 0 , version = 0 , key_lo = 0 , key_hi = 0;
+    stream >> magic >> version >> key_lo >> key_hi;
+    if( magic != RADIANCE_CACHE_MAGIC || version != RADIANCE_CACHE_VERSION )
+        return false;
+    if( key_lo != (unsigned int)( key & 0xffffffff ) || key_hi != (unsigned int)( key >> 32 ) )
+        return false;
+
+    // records are placed in the same buckets, the grid needs to be the same
+    auto max_radius = 0.0f;
+    stream >> max_radius;
+    if( max_radius != m_maxRadius )
+        return false;
+
+    decay = clamp( decay , 0.0f , 1.0f );
+    auto bucket_cnt = 0u;
+    stream >> bucket_cnt;
+    if( bucket_cnt > RADIANCE_CACHE_BUCKET_CNT )
+        return false;
+
+    // records are only published once the whole file is validated
+    auto buckets = std::make_unique<Bucket[]>( RADIANCE_CACHE_BUCKET_CNT );
+    for( auto i = 0u ; i < RADIANCE_CACHE_BUCKET_CNT ; ++i )
+        buckets[i].cnt.store( 0 , std::memory_order_relaxed );
+
+    auto loaded = 0u;
+    for( auto i = 0u ; i < bucket_cnt ; ++i ){
+        auto index = 0u , cnt = 0u;
+        stream >> index >> cnt;
+        if( index >= RADIANCE_CACHE_BUCKET_CNT || cnt > sizeof( Bucket::records ) / sizeof( Bucket::records[0] ) )
+            return false;
+
+        auto& b = buckets[index];
+        auto kept = b.cnt.load( std::memory_order_relaxed );
+        for( auto k = 0u ; k < cnt ; ++k ){
+            Record record;
+            stream >> record.p >> record.n >> record.irradiance >> record.radius >> record.trust;
+            if( !( record.radius > 0.0f ) || record.radius > m_maxRadius )
+                return false;
+
+            // records not trusted enough are gathered again
+            record.trust *= decay;
+            if( record.trust < RADIANCE_CACHE_MIN_TRUST || kept >= sizeof( b.records ) / sizeof( b.records[0] ) )
+                continue;
+            b.records[kept++] = record;
+        }
+        b.cnt.store( kept , std::memory_order_relaxed );
+        loaded += kept;
+    }
+
+    // a truncated file doesn't end with the magic number
+    magic = 0;
+    stream >> magic;
+    if( magic != RADIANCE_CACHE_MAGIC )
+        return false;
+
+    m_buckets = std::move( buckets );
+    SORT_STATS(sRadianceCacheLoadedRecord += loaded);
+    return loaded > 0;
+}
+
+bool RadianceCache::SaveCache( const std::string& filename , std::uint64_t key ) const{
+    SORT_PROFILE("Save Radiance Cache");
+
+    if( !m_buckets )
+        return false;
+
+    auto bucket_cnt = 0u;
+    for( auto i = 0u ; i < RADIANCE_CACHE_BUCKET_CNT ; ++i )
+        if( m_buckets[i].cnt.load( std::memory_order_acquire ) > 0 )
+            ++bucket_cnt;
+
+    const auto tmp_filename = filename + ".tmp";
+    {
+        OFileStream file( tmp_filename );
+        OStreamBase& stream = file;
+        stream << RADIANCE_CACHE_MAGIC << RADIANCE_CACHE_VERSION;
+        stream << (unsigned int)( key & 0xffffffff ) << (unsigned int)( key >> 32 );
+        stream << m_maxRadius << bucket_cnt;
+        for( auto i = 0u ; i < RADIANCE_CACHE_BUCKET_CNT ; ++i ){
+            const auto& b = m_buckets[i];
+            const auto cnt = b.cnt.load( std::memory_order_acquire );
+            if( 0 == cnt )
+                continue;
+            stream << i << cnt;
+            for( auto k = 0u ; k < cnt ; ++k ){
+                const auto& record = b.records[k];
+                stream << record.p << record.n << record.irradiance << record.radius << record.trust;
+            }
+        }
+        stream << RADIANCE_CACHE_MAGIC;
+    }
+
+    // the previous cache is only replaced once the new one is fully written
+    remove( filename.c_str() );
+    if( 0 != rename( tmp_filename.c_str() , filename.c_str() ) ){
+        remove( tmp_filename.c_str() );
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,124 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include "core/thread.h"
+#include "math/bbox.h"
+#include "spectrum/spectrum.h"
+
+class Scene;
+
+//! @brief  World space cache of irradiance on diffuse surfaces, it is only meant for fast previews.
+/**
+ * Each record is the irradiance at a point gathered with a few cosine weighted rays, along with a radius within which it is
+ * reused. The radius comes from the harmonic mean distance to the surfaces seen by the gathering rays, records close to
+ * other geometry are reused in smaller areas, which is the idea of irradiance caching. Only direct illumination at the
+ * surfaces hit by the gathering rays is accounted, a record holds one bounce of indirect illumination.
+ *
+ * Records are created lazily the first time a point is queried without any record around it. Records are kept in a
+ * hashed grid whose cells are twice as large as the maximum radius, the same as HashGrid, a query visits the 2x2x2 cells
+ * around the point. Each bucket holds a fixed number of records, new records are dropped once a bucket is full. Threads
+ * creating records in the same bucket are serialized, queries never take a lock.
+ *
+ * Records could be carried over to the next rendering of the same scene. Each time a record is carried over, it is
+ * trusted less and it counts less when being interpolated with fresh records. Records no longer trusted enough are
+ * dropped and gathered again.
+ */
+class RadianceCache{
+public:
+    //! @brief  Clear all records and fit the grid in the scene.
+    //!
+    //! @param  scene       The scene to be evaluated.
+    void        Reset( const Scene& scene );
+
+    //! @brief  Get the irradiance at a point, a record is created if there is none close enough.
+    //!
+    //! @param  scene       The scene to be evaluated.
+    //! @param  p           Position of the query.
+    //! @param  n           Shading normal at the position, it points to the side where irradiance is gathered.
+    //! @return             The irradiance at the point.
+    Spectrum    GetIrradiance( const Scene& scene , const Point& p , const Vector& n );
+
+    //! @brief  Load the records saved in a previous rendering of the same scene, it has to be called after 'Reset'.
+    //!
+    //! @param  filename    The file saved by 'SaveCache'.
+    //! @param  key         Hash of the scene, the cache is dropped if it is saved for another scene.
+    //! @param  decay       Factor applied to the trust of each loaded record.
+    //! @return             Whether any record is loaded.
+    bool        LoadCache( const std::string& filename , std::uint64_t key , float decay );
+
+    //! @brief  Save all records so that the next rendering of the same scene could start with them.
+    //!
+    //! @param  filename    The file to save the records in.
+    //! @param  key         Hash of the scene.
+    //! @return             Whether the records are saved.
+    bool        SaveCache( const std::string& filename , std::uint64_t key ) const;
+
+private:
+    //! @brief  A cached irradiance value.
+    struct Record{
+        Point       p;              /**< Position of the record. */
+        Vector      n;              /**< Shading normal of the record. */
+        Spectrum    irradiance;     /**< Irradiance at the position. */
+        float       radius = 0.0f;  /**< Radius within which the record is reused. */
+        float       trust = 1.0f;   /**< Weight of the record in interpolation, it decays each time the record is carried over. */
+    };
+
+    //! @brief  Records falling in a bucket of the grid.
+    struct Bucket{
+        Record                  records[8];     /**< Records of the bucket, only the first 'cnt' of them are valid. */
+        std::atomic<unsigned>   cnt;            /**< Number of records published in the bucket. */
+        spinlock_mutex          lock;           /**< Threads creating records in the bucket take turns. */
+    };
+
+    BBox        m_bbox;                     /**< Bounding box of the scene. */
+    float       m_maxRadius = 0.0f;         /**< Largest radius of records. */
+    float       m_minRadius = 0.0f;         /**< Smallest radius of records. */
+    float       m_invCellSize = 0.0f;       /**< Reciprocal of the size of cells. */
+
+    /**< Buckets of the grid, the number of buckets is a power of two. */
+    std::unique_ptr<Bucket[]>   m_buckets;
+
+    //! @brief  Interpolate the records around a point.
+    //!
+    //! @param  p           Position of the query.
+    //! @param  n           Shading normal at the position.
+    //! @param  irradiance  The interpolated irradiance, only valid if there is any record around.
+    //! @return             Whether there is any record close enough to the point.
+    bool        lookup( const Point& p , const Vector& n , Spectrum& irradiance ) const;
+
+    //! @brief  Gather the irradiance at a point with cosine weighted rays.
+    //!
+    //! @param  scene       The scene to be evaluated.
+    //! @param  p           Position of the point.
+    //! @param  n           Shading normal at the point.
+    //! @return             The new record at the point.
+    Record      gather( const Scene& scene , const Point& p , const Vector& n ) const;
+
+    //! @brief  Bucket of a cell.
+    SORT_FORCEINLINE unsigned bucket( int x , int y , int z ) const {
+        return ( ( (unsigned)x * 73856093u ) ^ ( (unsigned)y * 19349663u ) ^ ( (unsigned)z * 83492791u ) ) & ( RADIANCE_CACHE_BUCKET_CNT - 1 );
+    }
+
+    // Number of buckets in the grid, a bucket takes a few hundred bytes.
+    static constexpr unsigned RADIANCE_CACHE_BUCKET_CNT = 1u << 15;
+};
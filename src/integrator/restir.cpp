@@ -0,0 +1,243 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <mutex>
+#include "restir.h"
+#include "math/interaction.h"
+#include "core/globalconfig.h"
+#include "core/rand.h"
+#include "math/utils.h"
+#include "light/light.h"
+#include "material/material.h"
+#include "scatteringevent/scatteringevent.h"
+
+SORT_STATS_DECLARE_COUNTER(sPrimaryRayCount)
+SORT_STATS_DEFINE_COUNTER(sReSTIRReusedReservoirs)
+
+SORT_STATS_COUNTER("ReSTIR DI", "Primary Ray Count" , sPrimaryRayCount);
+SORT_STATS_COUNTER("ReSTIR DI", "Reused Reservoirs" , sReSTIRReusedReservoirs);
+
+// Reservoirs of previous samples are clamped to this many times the candidates of a sample, so that the history doesn't
+// dominate forever. It is the same number suggested in the paper.
+static constexpr float RESTIR_HISTORY_LIMIT = 20.0f;
+
+// Reservoirs are only reused between surfaces that are similar enough, otherwise the reused light samples hardly fit.
+static constexpr float RESTIR_NORMAL_THRESHOLD = 0.9f;
+static constexpr float RESTIR_DEPTH_THRESHOLD = 0.1f;
+
+// Whether nothing blocks the ray toward the light sample.
+static bool isVisible( const Visibility& visibility ){
+#ifndef ENABLE_TRANSPARENT_SHADOW
+    return visibility.IsVisible();
+#else
+    return !visibility.GetAttenuation().IsBlack();
+#endif
+}
+
+void ReSTIRDI::PreProcess( const Scene& scene ){
+    m_width = (int)g_resultResollutionWidth;
+    m_height = (int)g_resultResollutionHeight;
+    m_reservoirs = std::make_unique<PixelReservoir[]>( m_width * m_height * 2 );
+    m_locks = std::make_unique<spinlock_mutex[]>( m_width * m_height );
+}
+
+Spectrum ReSTIRDI::Li( const Ray& r , const PixelSample& ps , const Scene& scene ) const{
+    SORT_STATS(++sPrimaryRayCount);
+
+    if( r.m_Depth > max_recursive_depth )
+        return 0.0f;
+
+    SurfaceInteraction ip;
+    if( false == scene.GetIntersect( r , ip ) )
+        return scene.Le( r );
+
+    auto radiance = ip.Le( -r.m_Dir );
+
+    // no support for SSS in this integrator.
+    ScatteringEvent se( ip , SE_EVALUATE_ALL_NO_SSS );
+    ip.primitive->GetMaterial()->UpdateScatteringEvent( se );
+    const auto wo = -r.m_Dir;
+
+    // The reservoir combining all the ones reused by the pixel. Along with the light sample in it, the unshadowed
+    // contribution, the target function and the shadow ray of the sample are kept so that it is not evaluated again.
+    Reservoir   combined;
+    Spectrum    combined_contribution;
+    auto        combined_target = 0.0f;
+    Visibility  combined_visibility( scene );
+    const auto merge = [&]( const Reservoir& reservoir , const Spectrum& contribution , const float target , const Visibility& visibility ){
+        combined.M += reservoir.M;
+        const auto weight = target * reservoir.W * reservoir.M;
+        if( weight <= 0.0f )
+            return;
+        combined.weight_sum += weight;
+        if( sort_canonical() * combined.weight_sum < weight ){
+            combined.sample = reservoir.sample;
+            combined_contribution = contribution;
+            combined_target = target;
+            combined_visibility.ray = visibility.ray;
+        }
+    };
+
+    // initial candidates are picked through the light tree, lights close to the shading point are more likely to be picked
+    {
+        Reservoir   reservoir;
+        Spectrum    contribution;
+        auto        target = 0.0f;
+        Visibility  visibility( scene );
+        for( auto i = 0 ; i < m_candidateCnt ; ++i ){
+            reservoir.M += 1.0f;
+
+            float light_pick_pdf = 0.0f;
+            LightSampleRecord candidate;
+            candidate.light = scene.SampleLight( ip.intersect , ip.gnormal , sort_canonical() , &light_pick_pdf );
+            if( IS_PTR_INVALID(candidate.light) || light_pick_pdf <= 0.0f )
+                continue;
+            candidate.t = sort_canonical();
+            candidate.u = sort_canonical();
+            candidate.v = sort_canonical();
+
+            Visibility candidate_visibility( scene );
+            const auto c = evaluate( se , wo , candidate , candidate_visibility );
+            const auto p_hat = c.GetIntensity();
+            if( p_hat <= 0.0f )
+                continue;
+
+            // the points on lights are sampled with canonical random numbers, only the pdf of picking the light is left
+            const auto weight = p_hat / light_pick_pdf;
+            reservoir.weight_sum += weight;
+            if( sort_canonical() * reservoir.weight_sum < weight ){
+                reservoir.sample = candidate;
+                contribution = c;
+                target = p_hat;
+                visibility.ray = candidate_visibility.ray;
+            }
+        }
+
+        // occluded samples are not worth reusing by anyone
+        if( target > 0.0f && isVisible( visibility ) )
+            reservoir.W = reservoir.weight_sum / ( reservoir.M * target );
+        merge( reservoir , contribution , target , visibility );
+    }
+
+    const auto in_image = ps.pixel_x >= 0 && ps.pixel_x < m_width && ps.pixel_y >= 0 && ps.pixel_y < m_height && m_reservoirs;
+    if( in_image ){
+        const auto max_history = RESTIR_HISTORY_LIMIT * (float)m_candidateCnt;
+        const auto depth = ip.t;
+        const auto reuse = [&]( int x , int y ){
+            PixelReservoir previous;
+            if( !fetch( x , y , ps.index , previous ) )
+                return;
+            if( dot( previous.normal , ip.normal ) < RESTIR_NORMAL_THRESHOLD || fabs( previous.depth - depth ) > RESTIR_DEPTH_THRESHOLD * depth )
+                return;
+
+            auto& reservoir = previous.reservoir;
+            reservoir.M = std::min( reservoir.M , max_history );
+
+            // the light sample is evaluated again at the shading point of this pixel
+            Visibility visibility( scene );
+            const auto c = evaluate( se , wo , reservoir.sample , visibility );
+            merge( reservoir , c , c.GetIntensity() , visibility );
+            SORT_STATS(++sReSTIRReusedReservoirs);
+        };
+
+        // temporal reuse, the previous sample of the same pixel
+        if( m_temporalReuse )
+            reuse( ps.pixel_x , ps.pixel_y );
+
+        // spatial reuse, a few random pixels nearby
+        for( auto i = 0 ; i < m_spatialNeighborCnt ; ++i ){
+            const auto radius = m_spatialRadius * sqrt( sort_canonical() );
+            const auto phi = TWO_PI * sort_canonical();
+            const auto x = ps.pixel_x + (int)( radius * cos( phi ) );
+            const auto y = ps.pixel_y + (int)( radius * sin( phi ) );
+            if( ( x == ps.pixel_x && y == ps.pixel_y ) || x < 0 || x >= m_width || y < 0 || y >= m_height )
+                continue;
+            reuse( x , y );
+        }
+    }
+
+    if( combined_target > 0.0f )
+        combined.W = combined.weight_sum / ( combined.M * combined_target );
+
+    if( in_image ){
+        PixelReservoir current;
+        current.reservoir = combined;
+        current.reservoir.M = std::min( combined.M , RESTIR_HISTORY_LIMIT * (float)m_candidateCnt );
+        current.normal = ip.normal;
+        current.depth = ip.t;
+        current.stamp = ps.index + 1;
+        store( ps.pixel_x , ps.pixel_y , ps.index , current );
+    }
+
+    // only the light sample finally picked needs a shadow ray
+    if( combined.W > 0.0f ){
+#ifndef ENABLE_TRANSPARENT_SHADOW
+        if( combined_visibility.IsVisible() )
+            radiance += combined_contribution * combined.W;
+#else
+        radiance += combined_visibility.GetAttenuation() * combined_contribution * combined.W;
+#endif
+    }
+
+    return radiance;
+}
+
+Spectrum ReSTIRDI::evaluate( const ScatteringEvent& se , const Vector& wo , const LightSampleRecord& sample , Visibility& visibility ) const{
+    if( IS_PTR_INVALID(sample.light) )
+        return 0.0f;
+
+    LightSample ls;
+    ls.t = sample.t;
+    ls.u = sample.u;
+    ls.v = sample.v;
+
+    Vector wi;
+    auto light_pdf = 0.0f;
+    const auto li = sample.light->sample_l( se.GetInteraction().intersect , &ls , wi , 0 , &light_pdf , 0 , 0 , visibility );
+    if( light_pdf <= 0.0f || li.IsBlack() )
+        return 0.0f;
+    return li * se.Evaluate_BSDF( wo , wi ) / light_pdf;
+}
+
+bool ReSTIRDI::fetch( int x , int y , unsigned int index , PixelReservoir& ret ) const{
+    const auto pixel = y * m_width + x;
+
+    PixelReservoir slots[2];
+    {
+        std::lock_guard<spinlock_mutex> lock( m_locks[pixel] );
+        slots[0] = m_reservoirs[pixel * 2];
+        slots[1] = m_reservoirs[pixel * 2 + 1];
+    }
+
+    // the latest one written by a sample before this one, a pixel nearby may have written the other one in the same pass
+    auto found = false;
+    for( const auto& slot : slots ){
+        if( slot.stamp == 0 || slot.stamp > index )
+            continue;
+        if( !found || slot.stamp > ret.stamp ){
+            ret = slot;
+            found = true;
+        }
+    }
+    return found;
+}
+
+void ReSTIRDI::store( int x , int y , unsigned int index , const PixelReservoir& reservoir ) const{
+    const auto pixel = y * m_width + x;
+    std::lock_guard<spinlock_mutex> lock( m_locks[pixel] );
+    m_reservoirs[pixel * 2 + ( index & 1 )] = reservoir;
+}
@@ -0,0 +1,134 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "integrator.h"
+#include "core/thread.h"
+
+class ScatteringEvent;
+class Visibility;
+
+//! @brief  Direct illumination with spatiotemporal reservoir resampling.
+/**
+ * This is the algorithm from 'Spatiotemporal reservoir resampling for real-time ray tracing with dynamic direct lighting'.
+ * A few candidate light samples are drawn through the light tree at the first intersection of each camera ray, one of them
+ * is kept in a weighted reservoir. The reservoir is then combined with the one of the same pixel in the previous pass and
+ * the ones of a few pixels nearby, so that each pixel effectively resamples a lot more candidates than it generates. Only
+ * the light sample finally picked is shaded with a shadow ray, the cost per pixel doesn't depend on the number of lights.
+ *
+ * Light samples are reused in the primary sample space, a sample is the light along with the random numbers to sample it.
+ * It is evaluated again at whatever shading point that reuses it. Reservoirs are combined without the MIS weights that
+ * make it unbiased, it is only meant to be a fast preview of many-light direct illumination at a few samples per pixel.
+ * Indirect illumination is not evaluated at all.
+ *
+ * Reservoirs of the whole image are kept in a screen space buffer with two entries per pixel, one for the current
+ * sample and the other for the previous one. The camera never moves within a render, temporal reuse is always valid.
+ */
+class ReSTIRDI : public Integrator{
+public:
+    DEFINE_RTTI( ReSTIRDI , Integrator );
+
+    //! @brief  Allocate the reservoirs of the whole image.
+    //!
+    //! @param  scene           The scene to be evaluated.
+    void        PreProcess( const Scene& scene ) override;
+
+    //! @brief  Evaluate the radiance along a specific direction.
+    //!
+    //! @param  ray             The ray to be tested with.
+    //! @param  ps              Pixel sample used to evaluate Monte Carlo method, it also tells the pixel of the ray.
+    //! @param  scene           The scene to be evaluated.
+    //! @return                 The radiance along the opposite direction that the ray points to.
+    Spectrum    Li( const Ray& ray , const PixelSample& ps , const Scene& scene ) const override;
+
+    //! @brief      Serializing data from stream
+    //!
+    //! @param      Stream where the serialization data comes from. Depending on different situation, it could come from different places.
+    void    Serialize( IStreamBase& stream ) override {
+        Integrator::Serialize( stream );
+        stream >> m_candidateCnt;
+        stream >> m_spatialNeighborCnt;
+        stream >> m_spatialRadius;
+        stream >> m_temporalReuse;
+    }
+
+private:
+    //! @brief  A light sample in the primary sample space.
+    struct LightSampleRecord{
+        const Light*    light = nullptr;    /**< The light to be sampled. */
+        float           u = 0.0f;           /**< Random numbers to sample a point on the light. */
+        float           v = 0.0f;
+        float           t = 0.0f;
+    };
+
+    //! @brief  Weighted reservoir holding a single light sample.
+    struct Reservoir{
+        LightSampleRecord   sample;             /**< The light sample kept in the reservoir. */
+        float               weight_sum = 0.0f;  /**< Sum of the resampling weights of all candidates. */
+        float               W = 0.0f;           /**< Unbiased contribution weight of the sample. */
+        float               M = 0.0f;           /**< Number of candidates seen by the reservoir. */
+    };
+
+    //! @brief  The reservoir of a pixel, along with the surface it was generated on.
+    struct PixelReservoir{
+        Reservoir           reservoir;
+        Vector              normal;             /**< Shading normal of the first intersection. */
+        float               depth = 0.0f;       /**< Distance from the camera to the first intersection. */
+        unsigned int        stamp = 0;          /**< One plus the index of the sample writing it, zero means there is nothing. */
+    };
+
+    //! @brief  Evaluate the unshadowed contribution of a light sample at a shading point.
+    //!
+    //! @param  se              The scattering event of the shading point.
+    //! @param  wo              The direction toward the viewer.
+    //! @param  sample          The light sample to be evaluated.
+    //! @param  visibility      Visibility toward the sampled point on the light.
+    //! @return                 The contribution divided by the pdf of sampling the point on the light.
+    Spectrum    evaluate( const ScatteringEvent& se , const Vector& wo , const LightSampleRecord& sample , Visibility& visibility ) const;
+
+    //! @brief  Get the latest reservoir of a pixel generated before a sample.
+    //!
+    //! @param  x               Horizontal coordinate of the pixel.
+    //! @param  y               Vertical coordinate of the pixel.
+    //! @param  index           Index of the sample reusing the reservoir.
+    //! @param  ret             The reservoir to be returned.
+    //! @return                 Whether there is any reservoir to be reused.
+    bool        fetch( int x , int y , unsigned int index , PixelReservoir& ret ) const;
+
+    //! @brief  Keep the reservoir of a sample for the samples after it.
+    //!
+    //! @param  x               Horizontal coordinate of the pixel.
+    //! @param  y               Vertical coordinate of the pixel.
+    //! @param  index           Index of the sample.
+    //! @param  reservoir       The reservoir to be kept, along with the surface it is generated on.
+    void        store( int x , int y , unsigned int index , const PixelReservoir& reservoir ) const;
+
+    int         m_candidateCnt = 8;         /**< Number of light candidates generated at each pixel. */
+    int         m_spatialNeighborCnt = 3;   /**< Number of pixels nearby to reuse reservoirs from. */
+    float       m_spatialRadius = 16.0f;    /**< Radius in pixels to look for neighbors. */
+    bool        m_temporalReuse = true;     /**< Whether to reuse the reservoir of the previous sample of the pixel. */
+
+    /**< Two reservoirs for each pixel, samples with odd and even indices take turns to write them. */
+    std::unique_ptr<PixelReservoir[]>   m_reservoirs;
+    /**< Pixels nearby could be reading the reservoirs of a pixel in other threads. */
+    std::unique_ptr<spinlock_mutex[]>   m_locks;
+    int                                 m_width = 0;
+    int                                 m_height = 0;
+
+    SORT_STATS_ENABLE( "ReSTIR DI" )
+};
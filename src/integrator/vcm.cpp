@@ -0,0 +1,291 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <thread>
+#include "vcm.h"
+#include "hashgrid.h"
+#include "core/globalconfig.h"
+#include "core/memory.h"
+#include "light/light.h"
+#include "math/utils.h"
+
+SORT_STATS_DEFINE_COUNTER(sVCMPassCount)
+SORT_STATS_DEFINE_COUNTER(sVCMLightVertexCount)
+
+SORT_STATS_COUNTER("Vertex Connection and Merging", "Pass Count", sVCMPassCount);
+SORT_STATS_AVG_COUNT("Vertex Connection and Merging", "Average Light Vertices per Pass", sVCMLightVertexCount , sVCMPassCount);
+
+// Light paths traced in one chunk when generating light vertices.
+static constexpr unsigned VCM_LIGHT_PATH_GRAIN  = 256;
+// Light vertices inserted in the grid in one chunk.
+static constexpr unsigned VCM_LIGHT_VERTEX_GRAIN = 16384;
+
+//! @brief  Light vertex for vertex merging.
+struct VCM_LightVertex{
+    Point       p;              /**< Position of the vertex. */
+    Vector      wi;             /**< Direction towards where the light comes from. */
+    Spectrum    throughput;     /**< Throughput of the light path up to the vertex. */
+    double      vcm = 0.0;      /**< Partial MIS quantity shared by all techniques. */
+    double      vm = 0.0;       /**< Partial MIS quantity of vertex merging. */
+    float       rr = 1.0f;      /**< Russian roulette at the vertex. */
+    int         depth = 0;      /**< Number of vertices from the light source. */
+};
+
+//! @brief  Work split into chunks, any thread waiting for the work could pick up chunks.
+struct VCM_Job{
+    std::atomic<unsigned>   next = 0;       /**< The next chunk to be picked. */
+    std::atomic<unsigned>   done = 0;       /**< Number of finished chunks. */
+    unsigned                cnt = 1;        /**< Number of chunks, it is always positive. */
+
+    //! @brief  Execute chunks until all of them are picked.
+    //!
+    //! @return             Whether the last chunk is finished by this thread.
+    template<typename Func>
+    bool Run( const Func& func ){
+        auto last = false;
+        while( true ){
+            const auto chunk = next.fetch_add( 1 , std::memory_order_relaxed );
+            if( chunk >= cnt )
+                break;
+            func( chunk );
+            last |= done.fetch_add( 1 , std::memory_order_acq_rel ) + 1 == cnt;
+        }
+        return last;
+    }
+};
+
+//! @brief  Stages of generating light vertices of a pass.
+enum VCM_Stage : int {
+    VCM_TRACE ,         /**< Light paths are traced, light vertices are kept by chunks. */
+    VCM_GATHER ,        /**< Light vertices are copied in one array and counted in the grid. */
+    VCM_INSERT ,        /**< Light vertices are inserted in the grid. */
+    VCM_READY ,         /**< Light vertices are ready for merging. */
+};
+
+//! @brief  Light vertices of a pass along with everything needed for merging with them.
+struct VCM_Pass{
+    float                       radius = 0.0f;              /**< Merging radius of the pass. */
+    unsigned                    light_path_cnt = 0;         /**< Number of light paths of the pass. */
+    double                      vm_weight = 0.0;            /**< Weight of vertex merging relative to vertex connection. */
+    double                      vc_weight = 0.0;            /**< Weight of vertex connection relative to vertex merging. */
+    float                       vm_normalization = 0.0f;    /**< Normalization factor of the density estimation. */
+
+    std::vector<VCM_LightVertex>    vertices;               /**< Light vertices of the pass. */
+    HashGrid                        grid;                   /**< Grid for finding light vertices nearby. */
+
+    std::atomic<int>                                stage = VCM_TRACE;  /**< The current stage of generating light vertices. */
+    VCM_Job                                         trace;              /**< Job of tracing light paths. */
+    VCM_Job                                         gather;             /**< Job of gathering light vertices. */
+    VCM_Job                                         insert;             /**< Job of inserting light vertices in the grid. */
+    std::vector<std::vector<VCM_LightVertex>>       chunks;             /**< Light vertices of each chunk of light paths. */
+    std::vector<unsigned>                           chunk_offsets;      /**< Offsets of the light vertices of chunks. */
+};
+
+// The pass of the tile being rendered by the thread, vertex merging is disabled without it.
+static thread_local std::shared_ptr<VCM_Pass> g_currentPass;
+
+void VertexConnectionMerging::PreProcess( const Scene& scene ){
+    const auto& bbox = scene.GetBBox();
+    m_sceneRadius = std::max( 0.5f * ( bbox.m_Max - bbox.m_Min ).Length() , FLT_EPSILON );
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_passes.clear();
+}
+
+void VertexConnectionMerging::BeginPass( unsigned int sampleOffset , const Scene& scene ){
+    const auto pass_id = sampleOffset / std::max( 1u , (unsigned)g_samplePerPass );
+
+    std::shared_ptr<VCM_Pass> pass;
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        auto& p = m_passes[pass_id];
+        if( !p ){
+            p = std::make_shared<VCM_Pass>();
+
+            // one light path per pixel, the radius shrinks with iterations
+            const auto iteration = (float)( pass_id + 1 );
+            p->radius = std::max( m_radiusFactor * m_sceneRadius / pow( iteration , 0.5f * ( 1.0f - m_radiusAlpha ) ) , FLT_EPSILON );
+            p->light_path_cnt = std::max( 1u , (unsigned)( g_resultResollutionWidth * g_resultResollutionHeight ) );
+
+            const auto eta_vcm = PI * p->radius * p->radius * (double)p->light_path_cnt;
+            p->vm_weight = MIS( eta_vcm );
+            p->vc_weight = MIS( 1.0 / eta_vcm );
+            p->vm_normalization = (float)( 1.0 / eta_vcm );
+
+            p->trace.cnt = ( p->light_path_cnt + VCM_LIGHT_PATH_GRAIN - 1 ) / VCM_LIGHT_PATH_GRAIN;
+            p->chunks.resize( p->trace.cnt );
+
+            SORT_STATS(++sVCMPassCount);
+        }
+        pass = p;
+
+        // tiles are not supposed to take passes two iterations behind anymore, the ones still taking them hold their own
+        // references. Even if a late tile takes a pass that is released, light vertices are generated again for it.
+        for( auto it = m_passes.begin() ; it != m_passes.end() ; ){
+            if( it->first + 1 < pass_id )
+                it = m_passes.erase( it );
+            else
+                ++it;
+        }
+    }
+
+    g_currentPass = pass;
+    buildPass( *pass , scene );
+}
+
+void VertexConnectionMerging::EndPass( unsigned int sampleOffset ){
+    g_currentPass = nullptr;
+}
+
+void VertexConnectionMerging::buildPass( VCM_Pass& pass , const Scene& scene ) const{
+    // Instead of forking tasks, which could have the waiting thread pick up tiles waiting for the same pass, the chunks
+    // are picked by all tiles waiting for the light vertices. The one finishing the last chunk of a stage moves on to the
+    // next stage.
+    while( true ){
+        const auto stage = pass.stage.load( std::memory_order_acquire );
+        auto last = false;
+        switch( stage ){
+        case VCM_TRACE:
+            last = pass.trace.Run( [&]( unsigned chunk ){
+                auto& vertices = pass.chunks[chunk];
+                const auto start = chunk * VCM_LIGHT_PATH_GRAIN;
+                const auto end = std::min( pass.light_path_cnt , start + VCM_LIGHT_PATH_GRAIN );
+                for( auto i = start ; i < end ; ++i ){
+                    // scattering events of the light path are not needed once light vertices are recorded
+                    SORT_MEMORY_SCOPE();
+
+                    float pdf = 0.0f;
+                    const auto light = scene.SampleLight( sort_canonical() , &pdf );
+                    if( IS_PTR_INVALID(light) || pdf == 0.0f )
+                        continue;
+
+                    auto light_path = GetStaticAllocator().Allocate<BDPT_Vertex>( std::max( 1 , max_recursive_depth ) );
+                    const auto lps = _TraceLightPath( scene , light , pdf , light_path , false );
+                    for( auto k = 0u ; k < lps ; ++k ){
+                        const auto& v = light_path[k];
+
+                        // delta bxdfs never merge with anything
+                        if( v.se->HasDeltaBxdf() )
+                            continue;
+
+                        VCM_LightVertex lv;
+                        lv.p = v.p;
+                        lv.wi = v.wi;
+                        lv.throughput = v.throughput;
+                        lv.vcm = v.vcm;
+                        lv.vm = v.vm;
+                        lv.rr = v.rr;
+                        lv.depth = v.depth;
+                        vertices.push_back( lv );
+                    }
+                }
+            });
+            if( last ){
+                auto total = 0u;
+                pass.chunk_offsets.resize( pass.chunks.size() );
+                for( auto i = 0u ; i < pass.chunks.size() ; ++i ){
+                    pass.chunk_offsets[i] = total;
+                    total += (unsigned)pass.chunks[i].size();
+                }
+                pass.vertices.resize( total );
+                pass.grid.Reset( scene.GetBBox() , pass.radius , total );
+                pass.gather.cnt = (unsigned)pass.chunks.size();
+                pass.stage.store( VCM_GATHER , std::memory_order_release );
+
+                SORT_STATS(sVCMLightVertexCount += total);
+            }
+            break;
+        case VCM_GATHER:
+            last = pass.gather.Run( [&]( unsigned chunk ){
+                auto& vertices = pass.chunks[chunk];
+                std::copy( vertices.begin() , vertices.end() , pass.vertices.begin() + pass.chunk_offsets[chunk] );
+                for( const auto& v : vertices )
+                    pass.grid.Count( v.p );
+                std::vector<VCM_LightVertex>().swap( vertices );
+            });
+            if( last ){
+                pass.grid.FinishCounting();
+                pass.insert.cnt = std::max( 1u , ( (unsigned)pass.vertices.size() + VCM_LIGHT_VERTEX_GRAIN - 1 ) / VCM_LIGHT_VERTEX_GRAIN );
+                pass.stage.store( VCM_INSERT , std::memory_order_release );
+            }
+            break;
+        case VCM_INSERT:
+            last = pass.insert.Run( [&]( unsigned chunk ){
+                const auto start = chunk * VCM_LIGHT_VERTEX_GRAIN;
+                const auto end = std::min( (unsigned)pass.vertices.size() , start + VCM_LIGHT_VERTEX_GRAIN );
+                for( auto i = start ; i < end ; ++i )
+                    pass.grid.Insert( pass.vertices[i].p , i );
+            });
+            if( last )
+                pass.stage.store( VCM_READY , std::memory_order_release );
+            break;
+        default:
+            return;
+        }
+
+        // wait for the other threads to finish the chunks they picked
+        if( !last ){
+            while( pass.stage.load( std::memory_order_acquire ) == stage )
+                std::this_thread::yield();
+        }
+    }
+}
+
+double VertexConnectionMerging::_VmWeightFactor() const{
+    return g_currentPass ? g_currentPass->vm_weight : 0.0;
+}
+
+double VertexConnectionMerging::_VcWeightFactor() const{
+    return g_currentPass ? g_currentPass->vc_weight : 0.0;
+}
+
+Spectrum VertexConnectionMerging::_MergeVertices( const BDPT_Vertex& eye_vertex ) const{
+    const auto pass = g_currentPass.get();
+    if( IS_PTR_INVALID(pass) || eye_vertex.se->HasDeltaBxdf() )
+        return 0.0f;
+
+    const auto sqr_radius = pass->radius * pass->radius;
+    Spectrum total;
+    pass->grid.Query( eye_vertex.p , [&]( unsigned i ){
+        const auto& lv = pass->vertices[i];
+        if( ( lv.p - eye_vertex.p ).SquaredLength() > sqr_radius )
+            return;
+        if( lv.depth + eye_vertex.depth > max_recursive_depth )
+            return;
+
+        // the flux arriving at the light vertex is already projected, the cosine factor in the bsdf is taken out
+        const auto cos_in = absDot( eye_vertex.n , lv.wi );
+        if( cos_in <= 0.0f )
+            return;
+        auto eye_bsdf_pdfw = 0.0f;
+        const auto f = eye_vertex.se->Evaluate_BSDF( eye_vertex.wi , lv.wi , &eye_bsdf_pdfw ) / cos_in;
+        if( f.IsBlack() )
+            return;
+
+        // the reverse direction would be sampled by the light path at the light vertex
+        eye_bsdf_pdfw *= eye_vertex.rr;
+        const auto eye_bsdf_rev_pdfw = eye_vertex.se->Pdf_BSDF( lv.wi , eye_vertex.wi ) * lv.rr;
+
+        const double mis_light = lv.vcm * pass->vc_weight + lv.vm * MIS( eye_bsdf_pdfw );
+        const double mis_eye = eye_vertex.vcm * pass->vc_weight + eye_vertex.vm * MIS( eye_bsdf_rev_pdfw );
+        const auto weight = (float)( 1.0 / ( mis_light + 1.0 + mis_eye ) );
+
+        total += f * lv.throughput * weight;
+    });
+
+    return total * eye_vertex.throughput * pass->vm_normalization;
+}
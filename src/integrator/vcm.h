@@ -0,0 +1,102 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <unordered_map>
+#include "bidirpath.h"
+
+struct VCM_Pass;
+
+//! @brief  Vertex connection and merging integrator.
+/**
+ * This is the algorithm from 'Light Transport Simulation with Vertex Connection and Merging'. On top of all the techniques
+ * of bi-directional path tracing, eye vertices are also merged with light vertices nearby, which is photon mapping in
+ * disguise. Vertex merging is what makes specular-diffuse-specular paths, like caustics seen through water, converge at all.
+ * All techniques are combined with multiple importance sampling through the partial MIS quantities on each vertex.
+ *
+ * Each progressive pass is an iteration of the algorithm. The light vertices of an iteration are generated from as many light
+ * paths as pixels, and stored in a hashed grid shared by all tiles of the pass. The merging radius shrinks with iterations,
+ * so the result converges only if the image is rendered progressively in many passes.
+ */
+class VertexConnectionMerging : public BidirPathTracing{
+public:
+    DEFINE_RTTI( VertexConnectionMerging , Integrator );
+
+    //! @brief  Evaluate the size of the scene for the merging radius.
+    //!
+    //! @param  scene           The scene to be evaluated.
+    void    PreProcess( const Scene& scene ) override;
+
+    //! @brief  Make sure the light vertices of the pass are ready.
+    //!
+    //! The first tile taking a pass creates the light vertices of the pass. All tiles taking the pass before the light
+    //! vertices are ready help generating them.
+    //!
+    //! @param  sampleOffset    Number of samples per pixel taken by previous passes of the tile.
+    //! @param  scene           The rendering scene.
+    void    BeginPass( unsigned int sampleOffset , const Scene& scene ) override;
+
+    //! @brief  The tile is not going to merge with light vertices of the pass anymore.
+    //!
+    //! @param  sampleOffset    Number of samples per pixel taken by previous passes of the tile.
+    void    EndPass( unsigned int sampleOffset ) override;
+
+    //! @brief      Serializing data from stream
+    //!
+    //! @param      Stream where the serialization data comes from. Depending on different situation, it could come from different places.
+    void    Serialize( IStreamBase& stream ) override {
+        BidirPathTracing::Serialize( stream );
+        stream >> m_radiusFactor;
+        stream >> m_radiusAlpha;
+    }
+
+protected:
+    //! @brief  Weight of vertex merging relative to vertex connection in the partial MIS quantities.
+    double      _VmWeightFactor() const override;
+
+    //! @brief  Weight of vertex connection relative to vertex merging in the partial MIS quantities.
+    double      _VcWeightFactor() const override;
+
+    //! @brief  Merge an eye vertex with light vertices of the current pass nearby.
+    //!
+    //! @param  eye_vertex      The vertex on the path from the eye.
+    //! @return                 The radiance from merging vertices.
+    Spectrum    _MergeVertices( const BDPT_Vertex& eye_vertex ) const override;
+
+private:
+    /**< Merging radius of the first pass relative to the radius of the bounding sphere of the scene. */
+    float       m_radiusFactor = 0.003f;
+    /**< How fast the merging radius shrinks with passes, the radius of the i-th pass is proportional to (1/i)^((1-alpha)/2). */
+    float       m_radiusAlpha = 0.75f;
+    /**< Radius of the bounding sphere of the scene. */
+    float       m_sceneRadius = 1.0f;
+
+    /**< Light vertices of passes in flight. */
+    std::unordered_map<unsigned, std::shared_ptr<VCM_Pass>>     m_passes;
+    /**< Mutex protecting the passes. */
+    std::mutex                                                  m_mutex;
+
+    //! @brief  Generate light vertices of a pass with other tiles taking the same pass.
+    //!
+    //! @param  pass            The pass whose light vertices are generated.
+    //! @param  scene           The rendering scene.
+    void        buildPass( VCM_Pass& pass , const Scene& scene ) const;
+
+    SORT_STATS_ENABLE( "Vertex Connection and Merging" )
+};
@@ -0,0 +1,111 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "vpltree.h"
+#include "core/stats.h"
+#include "core/rand.h"
+#include "core/profile.h"
+#include "math/utils.h"
+#include "task/task.h"
+
+SORT_STATS_DEFINE_COUNTER(sVPLTreeNodeCount)
+
+SORT_STATS_COUNTER("Instant Radiosity", "Light Cut Tree Node Count", sVPLTreeNodeCount);
+
+// sub-trees with more virtual point lights than this are built in separate tasks
+static constexpr unsigned VPL_TREE_PARALLEL_THRESHOLD = 4096;
+
+// squared distance between a point and a bounding box, it is zero if the point is inside the box
+SORT_STATIC_FORCEINLINE float sqrDistance( const BBox& bbox , const Point& p ){
+    auto sqr_dist = 0.0f;
+    for( auto i = 0 ; i < 3 ; ++i ){
+        const auto d = std::max( 0.0f , std::max( bbox.m_Min[i] - p[i] , p[i] - bbox.m_Max[i] ) );
+        sqr_dist += d * d;
+    }
+    return sqr_dist;
+}
+
+void VPLTree::Build( const VirtualLightSources& vpls ){
+    SORT_PROFILE("Build Light Cut Tree");
+
+    m_nodes.clear();
+    const auto cnt = vpls.Size();
+    if( 0 == cnt )
+        return;
+
+    std::vector<unsigned> indices( cnt );
+    for( auto i = 0u ; i < cnt ; ++i )
+        indices[i] = i;
+
+    m_nodes.resize( 2 * cnt - 1 );
+    buildNode( vpls , indices , 0 , cnt , 0 );
+
+    SORT_STATS(sVPLTreeNodeCount += m_nodes.size());
+}
+
+void VPLTree::buildNode( const VirtualLightSources& vpls , std::vector<unsigned>& indices , unsigned start , unsigned end , unsigned node ){
+    auto& n = m_nodes[node];
+    if( end - start == 1 ){
+        const auto i = indices[start];
+        n.bbox = BBox( vpls.position[i] , vpls.position[i] );
+        n.power = vpls.power[i];
+        n.representative = i;
+        n.min_depth = n.max_depth = vpls.depth[i];
+        return;
+    }
+
+    // split at the median of the longest axis, it keeps the tree balanced
+    BBox bbox;
+    for( auto i = start ; i < end ; ++i )
+        bbox.Union( vpls.position[indices[i]] );
+    const auto axis = bbox.MaxAxisId();
+    const auto mid = ( start + end ) / 2;
+    std::nth_element( indices.begin() + start , indices.begin() + mid , indices.begin() + end , [&]( unsigned a , unsigned b ){
+        return vpls.position[a][axis] < vpls.position[b][axis];
+    });
+
+    const auto first = node + 1;
+    const auto second = node + 2 * ( mid - start );
+    if( end - start > VPL_TREE_PARALLEL_THRESHOLD ){
+        TaskGroup group;
+        group.Fork( [&, first, start, mid](){ buildNode( vpls , indices , start , mid , first ); } , "Build Light Cut Tree Node" );
+        buildNode( vpls , indices , mid , end , second );
+        group.Join();
+    }else{
+        buildNode( vpls , indices , start , mid , first );
+        buildNode( vpls , indices , mid , end , second );
+    }
+
+    // the representative is picked from the children with the probability proportional to their power
+    const auto& l = m_nodes[first];
+    const auto& r = m_nodes[second];
+    n.bbox = Union( l.bbox , r.bbox );
+    n.power = l.power + r.power;
+    n.second_child = second;
+    n.min_depth = std::min( l.min_depth , r.min_depth );
+    n.max_depth = std::max( l.max_depth , r.max_depth );
+
+    const auto li = l.power.GetIntensity();
+    const auto total = li + r.power.GetIntensity();
+    n.representative = ( total > 0.0f ? sort_canonical() * total < li : sort_canonical() < 0.5f ) ? l.representative : r.representative;
+}
+
+float VPLTree::errorBound( const VPLTree_Node& node , const Point& p , float minSqrDist ) const{
+    // lambertian bsdfs with the cosine factor are bounded by 1/PI at both ends
+    const auto gterm = 1.0f / std::max( minSqrDist , sqrDistance( node.bbox , p ) );
+    return node.power.GetIntensity() * gterm * INV_PI * INV_PI;
+}
@@ -0,0 +1,205 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+#include "math/bbox.h"
+#include "math/interaction.h"
+#include "spectrum/spectrum.h"
+
+//! @brief  Virtual point lights stored in flat arrays.
+/**
+ * Data touched by building and traversing the light cut tree is kept in separate streams, the interactions, which are
+ * much larger, are only touched when a virtual point light is picked as the representative of a cluster in a cut.
+ */
+struct VirtualLightSources{
+    std::vector<Point>                  position;       /**< Positions of the virtual point lights. */
+    std::vector<Spectrum>               power;          /**< Power carried by the virtual point lights. */
+    std::vector<int>                    depth;          /**< Number of bounces from the light source to the virtual point lights. */
+    std::vector<Vector>                 wi;             /**< Directions towards where the light comes from. */
+    std::vector<SurfaceInteraction>     interaction;    /**< Interactions used to evaluate the scattering at the virtual point lights. */
+
+    //! @brief  Add a virtual point light.
+    //!
+    //! @param  inter       The interaction where the light path bounces.
+    //! @param  w           Direction towards where the light comes from.
+    //! @param  p           Power carried by the virtual point light.
+    //! @param  d           Number of bounces from the light source.
+    void        Add( const SurfaceInteraction& inter , const Vector& w , const Spectrum& p , int d ){
+        position.push_back( inter.intersect );
+        power.push_back( p );
+        depth.push_back( d );
+        wi.push_back( w );
+        interaction.push_back( inter );
+    }
+
+    //! @brief  Append all virtual point lights in another container.
+    //!
+    //! @param  vpls        The virtual point lights to be appended.
+    void        Append( const VirtualLightSources& vpls ){
+        position.insert( position.end() , vpls.position.begin() , vpls.position.end() );
+        power.insert( power.end() , vpls.power.begin() , vpls.power.end() );
+        depth.insert( depth.end() , vpls.depth.begin() , vpls.depth.end() );
+        wi.insert( wi.end() , vpls.wi.begin() , vpls.wi.end() );
+        interaction.insert( interaction.end() , vpls.interaction.begin() , vpls.interaction.end() );
+    }
+
+    //! @brief  Number of virtual point lights.
+    unsigned    Size() const {
+        return (unsigned)position.size();
+    }
+};
+
+//! @brief  Light cut tree for evaluating lots of virtual point lights.
+/**
+ * This is the tree from 'Lightcuts: A Scalable Approach to Illumination'. Each node clusters the virtual point lights under
+ * it, one of them is picked as the representative with the probability proportional to its power. A cluster is
+ * approximated by evaluating its representative with the total power of the cluster. A shading point starts with the root
+ * as its cut and keeps replacing the cluster with the largest error bound with its children, until the error bounds of all
+ * clusters are small enough compared with the estimated radiance, or the cut is too large.
+ * The error bound assumes lambertian scattering at both ends, it is not a strict bound for glossy surfaces.
+ */
+class VPLTree{
+public:
+    //! @brief  Build the tree.
+    //!
+    //! @param  vpls        Virtual point lights to be clustered.
+    void        Build( const VirtualLightSources& vpls );
+
+    //! @brief  Evaluate the radiance from all virtual point lights through a light cut.
+    //!
+    //! @param  p               The position of the shading point.
+    //! @param  maxDepth        Virtual point lights with more bounces than this are ignored.
+    //! @param  minSqrDist      Lower bound of the squared distance used in the geometry term.
+    //! @param  errorRatio      Clusters with error bounds lower than this ratio of the total radiance are not refined.
+    //! @param  maxCutSize      Maximum number of clusters in a cut.
+    //! @param  evaluate        Evaluates a virtual point light for the shading point excluding its power, including visibility.
+    //! @param  cutSize         Number of clusters in the cut.
+    //! @return                 The radiance from all virtual point lights.
+    template<typename Func>
+    Spectrum    Evaluate( const Point& p , int maxDepth , float minSqrDist , float errorRatio , unsigned maxCutSize , const Func& evaluate , unsigned* cutSize = nullptr ) const;
+
+    //! @brief  Number of nodes in the tree.
+    unsigned    GetNodeCount() const {
+        return (unsigned)m_nodes.size();
+    }
+
+    //! @brief  Whether there is any virtual point light in the tree.
+    bool        IsEmpty() const {
+        return m_nodes.empty();
+    }
+
+private:
+    //! @brief  Node of the tree.
+    //!
+    //! Nodes are stored in depth first order, the first child of an interior node always comes right after the node.
+    struct VPLTree_Node{
+        BBox        bbox;                   /**< Bounding box of the virtual point lights under the node. */
+        Spectrum    power;                  /**< Total power of the virtual point lights under the node. */
+        unsigned    representative = 0;     /**< Index of the representative virtual point light. */
+        unsigned    second_child = 0;       /**< Index of the second child, it is zero for leaves. */
+        int         min_depth = 0;          /**< Minimum bounces of the virtual point lights under the node. */
+        int         max_depth = 0;          /**< Maximum bounces of the virtual point lights under the node. */
+    };
+
+    /**< Flattened nodes of the tree. */
+    std::vector<VPLTree_Node>   m_nodes;
+
+    //! @brief  Build a sub-tree recursively, large sub-trees are built in parallel.
+    //!
+    //! @param  vpls        Virtual point lights to be clustered.
+    //! @param  indices     Indices of the virtual point lights, the ones in the sub-tree are reordered while it is built.
+    //! @param  start       The first index of the sub-tree.
+    //! @param  end         The index after the last one of the sub-tree.
+    //! @param  node        Index of the root of the sub-tree, a sub-tree with n lights always takes 2n-1 nodes.
+    void        buildNode( const VirtualLightSources& vpls , std::vector<unsigned>& indices , unsigned start , unsigned end , unsigned node );
+
+    //! @brief  Upper bound of the error of approximating a cluster with its representative.
+    //!
+    //! @param  node        The cluster.
+    //! @param  p           The position of the shading point.
+    //! @param  minSqrDist  Lower bound of the squared distance used in the geometry term.
+    //! @return             Upper bound of the error in luminance.
+    float       errorBound( const VPLTree_Node& node , const Point& p , float minSqrDist ) const;
+};
+
+template<typename Func>
+Spectrum VPLTree::Evaluate( const Point& p , int maxDepth , float minSqrDist , float errorRatio , unsigned maxCutSize , const Func& evaluate , unsigned* cutSize ) const{
+    struct CutItem{
+        unsigned    node;           /**< The cluster in the cut. */
+        Spectrum    unit;           /**< Contribution of the representative per unit power. */
+        Spectrum    estimate;       /**< Estimated contribution of the cluster. */
+        float       bound;          /**< Error bound of the estimate. */
+    };
+    const auto less_bound = []( const CutItem& a , const CutItem& b ){ return a.bound < b.bound; };
+
+    Spectrum    total;
+    unsigned    cnt = 0;
+    std::vector<CutItem> heap;
+
+    // leaves are exact, clusters mixing too deep virtual point lights are refined before anything else
+    const auto add_cluster = [&]( unsigned index , const Spectrum* unit ){
+        const auto& node = m_nodes[index];
+        if( node.min_depth > maxDepth )
+            return;
+        ++cnt;
+
+        CutItem item;
+        item.node = index;
+        if( node.max_depth > maxDepth ){
+            item.unit = 0.0f;
+            item.bound = FLT_MAX;
+        }else{
+            item.unit = unit ? *unit : evaluate( node.representative );
+            item.bound = node.second_child ? errorBound( node , p , minSqrDist ) : 0.0f;
+        }
+        item.estimate = item.unit * node.power;
+        total += item.estimate;
+
+        if( item.bound > 0.0f ){
+            heap.push_back( item );
+            std::push_heap( heap.begin() , heap.end() , less_bound );
+        }
+    };
+
+    if( !m_nodes.empty() )
+        add_cluster( 0 , nullptr );
+
+    while( !heap.empty() && cnt < maxCutSize ){
+        const auto item = heap.front();
+        if( item.bound <= errorRatio * total.GetIntensity() )
+            break;
+        std::pop_heap( heap.begin() , heap.end() , less_bound );
+        heap.pop_back();
+
+        // the cluster is replaced by its children, one of them shares the same representative
+        total -= item.estimate;
+        --cnt;
+        const auto& node = m_nodes[item.node];
+        const auto  valid = node.max_depth <= maxDepth;
+        const unsigned children[2] = { item.node + 1 , node.second_child };
+        for( const auto child : children )
+            add_cluster( child , valid && m_nodes[child].representative == node.representative ? &item.unit : nullptr );
+    }
+
+    if( cutSize )
+        *cutSize = cnt;
+    return total;
+}
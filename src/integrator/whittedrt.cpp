@@ -44,6 +44,10 @@ Spectrum WhittedRT::Li( const Ray& r , const PixelSample& ps , const Scene& scen
     ScatteringEvent se( ip , SE_EVALUATE_ALL_NO_SSS );
     ip.primitive->GetMaterial()->UpdateScatteringEvent(se);
 
+    // with many lights, only the one resampled out of a few candidates is evaluated
+    if( m_lightCandidates > 0 )
+        return EvaluateLightCandidates( se , r , scene , (unsigned)m_lightCandidates , true );
+
     // lights
     Visibility visibility(scene);
     auto lights = scene.GetLights();
@@ -48,6 +48,7 @@ Spectrum AreaLight::sample_l(const Point& ip, const LightSample* ls , Vector& di
     // setup visibility tester
     const float delta = 0.01f;
     visibility.ray = Ray( ip , dirToLight , 0 , delta , len - delta );
+    visibility.light = this;
 
     return intensity;
 }
@@ -105,3 +106,21 @@ bool AreaLight::Le( const Ray& ray , SurfaceInteraction* intersect , Spectrum& r
 
     return result;
 }
+
+bool AreaLight::GetBounds( LightBounds& bounds ) const{
+    if( IS_PTR_INVALID(m_shape) )
+        return false;
+
+    // disk and quad only emit on the side of their normal, the transform of the shape is the same as the light.
+    bounds.bbox = m_shape->GetBBox();
+    if( SHAPE_SPHERE == m_shape->GetShapeType() ){
+        bounds.axis = DIR_UP;
+        bounds.cos_theta_o = -1.0f;
+    }else{
+        bounds.axis = normalize( m_light2world.TransformNormal( DIR_UP ) );
+        bounds.cos_theta_o = 1.0f;
+    }
+    bounds.cos_theta_e = 0.0f;
+    bounds.power = Power().GetIntensity();
+    return true;
+}
@@ -109,6 +109,12 @@ public:
         return m_shape.get();
     }
 
+    //! @brief  Get the spatial and directional bounds of the light.
+    //!
+    //! @param  bounds  The bounds of the light.
+    //! @return         Whether the light is bounded, it is 'False' if there is no shape attached.
+    bool GetBounds( LightBounds& bounds ) const override;
+
 private:
     /**< The shape attached to the light source. */
     std::unique_ptr<Shape>  m_shape = nullptr;
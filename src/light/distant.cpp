@@ -46,6 +46,7 @@ Spectrum DistantLight::sample_l(const Point& ip, const LightSample* ls , Vector&
 
     const float delta = 0.01f;
     visibility.ray = Ray( ip , dirToLight , 0 , delta );
+    visibility.light = this;
 
     return intensity;
 }
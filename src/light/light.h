@@ -21,6 +21,9 @@
 #include "math/transform.h"
 #include "core/scene.h"
 #include "math/vector3.h"
+#include "light/lightbounds.h"
+#include "math/vmf.h"
+#include "integrator/occlusiongrid.h"
 
 struct SurfaceInteraction;
 class LightSample;
@@ -43,7 +46,9 @@ public:
     //!
     //! @return     'True' if there is no blocker along the ray, otherwise it returns 'False'.
     bool    IsVisible() const{
-        return !m_scene.IsOccluded( ray );
+        if( coarse )
+            return !coarse->IsOccluded( ray );
+        return !m_scene.IsOccluded( ray , light );
     }
 #else
     //! @brief  Get occlusion along the ray.
@@ -54,16 +59,24 @@ public:
     //!                 to pass non-empty pointer.
     //! @return         The attenuation along the ray.
     Spectrum    GetAttenuation( MediumStack* ms = nullptr ) const {
-        return m_scene.GetAttenuation( ray , ms );
+        // attenuation through transparent surfaces can't be told by the coarse grid
+        if( coarse && m_scene.IsOpaque() )
+            return coarse->IsOccluded( ray ) ? 0.0f : 1.0f;
+        return m_scene.GetAttenuation( ray , ms , light );
     }
 #endif
 
     /**< The ray to be evaluated. */
     Ray ray;
+    /**< The light the ray goes toward, occluders of shadow rays are cached per light if it is set. */
+    const Light* light = nullptr;
+    /**< Coarse occupancy answering the ray approximately instead of the accelerator, it is only set in previews. */
+    const OcclusionGrid* coarse = nullptr;
 
 private:
     /**< The rendering scene. */
     const Scene& m_scene;
+
 };
 
 //! @brief  Base interface for lights.
@@ -95,6 +108,22 @@ public:
         return true;
     }
 
+    //! @brief  Get the intensity of the light.
+    //!
+    //! @return     The intensity, or the tint of the emission for lights with textures.
+    const Spectrum&     GetIntensity() const {
+        return intensity;
+    }
+
+    //! @brief  Change the intensity of the light.
+    //!
+    //! The light distribution of the scene needs to be built again after this.
+    //!
+    //! @param  i   The new intensity.
+    void                SetIntensity( const Spectrum& i ) {
+        intensity = i;
+    }
+
     //! @brief  Whether the light is an infinite light source.
     //!
     //! @return     Whether the light is an infinite light.
@@ -102,6 +131,16 @@ public:
         return false;
     }
 
+    //! @brief  Get the spatial and directional bounds of the light.
+    //!
+    //! Lights without bounds, like infinite lights, are not put in the light tree. They are picked with a probability of their own.
+    //!
+    //! @param  bounds  The bounds of the light.
+    //! @return         Whether the light is bounded.
+    virtual bool        GetBounds( LightBounds& bounds ) const {
+        return false;
+    }
+
     //! @brief  Get the shape of light, if there is one.
     //!
     //! Some light source has shape attached to it, like area light.
@@ -118,6 +157,25 @@ public:
     //! @return         The pdf w.r.t solid angle if the ray starting from 'p', tracing through 'wi' hits the light source.
     virtual float       Pdf( const Point& p , const Vector& wi ) const = 0;
 
+    //! @brief  Whether the light samples the product of its emission and a lobe of the bsdf.
+    //!
+    //! Approximating the bsdf with a lobe is not free, it is only worth it for lights that really use it.
+    //!
+    //! @return         Whether the versions of 'sample_l' and 'Pdf' taking a lobe differ from the ones without it.
+    virtual bool        UsesBsdfLobe() const {
+        return false;
+    }
+
+    //! @brief  The pdf w.r.t solid angle of picking a direction by the version of 'sample_l' guided by a lobe.
+    //!
+    //! @param  p       The point in world space to be shaded.
+    //! @param  wi      The direction pointing from the point.
+    //! @param  lobe    The lobe of the bsdf at the point.
+    //! @return         The pdf w.r.t solid angle if the ray starting from 'p', tracing through 'wi' hits the light source.
+    virtual float       Pdf( const Point& p , const Vector& wi , const VMFLobe& lobe ) const {
+        return Pdf( p , wi );
+    }
+
     //! @brief  Sample a direction given the intersection.
     //!
     //! Given an intersection, do importance sampling to pick a direction from intersection to light source.
@@ -138,6 +196,22 @@ public:
     virtual Spectrum sample_l(const Point& ip, const LightSample* ls , Vector& dirToLight , float* distance ,
                                 float* pdfw , float* emissionPdf , float* cosAtLight , Visibility& visibility ) const = 0;
 
+    //! @brief  Sample a direction given the intersection, guided by a lobe of the bsdf at the intersection.
+    //!
+    //! Lights that can't take advantage of the lobe simply ignore it.
+    //!
+    //! @param  ip              The point where we are interested in shading at.
+    //! @param  ls              The light sample information.
+    //! @param  lobe            The lobe of the bsdf at the point.
+    //! @param  dirToLight      The resulting direction goes from the intersection to light source.
+    //! @param  pdfw            The resulting pdf w.r.t solid angle to pick such a direction.
+    //! @param  visibility      The visibility data structured filled by the light source.
+    //! @return                 The radiance goes from the light source to the intersected point.
+    virtual Spectrum sample_l( const Point& ip , const LightSample* ls , const VMFLobe& lobe , Vector& dirToLight ,
+                               float* pdfw , Visibility& visibility ) const {
+        return sample_l( ip , ls , dirToLight , nullptr , pdfw , nullptr , nullptr , visibility );
+    }
+
     //! @brief      Sample a point and light out-going direction.
     //!
     //! The difference of this version the the above one is there is no intersection data given.
@@ -0,0 +1,35 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "math/bbox.h"
+#include "math/vector3.h"
+
+//! @brief  Spatial and directional bounds of the emission of a light.
+/**
+ * It is what the light tree needs to estimate how much a light, or a cluster of lights, contributes to a shading point.
+ * The emission is bounded by a cone around 'axis'. Normals of emitting surfaces are within 'cos_theta_o' of the axis, light leaves
+ * a surface within 'cos_theta_e' of its normal. The cone of normals of a point light covers the whole sphere since it emits in all directions.
+ */
+struct LightBounds{
+    BBox    bbox;                       /**< Bounding box of the light. */
+    Vector  axis = DIR_UP;              /**< The axis of the cone of normals. */
+    float   cos_theta_o = -1.0f;        /**< Cosine of the angle between the axis and the normals furthest away from it. */
+    float   cos_theta_e = 0.0f;         /**< Cosine of the angle between a normal and the directions furthest away from it that light leaves along. */
+    float   power = 0.0f;               /**< Approximation of the total power of the light. */
+};
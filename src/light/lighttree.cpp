@@ -0,0 +1,353 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include "lighttree.h"
+#include "light.h"
+#include "core/stats.h"
+#include "core/sassert.h"
+#include "math/utils.h"
+
+SORT_STATS_DEFINE_COUNTER(sLightTreeNodeCount)
+SORT_STATS_DEFINE_COUNTER(sLightTreeDepth)
+
+SORT_STATS_COUNTER("Light Tree", "Node Count", sLightTreeNodeCount);
+SORT_STATS_COUNTER("Light Tree", "Depth", sLightTreeDepth);
+
+// number of buckets along each axis to evaluate the split cost
+static constexpr unsigned LIGHT_TREE_BUCKET_CNT = 12;
+// deeper nodes are split in the middle so that the choices made from the root always fit in 64 bits
+static constexpr unsigned LIGHT_TREE_MAX_SAOH_DEPTH = 32;
+
+SORT_STATIC_FORCEINLINE float safeAcos( float x ){
+    return acos( clamp( x , -1.0f , 1.0f ) );
+}
+
+SORT_STATIC_FORCEINLINE float safeSqrt( float x ){
+    return sqrt( std::max( 0.0f , x ) );
+}
+
+// cosine of ( a - b ) given the sine and cosine of both angles, it is one if a is smaller than b.
+SORT_STATIC_FORCEINLINE float cosSubClamped( float sin_a , float cos_a , float sin_b , float cos_b ){
+    if( cos_a > cos_b )
+        return 1.0f;
+    return cos_a * cos_b + sin_a * sin_b;
+}
+
+// sine of ( a - b ) given the sine and cosine of both angles, it is zero if a is smaller than b.
+SORT_STATIC_FORCEINLINE float sinSubClamped( float sin_a , float cos_a , float sin_b , float cos_b ){
+    if( cos_a > cos_b )
+        return 0.0f;
+    return sin_a * cos_b - cos_a * sin_b;
+}
+
+// merge two cones of normals, the result is the smallest cone covering both of them.
+static void unionCone( const Vector& axis_a , float cos_a , const Vector& axis_b , float cos_b , Vector& axis , float& cos_theta ){
+    const auto theta_a = safeAcos( cos_a );
+    const auto theta_b = safeAcos( cos_b );
+    const auto theta_d = safeAcos( dot( axis_a , axis_b ) );
+    if( std::min( theta_d + theta_b , PI ) <= theta_a ){
+        axis = axis_a;
+        cos_theta = cos_a;
+        return;
+    }
+    if( std::min( theta_d + theta_a , PI ) <= theta_b ){
+        axis = axis_b;
+        cos_theta = cos_b;
+        return;
+    }
+
+    const auto theta_o = ( theta_a + theta_d + theta_b ) * 0.5f;
+    const auto rotation_axis = cross( axis_a , axis_b );
+    if( theta_o >= PI || rotation_axis.SquaredLength() == 0.0f ){
+        axis = axis_a;
+        cos_theta = -1.0f;
+        return;
+    }
+
+    // rotate the axis of the first cone towards the second one, the rotation axis is perpendicular to the axis being rotated.
+    const auto theta_r = theta_o - theta_a;
+    const auto k = normalize( rotation_axis );
+    axis = normalize( axis_a * cos( theta_r ) + cross( k , axis_a ) * sin( theta_r ) );
+    cos_theta = cos( theta_o );
+}
+
+static LightBounds unionBounds( const LightBounds& a , const LightBounds& b ){
+    if( a.power == 0.0f )
+        return b;
+    if( b.power == 0.0f )
+        return a;
+
+    LightBounds bounds;
+    bounds.bbox = Union( a.bbox , b.bbox );
+    unionCone( a.axis , a.cos_theta_o , b.axis , b.cos_theta_o , bounds.axis , bounds.cos_theta_o );
+    bounds.cos_theta_e = std::min( a.cos_theta_e , b.cos_theta_e );
+    bounds.power = a.power + b.power;
+    return bounds;
+}
+
+// estimation of the contribution of the lights in the bounds to the shading point.
+static float importance( const LightBounds& bounds , const Point& p , const Vector& n ){
+    // the distance is clamped so that the importance doesn't go to infinity when the shading point is close to the lights.
+    const auto center = ( bounds.bbox.m_Min + bounds.bbox.m_Max ) * 0.5f;
+    const auto radius2 = ( bounds.bbox.m_Max - center ).SquaredLength();
+    auto d2 = ( p - center ).SquaredLength();
+    d2 = std::max( std::max( d2 , sqrt( radius2 ) ) , FLT_EPSILON );
+
+    // angle between the axis and the direction from the lights to the shading point
+    const auto dir = p - center;
+    const auto wi = dir.SquaredLength() > 0.0f ? normalize( dir ) : DIR_UP;
+    const auto cos_theta_w = dot( bounds.axis , wi );
+    const auto sin_theta_w = safeSqrt( 1.0f - cos_theta_w * cos_theta_w );
+
+    // angle subtended by the bounding sphere of the lights
+    const auto inside = bounds.bbox.IsInBBox( p , 0.0f );
+    const auto cos_theta_b = inside || radius2 >= d2 ? -1.0f : safeSqrt( 1.0f - radius2 / d2 );
+    const auto sin_theta_b = safeSqrt( 1.0f - cos_theta_b * cos_theta_b );
+
+    // the minimum angle between the emitting directions and the direction to the shading point
+    const auto sin_theta_o = safeSqrt( 1.0f - bounds.cos_theta_o * bounds.cos_theta_o );
+    const auto cos_theta_x = cosSubClamped( sin_theta_w , cos_theta_w , sin_theta_o , bounds.cos_theta_o );
+    const auto sin_theta_x = sinSubClamped( sin_theta_w , cos_theta_w , sin_theta_o , bounds.cos_theta_o );
+    const auto cos_theta_p = cosSubClamped( sin_theta_x , cos_theta_x , sin_theta_b , cos_theta_b );
+    if( cos_theta_p <= bounds.cos_theta_e )
+        return 0.0f;
+
+    auto ret = bounds.power * cos_theta_p / d2;
+
+    // the cosine factor at the shading point, the side of the surface is unknown.
+    if( n.SquaredLength() > 0.0f ){
+        const auto cos_theta_i = fabs( dot( wi , n ) );
+        const auto sin_theta_i = safeSqrt( 1.0f - cos_theta_i * cos_theta_i );
+        ret *= cosSubClamped( sin_theta_i , cos_theta_i , sin_theta_b , cos_theta_b );
+    }
+
+    return std::max( ret , 0.0f );
+}
+
+// surface area orientation heuristic, the cost of a cluster of lights.
+static float evaluateCost( const LightBounds& bounds , const BBox& node_bbox , unsigned axis ){
+    const auto theta_o = safeAcos( bounds.cos_theta_o );
+    const auto theta_e = safeAcos( bounds.cos_theta_e );
+    const auto theta_w = std::min( theta_o + theta_e , PI );
+    const auto sin_theta_o = safeSqrt( 1.0f - bounds.cos_theta_o * bounds.cos_theta_o );
+    const auto m_omega = TWO_PI * ( 1.0f - bounds.cos_theta_o ) +
+                         HALF_PI * ( 2.0f * theta_w * sin_theta_o - cos( theta_o - 2.0f * theta_w ) - 2.0f * theta_o * sin_theta_o + bounds.cos_theta_o );
+
+    // thin slabs are penalized so that the tree doesn't end up with long thin nodes
+    const auto extent = node_bbox.m_Max - node_bbox.m_Min;
+    const auto max_extent = std::max( extent.x , std::max( extent.y , extent.z ) );
+    const auto kr = extent[axis] > 0.0f ? max_extent / extent[axis] : 0.0f;
+
+    const auto area = bounds.bbox.SurfaceArea();
+    return bounds.power * m_omega * kr * ( area > 0.0f ? area : 1.0f );
+}
+
+void LightTree::Build( const std::vector<const Light*>& lights ){
+    m_nodes.clear();
+    m_lightBits.clear();
+
+    std::vector<std::pair<const Light*, LightBounds>> bounded_lights;
+    bounded_lights.reserve( lights.size() );
+    for( const auto light : lights ){
+        LightBounds bounds;
+        if( light->GetBounds( bounds ) )
+            bounded_lights.push_back( std::make_pair( light , bounds ) );
+    }
+
+    if( bounded_lights.empty() )
+        return;
+
+    m_nodes.reserve( 2 * bounded_lights.size() - 1 );
+    buildNode( bounded_lights , 0 , (unsigned)bounded_lights.size() , 0 , 0 );
+
+    SORT_STATS(sLightTreeNodeCount = (StatsInt)m_nodes.size());
+}
+
+unsigned LightTree::buildNode( std::vector<std::pair<const Light*, LightBounds>>& lights , unsigned start , unsigned end , std::uint64_t bits , unsigned depth ){
+    sAssert( start < end , LIGHT );
+    SORT_STATS(sLightTreeDepth = std::max( sLightTreeDepth , (StatsInt)depth + 1 ));
+
+    const auto index = (unsigned)m_nodes.size();
+    m_nodes.push_back( LightTree_Node() );
+
+    if( end - start == 1 ){
+        m_nodes[index].bounds = lights[start].second;
+        m_nodes[index].light = lights[start].first;
+        m_lightBits[lights[start].first] = bits;
+        return index;
+    }
+
+    LightBounds node_bounds;
+    BBox centroid_bbox;
+    for( auto i = start ; i < end ; ++i ){
+        const auto& bounds = lights[i].second;
+        node_bounds = unionBounds( node_bounds , bounds );
+        centroid_bbox.Union( ( bounds.bbox.m_Min + bounds.bbox.m_Max ) * 0.5f );
+    }
+    // bounding box is needed even if none of the lights emits anything
+    for( auto i = start ; i < end ; ++i )
+        node_bounds.bbox.Union( lights[i].second.bbox );
+
+    const auto centroid = []( const LightBounds& bounds , unsigned axis ){
+        return ( bounds.bbox.m_Min[axis] + bounds.bbox.m_Max[axis] ) * 0.5f;
+    };
+
+    // pick the split with the lowest cost among all buckets of all axes
+    auto mid = start + ( end - start ) / 2;
+    auto split_found = false;
+    if( depth < LIGHT_TREE_MAX_SAOH_DEPTH ){
+        auto min_cost = FLT_MAX;
+        auto min_axis = -1;
+        auto min_bucket = 0u;
+        for( auto axis = 0u ; axis < 3 ; ++axis ){
+            const auto cmin = centroid_bbox.m_Min[axis];
+            const auto cmax = centroid_bbox.m_Max[axis];
+            if( cmax == cmin )
+                continue;
+
+            LightBounds buckets[LIGHT_TREE_BUCKET_CNT];
+            BBox bucket_bbox[LIGHT_TREE_BUCKET_CNT];
+            for( auto i = start ; i < end ; ++i ){
+                const auto& bounds = lights[i].second;
+                const auto b = std::min( (unsigned)( LIGHT_TREE_BUCKET_CNT * ( centroid( bounds , axis ) - cmin ) / ( cmax - cmin ) ) , LIGHT_TREE_BUCKET_CNT - 1 );
+                buckets[b] = unionBounds( buckets[b] , bounds );
+                bucket_bbox[b].Union( bounds.bbox );
+            }
+
+            for( auto k = 0u ; k < LIGHT_TREE_BUCKET_CNT - 1 ; ++k ){
+                LightBounds left , right;
+                BBox left_bbox , right_bbox;
+                for( auto i = 0u ; i <= k ; ++i ){
+                    left = unionBounds( left , buckets[i] );
+                    left_bbox.Union( bucket_bbox[i] );
+                }
+                for( auto i = k + 1 ; i < LIGHT_TREE_BUCKET_CNT ; ++i ){
+                    right = unionBounds( right , buckets[i] );
+                    right_bbox.Union( bucket_bbox[i] );
+                }
+                left.bbox = left_bbox;
+                right.bbox = right_bbox;
+
+                const auto cost = evaluateCost( left , node_bounds.bbox , axis ) + evaluateCost( right , node_bounds.bbox , axis );
+                if( cost > 0.0f && cost < min_cost ){
+                    min_cost = cost;
+                    min_axis = (int)axis;
+                    min_bucket = k;
+                }
+            }
+        }
+
+        if( min_axis >= 0 ){
+            const auto cmin = centroid_bbox.m_Min[min_axis];
+            const auto cmax = centroid_bbox.m_Max[min_axis];
+            const auto it = std::partition( lights.begin() + start , lights.begin() + end , [&]( const std::pair<const Light*, LightBounds>& light ){
+                const auto b = std::min( (unsigned)( LIGHT_TREE_BUCKET_CNT * ( centroid( light.second , min_axis ) - cmin ) / ( cmax - cmin ) ) , LIGHT_TREE_BUCKET_CNT - 1 );
+                return b <= min_bucket;
+            });
+            const auto split = (unsigned)( it - lights.begin() );
+            if( split > start && split < end ){
+                mid = split;
+                split_found = true;
+            }
+        }
+    }
+
+    // lights are split in the middle if there is no good split, it also happens for lights at the same position.
+    if( !split_found ){
+        const auto axis = centroid_bbox.MaxAxisId();
+        std::nth_element( lights.begin() + start , lights.begin() + mid , lights.begin() + end , [&]( const std::pair<const Light*, LightBounds>& a , const std::pair<const Light*, LightBounds>& b ){
+            return centroid( a.second , axis ) < centroid( b.second , axis );
+        });
+    }
+
+    buildNode( lights , start , mid , bits , depth + 1 );
+    const auto second_child = buildNode( lights , mid , end , bits | ( (std::uint64_t)1 << depth ) , depth + 1 );
+
+    m_nodes[index].bounds = node_bounds;
+    m_nodes[index].second_child = second_child;
+    return index;
+}
+
+const Light* LightTree::Sample( const Point& p , const Vector& n , float u , float* pdf ) const{
+    if( pdf )
+        *pdf = 0.0f;
+    if( m_nodes.empty() )
+        return nullptr;
+
+    auto node = 0u;
+    auto node_pdf = 1.0f;
+    while( true ){
+        const auto& cur = m_nodes[node];
+        if( 0 == cur.second_child ){
+            // the estimation is not accurate enough to be zero for lights that do lit the shading point, but zero is zero.
+            if( importance( cur.bounds , p , n ) <= 0.0f )
+                return nullptr;
+            if( pdf )
+                *pdf = node_pdf;
+            return cur.light;
+        }
+
+        const auto i0 = importance( m_nodes[node + 1].bounds , p , n );
+        const auto i1 = importance( m_nodes[cur.second_child].bounds , p , n );
+        if( i0 <= 0.0f && i1 <= 0.0f )
+            return nullptr;
+
+        // the random number is stretched to be reused in the next level
+        const auto p0 = i0 / ( i0 + i1 );
+        if( u < p0 ){
+            node = node + 1;
+            u = std::min( u / p0 , 1.0f - FLT_EPSILON );
+            node_pdf *= p0;
+        }else{
+            node = cur.second_child;
+            u = std::min( ( u - p0 ) / ( 1.0f - p0 ) , 1.0f - FLT_EPSILON );
+            node_pdf *= 1.0f - p0;
+        }
+    }
+}
+
+float LightTree::Pdf( const Point& p , const Vector& n , const Light* light ) const{
+    const auto it = m_lightBits.find( light );
+    if( it == m_lightBits.end() )
+        return 0.0f;
+
+    // follow the same choices made from the root to the light
+    auto bits = it->second;
+    auto node = 0u;
+    auto pdf = 1.0f;
+    while( 0 != m_nodes[node].second_child ){
+        const auto& cur = m_nodes[node];
+        const auto i0 = importance( m_nodes[node + 1].bounds , p , n );
+        const auto i1 = importance( m_nodes[cur.second_child].bounds , p , n );
+        if( i0 <= 0.0f && i1 <= 0.0f )
+            return 0.0f;
+
+        const auto p0 = i0 / ( i0 + i1 );
+        if( bits & 1 ){
+            node = cur.second_child;
+            pdf *= 1.0f - p0;
+        }else{
+            node = node + 1;
+            pdf *= p0;
+        }
+        bits >>= 1;
+    }
+
+    sAssert( m_nodes[node].light == light , LIGHT );
+    return importance( m_nodes[node].bounds , p , n ) > 0.0f ? pdf : 0.0f;
+}
@@ -0,0 +1,90 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include "light/lightbounds.h"
+
+class Light;
+
+//! @brief  Light tree for picking one light out of many lights for a shading point.
+/**
+ * Each node of the binary tree bounds the position and the emitting directions of the lights under it. During traversal the
+ * importance of both children is estimated for the shading point, the child to be visited is picked stochastically based on it.
+ * The pdf of picking a light is the product of the probabilities of all choices made on the way from the root to the light,
+ * the choices are recorded as bits so that the pdf of a light hit by a BSDF sampled ray can also be evaluated for MIS.
+ * Lights without bounds, like infinite lights, are not supposed to be in the tree.
+ */
+class LightTree{
+public:
+    //! @brief  Build the light tree.
+    //!
+    //! @param  lights      Lights to be put in the tree, lights without bounds are skipped.
+    void            Build( const std::vector<const Light*>& lights );
+
+    //! @brief  Pick a light for a shading point.
+    //!
+    //! @param  p           The position of the shading point.
+    //! @param  n           The normal at the shading point, it is a zero vector if the shading point is in a medium.
+    //! @param  u           The canonical random number to pick a light.
+    //! @param  pdf         The pdf of picking the light.
+    //! @return             The picked light, nullptr if none of the lights in the tree could lit the shading point.
+    const Light*    Sample( const Point& p , const Vector& n , float u , float* pdf ) const;
+
+    //! @brief  The pdf of picking a light for a shading point.
+    //!
+    //! @param  p           The position of the shading point.
+    //! @param  n           The normal at the shading point, it is a zero vector if the shading point is in a medium.
+    //! @param  light       The light to be evaluated.
+    //! @return             The pdf of picking the light, zero if the light is not in the tree.
+    float           Pdf( const Point& p , const Vector& n , const Light* light ) const;
+
+    //! @brief  Whether there is any light in the tree.
+    //!
+    //! @return             Whether the tree is empty.
+    bool            IsEmpty() const {
+        return m_nodes.empty();
+    }
+
+private:
+    //! @brief  Node of the light tree.
+    //!
+    //! Nodes are stored in depth first order, the first child of an interior node always comes right after the node.
+    struct LightTree_Node{
+        LightBounds     bounds;                 /**< Bounds of the lights under the node. */
+        unsigned        second_child = 0;       /**< Index of the second child, it is zero for leaves. */
+        const Light*    light = nullptr;        /**< The light in the leaf, nullptr for interior nodes. */
+    };
+
+    /**< Flattened nodes of the tree. */
+    std::vector<LightTree_Node>                     m_nodes;
+    /**< Choices made from the root to each light, the choice on the i-th level is the i-th bit, set if the second child is picked. */
+    std::unordered_map<const Light*, std::uint64_t> m_lightBits;
+
+    //! @brief  Build a sub-tree recursively.
+    //!
+    //! @param  lights      Lights and their bounds, the ones in the sub-tree are reordered while the sub-tree is built.
+    //! @param  start       Index of the first light in the sub-tree.
+    //! @param  end         Index after the last light in the sub-tree.
+    //! @param  bits        Choices made from the root to the sub-tree.
+    //! @param  depth       Depth of the sub-tree.
+    //! @return             Index of the root of the sub-tree.
+    unsigned        buildNode( std::vector<std::pair<const Light*, LightBounds>>& lights , unsigned start , unsigned end , std::uint64_t bits , unsigned depth );
+};
@@ -0,0 +1,278 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "meshlight.h"
+#include "accel/bvh.h"
+#include "core/mesh.h"
+#include "core/primitive.h"
+#include "core/rand.h"
+#include "sampler/sample.h"
+
+// triangles covering solid angle in this range are sampled w.r.t solid angle, sampling spherical triangles with tiny or almost
+// hemispherical solid angle is not numerically robust.
+static constexpr float MESHLIGHT_MIN_SPHERICAL_SAMPLE_AREA = 3e-4f;
+static constexpr float MESHLIGHT_MAX_SPHERICAL_SAMPLE_AREA = 6.22f;
+
+// The BVH of mesh light is traversed inside the top level traversal of shading, same as instanced meshes.
+static constexpr unsigned MESHLIGHT_BVH_MAX_DEPTH = 32;
+
+// solid angle of the triangle seen from the shading point
+SORT_STATIC_FORCEINLINE float triangleSolidAngle( const Point& p0 , const Point& p1 , const Point& p2 , const Point& p ){
+    return SphericalTriangleArea( normalize( p0 - p ) , normalize( p1 - p ) , normalize( p2 - p ) );
+}
+
+SORT_STATIC_FORCEINLINE bool sampleSphericalTriangle( float solid_angle ){
+    return solid_angle >= MESHLIGHT_MIN_SPHERICAL_SAMPLE_AREA && solid_angle <= MESHLIGHT_MAX_SPHERICAL_SAMPLE_AREA;
+}
+
+MeshLight::MeshLight(){
+}
+
+MeshLight::~MeshLight(){
+}
+
+void MeshLight::Build( const Mesh& mesh , const std::vector<Primitive>& primitives ){
+    sAssert( mesh.m_indices.size() == primitives.size() , LIGHT );
+
+    m_triangles.clear();
+    m_primitives.clear();
+    m_triangleIds.clear();
+    m_bbox = BBox();
+    m_surfaceArea = 0.0f;
+
+    std::vector<float> areas;
+    for( auto i = 0u ; i < primitives.size() ; ++i ){
+        const auto& index = mesh.m_indices[i];
+
+        MeshLight_Triangle tri;
+        tri.p0 = mesh.m_positions[index.m_id[0]];
+        tri.p1 = mesh.m_positions[index.m_id[1]];
+        tri.p2 = mesh.m_positions[index.m_id[2]];
+
+        // it is the same geometric normal as the one of intersections with the triangle
+        const auto n = cross( tri.p2 - tri.p0 , tri.p1 - tri.p0 );
+        tri.area = n.Length() * 0.5f;
+        tri.n = normalize( n );
+
+        m_triangleIds[&primitives[i]] = (unsigned)m_triangles.size();
+        m_triangles.push_back( tri );
+        m_primitives.push_back( &primitives[i] );
+        areas.push_back( tri.area );
+
+        m_bbox.Union( primitives[i].GetBBox() );
+        m_surfaceArea += tri.area;
+    }
+
+    m_triangleTable = std::make_unique<AliasTable>( areas.data() , (unsigned)areas.size() );
+
+    m_accelerator = std::make_unique<Bvh>( MESHLIGHT_BVH_MAX_DEPTH );
+    m_accelerator->Build( m_primitives , m_bbox );
+}
+
+float MeshLight::trianglePdf( const MeshLight_Triangle& tri , const Point& p , const Point& ps ) const{
+    const auto delta = ps - p;
+    const auto sqr_len = delta.SquaredLength();
+    if( sqr_len == 0.0f )
+        return 0.0f;
+
+    // light only leaves the front side of the triangle
+    const auto cos_at_light = -dot( delta , tri.n ) / sqrt( sqr_len );
+    if( cos_at_light <= 0.0f )
+        return 0.0f;
+
+    const auto solid_angle = triangleSolidAngle( tri.p0 , tri.p1 , tri.p2 , p );
+    if( sampleSphericalTriangle( solid_angle ) )
+        return 1.0f / solid_angle;
+    return sqr_len / ( tri.area * cos_at_light );
+}
+
+Spectrum MeshLight::sample_l(const Point& ip, const LightSample* ls , Vector& dirToLight , float* distance , float* pdfW , float* emissionPdf , float* cosAtLight , Visibility& visibility ) const{
+    sAssert(IS_PTR_VALID(ls), LIGHT );
+    if( pdfW )
+        *pdfW = 0.0f;
+    if( IS_PTR_INVALID(m_triangleTable) )
+        return 0.0f;
+
+    // the light sample is used to pick the light already, a new random number is needed for picking a triangle.
+    auto pick_pdf = 0.0f;
+    const auto id = m_triangleTable->SampleDiscrete( sort_canonical() , &pick_pdf );
+    if( id < 0 || pick_pdf == 0.0f )
+        return 0.0f;
+    const auto& tri = m_triangles[id];
+
+    Point ps;
+    const auto solid_angle = triangleSolidAngle( tri.p0 , tri.p1 , tri.p2 , ip );
+    auto sampled = false;
+    if( sampleSphericalTriangle( solid_angle ) ){
+        // the sampled point is where the direction hits the plane of the triangle
+        auto pdf = 0.0f;
+        const auto wi = UniformSampleSphericalTriangle( normalize( tri.p0 - ip ) , normalize( tri.p1 - ip ) , normalize( tri.p2 - ip ) , ls->u , ls->v , &pdf );
+        const auto d = dot( wi , tri.n );
+        if( pdf > 0.0f && d != 0.0f ){
+            ps = ip + wi * ( dot( tri.p0 - ip , tri.n ) / d );
+            sampled = true;
+        }
+    }
+    if( !sampled ){
+        // uniformly sample a point on the triangle
+        const auto su = sqrt( ls->u );
+        const auto b0 = 1.0f - su;
+        const auto b1 = ls->v * su;
+        ps = tri.p0 * b0 + tri.p1 * b1 + tri.p2 * ( 1.0f - b0 - b1 );
+    }
+
+    const auto dlt = ps - ip;
+    const auto len = dlt.Length();
+    if( len == 0.0f )
+        return 0.0f;
+    dirToLight = dlt / len;
+
+    // the pdf is evaluated the same way as the one for rays sampled from BSDF
+    const auto pdf = pick_pdf * trianglePdf( tri , ip , ps );
+    if( pdf == 0.0f )
+        return 0.0f;
+
+    if( pdfW )
+        *pdfW = pdf;
+
+    if( cosAtLight )
+        *cosAtLight = dot( -dirToLight , tri.n );
+
+    if( distance )
+        *distance = len;
+
+    // product of pdf of sampling a point w.r.t surface area and a direction w.r.t direction
+    if( emissionPdf )
+        *emissionPdf = UniformHemispherePdf() / m_surfaceArea;
+
+    // setup visibility tester
+    const auto delta = 0.01f;
+    visibility.ray = Ray( ip , dirToLight , 0 , delta , len - delta );
+    visibility.light = this;
+
+    return intensity;
+}
+
+Spectrum MeshLight::sample_l( const LightSample& ls , Ray& r , float* pdfW , float* pdfA , float* cosAtLight ) const{
+    if( IS_PTR_INVALID(m_triangleTable) ){
+        if( pdfW ) *pdfW = 0.0f;
+        return 0.0f;
+    }
+
+    // triangles are picked w.r.t area, the point is uniformly sampled on the triangle
+    const auto id = m_triangleTable->SampleDiscrete( ls.t , nullptr );
+    const auto& tri = m_triangles[id < 0 ? 0 : id];
+    const auto su = sqrt( ls.u );
+    const auto b0 = 1.0f - su;
+    const auto b1 = ls.v * su;
+
+    Vector t0 , t1;
+    coordinateSystem( tri.n , t0 , t1 );
+    const auto local = UniformSampleHemisphere( sort_canonical() , sort_canonical() );
+
+    r.m_Ori = tri.p0 * b0 + tri.p1 * b1 + tri.p2 * ( 1.0f - b0 - b1 );
+    r.m_Dir = t0 * local.x + tri.n * local.y + t1 * local.z;
+    r.m_fMin = 0.01f;
+    r.m_fMax = FLT_MAX;
+
+    if( pdfW )
+        *pdfW = UniformHemispherePdf() / m_surfaceArea;
+
+    if( pdfA )
+        *pdfA = 1.0f / m_surfaceArea;
+
+    if( cosAtLight )
+        *cosAtLight = satDot( r.m_Dir , tri.n );
+
+    return intensity;
+}
+
+float MeshLight::Pdf( const Point& p , const Vector& wi ) const{
+    if( IS_PTR_INVALID(m_accelerator) )
+        return 0.0f;
+
+    SurfaceInteraction intersect;
+    intersect.t = FLT_MAX;
+    if( !m_accelerator->GetIntersect( Ray( p , wi , 0 , 0.001f ) , intersect ) || IS_PTR_INVALID(intersect.primitive) )
+        return 0.0f;
+
+    const auto it = m_triangleIds.find( intersect.primitive );
+    if( it == m_triangleIds.end() )
+        return 0.0f;
+
+    const auto& tri = m_triangles[it->second];
+    return m_triangleTable->GetProperty( it->second ) * trianglePdf( tri , p , intersect.intersect );
+}
+
+Spectrum MeshLight::Power() const{
+    return m_surfaceArea * intensity.GetIntensity() * TWO_PI;
+}
+
+Spectrum MeshLight::Le( const SurfaceInteraction& intersect , const Vector& wo , float* directPdfA , float* emissionPdf ) const{
+    const auto cos = satDot( wo , intersect.gnormal );
+    if( cos == 0.0f || m_surfaceArea == 0.0f )
+        return 0.0f;
+
+    // picking a triangle w.r.t area and uniformly sampling a point on it is uniformly sampling a point on the mesh
+    if( directPdfA )
+        *directPdfA = 1.0f / m_surfaceArea;
+
+    if( emissionPdf )
+        *emissionPdf = UniformHemispherePdf() / m_surfaceArea;
+
+    return intensity;
+}
+
+bool MeshLight::Le( const Ray& ray , SurfaceInteraction* intersect , Spectrum& radiance ) const{
+    if( IS_PTR_INVALID(m_accelerator) )
+        return false;
+
+    SurfaceInteraction local;
+    local.t = FLT_MAX;
+    if( !m_accelerator->GetIntersect( ray , local ) || IS_PTR_INVALID(local.primitive) )
+        return false;
+
+    radiance = Le( local , -ray.m_Dir , 0 , 0 );
+    if( intersect )
+        *intersect = local;
+    return true;
+}
+
+bool MeshLight::GetBounds( LightBounds& bounds ) const{
+    if( m_surfaceArea <= 0.0f )
+        return false;
+
+    // the axis is the area weighted average of the normals, the cone covers all of them
+    Vector axis;
+    for( const auto& tri : m_triangles )
+        axis += tri.n * tri.area;
+
+    bounds.bbox = m_bbox;
+    bounds.cos_theta_o = -1.0f;
+    bounds.axis = DIR_UP;
+    if( axis.SquaredLength() > 0.0f ){
+        bounds.axis = normalize( axis );
+        bounds.cos_theta_o = 1.0f;
+        for( const auto& tri : m_triangles ){
+            if( tri.area > 0.0f )
+                bounds.cos_theta_o = std::min( bounds.cos_theta_o , dot( bounds.axis , tri.n ) );
+        }
+    }
+    bounds.cos_theta_e = 0.0f;
+    bounds.power = Power().GetIntensity();
+    return true;
+}
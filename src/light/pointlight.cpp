@@ -35,6 +35,7 @@ Spectrum PointLight::sample_l(const Point& ip, const LightSample* ls , Vector& d
     // setup visibility ray
     const auto delta = 0.01f;
     visibility.ray = Ray( ip , dirToLight , 0 , 0.0f , len - delta );
+    visibility.light = this;
 
     // direction pdf from 'intersect' to light source w.r.t solid angle
     if( pdfw )
@@ -76,3 +77,14 @@ Spectrum PointLight::sample_l( const LightSample& ls , Ray& r , float* pdfW , fl
 
     return intensity;
 }
+
+bool PointLight::GetBounds( LightBounds& bounds ) const{
+    // point light emits in all directions
+    const auto light_pos = Point( m_light2world.matrix.m[3] , m_light2world.matrix.m[7] , m_light2world.matrix.m[11] );
+    bounds.bbox = BBox( light_pos , light_pos );
+    bounds.axis = DIR_UP;
+    bounds.cos_theta_o = -1.0f;
+    bounds.cos_theta_e = 0.0f;
+    bounds.power = Power().GetIntensity();
+    return true;
+}
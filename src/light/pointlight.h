@@ -75,5 +75,7 @@ public:
         return 1.0f;
     }
 
+    bool GetBounds( LightBounds& bounds ) const override;
+
     friend class PointLightEntity;
 };
@@ -46,6 +46,26 @@ Spectrum SkyLight::sample_l(const Point& ip, const LightSample* ls , Vector& dir
     // setup visibility tester
     const float delta = 0.01f;
     visibility.ray = Ray( ip , dirToLight , 0 , delta , FLT_MAX );
+    visibility.light = this;
+
+    return sky.Evaluate( localDir ) * intensity;
+}
+
+Spectrum SkyLight::sample_l( const Point& ip , const LightSample* ls , const VMFLobe& lobe , Vector& dirToLight , float* pdfw , Visibility& visibility ) const{
+    auto local_lobe = lobe;
+    local_lobe.axis = normalize( m_light2world.GetInversed().TransformVector( lobe.axis ) );
+
+    float _pdfw = 0.0f;
+    const auto localDir = sky.sample_v( ls->u , ls->v , local_lobe , &_pdfw );
+    if( pdfw )
+        *pdfw = _pdfw;
+    if( _pdfw == 0.0f )
+        return 0.0f;
+    dirToLight = m_light2world.TransformVector(localDir);
+
+    const float delta = 0.01f;
+    visibility.ray = Ray( ip , dirToLight , 0 , delta , FLT_MAX );
+    visibility.light = this;
 
     return sky.Evaluate( localDir ) * intensity;
 }
@@ -108,10 +128,16 @@ bool SkyLight::Le( const Ray& ray , SurfaceInteraction* intersect , Spectrum& ra
     if( intersect && intersect->t != FLT_MAX )
         return false;
 
-    radiance = sky.Evaluate( m_light2world.GetInversed().TransformVector(ray.m_Dir) ) * intensity;
+    radiance = sky.Evaluate( m_light2world.GetInversed().TransformVector(ray.m_Dir) , ray.m_fFootprint ) * intensity;
     return true;
 }
 
 float SkyLight::Pdf( const Point& p , const Vector& wi ) const{
     return sky.Pdf( m_light2world.GetInversed().TransformVector(wi) );
 }
+
+float SkyLight::Pdf( const Point& p , const Vector& wi , const VMFLobe& lobe ) const{
+    auto local_lobe = lobe;
+    local_lobe.axis = normalize( m_light2world.GetInversed().TransformVector( lobe.axis ) );
+    return sky.Pdf( m_light2world.GetInversed().TransformVector(wi) , local_lobe );
+}
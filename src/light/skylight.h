@@ -55,6 +55,21 @@ public:
     //! @return                 The radiance goes from the light source to the intersected point.
     Spectrum sample_l( const LightSample& ls , Ray& r , float* pdfW , float* pdfA , float* cosAtLight ) const override;
 
+    //! @brief  Sample a direction proportional to the product of the sky and a lobe of the bsdf.
+    //!
+    //! A small bright sun reflected by a narrow lobe is missed by both sampling the sky alone and sampling the bsdf
+    //! alone, sampling their product doesn't.
+    //!
+    //! @param  ip              The point where we are interested in shading at.
+    //! @param  ls              The light sample information.
+    //! @param  lobe            The lobe of the bsdf at the point.
+    //! @param  dirToLight      The resulting direction goes from the intersection to light source.
+    //! @param  pdfw            The resulting pdf w.r.t solid angle to pick such a direction.
+    //! @param  visibility      The visibility data structured filled by the light source.
+    //! @return                 The radiance goes from the light source to the intersected point.
+    Spectrum sample_l( const Point& ip , const LightSample* ls , const VMFLobe& lobe , Vector& dirToLight , float* pdfw ,
+                       Visibility& visibility ) const override;
+
     //! @brief  Get the radiance light starting from the light source and ending at the intersection point.
     //!
     //! It simply returns zero for delta function, meaning there is no way to pick a ray hitting the delta light source.
@@ -110,6 +125,21 @@ public:
     //! @return         The pdf w.r.t solid angle if the ray starting from 'p', tracing through 'wi' hits the light source.
     float Pdf( const Point& p , const Vector& wi ) const override;
 
+    //! @brief  The pdf w.r.t solid angle of picking a direction by the version of 'sample_l' guided by a lobe.
+    //!
+    //! @param  p       The point in world space to be shaded.
+    //! @param  wi      The direction pointing from the point.
+    //! @param  lobe    The lobe of the bsdf at the point.
+    //! @return         The pdf w.r.t solid angle.
+    float Pdf( const Point& p , const Vector& wi , const VMFLobe& lobe ) const override;
+
+    //! @brief  Sky light samples the product of the sky and a lobe of the bsdf.
+    //!
+    //! @return     Always true.
+    bool UsesBsdfLobe() const override{
+        return true;
+    }
+
 private:
     /**< Sky information. */
     Sky sky;
@@ -50,6 +50,7 @@ Spectrum SpotLight::sample_l(const Point& ip, const LightSample* ls , Vector& di
     // update visility
     const float delta = 0.01f;
     visibility.ray = Ray( ip , dirToLight , 0 , delta , len - delta );
+    visibility.light = this;
 
     const float falloff = satDot( dirToLight , -light_dir );
     if( falloff <= cos_total_range )
@@ -99,4 +100,17 @@ Spectrum SpotLight::sample_l( const LightSample& ls , Ray& r , float* pdfW , flo
         return 0.0f;
 
     return intensity * d * d;
-}
\ No newline at end of file
+}
+
+bool SpotLight::GetBounds( LightBounds& bounds ) const{
+    const auto light_dir = Vector3f( m_light2world.matrix.m[1] , m_light2world.matrix.m[5] , m_light2world.matrix.m[9] );
+    const auto light_pos = Point( m_light2world.matrix.m[3] , m_light2world.matrix.m[7] , m_light2world.matrix.m[11] );
+
+    // the full intensity is within the fall-off start, the rest of the cone is covered by the emission angle
+    bounds.bbox = BBox( light_pos , light_pos );
+    bounds.axis = normalize( light_dir );
+    bounds.cos_theta_o = cos_falloff_start;
+    bounds.cos_theta_e = cos( std::max( 0.0f , acos( cos_total_range ) - acos( cos_falloff_start ) ) );
+    bounds.power = Power().GetIntensity();
+    return true;
+}
@@ -0,0 +1,239 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "volumelight.h"
+#include "core/mesh.h"
+#include "core/rand.h"
+#include "core/stats.h"
+#include "material/material.h"
+#include "medium/medium.h"
+#include "sampler/sample.h"
+#include "task/task.h"
+
+SORT_STATS_DEFINE_COUNTER(sVolumeLightCount)
+SORT_STATS_DEFINE_COUNTER(sVolumeLightCellCount)
+
+SORT_STATS_COUNTER("Statistics", "Volume Light Count", sVolumeLightCount);
+SORT_STATS_COUNTER("Statistics", "Volume Light Cells", sVolumeLightCellCount);
+
+// Emission of a cell is estimated with a few stratified points in each dimension.
+static constexpr int VOLUMELIGHT_CELL_SAMPLES = 2;
+
+// The estimation could miss hot spots smaller than a cell entirely. Cells with density keep a small share of the power of
+// the brightest cell so that no emission is left out of sampling.
+static constexpr float VOLUMELIGHT_MIN_CELL_WEIGHT = 1e-3f;
+
+bool VolumeLight::Build( const Mesh& mesh ){
+    m_mesh = &mesh;
+    m_material = nullptr;
+    m_cellTable.reset();
+    m_power = 0.0f;
+    m_bbox = BBox();
+
+    const auto grid = mesh.GetVolumeMajorantGrid();
+    if( IS_PTR_INVALID(grid) )
+        return false;
+
+    for( const auto& index : mesh.m_indices ){
+        if( IS_PTR_VALID(index.m_mat) && index.m_mat->HasVolumeAttached() ){
+            m_material = index.m_mat;
+            break;
+        }
+    }
+    if( IS_PTR_INVALID(m_material) )
+        return false;
+
+    m_cellVolume = mesh.GetVolumeScale();
+    for( auto i = 0 ; i < 3 ; ++i ){
+        m_res[i] = grid->GetResolution( i );
+        m_cellSize[i] = 1.0f / grid->GetCellsPerUnit( i );
+        m_cellVolume *= m_cellSize[i];
+    }
+    if( m_cellVolume <= 0.0f )
+        return false;
+
+    // the shader is evaluated at a few points in each cell, it only sees the density so most evaluations hit the cache of
+    // volume samples.
+    const auto cell_cnt = (unsigned)( m_res[0] * m_res[1] * m_res[2] );
+    std::vector<Spectrum> cell_emission( cell_cnt );
+    std::vector<char> cell_dense( cell_cnt , 0 );
+    ParallelFor( 0 , (unsigned)m_res[2] , 1 , [&]( unsigned begin , unsigned end ){
+        for( auto z = (int)begin ; z < (int)end ; ++z ){
+            for( auto y = 0 ; y < m_res[1] ; ++y ){
+                for( auto x = 0 ; x < m_res[0] ; ++x ){
+                    if( grid->GetMajorant( x , y , z ) <= 0.0f )
+                        continue;
+
+                    const auto c = ( z * m_res[1] + y ) * m_res[0] + x;
+                    cell_dense[c] = 1;
+
+                    Spectrum sum;
+                    for( auto k = 0 ; k < VOLUMELIGHT_CELL_SAMPLES * VOLUMELIGHT_CELL_SAMPLES * VOLUMELIGHT_CELL_SAMPLES ; ++k ){
+                        const auto sx = ( (float)( k % VOLUMELIGHT_CELL_SAMPLES ) + 0.5f ) / VOLUMELIGHT_CELL_SAMPLES;
+                        const auto sy = ( (float)( k / VOLUMELIGHT_CELL_SAMPLES % VOLUMELIGHT_CELL_SAMPLES ) + 0.5f ) / VOLUMELIGHT_CELL_SAMPLES;
+                        const auto sz = ( (float)( k / ( VOLUMELIGHT_CELL_SAMPLES * VOLUMELIGHT_CELL_SAMPLES ) ) + 0.5f ) / VOLUMELIGHT_CELL_SAMPLES;
+                        const auto uvw = Point( ( x + sx ) * m_cellSize[0] , ( y + sy ) * m_cellSize[1] , ( z + sz ) * m_cellSize[2] );
+                        if( uvw.x <= 1.0f && uvw.y <= 1.0f && uvw.z <= 1.0f )
+                            sum += emission( mesh.TransformFromVolume( uvw ) );
+                    }
+                    cell_emission[c] = sum / (float)( VOLUMELIGHT_CELL_SAMPLES * VOLUMELIGHT_CELL_SAMPLES * VOLUMELIGHT_CELL_SAMPLES );
+                }
+            }
+        }
+    } );
+
+    auto max_weight = 0.0f;
+    std::vector<float> weights( cell_cnt , 0.0f );
+    for( auto c = 0u ; c < cell_cnt ; ++c ){
+        weights[c] = cell_emission[c].GetIntensity();
+        max_weight = std::max( max_weight , weights[c] );
+        m_power += cell_emission[c] * m_cellVolume;
+    }
+    if( max_weight <= 0.0f )
+        return false;
+
+    auto dense_cnt = 0u;
+    for( auto c = 0u ; c < cell_cnt ; ++c ){
+        if( !cell_dense[c] )
+            continue;
+        weights[c] = std::max( weights[c] , max_weight * VOLUMELIGHT_MIN_CELL_WEIGHT );
+        ++dense_cnt;
+    }
+    m_cellTable = std::make_unique<AliasTable>( weights.data() , cell_cnt );
+
+    // the volume emits in all directions
+    m_power *= FOUR_PI;
+
+    for( auto i = 0 ; i < 8 ; ++i )
+        m_bbox.Union( mesh.TransformFromVolume( Point( (float)( i & 1 ) , (float)( ( i >> 1 ) & 1 ) , (float)( i >> 2 ) ) ) );
+
+    SORT_STATS(++sVolumeLightCount);
+    SORT_STATS(sVolumeLightCellCount += dense_cnt);
+    return true;
+}
+
+Spectrum VolumeLight::emission( const Point& p ) const{
+    MediumInteraction mi;
+    mi.intersect = p;
+    mi.mesh = m_mesh;
+
+    MediumSample ms;
+    m_material->EvaluateMediumSample( mi , ms );
+
+    // This model is what is used in PBRT and different from 'Production Volume Rendering' by Disney.
+    return ms.basecolor * ms.emission * ms.absorption;
+}
+
+Spectrum VolumeLight::samplePoint( float u , float v , Point& p , float& pdf ) const{
+    pdf = 0.0f;
+    if( IS_PTR_INVALID(m_cellTable) )
+        return 0.0f;
+
+    // the light sample is used to pick the light already, new random numbers are needed for picking a cell.
+    auto pick_pdf = 0.0f;
+    const auto c = m_cellTable->SampleDiscrete( sort_canonical() , &pick_pdf );
+    if( c < 0 || pick_pdf == 0.0f )
+        return 0.0f;
+
+    const auto x = c % m_res[0];
+    const auto y = c / m_res[0] % m_res[1];
+    const auto z = c / ( m_res[0] * m_res[1] );
+    const auto uvw = Point( ( x + u ) * m_cellSize[0] , ( y + v ) * m_cellSize[1] , ( z + sort_canonical() ) * m_cellSize[2] );
+
+    // cells on the border could be partially outside of the volume, nothing is there
+    pdf = pick_pdf / m_cellVolume;
+    p = m_mesh->TransformFromVolume( uvw );
+    if( uvw.x > 1.0f || uvw.y > 1.0f || uvw.z > 1.0f )
+        return 0.0f;
+    return emission( p );
+}
+
+Spectrum VolumeLight::sample_l(const Point& ip, const LightSample* ls , Vector& dirToLight , float* distance , float* pdfW , float* emissionPdf , float* cosAtLight , Visibility& visibility ) const{
+    sAssert(IS_PTR_VALID(ls), LIGHT );
+    if( pdfW )
+        *pdfW = 0.0f;
+
+    Point ps;
+    auto pdf = 0.0f;
+    const auto le = samplePoint( ls->u , ls->v , ps , pdf );
+    if( pdf <= 0.0f || le.IsBlack() )
+        return 0.0f;
+
+    const auto delta = ps - ip;
+    const auto sqr_len = delta.SquaredLength();
+    if( sqr_len <= 0.0f )
+        return 0.0f;
+    const auto len = sqrt( sqr_len );
+    dirToLight = delta / len;
+
+    // the shadow ray ends inside the volume, the medium stack takes care of the attenuation through the volume itself
+    visibility.ray = Ray( ip , dirToLight , 0 , 0.0f , len );
+    visibility.light = this;
+
+    // there is no cosine term since there is no surface at the sampled point
+    if( pdfW )
+        *pdfW = pdf * sqr_len;
+    if( distance )
+        *distance = len;
+    if( cosAtLight )
+        *cosAtLight = 1.0f;
+    if( emissionPdf )
+        *emissionPdf = pdf * UniformSpherePdf();
+
+    return le;
+}
+
+Spectrum VolumeLight::sample_l( const LightSample& ls , Ray& r , float* pdfW , float* pdfA , float* cosAtLight ) const{
+    if( pdfW )
+        *pdfW = 0.0f;
+
+    Point ps;
+    auto pdf = 0.0f;
+    const auto le = samplePoint( ls.u , ls.v , ps , pdf );
+    if( pdf <= 0.0f )
+        return 0.0f;
+
+    r.m_fMin = 0.0f;
+    r.m_fMax = FLT_MAX;
+    r.m_Ori = ps;
+    r.m_Dir = UniformSampleSphere( sort_canonical() , sort_canonical() );
+
+    if( pdfW )
+        *pdfW = pdf * UniformSpherePdf();
+    if( pdfA )
+        *pdfA = pdf;
+    if( cosAtLight )
+        *cosAtLight = 1.0f;
+
+    return le;
+}
+
+Spectrum VolumeLight::Power() const{
+    return m_power;
+}
+
+bool VolumeLight::GetBounds( LightBounds& bounds ) const{
+    if( IS_PTR_INVALID(m_cellTable) )
+        return false;
+
+    bounds.bbox = m_bbox;
+    bounds.axis = DIR_UP;
+    bounds.cos_theta_o = -1.0f;
+    bounds.cos_theta_e = 0.0f;
+    bounds.power = Power().GetIntensity();
+    return true;
+}
@@ -0,0 +1,113 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <memory>
+#include "light.h"
+#include "core/samplemethod.h"
+
+class Mesh;
+class MaterialBase;
+
+//! @brief  Light made of the emission of a heterogeneous volume.
+/**
+ * Fire and explosions are volumes that emit light, paths only get their emission if a collision happens to land where it
+ * is hot. Instead, the volume is sampled as a light so that whatever it lights up gets direct illumination from it.
+ *
+ * The emission is estimated on the cells of the majorant grid of the volume density once the scene is loaded. A cell is
+ * picked proportionally to its emitted power and a point is sampled uniformly inside it, the emission is evaluated at the
+ * point exactly. Rays never hit a volume light, it is a delta light from the point of view of integrators, so that
+ * the light samples are not weighted against samples that could never find it. Paths don't account the emission of the
+ * volume anymore except for the ones from the camera, the rest of it is taken by the light.
+ */
+class   VolumeLight : public Light{
+public:
+    //! @brief  Build the emission grid of the volume inside a mesh.
+    //!
+    //! @param  mesh        The mesh in world space with volume data inside.
+    //! @return             Whether the volume emits any light, the light is of no use otherwise.
+    bool    Build( const Mesh& mesh );
+
+    //! @brief  Sample a direction given the intersection.
+    //!
+    //! @param  ip              The point where we are interested in shading at.
+    //! @param  ls              The light sample information.
+    //! @param  dirToLight      The resulting direction goes from the intersection to light source.
+    //! @param  distance        The distance from the intersected point to the sampled point in the volume.
+    //! @param  pdfw            The resulting pdf w.r.t solid angle to pick such a direction.
+    //! @param  emissionPdf     The pdf of picking the sampled point w.r.t volume and the direction w.r.t solid angle.
+    //! @param  cosAtLight      It is always one since there is no surface.
+    //! @param  visibility      The visibility data structured filled by the light source.
+    //! @return                 The radiance goes from the light source to the intersected point.
+    Spectrum sample_l(const Point& ip, const LightSample* ls , Vector& dirToLight , float* distance , float* pdfw , float* emissionPdf , float* cosAtLight , Visibility& visibility ) const override;
+
+    //! @brief      Sample a point and light out-going direction.
+    //!
+    //! @param  ls              The light sample.
+    //! @param  r               The resulting sampled ray.
+    //! @param  pdfW            The pdf of picking the point w.r.t volume and the direction w.r.t solid angle.
+    //! @param  pdfA            The pdf of picking the point w.r.t volume.
+    //! @param  cosAtLight      It is always one since there is no surface.
+    //! @return                 The radiance goes from the light source along the ray.
+    Spectrum sample_l( const LightSample& ls , Ray& r , float* pdfW , float* pdfA , float* cosAtLight ) const override;
+
+    //! @brief  Approximation of total power of the light.
+    //!
+    //! @return     Approximation of the light power.
+    Spectrum Power() const override;
+
+    //! @brief  The pdf w.r.t solid angle if the ray starting from 'p', tracing through 'wi' hits the light source.
+    //!
+    //! @param  p       The point in world space to be shaded.
+    //! @param  wi      The direction pointing from the point.
+    //! @return         It is always zero since rays never hit the volume light.
+    float Pdf( const Point& p , const Vector& wi ) const override{
+        return 0.0f;
+    }
+
+    //! @brief  Get the spatial and directional bounds of the light.
+    //!
+    //! @param  bounds  The bounds of the light.
+    //! @return         Whether the light is bounded, it is 'False' if the volume emits nothing.
+    bool GetBounds( LightBounds& bounds ) const override;
+
+private:
+    const Mesh*                 m_mesh = nullptr;           /**< The mesh with volume data inside. */
+    const MaterialBase*         m_material = nullptr;       /**< The material evaluating the emission of the volume. */
+    std::unique_ptr<AliasTable> m_cellTable;                /**< Alias table for picking a cell w.r.t its power. */
+    float                       m_cellVolume = 0.0f;        /**< Volume of a cell in world space. */
+    float                       m_cellSize[3] = { 0.0f , 0.0f , 0.0f };    /**< Size of a cell in volume texture space. */
+    int                         m_res[3] = { 0 , 0 , 0 };   /**< Number of cells along each axis. */
+    Spectrum                    m_power;                    /**< Total power of the volume. */
+    BBox                        m_bbox;                     /**< Bounding box of the volume in world space. */
+
+    //! @brief  Sample a point in the volume.
+    //!
+    //! @param  u           Canonical random number along the x axis of the cell.
+    //! @param  v           Canonical random number along the y axis of the cell.
+    //! @param  p           The sampled point in world space.
+    //! @param  pdf         The pdf of the point w.r.t volume.
+    //! @return             The emission of the volume at the point.
+    Spectrum samplePoint( float u , float v , Point& p , float& pdf ) const;
+
+    //! @brief  Evaluate the emission of the volume at a point.
+    //!
+    //! @param  p           The point in world space.
+    //! @return             Emitted radiance per unit length.
+    Spectrum emission( const Point& p ) const;
+};
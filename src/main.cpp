@@ -21,6 +21,7 @@
 #include "core/stats.h"
 #include "core/profile.h"
 #include "core/path.h"
+#include "task/timeline.h"
 
 #ifdef SORT_IN_WINDOWS
 int __cdecl main( int argc , char** argv )
@@ -40,8 +41,13 @@ int main(int argc, char* argv[])
     // Flush main thread data
     SortStatsFlushData(true);
     // Output stats data
-    if(ret == 0 && !g_unitTestMode)
+    if(ret == 0 && !g_unitTestMode){
         SortStatsPrintData();
+        if( !g_statsFilePath.empty() )
+            SortStatsExportJson( g_statsFilePath );
+        if( !g_traceFilePath.empty() )
+            Timeline::GetSingleton().ExportChromeTrace( g_traceFilePath );
+    }
 
     SORT_PROFILE_END; // Main Thread
 
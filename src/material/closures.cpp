@@ -35,12 +35,14 @@
 #include "scatteringevent/bsdf/transparent.h"
 #include "scatteringevent/scatteringevent.h"
 #include "scatteringevent/bssrdf/bssrdf.h"
+#include "scatteringevent/bssrdf/randomwalk.h"
 #include "medium/medium.h"
 #include "medium/absorption.h"
 #include "medium/homogeneous.h"
 #include "medium/heterogeneous.h"
 #include "material/material.h"
 #include "core/mesh.h"
+#include "core/globalconfig.h"
 
 USE_TSL_NAMESPACE
 
@@ -52,6 +54,25 @@ IMPLEMENT_CLOSURE_TYPE_BEGIN(ClosureTypeEmpty)
 IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeEmpty, Tsl_float, dummy)
 IMPLEMENT_CLOSURE_TYPE_END(ClosureTypeEmpty)
 
+// Raise the roughness of a glossy lobe to the floor of the scattering event, the parameters are only copied if needed.
+template<class T>
+static const T& regularize( const T& params , const ScatteringEvent& se , T& regularized ){
+    const auto floor = se.GetRoughnessFloor();
+    if( params.roughness_u >= floor && params.roughness_v >= floor )
+        return params;
+    regularized = params;
+    regularized.roughness_u = std::max( params.roughness_u , floor );
+    regularized.roughness_v = std::max( params.roughness_v , floor );
+    return regularized;
+}
+
+// Create the BSSRDF of subsurface scattering, either walking through the interior or taking the diffusion profile.
+static const Bssrdf* createBssrdf( const SurfaceInteraction* intersection , const Spectrum& R , const Spectrum& mfp , const Spectrum& ew , const float sw ){
+    if( g_randomWalkSSS )
+        return SORT_MALLOC(RandomWalkBssrdf)( intersection , R , mfp , ew , sw );
+    return SORT_MALLOC(DisneyBssrdf)( intersection , R , mfp , ew , sw );
+}
+
 #define DEFINE_CLOSURETYPE(T)       inline static ClosureID closure_id = INVALID_CLOSURE_ID; \
                                     static void Register() { closure_id = T::RegisterClosure(); }
 
@@ -234,7 +255,7 @@ namespace {
 
                  const auto diffuseWeight = (Spectrum)( weight * (1.0f - params.metallic) * (1.0 - params.specTrans) );
                  if (!sssBaseColor.IsBlack() && bxdf_sampling_weight < 1.0f && !diffuseWeight.IsBlack() )
-                     se.AddBssrdf( SORT_MALLOC(DisneyBssrdf)(&se.GetInteraction(), sssBaseColor, params.scatterDistance, diffuseWeight , ( 1.0f - bxdf_sampling_weight ) * sample_weight * bssrdf_pdf ) );
+                     se.AddBssrdf( createBssrdf(&se.GetInteraction(), sssBaseColor, params.scatterDistance, diffuseWeight , ( 1.0f - bxdf_sampling_weight ) * sample_weight * bssrdf_pdf ) );
 
  #ifdef SSS_REPLACE_WITH_LAMBERT
                  if (addExtraLambert && !is_tsl_color_black(baseColor))
@@ -250,7 +271,8 @@ namespace {
          DEFINE_CLOSURETYPE(ClosureTypeMicrofacetReflectionGGX)
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
-             const auto& params = *(const ClosureTypeMicrofacetReflectionGGX*)param;
+             ClosureTypeMicrofacetReflectionGGX regularized;
+             const auto& params = regularize( *(const ClosureTypeMicrofacetReflectionGGX*)param , se , regularized );
              se.AddBxdf(SORT_MALLOC(MicroFacetReflection)(params, w));
          }
      };
@@ -259,7 +281,8 @@ namespace {
          DEFINE_CLOSURETYPE(ClosureTypeMicrofacetReflectionBlinn)
 
         void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
-             const auto& params = *(const ClosureTypeMicrofacetReflectionBlinn*)param;
+             ClosureTypeMicrofacetReflectionBlinn regularized;
+             const auto& params = regularize( *(const ClosureTypeMicrofacetReflectionBlinn*)param , se , regularized );
              se.AddBxdf(SORT_MALLOC(MicroFacetReflection)(params, w));
          }
      };
@@ -268,7 +291,8 @@ namespace {
          DEFINE_CLOSURETYPE(ClosureTypeMicrofacetReflectionBeckmann)
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
-             const auto& params = *(const ClosureTypeMicrofacetReflectionBeckmann*)param;
+             ClosureTypeMicrofacetReflectionBeckmann regularized;
+             const auto& params = regularize( *(const ClosureTypeMicrofacetReflectionBeckmann*)param , se , regularized );
              se.AddBxdf(SORT_MALLOC(MicroFacetReflection)(params, w));
          }
      };
@@ -277,7 +301,8 @@ namespace {
          DEFINE_CLOSURETYPE(ClosureTypeMicrofacetRefractionGGX)
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
-             const auto& params = *(const ClosureTypeMicrofacetRefractionGGX*)param;
+             ClosureTypeMicrofacetRefractionGGX regularized;
+             const auto& params = regularize( *(const ClosureTypeMicrofacetRefractionGGX*)param , se , regularized );
              se.AddBxdf(SORT_MALLOC(MicroFacetRefraction)(params, w));
          }
      };
@@ -286,7 +311,8 @@ namespace {
          DEFINE_CLOSURETYPE(ClosureTypeMicrofacetRefractionBlinn)
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
-             const auto& params = *(const ClosureTypeMicrofacetRefractionBlinn*)param;
+             ClosureTypeMicrofacetRefractionBlinn regularized;
+             const auto& params = regularize( *(const ClosureTypeMicrofacetRefractionBlinn*)param , se , regularized );
              se.AddBxdf(SORT_MALLOC(MicroFacetRefraction)(params, w));
          }
      };
@@ -295,7 +321,8 @@ namespace {
          DEFINE_CLOSURETYPE(ClosureTypeMicrofacetRefractionBeckmann)
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
-             const auto& params = *(const ClosureTypeMicrofacetRefractionBeckmann*)param;
+             ClosureTypeMicrofacetRefractionBeckmann regularized;
+             const auto& params = regularize( *(const ClosureTypeMicrofacetRefractionBeckmann*)param , se , regularized );
              se.AddBxdf(SORT_MALLOC(MicroFacetRefraction)(params, w));
          }
      };
@@ -332,7 +359,7 @@ namespace {
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
              const auto& params = *(ClosureTypeMirror*)param;
-             se.AddBxdf(SORT_MALLOC(MicroFacetReflection)(params, w));
+             se.AddBxdf(SORT_MALLOC(MicroFacetReflection)(params, w, false, se.GetRoughnessFloor()));
          }
      };
 
@@ -340,7 +367,8 @@ namespace {
          DEFINE_CLOSURETYPE(ClosureTypeDielectric)
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
-             const auto& params = *(ClosureTypeDielectric*)param;
+             ClosureTypeDielectric regularized;
+             const auto& params = regularize( *(const ClosureTypeDielectric*)param , se , regularized );
              se.AddBxdf(SORT_MALLOC(Dielectric)(params, w));
          }
      };
@@ -349,7 +377,8 @@ namespace {
          DEFINE_CLOSURETYPE(ClosureTypeMicrofacetReflectionDielectric)
 
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3 & w, ScatteringEvent & se) const override {
-             const auto& params = *(ClosureTypeMicrofacetReflectionDielectric*)param;
+             ClosureTypeMicrofacetReflectionDielectric regularized;
+             const auto& params = regularize( *(const ClosureTypeMicrofacetReflectionDielectric*)param , se , regularized );
              se.AddBxdf(SORT_MALLOC(MicroFacetReflection)(params, w));
          }
      };
@@ -387,6 +416,7 @@ namespace {
          void Process(const Tsl_Namespace::ClosureParamPtr param, const Tsl_Namespace::float3& w, ScatteringEvent& se) const override {
              const auto& params = *(const ClosureTypeCoat*)param;
              ScatteringEvent* bottom = SORT_MALLOC(ScatteringEvent)(se.GetInteraction(), SE_Flag( SE_EVALUATE_ALL | SE_SUB_EVENT | SE_REPLACE_BSSRDF ) );
+             bottom->SetRoughnessFloor(se.GetRoughnessFloor());
              ProcessSurfaceClosure((const ClosureTreeNodeBase*)params.closure, make_float3(1.0f, 1.0f, 1.0f), *bottom);
              se.AddBxdf(SORT_MALLOC(Coat)(params, w, bottom));
          }
@@ -399,6 +429,8 @@ namespace {
              const auto& params = *(const ClosureTypeDoubleSided*)param;
              ScatteringEvent* se0 = SORT_MALLOC(ScatteringEvent)(se.GetInteraction(), SE_Flag( SE_EVALUATE_ALL | SE_SUB_EVENT | SE_REPLACE_BSSRDF ) );
              ScatteringEvent* se1 = SORT_MALLOC(ScatteringEvent)(se.GetInteraction(), SE_Flag( SE_EVALUATE_ALL | SE_SUB_EVENT | SE_REPLACE_BSSRDF ) );
+             se0->SetRoughnessFloor(se.GetRoughnessFloor());
+             se1->SetRoughnessFloor(se.GetRoughnessFloor());
              ProcessSurfaceClosure((const ClosureTreeNodeBase*)params.closure0, make_float3(1.0f, 1.0f, 1.0f), *se0);
              ProcessSurfaceClosure((const ClosureTreeNodeBase*)params.closure1, make_float3(1.0f, 1.0f, 1.0f), *se1);
              se.AddBxdf(SORT_MALLOC(DoubleSided)(se0, se1, w));
@@ -470,12 +502,12 @@ namespace {
 
                  const auto bssrdf_pdf = bssrdf_channel_weight / total_channel_weight;
                  if (!is_tsl_color_black(mfp) && !is_tsl_color_black(sssBaseColor))
-                     se.AddBssrdf(SORT_MALLOC(DisneyBssrdf)(&se.GetInteraction(), sssBaseColor, mfp, weight, pdf_weight * bssrdf_pdf ));
+                     se.AddBssrdf(createBssrdf(&se.GetInteraction(), sssBaseColor, mfp, weight, pdf_weight * bssrdf_pdf ));
 
                  if (addExtraLambert && !is_tsl_color_black(baseColor))
                      se.AddBxdf(SORT_MALLOC(Lambert)(baseColor, weight, pdf_weight * ( 1.0f - bssrdf_pdf ), params.normal));
  #else
-                 se.AddBssrdf(SORT_MALLOC(DisneyBssrdf)(&se.GetInteraction(), params, weight ));
+                 se.AddBssrdf(createBssrdf(&se.GetInteraction(), params.base_color, params.scatter_distance, weight , Spectrum( weight ).GetIntensity() ));
  #endif
              }else{
                  se.AddBxdf(SORT_MALLOC(Lambert)(params.base_color, weight , params.normal));
@@ -540,6 +572,8 @@ namespace {
              ms.scattering = fmax(0.0f, params.scattering);
              ms.extinction = fmax(0.0f, ms.absorption + ms.scattering);
              ms.anisotropy = params.anisotropy;
+             ms.backAnisotropy = params.back_anisotropy;
+             ms.backWeight = saturate(params.back_weight);
              ms.emission = fmax(0.0f, params.emission);
              ms.basecolor = params.base_color;
          }
@@ -15,6 +15,8 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <stdio.h>
+#include <algorithm>
 #include <string.h>
 #include <tsl_system.h>
 #include "material.h"
@@ -22,13 +24,21 @@
 #include "core/log.h"
 #include "core/globalconfig.h"
 #include "core/strid.h"
+#include "core/stats.h"
 #include "scatteringevent/scatteringevent.h"
 #include "scatteringevent/bsdf/lambert.h"
 #include "scatteringevent/bsdf/transparent.h"
+#include "scatteringevent/bsdf/microfacet.h"
 #include "texture/imagetexture2d.h"
 
 USE_TSL_NAMESPACE
 
+SORT_STATS_DEFINE_COUNTER(sSharedShaderCnt)
+SORT_STATS_DEFINE_COUNTER(sNativeSurfaceClosureCnt)
+
+SORT_STATS_COUNTER("Material", "Shaders Shared by Identical Shader Graphs", sSharedShaderCnt);
+SORT_STATS_COUNTER("Material", "Surface Shaders Replaced by Native Closures", sNativeSurfaceClosureCnt);
+
 #ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION
 bool MaterialBase::IsMaterialBuilt() const{
     // std::memory_order_acquire is needed to make sure compiler doesn't do crazy out-of-order execution thing.
@@ -56,11 +66,20 @@ void Material::BuildMaterial() {
     auto tried_building_surface_shader = false;
     auto tried_building_volume_shader = false;
 
-    auto build_shader_type = [&](const TSL_ShaderData& shader_data, const char* root_shader, const std::string prefix, bool& shader_valid, bool& trying_building_shader_type, ShaderUnitContainer& shader_units, std::shared_ptr<Tsl_Namespace::ShaderInstance>& shader_instance) {
+    auto build_shader_type = [&](const TSL_ShaderData& shader_data, const std::string& shader_key, const char* root_shader, const std::string prefix, bool& shader_valid, bool& trying_building_shader_type, ShaderUnitContainer& shader_units, std::shared_ptr<Tsl_Namespace::ShaderInstance>& shader_instance) {
         // Build surface shader
         if (shader_valid) {
-            shader_valid = false;
             trying_building_shader_type = true;
+
+            // materials with identical shader graphs share the same shader, there is no need to compile it again.
+            const auto key = prefix + "\n" + shader_key;
+            shader_instance = MatManager::GetSingleton().GetCompiledShader(key);
+            if (shader_instance) {
+                SORT_STATS(++sSharedShaderCnt);
+                return;
+            }
+
+            shader_valid = false;
     
             for (const auto& shader : shader_data.m_sources)
                 shader_units[shader.name] = MatManager::GetSingleton().GetShaderUnitTemplate(shader.type);
@@ -124,20 +143,27 @@ void Material::BuildMaterial() {
                 return;
     
             shader_valid = true;
+            MatManager::GetSingleton().AddCompiledShader(key, shader_instance);
         }
     };
 
-    // build surface shader
-    build_shader_type(m_surface_shader_data, surface_shader_root, "Surface", m_surface_shader_valid, tried_building_surface_shader, m_surface_shader_units, m_surface_shader);
+    // build surface shader, simple ones don't need any shader at all
+    if (buildNativeSurfaceClosure())
+        tried_building_surface_shader = true;
+    else
+        build_shader_type(m_surface_shader_data, m_surface_shader_key, surface_shader_root, "Surface", m_surface_shader_valid, tried_building_surface_shader, m_surface_shader_units, m_surface_shader);
 
     // build volume shader
-    build_shader_type(m_volume_shader_data, surface_volume_root, "Volume", m_volume_shader_valid, tried_building_volume_shader, m_volume_shader_units, m_volume_shader);
+    build_shader_type(m_volume_shader_data, m_volume_shader_key, surface_volume_root, "Volume", m_volume_shader_valid, tried_building_volume_shader, m_volume_shader_units, m_volume_shader);
 
     // if there is volume shader, but no surface shader, a special transparent material will be applied automatically
     // this will make the shader authoring a lot easier.
     if (!m_surface_shader_valid && m_volume_shader_valid && !tried_building_surface_shader)
         m_special_transparent = true;
 
+    // constant inputs are not needed once the shaders are built
+    m_constantInputs.clear();
+
     auto build_shader_succesfully = true;
     if (tried_building_surface_shader && !m_surface_shader_valid ) {
         slog(WARNING, MATERIAL, "Build surface shader of material %s unsuccessfully.", m_name.c_str());
@@ -170,9 +196,21 @@ void Material::Serialize(IStreamBase& stream){
     const auto message = "Parsing Material '" + m_name + "'";
     SORT_PROFILE(message.c_str());
 
-    auto parse_shader_type = [&](TSL_ShaderData& shader_data, bool& is_shader_valid) {
+    // Names of shader units are unique across materials, they are replaced with their indices in the key of the shader graph.
+    // Everything that affects the compiled shader, types of shader units, default values and connections, goes in the key.
+    const auto output_node_name = "ShaderOutput_" + m_name;
+    auto append_float = [](std::string& key, const float x) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%a,", x);
+        key += buf;
+    };
+
+    auto parse_shader_type = [&](TSL_ShaderData& shader_data, bool& is_shader_valid, std::string& key) {
         is_shader_valid = true;
 
+        std::unordered_map<std::string, std::string> unit_keys;
+        unit_keys[output_node_name] = "#out";
+
         unsigned shader_unit_cnt = 0;
         stream >> shader_unit_cnt;
 
@@ -181,6 +219,9 @@ void Material::Serialize(IStreamBase& stream){
             ShaderSource shader_source;
             stream >> shader_source.name >> shader_source.type;
 
+            unit_keys[shader_source.name] = "#" + std::to_string(i);
+            key += "unit " + shader_source.type + "\n";
+
             auto parameter_cnt = 0u;
             stream >> parameter_cnt;
             for (auto j = 0u; j < parameter_cnt; ++j) {
@@ -189,22 +230,32 @@ void Material::Serialize(IStreamBase& stream){
                 stream >> default_value.shader_unit_param_name;
                 int channel_num = 0;
                 stream >> channel_num;
+
+                key += "param " + default_value.shader_unit_param_name + " ";
                 // currently only float and float3 are supported for now
                 if (channel_num == 1) {
                     float x;
                     stream >> x;
                     default_value.default_value = x;
+                    append_float(key, x);
+                    m_constantInputs[shader_source.name + "." + default_value.shader_unit_param_name] = Tsl_Namespace::make_float3(x, x, x);
                 }
                 else if (channel_num == 3) {
                     float x, y, z;
                     stream >> x >> y >> z;
                     default_value.default_value = Tsl_Namespace::make_float3(x, y, z);
+                    append_float(key, x);
+                    append_float(key, y);
+                    append_float(key, z);
+                    m_constantInputs[shader_source.name + "." + default_value.shader_unit_param_name] = Tsl_Namespace::make_float3(x, y, z);
                 }
                 else if (channel_num == 4) { // this is fairly ugly, but it works, I will find time to refactor it later.
                     std::string str;
                     stream >> str;
                     default_value.default_value = make_tsl_global_ref(str);
+                    key += "global " + str;
                 }
+                key += "\n";
 
                 m_paramDefaultValues.push_back(default_value);
             }
@@ -219,25 +270,60 @@ void Material::Serialize(IStreamBase& stream){
             stream >> connection.source_shader >> connection.source_property;
             stream >> connection.target_shader >> connection.target_property;
             shader_data.m_connections.push_back(connection);
+
+            auto unit_key = [&](const std::string& name) {
+                const auto it = unit_keys.find(name);
+                return it == unit_keys.end() ? name : it->second;
+            };
+            key += "connect " + unit_key(connection.source_shader) + "." + connection.source_property + " " +
+                   unit_key(connection.target_shader) + "." + connection.target_property + "\n";
         }
     };
 
     StringID surface_shader_tag;
     stream >> surface_shader_tag;
     if(surface_shader_tag == "Surface Shader"_sid)
-        parse_shader_type(m_surface_shader_data, m_surface_shader_valid);
+        parse_shader_type(m_surface_shader_data, m_surface_shader_valid, m_surface_shader_key);
 
     // temporary for now
     StringID volume_shader_tag;
     stream >> volume_shader_tag;
     if(volume_shader_tag == "Volume Shader"_sid)
-        parse_shader_type(m_volume_shader_data, m_volume_shader_valid);
+        parse_shader_type(m_volume_shader_data, m_volume_shader_valid, m_volume_shader_key);
 
     stream >> m_hasTransparentNode;
     stream >> m_hasSSSNode;
 
     stream >> m_volumeStep;
     stream >> m_volumeStepCnt;
+
+    // primitives keep the alpha mask the material is loaded with the first time
+    if (g_alphaMask && !m_alphaMask)
+        buildAlphaMask();
+}
+
+void Material::Reload(IStreamBase& stream){
+    m_surface_shader_valid = false;
+    m_volume_shader_valid = false;
+    m_special_transparent = false;
+    m_surface_shader_data = TSL_ShaderData();
+    m_volume_shader_data = TSL_ShaderData();
+    m_surface_shader_key.clear();
+    m_volume_shader_key.clear();
+    m_surface_shader = nullptr;
+    m_volume_shader = nullptr;
+    m_surface_shader_units.clear();
+    m_volume_shader_units.clear();
+    m_paramDefaultValues.clear();
+    m_constantInputs.clear();
+    m_nativeSurfaceClosure = NATIVE_SURFACE_CLOSURE_NONE;
+    m_nativeSurfaceParams = NativeSurfaceParams();
+#ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION
+    m_is_built.store(false, std::memory_order_release);
+#endif
+
+    Serialize(stream);
+    BuildMaterial();
 }
 
 void Material::UpdateScatteringEvent( ScatteringEvent& se ) const {
@@ -247,12 +333,121 @@ void Material::UpdateScatteringEvent( ScatteringEvent& se ) const {
         return;
     }
 
-    if( m_surface_shader_valid )
-        ExecuteSurfaceShader(m_surface_shader.get() , se );
-    else if( m_special_transparent )
+    if( m_surface_shader_valid ){
+        if( NATIVE_SURFACE_CLOSURE_NONE != m_nativeSurfaceClosure )
+            addNativeSurfaceClosure( se );
+        else
+            ExecuteSurfaceShader(m_surface_shader.get() , se );
+    }else if( m_special_transparent )
         se.AddBxdf(SORT_MALLOC(Transparent)());
 }
 
+bool Material::buildNativeSurfaceClosure() {
+    // transparency and sss need the closure tree, so does anything more than one closure with constant inputs.
+    if (!m_surface_shader_valid || m_hasTransparentNode || m_hasSSSNode)
+        return false;
+
+    // the only shader units are the output node and the one creating the closure.
+    const auto& sources = m_surface_shader_data.m_sources;
+    const auto& connections = m_surface_shader_data.m_connections;
+    if (sources.size() != 2 || connections.size() != 1)
+        return false;
+
+    const auto& connection = connections[0];
+    if (connection.target_shader != "ShaderOutput_" + m_name || connection.target_property != "Surface")
+        return false;
+
+    const auto it = std::find_if(sources.begin(), sources.end(), [&](const ShaderSource& source) { return source.name == connection.source_shader; });
+    if (it == sources.end() || connection.source_property != "Result")
+        return false;
+
+    auto constant_input = [&](const char* param, Tsl_float3& value) {
+        const auto input = m_constantInputs.find(it->name + "." + param);
+        if (input == m_constantInputs.end())
+            return false;
+        value = input->second;
+        return true;
+    };
+
+    NativeSurfaceParams params;
+    auto closure = NATIVE_SURFACE_CLOSURE_NONE;
+    if (it->type == "SORTNode_Material_DiffuseLambert") {
+        if (!constant_input("Diffuse", params.base_color) || !constant_input("Normal", params.normal))
+            return false;
+        closure = NATIVE_SURFACE_CLOSURE_LAMBERT;
+    } else {
+        if (it->type == "SORTNode_Material_MicrofacetReflectionGGX")
+            closure = NATIVE_SURFACE_CLOSURE_MICROFACET_REFLECTION_GGX;
+        else if (it->type == "SORTNode_Material_MicrofacetReflectionBlinn")
+            closure = NATIVE_SURFACE_CLOSURE_MICROFACET_REFLECTION_BLINN;
+        else if (it->type == "SORTNode_Material_MicrofacetReflectionBeckmann")
+            closure = NATIVE_SURFACE_CLOSURE_MICROFACET_REFLECTION_BECKMANN;
+        else
+            return false;
+
+        Tsl_float3 roughness_u, roughness_v;
+        if (!constant_input("InteriorIOR", params.eta) || !constant_input("AbsorptionCoefficient", params.absorption) ||
+            !constant_input("RoughnessU", roughness_u) || !constant_input("RoughnessV", roughness_v) ||
+            !constant_input("BaseColor", params.base_color) || !constant_input("Normal", params.normal))
+            return false;
+        params.roughness_u = roughness_u.x;
+        params.roughness_v = roughness_v.x;
+    }
+
+    SORT_STATS(++sNativeSurfaceClosureCnt);
+
+    m_nativeSurfaceClosure = closure;
+    m_nativeSurfaceParams = params;
+    return true;
+}
+
+void Material::addNativeSurfaceClosure( ScatteringEvent& se ) const {
+    const auto& np = m_nativeSurfaceParams;
+
+    // the closures are created exactly the same way the closure tree of the shader does, see closures.cpp.
+    auto make_microfacet_params = [&](auto& params) {
+        params.eta = np.eta;
+        params.absorption = np.absorption;
+        params.roughness_u = np.roughness_u;
+        params.roughness_v = np.roughness_v;
+        params.base_color = np.base_color;
+        params.normal = np.normal;
+        se.AddBxdf(SORT_MALLOC(MicroFacetReflection)(params, FULL_WEIGHT));
+    };
+
+    switch (m_nativeSurfaceClosure) {
+    case NATIVE_SURFACE_CLOSURE_LAMBERT:
+        {
+            ClosureTypeLambert params;
+            params.base_color = np.base_color;
+            params.normal = np.normal;
+            se.AddBxdf(SORT_MALLOC(Lambert)(params, FULL_WEIGHT));
+        }
+        break;
+    case NATIVE_SURFACE_CLOSURE_MICROFACET_REFLECTION_GGX:
+        {
+            ClosureTypeMicrofacetReflectionGGX params;
+            make_microfacet_params(params);
+        }
+        break;
+    case NATIVE_SURFACE_CLOSURE_MICROFACET_REFLECTION_BLINN:
+        {
+            ClosureTypeMicrofacetReflectionBlinn params;
+            make_microfacet_params(params);
+        }
+        break;
+    case NATIVE_SURFACE_CLOSURE_MICROFACET_REFLECTION_BECKMANN:
+        {
+            ClosureTypeMicrofacetReflectionBeckmann params;
+            make_microfacet_params(params);
+        }
+        break;
+    default:
+        sAssert(false, MATERIAL);
+        break;
+    }
+}
+
 void Material::UpdateMediumStack( const MediumInteraction& mi , const SE_Interaction flag , MediumStack& ms ) const {
     if (m_volume_shader_valid)
         ExecuteVolumeShader(m_volume_shader.get(), mi, ms, flag, this);
@@ -289,6 +484,10 @@ bool MaterialProxy::HasTransparency() const {
     return m_material.HasTransparency();
 }
 
+const AlphaMask* MaterialProxy::GetAlphaMask() const {
+    return m_material.GetAlphaMask();
+}
+
 bool MaterialProxy::HasSSS() const {
     return m_material.HasSSS();
 }
@@ -303,4 +502,73 @@ float MaterialProxy::GetVolumeStep() const {
 
 unsigned int MaterialProxy::GetVolumeStepCnt() const {
     return m_material.GetVolumeStepCnt();
-}
\ No newline at end of file
+}
+
+void Material::buildAlphaMask() {
+    if (!m_surface_shader_valid || !m_hasTransparentNode || m_hasSSSNode)
+        return;
+
+    const auto& sources = m_surface_shader_data.m_sources;
+    const auto& connections = m_surface_shader_data.m_connections;
+    auto find_source = [&](const std::string& name) -> const ShaderSource* {
+        const auto it = std::find_if(sources.begin(), sources.end(), [&](const ShaderSource& source) { return source.name == name; });
+        return it == sources.end() ? nullptr : &(*it);
+    };
+    auto find_input = [&](const std::string& name, const char* param) -> const ShaderConnection* {
+        const auto it = std::find_if(connections.begin(), connections.end(), [&](const ShaderConnection& connection) {
+            return connection.target_shader == name && connection.target_property == param;
+        });
+        return it == connections.end() ? nullptr : &(*it);
+    };
+
+    // the transparent node is the only source of transparency, there can't be anything else transparent in the graph.
+    const auto transparent_cnt = std::count_if(sources.begin(), sources.end(), [](const ShaderSource& source) { return source.type == "SORTNode_Material_Transparent"; });
+    if (transparent_cnt != 1)
+        return;
+
+    // the output is a blend of two closures
+    const auto output = find_input("ShaderOutput_" + m_name, "Surface");
+    const auto blend = output ? find_source(output->source_shader) : nullptr;
+    if (!blend || blend->type != "SORTNode_Material_Blend")
+        return;
+
+    // one of them is the transparent node passing everything through
+    const auto surface0 = find_input(blend->name, "Surface0");
+    const auto surface1 = find_input(blend->name, "Surface1");
+    if (!surface0 || !surface1)
+        return;
+    const auto source0 = find_source(surface0->source_shader);
+    const auto source1 = find_source(surface1->source_shader);
+    if (!source0 || !source1 || source0 == source1)
+        return;
+    const auto inverted = source1->type == "SORTNode_Material_Transparent";
+    const auto transparent = inverted ? source1 : source0;
+    if (transparent->type != "SORTNode_Material_Transparent" || find_input(transparent->name, "Attenuation"))
+        return;
+    const auto transparent_outputs = std::count_if(connections.begin(), connections.end(), [&](const ShaderConnection& connection) { return connection.source_shader == transparent->name; });
+    if (transparent_outputs != 1)
+        return;
+    const auto attenuation = m_constantInputs.find(transparent->name + ".Attenuation");
+    if (attenuation == m_constantInputs.end() || attenuation->second.x != 1.0f || attenuation->second.y != 1.0f || attenuation->second.z != 1.0f)
+        return;
+
+    // the factor is the alpha of an image texture, the type of the node is its color space followed by the file name.
+    const auto factor = find_input(blend->name, "Factor");
+    const auto image = factor && factor->source_property == "Alpha" ? find_source(factor->source_shader) : nullptr;
+    if (!image || find_input(image->name, "UVCoordinate"))
+        return;
+    std::string file;
+    for (const auto prefix : { "SORTNodeImageLinear", "SORTNodeImagesRGB" }) {
+        if (image->type.compare(0, strlen(prefix), prefix) == 0)
+            file = image->type.substr(strlen(prefix));
+    }
+    const auto tiling = m_constantInputs.find(image->name + ".UVTiling");
+    if (file.empty() || find_input(image->name, "UVTiling") || tiling == m_constantInputs.end())
+        return;
+
+    const auto texture = dynamic_cast<const ImageTexture2D*>(MatManager::GetSingleton().GetResource(file));
+    if (!texture)
+        return;
+
+    m_alphaMask = std::make_unique<AlphaMask>(texture, tiling->second.x, inverted);
+}
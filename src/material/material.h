@@ -20,9 +20,11 @@
 #include <unordered_map>
 #include <list>
 #include <vector>
+#include <memory>
 #include <string>
 #include "stream/stream.h"
 #include "tsl_system.h"
+#include "texture/alphamask.h"
 
 #ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION
 #include <atomic>
@@ -49,6 +51,25 @@ struct ShaderSource {
     std::string type;
 };
 
+//! @brief  Surface closures that are created natively, without executing any shader.
+enum NativeSurfaceClosure : unsigned char {
+    NATIVE_SURFACE_CLOSURE_NONE = 0,
+    NATIVE_SURFACE_CLOSURE_LAMBERT,
+    NATIVE_SURFACE_CLOSURE_MICROFACET_REFLECTION_GGX,
+    NATIVE_SURFACE_CLOSURE_MICROFACET_REFLECTION_BLINN,
+    NATIVE_SURFACE_CLOSURE_MICROFACET_REFLECTION_BECKMANN,
+};
+
+//! @brief  Parameters of a native surface closure, each closure only uses some of them.
+struct NativeSurfaceParams {
+    Tsl_float3  base_color;
+    Tsl_float3  normal;
+    Tsl_float3  eta;
+    Tsl_float3  absorption;
+    float       roughness_u = 0.0f;
+    float       roughness_v = 0.0f;
+};
+
 struct TSL_ShaderData {
     /**< Shader source code. */
     std::vector<ShaderSource>           m_sources;
@@ -103,6 +124,13 @@ public:
     //! @return     Return true if there is transparency in the material.
     virtual bool       HasTransparency() const = 0;
 
+    //! @brief  Get the binary alpha mask that replaces the transparency of the material during traversal.
+    //!
+    //! @return     The alpha mask, nullptr if the transparency of the material can't be baked.
+    virtual const AlphaMask* GetAlphaMask() const {
+        return nullptr;
+    }
+
     //! @brief  Whether the material has sss
     //!
     //! @return     Return true if there is sss node in the material.
@@ -186,6 +214,14 @@ public:
     //! @param  stream      Input stream for data.
     void        Serialize(IStreamBase& stream) override;
 
+    //! @brief  Load the material again from stream and build it.
+    //!
+    //! Everything loaded before is dropped, primitives referring to the material keep the same address. It is only
+    //! allowed when there is no rendering happening.
+    //!
+    //! @param  stream      Input stream for data.
+    void        Reload(IStreamBase& stream);
+
     //! @brief  Build shader in tsl.
     //!
     //! @param  shadingSys      Open-Shading-Language shading system.
@@ -204,6 +240,25 @@ public:
     bool        HasTransparency() const override {
         return m_hasTransparentNode;
     }
+
+    //! @brief  Get the binary alpha mask that replaces the transparency of the material during traversal.
+    //!
+    //! A material blending a transparent closure with opaque ones by the alpha of an image texture is a cut-out, rays
+    //! passing through it don't need to execute the shader at all once its alpha is baked. The mask is created the first
+    //! time the material is loaded, live updates of the material don't change it.
+    //!
+    //! @return     The alpha mask, nullptr if the transparency of the material can't be baked.
+    const AlphaMask* GetAlphaMask() const override {
+        return m_alphaMask.get();
+    }
+
+    //! @brief  Bake the alpha mask of the material if there is one.
+    //!
+    //! It needs to be called once the resources are loaded.
+    void        BakeAlphaMask() {
+        if( m_alphaMask )
+            m_alphaMask->Bake();
+    }
     
     //! @brief  Whether the material has sss
     //!
@@ -234,6 +289,25 @@ public:
     }
 
 private:
+    //! @brief  Replace the surface shader with a native closure if possible.
+    //!
+    //! A surface shader made of nothing but a single BXDF node with constant inputs always creates the same closure. There
+    //! is no need to compile it, neither is there any need to execute it and process its closure tree for every hit.
+    //!
+    //! @return     Whether the surface shader is replaced with a native closure.
+    bool        buildNativeSurfaceClosure();
+
+    //! @brief  Fill the scattering event with the native closure.
+    //!
+    //! @param  se      Scattering event to be populated.
+    void        addNativeSurfaceClosure( ScatteringEvent& se ) const;
+
+    //! @brief  Create the alpha mask of the material if its surface shader is a cut-out.
+    //!
+    //! The surface shader needs to be a blend of a fully transparent node and opaque closures, whose factor is the alpha
+    //! of an image texture sampled with the texture coordinate of the surface.
+    void        buildAlphaMask();
+
     /**< Whether this is a valid material */
     bool                            m_surface_shader_valid = false;
     bool                            m_volume_shader_valid = false;
@@ -250,6 +324,10 @@ private:
     TSL_ShaderData                  m_surface_shader_data;
     TSL_ShaderData                  m_volume_shader_data;
 
+    /**< Content of the shader graphs without material specific names, identical graphs share the same compiled shader. */
+    std::string                     m_surface_shader_key;
+    std::string                     m_volume_shader_key;
+
     /**< Shader unit instance. */
     std::shared_ptr<Tsl_Namespace::ShaderInstance>  m_surface_shader = nullptr;
     std::shared_ptr<Tsl_Namespace::ShaderInstance>  m_volume_shader = nullptr;
@@ -261,10 +339,20 @@ private:
 
     /**< Shader unit default values. */
     std::vector<ShaderParamDefaultValue>        m_paramDefaultValues;
+    /**< Default values that are constants, indexed by 'shader_unit.param', they are only needed until the material is built. */
+    std::unordered_map<std::string, Tsl_float3> m_constantInputs;
+
+    /**< Native closure replacing the surface shader. */
+    NativeSurfaceClosure            m_nativeSurfaceClosure = NATIVE_SURFACE_CLOSURE_NONE;
+    /**< Parameters of the native closure. */
+    NativeSurfaceParams             m_nativeSurfaceParams;
 
     bool                            m_hasTransparentNode = false;
     bool                            m_hasSSSNode = false;
 
+    /**< Alpha mask replacing the transparency of cut-out materials during traversal. */
+    std::unique_ptr<AlphaMask>      m_alphaMask;
+
     float                           m_volumeStep = 0.1f;
     unsigned int                    m_volumeStepCnt = 1024;
 };
@@ -327,6 +415,11 @@ public:
     //! @return Return true if there is transparency in the material.
     bool       HasTransparency() const override;
 
+    //! @brief  Get the alpha mask of the referred material.
+    //!
+    //! @return     The alpha mask, nullptr if the transparency of the material can't be baked.
+    const AlphaMask* GetAlphaMask() const override;
+
     //! @brief  Whether the material has sss
     //!
     //! @return Return true if there is sss node in the material.
@@ -22,11 +22,38 @@
 #include "core/globalconfig.h"
 #include "core/log.h"
 #include "core/timer.h"
+#include "core/thread.h"
 #include "scatteringevent/bsdf/merl.h"
 #include "scatteringevent/bsdf/fourierbxdf.h"
 #include "texture/imagetexture2d.h"
+#include "texture/udimtexture2d.h"
+#include "core/hash.h"
+#include "core/stats.h"
+#include <fstream>
 
-#ifdef ENABLE_ASYNC_TEXTURE_LOADING
+SORT_STATS_DEFINE_COUNTER(sSharedResourceCnt)
+
+SORT_STATS_COUNTER("Material", "Resources Shared by Content", sSharedResourceCnt);
+
+// size of the chunk read at a time when hashing the content of a file
+static constexpr std::size_t RESOURCE_HASH_CHUNK_SIZE = 1 << 20;
+
+// hash the content of a file, it is way cheaper than decoding images
+static bool hashFile(const std::string& filename, std::uint64_t& hash) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.good())
+        return false;
+
+    hash = FNV_OFFSET_BASIS;
+    std::vector<char> chunk(RESOURCE_HASH_CHUNK_SIZE);
+    while (file) {
+        file.read(chunk.data(), chunk.size());
+        hash = HashBytes(chunk.data(), (std::size_t)file.gcount(), hash);
+    }
+    return true;
+}
+
+#ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION_CHEAP
 #include <future>
 #endif
 
@@ -62,12 +89,6 @@ namespace {
     };
 }
 
-#ifdef ENABLE_ASYNC_TEXTURE_LOADING
-static bool async_load_resource(Resource* resource, std::string filename) {
-    return resource->LoadResource(filename);
-}
-#endif
-
 #ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION_CHEAP
 static void async_build_material(MaterialBase* material) {
     material->BuildMaterial();
@@ -78,16 +99,9 @@ static void async_build_material(MaterialBase* material) {
 unsigned MatManager::ParseMatFile( IStreamBase& stream ){
     SORT_PROFILE("Parsing Materials");
 
-    const auto current_task = GetCurrentTask();
-    const auto dependencies = current_task->GetDependencies();
-
     auto resource_cnt = 0u;
     stream >> resource_cnt;
 
-#ifdef ENABLE_ASYNC_TEXTURE_LOADING
-    std::vector<std::future<bool>>      async_resource_reading;
-#endif
-
 #ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION_CHEAP
     std::vector<std::future<void>>      async_material_building;
 #endif
@@ -99,18 +113,23 @@ unsigned MatManager::ParseMatFile( IStreamBase& stream ){
 
         Resource* ptr_resource = nullptr;
 
-        if (0 == m_resources.count(resource_file)) {
+        const StringID resource_sid(resource_file);
+        if (!m_resources.Contains(resource_sid)) {
             if (resource_type == SID("MerlBRDFMeasuredData")) {
-                m_resources[resource_file] = std::make_unique<MerlData>();
-                ptr_resource = m_resources[resource_file].get();
+                m_resources[resource_sid] = std::make_unique<MerlData>();
+                ptr_resource = m_resources[resource_sid].get();
             }
             else if (resource_type == SID("FourierBRDFMeasuredData")) {
-                m_resources[resource_file] = std::make_unique<FourierBxdfData>();
-                ptr_resource = m_resources[resource_file].get();
+                m_resources[resource_sid] = std::make_unique<FourierBxdfData>();
+                ptr_resource = m_resources[resource_sid].get();
             }
             else if (resource_type == SID("Texture2D")) {
-                m_resources[resource_file] = std::make_unique<ImageTexture2D>();
-                ptr_resource = m_resources[resource_file].get();
+                // tiles of a UDIM set are only loaded once they are looked up during rendering
+                if (UdimTexture2D::IsUdim(resource_file))
+                    m_resources[resource_sid] = std::make_unique<UdimTexture2D>();
+                else
+                    m_resources[resource_sid] = std::make_unique<ImageTexture2D>();
+                ptr_resource = m_resources[resource_sid].get();
             }
 
             if (!ptr_resource) {
@@ -118,9 +137,10 @@ unsigned MatManager::ParseMatFile( IStreamBase& stream ){
             }
             else {
 #ifdef ENABLE_ASYNC_TEXTURE_LOADING
-                async_resource_reading.push_back(std::async(std::launch::async, async_load_resource, ptr_resource, resource_file));
+                // the resource keeps loading while the scene is being loaded, see WaitForResourceLoading.
+                m_resourceLoading.Fork([this, ptr_resource, resource_file, resource_type]() { loadResource(ptr_resource, resource_file, resource_type); }, "Loading Resource", TaskClass::IO);
 #else
-                ptr_resource->LoadResource(resource_file);
+                loadResource(ptr_resource, resource_file, resource_type);
 #endif
             }
         }
@@ -177,7 +197,7 @@ unsigned MatManager::ParseMatFile( IStreamBase& stream ){
 
             // push it if it compiles the shader successful
             if( ret )
-                m_shader_units[shader_node_type] = shader_unit_template;
+                m_shader_units[StringID(shader_node_type)] = shader_unit_template;
         }
         else if (material_type == SID("ShaderGroupTemplate")) {
             // The following logic is very similar with 
@@ -297,7 +317,7 @@ unsigned MatManager::ParseMatFile( IStreamBase& stream ){
 
             // push it if it compiles the shader successful
             if (Tsl_Namespace::TSL_Resolving_Status::TSL_Resolving_Succeed == ret)
-                m_shader_units[shader_template_type] = shader_group;
+                m_shader_units[StringID(shader_template_type)] = shader_group;
         }
         else if (material_type == SID("Material")) {
             // allocate a new material
@@ -327,10 +347,6 @@ unsigned MatManager::ParseMatFile( IStreamBase& stream ){
         }
     }
 
-#ifdef ENABLE_ASYNC_TEXTURE_LOADING
-    std::for_each(async_resource_reading.begin(), async_resource_reading.end(), [](std::future<bool>& promise) { promise.wait(); });
-#endif
-
 #ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION_CHEAP
     std::for_each(async_material_building.begin(), async_material_building.end(), [](std::future<void>& promise) { promise.wait(); });
 #endif
@@ -344,30 +360,100 @@ unsigned MatManager::ParseMatFile( IStreamBase& stream ){
     return (unsigned int)m_matPool.size();
 }
 
+bool MatManager::UpdateMaterial( IStreamBase& stream ){
+    auto index = 0u;
+    stream >> index;
+
+    // the material still needs to be parsed even if it is not used so that the rest of the stream is not broken
+    if (index >= m_matPool.size() || g_noMaterial) {
+        Material().Serialize(stream);
+        return false;
+    }
+
+    // only materials live in the pool, proxies are kept separately
+    static_cast<Material*>(m_matPool[index].get())->Reload(stream);
+    return true;
+}
+
 const Resource* MatManager::GetResource(const std::string& name) const {
-    auto it = m_resources.find(name);
-    if (it == m_resources.end())
-        return nullptr;
-    return it->second.get();
+    const auto resource = m_resources.Find(StringID(name));
+    return resource ? resource->get() : nullptr;
 }
 
 const MaterialBase* MatManager::CreateMaterialProxy(const MaterialBase& material) {
-    m_matPool.push_back(std::move(std::make_unique<MaterialProxy>(material)));
-    return m_matPool.back().get();
+    // meshes could be loaded in multiple threads
+    std::lock_guard<std::mutex> lock(m_proxyPoolMutex);
+    m_proxyPool.push_back(std::make_unique<MaterialProxy>(material));
+    return m_proxyPool.back().get();
+}
+
+void MatManager::loadResource(Resource* resource, const std::string& filename, const StringID type) {
+    SORT_PROFILE("Load Resource");
+
+    // copies of the same file under different names are loaded only once
+    std::uint64_t key = 0;
+    if (!hashFile(filename, key)) {
+        resource->LoadResource(filename);
+        return;
+    }
+    key = HashValue(type.m_sid, key);
+
+    std::promise<bool> loading;
+    ResourceContent source;
+    {
+        std::lock_guard<std::mutex> lock(m_resourceContentsMutex);
+        auto it = m_resourceContents.find(key);
+        if (it == m_resourceContents.end())
+            m_resourceContents[key] = ResourceContent{ resource, loading.get_future().share() };
+        else
+            source = it->second;
+    }
+
+    if (!source.resource) {
+        loading.set_value(resource->LoadResource(filename));
+        return;
+    }
+
+    // the task loading the content is already running since it claims the content, waiting for it won't dead lock
+    if (source.loaded.get() && resource->ShareResource(*source.resource)) {
+        SORT_STATS(++sSharedResourceCnt);
+        return;
+    }
+    resource->LoadResource(filename);
+}
+
+void MatManager::WaitForResourceLoading() {
+    m_resourceLoading.Join();
+    m_resourceContents.clear();
+
+    // alpha masks are baked from textures, only materials live in the pool, proxies refer to them.
+    for (auto& material : m_matPool)
+        static_cast<Material*>(material.get())->BakeAlphaMask();
 }
 
 std::shared_ptr<Tsl_Namespace::ShaderUnitTemplate> MatManager::GetShaderUnitTemplate(const std::string& name_id) const {
-    auto it = m_shader_units.find(name_id);
-    if (it == m_shader_units.end())
+    const auto shader_unit = m_shader_units.Find(StringID(name_id));
+    return shader_unit ? *shader_unit : nullptr;
+}
+
+std::shared_ptr<Tsl_Namespace::ShaderInstance> MatManager::GetCompiledShader(const std::string& key) const {
+    std::lock_guard<std::mutex> lock(m_compiledShadersMutex);
+    auto it = m_compiledShaders.find(key);
+    if (it == m_compiledShaders.end())
         return nullptr;
     return it->second;
 }
 
+void MatManager::AddCompiledShader(const std::string& key, std::shared_ptr<Tsl_Namespace::ShaderInstance> shader) {
+    std::lock_guard<std::mutex> lock(m_compiledShadersMutex);
+    m_compiledShaders.insert(std::make_pair(key, shader));
+}
+
 #ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION
 void MatManager::WaitForMaterialBuilding() const {
     std::for_each(m_matPool.begin(), m_matPool.end(), [](const std::unique_ptr<MaterialBase>& mat) {
         while (!mat->IsMaterialBuilt()) {
-            _mm_pause();
+            SpinPause();
         }
     });
 }
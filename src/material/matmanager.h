@@ -21,7 +21,11 @@
 #include <vector>
 #include <memory>
 #include <unordered_map>
+#include <mutex>
+#include <future>
+#include <cstdint>
 #include "core/singleton.h"
+#include "core/flatmap.h"
 #include "material/material.h"
 #include "core/resource.h"
 #include "task/task.h"
@@ -47,6 +51,8 @@ public:
 
     //! @brief  Create a material proxy given a material.
     //!
+    //! It is safe to call it in multiple threads, proxies don't change the material ids of existing materials.
+    //!
     //! @param  material    The material to be proxied.
     //! @return             A material proxy that refers the to provided material.
     const MaterialBase* CreateMaterialProxy(const MaterialBase& material);
@@ -61,6 +67,14 @@ public:
     // result           : the number of materials in the file
     unsigned    ParseMatFile( class IStreamBase& stream );
 
+    //! @brief  Load a material again from stream, it comes with the index of the material in the material file.
+    //!
+    //! Shader unit templates need to be loaded already, only the material itself is in the stream.
+    //!
+    //! @param  stream      Input stream for data.
+    //! @return             Whether there is such a material.
+    bool        UpdateMaterial( class IStreamBase& stream );
+
     //! @brief  Get resource data based on index.
     //!
     //! @param  name        Name of the resource.
@@ -73,6 +87,23 @@ public:
     //! @return             The shader unit template returned, nullptr if it doesn't exist.
     std::shared_ptr<Tsl_Namespace::ShaderUnitTemplate> GetShaderUnitTemplate(const std::string& name) const;
 
+    //! @brief  Find a shader that is already compiled from an identical shader graph.
+    //!
+    //! @param  key         Content of the shader graph, see Material::Serialize for detail.
+    //! @return             The compiled shader, nullptr if no material has compiled such a graph yet.
+    std::shared_ptr<Tsl_Namespace::ShaderInstance> GetCompiledShader(const std::string& key) const;
+
+    //! @brief  Register a compiled shader so that materials with identical shader graphs don't need to compile it again.
+    //!
+    //! @param  key         Content of the shader graph, see Material::Serialize for detail.
+    //! @param  shader      The compiled shader.
+    void AddCompiledShader(const std::string& key, std::shared_ptr<Tsl_Namespace::ShaderInstance> shader);
+
+    //! @brief  Wait for all resources to be loaded.
+    //!
+    //! Resources are loaded in tasks while the rest of the scene is being loaded, this needs to be called before rendering.
+    void WaitForResourceLoading();
+
 #ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION
     //! @brief  Wait for all materials to be built before moving forward
     void WaitForMaterialBuilding() const;
@@ -80,13 +111,41 @@ public:
 
 private:
     std::vector<std::unique_ptr<MaterialBase>>       m_matPool;         /**< Material pool holding all materials. */
+    std::vector<std::unique_ptr<MaterialBase>>       m_proxyPool;       /**< Material proxies created by meshes. */
+    std::mutex                                       m_proxyPoolMutex;  /**< Meshes could be loaded in multiple threads. */
 
-    std::unordered_map<std::string, std::unique_ptr<Resource>>  m_resources;       /**< Resources used during BXDF evaluation. */
+    FlatSidMap<std::unique_ptr<Resource>>       m_resources;       /**< Resources used during BXDF evaluation, keyed by their file names. */
 
-    std::unordered_map<std::string, std::shared_ptr<Tsl_Namespace::ShaderUnitTemplate>>     m_shader_units;
+    /**< Shader unit templates keyed by their names. */
+    FlatSidMap<std::shared_ptr<Tsl_Namespace::ShaderUnitTemplate>>     m_shader_units;
 
     /**< Shader unit default values. */
     std::vector<ShaderParamDefaultValue>        m_paramDefaultValues;
 
+    /**< Compiled shaders indexed by the content of their shader graphs. */
+    std::unordered_map<std::string, std::shared_ptr<Tsl_Namespace::ShaderInstance>>     m_compiledShaders;
+    /**< Materials could be built in multiple threads. */
+    mutable std::mutex                          m_compiledShadersMutex;
+
+    /**< Tasks loading resources. */
+    TaskGroup                                   m_resourceLoading;
+
+    //! @brief  A resource claimed by the first task loading a file of specific content.
+    struct ResourceContent {
+        const Resource*             resource = nullptr;     /**< The resource that loads the data. */
+        std::shared_future<bool>    loaded;                 /**< Whether the data is loaded successfully, once it is done. */
+    };
+    /**< Resources indexed by the hash of the content of their files and their types. */
+    std::unordered_map<std::uint64_t, ResourceContent>  m_resourceContents;
+    /**< Resources are loaded in multiple threads. */
+    std::mutex                                  m_resourceContentsMutex;
+
+    //! @brief  Load a resource, or share the data of another resource loaded from a file of the same content.
+    //!
+    //! @param  resource    The resource to be loaded.
+    //! @param  filename    Name of the file holding the data.
+    //! @param  type        Type of the resource.
+    void loadResource(Resource* resource, const std::string& filename, const StringID type);
+
     friend class Singleton<MatManager>;
 };
@@ -16,15 +16,18 @@
  */
 
 #include <algorithm>
+#include <cstring>
 #include <vector>
 #include <tsl_system.h>
 #include "core/profile.h"
-#include "core/thread.h"
-#include "core/globalconfig.h"
 #include "math/interaction.h"
 #include "scatteringevent/scatteringevent.h"
 #include "medium/medium.h"
 #include "core/log.h"
+#include "core/stats.h"
+#include "core/workercontext.h"
+#include "core/rand.h"
+#include "core/globalconfig.h"
 #include "material.h"
 #include "texture/imagetexture2d.h"
 
@@ -52,27 +55,30 @@ public:
 
     void    sample_2d(const void* texture, float u, float v, float3& color) const override {
         auto resource = (const Resource*)texture;
-        auto sort_texture = dynamic_cast<const ImageTexture2D*>(resource);
-        auto ret = sort_texture->GetColorFromUV(u, v);
+        auto sort_texture = dynamic_cast<const Texture2DBase*>(resource);
+        // stochastic filtering takes a random number of the pixel sample, it converges to bilinear filtering across samples
+        auto ret = g_stochasticTexture ? sort_texture->GetColorFromUV(u, v, sort_canonical()) : sort_texture->GetColorFromUV(u, v);
         color = make_float3(ret.x, ret.y, ret.z);
     }
 
     void    sample_alpha_2d(const void* texture, float u, float v, float& alpha) const override {
         auto resource = (const Resource*)texture;
-        auto sort_texture = dynamic_cast<const ImageTexture2D*>(resource);
-        alpha = sort_texture->GetAlphaFromtUV(u, v);
+        auto sort_texture = dynamic_cast<const Texture2DBase*>(resource);
+        alpha = g_stochasticTexture ? sort_texture->GetAlphaFromtUV(u, v, sort_canonical()) : sort_texture->GetAlphaFromtUV(u, v);
     }
 };
 
-// Tsl shading system
-static std::vector<std::shared_ptr<ShadingContext>>    g_contexts;
-
+// Each thread owns its shading context in its worker context, it is created the first time the thread shades anything and
+// released along with the worker context. Neither the thread id nor the number of threads matters here.
 std::shared_ptr<Tsl_Namespace::ShadingContext> GetShadingContext() {
 #ifdef ENABLE_MULTI_THREAD_SHADER_COMPILATION_CHEAP
     // this is by no means a good approach, but I'll live with it before I have a proper job system.
     return ShadingSystem::get_instance().make_shading_context();
 #else
-    return g_contexts[ThreadId()];
+    auto& context = GetWorkerContext().shadingContext;
+    if( UNLIKELY(!context) )
+        context = ShadingSystem::get_instance().make_shading_context();
+    return std::static_pointer_cast<ShadingContext>( context );
 #endif
 }
 
@@ -105,15 +111,48 @@ void ExecuteVolumeShader(Tsl_Namespace::ShaderInstance* shader, const MediumInte
     ProcessVolumeClosure(closure, Tsl_Namespace::make_float3(1.0f, 1.0f, 1.0f), ms, flag, material, mi.mesh);
 }
 
+SORT_STATS_DEFINE_COUNTER(sVolumeSampleCount)
+SORT_STATS_DEFINE_COUNTER(sVolumeSampleCacheHit)
+
+SORT_STATS_COUNTER("Volume Shading", "Volume Shader Evaluations", sVolumeSampleCount);
+SORT_STATS_RATIO("Volume Shading", "Volume Shader Cache Hit Rate", sVolumeSampleCacheHit, sVolumeSampleCount);
+
+// Volume shaders see nothing but the density, evaluating the same shader at the same density always returns the same sample.
+// Empty space and saturated voxels of a volume all share a few density values, a small direct mapped cache in each thread
+// saves the shader execution for them.
+struct VolumeSampleCacheEntry{
+    const Tsl_Namespace::ShaderInstance*    shader = nullptr;   /**< Shader that evaluated the sample. */
+    float                                   density = 0.0f;     /**< Density the shader is evaluated at. */
+    MediumSample                            sample;             /**< Output of the shader. */
+};
+static constexpr unsigned VOLUME_SAMPLE_CACHE_SIZE = 64;
+static thread_local VolumeSampleCacheEntry g_volumeSampleCache[VOLUME_SAMPLE_CACHE_SIZE];
+
 void EvaluateVolumeSample(Tsl_Namespace::ShaderInstance* shader, const MediumInteraction& mi, MediumSample& ms) {
+    SORT_STATS(++sVolumeSampleCount);
+
     TslGlobal global;
     global.density = mi.mesh->SampleVolumeDensity(mi.intersect);
 
+    unsigned density_bits;
+    memcpy(&density_bits, &global.density, sizeof(density_bits));
+    const auto key = density_bits ^ (unsigned)((uintptr_t)shader >> 4);
+    auto& entry = g_volumeSampleCache[(key ^ (key >> 16)) % VOLUME_SAMPLE_CACHE_SIZE];
+    if (entry.shader == shader && entry.density == global.density) {
+        SORT_STATS(++sVolumeSampleCacheHit);
+        ms = entry.sample;
+        return;
+    }
+
     ClosureTreeNodeBase* closure = nullptr;
     auto raw_function = (void(*)(ClosureTreeNodeBase**, TslGlobal*))shader->get_function();
     raw_function(&closure, &global);
 
-    EvaluateVolumeSample(closure, Tsl_Namespace::make_float3(1.0f, 1.0f, 1.0f), ms);
+    entry.shader = shader;
+    entry.density = global.density;
+    entry.sample = MediumSample();
+    EvaluateVolumeSample(closure, Tsl_Namespace::make_float3(1.0f, 1.0f, 1.0f), entry.sample);
+    ms = entry.sample;
 }
 
 Spectrum EvaluateTransparency(Tsl_Namespace::ShaderInstance* shader , const SurfaceInteraction& intersection ){
@@ -138,15 +177,11 @@ void CreateTSLThreadContexts(){
     auto& shading_system = ShadingSystem::get_instance();
     shading_system.register_shadingsystem_interface(std::make_unique<TSL_ShadingSystemInterface>());
 
-    // register all closures
+    // register all closures, shading contexts are created lazily by the threads themselves
     RegisterClosures();
-
-    // allocate shading context for each thread
-    g_contexts.resize( g_threadCnt );
-    for (auto i = 0u; i < g_threadCnt; ++i)
-        g_contexts[i] = shading_system.make_shading_context();
 }
 
- void DestroyTSLThreadContexts(){
-     // to be implemented
- }
\ No newline at end of file
+void DestroyTSLThreadContexts(){
+    // contexts of worker threads go away with the threads, only the one of the calling thread is still alive
+    GetWorkerContext().shadingContext.reset();
+}
\ No newline at end of file
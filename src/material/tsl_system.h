@@ -51,7 +51,7 @@ DECLARE_TSLGLOBAL_VAR(Tsl_float3, I)            // this is world space input dir
 DECLARE_TSLGLOBAL_VAR(Tsl_float, density)       // volume density
 DECLARE_TSLGLOBAL_END()
 
-//! @brief  Get Shading context.
+//! @brief  Get Shading context of the current thread, it is created the first time it is needed by the thread.
 std::shared_ptr<Tsl_Namespace::ShadingContext> GetShadingContext();
 
 //! @brief  Execute Jited shader code.
@@ -79,9 +79,9 @@ void EvaluateVolumeSample(Tsl_Namespace::ShaderInstance* shader, const MediumInt
 //! @param  intersection    The intersection of interest.
 Spectrum EvaluateTransparency(Tsl_Namespace::ShaderInstance* shader, const SurfaceInteraction& intersection);
 
-//! @brief  Create thread contexts
+//! @brief  Register the shading system interface and closures, shading contexts are created lazily in each thread.
 void CreateTSLThreadContexts();
 
-//! @brief  Destroy thread contexts
+//! @brief  Release the shading context of the calling thread, the ones of worker threads are released when they exit.
 void DestroyTSLThreadContexts();
 
@@ -17,6 +17,7 @@
 
 #pragma once
 
+#include <float.h>
 #include "core/define.h"
 #include "math/point.h"
 #include "ray.h"
@@ -125,6 +126,24 @@ SORT_FORCEINLINE BBox Union( const BBox& bbox0 , const BBox& bbox1 ){
     return result;
 }
 
+//! @brief  Overlapping region of two bounding boxes.
+//!
+//! @return         The overlapping region, its minimum will be larger than its maximum along some axis if the boxes don't overlap.
+SORT_FORCEINLINE BBox Overlap( const BBox& bbox0 , const BBox& bbox1 ){
+    BBox result;
+    for( int i = 0 ; i < 3 ; i++ ){
+        result.m_Min[i] = std::max( bbox0.m_Min[i] , bbox1.m_Min[i] );
+        result.m_Max[i] = std::min( bbox0.m_Max[i] , bbox1.m_Max[i] );
+    }
+    return result;
+}
+
+//! @brief  Scale of the far distance in slab tests, it is 1 + 2 * gamma(3) as derived in PBRT.
+//!
+//! It covers the rounding errors of evaluating the distances to the slabs, rays touching the boundary of a bounding box,
+//! like rays hitting an edge of a triangle that bounds its box, would otherwise miss it and leak through the mesh.
+static constexpr float BBOX_ROBUST_SCALE = 1.0f + 2.0f * ( 3.0f * FLT_EPSILON * 0.5f ) / ( 1.0f - 3.0f * FLT_EPSILON * 0.5f );
+
 SORT_FORCEINLINE float Intersect( const Ray& ray , const BBox& bb , float* fmax = nullptr ){
     //set default value for tmax and tmin
     float tmax = ray.m_fMax;
@@ -144,6 +163,7 @@ SORT_FORCEINLINE float Intersect( const Ray& ray , const BBox& bb , float* fmax
                 t1 = t2;
                 t2 = t;
             }
+            t2 *= BBOX_ROBUST_SCALE;
 
             tmin = std::max( t1 , tmin );
             tmax = std::min( t2 , tmax );
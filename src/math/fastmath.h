@@ -0,0 +1,263 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstring>
+#include <cfloat>
+#include <limits>
+#include "core/define.h"
+
+/*
+description :
+    Fast approximations of the transcendental functions taking a visible slice of the shading time, exp in every step
+    through media, exp and log in the longitudinal scattering of hair and erf in the Beckmann distribution.
+
+    They are the classic Cephes single precision polynomials, except erf. Each function is written once as scalar code
+    here and once on top of 'simd_data' in 'simd/simd_math.h', both sharing the coefficients below so that they don't
+    drift apart. Errors are measured against double precision in the unit tests, over the documented ranges.
+*/
+
+// Range reduction and polynomial of exp, exp(x) = 2^n * exp(r) with |r| <= ln(2)/2.
+constexpr float FAST_EXP_HI         = 88.7228391f;
+constexpr float FAST_EXP_LO         = -87.3365447504019f;
+constexpr float FAST_LOG2E          = 1.44269504088896341f;
+constexpr float FAST_LN2_HI         = 0.693359375f;
+constexpr float FAST_LN2_LO         = -2.12194440e-4f;
+constexpr float FAST_EXP_POLY[6]    = { 1.9875691500e-4f , 1.3981999507e-3f , 8.3334519073e-3f , 4.1665795894e-2f , 1.6666665459e-1f , 5.0000001201e-1f };
+
+// Polynomial of log around one, the mantissa is kept within [sqrt(0.5), sqrt(2)).
+constexpr float FAST_SQRTHF         = 0.707106781186547524f;
+constexpr float FAST_LOG_POLY[9]    = { 7.0376836292e-2f , -1.1514610310e-1f , 1.1676998740e-1f , -1.2420140846e-1f , 1.4249322787e-1f ,
+                                        -1.6668057665e-1f , 2.0000714765e-1f , -2.4999993993e-1f , 3.3333331174e-1f };
+
+// Range reduction of sin and cos by multiples of pi/4, pi/4 is split in three parts to keep the precision.
+constexpr float FAST_FOUR_OVER_PI   = 1.27323954473516f;
+constexpr float FAST_PIO4_1         = 0.78515625f;
+constexpr float FAST_PIO4_2         = 2.4187564849853515625e-4f;
+constexpr float FAST_PIO4_3         = 3.77489497744594108e-8f;
+constexpr float FAST_SIN_POLY[3]    = { -1.9515295891e-4f , 8.3321608736e-3f , -1.6666654611e-1f };
+constexpr float FAST_COS_POLY[3]    = { 2.443315711809948e-5f , -1.388731625493765e-3f , 4.166664568298827e-2f };
+
+// Range reduction and polynomial of atan.
+constexpr float FAST_TAN3PIO8       = 2.414213562373095f;
+constexpr float FAST_TANPIO8        = 0.4142135623730950f;
+constexpr float FAST_ATAN_POLY[4]   = { 8.05374449538e-2f , -1.38776856032e-1f , 1.99777106478e-1f , -3.33329491539e-1f };
+constexpr float FAST_HALF_PI        = 1.57079632679489661f;
+constexpr float FAST_QUARTER_PI     = 0.785398163397448310f;
+constexpr float FAST_PI             = 3.14159265358979323f;
+
+// erf is the Taylor series below FAST_ERF_SPLIT and formula 7.1.26 of Abramowitz and Stegun above it.
+constexpr float FAST_ERF_SPLIT      = 0.5f;
+constexpr float FAST_ERF_TAYLOR[6]  = { 1.0f , -1.0f / 3.0f , 1.0f / 10.0f , -1.0f / 42.0f , 1.0f / 216.0f , -1.0f / 1320.0f };
+constexpr float FAST_TWO_OVER_SQRTPI = 1.12837916709551257f;
+constexpr float FAST_ERF_P          = 0.3275911f;
+constexpr float FAST_ERF_POLY[5]    = { 1.061405429f , -1.453152027f , 1.421413741f , -0.284496736f , 0.254829592f };
+
+//! @brief  2^n of an integral n within [-126, 127], built directly in the exponent bits.
+SORT_STATIC_FORCEINLINE float FastExp2i( const float n ){
+    const auto bits = (unsigned int)( (int)n + 127 ) << 23;
+    float ret;
+    memcpy( &ret , &bits , sizeof( ret ) );
+    return ret;
+}
+
+//! @brief  Exponential.
+//!
+//! Within 1 ulp of the exact result. Inputs that underflow single precision return exactly zero, inputs that overflow
+//! return infinity.
+//!
+//! @param  x       The exponent.
+//! @return         e raised to the power of x.
+SORT_STATIC_FORCEINLINE float FastExp( const float x ){
+    if( x > FAST_EXP_HI )
+        return std::numeric_limits<float>::infinity();
+    if( x < FAST_EXP_LO )
+        return 0.0f;
+
+    // n = round( x / ln(2) ), r = x - n * ln(2) in two steps, n is kept within [-126,127] so that 2^n is a normal float
+    const auto n = std::fmin( std::floor( x * FAST_LOG2E + 0.5f ) , 127.0f );
+    const auto r = ( x - n * FAST_LN2_HI ) - n * FAST_LN2_LO;
+
+    auto p = FAST_EXP_POLY[0];
+    for( auto i = 1 ; i < 6 ; ++i )
+        p = p * r + FAST_EXP_POLY[i];
+    p = p * ( r * r ) + r + 1.0f;
+    return p * FastExp2i( n );
+}
+
+//! @brief  Natural logarithm.
+//!
+//! Within 1 ulp of the exact result. Zero returns negative infinity, negative inputs return NaN, denormals are treated
+//! as the smallest normal float.
+//!
+//! @param  x       The input.
+//! @return         Natural logarithm of x.
+SORT_STATIC_FORCEINLINE float FastLog( float x ){
+    if( !( x > 0.0f ) )
+        return x == 0.0f ? -std::numeric_limits<float>::infinity() : std::numeric_limits<float>::quiet_NaN();
+    if( x == std::numeric_limits<float>::infinity() )
+        return x;
+    x = std::fmax( x , FLT_MIN );
+
+    // x = m * 2^e with m in [0.5, 1)
+    unsigned int bits;
+    memcpy( &bits , &x , sizeof( bits ) );
+    auto e = (float)( (int)( bits >> 23 ) - 126 );
+    bits = ( bits & 0x007fffffu ) | 0x3f000000u;
+    float m;
+    memcpy( &m , &bits , sizeof( m ) );
+
+    // the mantissa is moved to [sqrt(0.5), sqrt(2)) and centered at zero
+    if( m < FAST_SQRTHF ){
+        e -= 1.0f;
+        m = m + m - 1.0f;
+    }else{
+        m = m - 1.0f;
+    }
+
+    const auto z = m * m;
+    auto p = FAST_LOG_POLY[0];
+    for( auto i = 1 ; i < 9 ; ++i )
+        p = p * m + FAST_LOG_POLY[i];
+    auto y = p * m * z;
+    y += e * FAST_LN2_LO;
+    y += -0.5f * z;
+    return m + y + e * FAST_LN2_HI;
+}
+
+//! @brief  Power of a non-negative base.
+//!
+//! It is exp( y * log( x ) ), the error of log is scaled by the exponent, it is within 3 * ( 1 + |y * ln(x)| ) ulp.
+//! Negative bases return NaN.
+//!
+//! @param  x       The base.
+//! @param  y       The exponent.
+//! @return         x raised to the power of y.
+SORT_STATIC_FORCEINLINE float FastPow( const float x , const float y ){
+    if( y == 0.0f )
+        return 1.0f;
+    if( x == 0.0f )
+        return y > 0.0f ? 0.0f : std::numeric_limits<float>::infinity();
+    return FastExp( y * FastLog( x ) );
+}
+
+//! @brief  Sine and cosine at once.
+//!
+//! Both are within 2 ulp of the exact result, or 1e-7 absolute error near their roots, as long as |x| <= 8192. The
+//! precision of the range reduction drops beyond it.
+//!
+//! @param  x       The angle in radian.
+//! @param  s       Sine of the angle.
+//! @param  c       Cosine of the angle.
+SORT_STATIC_FORCEINLINE void FastSinCos( const float x , float& s , float& c ){
+    // |x| = j * pi / 4 + r with an even j and |r| <= pi / 4
+    const auto ax = std::fabs( x );
+    auto j = std::floor( ax * FAST_FOUR_OVER_PI );
+    j = 2.0f * std::floor( ( j + 1.0f ) * 0.5f );
+    const auto q = j - 8.0f * std::floor( j * 0.125f );
+    const auto r = ( ( ax - j * FAST_PIO4_1 ) - j * FAST_PIO4_2 ) - j * FAST_PIO4_3;
+    const auto z = r * r;
+
+    const auto ps = ( ( FAST_SIN_POLY[0] * z + FAST_SIN_POLY[1] ) * z + FAST_SIN_POLY[2] ) * z * r + r;
+    const auto pc = ( ( FAST_COS_POLY[0] * z + FAST_COS_POLY[1] ) * z + FAST_COS_POLY[2] ) * z * z - 0.5f * z + 1.0f;
+
+    // the octant picks the polynomial and the sign of each function
+    const auto swap = q == 2.0f || q == 6.0f;
+    s = swap ? pc : ps;
+    c = swap ? ps : pc;
+    if( ( q >= 4.0f ) != ( x < 0.0f ) )
+        s = -s;
+    if( q == 2.0f || q == 4.0f )
+        c = -c;
+}
+
+//! @brief  Sine, see FastSinCos for its precision.
+SORT_STATIC_FORCEINLINE float FastSin( const float x ){
+    float s , c;
+    FastSinCos( x , s , c );
+    return s;
+}
+
+//! @brief  Cosine, see FastSinCos for its precision.
+SORT_STATIC_FORCEINLINE float FastCos( const float x ){
+    float s , c;
+    FastSinCos( x , s , c );
+    return c;
+}
+
+//! @brief  Arc tangent.
+//!
+//! Within 3 ulp of the exact result.
+//!
+//! @param  x       The tangent.
+//! @return         The angle in [-pi/2, pi/2].
+SORT_STATIC_FORCEINLINE float FastAtan( const float x ){
+    auto t = std::fabs( x );
+    auto y0 = 0.0f;
+    if( t > FAST_TAN3PIO8 ){
+        y0 = FAST_HALF_PI;
+        t = -1.0f / t;
+    }else if( t > FAST_TANPIO8 ){
+        y0 = FAST_QUARTER_PI;
+        t = ( t - 1.0f ) / ( t + 1.0f );
+    }
+    const auto z = t * t;
+    const auto r = ( ( ( FAST_ATAN_POLY[0] * z + FAST_ATAN_POLY[1] ) * z + FAST_ATAN_POLY[2] ) * z + FAST_ATAN_POLY[3] ) * z * t + t + y0;
+    return x < 0.0f ? -r : r;
+}
+
+//! @brief  Arc tangent of y / x, taking the quadrant into account.
+//!
+//! Within 3 ulp of the exact result, away from the axes where the result is close to zero.
+//!
+//! @param  y       The vertical coordinate.
+//! @param  x       The horizontal coordinate.
+//! @return         The angle in [-pi, pi].
+SORT_STATIC_FORCEINLINE float FastAtan2( const float y , const float x ){
+    if( x == 0.0f )
+        return y > 0.0f ? FAST_HALF_PI : ( y < 0.0f ? -FAST_HALF_PI : 0.0f );
+    const auto a = FastAtan( y / x );
+    if( x < 0.0f )
+        return y >= 0.0f ? a + FAST_PI : a - FAST_PI;
+    return a;
+}
+
+//! @brief  Error function.
+//!
+//! Within 3 ulp of the exact result below 0.5 and within 4e-7 absolute error above it.
+//!
+//! @param  x       The input.
+//! @return         erf(x).
+SORT_STATIC_FORCEINLINE float FastErf( const float x ){
+    const auto ax = std::fabs( x );
+    if( ax < FAST_ERF_SPLIT ){
+        const auto z = x * x;
+        auto p = FAST_ERF_TAYLOR[5];
+        for( auto i = 4 ; i >= 0 ; --i )
+            p = p * z + FAST_ERF_TAYLOR[i];
+        return FAST_TWO_OVER_SQRTPI * x * p;
+    }
+
+    const auto t = 1.0f / ( 1.0f + FAST_ERF_P * ax );
+    auto p = FAST_ERF_POLY[0];
+    for( auto i = 1 ; i < 5 ; ++i )
+        p = p * t + FAST_ERF_POLY[i];
+    const auto r = 1.0f - p * t * FastExp( -ax * ax );
+    return x < 0.0f ? -r : r;
+}
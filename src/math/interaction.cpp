@@ -15,7 +15,9 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <algorithm>
 #include "interaction.h"
+#include "math/ray.h"
 #include "light/light.h"
 #include "core/primitive.h"
 
@@ -26,3 +28,85 @@ Spectrum SurfaceInteraction::Le( const Vector& wo , float* directPdfA , float* e
     const auto light = primitive->GetLight();
     return light ? light->Le( *this , wo , directPdfA , emissionPdf ) : Spectrum(0.0f);
 }
+
+void SurfaceInteraction::ComputeDifferentials( const Ray& ray ){
+    // intersect the auxiliary rays with the tangent plane of the surface
+    const auto dx = dot( gnormal , ray.m_rxDir );
+    const auto dy = dot( gnormal , ray.m_ryDir );
+    if( dx == 0.0f || dy == 0.0f ){
+        dpdx = dpdy = Vector();
+        dudx = dvdx = dudy = dvdy = 0.0f;
+        return;
+    }
+    const auto tx = dot( gnormal , intersect - ray.m_rxOri ) / dx;
+    const auto ty = dot( gnormal , intersect - ray.m_ryOri ) / dy;
+    dpdx = ray.m_rxOri + tx * ray.m_rxDir - intersect;
+    dpdy = ray.m_ryOri + ty * ray.m_ryDir - intersect;
+
+    // solve the over-determined linear system in the two axes that are the least aligned with the normal
+    const auto axis = majorAxis( gnormal );
+    const auto a0 = ( axis + 1 ) % 3;
+    const auto a1 = ( axis + 2 ) % 3;
+    const auto det = dpdu[a0] * dpdv[a1] - dpdv[a0] * dpdu[a1];
+    if( fabs( det ) < 1e-10f ){
+        dudx = dvdx = dudy = dvdy = 0.0f;
+        return;
+    }
+    const auto invDet = 1.0f / det;
+    dudx = ( dpdv[a1] * dpdx[a0] - dpdv[a0] * dpdx[a1] ) * invDet;
+    dvdx = ( dpdu[a0] * dpdx[a1] - dpdu[a1] * dpdx[a0] ) * invDet;
+    dudy = ( dpdv[a1] * dpdy[a0] - dpdv[a0] * dpdy[a1] ) * invDet;
+    dvdy = ( dpdu[a0] * dpdy[a1] - dpdu[a1] * dpdy[a0] ) * invDet;
+}
+
+void SurfaceInteraction::SpawnDifferentials( const Ray& in , Ray& out , const float pdf , const bool delta ) const{
+    if( !in.m_hasDifferentials ){
+        out.m_hasDifferentials = false;
+        return;
+    }
+
+    const auto wo = -in.m_Dir;
+    const auto wi = out.m_Dir;
+    const auto dwodx = -in.m_rxDir - wo;
+    const auto dwody = -in.m_ryDir - wo;
+
+    // the normal always points to the side of the incoming ray
+    const auto n = dot( wo , normal ) < 0.0f ? -normal : normal;
+    const auto dndx = dot( dwodx , n );
+    const auto dndy = dot( dwody , n );
+
+    Vector rxDir , ryDir;
+    const auto cosI = dot( wo , n );
+    const auto cosT = -dot( wi , n );
+    if( cosT <= 0.0f ){
+        // reflection
+        rxDir = wi - dwodx + 2.0f * dndx * n;
+        ryDir = wi - dwody + 2.0f * dndy * n;
+    }else{
+        // refraction, the relative index of refraction is recovered from the two directions
+        const auto sinI = cross( wo , n ).Length();
+        const auto eta = sinI > 1e-4f ? cross( wi , n ).Length() / sinI : 1.0f;
+        const auto dmu = eta - eta * eta * cosI / cosT;
+        rxDir = wi - eta * dwodx + dmu * dndx * n;
+        ryDir = wi - eta * dwody + dmu * dndy * n;
+    }
+    rxDir = normalize( rxDir );
+    ryDir = normalize( ryDir );
+
+    // a rough lobe spreads the differentials to its own width, the solid angle covered by the sample is roughly '1/pdf'
+    if( !delta && pdf > 0.0f ){
+        const auto spread = std::min( 1.0f , sqrt( INV_PI / pdf ) );
+        if( std::max( ( rxDir - wi ).Length() , ( ryDir - wi ).Length() ) < spread ){
+            Vector t0 , t1;
+            coordinateSystem( wi , t0 , t1 );
+            rxDir = normalize( wi + spread * t0 );
+            ryDir = normalize( wi + spread * t1 );
+        }
+    }
+
+    out.m_hasDifferentials = true;
+    out.m_rxOri = intersect + dpdx;
+    out.m_ryOri = intersect + dpdy;
+    out.m_rxDir = rxDir;
+    out.m_ryDir = ryDir;
+}
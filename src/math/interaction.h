@@ -23,6 +23,7 @@
 
 class Primitive;
 class PhaseFunction;
+class Ray;
 class Mesh;
 
 /**
@@ -46,6 +47,26 @@ struct SurfaceInteraction : public InteractionCommon{
     // get the emissive
     Spectrum Le( const Vector& wo , float* directPdfA = 0 , float* emissionPdf = 0 ) const;
 
+    //! @brief  Compute the differentials of the position and uv coordinate across a pixel.
+    //!
+    //! The auxiliary rays are intersected with the tangent plane of the surface, which is accurate enough as long as the
+    //! footprint of a pixel is small comparing with the curvature of the surface.
+    //!
+    //! @param  ray     The ray that hits the surface, it needs to carry differentials.
+    void    ComputeDifferentials( const Ray& ray );
+
+    //! @brief  Propagate ray differentials through a bounce on the surface.
+    //!
+    //! Differentials are reflected or refracted as if the surface was a perfect flat mirror or interface, curvature of
+    //! the surface is ignored. Rough lobes spread the differentials to the width of the lobe, which is estimated from the
+    //! pdf of the sampled direction, so that texture lookups after glossy or diffuse bounces are filtered accordingly.
+    //!
+    //! @param  in      The ray that hits the surface.
+    //! @param  out     The ray leaving the surface, its direction needs to be set already. It could be the same as 'in'.
+    //! @param  pdf     The pdf of sampling the direction of the outgoing ray in solid angle.
+    //! @param  delta   Whether the direction is sampled from a Dirac delta lobe.
+    void    SpawnDifferentials( const Ray& in , Ray& out , const float pdf , const bool delta ) const;
+
     // viewing direction in world space, this is usually Wo.
     Vector  view;
     // the shading normal
@@ -54,12 +75,20 @@ struct SurfaceInteraction : public InteractionCommon{
     Vector  gnormal;
     // tangent vector
     Vector  tangent;
-    // the uv coordinate
+    // the uv coordinate, it holds the barycentric coordinate of the hit instead as long as 'pending' is set
     float   u = 0.0f , v = 0.0f;
+    // partial derivatives of the position with respect to the uv coordinate, zero if the shape doesn't provide them
+    Vector  dpdu , dpdv;
+    // differentials of the position and the uv coordinate across a pixel, zero if the ray carries no differentials
+    Vector  dpdx , dpdy;
+    float   dudx = 0.0f , dvdx = 0.0f , dudy = 0.0f , dvdy = 0.0f;
     // the delta distance from the original point
     float   t = FLT_MAX;
     // the intersected primitive
     const Primitive*  primitive = nullptr;
+    // traversals only record the distance, the primitive and the barycentric coordinate of a hit, the rest of the
+    // attributes are not evaluated until the nearest hit is known, see 'FinalizeInteraction'.
+    bool    pending = false;
 
     //! @brief  Reset the intersection.
     //!
@@ -69,8 +98,108 @@ struct SurfaceInteraction : public InteractionCommon{
     SORT_FORCEINLINE void Reset(){
         t = FLT_MAX;
         primitive = nullptr;
+        pending = false;
+    }
+};
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
+// Up to 8 intersections are collected along a shadow ray in one traversal.
+#define     TOTAL_SHADOW_INTERSECTION_CNT   8
+
+//! @brief  Intersections along a shadow ray.
+/**
+ * Rather than tracing a shadow ray again past every semi-transparent surface it hits, the spatial data structure collects
+ * the nearest intersections along it in one traversal. It stops as soon as an opaque surface is found since there is no
+ * light passing through it anyway. Intersections with shapes that could be hit more than once along a ray, like spheres
+ * and instances, limit the range of interest since only the nearest intersection with such a shape is reported.
+ */
+struct ShadowIntersections{
+    SurfaceInteraction      intersections[TOTAL_SHADOW_INTERSECTION_CNT];   /**< The nearest intersections, not sorted. */
+    unsigned                cnt = 0;            /**< Number of intersections recorded. */
+    float                   maxt = FLT_MAX;     /**< Only intersections nearer than it are of interest. */
+    bool                    blocked = false;    /**< Whether an opaque surface is found along the ray. */
+    bool                    complete = true;    /**< Whether all intersections along the ray are recorded. */
+
+    //! @brief  Whether an intersection with the primitive is recorded already.
+    //!
+    //! BVH with spatial splits could reference a primitive in more than one leaf, its intersection shouldn't be recorded twice.
+    //!
+    //! @param  primitive   The primitive to be checked.
+    //! @return             Whether there is an intersection with the primitive.
+    bool    IsRecorded( const Primitive* primitive ) const {
+        for( auto i = 0u ; i < cnt ; ++i ){
+            if( intersections[i].primitive == primitive )
+                return true;
+        }
+        return false;
+    }
+
+    //! @brief  Pick the slot for a new intersection.
+    //!
+    //! Once all slots are taken, the farthest recorded intersection gives its slot to the new one. 'ResolveMaxDepth' needs
+    //! to be called once the slot is filled.
+    //!
+    //! @param  t           The distance of the new intersection.
+    //! @return             The slot to be filled, nullptr if the intersection is not among the nearest ones.
+    SurfaceInteraction* Allocate( const float t ) {
+        if( t >= maxt )
+            return nullptr;
+
+        if( cnt < TOTAL_SHADOW_INTERSECTION_CNT )
+            return &intersections[cnt++];
+
+        auto picked_i = 0u;
+        for( auto i = 1u ; i < cnt ; ++i ){
+            if( intersections[picked_i].t < intersections[i].t )
+                picked_i = i;
+        }
+        return &intersections[picked_i];
+    }
+
+    //! @brief  Record an intersection if it is among the nearest ones.
+    //!
+    //! @param  intersection    The intersection to be recorded.
+    //! @param  single_hit      Whether the shape can't be hit again further along the ray.
+    void    Add( const SurfaceInteraction& intersection , const bool single_hit ) {
+        auto slot = Allocate( intersection.t );
+        if( IS_PTR_INVALID(slot) )
+            return;
+
+        *slot = intersection;
+        if( !single_hit )
+            Clip( intersection.t );
+        ResolveMaxDepth();
+    }
+
+    //! @brief  Discard everything beyond a distance, the ray needs to be traced again from there.
+    //!
+    //! @param  t           The distance beyond which intersections are dropped.
+    void    Clip( const float t ) {
+        for( auto i = 0u ; i < cnt ; ){
+            if( intersections[i].t > t )
+                intersections[i] = intersections[--cnt];
+            else
+                ++i;
+        }
+        maxt = t;
+        complete = false;
+    }
+
+    //! @brief  Resoved the maximum depth of all intersections.
+    //!
+    //! Nothing is pruned but the clipped range until all slots are taken, after which only intersections nearer than the
+    //! farthest recorded one are of interest and the rest needs to be found by tracing the ray again.
+    void    ResolveMaxDepth() {
+        if( cnt < TOTAL_SHADOW_INTERSECTION_CNT )
+            return;
+
+        maxt = 0.0f;
+        for( auto i = 0u ; i < cnt ; ++i )
+            maxt = maxt < intersections[i].t ? intersections[i].t : maxt;
+        complete = false;
     }
 };
+#endif
 
 //! @brief  Interaction in a medium.
 /**
@@ -19,6 +19,62 @@
 #include "point.h"
 #include "math/vector3.h"
 
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
+#define SIMD_SSE_IMPLEMENTATION
+#include "simd/simd_wrapper.h"
+#endif
+
+namespace {
+    // Transform an array of coordinates in place with an affine matrix, 'r' holds the upper-left 3x3 part row by row
+    // followed by the translation. Only points are translated.
+    template<bool point>
+    void transformBatch( const float r[12] , char* data , const unsigned int cnt , const unsigned int stride ){
+        unsigned int i = 0;
+#ifdef SIMD_SSE_IMPLEMENTATION
+        simd_data e[12];
+        for( auto k = 0 ; k < 12 ; ++k )
+            e[k] = simd_set_ps1( r[k] );
+
+        float x[SIMD_CHANNEL] , y[SIMD_CHANNEL] , z[SIMD_CHANNEL];
+        for( ; i + SIMD_CHANNEL <= cnt ; i += SIMD_CHANNEL ){
+            for( auto k = 0 ; k < SIMD_CHANNEL ; ++k ){
+                const auto v = (const float*)( data + ( i + k ) * stride );
+                x[k] = v[0];
+                y[k] = v[1];
+                z[k] = v[2];
+            }
+
+            const auto sx = simd_set_ps( x );
+            const auto sy = simd_set_ps( y );
+            const auto sz = simd_set_ps( z );
+            auto tx = simd_mad_ps( sz , e[2] , simd_mad_ps( sy , e[1] , simd_mul_ps( sx , e[0] ) ) );
+            auto ty = simd_mad_ps( sz , e[5] , simd_mad_ps( sy , e[4] , simd_mul_ps( sx , e[3] ) ) );
+            auto tz = simd_mad_ps( sz , e[8] , simd_mad_ps( sy , e[7] , simd_mul_ps( sx , e[6] ) ) );
+            if( point ){
+                tx = simd_add_ps( tx , e[9] );
+                ty = simd_add_ps( ty , e[10] );
+                tz = simd_add_ps( tz , e[11] );
+            }
+
+            for( auto k = 0 ; k < SIMD_CHANNEL ; ++k ){
+                const auto v = (float*)( data + ( i + k ) * stride );
+                v[0] = tx[k];
+                v[1] = ty[k];
+                v[2] = tz[k];
+            }
+        }
+#endif
+
+        for( ; i < cnt ; ++i ){
+            const auto v = (float*)( data + i * stride );
+            const auto vx = v[0] , vy = v[1] , vz = v[2];
+            v[0] = vx * r[0] + vy * r[1] + vz * r[2] + ( point ? r[9] : 0.0f );
+            v[1] = vx * r[3] + vy * r[4] + vz * r[5] + ( point ? r[10] : 0.0f );
+            v[2] = vx * r[6] + vy * r[7] + vz * r[8] + ( point ? r[11] : 0.0f );
+        }
+    }
+}
+
 // default constructor
 Matrix::Matrix()
 {
@@ -91,6 +147,35 @@ Vector Matrix::TransformVector( const Vector& v ) const{
     return Vector( _x , _y , _z );
 }
 
+// transform vector with the transposed matrix
+Vector Matrix::TransformVectorTransposed( const Vector& v ) const{
+    float _x = v.x * m[0] + v.y * m[4] + v.z * m[8];
+    float _y = v.x * m[1] + v.y * m[5] + v.z * m[9];
+    float _z = v.x * m[2] + v.y * m[6] + v.z * m[10];
+
+    // return the result
+    return Vector( _x , _y , _z );
+}
+
+// transform an array of points
+void Matrix::TransformPoints( Point* points , unsigned int cnt ) const{
+    // projective matrices need the division by w, it is never the case for objects in a scene
+    if( !IsAffine() ){
+        for( auto i = 0u ; i < cnt ; ++i )
+            points[i] = TransformPoint( points[i] );
+        return;
+    }
+
+    const float r[12] = { m[0] , m[1] , m[2] , m[4] , m[5] , m[6] , m[8] , m[9] , m[10] , m[3] , m[7] , m[11] };
+    transformBatch<true>( r , (char*)points , cnt , sizeof( Point ) );
+}
+
+// transform an array of vectors with the transposed matrix
+void Matrix::TransformVectorsTransposed( Vector* vectors , unsigned int cnt , unsigned int stride ) const{
+    const float r[12] = { m[0] , m[4] , m[8] , m[1] , m[5] , m[9] , m[2] , m[6] , m[10] , 0.0f , 0.0f , 0.0f };
+    transformBatch<false>( r , (char*)vectors , cnt , stride );
+}
+
 // create a transpose matrix
 Matrix Matrix::Transpose() const
 {
@@ -153,3 +238,9 @@ bool Matrix::HasScale() const
     return !( IS_ONE(l0) && IS_ONE(l1) && IS_ONE(l2) );
 #undef IS_ONE
 }
+
+// whether the last row of the matrix is ( 0 , 0 , 0 , 1 )
+bool Matrix::IsAffine() const
+{
+    return m[12] == 0.0f && m[13] == 0.0f && m[14] == 0.0f && m[15] == 1.0f;
+}
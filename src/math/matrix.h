@@ -51,11 +51,45 @@ public:
     //! @return     Transformed vector.
     Vector TransformVector( const Vector& v ) const;
 
+    //! @brief  Transform a vector by the transpose of the matrix.
+    //!
+    //! Normals are transformed by the transpose of the inverse matrix, this saves building the transposed matrix
+    //! every time a normal is transformed.
+    //!
+    //! @param v    Vector to be transformed.
+    //! @return     Transformed vector.
+    Vector TransformVectorTransposed( const Vector& v ) const;
+
+    //! @brief  Transform an array of points in place.
+    //!
+    //! Points are transformed in batches of the SIMD width if the matrix is affine, which is the case for all
+    //! transformations of objects in a scene.
+    //!
+    //! @param points   Points to be transformed.
+    //! @param cnt      Number of points in the array.
+    void TransformPoints( Point* points , unsigned int cnt ) const;
+
+    //! @brief  Transform an array of vectors in place by the transpose of the matrix.
+    //!
+    //! @param vectors  The first vector to be transformed.
+    //! @param cnt      Number of vectors in the array.
+    //! @param stride   Distance in bytes between two vectors, the vectors could be members of larger structures.
+    void TransformVectorsTransposed( Vector* vectors , unsigned int cnt , unsigned int stride = sizeof( Vector ) ) const;
+
     // transform a ray
     // para 'r' : the ray to transform
     // result   : transformed ray
     Ray operator * ( const Ray& r ) const{
-        return Ray( TransformPoint(r.m_Ori) , TransformVector( r.m_Dir ) , r.m_Depth , r.m_fMin , r.m_fMax );
+        Ray ret( TransformPoint(r.m_Ori) , TransformVector( r.m_Dir ) , r.m_Depth , r.m_fMin , r.m_fMax );
+        ret.m_time = r.m_time;
+        if( r.m_hasDifferentials ){
+            ret.m_hasDifferentials = true;
+            ret.m_rxOri = TransformPoint( r.m_rxOri );
+            ret.m_ryOri = TransformPoint( r.m_ryOri );
+            ret.m_rxDir = TransformVector( r.m_rxDir );
+            ret.m_ryDir = TransformVector( r.m_ryDir );
+        }
+        return ret;
     }
     Ray operator () ( const Ray& r ) const{
         return *this * r;
@@ -70,6 +104,8 @@ public:
 
     // whether the matrix have scale factor
     bool    HasScale() const;
+    // whether the last row of the matrix is ( 0 , 0 , 0 , 1 )
+    bool    IsAffine() const;
 
 public:
     // the data of the 4x4 matrix
@@ -0,0 +1,120 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+#pragma once
+
+#include <cstdint>
+#include <string.h>
+#include <math.h>
+#include "core/define.h"
+#include "math/vector3.h"
+
+// Compact encodings of vertex attributes, they trade a little bit of precision for a lot less memory.
+
+//! @brief  Encode a unit vector in 32 bits with the octahedral mapping.
+//!
+//! The unit sphere is projected onto an octahedron, which is then unfolded onto a square. Each coordinate of the square
+//! takes 16 bits, the error of the decoded direction is well below a hundredth of a degree.
+//!
+//! @param  v       The vector to be encoded, it doesn't need to be normalized.
+//! @return         The encoded vector.
+SORT_STATIC_FORCEINLINE std::uint32_t encodeOctahedral( const Vector& v ){
+    const auto l1 = fabs( v.x ) + fabs( v.y ) + fabs( v.z );
+    auto x = l1 > 0.0f ? v.x / l1 : 0.0f;
+    auto y = l1 > 0.0f ? v.y / l1 : 0.0f;
+
+    // the lower hemisphere is folded over the diagonals
+    if( v.z < 0.0f ){
+        const auto ox = x;
+        x = ( 1.0f - fabs( y ) ) * ( ox >= 0.0f ? 1.0f : -1.0f );
+        y = ( 1.0f - fabs( ox ) ) * ( y >= 0.0f ? 1.0f : -1.0f );
+    }
+
+    const auto quantize = []( const float f ){
+        const auto c = f < -1.0f ? -1.0f : ( f > 1.0f ? 1.0f : f );
+        return (std::uint32_t)( ( c * 0.5f + 0.5f ) * 65535.0f + 0.5f );
+    };
+    return quantize( x ) | ( quantize( y ) << 16 );
+}
+
+//! @brief  Decode a unit vector encoded with the octahedral mapping.
+//!
+//! @param  e       The encoded vector.
+//! @return         The normalized vector.
+SORT_STATIC_FORCEINLINE Vector decodeOctahedral( const std::uint32_t e ){
+    auto x = (float)( e & 0xffff ) * ( 2.0f / 65535.0f ) - 1.0f;
+    auto y = (float)( e >> 16 ) * ( 2.0f / 65535.0f ) - 1.0f;
+    const auto z = 1.0f - fabs( x ) - fabs( y );
+
+    // unfold the lower hemisphere
+    const auto t = z < 0.0f ? -z : 0.0f;
+    x += x >= 0.0f ? -t : t;
+    y += y >= 0.0f ? -t : t;
+    return normalize( Vector( x , y , z ) );
+}
+
+//! @brief  Convert a single precision float to a half precision one, rounded to the nearest.
+//!
+//! Values too large for half precision become infinity, tiny ones become denormalized numbers or zero.
+//!
+//! @param  f       The single precision float.
+//! @return         Bits of the half precision float.
+SORT_STATIC_FORCEINLINE std::uint16_t floatToHalf( const float f ){
+    std::uint32_t x;
+    memcpy( &x , &f , sizeof( x ) );
+
+    const auto sign = ( x >> 16 ) & 0x8000;
+    const auto exponent = (int)( ( x >> 23 ) & 0xff ) - 127 + 15;
+    auto mantissa = x & 0x7fffff;
+
+    if( exponent >= 31 ){
+        // NaN stays NaN, everything else overflows to infinity
+        const auto is_nan = ( ( x >> 23 ) & 0xff ) == 0xff && mantissa != 0;
+        return (std::uint16_t)( sign | ( is_nan ? 0x7e00 : 0x7c00 ) );
+    }
+
+    if( exponent <= 0 ){
+        if( exponent < -10 )
+            return (std::uint16_t)sign;
+        mantissa |= 0x800000;
+        const auto shift = (std::uint32_t)( 14 - exponent );
+        return (std::uint16_t)( sign | ( ( mantissa + ( 1u << ( shift - 1 ) ) ) >> shift ) );
+    }
+
+    // a carry of the rounding into the exponent is still the right result
+    return (std::uint16_t)( ( sign | ( (std::uint32_t)exponent << 10 ) ) + ( ( mantissa + 0x1000 ) >> 13 ) );
+}
+
+//! @brief  Convert a half precision float to a single precision one, there is no loss at all.
+//!
+//! @param  h       Bits of the half precision float.
+//! @return         The single precision float.
+SORT_STATIC_FORCEINLINE float halfToFloat( const std::uint16_t h ){
+    const auto sign = (std::uint32_t)( h & 0x8000 ) << 16;
+    const auto exponent = (std::uint32_t)( h >> 10 ) & 0x1f;
+    const auto mantissa = (std::uint32_t)h & 0x3ff;
+
+    // denormalized numbers
+    if( exponent == 0 ){
+        const auto f = (float)mantissa * ( 1.0f / 16777216.0f );
+        return sign ? -f : f;
+    }
+
+    const auto x = sign | ( exponent == 31 ? ( 0x7f800000 | ( mantissa << 13 ) ) : ( ( ( exponent + 112 ) << 23 ) | ( mantissa << 13 ) ) );
+    float f;
+    memcpy( &f , &x , sizeof( f ) );
+    return f;
+}
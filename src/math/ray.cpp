@@ -16,6 +16,16 @@
  */
 
 #include "ray.h"
+#include "core/workercontext.h"
+
+// moment of the pixel sample being rendered by the thread
+void SetRayTime( float time ){
+    GetWorkerContext().rayTime = time;
+}
+
+float GetRayTime(){
+    return GetWorkerContext().rayTime;
+}
 
 Ray::Ray(){
     m_Depth = 0;
@@ -25,6 +35,9 @@ Ray::Ray(){
     m_fPdfA = 0.0f;
     m_we = 0.0f;
     m_fCosAtCamera = 0.0f;
+    m_fFootprint = 0.0f;
+    m_hasDifferentials = false;
+    m_time = GetWorkerContext().rayTime;
 }
 
 Ray::Ray( const Point& p , const Vector& dir , unsigned depth , float fmin , float fmax){
@@ -37,6 +50,9 @@ Ray::Ray( const Point& p , const Vector& dir , unsigned depth , float fmin , flo
     m_fPdfA = 0.0f;
     m_we = 0.0f;
     m_fCosAtCamera = 0.0f;
+    m_fFootprint = 0.0f;
+    m_hasDifferentials = false;
+    m_time = GetWorkerContext().rayTime;
 }
 
 Ray::Ray( const Ray& r ){
@@ -49,4 +65,11 @@ Ray::Ray( const Ray& r ){
     m_fPdfA = r.m_fPdfA;
     m_we = r.m_we;
     m_fCosAtCamera = r.m_fCosAtCamera;
+    m_fFootprint = r.m_fFootprint;
+    m_hasDifferentials = r.m_hasDifferentials;
+    m_time = r.m_time;
+    m_rxOri = r.m_rxOri;
+    m_ryOri = r.m_ryOri;
+    m_rxDir = r.m_rxDir;
+    m_ryDir = r.m_ryDir;
 }
\ No newline at end of file
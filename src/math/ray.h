@@ -34,6 +34,19 @@ SORT_STATIC_FORCEINLINE Vector3f permuteAxis(const Vector3f& v, int ax, int ay,
 }
 
 //! @brief  Data structure representing a ray.
+//! @brief  Set the moment in the shutter interval of rays created on the current thread from now on.
+//!
+//! All rays of a path are at the same moment. Instead of passing it through every place spawning a ray, rays pick it
+//! up from the thread, it is set once the pixel sample is drawn.
+//!
+//! @param  time    Moment in the shutter interval, it is in [0,1).
+void    SetRayTime( float time );
+
+//! @brief  Get the moment in the shutter interval of rays created on the current thread.
+//!
+//! @return         Moment in the shutter interval, it is in [0,1).
+float   GetRayTime();
+
 class Ray{
 public:
     // default constructor
@@ -68,6 +81,18 @@ public:
         m_scale_y = 1.0f / d.y;
     }
 
+    //! @brief  Scale the distance between the ray and its auxiliary rays.
+    //!
+    //! With multiple samples taken in a pixel, each of them only covers a fraction of the pixel.
+    //!
+    //! @param  s       The scaling factor, usually the reciprocal of the square root of the sample count per pixel.
+    SORT_FORCEINLINE void    ScaleDifferentials( const float s ){
+        m_rxOri = m_Ori + ( m_rxOri - m_Ori ) * s;
+        m_ryOri = m_Ori + ( m_ryOri - m_Ori ) * s;
+        m_rxDir = m_Dir + ( m_rxDir - m_Dir ) * s;
+        m_ryDir = m_Dir + ( m_ryDir - m_Dir ) * s;
+    }
+
 // the original point and direction are also public
     // original point of the ray
     Point   m_Ori;
@@ -85,6 +110,14 @@ public:
     float   m_fPdfA;
     float   m_fCosAtCamera;
 
+    float   m_fFootprint;   /**< Solid angle covered by the ray, it is used to filter distant lookups like sky, zero means no filtering. */
+
+    bool    m_hasDifferentials;     /**< Whether the ray carries the auxiliary rays of its neighbour pixels. */
+    Point   m_rxOri , m_ryOri;      /**< Origins of the auxiliary rays offset by one pixel along x and y on the image plane. */
+    Vector  m_rxDir , m_ryDir;      /**< Directions of the auxiliary rays offset by one pixel along x and y on the image plane. */
+
+    float   m_time;             /**< Moment of the ray in the shutter interval, 0 is when the shutter opens and 1 is when it closes. */
+
     // importance value of the ray
     Spectrum m_we;
 
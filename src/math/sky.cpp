@@ -15,13 +15,40 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <cfloat>
+#include <filesystem>
+#include <fstream>
 #include "sky.h"
 #include "math/ray.h"
 #include "core/samplemethod.h"
 #include "core/memory.h"
+#include "core/hash.h"
+#include "core/log.h"
+#include "core/profile.h"
+#include "stream/fstream.h"
+
+static constexpr unsigned int SKY_CACHE_MAGIC   = 0x594B5353;
+static constexpr unsigned int SKY_CACHE_VERSION = 1;
+
+// resolution of the lat-long image the analytic sky is baked in, the sky is smooth enough for it
+static constexpr int   SKY_BAKE_WIDTH       = 512;
+static constexpr int   SKY_BAKE_HEIGHT      = 256;
+// directions below the horizon take the radiance right above it, the model is not defined beneath
+static constexpr float SKY_HORIZON_COS      = 0.001f;
+// luminance of the sun outside the atmosphere, in the same unit of the sky, kcd/m^2
+static constexpr float SKY_SUN_LUMINANCE    = 1.6e6f;
+// the sun and the sky are both sampled regardless of how bright one is compared with the other
+static constexpr float SKY_SUN_MIN_PROB     = 0.05f;
+static constexpr float SKY_SUN_MAX_PROB     = 0.95f;
+// lobes wider than this barely change the distribution of the sky, there is no need to pay for product sampling
+static constexpr float SKY_PRODUCT_MIN_KAPPA    = 8.0f;
+// part of the samples are never guided by the lobe, the lobe is only an approximation of the bsdf
+static constexpr float SKY_PRODUCT_MAX_PROB     = 0.75f;
+// the sun is compared with the sky in a level that is not wider than this
+static constexpr int   SKY_PRODUCT_SUN_WIDTH    = 8;
 
 // evaluate value from sky
-Spectrum Sky::Evaluate( const Vector& wi ) const
+Spectrum Sky::Evaluate( const Vector& wi , float footprint ) const
 {
     float theta = sphericalTheta( wi );
     float phi = sphericalPhi( wi );
@@ -29,40 +56,361 @@ Spectrum Sky::Evaluate( const Vector& wi ) const
     float v = theta * INV_PI;
     float u = phi * INV_TWOPI;
 
-    return m_sky.GetColorFromUV( u , 1.0f - v );
+    // the sun disk is not filtered, it is way smaller than any reasonable footprint anyway
+    const auto sun = _sun( wi );
+    if( footprint <= 0.0f || m_levels.empty() )
+        return _lookup( 0 , u , 1.0f - v ) + sun;
+
+    // pick the level whose texels cover roughly the same solid angle as the footprint
+    int w = 0 , h = 0;
+    _getLevelSize( 0 , w , h );
+    const auto texel_solid_angle = TWO_PI * PI / (float)( w * h ) * std::max( sin( theta ) , 1.0f / (float)h );
+    const auto lod = 0.5f * log2( footprint / texel_solid_angle );
+    if( lod <= 0.0f )
+        return _lookup( 0 , u , 1.0f - v ) + sun;
+
+    const auto max_level = (unsigned)m_levels.size();
+    if( lod >= (float)max_level )
+        return _lookup( max_level , u , 1.0f - v ) + sun;
+
+    const auto level = (unsigned)lod;
+    const auto t = lod - (float)level;
+    return _lookup( level , u , 1.0f - v ) * ( 1.0f - t ) + _lookup( level + 1 , u , 1.0f - v ) * t + sun;
 }
 
 // get the average radiance
 Spectrum Sky::GetAverage() const
 {
-    return m_sky.GetAverage();
+    return m_baked.texels ? m_bakedAverage : m_sky.GetAverage();
+}
+
+// load image file
+void Sky::Load( const std::string& str , const std::string& cache )
+{
+    m_sky.LoadResource( str );
+    _generatePyramid();
+
+    // the sampling tables are built in the finest level that is not larger than the limitation
+    m_samplingLevel = 0;
+    int w = 0 , h = 0;
+    _getLevelSize( 0 , w , h );
+    while( w > (int)SKY_SAMPLING_RESOLUTION && m_samplingLevel < m_levels.size() )
+        _getLevelSize( ++m_samplingLevel , w , h );
+    _generateProductLevels();
+
+    if( cache.empty() ){
+        _generateDistribution2D();
+        return;
+    }
+
+    // the image file, instead of its content, identifies the cache so that hashing the whole image is not needed
+    std::error_code err;
+    const auto file_size = (std::uint64_t)std::filesystem::file_size( str , err );
+    const auto write_time = (std::int64_t)std::filesystem::last_write_time( str , err ).time_since_epoch().count();
+    auto key = HashBytes( str.data() , str.size() );
+    key = HashValue( file_size , key );
+    key = HashValue( write_time , key );
+    key = HashValue( SKY_SAMPLING_RESOLUTION , key );
+
+    if( _loadCache( cache , key ) )
+        return;
+
+    _generateDistribution2D();
+    if( !_saveCache( cache , key ) )
+        slog( WARNING , LIGHT , "Failed to save the sampling tables of sky in %s." , cache.c_str() );
+}
+
+// bake the analytic sky
+void Sky::Bake( const SkyModel& model )
+{
+    SORT_PROFILE("Bake Analytic Sky");
+
+    // Perez distribution, 'A Practical Analytic Model for Daylight', Preetham et al.
+    const auto T = model.turbidity;
+    const float coeff_Y[5] = {  0.1787f * T - 1.4630f , -0.3554f * T + 0.4275f , -0.0227f * T + 5.3251f ,  0.1206f * T - 2.5771f , -0.0670f * T + 0.3703f };
+    const float coeff_x[5] = { -0.0193f * T - 0.2592f , -0.0665f * T + 0.0008f , -0.0004f * T + 0.2125f , -0.0641f * T - 0.8989f , -0.0033f * T + 0.0452f };
+    const float coeff_y[5] = { -0.0167f * T - 0.2608f , -0.0950f * T + 0.0092f , -0.0079f * T + 0.2102f , -0.0441f * T - 1.6537f , -0.0109f * T + 0.0529f };
+    const auto perez = []( const float* c , float cos_theta , float gamma , float cos_gamma ){
+        return ( 1.0f + c[0] * exp( c[1] / cos_theta ) ) * ( 1.0f + c[2] * exp( c[3] * gamma ) + c[4] * cos_gamma * cos_gamma );
+    };
+
+    // the model has no night sky, a sun below the horizon is treated as a sun at the horizon
+    const auto sun_dir = normalize( model.sunDir );
+    const auto theta_s = std::min( acos( std::min( 1.0f , std::max( -1.0f , sun_dir.y ) ) ) , PI * 0.5f - 0.01f );
+    const auto theta_s2 = theta_s * theta_s;
+    const auto theta_s3 = theta_s2 * theta_s;
+    const auto T2 = T * T;
+
+    // zenith luminance in kcd/m^2 and zenith chromaticity
+    const auto chi = ( 4.0f / 9.0f - T / 120.0f ) * ( PI - 2.0f * theta_s );
+    const auto zenith_Y = ( 4.0453f * T - 4.9710f ) * tan( chi ) - 0.2155f * T + 2.4192f;
+    const auto zenith_x = (  0.00166f * theta_s3 - 0.00375f * theta_s2 + 0.00209f * theta_s ) * T2 +
+                          ( -0.02903f * theta_s3 + 0.06377f * theta_s2 - 0.03202f * theta_s + 0.00394f ) * T +
+                          (  0.11693f * theta_s3 - 0.21196f * theta_s2 + 0.06052f * theta_s + 0.25886f );
+    const auto zenith_y = (  0.00275f * theta_s3 - 0.00610f * theta_s2 + 0.00317f * theta_s ) * T2 +
+                          ( -0.04214f * theta_s3 + 0.08970f * theta_s2 - 0.04153f * theta_s + 0.00516f ) * T +
+                          (  0.15346f * theta_s3 - 0.26756f * theta_s2 + 0.06670f * theta_s + 0.26688f );
+    const auto cos_theta_s = cos( theta_s );
+    const auto norm_Y = zenith_Y / perez( coeff_Y , 1.0f , theta_s , cos_theta_s );
+    const auto norm_x = zenith_x / perez( coeff_x , 1.0f , theta_s , cos_theta_s );
+    const auto norm_y = zenith_y / perez( coeff_y , 1.0f , theta_s , cos_theta_s );
+    // same azimuth as the sun, but the clamped elevation
+    const auto horizontal = sqrt( sun_dir.x * sun_dir.x + sun_dir.z * sun_dir.z );
+    const auto sun = ( horizontal > 0.0f ) ? Vector( sin( theta_s ) * sun_dir.x / horizontal , cos_theta_s , sin( theta_s ) * sun_dir.z / horizontal ) : Vector( 0.0f , 1.0f , 0.0f );
+
+    m_baked.width = SKY_BAKE_WIDTH;
+    m_baked.height = SKY_BAKE_HEIGHT;
+    m_baked.texels = std::make_unique<Spectrum[]>( SKY_BAKE_WIDTH * SKY_BAKE_HEIGHT );
+
+    Spectrum sum;
+    for( auto y = 0 ; y < SKY_BAKE_HEIGHT ; ++y ){
+        const auto theta = PI * ( 1.0f - ( (float)y + 0.5f ) / (float)SKY_BAKE_HEIGHT );
+        const auto sin_theta = sin( theta );
+        const auto cos_theta = std::max( SKY_HORIZON_COS , cos( theta ) );
+        for( auto x = 0 ; x < SKY_BAKE_WIDTH ; ++x ){
+            const auto phi = TWO_PI * ( (float)x + 0.5f ) / (float)SKY_BAKE_WIDTH;
+            auto wi = sphericalVec( theta , phi );
+            wi.y = std::max( wi.y , SKY_HORIZON_COS );
+            const auto cos_gamma = std::min( 1.0f , std::max( -1.0f , dot( normalize( wi ) , sun ) ) );
+            const auto gamma = acos( cos_gamma );
+
+            // xyY -> XYZ -> linear sRGB
+            const auto Y = norm_Y * perez( coeff_Y , cos_theta , gamma , cos_gamma );
+            const auto cx = norm_x * perez( coeff_x , cos_theta , gamma , cos_gamma );
+            const auto cy = std::max( 1e-4f , norm_y * perez( coeff_y , cos_theta , gamma , cos_gamma ) );
+            const auto X = cx * Y / cy;
+            const auto Z = ( 1.0f - cx - cy ) * Y / cy;
+            const auto radiance = Spectrum(  3.2404542f * X - 1.5371385f * Y - 0.4985314f * Z ,
+                                            -0.9692660f * X + 1.8760108f * Y + 0.0415560f * Z ,
+                                             0.0556434f * X - 0.2040259f * Y + 1.0572252f * Z ).Clamp( 0.0f , FLT_MAX );
+
+            m_baked.texels[ y * SKY_BAKE_WIDTH + x ] = radiance;
+            sum += radiance * sin_theta;
+        }
+    }
+    m_bakedAverage = sum * ( PI * TWO_PI / (float)( SKY_BAKE_WIDTH * SKY_BAKE_HEIGHT ) ) / ( 4.0f * PI );
+
+    // the sun disk attenuated by Rayleigh and aerosol scattering along the air mass, there is no sun below the horizon
+    m_sunRadiance = 0.0f;
+    m_sunProbability = 0.0f;
+    m_sunCosMax = cos( std::max( 1e-4f , model.sunRadius ) );
+    m_sunDir = normalize( model.sunDir );
+    if( model.sunStrength > 0.0f && m_sunDir.y > 0.0f ){
+        const auto theta_deg = Degrees( acos( m_sunDir.y ) );
+        const auto air_mass = 1.0f / ( m_sunDir.y + 0.15f * pow( 93.885f - theta_deg , -1.253f ) );
+        const auto beta = 0.04608f * T - 0.04586f;
+        const auto transmittance = [&]( float lambda ){
+            return exp( -0.008735f * pow( lambda , -4.08f ) * air_mass ) * exp( -beta * pow( lambda , -1.3f ) * air_mass );
+        };
+        m_sunRadiance = Spectrum( transmittance( 0.65f ) , transmittance( 0.55f ) , transmittance( 0.45f ) ) * SKY_SUN_LUMINANCE * model.sunStrength;
+
+        // the sun is sampled by its share of the total power
+        const auto sun_solid_angle = TWO_PI * ( 1.0f - m_sunCosMax );
+        const auto sun_power = m_sunRadiance.GetIntensity() * sun_solid_angle;
+        const auto sky_power = m_bakedAverage.GetIntensity() * 4.0f * PI;
+        m_sunProbability = std::min( SKY_SUN_MAX_PROB , std::max( SKY_SUN_MIN_PROB , sun_power / std::max( 1e-6f , sun_power + sky_power ) ) );
+        m_bakedAverage += m_sunRadiance * sun_solid_angle / ( 4.0f * PI );
+    }
+
+    _generatePyramid();
+
+    // the baked image is already small enough to be sampled directly
+    m_samplingLevel = 0;
+    _generateDistribution2D();
+    _generateProductLevels();
+}
+
+// radiance of the sun disk
+Spectrum Sky::_sun( const Vector& wi ) const
+{
+    if( m_sunProbability <= 0.0f || dot( wi , m_sunDir ) < m_sunCosMax )
+        return 0.0f;
+    return m_sunRadiance;
+}
+
+// generate the image pyramid
+void Sky::_generatePyramid()
+{
+    SORT_PROFILE("Generate Sky Pyramid");
+
+    m_levels.clear();
+    int w = 0 , h = 0;
+    _getLevelSize( 0 , w , h );
+    while( w > 1 || h > 1 ){
+        const auto level = (unsigned)m_levels.size();
+
+        SkyLevel next;
+        next.width = std::max( 1 , ( w + 1 ) / 2 );
+        next.height = std::max( 1 , ( h + 1 ) / 2 );
+        next.texels = std::make_unique<Spectrum[]>( next.width * next.height );
+
+        // each texel is the average of the texels it covers in the finer level
+        for( auto i = 0 ; i < next.height ; ++i ){
+            for( auto j = 0 ; j < next.width ; ++j ){
+                Spectrum sum;
+                auto cnt = 0;
+                for( auto y = 2 * i ; y < std::min( 2 * i + 2 , h ) ; ++y ){
+                    for( auto x = 2 * j ; x < std::min( 2 * j + 2 , w ) ; ++x ){
+                        sum += _getTexel( level , x , y );
+                        ++cnt;
+                    }
+                }
+                next.texels[ i * next.width + j ] = sum / (float)cnt;
+            }
+        }
+
+        w = next.width;
+        h = next.height;
+        m_levels.push_back( std::move( next ) );
+    }
 }
 
 // generate 2d distribution
 void Sky::_generateDistribution2D()
 {
-    auto nu = m_sky.GetWidth();
-    auto nv = m_sky.GetHeight();
+    SORT_PROFILE("Generate Sky Distribution");
+
+    int nu = 0 , nv = 0;
+    _getLevelSize( m_samplingLevel , nu , nv );
     sAssert( nu != 0 && nv != 0 , LIGHT );
     auto data = std::make_unique<float[]>(nu*nv);
     for( auto i = 0 ; i < nv ; i++ )
     {
         auto offset = i * nu;
-        float sin_theta = sin( (float)i / (float)nv * PI );
+        float sin_theta = sin( ( (float)i + 0.5f ) / (float)nv * PI );
 
         for( auto j = 0 ; j < nu ; j++ )
-            data[offset+j] = std::max( 0.0f , m_sky.GetColor( (int)j , (int)i ).GetIntensity() * sin_theta );
+            data[offset+j] = std::max( 0.0f , _getTexel( m_samplingLevel , j , i ).GetIntensity() * sin_theta );
     }
 
     distribution.reset();
     distribution = std::make_unique<Distribution2D>( data.get() , nu , nv );
 }
 
+// load the sampling tables from the cache file
+bool Sky::_loadCache( const std::string& cache , std::uint64_t key )
+{
+    SORT_PROFILE("Load Sky Cache");
+
+    // IFileStream complains about missing files, a missing cache is totally expected though.
+    if( !std::ifstream( cache ).good() )
+        return false;
+
+    IFileStream stream( cache );
+    unsigned int magic = 0 , version = 0 , key_lo = 0 , key_hi = 0;
+    stream >> magic >> version >> key_lo >> key_hi;
+    if( magic != SKY_CACHE_MAGIC || version != SKY_CACHE_VERSION )
+        return false;
+    if( key_lo != (unsigned int)( key & 0xffffffff ) || key_hi != (unsigned int)( key >> 32 ) )
+        return false;
+
+    int nu = 0 , nv = 0;
+    _getLevelSize( m_samplingLevel , nu , nv );
+    auto loaded = std::make_unique<Distribution2D>();
+    if( !loaded->LoadCache( stream , nu , nv ) )
+        return false;
+
+    // a truncated file doesn't end with the magic number
+    magic = 0;
+    stream >> magic;
+    if( magic != SKY_CACHE_MAGIC )
+        return false;
+
+    distribution = std::move( loaded );
+    return true;
+}
+
+// save the sampling tables in the cache file
+bool Sky::_saveCache( const std::string& cache , std::uint64_t key ) const
+{
+    SORT_PROFILE("Save Sky Cache");
+
+    const auto tmp_filename = cache + ".tmp";
+    {
+        OFileStream stream( tmp_filename );
+        stream << SKY_CACHE_MAGIC << SKY_CACHE_VERSION;
+        stream << (unsigned int)( key & 0xffffffff ) << (unsigned int)( key >> 32 );
+        distribution->SaveCache( stream );
+        stream << SKY_CACHE_MAGIC;
+    }
+
+    // the previous cache is only replaced once the new one is fully written
+    remove( cache.c_str() );
+    if( 0 != rename( tmp_filename.c_str() , cache.c_str() ) ){
+        remove( tmp_filename.c_str() );
+        return false;
+    }
+    return true;
+}
+
+// get the texel in a level of the pyramid
+Spectrum Sky::_getTexel( unsigned level , int x , int y ) const
+{
+    if( 0 == level && !m_baked.texels )
+        return m_sky.GetColor( x , y );
+
+    // wrap around horizontally, clamp vertically
+    const auto& l = level ? m_levels[level - 1] : m_baked;
+    x = ( x >= 0 ) ? x % l.width : l.width - 1 - ( -x - 1 ) % l.width;
+    y = std::min( l.height - 1 , std::max( y , 0 ) );
+    return l.texels[ y * l.width + x ];
+}
+
+// bilinear filtering in a level of the pyramid
+Spectrum Sky::_lookup( unsigned level , float u , float v ) const
+{
+    if( 0 == level && !m_baked.texels )
+        return m_sky.GetColorFromUV( u , v );
+
+    int w = 0 , h = 0;
+    _getLevelSize( level , w , h );
+    const auto fu = u * w - 0.5f;
+    const auto fv = v * h - 0.5f;
+    const auto iu = (int)floor( fu );
+    const auto iv = (int)floor( fv );
+    const auto _fu = fu - (float)iu;
+    const auto _fv = fv - (float)iv;
+
+    return  _getTexel( level , iu , iv ) * ( 1.0f - _fu ) * ( 1.0f - _fv ) + _getTexel( level , iu + 1 , iv ) * _fu * ( 1.0f - _fv ) +
+            _getTexel( level , iu , iv + 1 ) * ( 1.0f - _fu ) * _fv + _getTexel( level , iu + 1 , iv + 1 ) * _fu * _fv;
+}
+
+// get the size of a level of the pyramid
+void Sky::_getLevelSize( unsigned level , int& width , int& height ) const
+{
+    if( 0 == level && m_baked.texels ){
+        width = m_baked.width;
+        height = m_baked.height;
+        return;
+    }
+    if( 0 == level ){
+        width = m_sky.GetWidth();
+        height = m_sky.GetHeight();
+        return;
+    }
+    width = m_levels[level - 1].width;
+    height = m_levels[level - 1].height;
+}
+
 // sample direction
 Vector Sky::sample_v( float u , float v , float* pdf , float* area_pdf ) const
 {
     sAssert( distribution != 0 , LIGHT );
 
+    // the sun disk is picked with its own probability, the random number is stretched back to be reused
+    if( m_sunProbability > 0.0f ){
+        if( u < m_sunProbability ){
+            Vector t0 , t1;
+            coordinateSystem( m_sunDir , t0 , t1 );
+            const auto local = UniformSampleCone( u / m_sunProbability , v , m_sunCosMax );
+            const auto wi = t0 * local.x + m_sunDir * local.y + t1 * local.z;
+            if( area_pdf ) *area_pdf = 0.0f;
+            if( pdf ) *pdf = Pdf( wi );
+            return wi;
+        }
+        u = std::min( ( u - m_sunProbability ) / ( 1.0f - m_sunProbability ) , 0.99999994f );
+    }
+
     float uv[2] ;
     float apdf = 0.0f;
     distribution->SampleContinuous( u , v , uv , &apdf );
@@ -76,12 +424,16 @@ Vector Sky::sample_v( float u , float v , float* pdf , float* area_pdf ) const
     Vector wi = sphericalVec( theta , phi );
     if( pdf )
     {
-        *pdf = apdf;
-        float sin_theta = sinTheta( wi );
-        if( sin_theta != 0.0f )
-            *pdf /= TWO_PI * PI * sinTheta( wi );
-        else
-            *pdf = 0.0f;
+        if( m_sunProbability > 0.0f ){
+            *pdf = Pdf( wi );
+        }else{
+            *pdf = apdf;
+            float sin_theta = sinTheta( wi );
+            if( sin_theta != 0.0f )
+                *pdf /= TWO_PI * PI * sinTheta( wi );
+            else
+                *pdf = 0.0f;
+        }
     }
 
     return wi;
@@ -90,13 +442,213 @@ Vector Sky::sample_v( float u , float v , float* pdf , float* area_pdf ) const
 // get the pdf
 float Sky::Pdf( const Vector& lwi ) const
 {
+    const auto sun_pdf = ( m_sunProbability > 0.0f && dot( lwi , m_sunDir ) >= m_sunCosMax ) ? m_sunProbability * UniformConePdf( m_sunCosMax ) : 0.0f;
+
     float sin_theta = sinTheta(lwi);
-    if( sin_theta == 0.0f ) return 0.0f;
+    if( sin_theta == 0.0f ) return sun_pdf;
     float u , v;
     float theta = sphericalTheta( lwi );
     float phi = sphericalPhi( lwi );
     v = 1.0f - theta * INV_PI;
     u = phi * INV_TWOPI;
 
-    return distribution->Pdf( u , v ) / ( TWO_PI * PI * sin_theta );
+    return distribution->Pdf( u , v ) / ( TWO_PI * PI * sin_theta ) * ( 1.0f - m_sunProbability ) + sun_pdf;
+}
+
+// generate the levels for product sampling
+void Sky::_generateProductLevels()
+{
+    SORT_PROFILE("Generate Sky Product Levels");
+
+    m_productLevels.clear();
+    m_productSunLevel = 0;
+    for( auto l = m_samplingLevel ; l <= (unsigned)m_levels.size() ; ++l ){
+        ProductLevel level;
+        _getLevelSize( l , level.width , level.height );
+        const auto w = level.width , h = level.height;
+        const auto d_theta = PI / (float)h;
+        const auto d_phi = TWO_PI / (float)w;
+
+        level.cosBound.resize( h + 1 );
+        for( auto y = 0 ; y <= h ; ++y )
+            level.cosBound[y] = cos( PI * ( 1.0f - (float)y / (float)h ) );
+        level.cosBound[0] = -1.0f;
+        level.cosBound[h] = 1.0f;
+
+        level.cosCenter.resize( h );
+        level.sinCenter.resize( h );
+        level.variance.resize( h );
+        for( auto y = 0 ; y < h ; ++y ){
+            const auto theta = PI * ( 1.0f - ( (float)y + 0.5f ) / (float)h );
+            level.cosCenter[y] = cos( theta );
+            level.sinCenter[y] = sin( theta );
+            level.variance[y] = ( d_theta * d_theta + SQR( level.sinCenter[y] * d_phi ) ) / 24.0f;
+        }
+
+        level.cosPhi.resize( w );
+        level.sinPhi.resize( w );
+        for( auto x = 0 ; x < w ; ++x ){
+            const auto phi = TWO_PI * ( (float)x + 0.5f ) / (float)w;
+            level.cosPhi[x] = cos( phi );
+            level.sinPhi[x] = sin( phi );
+        }
+
+        level.power.resize( w * h );
+        for( auto y = 0 ; y < h ; ++y ){
+            const auto solid_angle = d_phi * ( level.cosBound[y + 1] - level.cosBound[y] );
+            for( auto x = 0 ; x < w ; ++x )
+                level.power[ y * w + x ] = std::max( 0.0f , _getTexel( l , x , y ).GetIntensity() ) * solid_angle;
+        }
+
+        if( w > SKY_PRODUCT_SUN_WIDTH )
+            m_productSunLevel = (unsigned)m_productLevels.size() + 1;
+        m_productLevels.push_back( std::move( level ) );
+    }
+    m_productSunLevel = std::min( m_productSunLevel , (unsigned)m_productLevels.size() - 1 );
+}
+
+// power of a texel times the integral of the lobe over it
+float Sky::_productWeight( const ProductLevel& level , int x , int y , const VMFLobe& lobe ) const
+{
+    const auto power = level.power[ y * level.width + x ];
+    if( power <= 0.0f )
+        return 0.0f;
+    const auto sin_theta = level.sinCenter[y];
+    const Vector center( sin_theta * level.cosPhi[x] , level.cosCenter[y] , sin_theta * level.sinPhi[x] );
+    return power * lobe.Evaluate( center , level.variance[y] );
+}
+
+// weights of the four children of a texel
+void Sky::_productChildren( unsigned level , int x , int y , const VMFLobe& lobe , float weights[4] ) const
+{
+    const auto& children = m_productLevels[level - 1];
+    for( auto i = 0 ; i < 4 ; ++i ){
+        const auto cx = 2 * x + ( i & 1 );
+        const auto cy = 2 * y + ( i >> 1 );
+        weights[i] = ( cx < children.width && cy < children.height ) ? _productWeight( children , cx , cy , lobe ) : 0.0f;
+    }
+}
+
+// share of samples guided by the lobe
+float Sky::_productProbability( const VMFLobe& lobe ) const
+{
+    if( m_productLevels.empty() || lobe.kappa < SKY_PRODUCT_MIN_KAPPA )
+        return 0.0f;
+    return std::min( lobe.weight , SKY_PRODUCT_MAX_PROB );
+}
+
+// probability of sampling the sun disk in product sampling
+float Sky::_productSunProbability( const VMFLobe& lobe ) const
+{
+    if( m_sunProbability <= 0.0f )
+        return 0.0f;
+
+    // the disk is a footprint of the lobe too, the variance of a uniform disk is a quarter of its squared radius
+    const auto sun_solid_angle = TWO_PI * ( 1.0f - m_sunCosMax );
+    const auto sun = m_sunRadiance.GetIntensity() * sun_solid_angle * lobe.Evaluate( m_sunDir , 0.5f * ( 1.0f - m_sunCosMax ) );
+
+    const auto& level = m_productLevels[m_productSunLevel];
+    auto sky = 0.0f;
+    for( auto y = 0 ; y < level.height ; ++y )
+        for( auto x = 0 ; x < level.width ; ++x )
+            sky += _productWeight( level , x , y , lobe );
+
+    return std::min( SKY_SUN_MAX_PROB , std::max( SKY_SUN_MIN_PROB , sun / std::max( 1e-6f , sun + sky ) ) );
+}
+
+// pdf of picking a direction by walking down the pyramid
+float Sky::_productTexelPdf( const Vector& wi , const VMFLobe& lobe ) const
+{
+    const auto& finest = m_productLevels[0];
+    const auto u = sphericalPhi( wi ) * INV_TWOPI;
+    const auto v = 1.0f - sphericalTheta( wi ) * INV_PI;
+    const auto fx = std::min( (int)( u * finest.width ) , finest.width - 1 );
+    const auto fy = std::min( (int)( v * finest.height ) , finest.height - 1 );
+
+    auto x = fx , y = fy;
+    auto pdf = 1.0f;
+    for( auto l = 1u ; l < m_productLevels.size() ; ++l ){
+        float weights[4];
+        _productChildren( l , x >> 1 , y >> 1 , lobe , weights );
+        const auto total = weights[0] + weights[1] + weights[2] + weights[3];
+        const auto picked = weights[ ( x & 1 ) + 2 * ( y & 1 ) ];
+        if( picked <= 0.0f )
+            return 0.0f;
+        pdf *= picked / total;
+        x >>= 1;
+        y >>= 1;
+    }
+
+    return pdf / ( TWO_PI / (float)finest.width * ( finest.cosBound[fy + 1] - finest.cosBound[fy] ) );
+}
+
+// sample a direction guided by a lobe
+Vector Sky::sample_v( float u , float v , const VMFLobe& lobe , float* pdf ) const
+{
+    const auto product_prob = _productProbability( lobe );
+    if( u >= product_prob ){
+        u = std::min( ( u - product_prob ) / ( 1.0f - product_prob ) , 0.99999994f );
+        const auto wi = sample_v( u , v , pdf , nullptr );
+        if( pdf && product_prob > 0.0f && *pdf > 0.0f )
+            *pdf = Pdf( wi , lobe );
+        return wi;
+    }
+    u = std::min( u / product_prob , 0.99999994f );
+
+    // the random numbers are stretched back after each step, 'v' picks the row and 'u' picks the column
+    const auto sun_prob = _productSunProbability( lobe );
+    if( u < sun_prob ){
+        Vector t0 , t1;
+        coordinateSystem( m_sunDir , t0 , t1 );
+        const auto local = UniformSampleCone( u / sun_prob , v , m_sunCosMax );
+        const auto wi = t0 * local.x + m_sunDir * local.y + t1 * local.z;
+        if( pdf ) *pdf = Pdf( wi , lobe );
+        return wi;
+    }
+    u = std::min( ( u - sun_prob ) / ( 1.0f - sun_prob ) , 0.99999994f );
+
+    auto x = 0 , y = 0;
+    for( auto l = (unsigned)m_productLevels.size() - 1 ; l > 0 ; --l ){
+        float weights[4];
+        _productChildren( l , x , y , lobe , weights );
+        const auto top = weights[0] + weights[1];
+        const auto bottom = weights[2] + weights[3];
+        if( top + bottom <= 0.0f ){
+            if( pdf ) *pdf = 0.0f;
+            return Vector();
+        }
+
+        const auto top_prob = top / ( top + bottom );
+        const auto dy = ( v < top_prob || bottom <= 0.0f ) ? 0 : 1;
+        v = std::min( dy ? ( v - top_prob ) / ( 1.0f - top_prob ) : v / top_prob , 0.99999994f );
+
+        const auto* row = weights + 2 * dy;
+        const auto left_prob = row[0] / ( row[0] + row[1] );
+        const auto dx = ( u < left_prob || row[1] <= 0.0f ) ? 0 : 1;
+        u = std::min( dx ? ( u - left_prob ) / ( 1.0f - left_prob ) : u / left_prob , 0.99999994f );
+
+        x = 2 * x + dx;
+        y = 2 * y + dy;
+    }
+
+    // uniformly pick a direction in the texel
+    const auto& finest = m_productLevels[0];
+    const auto cos_theta = finest.cosBound[y] + ( finest.cosBound[y + 1] - finest.cosBound[y] ) * v;
+    const auto sin_theta = sqrt( std::max( 0.0f , 1.0f - cos_theta * cos_theta ) );
+    const auto wi = sphericalVec( sin_theta , cos_theta , TWO_PI * ( (float)x + u ) / (float)finest.width );
+    if( pdf ) *pdf = Pdf( wi , lobe );
+    return wi;
+}
+
+// get the pdf of sampling a direction guided by a lobe
+float Sky::Pdf( const Vector& wi , const VMFLobe& lobe ) const
+{
+    const auto product_prob = _productProbability( lobe );
+    if( product_prob <= 0.0f )
+        return Pdf( wi );
+
+    const auto sun_prob = _productSunProbability( lobe );
+    const auto sun_pdf = ( sun_prob > 0.0f && dot( wi , m_sunDir ) >= m_sunCosMax ) ? UniformConePdf( m_sunCosMax ) : 0.0f;
+    const auto product_pdf = sun_prob * sun_pdf + ( 1.0f - sun_prob ) * _productTexelPdf( wi , lobe );
+    return product_prob * product_pdf + ( 1.0f - product_prob ) * Pdf( wi );
 }
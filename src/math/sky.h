@@ -22,6 +22,28 @@
 #include "math/transform.h"
 #include "texture/imagetexture2d.h"
 #include "core/samplemethod.h"
+#include "math/vmf.h"
+#include <vector>
+#include <cstdint>
+
+//! @brief  The finest resolution of the sampling tables of the sky.
+//!
+//! Sampling tables of huge images take lots of memory and time to build while barely improving the quality of
+//! importance sampling. The tables are built from a coarser level of the image pyramid instead. It is still unbiased
+//! since the pdf is piecewise constant in each texel of that level.
+constexpr unsigned SKY_SAMPLING_RESOLUTION = 2048;
+
+//! @brief  Parameters of the analytic daylight model.
+/**
+ * The sky is the Preetham model, it is evaluated once into a small lat-long image when the scene is loaded. The sun
+ * is an analytic disk on top of it, whose color comes from the attenuation through the atmosphere.
+ */
+struct SkyModel{
+    float   turbidity = 3.0f;                   /**< Turbidity of the atmosphere, 2 is a very clear sky and 10 is hazy. */
+    Vector  sunDir = Vector( 0.0f , 1.0f , 0.0f );  /**< Direction pointing to the sun in the space of the sky. */
+    float   sunRadius = 0.00465f;               /**< Angular radius of the sun disk in radian. */
+    float   sunStrength = 1.0f;                 /**< Scaling of the radiance of the sun disk, zero removes the sun. */
+};
 
 ////////////////////////////////////////////////////////////////////////
 // definition of sky sphere
@@ -29,8 +51,9 @@ class   Sky{
 public:
     // evaluate value from sky
     // para 'r' : the ray which misses all of the triangle in the scene
+    // para 'footprint' : solid angle covered by the lookup, the image is filtered by the image pyramid if it is wider than a texel
     // result   : the spectrum in the sky
-    Spectrum Evaluate(const Vector& r) const;
+    Spectrum Evaluate(const Vector& r, float footprint = 0.0f) const;
 
     // get the average radiance
     Spectrum GetAverage() const;
@@ -41,16 +64,122 @@ public:
     // get the pdf
     float Pdf(const Vector& wi) const;
 
+    //! @brief  Sample a direction proportional to the product of the sky and a lobe of the bsdf.
+    //!
+    //! The image pyramid is walked from the coarsest level down to the level of the sampling tables, each step picks
+    //! one of the four children by its power times the integral of the lobe over it. Only a share of the samples is
+    //! guided by the lobe, the rest are drawn by 'sample_v' so that bright spots missed by the lobe are still covered.
+    //!
+    //! @param  u       A canonical random variable.
+    //! @param  v       A canonical random variable.
+    //! @param  lobe    The lobe of the bsdf in the space of the sky.
+    //! @param  pdf     The pdf w.r.t solid angle of the direction, the same as what 'Pdf' returns with the lobe.
+    //! @return         The sampled direction.
+    Vector sample_v(float u, float v, const VMFLobe& lobe, float* pdf) const;
+
+    //! @brief  The pdf of sampling a direction by the version of 'sample_v' guided by a lobe of the bsdf.
+    //!
+    //! @param  wi      The direction in the space of the sky.
+    //! @param  lobe    The lobe of the bsdf in the space of the sky.
+    //! @return         The pdf w.r.t solid angle.
+    float Pdf(const Vector& wi, const VMFLobe& lobe) const;
+
     // load image file
-    void Load(const std::string& str) {
-        m_sky.LoadResource(str);
-        _generateDistribution2D();
-    }
+    // para 'str' : name of the image file
+    // para 'cache' : file caching the sampling tables, empty means no caching
+    void Load(const std::string& str, const std::string& cache = "");
+
+    //! @brief  Evaluate the analytic daylight model into the lat-long cache and build the sampling tables from it.
+    //!
+    //! The sun is not baked in the image, it is sampled on its own so that its tiny disk is hit exactly.
+    //!
+    //! @param  model   Parameters of the model.
+    void Bake(const SkyModel& model);
 
 private:
+    // a level of the image pyramid
+    struct SkyLevel{
+        int                             width = 0;          /**< Width of the level. */
+        int                             height = 0;         /**< Height of the level. */
+        std::unique_ptr<Spectrum[]>     texels = nullptr;   /**< Texels of the level, in the same order as the image. */
+    };
+
     ImageTexture2D    m_sky;
+    /**< The analytic sky evaluated in a lat-long image, it replaces the image texture if it is not empty. */
+    SkyLevel                                m_baked;
+    /**< Average radiance of the analytic sky, including the sun. */
+    Spectrum                                m_bakedAverage;
+
+    /**< Direction pointing to the sun, it is only valid with a sun radiance. */
+    Vector                                  m_sunDir;
+    /**< Radiance of the sun disk, black if there is no sun. */
+    Spectrum                                m_sunRadiance;
+    /**< Cosine of the angular radius of the sun disk. */
+    float                                   m_sunCosMax = 1.0f;
+    /**< Probability of sampling the sun disk instead of the sky. */
+    float                                   m_sunProbability = 0.0f;
+    /**< Downsampled levels of the image, the first one is half of the resolution of the image. */
+    std::vector<SkyLevel>                   m_levels;
+    /**< Level of the pyramid, where the sampling tables are built. Zero means the image itself. */
+    unsigned                                m_samplingLevel = 0;
     std::unique_ptr<class Distribution2D>   distribution = nullptr;
 
+    // a level of the image pyramid visited by product sampling
+    struct ProductLevel{
+        int                 width = 0;      /**< Width of the level. */
+        int                 height = 0;     /**< Height of the level. */
+        std::vector<float>  power;          /**< Intensity of each texel times its solid angle. */
+        std::vector<float>  cosBound;       /**< Cosine of theta at the boundaries of rows, there is one more than rows. */
+        std::vector<float>  cosCenter;      /**< Cosine of theta at the center of each row. */
+        std::vector<float>  sinCenter;      /**< Sine of theta at the center of each row. */
+        std::vector<float>  variance;       /**< Variance of directions in a texel of each row along each axis. */
+        std::vector<float>  cosPhi;         /**< Cosine of phi at the center of each column. */
+        std::vector<float>  sinPhi;         /**< Sine of phi at the center of each column. */
+    };
+    /**< Levels of the pyramid for product sampling, from the level of the sampling tables to the single texel one. */
+    std::vector<ProductLevel>               m_productLevels;
+    /**< The level where the power of the sky is compared with the sun for product sampling, it has a few texels only. */
+    unsigned                                m_productSunLevel = 0;
+
+    // generate the image pyramid
+    void _generatePyramid();
+
     // generate 2d distribution
     void _generateDistribution2D();
+
+    // load the sampling tables from the cache file, it fails if the cache is from a different image
+    bool _loadCache(const std::string& cache, std::uint64_t key);
+
+    // save the sampling tables in the cache file
+    bool _saveCache(const std::string& cache, std::uint64_t key) const;
+
+    // get the texel in a level of the pyramid
+    Spectrum _getTexel(unsigned level, int x, int y) const;
+
+    // bilinear filtering in a level of the pyramid
+    Spectrum _lookup(unsigned level, float u, float v) const;
+
+    // get the size of a level of the pyramid
+    void _getLevelSize(unsigned level, int& width, int& height) const;
+
+    // radiance of the sun disk in a direction, black outside of the disk
+    Spectrum _sun(const Vector& wi) const;
+
+    // generate the levels for product sampling, it needs to be done after the sampling level is decided
+    void _generateProductLevels();
+
+    // power of a texel in a level for product sampling times the integral of the lobe over it
+    float _productWeight(const ProductLevel& level, int x, int y, const VMFLobe& lobe) const;
+
+    // weights of the four children of a texel, children out of the level are zero
+    void _productChildren(unsigned level, int x, int y, const VMFLobe& lobe, float weights[4]) const;
+
+    // share of samples guided by the lobe
+    float _productProbability(const VMFLobe& lobe) const;
+
+    // probability of sampling the sun disk in product sampling
+    float _productSunProbability(const VMFLobe& lobe) const;
+
+    // pdf w.r.t solid angle of picking a direction by walking down the pyramid
+    float _productTexelPdf(const Vector& wi, const VMFLobe& lobe) const;
 };
@@ -15,7 +15,9 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <algorithm>
 #include "transform.h"
+#include "bbox.h"
 
 // check whether the transform is identity
 bool Transform::IdIdentity() const
@@ -37,3 +39,31 @@ bool Transform::HasScale() const
 {
     return matrix.HasScale();
 }
+
+// transform a bounding box
+BBox Transform::TransformBBox( const BBox& bbox ) const
+{
+    BBox ret;
+    if( !matrix.IsAffine() ){
+        for( auto i = 0 ; i < 8 ; ++i ){
+            const Point corner( ( i & 1 ) ? bbox.m_Max.x : bbox.m_Min.x ,
+                                ( i & 2 ) ? bbox.m_Max.y : bbox.m_Min.y ,
+                                ( i & 4 ) ? bbox.m_Max.z : bbox.m_Min.z );
+            ret.Union( TransformPoint( corner ) );
+        }
+        return ret;
+    }
+
+    // Each axis of the new box is the translation plus the extreme values of each element times the extent of the box
+    // along the corresponding axis. It is as tight as transforming all eight corners.
+    for( auto i = 0 ; i < 3 ; ++i ){
+        ret.m_Min[i] = ret.m_Max[i] = matrix.m[i * 4 + 3];
+        for( auto j = 0 ; j < 3 ; ++j ){
+            const auto a = matrix.m[i * 4 + j] * bbox.m_Min[j];
+            const auto b = matrix.m[i * 4 + j] * bbox.m_Max[j];
+            ret.m_Min[i] += std::min( a , b );
+            ret.m_Max[i] += std::max( a , b );
+        }
+    }
+    return ret;
+}
@@ -24,6 +24,7 @@
 #include <math.h>
 
 class Transform;
+class BBox;
 
 // pre-declera functions
 Ray     operator* ( const Transform& t , const Ray& r );
@@ -52,9 +53,32 @@ public:
         return matrix.TransformVector(v);
     }
     Vector  TransformNormal( const Vector& n ) const{
-        return invMatrix.Transpose().TransformVector(n);
+        return invMatrix.TransformVectorTransposed(n);
     }
 
+    //! @brief  Transform an array of points in place.
+    //!
+    //! @param points   Points to be transformed.
+    //! @param cnt      Number of points in the array.
+    void    TransformPoints( Point* points , unsigned int cnt ) const{
+        matrix.TransformPoints( points , cnt );
+    }
+
+    //! @brief  Transform an array of normals in place, the normals are not normalized after transformation.
+    //!
+    //! @param normals  The first normal to be transformed.
+    //! @param cnt      Number of normals in the array.
+    //! @param stride   Distance in bytes between two normals, the normals could be members of larger structures.
+    void    TransformNormals( Vector* normals , unsigned int cnt , unsigned int stride = sizeof( Vector ) ) const{
+        invMatrix.TransformVectorsTransposed( normals , cnt , stride );
+    }
+
+    //! @brief  Get the bounding box of a transformed bounding box.
+    //!
+    //! @param bbox     Bounding box to be transformed.
+    //! @return         The tightest axis aligned bounding box of the transformed one.
+    BBox    TransformBBox( const BBox& bbox ) const;
+
     Ray     operator()( const Ray& r ) const {
         return *this * r;
     }
@@ -205,6 +229,23 @@ SORT_FORCEINLINE Transform Inverse( const Transform& t )
     return Transform( t.invMatrix , t.matrix );
 }
 
+//! @brief  Interpolate two transforms linearly.
+//!
+//! The matrices are blended entry by entry, every point moves along a straight line in between. It is not exactly a
+//! rotation for large angles, but whatever moves with it never leaves the bounding boxes at both ends.
+//!
+//! @param t0       The transform at the beginning.
+//! @param t1       The transform at the end.
+//! @param t        The interpolation factor, 0 is the beginning and 1 is the end.
+//! @return         The interpolated transform.
+SORT_FORCEINLINE Transform Lerp( const Transform& t0 , const Transform& t1 , float t )
+{
+    Matrix m;
+    for( auto i = 0 ; i < 16 ; ++i )
+        m.m[i] = t0.matrix.m[i] * ( 1.0f - t ) + t1.matrix.m[i] * t;
+    return FromMatrix( m );
+}
+
 // return the transpose of the transform
 SORT_FORCEINLINE Transform Transpose( const Transform& t )
 {
@@ -213,5 +254,5 @@ SORT_FORCEINLINE Transform Transpose( const Transform& t )
 
 // transform a ray
 SORT_FORCEINLINE Ray  operator* ( const Transform& t , const Ray& r ){
-    return Ray( t.TransformPoint(r.m_Ori) , t.TransformVector(r.m_Dir) , r.m_Depth , r.m_fMin , r.m_fMax );
+    return t.matrix * r;
 }
@@ -97,6 +97,42 @@ SORT_FORCEINLINE int clamp( int x , int mi , int ma ){
     return x;
 }
 
+//! @brief  Inverse of the error function.
+//!
+//! This is the approximation from 'Approximating the erfinv function', Mike Giles 2010.
+//!
+//! @param  x   Value to be evaluated, it is clamped to (-1,1).
+//! @return     The value whose error function is @param x.
+SORT_FORCEINLINE float ErfInv( float x ){
+    x = clamp( x , -0.99999f , 0.99999f );
+    auto w = -log( ( 1.0f - x ) * ( 1.0f + x ) );
+    float p;
+    if( w < 5.0f ){
+        w = w - 2.5f;
+        p = 2.81022636e-08f;
+        p = 3.43273939e-07f + p * w;
+        p = -3.5233877e-06f + p * w;
+        p = -4.39150654e-06f + p * w;
+        p = 0.00021858087f + p * w;
+        p = -0.00125372503f + p * w;
+        p = -0.00417768164f + p * w;
+        p = 0.246640727f + p * w;
+        p = 1.50140941f + p * w;
+    }else{
+        w = sqrt( w ) - 3.0f;
+        p = -0.000200214257f;
+        p = 0.000100950558f + p * w;
+        p = 0.00134934322f + p * w;
+        p = -0.00367342844f + p * w;
+        p = 0.00573950773f + p * w;
+        p = -0.0076224613f + p * w;
+        p = 0.00943887047f + p * w;
+        p = 1.00167406f + p * w;
+        p = 2.83297682f + p * w;
+    }
+    return p * x;
+}
+
 //! @brief  Degree to radian.
 //!
 //! @param  deg Degree to be converted.
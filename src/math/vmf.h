@@ -0,0 +1,52 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "math/vector3.h"
+#include "math/fastmath.h"
+#include "core/define.h"
+
+//! @brief  A von Mises-Fisher distribution approximating a lobe of the bsdf.
+/**
+ * The bsdf is way too complex to be multiplied with a light source on the fly, a vMF lobe centered at the mirrored
+ * direction is close enough for glossy lobes. Light sources that can afford sampling the product of their emission and
+ * the lobe, like the sky, use it as a hint, how well the lobe fits the bsdf only affects the variance.
+ */
+struct VMFLobe{
+    Vector  axis;               /**< Center of the lobe in world space, it is a normalized vector. */
+    float   kappa = 0.0f;       /**< Concentration of the lobe, larger means sharper, zero is a uniform distribution. */
+    float   weight = 0.0f;      /**< Fraction of the bsdf covered by the lobe, it is between 0 and 1. */
+
+    //! @brief  Evaluate the normalized density of the lobe, optionally widened by a footprint.
+    //!
+    //! A uniform footprint on the sphere is convolved with the lobe by adding up their variance, this is what
+    //! integrating the lobe over a texel of an environment map needs.
+    //!
+    //! @param  wi          The direction to evaluate, it is a normalized vector.
+    //! @param  variance    Variance in radian squared of the footprint along each axis.
+    //! @return             The density of the lobe w.r.t solid angle.
+    SORT_FORCEINLINE float Evaluate( const Vector& wi , float variance = 0.0f ) const{
+        const auto k = ( kappa > 0.0f ) ? 1.0f / ( 1.0f / kappa + variance ) : 0.0f;
+        if( k < 1e-4f )
+            return INV_FOUR_PI;
+
+        // 1 - cos is computed as half of the squared distance, which doesn't suffer from cancellation for sharp lobes
+        const auto d = axis - wi;
+        return k * INV_TWOPI / ( 1.0f - FastExp( -2.0f * k ) ) * FastExp( -0.5f * k * d.SquaredLength() );
+    }
+};
@@ -18,8 +18,10 @@
 #include "heterogeneous.h"
 #include "core/rand.h"
 #include "core/memory.h"
+#include "math/fastmath.h"
 #include "material/material.h"
 #include "phasefunction.h"
+#include "core/mesh.h"
 
 IMPLEMENT_CLOSURE_TYPE_BEGIN(ClosureTypeHeterogenous)
 IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeHeterogenous, Tsl_float3, base_color)
@@ -27,9 +29,133 @@ IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeHeterogenous, Tsl_float, emission)
 IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeHeterogenous, Tsl_float, absorption)
 IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeHeterogenous, Tsl_float, scattering)
 IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeHeterogenous, Tsl_float, anisotropy)
+IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeHeterogenous, Tsl_float, back_anisotropy)
+IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeHeterogenous, Tsl_float, back_weight)
 IMPLEMENT_CLOSURE_TYPE_END(ClosureTypeHeterogenous)
 
+// Ratio tracking starts russian roulette once the transmittance drops below this threshold.
+static constexpr float RATIO_TRACKING_RR_THRESHOLD = 0.1f;
+
+void HeterogenousMedium::evaluate(const MajorantGrid& grid, const Point& p, MediumSample& ms) const {
+    MediumInteraction tmp_mi;
+    tmp_mi.intersect = p;
+    tmp_mi.mesh = m_mesh;
+    m_material->EvaluateMediumSample(tmp_mi, ms);
+
+    // the majorant of later evaluations should cover the extinction here
+    const auto density = m_mesh->SampleVolumeDensity(p);
+    if (density > 0.0f)
+        grid.UpdateExtinctionScale((ms.basecolor * ms.extinction).GetMaxComponent() / density);
+}
+
+bool HeterogenousMedium::IsSampledAsLight() const {
+    return IS_PTR_VALID(m_mesh) && IS_PTR_VALID(m_mesh->GetVolumeLight());
+}
+
 Spectrum HeterogenousMedium::Tr(const Ray& ray, const float max_t) const {
+    const auto grid = m_mesh->GetVolumeMajorantGrid();
+    if (IS_PTR_INVALID(grid))
+        return trRayMarching(ray, max_t);
+
+    // Ratio Tracking, Jan Novak
+    // https://cs.dartmouth.edu/~wjarosz/publications/novak14residual.html
+    Point ori;
+    Vector dir;
+    m_mesh->TransformToVolume(ray, ori, dir);
+
+    const auto scale = grid->GetExtinctionScale();
+    auto tr = Spectrum(1.0f);
+    grid->Traverse(ori, dir, max_t, [&](const float t0, const float t1, const float density) {
+        const auto majorant = density * scale;
+        if (majorant <= 0.0f)
+            return true;
+
+        auto t = t0;
+        while (true) {
+            t -= FastLog(1.0f - sort_canonical()) / majorant;
+            if (t >= t1)
+                return true;
+
+            MediumSample ms;
+            evaluate(*grid, ray(t), ms);
+            tr = tr * (1.0f - ms.basecolor * ms.extinction / majorant);
+
+            // russian roulette to stop tracking once there is little transmittance left
+            const auto max_tr = tr.GetMaxComponent();
+            if (max_tr < RATIO_TRACKING_RR_THRESHOLD) {
+                const auto q = std::max(0.05f, 1.0f - max_tr / RATIO_TRACKING_RR_THRESHOLD);
+                if (sort_canonical() < q) {
+                    tr = 0.0f;
+                    return false;
+                }
+                tr /= 1.0f - q;
+            }
+        }
+    });
+
+    return tr;
+}
+
+Spectrum HeterogenousMedium::Sample(const Ray& ray, const float max_t, MediumInteraction*& mi, Spectrum& emission) const {
+    const auto grid = m_mesh->GetVolumeMajorantGrid();
+    if (IS_PTR_INVALID(grid))
+        return sampleRayMarching(ray, max_t, mi, emission);
+
+    // Weighted Delta Tracking, Jan Novak
+    // https://cs.dartmouth.edu/~wjarosz/publications/novak14residual.html
+    Point ori;
+    Vector dir;
+    m_mesh->TransformToVolume(ray, ori, dir);
+
+    const auto scale = grid->GetExtinctionScale();
+    auto weight = Spectrum(1.0f);
+    grid->Traverse(ori, dir, max_t, [&](const float t0, const float t1, const float density) {
+        const auto majorant = density * scale;
+        if (majorant <= 0.0f)
+            return true;
+
+        auto t = t0;
+        while (true) {
+            t -= FastLog(1.0f - sort_canonical()) / majorant;
+            if (t >= t1)
+                return true;
+
+            MediumSample ms;
+            evaluate(*grid, ray(t), ms);
+            const auto extinction = ms.basecolor * ms.extinction;
+            const auto null_extinction = majorant - extinction;
+
+            // pick the real collision by the ratio of real and null extinction, the null extinction could be negative
+            // if the majorant is not a real bound.
+            const auto real = (extinction[0] + extinction[1] + extinction[2]) / 3.0f;
+            const auto null = (fabs(null_extinction[0]) + fabs(null_extinction[1]) + fabs(null_extinction[2])) / 3.0f;
+            if (real + null <= 0.0f)
+                continue;
+            const auto p_real = real / (real + null);
+
+            if (sort_canonical() < p_real) {
+                // sample a medium and scatter the ray
+                mi = SORT_MALLOC(MediumInteraction)();
+                mi->intersect = ray(t);
+                mi->phaseFunction = ms.CreatePhaseFunction();
+
+                weight /= majorant * p_real;
+
+                // This model is what is used in PBRT and different from 'Production Volume Rendering' by Disney.
+                emission = ms.emission * ms.basecolor * ms.absorption * weight;
+
+                weight *= ms.scattering * ms.basecolor;
+                return false;
+            }
+
+            weight = weight * null_extinction / ( majorant * ( 1.0f - p_real ) );
+        }
+    });
+
+    return weight;
+}
+
+Spectrum HeterogenousMedium::trRayMarching(const Ray& ray, const float max_t) const {
     // get the step size and count
     auto        step_size = m_material->GetVolumeStep();
     const auto  step_cnt = m_material->GetVolumeStepCnt();
@@ -60,7 +186,7 @@ Spectrum HeterogenousMedium::Tr(const Ray& ray, const float max_t) const {
     return exponent.Exp();
 }
 
-Spectrum HeterogenousMedium::Sample(const Ray& ray, const float max_t, MediumInteraction*& mi, Spectrum& emission) const {
+Spectrum HeterogenousMedium::sampleRayMarching(const Ray& ray, const float max_t, MediumInteraction*& mi, Spectrum& emission) const {
     // Distance Sample, Jan Novak
     // https://cs.dartmouth.edu/~wjarosz/publications/novak18monte-slides-3-distance-sampling.pdf
 
@@ -99,11 +225,11 @@ Spectrum HeterogenousMedium::Sample(const Ray& ray, const float max_t, MediumInt
 
         if (1.0f - r >= beam_transmitancy[ch]) {
             // sample a medium and scatter the ray
-            const auto new_dt = -log(1.0f - r) / extinction[ch];
+            const auto new_dt = -FastLog(1.0f - r) / extinction[ch];
 
             mi = SORT_MALLOC(MediumInteraction)();
             mi->intersect = ray(t + new_dt);
-            mi->phaseFunction = SORT_MALLOC(HenyeyGreenstein)(ms.anisotropy);
+            mi->phaseFunction = ms.CreatePhaseFunction();
             
             const auto new_exponent = -new_dt * extinction;
             const auto new_beam_transmitancy = new_exponent.Exp();
@@ -19,6 +19,7 @@
 
 #include "core/define.h"
 #include "medium.h"
+#include "majorant.h"
 
 DECLARE_CLOSURE_TYPE_BEGIN(ClosureTypeHeterogenous, "medium_heterogeneous")
 DECLARE_CLOSURE_TYPE_VAR(ClosureTypeHeterogenous, Tsl_float3, base_color)
@@ -26,6 +27,8 @@ DECLARE_CLOSURE_TYPE_VAR(ClosureTypeHeterogenous, Tsl_float, emission)
 DECLARE_CLOSURE_TYPE_VAR(ClosureTypeHeterogenous, Tsl_float, absorption)
 DECLARE_CLOSURE_TYPE_VAR(ClosureTypeHeterogenous, Tsl_float, scattering)
 DECLARE_CLOSURE_TYPE_VAR(ClosureTypeHeterogenous, Tsl_float, anisotropy)
+DECLARE_CLOSURE_TYPE_VAR(ClosureTypeHeterogenous, Tsl_float, back_anisotropy)
+DECLARE_CLOSURE_TYPE_VAR(ClosureTypeHeterogenous, Tsl_float, back_weight)
 DECLARE_CLOSURE_TYPE_END(ClosureTypeHeterogenous)
 
 //! @brief  HomogeneousMedium has equal scattering, absorption co-efficient everywhere.
@@ -54,6 +57,9 @@ public:
     //! Beam transmittance is how much percentage of radiance get attenuated during
     //! traveling through the medium. It is a spectrum dependent attenuation.
     //!
+    //! It is estimated with ratio tracking against the majorant grid of the volume density if there is one, the medium is
+    //! only evaluated at the tentative collisions. Otherwise, it falls back to ray marching.
+    //!
     //! @param  ray         The ray, which it uses to evaluate beam transmittance.
     //! @param  max_t       The maximum distance to be considered, usually this is the distance the ray travels before it hits a surface.
     //! @return             The attenuation of each spectrum channel.
@@ -61,8 +67,11 @@ public:
 
     //! @brief  Importance sampling a point along the ray in the medium.
     //!
-    //! This is no way to use Delta-Tracking algorithm due to the lack of context of maximum density because
-    //! density is a shader driven property, there is no way to explictly evaluate the maximum value.
+    //! Points are sampled with delta tracking against the majorant grid of the volume density if there is one.
+    //! Since the medium is driven by shaders, the majorant is the maximum density scaled by the largest extinction per
+    //! unit density observed so far, which is not necessarily a real bound. Null collisions are weighted so that the
+    //! estimation stays unbiased even if the extinction exceeds the majorant. Without volume density, it falls back to
+    //! ray marching.
     //!
     //! @param ray          The ray we use to take sample.
     //! @param max_t        The maximum distance to be considered, usually this is the distance the ray travels before it hits a surface.
@@ -71,6 +80,24 @@ public:
     //! @return             The beam transmittance between the ray origin and the interaction.
     Spectrum Sample(const Ray& ray, const float max_t, MediumInteraction*& mi, Spectrum& emission) const override;
 
+    //! @brief  Whether the emission of the medium is sampled by a light.
+    //!
+    //! @return             Whether there is a volume light built from the volume of the mesh.
+    bool IsSampledAsLight() const override;
+
 private:
     const Mesh* m_mesh;
+
+    //! @brief  Evaluate the medium at a point and learn the extinction per unit density from it.
+    //!
+    //! @param  grid        The majorant grid of the volume density.
+    //! @param  p           The position to evaluate the medium.
+    //! @param  ms          The medium sample evaluated.
+    void evaluate(const MajorantGrid& grid, const Point& p, MediumSample& ms) const;
+
+    //! @brief  Evaluation of beam transmittance with ray marching, it is biased by the step count.
+    Spectrum trRayMarching(const Ray& ray, const float max_t) const;
+
+    //! @brief  Importance sampling a point along the ray in the medium with ray marching, it is biased by the step count.
+    Spectrum sampleRayMarching(const Ray& ray, const float max_t, MediumInteraction*& mi, Spectrum& emission) const;
 };
\ No newline at end of file
@@ -18,6 +18,7 @@
 #include "homogeneous.h"
 #include "core/rand.h"
 #include "core/memory.h"
+#include "math/fastmath.h"
 #include "phasefunction.h"
 
 IMPLEMENT_CLOSURE_TYPE_BEGIN(ClosureTypeHomogeneous)
@@ -26,6 +27,8 @@ IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeHomogeneous, Tsl_float, emission)
 IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeHomogeneous, Tsl_float, absorption)
 IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeHomogeneous, Tsl_float, scattering)
 IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeHomogeneous, Tsl_float, anisotropy)
+IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeHomogeneous, Tsl_float, back_anisotropy)
+IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeHomogeneous, Tsl_float, back_weight)
 IMPLEMENT_CLOSURE_TYPE_END(ClosureTypeHomogeneous)
 
 Spectrum HomogeneousMedium::Tr( const Ray& ray , const float max_t ) const{
@@ -33,38 +36,84 @@ Spectrum HomogeneousMedium::Tr( const Ray& ray , const float max_t ) const{
     return e.Exp();
 }
 
+// Equiangular sampling degenerates when the light is almost on the ray.
+static constexpr float EQUIANGULAR_MIN_DISTANCE = 1e-4f;
+
+// A channel is picked uniformly as the hero channel and all channels are combined through one-sample MIS with the balance
+// heuristic, which is simply the average of the pdf of each channel.
+float HomogeneousMedium::FreeFlightPdf( const Spectrum& extinction , const Spectrum& tr , const bool sample_medium ){
+    const auto density = sample_medium ? ( extinction * tr ) : tr;
+
+    auto pdf = 0.0f;
+    for( auto i = 0u ; i < RGBSPECTRUM_SAMPLE ; ++i )
+        pdf += density[i];
+    return pdf / RGBSPECTRUM_SAMPLE;
+}
+
+float HomogeneousMedium::SampleFreeFlight( const Spectrum& extinction , const float max_t ){
+    const auto ch = clamp( (int)(sort_canonical() * RGBSPECTRUM_SAMPLE) , 0 , RGBSPECTRUM_SAMPLE - 1 );
+    return fmin( -FastLog( sort_canonical() ) / extinction[ch] , max_t );
+}
+
 Spectrum HomogeneousMedium::Sample( const Ray& ray , const float max_t , MediumInteraction*& mi , Spectrum& emission ) const{
     const auto extinction = m_globalMediumSample.basecolor * m_globalMediumSample.extinction;
-    const auto scattering = m_globalMediumSample.basecolor * m_globalMediumSample.scattering;
-    const auto absorption = m_globalMediumSample.basecolor * m_globalMediumSample.absorption;
 
-    const auto ch = clamp( (int)(sort_canonical() * RGBSPECTRUM_SAMPLE) , 0 , RGBSPECTRUM_SAMPLE - 1 );
-    const auto d = fmin( -log( sort_canonical() ) / extinction[ch] , max_t );
+    const auto d = SampleFreeFlight( extinction , max_t );
+    const auto tr = ( extinction * (-fmin( d , FLT_MAX )) ).Exp();
+    return evaluate( ray , d , max_t , FreeFlightPdf( extinction , tr , d < max_t ) , tr , mi , emission );
+}
 
-    const auto sample_medium = d < max_t;
-    if (sample_medium) {
-        mi = SORT_MALLOC(MediumInteraction)();
-        mi->intersect = ray(d);
-        mi->phaseFunction = SORT_MALLOC(HenyeyGreenstein)(m_globalMediumSample.anisotropy);
+Spectrum HomogeneousMedium::SampleToward( const Ray& ray , const float max_t , const Point& target , MediumInteraction*& mi , Spectrum& emission ) const{
+    // the distance to the point on the ray closest to the light, and how far away the light is from the ray
+    const auto delta = dot( target - ray.m_Ori , ray.m_Dir );
+    const auto h = ( target - ray( delta ) ).Length();
+    if( h < EQUIANGULAR_MIN_DISTANCE || max_t <= 0.0f )
+        return Sample( ray , max_t , mi , emission );
+
+    // the range of angles, viewed from the light, that the segment of the ray in the medium covers
+    const auto theta_a = atan( -delta / h );
+    const auto theta_b = atan( ( fmin( max_t , FLT_MAX ) - delta ) / h );
+    if( theta_b - theta_a <= 0.0f )
+        return Sample( ray , max_t , mi , emission );
+
+    const auto extinction = m_globalMediumSample.basecolor * m_globalMediumSample.extinction;
+
+    // either technique is picked with equal chance, equiangular sampling always ends up in the medium
+    auto d = max_t;
+    if( sort_canonical() < 0.5f ){
+        d = SampleFreeFlight( extinction , max_t );
+    }else{
+        const auto theta = slerp( theta_a , theta_b , sort_canonical() );
+        d = clamp( delta + h * tan( theta ) , 0.0f , max_t * ( 1.0f - FLT_EPSILON ) );
     }
 
-    const auto e = extinction * (-fmin( d , FLT_MAX ));
-    const auto tr = e.Exp();
+    const auto sample_medium = d < max_t;
+    const auto tr = ( extinction * (-fmin( d , FLT_MAX )) ).Exp();
 
-    const auto density = sample_medium ? (extinction * tr) : tr;
+    // one-sample MIS with the balance heuristic, the pdf is the average of the pdf of both techniques
+    const auto x = d - delta;
+    const auto equiangular_pdf = sample_medium ? h / ( ( theta_b - theta_a ) * ( h * h + x * x ) ) : 0.0f;
+    const auto pdf = 0.5f * ( FreeFlightPdf( extinction , tr , sample_medium ) + equiangular_pdf );
 
-    auto pdf = 0.0f;
-    for( auto i = 0u ; i < RGBSPECTRUM_SAMPLE ; ++i )
-        pdf += density[i];
-    pdf /= RGBSPECTRUM_SAMPLE;
+    return evaluate( ray , d , max_t , pdf , tr , mi , emission );
+}
 
+Spectrum HomogeneousMedium::evaluate( const Ray& ray , const float d , const float max_t , const float pdf , const Spectrum& tr , MediumInteraction*& mi , Spectrum& emission ) const{
     // This should rarely happen, though.
     if ( UNLIKELY(pdf == 0.0f) )
         return 0.0f;
 
+    const auto sample_medium = d < max_t;
+    if (!sample_medium)
+        return tr / pdf;
+
+    mi = SORT_MALLOC(MediumInteraction)();
+    mi->intersect = ray(d);
+    mi->phaseFunction = m_globalMediumSample.CreatePhaseFunction();
+
     // This model is what is used in PBRT and different from 'Production Volume Rendering' by Disney.
-    if (sample_medium)
-        emission = m_globalMediumSample.basecolor * m_globalMediumSample.emission * m_globalMediumSample.absorption * tr / pdf;
+    emission = m_globalMediumSample.basecolor * m_globalMediumSample.emission * m_globalMediumSample.absorption * tr / pdf;
 
-    return sample_medium ? ( tr * scattering / pdf ) : ( tr / pdf );
-}
\ No newline at end of file
+    const auto scattering = m_globalMediumSample.basecolor * m_globalMediumSample.scattering;
+    return tr * scattering / pdf;
+}
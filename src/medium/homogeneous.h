@@ -26,6 +26,8 @@ DECLARE_CLOSURE_TYPE_VAR(ClosureTypeHomogeneous, Tsl_float, emission)
 DECLARE_CLOSURE_TYPE_VAR(ClosureTypeHomogeneous, Tsl_float, absorption)
 DECLARE_CLOSURE_TYPE_VAR(ClosureTypeHomogeneous, Tsl_float, scattering)
 DECLARE_CLOSURE_TYPE_VAR(ClosureTypeHomogeneous, Tsl_float, anisotropy)
+DECLARE_CLOSURE_TYPE_VAR(ClosureTypeHomogeneous, Tsl_float, back_anisotropy)
+DECLARE_CLOSURE_TYPE_VAR(ClosureTypeHomogeneous, Tsl_float, back_weight)
 DECLARE_CLOSURE_TYPE_END(ClosureTypeHomogeneous)
 
 //! @brief  HomogeneousMedium has equal scattering, absorption co-efficient everywhere.
@@ -41,7 +43,10 @@ public:
     //! @param param		Parameter to build the volume.
 	//! @param material		Material that spawns the medium.
     HomogeneousMedium(const ClosureTypeHomogeneous& param, const MaterialBase* material):
-        Medium(param.base_color, param.emission, param.absorption, param.scattering, param.anisotropy, material){}
+        Medium(param.base_color, param.emission, param.absorption, param.scattering, param.anisotropy, material){
+        m_globalMediumSample.backAnisotropy = param.back_anisotropy;
+        m_globalMediumSample.backWeight = saturate(param.back_weight);
+    }
 
     //! @brief  Evaluation of beam transmittance.
     //!
@@ -61,4 +66,47 @@ public:
     //! @param emission     The emission contribution in RTE.
     //! @return             The beam transmittance between the ray origin and the interaction.
     Spectrum Sample( const Ray& ray, const float max_t, MediumInteraction*& mi , Spectrum& emission ) const override;
+
+    //! @brief  Importance sampling a point along the ray in the medium, favoring points close to a light.
+    //!
+    //! Free flight sampling is combined with equiangular sampling toward the light through one-sample MIS. Equiangular
+    //! sampling makes points close to the light much more likely, which is where free flight alone converges slowly.
+    //!
+    //! @param ray          The ray we use to take sample.
+    //! @param max_t        The maximum distance to be considered, usually this is the distance the ray travels before it hits a surface.
+    //! @param target       Position of the light that the scattering point will likely be lit by.
+    //! @param mi           The interaction sampled.
+    //! @param emission     The emission contribution in RTE.
+    //! @return             The beam transmittance between the ray origin and the interaction.
+    Spectrum SampleToward( const Ray& ray , const float max_t , const Point& target , MediumInteraction*& mi , Spectrum& emission ) const override;
+
+    //! @brief  Sample a distance by free flight in a hero channel picked uniformly.
+    //!
+    //! It is shared with the random walk of subsurface scattering, whose extinction differs in each channel too.
+    //!
+    //! @param extinction   Extinction coefficient of each channel.
+    //! @param max_t        The maximum distance to be considered.
+    //! @return             The sampled distance, it is max_t if the sample passes through the medium.
+    static float SampleFreeFlight( const Spectrum& extinction , const float max_t );
+
+    //! @brief  Pdf of free flight sampling, all channels are combined through one-sample MIS with the balance heuristic.
+    //!
+    //! @param extinction   Extinction coefficient of each channel.
+    //! @param tr           The beam transmittance between the ray origin and the sampled distance.
+    //! @param sample_medium    Whether the sample is in the medium, or it passes through it.
+    //! @return             Pdf of the sampled distance, or the probability of passing through the medium.
+    static float FreeFlightPdf( const Spectrum& extinction , const Spectrum& tr , const bool sample_medium );
+
+private:
+    //! @brief  Evaluate the sampled distance once its pdf is known.
+    //!
+    //! @param ray          The ray we use to take sample.
+    //! @param d            The sampled distance, there is an interaction in the medium only if it is smaller than max_t.
+    //! @param max_t        The maximum distance to be considered.
+    //! @param pdf          The pdf of the sampled distance, or the probability of passing through the medium if d is max_t.
+    //! @param tr           The beam transmittance between the ray origin and the sampled distance.
+    //! @param mi           The interaction sampled.
+    //! @param emission     The emission contribution in RTE.
+    //! @return             The beam transmittance between the ray origin and the interaction divided by the pdf.
+    Spectrum evaluate( const Ray& ray , const float d , const float max_t , const float pdf , const Spectrum& tr , MediumInteraction*& mi , Spectrum& emission ) const;
 };
\ No newline at end of file
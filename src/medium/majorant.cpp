@@ -0,0 +1,60 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "majorant.h"
+
+void MajorantGrid::Build( const std::vector<float>& brick_max , const unsigned brick_res[3] , const float cells_per_unit[3] ){
+    m_majorants = nullptr;
+    if( 0 == brick_res[0] || 0 == brick_res[1] || 0 == brick_res[2] )
+        return;
+    for( auto i = 0 ; i < 3 ; ++i ){
+        m_res[i] = (int)brick_res[i];
+        m_cellsPerUnit[i] = cells_per_unit[i];
+    }
+
+    const auto index = [&]( int x , int y , int z ){
+        return ( z * m_res[1] + y ) * m_res[0] + x;
+    };
+
+    // the maximum of neighbors is separable, dilate one axis at a time
+    std::vector<float> src( brick_max ) , dst( brick_max.size() );
+    const int offset[3][3] = { { 1 , 0 , 0 } , { 0 , 1 , 0 } , { 0 , 0 , 1 } };
+    for( auto axis = 0 ; axis < 3 ; ++axis ){
+        for( auto z = 0 ; z < m_res[2] ; ++z ){
+            for( auto y = 0 ; y < m_res[1] ; ++y ){
+                for( auto x = 0 ; x < m_res[0] ; ++x ){
+                    const int c[3] = { x , y , z };
+                    auto m = src[index( x , y , z )];
+                    if( c[axis] > 0 )
+                        m = std::max( m , src[index( x - offset[axis][0] , y - offset[axis][1] , z - offset[axis][2] )] );
+                    if( c[axis] < m_res[axis] - 1 )
+                        m = std::max( m , src[index( x + offset[axis][0] , y + offset[axis][1] , z + offset[axis][2] )] );
+                    dst[index( x , y , z )] = m;
+                }
+            }
+        }
+        src.swap( dst );
+    }
+
+    m_majorants = std::make_unique<float[]>( src.size() );
+    std::copy( src.begin() , src.end() , m_majorants.get() );
+}
+
+void MajorantGrid::UpdateExtinctionScale( float scale ) const{
+    auto cur = m_extinctionScale.load( std::memory_order_relaxed );
+    while( scale > cur && !m_extinctionScale.compare_exchange_weak( cur , scale , std::memory_order_relaxed ) );
+}
@@ -0,0 +1,171 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <memory>
+#include <vector>
+#include "core/define.h"
+#include "math/point.h"
+
+//! @brief  Coarse grid of the maximum density of a 3D density texture.
+/**
+ * Each cell covers a block of texels of the density texture and keeps the maximum density of all texels that could
+ * contribute to a trilinear sample inside the cell. It bounds the density so that null-collision algorithms, like delta
+ * tracking and ratio tracking, could skip through the volume without evaluating the medium at every small step.
+ *
+ * The grid works in volume texture space, where the whole texture is in the unit cube. Density outside the unit cube is
+ * always zero.
+ */
+class MajorantGrid{
+public:
+    //! @brief  Build the grid from the maximum density of bricks of a density texture.
+    //!
+    //! Each cell matches a brick, the maximum of its neighbor bricks is also taken since a trilinear sample close to the
+    //! border of a brick blends texels in the neighbor brick.
+    //!
+    //! @param  brick_max   Maximum density of each brick, x goes first, then y and z.
+    //! @param  brick_res   Number of bricks along each axis.
+    //! @param  cells_per_unit  Number of bricks per unit in volume texture space along each axis, bricks on the border
+    //!                     could be partially outside of the unit cube.
+    void    Build( const std::vector<float>& brick_max , const unsigned brick_res[3] , const float cells_per_unit[3] );
+
+    //! @brief  Whether the grid is built from a valid texture.
+    SORT_FORCEINLINE bool IsValid() const {
+        return m_majorants != nullptr;
+    }
+
+    //! @brief  Walk through the cells along a ray in volume texture space with a 3D DDA.
+    //!
+    //! Only the part of the ray inside the unit cube is visited. The ray doesn't need to be normalized, the segments are
+    //! in units of the ray parameter.
+    //!
+    //! @param  ori         Origin of the ray in volume texture space.
+    //! @param  dir         Direction of the ray in volume texture space.
+    //! @param  max_t       The maximum ray parameter to be considered.
+    //! @param  func        Function taking the start, the end and the maximum density of a segment, it returns false to stop.
+    template<typename Func>
+    void    Traverse( const Point& ori , const Vector& dir , float max_t , const Func& func ) const;
+
+    //! @brief  Extinction coefficient per unit density observed so far.
+    //!
+    //! Media are driven by shaders, there is no way to bound the extinction coefficient by the density in general. The
+    //! largest ratio observed is used to scale the density into a majorant of the extinction coefficient. Null-collision
+    //! algorithms used by SORT stay unbiased even if the majorant is not a real bound, it only costs variance until the
+    //! scale catches up.
+    SORT_FORCEINLINE float GetExtinctionScale() const {
+        return m_extinctionScale.load( std::memory_order_relaxed );
+    }
+
+    //! @brief  Update the extinction coefficient per unit density, it only grows and it is thread-safe.
+    //!
+    //! @param  scale       Extinction coefficient per unit density observed at a point.
+    void    UpdateExtinctionScale( float scale ) const;
+
+    //! @brief  Maximum density of a cell.
+    SORT_FORCEINLINE float GetMajorant( int x , int y , int z ) const {
+        return m_majorants[ ( z * m_res[1] + y ) * m_res[0] + x ];
+    }
+
+    //! @brief  Number of cells along an axis.
+    SORT_FORCEINLINE int GetResolution( int axis ) const {
+        return m_res[axis];
+    }
+
+    //! @brief  Number of cells per unit along an axis in volume texture space.
+    SORT_FORCEINLINE float GetCellsPerUnit( int axis ) const {
+        return m_cellsPerUnit[axis];
+    }
+
+private:
+    /**< Maximum density of each cell. */
+    std::unique_ptr<float[]>    m_majorants;
+    /**< Number of cells along each axis. */
+    int                         m_res[3] = { 0 , 0 , 0 };
+    /**< Number of cells per unit along each axis. */
+    float                       m_cellsPerUnit[3] = { 0.0f , 0.0f , 0.0f };
+    /**< Extinction coefficient per unit density observed so far. */
+    mutable std::atomic<float>  m_extinctionScale = 1.0f;
+};
+
+template<typename Func>
+void MajorantGrid::Traverse( const Point& ori , const Vector& dir , float max_t , const Func& func ) const{
+    if( !IsValid() )
+        return;
+
+    // clip the ray against the unit cube
+    auto t_near = 0.0f , t_far = max_t;
+    for( auto i = 0 ; i < 3 ; ++i ){
+        if( dir[i] == 0.0f ){
+            if( ori[i] < 0.0f || ori[i] > 1.0f )
+                return;
+            continue;
+        }
+        const auto inv = 1.0f / dir[i];
+        auto t0 = -ori[i] * inv;
+        auto t1 = ( 1.0f - ori[i] ) * inv;
+        if( t0 > t1 )
+            std::swap( t0 , t1 );
+        t_near = std::max( t_near , t0 );
+        t_far = std::min( t_far , t1 );
+        if( t_near >= t_far )
+            return;
+    }
+
+    // setup the DDA from the cell where the ray enters
+    int cell[3] , step[3] , end[3];
+    float next[3] , delta[3];
+    for( auto i = 0 ; i < 3 ; ++i ){
+        const auto p = ori[i] + dir[i] * t_near;
+        cell[i] = std::min( std::max( (int)( p * m_cellsPerUnit[i] ) , 0 ) , m_res[i] - 1 );
+        if( dir[i] > 0.0f ){
+            step[i] = 1;
+            end[i] = m_res[i];
+            next[i] = t_near + ( (float)( cell[i] + 1 ) / m_cellsPerUnit[i] - p ) / dir[i];
+            delta[i] = 1.0f / ( m_cellsPerUnit[i] * dir[i] );
+        }else if( dir[i] < 0.0f ){
+            step[i] = -1;
+            end[i] = -1;
+            next[i] = t_near + ( (float)cell[i] / m_cellsPerUnit[i] - p ) / dir[i];
+            delta[i] = -1.0f / ( m_cellsPerUnit[i] * dir[i] );
+        }else{
+            step[i] = 0;
+            end[i] = -1;
+            next[i] = FLT_MAX;
+            delta[i] = FLT_MAX;
+        }
+    }
+
+    auto t = t_near;
+    while( true ){
+        const auto axis = ( next[0] < next[1] ) ? ( next[0] < next[2] ? 0 : 2 ) : ( next[1] < next[2] ? 1 : 2 );
+        const auto t_exit = std::min( next[axis] , t_far );
+        if( t_exit > t && !func( t , t_exit , GetMajorant( cell[0] , cell[1] , cell[2] ) ) )
+            return;
+        if( t_exit >= t_far )
+            return;
+
+        cell[axis] += step[axis];
+        if( cell[axis] == end[axis] )
+            return;
+        t = t_exit;
+        next[axis] += delta[axis];
+    }
+}
@@ -18,6 +18,17 @@
 #include "medium.h"
 #include "material/material.h"
 #include "core/rand.h"
+#include "core/memory.h"
+#include "phasefunction.h"
+
+const PhaseFunction* MediumSample::CreatePhaseFunction() const {
+    if (backWeight <= 0.0f)
+        return SORT_MALLOC(HenyeyGreenstein)(anisotropy);
+
+    const float g[] = { anisotropy , backAnisotropy };
+    const float w[] = { 1.0f - backWeight , backWeight };
+    return SORT_MALLOC(MultiLobeHenyeyGreenstein)(g, w, 2);
+}
 
 bool MediumStack::AddMedium(const Medium* medium) {
     // simply return false if there is no space, this should rarely happen unless there is more than 8 volumes overlap.
@@ -66,11 +77,14 @@ Spectrum MediumStack::Tr(const Ray& r, const float max_t) const {
     return medium->Tr(r, max_t) * m_mediumCnt;
 }
 
-Spectrum MediumStack::Sample(const Ray& r, const float max_t , MediumInteraction*& mi, Spectrum& emission) const {
+Spectrum MediumStack::Sample(const Ray& r, const float max_t , MediumInteraction*& mi, Spectrum& emission, const Point* target, const bool light_emission) const {
     if (0 == m_mediumCnt)
         return 1.0f;
 
     const auto k = clamp((int)(sort_canonical() * m_mediumCnt), 0, m_mediumCnt - 1);
     const Medium* medium = m_mediums[k];
-    return medium->Sample(r, max_t, mi, emission) * m_mediumCnt;
+    const auto attenuation = target ? medium->SampleToward(r, max_t, *target, mi, emission) : medium->Sample(r, max_t, mi, emission);
+    if (!light_emission && medium->IsSampledAsLight())
+        emission = 0.0f;
+    return attenuation * m_mediumCnt;
 }
\ No newline at end of file
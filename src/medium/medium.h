@@ -26,6 +26,7 @@
 #include "core/strid.h"
 
 class MaterialBase;
+class PhaseFunction;
 
 enum SE_Interaction : char {
     SE_REFLECTION = 0,
@@ -55,11 +56,18 @@ struct MediumSample {
     float         scattering = 0.0f;     /**< Scattering coefficient. */
     float         extinction = 0.0f;     /**< Absorption + scattering coefficient. */
     float         anisotropy = 0.0f;     /**< Anisotropy of the phase function. */
+    float         backAnisotropy = 0.0f; /**< Anisotropy of the second lobe of the phase function. */
+    float         backWeight = 0.0f;     /**< Weight of the second lobe of the phase function, there is only one lobe if it is zero. */
 
     MediumSample():anisotropy(0.0f){}
 
     MediumSample(const Spectrum& baseColor, const float emission, const float absorption, const float scattering, const float anisotropy) :
         basecolor(baseColor), emission(emission), absorption(absorption), scattering(scattering), extinction(absorption + scattering), anisotropy(anisotropy) {}
+
+    //! @brief  Create the phase function of the medium sample, memory is allocated from the memory pool.
+    //!
+    //! @return             A single Henyey-Greenstein lobe, or a blend of two lobes if the second lobe has weight.
+    const PhaseFunction* CreatePhaseFunction() const;
 };
 
 //! @brief  Medium is a data structure holding volumetric rendering data.
@@ -95,6 +103,30 @@ public:
     //! @return             The beam transmittance between the ray origin and the interaction.
     virtual Spectrum Sample( const Ray& ray , const float max_t , MediumInteraction*& interaction, Spectrum& emission) const = 0;
 
+    //! @brief  Importance sampling a point along the ray in the medium, favoring points close to a light.
+    //!
+    //! Mediums that can't do better than 'Sample' simply fall back to it.
+    //!
+    //! @param ray          The ray we use to take sample.
+    //! @param max_t        The maximum distance to be considered, usually this is the distance the ray travels before it hits a surface.
+    //! @param target       Position of the light that the scattering point will likely be lit by.
+    //! @param mi           The interaction sampled.
+    //! @param emission     The emission contribution in RTE.
+    //! @return             The beam transmittance between the ray origin and the interaction.
+    virtual Spectrum SampleToward( const Ray& ray , const float max_t , const Point& target , MediumInteraction*& mi , Spectrum& emission ) const{
+        return Sample( ray , max_t , mi , emission );
+    }
+
+    //! @brief  Whether the emission of the medium is sampled by a light.
+    //!
+    //! Paths don't account the emission of such mediums except for the ones from the camera, the rest of the emission is
+    //! taken by the light through next event estimation.
+    //!
+    //! @return             Whether the emission of the medium is sampled by a light.
+    virtual bool IsSampledAsLight() const {
+        return false;
+    }
+
 	//! @brief	Get the material that spawns the medium.
 	//!
 	//! @return				The material that spawns the medium.
@@ -155,8 +187,10 @@ public:
     //! @param  max_t       The maximum distance to be considered, usually this is the distance the ray travels before it hits a surface.
     //! @param  mi          The medium interaction taken as a sample, null if no sample is taken in the medium.
     //! @param  emission    The emission contribution in RTE.
+    //! @param  target      Position of a light to sample points close to, points are sampled by free flight only if it is null.
+    //! @param  light_emission  Whether the emission of mediums sampled by lights is accounted.
     //! @return             Attenuation along the ray all the way to the sampled point.
-    Spectrum    Sample(const Ray& r, const float max_t, MediumInteraction*& mi, Spectrum& emission) const;
+    Spectrum    Sample(const Ray& r, const float max_t, MediumInteraction*& mi, Spectrum& emission, const Point* target = nullptr, const bool light_emission = true) const;
 
 public:
     /**< Mediums it holds. */
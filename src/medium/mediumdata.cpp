@@ -20,21 +20,27 @@
 #include "stream/stream.h"
 
 float MediumDensity::Sample(const Point& uvw) const {
-    return ImageTexture3D::Sample(uvw[0], uvw[1], uvw[2]);
+    return SparseTexture3D::Sample(uvw[0], uvw[1], uvw[2]);
 }
 
 void MediumDensity::Serialize(IStreamBase& stream) {
-    stream >> m_width >> m_height >> m_depth;
+    SparseTexture3D::Serialize(stream);
+    buildMajorantGrid();
+}
+
+bool MediumDensity::LoadNanoVDB(const std::string& filename, VolumeQuantization quantization) {
+    const auto ret = SparseTexture3D::LoadNanoVDB(filename, quantization);
+    buildMajorantGrid();
+    return ret;
+}
 
+void MediumDensity::buildMajorantGrid() {
     // make sure the dimension is valid.
     if (m_width == 0 || m_height == 0 || m_depth == 0)
         return;
 
-    const auto tex_cnt = m_width * m_height * m_depth;
-
-    m_memory = std::make_unique<ImgMemory<float>>();
-    m_memory->m_texel = std::make_unique<float[]>(tex_cnt);
-    stream.Load((char*)m_memory->m_texel.get(), sizeof(float) * tex_cnt);
+    const float cells_per_unit[3] = { (float)m_width / BRICK_SIZE , (float)m_height / BRICK_SIZE , (float)m_depth / BRICK_SIZE };
+    m_majorantGrid.Build(GetBrickMaximum(), m_brickRes, cells_per_unit);
 }
 
 Spectrum MediumColor::Sample(const Point& uvw) const {
@@ -19,15 +19,17 @@
 
 #include "core/define.h"
 #include "texture/imagetexture3d.h"
+#include "texture/sparsetexture3d.h"
+#include "majorant.h"
 
 struct Point;
 class IStreamBase;
 
 //! @brief  Medium density data structure allows variation of density inside a medium volume.
 /**
- * Medium density is essentially a 3D texture.
+ * Medium density is essentially a 3D texture. It is stored sparsely since most of a smoke simulation is usually empty.
  */
-class MediumDensity : public ImageTexture3D<float> {
+class MediumDensity : public SparseTexture3D {
 public:
     //! @brief  Take a sample in 3D texture.
     //!
@@ -40,6 +42,27 @@ public:
     //! @param  Stream  where the serialization data comes from. Depending on different situation,
     //!                 it could come from different places.
     void    Serialize(IStreamBase& stream);
+
+    //! @brief  Load the density from a NanoVDB file instead of the stream.
+    //!
+    //! @param  filename     Full path of the NanoVDB file.
+    //! @param  quantization How texels are stored.
+    //! @return              Whether the density is loaded.
+    bool    LoadNanoVDB(const std::string& filename, VolumeQuantization quantization);
+
+    //! @brief  Get the coarse grid of the maximum density.
+    //!
+    //! @return         The majorant grid, it is invalid if there is no density data.
+    const MajorantGrid& GetMajorantGrid() const {
+        return m_majorantGrid;
+    }
+
+private:
+    /**< Coarse grid of the maximum density in the texture. */
+    MajorantGrid    m_majorantGrid;
+
+    //! @brief  Build the majorant grid from the maximum of bricks.
+    void    buildMajorantGrid();
 };
 
 //! @brief  Medium color data structure allows variation of color inside a medium volume.
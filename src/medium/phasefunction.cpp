@@ -0,0 +1,115 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cstring>
+#include "phasefunction.h"
+
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
+#define SIMD_SSE_IMPLEMENTATION
+#include "simd/simd_wrapper.h"
+static_assert( MultiLobeHenyeyGreenstein::MAX_LOBE_CNT == SIMD_CHANNEL , "All lobes of the phase function are evaluated in one SIMD register." );
+#endif
+
+// Same limits as the single lobe Henyey-Greenstein phase function, lobes that are almost isotropic are treated
+// as isotropic ones and the asymmetry parameter never reaches 1 or -1.
+static constexpr float ISOTROPIC_THRESHOLD = 0.03f;
+static constexpr float MAX_ASYMMETRY = 0.995f;
+
+MultiLobeHenyeyGreenstein::MultiLobeHenyeyGreenstein( const float* g , const float* w , const unsigned cnt ){
+    auto total = 0.0f;
+    for( auto i = 0u ; i < cnt && i < MAX_LOBE_CNT ; ++i )
+        total += fmax( 0.0f , w[i] );
+
+    // fall back to an isotropic lobe if nothing is valid.
+    if( total <= 0.0f ){
+        m_scale[0] = INV_FOUR_PI;
+        m_cdf[0] = 1.0f;
+        m_lobeCnt = 1;
+        return;
+    }
+
+    auto cdf = 0.0f;
+    for( auto i = 0u ; i < cnt && i < MAX_LOBE_CNT ; ++i ){
+        const auto weight = fmax( 0.0f , w[i] ) / total;
+        if( weight <= 0.0f )
+            continue;
+
+        const auto k = m_lobeCnt++;
+        const auto gk = fabs( g[i] ) < ISOTROPIC_THRESHOLD ? 0.0f : clamp( g[i] , -MAX_ASYMMETRY , MAX_ASYMMETRY );
+        m_g[k] = gk;
+        m_onePlusSqrG[k] = 1.0f + SQR( gk );
+        m_twoG[k] = 2.0f * gk;
+        m_scale[k] = weight * ( 1.0f - SQR( gk ) ) * INV_FOUR_PI;
+
+        cdf += weight;
+        m_cdf[k] = cdf;
+    }
+
+    // avoid picking nothing because of floating point precision.
+    m_cdf[m_lobeCnt - 1] = 1.0f;
+}
+
+float MultiLobeHenyeyGreenstein::P( const Vector& wo , const Vector& wi ) const{
+    // The same denominator convention as the single lobe version, 1 + g^2 + 2*g*cos(theta), since both directions point outward.
+    const auto cos_theta = dot( wo , wi );
+
+    // Unused lanes have zero scale and zero asymmetry, they contribute nothing without any branch.
+    float p[MAX_LOBE_CNT];
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
+    const auto denom = simd_mad_ps( simd_set_ps( m_twoG ) , simd_set_ps1( cos_theta ) , simd_set_ps( m_onePlusSqrG ) );
+    const auto lobe = simd_div_ps( simd_set_ps( m_scale ) , simd_mul_ps( denom , simd_sqrt_ps( denom ) ) );
+    memcpy( p , &lobe , sizeof( p ) );
+#else
+    for( auto i = 0u ; i < MAX_LOBE_CNT ; ++i ){
+        const auto denom = m_onePlusSqrG[i] + m_twoG[i] * cos_theta;
+        p[i] = m_scale[i] / ( denom * sqrt( denom ) );
+    }
+#endif
+
+    return ( p[0] + p[1] ) + ( p[2] + p[3] );
+}
+
+float MultiLobeHenyeyGreenstein::Sample( const Vector& wo , Vector& wi , float& pdf ) const{
+    // pick a lobe by its weight
+    const auto u = sort_canonical();
+    auto k = 0u;
+    while( k < m_lobeCnt - 1 && u >= m_cdf[k] )
+        ++k;
+
+    const auto g = m_g[k];
+    if( g != 0.0f ){
+        // invert the cdf of the picked lobe, the same as the single lobe version.
+        const auto sqrG = m_onePlusSqrG[k] - 1.0f;
+        const auto r = sort_canonical();
+        const auto cos_theta = ( m_onePlusSqrG[k] - SQR( ( 1.0f - sqrG ) / ( 1 + g - m_twoG[k] * r ) ) ) / ( -m_twoG[k] );
+        const auto sin_theta = ssqrt( 1.0f - SQR( cos_theta ) );
+
+        const auto phi = TWO_PI * sort_canonical();
+        const auto tmp = sphericalVec( sin_theta , cos_theta , phi );
+
+        Vector t0, t1;
+        coordinateSystem( wo, t0, t1 );
+        wi = t0 * tmp.x + wo * tmp.y + t1 * tmp.z;
+    }else{
+        const auto v0 = sort_canonical();
+        const auto v1 = sort_canonical();
+        wi = UniformSampleSphere( v0 , v1 );
+    }
+
+    pdf = P( wo , wi );
+    return pdf;
+}
@@ -129,13 +129,10 @@ public:
             const auto phi = TWO_PI * sort_canonical();
             const auto tmp = sphericalVec( sin_theta , cos_theta , phi );
 
+            // the sampled direction is expressed in the frame built around the out-going direction.
             Vector t0, t1;
             coordinateSystem( wo, t0, t1 );
-            Matrix m(t0.x, wo.x, t1.x, 0.0f,
-                     t0.y, wo.y, t1.y, 0.0f,
-                     t0.z, wo.z, t1.z, 0.0f,
-                     0.0f, 0.0f, 0.0f, 1.0f);
-            wi = m.TransformVector(tmp);
+            wi = t0 * tmp.x + wo * tmp.y + t1 * tmp.z;
 
             pdf = evaluate( wo , wi );
         }else{
@@ -175,4 +172,52 @@ private:
 	SORT_FORCEINLINE float clampG( const float g ){
 		return clamp( g , -0.995f , 0.995f );
 	}
-};
\ No newline at end of file
+};
+//! @brief  Weighted mixture of several Henyey-Greenstein lobes.
+/**
+ * A single Henyey-Greenstein lobe can't capture both the strong forward peak and the soft back scattering of
+ * clouds, a blend of a forward and a backward lobe is the common approximation. Since there could be hundreds
+ * of scattering events in a dense volume, all lobes are evaluated at once in SIMD lanes, which is also why
+ * there are never more lobes than lanes.
+ *
+ * Sampling picks a lobe by its weight first and then inverts the cdf of that lobe, the pdf is the whole mixture.
+ */
+class MultiLobeHenyeyGreenstein : public PhaseFunction{
+public:
+    //! Maximum number of lobes, one lobe per SIMD lane.
+    static constexpr unsigned MAX_LOBE_CNT = 4;
+
+    //! @brief  Constructor.
+    //!
+    //! @param  g       Asymmetry parameters of the lobes.
+    //! @param  w       Weights of the lobes, they don't need to sum up to one.
+    //! @param  cnt     Number of lobes, anything beyond MAX_LOBE_CNT is ignored.
+    MultiLobeHenyeyGreenstein( const float* g , const float* w , const unsigned cnt );
+
+    //! @brief  Evaluation of the phase function.
+    //!
+    //! Just like BXDF definition, the directions passed in need to point from outside from
+    //! the same point of interest.
+    //!
+    //! @param  wo      Out-going direction.
+    //! @param  wi      Incoming direction.
+    //! @return         Evaluation of phase function.
+    float P( const Vector& wo , const Vector& wi ) const override;
+
+    //! @brief  Sample an incoming direction based on out-going direction.
+    //!
+    //! The pdf is exactly the phase function itself, just like a single Henyey-Greenstein lobe.
+    //!
+    //! @param wo       Out-going direction.
+    //! @param wi       Incoming direction.
+    //! @param pdf      Pdf of sampling the incoming direction.
+    float Sample( const Vector& wo , Vector& wi , float& pdf ) const override;
+
+private:
+    float       m_g[MAX_LOBE_CNT] = { 0.0f };               /**< Asymmetry parameter of each lobe. */
+    float       m_onePlusSqrG[MAX_LOBE_CNT] = { 1.0f , 1.0f , 1.0f , 1.0f };   /**< 1 + g^2 of each lobe. */
+    float       m_twoG[MAX_LOBE_CNT] = { 0.0f };            /**< 2 * g of each lobe. */
+    float       m_scale[MAX_LOBE_CNT] = { 0.0f };           /**< Normalized weight * ( 1 - g^2 ) / ( 4 * PI ) of each lobe. */
+    float       m_cdf[MAX_LOBE_CNT] = { 0.0f };             /**< Cumulative normalized weights to pick a lobe. */
+    unsigned    m_lobeCnt = 0;                              /**< Number of lobes with non-zero weight. */
+};
@@ -24,8 +24,7 @@ void RandomSampler::Generate1D( float* sample , unsigned num , bool accept_unifo
 {
     sAssert( sample != 0 , SAMPLING );
 
-    for( unsigned i = 0 ; i < num ; ++i )
-        sample[i] = sort_canonical();
+    sort_canonical( sample , num );
 }
 
 // generate sample in two dimension
@@ -33,10 +32,5 @@ void RandomSampler::Generate2D( float* sample , unsigned num , bool accept_unifo
 {
     sAssert( sample != 0 , SAMPLING );
 
-    int count = 2 * num;
-    for( int i = 0 ; i < count ; i += 2 )
-    {
-        sample[i] = sort_canonical();
-        sample[i+1] = sort_canonical();
-    }
+    sort_canonical( sample , 2 * num );
 }
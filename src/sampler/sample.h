@@ -23,6 +23,21 @@
 #include "core/rand.h"
 #include "core/define.h"
 
+//! @brief  Draw the next dimension of the current pixel sample from the sampler bound to the thread.
+//!
+//! It falls back to 'sort_canonical' if there is no sampler bound to the thread.
+//!
+//! @return     A canonical number in [0,1).
+float   sort_sample_1d();
+
+//! @brief  Draw the next dimension of the current pixel sample as a pair of canonical numbers.
+//!
+//! It falls back to 'sort_canonical' if there is no sampler bound to the thread.
+//!
+//! @param  u   The first canonical number in [0,1).
+//! @param  v   The second canonical number in [0,1).
+void    sort_sample_2d( float& u , float& v );
+
 // Light Sample
 class   LightSample
 {
@@ -39,9 +54,8 @@ public:
     {
         if( auto_generate )
         {
-            t = sort_canonical();
-            u = sort_canonical();
-            v = sort_canonical();
+            t = sort_sample_1d();
+            sort_sample_2d( u , v );
         }else
         {
             t = 0.0f;
@@ -62,9 +76,8 @@ public:
     // default constructor
     BsdfSample(bool auto_generate=false){
         if( auto_generate ){
-            t = sort_canonical();
-            u = sort_canonical();
-            v = sort_canonical();
+            t = sort_sample_1d();
+            sort_sample_2d( u , v );
         }else{
             t = 0.0f;
             v = 0.0f;
@@ -88,6 +101,10 @@ public:
     float                           img_u = 0.0f;
     float                           img_v = 0.0f;   // the range of the float2 should be (0,0) <-> (1,1)
     float                           dof_u , dof_v;  // the range of the float2 should be (-1,-1) <-> (1,1)
+    float                           time = 0.0f;    // moment in the shutter interval, the range should be [0,1)
+    int                             pixel_x = 0;
+    int                             pixel_y = 0;    // the pixel that the sample belongs to
+    unsigned                        index = 0;      // index of the sample in the pixel
     std::unique_ptr<LightSample[]>  light_sample = nullptr;
     std::unique_ptr<BsdfSample[]>   bsdf_sample = nullptr;
     std::vector<unsigned>           light_dimension;
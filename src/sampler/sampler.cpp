@@ -16,6 +16,8 @@
  */
 
 #include "sampler.h"
+#include "math/ray.h"
+#include "core/workercontext.h"
 
 // default constructor
 Sampler::Sampler()
@@ -26,3 +28,35 @@ Sampler::Sampler()
 Sampler::~Sampler()
 {
 }
+
+void BindSampler( Sampler* sampler ){
+    GetWorkerContext().sampler = sampler;
+}
+
+void SuspendSample( SampleCursor& cursor ){
+    const auto sampler = GetWorkerContext().sampler;
+    cursor.dimension = sampler ? sampler->GetDimension() : 0;
+    cursor.random = sort_get_state();
+    cursor.time = GetRayTime();
+}
+
+void ResumeSample( const SampleCursor& cursor ){
+    if( const auto sampler = GetWorkerContext().sampler )
+        sampler->StartPixelSample( cursor.x , cursor.y , cursor.index , cursor.dimension );
+    sort_set_state( cursor.random );
+    SetRayTime( cursor.time );
+}
+
+float sort_sample_1d(){
+    const auto sampler = GetWorkerContext().sampler;
+    return sampler ? sampler->Get1D() : sort_canonical();
+}
+
+void sort_sample_2d( float& u , float& v ){
+    if( const auto sampler = GetWorkerContext().sampler ){
+        sampler->Get2D( u , v );
+        return;
+    }
+    u = sort_canonical();
+    v = sort_canonical();
+}
@@ -23,10 +23,13 @@
 #include "sample.h"
 #include "core/memory.h"
 #include "core/rtti.h"
+#include "core/rand.h"
 
-// WARNING: Code in this folder is very outdated. Not even functional.
-//          The whole sampler implementation will be redesigned later.
-//          But the priority is relatively low for now.
+// WARNING: The array based interface 'Generate1D/Generate2D' is very outdated. Samples are drawn one dimension after
+//          another through 'Get1D/Get2D' instead.
+
+//! @brief  Number of dimensions consumed by the camera for each pixel sample, image plane, lens and shutter time.
+constexpr unsigned SAMPLER_CAMERA_DIMENSIONS = 3;
 
 /////////////////////////////////////////////////////////////////////////////////
 // definitation of the sampler
@@ -53,4 +56,69 @@ public:
     // para 'sample' : the memory to save the sampled data
     // para 'num'    : the number of samples to be generated
     virtual void Generate2D( float* sample , unsigned num , bool accept_uniform = false ) const = 0;
+
+    //! @brief  Start a new sample of a pixel.
+    //!
+    //! Dimensions of the sample are drawn one after another afterward. Each call of 'Get1D' or 'Get2D' consumes exactly
+    //! one dimension, no matter how many numbers it returns.
+    //!
+    //! @param  x           Horizontal coordinate of the pixel.
+    //! @param  y           Vertical coordinate of the pixel.
+    //! @param  index       Index of the sample in the pixel.
+    //! @param  dimension   The first dimension to be drawn, dimensions before it are skipped.
+    virtual void    StartPixelSample( int x , int y , unsigned index , unsigned dimension = 0 ) {}
+
+    //! @brief  Get the next dimension of the current sample to be drawn.
+    //!
+    //! @return     The dimension, samplers that don't tell dimensions apart always return zero.
+    virtual unsigned GetDimension() const {
+        return 0;
+    }
+
+    //! @brief  Draw the next dimension of the current sample.
+    //!
+    //! @return     A canonical number in [0,1).
+    virtual float   Get1D() {
+        return sort_canonical();
+    }
+
+    //! @brief  Draw the next dimension of the current sample, it is made of two canonical numbers.
+    //!
+    //! @param  u   The first canonical number in [0,1).
+    //! @param  v   The second canonical number in [0,1).
+    virtual void    Get2D( float& u , float& v ) {
+        u = sort_canonical();
+        v = sort_canonical();
+    }
 };
+
+//! @brief  Bind a sampler to the current thread.
+//!
+//! Integrators draw the samples of every bounce from the sampler bound to the thread, there is no need to pass it
+//! through all the interfaces.
+//!
+//! @param  sampler     The sampler to be bound, nullptr falls back to pure random numbers.
+void    BindSampler( Sampler* sampler );
+
+//! @brief  Where a pixel sample drawn on the current thread is left off.
+//!
+//! A pixel sample can be suspended and resumed later, the samples drawn after resuming it are exactly the same as the
+//! ones that would be drawn without suspending it. It makes it possible to interleave the bounces of different paths.
+struct SampleCursor{
+    int             x = 0;              /**< Horizontal coordinate of the pixel. */
+    int             y = 0;              /**< Vertical coordinate of the pixel. */
+    unsigned        index = 0;          /**< Index of the sample in the pixel. */
+    unsigned        dimension = 0;      /**< The next dimension to be drawn. */
+    RandomState     random;             /**< State of the random number generator. */
+    float           time = 0.0f;        /**< Moment in the shutter interval of the rays of the sample. */
+};
+
+//! @brief  Save where the current sample of the sampler bound to the thread is left off.
+//!
+//! @param  cursor      The cursor of the sample, its pixel and index are expected to be filled already.
+void    SuspendSample( SampleCursor& cursor );
+
+//! @brief  Resume a pixel sample on the sampler bound to the thread.
+//!
+//! @param  cursor      The cursor saved when the sample was suspended.
+void    ResumeSample( const SampleCursor& cursor );
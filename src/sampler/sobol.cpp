@@ -0,0 +1,114 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "sobol.h"
+#include "core/sassert.h"
+
+// the largest float that is smaller than one
+static constexpr float ONE_MINUS_EPSILON = 0x1.fffffep-1f;
+
+// hash of the two integers, it mixes the bits well enough for seeding scramblings
+SORT_STATIC_FORCEINLINE unsigned hash( unsigned a , unsigned b ){
+    auto h = a * 0x9e3779b9u ^ ( b + 0x7f4a7c15u );
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+SORT_STATIC_FORCEINLINE unsigned reverseBits( unsigned x ){
+    x = ( x << 16 ) | ( x >> 16 );
+    x = ( ( x & 0x00ff00ffu ) << 8 ) | ( ( x & 0xff00ff00u ) >> 8 );
+    x = ( ( x & 0x0f0f0f0fu ) << 4 ) | ( ( x & 0xf0f0f0f0u ) >> 4 );
+    x = ( ( x & 0x33333333u ) << 2 ) | ( ( x & 0xccccccccu ) >> 2 );
+    x = ( ( x & 0x55555555u ) << 1 ) | ( ( x & 0xaaaaaaaau ) >> 1 );
+    return x;
+}
+
+// Owen scrambling of the bits in reversed order, the higher bits only affect the lower bits.
+SORT_STATIC_FORCEINLINE unsigned nestedUniformScramble( unsigned x , const unsigned seed ){
+    x = reverseBits( x );
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return reverseBits( x );
+}
+
+// the first dimension of the Sobol sequence is the van der Corput sequence
+SORT_STATIC_FORCEINLINE unsigned sobol0( const unsigned index ){
+    return reverseBits( index );
+}
+
+// the second dimension of the Sobol sequence, its generator matrix is the Pascal matrix modulo two
+SORT_STATIC_FORCEINLINE unsigned sobol1( unsigned index ){
+    auto r = 0u;
+    for( auto v = 1u << 31 ; index ; index >>= 1 , v ^= v >> 1 ){
+        if( index & 1 )
+            r ^= v;
+    }
+    return r;
+}
+
+SORT_STATIC_FORCEINLINE float toCanonical( const unsigned x ){
+    return std::min( (float)x * 0x1p-32f , ONE_MINUS_EPSILON );
+}
+
+void SobolSampler::Generate1D( float* sample , unsigned num , bool accept_uniform ) const{
+    sAssert( sample != 0 , SAMPLING );
+
+    const auto seed = sort_rand();
+    for( auto i = 0u ; i < num ; ++i )
+        sample[i] = toCanonical( nestedUniformScramble( sobol0( i ) , seed ) );
+}
+
+void SobolSampler::Generate2D( float* sample , unsigned num , bool accept_uniform ) const{
+    sAssert( sample != 0 , SAMPLING );
+
+    const auto seed0 = sort_rand();
+    const auto seed1 = sort_rand();
+    for( auto i = 0u ; i < num ; ++i ){
+        sample[2 * i] = toCanonical( nestedUniformScramble( sobol0( i ) , seed0 ) );
+        sample[2 * i + 1] = toCanonical( nestedUniformScramble( sobol1( i ) , seed1 ) );
+    }
+}
+
+void SobolSampler::StartPixelSample( int x , int y , unsigned index , unsigned dimension ){
+    m_pixelSeed = hash( (unsigned)x , (unsigned)y );
+    m_index = index;
+    m_dimension = dimension;
+}
+
+float SobolSampler::Get1D(){
+    const auto seed = hash( m_pixelSeed , m_dimension++ );
+
+    // shuffling the index decorrelates this dimension from the others
+    const auto index = nestedUniformScramble( m_index , seed );
+    return toCanonical( nestedUniformScramble( sobol0( index ) , hash( seed , 0 ) ) );
+}
+
+void SobolSampler::Get2D( float& u , float& v ){
+    const auto seed = hash( m_pixelSeed , m_dimension++ );
+
+    // shuffling the index decorrelates this dimension from the others
+    const auto index = nestedUniformScramble( m_index , seed );
+    u = toCanonical( nestedUniformScramble( sobol0( index ) , hash( seed , 0 ) ) );
+    v = toCanonical( nestedUniformScramble( sobol1( index ) , hash( seed , 1 ) ) );
+}
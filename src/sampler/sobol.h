@@ -0,0 +1,83 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "sampler.h"
+
+//! @brief  Owen scrambled Sobol sampler with padded dimensions.
+/**
+ * Each dimension of a pixel sample is drawn from the first two dimensions of the Sobol sequence, which form a (0,2)
+ * sequence in base two. Such a sequence has the same stratification as progressive multi-jittered (0,2) samples, every
+ * power of two prefix of it is stratified in all elementary intervals.
+ * Rather than going deeper in the Sobol sequence for higher dimensions, every dimension of every pixel is decorrelated
+ * with the others by hash based nested uniform scrambling of both the sample index and the sample values, which is
+ * known as padding. The scrambling is an Owen scrambling, it keeps the stratification and makes the estimator unbiased.
+ * There is no precomputed table at all, only the sample index, pixel and dimension are needed to draw a sample.
+ *
+ * Practical Hash-based Owen Scrambling
+ * http://www.jcgt.org/published/0009/04/01/
+ */
+class SobolSampler : public Sampler{
+public:
+    DEFINE_RTTI( SobolSampler , Sampler );
+
+    //! @brief  Generate samples in one dimension, a random scrambling is picked each time.
+    //!
+    //! @param  sample          The memory to save the sampled data.
+    //! @param  num             The number of samples to be generated.
+    //! @param  accept_uniform  Not used.
+    void    Generate1D( float* sample , unsigned num , bool accept_uniform = false ) const override;
+
+    //! @brief  Generate samples in two dimension, a random scrambling is picked each time.
+    //!
+    //! @param  sample          The memory to save the sampled data.
+    //! @param  num             The number of samples to be generated.
+    //! @param  accept_uniform  Not used.
+    void    Generate2D( float* sample , unsigned num , bool accept_uniform = false ) const override;
+
+    //! @brief  Start a new sample of a pixel.
+    //!
+    //! @param  x           Horizontal coordinate of the pixel.
+    //! @param  y           Vertical coordinate of the pixel.
+    //! @param  index       Index of the sample in the pixel.
+    //! @param  dimension   The first dimension to be drawn, dimensions before it are skipped.
+    void    StartPixelSample( int x , int y , unsigned index , unsigned dimension = 0 ) override;
+
+    //! @brief  Get the next dimension of the current sample to be drawn.
+    //!
+    //! @return     The dimension.
+    unsigned GetDimension() const override {
+        return m_dimension;
+    }
+
+    //! @brief  Draw the next dimension of the current sample.
+    //!
+    //! @return     A canonical number in [0,1).
+    float   Get1D() override;
+
+    //! @brief  Draw the next dimension of the current sample, it is made of two canonical numbers.
+    //!
+    //! @param  u   The first canonical number in [0,1).
+    //! @param  v   The second canonical number in [0,1).
+    void    Get2D( float& u , float& v ) override;
+
+private:
+    unsigned    m_pixelSeed = 0;    /**< Hash of the pixel coordinate. */
+    unsigned    m_index = 0;        /**< Index of the current sample in the pixel. */
+    unsigned    m_dimension = 0;    /**< The next dimension to be drawn. */
+};
@@ -103,6 +103,40 @@ public:
         return pdf( bsdfToBxdf(wo) , bsdfToBxdf(wi) );
     }
 
+    //! @brief  Rough estimation of the directional albedo of the bxdf, evaluation weight is not counted.
+    //!
+    //! The estimation only drives how often the bxdf is picked among the lobes of a scattering event, it doesn't need
+    //! to be accurate and it never scales the evaluated value.
+    //!
+    //! @param  wo      The exitant direction in local space.
+    //! @return         Fraction of energy from the exitant direction that is scattered by the bxdf.
+    Spectrum Albedo( const Vector& wo ) const{
+        return albedo( bsdfToBxdf(wo) );
+    }
+
+    //! @brief  Approximate the lobe of the bxdf around an exitant direction with a von Mises-Fisher distribution.
+    //!
+    //! Only glossy lobes that are reasonably close to a vMF distribution need to implement it, light sources use the
+    //! lobe to sample the product of their emission and the bxdf.
+    //!
+    //! @param  wo      The exitant direction in local space.
+    //! @param  axis    The center of the lobe in local space.
+    //! @param  kappa   The concentration of the lobe.
+    //! @return         Whether the bxdf could be approximated by a vMF lobe.
+    virtual bool    GetVMFLobe( const Vector& wo , Vector& axis , float& kappa ) const {
+        return false;
+    }
+
+    //! @brief  Whether the bxdf is a Dirac delta function.
+    //!
+    //! Directions of a delta bxdf can only be picked by sampling the bxdf itself, evaluating it or its pdf with any
+    //! other direction returns zero.
+    //!
+    //! @return         Whether the bxdf is a delta function.
+    virtual bool    IsDelta() const {
+        return false;
+    }
+
     //! @brief  Check the type of the bxdf, it shouldn't be overridden by derived classes.
     //!
     //! @param type     The type to check.
@@ -152,6 +186,17 @@ protected:
     //! @return     The probability of choosing the out-going direction based on the Incident direction.
     virtual float pdf( const Vector& wo , const Vector& wi ) const;
 
+    //! @brief  Rough estimation of the directional albedo of the bxdf.
+    //!
+    //! The default implementation knows nothing about the bxdf, all of them are treated as white so that the lobe is
+    //! picked purely based on its sample weight.
+    //!
+    //! @param wo   Exitant direction in shading coordinate.
+    //! @return     Fraction of energy from the exitant direction that is scattered by the bxdf.
+    virtual Spectrum albedo( const Vector& wo ) const{
+        return WHITE_SPECTRUM;
+    }
+
     //! @brief  Helper function to decide if a vector is pointing on the other side of the primitive.
     //!
     //! The sideness is decided by geometry normal instead of shading normal.
@@ -17,6 +17,7 @@
 
 #include "coat.h"
 #include "sampler/sample.h"
+#include "core/globalconfig.h"
 
 IMPLEMENT_CLOSURE_TYPE_BEGIN(ClosureTypeCoat)
 IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeCoat, Tsl_closure, closure)
@@ -30,10 +31,102 @@ IMPLEMENT_CLOSURE_TYPE_END(ClosureTypeCoat)
 // when evaluating the attenuation upward. The exact number is not mentioned in the original paper, 0.2 is used as default here.
 #define TIR_COMPENSATION    0.2f
 
+// Directional albedo of the coating layer, a rough dielectric interface with GGX distribution, tabulated by the cosine of
+// the exitant direction, the roughness and the index of refraction. It tells how much energy is reflected by the coating
+// before anything reaches the bottom layer, unlike the fresnel term, it accounts for the roughness of the coating.
+class CoatAlbedoTable{
+public:
+    CoatAlbedoTable(){
+        for( auto k = 0u ; k < TABLE_SIZE ; ++k ){
+            const auto ior = IOR_MIN + ( IOR_MAX - IOR_MIN ) * k / ( TABLE_SIZE - 1 );
+            const FresnelDielectric fresnel( 1.0f , ior );
+            for( auto j = 0u ; j < TABLE_SIZE ; ++j ){
+                const auto roughness = (float)j / ( TABLE_SIZE - 1 );
+                const GGX ggx( roughness , roughness );
+                const MicroFacetReflection mf( WHITE_SPECTRUM , &fresnel , &ggx , FULL_WEIGHT , DIR_UP );
+                for( auto i = 0u ; i < TABLE_SIZE ; ++i ){
+                    const auto cos_theta = std::max( COS_MIN , (float)i / ( TABLE_SIZE - 1 ) );
+                    const auto wo = Vector( std::sqrt( 1.0f - cos_theta * cos_theta ) , cos_theta , 0.0f );
+
+                    // stratified samples make the table deterministic
+                    auto total = 0.0f;
+                    for( auto v = 0u ; v < SAMPLE_SIZE ; ++v ){
+                        for( auto u = 0u ; u < SAMPLE_SIZE ; ++u ){
+                            BsdfSample bs;
+                            bs.u = ( u + 0.5f ) / SAMPLE_SIZE;
+                            bs.v = ( v + 0.5f ) / SAMPLE_SIZE;
+                            Vector wi;
+                            auto pdf = 0.0f;
+                            const auto f = mf.sample_f( wo , wi , bs , &pdf );
+                            if( pdf > 0.0f )
+                                total += f.GetIntensity() / pdf;
+                        }
+                    }
+                    m_albedo[k][j][i] = std::min( 1.0f , total / ( SAMPLE_SIZE * SAMPLE_SIZE ) );
+                }
+            }
+        }
+    }
+
+    // trilinear interpolation of the albedo, out of range parameters are clamped
+    float Lookup( float cos_theta , float roughness , float ior ) const {
+        const auto locate = []( float x , unsigned& i , float& t ){
+            x = clamp( x , 0.0f , 1.0f ) * ( TABLE_SIZE - 1 );
+            i = std::min( (unsigned)x , TABLE_SIZE - 2 );
+            t = x - i;
+        };
+        unsigned i , j , k;
+        float ti , tj , tk;
+        locate( cos_theta , i , ti );
+        locate( roughness , j , tj );
+        locate( ( ior - IOR_MIN ) / ( IOR_MAX - IOR_MIN ) , k , tk );
+
+        const auto bilinear = [&]( unsigned k ){
+            const auto a = slerp( m_albedo[k][j][i] , m_albedo[k][j][i+1] , ti );
+            const auto b = slerp( m_albedo[k][j+1][i] , m_albedo[k][j+1][i+1] , ti );
+            return slerp( a , b , tj );
+        };
+        return slerp( bilinear( k ) , bilinear( k + 1 ) , tk );
+    }
+
+private:
+    static constexpr unsigned   TABLE_SIZE = 16;        /**< Number of entries along each dimension. */
+    static constexpr unsigned   SAMPLE_SIZE = 8;        /**< Number of stratified samples along each dimension per entry. */
+    static constexpr float      IOR_MIN = 1.0f;         /**< Minimum index of refraction in the table. */
+    static constexpr float      IOR_MAX = 3.0f;         /**< Maximum index of refraction in the table. */
+    static constexpr float      COS_MIN = 0.01f;        /**< Exitant directions are kept off the horizon. */
+
+    float   m_albedo[TABLE_SIZE][TABLE_SIZE][TABLE_SIZE];   /**< Albedo indexed by ior, roughness and cosine. */
+};
+
+// The table is built the first time a coat is shaded.
+static const CoatAlbedoTable& coatAlbedo(){
+    static const CoatAlbedoTable table;
+    return table;
+}
+
 Coat::Coat( const ClosureTypeCoat& params , const Spectrum& weight, const ScatteringEvent* bottom )
- : Bxdf(weight, (BXDF_TYPE)(BXDF_DIFFUSE | BXDF_REFLECTION), params.normal, false), thickness(1.0f), ior(params.ior), sigma(params.sigma), ggx(params.roughness, params.roughness),
+ : Bxdf(weight, (BXDF_TYPE)(BXDF_DIFFUSE | BXDF_REFLECTION), params.normal, false), thickness(1.0f), ior(params.ior), roughness(params.roughness),
+   stochastic(g_stochasticCoat), sigma(params.sigma), ggx(params.roughness, params.roughness),
    fresnel(1.0f,params.ior), coat_weight( 1.0f ), coat(coat_weight, &fresnel , &ggx , coat_weight , params.normal ), bottom( bottom ){}
 
+float Coat::topLayerProbability( const Vector& swo , const Vector& r_wo ) const{
+    const auto attenuation = ( -thickness * sigma * 2.0f / absCosTheta(r_wo) ).Exp();
+    const auto I1 = coatAlbedo().Lookup( cosTheta(swo) , roughness , ior );
+    const auto I2 = ( 1.0f - I1 ) * ( 1.0f - I1 ) * attenuation.GetIntensity() / ( ior * ior );
+    return I1 + I2 > 0.0f ? I1 / ( I1 + I2 ) : 1.0f;
+}
+
+Spectrum Coat::bottomLayer( const Vector& swo , const Vector& swi , const Vector& r_wo , const Vector& r_wi ) const{
+    // Bouguer-Lambert-Beer law
+    const auto attenuation = ( -thickness * sigma * (1.0f / absCosTheta(r_wo) + 1.0f / absCosTheta(r_wi))).Exp();
+    // Fresnel attenuation between the boundary across layer0 and layer1
+    const auto T12 = (1.0f - fresnel.Evaluate(cosTheta(swo)));
+    const auto T21 = slerp( 1.0f - fresnel.Evaluate(cosTheta(swi)), 1.0f, TIR_COMPENSATION);
+
+    return bottom->Evaluate_BSDF( -r_wo , -r_wi ) * attenuation * T12 * T21 / ( ior * ior );
+}
+
 Spectrum Coat::F( const Vector& wo , const Vector& wi ) const{
     if (!SameHemiSphere(wo, wi)) return 0.0f;
     if (!PointingUp(wo)) return 0.0f;
@@ -41,20 +134,21 @@ Spectrum Coat::F( const Vector& wo , const Vector& wi ) const{
     const auto swo = bsdfToBxdf( wo );
     const auto swi = bsdfToBxdf( wi );
 
-    auto ret = coat.f(swo, swi);
     auto tir_o = false, tir_i = false;
     const auto r_wo = refract(swo, DIR_UP, ior, 1.0f, tir_o);
     const auto r_wi = refract(swi, DIR_UP, ior, 1.0f, tir_i);
-    if (!tir_o && !tir_i) {
-        // Bouguer-Lambert-Beer law
-        const auto attenuation = ( -thickness * sigma * (1.0f / absCosTheta(r_wo) + 1.0f / absCosTheta(r_wi))).Exp();
-        // Fresnel attenuation between the boundary across layer0 and layer1
-        const auto T12 = (1.0f - fresnel.Evaluate(cosTheta(swo)));
-        const auto T21 = slerp( 1.0f - fresnel.Evaluate(cosTheta(swi)), 1.0f, TIR_COMPENSATION);
 
-        ret += bottom->Evaluate_BSDF( -r_wo , -r_wi ) * attenuation * T12 * T21 / ( ior * ior );
+    if( stochastic ){
+        // only one of the layers is evaluated, the other one is accounted by scaling it up
+        const auto top_prob = topLayerProbability( swo , r_wo );
+        if( sort_canonical() < top_prob )
+            return coat.f( swo , swi ) / top_prob;
+        return ( tir_o || tir_i ) ? Spectrum( 0.0f ) : bottomLayer( swo , swi , r_wo , r_wi ) / ( 1.0f - top_prob );
     }
 
+    auto ret = coat.f(swo, swi);
+    if (!tir_o && !tir_i)
+        ret += bottomLayer( swo , swi , r_wo , r_wi );
     return ret;
 }
 
@@ -64,11 +158,7 @@ Spectrum Coat::Sample_F( const Vector& wo , Vector& wi , const BsdfSample& bs ,
 
     auto tir_o = false , tir_i = false;
     const auto r_wo = refract(swo, DIR_UP, ior, 1.0f, tir_o);
-    Vector r_wi;
-    const auto attenuation = ( -thickness * sigma * 2.0f / absCosTheta(r_wo) ).Exp();
-    const auto I1 = fresnel.Evaluate(cosTheta(swo)).GetIntensity();
-    const auto I2 = ( 1.0f - I1 ) * ( 1.0f - I1 ) * attenuation.GetIntensity() / ( ior * ior );
-    const auto specProp = I1 / ( I1 + I2 );
+    const auto specProp = topLayerProbability( swo , r_wo );
 
     Spectrum ret;
     auto nbs = BsdfSample(true);
@@ -78,14 +168,14 @@ Spectrum Coat::Sample_F( const Vector& wo , Vector& wi , const BsdfSample& bs ,
         wi = bxdfToBsdf(swi);
 
         auto r_wi = refract(swi, DIR_UP, ior, 1.0f, tir_i);
-        if (!tir_o && !tir_i) {
-            // Bouguer-Lambert-Beer law
-            const auto attenuation = (-thickness * sigma * (1.0f / absCosTheta(r_wo) + 1.0f / absCosTheta(r_wi))).Exp();
-            // Fresnel attenuation between the boundary across layer0 and layer1
-            const auto T12 = (1.0f - fresnel.Evaluate(cosTheta(swo)));
-            const auto T21 = slerp(1.0f - fresnel.Evaluate(cosTheta(swi)), 1.0f, TIR_COMPENSATION);
-
-            ret += bottom->Evaluate_BSDF(-r_wo, -r_wi) * attenuation * T12 * T21 / (ior * ior);
+        if( stochastic ){
+            // the bottom layer is evaluated only if it is picked, the value is still unbiased
+            if( sort_canonical() < specProp )
+                ret /= specProp;
+            else
+                ret = ( tir_o || tir_i ) ? Spectrum( 0.0f ) : bottomLayer( swo , swi , r_wo , r_wi ) / ( 1.0f - specProp );
+        }else if (!tir_o && !tir_i) {
+            ret += bottomLayer( swo , swi , r_wo , r_wi );
         }
 
         if(pPdf)
@@ -114,7 +204,8 @@ Spectrum Coat::Sample_F( const Vector& wo , Vector& wi , const BsdfSample& bs ,
         const auto T12 = (1.0f - fresnel.Evaluate(cosTheta(swo)));
         const auto T21 = slerp(1.0f - fresnel.Evaluate(cosTheta(swi)), 1.0f, TIR_COMPENSATION);
 
-        ret *= attenuation * T12 * T21 / (ior * ior);
+        // the coating layer reflects some light in the direction too, it is as cheap as it gets to evaluate
+        ret = ret * attenuation * T12 * T21 / (ior * ior) + coat.f( swo , swi );
 
         if( pPdf )
             *pPdf = slerp(*pPdf, coat.pdf( swo , swi ) , specProp);
@@ -138,10 +229,7 @@ float Coat::Pdf( const Vector& wo , const Vector& wi ) const{
     auto tir_o = false , tir_i = false;
     const auto r_wo = refract(swo, DIR_UP, ior, 1.0f, tir_o);
     const auto r_wi = refract(swi, DIR_UP, ior, 1.0f, tir_i);
-    const auto attenuation = ( -thickness * sigma * 2.0f / absCosTheta(r_wo) ).Exp();
-    const auto I1 = fresnel.Evaluate(cosTheta(swo)).GetIntensity();
-    const auto I2 = ( 1.0f - I1 ) * ( 1.0f - I1 ) * attenuation.GetIntensity() / ( ior * ior );
-    const auto specProp = I1 / ( I1 + I2 );
+    const auto specProp = topLayerProbability( swo , r_wo );
 
     const auto layer0_pdf = coat.pdf( swo , swi );
     const auto layer1_pdf = (tir_o || tir_i) ? 0.0f : bottom->Pdf_BSDF(-r_wo, -r_wi);
@@ -45,6 +45,12 @@ DECLARE_CLOSURE_TYPE_END(ClosureTypeCoat)
  * Due to the assumption made in the algorithm, there is no support for coating BSSRDF materials since the exit position and enter position are different,
  * leading to failure of some assumptions in the original algorithm, for which reason, SORT will fall back to Lambert for all BSSRDF materials under the coating
  * layer.
+ *
+ * Evaluating the coating always evaluates the bottom layer as well, which could be a whole stack of lobes by itself. Once it
+ * is enabled, the stochastic mode evaluates only one of the two layers, picked by the energy the coating reflects. The energy
+ * is looked up in a table of the directional albedo of the coating, the contribution of the picked layer is scaled by the
+ * reciprocal of its probability so that the BRDF is still evaluated without bias, but with some noise. The pdf is always
+ * evaluated exactly, it is needed by multiple importance sampling.
  */
 class Coat : public Bxdf{
 public:
@@ -82,6 +88,8 @@ public:
 private:
     const float thickness ;     /**< Thickness of the layer. */
     const float ior ;           /**< Index of refraction out side the surface where the normal points. */
+    const float roughness ;     /**< Roughness of the coating layer. */
+    const bool  stochastic ;    /**< Whether only one of the layers is evaluated at a time. */
     const Spectrum sigma;       /**< Sigma of the BRDF model. */
 
     const GGX                   ggx;            /**< Using GGX as default NDF. */
@@ -90,6 +98,22 @@ private:
     const MicroFacetReflection  coat;           /**< Using Microfacet as coated layer. */
     const ScatteringEvent*      bottom;         /**< Bottom layer. */
 
+    //! @brief Probability of picking the top layer, it is the share of the energy reflected by the coating.
+    //!
+    //! @param swo      Exitant direction in shading coordinate of the bxdf.
+    //! @param r_wo     Exitant direction refracted into the coating layer.
+    //! @return         Probability of picking the top layer, the bottom layer takes the rest.
+    float   topLayerProbability( const Vector& swo , const Vector& r_wo ) const;
+
+    //! @brief Evaluate the bottom layer seen through the coating layer.
+    //!
+    //! @param swo      Exitant direction in shading coordinate of the bxdf.
+    //! @param swi      Incident direction in shading coordinate of the bxdf.
+    //! @param r_wo     Exitant direction refracted into the coating layer.
+    //! @param r_wi     Incident direction refracted into the coating layer.
+    //! @return         The bottom layer attenuated by the coating layer.
+    Spectrum bottomLayer( const Vector& swo , const Vector& swi , const Vector& r_wo , const Vector& r_wi ) const;
+
     Spectrum f( const Vector& wo , const Vector& wi ) const override{
         sAssertMsg( false , MATERIAL , "This function shouldn't be called" );
         return 0.0f;
@@ -21,6 +21,7 @@
 #include "core/sassert.h"
 #include "lambert.h"
 #include "microfacet.h"
+#include "energycompensation.h"
 #include "core/memory.h"
 #include "math/exp.h"
 #include "material/tsl_utils.h"
@@ -74,6 +75,43 @@ constexpr static float burley_max_r_d = 16.0f;
 constexpr static float burley_max_cdf = burley_max_cdf_calc( burley_max_r_d );
 constexpr static float burley_inv_max_cdf = 1.0f / burley_max_cdf;
 
+//! @brief  Tabulated exponential terms of the Burley reflectance profile.
+//!
+//! Both the profile and its pdf only depend on the distance normalized by the per-channel scatter distance, which is the output
+//! of the shader and can't be known before rendering. The normalized part, exp(-x) + exp(-x/3), is the same for any material
+//! though and is tabulated once instead of evaluating two exponentials per channel for every lookup.
+class BurleyProfileTable{
+public:
+    //! @brief  Tabulate the profile in [0, burley_max_r_d].
+    BurleyProfileTable(){
+        for( auto i = 0u ; i <= TABLE_SIZE ; ++i ){
+            const auto x = (float)i * burley_max_r_d / TABLE_SIZE;
+            m_table[i] = exp( -x ) + exp( -x / 3.0f );
+        }
+    }
+
+    //! @brief  Evaluate exp(-x) + exp(-x/3).
+    //!
+    //! @param  x       Distance normalized by the scatter distance.
+    //! @return         The exponential terms of the profile.
+    SORT_FORCEINLINE float Evaluate( const float x ) const {
+        // samples beyond the sampling range only happen for channels other than the sampled one.
+        if( UNLIKELY( x >= burley_max_r_d ) )
+            return exp( -x ) + exp( -x / 3.0f );
+
+        const auto fi = x * ( TABLE_SIZE / burley_max_r_d );
+        const auto i = (unsigned)fi;
+        const auto t = fi - (float)i;
+        return m_table[i] + ( m_table[i+1] - m_table[i] ) * t;
+    }
+
+private:
+    static constexpr unsigned TABLE_SIZE = 1024;    /**< Number of intervals in the table. */
+    float m_table[TABLE_SIZE + 1];                  /**< Profile at the end points of all intervals. */
+};
+
+static const BurleyProfileTable g_burleyProfile;
+
 float ClearcoatGGX::D(const Vector& h) const {
     // D(h) = ( alpha^2 - 1 ) / ( 2 * PI * ln(alpha) * ( 1 + ( alpha^2 - 1 ) * cos(\theta) ^ 2 )
 
@@ -153,8 +191,11 @@ Spectrum DisneyBssrdf::S( const Vector& wo , const Point& po , const Vector& wi
 
 Spectrum DisneyBssrdf::Sr( float r ) const{
     r = ( r < 0.000001f ) ? 0.000001f : r;
-    constexpr auto EIGHT_PI = 4.0 * TWO_PI;
-    return R * ( ( Spectrum( -r ) / d ).Exp() + ( Spectrum( -r ) / ( 3.0f * d ) ).Exp() ) / ( EIGHT_PI * d * r );
+    constexpr auto EIGHT_PI = 4.0f * TWO_PI;
+    Spectrum profile;
+    for( auto ch = 0 ; ch < SPECTRUM_SAMPLE ; ++ch )
+        profile[ch] = g_burleyProfile.Evaluate( r / d[ch] );
+    return R * profile / ( EIGHT_PI * d * r );
 }
 
 float DisneyBssrdf::Sample_Sr(int ch, float r) const{
@@ -171,7 +212,7 @@ float DisneyBssrdf::Pdf_Sr(int ch, float r) const{
     // Sr(ch,r) = ( 0.25f * exp( -r / d[ch] ) / ( TWO_PI * d[ch] * r ) + 0.75f * exp( -r / ( 3.0f * d[ch] ) ) / ( SIX_PI * d[ch] * r )
     constexpr auto EIGHT_PI = 4.0f * TWO_PI;
     r = ( r < 0.000001f ) ? 0.000001f : r;
-    return ( exp( -r / d[ch] ) + exp( -r / ( 3.0f * d[ch] ) ) ) / ( EIGHT_PI * d[ch] * r ) * burley_inv_max_cdf;
+    return g_burleyProfile.Evaluate( r / d[ch] ) / ( EIGHT_PI * d[ch] * r ) * burley_inv_max_cdf;
 }
 
 float DisneyBssrdf::Max_Sr(int ch) const{
@@ -256,6 +297,10 @@ Spectrum DisneyBRDF::f( const Vector& wo , const Vector& wi ) const {
         const FresnelSchlick<Spectrum> fresnel(Cspec0);
         const MicroFacetReflection mf(WHITE_SPECTRUM, &fresnel, &ggx, FULL_WEIGHT, nn);
         ret += mf.f(wo, wi);
+
+        // energy compensation of multiple scattering, the average of Schlick's Fresnel is F0 + ( 1 - F0 ) / 21
+        const auto Favg = Cspec0 + ( WHITE_SPECTRUM - Cspec0 ) * ( 1.0f / 21.0f );
+        ret += GGXMultiScattering(Favg, absCosTheta(wo), absCosTheta(wi), roughness);
     }
 
     // Another layer of clear coat on top of everything below.
@@ -334,7 +379,7 @@ Spectrum DisneyBRDF::sample_f(const Vector& wo, Vector& wi, const BsdfSample& bs
     }else if (r <= sr_w) {
         BsdfSample sample(true);
         Vector wh;
-        wh = ggx.sample_f(sample);
+        wh = ggx.sample_visible(wo, sample);
         wi = 2 * dot(wo, wh) * wh - wo;
     }else if (r <= st_w) {
         if (thinSurface) {
@@ -398,7 +443,7 @@ float DisneyBRDF::pdf( const Vector& wo , const Vector& wi ) const {
         total_pdf += clearcoat_weight * cggx.Pdf(wh) / (4.0f * absDot(wo, wh));
     }
     if (specular_reflection_weight > 0.0f) {
-        total_pdf += specular_reflection_weight * ggx.Pdf(wh) / (4.0f * absDot(wo, wh));
+        total_pdf += specular_reflection_weight * ggx.PdfVisible(wo, wh) / (4.0f * absDot(wo, wh));
     }
     if (specular_transmission_weight > 0.0f) {
         if (thinSurface) {
@@ -196,6 +196,24 @@ public:
     //! @return     Sampled normal direction based on the NDF.
     Vector sample_f(const BsdfSample& bs) const override;
 
+    //! @brief The clearcoat NDF has no visible normal sampling, the NDF is sampled instead.
+    //!
+    //! @param wo   The direction the normals are visible from.
+    //! @param bs   Sample holding all necessary random variables.
+    //! @return     Sampled normal direction based on the NDF.
+    Vector sample_visible(const Vector& wo, const BsdfSample& bs) const override {
+        return sample_f(bs);
+    }
+
+    //! @brief PDF of sampling a specific normal direction by 'sample_visible'.
+    //!
+    //! @param wo   The direction the normals are visible from.
+    //! @param wh   Normal direction to be sampled.
+    //! @return     The pdf of picking the normal.
+    float PdfVisible(const Vector& wo, const Vector& wh) const override {
+        return Pdf(wh);
+    }
+
 protected:
     //! @brief Smith shadow-masking function G1
     float G1(const Vector& v) const override;
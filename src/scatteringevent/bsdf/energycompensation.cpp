@@ -0,0 +1,144 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "energycompensation.h"
+#include "microfacet.h"
+#include "fresnel.h"
+#include "sampler/sample.h"
+#include "core/stats.h"
+
+SORT_STATS_DEFINE_COUNTER(sGGXAlbedoTableCnt)
+
+SORT_STATS_COUNTER("Material", "GGX Albedo Tables Built", sGGXAlbedoTableCnt);
+
+// Directional albedo of GGX reflection with perfect Fresnel, tabulated by the roughness and the cosine of the exitant
+// direction, along with the average albedo of each roughness.
+class GGXAlbedoTable{
+public:
+    GGXAlbedoTable(){
+        const FresnelNo fresnel;
+        for( auto j = 0u ; j < TABLE_SIZE ; ++j ){
+            const auto roughness = (float)j / ( TABLE_SIZE - 1 );
+            const GGX ggx( roughness , roughness );
+            const MicroFacetReflection mf( WHITE_SPECTRUM , &fresnel , &ggx , FULL_WEIGHT , DIR_UP );
+
+            auto average = 0.0f;
+            for( auto i = 0u ; i < TABLE_SIZE ; ++i ){
+                const auto cos_theta = std::max( COS_MIN , (float)i / ( TABLE_SIZE - 1 ) );
+                const auto wo = Vector( std::sqrt( 1.0f - cos_theta * cos_theta ) , cos_theta , 0.0f );
+
+                // stratified samples make the table deterministic
+                auto total = 0.0f;
+                for( auto v = 0u ; v < SAMPLE_SIZE ; ++v ){
+                    for( auto u = 0u ; u < SAMPLE_SIZE ; ++u ){
+                        BsdfSample bs;
+                        bs.u = ( u + 0.5f ) / SAMPLE_SIZE;
+                        bs.v = ( v + 0.5f ) / SAMPLE_SIZE;
+                        Vector wi;
+                        auto pdf = 0.0f;
+                        const auto f = mf.sample_f( wo , wi , bs , &pdf );
+                        if( pdf > 0.0f )
+                            total += f.GetIntensity() / pdf;
+                    }
+                }
+                m_albedo[j][i] = std::min( 1.0f , total / ( SAMPLE_SIZE * SAMPLE_SIZE ) );
+
+                // trapezoidal rule of 2 * \int E(u) * u du
+                const auto weight = ( i == 0 || i == TABLE_SIZE - 1 ) ? 0.5f : 1.0f;
+                average += 2.0f * weight * m_albedo[j][i] * cos_theta / ( TABLE_SIZE - 1 );
+            }
+            m_average[j] = std::min( 1.0f , average );
+        }
+
+        SORT_STATS(++sGGXAlbedoTableCnt);
+    }
+
+    // bilinear interpolation of the albedo, out of range parameters are clamped
+    float Albedo( float cos_theta , float roughness ) const {
+        unsigned i , j;
+        float ti , tj;
+        locate( cos_theta , i , ti );
+        locate( roughness , j , tj );
+        const auto a = slerp( m_albedo[j][i] , m_albedo[j][i+1] , ti );
+        const auto b = slerp( m_albedo[j+1][i] , m_albedo[j+1][i+1] , ti );
+        return slerp( a , b , tj );
+    }
+
+    // linear interpolation of the average albedo, out of range roughness is clamped
+    float Average( float roughness ) const {
+        unsigned j;
+        float tj;
+        locate( roughness , j , tj );
+        return slerp( m_average[j] , m_average[j+1] , tj );
+    }
+
+private:
+    static constexpr unsigned   TABLE_SIZE = 32;        /**< Number of entries along each dimension. */
+    static constexpr unsigned   SAMPLE_SIZE = 16;       /**< Number of stratified samples along each dimension per entry. */
+    static constexpr float      COS_MIN = 0.01f;        /**< Exitant directions are kept off the horizon. */
+
+    float   m_albedo[TABLE_SIZE][TABLE_SIZE];   /**< Albedo indexed by roughness and cosine. */
+    float   m_average[TABLE_SIZE];              /**< Average albedo indexed by roughness. */
+
+    static void locate( float x , unsigned& i , float& t ){
+        x = clamp( x , 0.0f , 1.0f ) * ( TABLE_SIZE - 1 );
+        i = std::min( (unsigned)x , TABLE_SIZE - 2 );
+        t = x - i;
+    }
+};
+
+// The table is built the first time a micro facet surface is shaded.
+static const GGXAlbedoTable& ggxAlbedo(){
+    static const GGXAlbedoTable table;
+    return table;
+}
+
+float GGXAlbedo( float cos_theta , float roughness ){
+    return ggxAlbedo().Albedo( cos_theta , roughness );
+}
+
+float GGXAverageAlbedo( float roughness ){
+    return ggxAlbedo().Average( roughness );
+}
+
+Spectrum AverageFresnel( const Fresnel& fresnel ){
+    // midpoint rule of 2 * \int F(u) * u du, the Fresnel term is smooth enough for a handful of samples
+    constexpr auto SAMPLE_CNT = 8u;
+    Spectrum ret;
+    for( auto i = 0u ; i < SAMPLE_CNT ; ++i ){
+        const auto u = ( i + 0.5f ) / SAMPLE_CNT;
+        ret += fresnel.Evaluate( u ) * ( 2.0f * u / SAMPLE_CNT );
+    }
+    return ret;
+}
+
+Spectrum GGXMultiScattering( const Spectrum& f_avg , float cos_o , float cos_i , float roughness ){
+    const auto& table = ggxAlbedo();
+    const auto e_avg = table.Average( roughness );
+
+    // smooth surfaces lose barely anything
+    if( e_avg >= 0.999f )
+        return 0.0f;
+
+    const auto e_o = table.Albedo( cos_o , roughness );
+    const auto e_i = table.Albedo( cos_i , roughness );
+    const auto f_ms = ( 1.0f - e_o ) * ( 1.0f - e_i ) / ( PI * ( 1.0f - e_avg ) );
+
+    // light bouncing among the facets is tinted by the Fresnel term every time it bounces
+    const auto f_add = f_avg * f_avg * e_avg / ( WHITE_SPECTRUM - f_avg * ( 1.0f - e_avg ) );
+    return f_add * ( f_ms * cos_i );
+}
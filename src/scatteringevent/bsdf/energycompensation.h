@@ -0,0 +1,61 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "spectrum/spectrum.h"
+
+class Fresnel;
+
+// Kulla-Conty energy compensation of micro facet reflection with GGX distribution.
+// Revisiting Physically Based Shading at Imageworks, Christopher Kulla and Alejandro Conty
+// https://blog.selfshadow.com/publications/s2017-shading-course/imageworks/s2017_pbs_imageworks_slides_v2.pdf
+//
+// A micro facet model only counts light bouncing off the facets once, light bouncing more than once is simply lost,
+// which is obvious on rough surfaces. The missing energy is added back by a diffuse-like lobe built from the directional
+// albedo of the single scattering model. The albedo is tabulated the first time it is needed, it only depends on the
+// roughness of the surface and the cosine of the direction.
+
+//! @brief  Directional albedo of GGX micro facet reflection without Fresnel.
+//!
+//! @param  cos_theta   Cosine of the angle between the direction and the normal.
+//! @param  roughness   Roughness of the surface, the same as the one passed to GGX.
+//! @return             Fraction of energy reflected by a single bounce on the facets.
+float   GGXAlbedo( float cos_theta , float roughness );
+
+//! @brief  Cosine weighted average of the directional albedo of GGX micro facet reflection without Fresnel.
+//!
+//! @param  roughness   Roughness of the surface, the same as the one passed to GGX.
+//! @return             Fraction of energy reflected by a single bounce on the facets under uniform lighting.
+float   GGXAverageAlbedo( float roughness );
+
+//! @brief  Cosine weighted average of a Fresnel term over the hemisphere.
+//!
+//! @param  fresnel     The Fresnel term.
+//! @return             The average Fresnel term.
+Spectrum AverageFresnel( const Fresnel& fresnel );
+
+//! @brief  Energy lost by GGX micro facet reflection, ready to be added to the single scattering BRDF.
+//!
+//! Just like what the Bxdf returns, the value is multiplied by the cosine of the incident direction.
+//!
+//! @param  f_avg       Average Fresnel term of the surface.
+//! @param  cos_o       Absolute cosine of the angle between the exitant direction and the normal.
+//! @param  cos_i       Absolute cosine of the angle between the incident direction and the normal.
+//! @param  roughness   Roughness of the surface, the same as the one passed to GGX.
+//! @return             The multiple scattering term multiplied by the cosine of the incident direction.
+Spectrum GGXMultiScattering( const Spectrum& f_avg , float cos_o , float cos_i , float roughness );
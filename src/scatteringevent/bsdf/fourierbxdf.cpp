@@ -23,6 +23,11 @@
 #include "sampler/sample.h"
 #include "material/matmanager.h"
 
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
+#define SIMD_SSE_IMPLEMENTATION
+#include "simd/simd_wrapper.h"
+#endif
+
 IMPLEMENT_CLOSURE_TYPE_BEGIN(ClosureTypeFourier)
 IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeFourier, Tsl_resource, measured_data)
 IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeFourier, Tsl_float3, normal)
@@ -84,6 +89,8 @@ bool FourierBxdfData::LoadResource( const std::string filename ){
     for( int i = 1 ; i < bsdfTable.nMu ; ++i )
         bsdfTable.recip[i] = 1.0f / (float) i;
 
+    m_memory.Set( sizeof(float) * ( 2 * bsdfTable.nMu + 2 * sqMu + coeff ) + sizeof(int) * 2 * sqMu );
+
     file.close();
     return true;
 }
@@ -105,7 +112,10 @@ Spectrum FourierBxdfData::f( const Vector& wo , const Vector& wi ) const
     memset( ak , 0 , sizeof( float ) * bsdfTable.nMax * bsdfTable.nChannels );
     auto nMax = blendCoefficients( ak , bsdfTable.nChannels , offsetI, offsetO, weightsI, weightsO );
 
-    auto Y = (float)(std::max(0.0f, fourier(ak, nMax, dPhi)));
+    auto cosKPhi = (float*)SORT_MALLOC_ARRAY(float, nMax );
+    fourierBasis( nMax , dPhi , cosKPhi );
+
+    auto Y = (float)(std::max(0.0f, fourier(ak, cosKPhi, nMax)));
     auto scale = (float)((muI != 0.0f) ? (1.0f / fabs(muI)) : 0.0f);
     if( muI * muO > 0.0f ){
         auto eta = ( muI > 0.0f ) ? 1 / bsdfTable.eta : bsdfTable.eta;
@@ -115,8 +125,8 @@ Spectrum FourierBxdfData::f( const Vector& wo , const Vector& wi ) const
     if( bsdfTable.nChannels == 1 )
         return scale * Y;
 
-    auto R = fourier( ak + 1 * bsdfTable.nMax , nMax , dPhi );
-    auto B = fourier( ak + 2 * bsdfTable.nMax , nMax , dPhi );
+    auto R = fourier( ak + 1 * bsdfTable.nMax , cosKPhi , nMax );
+    auto B = fourier( ak + 2 * bsdfTable.nMax , cosKPhi , nMax );
     auto G = 1.39829f * Y - 0.100913f * B - 0.297375f * R;
     return Spectrum( R * scale , G * scale , B * scale ).Clamp( 0.0f , FLT_MAX );
 }
@@ -162,8 +172,11 @@ Spectrum FourierBxdfData::sample_f( const Vector& wo , Vector& wi , const BsdfSa
     if( bsdfTable.nChannels == 1 )
         return scale * Y;
 
-    auto R = fourier( ak + 1 * bsdfTable.nMax , nMax , cosPhi );
-    auto B = fourier( ak + 2 * bsdfTable.nMax , nMax , cosPhi );
+    auto cosKPhi = (float*)SORT_MALLOC_ARRAY(float, nMax );
+    fourierBasis( nMax , cosPhi , cosKPhi );
+
+    auto R = fourier( ak + 1 * bsdfTable.nMax , cosKPhi , nMax );
+    auto B = fourier( ak + 2 * bsdfTable.nMax , cosKPhi , nMax );
     auto G = 1.39829f * Y - 0.100913f * B - 0.297375f * R;
     return Spectrum( R * scale , G * scale , B * scale ).Clamp( 0.0f , FLT_MAX );
 }
@@ -189,7 +202,10 @@ float FourierBxdfData::pdf( const Vector& wo , const Vector& wi ) const
         rho += weightsO[o] * bsdfTable.cdf[ (offsetO + o) * bsdfTable.nMu + bsdfTable.nMu - 1 ] * TWO_PI;
     }
 
-    auto Y = fourier(ak, nMax, cosPhi);
+    auto cosKPhi = (float*)SORT_MALLOC_ARRAY(float, nMax );
+    fourierBasis( nMax , cosPhi , cosKPhi );
+
+    auto Y = fourier(ak, cosKPhi, nMax);
     return (rho > 0.0f && Y > 0.0f) ? (Y/rho) : 0.0f;
 }
 
@@ -315,19 +331,34 @@ float FourierBxdfData::sampleCatmullRom2D( int size1 , int size2 , const float*
     return x0 + w * t;
 }
 
-// Fourier interpolation
-float FourierBxdfData::fourier( const float* ak , int m , double cosPhi ) const
+// Cosine of multiples of the angle
+void FourierBxdfData::fourierBasis( int m , double cosPhi , float* cosKPhi ) const
 {
     // cos( K * phi ) = 2.0 * cos( (K-1) * phi ) cos( phi ) - cos( (K-2) * Phi );
-    double value = 0.0;
+    // the recurrence is sequential, it is kept in double precision to avoid accumulating error
     double cosKMinusOnePhi = cosPhi;
-    double cosKPhi = 1.0;
+    double cosCurPhi = 1.0;
     for(auto i = 0 ; i < m ; ++i ){
-        value += cosKPhi * ak[i];
-        double cosKPlusPhi = 2.0 * cosPhi * cosKPhi - cosKMinusOnePhi;
-        cosKMinusOnePhi = cosKPhi;
-        cosKPhi = cosKPlusPhi;
+        cosKPhi[i] = (float)cosCurPhi;
+        double cosKPlusPhi = 2.0 * cosPhi * cosCurPhi - cosKMinusOnePhi;
+        cosKMinusOnePhi = cosCurPhi;
+        cosCurPhi = cosKPlusPhi;
     }
+}
+
+// Fourier interpolation
+float FourierBxdfData::fourier( const float* ak , const float* cosKPhi , int m ) const
+{
+    double value = 0.0;
+    auto i = 0;
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
+    auto sum = simd_zero();
+    for( ; i + SIMD_CHANNEL <= m ; i += SIMD_CHANNEL )
+        sum = simd_mad_ps( simd_set_ps( ak + i ) , simd_set_ps( cosKPhi + i ) , sum );
+    value = (double)sum[0] + (double)sum[1] + (double)sum[2] + (double)sum[3];
+#endif
+    for( ; i < m ; ++i )
+        value += (double)cosKPhi[i] * ak[i];
     return (float)value;
 }
 
@@ -397,8 +428,18 @@ int FourierBxdfData::blendCoefficients( float* ak , int channel , int offsetI ,
                 float* a = bsdfTable.GetAk(offsetI + j , offsetO + i, &m );
                 nMax = std::max( nMax , m );
                 for(auto c = 0 ; c < channel ; ++c ){
-                    for(auto k = 0 ; k < m ; ++k )
-                        ak[ c * bsdfTable.nMax + k ] += w * a[ c * m + k ];
+                    auto dst = ak + c * bsdfTable.nMax;
+                    const auto src = a + c * m;
+                    auto k = 0;
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
+                    const auto simd_w = simd_set_ps1( w );
+                    for( ; k + SIMD_CHANNEL <= m ; k += SIMD_CHANNEL ){
+                        const simd_data blended = simd_mad_ps( simd_w , simd_set_ps( src + k ) , simd_set_ps( dst + k ) );
+                        memcpy( dst + k , &blended , sizeof( blended ) );
+                    }
+#endif
+                    for( ; k < m ; ++k )
+                        dst[k] += w * src[k];
                 }
             }
         }
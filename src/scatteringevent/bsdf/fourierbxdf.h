@@ -19,6 +19,7 @@
 
 #include "bxdf.h"
 #include "core/resource.h"
+#include "core/memory.h"
 #include "scatteringevent/bsdf/bxdf_utils.h"
 
 DECLARE_CLOSURE_TYPE_BEGIN(ClosureTypeFourier, "fourier")
@@ -94,8 +95,13 @@ private:
 
     FourierBxdfTable    bsdfTable;
 
-    // Fourier interpolation
-    float fourier( const float* ak , int m , double cosPhi ) const;
+    // Memory of the table accounted in the memory of measured BRDFs
+    TrackedMemory       m_memory = TrackedMemory( MemoryCategory::MeasuredBxdf );
+
+    // Cosine of multiples of the angle, cos( k * phi ) for k in [0, m), it is shared by all channels
+    void fourierBasis( int m , double cosPhi , float* cosKPhi ) const;
+    // Fourier interpolation with the cosine of multiples of the angle
+    float fourier( const float* ak , const float* cosKPhi , int m ) const;
     // Importance sampling for fourier interpolation
     // Refer these two wiki pages for further detail:
     // Bisection method :   https://en.wikipedia.org/wiki/Bisection_method
@@ -20,6 +20,21 @@
 #include "core/samplemethod.h"
 #include "fresnel.h"
 #include "math/utils.h"
+#include "math/fastmath.h"
+
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
+#define SIMD_SSE_IMPLEMENTATION
+#include "simd/simd_wrapper.h"
+#include "simd/simd_math.h"
+#endif
+
+static_assert( PMAX + 1 == 4 , "All lobes of the hair bxdf are evaluated in four lanes." );
+
+// Coefficients of the series of the modified Bessel function, 1 / ( 4 ^ i * ( i! ) ^ 2 ).
+static const float I0_COEFFS[10] = {
+    1.0f , 1.0f / 4.0f , 1.0f / 64.0f , 1.0f / 2304.0f , 1.0f / 147456.0f , 1.0f / 14745600.0f , 1.0f / 2123366400.0f ,
+    1.0f / 416179814400.0f , 1.0f / 106542032486400.0f , 1.0f / 34519618525593600.0f
+};
 
 IMPLEMENT_CLOSURE_TYPE_BEGIN(ClosureTypeHair)
 IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeHair, Tsl_float3, sigma)
@@ -40,27 +55,15 @@ SORT_STATIC_FORCEINLINE void Ap( const float cosThetaO , const float eta , const
 }
 
 SORT_STATIC_FORCEINLINE float I0(const float x) {
-    auto val = 0.0f;
-    auto x2i = 1.0f;
-    int64_t ifact = 1;
-    auto i4 = 1;
-    for (int i = 0; i < 10; ++i) {
-        if (i > 1) ifact *= i;
-        val += x2i / (float)(i4*ifact*ifact);
-        x2i *= x * x;
-        i4 *= 4;
-    }
+    const auto x2 = x * x;
+    auto val = I0_COEFFS[9];
+    for (int i = 8; i >= 0; --i)
+        val = val * x2 + I0_COEFFS[i];
     return val;
 }
 
-SORT_STATIC_FORCEINLINE float LogI0(float x) {
-    return (x > 12) ? x + 0.5f * (-log(TWO_PI) + log(1 / x) + 1 / (8 * x)) : log(I0(x));
-}
-
-SORT_STATIC_FORCEINLINE float Mp( const float cosThetaI , const float cosThetaO , const float sinThetaI , const float sinThetaO , const float v ){
-    const auto a = cosThetaI * cosThetaO / v;
-    const auto b = sinThetaI * sinThetaO / v;
-    return (v <= .1) ? (exp(LogI0(a) - b - 1 / v + 0.6931f + log(1 / (2 * v)))) : (exp(-b) * I0(a)) / (sinh(1 / v) * 2 * v);
+SORT_STATIC_FORCEINLINE float LogI0(const float x , const float i0) {
+    return (x > 12) ? x + 0.5f * (-FastLog(TWO_PI) + FastLog(1 / x) + 1 / (8 * x)) : FastLog(i0);
 }
 
 SORT_STATIC_FORCEINLINE float Phi( const int p , const float gammaO , const float gammaT ){
@@ -68,46 +71,27 @@ SORT_STATIC_FORCEINLINE float Phi( const int p , const float gammaO , const floa
 }
 
 SORT_STATIC_FORCEINLINE float Logistic( float x , const float scale ){
-    x = abs(x);
-    return exp( -x / scale ) / ( scale * SQR( 1.0f + exp( -x / scale ) ) );
+    const auto e = FastExp( -abs(x) / scale );
+    return e / ( scale * SQR( 1.0f + e ) );
 }
 
 SORT_STATIC_FORCEINLINE float LogisticCDF( const float x , const float scale ){
-    return 1.0f / ( 1.0f + exp( -x / scale ) );
+    return 1.0f / ( 1.0f + FastExp( -x / scale ) );
 }
 
-SORT_STATIC_FORCEINLINE float TrimmedLogistic( const float x , const float scale , const float a , const float b ){
-    return Logistic( x , scale ) / ( LogisticCDF( b , scale ) - LogisticCDF( a , scale ) );
-}
 
-SORT_STATIC_FORCEINLINE float SampleTrimmedLogistic(const float r, const float scale, const float a, const float b) {
-    const auto k = LogisticCDF(b, scale) - LogisticCDF(a, scale);
-    const auto x = -scale * log(1 / (r * k + LogisticCDF(a, scale)) - 1);
-    return clamp(x, a, b);
+// The cdf of the trimmed range is the same for all lobes, 'cdfMin' and 'norm' are evaluated once in the constructor.
+SORT_STATIC_FORCEINLINE float SampleTrimmedLogistic(const float r, const float scale, const float cdfMin, const float norm) {
+    const auto x = -scale * FastLog(1 / (r / norm + cdfMin) - 1);
+    return clamp(x, -PI, PI);
 }
 
-SORT_STATIC_FORCEINLINE float Np( const float phi , const int p , const float scale , const float gammaO , const float gammaT ){
+// The logistic distribution is trimmed to [-PI, PI], 'norm' is the reciprocal of its cdf in the range.
+SORT_STATIC_FORCEINLINE float Np( const float phi , const int p , const float scale , const float norm , const float gammaO , const float gammaT ){
     float dphi = phi - Phi( p , gammaO , gammaT );
     while( dphi > PI ) dphi -= TWO_PI;
     while( dphi < -PI ) dphi += TWO_PI;
-    return TrimmedLogistic( dphi, scale, -PI, PI);
-}
-
-SORT_STATIC_FORCEINLINE void ComputeApPdf(const float cosThetaO , const float cosThetaT ,
-                                const float cosGammaO , const float cosGammaT ,
-                                const float eta , const Spectrum sigma, float pdf[] ){
-    const auto T = sigma * ( -2.0f * cosGammaT / cosThetaT );
-    const auto expT = T.Exp();
-
-    Spectrum ap[PMAX + 1];
-    Ap( cosThetaO , eta , cosGammaO , expT , ap );
-
-    auto sumY = 0.0f;
-    for( auto i = 0 ; i <= PMAX ; ++i )
-        sumY += ap[i].GetIntensity();
-
-    for (int i = 0; i <= PMAX; ++i)
-        pdf[i] = ap[i].GetIntensity() / sumY;
+    return Logistic( dphi , scale ) * norm;
 }
 
 Hair::Hair(const ClosureTypeHair& params, const Spectrum& weight): Hair(params.sigma, params.longtitudinalRoughness, params.azimuthalRoughness, params.ior, weight, true ){}
@@ -136,67 +120,127 @@ Hair::Hair(const Spectrum& absorption, const float lRoughness, const float aRoug
     m_scale = SqrtPiOver8 * (0.265f * m_aRoughness + 1.194f * SQR(m_aRoughness) + 5.372f * Pow<22>(m_aRoughness));
 
     m_etaSqr = SQR( m_eta );
+
+    // terms of the longitudinal scattering that only depend on the roughness of each lobe
+    for( int p = 0 ; p <= PMAX ; ++p ){
+        const auto v = m_v[p];
+        m_invV[p] = 1.0f / v;
+        m_mpBias[p] = -1 / v + 0.6931f + log(1 / (2 * v));
+        m_mpScale[p] = 1.0f / (sinh(1 / v) * 2 * v);
+    }
+    m_npCdfMin = LogisticCDF( -PI , m_scale );
+    m_npNorm = 1.0f / ( LogisticCDF( PI , m_scale ) - m_npCdfMin );
 }
 
-Spectrum Hair::f( const Vector& wo , const Vector& wi ) const{
-    if( wo.y <= 0.0f || wi.y == 0.0f )
-        return 0.0f;
+void Hair::evaluateLobes( const float sinThetaI , const float cosThetaI , const float sinThetaO , const float cosThetaO ,
+                          const float phi , const float gammaO , const float gammaT , float mn[] ) const{
+    float sinThetaIp[PMAX + 1] , cosThetaIp[PMAX + 1];
+    for( auto p = 0 ; p <= PMAX ; ++p ){
+#ifndef DISABLE_ANGLE_TILT
+        if( p == 0 ){
+            sinThetaIp[p] = sinThetaI * m_cos2kAlpha[1] + cosThetaI * m_sin2kAlpha[1];
+            cosThetaIp[p] = cosThetaI * m_cos2kAlpha[1] - sinThetaI * m_sin2kAlpha[1];
+        }else if( p == 1 ){
+            sinThetaIp[p] = sinThetaI * m_cos2kAlpha[0] - cosThetaI * m_sin2kAlpha[0];
+            cosThetaIp[p] = cosThetaI * m_cos2kAlpha[0] + sinThetaI * m_sin2kAlpha[0];
+        }else if( p == 2 ){
+            sinThetaIp[p] = sinThetaI * m_cos2kAlpha[2] - cosThetaI * m_sin2kAlpha[2];
+            cosThetaIp[p] = cosThetaI * m_cos2kAlpha[2] + sinThetaI * m_sin2kAlpha[2];
+        }else{
+            sinThetaIp[p] = sinThetaI;
+            cosThetaIp[p] = cosThetaI;
+        }
+        cosThetaIp[p] = abs( cosThetaIp[p] );
+#else
+        sinThetaIp[p] = sinThetaI;
+        cosThetaIp[p] = cosThetaI;
+#endif
+    }
 
-    const auto sinThetaO = wo.x;
-    const auto cosThetaO = ssqrt( 1.0f - SQR(sinThetaO) );
-    const auto phiO = atan2(wo.y, wo.z);
+    // the longitudinal scattering of all lobes, the modified Bessel function overflows for low roughness, it is evaluated
+    // in log space in this case
+    float mp[PMAX + 1];
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
+    const auto inv_v = simd_set_ps( m_invV );
+    const auto a = simd_mul_ps( simd_mul_ps( simd_set_ps( cosThetaIp ) , simd_set_ps1( cosThetaO ) ) , inv_v );
+    const auto b = simd_mul_ps( simd_mul_ps( simd_set_ps( sinThetaIp ) , simd_set_ps1( sinThetaO ) ) , inv_v );
+    const auto x2 = simd_mul_ps( a , a );
+    simd_data i0 = simd_set_ps1( I0_COEFFS[9] );
+    for( int i = 8 ; i >= 0 ; --i )
+        i0 = simd_mad_ps( i0 , x2 , simd_set_ps1( I0_COEFFS[i] ) );
+
+    // both branches of LogI0 are evaluated in all lanes
+    const auto rcp_a = simd_rcp_ps( a );
+    auto asymptotic = simd_add_ps( simd_log_ps( rcp_a ) , simd_mul_ps( simd_set_ps1( 0.125f ) , rcp_a ) );
+    asymptotic = simd_mad_ps( simd_set_ps1( 0.5f ) , simd_sub_ps( asymptotic , simd_set_ps1( FastLog( TWO_PI ) ) ) , a );
+    const auto log_i0 = simd_pick_ps( simd_cmpgt_ps( a , simd_set_ps1( 12.0f ) ) , asymptotic , simd_log_ps( i0 ) );
+
+    const auto mp_low = simd_exp_ps( simd_add_ps( simd_sub_ps( log_i0 , b ) , simd_set_ps( m_mpBias ) ) );
+    const auto mp_high = simd_mul_ps( simd_mul_ps( simd_exp_ps( simd_sub_ps( simd_zeros , b ) ) , i0 ) , simd_set_ps( m_mpScale ) );
+    const simd_data simd_mp = simd_pick_ps( simd_cmple_ps( simd_set_ps( m_v ) , simd_set_ps1( 0.1f ) ) , mp_low , mp_high );
+    memcpy( mp , &simd_mp , sizeof( mp ) );
+#else
+    for( auto p = 0 ; p <= PMAX ; ++p ){
+        const auto a = cosThetaIp[p] * cosThetaO * m_invV[p];
+        const auto b = sinThetaIp[p] * sinThetaO * m_invV[p];
+        const auto i0 = I0( a );
+        mp[p] = ( m_v[p] <= .1 ) ? FastExp( LogI0( a , i0 ) - b + m_mpBias[p] ) : FastExp( -b ) * i0 * m_mpScale[p];
+    }
+#endif
 
-    const auto sinThetaI = wi.x;
-    const auto cosThetaI = ssqrt( 1.0f - SQR(sinThetaI) );
-    const auto phiI = atan2(wi.y, wi.z);
+    for( auto p = 0 ; p <= PMAX ; ++p )
+        mn[p] = mp[p] * ( ( p < PMAX ) ? Np( phi , p , m_scale , m_npNorm , gammaO , gammaT ) : INV_TWOPI );
+}
+
+void Hair::evaluateExitant( const Vector& wo , ExitantTerms& terms ) const{
+    terms.sinThetaO = wo.x;
+    terms.cosThetaO = ssqrt( 1.0f - SQR( terms.sinThetaO ) );
+    terms.phiO = FastAtan2( wo.y , wo.z );
 
-    const auto sinThetaT = sinThetaO / m_eta;
+    const auto sinThetaT = terms.sinThetaO / m_eta;
     const auto cosThetaT = ssqrt( 1.0f - SQR(sinThetaT) );
 
     // Modified index of refraction.
     // 'Light Scattering from Human Hair Fibers'
     // http://www.graphics.stanford.edu/papers/hair/hair-sg03final.pdf
-    const auto etap = sqrt( m_etaSqr - SQR( sinThetaO ) ) / cosThetaO;
+    const auto etap = sqrt( m_etaSqr - SQR( terms.sinThetaO ) ) / terms.cosThetaO;
 
-    const auto cosGammaO = wo.y / cosThetaO;
-    const auto sinGammaO = wo.z / cosThetaO;
-    const auto gammaO = asin( clamp( sinGammaO , -1.0f , 1.0f ) );
+    const auto cosGammaO = wo.y / terms.cosThetaO;
+    const auto sinGammaO = wo.z / terms.cosThetaO;
+    terms.gammaO = asin( clamp( sinGammaO , -1.0f , 1.0f ) );
 
     const auto sinGammaT = sinGammaO / etap;
     const auto cosGammaT = ssqrt( 1.0f - SQR(sinGammaT) );
-    const auto gammaT = asin( clamp( sinGammaT , -1.0f , 1.0f ) );
+    terms.gammaT = asin( clamp( sinGammaT , -1.0f , 1.0f ) );
 
     const auto T = m_sigma * ( -2.0f * cosGammaT / cosThetaT );
-    const auto expT = T.Exp();
-    const auto phi = phiI - phiO;
+    Ap( terms.cosThetaO , m_eta , cosGammaO , T.Exp() , terms.ap );
+
+    // the lobes are picked proportional to their attenuation while sampling
+    auto sumY = 0.0f;
+    for( auto p = 0 ; p <= PMAX ; ++p )
+        sumY += terms.ap[p].GetIntensity();
+    for( auto p = 0 ; p <= PMAX ; ++p )
+        terms.apPdf[p] = terms.ap[p].GetIntensity() / sumY;
+}
+
+Spectrum Hair::f( const Vector& wo , const Vector& wi ) const{
+    if( wo.y <= 0.0f || wi.y == 0.0f )
+        return 0.0f;
+
+    ExitantTerms eo;
+    evaluateExitant( wo , eo );
+
+    const auto sinThetaI = wi.x;
+    const auto cosThetaI = ssqrt( 1.0f - SQR(sinThetaI) );
+    const auto phiI = FastAtan2(wi.y, wi.z);
 
-    Spectrum ap[PMAX + 1];
-    Ap( cosThetaO , m_eta , cosGammaO , expT , ap );
+    float mn[PMAX + 1];
+    evaluateLobes( sinThetaI , cosThetaI , eo.sinThetaO , eo.cosThetaO , phiI - eo.phiO , eo.gammaO , eo.gammaT , mn );
 
     Spectrum fsum(0.0f);
-    for( auto p = 0 ; p < PMAX ; ++p ){
-#ifndef DISABLE_ANGLE_TILT
-        float sinThetaIp , cosThetaIp;
-        if( p == 0 ){
-            sinThetaIp = sinThetaI * m_cos2kAlpha[1] + cosThetaI * m_sin2kAlpha[1];
-            cosThetaIp = cosThetaI * m_cos2kAlpha[1] - sinThetaI * m_sin2kAlpha[1];
-        }else if( p == 1 ){
-            sinThetaIp = sinThetaI * m_cos2kAlpha[0] - cosThetaI * m_sin2kAlpha[0];
-            cosThetaIp = cosThetaI * m_cos2kAlpha[0] + sinThetaI * m_sin2kAlpha[0];
-        }else if( p == 2 ){
-            sinThetaIp = sinThetaI * m_cos2kAlpha[2] - cosThetaI * m_sin2kAlpha[2];
-            cosThetaIp = cosThetaI * m_cos2kAlpha[2] + sinThetaI * m_sin2kAlpha[2];
-        }else{
-            sinThetaIp = sinThetaI;
-            cosThetaIp = cosThetaI;
-        }
-        cosThetaIp = abs( cosThetaIp );
-        fsum += Mp( cosThetaIp , cosThetaO , sinThetaIp , sinThetaO , m_v[p] ) * ap[p] * Np( phi, p, m_scale, gammaO, gammaT );
-#else
-        fsum += Mp( cosThetaI , cosThetaO , sinThetaI , sinThetaO , m_v[p] ) * ap[p] * Np( phi, p, m_scale, gammaO, gammaT );
-#endif
-    }
-    fsum += Mp( cosThetaI, cosThetaO, sinThetaI, sinThetaO, m_v[PMAX] ) * ap[PMAX] * INV_TWOPI;
+    for( auto p = 0 ; p <= PMAX ; ++p )
+        fsum += mn[p] * eo.ap[p];
 
     return fsum;
 }
@@ -208,36 +252,22 @@ Spectrum Hair::sample_f(const Vector& wo, Vector& wi, const BsdfSample& bs, floa
         return 0.0f;
     }
 
-    const auto sinThetaO = wo.x;
-    const auto cosThetaO = ssqrt( 1.0f - SQR( sinThetaO ) );
-    const auto phiO = atan2( wo.y , wo.z );
+    ExitantTerms eo;
+    evaluateExitant( wo , eo );
 
-    const auto sinThetaT = sinThetaO / m_eta;
-    const auto cosThetaT = ssqrt( 1.0f - SQR(sinThetaT) );
-
-    const auto etap = sqrt( m_etaSqr - SQR( sinThetaO ) ) / cosThetaO;
-
-    const auto cosGammaO = wo.y / cosThetaO;
-    const auto sinGammaO = wo.z / cosThetaO;
-
-    const auto sinGammaT = sinGammaO / etap;
-    const auto cosGammaT = ssqrt( 1.0f - SQR(sinGammaT) );
-
-    float apPdf[PMAX + 1] = {0.0f};
-    ComputeApPdf( cosThetaO , cosThetaT , cosGammaO , cosGammaT , m_eta , m_sigma , apPdf );
     auto r = sort_canonical();
     auto p = 0;
     for( ; p < PMAX ; ++p ){
-        if( r < apPdf[p] ) break;
-        r -= apPdf[p];
+        if( r < eo.apPdf[p] ) break;
+        r -= eo.apPdf[p];
     }
 
     r = sort_canonical();
     // special handling for corner case where 'r' equals to 0, leading exp( -2.0f / m_v[p] ) potentially reaches 0, eventually resulting in a 'Nan'
-    const auto cosTheta = r > 0.0f ? ( 1.0f + m_v[p] * log( r + ( 1.0f - r ) * exp( -2.0f / m_v[p] ) ) ) : -1.0f ;
+    const auto cosTheta = r > 0.0f ? ( 1.0f + m_v[p] * FastLog( r + ( 1.0f - r ) * FastExp( -2.0f / m_v[p] ) ) ) : -1.0f ;
     const auto sinTheta = ssqrt( 1.0f - SQR( cosTheta ) );
-    const auto cosPhi = cos( TWO_PI * sort_canonical() );
-    auto sinThetaI = -cosTheta * sinThetaO + sinTheta * cosPhi * cosThetaO;
+    const auto cosPhi = FastCos( TWO_PI * sort_canonical() );
+    auto sinThetaI = -cosTheta * eo.sinThetaO + sinTheta * cosPhi * eo.cosThetaO;
     auto cosThetaI = ssqrt( 1.0f - SQR( sinThetaI ) );
 
 #ifndef DISABLE_ANGLE_TILT
@@ -258,94 +288,48 @@ Spectrum Hair::sample_f(const Vector& wo, Vector& wi, const BsdfSample& bs, floa
     cosThetaI = cosThetaIp;
 #endif
 
-    const auto gammaO = asin( clamp( sinGammaO , -1.0f , 1.0f ) );
-    const auto gammaT = asin( clamp( sinGammaT , -1.0f , 1.0f ) );
-    const auto dphi = ( p < PMAX ) ? Phi( p , gammaO , gammaT ) + SampleTrimmedLogistic( sort_canonical() , m_scale , -PI , PI ) : TWO_PI * sort_canonical();
+    const auto dphi = ( p < PMAX ) ? Phi( p , eo.gammaO , eo.gammaT ) + SampleTrimmedLogistic( sort_canonical() , m_scale , m_npCdfMin , m_npNorm ) : TWO_PI * sort_canonical();
 
-    const auto phiI = phiO + dphi;
-    wi = Vector3f( sinThetaI , cosThetaI * sin( phiI ) , cosThetaI * cos( phiI ) );
+    const auto phiI = eo.phiO + dphi;
+    float sinPhiI , cosPhiI;
+    FastSinCos( phiI , sinPhiI , cosPhiI );
+    wi = Vector3f( sinThetaI , cosThetaI * sinPhiI , cosThetaI * cosPhiI );
+
+    // the bxdf and the pdf share the same lobes, they only differ in the weight of each lobe
+    float mn[PMAX + 1];
+    evaluateLobes( sinThetaI , cosThetaI , eo.sinThetaO , eo.cosThetaO , dphi , eo.gammaO , eo.gammaT , mn );
 
     if( pPdf ){
         *pPdf = 0.0f;
-        for( auto p = 0 ; p < PMAX ; ++p ){
-#ifndef DISABLE_ANGLE_TILT
-            float sinThetaIp , cosThetaIp;
-            if( p == 0 ){
-                sinThetaIp = sinThetaI * m_cos2kAlpha[1] + cosThetaI * m_sin2kAlpha[1];
-                cosThetaIp = cosThetaI * m_cos2kAlpha[1] - sinThetaI * m_sin2kAlpha[1];
-            }else if( p == 1 ){
-                sinThetaIp = sinThetaI * m_cos2kAlpha[0] - cosThetaI * m_sin2kAlpha[0];
-                cosThetaIp = cosThetaI * m_cos2kAlpha[0] + sinThetaI * m_sin2kAlpha[0];
-            }else if( p == 2 ){
-                sinThetaIp = sinThetaI * m_cos2kAlpha[2] - cosThetaI * m_sin2kAlpha[2];
-                cosThetaIp = cosThetaI * m_cos2kAlpha[2] + sinThetaI * m_sin2kAlpha[2];
-            }else{
-                sinThetaIp = sinThetaI;
-                cosThetaIp = cosThetaI;
-            }
-            cosThetaIp = abs( cosThetaIp );
-            *pPdf += Mp( cosThetaIp , cosThetaO , sinThetaIp , sinThetaO , m_v[p] ) * apPdf[p] * Np( dphi, p, m_scale, gammaO, gammaT );
-#else
-            *pPdf += Mp( cosThetaI , cosThetaO , sinThetaI , sinThetaO , m_v[p] ) * apPdf[p] * Np( dphi, p, m_scale, gammaO, gammaT );
-#endif
-        }
-        *pPdf += Mp( cosThetaI , cosThetaO , sinThetaI , sinThetaO , m_v[PMAX] ) * apPdf[PMAX] * INV_TWOPI;
+        for( auto i = 0 ; i <= PMAX ; ++i )
+            *pPdf += mn[i] * eo.apPdf[i];
     }
-    return f( wo , wi );
+
+    if( wi.y == 0.0f )
+        return 0.0f;
+
+    Spectrum fsum(0.0f);
+    for( auto i = 0 ; i <= PMAX ; ++i )
+        fsum += mn[i] * eo.ap[i];
+    return fsum;
 }
 
 float Hair::pdf( const Vector& wo , const Vector& wi ) const{
     if( wo.y <= 0.0f || wi.y == 0.0f )
         return 0.0f;
 
-    const auto sinThetaO = wo.x;
-    const auto cosThetaO = ssqrt( 1.0f - SQR(sinThetaO) );
-    const auto phiO = atan2(wo.y, wo.z);
+    ExitantTerms eo;
+    evaluateExitant( wo , eo );
 
     const auto sinThetaI = wi.x;
     const auto cosThetaI = ssqrt( 1.0f - SQR(sinThetaI) );
-    const auto phiI = atan2(wi.y, wi.z);
-
-    const auto sinThetaT = sinThetaO / m_eta;
-    const auto cosThetaT = ssqrt( 1.0f - SQR(sinThetaT) );
-
-    const auto etap = sqrt( m_etaSqr - SQR( sinThetaO ) ) / cosThetaO;
-
-    const auto cosGammaO = wo.y / cosThetaO;
-    const auto sinGammaO = wo.z / cosThetaO;
-    const auto gammaO = asin( clamp( sinGammaO , -1.0f , 1.0f ) );
-
-    const auto sinGammaT = sinGammaO / etap;
-    const auto cosGammaT = ssqrt( 1.0f - SQR(sinGammaT) );
-    const auto gammaT = asin( clamp( sinGammaT , -1.0f , 1.0f ) );
+    const auto phiI = FastAtan2(wi.y, wi.z);
 
-    float apPdf[PMAX + 1] = {0.0f};
-    ComputeApPdf( cosThetaO , cosThetaT , cosGammaO , cosGammaT , m_eta , m_sigma , apPdf );
+    float mn[PMAX + 1];
+    evaluateLobes( sinThetaI , cosThetaI , eo.sinThetaO , eo.cosThetaO , phiI - eo.phiO , eo.gammaO , eo.gammaT , mn );
 
-    auto phi = phiI - phiO;
     auto pdf = 0.0f;
-    for( auto p = 0 ; p < PMAX ; ++p ){
-#ifndef DISABLE_ANGLE_TILT
-        float sinThetaIp , cosThetaIp;
-        if( p == 0 ){
-            sinThetaIp = sinThetaI * m_cos2kAlpha[1] + cosThetaI * m_sin2kAlpha[1];
-            cosThetaIp = cosThetaI * m_cos2kAlpha[1] - sinThetaI * m_sin2kAlpha[1];
-        }else if( p == 1 ){
-            sinThetaIp = sinThetaI * m_cos2kAlpha[0] - cosThetaI * m_sin2kAlpha[0];
-            cosThetaIp = cosThetaI * m_cos2kAlpha[0] + sinThetaI * m_sin2kAlpha[0];
-        }else if( p == 2 ){
-            sinThetaIp = sinThetaI * m_cos2kAlpha[2] - cosThetaI * m_sin2kAlpha[2];
-            cosThetaIp = cosThetaI * m_cos2kAlpha[2] + sinThetaI * m_sin2kAlpha[2];
-        }else{
-            sinThetaIp = sinThetaI;
-            cosThetaIp = cosThetaI;
-        }
-        cosThetaIp = abs( cosThetaIp );
-        pdf += Mp( cosThetaIp , cosThetaO , sinThetaIp , sinThetaO , m_v[p] ) * apPdf[p] * Np( phi, p, m_scale, gammaO, gammaT );
-#else
-        pdf += Mp( cosThetaI , cosThetaO , sinThetaI , sinThetaO , m_v[p] ) * apPdf[p] * Np( phi, p, m_scale, gammaO, gammaT );
-#endif
-    }
-    pdf += Mp( cosThetaI , cosThetaO , sinThetaI , sinThetaO , m_v[PMAX] ) * apPdf[PMAX] * INV_TWOPI;
+    for( auto p = 0 ; p <= PMAX ; ++p )
+        pdf += mn[p] * eo.apPdf[p];
     return pdf;
 }
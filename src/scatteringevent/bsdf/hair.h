@@ -74,6 +74,42 @@ public:
     float pdf( const Vector& wo , const Vector& wi ) const override;
 
 private:
+    //! @brief  Terms of the scattering that only depend on the exitant direction.
+    struct ExitantTerms{
+        float       sinThetaO;              /**< Sine of the longitudinal angle of the exitant direction. */
+        float       cosThetaO;              /**< Cosine of the longitudinal angle of the exitant direction. */
+        float       phiO;                   /**< Azimuthal angle of the exitant direction. */
+        float       gammaO;                 /**< Offset angle of the exitant direction. */
+        float       gammaT;                 /**< Offset angle of the refracted direction inside the hair. */
+        Spectrum    ap[PMAX + 1];           /**< Attenuation of each lobe. */
+        float       apPdf[PMAX + 1];        /**< Probability of picking each lobe while sampling. */
+    };
+
+    //! @brief  Evaluate the terms that only depend on the exitant direction.
+    //!
+    //! Sampling needs the attenuation of all lobes to pick one, the same terms are reused to evaluate the bxdf and the
+    //! pdf of the sampled direction afterward.
+    //!
+    //! @param wo           Exitant direction in shading coordinate.
+    //! @param terms        The terms of the exitant direction.
+    void evaluateExitant( const Vector& wo , ExitantTerms& terms ) const;
+
+    //! @brief  Evaluate the longitudinal and azimuthal scattering of all lobes at once.
+    //!
+    //! The lobes are evaluated in parallel lanes. Entry 'p' of the result is the product of Mp and Np of the p-th lobe,
+    //! the last lobe has a uniform azimuthal distribution.
+    //!
+    //! @param sinThetaI    Sine of the longitudinal angle of the incident direction.
+    //! @param cosThetaI    Cosine of the longitudinal angle of the incident direction.
+    //! @param sinThetaO    Sine of the longitudinal angle of the exitant direction.
+    //! @param cosThetaO    Cosine of the longitudinal angle of the exitant direction.
+    //! @param phi          Azimuthal angle between the incident and exitant directions.
+    //! @param gammaO       Offset angle of the exitant direction.
+    //! @param gammaT       Offset angle of the refracted direction inside the hair.
+    //! @param mn           The product of the longitudinal and azimuthal terms of each lobe.
+    void evaluateLobes( const float sinThetaI , const float cosThetaI , const float sinThetaO , const float cosThetaO ,
+                        const float phi , const float gammaO , const float gammaT , float mn[] ) const;
+
     const Spectrum  m_sigma;            /**< Absorption coefficient. */
     const float     m_lRoughness;       /**< Longtitudinal roughness. */
     const float     m_aRoughness;       /**< Azimuthal roughness. */
@@ -82,6 +118,11 @@ private:
     float           m_v[PMAX+1];          /**< Some pre-calculated cached data. */
     float           m_scale;              /**< Azimuhthal logisitic scale factor. */
     float           m_etaSqr;             /**< Squared eta. */
+    float           m_invV[PMAX+1];       /**< Reciprocal of the longitudinal variance of each lobe. */
+    float           m_mpBias[PMAX+1];     /**< Roughness dependent exponent of the longitudinal scattering in log space. */
+    float           m_mpScale[PMAX+1];    /**< Roughness dependent normalization of the longitudinal scattering. */
+    float           m_npNorm;             /**< Reciprocal of the cdf of the trimmed logistic distribution. */
+    float           m_npCdfMin;           /**< Cdf of the logistic distribution at the lower end of the trimmed range. */
 #ifndef DISABLE_ANGLE_TILT
     float           m_cos2kAlpha[PMAX];   /**< Some pre-calculated cached data, cos( 2 ^ k ). */
     float           m_sin2kAlpha[PMAX];   /**< Some pre-calculated cached data, sin( 2 ^ k ). */
@@ -67,6 +67,13 @@ public:
     //! @return     The Evaluated BRDF value.
     Spectrum f( const Vector& wo , const Vector& wi ) const override;
 
+    //! @brief Directional albedo of the BRDF.
+    //! @param wo   Exitant direction in shading coordinate.
+    //! @return     The direction-hemisphere reflectance.
+    Spectrum albedo( const Vector& wo ) const override{
+        return R;
+    }
+
 private:
     const Spectrum R;         /**< Direction-Hemisphere reflection or total reflection. */
 };
@@ -110,6 +117,13 @@ public:
     //! @return     The probability of choosing the out-going direction based on the Incident direction.
     float pdf( const Vector& wo , const Vector& wi ) const override;
 
+    //! @brief Directional albedo of the BTDF.
+    //! @param wo   Exitant direction in shading coordinate.
+    //! @return     The direction-hemisphere transmittance.
+    Spectrum albedo( const Vector& wo ) const override{
+        return T;
+    }
+
 private:
     const Spectrum T;         /**< Direction-Hemisphere reflection or total reflection. */
 };
@@ -18,6 +18,14 @@
 #include <string.h>
 #include <fstream>
 #include "merl.h"
+#if defined(SORT_IN_WINDOWS)
+    #include <Windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
 #include "core/define.h"
 #include "core/memory.h"
 #include "core/path.h"
@@ -37,47 +45,128 @@ static const unsigned MERL_SAMPLING_COUNT = 1458000;
 static const double MERL_RED_SCALE = 0.0006666666666667;
 static const double MERL_GREEN_SCALE = 0.000766666666666667;
 static const double MERL_BLUE_SCALE = 0.0011066666666666667;
+static const double MERL_SCALES[3] = { MERL_RED_SCALE , MERL_GREEN_SCALE , MERL_BLUE_SCALE };
+static const std::size_t MERL_HEADER_SIZE = sizeof( unsigned int ) * 3;
+static const std::size_t MERL_FILE_SIZE = MERL_HEADER_SIZE + sizeof( double ) * 3 * MERL_SAMPLING_COUNT;
+
+namespace {
+    // Map the whole file in read-only mode, the pages are backed by the file itself.
+    const char* mapFile( const std::string& filename , std::size_t& size ){
+#if defined(SORT_IN_WINDOWS)
+        const auto file = CreateFileA( filename.c_str() , GENERIC_READ , FILE_SHARE_READ , nullptr , OPEN_EXISTING , FILE_ATTRIBUTE_NORMAL , nullptr );
+        if( file == INVALID_HANDLE_VALUE )
+            return nullptr;
+
+        // the view keeps the mapping alive, both handles can be closed right away
+        const char* bytes = nullptr;
+        LARGE_INTEGER file_size;
+        if( GetFileSizeEx( file , &file_size ) && file_size.QuadPart > 0 ){
+            const auto mapping = CreateFileMappingA( file , nullptr , PAGE_READONLY , 0 , 0 , nullptr );
+            if( mapping ){
+                bytes = (const char*)MapViewOfFile( mapping , FILE_MAP_READ , 0 , 0 , 0 );
+                CloseHandle( mapping );
+            }
+            size = (std::size_t)file_size.QuadPart;
+        }
+        CloseHandle( file );
+        return bytes;
+#else
+        const auto fd = open( filename.c_str() , O_RDONLY );
+        if( fd == -1 )
+            return nullptr;
+
+        // the mapping stays valid after the file descriptor is closed
+        void* bytes = MAP_FAILED;
+        struct stat st;
+        if( fstat( fd , &st ) == 0 && st.st_size > 0 ){
+            size = (std::size_t)st.st_size;
+            bytes = mmap( nullptr , size , PROT_READ , MAP_SHARED , fd , 0 );
+        }
+        close( fd );
+        return bytes == MAP_FAILED ? nullptr : (const char*)bytes;
+#endif
+    }
+
+    void unmapFile( const char* bytes , std::size_t size ){
+#if defined(SORT_IN_WINDOWS)
+        UnmapViewOfFile( bytes );
+#else
+        munmap( (void*)bytes , size );
+#endif
+    }
+
+    bool checkDimension( const unsigned int dims[3] ){
+        return  dims[0] == MERL_SAMPLING_RES_THETA_H &&
+                dims[1] == MERL_SAMPLING_RES_THETA_D &&
+                dims[2] == MERL_SAMPLING_RES_PHI_D;
+    }
+}
+
+MerlData::~MerlData(){
+    if( m_mapped )
+        unmapFile( m_mapped , m_mappedSize );
+}
 
 // Load data from file
 bool MerlData::LoadResource( const std::string filename )
 {
-    // get full path
-    auto str = ( filename );
+    // sharing the pages of the file is preferred, the raw table is scaled during lookup
+    auto size = (std::size_t)0;
+    if( const auto bytes = mapFile( filename , size ) ){
+        unsigned int dims[3];
+        memcpy( dims , bytes , MERL_HEADER_SIZE );
+        if( size < MERL_FILE_SIZE || !checkDimension( dims ) ){
+            unmapFile( bytes , size );
+            return false;
+        }
+
+        m_mapped = bytes;
+        m_mappedSize = size;
+        return true;
+    }
 
     // try to open the file
-    std::ifstream file( str.c_str() , std::ios::binary );
+    std::ifstream file( filename.c_str() , std::ios::binary );
     if( false == file.is_open() )
         return false;
 
     unsigned int dims[3];
-    file.read( (char*)dims , sizeof(unsigned int) * 3 );
+    file.read( (char*)dims , MERL_HEADER_SIZE );
 
     // check dimension
-    if( dims[0] != MERL_SAMPLING_RES_THETA_H ||
-       dims[1] != MERL_SAMPLING_RES_THETA_D ||
-       dims[2] != MERL_SAMPLING_RES_PHI_D ){
+    if( !checkDimension( dims ) ){
         file.close();
         return false;
     }
 
-    // allocate data
-    auto trunksize = dims[0] * dims[1] * dims[2];
-    auto size = 3u * trunksize;
-    m_data = std::make_unique<double[]>(size);
-    file.read( (char*)m_data.get() , sizeof( double ) * size );
+    // convert the data to single precision one channel at a time
+    m_data = std::make_unique<float[]>( 3 * MERL_SAMPLING_COUNT );
+    std::unique_ptr<double[]> channel = std::make_unique<double[]>( MERL_SAMPLING_COUNT );
+    for( auto c = 0u ; c < 3 ; ++c ){
+        file.read( (char*)channel.get() , sizeof( double ) * MERL_SAMPLING_COUNT );
 
-    unsigned offset = 0;
-    for(auto i = 0u ; i < trunksize ; i++ )
-        m_data[offset++] *= MERL_RED_SCALE;
-    for(auto i = 0u ; i < trunksize ; i++ )
-        m_data[offset++] *= MERL_GREEN_SCALE;
-    for(auto i = 0u ; i < trunksize ; i++ )
-        m_data[offset++] *= MERL_BLUE_SCALE;
+        auto dst = m_data.get() + c * MERL_SAMPLING_COUNT;
+        for( auto i = 0u ; i < MERL_SAMPLING_COUNT ; ++i )
+            dst[i] = (float)( channel[i] * MERL_SCALES[c] );
+    }
+    m_memory.Set( sizeof( float ) * 3 * MERL_SAMPLING_COUNT );
 
     file.close();
     return true;
 }
 
+float MerlData::lookup( unsigned channel , unsigned index ) const
+{
+    index += channel * MERL_SAMPLING_COUNT;
+    if( m_data )
+        return m_data[index];
+
+    // the table right after the header is not aligned to double
+    double v;
+    memcpy( &v , m_mapped + MERL_HEADER_SIZE + sizeof( double ) * index , sizeof( double ) );
+    return (float)( v * MERL_SCALES[channel] );
+}
+
 // evaluate bxdf
 Spectrum MerlData::f( const Vector& Wo , const Vector& Wi ) const
 {
@@ -120,13 +209,7 @@ Spectrum MerlData::f( const Vector& Wo , const Vector& Wi ) const
     // calculate the index
     auto index = wdPhiIndex + MERL_SAMPLING_RES_PHI_D * (wdThetaIndex + whThetaIndex * MERL_SAMPLING_RES_THETA_D);
 
-    const auto r = (float)( m_data[ index ] );
-    index += MERL_SAMPLING_COUNT;
-    const auto g = (float)( m_data[ index ] );
-    index += MERL_SAMPLING_COUNT;
-    const auto b = (float)( m_data[ index ] );
-
-    return Spectrum( r , g , b );
+    return Spectrum( lookup( 0 , index ) , lookup( 1 , index ) , lookup( 2 , index ) );
 }
 
  Merl::Merl(const ClosureTypeMERL& params, const Spectrum& weight, bool doubleSided)
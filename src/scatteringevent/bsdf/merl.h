@@ -19,6 +19,7 @@
 
 #include "bxdf.h"
 #include "core/resource.h"
+#include "core/memory.h"
 #include "scatteringevent/bsdf/bxdf_utils.h"
 
 DECLARE_CLOSURE_TYPE_BEGIN(ClosureTypeMERL, "merl")
@@ -39,6 +40,9 @@ DECLARE_CLOSURE_TYPE_END(ClosureTypeMERL)
 class MerlData : public Resource
 {
 public:
+    //! Release the memory mapped file if there is one.
+    ~MerlData() override;
+
     //! Evaluate the BRDF
     //! @param wo   Exitant direction in shading coordinate.
     //! @param wi   Incident direction in shading coordinate.
@@ -46,15 +50,29 @@ public:
     Spectrum f( const Vector& wo , const Vector& wi ) const;
 
     //! Load brdf data from MERL file.
+    //!
+    //! The file is memory mapped in read-only mode if possible. Pages of a mapped file live in the page cache of the OS,
+    //! they are shared by all materials referring to the file and by all SORT processes on the same machine. If the file
+    //! can't be mapped, the table is loaded in single precision, which takes half the memory of the file.
+    //!
     //! @param filename Name of the MERL file.
     bool    LoadResource(const std::string filename) override;
 
     //! Whether there is valid data loaded.
     //! @return True if data is valid, otherwise it will return false.
-    bool    IsValid() { return m_data != 0; }
+    bool    IsValid() { return m_mapped != nullptr || m_data != nullptr; }
 
 private:
-    std::unique_ptr<double[]>    m_data = nullptr;   /**< The actual data of MERL brdf. */
+    std::unique_ptr<float[]>    m_data = nullptr;       /**< Scaled reflectance in single precision, only used if the file is not mapped. */
+    const char*                 m_mapped = nullptr;     /**< The MERL file mapped in memory. */
+    std::size_t                 m_mappedSize = 0;       /**< Size of the mapped file in bytes. */
+    TrackedMemory               m_memory = TrackedMemory( MemoryCategory::MeasuredBxdf );   /**< Memory of the table, mapped files are not accounted as they are paged by the OS. */
+
+    //! Reflectance of a channel in the table.
+    //! @param channel  The color channel, 0 for red, 1 for green and 2 for blue.
+    //! @param index    Index of the entry in the table of the channel.
+    //! @return         The scaled reflectance.
+    float   lookup( unsigned channel , unsigned index ) const;
 };
 
 //! @brief  MERL brdf.
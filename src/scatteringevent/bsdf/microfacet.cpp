@@ -19,8 +19,10 @@
 #include "microfacet.h"
 #include "sampler/sample.h"
 #include "math/utils.h"
+#include "math/fastmath.h"
 #include "core/memory.h"
 #include "scatteringevent/bsdf/fresnel.h"
+#include "scatteringevent/bsdf/energycompensation.h"
 
 IMPLEMENT_CLOSURE_TYPE_BEGIN(ClosureTypeMirror)
 IMPLEMENT_CLOSURE_TYPE_VAR(ClosureTypeMirror, Tsl_float3, base_color)
@@ -123,7 +125,7 @@ float Blinn::D(const Vector& h) const {
     if (NoH <= 0.0f) return 0.0f;
     const auto sin_phi_h_sq = sinPhi2(h);
     const auto cos_phi_h_sq = 1.0f - sin_phi_h_sq;
-    return expUV * pow(NoH, cos_phi_h_sq * expU + sin_phi_h_sq * expV) * INV_TWOPI;
+    return expUV * FastPow(NoH, cos_phi_h_sq * expU + sin_phi_h_sq * expV) * INV_TWOPI;
 }
 
 Vector Blinn::sample_f( const BsdfSample& bs ) const {
@@ -143,7 +145,7 @@ Vector Blinn::sample_f( const BsdfSample& bs ) const {
     const auto sin_phi_h = std::sin(phi);
     const auto sin_phi_h_sq = sin_phi_h * sin_phi_h;
     const auto alpha = expU * (1.0f - sin_phi_h_sq) + expV * sin_phi_h_sq;
-    const auto cos_theta = std::pow(bs.u, 1.0f / (alpha + 2.0f));
+    const auto cos_theta = FastPow(bs.u, 1.0f / (alpha + 2.0f));
     const auto sin_theta = sqrt( 1.0f - SQR( cos_theta ) ) ;
 
     return sphericalVec(sin_theta, cos_theta, phi);
@@ -181,11 +183,11 @@ float Beckmann::D(const Vector& h) const {
     // Isotropic model:     D(w_h) = pow( e , -(tan(\theta_h)/alpha)^2 ) / ( PI * alpha^2 * cos(\theta_h)^4 )
     const auto cos_theta_h_sq = cosTheta2(h);
     if( cos_theta_h_sq <= 0.0f ) return 0.f;
-    return exp( ( SQR( h.x ) / alphaU2 + SQR( h.z ) / alphaV2 ) / (-cos_theta_h_sq) ) / ( PI * alphaUV * SQR( cos_theta_h_sq ) );
+    return FastExp( ( SQR( h.x ) / alphaU2 + SQR( h.z ) / alphaV2 ) / (-cos_theta_h_sq) ) / ( PI * alphaUV * SQR( cos_theta_h_sq ) );
 }
 
 Vector Beckmann::sample_f( const BsdfSample& bs ) const {
-    const auto logSample = std::log( bs.u );
+    const auto logSample = FastLog( bs.u );
 
     float theta, phi;
     if( alphaU == alphaV ){
@@ -207,13 +209,72 @@ Vector Beckmann::sample_f( const BsdfSample& bs ) const {
     return sphericalVec(theta, phi);
 }
 
+// Sample the slopes of visible normals of the Beckmann distribution with unit roughness, the view direction is in the xy plane.
+static void sampleBeckmannSlopes( float cos_theta , float u , float v , float& slope_x , float& slope_y ){
+    // normal incidence sees the whole distribution
+    if( cos_theta > 0.9999f ){
+        const auto r = std::sqrt( -FastLog( 1.0f - u ) );
+        FastSinCos( TWO_PI * v , slope_y , slope_x );
+        slope_x *= r;
+        slope_y *= r;
+        return;
+    }
+
+    const auto sin_theta = std::sqrt( std::max( 0.0f , 1.0f - cos_theta * cos_theta ) );
+    const auto tan_theta = sin_theta / cos_theta;
+    const auto cot_theta = 1.0f / tan_theta;
+    const auto inv_sqrt_pi = 1.0f / std::sqrt( PI );
+
+    // the marginal cdf of the slope along the view direction is inverted with a few newton iterations, starting from a fit
+    auto a = -1.0f , c = FastErf( cot_theta );
+    const auto sample_x = std::max( u , 1e-6f );
+    const auto theta = std::acos( cos_theta );
+    const auto fit = 1.0f + theta * ( -0.876f + theta * ( 0.4265f - 0.0594f * theta ) );
+    auto b = c - ( 1.0f + c ) * FastPow( 1.0f - sample_x , fit );
+    const auto normalization = 1.0f / ( 1.0f + c + inv_sqrt_pi * tan_theta * FastExp( -cot_theta * cot_theta ) );
+    for( auto it = 0 ; it < 10 ; ++it ){
+        if( !( b >= a && b <= c ) )
+            b = 0.5f * ( a + c );
+        const auto inv_erf = ErfInv( b );
+        const auto value = normalization * ( 1.0f + b + inv_sqrt_pi * tan_theta * FastExp( -inv_erf * inv_erf ) ) - sample_x;
+        if( std::fabs( value ) < 1e-5f )
+            break;
+        const auto derivative = normalization * ( 1.0f - inv_erf * tan_theta );
+        if( value > 0.0f )
+            c = b;
+        else
+            a = b;
+        b -= value / derivative;
+    }
+    slope_x = ErfInv( b );
+    slope_y = ErfInv( 2.0f * std::max( v , 1e-6f ) - 1.0f );
+}
+
+Vector Beckmann::sample_visible( const Vector& wo , const BsdfSample& bs ) const {
+    // stretch the view direction so that the distribution is the one of unit roughness
+    const auto v = wo.y < 0.0f ? -wo : wo;
+    const auto vs = normalize( Vector( v.x * alphaU , v.y , v.z * alphaV ) );
+
+    float slope_x, slope_y;
+    sampleBeckmannSlopes( cosTheta( vs ) , bs.u , bs.v , slope_x , slope_y );
+
+    // rotate the slopes to the azimuth of the view direction and unstretch them
+    const auto cos_phi = cosPhi( vs ) , sin_phi = sinPhi( vs );
+    const auto sx = alphaU * ( cos_phi * slope_x - sin_phi * slope_y );
+    const auto sz = alphaV * ( sin_phi * slope_x + cos_phi * slope_y );
+    return normalize( Vector( -sx , 1.0f , -sz ) );
+}
+
 float Beckmann::G1( const Vector& v ) const {
+    // The exact Smith masking function is used, visible normals are sampled exactly and their pdf has to match.
     const auto absTan = fabs( tanTheta(v) );
     if( IsInf( absTan ) ) return 0.0f;
+    if( absTan == 0.0f ) return 1.0f;
     const auto cos_phi_sq = cosPhi2(v);
     const auto a = 1.0f / ( sqrt( cos_phi_sq * alphaU2 + ( 1.0f - cos_phi_sq ) * alphaV2 ) * absTan );
-    if( a > 1.6f || IsInf( a ) ) return 1.0f;
-    return ( 3.535f * a + 2.181f * a * a ) / ( 1.0f + 2.276f * a + 2.577f * a * a );
+    if( IsInf( a ) ) return 1.0f;
+    const auto lambda = 0.5f * ( FastErf( a ) - 1.0f ) + FastExp( -a * a ) / ( 2.0f * a * std::sqrt( PI ) );
+    return 1.0f / ( 1.0f + lambda );
 }
 
 GGX::GGX( float roughnessU , float roughnessV ) {
@@ -265,6 +326,22 @@ Vector GGX::sample_f( const BsdfSample& bs ) const {
     return sphericalVec(theta, phi);
 }
 
+Vector GGX::sample_visible( const Vector& wo , const BsdfSample& bs ) const {
+    // stretch the view direction so that the distribution is the one of unit roughness
+    const auto v = wo.y < 0.0f ? -wo : wo;
+    const auto vs = normalize( Vector( v.x * alphaU , v.y , v.z * alphaV ) );
+
+    // visible normals of a unit roughness GGX are the halfway vectors between the view direction and points on a spherical
+    // cap of the unit sphere, the cap is the part of the sphere above the plane at -vs.y
+    const auto phi = TWO_PI * bs.u;
+    const auto y = ( 1.0f - bs.v ) * ( 1.0f + vs.y ) - vs.y;
+    const auto sin_theta = std::sqrt( std::max( 0.0f , 1.0f - y * y ) );
+    const auto h = Vector( sin_theta * std::cos( phi ) , y , sin_theta * std::sin( phi ) ) + vs;
+
+    // unstretch the normal
+    return normalize( Vector( h.x * alphaU , std::max( 0.0f , h.y ) , h.z * alphaV ) );
+}
+
 float GGX::G1( const Vector& v ) const {
     const auto tan_theta_sq = tanTheta2(v);
     if( IsInf( tan_theta_sq ) ) return 0.0f;
@@ -286,6 +363,7 @@ Microfacet::Microfacet(const MF_Dist_Type distType, float ru , float rv , const
 MicroFacetReflection::MicroFacetReflection(const ClosureTypeMicrofacetReflectionGGX& params, const Spectrum& weight, bool doubleSided):
     Microfacet(MF_DIST_GGX, params.roughness_u, params.roughness_v, weight, (BXDF_TYPE)(BXDF_DIFFUSE | BXDF_REFLECTION), params.normal, false),
     R(params.base_color), fresnel(SORT_MALLOC(FresnelConductor)(params.eta, params.absorption)) {
+    compensateEnergy(params.roughness_u, params.roughness_v);
 }
 
 MicroFacetReflection::MicroFacetReflection(const ClosureTypeMicrofacetReflectionBlinn& params, const Spectrum& weight, bool doubleSided) :
@@ -301,10 +379,11 @@ MicroFacetReflection::MicroFacetReflection(const ClosureTypeMicrofacetReflection
 MicroFacetReflection::MicroFacetReflection(const ClosureTypeMicrofacetReflectionDielectric& params, const Spectrum& weight, bool doubleSided) :
      Microfacet(MF_DIST_GGX, params.roughness_u, params.roughness_v, weight, (BXDF_TYPE)(BXDF_DIFFUSE | BXDF_REFLECTION), params.normal, false),
      R(params.base_color), fresnel(SORT_MALLOC(FresnelDielectric)(params.iorI, params.iorT)) {
+    compensateEnergy(params.roughness_u, params.roughness_v);
 }
 
-MicroFacetReflection::MicroFacetReflection(const ClosureTypeMirror& params, const Spectrum& weight, bool doubleSided ):
-    Microfacet(MF_DIST_GGX, 0.0f, 0.0f, weight, (BXDF_TYPE)(BXDF_DIFFUSE | BXDF_REFLECTION), params.normal, false), R(params.base_color), fresnel(SORT_MALLOC(FresnelNo)()) {
+MicroFacetReflection::MicroFacetReflection(const ClosureTypeMirror& params, const Spectrum& weight, bool doubleSided , float roughness ):
+    Microfacet(MF_DIST_GGX, roughness, roughness, weight, (BXDF_TYPE)(BXDF_DIFFUSE | BXDF_REFLECTION), params.normal, false), R(params.base_color), fresnel(SORT_MALLOC(FresnelNo)()) {
 }
 
 Spectrum MicroFacetReflection::f( const Vector& wo , const Vector& wi ) const {
@@ -318,12 +397,23 @@ Spectrum MicroFacetReflection::f( const Vector& wo , const Vector& wi ) const {
     // evaluate fresnel term
     const auto wh = normalize(wi + wo);
     const auto F = fresnel->Evaluate( dot(wo,wh) );
-    return R * distribution->D(wh) * F * distribution->G(wo,wi) / ( 4.0f * NoV );
+    const auto single = R * distribution->D(wh) * F * distribution->G(wo,wi) / ( 4.0f * NoV );
+    if( msRoughness < 0.0f )
+        return single;
+
+    // energy bouncing more than once among the facets
+    return single + R * GGXMultiScattering( msFresnel , NoV , absCosTheta( wi ) , msRoughness );
+}
+
+void MicroFacetReflection::compensateEnergy( float ru , float rv ){
+    // the table is isotropic, an anisotropic surface is approximated by the geometric mean of its roughness
+    msRoughness = std::sqrt( ru * rv );
+    msFresnel = AverageFresnel( *fresnel );
 }
 
 Spectrum MicroFacetReflection::sample_f( const Vector& wo , Vector& wi , const BsdfSample& bs , float* pPdf ) const {
-    // sampling the normal
-    const auto wh = distribution->sample_f( bs );
+    // sampling a normal visible from the exitant direction, the reflected direction is rarely below the surface
+    const auto wh = distribution->sample_visible( wo , bs );
 
     // reflect the incident direction
     wi = reflect( wo , wh );
@@ -342,7 +432,21 @@ float MicroFacetReflection::pdf( const Vector& wo , const Vector& wi ) const {
 
     const auto h = normalize( wo + wi );
     const auto EoH = absDot( wo , h );
-    return distribution->Pdf(h) / (4.0f * EoH);
+    return distribution->PdfVisible( wo , h ) / (4.0f * EoH);
+}
+
+bool MicroFacetReflection::GetVMFLobe( const Vector& wo , Vector& axis , float& kappa ) const {
+    const auto swo = bsdfToBxdf( wo );
+    if( swo.y == 0.0f || ( !doubleSided && !PointingUp( swo ) ) )
+        return false;
+
+    const auto concentration = distribution->VMFConcentration();
+    if( concentration <= 0.0f )
+        return false;
+
+    axis = bxdfToBsdf( reflect( swo ) );
+    kappa = concentration / ( 4.0f * std::max( absCosTheta( swo ) , 0.1f ) );
+    return true;
 }
 
 MicroFacetRefraction::MicroFacetRefraction(const ClosureTypeMicrofacetRefractionGGX&params, const Spectrum& weight):
@@ -387,8 +491,8 @@ Spectrum MicroFacetRefraction::sample_f( const Vector& wo , Vector& wi , const B
     if( cosTheta( wo ) == 0.0f )
         return 0.0f;
 
-    // sampling the normal
-    const auto wh = distribution->sample_f( bs );
+    // sampling a normal visible from the exitant direction
+    const auto wh = distribution->sample_visible( wo , bs );
 
     // try to get refracted ray
     auto total_reflection = false;
@@ -409,5 +513,5 @@ float MicroFacetRefraction::pdf( const Vector& wo , const Vector& wi ) const {
     // Compute change of variables _dwh\_dwi_ for microfacet transmission
     const auto sqrtDenom = dot(wo, wh) + eta * dot(wi, wh);
     const auto dwh_dwi = eta * eta * absDot(wi, wh) / (sqrtDenom * sqrtDenom);
-    return distribution->Pdf(wh) * dwh_dwi;
+    return distribution->PdfVisible(wo, wh) * dwh_dwi;
 }
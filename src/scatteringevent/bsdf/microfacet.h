@@ -112,10 +112,49 @@ public:
         return D( wh ) * absCosTheta(wh);
     }
 
+    //! @brief Sampling a normal visible from a direction, respect to the distribution of visible normals.
+    //!
+    //! Normals facing away from the direction are never picked, neither are the ones hidden behind other micro facets.
+    //! Distributions that can't sample their visible normals sample the NDF instead.
+    //!
+    //! @param wo   The direction the normals are visible from, it is flipped to the upper hemisphere if it is below.
+    //! @param bs   Sample holding all necessary random variables.
+    //! @return     Sampled normal direction in the upper hemisphere.
+    virtual Vector sample_visible( const Vector& wo , const BsdfSample& bs ) const {
+        return sample_f( bs );
+    }
+
+    //! @brief PDF of sampling a specific normal direction visible from a direction.
+    //!
+    //! @param wo   The direction the normals are visible from.
+    //! @param wh   Normal direction to be sampled, it could be in either hemisphere.
+    //! @return     The pdf of picking the normal by 'sample_visible'.
+    virtual float PdfVisible( const Vector& wo , const Vector& wh ) const {
+        return Pdf( wh );
+    }
+
+    //! @brief Concentration of a von Mises-Fisher distribution roughly matching the NDF around the normal.
+    //!
+    //! @return     The concentration, zero means the NDF can't be approximated.
+    virtual float VMFConcentration() const {
+        return 0.0f;
+    }
+
 protected:
     //! @brief Smith shadow-masking function G1
     virtual float G1( const Vector& v ) const  = 0;
 
+    //! @brief PDF of the distribution of visible normals, D(wh) * G1(wo) * max( 0 , dot( wo , wh ) ) / cos(wo).
+    //!
+    //! Both directions are flipped to the upper hemisphere first.
+    float visibleNormalPdf( const Vector& wo , const Vector& wh ) const {
+        const auto NoV = absCosTheta( wo );
+        const auto VoH = wo.y * wh.y < 0.0f ? -dot( wo , wh ) : dot( wo , wh );
+        if( NoV == 0.0f || VoH <= 0.0f )
+            return 0.0f;
+        return D( wh ) * G1( wo ) * VoH / NoV;
+    }
+
     //! @brief Check if the two vectors are in the same hemisphere in shading coordinate
     bool SameHemiSphere(const Vector& wo, const Vector& wi) const { return wo.y * wi.y > 0.0f; }
 };
@@ -137,6 +176,15 @@ public:
     //! @return     Sampled normal direction based on the NDF.
     Vector sample_f( const BsdfSample& bs ) const override;
 
+    //! @brief Concentration of a von Mises-Fisher distribution roughly matching the NDF around the normal.
+    //!
+    //! cos(theta)^e is close to exp(e * (cos(theta) - 1)) around the normal.
+    //!
+    //! @return     The concentration.
+    float VMFConcentration() const override {
+        return std::max( 0.0f , expUV - 2.0f );
+    }
+
 private:
     float expU , expV , exp , expUV;      /**< Internal data used for NDF calculation. */
     float alphaU2 , alphaV2;
@@ -162,6 +210,33 @@ public:
     //! @return     Sampled normal direction based on the NDF.
     Vector sample_f( const BsdfSample& bs ) const override;
 
+    //! @brief Sampling a normal visible from a direction, respect to the distribution of visible normals.
+    //!
+    //! 'An Improved Visible Normal Sampling Routine for the Beckmann Distribution', Wenzel Jakob 2014
+    //!
+    //! @param wo   The direction the normals are visible from, it is flipped to the upper hemisphere if it is below.
+    //! @param bs   Sample holding all necessary random variables.
+    //! @return     Sampled normal direction in the upper hemisphere.
+    Vector sample_visible( const Vector& wo , const BsdfSample& bs ) const override;
+
+    //! @brief PDF of sampling a specific normal direction visible from a direction.
+    //!
+    //! @param wo   The direction the normals are visible from.
+    //! @param wh   Normal direction to be sampled, it could be in either hemisphere.
+    //! @return     The pdf of picking the normal by 'sample_visible'.
+    float PdfVisible( const Vector& wo , const Vector& wh ) const override {
+        return visibleNormalPdf( wo , wh );
+    }
+
+    //! @brief Concentration of a von Mises-Fisher distribution roughly matching the NDF around the normal.
+    //!
+    //! exp(-tan(theta)^2 / alpha^2) is close to exp(2 / alpha^2 * (cos(theta) - 1)) around the normal.
+    //!
+    //! @return     The concentration.
+    float VMFConcentration() const override {
+        return 2.0f / alphaUV;
+    }
+
 private:
     float alphaU , alphaV;        /**< Internal data used for NDF calculation. */
     float alphaU2 , alphaV2 , alphaUV, alpha;
@@ -187,6 +262,33 @@ public:
     //! @return     Sampled normal direction based on the NDF.
     Vector sample_f( const BsdfSample& bs ) const override;
 
+    //! @brief Sampling a normal visible from a direction, respect to the distribution of visible normals.
+    //!
+    //! 'Sampling Visible GGX Normals with Spherical Caps', Jonathan Dupuy and Anis Benyoub 2023
+    //!
+    //! @param wo   The direction the normals are visible from, it is flipped to the upper hemisphere if it is below.
+    //! @param bs   Sample holding all necessary random variables.
+    //! @return     Sampled normal direction in the upper hemisphere.
+    Vector sample_visible( const Vector& wo , const BsdfSample& bs ) const override;
+
+    //! @brief PDF of sampling a specific normal direction visible from a direction.
+    //!
+    //! @param wo   The direction the normals are visible from.
+    //! @param wh   Normal direction to be sampled, it could be in either hemisphere.
+    //! @return     The pdf of picking the normal by 'sample_visible'.
+    float PdfVisible( const Vector& wo , const Vector& wh ) const override {
+        return visibleNormalPdf( wo , wh );
+    }
+
+    //! @brief Concentration of a von Mises-Fisher distribution roughly matching the NDF around the normal.
+    //!
+    //! The tail of GGX is way longer than a vMF distribution, the peak matches the one of Beckmann though.
+    //!
+    //! @return     The concentration.
+    float VMFConcentration() const override {
+        return 2.0f / alphaUV;
+    }
+
 protected:
     float alphaU , alphaV;        /**< Internal data used for NDF calculation. */
     float alphaU2 , alphaV2 , alphaUV , alpha;
@@ -231,7 +333,8 @@ public:
     //! @param  params          Parameter set.
     //! @param  weight          Weight of this bxdf.
     //! @param  doubleSided     Whether the material is double sided
-    MicroFacetReflection(const ClosureTypeMirror& params, const Spectrum& weight, bool doubleSided = false);
+    //! @param  roughness       Roughness of the mirror, only non-zero when it is blurred by path regularization.
+    MicroFacetReflection(const ClosureTypeMirror& params, const Spectrum& weight, bool doubleSided = false, float roughness = 0.0f);
 
     //! @brief Constructor from parameter set
     //!
@@ -295,9 +398,35 @@ public:
     //! @return     The probability of choosing the out-going direction based on the Incident direction.
     float pdf( const Vector& wo , const Vector& wi ) const override;
 
+    //! @brief Directional albedo of the BRDF, approximated by the Fresnel term at the exitant direction.
+    //! @param wo   Exitant direction in shading coordinate.
+    //! @return     Fraction of energy from the exitant direction that is reflected.
+    Spectrum albedo( const Vector& wo ) const override{
+        return R * fresnel->Evaluate( absCosTheta( wo ) );
+    }
+
+    //! @brief  Approximate the lobe around the mirrored exitant direction with a von Mises-Fisher distribution.
+    //!
+    //! 'All-Frequency Rendering of Dynamic, Spatially-Varying Reflectance', Wang et al. 2009. Reflecting the normals
+    //! doubles the angles, the lobe is also stretched at grazing angles.
+    //!
+    //! @param  wo      The exitant direction in local space.
+    //! @param  axis    The center of the lobe in local space.
+    //! @param  kappa   The concentration of the lobe.
+    //! @return         Whether the bxdf could be approximated by a vMF lobe.
+    bool GetVMFLobe( const Vector& wo , Vector& axis , float& kappa ) const override;
+
 private:
     const Spectrum R;                   /**< Direction-hemisphere reflection. */
     const Fresnel* fresnel = nullptr;   /**< Fresnel term. */
+    float    msRoughness = -1.0f;       /**< Roughness used to compensate energy lost by multiple scattering, negative means no compensation. */
+    Spectrum msFresnel;                 /**< Average Fresnel term used to tint the compensated energy. */
+
+    //! @brief  Enable energy compensation of multiple scattering, only valid for GGX distribution.
+    //!
+    //! @param ru   Roughness along the tangent.
+    //! @param rv   Roughness along the bi-tangent.
+    void    compensateEnergy( float ru , float rv );
 };
 
 //! @brief Microfacet Refraction BTDF.
@@ -366,6 +495,13 @@ public:
     //! @return     The probability of choosing the out-going direction based on the Incident direction.
     float pdf( const Vector& wo , const Vector& wi ) const override;
 
+    //! @brief Directional albedo of the BTDF, approximated by the energy left by the Fresnel term at the exitant direction.
+    //! @param wo   Exitant direction in shading coordinate.
+    //! @return     Fraction of energy from the exitant direction that is transmitted.
+    Spectrum albedo( const Vector& wo ) const override{
+        return T * ( WHITE_SPECTRUM - fresnel.Evaluate( cosTheta( wo ) ) );
+    }
+
 private:
     const Spectrum            T;          /**< Direction-hemisphere transmittance. */
     float                     etaI;       /**< Index of refraction of the side that normal points. */
@@ -56,6 +56,13 @@ public:
     //! @return     The Evaluated BRDF value.
     Spectrum f( const Vector& wo , const Vector& wi ) const override;
 
+    //! @brief Directional albedo of the BRDF.
+    //! @param wo   Exitant direction in shading coordinate.
+    //! @return     The direction-hemisphere reflectance.
+    Spectrum albedo( const Vector& wo ) const override{
+        return R;
+    }
+
 private:
     const Spectrum R;   /**< Direction-Hemisphere reflection or total reflection. */
     float   A;          /**< Internal data for OrenNayar computation. */
@@ -46,6 +46,13 @@ public:
     //! @param weight       Weight of this BRDF.
     // Transparent( const Params& param , const Spectrum& weight ):Bxdf(weight, (BXDF_TYPE)(BXDF_DIFFUSE|BXDF_REFLECTION), DIR_UP, true),A(param.attenuation){}
 
+    //! @brief      Transparent material passes lights through in the same direction.
+    //!
+    //! @return     It is always a delta function.
+    bool IsDelta() const override {
+        return true;
+    }
+
     //! Evaluate the BRDF
     //! @param wo   Exitant direction in shading coordinate.
     //! @param wi   Incident direction in shading coordinate.
@@ -18,6 +18,7 @@
 #pragma once
 
 #include "core/define.h"
+#include "core/memory.h"
 #include "spectrum/spectrum.h"
 #include "math/vector3.h"
 #include "math/point.h"
@@ -42,15 +43,75 @@ struct BSSRDFIntersections{
     BSSRDFIntersection*     intersections[TOTAL_SSS_INTERSECTION_CNT] = { nullptr };
     unsigned                cnt = 0;
 
+    // number of nearest intersections to be recorded, the random walk only needs the nearest one
+    unsigned                capacity = TOTAL_SSS_INTERSECTION_CNT;
+
     // following field is only used for spatial data structure to evaluate intersections
     float                   maxt = FLT_MAX;
 
+    //! @brief  Whether an intersection with the primitive is recorded already.
+    //!
+    //! BVH with spatial splits could reference a primitive in more than one leaf, its intersection shouldn't be recorded twice.
+    //!
+    //! @param  primitive   The primitive to be checked.
+    //! @return             Whether there is an intersection with the primitive.
+    bool    IsRecorded( const Primitive* primitive ) const {
+        for( auto i = 0u ; i < cnt ; ++i ){
+            if( intersections[i]->intersection.primitive == primitive )
+                return true;
+        }
+        return false;
+    }
+
+    //! @brief  Pick the slot for a new intersection.
+    //!
+    //! Until all slots are taken, a new one is allocated for the intersection. After that, the farthest recorded intersection
+    //! gives its slot to the new one. 'ResolveMaxDepth' needs to be called once the slot is filled. Slots allocated by an
+    //! earlier query with the same container are reused.
+    //!
+    //! @param  t           The distance of the new intersection.
+    //! @return             The slot to be filled, nullptr if the intersection is not among the nearest ones.
+    SurfaceInteraction* Allocate( const float t ) {
+        if( t >= maxt )
+            return nullptr;
+
+        if( cnt < capacity ){
+            if( IS_PTR_INVALID(intersections[cnt]) )
+                intersections[cnt] = SORT_MALLOC(BSSRDFIntersection)();
+            return &intersections[cnt++]->intersection;
+        }
+
+        auto picked_i = 0u;
+        for( auto i = 1u ; i < cnt ; ++i ){
+            if( intersections[picked_i]->intersection.t < intersections[i]->intersection.t )
+                picked_i = i;
+        }
+        return &intersections[picked_i]->intersection;
+    }
+
+    //! @brief  Record an intersection if it is among the nearest ones.
+    //!
+    //! @param  intersection    The intersection to be recorded.
+    void    Add( const SurfaceInteraction& intersection ) {
+        auto slot = Allocate( intersection.t );
+        if( IS_PTR_INVALID(slot) )
+            return;
+
+        *slot = intersection;
+        ResolveMaxDepth();
+    }
+
     //! @brief  Resoved the maximum depth of all intersections.
+    //!
+    //! Nothing can be pruned until all slots are taken, after which only intersections nearer than the farthest recorded
+    //! one are of interest.
     void    ResolveMaxDepth() {
+        if( cnt < capacity )
+            return;
+
         maxt = 0.0f;
-        maxt = std::max(intersections[0]->intersection.t, intersections[1]->intersection.t);
-        maxt = std::max(maxt, intersections[2]->intersection.t);
-        maxt = std::max(maxt, intersections[3]->intersection.t);
+        for( auto i = 0u ; i < cnt ; ++i )
+            maxt = std::max( maxt , intersections[i]->intersection.t );
     }
 };
 
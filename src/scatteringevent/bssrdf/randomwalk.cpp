@@ -0,0 +1,110 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "randomwalk.h"
+#include "core/rand.h"
+#include "core/scene.h"
+#include "core/samplemethod.h"
+#include "core/stats.h"
+#include "material/material.h"
+#include "medium/homogeneous.h"
+#include "medium/phasefunction.h"
+
+SORT_STATS_DEFINE_COUNTER(sRandomWalkCount)
+SORT_STATS_DEFINE_COUNTER(sRandomWalkStepCount)
+SORT_STATS_DEFINE_COUNTER(sRandomWalkLostCount)
+
+SORT_STATS_COUNTER("Subsurface Scattering", "Random Walks", sRandomWalkCount);
+SORT_STATS_AVG_COUNT("Subsurface Scattering", "Average Steps per Walk", sRandomWalkStepCount, sRandomWalkCount);
+SORT_STATS_COUNTER("Subsurface Scattering", "Walks Lost", sRandomWalkLostCount);
+
+// Walks still inside the object after this many steps are taken as absorbed.
+static constexpr unsigned RANDOM_WALK_MAX_STEPS = 256;
+
+// Mean free paths are clamped by this, walks in dense interiors would never finish otherwise.
+static constexpr float RANDOM_WALK_MIN_MFP = 0.0001f;
+
+RandomWalkBssrdf::RandomWalkBssrdf( const SurfaceInteraction* intersection , const Spectrum& R , const Spectrum& mfp , const Spectrum& ew , const float sw )
+    : Bssrdf( ew , sw ) , m_intersection( intersection ) {
+    // the albedo of single scattering and the extinction are fitted so that multiple scattering of the walk matches the
+    // reflectance and mean free path of the diffusion profile, Eq 4 and Eq 5 in the paper.
+    for( auto ch = 0 ; ch < SPECTRUM_SAMPLE ; ++ch ){
+        const auto A = saturate( R[ch] );
+        const auto albedo = 1.0f - exp( A * ( -5.09406f + A * ( 2.61188f - A * 4.31805f ) ) );
+        const auto s = 1.9f - A + 3.5f * SQR( A - 0.8f );
+        m_extinction[ch] = 1.0f / ( std::max( mfp[ch] , RANDOM_WALK_MIN_MFP ) * s );
+        m_scattering[ch] = albedo * m_extinction[ch];
+    }
+}
+
+void RandomWalkBssrdf::Sample_S( const Scene& scene , const Vector& wo , const Point& po , BSSRDFIntersections& inter ) const {
+    SORT_STATS(++sRandomWalkCount);
+
+    // the walk enters the surface through a diffuse transmission, on the other side of the extant direction
+    const auto nn = normalize( m_intersection->normal );
+    const auto btn = normalize( cross( nn , m_intersection->tangent ) );
+    const auto tn = normalize( cross( btn , nn ) );
+    const auto local = CosSampleHemisphere( sort_canonical() , sort_canonical() );
+    auto dir = btn * local.x + nn * local.y + tn * local.z;
+    if( dot( wo , m_intersection->gnormal ) > 0.0f )
+        dir = -dir;
+
+    // only the nearest hit with the primitives of the same material is of interest, it is where the walk leaves
+    const auto material_id = m_intersection->primitive->GetMaterial()->GetUniqueID();
+    inter.capacity = 1;
+
+    const IsotropicPhaseFunction phase;
+    Spectrum throughput( 1.0f );
+    auto p = po;
+    for( auto step = 0u ; step < RANDOM_WALK_MAX_STEPS ; ++step ){
+        SORT_STATS(++sRandomWalkStepCount);
+
+        const auto d = HomogeneousMedium::SampleFreeFlight( m_extinction , FLT_MAX );
+        const Ray ray( p , dir , 0 , 0.0001f , d );
+        scene.GetIntersect( ray , inter , material_id );
+
+        if( inter.cnt > 0 ){
+            // the walk passes through the rest of the interior and leaves the object
+            const auto t = inter.intersections[0]->intersection.t;
+            const auto tr = ( m_extinction * -t ).Exp();
+            const auto pdf = HomogeneousMedium::FreeFlightPdf( m_extinction , tr , false );
+            if( pdf <= 0.0f )
+                break;
+            inter.intersections[0]->weight = throughput * tr / pdf * GetEvalWeight();
+            return;
+        }
+
+        // the walk scatters inside the object
+        const auto tr = ( m_extinction * -d ).Exp();
+        const auto pdf = HomogeneousMedium::FreeFlightPdf( m_extinction , tr , true );
+        if( pdf <= 0.0f )
+            break;
+        throughput *= m_scattering * tr / pdf;
+        if( throughput.IsBlack() )
+            break;
+
+        // the isotropic phase function is sampled perfectly, it leaves the throughput untouched
+        auto phase_pdf = 0.0f;
+        Vector wi;
+        phase.Sample( -dir , wi , phase_pdf );
+        p = ray( d );
+        dir = wi;
+    }
+
+    SORT_STATS(++sRandomWalkLostCount);
+    inter.cnt = 0;
+}
@@ -0,0 +1,68 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "bssrdf.h"
+
+//! @brief  Random walk subsurface scattering.
+/**
+ * Practical and Controllable Subsurface Scattering for Production Path Tracing
+ * https://dl.acm.org/doi/10.1145/2897839.2927433
+ *
+ * Instead of a diffusion profile, the interior of the object is traced as a homogeneous medium. The walk enters the
+ * surface, scatters inside of it by free flight and phase function sampling like any homogeneous medium and leaves the
+ * object where it hits its surface again. It only takes one nearest hit query with the primitives of the same material
+ * at each step, while the separable BSSRDF records a few hits of a probe ray that may not even find the surface of
+ * thin features like ears and leaves. It follows the actual shape of the object, light passing through thin parts is
+ * not lost either.
+ */
+class RandomWalkBssrdf : public Bssrdf{
+public:
+    //! @brief  Constructor.
+    //!
+    //! @param  intersection    Intersection where the walk enters the object.
+    //! @param  R               Reflectance of the material, the albedo of the interior is picked to match it.
+    //! @param  mfp             Spectrum dependent mean free path.
+    //! @param  ew              Evaluation weight.
+    //! @param  sw              Sample weight.
+    RandomWalkBssrdf( const SurfaceInteraction* intersection , const Spectrum& R , const Spectrum& mfp , const Spectrum& ew , const float sw );
+
+    //! @brief  There is no closed form of the BSSRDF, it can only be sampled.
+    //!
+    //! @param  wo      Extant direction.
+    //! @param  po      Extant position.
+    //! @param  wi      Incident direction.
+    //! @param  pi      Incident position.
+    //! @return         Zero.
+    Spectrum    S( const Vector& wo , const Point& po , const Vector& wi , const Point& pi ) const override{
+        return 0.0f;
+    }
+
+    //! @brief  Walk through the interior of the object until it leaves its surface.
+    //!
+    //! @param  scene   The scene where ray tracing happens.
+    //! @param  wo      Extant direction.
+    //! @param  po      Extant position.
+    //! @param  inter   The point where the walk leaves the object, there is none if it is absorbed or lost.
+    void        Sample_S( const Scene& scene , const Vector& wo , const Point& po , BSSRDFIntersections& inter ) const override;
+
+private:
+    const SurfaceInteraction*   m_intersection; /**< Intersection where the walk enters the object. */
+    Spectrum                    m_extinction;   /**< Extinction coefficient of the interior. */
+    Spectrum                    m_scattering;   /**< Scattering coefficient of the interior. */
+};
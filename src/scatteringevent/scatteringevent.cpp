@@ -21,22 +21,32 @@
 #include "sampler/sample.h"
 #include "scatteringevent/bsdf/bxdf_utils.h"
 
+SORT_STATIC_FORCEINLINE float sampleWeight( const Bssrdf* bssrdf ){
+    return bssrdf->GetSampleWeight();
+}
+
+SORT_STATIC_FORCEINLINE float sampleWeight( const float pdf ){
+    return pdf;
+}
+
+// Lobes are never picked less often than this fraction of their sample weight, even if their albedo is estimated as
+// black, since the estimation is only a rough approximation that could be wrong for some directions.
+static constexpr float PICK_ALBEDO_MIN = 0.05f;
+
 template< class T  >
-SORT_STATIC_FORCEINLINE const T* pickScattering( const T* const scattering[] , unsigned int cnt , float totalWeight , float& pdf ){
+SORT_STATIC_FORCEINLINE unsigned int pickScattering( const T scattering[] , unsigned int cnt , float totalWeight , float& pdf ){
     sAssert( totalWeight > 0.0f , MATERIAL );
 
-    const T* picked = nullptr;
     auto r = sort_canonical() * totalWeight;
     for( auto i = 0u ; i < cnt ; ++i ){
-        const auto weight = scattering[i]->GetSampleWeight();
+        const auto weight = sampleWeight( scattering[i] );
         if( r <= weight || i == cnt - 1 ){
-            picked = scattering[i];
             pdf = weight / totalWeight;
-            break;
+            return i;
         }
         r -= weight;
     }
-    return picked;
+    return 0;
 }
 
 ScatteringEvent::ScatteringEvent( const SurfaceInteraction& intersection , const SE_Flag flag )
@@ -79,33 +89,95 @@ float ScatteringEvent::SampleScatteringType( SE_Flag& flag ) const{
     return flag == SE_EVALUATE_BXDF ? pdf_bxdf : 1.0f - pdf_bxdf;
 }
 
-Spectrum ScatteringEvent::Evaluate_BSDF( const Vector& wo , const Vector& wi ) const{
+const float* ScatteringEvent::pickPdf( const Vector& swo ) const{
+    if( m_pickValid && m_pickWo == swo )
+        return m_pickPdf;
+
+    // there is no need to estimate the albedo if there is only one lobe
+    if( m_bxdfCnt <= 1 ){
+        m_pickPdf[0] = 1.0f;
+    }else{
+        auto total = 0.0f;
+        for( auto i = 0u ; i < m_bxdfCnt ; ++i ){
+            const auto& lobe = m_bxdfs[i];
+            const auto albedo = ( lobe.bxdf->Albedo( swo ) * lobe.evalWeight ).GetIntensity() / std::max( lobe.evalWeight.GetIntensity() , 0.0001f );
+            m_pickPdf[i] = lobe.sampleWeight * std::max( albedo , PICK_ALBEDO_MIN );
+            total += m_pickPdf[i];
+        }
+
+        sAssert( total > 0.0f , MATERIAL );
+        for( auto i = 0u ; i < m_bxdfCnt ; ++i )
+            m_pickPdf[i] /= total;
+    }
+
+    m_pickWo = swo;
+    m_pickValid = true;
+    return m_pickPdf;
+}
+
+bool ScatteringEvent::HasDeltaBxdf() const{
+    for( auto i = 0u ; i < m_bxdfCnt ; ++i )
+        if( m_bxdfs[i].delta )
+            return true;
+    return false;
+}
+
+Spectrum ScatteringEvent::Evaluate_BSDF( const Vector& wo , const Vector& wi , float* pdf ) const{
     const auto swo = worldToLocal( wo );
     const auto swi = worldToLocal( wi );
+    const auto pick_pdf = pdf ? pickPdf( swo ) : nullptr;
     Spectrum r;
-    for( auto i = 0u ; i < m_bxdfCnt ; ++i )
-        r += m_bxdfs[i]->F( swo , swi ) * m_bxdfs[i]->GetEvalWeight();
+    auto p = 0.0f;
+    for( auto i = 0u ; i < m_bxdfCnt ; ++i ){
+        const auto& lobe = m_bxdfs[i];
+
+        // a delta lobe has no contribution in any direction other than the one it samples itself
+        if( lobe.delta )
+            continue;
+
+        r += lobe.bxdf->F( swo , swi ) * lobe.evalWeight;
+        if( pdf )
+            p += lobe.bxdf->Pdf( swo , swi ) * pick_pdf[i];
+    }
 
+    if( pdf )
+        *pdf = p;
     return r;
 }
 
-Spectrum ScatteringEvent::Sample_BSDF( const Vector& wo , Vector& wi , const class BsdfSample& bs , float& pdf ) const{
+Spectrum ScatteringEvent::EstimateAlbedo( const Vector& wo ) const{
+    const auto swo = worldToLocal( wo );
+    Spectrum r;
+    for( auto i = 0u ; i < m_bxdfCnt ; ++i ){
+        const auto& lobe = m_bxdfs[i];
+        r += lobe.delta ? lobe.evalWeight : lobe.bxdf->F( swo , DIR_UP ) * lobe.evalWeight * PI;
+    }
+    for( auto i = 0u ; i < m_bssrdfCnt ; ++i )
+        r += m_bssrdfs[i]->GetEvalWeight();
+    return r.Clamp( 0.0f , 1.0f );
+}
+
+Spectrum ScatteringEvent::Sample_BSDF( const Vector& wo , Vector& wi , const class BsdfSample& bs , float& pdf , bool* delta ) const{
     pdf = 0.0f;
 
     Spectrum ret;
     if( m_bxdfCnt == 0 )
         return ret;
 
-    // randomly pick a bxdf
-    float bxdf_pdf = 0.0f;
-    sAssert( m_bxdfTotalSampleWeight > 0.0f , MATERIAL );
-    const Bxdf* bxdf = pickScattering<Bxdf>( m_bxdfs , m_bxdfCnt , m_bxdfTotalSampleWeight , bxdf_pdf );
-
     // transform the 'wo' from world space to shading coordinate
     auto swo = worldToLocal( wo );
 
+    // randomly pick a bxdf, lobes scattering more energy towards 'wo' are more likely to be picked
+    float bxdf_pdf = 0.0f;
+    sAssert( m_bxdfTotalSampleWeight > 0.0f , MATERIAL );
+    const auto pick_pdf = pickPdf( swo );
+    const auto picked = pickScattering( pick_pdf , m_bxdfCnt , 1.0f , bxdf_pdf );
+    const auto& lobe = m_bxdfs[picked];
+    if( delta )
+        *delta = lobe.delta;
+
     // sample the direction
-    ret = bxdf->Sample_F( swo , wi , bs , &pdf ) * bxdf->GetEvalWeight();
+    ret = lobe.bxdf->Sample_F( swo , wi , bs , &pdf ) * lobe.evalWeight;
 
     // if there is no probability of sampling that direction , just return 0.0f
     if( pdf == 0.0f )
@@ -114,11 +186,12 @@ Spectrum ScatteringEvent::Sample_BSDF( const Vector& wo , Vector& wi , const cla
     // update the pdf
     pdf *= bxdf_pdf;
 
-    // setup pdf
+    // the direction could be sampled by any of the other lobes too, the pdf of the mixture is what MIS needs
     for( auto i = 0u; i < m_bxdfCnt ; ++i ){
-        if( m_bxdfs[i] != bxdf ){
-            ret += m_bxdfs[i]->F(wo,wi) * m_bxdfs[i]->GetEvalWeight();
-            pdf += m_bxdfs[i]->Pdf(wo,wi) * m_bxdfs[i]->GetSampleWeight();
+        const auto& other = m_bxdfs[i];
+        if( i != picked && !other.delta ){
+            ret += other.bxdf->F(swo,wi) * other.evalWeight;
+            pdf += other.bxdf->Pdf(swo,wi) * pick_pdf[i];
         }
     }
 
@@ -131,17 +204,41 @@ Spectrum ScatteringEvent::Sample_BSDF( const Vector& wo , Vector& wi , const cla
 float ScatteringEvent::Pdf_BSDF( const Vector& wo , const Vector& wi ) const{
     const auto lwo = worldToLocal( wo );
     const auto lwi = worldToLocal( wi );
+    const auto pick_pdf = pickPdf( lwo );
 
     auto pdf = 0.0f;
-    for( auto i = 0u ; i < m_bxdfCnt ; ++i )
-        pdf += m_bxdfs[i]->Pdf( lwo , lwi ) * m_bxdfs[i]->GetSampleWeight();
+    for( auto i = 0u ; i < m_bxdfCnt ; ++i ){
+        const auto& lobe = m_bxdfs[i];
+        if( !lobe.delta )
+            pdf += lobe.bxdf->Pdf( lwo , lwi ) * pick_pdf[i];
+    }
     return pdf;
 }
 
+bool ScatteringEvent::GetVMFLobe( const Vector& wo , VMFLobe& lobe ) const{
+    if( m_bxdfCnt == 0 )
+        return false;
+
+    const auto swo = worldToLocal( wo );
+    const auto pick_pdf = pickPdf( swo );
+
+    lobe.weight = 0.0f;
+    for( auto i = 0u ; i < m_bxdfCnt ; ++i ){
+        Vector axis;
+        auto kappa = 0.0f;
+        if( m_bxdfs[i].delta || pick_pdf[i] <= lobe.weight || !m_bxdfs[i].bxdf->GetVMFLobe( swo , axis , kappa ) )
+            continue;
+        lobe.axis = normalize( localToWorld( axis ) );
+        lobe.kappa = kappa;
+        lobe.weight = pick_pdf[i];
+    }
+    return lobe.weight > 0.0f;
+}
+
 void ScatteringEvent::Sample_BSSRDF( const Scene& scene , const Vector& wo , const Point& po , BSSRDFIntersections& inter , float& pdf ) const{
     // Randomly pick a bssrdf
     sAssert( m_bssrdfTotalSampleWeight > 0.0f , MATERIAL );
-    const Bssrdf* bssrdf = pickScattering<Bssrdf>( m_bssrdfs , m_bssrdfCnt , m_bssrdfTotalSampleWeight , pdf );
+    const Bssrdf* bssrdf = m_bssrdfs[pickScattering( m_bssrdfs , m_bssrdfCnt , m_bssrdfTotalSampleWeight , pdf )];
 
     // importance sampling the bssrdf
     bssrdf->Sample_S( scene , wo , po , inter );
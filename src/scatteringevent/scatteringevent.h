@@ -20,6 +20,7 @@
 #include "core/define.h"
 #include "math/interaction.h"
 #include "bssrdf/bssrdf.h"
+#include "math/vmf.h"
 
 enum SE_Flag : unsigned int{
     SE_NONE             = 0x00,
@@ -39,6 +40,19 @@ enum SE_Flag : unsigned int{
 class Bxdf;
 class MediumStack;
 
+//! @brief  Inline record of a bxdf lobe held by a scattering event.
+/**
+ * The weights of the bxdf and whether it is a delta function are copied next to the pointer when the lobe is added,
+ * so that looping through all lobes of a scattering event, which happens several times per vertex because of MIS,
+ * only touches the bxdfs that really need to be evaluated.
+ */
+struct BxdfLobe{
+    const Bxdf*     bxdf            = nullptr;      /**< The bxdf of this lobe. */
+    Spectrum        evalWeight;                     /**< Evaluation weight of the bxdf. */
+    float           sampleWeight    = 0.0f;         /**< Sample weight of the bxdf. */
+    bool            delta           = false;        /**< Whether the bxdf is a Dirac delta function. */
+};
+
 //! @brief  ScatteringEvent is a bsdf/bssrdf holder that could hold multiple of each.
 /**
  * ScatteringEvent is the new 'BSDF' class, which not only holds BRDF/BTDF, but also holds BSSRDF for sub-surface 
@@ -69,8 +83,13 @@ public:
     SORT_FORCEINLINE  void    AddBxdf( const Bxdf* bxdf ){
         if( m_bxdfCnt == SE_MAX_BXDF_COUNT || IS_PTR_INVALID(bxdf) || bxdf->GetEvalWeight().IsBlack() )
             return;
-        m_bxdfs[m_bxdfCnt++] = bxdf;
-        m_bxdfTotalSampleWeight += bxdf->GetSampleWeight();
+        auto& lobe = m_bxdfs[m_bxdfCnt++];
+        lobe.bxdf = bxdf;
+        lobe.evalWeight = bxdf->GetEvalWeight();
+        lobe.sampleWeight = bxdf->GetSampleWeight();
+        lobe.delta = bxdf->IsDelta();
+        m_bxdfTotalSampleWeight += lobe.sampleWeight;
+        m_pickValid = false;
     }
 
     //! @brief  Add a bssrdf in the scattering event, there will be at most 4 bssrdf in it.
@@ -102,19 +121,54 @@ public:
         return m_flag;
     }
 
+    //! @brief  Set the lowest roughness of glossy lobes added afterwards.
+    //!
+    //! Path regularization raises it once the path went through rough bounces, near-specular lobes are blurred so that
+    //! caustics are captured by bsdf sampling instead of showing up as fireflies. It needs to be set before the material
+    //! populates the scattering event.
+    //!
+    //! @param  roughness   The lowest roughness of glossy lobes, zero leaves all lobes untouched.
+    SORT_FORCEINLINE void       SetRoughnessFloor( const float roughness ){
+        m_roughnessFloor = roughness;
+    }
+
+    //! @brief  Get the lowest roughness of glossy lobes in this scattering event.
+    //!
+    //! @return  The lowest roughness of glossy lobes, zero by default.
+    SORT_FORCEINLINE float      GetRoughnessFloor() const {
+        return m_roughnessFloor;
+    }
+
     //! @brief  Randomly pick between bxdf and bssrdf
     //!
     //! @param  flag        Which catagory it picks, it could be SE_EVALUATE_BXDF/SE_EVALUATE_BSSRDF.
     //! @return             The properbility of picking the bxdf/bssrdf.
     float       SampleScatteringType( SE_Flag& flag ) const;
 
+    //! @brief  Whether any of the bxdfs is a Dirac delta function.
+    //!
+    //! @return             Whether there is a delta bxdf in the scattering event.
+    bool        HasDeltaBxdf() const;
+
     //! @brief Evaluate the value of BSDF based on the incident and outgoing directions.
     //!
+    //! All lobes are evaluated in a single pass. If the pdf is also requested, it is accumulated in the same pass,
+    //! which is cheaper than calling Pdf_BSDF afterwards with the same pair of directions, a common pattern in MIS.
+    //!
     //! @param wo           Exitant direction in shading coordinate.
     //! @param wi           Incident direction in shading coordinate.
-    //! @param inter_flag   Interaction flag, this is for updating mediums.
+    //! @param pdf          The pdf of sampling the incident direction, the same as what Pdf_BSDF returns. It could be 'nullptr'.
     //! @return             The Evaluated value of the BSDF.
-    Spectrum    Evaluate_BSDF( const Vector& wo , const Vector& wi ) const;
+    Spectrum    Evaluate_BSDF( const Vector& wo , const Vector& wi , float* pdf = nullptr ) const;
+
+    //! @brief Estimate the albedo of the surface, it is only used as a feature of denoising and compositing.
+    //!
+    //! Rough lobes are evaluated with light coming from the normal, which is exact for a lambert lobe. Delta lobes and
+    //! bssrdfs contribute their weights. No random number is drawn so that the path being traced stays the same.
+    //!
+    //! @param wo           Exitant direction in world coordinate.
+    //! @return             The estimated albedo clamped to [0, 1].
+    Spectrum    EstimateAlbedo( const Vector& wo ) const;
 
     //! @brief Importance sampling for the bsdf.
     //!
@@ -123,8 +177,9 @@ public:
     //! @param bs           Sample for bsdf that holds some random variables.
     //! @param pdf          Probability density of the selected direction.
     //! @param inter_flag   Interaction flag, this is for updating mediums.
+    //! @param delta        Whether the direction is sampled from a Dirac delta lobe. It could be 'nullptr'.
     //! @return             The Evaluated BRDF value.
-    Spectrum    Sample_BSDF( const Vector& wo , Vector& wi , const class BsdfSample& bs , float& pdf ) const;
+    Spectrum    Sample_BSDF( const Vector& wo , Vector& wi , const class BsdfSample& bs , float& pdf , bool* delta = nullptr ) const;
 
     //! @brief Evaluate the pdf of an existance direction given the Incident direction.
     //!
@@ -134,6 +189,15 @@ public:
     //! @return             The probability of choosing the out-going direction based on the Incident direction.
     float       Pdf_BSDF( const Vector& wo , const Vector& wi ) const;
 
+    //! @brief Approximate the most likely picked glossy lobe with a von Mises-Fisher distribution.
+    //!
+    //! The weight of the resulting lobe is the probability of picking its bxdf, which is how much of the bsdf it covers.
+    //!
+    //! @param wo           Exitant direction in world space.
+    //! @param lobe         The resulting lobe in world space.
+    //! @return             Whether any of the bxdfs could be approximated by a vMF lobe.
+    bool        GetVMFLobe( const Vector& wo , VMFLobe& lobe ) const;
+
     //! @brief  Importance sample the incident direction and position.
     //!
     //! @param  scene       The scene where ray tracing happens.
@@ -144,12 +208,13 @@ public:
     void        Sample_BSSRDF( const Scene& scene , const Vector& wo , const Point& po , BSSRDFIntersections& inter , float& pdf ) const;
 
 private:
-    const Bxdf*         m_bxdfs[SE_MAX_BXDF_COUNT]      = { nullptr };     /**< All bsdfs in the scattering event. */
+    BxdfLobe            m_bxdfs[SE_MAX_BXDF_COUNT];                        /**< All bsdfs in the scattering event. */
     unsigned            m_bxdfCnt                       = 0;               /**< Number of bxdfs in the scattering event. */
     float               m_bxdfTotalSampleWeight         = 0.0f;            /**< Total weight of BXDF. */
     const Bssrdf*       m_bssrdfs[SE_MAX_BSSRDF_COUNT]  = { nullptr };     /**< All bssrdfs in the scattering event. */
     unsigned            m_bssrdfCnt                     = 0;               /**< Number of bssrdfs in the scattering event. */
     float               m_bssrdfTotalSampleWeight       = 0.0f;            /**< Total weight of BSSRDF. */
+    float               m_roughnessFloor                = 0.0f;            /**< Lowest roughness of glossy lobes, raised by path regularization. */
 
     const SE_Flag       m_flag;             /**< Some scattering event is under other scattering event, like 'Blend' and 'Coat'. */
     Vector              m_n;                /**< Normal at the point to be evaluated. */
@@ -157,6 +222,24 @@ private:
     Vector              m_bt;               /**< Tangent at the point to be evaluated. */
     const SurfaceInteraction& m_intersection;     /**< Intersection at the point to be evaluated. */
 
+    /**< Probability of picking each bxdf given the exitant direction, only valid for 'm_pickWo'. */
+    mutable float       m_pickPdf[SE_MAX_BXDF_COUNT]    = { 0.0f };
+    /**< Exitant direction in shading coordinate that the picking probabilities are evaluated with. */
+    mutable Vector      m_pickWo;
+    /**< Whether the picking probabilities are evaluated already. */
+    mutable bool        m_pickValid                     = false;
+
+    //! @brief  Evaluate the probabilities of picking each bxdf given an exitant direction.
+    //!
+    //! Each lobe is weighted by its sample weight scaled by the estimated directional albedo of the bxdf, lobes that
+    //! hardly scatter anything towards 'wo', like a specular layer with little Fresnel reflection at normal incidence,
+    //! are picked less. Sampling, evaluating and pdf queries of the same exitant direction have to agree on these
+    //! probabilities, the result is cached since MIS queries the same direction several times.
+    //!
+    //! @param swo      Exitant direction in shading coordinate.
+    //! @return         Probabilities of picking each bxdf, they sum up to one.
+    const float*        pickPdf( const Vector& swo ) const;
+
     //! @brief  Transform a vector from world coordinate to local shading coordinate.
     //!
     //! @param v        A vector in world coordinate.
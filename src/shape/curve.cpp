@@ -0,0 +1,277 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "curve.h"
+
+namespace {
+    //! @brief  De Casteljau evaluation of a cubic Bezier segment.
+    SORT_STATIC_FORCEINLINE Vector evalBezier( const Vector cp[4] , const float u ){
+        const Vector cp1[3] = { slerp( cp[0] , cp[1] , u ) , slerp( cp[1] , cp[2] , u ) , slerp( cp[2] , cp[3] , u ) };
+        const Vector cp2[2] = { slerp( cp1[0] , cp1[1] , u ) , slerp( cp1[1] , cp1[2] , u ) };
+        return slerp( cp2[0] , cp2[1] , u );
+    }
+
+    //! @brief  Derivative of a cubic Bezier segment.
+    SORT_STATIC_FORCEINLINE Vector derivBezier( const Vector cp[4] , const float u ){
+        const auto d0 = cp[1] - cp[0] , d1 = cp[2] - cp[1] , d2 = cp[3] - cp[2];
+        return 3.0f * ( d0 * SQR( 1.0f - u ) + d1 * ( 2.0f * u * ( 1.0f - u ) ) + d2 * SQR( u ) );
+    }
+
+    //! @brief  Split a cubic Bezier segment in the middle, the two halves share the fourth control point.
+    SORT_STATIC_FORCEINLINE void splitBezier( const Vector cp[4] , Vector split[7] ){
+        split[0] = cp[0];
+        split[1] = ( cp[0] + cp[1] ) * 0.5f;
+        split[2] = ( cp[0] + 2.0f * cp[1] + cp[2] ) * 0.25f;
+        split[3] = ( cp[0] + 3.0f * cp[1] + 3.0f * cp[2] + cp[3] ) * 0.125f;
+        split[4] = ( cp[1] + 2.0f * cp[2] + cp[3] ) * 0.25f;
+        split[5] = ( cp[2] + cp[3] ) * 0.5f;
+        split[6] = cp[3];
+    }
+
+    //! @brief  Control points of a segment in ray space along with the width of the segment.
+    struct RaySpaceSegment{
+        /**< Control points in a space where the ray starts at origin, pointing along z. */
+        Vector  cp[4];
+        /**< Full width at both ends of the segment. */
+        float   width[2];
+        /**< Minimum distance along the ray to be considered as an intersection. */
+        float   zMin;
+    };
+
+    //! @brief  Recursively subdivide the segment until it is flat enough to be treated as a line in ray space.
+    //!
+    //! The curve is treated as a ribbon always facing the ray, the distance along the ray is z in ray space.
+    //!
+    //! @param  seg     The segment in ray space.
+    //! @param  cp      Control points of the current sub segment.
+    //! @param  u0      The parametric coordinate where the sub segment starts.
+    //! @param  u1      The parametric coordinate where the sub segment ends.
+    //! @param  depth   Number of remaining subdivisions.
+    //! @param  zMax    The closest intersection found so far, it will be updated if there is a closer one.
+    //! @param  uHit    The parametric coordinate of the closest intersection.
+    //! @return         Whether there is a closer intersection.
+    bool recursiveIntersect( const RaySpaceSegment& seg , const Vector cp[4] , const float u0 , const float u1 , const int depth , float& zMax , float& uHit ){
+        // Bounding box of the sub segment in ray space, expended by the maximum half width.
+        const auto w0 = slerp( seg.width[0] , seg.width[1] , u0 );
+        const auto w1 = slerp( seg.width[0] , seg.width[1] , u1 );
+        const auto half_w = std::max( w0 , w1 ) * 0.5f;
+        const auto x_min = std::min( std::min( cp[0].x , cp[1].x ) , std::min( cp[2].x , cp[3].x ) ) - half_w;
+        const auto x_max = std::max( std::max( cp[0].x , cp[1].x ) , std::max( cp[2].x , cp[3].x ) ) + half_w;
+        const auto y_min = std::min( std::min( cp[0].y , cp[1].y ) , std::min( cp[2].y , cp[3].y ) ) - half_w;
+        const auto y_max = std::max( std::max( cp[0].y , cp[1].y ) , std::max( cp[2].y , cp[3].y ) ) + half_w;
+        const auto z_min = std::min( std::min( cp[0].z , cp[1].z ) , std::min( cp[2].z , cp[3].z ) ) - half_w;
+        const auto z_max = std::max( std::max( cp[0].z , cp[1].z ) , std::max( cp[2].z , cp[3].z ) ) + half_w;
+        if( x_min > 0.0f || x_max < 0.0f || y_min > 0.0f || y_max < 0.0f || z_max < seg.zMin || z_min > zMax )
+            return false;
+
+        if( depth > 0 ){
+            Vector split[7];
+            splitBezier( cp , split );
+            const auto u_mid = ( u0 + u1 ) * 0.5f;
+            auto hit = recursiveIntersect( seg , split , u0 , u_mid , depth - 1 , zMax , uHit );
+            hit |= recursiveIntersect( seg , split + 3 , u_mid , u1 , depth - 1 , zMax , uHit );
+            return hit;
+        }
+
+        // The ray needs to be between the two planes perpendicular to the tangent at both ends of the sub segment.
+        const auto edge0 = ( cp[1].y - cp[0].y ) * -cp[0].y + cp[0].x * ( cp[0].x - cp[1].x );
+        if( edge0 < 0.0f )
+            return false;
+        const auto edge1 = ( cp[2].y - cp[3].y ) * -cp[3].y + cp[3].x * ( cp[3].x - cp[2].x );
+        if( edge1 < 0.0f )
+            return false;
+
+        // The closest point on the chord of the sub segment to the ray.
+        const auto seg_x = cp[3].x - cp[0].x , seg_y = cp[3].y - cp[0].y;
+        const auto denom = SQR( seg_x ) + SQR( seg_y );
+        if( denom == 0.0f )
+            return false;
+        const auto w = saturate( -( cp[0].x * seg_x + cp[0].y * seg_y ) / denom );
+        const auto pc = evalBezier( cp , w );
+
+        const auto u = slerp( u0 , u1 , w );
+        const auto hit_width = slerp( seg.width[0] , seg.width[1] , u );
+        if( SQR( pc.x ) + SQR( pc.y ) > SQR( hit_width ) * 0.25f )
+            return false;
+        if( pc.z <= seg.zMin || pc.z >= zMax )
+            return false;
+
+        zMax = pc.z;
+        uHit = u;
+        return true;
+    }
+}
+
+Curve::Curve( const std::vector<Point>& points , unsigned int offset , unsigned int seg_cnt , const float* v , float w_bottom , float w_tip , int matId ) :
+    m_points(points), m_offset(offset), m_segCnt(seg_cnt), m_wBottom(w_bottom), m_wTip(w_tip), m_matId(matId) {
+    sAssert( m_segCnt > 0 && m_segCnt <= CURVE_MAX_SEGMENTS , GENERAL );
+    sAssert( m_offset + 3 * m_segCnt < m_points.size() , GENERAL );
+    sAssert( m_wBottom >= 0.0f , GENERAL );
+    sAssert( m_wTip >= 0.0f , GENERAL );
+    for( auto i = 0u ; i <= m_segCnt ; ++i )
+        m_v[i] = v[i];
+    buildBounds();
+}
+
+bool Curve::GetIntersect( const Ray& r , SurfaceInteraction* intersect ) const{
+    // Setup a coordinate system where the ray points along z.
+    const auto dir_len = r.m_Dir.Length();
+    const auto inv_len = 1.0f / dir_len;
+    const auto dir = r.m_Dir * inv_len;
+    Vector axis_x , axis_y;
+    coordinateSystem( dir , axis_x , axis_y );
+
+    auto found = false;
+    auto z_max = ( intersect ? std::min( intersect->t , r.m_fMax ) : r.m_fMax ) * dir_len;
+    auto seg_hit = 0u;
+    auto u_hit = 0.0f;
+    for( auto i = 0u ; i < m_segCnt ; ++i ){
+        // Reject the segment with its oriented bounding box first.
+        const auto& obb = m_obb[i];
+        const Vector ori( r.m_Ori );
+        const Vector ori_obb( dot( obb.axis[0] , ori ) , dot( obb.axis[1] , ori ) , dot( obb.axis[2] , ori ) );
+        const Vector dir_obb( dot( obb.axis[0] , r.m_Dir ) , dot( obb.axis[1] , r.m_Dir ) , dot( obb.axis[2] , r.m_Dir ) );
+        const Ray ray_obb( Point( ori_obb.x , ori_obb.y , ori_obb.z ) , dir_obb , 0 , r.m_fMin , z_max * inv_len );
+        if( Intersect( ray_obb , obb.bound ) < 0.0f )
+            continue;
+
+        RaySpaceSegment seg;
+        for( auto j = 0u ; j < 4 ; ++j ){
+            const auto d = m_points[m_offset + 3 * i + j] - r.m_Ori;
+            seg.cp[j] = Vector( dot( d , axis_x ) , dot( d , axis_y ) , dot( d , dir ) );
+        }
+        seg.width[0] = 2.0f * halfWidth( m_v[i] );
+        seg.width[1] = 2.0f * halfWidth( m_v[i + 1] );
+        seg.zMin = r.m_fMin * dir_len;
+
+        // Number of subdivisions needed for the sub segments to be flat enough, the error is bounded by 5% of the width.
+        auto l0 = 0.0f;
+        for( auto j = 0u ; j < 2 ; ++j ){
+            const auto dd = seg.cp[j] - 2.0f * seg.cp[j + 1] + seg.cp[j + 2];
+            l0 = std::max( l0 , std::max( std::max( fabs( dd.x ) , fabs( dd.y ) ) , fabs( dd.z ) ) );
+        }
+        const auto eps = std::max( seg.width[0] , seg.width[1] ) * 0.05f;
+        const auto r0 = ( eps > 0.0f && l0 > 0.0f ) ? (int)( log2( 1.41421356237f * 6.0f * l0 / ( 8.0f * eps ) ) * 0.5f ) : 0;
+        const auto max_depth = clamp( r0 , 0 , 10 );
+
+        if( recursiveIntersect( seg , seg.cp , 0.0f , 1.0f , max_depth , z_max , u_hit ) ){
+            found = true;
+            seg_hit = i;
+
+            // There is no need to look for the closest intersection if it is not needed.
+            if( IS_PTR_INVALID(intersect) )
+                return true;
+        }
+    }
+
+    if( !found )
+        return false;
+
+    const auto t = z_max * inv_len;
+    intersect->t = t;
+    intersect->intersect = r(t);
+
+    Vector cp[4];
+    for( auto j = 0u ; j < 4 ; ++j )
+        cp[j] = m_points[m_offset + 3 * seg_hit + j];
+    const auto center = evalBezier( cp , u_hit );
+    const auto tangent = normalize( derivBezier( cp , u_hit ) );
+
+    // The ribbon faces the ray, the shading normal is bent towards both sides as if it were a cylinder.
+    auto facing = -dir - tangent * dot( -dir , tangent );
+    facing = ( dot( facing , facing ) > 0.0f ) ? normalize( facing ) : axis_x;
+    const auto bitangent = cross( tangent , facing );
+    const auto half_w = halfWidth( slerp( m_v[seg_hit] , m_v[seg_hit + 1] , u_hit ) );
+    const auto offset = ( half_w > 0.0f ) ? clamp( dot( Vector( intersect->intersect ) - center , bitangent ) / half_w , -1.0f , 1.0f ) : 0.0f;
+
+    intersect->gnormal = normalize( facing * sqrt( 1.0f - SQR( offset ) ) + bitangent * offset );
+    intersect->normal = intersect->gnormal;
+    intersect->tangent = tangent;
+    intersect->view = -r.m_Dir;
+    intersect->u = 1.0f;
+    intersect->v = slerp( m_v[seg_hit] , m_v[seg_hit + 1] , u_hit );
+    return true;
+}
+
+bool Curve::GetIntersect( const BBox& box ) const{
+    for( auto i = 0u ; i < m_segCnt ; ++i ){
+        BBox seg_box;
+        for( auto j = 0u ; j < 4 ; ++j )
+            seg_box.Union( m_points[m_offset + 3 * i + j] );
+        seg_box.Expend( std::max( halfWidth( m_v[i] ) , halfWidth( m_v[i + 1] ) ) );
+
+        if( seg_box.m_Min.x <= box.m_Max.x && seg_box.m_Max.x >= box.m_Min.x &&
+            seg_box.m_Min.y <= box.m_Max.y && seg_box.m_Max.y >= box.m_Min.y &&
+            seg_box.m_Min.z <= box.m_Max.z && seg_box.m_Max.z >= box.m_Min.z )
+            return true;
+    }
+    return false;
+}
+
+BBox Curve::GetBBox() const{
+    if( !m_bbox ){
+        m_bbox = std::make_unique<BBox>();
+        for( auto i = 0u ; i < m_segCnt ; ++i ){
+            BBox seg_box;
+            for( auto j = 0u ; j < 4 ; ++j )
+                seg_box.Union( m_points[m_offset + 3 * i + j] );
+            seg_box.Expend( std::max( halfWidth( m_v[i] ) , halfWidth( m_v[i + 1] ) ) );
+            m_bbox->Union( seg_box );
+        }
+    }
+    return *m_bbox;
+}
+
+float Curve::SurfaceArea() const{
+    auto area = 0.0f;
+    for( auto i = 0u ; i < m_segCnt ; ++i ){
+        const auto* cp = &m_points[m_offset + 3 * i];
+        const auto chord = distance( cp[0] , cp[3] );
+        const auto polygon = distance( cp[0] , cp[1] ) + distance( cp[1] , cp[2] ) + distance( cp[2] , cp[3] );
+        area += ( chord + polygon ) * 0.5f * ( halfWidth( m_v[i] ) + halfWidth( m_v[i + 1] ) ) * PI;
+    }
+    return area;
+}
+
+void Curve::SetTransform( const Transform& transform ){
+    m_transform = transform;
+    m_bbox = nullptr;
+    buildBounds();
+}
+
+void Curve::buildBounds(){
+    for( auto i = 0u ; i < m_segCnt ; ++i ){
+        const auto* cp = &m_points[m_offset + 3 * i];
+        auto& obb = m_obb[i];
+
+        // The box is aligned with the chord of the segment, falling back to the first leg for closed segments.
+        auto y = cp[3] - cp[0];
+        if( dot( y , y ) == 0.0f )
+            y = cp[1] - cp[0];
+        y = ( dot( y , y ) > 0.0f ) ? normalize( y ) : Vector( 0.0f , 1.0f , 0.0f );
+        coordinateSystem( y , obb.axis[0] , obb.axis[2] );
+        obb.axis[1] = y;
+
+        // A Bezier segment never leaves the convex hull of its control points.
+        obb.bound = BBox();
+        for( auto j = 0u ; j < 4 ; ++j ){
+            const Vector p = cp[j];
+            obb.bound.Union( Point( dot( obb.axis[0] , p ) , dot( obb.axis[1] , p ) , dot( obb.axis[2] , p ) ) );
+        }
+        obb.bound.Expend( std::max( halfWidth( m_v[i] ) , halfWidth( m_v[i + 1] ) ) );
+    }
+}
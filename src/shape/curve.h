@@ -0,0 +1,160 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <vector>
+#include "shape.h"
+#include "math/utils.h"
+
+//! @brief  Maximum number of cubic Bezier segments grouped in one curve primitive.
+constexpr unsigned int CURVE_MAX_SEGMENTS = 4;
+
+//! @brief  Curve is a piece of a hair strand made of a few consecutive cubic Bezier segments.
+/**
+ * Unlike Line, which needs one primitive for every linear piece of a strand, a curve groups up to
+ * CURVE_MAX_SEGMENTS smooth segments of one strand in a single primitive. The control points are
+ * not owned by the curve, they are shared by all curves of a HairVisual so that the neighbouring
+ * segments don't duplicate the end points.
+ * Each segment is bounded by an oriented box aligned with its chord, which is way tighter than an
+ * axis aligned box for thin and long hair segments. The intersection is done by recursively
+ * subdividing the segment in a space where the ray points along the z axis, the surface is treated
+ * as a ribbon facing the ray with a shading normal of a cylinder to avoid the flat look.
+ */
+class   Curve : public Shape{
+public:
+    //! @brief Constructor
+    //!
+    //! @param  points      Control points of all strands, shared by all curves of a visual.
+    //! @param  offset      Index of the first control point of this curve in @param points.
+    //! @param  seg_cnt     Number of cubic segments in this curve, it can't be larger than CURVE_MAX_SEGMENTS.
+    //! @param  v           V coordinate at the end points of each segment, there are @param seg_cnt + 1 of them.
+    //! @param  w_bottom    Half width (radius) of the strand at its root.
+    //! @param  w_tip       Half width (radius) of the strand at its tip.
+    //! @param  matId       Material id of the curve.
+    Curve( const std::vector<Point>& points , unsigned int offset , unsigned int seg_cnt , const float* v , float w_bottom , float w_tip , int matId );
+
+    //! @brief Sample a point on the surface of the shape given a shading point.
+    //!
+    //! This function should not be called, meaning curve should not be used as a light source.
+    //!
+    //! @param ls       The light sample.
+    //! @param p        The position of shading point to be lit.
+    //! @param wi       The vector from shading point to sampled point, it is normalized.
+    //! @param pdf      The pdf w.r.t solid angle ( not surface area ) of picking the sampled point.
+    //! @return         The sampled point on the surface of the shape.
+    Point           Sample_l( const LightSample& ls , const Point& p , Vector& wi , Vector& n, float* pdf ) const override{
+        sAssertMsg( false , LIGHT , "Using curve as a area light source shape.");
+        return Point();
+    }
+
+    //! @brief Sample a ray from the light source without a given shading point.
+    //!
+    //! This function should not be called, meaning curve should not be used as a light source.
+    //!
+    //! @param ls       The light sample.
+    //! @param r        The ray randomly sampled, whose origin lies on the surface of the shape,
+    //!                 the direction of the ray will point outward depending on the normal.
+    //! @param n        The normal at the surface where the ray shoots from.
+    //! @param pdf      The pdf w.r.t solid angle of picking the ray.
+    void            Sample_l( const LightSample& ls , Ray& r , Vector& n , float* pdf ) const override{
+        sAssertMsg( false , LIGHT , "Using curve as a area light source shape.");
+    }
+
+    //! @brief      Get intersected point between the ray and the shape.
+    //!
+    //! @param ray      The ray to be tested against.
+    //! @param inter    The intersection data to be filled. If it is nullptr, there is no detailed information
+    //!                 for the intersection.
+    //! @return         Whether the ray intersects the shape.
+    bool            GetIntersect( const Ray& ray , SurfaceInteraction* inter = nullptr ) const override;
+
+    //! @brief Intersection test between the shape and a bounding box.
+    //!
+    //! This is a conservative test against the bounding box of the control points of each segment.
+    //!
+    //! param box       Bounding box to be checked.
+    bool            GetIntersect( const BBox& box ) const override;
+
+    //! @brief      Get bounding box of the shape in world space.
+    //!
+    //! @return     The bounding box of the shape.
+    BBox            GetBBox() const override;
+
+    //! @brief      Get the surface area of the shape.
+    //!
+    //! The length of each segment is approximated by the average of its chord and its control polygon.
+    //!
+    //! @return     Surface area of the shape.
+    float           SurfaceArea() const override;
+
+    //! @brief      Get the material id.
+    //!
+    //! @return     Material id of the shape.
+    int             GetMaterialId() const {
+        return m_matId;
+    }
+
+    //! @brief Set transform for the shape.
+    //!
+    //! Just like Line, control points are pre-transformed into world space. Since they are shared by all curves
+    //! of a visual, it is the visual that transforms them only once, this only rebuilds the bounding volumes.
+    //!
+    //! @param transform    The new transform of the shape to be set.
+    void    SetTransform( const Transform& transform ) override;
+
+    //! @brief      Get the type of the shape
+    //!
+    //! @return     The type of the shape.
+    SHAPE_TYPE GetShapeType() const override{
+        return SHAPE_CURVE;
+    }
+
+private:
+    //! @brief  Oriented bounding box of a segment.
+    struct OBB{
+        /**< Axis of the box, the second one is along the chord of the segment. */
+        Vector  axis[3];
+        /**< Bounding box of the segment in the space spanned by the axis. */
+        BBox    bound;
+    };
+
+    /**< Control points shared by all curves of a visual. */
+    const std::vector<Point>&   m_points;
+    /**< Index of the first control point of this curve. */
+    const unsigned int          m_offset;
+    /**< Number of cubic segments in this curve. */
+    const unsigned int          m_segCnt;
+    /**< V coordinate at the end points of each segment. */
+    float                       m_v[CURVE_MAX_SEGMENTS + 1];
+    /**< Half width (radius) of the strand at its root. */
+    const float                 m_wBottom;
+    /**< Half width (radius) of the strand at its tip. */
+    const float                 m_wTip;
+    /**< Material index of the curve. */
+    const int                   m_matId;
+    /**< Oriented bounding box of each segment. */
+    OBB                         m_obb[CURVE_MAX_SEGMENTS];
+
+    //! @brief  Get the half width of the strand at a specific v coordinate.
+    float   halfWidth( const float v ) const {
+        return slerp( m_wBottom , m_wTip , v );
+    }
+
+    //! @brief  Rebuild the oriented bounding box of each segment.
+    void    buildBounds();
+};
@@ -83,7 +83,7 @@ bool Disk::GetIntersect( const Ray& r , SurfaceInteraction* intersect ) const{
     return true;
 }
 
-const BBox& Disk::GetBBox() const{
+BBox Disk::GetBBox() const{
     if( !m_bbox ){
         m_bbox = std::make_unique<BBox>();
         m_bbox->Union( m_transform.TransformPoint( Point( radius , 0.0f , radius ) ) );
@@ -71,7 +71,7 @@ public:
     //! box, which is also acceptable to all rest systems call this function.
     //!
     //! @return     The bounding box of the shape.
-    const BBox&     GetBBox() const override;
+    BBox            GetBBox() const override;
 
     //! @brief      Get the surface area of the shape.
     //!
@@ -88,6 +88,13 @@ public:
         radius = r;
     }
 
+    //! @brief      Get the radius of the disk.
+    //!
+    //! @return     Radius of the disk.
+    float           GetRadius() const{
+        return radius;
+    }
+
     //! @brief      Get the type of the shape
     //!
     //! @return     The type of the shape.
@@ -0,0 +1,334 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include "instance.h"
+#include "accel/bvh.h"
+#include "entity/visual.h"
+#include "core/primitive.h"
+#include "core/globalconfig.h"
+#include "stream/mstream.h"
+#include "stream/mapstream.h"
+
+SORT_STATS_DEFINE_COUNTER(sGeometryPageFaults)
+SORT_STATS_DEFINE_COUNTER(sGeometryPageOuts)
+SORT_STATS_DEFINE_COUNTER(sMotionSegments)
+
+SORT_STATS_COUNTER("Geometry Paging", "Page Faults", sGeometryPageFaults);
+SORT_STATS_COUNTER("Geometry Paging", "Paged Out Meshes", sGeometryPageOuts);
+SORT_STATS_COUNTER("Motion Blur", "Moving Instance Segments", sMotionSegments);
+
+// Meshes are usually instanced because they are detailed, the BVH of them is allowed to go deeper than the default one.
+static constexpr unsigned INSTANCE_BVH_MAX_DEPTH    = 32;
+
+// Once the cache goes beyond the budget, meshes are dropped until it is below this ratio of the budget, so that a ray
+// faulting on a mesh doesn't need to drop another one every time.
+static constexpr float GEOMETRY_CACHE_EVICT_RATIO   = 0.75f;
+
+namespace {
+    // Keep the vertices and the BVH of a prototype in memory while a ray traverses them.
+    struct PrototypePin{
+        PrototypePin( const InstancePrototype& prototype ) : m_prototype( prototype ) {
+            prototype.Pin();
+        }
+        ~PrototypePin(){
+            m_prototype.Unpin();
+        }
+        const InstancePrototype& m_prototype;
+    };
+}
+
+InstancePrototype::InstancePrototype( MeshVisual& mesh ) : m_mesh( mesh ){
+    for( const auto& primitive : mesh.CreatePrimitives() ){
+        m_primitives.push_back( &primitive );
+        m_bbox.Union( primitive.GetBBox() );
+        m_surfaceArea += primitive.SurfaceArea();
+        m_transparent |= primitive.HasTransparency();
+        m_sss |= primitive.GetMaterial()->HasSSS();
+        m_volume |= primitive.GetMaterial()->HasVolumeAttached();
+    }
+}
+
+InstancePrototype::~InstancePrototype(){
+    if( m_pageSize )
+        GeometryCache::GetSingleton().Remove( this );
+}
+
+void InstancePrototype::Build(){
+    // Fbvh traverses in a thread local stack, it can't be nested in the top level traversal, which could be Fbvh too.
+    m_accelerator = std::make_unique<Bvh>( INSTANCE_BVH_MAX_DEPTH );
+    m_accelerator->SetLinearBuild( g_linearBvhObjects );
+    m_accelerator->Build( m_primitives , m_bbox );
+
+    if( 0 == g_geometryBudget )
+        return;
+
+    // the BVH is saved in the format of the acceleration structure cache, it is loaded back without being built again
+    const auto& mesh = *m_mesh.m_memory;
+    IMemoryStream stream;
+    stream << (unsigned int)mesh.m_positions.size() << (unsigned int)mesh.m_vertices.size() << (unsigned int)mesh.m_compactVertices.size();
+    stream.Write( (char*)mesh.m_positions.data() , (int)( sizeof( Point ) * mesh.m_positions.size() ) );
+    stream.Write( (char*)mesh.m_vertices.data() , (int)( sizeof( MeshVertex ) * mesh.m_vertices.size() ) );
+    stream.Write( (char*)mesh.m_compactVertices.data() , (int)( sizeof( CompactMeshVertex ) * mesh.m_compactVertices.size() ) );
+    m_accelerator->SaveCache( stream );
+
+    if( !GeometryCache::GetSingleton().Store( stream.GetData() , stream.GetDataSize() , m_pageOffset ) )
+        return;
+    m_pageSize = stream.GetDataSize();
+    m_lastUse.store( GeometryCache::GetSingleton().Now() , std::memory_order_relaxed );
+    GeometryCache::GetSingleton().Add( this );
+}
+
+void InstancePrototype::Pin() const{
+    if( !m_pageSize )
+        return;
+
+    const auto now = GeometryCache::GetSingleton().Now();
+    if( m_lastUse.load( std::memory_order_relaxed ) != now )
+        m_lastUse.store( now , std::memory_order_relaxed );
+
+    // The cache marks the mesh as not resident before checking the pins, a pin that still sees it resident is seen there.
+    m_pinCnt.fetch_add( 1 );
+    if( LIKELY( m_resident.load() ) )
+        return;
+    pageIn();
+}
+
+void InstancePrototype::pageIn() const{
+    {
+        std::lock_guard<std::mutex> lock( m_pageMutex );
+        if( m_resident.load() )
+            return;
+
+        std::vector<char> data( m_pageSize );
+        const auto fetched = GeometryCache::GetSingleton().Fetch( data.data() , m_pageSize , m_pageOffset );
+        sAssertMsg( fetched , RESOURCE , "Failed to load an instanced mesh from the page file." );
+
+        auto& mesh = *m_mesh.m_memory;
+        IMemoryViewStream stream( data.data() , data.size() );
+        unsigned int position_cnt = 0 , vertex_cnt = 0 , compact_vertex_cnt = 0;
+        stream >> position_cnt >> vertex_cnt >> compact_vertex_cnt;
+        mesh.m_positions.resize( position_cnt );
+        mesh.m_vertices.resize( vertex_cnt );
+        mesh.m_compactVertices.resize( compact_vertex_cnt );
+        stream.LoadBulk( (char*)mesh.m_positions.data() , sizeof( Point ) * position_cnt );
+        stream.LoadBulk( (char*)mesh.m_vertices.data() , sizeof( MeshVertex ) * vertex_cnt );
+        stream.LoadBulk( (char*)mesh.m_compactVertices.data() , sizeof( CompactMeshVertex ) * compact_vertex_cnt );
+
+        auto accelerator = std::make_unique<Bvh>( INSTANCE_BVH_MAX_DEPTH );
+        accelerator->SetLinearBuild( g_linearBvhObjects );
+        if( !accelerator->LoadCache( stream , m_primitives , m_bbox ) )
+            accelerator->Build( m_primitives , m_bbox );
+        m_accelerator = std::move( accelerator );
+
+        m_resident.store( true );
+        SORT_STATS(++sGeometryPageFaults);
+    }
+
+    // it is pinned, it is not going to be dropped right away
+    GeometryCache::GetSingleton().Add( this );
+}
+
+bool InstancePrototype::PageOut() const{
+    std::lock_guard<std::mutex> lock( m_pageMutex );
+    if( !m_resident.load() )
+        return false;
+
+    // A ray pinning the mesh from now on sees it not resident and waits for the lock, the ones before are seen here.
+    m_resident.store( false );
+    if( m_pinCnt.load() > 0 ){
+        m_resident.store( true );
+        return false;
+    }
+
+    auto& mesh = *m_mesh.m_memory;
+    std::vector<Point>().swap( mesh.m_positions );
+    std::vector<MeshVertex>().swap( mesh.m_vertices );
+    std::vector<CompactMeshVertex>().swap( mesh.m_compactVertices );
+    m_accelerator.reset();
+
+    SORT_STATS(++sGeometryPageOuts);
+    return true;
+}
+
+Instance::Instance( const InstancePrototype& prototype , const Transform& transform ) : m_prototype( prototype ){
+    Instance::SetTransform( transform );
+}
+
+Instance::Instance( const InstancePrototype& prototype , const Transform& begin , const Transform& end , float time_begin , float time_end ) :
+    m_prototype( prototype ), m_moving( true ), m_timeBegin( time_begin ), m_timeEnd( time_end ){
+    SetMotion( begin , end );
+    SORT_STATS(++sMotionSegments);
+}
+
+void Instance::SetTransform( const Transform& transform ){
+    m_transform = transform;
+    m_transformEnd = transform;
+    m_flipped = m_transform.matrix.Determinant() < 0.0f;
+    m_bbox = nullptr;
+}
+
+void Instance::SetMotion( const Transform& begin , const Transform& end ){
+    m_transform = begin;
+    m_transformEnd = end;
+    m_flipped = m_transform.matrix.Determinant() < 0.0f;
+    m_bbox = nullptr;
+}
+
+bool Instance::GetIntersect( const Ray& r , SurfaceInteraction* intersect ) const{
+    // the segment only exists in its own part of the shutter interval
+    if( m_moving && ( r.m_time < m_timeBegin || r.m_time >= m_timeEnd ) )
+        return false;
+
+    Transform moved;
+    if( m_moving )
+        moved = Lerp( m_transform , m_transformEnd , ( r.m_time - m_timeBegin ) / ( m_timeEnd - m_timeBegin ) );
+    const auto& transform = m_moving ? moved : m_transform;
+
+    const auto ray = transform.invMatrix( r );
+
+    const PrototypePin pin( m_prototype );
+    const auto& accelerator = m_prototype.GetAccelerator();
+    if( IS_PTR_INVALID(intersect) )
+        return accelerator.IsOccluded( ray );
+
+    // Shadow queries are resolved in the top level since the transparency of the nearest primitive is needed there.
+    SurfaceInteraction local;
+    local.t = intersect->t;
+    if( !accelerator.GetIntersect( ray , local ) || IS_PTR_INVALID(local.primitive) )
+        return false;
+
+    intersect->t = local.t;
+    intersect->u = local.u;
+    intersect->v = local.v;
+    intersect->primitive = local.primitive;
+    intersect->intersect = transform.TransformPoint( local.intersect );
+    intersect->normal = normalize( transform.TransformNormal( local.normal ) );
+    intersect->tangent = normalize( transform.TransformVector( local.tangent ) );
+    intersect->dpdu = transform.TransformVector( local.dpdu );
+    intersect->dpdv = transform.TransformVector( local.dpdv );
+    // the geometric normal of a flattened mesh follows the winding of its triangles
+    intersect->gnormal = normalize( transform.TransformNormal( local.gnormal ) ) * ( m_flipped ? -1.0f : 1.0f );
+    intersect->view = -r.m_Dir;
+
+    return true;
+}
+
+BBox Instance::GetBBox() const{
+    if( !m_bbox ){
+        m_bbox = std::make_unique<BBox>( m_transform.TransformBBox( m_prototype.GetBBox() ) );
+
+        // points move along straight lines in between, the boxes at both ends cover the whole segment.
+        if( m_moving )
+            m_bbox->Union( m_transformEnd.TransformBBox( m_prototype.GetBBox() ) );
+    }
+    return *m_bbox;
+}
+
+float Instance::SurfaceArea() const{
+    // area scales with the square of the uniform scaling factor
+    const auto det = fabs( m_transform.matrix.Determinant() );
+    return m_prototype.GetSurfaceArea() * pow( det , 2.0f / 3.0f );
+}
+
+GeometryCache::~GeometryCache(){
+    if( m_file.is_open() )
+        m_file.close();
+    if( !m_filePath.empty() ){
+        std::error_code err;
+        std::filesystem::remove( m_filePath , err );
+    }
+}
+
+bool GeometryCache::Store( const char* data , std::size_t size , std::uint64_t& offset ){
+    std::lock_guard<std::mutex> lock( m_fileMutex );
+    if( m_filePath.empty() ){
+        const auto name = "sort_geometry_" + std::to_string( (std::uint64_t)std::chrono::steady_clock::now().time_since_epoch().count() ) + ".pages";
+        std::error_code err;
+        m_filePath = ( std::filesystem::temp_directory_path( err ) / name ).string();
+        m_file.open( m_filePath , std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc );
+        if( !m_file.is_open() )
+            slog( WARNING , RESOURCE , "Failed to create the page file %s, instanced meshes stay in memory." , m_filePath.c_str() );
+    }
+    if( !m_file.is_open() )
+        return false;
+
+    offset = m_fileSize;
+    m_file.seekp( (std::streamoff)offset );
+    m_file.write( data , (std::streamsize)size );
+    if( !m_file ){
+        m_file.clear();
+        return false;
+    }
+    m_fileSize += size;
+    return true;
+}
+
+bool GeometryCache::Fetch( char* data , std::size_t size , std::uint64_t offset ){
+    std::lock_guard<std::mutex> lock( m_fileMutex );
+    m_file.seekg( (std::streamoff)offset );
+    m_file.read( data , (std::streamsize)size );
+    if( !m_file ){
+        m_file.clear();
+        return false;
+    }
+    return true;
+}
+
+void GeometryCache::Add( const InstancePrototype* prototype ){
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_clock.fetch_add( 1 , std::memory_order_relaxed );
+
+    auto& entry = m_prototypes[prototype];
+    m_size = m_size - entry + prototype->m_pageSize;
+    entry = prototype->m_pageSize;
+
+    const auto budget = (std::size_t)g_geometryBudget << 20;
+    if( m_size <= budget )
+        return;
+
+    // drop the least recently used ones, except the one just loaded, meshes with rays inside are skipped
+    std::vector<std::pair<std::uint64_t, const InstancePrototype*>> candidates;
+    candidates.reserve( m_prototypes.size() );
+    for( const auto& it : m_prototypes ){
+        if( it.first != prototype )
+            candidates.push_back( std::make_pair( it.first->m_lastUse.load( std::memory_order_relaxed ) , it.first ) );
+    }
+    std::sort( candidates.begin() , candidates.end() );
+
+    const auto target = (std::size_t)( (float)budget * GEOMETRY_CACHE_EVICT_RATIO );
+    for( const auto& candidate : candidates ){
+        if( m_size <= target )
+            break;
+        if( !candidate.second->PageOut() )
+            continue;
+        auto it = m_prototypes.find( candidate.second );
+        m_size -= it->second;
+        m_prototypes.erase( it );
+    }
+}
+
+void GeometryCache::Remove( const InstancePrototype* prototype ){
+    std::lock_guard<std::mutex> lock( m_mutex );
+    auto it = m_prototypes.find( prototype );
+    if( it == m_prototypes.end() )
+        return;
+    m_size -= it->second;
+    m_prototypes.erase( it );
+}
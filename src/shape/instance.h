@@ -0,0 +1,297 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <fstream>
+#include <unordered_map>
+#include "shape.h"
+#include "core/singleton.h"
+#include "core/stats.h"
+
+class Accelerator;
+class MeshVisual;
+class Primitive;
+
+//! @brief  A mesh shared by multiple instances in the scene.
+/**
+ * The triangles of the mesh stay in its local space, a BVH of them is built once no matter how many instances
+ * the mesh has. Instances transform rays into the local space of the mesh before traversing the BVH.
+ *
+ * With a geometry budget, vertices of the mesh and its BVH are written to the page file of GeometryCache once built,
+ * they could be dropped any time no ray is traversing them and are loaded back on the first ray getting to an
+ * instance again. Faces and triangles always stay in memory since intersections refer to them after the traversal.
+ */
+class InstancePrototype{
+public:
+    //! @brief  Constructor.
+    //!
+    //! @param  mesh        The mesh shared by the instances, it is in its local space.
+    InstancePrototype( MeshVisual& mesh );
+
+    //! @brief  Destructor.
+    ~InstancePrototype();
+
+    //! @brief  Build the BVH of the mesh, both of them are handed over to GeometryCache if there is a geometry budget.
+    void    Build();
+
+    //! @brief  Make sure the vertices and the BVH are in memory, they are kept until 'Unpin' is called.
+    //!
+    //! Threads faulting on the same mesh at the same time wait for one of them to load it instead of loading it again.
+    void    Pin() const;
+
+    //! @brief  Allow the vertices and the BVH to be dropped again.
+    SORT_FORCEINLINE void   Unpin() const {
+        if( m_pageSize )
+            m_pinCnt.fetch_sub( 1 );
+    }
+
+    //! @brief  Drop the vertices and the BVH unless rays are traversing them.
+    //!
+    //! @return     Whether they are dropped.
+    bool    PageOut() const;
+
+    //! @brief  Get the bottom level BVH of the mesh.
+    //!
+    //! @return     The BVH holding all triangles of the mesh in its local space.
+    SORT_FORCEINLINE const Accelerator& GetAccelerator() const {
+        return *m_accelerator;
+    }
+
+    //! @brief  Get the bounding box of the mesh in its local space.
+    //!
+    //! @return     The bounding box of the mesh.
+    SORT_FORCEINLINE const BBox& GetBBox() const {
+        return m_bbox;
+    }
+
+    //! @brief  Get the triangles of the mesh, they are always in memory even if the BVH is paged out.
+    //!
+    //! @return     Triangles of the mesh in its local space.
+    SORT_FORCEINLINE const std::vector<const Primitive*>& GetPrimitives() const {
+        return m_primitives;
+    }
+
+    //! @brief  Get the surface area of the mesh in its local space.
+    //!
+    //! @return     The surface area of the mesh.
+    SORT_FORCEINLINE float GetSurfaceArea() const {
+        return m_surfaceArea;
+    }
+
+    //! @brief  Whether any triangle of the mesh has transparency.
+    //!
+    //! @return     Whether shadow rays could pass through some part of the mesh.
+    SORT_FORCEINLINE bool HasTransparency() const {
+        return m_transparent;
+    }
+
+    //! @brief  Whether any triangle of the mesh has SSS.
+    //!
+    //! @return     Whether any triangle of the mesh has SSS.
+    SORT_FORCEINLINE bool HasSSS() const {
+        return m_sss;
+    }
+
+    //! @brief  Whether any triangle of the mesh has volume attached.
+    //!
+    //! @return     Whether any triangle of the mesh has volume attached.
+    SORT_FORCEINLINE bool HasVolume() const {
+        return m_volume;
+    }
+
+private:
+    MeshVisual&                     m_mesh;                 /**< The mesh shared by the instances. */
+    std::vector<const Primitive*>   m_primitives;           /**< Triangles of the mesh in its local space. */
+    mutable std::unique_ptr<Accelerator>    m_accelerator;  /**< Bottom level BVH of the mesh, nullptr if it is paged out. */
+    BBox                            m_bbox;                 /**< Bounding box of the mesh in its local space. */
+    float                           m_surfaceArea = 0.0f;   /**< Surface area of the mesh in its local space. */
+    bool                            m_transparent = false;  /**< Whether any triangle of the mesh has transparency. */
+    bool                            m_sss = false;          /**< Whether any triangle of the mesh has SSS. */
+    bool                            m_volume = false;       /**< Whether any triangle of the mesh has volume attached. */
+
+    std::uint64_t                   m_pageOffset = 0;       /**< Offset of the vertices and the BVH in the page file. */
+    std::size_t                     m_pageSize = 0;         /**< Size of them in the page file, 0 if the mesh is never paged out. */
+    mutable std::mutex              m_pageMutex;            /**< Serializes loading and dropping the vertices and the BVH. */
+    mutable std::atomic<bool>       m_resident = { true };  /**< Whether the vertices and the BVH are in memory. */
+    mutable std::atomic<int>        m_pinCnt = { 0 };       /**< Number of rays traversing the mesh. */
+    mutable std::atomic<std::uint64_t>  m_lastUse = { 0 };  /**< The last time the mesh is traversed, in the clock of the cache. */
+
+    //! @brief  Load the vertices and the BVH back from the page file.
+    void    pageIn() const;
+
+    friend class GeometryCache;
+};
+
+//! @brief  Bounded cache of the vertices and the BVH of all instanced meshes.
+/**
+ * Meshes shared by instances are written to a page file right after their BVH is built. The cache keeps track of
+ * the memory taken by the ones in memory, once it goes beyond the budget the least recently used ones that no ray
+ * is traversing are dropped. It happens while the scene is loaded too, so a scene doesn't need to fit in memory.
+ */
+class GeometryCache : public Singleton<GeometryCache>{
+public:
+    //! @brief  Remove the page file.
+    ~GeometryCache();
+
+    //! @brief  Write the data of a mesh to the page file.
+    //!
+    //! @param  data        The data to be written.
+    //! @param  size        Size of the data in bytes.
+    //! @param  offset      Offset of the data in the page file.
+    //! @return             Whether the data is written.
+    bool            Store( const char* data , std::size_t size , std::uint64_t& offset );
+
+    //! @brief  Read the data of a mesh from the page file.
+    //!
+    //! @param  data        The buffer to be filled.
+    //! @param  size        Size of the data in bytes.
+    //! @param  offset      Offset of the data in the page file.
+    //! @return             Whether the data is read.
+    bool            Fetch( char* data , std::size_t size , std::uint64_t offset );
+
+    //! @brief  Keep track of a mesh just loaded, older ones are dropped if it goes beyond the budget.
+    //!
+    //! @param  prototype   The mesh just loaded, it is pinned so it is never dropped here.
+    void            Add( const InstancePrototype* prototype );
+
+    //! @brief  Stop tracking a mesh, it is called when the mesh is destroyed or dropped.
+    //!
+    //! @param  prototype   The mesh to be removed.
+    void            Remove( const InstancePrototype* prototype );
+
+    //! @brief  Current time of the cache.
+    SORT_FORCEINLINE std::uint64_t  Now() const {
+        return m_clock.load( std::memory_order_relaxed );
+    }
+
+private:
+    std::mutex                                              m_mutex;            /**< Protects the tracked meshes. */
+    std::unordered_map<const InstancePrototype*, std::size_t> m_prototypes;     /**< Meshes in memory and their memory usage. */
+    std::size_t                                             m_size = 0;         /**< Memory taken by all meshes in memory in bytes. */
+    std::atomic<std::uint64_t>                              m_clock = { 1 };    /**< It ticks every time a mesh is loaded. */
+
+    std::mutex                                              m_fileMutex;        /**< Protects the page file. */
+    std::fstream                                            m_file;             /**< The page file. */
+    std::string                                             m_filePath;         /**< Full path of the page file. */
+    std::uint64_t                                           m_fileSize = 0;     /**< Size of the page file in bytes. */
+
+    SORT_STATS_ENABLE( "Geometry Paging" )
+
+    GeometryCache() = default;
+    friend class Singleton<GeometryCache>;
+};
+
+//! @brief  Instance of a mesh shared by multiple instances.
+/**
+ * An instance is nothing but a transform referencing a prototype, it appears as a single primitive in the top level
+ * spatial data structure. Intersections found in the prototype are transformed back to world space, the primitive
+ * of the intersection is the triangle of the prototype so that its material is respected.
+ *
+ * A moving instance is split into segments in time, each of them is a separate instance interpolating the transforms
+ * at both ends of its own part of the shutter interval. The bounding box of a segment only covers the motion during
+ * the segment, the top level spatial data structure doesn't need to know anything about time while the boxes stay
+ * far tighter than a single box covering the whole motion.
+ */
+class   Instance : public Shape{
+public:
+    //! @brief  Constructor.
+    //!
+    //! @param  prototype   The mesh shared by the instances.
+    //! @param  transform   The transform from the local space of the prototype to world space.
+    Instance( const InstancePrototype& prototype , const Transform& transform );
+
+    //! @brief  Constructor of a segment of a moving instance.
+    //!
+    //! @param  prototype   The mesh shared by the instances.
+    //! @param  begin       The transform at the beginning of the segment.
+    //! @param  end         The transform at the end of the segment.
+    //! @param  time_begin  The beginning of the segment in the shutter interval.
+    //! @param  time_end    The end of the segment in the shutter interval.
+    Instance( const InstancePrototype& prototype , const Transform& begin , const Transform& end , float time_begin , float time_end );
+
+    //! @brief  Sampling instances as light sources is not supported.
+    Point           Sample_l( const LightSample& ls , const Point& p , Vector& wi , Vector& n, float* pdf ) const override{
+        return Point();
+    }
+
+    //! @brief  Sampling instances as light sources is not supported.
+    void            Sample_l( const LightSample& ls , Ray& r , Vector& n , float* pdf ) const override{}
+
+    //! @brief  Get intersected point between the ray and the instance.
+    //!
+    //! The ray is transformed into the local space of the prototype without normalizing its direction, so that
+    //! the distance of intersections is the same in both spaces. A segment of a moving instance ignores rays out of
+    //! its part of the shutter interval.
+    //!
+    //! @param ray      The ray to be tested against.
+    //! @param inter    The intersection data to be filled. If it is nullptr, there is no detailed information
+    //!                 for the intersection.
+    //! @return         Whether the ray intersects the shape.
+    bool            GetIntersect( const Ray& ray , SurfaceInteraction* inter = nullptr ) const override;
+
+    //! @brief  Get bounding box of the instance in world space.
+    //!
+    //! The bounding box of a segment of a moving instance covers the transforms at both ends of it.
+    //!
+    //! @return     The bounding box of the shape.
+    BBox            GetBBox() const override;
+
+    //! @brief  Get the surface area of the instance.
+    //!
+    //! It is an approximation for transform with non-uniform scaling.
+    //!
+    //! @return     Surface area of the shape.
+    float           SurfaceArea() const override;
+
+    //! @brief  Get the type of the shape
+    //!
+    //! @return     The type of the shape.
+    SHAPE_TYPE GetShapeType() const override{
+        return SHAPE_INSTANCE;
+    }
+
+    //! @brief  Move the instance to a new place.
+    //!
+    //! @param  transform   The new transform from the local space of the prototype to world space.
+    void    SetTransform( const Transform& transform ) override;
+
+    //! @brief  Move a segment of a moving instance to a new place.
+    //!
+    //! @param  begin       The new transform at the beginning of the segment.
+    //! @param  end         The new transform at the end of the segment.
+    void    SetMotion( const Transform& begin , const Transform& end );
+
+    //! @brief  Get the mesh shared by the instances.
+    //!
+    //! @return     The prototype of the instance.
+    SORT_FORCEINLINE const InstancePrototype& GetPrototype() const {
+        return m_prototype;
+    }
+
+private:
+    const InstancePrototype&    m_prototype;        /**< The prototype of the instance. */
+    bool                        m_flipped = false;  /**< Whether the transform flips the handedness of the prototype. */
+    bool                        m_moving = false;   /**< Whether the instance is a segment of a moving instance. */
+    Transform                   m_transformEnd;     /**< The transform at the end of the segment, 'm_transform' is the one at the beginning. */
+    float                       m_timeBegin = 0.0f; /**< The beginning of the segment in the shutter interval. */
+    float                       m_timeEnd = 1.0f;   /**< The end of the segment in the shutter interval. */
+};
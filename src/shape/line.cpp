@@ -19,6 +19,14 @@
 #include "math/utils.h"
 
 bool Line::GetIntersect( const Ray& r , SurfaceInteraction* intersect ) const{
+    if( !GetIntersectDeferred( r , intersect ) )
+        return false;
+    if( intersect )
+        FinalizeInteraction( r , intersect );
+    return true;
+}
+
+bool Line::GetIntersectDeferred( const Ray& r , SurfaceInteraction* intersect ) const{
     // convert it to line space first
     const auto ray = m_world2Line( r );
 
@@ -52,49 +60,54 @@ bool Line::GetIntersect( const Ray& r , SurfaceInteraction* intersect ) const{
     if( t >= intersect->t )
         return false;
 
-    if( intersect ){
-        intersect->intersect = r(t);
-
-        if( inter.y == m_length ){
-            // A corner case where the tip of the line is being intersected.
-            intersect->gnormal = normalize( m_world2Line.GetInversed().TransformVector( Vector( 0.0f , 1.0f , 0.0f ) ) );
-            intersect->normal = intersect->gnormal;
-            intersect->tangent = normalize( m_world2Line.GetInversed().TransformVector( Vector( 1.0f , 0.0f , 0.0f ) ) );
-        }else{
-            // There could be better way to calculate the normal with smarter math.
-            /*const auto w = lerp( m_w0 , m_w1 , inter.y / m_length );
-            Point top( m_w1 * inter.x / w , m_length ,  m_w1 * inter.z / w );
-            const auto tangent = normalize( top - inter );
-            intersect->tangent = m_world2Line.GetInversed()( tangent );
-
-            const auto normal = Vector( inter.x , 0.0f , inter.z );
-            const auto biTangent = cross( normal , tangent );
-            intersect->normal = normalize( m_world2Line.GetInversed()( cross( tangent , biTangent ) ) );
-            intersect->gnormal = intersect->normal;*/
-
-            // This may not be physically correct, but it should be fine for a pixel width line.
-            intersect->gnormal = normalize(m_world2Line.GetInversed().TransformVector( Vector( inter.x , 0.0f , inter.z ) ) );
-            intersect->normal = intersect->gnormal;
-            intersect->tangent = normalize( m_gp1 - m_gp0 );
-
-            intersect->view = -r.m_Dir;
-        }
-
-        intersect->u = 1.0f;
-        intersect->v = slerp( m_v0 , m_v1 , inter.y / m_length );
-        intersect->t = t;
-    }
+    intersect->t = t;
+    intersect->pending = true;
     return true;
 }
 
-const BBox& Line::GetBBox() const{
-    if( !m_bbox ){
-        m_bbox = std::make_unique<BBox>();
-        m_bbox->Union( m_gp0 );
-        m_bbox->Union( m_gp1 );
-        m_bbox->Expend( std::max( m_w0 , m_w1 ) );
+void Line::FinalizeInteraction( const Ray& r , SurfaceInteraction* intersect ) const{
+    // the point in line space is evaluated the same way as the intersection test does
+    const auto t = intersect->t;
+    const auto inter = m_world2Line( r )( t );
+
+    intersect->intersect = r(t);
+    intersect->view = -r.m_Dir;
+
+    if( inter.y == m_length ){
+        // A corner case where the tip of the line is being intersected.
+        intersect->gnormal = normalize( m_world2Line.GetInversed().TransformVector( Vector( 0.0f , 1.0f , 0.0f ) ) );
+        intersect->normal = intersect->gnormal;
+        intersect->tangent = normalize( m_world2Line.GetInversed().TransformVector( Vector( 1.0f , 0.0f , 0.0f ) ) );
+    }else{
+        // There could be better way to calculate the normal with smarter math.
+        /*const auto w = lerp( m_w0 , m_w1 , inter.y / m_length );
+        Point top( m_w1 * inter.x / w , m_length ,  m_w1 * inter.z / w );
+        const auto tangent = normalize( top - inter );
+        intersect->tangent = m_world2Line.GetInversed()( tangent );
+
+        const auto normal = Vector( inter.x , 0.0f , inter.z );
+        const auto biTangent = cross( normal , tangent );
+        intersect->normal = normalize( m_world2Line.GetInversed()( cross( tangent , biTangent ) ) );
+        intersect->gnormal = intersect->normal;*/
+
+        // This may not be physically correct, but it should be fine for a pixel width line.
+        intersect->gnormal = normalize(m_world2Line.GetInversed().TransformVector( Vector( inter.x , 0.0f , inter.z ) ) );
+        intersect->normal = intersect->gnormal;
+        intersect->tangent = normalize( m_gp1 - m_gp0 );
     }
-    return *m_bbox;
+
+    intersect->u = 1.0f;
+    intersect->v = slerp( m_v0 , m_v1 , inter.y / m_length );
+    intersect->pending = false;
+}
+
+BBox Line::GetBBox() const{
+    // hair has as many lines as meshes have triangles, it is evaluated on the fly instead of being cached
+    BBox bbox;
+    bbox.Union( m_gp0 );
+    bbox.Union( m_gp1 );
+    bbox.Expend( std::max( m_w0 , m_w1 ) );
+    return bbox;
 }
 
 float Line::SurfaceArea() const{
@@ -19,7 +19,15 @@
 
 #include "shape.h"
 
-#ifdef SSE_ENABLED
+#if defined(AVX_ENABLED) || defined(AVX512_ENABLED)
+    #include <immintrin.h>
+#endif
+
+#ifdef NEON_ENABLED
+    #include <arm_neon.h>
+#endif
+
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
 struct Line4;
 struct Ray4_Data;
 #endif
@@ -29,6 +37,11 @@ struct Line8;
 struct Ray8_Data;
 #endif
 
+#ifdef AVX512_ENABLED
+struct Line16;
+struct Ray16_Data;
+#endif
+
 //! @brief  Line is a common type for hair or fur rendering.
 /**
  * Although being called line, this shape is essentially open cylinder. Other choose is to represent line
@@ -93,6 +106,24 @@ public:
     //! @return         Whether the ray intersects the shape.
     bool            GetIntersect( const Ray& ray , SurfaceInteraction* inter = nullptr ) const override;
 
+    //! @brief      Intersection test recording only the distance of the hit.
+    //!
+    //! This is what traversals use, the hit is marked as pending and 'FinalizeInteraction' evaluates the rest of the
+    //! attributes once it turns out to be the nearest one.
+    //!
+    //! @param ray      The ray to be tested against.
+    //! @param inter    The intersection data to be filled. If it is nullptr, it is an occlusion test.
+    //! @return         Whether the ray intersects the shape.
+    bool            GetIntersectDeferred( const Ray& ray , SurfaceInteraction* inter ) const;
+
+    //! @brief      Evaluate the position, normals, tangent and uv coordinate of a pending hit.
+    //!
+    //! The point in the space of the line is recovered from the distance, which is cheaper than carrying it around.
+    //!
+    //! @param ray      The ray that hits the line.
+    //! @param inter    The intersection holding the distance of the hit.
+    void            FinalizeInteraction( const Ray& ray , SurfaceInteraction* inter ) const override;
+
     //! @brief Intersection test between the shape and a bounding box.
     //!
     //! Because the accurate intersection test depends also on the viewing angle, which is not available
@@ -107,7 +138,7 @@ public:
     //! either side.
     //!
     //! @return     The bounding box of the shape.
-    const BBox&     GetBBox() const override;
+    BBox            GetBBox() const override;
 
     //! @brief      Get the surface area of the shape.
     //!
@@ -164,13 +195,32 @@ private:
      * there is no scaling in the matrix. */
     Transform       m_world2Line;
 
-#ifdef SSE_ENABLED
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
     friend struct Line4;
-    friend SORT_FORCEINLINE bool intersectLine_SIMD( const Ray& ray , const Ray4_Data& ray_simd , const Line4& line_simd , SurfaceInteraction* ret );
+    #ifdef SORT_IN_WINDOWS
+        friend SORT_FORCEINLINE void setupLineIntersection( const Line4& line_simd , const Ray& ray , const simd_data_sse& t_simd , const simd_data_sse& inter_x , const simd_data_sse& inter_y , const simd_data_sse& inter_z , const int res_i , SurfaceInteraction* ret );
+    #elif defined(NEON_ENABLED)
+        friend SORT_FORCEINLINE void setupLineIntersection( const Line4& line_simd , const Ray& ray , const float32x4_t& t_simd , const float32x4_t& inter_x , const float32x4_t& inter_y , const float32x4_t& inter_z , const int res_i , SurfaceInteraction* ret );
+    #else
+        friend SORT_FORCEINLINE void setupLineIntersection( const Line4& line_simd , const Ray& ray , const __m128& t_simd , const __m128& inter_x , const __m128& inter_y , const __m128& inter_z , const int res_i , SurfaceInteraction* ret );
+    #endif
 #endif
 
 #ifdef AVX_ENABLED
     friend struct Line8;
-    friend SORT_FORCEINLINE bool intersectLine_SIMD( const Ray& ray , const Ray8_Data& ray_simd , const Line8& line_simd , SurfaceInteraction* ret );
+    #ifdef SORT_IN_WINDOWS
+        friend SORT_FORCEINLINE void setupLineIntersection( const Line8& line_simd , const Ray& ray , const simd_data_avx& t_simd , const simd_data_avx& inter_x , const simd_data_avx& inter_y , const simd_data_avx& inter_z , const int res_i , SurfaceInteraction* ret );
+    #else
+        friend SORT_FORCEINLINE void setupLineIntersection( const Line8& line_simd , const Ray& ray , const __m256& t_simd , const __m256& inter_x , const __m256& inter_y , const __m256& inter_z , const int res_i , SurfaceInteraction* ret );
+    #endif
+#endif
+
+#ifdef AVX512_ENABLED
+    friend struct Line16;
+    #ifdef SORT_IN_WINDOWS
+        friend SORT_FORCEINLINE void setupLineIntersection( const Line16& line_simd , const Ray& ray , const simd_data_avx512& t_simd , const simd_data_avx512& inter_x , const simd_data_avx512& inter_y , const simd_data_avx512& inter_z , const int res_i , SurfaceInteraction* ret );
+    #else
+        friend SORT_FORCEINLINE void setupLineIntersection( const Line16& line_simd , const Ray& ray , const __m512& t_simd , const __m512& inter_x , const __m512& inter_y , const __m512& inter_z , const int res_i , SurfaceInteraction* ret );
+    #endif
 #endif
 };
@@ -92,7 +92,7 @@ bool Quad::GetIntersect( const Ray& r , SurfaceInteraction* intersect ) const{
     return true;
 }
 
-const BBox& Quad::GetBBox() const{
+BBox Quad::GetBBox() const{
     const auto halfx = sizeX * 0.5f;
     const auto halfy = sizeY * 0.5f;
     if( !m_bbox ){
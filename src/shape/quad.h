@@ -71,7 +71,7 @@ public:
     //! box, which is also acceptable to all rest systems call this function.
     //!
     //! @return     The bounding box of the shape.
-    const BBox&     GetBBox() const override;
+    BBox            GetBBox() const override;
 
     //! @brief      Get the surface area of the shape.
     //!
@@ -91,6 +91,16 @@ public:
     //! @param      y   Size along y axis.
     void            SetSizeY(float y) { sizeY = std::max( 0.0001f , y ); }
 
+    //! @brief      Get the size of the quad along x axis.
+    //!
+    //! @return     The size of the quad along x axis.
+    float           GetSizeX() const { return sizeX; }
+
+    //! @brief      Get the size of the quad along y axis.
+    //!
+    //! @return     The size of the quad along y axis.
+    float           GetSizeY() const { return sizeY; }
+
     //! @brief      Get the type of the shape
     //!
     //! @return     The type of the shape.
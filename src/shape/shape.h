@@ -32,6 +32,9 @@ enum SHAPE_TYPE{
     SHAPE_DISK      = 2,
     SHAPE_QUAD      = 3,
     SHAPE_SPHERE    = 4,
+    SHAPE_INSTANCE  = 5,
+    SHAPE_CURVE     = 6,
+    SHAPE_SUBDIVISION = 7,
 };
 
 //! @brief Shape class defines basic interface of shape.
@@ -44,6 +47,12 @@ enum SHAPE_TYPE{
 class Shape
 {
 public:
+    //! @brief  Default constructor.
+    Shape() = default;
+
+    //! @brief  Move constructor, triangles of meshes are moved in contiguous arrays.
+    Shape( Shape&& ) = default;
+
     //! @brief  Empty virtual destructor.
     virtual ~Shape(){}
 
@@ -106,6 +115,15 @@ public:
     //! @return         Whether the ray intersects the shape.
     virtual bool    GetIntersect( const Ray& ray , SurfaceInteraction* inter = nullptr ) const = 0;
 
+    //! @brief      Evaluate the attributes of a hit recorded by a traversal.
+    //!
+    //! Shapes that only record the distance and the barycentric coordinate of a hit during traversal evaluate the rest
+    //! of the attributes here, once the nearest hit is known. Shapes filling everything in 'GetIntersect' do nothing.
+    //!
+    //! @param ray      The ray that hits the shape.
+    //! @param inter    The intersection to be completed, its distance and barycentric coordinate are already filled.
+    virtual void    FinalizeInteraction( const Ray& ray , SurfaceInteraction* inter ) const {}
+
     //! @brief Intersection test between the shape and a bounding box.
     //!
     //! The default implementation here is a fairly conservative one by returning true.
@@ -117,9 +135,23 @@ public:
     //!
     //! Get the bounding box of the shape. Some shape may return a relatively conservative bounding
     //! box, which is also acceptable to all rest systems call this function.
+    //! It is returned by value so that shapes as numerous as triangles and lines could evaluate it on the fly instead
+    //! of caching one per shape, BVH construction keeps its own copy of all bounding boxes in a contiguous buffer.
     //!
     //! @return     The bounding box of the shape.
-    virtual const   BBox&   GetBBox() const = 0;
+    virtual BBox    GetBBox() const = 0;
+
+    //! @brief      Get the bounding box of the part of the shape inside a box.
+    //!
+    //! This is used by spatial splits during BVH construction. The default implementation clips the bounding box of the
+    //! shape, which is conservative. Shapes could return a tighter bounding box by clipping their real geometry.
+    //!
+    //! @param box  The box to clip the shape against.
+    //! @return     The bounding box of the clipped shape, it is inverted if nothing of the shape is inside the box.
+    virtual BBox    ClipBBox( const BBox& box ) const { return Overlap( GetBBox() , box ); }
+
+    //! @brief      Drop the cached bounding box, it needs to be done once the shape is moved.
+    SORT_FORCEINLINE void   ResetBBox() { m_bbox = nullptr; }
 
     //! @brief      Get the surface area of the shape.
     //!
@@ -134,12 +166,22 @@ public:
     //! @param transform    The new transform of the shape to be set.
     virtual void    SetTransform( const Transform& transform ) { m_transform = transform; }
 
+    //! @brief      Get transform of the shape.
+    //!
+    //! @return     Transform of the shape from local space to world space.
+    const Transform& GetTransform() const { return m_transform; }
+
     //! @brief      Get the type of the shape
     //!
     //! @return     The type of the shape.
     virtual SHAPE_TYPE GetShapeType() const = 0;
+
+    //! @brief      Whether rays pass through the shape wherever the alpha mask of its material is transparent.
+    //!
+    //! @return     Whether the intersection test takes the alpha mask into account.
+    virtual bool    HasAlphaMask() const { return false; }
     
 protected:
     Transform                       m_transform;    /**< Transform of the shape from local space to world space. It is assumed there is no scaling in this matrix, the upper level code should handle it. */
-    mutable std::unique_ptr<BBox>   m_bbox;         /**< Bounding box of the shape in world coordinate. */
+    mutable std::unique_ptr<BBox>   m_bbox;         /**< Cached bounding box of the shape in world coordinate, triangles and lines don't use it. */
 };
@@ -121,7 +121,7 @@ void Sphere::Sample_l( const LightSample& ls , Ray& r , Vector& n , float* pdf )
 }
 
 // get the bounding box of the primitive
-const BBox& Sphere::GetBBox() const{
+BBox Sphere::GetBBox() const{
     Point center = m_transform.TransformPoint( Point( 0.0f , 0.0f , 0.0f ) );
 
     if( !m_bbox )
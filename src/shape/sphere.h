@@ -80,7 +80,7 @@ public:
     //! box, which is also acceptable to all rest systems call this function.
     //!
     //! @return     The bounding box of the shape.
-    const BBox&     GetBBox() const override;
+    BBox            GetBBox() const override;
 
     //! @brief      Get the surface area of the shape.
     //!
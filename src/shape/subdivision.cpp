@@ -0,0 +1,777 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+#include <algorithm>
+#include "subdivision.h"
+#include "triangle.h"
+#include "core/hash.h"
+#include "core/globalconfig.h"
+#include "texture/imagetexture2d.h"
+
+SORT_STATS_DEFINE_COUNTER(sSubdivisionTessellatedPatches)
+SORT_STATS_DEFINE_COUNTER(sSubdivisionEvictedPatches)
+SORT_STATS_DEFINE_COUNTER(sSubdivisionMicroQuads)
+
+SORT_STATS_COUNTER("Subdivision", "Tessellated Patches", sSubdivisionTessellatedPatches);
+SORT_STATS_COUNTER("Subdivision", "Evicted Patches", sSubdivisionEvictedPatches);
+SORT_STATS_COUNTER("Subdivision", "Micro Quads", sSubdivisionMicroQuads);
+
+// Once the cache goes beyond the budget, tessellations are dropped until it is below this ratio of the budget, so that
+// it doesn't need to evict something every time a new patch is tessellated.
+static constexpr float SUBDIVISION_CACHE_EVICT_RATIO = 0.75f;
+
+namespace {
+    // Patches are tessellated independently, vertices shared by adjacent patches need to be bitwise identical, otherwise
+    // rays leak through the cracks between them. Every vertex and face in the refinement has a key that only depends on
+    // how it is derived from the control mesh, all sums are evaluated in the order of the keys so that it doesn't matter
+    // in what order the patch sees them.
+    SORT_FORCEINLINE std::uint64_t mixKey( std::uint64_t a , std::uint64_t b ){
+        return HashValue( b , HashValue( a ) );
+    }
+
+    using KeyedPoint = std::pair<std::uint64_t, Point>;
+
+    Point sortedSum( std::vector<KeyedPoint>& items ){
+        std::sort( items.begin() , items.end() , []( const KeyedPoint& a , const KeyedPoint& b ){ return a.first < b.first; } );
+        Point sum;
+        for( const auto& item : items )
+            sum = sum + item.second;
+        return sum;
+    }
+
+    // The faces of the control mesh around the patch, it gets refined level by level.
+    struct LocalMesh{
+        std::vector<Point>          points;
+        std::vector<std::uint64_t>  vertex_keys;
+        std::vector<unsigned>       face_offsets;   // with the end of the last face at the end
+        std::vector<unsigned>       face_vertices;
+        std::vector<std::uint64_t>  face_keys;
+        std::vector<int>            face_nodes;     // node of the face in the hierarchy, -1 for faces out of the patch
+        std::vector<Vector2f>       face_uvs;       // per corner, only faces in the patch have them
+
+        unsigned FaceCnt() const {
+            return (unsigned)face_offsets.size() - 1;
+        }
+        unsigned FaceSize( unsigned f ) const {
+            return face_offsets[f + 1] - face_offsets[f];
+        }
+        unsigned Corner( unsigned f , unsigned i ) const {
+            return face_vertices[face_offsets[f] + i];
+        }
+    };
+
+    struct LocalEdge{
+        unsigned    v[2];
+        unsigned    f[2];
+        unsigned    face_cnt = 0;   // anything other than two is a boundary, including non-manifold edges
+
+        bool IsBoundary() const {
+            return face_cnt != 2;
+        }
+        unsigned Other( unsigned vertex ) const {
+            return v[0] == vertex ? v[1] : v[0];
+        }
+    };
+
+    struct Topology{
+        std::vector<LocalEdge>              edges;
+        std::vector<unsigned>               face_edges;     // the edge from each corner to the next one
+        std::vector<std::vector<unsigned>>  vertex_edges;
+        std::vector<std::vector<unsigned>>  vertex_faces;
+    };
+
+    void buildTopology( const LocalMesh& mesh , Topology& topo ){
+        const auto vertex_cnt = (unsigned)mesh.points.size();
+        topo.vertex_edges.assign( vertex_cnt , {} );
+        topo.vertex_faces.assign( vertex_cnt , {} );
+        topo.face_edges.resize( mesh.face_vertices.size() );
+
+        std::unordered_map<std::uint64_t, unsigned> edge_map;
+        for( auto f = 0u ; f < mesh.FaceCnt() ; ++f ){
+            const auto n = mesh.FaceSize( f );
+            for( auto i = 0u ; i < n ; ++i ){
+                const auto a = mesh.Corner( f , i );
+                const auto b = mesh.Corner( f , ( i + 1 ) % n );
+                const auto lo = std::min( a , b ) , hi = std::max( a , b );
+                const auto key = ( (std::uint64_t)lo << 32 ) | hi;
+
+                auto it = edge_map.find( key );
+                if( it == edge_map.end() ){
+                    it = edge_map.insert( std::make_pair( key , (unsigned)topo.edges.size() ) ).first;
+                    LocalEdge edge;
+                    edge.v[0] = lo;
+                    edge.v[1] = hi;
+                    topo.edges.push_back( edge );
+                    topo.vertex_edges[lo].push_back( it->second );
+                    topo.vertex_edges[hi].push_back( it->second );
+                }
+
+                auto& edge = topo.edges[it->second];
+                if( edge.face_cnt < 2 )
+                    edge.f[edge.face_cnt] = f;
+                ++edge.face_cnt;
+
+                topo.face_edges[mesh.face_offsets[f] + i] = it->second;
+                topo.vertex_faces[a].push_back( f );
+            }
+        }
+    }
+
+    // Boundary vertices with two boundary edges follow the cubic B-spline of the boundary, vertices with a single face or
+    // more boundary edges are corners.
+    bool isSmoothBoundary( const Topology& topo , unsigned v , unsigned& a , unsigned& b ){
+        auto cnt = 0u;
+        for( const auto e : topo.vertex_edges[v] ){
+            const auto& edge = topo.edges[e];
+            if( !edge.IsBoundary() )
+                continue;
+            if( cnt == 0 )
+                a = edge.Other( v );
+            else
+                b = edge.Other( v );
+            ++cnt;
+        }
+        return cnt == 2 && topo.vertex_faces[v].size() > 1;
+    }
+
+    bool isInterior( const Topology& topo , unsigned v ){
+        for( const auto e : topo.vertex_edges[v] ){
+            if( topo.edges[e].IsBoundary() )
+                return false;
+        }
+        return !topo.vertex_faces[v].empty();
+    }
+
+    // One step of Catmull-Clark refinement. Faces that don't touch any vertex of the sub-faces of the patch are dropped,
+    // the rest is exactly what is needed to refine the patch once more.
+    void refine( const LocalMesh& in , LocalMesh& out , std::vector<SubdivisionTessellation::Node>& nodes ){
+        Topology topo;
+        buildTopology( in , topo );
+
+        const auto vertex_cnt = (unsigned)in.points.size();
+        const auto edge_cnt = (unsigned)topo.edges.size();
+        const auto face_cnt = in.FaceCnt();
+
+        std::vector<KeyedPoint> items;
+
+        // face points
+        std::vector<Point> face_points( face_cnt );
+        for( auto f = 0u ; f < face_cnt ; ++f ){
+            const auto n = in.FaceSize( f );
+            Point sum;
+            for( auto i = 0u ; i < n ; ++i )
+                sum = sum + in.points[in.Corner( f , i )];
+            face_points[f] = sum / (float)n;
+        }
+
+        // edge points
+        std::vector<Point>          edge_points( edge_cnt );
+        std::vector<std::uint64_t>  edge_keys( edge_cnt );
+        std::vector<Point>          edge_midpoints( edge_cnt );
+        for( auto e = 0u ; e < edge_cnt ; ++e ){
+            const auto& edge = topo.edges[e];
+            const auto ka = in.vertex_keys[edge.v[0]] , kb = in.vertex_keys[edge.v[1]];
+            edge_keys[e] = mixKey( std::min( ka , kb ) , std::max( ka , kb ) );
+
+            items.clear();
+            items.push_back( KeyedPoint( ka , in.points[edge.v[0]] ) );
+            items.push_back( KeyedPoint( kb , in.points[edge.v[1]] ) );
+            edge_midpoints[e] = sortedSum( items ) * 0.5f;
+
+            if( edge.IsBoundary() ){
+                edge_points[e] = edge_midpoints[e];
+            }else{
+                items.push_back( KeyedPoint( in.face_keys[edge.f[0]] , face_points[edge.f[0]] ) );
+                items.push_back( KeyedPoint( in.face_keys[edge.f[1]] , face_points[edge.f[1]] ) );
+                edge_points[e] = sortedSum( items ) * 0.25f;
+            }
+        }
+
+        // vertex points
+        std::vector<Point> vertex_points( vertex_cnt );
+        for( auto v = 0u ; v < vertex_cnt ; ++v ){
+            const auto& p = in.points[v];
+            auto a = 0u , b = 0u;
+            if( isInterior( topo , v ) ){
+                const auto& faces = topo.vertex_faces[v];
+                const auto& edges = topo.vertex_edges[v];
+                const auto n = (float)edges.size();
+
+                items.clear();
+                for( const auto f : faces )
+                    items.push_back( KeyedPoint( in.face_keys[f] , face_points[f] ) );
+                const auto q = sortedSum( items ) / (float)faces.size();
+
+                items.clear();
+                for( const auto e : edges )
+                    items.push_back( KeyedPoint( edge_keys[e] , edge_midpoints[e] ) );
+                const auto r = sortedSum( items ) / n;
+
+                vertex_points[v] = ( q + r * 2.0f + p * ( n - 3.0f ) ) / n;
+            }else if( isSmoothBoundary( topo , v , a , b ) ){
+                items.clear();
+                items.push_back( KeyedPoint( in.vertex_keys[a] , in.points[a] ) );
+                items.push_back( KeyedPoint( in.vertex_keys[b] , in.points[b] ) );
+                vertex_points[v] = ( sortedSum( items ) + p * 6.0f ) / 8.0f;
+            }else{
+                vertex_points[v] = p;
+            }
+        }
+
+        // every face is split into quads, one for each corner
+        LocalMesh refined;
+        refined.points.reserve( vertex_cnt + edge_cnt + face_cnt );
+        refined.points.insert( refined.points.end() , vertex_points.begin() , vertex_points.end() );
+        refined.points.insert( refined.points.end() , edge_points.begin() , edge_points.end() );
+        refined.points.insert( refined.points.end() , face_points.begin() , face_points.end() );
+        refined.vertex_keys.reserve( refined.points.size() );
+        for( const auto key : in.vertex_keys )
+            refined.vertex_keys.push_back( mixKey( 2 , key ) );
+        for( const auto key : edge_keys )
+            refined.vertex_keys.push_back( mixKey( 3 , key ) );
+        for( const auto key : in.face_keys )
+            refined.vertex_keys.push_back( mixKey( 4 , key ) );
+
+        refined.face_offsets.push_back( 0 );
+        for( auto f = 0u ; f < face_cnt ; ++f ){
+            const auto n = in.FaceSize( f );
+            const auto offset = in.face_offsets[f];
+            const auto node = in.face_nodes[f];
+            if( node >= 0 ){
+                nodes[node].child = (unsigned)nodes.size();
+                nodes[node].child_cnt = n;
+                nodes.resize( nodes.size() + n );
+            }
+
+            Vector2f centroid;
+            if( node >= 0 ){
+                for( auto i = 0u ; i < n ; ++i )
+                    centroid += in.face_uvs[offset + i];
+                centroid = centroid / (float)n;
+            }
+
+            for( auto i = 0u ; i < n ; ++i ){
+                const auto prev = ( i + n - 1 ) % n , next = ( i + 1 ) % n;
+                refined.face_vertices.push_back( in.Corner( f , i ) );
+                refined.face_vertices.push_back( vertex_cnt + topo.face_edges[offset + i] );
+                refined.face_vertices.push_back( vertex_cnt + edge_cnt + f );
+                refined.face_vertices.push_back( vertex_cnt + topo.face_edges[offset + prev] );
+                refined.face_offsets.push_back( (unsigned)refined.face_vertices.size() );
+                refined.face_keys.push_back( mixKey( in.face_keys[f] , i ) );
+
+                // texture coordinates are interpolated linearly, they are only needed by the patch itself
+                if( node >= 0 ){
+                    const auto& uv = in.face_uvs[offset + i];
+                    refined.face_uvs.push_back( uv );
+                    refined.face_uvs.push_back( ( uv + in.face_uvs[offset + next] ) * 0.5f );
+                    refined.face_uvs.push_back( centroid );
+                    refined.face_uvs.push_back( ( in.face_uvs[offset + prev] + uv ) * 0.5f );
+                    refined.face_nodes.push_back( (int)( nodes[node].child + i ) );
+                }else{
+                    refined.face_uvs.insert( refined.face_uvs.end() , 4 , Vector2f() );
+                    refined.face_nodes.push_back( -1 );
+                }
+            }
+        }
+
+        // only keep the faces touching the patch and the vertices used by them
+        std::vector<char> in_patch( refined.points.size() , 0 );
+        for( auto f = 0u ; f < refined.FaceCnt() ; ++f ){
+            if( refined.face_nodes[f] < 0 )
+                continue;
+            for( auto i = 0u ; i < 4 ; ++i )
+                in_patch[refined.Corner( f , i )] = 1;
+        }
+
+        out = LocalMesh();
+        out.face_offsets.push_back( 0 );
+        std::vector<unsigned> remap( refined.points.size() , ~0u );
+        for( auto f = 0u ; f < refined.FaceCnt() ; ++f ){
+            auto touching = false;
+            for( auto i = 0u ; i < 4 ; ++i )
+                touching |= in_patch[refined.Corner( f , i )] != 0;
+            if( !touching )
+                continue;
+
+            for( auto i = 0u ; i < 4 ; ++i ){
+                const auto v = refined.Corner( f , i );
+                if( remap[v] == ~0u ){
+                    remap[v] = (unsigned)out.points.size();
+                    out.points.push_back( refined.points[v] );
+                    out.vertex_keys.push_back( refined.vertex_keys[v] );
+                }
+                out.face_vertices.push_back( remap[v] );
+                out.face_uvs.push_back( refined.face_uvs[4 * f + i] );
+            }
+            out.face_offsets.push_back( (unsigned)out.face_vertices.size() );
+            out.face_keys.push_back( refined.face_keys[f] );
+            out.face_nodes.push_back( refined.face_nodes[f] );
+        }
+    }
+
+    std::shared_ptr<SubdivisionTessellation> tessellate( const SubdivisionMesh& mesh , unsigned face ){
+        auto tessellation = std::make_shared<SubdivisionTessellation>();
+        if( mesh.FaceSize( face ) < 3 )
+            return tessellation;
+
+        // the faces sharing any vertex with the patch, the limit surface of the patch only depends on them
+        std::vector<unsigned> ring;
+        for( auto i = mesh.m_faceOffsets[face] ; i < mesh.m_faceOffsets[face + 1] ; ++i ){
+            const auto v = mesh.m_faceVertices[i];
+            ring.insert( ring.end() , mesh.m_vertexFaces.begin() + mesh.m_vertexFaceOffsets[v] , mesh.m_vertexFaces.begin() + mesh.m_vertexFaceOffsets[v + 1] );
+        }
+        std::sort( ring.begin() , ring.end() );
+        ring.erase( std::unique( ring.begin() , ring.end() ) , ring.end() );
+
+        auto& nodes = tessellation->nodes;
+        nodes.resize( 1 );
+
+        LocalMesh local;
+        local.face_offsets.push_back( 0 );
+        std::unordered_map<unsigned, unsigned> remap;
+        for( const auto f : ring ){
+            for( auto i = mesh.m_faceOffsets[f] ; i < mesh.m_faceOffsets[f + 1] ; ++i ){
+                const auto v = mesh.m_faceVertices[i];
+                auto it = remap.find( v );
+                if( it == remap.end() ){
+                    it = remap.insert( std::make_pair( v , (unsigned)local.points.size() ) ).first;
+                    local.points.push_back( mesh.m_positions[v] );
+                    local.vertex_keys.push_back( mixKey( 0 , v ) );
+                }
+                local.face_vertices.push_back( it->second );
+                local.face_uvs.push_back( f == face ? mesh.m_faceUVs[i] : Vector2f() );
+            }
+            local.face_offsets.push_back( (unsigned)local.face_vertices.size() );
+            local.face_keys.push_back( mixKey( 1 , f ) );
+            local.face_nodes.push_back( f == face ? 0 : -1 );
+        }
+
+        const auto level = std::max( 1u , std::min( mesh.m_level , SUBDIVISION_MAX_LEVEL ) );
+        for( auto l = 0u ; l < level ; ++l ){
+            LocalMesh refined;
+            refine( local , refined , nodes );
+            local = std::move( refined );
+        }
+
+        // push the vertices of the patch to the limit surface
+        Topology topo;
+        buildTopology( local , topo );
+
+        std::vector<unsigned> remap_patch( local.points.size() , ~0u );
+        std::vector<unsigned> patch_vertices;
+        std::vector<Vector2f> patch_uvs;
+        for( auto f = 0u ; f < local.FaceCnt() ; ++f ){
+            if( local.face_nodes[f] < 0 )
+                continue;
+            for( auto i = 0u ; i < 4 ; ++i ){
+                const auto v = local.Corner( f , i );
+                if( remap_patch[v] == ~0u ){
+                    remap_patch[v] = (unsigned)patch_vertices.size();
+                    patch_vertices.push_back( v );
+                    patch_uvs.push_back( local.face_uvs[local.face_offsets[f] + i] );
+                }
+            }
+        }
+
+        auto& positions = tessellation->positions;
+        auto& normals = tessellation->normals;
+        positions.resize( patch_vertices.size() );
+        normals.resize( patch_vertices.size() );
+
+        std::vector<KeyedPoint> items;
+        for( auto i = 0u ; i < patch_vertices.size() ; ++i ){
+            const auto v = patch_vertices[i];
+            const auto& p = local.points[v];
+            auto a = 0u , b = 0u;
+            if( isInterior( topo , v ) ){
+                // all faces are quads after the first level of refinement
+                const auto n = (float)topo.vertex_edges[v].size();
+
+                items.clear();
+                for( const auto e : topo.vertex_edges[v] ){
+                    const auto other = topo.edges[e].Other( v );
+                    items.push_back( KeyedPoint( local.vertex_keys[other] , local.points[other] ) );
+                }
+                const auto edge_sum = sortedSum( items );
+
+                items.clear();
+                for( const auto f : topo.vertex_faces[v] ){
+                    auto corner = 0u;
+                    while( local.Corner( f , corner ) != v )
+                        ++corner;
+                    const auto diagonal = local.Corner( f , ( corner + 2 ) % 4 );
+                    items.push_back( KeyedPoint( local.vertex_keys[diagonal] , local.points[diagonal] ) );
+                }
+                const auto diagonal_sum = sortedSum( items );
+
+                positions[i] = ( p * ( n * n ) + edge_sum * 4.0f + diagonal_sum ) / ( n * ( n + 5.0f ) );
+            }else if( isSmoothBoundary( topo , v , a , b ) ){
+                items.clear();
+                items.push_back( KeyedPoint( local.vertex_keys[a] , local.points[a] ) );
+                items.push_back( KeyedPoint( local.vertex_keys[b] , local.points[b] ) );
+                positions[i] = ( sortedSum( items ) + p * 4.0f ) / 6.0f;
+            }else{
+                positions[i] = p;
+            }
+
+            // the normal is the average of the normals of the adjacent quads, summed in a fixed order as well
+            items.clear();
+            for( const auto f : topo.vertex_faces[v] ){
+                const auto& p0 = local.points[local.Corner( f , 0 )];
+                const auto& p1 = local.points[local.Corner( f , 1 )];
+                const auto& p2 = local.points[local.Corner( f , 2 )];
+                const auto& p3 = local.points[local.Corner( f , 3 )];
+                items.push_back( KeyedPoint( local.face_keys[f] , Point( cross( p3 - p1 , p2 - p0 ) ) ) );
+            }
+            normals[i] = normalize( Vector( sortedSum( items ) ) );
+        }
+
+        // displacement along the normal, vertices shared by adjacent patches get the same displacement as long as they
+        // have the same texture coordinate
+        const auto displaced = mesh.DisplacementBound() > 0.0f;
+        if( displaced ){
+            for( auto i = 0u ; i < positions.size() ; ++i )
+                positions[i] = positions[i] + normals[i] * mesh.Displacement( patch_uvs[i] );
+        }
+
+        // quads of the patch, they are the leaves of the hierarchy
+        for( auto f = 0u ; f < local.FaceCnt() ; ++f ){
+            const auto node = local.face_nodes[f];
+            if( node < 0 )
+                continue;
+            nodes[node].child = (unsigned)( tessellation->quads.size() / 4 );
+            for( auto i = 0u ; i < 4 ; ++i ){
+                tessellation->quads.push_back( remap_patch[local.Corner( f , i )] );
+                tessellation->uvs.push_back( local.face_uvs[local.face_offsets[f] + i] );
+            }
+        }
+        SORT_STATS(sSubdivisionMicroQuads += tessellation->quads.size() / 4);
+
+        // shading normals of the displaced surface
+        if( displaced ){
+            std::fill( normals.begin() , normals.end() , Vector() );
+            for( auto q = 0u ; q < tessellation->quads.size() ; q += 4 ){
+                const auto* quad = &tessellation->quads[q];
+                const auto n = cross( positions[quad[3]] - positions[quad[1]] , positions[quad[2]] - positions[quad[0]] );
+                for( auto i = 0u ; i < 4 ; ++i )
+                    normals[quad[i]] += n;
+            }
+            for( auto& n : normals )
+                n = normalize( n );
+        }
+
+        // children are always after their parents, the bounding boxes are evaluated bottom up
+        for( auto i = (int)nodes.size() - 1 ; i >= 0 ; --i ){
+            auto& node = nodes[i];
+            node.bbox = BBox();
+            if( node.child_cnt == 0 ){
+                for( auto j = 0u ; j < 4 ; ++j )
+                    node.bbox.Union( positions[tessellation->quads[4 * node.child + j]] );
+            }else{
+                for( auto j = 0u ; j < node.child_cnt ; ++j )
+                    node.bbox.Union( nodes[node.child + j].bbox );
+            }
+        }
+
+        return tessellation;
+    }
+
+    // Slab test against the closest intersection found so far.
+    SORT_FORCEINLINE bool intersectNode( const Ray& ray , const BBox& bb , float tmax ){
+        auto tmin = ray.m_fMin;
+        for( unsigned axis = 0 ; axis < 3 ; axis ++ ){
+            if( ray.m_Dir[axis] < 0.00001f && ray.m_Dir[axis] > -0.00001f ){
+                if( ray.m_Ori[axis] > bb.m_Max[axis] || ray.m_Ori[axis] < bb.m_Min[axis] )
+                    return false;
+            }else{
+                const auto ood = 1.0f / ray.m_Dir[axis];
+                auto t1 = ( bb.m_Min[axis] - ray.m_Ori[axis] ) * ood;
+                auto t2 = ( bb.m_Max[axis] - ray.m_Ori[axis] ) * ood;
+                if( t1 > t2 )
+                    std::swap( t1 , t2 );
+                tmin = std::max( t1 , tmin );
+                tmax = std::min( t2 * BBOX_ROBUST_SCALE , tmax );
+                if( tmin > tmax )
+                    return false;
+            }
+        }
+        return true;
+    }
+}
+
+SubdivisionMesh::SubdivisionMesh() = default;
+SubdivisionMesh::~SubdivisionMesh() = default;
+
+void SubdivisionMesh::BuildAdjacency(){
+    m_vertexFaceOffsets.assign( m_positions.size() + 1 , 0 );
+    for( const auto v : m_faceVertices )
+        ++m_vertexFaceOffsets[v + 1];
+    for( auto i = 1u ; i < m_vertexFaceOffsets.size() ; ++i )
+        m_vertexFaceOffsets[i] += m_vertexFaceOffsets[i - 1];
+
+    // faces are visited in order, the faces of each vertex are sorted naturally
+    std::vector<unsigned> cursor( m_vertexFaceOffsets.begin() , m_vertexFaceOffsets.end() - 1 );
+    m_vertexFaces.resize( m_faceVertices.size() );
+    for( auto f = 0u ; f + 1 < m_faceOffsets.size() ; ++f ){
+        for( auto i = m_faceOffsets[f] ; i < m_faceOffsets[f + 1] ; ++i )
+            m_vertexFaces[cursor[m_faceVertices[i]]++] = f;
+    }
+}
+
+float SubdivisionMesh::DisplacementBound() const{
+    if( !m_displacement || !m_displacement->IsValid() )
+        return 0.0f;
+    return fabs( m_displacementScale ) * std::max( m_displacementMidLevel , 1.0f - m_displacementMidLevel );
+}
+
+float SubdivisionMesh::Displacement( const Vector2f& uv ) const{
+    if( !m_displacement || !m_displacement->IsValid() )
+        return 0.0f;
+    const auto value = std::min( 1.0f , std::max( 0.0f , m_displacement->GetColorFromUV( uv.x , uv.y ).GetIntensity() ) );
+    return ( value - m_displacementMidLevel ) * m_displacementScale;
+}
+
+std::size_t SubdivisionTessellation::MemoryUsage() const{
+    return sizeof( SubdivisionTessellation ) + positions.capacity() * sizeof( Point ) + normals.capacity() * sizeof( Vector ) +
+           quads.capacity() * sizeof( unsigned ) + uvs.capacity() * sizeof( Vector2f ) + nodes.capacity() * sizeof( Node );
+}
+
+SubdivisionPatch::~SubdivisionPatch(){
+    SubdivisionCache::GetSingleton().Remove( this );
+}
+
+void SubdivisionPatch::Reset(){
+    SubdivisionCache::GetSingleton().Remove( this );
+    std::atomic_store( &m_tessellation , std::shared_ptr<const SubdivisionTessellation>() );
+    ResetBBox();
+}
+
+std::shared_ptr<const SubdivisionTessellation> SubdivisionPatch::getTessellation() const{
+    const auto now = SubdivisionCache::GetSingleton().Now();
+
+    auto tessellation = std::atomic_load( &m_tessellation );
+    if( tessellation ){
+        // only write it when the clock has ticked, patches hit by a lot of rays are not written all the time
+        if( m_lastUse.load( std::memory_order_relaxed ) != now )
+            m_lastUse.store( now , std::memory_order_relaxed );
+        return tessellation;
+    }
+
+    // threads tessellating the same patch at the same time is rare, the first one storing it wins
+    std::shared_ptr<const SubdivisionTessellation> fresh = tessellate( m_mesh , m_face );
+    std::shared_ptr<const SubdivisionTessellation> expected;
+    if( !std::atomic_compare_exchange_strong( &m_tessellation , &expected , fresh ) )
+        return expected;
+
+    SORT_STATS(++sSubdivisionTessellatedPatches);
+    m_lastUse.store( now , std::memory_order_relaxed );
+    SubdivisionCache::GetSingleton().Add( this , fresh->MemoryUsage() );
+    return fresh;
+}
+
+bool SubdivisionPatch::GetIntersect( const Ray& r , SurfaceInteraction* intersect ) const{
+    // nothing is tessellated until a ray gets close to the patch
+    if( Intersect( r , GetBBox() ) < 0.0f )
+        return false;
+
+    const auto tessellation = getTessellation();
+    const auto& nodes = tessellation->nodes;
+    if( nodes.empty() )
+        return false;
+
+    const auto& positions = tessellation->positions;
+    const auto& quads = tessellation->quads;
+
+    auto t_max = intersect ? std::min( intersect->t , r.m_fMax ) : r.m_fMax;
+    auto hit_quad = ~0u , hit_triangle = 0u;
+    auto hit_u = 0.0f , hit_v = 0.0f;
+
+    // the stack never holds more than three siblings of each level along with the node being visited
+    unsigned stack[4 * SUBDIVISION_MAX_LEVEL + 4];
+    const auto& root = nodes[0];
+    for( auto c = 0u ; c < root.child_cnt ; ++c ){
+        auto top = 0u;
+        stack[top++] = root.child + c;
+        while( top > 0 ){
+            const auto& node = nodes[stack[--top]];
+            if( !intersectNode( r , node.bbox , t_max ) )
+                continue;
+
+            if( node.child_cnt > 0 ){
+                for( auto i = 0u ; i < node.child_cnt ; ++i )
+                    stack[top++] = node.child + i;
+                continue;
+            }
+
+            const auto* quad = &quads[4 * node.child];
+            const auto& p0 = positions[quad[0]];
+            const auto& p1 = positions[quad[1]];
+            const auto& p2 = positions[quad[2]];
+            const auto& p3 = positions[quad[3]];
+
+            auto t = 0.0f , u = 0.0f , v = 0.0f;
+            if( intersectTriangle( r , p0 , p1 , p2 , t , u , v ) && t < t_max && t > 0.0f ){
+                if( IS_PTR_INVALID(intersect) )
+                    return true;
+                t_max = t;
+                hit_quad = node.child;
+                hit_triangle = 0;
+                hit_u = u;
+                hit_v = v;
+            }
+            if( intersectTriangle( r , p0 , p2 , p3 , t , u , v ) && t < t_max && t > 0.0f ){
+                if( IS_PTR_INVALID(intersect) )
+                    return true;
+                t_max = t;
+                hit_quad = node.child;
+                hit_triangle = 1;
+                hit_u = u;
+                hit_v = v;
+            }
+        }
+    }
+
+    if( hit_quad == ~0u )
+        return false;
+
+    // the two triangles of a quad are ( 0 , 1 , 2 ) and ( 0 , 2 , 3 )
+    const unsigned corners[2][3] = { { 0 , 1 , 2 } , { 0 , 2 , 3 } };
+    const auto* corner = corners[hit_triangle];
+    const auto* quad = &quads[4 * hit_quad];
+    const auto* uvs = &tessellation->uvs[4 * hit_quad];
+    const auto& op0 = positions[quad[corner[0]]];
+    const auto& op1 = positions[quad[corner[1]]];
+    const auto& op2 = positions[quad[corner[2]]];
+    const auto& uv0 = uvs[corner[0]];
+    const auto& uv1 = uvs[corner[1]];
+    const auto& uv2 = uvs[corner[2]];
+    const auto& n0 = tessellation->normals[quad[corner[0]]];
+    const auto& n1 = tessellation->normals[quad[corner[1]]];
+    const auto& n2 = tessellation->normals[quad[corner[2]]];
+    const auto u = hit_u , v = hit_v , w = 1 - u - v;
+
+    intersect->intersect = r(t_max);
+    intersect->gnormal = normalize(cross( ( op2 - op0 ) , ( op1 - op0 ) ));
+    intersect->normal = ( w * n0 + u * n1 + v * n2 ).Normalize();
+    intersect->view = -r.m_Dir;
+
+    const auto uv = w * uv0 + u * uv1 + v * uv2;
+    intersect->u = uv.x;
+    intersect->v = uv.y;
+    intersect->t = t_max;
+
+    const auto duv02 = uv0 - uv2;
+    const auto duv12 = uv1 - uv2;
+    const auto uvDet = duv02.x * duv12.y - duv02.y * duv12.x;
+    if( uvDet != 0.0f ){
+        const auto dp02 = op0 - op2;
+        const auto dp12 = op1 - op2;
+        const auto invUvDet = 1.0f / uvDet;
+        intersect->dpdu = ( duv12.y * dp02 - duv02.y * dp12 ) * invUvDet;
+        intersect->dpdv = ( duv02.x * dp12 - duv12.x * dp02 ) * invUvDet;
+    }else{
+        intersect->dpdu = intersect->dpdv = Vector();
+    }
+
+    // the tangent follows the texture coordinate, there is no tangent data in the control mesh
+    if( intersect->dpdu.SquaredLength() > 0.0f ){
+        intersect->tangent = normalize( intersect->dpdu );
+    }else{
+        Vector bitangent;
+        coordinateSystem( intersect->normal , intersect->tangent , bitangent );
+    }
+
+    return true;
+}
+
+BBox SubdivisionPatch::GetBBox() const{
+    if( !m_bbox ){
+        // the limit surface lies in the convex hull of the control points of the adjacent faces
+        m_bbox = std::make_unique<BBox>();
+        for( auto i = m_mesh.m_faceOffsets[m_face] ; i < m_mesh.m_faceOffsets[m_face + 1] ; ++i ){
+            const auto v = m_mesh.m_faceVertices[i];
+            for( auto j = m_mesh.m_vertexFaceOffsets[v] ; j < m_mesh.m_vertexFaceOffsets[v + 1] ; ++j ){
+                const auto f = m_mesh.m_vertexFaces[j];
+                for( auto k = m_mesh.m_faceOffsets[f] ; k < m_mesh.m_faceOffsets[f + 1] ; ++k )
+                    m_bbox->Union( m_mesh.m_positions[m_mesh.m_faceVertices[k]] );
+            }
+        }
+
+        const auto bound = m_mesh.DisplacementBound();
+        if( bound > 0.0f ){
+            m_bbox->m_Min = m_bbox->m_Min - Vector( bound , bound , bound );
+            m_bbox->m_Max = m_bbox->m_Max + Vector( bound , bound , bound );
+        }
+    }
+    return *m_bbox;
+}
+
+float SubdivisionPatch::SurfaceArea() const{
+    const auto offset = m_mesh.m_faceOffsets[m_face];
+    const auto n = m_mesh.FaceSize( m_face );
+    auto area = 0.0f;
+    for( auto i = 1u ; i + 1 < n ; ++i ){
+        const auto& p0 = m_mesh.m_positions[m_mesh.m_faceVertices[offset]];
+        const auto& p1 = m_mesh.m_positions[m_mesh.m_faceVertices[offset + i]];
+        const auto& p2 = m_mesh.m_positions[m_mesh.m_faceVertices[offset + i + 1]];
+        area += cross( p1 - p0 , p2 - p0 ).Length() * 0.5f;
+    }
+    return area;
+}
+
+void SubdivisionCache::Add( const SubdivisionPatch* patch , std::size_t size ){
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_clock.fetch_add( 1 , std::memory_order_relaxed );
+
+    auto& entry = m_patches[patch];
+    m_size = m_size - entry + size;
+    entry = size;
+
+    const auto budget = (std::size_t)g_subdivisionCacheSize << 20;
+    if( m_size <= budget )
+        return;
+
+    // drop the least recently used ones, except the one just tessellated
+    std::vector<std::pair<std::uint64_t, const SubdivisionPatch*>> candidates;
+    candidates.reserve( m_patches.size() );
+    for( const auto& it : m_patches ){
+        if( it.first != patch )
+            candidates.push_back( std::make_pair( it.first->m_lastUse.load( std::memory_order_relaxed ) , it.first ) );
+    }
+    std::sort( candidates.begin() , candidates.end() );
+
+    const auto target = (std::size_t)( (float)budget * SUBDIVISION_CACHE_EVICT_RATIO );
+    for( const auto& candidate : candidates ){
+        if( m_size <= target )
+            break;
+        auto it = m_patches.find( candidate.second );
+        m_size -= it->second;
+        m_patches.erase( it );
+
+        // rays still traversing the tessellation keep it alive until they are done
+        std::atomic_store( &candidate.second->m_tessellation , std::shared_ptr<const SubdivisionTessellation>() );
+        SORT_STATS(++sSubdivisionEvictedPatches);
+    }
+}
+
+void SubdivisionCache::Remove( const SubdivisionPatch* patch ){
+    std::lock_guard<std::mutex> lock( m_mutex );
+    auto it = m_patches.find( patch );
+    if( it == m_patches.end() )
+        return;
+    m_size -= it->second;
+    m_patches.erase( it );
+}
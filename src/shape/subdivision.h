@@ -0,0 +1,204 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include "shape.h"
+#include "math/vector2.h"
+#include "core/singleton.h"
+#include "core/stats.h"
+
+class ImageTexture2D;
+
+//! @brief  Maximum number of times a face of a subdivision surface is subdivided.
+constexpr unsigned SUBDIVISION_MAX_LEVEL = 6;
+
+//! @brief  Control mesh of a Catmull-Clark subdivision surface.
+/**
+ * The control mesh is made of polygons of any number of vertices. Each face of it is a patch that is tessellated on its
+ * own, the limit surface of a face only depends on the faces sharing any vertex with it, which are also kept here.
+ * Boundary edges are smooth and boundary vertices with a single face are kept as corners, which is the default of
+ * Blender.
+ */
+class SubdivisionMesh{
+public:
+    std::vector<Point>      m_positions;            /**< Control points in world space. */
+    std::vector<unsigned>   m_faceOffsets;          /**< Offset of the first corner of each face, with the end of the last face at the end. */
+    std::vector<unsigned>   m_faceVertices;         /**< Vertex index of each face corner. */
+    std::vector<Vector2f>   m_faceUVs;              /**< Texture coordinate of each face corner. */
+    std::vector<unsigned>   m_vertexFaceOffsets;    /**< Offset of the faces adjacent to each vertex, with the end at the end. */
+    std::vector<unsigned>   m_vertexFaces;          /**< Faces adjacent to each vertex, in increasing order. */
+    unsigned                m_level = 1;            /**< Number of times each face is subdivided. */
+
+    std::unique_ptr<ImageTexture2D> m_displacement; /**< Displacement map, there is no displacement without it. */
+    float                   m_displacementScale = 0.0f;     /**< Displacement along the normal is the scale times the texture value minus the middle level. */
+    float                   m_displacementMidLevel = 0.5f;  /**< Texture value with no displacement at all. */
+
+    //! @brief  Constructor and destructor are defined where the displacement map is a complete type.
+    SubdivisionMesh();
+    ~SubdivisionMesh();
+
+    //! @brief  Build the list of adjacent faces of each vertex, it needs to be done once the faces are loaded.
+    void    BuildAdjacency();
+
+    //! @brief  The largest distance a point on the surface is displaced by.
+    float   DisplacementBound() const;
+
+    //! @brief  Sample the displacement at a texture coordinate.
+    //!
+    //! @param  uv      Texture coordinate of the point.
+    //! @return         Distance along the normal the point is displaced by.
+    float   Displacement( const Vector2f& uv ) const;
+
+    //! @brief  Get the number of corners of a face.
+    SORT_FORCEINLINE unsigned FaceSize( unsigned face ) const {
+        return m_faceOffsets[face + 1] - m_faceOffsets[face];
+    }
+};
+
+//! @brief  Tessellation of a single face of a subdivision surface.
+/**
+ * The face is subdivided into quads recursively, which gives a natural hierarchy to accelerate intersection tests. The
+ * root node is the face itself, each node has the sub-faces of it as children and the quads of the last level are the
+ * leaves.
+ */
+struct SubdivisionTessellation{
+    //! @brief  A node in the hierarchy of sub-faces.
+    struct Node{
+        BBox        bbox;               /**< Bounding box of all quads under the node. */
+        unsigned    child = 0;          /**< The first child node, or the quad index of a leaf node. */
+        unsigned    child_cnt = 0;      /**< Number of children, zero for leaf nodes. */
+    };
+
+    std::vector<Point>      positions;  /**< Positions of vertices in world space. */
+    std::vector<Vector>     normals;    /**< Shading normals of vertices. */
+    std::vector<unsigned>   quads;      /**< Four vertex indices of each quad. */
+    std::vector<Vector2f>   uvs;        /**< Texture coordinates of the four corners of each quad. */
+    std::vector<Node>       nodes;      /**< The hierarchy of sub-faces, the first one is the root. */
+
+    //! @brief  Memory taken by the tessellation in bytes.
+    std::size_t MemoryUsage() const;
+};
+
+//! @brief  A face of a subdivision surface, it is tessellated on demand the first time a ray gets close to it.
+/**
+ * The bounding box is the one of the control points of all adjacent faces, the limit surface lies in their convex hull,
+ * expanded by the largest displacement. Nothing is tessellated until a ray hits the bounding box. Tessellations are kept
+ * in SubdivisionCache, which drops the least recently used ones once there are too many of them.
+ */
+class SubdivisionPatch : public Shape{
+public:
+    //! @brief  Constructor.
+    //!
+    //! @param  mesh    The control mesh of the subdivision surface.
+    //! @param  face    The face of the control mesh it represents.
+    SubdivisionPatch( const SubdivisionMesh& mesh , unsigned face ) : m_mesh(mesh) , m_face(face) {}
+
+    //! @brief  Drop the tessellation from the cache.
+    ~SubdivisionPatch() override;
+
+    //! @brief  Drop the tessellation and the bounding box, it is needed once the control mesh is moved.
+    void    Reset();
+
+    //! @brief  Sampling patches as area lights is not supported.
+    Point   Sample_l( const LightSample& ls , const Point& p , Vector& wi , Vector& n , float* pdf ) const override{
+        return Point();
+    }
+
+    //! @brief  Sampling patches as area lights is not supported.
+    void    Sample_l( const LightSample& ls , Ray& r , Vector& n , float* pdf ) const override{
+    }
+
+    //! @brief  Get the intersection between a ray and the tessellated patch.
+    //!
+    //! @param  ray     The ray to be tested against.
+    //! @param  inter   The intersection data to be filled. If it is nullptr, there is no detailed information
+    //!                 for the intersection.
+    //! @return         Whether the ray intersects the patch.
+    bool    GetIntersect( const Ray& ray , SurfaceInteraction* inter = nullptr ) const override;
+
+    //! @brief  Get the conservative bounding box of the patch, which doesn't need it to be tessellated.
+    //!
+    //! @return         The bounding box of the patch.
+    BBox GetBBox() const override;
+
+    //! @brief  Surface area of the control face, it is only an approximation of the one of the limit surface.
+    //!
+    //! @return         Surface area of the patch.
+    float   SurfaceArea() const override;
+
+    //! @brief  Get the type of the shape.
+    //!
+    //! @return         The type of the shape.
+    SHAPE_TYPE GetShapeType() const override{
+        return SHAPE_SUBDIVISION;
+    }
+
+private:
+    //! @brief  Get the tessellation of the patch, it is generated if it is not in the cache.
+    std::shared_ptr<const SubdivisionTessellation>  getTessellation() const;
+
+    const SubdivisionMesh&  m_mesh;     /**< The control mesh of the subdivision surface. */
+    const unsigned          m_face;     /**< The face of the control mesh. */
+
+    /**< The tessellation, it is only accessed with atomic operations since it could be dropped by the cache any time. */
+    mutable std::shared_ptr<const SubdivisionTessellation>  m_tessellation;
+    /**< The last time the tessellation is used, in the clock of the cache. */
+    mutable std::atomic<std::uint64_t>                      m_lastUse = { 0 };
+
+    friend class SubdivisionCache;
+};
+
+//! @brief  Bounded cache of the tessellations of all subdivision patches.
+/**
+ * Patches keep their own tessellation, the cache only tracks the memory taken by them. Once it goes beyond the budget,
+ * the least recently used ones are dropped, they will be tessellated again if rays get to them later. The clock of the
+ * cache only ticks when a patch is tessellated, so that intersection tests never write anything shared.
+ */
+class SubdivisionCache : public Singleton<SubdivisionCache>{
+public:
+    //! @brief  Keep track of a new tessellation of a patch, older ones are dropped if it goes beyond the budget.
+    //!
+    //! @param  patch   The patch that is just tessellated.
+    //! @param  size    Memory taken by the tessellation in bytes.
+    void            Add( const SubdivisionPatch* patch , std::size_t size );
+
+    //! @brief  Stop tracking a patch, it is called when the patch is destroyed.
+    //!
+    //! @param  patch   The patch to be removed.
+    void            Remove( const SubdivisionPatch* patch );
+
+    //! @brief  Current time of the cache.
+    SORT_FORCEINLINE std::uint64_t  Now() const {
+        return m_clock.load( std::memory_order_relaxed );
+    }
+
+private:
+    std::mutex                                              m_mutex;            /**< Protects everything below. */
+    std::unordered_map<const SubdivisionPatch*, std::size_t> m_patches;         /**< Patches with a tessellation and their memory usage. */
+    std::size_t                                             m_size = 0;         /**< Memory taken by all tessellations in bytes. */
+    std::atomic<std::uint64_t>                              m_clock = { 1 };    /**< It ticks every time a patch is tessellated. */
+
+    SORT_STATS_ENABLE( "Subdivision" )
+
+    SubdivisionCache() = default;
+    friend class Singleton<SubdivisionCache>;
+};
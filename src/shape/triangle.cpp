@@ -17,28 +17,13 @@
 
 #include "triangle.h"
 #include "entity/visual.h"
+#include "material/material.h"
 
 SORT_STATIC_FORCEINLINE Vector3f Permute( const Vector3f& v , int ax , int ay , int az ){
     return Vector3f( v[ax] , v[ay] , v[az] );
 }
 
-bool Triangle::GetIntersect( const Ray& r , SurfaceInteraction* intersect ) const{
-    // get the memory
-    // note : reference is not used here because it's not thread-safe
-    auto& mem = m_meshVisual->m_memory;
-    const auto id0 = m_index.m_id[0];
-    const auto id1 = m_index.m_id[1];
-    const auto id2 = m_index.m_id[2];
-
-    const auto& mv0 = mem->m_vertices[id0];
-    const auto& mv1 = mem->m_vertices[id1];
-    const auto& mv2 = mem->m_vertices[id2];
-
-    // get three vertexes
-    const auto& op0 = mv0.m_position;
-    const auto& op1 = mv1.m_position;
-    const auto& op2 = mv2.m_position;
-
+bool intersectTriangle( const Ray& r , const Point& op0 , const Point& op1 , const Point& op2 , float& t , float& u , float& v ){
     auto p0 = op0;
     auto p1 = op1;
     auto p2 = op2;
@@ -68,12 +53,14 @@ bool Triangle::GetIntersect( const Ray& r , SurfaceInteraction* intersect ) cons
     auto e1 = p2.x * p0.z - p2.z * p0.x;
     auto e2 = p0.x * p1.z - p0.z * p1.x;
 
-    // fall back to double precision for better accuracy at some performance cost
-    if( UNLIKELY( e0 == 0.0f || e1 == 0.0f || e2 == 0.0f ) ){
+    // Fall back to double precision for better accuracy at some performance cost. Only the edge functions that are exactly
+    // zero are evaluated again so that the other triangle sharing the edge always gets exactly the negated value.
+    if( UNLIKELY( e0 == 0.0f ) )
         e0 = (float)( (double)p1.x * (double)p2.z - (double)p1.z * (double)p2.x );
+    if( UNLIKELY( e1 == 0.0f ) )
         e1 = (float)( (double)p2.x * (double)p0.z - (double)p2.z * (double)p0.x );
+    if( UNLIKELY( e2 == 0.0f ) )
         e2 = (float)( (double)p0.x * (double)p1.z - (double)p0.z * (double)p1.x );
-    }
 
     if( ( e0 < 0 || e1 < 0 || e2 < 0 ) && ( e0 > 0 || e1 > 0 || e2 > 0 ) )
         return false;
@@ -85,18 +72,90 @@ bool Triangle::GetIntersect( const Ray& r , SurfaceInteraction* intersect ) cons
     p1.y *= r.m_scale_y;
     p2.y *= r.m_scale_y;
     const auto invDet = 1.0f / det;
-    const auto t = ( e0 * p0.y + e1 * p1.y + e2 * p2.y ) * invDet;
+    t = ( e0 * p0.y + e1 * p1.y + e2 * p2.y ) * invDet;
     if( t <= r.m_fMin || t >= r.m_fMax )
         return false;
+
+    u = e1 * invDet;
+    v = e2 * invDet;
+    return true;
+}
+
+void Triangle::GetVertices( Point& p0 , Point& p1 , Point& p2 ) const{
+    const auto& mem = m_meshVisual->m_memory;
+    p0 = mem->m_positions[m_index.m_id[0]];
+    p1 = mem->m_positions[m_index.m_id[1]];
+    p2 = mem->m_positions[m_index.m_id[2]];
+}
+
+Triangle::Triangle( const MeshVisual* mesh , const MeshFaceIndex& index ) : m_meshVisual(mesh) , m_index(index) {
+    if( IS_PTR_VALID(index.m_mat) )
+        m_alphaMask = index.m_mat->GetAlphaMask();
+}
+
+bool Triangle::GetIntersect( const Ray& r , SurfaceInteraction* intersect ) const{
+    if( !GetIntersectDeferred( r , intersect ) )
+        return false;
+    if( intersect )
+        FinalizeInteraction( r , intersect );
+    return true;
+}
+
+bool Triangle::GetIntersectDeferred( const Ray& r , SurfaceInteraction* intersect ) const{
+    // get the memory
+    // note : reference is not used here because it's not thread-safe
+    auto& mem = m_meshVisual->m_memory;
+    const auto id0 = m_index.m_id[0];
+    const auto id1 = m_index.m_id[1];
+    const auto id2 = m_index.m_id[2];
+
+    // only positions are needed until there is a valid intersection
+    const auto& op0 = mem->m_positions[id0];
+    const auto& op1 = mem->m_positions[id1];
+    const auto& op2 = mem->m_positions[id2];
+
+    auto t = 0.0f , u = 0.0f , v = 0.0f;
+    if( !intersectTriangle( r , op0 , op1 , op2 , t , u , v ) )
+        return false;
+
+    // rays pass through transparent texels of cut-outs as if there is nothing, without executing any shader.
+    if( m_alphaMask && ( IS_PTR_INVALID(intersect) || ( t <= intersect->t && t > 0.0f ) ) ){
+        const auto tc = ( 1 - u - v ) * mem->GetTexCoord(id0) + u * mem->GetTexCoord(id1) + v * mem->GetTexCoord(id2);
+        if( !m_alphaMask->IsOpaque( tc.x , tc.y ) )
+            return false;
+    }
+
     if(IS_PTR_INVALID(intersect))
         return true;
     if( t > intersect->t || t <= 0.0f )
         return false;
 
-    const auto u = e1 * invDet;
-    const auto v = e2 * invDet;
+    intersect->t = t;
+    intersect->u = u;
+    intersect->v = v;
+    intersect->pending = true;
+    return true;
+}
+
+void Triangle::FinalizeInteraction( const Ray& r , SurfaceInteraction* intersect ) const{
+    auto& mem = m_meshVisual->m_memory;
+    const auto id0 = m_index.m_id[0];
+    const auto id1 = m_index.m_id[1];
+    const auto id2 = m_index.m_id[2];
+
+    const auto& op0 = mem->m_positions[id0];
+    const auto& op1 = mem->m_positions[id1];
+    const auto& op2 = mem->m_positions[id2];
+
+    const auto t = intersect->t;
+    const auto u = intersect->u;
+    const auto v = intersect->v;
     const auto w = 1 - u - v;
 
+    const auto mv0 = mem->GetVertex(id0);
+    const auto mv1 = mem->GetVertex(id1);
+    const auto mv2 = mem->GetVertex(id2);
+
     // store the intersection
     intersect->intersect = r(t);
 
@@ -108,31 +167,79 @@ bool Triangle::GetIntersect( const Ray& r , SurfaceInteraction* intersect ) cons
     const auto uv = w * mv0.m_texCoord + u * mv1.m_texCoord + v * mv2.m_texCoord;
     intersect->u = uv.x;
     intersect->v = uv.y;
-    intersect->t = t;
-
-    return true;
+    intersect->pending = false;
+
+    // partial derivatives of the position with respect to the uv coordinate, they are needed by ray differentials
+    const auto duv02 = mv0.m_texCoord - mv2.m_texCoord;
+    const auto duv12 = mv1.m_texCoord - mv2.m_texCoord;
+    const auto uvDet = duv02.x * duv12.y - duv02.y * duv12.x;
+    if( uvDet != 0.0f ){
+        const auto dp02 = op0 - op2;
+        const auto dp12 = op1 - op2;
+        const auto invUvDet = 1.0f / uvDet;
+        intersect->dpdu = ( duv12.y * dp02 - duv02.y * dp12 ) * invUvDet;
+        intersect->dpdv = ( duv02.x * dp12 - duv12.x * dp02 ) * invUvDet;
+    }else{
+        intersect->dpdu = intersect->dpdv = Vector();
+    }
 }
 
-const BBox& Triangle::GetBBox() const{
-    // if there is no bounding box , cache it
-    if( !m_bbox ){
-        m_bbox = std::make_unique<BBox>();
-
-        const auto& mem = m_meshVisual->m_memory;
-        const auto id0 = m_index.m_id[0];
-        const auto id1 = m_index.m_id[1];
-        const auto id2 = m_index.m_id[2];
+BBox Triangle::GetBBox() const{
+    // there is no cache, it is thread-safe and always follows the vertices even if they are moved
+    const auto& mem = m_meshVisual->m_memory;
+    BBox bbox;
+    bbox.Union( mem->m_positions[m_index.m_id[0]] );
+    bbox.Union( mem->m_positions[m_index.m_id[1]] );
+    bbox.Union( mem->m_positions[m_index.m_id[2]] );
+    return bbox;
+}
 
-        const auto& p0 = mem->m_vertices[id0].m_position;
-        const auto& p1 = mem->m_vertices[id1].m_position;
-        const auto& p2 = mem->m_vertices[id2].m_position;
+BBox Triangle::ClipBBox( const BBox& box ) const{
+    // a triangle clipped by six planes has at most nine vertices
+    static constexpr int MAX_CLIPPED_VERTEX_CNT = 9;
 
-        m_bbox->Union( p0 );
-        m_bbox->Union( p1 );
-        m_bbox->Union( p2 );
+    const auto& mem = m_meshVisual->m_memory;
+    Point polygon[2][MAX_CLIPPED_VERTEX_CNT];
+    polygon[0][0] = mem->m_positions[m_index.m_id[0]];
+    polygon[0][1] = mem->m_positions[m_index.m_id[1]];
+    polygon[0][2] = mem->m_positions[m_index.m_id[2]];
+
+    // Sutherland-Hodgman clipping against each plane of the box
+    auto cnt = 3;
+    auto cur = 0;
+    for( auto plane = 0 ; plane < 6 && cnt > 0 ; ++plane ){
+        const auto axis = plane % 3;
+        const auto is_max = plane >= 3;
+        const auto pos = is_max ? box.m_Max[axis] : box.m_Min[axis];
+        const auto inside = [&]( const Point& p ){ return is_max ? p[axis] <= pos : p[axis] >= pos; };
+
+        const auto* src = polygon[cur];
+        auto* dst = polygon[1 - cur];
+        auto dst_cnt = 0;
+        for( auto i = 0 ; i < cnt ; ++i ){
+            const auto& p0 = src[i];
+            const auto& p1 = src[( i + 1 ) % cnt];
+            const auto in0 = inside( p0 );
+            const auto in1 = inside( p1 );
+            if( in0 )
+                dst[dst_cnt++] = p0;
+            if( in0 != in1 && dst_cnt < MAX_CLIPPED_VERTEX_CNT ){
+                const auto t = ( pos - p0[axis] ) / ( p1[axis] - p0[axis] );
+                auto p = p0 + ( p1 - p0 ) * t;
+                p[axis] = pos;
+                dst[dst_cnt++] = p;
+            }
+        }
+        cnt = dst_cnt;
+        cur = 1 - cur;
     }
 
-    return *m_bbox;
+    BBox ret;
+    for( auto i = 0 ; i < cnt ; ++i )
+        ret.Union( polygon[cur][i] );
+
+    // numerical error could push the vertices slightly out of the box
+    return cnt > 0 ? Overlap( ret , box ) : ret;
 }
 
 float Triangle::SurfaceArea() const{
@@ -141,9 +248,9 @@ float Triangle::SurfaceArea() const{
     const auto id1 = m_index.m_id[1];
     const auto id2 = m_index.m_id[2];
 
-    const auto& p0 = mem->m_vertices[id0].m_position;
-    const auto& p1 = mem->m_vertices[id1].m_position;
-    const auto& p2 = mem->m_vertices[id2].m_position;
+    const auto& p0 = mem->m_positions[id0];
+    const auto& p1 = mem->m_positions[id1];
+    const auto& p2 = mem->m_positions[id2];
 
     const auto e0 = p1 - p0 ;
     const auto e1 = p2 - p0 ;
@@ -167,11 +274,7 @@ bool Triangle::GetIntersect(const BBox& box) const{
     const auto id1 = m_index.m_id[1];
     const auto id2 = m_index.m_id[2];
 
-    const auto& mv0 = mem->m_vertices[id0];
-    const auto& mv1 = mem->m_vertices[id1];
-    const auto& mv2 = mem->m_vertices[id2];
-
-    Point tri[3] = { mv0.m_position , mv1.m_position , mv2.m_position };
+    Point tri[3] = { mem->m_positions[id0] , mem->m_positions[id1] , mem->m_positions[id2] };
 
     float triMin , triMax;  // will initialize later
     auto boxMin = FLT_MAX, boxMax = -FLT_MAX;
@@ -20,10 +20,19 @@
 #include "core/define.h"
 #include "shape.h"
 
+#if defined(AVX_ENABLED) || defined(AVX512_ENABLED)
+    #include <immintrin.h>
+#endif
+
+#ifdef NEON_ENABLED
+    #include <arm_neon.h>
+#endif
+
 class   MeshVisual;
+class   AlphaMask;
 struct  MeshFaceIndex;
 
-#ifdef SSE_ENABLED
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
     struct Triangle4;
 #ifdef SORT_IN_WINDOWS
     struct simd_data_sse;
@@ -37,7 +46,30 @@ struct  MeshFaceIndex;
 #endif
 #endif
 
+#ifdef AVX512_ENABLED
+    struct Triangle16;
+#ifdef SORT_IN_WINDOWS
+    struct simd_data_avx512;
+#endif
+#endif
+
 //! @brief Triangle class defines the basic behavior of triangle.
+//! @brief  Watertight intersection between a ray and a triangle.
+//!
+//! The detail algorithm could be found in this paper,
+//! <a href="http://jcgt.org/published/0002/01/05/paper.pdf">Watertight Ray/Triangle Intersection</a>.
+//! Triangles sharing an edge never leak rays through the edge as long as they have exactly the same vertices.
+//!
+//! @param r        The ray to be tested against.
+//! @param p0       The first vertex of the triangle.
+//! @param p1       The second vertex of the triangle.
+//! @param p2       The third vertex of the triangle.
+//! @param t        Distance from the ray origin to the intersection.
+//! @param u        Barycentric coordinate of the second vertex.
+//! @param v        Barycentric coordinate of the third vertex.
+//! @return         Whether the ray intersects the triangle between the near and far distance of the ray.
+bool intersectTriangle( const Ray& r , const Point& p0 , const Point& p1 , const Point& p2 , float& t , float& u , float& v );
+
 /**
  * Triangle is the most common shape that is used in a ray tracer.
  */
@@ -47,7 +79,7 @@ public:
     //!
     //! @param mesh         The triangle mesh it belongs to
     //! @param index        The index buffer
-    Triangle( const class MeshVisual* mesh , const struct MeshFaceIndex& index ): m_meshVisual(mesh) , m_index(index) {}
+    Triangle( const class MeshVisual* mesh , const struct MeshFaceIndex& index );
 
     //! @brief Sample a point on the surface of the shape given a shading point.
     //!
@@ -85,11 +117,30 @@ public:
     //! <a href="http://jcgt.org/published/0002/01/05/paper.pdf">Watertight Ray/Triangle Intersection</a>.
     //!
     //! @param ray      The ray to be tested against.
+    //! Triangles of cut-out materials are tested against the alpha masks of the materials, rays pass through them
+    //! wherever the masks are transparent.
+    //!
     //! @param inter    The intersection data to be filled. If it is nullptr, there is no detailed information
     //!                 for the intersection.
     //! @return         Whether the ray intersects the shape.
     bool            GetIntersect( const Ray& ray , SurfaceInteraction* inter = nullptr ) const override;
 
+    //! @brief      Intersection test recording only the distance and the barycentric coordinate of the hit.
+    //!
+    //! This is what traversals use, the hit is marked as pending and 'FinalizeInteraction' evaluates the rest of the
+    //! attributes once it turns out to be the nearest one.
+    //!
+    //! @param ray      The ray to be tested against.
+    //! @param inter    The intersection data to be filled. If it is nullptr, it is an occlusion test.
+    //! @return         Whether the ray intersects the shape.
+    bool            GetIntersectDeferred( const Ray& ray , SurfaceInteraction* inter ) const;
+
+    //! @brief      Evaluate the position, normals, tangent, uv coordinate and its derivatives of a pending hit.
+    //!
+    //! @param ray      The ray that hits the triangle.
+    //! @param inter    The intersection holding the distance and the barycentric coordinate of the hit.
+    void            FinalizeInteraction( const Ray& ray , SurfaceInteraction* inter ) const override;
+
     //! @brief Intersection test between the shape and a bounding box.
     //!
     //! Detail algorithm of triangle and bounding box intersection comes from this paper,
@@ -100,11 +151,20 @@ public:
 
     //! @brief      Get bounding box of the shape in world space.
     //!
-    //! Get the bounding box of the shape. Some shape may return a relatively conservative bounding
-    //! box, which is also acceptable to all rest systems call this function.
+    //! The bounding box is evaluated from the three vertices every time, it is cheap enough that caching it for each
+    //! triangle costs more in memory than it saves.
     //!
     //! @return     The bounding box of the shape.
-    const BBox&     GetBBox() const override;
+    BBox            GetBBox() const override;
+
+    //! @brief      Get the bounding box of the part of the triangle inside a box.
+    //!
+    //! The triangle is clipped against the six planes of the box, which is a lot tighter than clipping its bounding box
+    //! for long diagonal triangles.
+    //!
+    //! @param box  The box to clip the triangle against.
+    //! @return     The bounding box of the clipped triangle, it is inverted if nothing of the triangle is inside the box.
+    BBox            ClipBBox( const BBox& box ) const override;
 
     //! @brief      Get the surface area of the shape.
     //!
@@ -121,14 +181,33 @@ public:
         return SHAPE_TRIANGLE;
     }
 
+    //! @brief      Get the positions of the three vertices in world space.
+    //!
+    //! @param p0   The first vertex of the triangle.
+    //! @param p1   The second vertex of the triangle.
+    //! @param p2   The third vertex of the triangle.
+    void            GetVertices( Point& p0 , Point& p1 , Point& p2 ) const;
+
+    //! @brief      Whether the triangle is tested against an alpha mask.
+    //!
+    //! Such triangles can't be intersected in SIMD packs, the mask needs to be looked up for each of them.
+    //!
+    //! @return     Whether there is an alpha mask.
+    bool            HasAlphaMask() const override{
+        return m_alphaMask;
+    }
+
 private:
     const MeshVisual*        m_meshVisual = nullptr;     /**< Visual holding the vertex buffer. */
     const MeshFaceIndex&     m_index;                    /**< Index buffer points to the index of this triangle. */
+    const AlphaMask*         m_alphaMask = nullptr;      /**< Alpha mask of the material, nullptr if it is not a cut-out. */
 
-#ifdef SSE_ENABLED
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
     friend struct Triangle4;
     #ifdef SORT_IN_WINDOWS
         friend SORT_FORCEINLINE void setupIntersection(const Triangle4& tri4, const Ray& ray, const simd_data_sse& t4, const simd_data_sse& u4, const simd_data_sse& v4, const int id, SurfaceInteraction* intersection);
+    #elif defined(NEON_ENABLED)
+        friend SORT_FORCEINLINE void setupIntersection(const Triangle4& tri4, const Ray& ray, const float32x4_t& t4, const float32x4_t& u4, const float32x4_t& v4, const int id, SurfaceInteraction* intersection);
     #else
         friend SORT_FORCEINLINE void setupIntersection(const Triangle4& tri4, const Ray& ray, const __m128& t4, const __m128& u4, const __m128& v4, const int id, SurfaceInteraction* intersection);
     #endif
@@ -142,4 +221,13 @@ private:
         friend SORT_FORCEINLINE void setupIntersection(const Triangle8& tri8, const Ray& ray, const __m256& t8, const __m256& u8, const __m256& v8, const int id, SurfaceInteraction* intersection);
     #endif
 #endif
+
+#ifdef AVX512_ENABLED
+    friend struct Triangle16;
+    #ifdef SORT_IN_WINDOWS
+        friend SORT_FORCEINLINE void setupIntersection(const Triangle16& tri16, const Ray& ray, const simd_data_avx512& t16, const simd_data_avx512& u16, const simd_data_avx512& v16, const int id, SurfaceInteraction* intersection);
+    #else
+        friend SORT_FORCEINLINE void setupIntersection(const Triangle16& tri16, const Ray& ray, const __m512& t16, const __m512& u16, const __m512& v16, const int id, SurfaceInteraction* intersection);
+    #endif
+#endif
 };
\ No newline at end of file
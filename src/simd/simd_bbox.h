@@ -23,7 +23,7 @@
 // Reference implementation is disabled by default, it is only for debugging purposes.
 // #define SIMD_BBOX_REFERENCE_IMPLEMENTATION
 
-#if defined(SIMD_SSE_IMPLEMENTATION) && defined(SIMD_AVX_IMPLEMENTATION)
+#if ( defined(SIMD_SSE_IMPLEMENTATION) + defined(SIMD_AVX_IMPLEMENTATION) + defined(SIMD_AVX512_IMPLEMENTATION) ) > 1
     static_assert( false , "More than one SIMD version is defined before including simd_bbox." );
 #endif
 
@@ -37,9 +37,13 @@
     #define Simd_BBox   BBox4
 #endif
 
+#if defined(SIMD_AVX512_IMPLEMENTATION)
+    #define Simd_BBox   BBox16
+#endif
+
 //! @brief  SIMD version bounding box.
 /**
- * This is basically 4/8 bounding box in a single data structure. For best performance, they are saved in
+ * This is basically 4/8/16 bounding box in a single data structure. For best performance, they are saved in
  * structure of arrays.
  * Since this data structure is only used in limited places, only very few interfaces are implemented for
  * simplicity.
@@ -61,23 +65,26 @@ static_assert( sizeof( Simd_BBox ) % SIMD_ALIGNMENT == 0 , "Incorrect size of Si
 
 SORT_FORCEINLINE int IntersectBBox_SIMD(const Ray& ray, const Simd_Ray_Data& simd_ray , const Simd_BBox& bb, simd_data& f_min ) {
 #ifndef SIMD_BBOX_REFERENCE_IMPLEMENTATION
+    // The distances are evaluated as (b - o) / d rather than b / d - o / d, so that their rounding errors are bounded by the
+    // distances themselves and scaling the far distance by BBOX_ROBUST_SCALE is enough to make the test conservative.
     f_min = simd_set_ps1( ray.m_fMin );
     simd_data f_max = simd_set_ps1( ray.m_fMax );
 
-    simd_data t1    = simd_add_ps( ray_ori_dir_x(simd_ray) , simd_mul_ps( ray_rcp_dir_x(simd_ray) , bb.m_max_x ) );
-    simd_data t2    = simd_add_ps( ray_ori_dir_x(simd_ray) , simd_mul_ps( ray_rcp_dir_x(simd_ray) , bb.m_min_x ) );
+    simd_data t1    = simd_mul_ps( simd_sub_ps( bb.m_max_x , ray_ori_x(simd_ray) ) , ray_rcp_dir_x(simd_ray) );
+    simd_data t2    = simd_mul_ps( simd_sub_ps( bb.m_min_x , ray_ori_x(simd_ray) ) , ray_rcp_dir_x(simd_ray) );
     f_min           = simd_max_ps( f_min , simd_min_ps( t1 , t2 ) );
     f_max           = simd_min_ps( f_max , simd_max_ps( t1 , t2 ) );
 
-    t1              = simd_add_ps( ray_ori_dir_y(simd_ray) , simd_mul_ps( ray_rcp_dir_y(simd_ray) , bb.m_max_y ) );
-    t2              = simd_add_ps( ray_ori_dir_y(simd_ray) , simd_mul_ps( ray_rcp_dir_y(simd_ray) , bb.m_min_y ) );
+    t1              = simd_mul_ps( simd_sub_ps( bb.m_max_y , ray_ori_y(simd_ray) ) , ray_rcp_dir_y(simd_ray) );
+    t2              = simd_mul_ps( simd_sub_ps( bb.m_min_y , ray_ori_y(simd_ray) ) , ray_rcp_dir_y(simd_ray) );
     f_min           = simd_max_ps( f_min , simd_min_ps( t1 , t2 ) );
     f_max           = simd_min_ps( f_max , simd_max_ps( t1 , t2 ) );
 
-    t1              = simd_add_ps( ray_ori_dir_z(simd_ray) , simd_mul_ps( ray_rcp_dir_z(simd_ray) , bb.m_max_z ) );
-    t2              = simd_add_ps( ray_ori_dir_z(simd_ray) , simd_mul_ps( ray_rcp_dir_z(simd_ray) , bb.m_min_z ) );
+    t1              = simd_mul_ps( simd_sub_ps( bb.m_max_z , ray_ori_z(simd_ray) ) , ray_rcp_dir_z(simd_ray) );
+    t2              = simd_mul_ps( simd_sub_ps( bb.m_min_z , ray_ori_z(simd_ray) ) , ray_rcp_dir_z(simd_ray) );
     f_min           = simd_max_ps( f_min , simd_min_ps( t1 , t2 ) );
     f_max           = simd_min_ps( f_max , simd_max_ps( t1 , t2 ) );
+    f_max           = simd_mul_ps( f_max , simd_set_ps1( BBOX_ROBUST_SCALE ) );
 
     const simd_data mask = simd_and_ps( bb.m_mask , simd_cmple_ps( f_min , f_max ) );
     f_min = simd_pick_ps( mask , f_min , simd_neg_ones );
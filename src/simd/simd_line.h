@@ -25,7 +25,7 @@
 // Reference implementation is disabled by default, it is only for debugging purposes.
 // #define SIMD_LINE_REFERENCE_IMPLEMENTATION
 
-#if defined(SIMD_SSE_IMPLEMENTATION) && defined(SIMD_AVX_IMPLEMENTATION)
+#if ( defined(SIMD_SSE_IMPLEMENTATION) + defined(SIMD_AVX_IMPLEMENTATION) + defined(SIMD_AVX512_IMPLEMENTATION) ) > 1
     static_assert( false , "More than one SIMD version is defined before including simd_line.h." );
 #endif
 
@@ -39,6 +39,10 @@
     #define Simd_Line   Line8
 #endif
 
+#ifdef SIMD_AVX512_IMPLEMENTATION
+    #define Simd_Line   Line16
+#endif
+
 //! @brief  Like Triangle8, Line8 is the corresponding version for line shape.
 struct alignas(SIMD_ALIGNMENT) Simd_Line{
     simd_data  m_p0_x , m_p0_y , m_p0_z;   /**< Point at the end of the line. */
@@ -122,6 +126,16 @@ struct alignas(SIMD_ALIGNMENT) Simd_Line{
         m_ori_line[7] = line;
         return true;
 #endif
+
+#ifdef SIMD_AVX512_IMPLEMENTATION
+        const Line* line = dynamic_cast<const Line*>(primitive->GetShape());
+        auto i = 0;
+        while( i < SIMD_CHANNEL - 1 && IS_PTR_VALID(m_ori_pri[i]) )
+            ++i;
+        m_ori_pri[i] = primitive;
+        m_ori_line[i] = line;
+        return i == SIMD_CHANNEL - 1;
+#endif
     }
 
     //! @brief  Pack line information into SIMD compatible data.
@@ -213,6 +227,13 @@ struct alignas(SIMD_ALIGNMENT) Simd_Line{
         m_ori_pri[0] = m_ori_pri[1] = m_ori_pri[2] = m_ori_pri[3] = m_ori_pri[4] = m_ori_pri[5] = m_ori_pri[6] = m_ori_pri[7] = nullptr;
         m_ori_line[0] = m_ori_line[1] = m_ori_line[2] = m_ori_line[3] = m_ori_line[4] = m_ori_line[5] = m_ori_line[6] = m_ori_line[7] = nullptr;
 #endif
+
+#ifdef SIMD_AVX512_IMPLEMENTATION
+        for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+            m_ori_pri[i] = nullptr;
+            m_ori_line[i] = nullptr;
+        }
+#endif
     }
 };
 
@@ -286,6 +307,21 @@ SORT_FORCEINLINE bool intersectLine_Inner( const Ray& ray , const Simd_Ray_Data&
     return true;
 }
 
+//! @brief  A helper function setup the result of intersection.
+//!
+//! Only the distance and the primitive are recorded, the rest of the attributes are evaluated by 'FinalizeInteraction'
+//! once the nearest hit is known.
+//!
+//! @param  line_simd     The line data structure that has 4/8 lines.
+//! @param  t_simd        The distances from ray origin to lines.
+//! @param  res_i         Index of the intersection of our interest.
+//! @param  ret           The pointer to the result to be filled. It can't be nullptr.
+SORT_FORCEINLINE void setupLineIntersection( const Simd_Line& line_simd , const simd_data& t_simd , const int res_i , SurfaceInteraction* ret ){
+    ret->t = t_simd[res_i];
+    ret->primitive = line_simd.m_ori_pri[res_i];
+    ret->pending = true;
+}
+
 //! @brief  With the power of SIMD, this utility function helps intersect a ray with four lines at the cost of one.
 //!
 //! @param  ray         Ray to be tested against.
@@ -313,29 +349,8 @@ SORT_FORCEINLINE bool intersectLine_SIMD( const Ray& ray , const Simd_Ray_Data&
     // get the index of the closest one
     const auto resolved_mask = simd_movemask_ps( simd_cmpeq_ps( t_simd , t_min ) );
     const auto res_i = __bsf(resolved_mask);
-    const auto line = line_simd.m_ori_line[res_i];
-
-    ret->intersect = ray( t_simd[res_i] );
-
-    if( inter_y[res_i] == line->m_length ){
-        // A corner case where the tip of the line is being intersected.
-        ret->gnormal = normalize( line->m_world2Line.GetInversed().TransformVector( Vector( 0.0f , 1.0f , 0.0f ) ) );
-        ret->normal = ret->gnormal;
-        ret->tangent = normalize( line->m_world2Line.GetInversed().TransformVector( Vector( 1.0f , 0.0f , 0.0f ) ) );
-    }else{
-        // This may not be physically correct, but it should be fine for a pixel width line.
-        ret->gnormal = normalize(line->m_world2Line.GetInversed().TransformVector( Vector( inter_x[res_i], 0.0f , inter_z[res_i] ) ) );
-        ret->normal = ret->gnormal;
-        ret->tangent = normalize( line->m_gp1 - line->m_gp0 );
-
-        ret->view = -ray.m_Dir;
-    }
 
-    ret->u = 1.0f;
-    ret->v = slerp( line->m_v0 , line->m_v1 , inter_y[res_i] / line->m_length );
-    ret->t = t_simd[res_i];
-
-    ret->primitive = line_simd.m_ori_pri[res_i];
+    setupLineIntersection( line_simd , t_simd , res_i , ret );
 
     return true;
 #else
@@ -364,4 +379,69 @@ SORT_FORCEINLINE bool intersectLineFast_SIMD( const Ray& ray , const Simd_Ray_Da
 #endif
 }
 
+#ifdef ENABLE_TRANSPARENT_SHADOW
+//! @brief  Unlike the above functions, this helper function will populate all results in the ShadowIntersections data structure.
+//!         It is for shadow rays passing through semi-transparent surfaces.
+//!
+//! @param  ray             Ray to be tested against.
+//! @param  ray_simd        Resolved simd ray data.
+//! @param  line_simd       Data structure holds four lines.
+//! @param  intersections   The intersections along the shadow ray.
+//! @return                 Whether an opaque line is found, there is no need to test anything else once it happens.
+SORT_FORCEINLINE bool intersectLineShadow_SIMD( const Ray& ray , const Simd_Ray_Data& ray_simd, const Simd_Line& line_simd , ShadowIntersections& intersections ){
+#ifndef SIMD_LINE_REFERENCE_IMPLEMENTATION
+    simd_data  mask, t_simd , inter_x , inter_y , inter_z ;
+    const auto intersected = intersectLine_Inner( ray , ray_simd, line_simd , mask , t_simd , inter_x , inter_y , inter_z );
+    if( !intersected )
+        return false;
+
+    mask = simd_and_ps( mask , simd_cmplt_ps( t_simd , simd_set_ps1(intersections.maxt) ) );
+    auto resolved_mask = simd_movemask_ps(mask);
+    while( resolved_mask ){
+        const auto res_i = __bsf(resolved_mask);
+        resolved_mask = resolved_mask & (resolved_mask - 1);
+
+        // there is no need to setup the intersection to know the ray is blocked.
+        const auto primitive = line_simd.m_ori_pri[res_i];
+        if( LIKELY(!primitive->HasTransparency()) ){
+            intersections.blocked = true;
+            return true;
+        }
+
+        if( intersections.IsRecorded( primitive ) )
+            continue;
+
+        // the maximum depth may have shrunk since the mask was evaluated
+        auto slot = intersections.Allocate( t_simd[res_i] );
+        if( IS_PTR_INVALID(slot) )
+            continue;
+
+        setupLineIntersection( line_simd , t_simd , res_i , slot );
+        FinalizeInteraction( ray , *slot );
+        intersections.ResolveMaxDepth();
+    }
+    return false;
+#else
+    SurfaceInteraction intersection;
+    for( auto i = 0u ; i < SIMD_CHANNEL && IS_PTR_VALID(line_simd.m_ori_pri[i]) ; ++i ){
+        const auto* primitive = line_simd.m_ori_pri[i];
+
+        intersection.Reset();
+        intersection.t = intersections.maxt;
+        if( !primitive->GetIntersect( ray , &intersection ) )
+            continue;
+
+        if( !primitive->HasTransparency() ){
+            intersections.blocked = true;
+            return true;
+        }
+
+        if( !intersections.IsRecorded( primitive ) )
+            intersections.Add( intersection , true );
+    }
+    return false;
+#endif
+}
+#endif
+
 #endif // SIMD_SSE_IMPLEMENTATION || SIMD_AVX_IMPLEMENTATION
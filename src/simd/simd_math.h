@@ -0,0 +1,181 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <limits>
+#include "core/define.h"
+#include "simd_wrapper.h"
+#include "math/fastmath.h"
+
+// Vectorized versions of the functions in 'math/fastmath.h', they share the same coefficients and the same precision. The
+// width is whatever SIMD implementation is defined before including 'simd_wrapper.h', 4, 8 or 16 lanes.
+// Branches in the scalar version are replaced by evaluating both sides and picking, lanes never diverge.
+
+#ifdef SIMD_CHANNEL
+
+SORT_STATIC_FORCEINLINE simd_data   simd_abs_ps( const simd_data& x ){
+    return simd_max_ps( x , simd_sub_ps( simd_zeros , x ) );
+}
+
+//! @brief  Exponential of all lanes, see FastExp.
+SORT_STATIC_FORCEINLINE simd_data   simd_exp_ps( const simd_data& x ){
+    const auto xc = simd_min_ps( simd_max_ps( x , simd_set_ps1( FAST_EXP_LO ) ) , simd_set_ps1( FAST_EXP_HI ) );
+
+    auto n = simd_floor_ps( simd_mad_ps( xc , simd_set_ps1( FAST_LOG2E ) , simd_set_ps1( 0.5f ) ) );
+    n = simd_min_ps( n , simd_set_ps1( 127.0f ) );
+    auto r = simd_sub_ps( xc , simd_mul_ps( n , simd_set_ps1( FAST_LN2_HI ) ) );
+    r = simd_sub_ps( r , simd_mul_ps( n , simd_set_ps1( FAST_LN2_LO ) ) );
+
+    auto p = simd_set_ps1( FAST_EXP_POLY[0] );
+    for( auto i = 1 ; i < 6 ; ++i )
+        p = simd_mad_ps( p , r , simd_set_ps1( FAST_EXP_POLY[i] ) );
+    p = simd_add_ps( simd_mad_ps( p , simd_mul_ps( r , r ) , r ) , simd_ones );
+
+    auto ret = simd_mul_ps( p , simd_exp2i_ps( n ) );
+    ret = simd_pick_ps( simd_cmpgt_ps( x , simd_set_ps1( FAST_EXP_HI ) ) , simd_set_ps1( std::numeric_limits<float>::infinity() ) , ret );
+    return simd_pick_ps( simd_cmplt_ps( x , simd_set_ps1( FAST_EXP_LO ) ) , simd_zeros , ret );
+}
+
+//! @brief  Natural logarithm of all lanes, see FastLog.
+SORT_STATIC_FORCEINLINE simd_data   simd_log_ps( const simd_data& x ){
+    simd_data e;
+    auto m = simd_frexp_ps( simd_max_ps( x , simd_set_ps1( FLT_MIN ) ) , e );
+
+    const auto small = simd_cmplt_ps( m , simd_set_ps1( FAST_SQRTHF ) );
+    e = simd_sub_ps( e , simd_pick_ps( small , simd_ones , simd_zeros ) );
+    m = simd_sub_ps( simd_pick_ps( small , simd_add_ps( m , m ) , m ) , simd_ones );
+
+    const auto z = simd_mul_ps( m , m );
+    auto p = simd_set_ps1( FAST_LOG_POLY[0] );
+    for( auto i = 1 ; i < 9 ; ++i )
+        p = simd_mad_ps( p , m , simd_set_ps1( FAST_LOG_POLY[i] ) );
+    auto y = simd_mul_ps( simd_mul_ps( p , m ) , z );
+    y = simd_mad_ps( e , simd_set_ps1( FAST_LN2_LO ) , y );
+    y = simd_mad_ps( z , simd_set_ps1( -0.5f ) , y );
+    auto ret = simd_mad_ps( e , simd_set_ps1( FAST_LN2_HI ) , simd_add_ps( m , y ) );
+
+    const auto inf = simd_set_ps1( std::numeric_limits<float>::infinity() );
+    ret = simd_pick_ps( simd_cmpeq_ps( x , inf ) , inf , ret );
+    ret = simd_pick_ps( simd_cmplt_ps( x , simd_zeros ) , simd_set_ps1( std::numeric_limits<float>::quiet_NaN() ) , ret );
+    return simd_pick_ps( simd_cmpeq_ps( x , simd_zeros ) , simd_sub_ps( simd_zeros , inf ) , ret );
+}
+
+//! @brief  Power of non-negative bases in all lanes, see FastPow.
+SORT_STATIC_FORCEINLINE simd_data   simd_pow_ps( const simd_data& x , const simd_data& y ){
+    // a zero base goes through log(0) = -inf, exp takes care of both signs of the exponent.
+    const auto ret = simd_exp_ps( simd_mul_ps( y , simd_log_ps( x ) ) );
+    return simd_pick_ps( simd_cmpeq_ps( y , simd_zeros ) , simd_ones , ret );
+}
+
+//! @brief  Sine and cosine of all lanes, see FastSinCos.
+SORT_STATIC_FORCEINLINE void        simd_sincos_ps( const simd_data& x , simd_data& s , simd_data& c ){
+    const auto ax = simd_abs_ps( x );
+    auto j = simd_floor_ps( simd_mul_ps( ax , simd_set_ps1( FAST_FOUR_OVER_PI ) ) );
+    j = simd_mul_ps( simd_set_ps1( 2.0f ) , simd_floor_ps( simd_mul_ps( simd_add_ps( j , simd_ones ) , simd_set_ps1( 0.5f ) ) ) );
+    const auto q = simd_sub_ps( j , simd_mul_ps( simd_set_ps1( 8.0f ) , simd_floor_ps( simd_mul_ps( j , simd_set_ps1( 0.125f ) ) ) ) );
+
+    auto r = simd_sub_ps( ax , simd_mul_ps( j , simd_set_ps1( FAST_PIO4_1 ) ) );
+    r = simd_sub_ps( r , simd_mul_ps( j , simd_set_ps1( FAST_PIO4_2 ) ) );
+    r = simd_sub_ps( r , simd_mul_ps( j , simd_set_ps1( FAST_PIO4_3 ) ) );
+    const auto z = simd_mul_ps( r , r );
+
+    auto ps = simd_mad_ps( simd_set_ps1( FAST_SIN_POLY[0] ) , z , simd_set_ps1( FAST_SIN_POLY[1] ) );
+    ps = simd_mad_ps( ps , z , simd_set_ps1( FAST_SIN_POLY[2] ) );
+    ps = simd_mad_ps( simd_mul_ps( ps , z ) , r , r );
+
+    auto pc = simd_mad_ps( simd_set_ps1( FAST_COS_POLY[0] ) , z , simd_set_ps1( FAST_COS_POLY[1] ) );
+    pc = simd_mad_ps( pc , z , simd_set_ps1( FAST_COS_POLY[2] ) );
+    pc = simd_mad_ps( simd_mul_ps( pc , z ) , z , simd_sub_ps( simd_ones , simd_mul_ps( simd_set_ps1( 0.5f ) , z ) ) );
+
+    // there is no xor in the wrapper, signs are flipped by multiplying -1 instead.
+    const auto q2 = simd_cmpeq_ps( q , simd_set_ps1( 2.0f ) );
+    const auto q4 = simd_cmpeq_ps( q , simd_set_ps1( 4.0f ) );
+    const auto q6 = simd_cmpeq_ps( q , simd_set_ps1( 6.0f ) );
+    const auto swap = simd_or_ps( q2 , q6 );
+    const auto sign_s = simd_mul_ps( simd_pick_ps( simd_cmpge_ps( q , simd_set_ps1( 4.0f ) ) , simd_neg_ones , simd_ones ) ,
+                                     simd_pick_ps( simd_cmplt_ps( x , simd_zeros ) , simd_neg_ones , simd_ones ) );
+    const auto sign_c = simd_pick_ps( simd_or_ps( q2 , q4 ) , simd_neg_ones , simd_ones );
+    s = simd_mul_ps( simd_pick_ps( swap , pc , ps ) , sign_s );
+    c = simd_mul_ps( simd_pick_ps( swap , ps , pc ) , sign_c );
+}
+
+//! @brief  Sine of all lanes, see FastSinCos.
+SORT_STATIC_FORCEINLINE simd_data   simd_sin_ps( const simd_data& x ){
+    simd_data s , c;
+    simd_sincos_ps( x , s , c );
+    return s;
+}
+
+//! @brief  Cosine of all lanes, see FastSinCos.
+SORT_STATIC_FORCEINLINE simd_data   simd_cos_ps( const simd_data& x ){
+    simd_data s , c;
+    simd_sincos_ps( x , s , c );
+    return c;
+}
+
+//! @brief  Arc tangent of all lanes, see FastAtan.
+SORT_STATIC_FORCEINLINE simd_data   simd_atan_ps( const simd_data& x ){
+    const auto ax = simd_abs_ps( x );
+    const auto big = simd_cmpgt_ps( ax , simd_set_ps1( FAST_TAN3PIO8 ) );
+    const auto mid = simd_cmpgt_ps( ax , simd_set_ps1( FAST_TANPIO8 ) );
+
+    auto t = simd_pick_ps( mid , simd_div_ps( simd_sub_ps( ax , simd_ones ) , simd_add_ps( ax , simd_ones ) ) , ax );
+    t = simd_pick_ps( big , simd_div_ps( simd_neg_ones , ax ) , t );
+    auto y0 = simd_pick_ps( mid , simd_set_ps1( FAST_QUARTER_PI ) , simd_zeros );
+    y0 = simd_pick_ps( big , simd_set_ps1( FAST_HALF_PI ) , y0 );
+
+    const auto z = simd_mul_ps( t , t );
+    auto p = simd_mad_ps( simd_set_ps1( FAST_ATAN_POLY[0] ) , z , simd_set_ps1( FAST_ATAN_POLY[1] ) );
+    p = simd_mad_ps( p , z , simd_set_ps1( FAST_ATAN_POLY[2] ) );
+    p = simd_mad_ps( p , z , simd_set_ps1( FAST_ATAN_POLY[3] ) );
+    const auto r = simd_add_ps( simd_mad_ps( simd_mul_ps( p , z ) , t , t ) , y0 );
+    return simd_mul_ps( r , simd_pick_ps( simd_cmplt_ps( x , simd_zeros ) , simd_neg_ones , simd_ones ) );
+}
+
+//! @brief  Arc tangent of y / x in all lanes, see FastAtan2.
+SORT_STATIC_FORCEINLINE simd_data   simd_atan2_ps( const simd_data& y , const simd_data& x ){
+    auto a = simd_atan_ps( simd_div_ps( y , x ) );
+    const auto offset = simd_pick_ps( simd_cmpge_ps( y , simd_zeros ) , simd_set_ps1( FAST_PI ) , simd_set_ps1( -FAST_PI ) );
+    a = simd_add_ps( a , simd_pick_ps( simd_cmplt_ps( x , simd_zeros ) , offset , simd_zeros ) );
+
+    auto axis = simd_pick_ps( simd_cmpgt_ps( y , simd_zeros ) , simd_set_ps1( FAST_HALF_PI ) , simd_zeros );
+    axis = simd_pick_ps( simd_cmplt_ps( y , simd_zeros ) , simd_set_ps1( -FAST_HALF_PI ) , axis );
+    return simd_pick_ps( simd_cmpeq_ps( x , simd_zeros ) , axis , a );
+}
+
+//! @brief  Error function of all lanes, see FastErf.
+SORT_STATIC_FORCEINLINE simd_data   simd_erf_ps( const simd_data& x ){
+    const auto ax = simd_abs_ps( x );
+
+    const auto z = simd_mul_ps( x , x );
+    auto ps = simd_set_ps1( FAST_ERF_TAYLOR[5] );
+    for( auto i = 4 ; i >= 0 ; --i )
+        ps = simd_mad_ps( ps , z , simd_set_ps1( FAST_ERF_TAYLOR[i] ) );
+    ps = simd_mul_ps( simd_mul_ps( simd_set_ps1( FAST_TWO_OVER_SQRTPI ) , x ) , ps );
+
+    const auto t = simd_rcp_ps( simd_mad_ps( simd_set_ps1( FAST_ERF_P ) , ax , simd_ones ) );
+    auto pl = simd_set_ps1( FAST_ERF_POLY[0] );
+    for( auto i = 1 ; i < 5 ; ++i )
+        pl = simd_mad_ps( pl , t , simd_set_ps1( FAST_ERF_POLY[i] ) );
+    pl = simd_sub_ps( simd_ones , simd_mul_ps( simd_mul_ps( pl , t ) , simd_exp_ps( simd_sub_ps( simd_zeros , z ) ) ) );
+    pl = simd_mul_ps( pl , simd_pick_ps( simd_cmplt_ps( x , simd_zeros ) , simd_neg_ones , simd_ones ) );
+
+    return simd_pick_ps( simd_cmplt_ps( ax , simd_set_ps1( FAST_ERF_SPLIT ) ) , ps , pl );
+}
+
+#endif // SIMD_CHANNEL
@@ -0,0 +1,321 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+#pragma once
+
+#include "core/define.h"
+#include "math/ray.h"
+#include "shape/quad.h"
+#include "shape/disk.h"
+#include "core/primitive.h"
+
+// Reference implementation is disabled by default, it is only for debugging purposes.
+// #define SIMD_PLANAR_REFERENCE_IMPLEMENTATION
+
+#if ( defined(SIMD_SSE_IMPLEMENTATION) + defined(SIMD_AVX_IMPLEMENTATION) + defined(SIMD_AVX512_IMPLEMENTATION) ) > 1
+    static_assert( false , "More than one SIMD version is defined before including simd_planar.h." );
+#endif
+
+#ifdef SIMD_BVH_IMPLEMENTATION
+
+#ifdef SIMD_SSE_IMPLEMENTATION
+    #define Simd_Planar   Planar4
+#endif
+
+#ifdef SIMD_AVX_IMPLEMENTATION
+    #define Simd_Planar   Planar8
+#endif
+
+#ifdef SIMD_AVX512_IMPLEMENTATION
+    #define Simd_Planar   Planar16
+#endif
+
+//! @brief  Like Triangle8 and Line8, Planar8 packs quads and disks so that a ray is tested against eight of them at once.
+/**
+ * Quads and disks both lie on the plane of y = 0 in their local space, they only differ in the test of whether the hit
+ * point on the plane is inside the shape. Both kinds of shapes are mixed in one pack, each channel picks its own test.
+ * Shapes are assumed to have no scaling in their transform, which is what Shape expects anyway, so the distance along
+ * the ray is the same in both spaces and the normal and tangent are rows of the transform from world space to local space.
+ */
+struct alignas(SIMD_ALIGNMENT) Simd_Planar{
+    /**< Transformation from world space to the local space of the shape. */
+    simd_data  m_mat_00, m_mat_01, m_mat_02, m_mat_03;
+    simd_data  m_mat_10, m_mat_11, m_mat_12, m_mat_13;
+    simd_data  m_mat_20, m_mat_21, m_mat_22, m_mat_23;
+
+    simd_data  m_ext_x , m_ext_z;          /**< Half size of quads, radius of disks. */
+    simd_data  m_disk;                     /**< Mask marks which shape is a disk. */
+    simd_data  m_mask;                     /**< Mask marks which shape is valid. */
+
+    /**< Pointers to original primitive. */
+    const Primitive*    m_ori_pri[SIMD_CHANNEL] = { nullptr };
+
+    //! @brief  Push a quad or a disk in the data structure.
+    //!
+    //! @param  pri     The original primitive.
+    //! @return         Whether the data structure is full.
+    bool PushPlanar( const Primitive* primitive ){
+        auto i = 0;
+        while( i < SIMD_CHANNEL - 1 && IS_PTR_VALID(m_ori_pri[i]) )
+            ++i;
+        m_ori_pri[i] = primitive;
+        return i == SIMD_CHANNEL - 1;
+    }
+
+    //! @brief  Pack quad and disk information into SIMD compatible data.
+    //!
+    //! @return     Whether there is valid shape inside.
+    bool PackData(){
+        if( !m_ori_pri[0] )
+            return false;
+
+        bool    mask[SIMD_CHANNEL] = { false } , disk[SIMD_CHANNEL] = { false };
+        float   ext_x[SIMD_CHANNEL] = { 0.0f } , ext_z[SIMD_CHANNEL] = { 0.0f };
+        float   mat[12][SIMD_CHANNEL] = { { 0.0f } };
+        for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+            if(IS_PTR_INVALID(m_ori_pri[i]))
+                continue;
+
+            const auto shape = m_ori_pri[i]->GetShape();
+            if( SHAPE_DISK == shape->GetShapeType() ){
+                const auto radius = static_cast<const Disk*>(shape)->GetRadius();
+                ext_x[i] = ext_z[i] = radius;
+                disk[i] = true;
+            }else{
+                const auto quad = static_cast<const Quad*>(shape);
+                ext_x[i] = quad->GetSizeX() * 0.5f;
+                ext_z[i] = quad->GetSizeY() * 0.5f;
+            }
+
+            const auto& world2local = shape->GetTransform().invMatrix;
+            for( auto k = 0 ; k < 12 ; ++k )
+                mat[k][i] = world2local.m[k];
+
+            mask[i] = true;
+        }
+
+        m_mat_00 = simd_set_ps( mat[0] );
+        m_mat_01 = simd_set_ps( mat[1] );
+        m_mat_02 = simd_set_ps( mat[2] );
+        m_mat_03 = simd_set_ps( mat[3] );
+        m_mat_10 = simd_set_ps( mat[4] );
+        m_mat_11 = simd_set_ps( mat[5] );
+        m_mat_12 = simd_set_ps( mat[6] );
+        m_mat_13 = simd_set_ps( mat[7] );
+        m_mat_20 = simd_set_ps( mat[8] );
+        m_mat_21 = simd_set_ps( mat[9] );
+        m_mat_22 = simd_set_ps( mat[10] );
+        m_mat_23 = simd_set_ps( mat[11] );
+
+        m_ext_x = simd_set_ps( ext_x );
+        m_ext_z = simd_set_ps( ext_z );
+        m_disk = simd_set_mask( disk );
+        m_mask = simd_set_mask( mask );
+
+        return true;
+    }
+
+    //! @brief  Reset the data for reuse
+    void Reset(){
+        for( auto i = 0 ; i < SIMD_CHANNEL ; ++i )
+            m_ori_pri[i] = nullptr;
+    }
+};
+
+static_assert( sizeof( Simd_Planar ) % SIMD_ALIGNMENT == 0 , "Incorrect size of Simd_Planar." );
+
+//! @brief  Helper function that implements the core algorithm of ray quad/disk intersection.
+//!
+//! @param  ray         Ray to be tested against.
+//! @param  ray_simd    Resolved simd ray data.
+//! @param  planar_simd The data structure holds quads and disks. Some of them may be invalid.
+//! @param  mask        The mask of valid results.
+//! @param  t_simd      Distance from the ray origin to the intersected points.
+//! @return             Whether there is intersection between the ray and any of the shapes.
+SORT_FORCEINLINE bool intersectPlanar_Inner( const Ray& ray , const Simd_Ray_Data& ray_simd, const Simd_Planar& planar_simd , simd_data& mask , simd_data& t_simd ){
+    // the distance to the plane only needs the y axis of the local space, the other two are skipped for rays missing the plane.
+    const simd_data _ray_ori_y = simd_add_ps( simd_mad_ps( planar_simd.m_mat_12, ray_ori_z(ray_simd), simd_mad_ps( planar_simd.m_mat_11, ray_ori_y(ray_simd), simd_mul_ps( planar_simd.m_mat_10, ray_ori_x(ray_simd)) ) ) , planar_simd.m_mat_13 );
+    const simd_data _ray_dir_y = simd_mad_ps( planar_simd.m_mat_12, ray_dir_z(ray_simd), simd_mad_ps( planar_simd.m_mat_11, ray_dir_y(ray_simd), simd_mul_ps( planar_simd.m_mat_10, ray_dir_x(ray_simd) )));
+
+    const simd_data zeros = simd_zero();
+    t_simd = simd_div_ps( simd_sub_ps( zeros , _ray_ori_y ) , _ray_dir_y );
+
+    const simd_data ray_min_t = simd_set_ps1(ray.m_fMin);
+    const simd_data ray_max_t = simd_set_ps1(ray.m_fMax);
+    mask = simd_and_ps( planar_simd.m_mask , simd_cmpneq_ps( _ray_dir_y , zeros ) );
+    mask = simd_and_ps( mask , simd_and_ps( simd_cmpgt_ps( t_simd , ray_min_t ) , simd_cmple_ps( t_simd , ray_max_t ) ) );
+    if( 0 == simd_movemask_ps(mask) )
+        return false;
+
+    const simd_data _ray_ori_x = simd_add_ps( simd_mad_ps( planar_simd.m_mat_02, ray_ori_z(ray_simd), simd_mad_ps( planar_simd.m_mat_01, ray_ori_y(ray_simd), simd_mul_ps( planar_simd.m_mat_00, ray_ori_x(ray_simd)) ) ) , planar_simd.m_mat_03 );
+    const simd_data _ray_ori_z = simd_add_ps( simd_mad_ps( planar_simd.m_mat_22, ray_ori_z(ray_simd), simd_mad_ps( planar_simd.m_mat_21, ray_ori_y(ray_simd), simd_mul_ps( planar_simd.m_mat_20, ray_ori_x(ray_simd)) ) ) , planar_simd.m_mat_23 );
+    const simd_data _ray_dir_x = simd_mad_ps( planar_simd.m_mat_02, ray_dir_z(ray_simd), simd_mad_ps( planar_simd.m_mat_01, ray_dir_y(ray_simd), simd_mul_ps( planar_simd.m_mat_00, ray_dir_x(ray_simd) )));
+    const simd_data _ray_dir_z = simd_mad_ps( planar_simd.m_mat_22, ray_dir_z(ray_simd), simd_mad_ps( planar_simd.m_mat_21, ray_dir_y(ray_simd), simd_mul_ps( planar_simd.m_mat_20, ray_dir_x(ray_simd) )));
+
+    const simd_data inter_x = simd_mad_ps( t_simd , _ray_dir_x , _ray_ori_x );
+    const simd_data inter_z = simd_mad_ps( t_simd , _ray_dir_z , _ray_ori_z );
+
+    // quads check the hit point against the rectangle, disks against the circle.
+    const simd_data inside_quad = simd_and_ps( simd_and_ps( simd_cmple_ps( inter_x , planar_simd.m_ext_x ) , simd_cmpge_ps( inter_x , simd_sub_ps( zeros , planar_simd.m_ext_x ) ) ) ,
+                                               simd_and_ps( simd_cmple_ps( inter_z , planar_simd.m_ext_z ) , simd_cmpge_ps( inter_z , simd_sub_ps( zeros , planar_simd.m_ext_z ) ) ) );
+    const simd_data inside_disk = simd_cmple_ps( simd_add_ps( simd_sqr_ps( inter_x ) , simd_sqr_ps( inter_z ) ) , simd_sqr_ps( planar_simd.m_ext_x ) );
+    mask = simd_and_ps( mask , simd_pick_ps( planar_simd.m_disk , inside_disk , inside_quad ) );
+    if( 0 == simd_movemask_ps(mask) )
+        return false;
+
+    t_simd = simd_pick_ps( mask , t_simd , simd_infinites );
+    return true;
+}
+
+//! @brief  A helper function setup the result of intersection.
+//!
+//! @param  planar_simd   The data structure that has 4/8 quads and disks.
+//! @param  ray           Ray that we used to tested.
+//! @param  t_simd        The distances from ray origin to the shapes.
+//! @param  res_i         Index of the intersection of our interest.
+//! @param  ret           The pointer to the result to be filled. It can't be nullptr.
+SORT_FORCEINLINE void setupPlanarIntersection( const Simd_Planar& planar_simd , const Ray& ray , const simd_data& t_simd , const int res_i , SurfaceInteraction* ret ){
+    ret->t = t_simd[res_i];
+    ret->intersect = ray( ret->t );
+
+    // the transform is a rotation, the local y axis and z axis in world space are rows of its inverse.
+    ret->normal = Vector( planar_simd.m_mat_10[res_i] , planar_simd.m_mat_11[res_i] , planar_simd.m_mat_12[res_i] );
+    ret->gnormal = ret->normal;
+    ret->tangent = Vector( planar_simd.m_mat_20[res_i] , planar_simd.m_mat_21[res_i] , planar_simd.m_mat_22[res_i] );
+    ret->view = -ray.m_Dir;
+
+    ret->primitive = planar_simd.m_ori_pri[res_i];
+}
+
+//! @brief  Intersect a ray with all quads and disks in the data structure at the cost of one.
+//!
+//! @param  ray         Ray to be tested against.
+//! @param  ray_simd    Resolved simd ray data.
+//! @param  planar_simd Data structure holds the quads and disks.
+//! @param  ret         The result of intersection.
+//! @return             Whether there is any intersection that is valid.
+SORT_FORCEINLINE bool intersectPlanar_SIMD( const Ray& ray , const Simd_Ray_Data& ray_simd, const Simd_Planar& planar_simd , SurfaceInteraction* ret ){
+#ifndef SIMD_PLANAR_REFERENCE_IMPLEMENTATION
+    sAssert(IS_PTR_VALID(ret), SPATIAL_ACCELERATOR );
+
+    simd_data  mask, t_simd;
+    if( !intersectPlanar_Inner( ray , ray_simd , planar_simd , mask , t_simd ) )
+        return false;
+
+    mask = simd_and_ps( mask , simd_cmple_ps( t_simd , simd_set_ps1(ret->t) ) );
+    if( 0 == simd_movemask_ps(mask) )
+        return false;
+    t_simd = simd_pick_ps( mask , t_simd , simd_infinites );
+
+    // find the closest result
+    const simd_data t_min = simd_minreduction_ps( t_simd );
+
+    // get the index of the closest one
+    const auto resolved_mask = simd_movemask_ps( simd_cmpeq_ps( t_simd , t_min ) );
+    const auto res_i = __bsf(resolved_mask);
+
+    setupPlanarIntersection( planar_simd , ray , t_simd , res_i , ret );
+
+    return true;
+#else
+    bool ret_val = false;
+    for( auto i = 0u ; i < SIMD_CHANNEL && IS_PTR_VALID(planar_simd.m_ori_pri[i]) ; ++i )
+        ret_val |= planar_simd.m_ori_pri[i]->GetIntersect( ray , ret );
+    return ret_val;
+#endif
+}
+
+//! @brief  Check whether a ray hits any of the quads and disks in the data structure.
+//!
+//! @param  ray         Ray to be tested against.
+//! @param  ray_simd    Resolved simd ray data.
+//! @param  planar_simd Data structure holds the quads and disks.
+//! @return             Whether there is any intersection that is valid.
+SORT_FORCEINLINE bool intersectPlanarFast_SIMD( const Ray& ray , const Simd_Ray_Data& ray_simd, const Simd_Planar& planar_simd ){
+#ifndef SIMD_PLANAR_REFERENCE_IMPLEMENTATION
+    simd_data dummy_mask , dummy_t;
+    return intersectPlanar_Inner( ray , ray_simd , planar_simd , dummy_mask , dummy_t );
+#else
+    bool ret = false;
+    for( auto i = 0u ; i < SIMD_CHANNEL && IS_PTR_VALID(planar_simd.m_ori_pri[i]) && !ret ; ++i )
+        ret |= planar_simd.m_ori_pri[i]->GetIntersect( ray , nullptr );
+    return ret;
+#endif
+}
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
+//! @brief  Populate all intersections with quads and disks along a shadow ray passing through semi-transparent surfaces.
+//!
+//! @param  ray             Ray to be tested against.
+//! @param  ray_simd        Resolved simd ray data.
+//! @param  planar_simd     Data structure holds the quads and disks.
+//! @param  intersections   The intersections along the shadow ray.
+//! @return                 Whether an opaque shape is found, there is no need to test anything else once it happens.
+SORT_FORCEINLINE bool intersectPlanarShadow_SIMD( const Ray& ray , const Simd_Ray_Data& ray_simd, const Simd_Planar& planar_simd , ShadowIntersections& intersections ){
+#ifndef SIMD_PLANAR_REFERENCE_IMPLEMENTATION
+    simd_data  mask, t_simd;
+    if( !intersectPlanar_Inner( ray , ray_simd , planar_simd , mask , t_simd ) )
+        return false;
+
+    mask = simd_and_ps( mask , simd_cmplt_ps( t_simd , simd_set_ps1(intersections.maxt) ) );
+    auto resolved_mask = simd_movemask_ps(mask);
+    while( resolved_mask ){
+        const auto res_i = __bsf(resolved_mask);
+        resolved_mask = resolved_mask & (resolved_mask - 1);
+
+        // there is no need to setup the intersection to know the ray is blocked.
+        const auto primitive = planar_simd.m_ori_pri[res_i];
+        if( LIKELY(!primitive->HasTransparency()) ){
+            intersections.blocked = true;
+            return true;
+        }
+
+        if( intersections.IsRecorded( primitive ) )
+            continue;
+
+        // the maximum depth may have shrunk since the mask was evaluated
+        auto slot = intersections.Allocate( t_simd[res_i] );
+        if( IS_PTR_INVALID(slot) )
+            continue;
+
+        setupPlanarIntersection( planar_simd , ray , t_simd , res_i , slot );
+        intersections.ResolveMaxDepth();
+    }
+    return false;
+#else
+    SurfaceInteraction intersection;
+    for( auto i = 0u ; i < SIMD_CHANNEL && IS_PTR_VALID(planar_simd.m_ori_pri[i]) ; ++i ){
+        const auto* primitive = planar_simd.m_ori_pri[i];
+
+        intersection.Reset();
+        intersection.t = intersections.maxt;
+        if( !primitive->GetIntersect( ray , &intersection ) )
+            continue;
+
+        if( !primitive->HasTransparency() ){
+            intersections.blocked = true;
+            return true;
+        }
+
+        if( !intersections.IsRecorded( primitive ) )
+            intersections.Add( intersection , true );
+    }
+    return false;
+#endif
+}
+#endif
+
+#endif // SIMD_BVH_IMPLEMENTATION
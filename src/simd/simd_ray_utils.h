@@ -21,11 +21,11 @@
 #include "simd_wrapper.h"
 #include "math/ray.h"
 
-#if defined(SIMD_SSE_IMPLEMENTATION) && defined(SIMD_AVX_IMPLEMENTATION)
+#if ( defined(SIMD_SSE_IMPLEMENTATION) + defined(SIMD_AVX_IMPLEMENTATION) + defined(SIMD_AVX512_IMPLEMENTATION) ) > 1
     static_assert( false , "More than one SIMD version is defined before including simd_bbox." );
 #endif
 
-#if defined(SSE_ENABLED) || defined(AVX_ENABLED)
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED) || defined(AVX_ENABLED) || defined(AVX512_ENABLED)
 #ifdef SIMD_BVH_IMPLEMENTATION
 
 #ifdef SIMD_SSE_IMPLEMENTATION
@@ -34,21 +34,21 @@
 #ifdef SIMD_AVX_IMPLEMENTATION
     #define Simd_Ray_Data   Ray8_Data
 #endif
+#ifdef SIMD_AVX512_IMPLEMENTATION
+    #define Simd_Ray_Data   Ray16_Data
+#endif
 
 SORT_STATIC_FORCEINLINE float sign( const float x ){
     return x < 0.0f ? -1.0f : 1.0f;
 }
 
 struct alignas(SIMD_ALIGNMENT) Simd_Ray_Data{
-    simd_data  ori_dir_x;    /**< -Ori.x/Dir.x , this is used in ray AABB intersection. */
-	simd_data  ori_dir_y;    /**< -Ori.y/Dir.y , this is used in ray AABB intersection. */
-	simd_data  ori_dir_z;    /**< -Ori.z/Dir.z , this is used in ray AABB intersection. */
-	simd_data  rcp_dir_x;    /**< 1.0/Dir.x , this is used in ray AABB intersection. */
+    simd_data  rcp_dir_x;    /**< 1.0/Dir.x , this is used in ray AABB intersection. */
 	simd_data  rcp_dir_y;    /**< 1.0/Dir.y , this is used in ray AABB intersection. */
 	simd_data  rcp_dir_z;    /**< 1.0/Dir.z , this is used in ray AABB intersection. */
-	simd_data  ori_x;        /**< Ori.x , this is used in ray Triangle&Line intersection. */
-	simd_data  ori_y;        /**< Ori.y , this is used in ray Triangle&Line intersection. */
-	simd_data  ori_z;        /**< Ori.z , this is used in ray Triangle&Line intersection. */
+	simd_data  ori_x;        /**< Ori.x , this is used in ray AABB&Triangle&Line intersection. */
+	simd_data  ori_y;        /**< Ori.y , this is used in ray AABB&Triangle&Line intersection. */
+	simd_data  ori_z;        /**< Ori.z , this is used in ray AABB&Triangle&Line intersection. */
 	simd_data  dir_x;        /**< Dir.x , this is used in ray Line intersection. */
 	simd_data  dir_y;        /**< Dir.x , this is used in ray Line intersection. */
 	simd_data  dir_z;        /**< Dir.x , this is used in ray Line intersection. */
@@ -57,7 +57,7 @@ struct alignas(SIMD_ALIGNMENT) Simd_Ray_Data{
 	simd_data  scale_z;      /**< Scaling along each axis in local coordinate. */
 };
 
-void resolveRayData( const Ray& ray , Simd_Ray_Data& simd_ray_data ){
+SORT_STATIC_FORCEINLINE void resolveRayData( const Ray& ray , Simd_Ray_Data& simd_ray_data ){
     constexpr float delta = 0.00001f;
     const auto dir_x = fabs(ray.m_Dir[0]) < delta ? sign(ray.m_Dir[0]) * delta : ray.m_Dir[0];
     const auto dir_y = fabs(ray.m_Dir[1]) < delta ? sign(ray.m_Dir[1]) * delta : ray.m_Dir[1];
@@ -65,9 +65,6 @@ void resolveRayData( const Ray& ray , Simd_Ray_Data& simd_ray_data ){
     simd_ray_data.rcp_dir_x = simd_set_ps1( 1.0f/dir_x );
     simd_ray_data.rcp_dir_y = simd_set_ps1( 1.0f/dir_y );
     simd_ray_data.rcp_dir_z = simd_set_ps1( 1.0f/dir_z );
-    simd_ray_data.ori_dir_x = simd_set_ps1( -ray.m_Ori[0]/dir_x );
-    simd_ray_data.ori_dir_y = simd_set_ps1( -ray.m_Ori[1]/dir_y ); 
-    simd_ray_data.ori_dir_z = simd_set_ps1( -ray.m_Ori[2]/dir_z ); 
 
     simd_ray_data.ori_x = simd_set_ps1( ray.m_Ori.x );
     simd_ray_data.ori_y = simd_set_ps1( ray.m_Ori.y );
@@ -82,15 +79,6 @@ void resolveRayData( const Ray& ray , Simd_Ray_Data& simd_ray_data ){
     simd_ray_data.scale_z = simd_set_ps1( ray.m_scale_z );
 }
 
-SORT_STATIC_FORCEINLINE simd_data   ray_ori_dir_x( const Simd_Ray_Data& ray ){
-    return ray.ori_dir_x;
-}
-SORT_STATIC_FORCEINLINE simd_data   ray_ori_dir_y( const Simd_Ray_Data& ray ){
-    return ray.ori_dir_y;
-}
-SORT_STATIC_FORCEINLINE simd_data   ray_ori_dir_z( const Simd_Ray_Data& ray ){
-    return ray.ori_dir_z;
-}
 SORT_STATIC_FORCEINLINE simd_data   ray_ori_x( const Simd_Ray_Data& ray ){
     return ray.ori_x;
 }
@@ -30,7 +30,16 @@
 // Reference implementation is disabled by default, it is only for debugging purposes.
 // #define SIMD_TRI_REFERENCE_IMPLEMENTATION
 
-#if defined(SIMD_SSE_IMPLEMENTATION) && defined(SIMD_AVX_IMPLEMENTATION)
+// Two ray triangle intersection algorithms are available, it is selected by 'ENABLE_WATERTIGHT_INTERSECTION' in CMake.
+//  - Woop's watertight algorithm is the default one. Vertices are transformed with the shear precomputed in each ray and edge
+//    functions are evaluated in double precision when they are exactly zero. It is exactly what Triangle::GetIntersect does,
+//    rays never leak through the shared edges and vertices of adjacent triangles.
+//  - Baldwin-Weber's algorithm is used if SIMD_TRI_BALDWIN_WEBER is defined. A transformation from world space to the
+//    barycentric space of each triangle is precomputed while packing, it takes fewer instructions per test. But the
+//    barycentric coordinates of two triangles sharing an edge come from different transformations, rays hitting an edge
+//    exactly may go through both of them.
+
+#if ( defined(SIMD_SSE_IMPLEMENTATION) + defined(SIMD_AVX_IMPLEMENTATION) + defined(SIMD_AVX512_IMPLEMENTATION) ) > 1
     static_assert( false , "More than one SIMD version is defined before including simd_triangle.h." );
 #endif
 
@@ -44,6 +53,10 @@
     #define Simd_Triangle       Triangle8
 #endif
 
+#ifdef SIMD_AVX512_IMPLEMENTATION
+    #define Simd_Triangle       Triangle16
+#endif
+
 //! @brief  Simd_Triangle is more of a simplified resolved data structure holds only bare bone information of triangle.
 /**
  * Simd_Triangle is used in OBVH/QBVH to accelerate ray triangle intersection using AVX/SSE. Its sole purpose is to accelerate 
@@ -53,9 +66,15 @@
  * incur more cost in term of memory usage.
  */
 struct alignas(SIMD_ALIGNMENT) Simd_Triangle{
+#ifdef SIMD_TRI_BALDWIN_WEBER
+    simd_data  m_u_x , m_u_y , m_u_z , m_u_o ;  /**< Row of the transformation evaluating the barycentric coordinate of point 1. */
+    simd_data  m_v_x , m_v_y , m_v_z , m_v_o ;  /**< Row of the transformation evaluating the barycentric coordinate of point 2. */
+    simd_data  m_w_x , m_w_y , m_w_z , m_w_o ;  /**< Row of the transformation evaluating the scaled distance to the triangle plane. */
+#else
     simd_data  m_p0_x , m_p0_y , m_p0_z ;  /**< Position of point 0 of the triangle. */
     simd_data  m_p1_x , m_p1_y , m_p1_z ;  /**< Position of point 1 of the triangle. */
     simd_data  m_p2_x , m_p2_y , m_p2_z ;  /**< Position of point 2 of the triangle. */
+#endif
     simd_data  m_mask;
 
     /**< Pointers to original primitives. */
@@ -126,6 +145,16 @@ struct alignas(SIMD_ALIGNMENT) Simd_Triangle{
         m_ori_tri[7] = triangle;
         return true;
 #endif
+
+#ifdef SIMD_AVX512_IMPLEMENTATION
+        const Triangle* triangle = dynamic_cast<const Triangle*>(primitive->GetShape());
+        auto i = 0;
+        while( i < SIMD_CHANNEL - 1 && IS_PTR_VALID(m_ori_pri[i]) )
+            ++i;
+        m_ori_pri[i] = primitive;
+        m_ori_tri[i] = triangle;
+        return i == SIMD_CHANNEL - 1;
+#endif
     }
 
     //! @brief  Pack triangle information into SSE/AVX compatible data.
@@ -135,6 +164,58 @@ struct alignas(SIMD_ALIGNMENT) Simd_Triangle{
         if( !m_ori_pri[0] )
             return false;
 
+#ifdef SIMD_TRI_BALDWIN_WEBER
+        bool    mask[SIMD_CHANNEL] = { false };
+        float   rows[12][SIMD_CHANNEL] = { { 0.0f } };
+        for( auto i = 0 ; i < SIMD_CHANNEL && IS_PTR_VALID(m_ori_pri[i]) ; ++i ){
+            const auto triangle = m_ori_tri[i];
+
+            const auto& mem = triangle->m_meshVisual->m_memory;
+            const auto& v0 = mem->m_positions[triangle->m_index.m_id[0]];
+            const auto& v1 = mem->m_positions[triangle->m_index.m_id[1]];
+            const auto& v2 = mem->m_positions[triangle->m_index.m_id[2]];
+
+            // The transformation is the inverse of the matrix with the two edges and the axis along the major component of the
+            // normal as columns, the determinant is that major component, which is as far from zero as it gets.
+            const auto e1 = v1 - v0;
+            const auto e2 = v2 - v0;
+            const auto n = cross( e1 , e2 );
+            const auto axis = ( fabs( n.x ) > fabs( n.y ) ) ? ( fabs( n.x ) > fabs( n.z ) ? 0u : 2u ) : ( fabs( n.y ) > fabs( n.z ) ? 1u : 2u );
+            const auto det = n[axis];
+            if( det == 0.0f )
+                continue;
+
+            Vector k( 0.0f );
+            k[axis] = 1.0f;
+            const auto inv_det = 1.0f / det;
+            const Vector row_u = cross( e2 , k ) * inv_det;
+            const Vector row_v = cross( k , e1 ) * inv_det;
+            const Vector row_w = n * inv_det;
+            const Vector o( v0.x , v0.y , v0.z );
+            const float row_data[12] = { row_u.x , row_u.y , row_u.z , -dot( row_u , o ) ,
+                                         row_v.x , row_v.y , row_v.z , -dot( row_v , o ) ,
+                                         row_w.x , row_w.y , row_w.z , -dot( row_w , o ) };
+            for( auto j = 0 ; j < 12 ; ++j )
+                rows[j][i] = row_data[j];
+            mask[i] = true;
+        }
+
+        m_u_x = simd_set_ps( rows[0] );
+        m_u_y = simd_set_ps( rows[1] );
+        m_u_z = simd_set_ps( rows[2] );
+        m_u_o = simd_set_ps( rows[3] );
+        m_v_x = simd_set_ps( rows[4] );
+        m_v_y = simd_set_ps( rows[5] );
+        m_v_z = simd_set_ps( rows[6] );
+        m_v_o = simd_set_ps( rows[7] );
+        m_w_x = simd_set_ps( rows[8] );
+        m_w_y = simd_set_ps( rows[9] );
+        m_w_z = simd_set_ps( rows[10] );
+        m_w_o = simd_set_ps( rows[11] );
+        m_mask = simd_set_mask( mask );
+
+        return true;
+#else
         bool	mask[SIMD_CHANNEL] = { false };
         float   p0_x[SIMD_CHANNEL] , p0_y[SIMD_CHANNEL] , p0_z[SIMD_CHANNEL] , p1_x[SIMD_CHANNEL] , p1_y[SIMD_CHANNEL] , p1_z[SIMD_CHANNEL] , p2_x[SIMD_CHANNEL] , p2_y[SIMD_CHANNEL] , p2_z[SIMD_CHANNEL];
         for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
@@ -150,21 +231,22 @@ struct alignas(SIMD_ALIGNMENT) Simd_Triangle{
             const auto id1 = triangle->m_index.m_id[1];
             const auto id2 = triangle->m_index.m_id[2];
 
-            const auto& mv0 = mem->m_vertices[id0];
-            const auto& mv1 = mem->m_vertices[id1];
-            const auto& mv2 = mem->m_vertices[id2];
+            // only the position stream is touched while packing triangles
+            const auto& v0 = mem->m_positions[id0];
+            const auto& v1 = mem->m_positions[id1];
+            const auto& v2 = mem->m_positions[id2];
 
-            p0_x[i] = mv0.m_position.x;
-            p0_y[i] = mv0.m_position.y;
-            p0_z[i] = mv0.m_position.z;
+            p0_x[i] = v0.x;
+            p0_y[i] = v0.y;
+            p0_z[i] = v0.z;
 
-            p1_x[i] = mv1.m_position.x;
-            p1_y[i] = mv1.m_position.y;
-            p1_z[i] = mv1.m_position.z;
+            p1_x[i] = v1.x;
+            p1_y[i] = v1.y;
+            p1_z[i] = v1.z;
 
-            p2_x[i] = mv2.m_position.x;
-            p2_y[i] = mv2.m_position.y;
-            p2_z[i] = mv2.m_position.z;
+            p2_x[i] = v2.x;
+            p2_y[i] = v2.y;
+            p2_z[i] = v2.z;
 
             mask[i] = true;
         }
@@ -181,6 +263,7 @@ struct alignas(SIMD_ALIGNMENT) Simd_Triangle{
         m_mask = simd_set_mask( mask );
 
         return true;
+#endif
     }
 
     //! @brief  Reset the data for reuse
@@ -194,6 +277,13 @@ struct alignas(SIMD_ALIGNMENT) Simd_Triangle{
         m_ori_pri[0] = m_ori_pri[1] = m_ori_pri[2] = m_ori_pri[3] = m_ori_pri[4] = m_ori_pri[5] = m_ori_pri[6] = m_ori_pri[7] = nullptr;
         m_ori_tri[0] = m_ori_tri[1] = m_ori_tri[2] = m_ori_tri[3] = m_ori_tri[4] = m_ori_tri[5] = m_ori_tri[6] = m_ori_tri[7] = nullptr;
 #endif
+
+#ifdef SIMD_AVX512_IMPLEMENTATION
+        for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+            m_ori_pri[i] = nullptr;
+            m_ori_tri[i] = nullptr;
+        }
+#endif
     }
 };
 
@@ -212,6 +302,46 @@ template< bool quick_quit >
 SORT_FORCEINLINE bool intersectTriangleInner_SIMD(const Ray& ray, const Simd_Ray_Data& ray_simd, const Simd_Triangle& tri_simd, simd_data& t_simd, simd_data& u_simd, simd_data& v_simd, simd_data& mask) {
     mask = tri_simd.m_mask;
 
+#ifdef SIMD_TRI_BALDWIN_WEBER
+    // step 0 : transform the ray to the barycentric space of the triangles, where they lie on the plane of z = 0
+    const simd_data ori_w = simd_mad_ps(tri_simd.m_w_z, ray_ori_z(ray_simd), simd_mad_ps(tri_simd.m_w_y, ray_ori_y(ray_simd), simd_mad_ps(tri_simd.m_w_x, ray_ori_x(ray_simd), tri_simd.m_w_o)));
+    const simd_data dir_w = simd_mad_ps(tri_simd.m_w_z, ray_dir_z(ray_simd), simd_mad_ps(tri_simd.m_w_y, ray_dir_y(ray_simd), simd_mul_ps(tri_simd.m_w_x, ray_dir_x(ray_simd))));
+
+    // step 1 : intersect the ray with the planes
+    const simd_data zeros = simd_zero();
+    mask = simd_and_ps(mask, simd_cmpneq_ps(dir_w, zeros));
+    t_simd = simd_div_ps(simd_sub_ps(zeros, ori_w), dir_w);
+
+    const simd_data ray_min_t = simd_set_ps1(ray.m_fMin);
+    const simd_data ray_max_t = simd_set_ps1(ray.m_fMax);
+    mask = simd_and_ps(simd_and_ps(mask, simd_cmpgt_ps(t_simd, ray_min_t)), simd_cmple_ps(t_simd, ray_max_t));
+    auto c = simd_movemask_ps(mask);
+    if (0 == c)
+        return false;
+
+    // step 2 : evaluate the barycentric coordinates of the intersections
+    const simd_data ori_u = simd_mad_ps(tri_simd.m_u_z, ray_ori_z(ray_simd), simd_mad_ps(tri_simd.m_u_y, ray_ori_y(ray_simd), simd_mad_ps(tri_simd.m_u_x, ray_ori_x(ray_simd), tri_simd.m_u_o)));
+    const simd_data dir_u = simd_mad_ps(tri_simd.m_u_z, ray_dir_z(ray_simd), simd_mad_ps(tri_simd.m_u_y, ray_dir_y(ray_simd), simd_mul_ps(tri_simd.m_u_x, ray_dir_x(ray_simd))));
+    const simd_data ori_v = simd_mad_ps(tri_simd.m_v_z, ray_ori_z(ray_simd), simd_mad_ps(tri_simd.m_v_y, ray_ori_y(ray_simd), simd_mad_ps(tri_simd.m_v_x, ray_ori_x(ray_simd), tri_simd.m_v_o)));
+    const simd_data dir_v = simd_mad_ps(tri_simd.m_v_z, ray_dir_z(ray_simd), simd_mad_ps(tri_simd.m_v_y, ray_dir_y(ray_simd), simd_mul_ps(tri_simd.m_v_x, ray_dir_x(ray_simd))));
+    u_simd = simd_mad_ps(dir_u, t_simd, ori_u);
+    v_simd = simd_mad_ps(dir_v, t_simd, ori_v);
+
+    const simd_data inside = simd_and_ps(simd_and_ps(simd_cmpge_ps(u_simd, zeros), simd_cmpge_ps(v_simd, zeros)), simd_cmple_ps(simd_add_ps(u_simd, v_simd), simd_ones));
+    mask = simd_and_ps(mask, inside);
+    c = simd_movemask_ps(mask);
+    if (0 == c)
+        return false;
+
+    if (quick_quit)
+        return true;
+
+    // mask out the invalid values
+    t_simd = simd_pick_ps( mask, t_simd, simd_infinites);
+
+    return true;
+#else
+
     // step 0 : translate the vertices to ray coordinate system
     simd_data p0[3], p1[3], p2[3];
     p0[0] = simd_sub_ps(tri_simd.m_p0_x, ray_ori_x(ray_simd));
@@ -249,11 +379,26 @@ SORT_FORCEINLINE bool intersectTriangleInner_SIMD(const Ray& ray, const Simd_Ray
     p2_z = simd_mad_ps(p2_y, ray_scale_z(ray_simd), p2_z);
 
     // compute the edge functions
-    const simd_data e0 = simd_sub_ps(simd_mul_ps(p1_x, p2_z), simd_mul_ps(p1_z, p2_x));
-    const simd_data e1 = simd_sub_ps(simd_mul_ps(p2_x, p0_z), simd_mul_ps(p2_z, p0_x));
-    const simd_data e2 = simd_sub_ps(simd_mul_ps(p0_x, p1_z), simd_mul_ps(p0_z, p1_x));
+    simd_data e0 = simd_sub_ps(simd_mul_ps(p1_x, p2_z), simd_mul_ps(p1_z, p2_x));
+    simd_data e1 = simd_sub_ps(simd_mul_ps(p2_x, p0_z), simd_mul_ps(p2_z, p0_x));
+    simd_data e2 = simd_sub_ps(simd_mul_ps(p0_x, p1_z), simd_mul_ps(p0_z, p1_x));
 
     const simd_data zeros = simd_zero();
+
+    // Fall back to double precision for the edge functions that are exactly zero, exactly like Triangle::GetIntersect does.
+    // Only these edge functions are evaluated again, the other triangle sharing the edge gets exactly the negated value.
+    auto on_edge = simd_movemask_ps(simd_and_ps(mask, simd_or_ps(simd_or_ps(simd_cmpeq_ps(e0, zeros), simd_cmpeq_ps(e1, zeros)), simd_cmpeq_ps(e2, zeros))));
+    while (UNLIKELY(on_edge)) {
+        const auto i = __bsf(on_edge);
+        on_edge &= on_edge - 1;
+
+        if (e0[i] == 0.0f)
+            e0[i] = (float)((double)p1_x[i] * (double)p2_z[i] - (double)p1_z[i] * (double)p2_x[i]);
+        if (e1[i] == 0.0f)
+            e1[i] = (float)((double)p2_x[i] * (double)p0_z[i] - (double)p2_z[i] * (double)p0_x[i]);
+        if (e2[i] == 0.0f)
+            e2[i] = (float)((double)p0_x[i] * (double)p1_z[i] - (double)p0_z[i] * (double)p1_x[i]);
+    }
     const simd_data c0 = simd_and_ps(simd_and_ps(simd_cmpge_ps(e0, zeros), simd_cmpge_ps(e1, zeros)), simd_cmpge_ps(e2, zeros));
     const simd_data c1 = simd_and_ps(simd_and_ps(simd_cmple_ps(e0, zeros), simd_cmple_ps(e1, zeros)), simd_cmple_ps(e2, zeros));
     mask = simd_or_ps( simd_and_ps(mask,c0) , simd_and_ps(mask,c1) );
@@ -296,47 +441,26 @@ SORT_FORCEINLINE bool intersectTriangleInner_SIMD(const Ray& ray, const Simd_Ray
     v_simd = simd_mul_ps(e2, rcp_det);
 
     return true;
+#endif
 }
 
 //! @brief  A helper function setup the result of intersection.
 //!
+//! Only the distance, the barycentric coordinate and the primitive are recorded, the rest of the attributes are evaluated
+//! by 'FinalizeInteraction' once the nearest hit is known.
+//!
 //! @param  tri_simd      The triangle data structure that has 4/8 triangles.
-//! @param  ray           Ray that we used to tested.
 //! @param  t_simd        Output, the distances from ray origin to triangles. It will be FLT_MAX if there is no intersection.
 //! @param  u_simd        Blending factor.
 //! @param  v_simd        Blending factor.
 //! @param  id            Index of the intersection of our interest.
 //! @param  intersection  The pointer to the result to be filled. It can't be nullptr.
-SORT_FORCEINLINE void setupIntersection(const Simd_Triangle& tri_simd, const Ray& ray, const simd_data& t_simd, const simd_data& u_simd, const simd_data& v_simd, const int id, SurfaceInteraction* intersection) {
-    const auto* triangle = tri_simd.m_ori_tri[id];
-
-    const auto u = u_simd[id];
-    const auto v = v_simd[id];
-    const auto w = 1 - u - v;
-
-    const auto& mem = triangle->m_meshVisual->m_memory;
-    const auto id0 = triangle->m_index.m_id[0];
-    const auto id1 = triangle->m_index.m_id[1];
-    const auto id2 = triangle->m_index.m_id[2];
-
-    const auto& mv0 = mem->m_vertices[id0];
-    const auto& mv1 = mem->m_vertices[id1];
-    const auto& mv2 = mem->m_vertices[id2];
-
-    const auto res_t = t_simd[id];
-    intersection->intersect = ray(res_t);
-    intersection->t = res_t;
-
-    intersection->gnormal = normalize(cross((mv2.m_position - mv0.m_position), (mv1.m_position - mv0.m_position)));
-    intersection->normal = (w * mv0.m_normal + u * mv1.m_normal + v * mv2.m_normal).Normalize();
-    intersection->tangent = (w * mv0.m_tangent + u * mv1.m_tangent + v * mv2.m_tangent).Normalize();
-    intersection->view = -ray.m_Dir;
-
-    const auto uv = w * mv0.m_texCoord + u * mv1.m_texCoord + v * mv2.m_texCoord;
-    intersection->u = uv.x;
-    intersection->v = uv.y;
-
+SORT_FORCEINLINE void setupIntersection(const Simd_Triangle& tri_simd, const simd_data& t_simd, const simd_data& u_simd, const simd_data& v_simd, const int id, SurfaceInteraction* intersection) {
+    intersection->t = t_simd[id];
+    intersection->u = u_simd[id];
+    intersection->v = v_simd[id];
     intersection->primitive = tri_simd.m_ori_pri[id];
+    intersection->pending = true;
 }
 
 //! @brief  With the power of SSE/AVX, this utility function helps intersect a ray with four/eight triangles at the cost of one.
@@ -370,7 +494,7 @@ SORT_FORCEINLINE bool intersectTriangle_SIMD( const Ray& ray , const Simd_Ray_Da
     sAssert( resolved_mask > 0 && resolved_mask < pow(2,SIMD_CHANNEL) , SPATIAL_ACCELERATOR );
     sAssert( res_i >= 0 && res_i < SIMD_CHANNEL , SPATIAL_ACCELERATOR );
     
-    setupIntersection(tri_simd, ray, t_simd, u_simd, v_simd, res_i, ret);
+    setupIntersection(tri_simd, t_simd, u_simd, v_simd, res_i, ret);
 
     return true;
 #else
@@ -429,58 +553,98 @@ SORT_FORCEINLINE void intersectTriangleMulti_SIMD(const Ray& ray, const Simd_Ray
         resolved_mask = resolved_mask & (resolved_mask - 1);
 
         const auto primitive = tri_simd.m_ori_pri[res_i];
-        if (matID != primitive->GetMaterial()->GetUniqueID())
+        if (( matID != INVALID_SID && matID != primitive->GetMaterial()->GetUniqueID() ) || intersections.IsRecorded(primitive))
             continue;
 
-        if (intersections.cnt < TOTAL_SSS_INTERSECTION_CNT) {
-            intersections.intersections[intersections.cnt] = SORT_MALLOC(BSSRDFIntersection)();
-            setupIntersection(tri_simd, ray, t_simd, u_simd, v_simd, res_i, &intersections.intersections[intersections.cnt++]->intersection);
-        } else {
-            auto picked_i = -1;
-            auto t = 0.0f;
-            for (auto i = 0; i < TOTAL_SSS_INTERSECTION_CNT; ++i) {
-                if (t < intersections.intersections[i]->intersection.t) {
-                    t = intersections.intersections[i]->intersection.t;
-                    picked_i = i;
-                }
-            }
-            if( picked_i >= 0 )
-                setupIntersection(tri_simd, ray, t_simd, u_simd, v_simd, res_i, &intersections.intersections[picked_i]->intersection);
-
-            intersections.ResolveMaxDepth();
-        }
+        // the maximum depth may have shrunk since the mask was evaluated
+        auto slot = intersections.Allocate(t_simd[res_i]);
+        if (IS_PTR_INVALID(slot))
+            continue;
+
+        setupIntersection(tri_simd, t_simd, u_simd, v_simd, res_i, slot);
+        FinalizeInteraction(ray, *slot);
+        intersections.ResolveMaxDepth();
     }
 #else
     SurfaceInteraction intersection;
     for( auto i = 0u ; i < SIMD_CHANNEL && IS_PTR_VALID(tri_simd.m_ori_pri[i]) ; ++i ){
         const auto* primitive = tri_simd.m_ori_pri[i];
-        if (matID != primitive->GetMaterial()->GetUniqueID())
+        if (( matID != INVALID_SID && matID != primitive->GetMaterial()->GetUniqueID() ) || intersections.IsRecorded(primitive))
             continue;
 
         intersection.Reset();
+        intersection.t = intersections.maxt;
         const auto intersected = primitive->GetIntersect(ray, &intersection);
-        if (intersected) {
-            if (intersections.cnt < TOTAL_SSS_INTERSECTION_CNT) {
-                intersections.intersections[intersections.cnt] = SORT_MALLOC(BSSRDFIntersection)();
-                intersections.intersections[intersections.cnt++]->intersection = intersection;
-            }
-            else {
-                auto picked_i = -1;
-                auto t = 0.0f;
-                for (auto i = 0; i < TOTAL_SSS_INTERSECTION_CNT; ++i) {
-                    if (t < intersections.intersections[i]->intersection.t) {
-                        t = intersections.intersections[i]->intersection.t;
-                        picked_i = i;
-                    }
-                }
-                if (picked_i >= 0)
-                    intersections.intersections[picked_i]->intersection = intersection;
-
-                intersections.ResolveMaxDepth();
-            }
+        if (intersected)
+            intersections.Add(intersection);
+    }
+#endif
+}
+
+
+#ifdef ENABLE_TRANSPARENT_SHADOW
+//! @brief  Similar to the above function, this helper function will populate all results in the ShadowIntersections data structure.
+//!         It is for shadow rays passing through semi-transparent surfaces.
+//!
+//! @param  ray             Ray to be tested against.
+//! @param  ray_simd        Resolved simd ray data.
+//! @param  tri_simd        Data structure holds four/eight triangles.
+//! @param  intersections   The intersections along the shadow ray.
+//! @return                 Whether an opaque triangle is found, there is no need to test anything else once it happens.
+SORT_FORCEINLINE bool intersectTriangleShadow_SIMD(const Ray& ray, const Simd_Ray_Data& ray_simd, const Simd_Triangle& tri_simd, ShadowIntersections& intersections) {
+#ifndef SIMD_TRI_REFERENCE_IMPLEMENTATION
+    simd_data   u_simd, v_simd, t_simd, mask;
+    const auto intersected = intersectTriangleInner_SIMD<false>(ray, ray_simd, tri_simd, t_simd, u_simd, v_simd, mask);
+    if (!intersected)
+        return false;
+
+    mask = simd_and_ps(mask, simd_cmplt_ps(t_simd, simd_set_ps1(intersections.maxt)));
+    auto resolved_mask = simd_movemask_ps(mask);
+    while (resolved_mask) {
+        const auto res_i = __bsf(resolved_mask);
+        resolved_mask = resolved_mask & (resolved_mask - 1);
+
+        // there is no need to setup the intersection to know the ray is blocked.
+        const auto primitive = tri_simd.m_ori_pri[res_i];
+        if (!primitive->HasTransparency()) {
+            intersections.blocked = true;
+            return true;
         }
+
+        if (intersections.IsRecorded(primitive))
+            continue;
+
+        // the maximum depth may have shrunk since the mask was evaluated
+        auto slot = intersections.Allocate(t_simd[res_i]);
+        if (IS_PTR_INVALID(slot))
+            continue;
+
+        setupIntersection(tri_simd, t_simd, u_simd, v_simd, res_i, slot);
+        FinalizeInteraction(ray, *slot);
+        intersections.ResolveMaxDepth();
     }
+    return false;
+#else
+    SurfaceInteraction intersection;
+    for( auto i = 0u ; i < SIMD_CHANNEL && IS_PTR_VALID(tri_simd.m_ori_pri[i]) ; ++i ){
+        const auto* primitive = tri_simd.m_ori_pri[i];
+
+        intersection.Reset();
+        intersection.t = intersections.maxt;
+        if (!primitive->GetIntersect(ray, &intersection))
+            continue;
+
+        if (!primitive->HasTransparency()) {
+            intersections.blocked = true;
+            return true;
+        }
+
+        if (!intersections.IsRecorded(primitive))
+            intersections.Add(intersection, true);
+    }
+    return false;
 #endif
 }
+#endif
 
 #endif // SIMD_SSE_IMPLEMENTATION || SIMD_AVX_IMPLEMENTATION
\ No newline at end of file
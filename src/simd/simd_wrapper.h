@@ -22,32 +22,49 @@
 //  - Nan != Nan     ( SIMD, 0xffffffff )     ( Non-SIMD, false )
 
 #include <float.h>
+#include <string.h>
 #include "core/define.h"
 
-#if defined(SIMD_SSE_IMPLEMENTATION) && defined(SIMD_AVX_IMPLEMENTATION)
+#if ( defined(SIMD_SSE_IMPLEMENTATION) + defined(SIMD_AVX_IMPLEMENTATION) + defined(SIMD_AVX512_IMPLEMENTATION) ) > 1
     static_assert( false , "More than one SIMD version is defined before including the wrapper." );
 #endif
 
 const static unsigned mask_true_i = 0xffffffff;
 const static float mask_true = *((float*)&( mask_true_i ));
 
-#ifdef SSE_ENABLED
+#if defined(SSE_ENABLED) && defined(NEON_ENABLED)
+    static_assert( false , "SSE and NEON can't be enabled at the same time." );
+#endif
+
+// NEON is the four-wide instruction set on ARM, it shares the SSE version of the wrapper so that everything built on top
+// of it, QBVH, Triangle4, Line4 and BBox4, works on ARM without any change.
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
+
+#ifdef NEON_ENABLED
+#if !defined(__aarch64__) && !defined(_M_ARM64)
+    static_assert( false , "NEON is only supported on 64 bits ARM CPUs, 32 bits ARM doesn't have vector division and square root." );
+#endif
+#include <arm_neon.h>
+#define simd_native_sse float32x4_t
+#else
 #include <nmmintrin.h>
+#define simd_native_sse __m128
+#endif
 
 #ifndef SORT_IN_WINDOWS
-#define simd_data_sse   __m128
+#define simd_data_sse   simd_native_sse
 #else
 // somehow this data structure can introduce huge performance problem on MacOS
 // since it is purely for [] operator, it is only used on Windows, where there is no
 // performance issue by using it.
 struct simd_data_sse{
     union{
-        __m128  sse_data;
-        float   float_data[4];
+        simd_native_sse sse_data;
+        float           float_data[4];
     };
 
     SORT_FORCEINLINE simd_data_sse(){}
-    SORT_FORCEINLINE simd_data_sse( const __m128& data ):sse_data(data){}
+    SORT_FORCEINLINE simd_data_sse( const simd_native_sse& data ):sse_data(data){}
     
     SORT_FORCEINLINE float  operator []( const int i ) const{
         return float_data[i];
@@ -58,7 +75,7 @@ struct simd_data_sse{
 };
 #endif
 
-SORT_STATIC_FORCEINLINE __m128 get_sse_data( const simd_data_sse& d ){
+SORT_STATIC_FORCEINLINE simd_native_sse get_sse_data( const simd_data_sse& d ){
 #ifdef SORT_IN_WINDOWS
     return d.sse_data;
 #else
@@ -67,9 +84,132 @@ SORT_STATIC_FORCEINLINE __m128 get_sse_data( const simd_data_sse& d ){
 }
 
 // zero tolerance in any extra size in this structure.
-static_assert( sizeof( simd_data_sse ) == sizeof( __m128 ) , "Incorrect SSE data size." );
+static_assert( sizeof( simd_data_sse ) == sizeof( simd_native_sse ) , "Incorrect SSE data size." );
+
+#if defined(SIMD_SSE_IMPLEMENTATION) && defined(NEON_ENABLED)
+
+static const float32x4_t sse_zeros      = vdupq_n_f32( 0.0f );
+static const float32x4_t sse_infinites  = vdupq_n_f32( FLT_MAX );
+static const float32x4_t sse_neg_ones   = vdupq_n_f32( -1.0f );
+static const float32x4_t sse_ones       = vdupq_n_f32( 1.0f );
+
+#define simd_data       simd_data_sse
+#define simd_ones       sse_ones
+#define simd_zeros      sse_zeros
+#define simd_neg_ones   sse_neg_ones
+#define simd_infinites  sse_infinites
+
+#define SIMD_CHANNEL    4
+#define SIMD_ALIGNMENT  16
+
+SORT_STATIC_FORCEINLINE float32x4_t neon_mask( const uint32x4_t mask ){
+    return vreinterpretq_f32_u32( mask );
+}
+SORT_STATIC_FORCEINLINE uint32x4_t  neon_bits( const simd_data& s ){
+    return vreinterpretq_u32_f32( get_sse_data(s) );
+}
+
+SORT_STATIC_FORCEINLINE simd_data   simd_zero(){
+    return vdupq_n_f32( 0.0f );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_set_ps1( const float d ){
+    return vdupq_n_f32( d );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_set_ps( const float d[] ){
+    return vld1q_f32( d );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_set_u8_ps( const unsigned char d[] ){
+    unsigned int packed;
+    memcpy( &packed , d , sizeof( packed ) );
+    const uint16x8_t d16 = vmovl_u8( vcreate_u8( packed ) );
+    return vcvtq_f32_u32( vmovl_u16( vget_low_u16( d16 ) ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_set_mask(const bool mask[]) {
+    const uint32_t m[4] = { mask[0] ? mask_true_i : 0u , mask[1] ? mask_true_i : 0u , mask[2] ? mask_true_i : 0u , mask[3] ? mask_true_i : 0u };
+    return neon_mask( vld1q_u32( m ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_add_ps( const simd_data& s0 , const simd_data& s1 ){
+    return vaddq_f32( get_sse_data(s0) , get_sse_data(s1) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_sub_ps( const simd_data& s0 , const simd_data& s1 ){
+    return vsubq_f32( get_sse_data(s0) , get_sse_data(s1) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_mul_ps( const simd_data& s0 , const simd_data& s1 ){
+    return vmulq_f32( get_sse_data(s0) , get_sse_data(s1) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_div_ps( const simd_data& s0 , const simd_data& s1 ){
+    return vdivq_f32( get_sse_data(s0) , get_sse_data(s1) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_sqr_ps( const simd_data& m ){
+    return vmulq_f32( get_sse_data(m) , get_sse_data(m) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_sqrt_ps( const simd_data& m ){
+    return vsqrtq_f32( get_sse_data(m) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_rcp_ps( const simd_data& m ){
+    return vdivq_f32( sse_ones , get_sse_data(m) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_mad_ps( const simd_data& a , const simd_data& b , const simd_data& c ){
+    // not fused on purpose, the result matches the SSE version
+    return vaddq_f32( vmulq_f32( get_sse_data(a) , get_sse_data(b) ) , get_sse_data(c) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_pick_ps( const simd_data& mask , const simd_data& a , const simd_data& b ){
+    return vbslq_f32( neon_bits(mask) , get_sse_data(a) , get_sse_data(b) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmpeq_ps( const simd_data& s0 , const simd_data& s1 ){
+    return neon_mask( vceqq_f32( get_sse_data(s0) , get_sse_data(s1) ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmpneq_ps( const simd_data& s0 , const simd_data& s1 ){
+    return neon_mask( vmvnq_u32( vceqq_f32( get_sse_data(s0) , get_sse_data(s1) ) ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmple_ps( const simd_data& s0 , const simd_data& s1 ){
+    return neon_mask( vcleq_f32( get_sse_data(s0) , get_sse_data(s1) ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmplt_ps( const simd_data& s0 , const simd_data& s1 ){
+    return neon_mask( vcltq_f32( get_sse_data(s0) , get_sse_data(s1) ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmpge_ps( const simd_data& s0 , const simd_data& s1 ){
+    return neon_mask( vcgeq_f32( get_sse_data(s0) , get_sse_data(s1) ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmpgt_ps( const simd_data& s0 , const simd_data& s1 ){
+    return neon_mask( vcgtq_f32( get_sse_data(s0) , get_sse_data(s1) ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_and_ps( const simd_data& s0 , const simd_data& s1 ){
+    return neon_mask( vandq_u32( neon_bits(s0) , neon_bits(s1) ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_or_ps( const simd_data& s0 , const simd_data& s1 ){
+    return neon_mask( vorrq_u32( neon_bits(s0) , neon_bits(s1) ) );
+}
+SORT_STATIC_FORCEINLINE int         simd_movemask_ps( const simd_data& mask ){
+    static const uint32_t bit_weights[4] = { 1u , 2u , 4u , 8u };
+    const uint32x4_t sign = vshrq_n_u32( neon_bits(mask) , 31 );
+    return (int)vaddvq_u32( vmulq_u32( sign , vld1q_u32( bit_weights ) ) );
+}
+// Unlike vminq_f32/vmaxq_f32, the second operand is returned if either of them is NaN, exactly like SSE. Slab tests
+// rely on it to skip NaN caused by axis aligned rays.
+SORT_STATIC_FORCEINLINE simd_data   simd_min_ps( const simd_data& s0 , const simd_data& s1 ){
+    return vbslq_f32( vcltq_f32( get_sse_data(s0) , get_sse_data(s1) ) , get_sse_data(s0) , get_sse_data(s1) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_max_ps( const simd_data& s0 , const simd_data& s1 ){
+    return vbslq_f32( vcgtq_f32( get_sse_data(s0) , get_sse_data(s1) ) , get_sse_data(s0) , get_sse_data(s1) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_minreduction_ps( const simd_data& s ){
+    const simd_data t_min = simd_min_ps( s , vrev64q_f32( get_sse_data(s) ) );
+    return simd_min_ps( t_min , vextq_f32( get_sse_data(t_min) , get_sse_data(t_min) , 2 ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_floor_ps( const simd_data& s ){
+    return vrndmq_f32( get_sse_data(s) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_exp2i_ps( const simd_data& n ){
+    return vreinterpretq_f32_s32( vshlq_n_s32( vaddq_s32( vcvtq_s32_f32( get_sse_data(n) ) , vdupq_n_s32( 127 ) ) , 23 ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_frexp_ps( const simd_data& s , simd_data& e ){
+    const uint32x4_t bits = neon_bits( s );
+    e = vcvtq_f32_s32( vsubq_s32( vreinterpretq_s32_u32( vshrq_n_u32( bits , 23 ) ) , vdupq_n_s32( 126 ) ) );
+    return neon_mask( vorrq_u32( vandq_u32( bits , vdupq_n_u32( 0x007fffff ) ) , vdupq_n_u32( 0x3f000000 ) ) );
+}
 
-#ifdef  SIMD_SSE_IMPLEMENTATION
+#elif defined(SIMD_SSE_IMPLEMENTATION)
 
 static const __m128 sse_zeros       = _mm_set_ps1( 0.0f );
 static const __m128 sse_infinites   = _mm_set_ps1( FLT_MAX );
@@ -99,6 +239,11 @@ SORT_STATIC_FORCEINLINE simd_data   simd_set_ps1( const float d ){
 SORT_STATIC_FORCEINLINE simd_data   simd_set_ps( const float d[] ){
     return _mm_set_ps( d[3] , d[2] , d[1] , d[0] );
 }
+SORT_STATIC_FORCEINLINE simd_data   simd_set_u8_ps( const unsigned char d[] ){
+    int packed;
+    memcpy( &packed , d , sizeof( packed ) );
+    return _mm_cvtepi32_ps( _mm_cvtepu8_epi32( _mm_cvtsi32_si128( packed ) ) );
+}
 SORT_STATIC_FORCEINLINE simd_data   simd_set_mask(const bool mask[]) {
 #define MASK_TO_INT(m)  (m?mask_true:0)
     return _mm_set_ps(MASK_TO_INT(mask[3]), MASK_TO_INT(mask[2]), MASK_TO_INT(mask[1]), MASK_TO_INT(mask[0]));
@@ -168,9 +313,20 @@ SORT_STATIC_FORCEINLINE simd_data   simd_minreduction_ps( const simd_data& s ){
     const __m128 t_min = _mm_min_ps( get_sse_data(s) , _mm_shuffle_ps( get_sse_data(s) , get_sse_data(s) , _MM_SHUFFLE(2, 3, 0, 1) ) );
     return _mm_min_ps( t_min , _mm_shuffle_ps(t_min, t_min, _MM_SHUFFLE(1, 0, 3, 2) ) );
 }
+SORT_STATIC_FORCEINLINE simd_data   simd_floor_ps( const simd_data& s ){
+    return _mm_floor_ps( get_sse_data(s) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_exp2i_ps( const simd_data& n ){
+    return _mm_castsi128_ps( _mm_slli_epi32( _mm_add_epi32( _mm_cvttps_epi32( get_sse_data(n) ) , _mm_set1_epi32( 127 ) ) , 23 ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_frexp_ps( const simd_data& s , simd_data& e ){
+    const __m128i bits = _mm_castps_si128( get_sse_data(s) );
+    e = _mm_cvtepi32_ps( _mm_sub_epi32( _mm_srli_epi32( bits , 23 ) , _mm_set1_epi32( 126 ) ) );
+    return _mm_castsi128_ps( _mm_or_si128( _mm_and_si128( bits , _mm_set1_epi32( 0x007fffff ) ) , _mm_set1_epi32( 0x3f000000 ) ) );
+}
 
 #endif // SIMD_SSE_IMPLEMENTATION
-#endif // SSE_ENABLED
+#endif // SSE_ENABLED || NEON_ENABLED
 
 #ifdef  AVX_ENABLED
 
@@ -197,6 +353,12 @@ struct simd_data_avx {
 };
 #endif
 
+// zero tolerance in any extra size in this structure.
+static_assert(sizeof(simd_data_avx) == sizeof(__m256), "Incorrect AVX data size.");
+
+#ifdef SIMD_AVX_IMPLEMENTATION
+
+// Passing AVX registers by value is only defined in the files compiled with AVX, other files may be compiled without it.
 SORT_STATIC_FORCEINLINE __m256 get_avx_data( const simd_data_avx& d ){
 #ifdef SORT_IN_WINDOWS
     return d.avx_data;
@@ -205,11 +367,6 @@ SORT_STATIC_FORCEINLINE __m256 get_avx_data( const simd_data_avx& d ){
 #endif
 }
 
-// zero tolerance in any extra size in this structure.
-static_assert(sizeof(simd_data_avx) == sizeof(__m256), "Incorrect AVX data size.");
-
-#ifdef SIMD_AVX_IMPLEMENTATION
-
 static const __m256 avx_zeros       = _mm256_set_ps(0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f);
 static const __m256 avx_infinites   = _mm256_set_ps(FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX );
 static const __m256 avx_neg_ones    = _mm256_set_ps(-1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f);
@@ -233,6 +390,13 @@ SORT_STATIC_FORCEINLINE simd_data   simd_set_ps1( const float f ){
 SORT_STATIC_FORCEINLINE simd_data   simd_set_ps( const float d[] ){
     return _mm256_set_ps( d[7] , d[6] , d[5] , d[4] , d[3] , d[2] , d[1] , d[0] );
 }
+SORT_STATIC_FORCEINLINE simd_data   simd_set_u8_ps( const unsigned char d[] ){
+    // AVX2 is not required, the bytes are expanded in two halves.
+    const __m128i bytes = _mm_loadl_epi64( (const __m128i*)d );
+    const __m128i lo = _mm_cvtepu8_epi32( bytes );
+    const __m128i hi = _mm_cvtepu8_epi32( _mm_srli_si128( bytes , 4 ) );
+    return _mm256_cvtepi32_ps( _mm256_insertf128_si256( _mm256_castsi128_si256( lo ) , hi , 1 ) );
+}
 SORT_STATIC_FORCEINLINE simd_data   simd_set_mask(const bool mask[]) {
 #define MASK_TO_INT(m)  (m?mask_true:0.0f)
     return _mm256_set_ps( MASK_TO_INT( mask[7] ) , MASK_TO_INT( mask[6] ) , MASK_TO_INT( mask[5] ) , MASK_TO_INT( mask[4] ) , MASK_TO_INT( mask[3] ) , MASK_TO_INT( mask[2] ) , MASK_TO_INT( mask[1] ) , MASK_TO_INT( mask[0] ) );
@@ -310,10 +474,187 @@ SORT_STATIC_FORCEINLINE simd_data   simd_minreduction_ps( const simd_data& s ){
     simd_data_avx reduced_data = _mm256_min_ps(shuffled, avx_data);
     return simd_set_ps1( reduced_data[0] < reduced_data[4] ? reduced_data[0] : reduced_data[4] );
 }
+SORT_STATIC_FORCEINLINE simd_data   simd_floor_ps( const simd_data& s ){
+    return _mm256_floor_ps( get_avx_data(s) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_exp2i_ps( const simd_data& n ){
+    // no 256 bits integer operation without AVX2, the exponents are built in two halves.
+    const __m256i ni = _mm256_cvttps_epi32( get_avx_data(n) );
+    const __m128i lo = _mm_slli_epi32( _mm_add_epi32( _mm256_castsi256_si128( ni ) , _mm_set1_epi32( 127 ) ) , 23 );
+    const __m128i hi = _mm_slli_epi32( _mm_add_epi32( _mm256_extractf128_si256( ni , 1 ) , _mm_set1_epi32( 127 ) ) , 23 );
+    return _mm256_castsi256_ps( _mm256_insertf128_si256( _mm256_castsi128_si256( lo ) , hi , 1 ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_frexp_ps( const simd_data& s , simd_data& e ){
+    const __m256i bits = _mm256_castps_si256( get_avx_data(s) );
+    const __m128i lo = _mm_sub_epi32( _mm_srli_epi32( _mm256_castsi256_si128( bits ) , 23 ) , _mm_set1_epi32( 126 ) );
+    const __m128i hi = _mm_sub_epi32( _mm_srli_epi32( _mm256_extractf128_si256( bits , 1 ) , 23 ) , _mm_set1_epi32( 126 ) );
+    e = _mm256_cvtepi32_ps( _mm256_insertf128_si256( _mm256_castsi128_si256( lo ) , hi , 1 ) );
+    const __m256 mantissa = _mm256_and_ps( get_avx_data(s) , _mm256_castsi256_ps( _mm256_set1_epi32( 0x007fffff ) ) );
+    return _mm256_or_ps( mantissa , _mm256_castsi256_ps( _mm256_set1_epi32( 0x3f000000 ) ) );
+}
+
+#endif
 
 #endif
 
+#ifdef  AVX512_ENABLED
+
+#include <immintrin.h>
+
+#ifndef SORT_IN_WINDOWS
+#define simd_data_avx512    __m512
+#else
+struct simd_data_avx512 {
+    union {
+        __m512  avx512_data;
+        float   float_data[16];
+    };
+
+    SORT_FORCEINLINE simd_data_avx512() {}
+    SORT_FORCEINLINE simd_data_avx512(const __m512& data) :avx512_data(data) {}
+
+    SORT_FORCEINLINE float  operator [](const int i) const {
+        return float_data[i];
+    }
+    SORT_FORCEINLINE float& operator [](const int i) {
+        return float_data[i];
+    }
+};
+#endif
+
+// zero tolerance in any extra size in this structure.
+static_assert(sizeof(simd_data_avx512) == sizeof(__m512), "Incorrect AVX-512 data size.");
+
+#ifdef SIMD_AVX512_IMPLEMENTATION
+
+SORT_STATIC_FORCEINLINE __m512 get_avx512_data( const simd_data_avx512& d ){
+#ifdef SORT_IN_WINDOWS
+    return d.avx512_data;
+#else
+    return d;
 #endif
+}
+
+static const __m512 avx512_zeros        = _mm512_set1_ps( 0.0f );
+static const __m512 avx512_infinites    = _mm512_set1_ps( FLT_MAX );
+static const __m512 avx512_neg_ones     = _mm512_set1_ps( -1.0f );
+static const __m512 avx512_ones         = _mm512_set1_ps( 1.0f );
+
+#define simd_data       simd_data_avx512
+#define simd_ones       avx512_ones
+#define simd_zeros      avx512_zeros
+#define simd_neg_ones   avx512_neg_ones
+#define simd_infinites  avx512_infinites
+
+#define SIMD_CHANNEL    16
+#define SIMD_ALIGNMENT  64
+
+// Only AVX-512F is required. Masks are still stored as full lanes, the same as SSE and AVX, so that the kernels shared by all
+// versions don't need to know about it. Comparisons, selections and mask extraction go through mask registers under the hood.
+SORT_STATIC_FORCEINLINE __mmask16   avx512_kmask( const simd_data& mask ){
+    return _mm512_test_epi32_mask( _mm512_castps_si512( get_avx512_data(mask) ) , _mm512_set1_epi32( (int)0x80000000 ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   avx512_lanes( const __mmask16 mask ){
+    return _mm512_castsi512_ps( _mm512_maskz_set1_epi32( mask , -1 ) );
+}
+
+SORT_STATIC_FORCEINLINE simd_data   simd_zero(){
+    return _mm512_setzero_ps();
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_set_ps1( const float f ){
+    return _mm512_set1_ps( f );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_set_ps( const float d[] ){
+    return _mm512_loadu_ps( d );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_set_u8_ps( const unsigned char d[] ){
+    return _mm512_cvtepi32_ps( _mm512_cvtepu8_epi32( _mm_loadu_si128( (const __m128i*)d ) ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_set_mask(const bool mask[]) {
+    __mmask16 k = 0;
+    for( auto i = 0 ; i < SIMD_CHANNEL ; ++i )
+        k |= mask[i] ? ( 1 << i ) : 0;
+    return avx512_lanes( k );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_add_ps( const simd_data& s0 , const simd_data& s1 ){
+    return _mm512_add_ps( get_avx512_data(s0) , get_avx512_data(s1) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_sub_ps( const simd_data& s0 , const simd_data& s1 ){
+    return _mm512_sub_ps( get_avx512_data(s0) , get_avx512_data(s1) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_mul_ps( const simd_data& s0 , const simd_data& s1 ){
+    return _mm512_mul_ps( get_avx512_data(s0) , get_avx512_data(s1) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_div_ps( const simd_data& s0 , const simd_data& s1 ){
+    return _mm512_div_ps( get_avx512_data(s0) , get_avx512_data(s1) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_sqr_ps( const simd_data& m ){
+    return _mm512_mul_ps( get_avx512_data(m) , get_avx512_data(m) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_sqrt_ps( const simd_data& m ){
+    return _mm512_sqrt_ps( get_avx512_data(m) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_rcp_ps( const simd_data& m ){
+    return _mm512_div_ps( avx512_ones , get_avx512_data(m) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_mad_ps( const simd_data& a , const simd_data& b , const simd_data& c ){
+    // no fused multiply-add, a node picking a different ISA should still produce exactly the same image.
+    return _mm512_add_ps( _mm512_mul_ps( get_avx512_data(a) , get_avx512_data(b) ) , get_avx512_data(c) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_pick_ps( const simd_data& mask , const simd_data& a , const simd_data& b ){
+    return _mm512_mask_blend_ps( avx512_kmask(mask) , get_avx512_data(b) , get_avx512_data(a) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmpeq_ps( const simd_data& s0 , const simd_data& s1 ){
+    return avx512_lanes( _mm512_cmp_ps_mask( get_avx512_data(s0) , get_avx512_data(s1) , _CMP_EQ_OQ ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmpneq_ps( const simd_data& s0 , const simd_data& s1 ){
+    return avx512_lanes( _mm512_cmp_ps_mask( get_avx512_data(s0) , get_avx512_data(s1) , _CMP_NEQ_OQ ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmple_ps( const simd_data& s0 , const simd_data& s1 ){
+    return avx512_lanes( _mm512_cmp_ps_mask( get_avx512_data(s0) , get_avx512_data(s1) , _CMP_LE_OQ ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmplt_ps( const simd_data& s0 , const simd_data& s1 ){
+    return avx512_lanes( _mm512_cmp_ps_mask( get_avx512_data(s0) , get_avx512_data(s1) , _CMP_LT_OQ ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmpge_ps( const simd_data& s0 , const simd_data& s1 ){
+    return avx512_lanes( _mm512_cmp_ps_mask( get_avx512_data(s0) , get_avx512_data(s1) , _CMP_GE_OQ ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_cmpgt_ps( const simd_data& s0 , const simd_data& s1 ){
+    return avx512_lanes( _mm512_cmp_ps_mask( get_avx512_data(s0) , get_avx512_data(s1) , _CMP_GT_OQ ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_and_ps( const simd_data& s0 , const simd_data& s1 ){
+    return _mm512_castsi512_ps( _mm512_and_si512( _mm512_castps_si512( get_avx512_data(s0) ) , _mm512_castps_si512( get_avx512_data(s1) ) ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_or_ps( const simd_data& s0 , const simd_data& s1 ){
+    return _mm512_castsi512_ps( _mm512_or_si512( _mm512_castps_si512( get_avx512_data(s0) ) , _mm512_castps_si512( get_avx512_data(s1) ) ) );
+}
+SORT_STATIC_FORCEINLINE int         simd_movemask_ps( const simd_data& mask ){
+    return (int)avx512_kmask( mask );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_min_ps( const simd_data& s0 , const simd_data& s1 ){
+    return _mm512_min_ps( get_avx512_data(s0) , get_avx512_data(s1) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_max_ps( const simd_data& s0 , const simd_data& s1 ){
+    return _mm512_max_ps( get_avx512_data(s0) , get_avx512_data(s1) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_minreduction_ps( const simd_data& s ){
+    return _mm512_set1_ps( _mm512_reduce_min_ps( get_avx512_data(s) ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_floor_ps( const simd_data& s ){
+    return _mm512_roundscale_ps( get_avx512_data(s) , _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_exp2i_ps( const simd_data& n ){
+    return _mm512_castsi512_ps( _mm512_slli_epi32( _mm512_add_epi32( _mm512_cvttps_epi32( get_avx512_data(n) ) , _mm512_set1_epi32( 127 ) ) , 23 ) );
+}
+SORT_STATIC_FORCEINLINE simd_data   simd_frexp_ps( const simd_data& s , simd_data& e ){
+    const __m512i bits = _mm512_castps_si512( get_avx512_data(s) );
+    e = _mm512_cvtepi32_ps( _mm512_sub_epi32( _mm512_srli_epi32( bits , 23 ) , _mm512_set1_epi32( 126 ) ) );
+    return _mm512_castsi512_ps( _mm512_or_si512( _mm512_and_si512( bits , _mm512_set1_epi32( 0x007fffff ) ) , _mm512_set1_epi32( 0x3f000000 ) ) );
+}
+
+#endif // SIMD_AVX512_IMPLEMENTATION
+
+#endif // AVX512_ENABLED
 
 SORT_STATIC_FORCEINLINE int __bsf(int v) {
 #ifdef SORT_IN_WINDOWS
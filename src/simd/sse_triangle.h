@@ -19,7 +19,7 @@
 
 #include "core/define.h"
 
-#ifdef  SSE_ENABLED
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
 #include "simd_wrapper.h"
 #include "simd_triangle.h"
 #endif
\ No newline at end of file
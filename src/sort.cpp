@@ -15,6 +15,11 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <fstream>
+#include <sstream>
+#include <atomic>
+#include <thread>
+#include <chrono>
 #include "sort.h"
 #include "core/globalconfig.h"
 #include "thirdparty/gtest/gtest.h"
@@ -22,8 +27,32 @@
 #include "core/scene.h"
 #include "sampler/random.h"
 #include "core/timer.h"
-#include "stream/fstream.h"
+#include "stream/mapstream.h"
+#include "stream/pstream.h"
 #include "material/tsl_system.h"
+#include "core/cpuinfo.h"
+#include "core/strid.h"
+#include "material/matmanager.h"
+#include "core/hash.h"
+#include "stream/sstream.h"
+#include "task/coordinator.h"
+#include "imagesensor/checkpoint.h"
+#include "imagesensor/relightcache.h"
+#include "core/memory.h"
+#include "task/telemetry.h"
+#include "task/timeline.h"
+#include "core/bundle.h"
+#include "camera/camera.h"
+#include "math/utils.h"
+
+// Seconds between two snapshots of live telemetry.
+static constexpr float TELEMETRY_INTERVAL = 0.5f;
+
+// Maximum number of events kept per worker in the timeline, about 2MB per worker.
+static constexpr unsigned int TIMELINE_CAPACITY = 65536;
+
+// Milliseconds between two checks of updates from the client while a frame is rendered in server mode.
+static constexpr unsigned int UPDATE_POLL_INTERVAL = 5;
 
 SORT_STATS_DEFINE_COUNTER(sRenderingTimeMS)
 SORT_STATS_DEFINE_COUNTER(sSamplePerPixel)
@@ -31,55 +60,398 @@ SORT_STATS_DEFINE_COUNTER(sThreadCnt)
 
 SORT_STATS_TIME("Performance", "Rendering Time", sRenderingTimeMS);
 SORT_STATS_AVG_RAY_SECOND("Performance", "Number of rays per second", sRayCount , sRenderingTimeMS);
+SORT_STATS_DEFINE_COUNTER(sPeakResidentMemory)
+SORT_STATS_COUNTER("Performance", "Peak Resident Memory (Bytes)", sPeakResidentMemory);
 SORT_STATS_COUNTER("Statistics", "Sample per Pixel", sSamplePerPixel);
 SORT_STATS_COUNTER("Performance", "Worker thread number", sThreadCnt);
 
-void SchedulTasks( Scene& scene , IStreamBase& stream ){
-    SORT_PROFILE("Schedule Tasks");
+static void scheduleRenderTasks( Scene& scene , const Task* pre_render_task ){
+    auto tiles = std::make_shared<std::vector<RenderTile>>();
+    ForEachTile( [&]( const Vector2i& tl , const Vector2i& size ){
+        // tiles resumed from a checkpoint continue with the samples they haven't taken yet
+        const auto sample_offset = g_imageSensor->GetTileSampleCnt( tl );
+        if( sample_offset >= g_samplePerPixel )
+            return;
+        RenderTile tile;
+        tile.coord = tl;
+        tile.size = size;
+        tile.sampleOffset = sample_offset;
+        tiles->push_back( tile );
+    });
+
+    // light paths have no pixel affinity, they are traced in batches of their own along with the tiles
+    if( !tiles->empty() )
+        ScheduleLightPaths( scene , pre_render_task );
 
+    // Without the prepass, tiles are rendered from the center of the image outwards. Radiance splatted by the prepass
+    // would land in the image, integrators splatting radiance don't take it.
+    if( !g_costPrepass || IS_PTR_INVALID(g_integrator) || g_integrator->NeedSplatting() ){
+        ScheduleRenderTiles( *tiles , scene , pre_render_task );
+        return;
+    }
+
+    std::vector<TaskHandle> prepass_tasks;
+    for( auto i = 0u ; i < (unsigned int)tiles->size() ; ++i )
+        prepass_tasks.push_back( SCHEDULE_TASK<TileCostPrepass_Task>( "tile cost prepass" , DEFAULT_TASK_PRIORITY , {pre_render_task} , scene , tiles , i ) );
+    SCHEDULE_TASK<TileScheduling_Task>( "tile scheduling" , DEFAULT_TASK_PRIORITY , prepass_tasks , scene , tiles );
+}
+
+// Schedule all tasks preparing the scene for rendering, it returns the last one of them.
+static TaskHandle schedulePreparationTasks( Scene& scene , IStreamBase& stream ){
     auto loading_task       = SCHEDULE_TASK<Loading_Task>( "Loading" , DEFAULT_TASK_PRIORITY, {} , scene, stream);
     auto sac_task           = SCHEDULE_TASK<SpatialAccelerationConstruction_Task>( "Spatial Data Structure Construction" , DEFAULT_TASK_PRIORITY, {loading_task} , scene);
     auto savc_task          = SCHEDULE_TASK<SpatialAccelerationVolConstruction_Task>( "Spatial Data Structure (Volume) Construction" , DEFAULT_TASK_PRIORITY, {loading_task} , scene);
-    auto pre_render_task    = SCHEDULE_TASK<PreRender_Task>( "Pre rendering pass" , DEFAULT_TASK_PRIORITY, {sac_task, savc_task} , scene);
-
-    // Push render task into the queue
-    const auto tilesize = (int)g_tileSize;
-    const auto width = (int)g_resultResollution[0];
-    const auto height = (int)g_resultResollution[1];
-
-    // get the number of total task
-    Vector2i tile_num = Vector2i( (int)ceil(width / (float)tilesize) , (int)ceil(height / (float)tilesize) );
-
-    // start tile from center instead of top-left corner
-    Vector2i cur_pos( tile_num / 2 );
-    int cur_dir = 0;
-    int cur_len = 0;
-    int cur_dir_len = 1;
-    const Vector2i dir[4] = { Vector2i( 0 , -1 ) , Vector2i( -1 , 0 ) , Vector2i( 0 , 1 ) , Vector2i( 1 , 0 ) };
-
-    unsigned int priority = DEFAULT_TASK_PRIORITY;
-    while (true){
-        // only process node inside the image region
-        if (cur_pos.x >= 0 && cur_pos.x < tile_num.x && cur_pos.y >= 0 && cur_pos.y < tile_num.y ){
-            Vector2i tl( cur_pos.x * tilesize , cur_pos.y * tilesize );
-            Vector2i size( (tilesize < (width - tl.x)) ? tilesize : (width - tl.x) ,
-                           (tilesize < (height - tl.y)) ? tilesize : (height - tl.y) );
-
-            SCHEDULE_TASK<Render_Task>( "render task" , priority-- , {pre_render_task} , tl , size , scene );
+    return SCHEDULE_TASK<PreRender_Task>( "Pre rendering pass" , DEFAULT_TASK_PRIORITY, {sac_task, savc_task} , scene);
+}
+
+void SchedulTasks( Scene& scene , IStreamBase& stream ){
+    SORT_PROFILE("Schedule Tasks");
+
+    auto pre_render_task = schedulePreparationTasks( scene , stream );
+    scheduleRenderTasks( scene , pre_render_task );
+}
+
+// Schedule another frame in server mode, the scene is already loaded and shaders are compiled. Spatial acceleration
+// structures are only refitted if something is moved.
+static void scheduleFrameTasks( Scene& scene , bool moved ){
+    SORT_PROFILE("Schedule Frame Tasks");
+
+    TaskHandle pre_render_task;
+    if( moved ){
+        auto refit_task = SCHEDULE_TASK<SpatialAccelerationRefit_Task>( "Spatial Data Structure Refitting" , DEFAULT_TASK_PRIORITY, {} , scene);
+        pre_render_task = SCHEDULE_TASK<PreRender_Task>( "Pre rendering pass" , DEFAULT_TASK_PRIORITY, {refit_task} , scene);
+    }else{
+        pre_render_task = SCHEDULE_TASK<PreRender_Task>( "Pre rendering pass" , DEFAULT_TASK_PRIORITY, {} , scene);
+    }
+
+    scheduleRenderTasks( scene , pre_render_task );
+}
+
+// Execute all scheduled tasks in all worker threads, it returns once all of them are done.
+static void executeTasks(){
+    std::vector< std::unique_ptr<WorkerThread> > threads;
+    for( unsigned i = 0 ; i < g_threadCnt - 1 ; ++i )
+        threads.push_back( std::make_unique<WorkerThread>( i + 1 ) );
+
+    // I/O workers come after compute workers, their ids don't collide with any per-thread data of compute workers
+    for( unsigned i = 0 ; i < g_ioThreadCnt ; ++i )
+        threads.push_back( std::make_unique<WorkerThread>( g_threadCnt + i , true ) );
+
+    // start all threads
+    for_each( threads.begin() , threads.end() , []( std::unique_ptr<WorkerThread>& thread ) { thread->BeginThread(); } );
+
+    SORT_STATS( TIMING_EVENT_STAT( "" , sRenderingTimeMS ) );
+    PinWorkerThread( 0 );
+    EXECUTING_TASKS();
+
+    // wait for all the threads to be finished
+    for_each( threads.begin() , threads.end() , []( std::unique_ptr<WorkerThread>& thread ) { thread->Join(); } );
+}
+
+// Execute tasks of a frame in server mode. Updates coming from the client while the frame is being rendered cancel it
+// right away, tiles in flight stop at the next sample and the rest are flushed without touching the scene.
+// It returns false if the frame is cancelled.
+static bool executeFrameTasks( const IStreamBase& stream ){
+    std::atomic<bool> done = { false };
+    std::thread watcher( [&](){
+        while( !done.load( std::memory_order_relaxed ) ){
+            if( stream.HasPendingData() ){
+                Render_Task::SetCancelled( true );
+                break;
+            }
+            std::this_thread::sleep_for( std::chrono::milliseconds( UPDATE_POLL_INTERVAL ) );
         }
+    });
+
+    executeTasks();
+
+    done.store( true , std::memory_order_relaxed );
+    watcher.join();
+
+    const auto cancelled = Render_Task::IsCancelled();
+    Render_Task::SetCancelled( false );
+    return !cancelled;
+}
+
+// Post process the image with all worker threads, they pick up tasks forked by the post process.
+static void postProcess(){
+    SCHEDULE_TASK<PostProcess_Task>( "Post Process" , DEFAULT_TASK_PRIORITY , {} );
+    executeTasks();
+}
+
+// Caches in a scene bundle are only used if the bundle is compiled from the same scene file, the bundle is ignored as a
+// whole otherwise.
+static void checkBundle( const IMappedFileStream* scene_file , std::uint64_t scene_hash ){
+    if( g_bundleDir.empty() || g_compileBundle )
+        return;
+    if( !scene_file || !CheckBundleManifest( g_bundleDir , scene_hash ) ){
+        slog( WARNING , GENERAL , "The scene bundle in %s is not used." , g_bundleDir.c_str() );
+        GlobalConfiguration::GetSingleton().DiscardBundle();
+    }
+}
+
+// Load the scene and build everything cached in the scene bundle, nothing is rendered. The manifest is written last so
+// that a bundle interrupted halfway is never picked up.
+static int compileBundle( IStreamBase& stream , const IMappedFileStream* scene_file , std::uint64_t scene_hash ){
+    if( !scene_file ){
+        slog( WARNING , GENERAL , "A scene bundle needs a scene file to identify the scene, nothing is compiled." );
+        return -1;
+    }
+
+    if( !PrepareBundleDir( g_bundleDir ) ){
+        slog( WARNING , GENERAL , "Failed to create the scene bundle in %s." , g_bundleDir.c_str() );
+        return -1;
+    }
+
+    CreateTSLThreadContexts();
+    Scheduler::GetSingleton().SetupWorkers( g_threadCnt );
+
+    Scene scene;
+    auto loading_task = SCHEDULE_TASK<Loading_Task>( "Loading" , DEFAULT_TASK_PRIORITY, {} , scene, stream);
+    SCHEDULE_TASK<SpatialAccelerationConstruction_Task>( "Spatial Data Structure Construction" , DEFAULT_TASK_PRIORITY, {loading_task} , scene);
+    executeTasks();
 
-        // turn to the next direction
-        if (cur_len >= cur_dir_len){
-            cur_dir = (cur_dir + 1) % 4;
-            cur_len = 0;
-            cur_dir_len += 1 - cur_dir % 2;
+    DestroyTSLThreadContexts();
+
+    if( !WriteBundleManifest( g_bundleDir , scene_hash ) ){
+        slog( WARNING , GENERAL , "Failed to write the manifest of the scene bundle in %s." , g_bundleDir.c_str() );
+        return -1;
+    }
+    slog( INFO , GENERAL , "Scene %s is compiled into the bundle in %s." , g_inputFilePath.c_str() , g_bundleDir.c_str() );
+    return 0;
+}
+
+// Views of a multi-view job. They are listed in a file, one per line with the eye, the target and the up direction, or
+// they are evenly spaced on a turntable around the target of the camera in the scene, about its up direction.
+static std::vector<CameraView> makeViews( const Camera& camera ){
+    std::vector<CameraView> views;
+    if( !g_viewsFilePath.empty() ){
+        std::ifstream file( g_viewsFilePath );
+        if( !file )
+            slog( WARNING , GENERAL , "Failed to open the file of views %s." , g_viewsFilePath.c_str() );
+
+        std::string line;
+        while( std::getline( file , line ) ){
+            if( line.empty() || line[0] == '#' )
+                continue;
+            std::istringstream values( line );
+            CameraView view;
+            if( values >> view.eye.x >> view.eye.y >> view.eye.z >> view.target.x >> view.target.y >> view.target.z >> view.up.x >> view.up.y >> view.up.z )
+                views.push_back( view );
+            else
+                slog( WARNING , GENERAL , "Invalid view '%s' is skipped." , line.c_str() );
         }
+        return views;
+    }
+
+    CameraView base;
+    if( !camera.GetView( base ) )
+        return views;
 
-        cur_pos += dir[cur_dir];
-        ++cur_len;
-        if( (cur_pos.x < 0 || cur_pos.x >= tile_num.x ) && (cur_pos.y < 0 || cur_pos.y >= tile_num.y ) )
+    // Rodrigues' rotation of the offset from the target about the up direction
+    const auto axis = normalize( base.up );
+    const auto offset = base.eye - base.target;
+    for( auto i = 0u ; i < g_turntableFrames ; ++i ){
+        const auto angle = TWO_PI * (float)i / (float)g_turntableFrames;
+        const auto c = cos( angle ) , s = sin( angle );
+        auto view = base;
+        view.eye = base.target + offset * c + cross( axis , offset ) * s + axis * ( dot( axis , offset ) * ( 1.0f - c ) );
+        views.push_back( view );
+    }
+    return views;
+}
+
+// Name of the output file of a view, the index of the view goes right before the extension.
+static std::string viewOutputFileName( const std::string& name , unsigned int index ){
+    char suffix[16];
+    snprintf( suffix , sizeof( suffix ) , "_%03u" , index );
+    const auto dot_pos = name.find_last_of( '.' );
+    const auto slash_pos = name.find_last_of( "/\\" );
+    if( dot_pos == std::string::npos || ( slash_pos != std::string::npos && dot_pos < slash_pos ) )
+        return name + suffix;
+    return name.substr( 0 , dot_pos ) + suffix + name.substr( dot_pos );
+}
+
+// Render all views of a multi-view job with the scene loaded once. Spatial acceleration structures and compiled shaders
+// are shared by all views, each of them only restarts the image and prepares the camera and the integrator again.
+static void renderViews( Scene& scene , IStreamBase& stream ){
+    schedulePreparationTasks( scene , stream );
+    executeTasks();
+
+    const auto camera = scene.GetCamera();
+    const auto views = IS_PTR_VALID( camera ) ? makeViews( *camera ) : std::vector<CameraView>();
+    if( views.empty() ){
+        slog( WARNING , GENERAL , "There is no view to render, only the camera in the scene is rendered." );
+        scheduleFrameTasks( scene , false );
+        executeTasks();
+        postProcess();
+        return;
+    }
+
+    const auto output_name = g_outputFileName;
+    for( auto i = 0u ; i < (unsigned int)views.size() ; ++i ){
+        if( !camera->SetView( views[i] ) ){
+            slog( WARNING , GENERAL , "The camera in the scene can't be moved, only its own view is rendered." );
             break;
+        }
+        slog( INFO , GENERAL , "Rendering view %u of %u." , i + 1 , (unsigned int)views.size() );
+
+        GlobalConfiguration::GetSingleton().SetOutputFileName( viewOutputFileName( output_name , i ) );
+        if( i > 0 )
+            g_imageSensor->Restart();
+        scheduleFrameTasks( scene , false );
+        executeTasks();
+        postProcess();
     }
+    GlobalConfiguration::GetSingleton().SetOutputFileName( output_name );
+}
+
+// Apply updates of the scene coming from the stream in server mode until the next frame is requested.
+// It returns false if the server needs to quit. 'lights_only' tells whether nothing but strength and color of lights changed.
+static bool receiveUpdates( Scene& scene , IStreamBase& stream , bool& moved , bool& lights_only ){
+    while( true ){
+        StringID command;
+        stream >> command;
+
+        if( SID("Render") == command )
+            return true;
+
+        if( SID("Update Camera") == command ){
+            auto index = 0u;
+            stream >> index;
+            lights_only = false;
+            if( !scene.UpdateEntity( index , stream ) ){
+                slog( WARNING , GENERAL , "There is no camera entity %d, the stream is broken." , index );
+                return false;
+            }
+        }else if( SID("Update Transform") == command ){
+            auto index = 0u;
+            Transform transform;
+            stream >> index >> transform;
+            lights_only = false;
+            if( scene.UpdateTransform( index , transform ) )
+                moved = true;
+            else
+                slog( WARNING , GENERAL , "There is no entity %d to be moved." , index );
+        }else if( SID("Update Light") == command ){
+            auto index = 0u;
+            auto energy = 0.0f;
+            Spectrum color;
+            stream >> index >> energy >> color;
+            if( !scene.UpdateLight( index , energy , color ) )
+                slog( WARNING , GENERAL , "There is no light entity %d to be updated." , index );
+        }else if( SID("Update Material") == command ){
+            lights_only = false;
+            if( !MatManager::GetSingleton().UpdateMaterial( stream ) )
+                slog( WARNING , MATERIAL , "Material to be updated is not found." );
+        }else{
+            // 'Quit' is sent once the client is done, reaching the end of the stream means the same.
+            return false;
+        }
+    }
+}
+
+// Run as a worker of distributed rendering. The scene file comes from the coordinator, tiles handed out by the
+// coordinator are rendered with all threads and sent back one by one as soon as they are done.
+static int runWorker(){
+    const auto& address = g_coordinatorAddress;
+    const auto colon = address.rfind( ':' );
+    const auto host = colon == std::string::npos ? std::string( "localhost" ) : address.substr( 0 , colon );
+    const auto port = atoi( colon == std::string::npos ? address.c_str() : address.c_str() + colon + 1 );
+
+    Socket socket;
+    if( port <= 0 || !socket.Connect( host , (unsigned short)port ) ){
+        slog( WARNING , GENERAL , "Failed to connect to the coordinator %s." , address.c_str() );
+        return -1;
+    }
+
+    ISocketStream input_stream( socket );
+    OSocketStream output_stream( socket );
+    IStreamBase& input = input_stream;
+    OStreamBase& output = output_stream;
+
+    StringID command;
+    std::string scene_file;
+    unsigned int hash_low = 0 , hash_high = 0;
+    input >> command >> scene_file >> hash_low >> hash_high;
+    if( SID("Scene") != command ){
+        slog( WARNING , GENERAL , "The coordinator %s doesn't send the scene." , address.c_str() );
+        return -1;
+    }
+
+    // the scene file is shared by all machines, it is not worth rendering if it is changed since the coordinator loads it.
+    IMappedFileStream stream( scene_file );
+    const auto hash = HashBytes( stream.GetData() , stream.GetSize() );
+    if( !stream.IsValid() || hash != ( ( (std::uint64_t)hash_high << 32 ) | hash_low ) ){
+        slog( WARNING , GENERAL , "Scene file %s is not the same as the one of the coordinator." , scene_file.c_str() );
+        output << SID("Invalid Scene");
+        output.Flush();
+        return -1;
+    }
+    GlobalConfiguration::GetSingleton().Serialize( stream );
+    checkBundle( &stream , hash );
+    static_cast<RemoteImage*>( g_imageSensor )->SetStream( &output_stream );
+
+    CreateTSLThreadContexts();
+    Scheduler::GetSingleton().SetupWorkers( g_threadCnt );
+
+    std::unique_ptr<Telemetry> telemetry;
+    if( g_telemetryPort > 0 ){
+        telemetry = std::make_unique<Telemetry>( (unsigned short)g_telemetryPort , TELEMETRY_INTERVAL );
+        telemetry->Start();
+    }
+
+    Scene scene;
+    schedulePreparationTasks( scene , stream );
+    executeTasks();
+
+    output << SID("Ready") << g_threadCnt;
+    output.Flush();
+
+    // 'Quit' is sent once all tiles are done, losing the coordinator means the same.
+    while( output_stream.IsValid() ){
+        auto cnt = 0u;
+        input >> command >> cnt;
+        if( SID("Render Tiles") != command )
+            break;
+
+        unsigned int priority = DEFAULT_TASK_PRIORITY;
+        for( auto i = 0u ; i < cnt ; ++i ){
+            Vector2i tl , size;
+            unsigned int sample_offset = 0 , sample_cnt = 0;
+            input >> tl.x >> tl.y >> size.x >> size.y >> sample_offset >> sample_cnt;
+            SCHEDULE_TASK<Render_Task>( "render task" , priority-- , {} , tl , size , scene , sample_offset , sample_cnt );
+        }
+        executeTasks();
+    }
+
+    if( telemetry )
+        telemetry->Stop();
+
+    DestroyTSLThreadContexts();
+
+    SORT_STATS(sPeakResidentMemory = (StatsInt)GetPeakResidentMemory());
+    RecordMemoryStats();
+
+    return 0;
+}
+
+// Set up what the process needs before anything is loaded, once the command line arguments are parsed.
+static void setupProcess(){
+    slog(INFO, GENERAL, "Number of CPU cores %d", std::thread::hardware_concurrency());
+    slog(INFO, GENERAL, "Widest SIMD instruction set of the CPU is %s.", GetSimdIsaName(GetSupportedSimdIsa()));
+    SetNumaAware( g_numaAware );
+    SetHugePagePolicy( g_hugePagePolicy );
+    SetMemoryBudget( MemoryCategory::Texture , (unsigned long long)g_textureBudget * 1024ull * 1024ull );
+    SetMemoryBudget( MemoryCategory::Accelerator , (unsigned long long)g_acceleratorBudget * 1024ull * 1024ull );
+    if( g_numaAware )
+        slog(INFO, GENERAL, "NUMA awareness is enabled with %d nodes.", GetNumaNodeCnt());
+    #ifdef SORT_ENABLE_STATS_COLLECTION
+        slog(INFO, GENERAL, "Stats collection is enabled.");
+    #else
+        slog(INFO, GENERAL, "Stats collection is disabled.");
+    #endif
+    slog(INFO, GENERAL, "Profiling system is %s.", SORT_PROFILE_ISENABLED ? "enabled" : "disabled");
 }
 
 int RunSORT( int argc , char** argv ){
@@ -92,20 +464,76 @@ int RunSORT( int argc , char** argv ){
 
     if (!valid_args) {
         slog(INFO, GENERAL, "There is not enough command line arguments.");
-        slog(INFO, GENERAL, "  --input:<filename>   Specify the sort input file.");
+        slog(INFO, GENERAL, "  --input:<filename>   Specify the sort input file, '-' streams it from the standard input.");
         slog(INFO, GENERAL, "  --blendermode        SORT is triggered from Blender.");
+        slog(INFO, GENERAL, "  --server             Keep the scene resident and render more frames with updates from the input.");
+        slog(INFO, GENERAL, "  --coordinator:<port> Hand out tiles to workers connecting to the port instead of rendering them.");
+        slog(INFO, GENERAL, "  --worker:<host:port> Render tiles handed out by the coordinator.");
+        slog(INFO, GENERAL, "  --workertimeout:<s>  Seconds before a worker not responding is dropped by the coordinator.");
         slog(INFO, GENERAL, "  --unittest           Run unit tests.");
         slog(INFO, GENERAL, "  --nomaterial         Disable materials in SORT.");
+        slog(INFO, GENERAL, "  --alphamask          Bake the alpha of cut-out materials in bit masks tested during traversal.");
+        slog(INFO, GENERAL, "  --stochasticcoat     Evaluate one layer of coated surfaces picked by its energy instead of all of them.");
+        slog(INFO, GENERAL, "  --randomwalksss      Trace subsurface scattering as a random walk inside objects instead of a diffusion profile.");
+        slog(INFO, GENERAL, "  --compactmesh        Keep normals, tangents and UVs of meshes in a compact format to save memory.");
+        slog(INFO, GENERAL, "  --cleanmesh          Drop degenerate triangles, weld identical vertices and sort meshes along a Morton curve.");
+        slog(INFO, GENERAL, "  --stochastictexture  Fetch one texel per texture lookup in shaders, picked by its bilinear weight, instead of four.");
+        slog(INFO, GENERAL, "  --relight            Keep pixels split by lights in server mode, so that edits of lights show up without rendering again.");
+        slog(INFO, GENERAL, "  --lod:<pixels>       Simplify meshes far away from the camera, with about the given error in pixels.");
+        slog(INFO, GENERAL, "  --dedupmesh          Share identical meshes as instances of one mesh instead of keeping a copy of each.");
+        slog(INFO, GENERAL, "  --lbvh:<scope>       Build BVHs along a Morton curve, faster to build but slower to trace, 'scene', 'objects' or both by default.");
+        slog(INFO, GENERAL, "  --camerasah:<w>      Weight the cost of BVH nodes of the scene by camera rays, w times as many as uniform rays, 0 by default.");
+        slog(INFO, GENERAL, "  --optbvh             Collapse QBVH/OBVH from a restructured binary BVH, slower to build but faster to trace.");
+        slog(INFO, GENERAL, "  --subdcache:<MB>     Memory budget of the tessellations of subdivision surfaces, 1024 by default.");
+        slog(INFO, GENERAL, "  --geometrybudget:<MB> Memory budget of instanced meshes, the rest of them are paged out to a temporary file.");
+        slog(INFO, GENERAL, "  --texturebudget:<MB> Memory budget of image textures, textures are loaded at lower resolutions beyond it.");
+        slog(INFO, GENERAL, "  --texturecompression Keep 8 bit image textures in BC1 blocks, or BC3 blocks with alpha, at a fraction of the memory.");
+        slog(INFO, GENERAL, "  --accelbudget:<MB>   Memory budget of acceleration structures, nodes are compressed beyond it.");
+        slog(INFO, GENERAL, "  --numa               Pin worker threads and interleave the acceleration structure across NUMA nodes.");
+        slog(INFO, GENERAL, "  --costprepass        Estimate the cost of tiles in a prepass, expensive tiles are rendered first.");
+        slog(INFO, GENERAL, "  --deferredbounces    Trace secondary bounces of camera ray packets in batches sorted by coherence.");
+        slog(INFO, GENERAL, "  --interleaved        Trace batches of secondary rays with several rays interleaved to hide memory latency.");
+        slog(INFO, GENERAL, "  --preview            Trade accuracy for speed, diffuse bounces are cut short with a radiance cache.");
+        slog(INFO, GENERAL, "  --pyramid            Show the image at 1/8, 1/4 and 1/2 of the resolution before the first full pass.");
+        slog(INFO, GENERAL, "  --pixelorder:<mode>  Order of pixels in a tile, 'scanline', 'morton' or 'interleaved' samples along a Morton curve, scanline by default.");
+        slog(INFO, GENERAL, "  --hugepages:<mode>   Huge pages of large structures, 'off', 'transparent' or 'explicit', transparent by default.");
         slog(INFO, GENERAL, "  --profiling:<on|off> Toggling profiling option, false by default.");
+        slog(INFO, GENERAL, "  --accelcache:<file>  Cache the spatial acceleration structure in the file.");
+        slog(INFO, GENERAL, "  --skycache:<file>    Cache the sampling tables of the sky light in the file.");
+        slog(INFO, GENERAL, "  --sharedcache:<dir>  Share decoded textures with other processes on the machine through the directory, like /dev/shm.");
+        slog(INFO, GENERAL, "  --warmstart:<dir>    Keep the path guiding tree and the radiance cache in the directory, the next rendering starts with them.");
+        slog(INFO, GENERAL, "  --warmdecay:<x>      Fraction of the trust in the kept structures left each time they are reused, 0.5 by default.");
+        slog(INFO, GENERAL, "  --compile:<dir>      Load the scene and compile what it takes to render it in a bundle, nothing is rendered.");
+        slog(INFO, GENERAL, "  --bundle:<dir>       Render with the bundle compiled from the same scene file, caches not specified go to it.");
+        slog(INFO, GENERAL, "  --views:<file>       Render the views listed in the file, one per line with the eye, the target and the up direction.");
+        slog(INFO, GENERAL, "  --turntable:<n>      Render n views evenly spaced around the target of the camera, about its up direction.");
+        slog(INFO, GENERAL, "  --checkpoint:<file>  Save the image being rendered in the file periodically.");
+        slog(INFO, GENERAL, "  --checkpointinterval:<s> Seconds between two checkpoints, 600 by default.");
+        slog(INFO, GENERAL, "  --resume             Resume rendering from the checkpoint file.");
+        slog(INFO, GENERAL, "  --aov:<names>        Write AOVs in the exr file, like 'albedo,normal,depth,direct,indirect,samplecount,outlier', 'cost' or 'all'.");
+        slog(INFO, GENERAL, "  --denoiser[:<class>] Denoise the image, 'BilateralDenoiser' by default.");
+        slog(INFO, GENERAL, "  --pixelfilter[:<class>] Weight samples in the pixels around them, 'GaussianFilter' by default, 'BlackmanHarrisFilter' is sharper.");
+        slog(INFO, GENERAL, "  --robust[:<n>]       Split the samples of each pixel into n buckets and take the median of their means, 8 by default, it replaces clamping.");
+        slog(INFO, GENERAL, "  --bucket             Stream tiles to a tiled exr file as they are done, nothing covering the whole image is kept in memory.");
+        slog(INFO, GENERAL, "  --telemetry:<port>   Serve live telemetry, like rays per second and remaining time, as JSON through HTTP.");
+        slog(INFO, GENERAL, "  --stats:<file>       Export stats, including histograms and task timings, in a JSON file.");
+        slog(INFO, GENERAL, "  --trace:<file>       Export the timeline of tasks and idle workers as a Chrome trace, viewable in Perfetto.");
+        slog(INFO, GENERAL, "  --iothreads:<n>      Number of extra threads loading resources, so that disk latency doesn't park a core, 4 by default.");
+        slog(INFO, GENERAL, "  --threads:<n>        Override the number of threads of the scene, the same goes for the options below.");
+        slog(INFO, GENERAL, "  --spp:<n>            Override the number of samples per pixel.");
+        slog(INFO, GENERAL, "  --region:<x0,y0,x1,y1> Render only the pixels in the region, the rest of the image stays black.");
+        slog(INFO, GENERAL, "  --tilesize:<n|auto>  Override the tile size, 'auto' picks one from the resolution and the number of threads.");
+        slog(INFO, GENERAL, "  --accelerator:<class> Override the spatial acceleration structure, it takes its default settings.");
+        slog(INFO, GENERAL, "  --raydevice:<lib>    Offload large batches of rays to the ray traversal device in a shared library.");
+        slog(INFO, GENERAL, "  --integrator:<class> Override the integrator, it takes its default settings.");
+        slog(INFO, GENERAL, "  --sampler:<class>    Override the sampler.");
         return -1;
     }else{
-        slog(INFO, GENERAL, "Number of CPU cores %d", std::thread::hardware_concurrency());
-        #ifdef SORT_ENABLE_STATS_COLLECTION
-            slog(INFO, GENERAL, "Stats collection is enabled.");
-        #else
-            slog(INFO, GENERAL, "Stats collection is disabled.");
-        #endif
-        slog(INFO, GENERAL, "Profiling system is %s.", SORT_PROFILE_ISENABLED ? "enabled" : "disabled");
+        setupProcess();
+
+        // serial phases like loading the scene are recorded too
+        if( !g_traceFilePath.empty() )
+            Timeline::GetSingleton().Enable( TIMELINE_CAPACITY );
     }
 
     // Run in unit test mode if required.
@@ -116,38 +544,211 @@ int RunSORT( int argc , char** argv ){
         return ret;
     }
 
-    // Load the global configuration from stream
-    IFileStream stream( g_inputFilePath );
+    // Load the global configuration from stream, the scene file is memory mapped so that bulk data is loaded without parsing.
+    // Blender streams the scene through a pipe instead, so that the scene is parsed while it is still being exported.
+    if( !g_coordinatorAddress.empty() )
+        return runWorker();
+
+    std::unique_ptr<IStreamBase> input_stream;
+    const IMappedFileStream* scene_file = nullptr;
+    if( g_inputFilePath == "-" ){
+        input_stream = std::make_unique<IPipeStream>();
+    }else{
+        auto mapped_stream = std::make_unique<IMappedFileStream>( g_inputFilePath );
+        scene_file = mapped_stream.get();
+        input_stream = std::move( mapped_stream );
+    }
+    auto& stream = *input_stream;
     GlobalConfiguration::GetSingleton().Serialize(stream);
 
+    // The scene file identifies the scene for caches, checkpoints and workers of distributed rendering.
+    const auto scene_hash = scene_file ? HashBytes( scene_file->GetData() , scene_file->GetSize() ) : 0ull;
+    if( g_compileBundle )
+        return compileBundle( stream , scene_file , scene_hash );
+    checkBundle( scene_file , scene_hash );
+
+    // The coordinator doesn't load the scene, workers load it from the same file. Radiance splatted from light paths
+    // lands anywhere in the image, integrators splatting it are rendered locally instead.
+    if( g_coordinatorPort > 0 ){
+        if( !scene_file )
+            slog( WARNING , GENERAL , "Distributed rendering needs a scene file accessible by all workers, it is rendered locally." );
+        else if( IS_PTR_VALID(g_integrator) && g_integrator->NeedSplatting() )
+            slog( WARNING , GENERAL , "Distributed rendering doesn't support integrators splatting radiance, it is rendered locally." );
+        else{
+            Coordinator coordinator( g_inputFilePath , scene_hash );
+            if( coordinator.Render() ){
+                Scheduler::GetSingleton().SetupWorkers( g_threadCnt );
+                postProcess();
+                return 0;
+            }
+            slog( WARNING , GENERAL , "Failed to coordinate workers, the scene is rendered locally." );
+        }
+    }
+
+    // The image is saved periodically so that rendering could resume from it after a crash, a checkpoint is only resumed
+    // if it is taken from the same scene file.
+    std::unique_ptr<Checkpoint> checkpoint;
+    if( !g_checkpointFilePath.empty() ){
+        if( !scene_file ){
+            slog( WARNING , GENERAL , "Checkpoints need a scene file to identify the scene, they are disabled." );
+        }else{
+            checkpoint = std::make_unique<Checkpoint>( *g_imageSensor , g_checkpointFilePath , scene_hash , g_checkpointInterval );
+            if( g_resume )
+                slog( INFO , GENERAL , checkpoint->Load() ? "Rendering resumes from %s." : "Rendering starts from scratch, %s can't be resumed." , g_checkpointFilePath.c_str() );
+            checkpoint->Start();
+        }
+    }
+
     CreateTSLThreadContexts();
 
-    Scene scene;
-    // Schedule all tasks.
-    SchedulTasks( scene , stream );
+    // Each worker thread, including the main thread, owns a task queue.
+    Scheduler::GetSingleton().SetupWorkers( g_threadCnt );
 
-    std::vector< std::unique_ptr<WorkerThread> > threads;
-    for( unsigned i = 0 ; i < g_threadCnt - 1 ; ++i )
-        threads.push_back( std::make_unique<WorkerThread>( i + 1 ) );
+    // Live telemetry goes to Blender through the shared memory, and to anyone asking through HTTP with a port.
+    std::unique_ptr<Telemetry> telemetry;
+    if( g_blenderMode || g_telemetryPort > 0 ){
+        telemetry = std::make_unique<Telemetry>( (unsigned short)g_telemetryPort , TELEMETRY_INTERVAL );
+        telemetry->Start();
+    }
 
-    // start all threads
-    for_each( threads.begin() , threads.end() , []( std::unique_ptr<WorkerThread>& thread ) { thread->BeginThread(); } );
+    Scene scene;
+    if( g_multiView ){
+        // every view is post processed as soon as it is rendered
+        renderViews( scene , stream );
+    }else{
+        // Schedule all tasks.
+        SchedulTasks( scene , stream );
+        executeTasks();
 
-    {
-        SORT_STATS( TIMING_EVENT_STAT( "" , sRenderingTimeMS ) );
-        EXECUTING_TASKS();
+        if( checkpoint )
+            checkpoint->Stop();
 
-        // wait for all the threads to be finished
-        for_each( threads.begin() , threads.end() , []( std::unique_ptr<WorkerThread>& thread ) { thread->Join(); } );
+        // Post process for image sensor
+        postProcess();
+        RelightCache::GetSingleton().Finish();
     }
 
     SORT_STATS(sSamplePerPixel = g_samplePerPixel);
     SORT_STATS(sThreadCnt = g_threadCnt);
 
-    // Post process for image sensor
-    g_imageSensor->PostProcess();
+    // The scene, materials with their compiled shaders and spatial acceleration structures stay resident in server mode,
+    // each frame only executes tasks depending on what is updated.
+    while( g_serverMode ){
+        auto moved = false;
+        auto lights_only = true;
+        if( !receiveUpdates( scene , stream , moved , lights_only ) )
+            break;
+
+        // edits of lights alone are applied to the recorded frame right away, nothing is traced
+        auto& relight_cache = RelightCache::GetSingleton();
+        if( lights_only && relight_cache.IsComplete() ){
+            relight_cache.Relight( *g_imageSensor );
+            postProcess();
+            continue;
+        }
+
+        // a cancelled frame is not post processed, the next one starts over with the updates
+        g_imageSensor->Restart();
+        scheduleFrameTasks( scene , moved );
+        if( executeFrameTasks( stream ) ){
+            postProcess();
+            relight_cache.Finish();
+        }
+    }
+
+    if( telemetry )
+        telemetry->Stop();
 
     DestroyTSLThreadContexts();
 
+    SORT_STATS(sPeakResidentMemory = (StatsInt)GetPeakResidentMemory());
+    RecordMemoryStats();
+
     return 0;
 }
+
+RenderSession::RenderSession( const std::vector<std::string>& options ){
+    // options are parsed as command line arguments, the first one is always the executable
+    std::vector<std::string> args = { "sort" };
+    args.insert( args.end() , options.begin() , options.end() );
+    std::vector<char*> argv;
+    for( auto& arg : args )
+        argv.push_back( &arg[0] );
+    GlobalConfiguration::GetSingleton().ParseCommandLine( (int)argv.size() , argv.data() );
+
+    if( !g_profilingEnabled )
+        SORT_PROFILE_DISABLE;
+    setupProcess();
+}
+
+RenderSession::~RenderSession(){
+    if( m_scene )
+        DestroyTSLThreadContexts();
+}
+
+bool RenderSession::LoadScene( IStreamBase& stream ){
+    if( m_scene ){
+        slog( WARNING , GENERAL , "A scene is already loaded in the session." );
+        return false;
+    }
+
+    // the number of threads comes with the scene, workers are set up once it is known
+    GlobalConfiguration::GetSingleton().Serialize( stream );
+    CreateTSLThreadContexts();
+    Scheduler::GetSingleton().SetupWorkers( g_threadCnt );
+
+    // the application reads the image from memory, nothing is written to the output file of the scene
+    GlobalConfiguration::GetSingleton().SetOutputFileName( "" );
+
+    m_scene = std::make_unique<Scene>();
+    schedulePreparationTasks( *m_scene , stream );
+    executeTasks();
+    return true;
+}
+
+bool RenderSession::Render( TileCallback callback ){
+    if( !m_scene )
+        return false;
+
+    Render_Task::SetCancelled( false );
+    g_imageSensor->Restart();
+    g_imageSensor->SetTileCallback( std::move( callback ) );
+    scheduleFrameTasks( *m_scene , false );
+    executeTasks();
+    g_imageSensor->SetTileCallback( nullptr );
+
+    // an image cancelled halfway is left as it is, tiles not rendered keep whatever the last frame has
+    if( Render_Task::IsCancelled() )
+        return false;
+    postProcess();
+    return true;
+}
+
+void RenderSession::Cancel(){
+    Render_Task::SetCancelled( true );
+}
+
+TelemetrySnapshot RenderSession::QueryStats() const{
+    TelemetrySnapshot snapshot;
+    snapshot.elapsedTime = (float)m_timer.GetElapsedTime() / 1000.0f;
+
+    const auto& scheduler = Scheduler::GetSingleton();
+    for( auto i = 0u ; i < scheduler.GetWorkerCnt() ; ++i )
+        snapshot.rayCnt += scheduler.GetRayCnt( i );
+
+    if( IS_PTR_VALID(g_imageSensor) ){
+        snapshot.tracedSampleCnt = g_imageSensor->GetTracedSampleCnt();
+        snapshot.tilePassCnt = g_imageSensor->GetFinishedTilePassCnt();
+
+        Vector2i region_min , region_max;
+        GlobalConfiguration::GetSingleton().GetRenderRegion( region_min , region_max );
+        const auto expected = (std::uint64_t)( region_max.x - region_min.x ) * ( region_max.y - region_min.y ) * g_samplePerPixel;
+        snapshot.progress = expected > 0 ? (float)( (double)std::min( snapshot.tracedSampleCnt , expected ) / (double)expected ) : 0.0f;
+    }
+    snapshot.peakMemory = GetPeakResidentMemory();
+    return snapshot;
+}
+
+const RenderTarget& RenderSession::GetImage() const{
+    return g_imageSensor->GetRenderTarget();
+}
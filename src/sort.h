@@ -77,9 +77,76 @@
 
 #pragma once
 
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include "math/vector2.h"
+#include "task/telemetry.h"
+
+class IStreamBase;
+class Scene;
+class RenderTarget;
+
 //! @brief      Run SORT.
 //!
 //! @param  argc    Number of arguments, including the executable instance itself.
 //! @param  argv    The command arguments.
 //! @return         Return value of '0' means nothing goes wrong, otherwise there is something wrong.
-int     RunSORT( int argc , char** argv );
\ No newline at end of file
+int     RunSORT( int argc , char** argv );
+//! @brief  A render session embedded in another application, without spawning a process.
+/**
+ * The renderer keeps its configuration, materials and workers in singletons, there can only be one session alive in a
+ * process at a time. The scene is pushed through a stream, the same way as the scene file is loaded by the executable,
+ * a memory stream avoids writing it to disk. Once loaded, the scene, its acceleration structures and compiled shaders
+ * stay resident, it could be rendered as many times as needed.
+ *
+ * The executable and the session share everything but the handling of command line arguments and output files, a
+ * session keeps the image in memory until the application asks for it.
+ */
+class RenderSession{
+public:
+    //! @brief  The function called once a pass of a tile is merged, with the top-left corner and the size of the tile.
+    //!
+    //! It is called by worker threads, possibly at the same time.
+    using TileCallback = std::function<void( const Vector2i& , const Vector2i& )>;
+
+    //! @brief  Create a session, workers and thread contexts of shaders are set up here.
+    //!
+    //! @param  options     Options in the form of command line arguments, like '--threads:8', '--input' is not needed.
+    RenderSession( const std::vector<std::string>& options = {} );
+
+    //! @brief  Destroy the session, it waits for rendering to be done.
+    ~RenderSession();
+
+    //! @brief  Load the scene from a stream, the acceleration structures are built and shaders are compiled.
+    //!
+    //! @param  stream      The stream holding the scene, in the same format as scene files.
+    //! @return             Whether the scene is loaded.
+    bool    LoadScene( IStreamBase& stream );
+
+    //! @brief  Render the loaded scene, it returns once the image is done or rendering is cancelled.
+    //!
+    //! @param  callback    The function called once a pass of a tile is merged, it could be empty.
+    //! @return             'False' if there is no scene loaded or rendering is cancelled.
+    bool    Render( TileCallback callback = nullptr );
+
+    //! @brief  Cancel rendering, it could be called from any thread. Tiles in flight stop at the next sample.
+    void    Cancel();
+
+    //! @brief  Query how the rendering is going, it could be called from any thread.
+    //!
+    //! Rates are not measured between queries, only counters and the progress are filled.
+    //!
+    //! @return             Counters of the session.
+    TelemetrySnapshot   QueryStats() const;
+
+    //! @brief  Get the rendered image, it is only complete once rendering is done.
+    //!
+    //! @return             The image of the session.
+    const RenderTarget& GetImage() const;
+
+private:
+    std::unique_ptr<Scene>  m_scene;            /**< The loaded scene, it is null until a scene is loaded. */
+    Timer                   m_timer;            /**< Clock of the session, it starts along with the session. */
+};
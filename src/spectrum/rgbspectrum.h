@@ -22,6 +22,7 @@
 #include "core/define.h"
 #include "core/sassert.h"
 #include "math/utils.h"
+#include "spectrum/spectrum_simd.h"
 
 #define RGBSPECTRUM_SAMPLE      3
 
@@ -29,26 +30,41 @@
 /**
  * The color space is linear and sRGB. SORT doesn't support more advanced HDR color spaces, like
  * Rec 2020. All colors are in sRGB space and linear in SORT.
+ * With SSE enabled, the color is padded to four channels so that all arithmetic is done in one SIMD register. The
+ * fourth channel is only padding, its value is undefined and it never contributes to any result.
  */
 class   RGBSpectrum{
 public:
     //! @brief  Default constructor.
-    SORT_FORCEINLINE RGBSpectrum():r(0.0f),g(0.0f),b(0.0f){}
+    SORT_FORCEINLINE RGBSpectrum():RGBSpectrum(0.0f){}
 
     //! @brief  Conversion from tsl float3
-    SORT_FORCEINLINE RGBSpectrum(const Tsl_Namespace::float3& f3) : r(f3.x), g(f3.y), b(f3.z) {}
+    SORT_FORCEINLINE RGBSpectrum(const Tsl_Namespace::float3& f3) : RGBSpectrum(f3.x, f3.y, f3.z) {}
 
     //! @brief  Constructor from three float values.
     //!
     //! @param  r   Value in red channel.
     //! @param  g   Value in green channel.
     //! @param  b   Value in blue channel.
+#ifdef SSE_ENABLED
+    SORT_FORCEINLINE RGBSpectrum( float r , float g , float b ):m(_mm_set_ps(0.0f,b,g,r)){}
+#else
     SORT_FORCEINLINE RGBSpectrum( float r , float g , float b ):r(r),g(g),b(b){}
+#endif
 
     //! @brief  Constructor from a single value that propogates to all channels
     //!
     //! @param  g   Value to be propergated.
+#ifdef SSE_ENABLED
+    SORT_FORCEINLINE RGBSpectrum( float g ):m(_mm_set1_ps(g)){}
+
+    //! @brief  Constructor from a SIMD register.
+    //!
+    //! @param  v   Values of the channels, the fourth channel is padding.
+    SORT_FORCEINLINE explicit RGBSpectrum( const __m128 v ):m(v){}
+#else
     SORT_FORCEINLINE RGBSpectrum( float g ):RGBSpectrum(g,g,g){}
+#endif
 
     //! @brief  Get the value of the maximum channel.
     //!
@@ -63,7 +79,11 @@ public:
     //! @param  high    Maximum value of the range of clamping.
     //! @return         The clamped color.
     SORT_FORCEINLINE RGBSpectrum Clamp(float low, float high) const {
+#ifdef SSE_ENABLED
+        return RGBSpectrum( _mm_min_ps( _mm_max_ps( m , _mm_set1_ps( low ) ) , _mm_set1_ps( high ) ) );
+#else
         return RGBSpectrum(clamp(r, low, high), clamp(g,low,high), clamp(b,low,high));
+#endif
     }
 
     //! = operator
@@ -71,7 +91,11 @@ public:
     //! @param  color   Source color to copy from.
     //! @return         The copied color.
     const RGBSpectrum& operator = ( const RGBSpectrum& color ){
+#ifdef SSE_ENABLED
+        m = color.m;
+#else
         x = color.x; y = color.y; z = color.z;
+#endif
         return *this;
     }
 
@@ -117,14 +141,22 @@ public:
     //!
     //! @return     A color with each channel as exp of the original color.
     SORT_FORCEINLINE RGBSpectrum Exp() const {
-        return RGBSpectrum( exp( r ) , exp( g ) , exp( b ) );
+#ifdef SSE_ENABLED
+        return RGBSpectrum( spectrum_exp_ps( m ) );
+#else
+        return RGBSpectrum( FastExp( r ) , FastExp( g ) , FastExp( b ) );
+#endif
     }
 
     //! @brief  Return the squared root of each channel.
     //!
     //! @return     A color with each channel as squared root of the original color.
     SORT_FORCEINLINE RGBSpectrum Sqrt() const {
+#ifdef SSE_ENABLED
+        return RGBSpectrum( _mm_sqrt_ps( m ) );
+#else
         return RGBSpectrum( sqrt( r ) , sqrt( g ) , sqrt( b ) );
+#endif
     }
 
     //! @brief  Whether the color is valid.
@@ -148,6 +180,9 @@ public:
         struct{
             float data[3];
         };
+#ifdef SSE_ENABLED
+        __m128  m;
+#endif
     };
 
     static const RGBSpectrum    m_White;
@@ -157,90 +192,170 @@ public:
 #define FULL_WEIGHT         WHITE_SPECTRUM
 
 SORT_STATIC_FORCEINLINE RGBSpectrum operator + ( const RGBSpectrum& c0 , const RGBSpectrum& c1 ){
+#ifdef SSE_ENABLED
+    return RGBSpectrum( _mm_add_ps( c0.m , c1.m ) );
+#else
     return RGBSpectrum( c0.r + c1.r , c0.g + c1.g , c0.b + c1.b );
+#endif
 }
 
 SORT_STATIC_FORCEINLINE RGBSpectrum operator - ( const RGBSpectrum& c0 , const RGBSpectrum& c1 ){
+#ifdef SSE_ENABLED
+    return RGBSpectrum( _mm_sub_ps( c0.m , c1.m ) );
+#else
     return RGBSpectrum( c0.r - c1.r , c0.g - c1.g , c0.b - c1.b );
+#endif
 }
 
 SORT_STATIC_FORCEINLINE RGBSpectrum operator * ( const RGBSpectrum& c0 , const RGBSpectrum& c1 ){
+#ifdef SSE_ENABLED
+    return RGBSpectrum( _mm_mul_ps( c0.m , c1.m ) );
+#else
     return RGBSpectrum( c0.r * c1.r , c0.g * c1.g , c0.b * c1.b );
+#endif
 }
 
 SORT_STATIC_FORCEINLINE RGBSpectrum operator / ( const RGBSpectrum& c0 , const RGBSpectrum& c1 ){
+#ifdef SSE_ENABLED
+    return RGBSpectrum( _mm_div_ps( c0.m , c1.m ) );
+#else
     return RGBSpectrum( c0.r / c1.r , c0.g / c1.g , c0.b / c1.b );
+#endif
 }
 
 SORT_STATIC_FORCEINLINE RGBSpectrum operator + ( const RGBSpectrum& c0 , const float f ){
+#ifdef SSE_ENABLED
+    return RGBSpectrum( _mm_add_ps( c0.m , _mm_set1_ps( f ) ) );
+#else
     return RGBSpectrum( c0.r + f , c0.g + f , c0.b + f );
+#endif
 }
 
 SORT_STATIC_FORCEINLINE RGBSpectrum operator - ( const RGBSpectrum& c0 , const float f ){
+#ifdef SSE_ENABLED
+    return RGBSpectrum( _mm_sub_ps( c0.m , _mm_set1_ps( f ) ) );
+#else
     return RGBSpectrum( c0.r - f , c0.g - f , c0.b - f );
+#endif
 }
 
 SORT_STATIC_FORCEINLINE RGBSpectrum operator * ( const RGBSpectrum& c0 , const float f ){
+#ifdef SSE_ENABLED
+    return RGBSpectrum( _mm_mul_ps( c0.m , _mm_set1_ps( f ) ) );
+#else
     return RGBSpectrum( c0.r * f , c0.g * f , c0.b * f );
+#endif
 }
 
 SORT_STATIC_FORCEINLINE RGBSpectrum operator / ( const RGBSpectrum& c0 , const float f ){
+#ifdef SSE_ENABLED
+    return RGBSpectrum( _mm_div_ps( c0.m , _mm_set1_ps( f ) ) );
+#else
     return RGBSpectrum( c0.r / f , c0.g / f , c0.b / f );
+#endif
 }
 
 SORT_STATIC_FORCEINLINE RGBSpectrum operator + ( const float f , const RGBSpectrum& c0 ){
+#ifdef SSE_ENABLED
+    return RGBSpectrum( _mm_add_ps( _mm_set1_ps( f ) , c0.m ) );
+#else
     return RGBSpectrum( f + c0.r , f + c0.g , f + c0.b );
+#endif
 }
 
 SORT_STATIC_FORCEINLINE RGBSpectrum operator - ( const float f , const RGBSpectrum& c0 ){
+#ifdef SSE_ENABLED
+    return RGBSpectrum( _mm_sub_ps( _mm_set1_ps( f ) , c0.m ) );
+#else
     return RGBSpectrum( f - c0.r , f - c0.g , f - c0.b );
+#endif
 }
 
 SORT_STATIC_FORCEINLINE RGBSpectrum operator * ( const float f , const RGBSpectrum& c0 ){
+#ifdef SSE_ENABLED
+    return RGBSpectrum( _mm_mul_ps( _mm_set1_ps( f ) , c0.m ) );
+#else
     return RGBSpectrum( f * c0.r , f * c0.g , f * c0.b );
+#endif
 }
 
 SORT_STATIC_FORCEINLINE RGBSpectrum operator / ( const float f , const RGBSpectrum& c0 ){
+#ifdef SSE_ENABLED
+    return RGBSpectrum( _mm_div_ps( _mm_set1_ps( f ) , c0.m ) );
+#else
     return RGBSpectrum( f / c0.r , f / c0.g , f / c0.b );
+#endif
 }
 
 SORT_STATIC_FORCEINLINE RGBSpectrum operator += ( RGBSpectrum& c0 , const RGBSpectrum& c1 ){
+#ifdef SSE_ENABLED
+    c0.m = _mm_add_ps( c0.m , c1.m );
+#else
     c0.r += c1.r; c0.g += c1.g; c0.b += c1.b;
+#endif
     return c0;
 }
 
 SORT_STATIC_FORCEINLINE RGBSpectrum operator -= ( RGBSpectrum& c0 , const RGBSpectrum& c1 ){
+#ifdef SSE_ENABLED
+    c0.m = _mm_sub_ps( c0.m , c1.m );
+#else
     c0.r -= c1.r; c0.g -= c1.g; c0.b -= c1.b;
+#endif
     return c0;
 }
 
 SORT_STATIC_FORCEINLINE RGBSpectrum operator *= ( RGBSpectrum& c0 , const RGBSpectrum& c1 ){
+#ifdef SSE_ENABLED
+    c0.m = _mm_mul_ps( c0.m , c1.m );
+#else
     c0.r *= c1.r; c0.g *= c1.g; c0.b *= c1.b;
+#endif
     return c0;
 }
 
 SORT_STATIC_FORCEINLINE RGBSpectrum operator /= ( RGBSpectrum& c0 , const RGBSpectrum& c1 ){
+#ifdef SSE_ENABLED
+    c0.m = _mm_div_ps( c0.m , c1.m );
+#else
     c0.r /= c1.r; c0.g /= c1.g; c0.b /= c1.b;
+#endif
     return c0;
 }
 
 SORT_STATIC_FORCEINLINE RGBSpectrum operator += ( RGBSpectrum& c0 , const float f ){
+#ifdef SSE_ENABLED
+    c0.m = _mm_add_ps( c0.m , _mm_set1_ps( f ) );
+#else
     c0.r += f; c0.g += f; c0.b += f;
+#endif
     return c0;
 }
 
 SORT_STATIC_FORCEINLINE RGBSpectrum operator -= ( RGBSpectrum& c0 , const float f ){
+#ifdef SSE_ENABLED
+    c0.m = _mm_sub_ps( c0.m , _mm_set1_ps( f ) );
+#else
     c0.r -= f; c0.g -= f; c0.b -= f;
+#endif
     return c0;
 }
 
 SORT_STATIC_FORCEINLINE RGBSpectrum operator *= ( RGBSpectrum& c0 , const float f ){
+#ifdef SSE_ENABLED
+    c0.m = _mm_mul_ps( c0.m , _mm_set1_ps( f ) );
+#else
     c0.r *= f; c0.g *= f; c0.b *= f;
+#endif
     return c0;
 }
 
 SORT_STATIC_FORCEINLINE RGBSpectrum operator /= ( RGBSpectrum& c0 , const float f ){
+#ifdef SSE_ENABLED
+    c0.m = _mm_div_ps( c0.m , _mm_set1_ps( f ) );
+#else
     c0.r /= f; c0.g /= f; c0.b /= f;
+#endif
     return c0;
 }
 
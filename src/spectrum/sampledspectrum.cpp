@@ -0,0 +1,129 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cmath>
+#include "sampledspectrum.h"
+
+namespace {
+    constexpr float SMITS_LAMBDA_MIN    = 380.0f;
+    constexpr float SMITS_LAMBDA_MAX    = 720.0f;
+    constexpr int   SMITS_BIN_COUNT     = 10;
+
+    // Basis spectra from Smits, 'An RGB to spectrum conversion for reflectances', sampled between 380nm and 720nm.
+    constexpr float smits_white[]   = { 1.0000f, 1.0000f, 0.9999f, 0.9993f, 0.9992f, 0.9998f, 1.0000f, 1.0000f, 1.0000f, 1.0000f };
+    constexpr float smits_cyan[]    = { 0.9710f, 0.9426f, 1.0007f, 1.0007f, 1.0007f, 1.0007f, 0.1564f, 0.0000f, 0.0000f, 0.0000f };
+    constexpr float smits_magenta[] = { 1.0000f, 1.0000f, 0.9685f, 0.2229f, 0.0000f, 0.0458f, 0.8369f, 1.0000f, 1.0000f, 0.9959f };
+    constexpr float smits_yellow[]  = { 0.0001f, 0.0000f, 0.1088f, 0.6651f, 1.0000f, 1.0000f, 0.9996f, 0.9586f, 0.9685f, 0.9840f };
+    constexpr float smits_red[]     = { 0.1012f, 0.0515f, 0.0000f, 0.0000f, 0.0000f, 0.0000f, 0.8325f, 1.0149f, 1.0149f, 1.0149f };
+    constexpr float smits_green[]   = { 0.0000f, 0.0000f, 0.0273f, 0.7937f, 1.0000f, 0.9418f, 0.1719f, 0.0000f, 0.0000f, 0.0025f };
+    constexpr float smits_blue[]    = { 1.0000f, 1.0000f, 0.8916f, 0.3323f, 0.0000f, 0.0000f, 0.0003f, 0.0369f, 0.0483f, 0.0496f };
+
+    // Linear interpolation of a basis spectrum, wavelengths out of range clamp to the end points.
+    SORT_FORCEINLINE float smits_basis( const float* basis , const float lambda ){
+        const auto t = saturate( ( lambda - SMITS_LAMBDA_MIN ) / ( SMITS_LAMBDA_MAX - SMITS_LAMBDA_MIN ) ) * ( SMITS_BIN_COUNT - 1 );
+        const auto i = std::min( (int)t , SMITS_BIN_COUNT - 2 );
+        const auto f = t - (float)i;
+        return slerp( basis[i] , basis[i+1] , f );
+    }
+
+    SORT_FORCEINLINE float smits( const RGBSpectrum& rgb , const float lambda ){
+        const auto r = rgb.r , g = rgb.g , b = rgb.b;
+        if( r <= g && r <= b ){
+            const auto w = r * smits_basis( smits_white , lambda );
+            if( g <= b )
+                return w + ( g - r ) * smits_basis( smits_cyan , lambda ) + ( b - g ) * smits_basis( smits_blue , lambda );
+            return w + ( b - r ) * smits_basis( smits_cyan , lambda ) + ( g - b ) * smits_basis( smits_green , lambda );
+        }
+        if( g <= r && g <= b ){
+            const auto w = g * smits_basis( smits_white , lambda );
+            if( r <= b )
+                return w + ( r - g ) * smits_basis( smits_magenta , lambda ) + ( b - r ) * smits_basis( smits_blue , lambda );
+            return w + ( b - g ) * smits_basis( smits_magenta , lambda ) + ( r - b ) * smits_basis( smits_red , lambda );
+        }
+        const auto w = b * smits_basis( smits_white , lambda );
+        if( r <= g )
+            return w + ( r - b ) * smits_basis( smits_yellow , lambda ) + ( g - r ) * smits_basis( smits_green , lambda );
+        return w + ( g - b ) * smits_basis( smits_yellow , lambda ) + ( r - g ) * smits_basis( smits_red , lambda );
+    }
+
+    SORT_FORCEINLINE float piecewise_gaussian( const float x , const float mu , const float sigma0 , const float sigma1 ){
+        const auto t = ( x - mu ) / ( x < mu ? sigma0 : sigma1 );
+        return std::exp( -0.5f * t * t );
+    }
+
+    // Analytic fit of the CIE 1931 color matching functions from Wyman, Sloan and Shirley, 'Simple analytic
+    // approximations to the CIE XYZ color matching functions'.
+    SORT_FORCEINLINE void cie_xyz( const float lambda , float& x , float& y , float& z ){
+        x = 1.056f * piecewise_gaussian( lambda , 599.8f , 37.9f , 31.0f ) + 0.362f * piecewise_gaussian( lambda , 442.0f , 16.0f , 26.7f )
+          - 0.065f * piecewise_gaussian( lambda , 501.1f , 20.4f , 26.2f );
+        y = 0.821f * piecewise_gaussian( lambda , 568.8f , 46.9f , 40.5f ) + 0.286f * piecewise_gaussian( lambda , 530.9f , 16.3f , 31.1f );
+        z = 1.217f * piecewise_gaussian( lambda , 437.0f , 11.8f , 36.0f ) + 0.681f * piecewise_gaussian( lambda , 459.0f , 26.0f , 13.8f );
+    }
+
+    SORT_FORCEINLINE RGBSpectrum xyz_to_rgb( const float x , const float y , const float z ){
+        return RGBSpectrum(  3.2404542f * x - 1.5371385f * y - 0.4985314f * z ,
+                            -0.9692660f * x + 1.8760108f * y + 0.0415560f * z ,
+                             0.0556434f * x - 0.2040259f * y + 1.0572252f * z );
+    }
+
+    // Color of the constant spectrum, it is what a white surface should map to.
+    const RGBSpectrum& white_balance(){
+        static const RGBSpectrum white = [](){
+            float X = 0.0f, Y = 0.0f, Z = 0.0f;
+            for( auto lambda = SPECTRAL_LAMBDA_MIN + 0.5f ; lambda < SPECTRAL_LAMBDA_MAX ; lambda += 1.0f ){
+                float x, y, z;
+                cie_xyz( lambda , x , y , z );
+                X += x; Y += y; Z += z;
+            }
+            return xyz_to_rgb( X , Y , Z );
+        }();
+        return white;
+    }
+}
+
+SampledWavelengths SampledWavelengths::SampleHero( float u ){
+    constexpr auto range = SPECTRAL_LAMBDA_MAX - SPECTRAL_LAMBDA_MIN;
+    constexpr auto step = range / (float)SAMPLED_SPECTRUM_SAMPLE;
+
+    SampledWavelengths wl;
+    const auto hero = SPECTRAL_LAMBDA_MIN + u * range;
+    for( auto i = 0 ; i < SAMPLED_SPECTRUM_SAMPLE ; ++i ){
+        auto lambda = hero + step * (float)i;
+        if( lambda >= SPECTRAL_LAMBDA_MAX )
+            lambda -= range;
+        wl.lambda[i] = lambda;
+    }
+    wl.pdf = 1.0f / range;
+    return wl;
+}
+
+SampledSpectrum SampledSpectrum::FromRGB( const RGBSpectrum& rgb , const SampledWavelengths& wl ){
+    return SampledSpectrum( smits( rgb , wl.lambda[0] ) , smits( rgb , wl.lambda[1] ) , smits( rgb , wl.lambda[2] ) , smits( rgb , wl.lambda[3] ) );
+}
+
+RGBSpectrum SampledSpectrum::ToRGB( const SampledWavelengths& wl ) const{
+    // The pdf and the integral of the constant spectrum cancel each other except for the sample count and the step
+    // size of the white balance integration, which is one nanometer.
+    float X = 0.0f, Y = 0.0f, Z = 0.0f;
+    for( auto i = 0 ; i < SAMPLED_SPECTRUM_SAMPLE ; ++i ){
+        float x, y, z;
+        cie_xyz( wl.lambda[i] , x , y , z );
+        X += x * data[i]; Y += y * data[i]; Z += z * data[i];
+    }
+    const auto scale = 1.0f / ( wl.pdf * (float)SAMPLED_SPECTRUM_SAMPLE );
+    return xyz_to_rgb( X * scale , Y * scale , Z * scale ) / white_balance();
+}
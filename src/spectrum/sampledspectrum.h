@@ -0,0 +1,175 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include "core/define.h"
+#include "spectrum/rgbspectrum.h"
+
+#define SAMPLED_SPECTRUM_SAMPLE     4
+#define SPECTRAL_LAMBDA_MIN         360.0f
+#define SPECTRAL_LAMBDA_MAX         830.0f
+
+//! @brief  Wavelengths carried by one path in spectral mode.
+/**
+ * Hero wavelength sampling, a single uniformly distributed hero wavelength is picked per path and the other three
+ * wavelengths are rotated from it by a quarter of the visible range. All four of them share the same pdf, which keeps
+ * the estimator trivially simple and fills exactly one SIMD register.
+ */
+class SampledWavelengths{
+public:
+    //! @brief  Sample the wavelengths of a path.
+    //!
+    //! @param  u   Canonical random number that picks the hero wavelength.
+    //! @return     The four wavelengths in nanometers.
+    static SampledWavelengths SampleHero( float u );
+
+    float   lambda[SAMPLED_SPECTRUM_SAMPLE];    /**< Wavelengths in nanometers, the first one is the hero wavelength. */
+    float   pdf = 0.0f;                          /**< Pdf of each wavelength, it is the same for all of them. */
+};
+
+//! @brief  Spectral radiance or reflectance evaluated at the wavelengths of a path.
+/**
+ * It has exactly the same four-wide layout as RGBSpectrum with SSE enabled, except that the fourth lane is a real
+ * channel here. The arithmetic is the same so that switching a kernel between the two only changes the type.
+ */
+class SampledSpectrum{
+public:
+    //! @brief  Default constructor.
+    SORT_FORCEINLINE SampledSpectrum() : SampledSpectrum(0.0f) {}
+
+    //! @brief  Constructor from a single value that propogates to all channels.
+    //!
+    //! @param  v   Value to be propergated.
+#ifdef SSE_ENABLED
+    SORT_FORCEINLINE SampledSpectrum( const float v ) : m(_mm_set1_ps(v)) {}
+
+    //! @brief  Constructor from a SIMD register.
+    //!
+    //! @param  v   Values of the four channels.
+    SORT_FORCEINLINE explicit SampledSpectrum( const __m128 v ) : m(v) {}
+#else
+    SORT_FORCEINLINE SampledSpectrum( const float v ) { for( auto& d : data ) d = v; }
+#endif
+
+    //! @brief  Constructor from four values.
+    SORT_FORCEINLINE SampledSpectrum( const float v0 , const float v1 , const float v2 , const float v3 ){
+#ifdef SSE_ENABLED
+        m = _mm_set_ps( v3 , v2 , v1 , v0 );
+#else
+        data[0] = v0; data[1] = v1; data[2] = v2; data[3] = v3;
+#endif
+    }
+
+    //! @brief  Upsample a linear sRGB color to the wavelengths of a path.
+    //!
+    //! The conversion is the one from Smits, 'An RGB to spectrum conversion for reflectances'. A constant color
+    //! results in a constant spectrum.
+    //!
+    //! @param  rgb     Color in linear sRGB space.
+    //! @param  wl      Wavelengths to evaluate the spectrum at.
+    //! @return         The spectrum at the wavelengths.
+    static SampledSpectrum FromRGB( const RGBSpectrum& rgb , const SampledWavelengths& wl );
+
+    //! @brief  Monte Carlo estimation of the color of the spectrum.
+    //!
+    //! The result is white balanced so that a constant spectrum results in a gray color with the same value. Averaging
+    //! the result of many different wavelength samples converges to the color of the full spectrum.
+    //!
+    //! @param  wl      Wavelengths the spectrum is evaluated at.
+    //! @return         The color in linear sRGB space.
+    RGBSpectrum ToRGB( const SampledWavelengths& wl ) const;
+
+    //! @brief  Clamp all channels in a specific range.
+    SORT_FORCEINLINE SampledSpectrum Clamp( const float low , const float high ) const{
+#ifdef SSE_ENABLED
+        return SampledSpectrum( _mm_min_ps( _mm_max_ps( m , _mm_set1_ps( low ) ) , _mm_set1_ps( high ) ) );
+#else
+        return SampledSpectrum( clamp( data[0], low, high ) , clamp( data[1], low, high ) , clamp( data[2], low, high ) , clamp( data[3], low, high ) );
+#endif
+    }
+
+    //! @brief  Exponential of each channel.
+    SORT_FORCEINLINE SampledSpectrum Exp() const{
+#ifdef SSE_ENABLED
+        return SampledSpectrum( spectrum_exp_ps( m ) );
+#else
+        return SampledSpectrum( FastExp( data[0] ) , FastExp( data[1] ) , FastExp( data[2] ) , FastExp( data[3] ) );
+#endif
+    }
+
+    //! @brief  Whether all channels are zero.
+    SORT_FORCEINLINE bool IsBlack() const{
+        return data[0] == 0.0f && data[1] == 0.0f && data[2] == 0.0f && data[3] == 0.0f;
+    }
+
+    //! @brief  Average value of all channels.
+    SORT_FORCEINLINE float Average() const{
+        return ( data[0] + data[1] + data[2] + data[3] ) * 0.25f;
+    }
+
+    //! @brief  Get the value of the maximum channel.
+    SORT_FORCEINLINE float GetMaxComponent() const{
+        return std::max( std::max( data[0] , data[1] ) , std::max( data[2] , data[3] ) );
+    }
+
+    union{
+        float   data[SAMPLED_SPECTRUM_SAMPLE];
+#ifdef SSE_ENABLED
+        __m128  m;
+#endif
+    };
+};
+
+#ifdef SSE_ENABLED
+#define SAMPLED_SPECTRUM_OP(op,intrinsic) \
+SORT_STATIC_FORCEINLINE SampledSpectrum operator op ( const SampledSpectrum& s0 , const SampledSpectrum& s1 ){ \
+    return SampledSpectrum( intrinsic( s0.m , s1.m ) ); \
+} \
+SORT_STATIC_FORCEINLINE SampledSpectrum operator op ( const SampledSpectrum& s0 , const float f ){ \
+    return SampledSpectrum( intrinsic( s0.m , _mm_set1_ps( f ) ) ); \
+} \
+SORT_STATIC_FORCEINLINE SampledSpectrum operator op ( const float f , const SampledSpectrum& s0 ){ \
+    return SampledSpectrum( intrinsic( _mm_set1_ps( f ) , s0.m ) ); \
+} \
+SORT_STATIC_FORCEINLINE SampledSpectrum& operator op##= ( SampledSpectrum& s0 , const SampledSpectrum& s1 ){ \
+    s0.m = intrinsic( s0.m , s1.m ); \
+    return s0; \
+}
+#else
+#define SAMPLED_SPECTRUM_OP(op,intrinsic) \
+SORT_STATIC_FORCEINLINE SampledSpectrum operator op ( const SampledSpectrum& s0 , const SampledSpectrum& s1 ){ \
+    return SampledSpectrum( s0.data[0] op s1.data[0] , s0.data[1] op s1.data[1] , s0.data[2] op s1.data[2] , s0.data[3] op s1.data[3] ); \
+} \
+SORT_STATIC_FORCEINLINE SampledSpectrum operator op ( const SampledSpectrum& s0 , const float f ){ \
+    return s0 op SampledSpectrum( f ); \
+} \
+SORT_STATIC_FORCEINLINE SampledSpectrum operator op ( const float f , const SampledSpectrum& s0 ){ \
+    return SampledSpectrum( f ) op s0; \
+} \
+SORT_STATIC_FORCEINLINE SampledSpectrum& operator op##= ( SampledSpectrum& s0 , const SampledSpectrum& s1 ){ \
+    s0 = s0 op s1; \
+    return s0; \
+}
+#endif
+
+SAMPLED_SPECTRUM_OP(+,_mm_add_ps)
+SAMPLED_SPECTRUM_OP(-,_mm_sub_ps)
+SAMPLED_SPECTRUM_OP(*,_mm_mul_ps)
+SAMPLED_SPECTRUM_OP(/,_mm_div_ps)
+
+#undef SAMPLED_SPECTRUM_OP
@@ -0,0 +1,77 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "core/define.h"
+#if defined(SORT_IN_WINDOWS)
+    #include <Windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+#include "mapstream.h"
+
+IMappedFileStream::IMappedFileStream( const std::string& filename , bool sequential ){
+    // Map the whole file in read-only mode, the pages are backed by the file itself.
+#if defined(SORT_IN_WINDOWS)
+    const auto file = CreateFileA( filename.c_str() , GENERIC_READ , FILE_SHARE_READ , nullptr , OPEN_EXISTING , FILE_ATTRIBUTE_NORMAL | ( sequential ? FILE_FLAG_SEQUENTIAL_SCAN : 0 ) , nullptr );
+    if( file != INVALID_HANDLE_VALUE ){
+        // the view keeps the mapping alive, both handles can be closed right away
+        LARGE_INTEGER file_size;
+        if( GetFileSizeEx( file , &file_size ) && file_size.QuadPart > 0 ){
+            const auto mapping = CreateFileMappingA( file , nullptr , PAGE_READONLY , 0 , 0 , nullptr );
+            if( mapping ){
+                m_data = (const char*)MapViewOfFile( mapping , FILE_MAP_READ , 0 , 0 , 0 );
+                CloseHandle( mapping );
+            }
+            m_size = m_data ? (std::size_t)file_size.QuadPart : 0;
+        }
+        CloseHandle( file );
+    }
+#else
+    const auto fd = open( filename.c_str() , O_RDONLY );
+    if( fd != -1 ){
+        // the mapping stays valid after the file descriptor is closed
+        struct stat st;
+        if( fstat( fd , &st ) == 0 && st.st_size > 0 ){
+            const auto bytes = mmap( nullptr , (std::size_t)st.st_size , PROT_READ , MAP_PRIVATE , fd , 0 );
+            if( bytes != MAP_FAILED ){
+                // the scene is parsed from the beginning to the end, it is worth reading ahead aggressively.
+                if( sequential )
+                    madvise( bytes , (std::size_t)st.st_size , MADV_SEQUENTIAL );
+                m_data = (const char*)bytes;
+                m_size = (std::size_t)st.st_size;
+            }
+        }
+        close( fd );
+    }
+#endif
+
+    if( !m_data )
+        slog(WARNING, STREAM, "File %s can't be loaded.", filename.c_str());
+}
+
+IMappedFileStream::~IMappedFileStream(){
+    if( !m_data )
+        return;
+#if defined(SORT_IN_WINDOWS)
+    UnmapViewOfFile( m_data );
+#else
+    munmap( (void*)m_data , m_size );
+#endif
+}
@@ -0,0 +1,170 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <string.h>
+#include "stream.h"
+
+//! @brief Streaming from a block of memory that is not owned by the stream.
+/**
+ * IMemoryViewStream reads from memory owned by something else, like a memory mapped file. Values are copied
+ * straight out of the memory and large arrays, like vertex buffers of meshes, can be fetched without any copy
+ * at all. Multiple views can read different parts of the same memory concurrently.
+ * Any attempt to write data to the memory will result in immediate crash.
+ */
+class IMemoryViewStream : public IStreamBase{
+public:
+    //! @brief Constructing from a block of memory.
+    //!
+    //! @param data         Address of the memory, it needs to outlive the stream.
+    //! @param size         Size of the memory in bytes.
+    IMemoryViewStream( const char* data , std::size_t size ) : m_data(data), m_size(data ? size : 0) {}
+
+    //! @brief Whether there is memory to be streamed from.
+    //!
+    //! @return             It returns true if the stream is backed by valid memory.
+    SORT_FORCEINLINE bool   IsValid() const {
+        return nullptr != m_data;
+    }
+
+    //! @brief Get the address of the memory to be streamed.
+    //!
+    //! @return             Address of the memory, nullptr if there is no memory.
+    SORT_FORCEINLINE const char*    GetData() const {
+        return m_data;
+    }
+
+    //! @brief Get the size of the memory to be streamed.
+    //!
+    //! @return             Size of the memory in bytes.
+    SORT_FORCEINLINE std::size_t    GetSize() const {
+        return m_size;
+    }
+
+    //! @brief Streaming in a float number from memory.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (float& v) override {
+        return read( v );
+    }
+
+    //! @brief Streaming in an integer number from memory.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (int& v) override {
+        return read( v );
+    }
+
+    //! @brief Streaming in an unsigned integer number from memory.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (unsigned int& v) override {
+        return read( v );
+    }
+
+    //! @brief Streaming in a string from memory.
+    //!
+    //! Unlike stand stream, space doesn't count to separate strings. For example, streaming "hello world" in will
+    //! result in one single string instead of two.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (std::string& v) override {
+        const auto start = m_pos;
+        while( m_pos < m_size && m_data[m_pos] != 0 )
+            ++m_pos;
+        v.assign( m_data + start , m_pos - start );
+        m_pos = std::min( m_pos + 1 , m_size );
+        return *this;
+    }
+
+    //! @brief Streaming in a boolean value from memory.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (bool& v) override {
+        return read( v );
+    }
+
+    //! @brief Loading data from stream directly.
+    //!
+    //! @param  data    Data to be filled.
+    //! @param  size    Size of the data to be filled in bytes.
+    StreamBase& Load( char* data , int size ) override {
+        if( const auto src = Fetch( (std::size_t)size ) )
+            memcpy( data , src , size );
+        else
+            memset( data , 0 , size );
+        return *this;
+    }
+
+    //! @brief Fetch a block of data from the memory without copying it.
+    //!
+    //! @param  size    Size of the data to be fetched in bytes.
+    //! @return         Address of the data in the memory, nullptr if there is not enough data left.
+    const char* Fetch( std::size_t size ) override {
+        if( UNLIKELY( m_pos + size > m_size ) ){
+            m_pos = m_size;
+            return nullptr;
+        }
+        const auto ret = m_data + m_pos;
+        m_pos += size;
+        return ret;
+    }
+
+protected:
+    const char*     m_data = nullptr;   /**< Address of the memory. */
+    std::size_t     m_size = 0;         /**< Size of the memory in bytes. */
+    std::size_t     m_pos = 0;          /**< Current position in the memory. */
+
+    //! @brief  Default constructor for derived streams that setup the memory themselves.
+    IMemoryViewStream() = default;
+
+private:
+    //! @brief  Copy a value out of the memory, reading beyond the end of the memory results in default value.
+    template<class T>
+    SORT_FORCEINLINE StreamBase& read( T& v ){
+        if( const auto src = Fetch( sizeof( T ) ) )
+            memcpy( &v , src , sizeof( T ) );
+        else
+            v = T();
+        return *this;
+    }
+};
+
+//! @brief Streaming from a memory mapped file.
+/**
+ * IMappedFileStream maps the whole file in read-only mode instead of reading it through a file buffer.
+ * Pages are loaded by the OS on demand, loading large scenes is limited by the bandwidth of the disk instead
+ * of the number of reads. Since the whole file is accessible, parts of it can be handed over to views and
+ * deserialized in parallel.
+ */
+class IMappedFileStream : public IMemoryViewStream{
+public:
+    //! @brief Constructing from a file name.
+    //!
+    //! @param filename     Name of the file to be streamed.
+    //! @param sequential   Whether the file is read from the beginning to the end, pages are read ahead aggressively then.
+    IMappedFileStream( const std::string& filename , bool sequential = true );
+
+    //! @brief Destructor will unmap the file.
+    ~IMappedFileStream();
+};
@@ -17,6 +17,7 @@
 
 #pragma once
 
+#include <string.h>
 #include "stream.h"
 #include "core/define.h"
 
@@ -138,6 +139,13 @@ public:
         return m_pos;
     }
 
+    //! @brief  Get the written data of the stream.
+    //!
+    //! @return     Address of the written data.
+    const char*     GetData() const {
+        return m_data.get();
+    }
+
     //! @brief Reading data from stream.
     //!
     //! @param  data    Data to be filled.
@@ -147,7 +155,7 @@ public:
             Resize( 2 * m_capacity );
             return Write( data , size );
         }else{
-            memcpy( data , m_data.get() + m_pos , size );
+            memcpy( m_data.get() + m_pos , data , size );
             m_pos += size;
         }
         return *this;
@@ -277,12 +285,24 @@ public:
         if( m_pos + size > m_capacity ){
             memset( data , 0 , size );
         }else{
-            memcpy( data , m_data.get() , size );
+            memcpy( data , m_data.get() + m_pos , size );
             m_pos += size;
         }
         return *this;
     }
 
+    //! @brief Fetch a block of data from the memory without copying it.
+    //!
+    //! @param  size    Size of the data to be fetched in bytes.
+    //! @return         Address of the data in the memory, nullptr if there is not enough data left.
+    const char* Fetch( std::size_t size ) override {
+        if( m_pos + size > m_capacity )
+            return nullptr;
+        const auto ret = m_data.get() + m_pos;
+        m_pos += (unsigned int)size;
+        return ret;
+    }
+
 private:
     /**< Pointer points to the address where the memory is. */
     std::unique_ptr<char[]>     m_data = nullptr;
@@ -0,0 +1,57 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "core/define.h"
+#if defined(SORT_IN_WINDOWS)
+    #include <io.h>
+    #include <fcntl.h>
+    #include <windows.h>
+#else
+    #include <poll.h>
+#endif
+#include "pstream.h"
+
+// Most of the scene is fetched in blocks of entities, a large buffer saves the number of reads for the rest of it.
+static constexpr std::size_t PIPE_BUFFER_SIZE = 1024 * 1024;
+
+IPipeStream::IPipeStream( FILE* file ) : m_file( file ){
+#if defined(SORT_IN_WINDOWS)
+    // the standard input is opened in text mode on Windows by default
+    _setmode( _fileno( m_file ) , _O_BINARY );
+#endif
+    if( m_file == stdin )
+        setvbuf( m_file , nullptr , _IOFBF , PIPE_BUFFER_SIZE );
+}
+
+const char* IPipeStream::Fetch( std::size_t size ){
+    auto block = std::make_unique<char[]>( size );
+    if( UNLIKELY( fread( block.get() , 1 , size , m_file ) < size ) )
+        return nullptr;
+    m_blocks.push_back( std::move( block ) );
+    return m_blocks.back().get();
+}
+
+bool IPipeStream::HasPendingData() const{
+#if defined(SORT_IN_WINDOWS)
+    DWORD available = 0;
+    const auto pipe = (HANDLE)_get_osfhandle( _fileno( m_file ) );
+    return PeekNamedPipe( pipe , nullptr , 0 , nullptr , &available , nullptr ) && available > 0;
+#else
+    pollfd fd = { fileno( m_file ) , POLLIN , 0 };
+    return poll( &fd , 1 , 0 ) > 0 && ( fd.revents & POLLIN );
+#endif
+}
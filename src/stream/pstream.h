@@ -0,0 +1,125 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <memory>
+#include "stream.h"
+
+//! @brief Streaming from the standard input of the process.
+/**
+ * IPipeStream reads the scene while it is still being produced by the other end of the pipe, like the Blender plugin.
+ * There is no intermediate file to write and read again. Reading blocks until the data is available, reading beyond
+ * the end of the pipe results in default values.
+ * Blocks fetched from the pipe are kept alive during the life time of the stream so that they can be deserialized
+ * in parallel, just like the ones fetched from a memory mapped file.
+ * Any attempt to write data to the pipe will result in immediate crash.
+ */
+class IPipeStream : public IStreamBase{
+public:
+    //! @brief Constructing a stream from a pipe.
+    //!
+    //! @param file         The pipe to be streamed from, it is the standard input by default.
+    IPipeStream( FILE* file = stdin );
+
+    //! @brief Streaming in a float number from the pipe.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (float& v) override {
+        return read( v );
+    }
+
+    //! @brief Streaming in an integer number from the pipe.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (int& v) override {
+        return read( v );
+    }
+
+    //! @brief Streaming in an unsigned integer number from the pipe.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (unsigned int& v) override {
+        return read( v );
+    }
+
+    //! @brief Streaming in a string from the pipe.
+    //!
+    //! Unlike stand stream, space doesn't count to separate strings. For example, streaming "hello world" in will
+    //! result in one single string instead of two.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (std::string& v) override {
+        v = "";
+        for( auto c = getc( m_file ) ; c != 0 && c != EOF ; c = getc( m_file ) )
+            v += (char)c;
+        return *this;
+    }
+
+    //! @brief Streaming in a boolean value from the pipe.
+    //!
+    //! @param v            Value to be loaded.
+    //! @return             Reference of the stream itself.
+    StreamBase& operator >> (bool& v) override {
+        return read( v );
+    }
+
+    //! @brief Loading data from stream directly.
+    //!
+    //! @param  data    Data to be filled.
+    //! @param  size    Size of the data to be filled in bytes.
+    StreamBase& Load( char* data , int size ) override {
+        const auto loaded = fread( data , 1 , (std::size_t)size , m_file );
+        if( UNLIKELY( loaded < (std::size_t)size ) )
+            memset( data + loaded , 0 , (std::size_t)size - loaded );
+        return *this;
+    }
+
+    //! @brief Fetch a block of data from the pipe.
+    //!
+    //! The block is copied out of the pipe into memory owned by the stream, it stays valid until the stream is destroyed.
+    //!
+    //! @param  size    Size of the data to be fetched in bytes.
+    //! @return         Address of the data, nullptr if there is not enough data left.
+    const char* Fetch( std::size_t size ) override;
+
+    //! @brief Whether the other end of the pipe has written more data.
+    //!
+    //! Only the pipe itself is polled, data already read into the buffer of the file is not counted.
+    //!
+    //! @return         Whether there is data ready to be read.
+    bool HasPendingData() const override;
+
+private:
+    FILE*                                   m_file = nullptr;   /**< The pipe to be streamed from. */
+    std::vector<std::unique_ptr<char[]>>    m_blocks;           /**< Blocks fetched from the pipe. */
+
+    //! @brief  Copy a value out of the pipe, reading beyond the end of the pipe results in default value.
+    template<class T>
+    SORT_FORCEINLINE StreamBase& read( T& v ){
+        if( UNLIKELY( 1 != fread( &v , sizeof( T ) , 1 , m_file ) ) )
+            v = T();
+        return *this;
+    }
+};
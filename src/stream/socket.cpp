@@ -0,0 +1,248 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "core/define.h"
+#if defined(SORT_IN_WINDOWS)
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    #pragma comment(lib, "Ws2_32.lib")
+#else
+    #include <sys/socket.h>
+    #include <sys/select.h>
+    #include <sys/time.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <netdb.h>
+    #include <unistd.h>
+#endif
+#include <string.h>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include "socket.h"
+#include "core/log.h"
+
+#if defined(SORT_IN_WINDOWS)
+    using NativeSocket = SOCKET;
+    using socklen_t = int;
+    #define SORT_SOCKET_SEND_FLAGS  0
+#else
+    using NativeSocket = int;
+    #define INVALID_SOCKET          -1
+    #define SOCKET_ERROR            -1
+    #define closesocket             close
+    // a broken connection shouldn't kill the process, Mac doesn't support the flag but the socket option instead
+    #if defined(MSG_NOSIGNAL)
+        #define SORT_SOCKET_SEND_FLAGS  MSG_NOSIGNAL
+    #else
+        #define SORT_SOCKET_SEND_FLAGS  0
+    #endif
+#endif
+
+static SORT_FORCEINLINE NativeSocket native( SocketHandle s ){
+    return (NativeSocket)s;
+}
+
+// Winsock needs to be initialized before any socket is created, there is no need to clean it up before exiting.
+static void initializeSocketLibrary(){
+#if defined(SORT_IN_WINDOWS)
+    static const auto initialized = [](){
+        WSADATA data;
+        return WSAStartup( MAKEWORD( 2 , 2 ) , &data ) == 0;
+    }();
+    if( !initialized )
+        slog( WARNING , STREAM , "Failed to initialize Winsock." );
+#endif
+}
+
+// setup a connected socket, Nagle's algorithm is disabled since latency matters more than the number of packets.
+static void setupConnection( SocketHandle s ){
+    int flag = 1;
+    setsockopt( native( s ) , IPPROTO_TCP , TCP_NODELAY , (const char*)&flag , sizeof( flag ) );
+#if defined(SO_NOSIGPIPE)
+    setsockopt( native( s ) , SOL_SOCKET , SO_NOSIGPIPE , (const char*)&flag , sizeof( flag ) );
+#endif
+}
+
+Socket::~Socket(){
+    Close();
+}
+
+bool Socket::Listen( unsigned short port ){
+    initializeSocketLibrary();
+    Close();
+
+    const auto s = socket( AF_INET , SOCK_STREAM , IPPROTO_TCP );
+    if( s == INVALID_SOCKET )
+        return false;
+
+    // the port can be listened to again right after the last coordinator exits
+    int reuse = 1;
+    setsockopt( s , SOL_SOCKET , SO_REUSEADDR , (const char*)&reuse , sizeof( reuse ) );
+
+    sockaddr_in address;
+    memset( &address , 0 , sizeof( address ) );
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl( INADDR_ANY );
+    address.sin_port = htons( port );
+    if( bind( s , (const sockaddr*)&address , sizeof( address ) ) == SOCKET_ERROR || listen( s , SOMAXCONN ) == SOCKET_ERROR ){
+        closesocket( s );
+        return false;
+    }
+
+    m_socket = (SocketHandle)s;
+    m_valid = true;
+    return true;
+}
+
+bool Socket::Connect( const std::string& host , unsigned short port ){
+    initializeSocketLibrary();
+    Close();
+
+    addrinfo hints;
+    memset( &hints , 0 , sizeof( hints ) );
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+
+    addrinfo* addresses = nullptr;
+    if( getaddrinfo( host.c_str() , std::to_string( port ).c_str() , &hints , &addresses ) != 0 )
+        return false;
+
+    for( auto address = addresses ; address && !m_valid ; address = address->ai_next ){
+        const auto s = socket( address->ai_family , address->ai_socktype , address->ai_protocol );
+        if( s == INVALID_SOCKET )
+            continue;
+        if( connect( s , address->ai_addr , (socklen_t)address->ai_addrlen ) == SOCKET_ERROR ){
+            closesocket( s );
+            continue;
+        }
+        m_socket = (SocketHandle)s;
+        m_valid = true;
+    }
+    freeaddrinfo( addresses );
+
+    if( m_valid )
+        setupConnection( m_socket );
+    return m_valid;
+}
+
+std::unique_ptr<Socket> Socket::Accept(){
+    if( !m_valid )
+        return nullptr;
+
+    const auto s = accept( native( m_socket ) , nullptr , nullptr );
+    if( s == INVALID_SOCKET )
+        return nullptr;
+
+    auto ret = std::make_unique<Socket>();
+    ret->m_socket = (SocketHandle)s;
+    ret->m_valid = true;
+    setupConnection( ret->m_socket );
+    return ret;
+}
+
+bool Socket::Send( const char* data , std::size_t size ){
+    while( m_valid && size > 0 ){
+        const auto sent = send( native( m_socket ) , data , (int)std::min( size , (std::size_t)0x10000000 ) , SORT_SOCKET_SEND_FLAGS );
+        if( sent <= 0 ){
+            Close();
+            break;
+        }
+        data += sent;
+        size -= (std::size_t)sent;
+    }
+    return m_valid;
+}
+
+std::size_t Socket::Receive( char* data , std::size_t size ){
+    if( !m_valid )
+        return 0;
+
+    const auto received = recv( native( m_socket ) , data , (int)std::min( size , (std::size_t)0x10000000 ) , 0 );
+    if( received <= 0 ){
+        Close();
+        return 0;
+    }
+    return (std::size_t)received;
+}
+
+void Socket::SetTimeOut( float seconds ){
+    if( !m_valid )
+        return;
+
+    const auto s = native( m_socket );
+#if defined(SORT_IN_WINDOWS)
+    const DWORD ms = (DWORD)( seconds * 1000.0f );
+    setsockopt( s , SOL_SOCKET , SO_RCVTIMEO , (const char*)&ms , sizeof( ms ) );
+    setsockopt( s , SOL_SOCKET , SO_SNDTIMEO , (const char*)&ms , sizeof( ms ) );
+#else
+    timeval tv;
+    tv.tv_sec = (time_t)seconds;
+    tv.tv_usec = (suseconds_t)( ( seconds - (float)tv.tv_sec ) * 1000000.0f );
+    setsockopt( s , SOL_SOCKET , SO_RCVTIMEO , &tv , sizeof( tv ) );
+    setsockopt( s , SOL_SOCKET , SO_SNDTIMEO , &tv , sizeof( tv ) );
+#endif
+}
+
+void Socket::Close(){
+    if( !m_valid )
+        return;
+    closesocket( native( m_socket ) );
+    m_valid = false;
+}
+
+bool Socket::Wait( const std::vector<Socket*>& sockets , float seconds , std::vector<bool>& readable ){
+    readable.assign( sockets.size() , false );
+
+    fd_set set;
+    FD_ZERO( &set );
+    auto max_fd = 0;
+    auto any = false;
+    for( const auto s : sockets ){
+        if( !s || !s->m_valid )
+            continue;
+        const auto fd = native( s->m_socket );
+        FD_SET( fd , &set );
+        max_fd = std::max( max_fd , (int)fd );
+        any = true;
+    }
+
+    if( !any ){
+        // nothing to wait for, simply sleep for a while
+        std::this_thread::sleep_for( std::chrono::milliseconds( (long long)( seconds * 1000.0f ) ) );
+        return false;
+    }
+
+    timeval tv;
+    tv.tv_sec = (long)seconds;
+    tv.tv_usec = (long)( ( seconds - (float)tv.tv_sec ) * 1000000.0f );
+
+    // the first argument is ignored by Winsock
+    if( select( max_fd + 1 , &set , nullptr , nullptr , &tv ) <= 0 )
+        return false;
+
+    auto ret = false;
+    for( auto i = 0u ; i < sockets.size() ; ++i ){
+        const auto s = sockets[i];
+        if( !s || !s->m_valid )
+            continue;
+        readable[i] = FD_ISSET( native( s->m_socket ) , &set ) != 0;
+        ret |= readable[i];
+    }
+    return ret;
+}
@@ -0,0 +1,107 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <memory>
+#include <vector>
+#include "core/define.h"
+
+#if defined(SORT_IN_WINDOWS)
+    using SocketHandle = std::uintptr_t;
+#else
+    using SocketHandle = int;
+#endif
+
+//! @brief A thin wrapper of a TCP socket.
+/**
+ * Socket hides the differences between BSD sockets and Winsock. It is only used for connecting the coordinator
+ * and the workers of distributed rendering, there is no attempt to be a general purpose networking library.
+ * All operations block, sending or receiving data either succeeds entirely or breaks the socket.
+ */
+class Socket{
+public:
+    //! @brief Default constructor creates an invalid socket.
+    Socket() = default;
+
+    //! @brief Destructor closes the socket.
+    ~Socket();
+
+    //! @brief Listen to a port for incoming connections on all network interfaces.
+    //!
+    //! @param  port    The port to listen to.
+    //! @return         Whether the socket is listening.
+    bool    Listen( unsigned short port );
+
+    //! @brief Connect to a listening socket.
+    //!
+    //! @param  host    Name or address of the host to connect to.
+    //! @param  port    The port to connect to.
+    //! @return         Whether the connection is established.
+    bool    Connect( const std::string& host , unsigned short port );
+
+    //! @brief Accept an incoming connection of a listening socket.
+    //!
+    //! @return         The connected socket, nullptr if there is no connection accepted.
+    std::unique_ptr<Socket> Accept();
+
+    //! @brief Send all the data.
+    //!
+    //! @param  data    Data to be sent.
+    //! @param  size    Size of the data in bytes.
+    //! @return         Whether all the data is sent, the socket is broken otherwise.
+    bool    Send( const char* data , std::size_t size );
+
+    //! @brief Receive some data, it blocks until there is data available.
+    //!
+    //! @param  data    Buffer to be filled.
+    //! @param  size    Capacity of the buffer in bytes.
+    //! @return         Number of bytes received, 0 means the socket is closed or broken.
+    std::size_t Receive( char* data , std::size_t size );
+
+    //! @brief Give up sending or receiving data if the other end doesn't respond in time.
+    //!
+    //! @param  seconds Time out in seconds, 0 means waiting forever.
+    void    SetTimeOut( float seconds );
+
+    //! @brief Close the socket.
+    void    Close();
+
+    //! @brief Whether the socket is usable.
+    //!
+    //! @return         It returns false once the socket is closed or broken.
+    SORT_FORCEINLINE bool IsValid() const {
+        return m_valid;
+    }
+
+    //! @brief Wait until any of the sockets has data to be received or a connection to be accepted.
+    //!
+    //! @param  sockets     Sockets to wait for, invalid ones are ignored.
+    //! @param  seconds     Time out in seconds.
+    //! @param  readable    Whether each of the sockets is readable.
+    //! @return             Whether any of the sockets is readable.
+    static bool Wait( const std::vector<Socket*>& sockets , float seconds , std::vector<bool>& readable );
+
+private:
+    SocketHandle    m_socket = 0;       /**< The handle of the socket. */
+    bool            m_valid = false;    /**< Whether the socket is usable. */
+
+    Socket( const Socket& ) = delete;
+    Socket& operator = ( const Socket& ) = delete;
+};
@@ -17,18 +17,26 @@
 
 #pragma once
 
+#include <string.h>
+#include <vector>
+#include <algorithm>
 #include "stream.h"
+#include "socket.h"
 #include "core/define.h"
 
 //! @brief Streaming from socket through network.
 /**
  * ISocketStream only works for streaming data from socket. Any attempt to write data
  * to socket will result in immediate crash.
+ * Data is received in large blocks and buffered in the stream. Once the socket is broken, all values
+ * streamed in afterwards are default values, it is up to the higher level code to check IsValid.
  */
 class ISocketStream : public IStreamBase{
 public:
     //! @brief  Constructor.
-    ISocketStream(){
+    //!
+    //! @param  socket  The connected socket to receive data from, it needs to outlive the stream.
+    ISocketStream( Socket& socket ) : m_socket( socket ), m_buffer( SOCKET_STREAM_BUFFER_SIZE ){
     }
 
     //! @brief Streaming in a float number from socket.
@@ -36,7 +44,7 @@ public:
     //! @param v    Value to be loaded.
     //! @return     Reference of the stream itself.
     StreamBase& operator >> (float& v) override {
-        return *this;
+        return read( v );
     }
 
     //! @brief Streaming in an integer number from socket.
@@ -44,7 +52,7 @@ public:
     //! @param v    Value to be loaded.
     //! @return     Reference of the stream itself.
     StreamBase& operator >> (int& v) override {
-        return *this;
+        return read( v );
     }
 
     //! @brief Streaming in an unsigned integer number from socket.
@@ -52,7 +60,7 @@ public:
     //! @param v    Value to be loaded.
     //! @return     Reference of the stream itself.
     StreamBase& operator >> (unsigned int& v) override {
-        return *this;
+        return read( v );
     }
 
     //! @brief Streaming in a string from socket.
@@ -63,6 +71,10 @@ public:
     //! @param v    Value to be loaded.
     //! @return     Reference of the stream itself.
     StreamBase& operator >> (std::string& v) override {
+        v = "";
+        char c = 0;
+        while( receive( &c , 1 ) && c != 0 )
+            v += c;
         return *this;
     }
 
@@ -71,7 +83,7 @@ public:
     //! @param v    Value to be loaded.
     //! @return     Reference of the stream itself.
     StreamBase& operator >> (bool& v) override {
-        return *this;
+        return read( v );
     }
 
     //! @brief Loading data from stream directly.
@@ -79,6 +91,63 @@ public:
     //! @param  data    Data to be filled.
     //! @param  size    Size of the data to be filled in bytes.
     StreamBase& Load( char* data , int size ) override {
+        if( UNLIKELY( !receive( data , (std::size_t)size ) ) )
+            memset( data , 0 , (std::size_t)size );
+        return *this;
+    }
+
+    //! @brief Whether there is data received already but not streamed yet.
+    //!
+    //! Data may be buffered even if the socket has nothing more to receive, waiting on the socket alone is not enough.
+    //!
+    //! @return     Whether streaming in more data doesn't need to wait for the network.
+    SORT_FORCEINLINE bool HasBufferedData() const {
+        return m_pos < m_end;
+    }
+
+    //! @brief Whether everything streamed in so far is received.
+    //!
+    //! @return     It returns false once the socket is closed or broken.
+    SORT_FORCEINLINE bool IsValid() const {
+        return m_valid;
+    }
+
+private:
+    static constexpr std::size_t SOCKET_STREAM_BUFFER_SIZE = 64 * 1024;
+
+    Socket&             m_socket;           /**< The socket to receive data from. */
+    std::vector<char>   m_buffer;           /**< Data received but not streamed yet. */
+    std::size_t         m_pos = 0;          /**< Position of the next byte to be streamed in the buffer. */
+    std::size_t         m_end = 0;          /**< End of the received data in the buffer. */
+    bool                m_valid = true;     /**< Whether everything streamed in so far is received. */
+
+    //! @brief  Fill the data from the buffer, more data is received once the buffer runs out.
+    //!
+    //! @param  data    Data to be filled.
+    //! @param  size    Size of the data in bytes.
+    //! @return         Whether the data is filled entirely.
+    bool receive( char* data , std::size_t size ){
+        while( size > 0 && m_valid ){
+            if( m_pos == m_end ){
+                m_pos = 0;
+                m_end = m_socket.Receive( m_buffer.data() , m_buffer.size() );
+                m_valid = m_end > 0;
+                continue;
+            }
+            const auto cnt = std::min( size , m_end - m_pos );
+            memcpy( data , m_buffer.data() + m_pos , cnt );
+            m_pos += cnt;
+            data += cnt;
+            size -= cnt;
+        }
+        return m_valid;
+    }
+
+    //! @brief  Copy a value out of the socket, a broken socket results in default value.
+    template<class T>
+    SORT_FORCEINLINE StreamBase& read( T& v ){
+        if( UNLIKELY( !receive( (char*)&v , sizeof( T ) ) ) )
+            v = T();
         return *this;
     }
 };
@@ -87,11 +156,14 @@ public:
 /**
  * OSocketStream only works for streaming data to socket. Any attempt to read data
  * from socket will result in immediate crash.
+ * Data is buffered in the stream until it is flushed, a message is usually flushed as a whole.
  */
 class OSocketStream : public OStreamBase{
 public:
     //! @brief  Constructor.
-    OSocketStream(){
+    //!
+    //! @param  socket  The connected socket to send data to, it needs to outlive the stream.
+    OSocketStream( Socket& socket ) : m_socket( socket ){
     }
 
     //! @brief Streaming in a float number from socket.
@@ -99,7 +171,7 @@ public:
     //! @param v    Value to be saved.
     //! @return     Reference of the stream itself.
     StreamBase& operator << (const float v) override {
-        return *this;
+        return write( v );
     }
 
     //! @brief Streaming in an integer number from socket.
@@ -107,7 +179,7 @@ public:
     //! @param v    Value to be saved.
     //! @return     Reference of the stream itself.
     StreamBase& operator << (const int v) override {
-        return *this;
+        return write( v );
     }
 
     //! @brief Streaming in an unsigned integer number from socket.
@@ -115,7 +187,7 @@ public:
     //! @param v    Value to be saved.
     //! @return     Reference of the stream itself.
     StreamBase& operator << (const unsigned int v) override {
-        return *this;
+        return write( v );
     }
 
     //! @brief Streaming in a string from socket.
@@ -126,6 +198,7 @@ public:
     //! @param v    Value to be saved.
     //! @return     Reference of the stream itself.
     StreamBase& operator << (const std::string& v) override {
+        m_buffer.insert( m_buffer.end() , v.c_str() , v.c_str() + v.size() + 1 );
         return *this;
     }
 
@@ -134,7 +207,7 @@ public:
     //! @param v    Value to be saved.
     //! @return     Reference of the stream itself.
     StreamBase& operator << (const bool v) override {
-        return *this;
+        return write( v );
     }
 
     //! @brief Writing data to stream.
@@ -142,6 +215,32 @@ public:
     //! @param  data    Data to be written.
     //! @param  size    Size of the data to be filled in bytes.
     StreamBase& Write( char* data , int size ) override {
+        m_buffer.insert( m_buffer.end() , data , data + size );
+        return *this;
+    }
+
+    //! @brief Send all the buffered data.
+    void Flush() override {
+        m_socket.Send( m_buffer.data() , m_buffer.size() );
+        m_buffer.clear();
+    }
+
+    //! @brief Whether everything flushed so far is sent.
+    //!
+    //! @return     It returns false once the socket is closed or broken.
+    SORT_FORCEINLINE bool IsValid() const {
+        return m_socket.IsValid();
+    }
+
+private:
+    Socket&             m_socket;   /**< The socket to send data to. */
+    std::vector<char>   m_buffer;   /**< Data to be sent. */
+
+    //! @brief  Append a value to the buffer.
+    template<class T>
+    SORT_FORCEINLINE StreamBase& write( const T& v ){
+        const auto bytes = (const char*)&v;
+        m_buffer.insert( m_buffer.end() , bytes , bytes + sizeof( T ) );
         return *this;
     }
-};
\ No newline at end of file
+};
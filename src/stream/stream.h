@@ -247,6 +247,40 @@ public:
  */
 class IStreamBase : public StreamBase {
 public:
+    //! @brief Fetch a block of data from the stream without copying it.
+    //!
+    //! Streams backed by memory return the address of the data and skip it. The others return nullptr without
+    //! consuming anything, the data needs to be loaded by the caller then.
+    //!
+    //! @param  size    Size of the data to be fetched in bytes.
+    //! @return         Address of the data in the stream, nullptr if it is not accessible.
+    virtual const char* Fetch( std::size_t size ) { return nullptr; }
+
+    //! @brief Whether more data has arrived in the stream without blocking to wait for it.
+    //!
+    //! Only streams fed by another process while the renderer is busy can tell, the others always return false.
+    //!
+    //! @return         Whether there is data ready to be read.
+    virtual bool HasPendingData() const { return false; }
+
+    //! @brief Loading a large block of data from stream.
+    //!
+    //! Unlike Load, the size of the block is not limited by the range of an integer.
+    //!
+    //! @param  data    Data to be filled.
+    //! @param  size    Size of the data to be filled in bytes.
+    //! @return         Reference of the stream itself.
+    SORT_FORCEINLINE IStreamBase& LoadBulk( char* data , std::size_t size ){
+        constexpr std::size_t max_chunk = 1u << 30u;
+        while( size > 0 ){
+            const auto chunk = std::min( size , max_chunk );
+            Load( data , (int)chunk );
+            data += chunk;
+            size -= chunk;
+        }
+        return *this;
+    }
+
     //! @brief Disable streaming in a float number. Attempting to do it will result in crash!
     //!
     //! @param v    Value to be saved.
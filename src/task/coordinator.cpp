@@ -0,0 +1,283 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include "coordinator.h"
+#include "render_task.h"
+#include "core/globalconfig.h"
+#include "core/strid.h"
+#include "core/log.h"
+#include "stream/sstream.h"
+#include "imagesensor/remoteimage.h"
+
+// Passes handed out to a worker at once for each of its threads, a few more than threads hide the latency of network.
+static constexpr unsigned int PASSES_PER_THREAD = 2;
+// A pass taking this many times longer than the average is stuck with a slow worker.
+static constexpr unsigned int SLOW_PASS_FACTOR = 4;
+// A pass is never considered slow within this time in milliseconds.
+static constexpr unsigned int SLOW_PASS_TIME = 1000;
+// Time to wait for messages in each iteration in seconds.
+static constexpr float WAIT_TIME = 0.1f;
+
+Coordinator::Coordinator( const std::string& sceneFile , std::uint64_t sceneHash ) : m_sceneFile( sceneFile ), m_sceneHash( sceneHash ){
+    // tiles are handed out in the same order as they are rendered on a single machine
+    ForEachTile( [&]( const Vector2i& tl , const Vector2i& size ){
+        TileState tile;
+        tile.coord = tl;
+        tile.size = size;
+        m_tiles.push_back( tile );
+    });
+}
+
+Coordinator::~Coordinator(){
+    for( auto& worker : m_workers ){
+        if( !worker->socket->IsValid() )
+            continue;
+        OStreamBase& output = *worker->output;
+        output << SID("Quit");
+        output.Flush();
+    }
+}
+
+bool Coordinator::Render(){
+    if( !m_listener.Listen( (unsigned short)g_coordinatorPort ) ){
+        slog( WARNING , TASK , "Failed to listen to port %d for workers." , g_coordinatorPort );
+        return false;
+    }
+    slog( INFO , TASK , "Waiting for workers on port %d." , g_coordinatorPort );
+
+    std::vector<Socket*> sockets;
+    std::vector<bool> readable;
+    while( m_finishedCnt < m_tiles.size() ){
+        sockets.clear();
+        sockets.push_back( &m_listener );
+        for( const auto& worker : m_workers )
+            sockets.push_back( worker->socket.get() );
+        Socket::Wait( sockets , WAIT_TIME , readable );
+
+        const auto worker_cnt = m_workers.size();
+        if( readable[0] )
+            acceptWorker();
+
+        const auto time_out = (unsigned int)( g_workerTimeOut * 1000.0f );
+        for( auto i = 0u ; i < worker_cnt ; ++i ){
+            auto& worker = *m_workers[i];
+            auto usable = true;
+            if( readable[i + 1] ){
+                // messages received already are handled without waiting for the socket again
+                do{
+                    usable = receive( worker );
+                }while( usable && worker.input->HasBufferedData() );
+            }else if( !worker.tiles.empty() && m_timer.GetElapsedTime() - worker.responseTime > time_out ){
+                slog( WARNING , TASK , "A worker is not responding for %.1f seconds, it is dropped." , g_workerTimeOut );
+                usable = false;
+            }
+
+            if( !usable )
+                release( worker );
+        }
+
+        // forget about the workers released
+        m_workers.erase( std::remove_if( m_workers.begin() , m_workers.end() , []( const std::unique_ptr<RemoteWorker>& worker ){
+            return !worker->socket->IsValid();
+        }) , m_workers.end() );
+
+        // keep all workers busy
+        for( auto& worker : m_workers ){
+            if( worker->capacity > 0 && worker->tiles.empty() )
+                handout( *worker );
+        }
+    }
+
+    return true;
+}
+
+void Coordinator::acceptWorker(){
+    auto socket = m_listener.Accept();
+    if( !socket )
+        return;
+
+    // a worker dying in the middle of a message shouldn't block the coordinator forever
+    socket->SetTimeOut( g_workerTimeOut );
+
+    auto worker = std::make_unique<RemoteWorker>();
+    worker->input = std::make_unique<ISocketStream>( *socket );
+    worker->output = std::make_unique<OSocketStream>( *socket );
+    worker->socket = std::move( socket );
+    worker->responseTime = m_timer.GetElapsedTime();
+
+    // the hash is sent in two halves since streams don't support 64 bits integers
+    OStreamBase& output = *worker->output;
+    output << SID("Scene") << m_sceneFile << (unsigned int)( m_sceneHash & 0xffffffffull ) << (unsigned int)( m_sceneHash >> 32 );
+    output.Flush();
+    if( worker->output->IsValid() )
+        m_workers.push_back( std::move( worker ) );
+}
+
+bool Coordinator::receive( RemoteWorker& worker ){
+    IStreamBase& input = *worker.input;
+    StringID message;
+    input >> message;
+    if( !worker.input->IsValid() )
+        return false;
+
+    const auto now = m_timer.GetElapsedTime();
+    worker.responseTime = now;
+
+    if( SID("Ready") == message ){
+        input >> worker.capacity;
+        worker.capacity = std::max( 1u , worker.capacity );
+        slog( INFO , TASK , "A worker with %d threads is ready." , worker.capacity );
+        return worker.input->IsValid();
+    }
+
+    if( SID("Tile") == message ){
+        Vector2i coord , size;
+        unsigned int sample_offset = 0 , sample_cnt = 0;
+        std::vector<Spectrum> radiance;
+        std::vector<float> weight;
+        if( !RemoteImage::ReceiveTile( input , coord , size , sample_offset , sample_cnt , radiance , weight ) || !worker.input->IsValid() )
+            return false;
+
+        // passes merged from other workers are not expected any more, they are simply dropped
+        auto it = std::find_if( worker.tiles.begin() , worker.tiles.end() , [&]( unsigned int index ){
+            return m_tiles[index].coord == coord && m_tiles[index].sampleOffset == sample_offset;
+        });
+        if( it == worker.tiles.end() )
+            return true;
+        const auto index = *it;
+        worker.tiles.erase( it );
+
+        auto& tile = m_tiles[index];
+        if( tile.size != size || tile.sampleCnt != sample_cnt ){
+            slog( WARNING , TASK , "A worker returns a tile that is not handed out to it." );
+            return false;
+        }
+
+        RenderedTile rt;
+        rt.coord = coord;
+        rt.size = size;
+        rt.sampleOffset = sample_offset;
+        rt.sampleCnt = sample_cnt;
+        rt.radiance = radiance.data();
+        rt.weight = weight.data();
+
+        // tiles clipped by the region start in the middle of the tile they come from
+        const auto slot = TileSlot( coord , (int)g_tileSize , (int)g_resultResollutionHeight );
+        g_imageSensor->FinishTile( slot.x , slot.y , rt );
+
+        // the pass may be handed out to other workers too, they don't need to return it any more
+        for( auto& other : m_workers )
+            other->tiles.erase( std::remove( other->tiles.begin() , other->tiles.end() , index ) , other->tiles.end() );
+
+        m_passTime += now - tile.handoutTime;
+        ++m_passCnt;
+
+        finishPass( tile );
+        return true;
+    }
+
+    if( SID("Invalid Scene") == message )
+        slog( WARNING , TASK , "A worker can't load the same content of the scene file %s." , m_sceneFile.c_str() );
+    return false;
+}
+
+void Coordinator::handout( RemoteWorker& worker ){
+    const auto now = m_timer.GetElapsedTime();
+    const auto batch_size = worker.capacity * PASSES_PER_THREAD;
+
+    std::vector<unsigned int> batch;
+
+    // passes not handed out yet go first
+    for( auto i = 0u ; i < m_tiles.size() && batch.size() < batch_size ; ++i ){
+        auto& tile = m_tiles[i];
+        if( tile.finished || tile.workerCnt > 0 )
+            continue;
+
+        // stop refining the tile once the time budget runs out, the first pass is always finished
+        if( tile.sampleOffset > 0 && outOfBudget() ){
+            tile.finished = true;
+            ++m_finishedCnt;
+            continue;
+        }
+
+        tile.sampleCnt = std::min( g_samplePerPass , g_samplePerPixel - tile.sampleOffset );
+        tile.handoutTime = now;
+        ++tile.workerCnt;
+        batch.push_back( i );
+    }
+
+    // there is nothing else to do, help out with the passes stuck with slow workers
+    if( batch.empty() && m_passCnt > 0 ){
+        const auto slow_time = std::max( SLOW_PASS_TIME , SLOW_PASS_FACTOR * ( m_passTime / m_passCnt ) );
+        for( auto i = 0u ; i < m_tiles.size() && batch.size() < batch_size ; ++i ){
+            auto& tile = m_tiles[i];
+            if( tile.finished || tile.workerCnt != 1 || now - tile.handoutTime < slow_time )
+                continue;
+
+            ++tile.workerCnt;
+            batch.push_back( i );
+        }
+    }
+
+    if( batch.empty() )
+        return;
+
+    // the time budget starts once there is a worker rendering
+    if( !m_started ){
+        m_budgetTimer.Reset();
+        m_started = true;
+    }
+
+    OStreamBase& output = *worker.output;
+    output << SID("Render Tiles") << (unsigned int)batch.size();
+    for( const auto index : batch ){
+        const auto& tile = m_tiles[index];
+        output << tile.coord.x << tile.coord.y << tile.size.x << tile.size.y << tile.sampleOffset << tile.sampleCnt;
+    }
+    worker.tiles = std::move( batch );
+    worker.responseTime = now;
+
+    output.Flush();
+    if( !worker.output->IsValid() )
+        release( worker );
+}
+
+void Coordinator::release( RemoteWorker& worker ){
+    for( const auto index : worker.tiles ){
+        auto& tile = m_tiles[index];
+        if( tile.workerCnt > 0 )
+            --tile.workerCnt;
+    }
+    worker.tiles.clear();
+    worker.socket->Close();
+}
+
+bool Coordinator::outOfBudget() const{
+    return g_progressive && g_timeBudget > 0.0f && m_budgetTimer.GetElapsedTime() >= g_timeBudget * 1000.0f;
+}
+
+void Coordinator::finishPass( TileState& tile ){
+    tile.sampleOffset += tile.sampleCnt;
+    tile.sampleCnt = 0;
+    tile.workerCnt = 0;
+
+    if( tile.sampleOffset >= g_samplePerPixel || outOfBudget() ){
+        tile.finished = true;
+        ++m_finishedCnt;
+    }
+}
@@ -0,0 +1,125 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include "math/vector2.h"
+#include "core/timer.h"
+#include "stream/socket.h"
+
+class ISocketStream;
+class OSocketStream;
+
+//! @brief  Coordinator hands out tiles of the image to workers on other machines and merges what they return.
+/**
+ * Workers connect to the coordinator whenever they are ready, even in the middle of a frame. The scene is not sent
+ * through network, a farm shares the storage. Workers receive the path of the scene file along with the hash of its
+ * content so that they never render a stale copy of it.
+ *
+ * Work is handed out dynamically in units of one pass of a tile, each worker gets a batch large enough to keep all of
+ * its threads busy. The next pass of a tile is not handed out until the previous one is merged, passes are always
+ * blended in order. Since random numbers only depend on the pixel and the index of the sample, the merged image is
+ * identical to rendering on a single machine.
+ *
+ * A worker not responding for a while is dropped, tiles handed out to it go back to the queue. Tiles stuck with a slow
+ * worker are handed out again to idle ones once there is nothing else left, whichever comes back first wins.
+ */
+class Coordinator{
+public:
+    //! @brief  Constructor.
+    //!
+    //! @param  sceneFile   Full path of the scene file, it needs to be accessible by all workers.
+    //! @param  sceneHash   Hash of the content of the scene file.
+    Coordinator( const std::string& sceneFile , std::uint64_t sceneHash );
+
+    //! @brief  Destructor, all workers are released.
+    ~Coordinator();
+
+    //! @brief  Render the image with all workers.
+    //!
+    //! It returns once all tiles are merged in the image sensor.
+    //!
+    //! @return             Whether the image is rendered, it fails if the port can't be listened to.
+    bool    Render();
+
+private:
+    //! @brief  State of one tile of the image.
+    struct TileState{
+        Vector2i        coord;              /**< Top-left corner of the tile. */
+        Vector2i        size;               /**< Size of the tile. */
+        unsigned int    sampleOffset = 0;   /**< Samples per pixel merged so far. */
+        unsigned int    sampleCnt = 0;      /**< Samples per pixel of the pass handed out. */
+        unsigned int    workerCnt = 0;      /**< Number of workers rendering the pass. */
+        unsigned int    handoutTime = 0;    /**< When the pass is handed out for the first time in milliseconds. */
+        bool            finished = false;   /**< Whether there is no more pass to be rendered. */
+    };
+
+    //! @brief  A worker connected to the coordinator.
+    struct RemoteWorker{
+        std::unique_ptr<Socket>         socket;             /**< The connection to the worker. */
+        std::unique_ptr<ISocketStream>  input;              /**< Messages coming from the worker. */
+        std::unique_ptr<OSocketStream>  output;             /**< Messages going to the worker. */
+        unsigned int                    capacity = 0;       /**< Number of threads of the worker, 0 means it is not ready. */
+        std::vector<unsigned int>       tiles;              /**< Tiles handed out to the worker but not returned yet. */
+        unsigned int                    responseTime = 0;   /**< When the worker responded last time in milliseconds. */
+    };
+
+    std::string                                 m_sceneFile;        /**< Full path of the scene file. */
+    std::uint64_t                               m_sceneHash;        /**< Hash of the content of the scene file. */
+    Socket                                      m_listener;         /**< Socket waiting for workers to connect. */
+    std::vector<TileState>                      m_tiles;            /**< All tiles of the image in the order of handing out. */
+    std::vector<std::unique_ptr<RemoteWorker>>  m_workers;          /**< All workers connected. */
+    Timer                                       m_timer;            /**< Clock of the coordinator. */
+    Timer                                       m_budgetTimer;      /**< Clock of the time budget, it starts with the first pass handed out. */
+    bool                                        m_started = false;  /**< Whether any pass is handed out. */
+    unsigned int                                m_finishedCnt = 0;  /**< Number of tiles with all passes merged. */
+    unsigned int                                m_passTime = 0;     /**< Total time of passes merged in milliseconds. */
+    unsigned int                                m_passCnt = 0;      /**< Number of passes merged. */
+
+    //! @brief  Accept a new worker and send the scene to it.
+    void    acceptWorker();
+
+    //! @brief  Handle a message from a worker.
+    //!
+    //! @param  worker      The worker sending the message.
+    //! @return             Whether the worker is still usable.
+    bool    receive( RemoteWorker& worker );
+
+    //! @brief  Hand out another batch of passes to an idle worker.
+    //!
+    //! @param  worker      The idle worker.
+    void    handout( RemoteWorker& worker );
+
+    //! @brief  Release a worker, tiles handed out only to the worker go back to the queue.
+    //!
+    //! @param  worker      The worker to be released.
+    void    release( RemoteWorker& worker );
+
+    //! @brief  The pass of a tile comes to an end, the next pass is to be handed out if there is any.
+    //!
+    //! @param  tile        The tile with its pass merged.
+    void    finishPass( TileState& tile );
+
+    //! @brief  Whether the time budget of progressive rendering runs out.
+    //!
+    //! @return             It returns true if no more passes are to be handed out except the first ones.
+    bool    outOfBudget() const;
+};
@@ -21,6 +21,7 @@
 #include "material/matmanager.h"
 #include "core/globalconfig.h"
 #include "core/scene.h"
+#include "camera/camera.h"
 
 SORT_STATS_DEFINE_COUNTER(sPreprocessTimeMS)
 SORT_STATS_TIME("Performance", "Pre-processing Time", sPreprocessTimeMS);
@@ -33,13 +34,55 @@ void Loading_Task::Execute(){
 
     // Serialize the scene entities
     m_scene.LoadScene(m_stream);
+
+    // Resources are loaded along with the entities
+    MatManager::GetSingleton().WaitForResourceLoading();
 }
 
 void SpatialAccelerationConstruction_Task::Execute(){
     SORT_STATS( TIMING_EVENT_STAT( "Spatial acceleration structure construction" , sPreprocessTimeMS ) );
 
 	sAssert( g_accelerator , SPATIAL_ACCELERATOR );
-	g_accelerator->Build(m_scene.GetPrimitives(), m_scene.GetBBox());
+
+    // the cached acceleration structure is reused if the topology of the scene is not changed, it is refitted if primitives are moved.
+    const auto& cache_file = g_acceleratorCacheFilePath;
+    const auto topology = m_scene.GetTopologyHash();
+    const auto geometry = m_scene.GetGeometryHash();
+    auto refitted = false;
+    auto loaded = false;
+    if( !cache_file.empty() && LoadAcceleratorCache( *g_accelerator , cache_file , topology , geometry , m_scene.GetPrimitives() , m_scene.GetBBox() , refitted ) ){
+        slog( INFO , SPATIAL_ACCELERATOR , "Spatial acceleration structure is %s from %s." , refitted ? "refitted" : "loaded" , cache_file.c_str() );
+        loaded = !refitted;
+    }else{
+        // nodes the camera sees are refined more if camera rays are weighted in the cost model
+        RayDistribution rays;
+        const auto camera = m_scene.GetCamera();
+        if( g_cameraSah > 0.0f && IS_PTR_VALID( camera ) && camera->GetRayCone( rays.origin , rays.dir , rays.cosHalfAngle ) )
+            rays.weight = g_cameraSah;
+        g_accelerator->SetRayDistribution( rays );
+        g_accelerator->Build(m_scene.GetPrimitives(), m_scene.GetBBox());
+    }
+
+    if( !loaded && !cache_file.empty() && g_accelerator->GetIsValid() && !SaveAcceleratorCache( *g_accelerator , cache_file , topology , geometry ) )
+        slog( INFO , SPATIAL_ACCELERATOR , "Spatial acceleration structure is not cached in %s." , cache_file.c_str() );
+
+    // probe rays of SSS materials traverse their own primitives only
+    m_scene.BuildSSSAccelerators();
+}
+
+void SpatialAccelerationRefit_Task::Execute(){
+    SORT_STATS( TIMING_EVENT_STAT( "Spatial acceleration structure refitting" , sPreprocessTimeMS ) );
+
+    sAssert( g_accelerator , SPATIAL_ACCELERATOR );
+    if( !g_accelerator->RefitScene( m_scene.GetBBox() ) ){
+        slog( INFO , SPATIAL_ACCELERATOR , "Spatial acceleration structure is built again since refitting degrades it too much." );
+        g_accelerator->Build( m_scene.GetPrimitives() , m_scene.GetBBox() );
+    }
+    m_scene.BuildSSSAccelerators();
+
+    // volumes are few, it is not worth refitting them
+    sAssert( g_acceleratorVol , SPATIAL_ACCELERATOR );
+    g_acceleratorVol->Build( m_scene.GetPrimitivesVol() , m_scene.GetBBoxVol() );
 }
 
 void SpatialAccelerationVolConstruction_Task::Execute() {
@@ -32,6 +32,11 @@ public:
     //! @brief  Load data from input file.
     void        Execute() override;
 
+    //! @brief  Loading is mostly waiting for the stream, heavy entities are deserialized in forked compute tasks.
+    TaskClass   GetTaskClass() const override {
+        return TaskClass::IO;
+    }
+
 private:
     /**< The scene description to be filled with during loading. */
     class Scene&            m_scene;
@@ -56,6 +61,24 @@ private:
     class Scene&      m_scene;
 };
 
+//! @brief  Refit the spatial acceleration structures after entities of the scene are moved.
+/**
+ * It is only scheduled in server mode, where the scene stays resident between frames. The acceleration structure is
+ * built again only if refitting degrades it too much.
+ */
+class SpatialAccelerationRefit_Task : public Task{
+public:
+    SpatialAccelerationRefit_Task( class Scene& scene, const char* name ,
+                 unsigned int priority , const Task::Task_Container& dependencies ) :
+        Task( name , DEFAULT_TASK_PRIORITY, dependencies  ) , m_scene(scene) {}
+
+    void        Execute() override;
+
+private:
+    /**< The scene that is moved. */
+    class Scene&      m_scene;
+};
+
 //! @brief  Spatial acceleration data structure construction pass, this is for primitives that has volumes attached.
 class SpatialAccelerationVolConstruction_Task : public Task {
 public:
@@ -24,68 +24,850 @@
 #include "core/profile.h"
 #include "sampler/random.h"
 #include "medium/medium.h"
+#include "core/timer.h"
+#include "texture/texturefeedback.h"
+#include "imagesensor/relightcache.h"
+#include <algorithm>
+#include <climits>
+
+// Time budget of progressive rendering is measured against this clock.
+static Timer g_renderingTimer;
+
+// Maximum number of camera rays traced in one packet.
+static constexpr unsigned int RAY_PACKET_SIZE = 256;
+
+// Only one pixel in this many pixels along each axis is traced in the prepass estimating the cost of tiles.
+static constexpr int TILE_COST_PREPASS_STRIDE = 4;
+
+// Tiles are not split into pieces with fewer rows than this.
+static constexpr int TILE_SPLIT_MIN_ROWS = 4;
+
+// Random numbers of light paths are drawn from this stream, so that they don't correlate with the ones of camera rays.
+static constexpr unsigned int LIGHT_PATH_RANDOM_STREAM = 2;
+
+// Blocks of the coarsest pass of the resolution pyramid are this many pixels along each axis, the size is halved
+// in each later pass until it reaches two.
+static constexpr int RESOLUTION_PYRAMID_TOP = 8;
+
+// Number of coarse passes of the resolution pyramid.
+static constexpr unsigned int RESOLUTION_PYRAMID_LEVEL_CNT = 3;
+
+// Pixels with the first hit blurred into a spot larger than this radius in pixels are flagged as strongly defocused.
+static constexpr float DEFOCUS_HINT_RADIUS = 4.0f;
+
+// Samplers and pixel samples are only needed while a render task is executed, each worker keeps one set of them
+// instead of every task waiting in the queues holding its own.
+struct RenderTaskPool{
+    std::unique_ptr<Sampler>    sampler;            /**< Sampler shared by all render tasks executed by the worker. */
+    std::vector<PixelSample>    pixelSamples;       /**< Pixel samples shared by all render tasks executed by the worker. */
+};
+static thread_local RenderTaskPool g_renderTaskPool;
+
+// Samples of a pixel taken in the current pass, they are accumulated here until the pixel is stored.
+struct PixelPass{
+    Spectrum        radiance;                   /**< Sum of the radiance of valid samples. */
+    unsigned int    takenCnt = 0;               /**< Number of samples taken. */
+    unsigned int    validCnt = 0;               /**< Number of valid samples. */
+    unsigned int    sampleOffset = 0;           /**< Samples taken by the pixel before this pass. */
+    PixelStats*     stats = nullptr;            /**< Statistics of the pixel with adaptive sampling, nullptr otherwise. */
+    bool            skipped = false;            /**< Whether the pixel was converged before the pass. */
+    bool            converged = false;          /**< Whether the pixel converged during the pass. */
+};
+
+// Take every other bit of a Morton code, which is the coordinate along one of the axes.
+static SORT_FORCEINLINE unsigned compactMortonBits( unsigned v ){
+    v &= 0x55555555u;
+    v = ( v | ( v >> 1 ) ) & 0x33333333u;
+    v = ( v | ( v >> 2 ) ) & 0x0f0f0f0fu;
+    v = ( v | ( v >> 4 ) ) & 0x00ff00ffu;
+    v = ( v | ( v >> 8 ) ) & 0x0000ffffu;
+    return v;
+}
+
+// Pixels of a tile in the order they are traced. Tiles are neither always square nor a power of two in size, the Morton
+// curve covers the smallest square of a power of two around the tile and pixels outside of the tile are dropped.
+static std::vector<Vector2i> pixelsInOrder( const Vector2i& coord , const Vector2i& size , PixelOrder order ){
+    std::vector<Vector2i> pixels;
+    pixels.reserve( size.x * size.y );
+    if( PixelOrder::Scanline == order ){
+        for( int i = coord.y ; i < coord.y + size.y ; ++i )
+            for( int j = coord.x ; j < coord.x + size.x ; ++j )
+                pixels.push_back( Vector2i( j , i ) );
+        return pixels;
+    }
+
+    auto side = 1u;
+    while( side < (unsigned)std::max( size.x , size.y ) )
+        side <<= 1;
+    for( auto m = 0u ; m < side * side ; ++m ){
+        const auto x = (int)compactMortonBits( m );
+        const auto y = (int)compactMortonBits( m >> 1 );
+        if( x < size.x && y < size.y )
+            pixels.push_back( Vector2i( coord.x + x , coord.y + y ) );
+    }
+    return pixels;
+}
+
+// Number of tiles of the whole image. It is the step between the priorities of two passes of a tile, tiles culled by
+// the region only leave gaps in them.
+static unsigned int imageTileCnt(){
+    const auto tile_size = g_tileSize;
+    return ( ( g_resultResollutionWidth + tile_size - 1 ) / tile_size ) * ( ( g_resultResollutionHeight + tile_size - 1 ) / tile_size );
+}
+
+// Priority of a full pass of a tile. Passes are ordered by their index first and by the order of tiles next, the base
+// leaves room for every pass configured so that even the last one stays above tasks taking the default priority.
+static unsigned int passPriority( unsigned int sampleOffset , unsigned int tileIndex ){
+    const auto tile_cnt = (unsigned long long)imageTileCnt();
+    const auto pass_cnt = ( g_samplePerPixel + g_samplePerPass - 1 ) / g_samplePerPass;
+    const auto pass = std::min( sampleOffset / g_samplePerPass , pass_cnt - 1 );
+    const auto priority = DEFAULT_TASK_PRIORITY + ( pass_cnt - pass ) * tile_cnt - tileIndex;
+    sAssertMsg( priority + RESOLUTION_PYRAMID_LEVEL_CNT * tile_cnt <= UINT_MAX , TASK , "Too many passes to order them by priority." );
+    return (unsigned int)priority;
+}
+
+SORT_STATS_DEFINE_COUNTER(sSplitTileCount)
+SORT_STATS_DEFINE_COUNTER(sDefocusedPixelCount)
+SORT_STATS_COUNTER("Performance", "Split Tiles", sSplitTileCount);
+SORT_STATS_COUNTER("Performance", "Defocused Pixels", sDefocusedPixelCount);
+SORT_STATS_DEFINE_COUNTER(sLightPathTaskCount)
+SORT_STATS_DEFINE_COUNTER(sDraftSampleCount)
+SORT_STATS_DEFINE_COUNTER(sReusedDraftSampleCount)
+SORT_STATS_COUNTER("Performance", "Resolution Pyramid Samples", sDraftSampleCount);
+SORT_STATS_COUNTER("Performance", "Resolution Pyramid Samples Reused", sReusedDraftSampleCount);
+SORT_STATS_COUNTER("Performance", "Light Path Tasks", sLightPathTaskCount);
+
+void ForEachTile( const std::function<void( const Vector2i& , const Vector2i& )>& func ){
+    const auto tilesize = (int)g_tileSize;
+    const auto width = (int)g_resultResollution[0];
+    const auto height = (int)g_resultResollution[1];
+
+    Vector2i region_min , region_max;
+    GlobalConfiguration::GetSingleton().GetRenderRegion( region_min , region_max );
+
+    // get the number of total task
+    Vector2i tile_num = Vector2i( (int)ceil(width / (float)tilesize) , (int)ceil(height / (float)tilesize) );
+
+    // start tile from center instead of top-left corner
+    Vector2i cur_pos( tile_num / 2 );
+    int cur_dir = 0;
+    int cur_len = 0;
+    int cur_dir_len = 1;
+    const Vector2i dir[4] = { Vector2i( 0 , -1 ) , Vector2i( -1 , 0 ) , Vector2i( 0 , 1 ) , Vector2i( 1 , 0 ) };
+
+    while (true){
+        // only process node inside the image region
+        if (cur_pos.x >= 0 && cur_pos.x < tile_num.x && cur_pos.y >= 0 && cur_pos.y < tile_num.y ){
+            Vector2i tl( cur_pos.x * tilesize , cur_pos.y * tilesize );
+            Vector2i size( (tilesize < (width - tl.x)) ? tilesize : (width - tl.x) ,
+                           (tilesize < (height - tl.y)) ? tilesize : (height - tl.y) );
+
+            // tiles are clipped by the region, pieces of them still belong to the tiles they come from
+            const Vector2i rtl( std::max( tl.x , region_min.x ) , std::max( tl.y , region_min.y ) );
+            const Vector2i rbr( std::min( tl.x + size.x , region_max.x ) , std::min( tl.y + size.y , region_max.y ) );
+            if( rtl.x < rbr.x && rtl.y < rbr.y )
+                func( rtl , rbr - rtl );
+        }
+
+        // turn to the next direction
+        if (cur_len >= cur_dir_len){
+            cur_dir = (cur_dir + 1) % 4;
+            cur_len = 0;
+            cur_dir_len += 1 - cur_dir % 2;
+        }
+
+        cur_pos += dir[cur_dir];
+        ++cur_len;
+        if( (cur_pos.x < 0 || cur_pos.x >= tile_num.x ) && (cur_pos.y < 0 || cur_pos.y >= tile_num.y ) )
+            break;
+    }
+}
+
+Vector2i TileSlot( const Vector2i& coord , int tileSize , int height ){
+    return Vector2i( coord.x / tileSize , ( height - 1 - coord.y / tileSize * tileSize ) / tileSize );
+}
+
+void ScheduleRenderTiles( const std::vector<RenderTile>& tiles , const Scene& scene , const Task* dependency ){
+    std::vector<const Task*> dependencies;
+    if( dependency )
+        dependencies.push_back( dependency );
+
+    // coarse passes take priorities above all full passes, the coarsest one goes first. Each pass of a tile depends on
+    // the coarser one since it fills its blocks with pixels traced by them.
+    const auto tile_cnt = imageTileCnt();
+    for( auto t = 0u ; t < (unsigned int)tiles.size() ; ++t ){
+        const auto& tile = tiles[t];
+        auto tile_dependencies = dependencies;
+        auto feedback = tile.textureFeedback;
+
+        // the last task of the chain is held until the next one is registered on it, it could be finished right away
+        TaskHandle previous;
+        if( g_imageSensor->HasDraft() && tile.sampleOffset == 0 ){
+            if( !feedback )
+                feedback = std::make_shared<TextureFeedback>();
+            auto draft_priority = passPriority( 0 , t ) + RESOLUTION_PYRAMID_LEVEL_CNT * tile_cnt;
+            for( auto level = RESOLUTION_PYRAMID_TOP ; level > 1 ; level /= 2 , draft_priority -= tile_cnt ){
+                previous = SCHEDULE_TASK<Draft_Task>( "draft task" , draft_priority , tile_dependencies ,
+                                                      tile.coord , tile.size , scene , level , feedback );
+                tile_dependencies = { previous };
+            }
+        }
+
+        // texture tiles the prepasses asked for are loaded by an I/O worker before the first full pass
+        const auto priority = passPriority( tile.sampleOffset , t );
+        if( feedback ){
+            previous = SCHEDULE_TASK<TexturePrefetch_Task>( "texture prefetch task" , priority , tile_dependencies , feedback );
+            tile_dependencies = { previous };
+        }
+        SCHEDULE_TASK<Render_Task>( "render task" , priority , tile_dependencies , tile.coord , tile.size , scene ,
+                                    tile.sampleOffset , std::min( g_samplePerPass , g_samplePerPixel - tile.sampleOffset ) );
+    }
+}
+
+void ScheduleLightPaths( const Scene& scene , const Task* dependency ){
+    if( IS_PTR_INVALID(g_integrator) )
+        return;
+
+    std::vector<const Task*> dependencies;
+    if( dependency )
+        dependencies.push_back( dependency );
+
+    // batches take the lowest priority, being small and even, they fill the gaps left by tiles at the end of rendering
+    const auto total = g_integrator->GetLightPathCnt();
+    const auto batch = std::max( 1u , g_integrator->GetLightPathBatchSize() );
+    for( auto first = 0ull ; first < total ; first += batch ){
+        const auto cnt = (unsigned int)std::min<unsigned long long>( batch , total - first );
+        SCHEDULE_TASK<LightPath_Task>( "light path task" , 0 , dependencies , scene , first , cnt );
+    }
+}
+
+void Render_Task::ResetTimeBudget(){
+    g_renderingTimer.Reset();
+}
+
+void Render_Task::SetCancelled( bool cancelled ){
+    Scheduler::GetSingleton().SetFlushing( cancelled );
+}
+
+bool Render_Task::IsCancelled(){
+    return Scheduler::GetSingleton().IsFlushing();
+}
 
 Render_Task::Render_Task(const Vector2i& ori , const Vector2i& size , const Scene& scene ,
+            unsigned int sampleOffset , unsigned int sampleCnt ,
             const char* name , unsigned int priority , const Task::Task_Container& dependencies ) :
-            Task( name , priority , dependencies ), m_coord(ori), m_size(size), m_scene(scene){
-    m_sampler = std::make_unique<RandomSampler>();
-    m_pixelSamples = std::make_unique<PixelSample[]>(g_samplePerPixel);
+            Task( name , priority , dependencies ), m_coord(ori), m_size(size), m_scene(scene),
+            m_sampleOffset(sampleOffset), m_sampleCnt(sampleCnt){
+}
+
+void Render_Task::acquireSamples(){
+    auto& pool = g_renderTaskPool;
+    if( IS_PTR_INVALID(pool.sampler) ){
+        pool.sampler = MakeUniqueInstance<Sampler>( g_samplerType );
+        if( IS_PTR_INVALID(pool.sampler) )
+            pool.sampler = std::make_unique<RandomSampler>();
+    }
+    if( pool.pixelSamples.size() < m_sampleCnt )
+        pool.pixelSamples.resize( m_sampleCnt );
+
+    m_sampler = pool.sampler.get();
+    m_pixelSamples = pool.pixelSamples.data();
 }
 
 void Render_Task::Execute(){
     if(IS_PTR_INVALID(g_integrator))
         return;
 
+    // stop refining the tile once the time budget runs out, the first pass is always finished
+    if( g_progressive && m_sampleOffset > 0 && g_timeBudget > 0.0f && g_renderingTimer.GetElapsedTime() >= g_timeBudget * 1000.0f )
+        return;
+
+    // release whatever is left by previous tasks, samples below only rewind their own memory
+    SORT_CLEAR_MEMPOOL();
+
     auto camera = m_scene.GetCamera();
 
+    // each sample covers a fraction of the pixel
+    const auto differential_scale = 1.0f / sqrt( (float)g_samplePerPixel );
+
     // request samples
-    g_integrator->RequestSample( m_sampler.get() , m_pixelSamples.get() , g_samplePerPixel);
+    acquireSamples();
+    g_integrator->RequestSample( m_sampler , m_pixelSamples , m_sampleCnt);
+
+    // integrators draw samples of every bounce from the sampler of the task
+    BindSampler( m_sampler );
+
+    g_integrator->BeginPass( m_sampleOffset , m_scene );
+
+    // results are accumulated in the tile buffer and flushed to the image sensor once the tile is done
+    m_tileRadiance = std::make_unique<Spectrum[]>( m_size.x * m_size.y );
+    m_tileWeight = std::make_unique<float[]>( m_size.x * m_size.y );
+
+    // filtered samples reach the pixels around them, the tile buffer has an apron for the ones beyond the tile
+    const auto filter = g_imageSensor->GetPixelFilter();
+    if( filter ){
+        m_filteredTile = std::make_unique<FilteredTile>();
+        m_filteredTile->Reset( m_coord , m_size , *filter );
+    }
+
+    // robust accumulation keeps the samples of each pixel in buckets, the tile average is still used by AOVs
+    const auto bucket_cnt = g_imageSensor->GetRobustBucketCnt();
+    if( bucket_cnt > 0 ){
+        m_bucketTile = std::make_unique<BucketTile>();
+        m_bucketTile->Reset( m_coord , m_size , bucket_cnt );
+    }
+
+    // AOVs are recorded by the integrator in the sample bound to the thread and averaged the same way as the radiance
+    const auto aov = g_imageSensor->HasAov();
+    if( aov ){
+        m_tileAov = std::make_unique<float[]>( m_size.x * m_size.y * AOV_CHANNEL_CNT );
+        BindAovSample( &m_aovSample );
+    }
+
+    // radiance split by lights is recorded sample by sample so that the frame could be relit later
+    const auto relight = RelightCache::GetSingleton().IsRecording();
+    RelightSample relight_sample;
+    if( relight )
+        BindRelightSample( &relight_sample );
+
+    const auto adaptive = g_adaptiveSampling;
+    const auto min_spp = g_minSamplePerPixel;
+    const auto noise_threshold = g_noiseThreshold;
+
+    unsigned long long traced_sample_cnt = 0;
+    auto tile_converged = adaptive;
+
+    // pixels with adaptive sampling stop taking samples on their own pace, they can't be traced in packets
+    const auto packet = !adaptive && !relight && g_integrator->SupportPrimaryRayPacket();
+    if( packet )
+        traced_sample_cnt = renderPackets( camera );
+
+    // pixels are visited row by row, or along a Morton curve so that consecutive camera rays stay close to each other.
+    // Rows of a tile can't be handed to other workers while the curve is walked, it is split before anything is traced.
+    const auto pixel_order = g_pixelOrder;
+    if( !packet && pixel_order != PixelOrder::Scanline )
+        splitTile( m_coord.y );
+    const auto pixels = packet ? std::vector<Vector2i>() : pixelsInOrder( m_coord , m_size , pixel_order );
+
+    // interleaved samples are taken one pass over the tile at a time, instead of all samples of a pixel back-to-back
+    const auto round_cnt = pixel_order == PixelOrder::Interleaved ? m_sampleCnt : 1u;
+    const auto round_size = m_sampleCnt / round_cnt;
+    auto passes = std::make_unique<PixelPass[]>( pixels.size() );
+
+    // take one sample of a pixel, it returns false once the pixel is converged
+    auto trace_sample = [&]( int j , int i , unsigned k , PixelPass& pass ){
+        // memory allocated for the sample is released once it is done
+        SORT_MEMORY_SCOPE();
+
+        // generate rays
+        const auto sample_offset = pass.sampleOffset;
+        const auto stats = pass.stats;
+        generateCameraSample( j , i , sample_offset + k , m_pixelSamples[k] );
+        auto r = camera->GenerateRay( (float)j , (float)i , m_pixelSamples[k] );
+        r.ScaleDifferentials( differential_scale );
+
+        // the very first sample of a pixel tells whether what it sees is strongly defocused
+        if( stats && sample_offset + k == 0 && camera->HasDepthOfField() ){
+            SurfaceInteraction probe;
+            if( m_scene.GetIntersect( r , probe ) && camera->GetDefocusRadius( probe.intersect ) > DEFOCUS_HINT_RADIUS ){
+                stats->FlagDefocused();
+                SORT_STATS(++sDefocusedPixelCount);
+            }
+        }
+
+        Spectrum li;
+        if( sample_offset + k == 0 && !aov && !relight && g_imageSensor->HasDraftSample( j , i ) ){
+            // the first sample is taken by the resolution pyramid already
+            li = g_imageSensor->GetDraftSample( j , i );
+            SORT_STATS(++sReusedDraftSampleCount);
+        }else{
+            // random numbers taken by the integrator only depend on the pixel sample, not the thread
+            sort_seed( j , i , sample_offset + k , 1 );
+            if( aov )
+                m_aovSample.Clear();
+            if( relight )
+                relight_sample.Clear();
+            // accumulate the radiance
+            const Timer sample_timer;
+            li = g_integrator->Li( r , m_pixelSamples[k] , m_scene );
+            if( aov )
+                RecordTimeAov( sample_timer.GetElapsedTimeInMicroseconds() );
+            if( g_clammping > 0.0f )
+                li = li.Clamp( 0.0f , g_clammping );
+        }
+        ++pass.takenCnt;
+
+        sAssert( li.IsValid() , GENERAL );
+
+        if( li.IsValid() ){
+            pass.radiance += li;
+            ++pass.validCnt;
+            if( filter )
+                m_filteredTile->AddSample( j + m_pixelSamples[k].img_u , i + m_pixelSamples[k].img_v , li , *filter );
+            if( bucket_cnt > 0 )
+                m_bucketTile->AddSample( j , i , sample_offset + k , li );
+            if( aov ){
+                // the tile buffer keeps the sum of AOVs until the pixel is stored
+                auto aov_sum = m_tileAov.get() + ( ( i - m_coord.y ) * m_size.x + j - m_coord.x ) * AOV_CHANNEL_CNT;
+                for( auto c = 0u ; c < AOV_CHANNEL_CNT ; ++c )
+                    aov_sum[c] += m_aovSample.channels[c];
+            }
+            if( relight )
+                RelightCache::GetSingleton().AddSample( j , i , li , relight_sample );
+
+            // stop sampling the pixel once it is converged
+            if( stats ){
+                stats->Add( li.GetIntensity() );
+                if( stats->IsConverged( min_spp , noise_threshold ) )
+                    return false;
+            }
+        }
+        return true;
+    };
+
+    // a cancelled tile stops at the next sample, it has to be quick for interactive updates
+    auto cancelled = false;
+    for( auto round = 0u ; round < round_cnt && !cancelled ; ++round ){
+        for( auto p = 0u ; p < pixels.size() && !cancelled ; ++p ){
+            const auto j = pixels[p].x;
+            const auto i = pixels[p].y;
+            if( pixel_order == PixelOrder::Scanline && j == m_coord.x )
+                splitTile( i );
+
+            // rows handed to another task are not traced here
+            if( i >= m_coord.y + m_size.y )
+                continue;
 
-    Vector2i rb = m_coord + m_size;
+            auto& pass = passes[p];
+            if( 0 == round ){
+                // converged pixels don't take any more samples
+                pass.stats = adaptive ? &g_imageSensor->GetPixelStats( j , i ) : nullptr;
+                pass.skipped = pass.stats && pass.stats->IsConverged( min_spp , noise_threshold );
+                pass.sampleOffset = pass.stats ? pass.stats->GetCnt() : m_sampleOffset;
+            }
+            if( pass.skipped || pass.converged )
+                continue;
+
+            for( auto k = round * round_size ; k < ( round + 1 ) * round_size ; ++k ){
+                if( UNLIKELY( IsCancelled() ) ){
+                    cancelled = true;
+                    break;
+                }
+                if( !trace_sample( j , i , k , pass ) ){
+                    pass.converged = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    // store the pixels once all of their samples are taken
+    for( auto p = 0u ; p < pixels.size() && !cancelled ; ++p ){
+        const auto j = pixels[p].x;
+        const auto i = pixels[p].y;
+        const auto& pass = passes[p];
+        if( i >= m_coord.y + m_size.y || pass.skipped )
+            continue;
+
+        const auto sample_cnt = pass.stats ? pass.validCnt : m_sampleCnt;
+        const auto pixel_id = ( i - m_coord.y ) * m_size.x + j - m_coord.x;
+        // a pass without any valid sample leaves the pixel untouched instead of blending black into it
+        m_tileRadiance[pixel_id] = pass.validCnt > 0 ? pass.radiance / (float)pass.validCnt : pass.radiance;
+        m_tileWeight[pixel_id] = pass.validCnt > 0 ? (float)sample_cnt / (float)( pass.sampleOffset + sample_cnt ) : 0.0f;
+        if( aov )
+            storeAov( pixel_id , m_tileAov.get() + pixel_id * AOV_CHANNEL_CNT , pass.validCnt , pass.sampleOffset + sample_cnt );
+
+        traced_sample_cnt += pass.takenCnt;
+        tile_converged &= pass.stats && pass.stats->IsConverged( min_spp , noise_threshold );
+    }
+
+    BindSampler( nullptr );
+    BindAovSample( nullptr );
+    BindRelightSample( nullptr );
+
+    g_integrator->EndPass( m_sampleOffset );
+
+    // nothing of a cancelled tile is written to the image sensor, neither is the next pass scheduled
+    if( cancelled || IsCancelled() ){
+        m_tileRadiance = nullptr;
+        m_tileWeight = nullptr;
+        m_tileAov = nullptr;
+        m_filteredTile = nullptr;
+        m_bucketTile = nullptr;
+        return;
+    }
+
+    // pieces of a split tile still belong to the tile they come from
+    const auto slot = TileSlot( m_coord , (int)g_tileSize , (int)g_resultResollutionHeight );
+    RenderedTile tile;
+    tile.coord = m_coord;
+    tile.size = m_size;
+    tile.sampleOffset = m_sampleOffset;
+    tile.sampleCnt = m_sampleCnt;
+    tile.radiance = m_tileRadiance.get();
+    tile.weight = m_tileWeight.get();
+    tile.aov = m_tileAov.get();
+    tile.filtered = m_filteredTile.get();
+    tile.buckets = m_bucketTile.get();
+    g_imageSensor->FinishTile( slot.x , slot.y , tile );
+    g_imageSensor->NotifyTileFinished( m_coord , m_size );
+
+    m_tileRadiance = nullptr;
+    m_tileWeight = nullptr;
+    m_tileAov = nullptr;
+    m_filteredTile = nullptr;
+    m_bucketTile = nullptr;
+
+    g_imageSensor->AddTracedSamples( traced_sample_cnt );
+
+    // schedule the next pass of the tile, lowering the priority by the tile count makes sure all tiles
+    // finish their current pass before any later pass kicks in. Converged tiles leave the budget to noisy ones.
+    // The first pass takes a priority with room for all passes, see 'passPriority'.
+    const auto next_offset = m_sampleOffset + m_sampleCnt;
+    if( g_progressive && next_offset < g_samplePerPixel && !tile_converged ){
+        SCHEDULE_TASK<Render_Task>( "render task" , GetPriority() - imageTileCnt() , {} , m_coord , m_size , m_scene ,
+                                    next_offset , std::min( g_samplePerPass , g_samplePerPixel - next_offset ) );
+    }
+}
+
+void Draft_Task::Execute(){
+    if(IS_PTR_INVALID(g_integrator))
+        return;
+
+    SORT_CLEAR_MEMPOOL();
 
-    for( int i = m_coord.y ; i < rb.y ; i++ ){
-        for( int j = m_coord.x ; j < rb.x ; j++ ){
-            // generate samples to be used later
-            g_integrator->GenerateSample( m_sampler.get() , m_pixelSamples.get(), g_samplePerPixel, m_scene );
+    auto camera = m_scene.GetCamera();
+    const auto differential_scale = 1.0f / sqrt( (float)g_samplePerPixel );
+
+    acquireSamples();
+    g_integrator->RequestSample( m_sampler , m_pixelSamples , 1 );
+    BindSampler( m_sampler );
+    g_integrator->BeginPass( 0 , m_scene );
+
+    // texture tiles not resident are black in the coarse pass, the full passes don't start until they are loaded
+    TextureFeedbackScope feedback_scope( m_feedback.get() );
+
+    // the sample taken here stands for the first sample of the pixel in the first full pass
+    const auto rb = m_coord + m_size;
+    for( int i = m_coord.y ; i < rb.y ; i += m_level ){
+        for( int j = m_coord.x ; j < rb.x ; j += m_level ){
+            // pixels of the coarser pass are traced already
+            const auto coarser = m_level < RESOLUTION_PYRAMID_TOP && ( i - m_coord.y ) % ( 2 * m_level ) == 0 && ( j - m_coord.x ) % ( 2 * m_level ) == 0;
+            if( coarser )
+                continue;
+
+            SORT_MEMORY_SCOPE();
+
+            generateCameraSample( j , i , 0 , m_pixelSamples[0] );
+            auto r = camera->GenerateRay( (float)j , (float)i , m_pixelSamples[0] );
+            r.ScaleDifferentials( differential_scale );
+
+            sort_seed( j , i , 0 , 1 );
+            auto li = g_integrator->Li( r , m_pixelSamples[0] , m_scene );
+            if( g_clammping > 0.0f )
+                li = li.Clamp( 0.0f , g_clammping );
+            g_imageSensor->SetDraftSample( j , i , li );
+            SORT_STATS(++sDraftSampleCount);
+        }
+    }
+
+    BindSampler( nullptr );
+    g_integrator->EndPass( 0 );
+
+    auto x_off = m_coord.x / g_tileSize;
+    auto y_off = (g_resultResollutionHeight - 1 - m_coord.y / g_tileSize * g_tileSize ) / g_tileSize ;
+    g_imageSensor->FinishDraft( x_off , y_off , m_coord , m_size , m_level );
+}
 
-            // the radiance
-            Spectrum radiance;
+void TexturePrefetch_Task::Execute(){
+    m_feedback->Prefetch();
+}
+
+void Render_Task::generateCameraSample( int x , int y , unsigned index , PixelSample& ps ){
+    sort_seed( x , y , index , 0 );
+    ps.pixel_x = x;
+    ps.pixel_y = y;
+    ps.index = index;
+    m_sampler->StartPixelSample( x , y , index );
+    m_sampler->Get2D( ps.img_u , ps.img_v );
+    m_sampler->Get2D( ps.dof_u , ps.dof_v );
+    ps.time = m_sampler->Get1D();
+
+    // all rays of the sample are at the same moment, the camera ray included
+    SetRayTime( ps.time );
+}
+
+void Render_Task::storeAov( int pixelId , const float* sum , unsigned int validCnt , unsigned int totalCnt ){
+    auto dst = m_tileAov.get() + pixelId * AOV_CHANNEL_CNT;
+    const auto inv = validCnt > 0 ? 1.0f / (float)validCnt : 0.0f;
+    for( auto c = 0u ; c < AOV_CHANNEL_CNT ; ++c )
+        dst[c] = sum[c] * inv;
+
+    // the sample count is not averaged, it is the total number of samples taken by the pixel
+    dst[AovChannelOffset( AOV_SAMPLE_COUNT )] = (float)totalCnt;
+}
+
+void Render_Task::splitTile( int row ){
+    if( !g_tileSplitting )
+        return;
 
-            auto valid_pixel_cnt = g_samplePerPixel;
-            for( unsigned k = 0 ; k < g_samplePerPixel; ++k ){
-                // clear managed memory after each pixel
-                SORT_CLEAR_MEMPOOL();
+    // only split if there is enough work left and some worker has nothing else to do
+    const auto rows_left = m_coord.y + m_size.y - row;
+    if( rows_left < 2 * TILE_SPLIT_MIN_ROWS || 0 == Scheduler::GetSingleton().GetIdleWorkerCnt() )
+        return;
+
+    // the bottom half of the rows left is handed to another task taking the same pass, later passes of both pieces are
+    // scheduled by themselves.
+    const auto split = row + rows_left / 2;
+    SCHEDULE_TASK<Render_Task>( "render task" , GetPriority() , {} , Vector2i( m_coord.x , split ) ,
+                                Vector2i( m_size.x , m_coord.y + m_size.y - split ) , m_scene , m_sampleOffset , m_sampleCnt );
+    m_size.y = split - m_coord.y;
+    SORT_STATS(++sSplitTileCount);
+}
 
-                // generate rays
-                auto r = camera->GenerateRay( (float)j , (float)i , m_pixelSamples[k] );
-                // accumulate the radiance
-                auto li = g_integrator->Li( r , m_pixelSamples[k] , m_scene );
+unsigned long long Render_Task::renderPackets( const Camera* camera ){
+    const auto rb = m_coord + m_size;
+    const auto pixel_cnt = std::max( 1u , RAY_PACKET_SIZE / m_sampleCnt );
+    const auto ray_cap = pixel_cnt * m_sampleCnt;
+
+    auto pixel_samples = std::make_unique<PixelSample[]>( ray_cap );
+    for( auto p = 0u ; p < pixel_cnt ; ++p )
+        g_integrator->RequestSample( m_sampler , pixel_samples.get() + p * m_sampleCnt , m_sampleCnt );
+
+    auto camera_rays = std::make_unique<Ray[]>( ray_cap );
+    auto packet_rays = std::make_unique<Ray[]>( ray_cap );
+    auto ray_ids = std::make_unique<unsigned int[]>( ray_cap );
+    auto intersects = std::make_unique<SurfaceInteraction[]>( ray_cap );
+    auto radiance = std::make_unique<Spectrum[]>( pixel_cnt );
+    auto valid_cnt = std::make_unique<unsigned int[]>( pixel_cnt );
+
+    const auto aov = IS_PTR_VALID( m_tileAov );
+    auto aov_sum = aov ? std::make_unique<float[]>( pixel_cnt * AOV_CHANNEL_CNT ) : nullptr;
+
+    // paths of a packet could be traced bounce by bounce all together, AOVs are only recorded by paths traced one by one
+    const auto deferred = g_deferredBounces && !aov;
+    auto cursors = deferred ? std::make_unique<SampleCursor[]>( ray_cap ) : nullptr;
+    auto packet_samples = deferred ? std::make_unique<const PixelSample*[]>( ray_cap ) : nullptr;
+    auto packet_radiance = deferred ? std::make_unique<Spectrum[]>( ray_cap ) : nullptr;
+
+    const auto weight = (float)m_sampleCnt / (float)( m_sampleOffset + m_sampleCnt );
+    const auto differential_scale = 1.0f / sqrt( (float)g_samplePerPixel );
+
+    unsigned long long traced_sample_cnt = 0;
+    for( int i = m_coord.y ; i < m_coord.y + m_size.y ; i++ ){
+        splitTile( i );
+        for( int j0 = m_coord.x ; j0 < rb.x ; j0 += pixel_cnt ){
+            // the caller drops the whole tile once it is cancelled
+            if( UNLIKELY( IsCancelled() ) )
+                return traced_sample_cnt;
+
+            const auto j1 = std::min( rb.x , j0 + (int)pixel_cnt );
+            const auto ray_cnt = (unsigned int)( j1 - j0 ) * m_sampleCnt;
+
+            // generate camera rays of all pixels in the packet
+            for( int j = j0 ; j < j1 ; ++j ){
+                auto ps = pixel_samples.get() + ( j - j0 ) * m_sampleCnt;
+                for( auto k = 0u ; k < m_sampleCnt ; ++k ){
+                    generateCameraSample( j , i , m_sampleOffset + k , ps[k] );
+                    auto& r = camera_rays[ ( j - j0 ) * m_sampleCnt + k ];
+                    r = camera->GenerateRay( (float)j , (float)i , ps[k] );
+                    r.ScaleDifferentials( differential_scale );
+                }
+            }
+
+            // group rays by the octant of their directions, rays in the same group visit nodes in similar orders
+            unsigned int octant_offset[9] = { 0 };
+            const auto octant = []( const Ray& r ){
+                return ( r.m_Dir.x < 0.0f ? 1 : 0 ) | ( r.m_Dir.y < 0.0f ? 2 : 0 ) | ( r.m_Dir.z < 0.0f ? 4 : 0 );
+            };
+            for( auto r = 0u ; r < ray_cnt ; ++r )
+                ++octant_offset[ octant( camera_rays[r] ) + 1 ];
+            for( auto o = 1u ; o < 9u ; ++o )
+                octant_offset[o] += octant_offset[o-1];
+            for( auto r = 0u ; r < ray_cnt ; ++r ){
+                const auto id = octant_offset[ octant( camera_rays[r] ) ]++;
+                ray_ids[id] = r;
+                packet_rays[id] = camera_rays[r];
+            }
+
+            // the time taken by the packet is shared evenly by its rays
+            const Timer packet_timer;
+            m_scene.GetIntersect( packet_rays.get() , intersects.get() , ray_cnt );
+            const auto packet_time = aov ? packet_timer.GetElapsedTimeInMicroseconds() / (float)ray_cnt : 0.0f;
+
+            // shade the samples in the order of tracing
+            for( auto p = 0u ; p < pixel_cnt ; ++p ){
+                radiance[p] = 0.0f;
+                valid_cnt[p] = 0;
+            }
+            if( aov )
+                std::fill( aov_sum.get() , aov_sum.get() + pixel_cnt * AOV_CHANNEL_CNT , 0.0f );
+            if( deferred ){
+                // allocations of a path are kept until the whole packet is done, paths are suspended between bounces
+                SORT_MEMORY_SCOPE();
+
+                for( auto r = 0u ; r < ray_cnt ; ++r ){
+                    // the pixel sample is left off right after the dimensions taken by the camera
+                    auto& cursor = cursors[r];
+                    cursor.x = j0 + (int)( ray_ids[r] / m_sampleCnt );
+                    cursor.y = i;
+                    cursor.index = m_sampleOffset + ray_ids[r] % m_sampleCnt;
+                    m_sampler->StartPixelSample( cursor.x , cursor.y , cursor.index , SAMPLER_CAMERA_DIMENSIONS );
+                    sort_seed( cursor.x , cursor.y , cursor.index , 1 );
+                    SetRayTime( pixel_samples[ray_ids[r]].time );
+                    SuspendSample( cursor );
+                    packet_samples[r] = &pixel_samples[ray_ids[r]];
+                }
+                g_integrator->LiDeferred( packet_rays.get() , packet_samples.get() , m_scene , intersects.get() , cursors.get() , ray_cnt , packet_radiance.get() );
+            }
+
+            for( auto r = 0u ; r < ray_cnt ; ++r ){
+                const auto p = ray_ids[r] / m_sampleCnt;
+
+                Spectrum li;
+                if( deferred ){
+                    li = packet_radiance[r];
+                }else{
+                    // memory allocated for the sample is released once it is done
+                    SORT_MEMORY_SCOPE();
+
+                    // resume the pixel sample right after the dimensions taken by the camera
+                    const auto index = m_sampleOffset + ray_ids[r] % m_sampleCnt;
+                    m_sampler->StartPixelSample( j0 + (int)p , i , index , SAMPLER_CAMERA_DIMENSIONS );
+                    sort_seed( j0 + (int)p , i , index , 1 );
+                    SetRayTime( pixel_samples[ray_ids[r]].time );
+                    if( aov ){
+                        m_aovSample.Clear();
+                        RecordRayAov();
+                    }
+                    const Timer sample_timer;
+                    li = g_integrator->LiWithPrimaryHit( packet_rays[r] , pixel_samples[ray_ids[r]] , m_scene , intersects[r] );
+                    if( aov )
+                        RecordTimeAov( packet_time + sample_timer.GetElapsedTimeInMicroseconds() );
+                }
                 if( g_clammping > 0.0f )
                     li = li.Clamp( 0.0f , g_clammping );
-                
+
                 sAssert( li.IsValid() , GENERAL );
-                
-                if( li.IsValid() )
-                    radiance += li;
-                else
-                    --valid_pixel_cnt;
+
+                if( li.IsValid() ){
+                    radiance[p] += li;
+                    ++valid_cnt[p];
+                    if( m_filteredTile ){
+                        const auto& ps = pixel_samples[ray_ids[r]];
+                        m_filteredTile->AddSample( j0 + (int)p + ps.img_u , i + ps.img_v , li , *g_imageSensor->GetPixelFilter() );
+                    }
+                    if( m_bucketTile )
+                        m_bucketTile->AddSample( j0 + (int)p , i , m_sampleOffset + ray_ids[r] % m_sampleCnt , li );
+                    if( aov ){
+                        auto sum = aov_sum.get() + p * AOV_CHANNEL_CNT;
+                        for( auto c = 0u ; c < AOV_CHANNEL_CNT ; ++c )
+                            sum[c] += m_aovSample.channels[c];
+                    }
+                }
             }
 
-            if( valid_pixel_cnt > 0 )
-                radiance /= (float)valid_pixel_cnt;
-            
-            // store the pixel
-            g_imageSensor->StorePixel( j , i , radiance , *this );
+            // store the pixels
+            for( int j = j0 ; j < j1 ; ++j ){
+                const auto p = j - j0;
+                const auto pixel_id = ( i - m_coord.y ) * m_size.x + j - m_coord.x;
+                m_tileRadiance[pixel_id] = valid_cnt[p] > 0 ? radiance[p] / (float)valid_cnt[p] : radiance[p];
+                m_tileWeight[pixel_id] = valid_cnt[p] > 0 ? weight : 0.0f;
+                if( aov )
+                    storeAov( pixel_id , aov_sum.get() + p * AOV_CHANNEL_CNT , valid_cnt[p] , m_sampleOffset + m_sampleCnt );
+            }
+
+            traced_sample_cnt += ray_cnt;
         }
     }
+    return traced_sample_cnt;
+}
 
-    if( g_integrator->NeedRefreshTile() ){
-        auto x_off = m_coord.x / g_tileSize;
-        auto y_off = (g_resultResollutionHeight - 1 - m_coord.y ) / g_tileSize ;
-        g_imageSensor->FinishTile( x_off, y_off, *this );
+void TileCostPrepass_Task::Execute(){
+    if( IS_PTR_INVALID(g_integrator) )
+        return;
+
+    SORT_CLEAR_MEMPOOL();
+
+    auto& tile = (*m_tiles)[m_tileId];
+    const auto camera = m_scene.GetCamera();
+    const auto rb = tile.coord + tile.size;
+
+    // the prepass takes pure random numbers in its own stream, it doesn't touch the samples of the image
+    RandomSampler sampler;
+    PixelSample ps;
+    g_integrator->RequestSample( &sampler , &ps , 1 );
+
+    tile.textureFeedback = std::make_shared<TextureFeedback>();
+    TextureFeedbackScope feedback_scope( tile.textureFeedback.get() );
+
+    const Timer timer;
+    for( int i = tile.coord.y ; i < rb.y ; i += TILE_COST_PREPASS_STRIDE ){
+        for( int j = tile.coord.x ; j < rb.x ; j += TILE_COST_PREPASS_STRIDE ){
+            SORT_MEMORY_SCOPE();
+
+            sort_seed( j , i , 0 , 2 );
+            ps.pixel_x = j;
+            ps.pixel_y = i;
+            ps.index = 0;
+            ps.img_u = sort_canonical();
+            ps.img_v = sort_canonical();
+            ps.dof_u = sort_canonical();
+            ps.dof_v = sort_canonical();
+            ps.time = sort_canonical();
+            SetRayTime( ps.time );
+            const auto r = camera->GenerateRay( (float)j , (float)i , ps );
+            g_integrator->Li( r , ps , m_scene );
+        }
     }
+    tile.cost = timer.GetElapsedTimeInMicroseconds();
+}
+
+void TileScheduling_Task::Execute(){
+    // ties keep the spiral order
+    auto& tiles = *m_tiles;
+    std::stable_sort( tiles.begin() , tiles.end() , []( const RenderTile& t0 , const RenderTile& t1 ){
+        return t0.cost > t1.cost;
+    });
+    ScheduleRenderTiles( tiles , m_scene , nullptr );
+}
+
+void LightPath_Task::Execute(){
+    if(IS_PTR_INVALID(g_integrator))
+        return;
+
+    // release whatever is left by previous tasks, paths below only rewind their own memory
+    SORT_CLEAR_MEMPOOL();
+
+    for( auto i = 0u ; i < m_cnt ; ++i ){
+        // the rest of the batch is dropped once rendering is cancelled
+        if( UNLIKELY( Render_Task::IsCancelled() ) )
+            return;
+
+        // memory allocated for the path is released once it is done
+        SORT_MEMORY_SCOPE();
+
+        // random numbers taken by the path only depend on its index, not the thread
+        const auto index = m_first + i;
+        sort_seed( (unsigned)index , (unsigned)( index >> 32 ) , 0 , LIGHT_PATH_RANDOM_STREAM );
+        g_integrator->TraceLightPath( m_scene , index );
+    }
+
+    SORT_STATS(++sLightPathTaskCount);
 }
 
 void PreRender_Task::Execute(){
+    // cameras depending on the scene, like the one baking textures, are set up before the integrator
+    if( auto camera = m_scene.GetCamera() )
+        camera->Prepare( m_scene );
     g_integrator->PreProcess(m_scene);
+    RelightCache::GetSingleton().Reset( m_scene , g_imageSensor->GetWidth() , g_imageSensor->GetHeight() );
+
+    // time budget starts after all the preparation is done
+    Render_Task::ResetTimeBudget();
+}
+
+void PostProcess_Task::Execute(){
+    g_integrator->PostProcess();
+    g_imageSensor->PostProcess();
 }
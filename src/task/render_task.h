@@ -21,6 +21,118 @@
 #include "sampler/sampler.h"
 #include "math/vector2.h"
 #include "core/scene.h"
+#include "imagesensor/aov.h"
+#include "imagesensor/pixelfilter.h"
+#include "imagesensor/robustfilm.h"
+#include <functional>
+#include <memory>
+#include <vector>
+
+class TextureFeedback;
+
+//! @brief  RenderedTile is a view of the radiance of a tile rendered in one pass.
+//!
+//! The radiance either comes from a render task of this process or from a tile rendered by a remote worker.
+//! Image sensors blend it into the image without knowing where it comes from.
+struct RenderedTile{
+    Vector2i            coord;              /**< Top-left corner of the tile. */
+    Vector2i            size;               /**< Size of the tile. */
+    unsigned int        sampleOffset = 0;   /**< Samples per pixel taken by previous passes of the tile. */
+    unsigned int        sampleCnt = 0;      /**< Samples per pixel taken in this pass. */
+    const Spectrum*     radiance = nullptr; /**< Average radiance of each pixel in this pass. */
+    const float*        weight = nullptr;   /**< Weight to blend each pixel with previous passes. */
+    const float*        aov = nullptr;      /**< Average AOVs of each pixel in this pass, nullptr if there is no AOV. */
+    const FilteredTile* filtered = nullptr; /**< Filtered samples of this pass, nullptr if samples are not filtered. */
+    const BucketTile*   buckets = nullptr;  /**< Samples of this pass split into buckets, nullptr without robust accumulation. */
+
+    //! @brief  Get the coordinate of the tile, top-left corner.
+    //!
+    //! @return Top-left corner of the tile.
+    SORT_FORCEINLINE Vector2i    GetTopLeft() const {
+        return coord;
+    }
+
+    //! @brief  Get the size of the tile.
+    //!
+    //! @return The size of the tile.
+    SORT_FORCEINLINE Vector2i    GetTileSize() const {
+        return size;
+    }
+
+    //! @brief  Get the radiance of a pixel rendered in this pass.
+    //!
+    //! @param  x       Horizontal coordinate of the pixel in the image.
+    //! @param  y       Vertical coordinate of the pixel in the image.
+    //! @return         Average radiance of the samples taken in this pass.
+    SORT_FORCEINLINE const Spectrum& GetTileRadiance( int x , int y ) const {
+        return radiance[ ( y - coord.y ) * size.x + x - coord.x ];
+    }
+
+    //! @brief  Get the weight to blend the radiance of this pass with previous passes.
+    //!
+    //! @param  x       Horizontal coordinate of the pixel in the image.
+    //! @param  y       Vertical coordinate of the pixel in the image.
+    //! @return         Blending weight, 0 means the pixel is untouched in this pass.
+    SORT_FORCEINLINE float GetTileWeight( int x , int y ) const {
+        return weight[ ( y - coord.y ) * size.x + x - coord.x ];
+    }
+
+    //! @brief  Get the AOVs of a pixel rendered in this pass.
+    //!
+    //! @param  x       Horizontal coordinate of the pixel in the image.
+    //! @param  y       Vertical coordinate of the pixel in the image.
+    //! @return         All 'AOV_CHANNEL_CNT' channels of the pixel.
+    SORT_FORCEINLINE const float* GetTileAov( int x , int y ) const {
+        return aov + ( ( y - coord.y ) * size.x + x - coord.x ) * AOV_CHANNEL_CNT;
+    }
+};
+
+//! @brief  Visit all tiles of the image, starting from the center and spiraling outwards.
+//!
+//! If only a region of the image is rendered, tiles out of it are skipped and the rest are clipped by it.
+//!
+//! @param  func    Function taking the top-left corner and the size of each tile.
+void ForEachTile( const std::function<void( const Vector2i& , const Vector2i& )>& func );
+
+//! @brief  Get the slot of the image tile that a tile or a piece of it belongs to.
+//!
+//! Pieces of tiles clipped by the region or split by render tasks don't start at multiples of the tile size, they
+//! still go to the slot of the tile they come from. Rows of slots are counted from the bottom of the image.
+//!
+//! @param  coord       Top-left corner of the tile or the piece of it.
+//! @param  tileSize    Size of tiles along each axis.
+//! @param  height      Height of the image.
+//! @return             Column and row of the slot.
+Vector2i TileSlot( const Vector2i& coord , int tileSize , int height );
+
+//! @brief  A tile to be rendered, along with its cost estimated by the prepass.
+struct RenderTile{
+    Vector2i            coord;              /**< Top-left corner of the tile. */
+    Vector2i            size;               /**< Size of the tile. */
+    unsigned int        sampleOffset = 0;   /**< Samples per pixel taken by previous passes of the tile. */
+    float               cost = 0.0f;        /**< Time in microseconds taken by the prepass of the tile, 0 if there is no prepass. */
+    std::shared_ptr<TextureFeedback> textureFeedback;   /**< Texture tiles the prepass of the tile needs, nullptr if there is no prepass. */
+};
+
+//! @brief  Tiles shared by the prepass tasks and the task scheduling the tiles afterward.
+using RenderTileList = std::shared_ptr<std::vector<RenderTile>>;
+
+//! @brief  Schedule the render tasks of the first pass of tiles.
+//!
+//! Tiles scheduled earlier get higher priorities. With the resolution pyramid, coarse passes of all tiles are
+//! scheduled ahead of the first pass of any tile. Texture tiles looked up by the coarse passes or the cost prepass of a
+//! tile are prefetched by an I/O worker before its first full pass.
+//!
+//! @param  tiles       The tiles to be rendered.
+//! @param  scene       The scene to be rendered.
+//! @param  dependency  The task that all render tasks depend on, nullptr if there is none.
+void ScheduleRenderTiles( const std::vector<RenderTile>& tiles , const Scene& scene , const Task* dependency );
+
+//! @brief  Schedule the light path tasks of the integrator, if it traces any.
+//!
+//! @param  scene       The scene to be rendered.
+//! @param  dependency  The task that all light path tasks depend on, nullptr if there is none.
+void ScheduleLightPaths( const Scene& scene , const Task* dependency );
 
 //! @brief  Render_Task is a basic rendering unit doing ray tracing.
 //!
@@ -31,13 +143,19 @@ class Render_Task : public Task{
 public:
     //! @brief Constructor
     //!
+    //! @param sampleOffset Number of samples per pixel taken by previous passes of the tile.
+    //! @param sampleCnt    Number of samples per pixel to take in this pass.
     //! @param priority     New priority of the task.
     Render_Task(const Vector2i& ori , const Vector2i& size , const Scene& scene ,
+                unsigned int sampleOffset , unsigned int sampleCnt ,
                 const char* name , unsigned int priority , const Task::Task_Container& dependencies );
 
     //! @brief  Execute the task
     void        Execute() override;
 
+    //! @brief  Tiles not started yet are dropped once rendering is cancelled.
+    bool        IsCancellable() const override { return true; }
+
     //! @brief  Get the coordinate of the tile, top-left corner.
     //!
     //! @return Top-left corner of the tile.
@@ -52,12 +170,169 @@ public:
         return m_size;
     }
 
-private:
+    //! @brief  Get the number of samples per pixel taken by previous passes of the tile.
+    //!
+    //! @return Number of samples per pixel already accumulated in the image sensor.
+    SORT_FORCEINLINE unsigned int GetSampleOffset() const {
+        return m_sampleOffset;
+    }
+
+    //! @brief  Get the number of samples per pixel taken by this pass.
+    //!
+    //! @return Number of samples per pixel in this pass.
+    SORT_FORCEINLINE unsigned int GetSampleCnt() const {
+        return m_sampleCnt;
+    }
+
+    //! @brief  Reset the clock that the time budget of progressive rendering is measured against.
+    static void ResetTimeBudget();
+
+    //! @brief  Cancel or resume rendering, it could be called from any thread.
+    //!
+    //! Tiles and light paths not started yet are flushed by the scheduler without being executed, the ones in flight
+    //! stop at the next sample and leave the image sensor untouched. The scene stays as it is.
+    //!
+    //! @param  cancelled   Whether rendering is cancelled.
+    static void SetCancelled( bool cancelled );
+
+    //! @brief  Whether rendering is cancelled.
+    //!
+    //! @return 'True' if tiles and light paths are being flushed.
+    static bool IsCancelled();
+
+protected:
+    //! @brief  Render the tile with camera rays traced in packets.
+    //!
+    //! Camera rays of a few neighboring pixels are generated all at once, grouped by the octant of their directions
+    //! and traced as a packet before being shaded one by one.
+    //!
+    //! @param  camera  The camera to generate rays.
+    //! @return         Number of samples traced in the tile.
+    unsigned long long  renderPackets( const class Camera* camera );
+
+    //! @brief  Hand the bottom half of the rows left in the tile to an idle worker.
+    //!
+    //! Expensive tiles rendered at last would otherwise keep most workers idle. The tile is only split if some worker
+    //! is waiting for tasks, it shrinks to the rows it keeps.
+    //!
+    //! @param  row     The row about to be rendered, rows above it are done already.
+    void    splitTile( int row );
+
+    //! @brief  Start a new sample of a pixel and draw the dimensions taken by the camera.
+    //!
+    //! @param  x       Horizontal coordinate of the pixel.
+    //! @param  y       Vertical coordinate of the pixel.
+    //! @param  index   Index of the sample in the pixel.
+    //! @param  ps      The pixel sample to be filled.
+    void    generateCameraSample( int x , int y , unsigned index , PixelSample& ps );
+
+    //! @brief  Store the AOVs of a pixel in the tile buffer.
+    //!
+    //! @param  pixelId     Index of the pixel in the tile.
+    //! @param  sum         Sum of the AOVs recorded by all valid samples of the pixel in this pass.
+    //! @param  validCnt    Number of valid samples in this pass.
+    //! @param  totalCnt    Number of samples taken by the pixel so far, including previous passes.
+    void    storeAov( int pixelId , const float* sum , unsigned int validCnt , unsigned int totalCnt );
+
+    //! @brief  Take the sampler and pixel samples of the worker executing the task.
+    //!
+    //! Tasks waiting in the queues don't hold any of them, memory taken by scheduled tasks doesn't grow with the number
+    //! of samples per pixel.
+    void    acquireSamples();
+
     Vector2i                            m_coord;            /**< Top-left corner of the current tile. */
     Vector2i                            m_size;             /**< Size of the current tile to be rendered. */
     const Scene&                        m_scene;            /**< Scene for ray tracing. */
-    std::unique_ptr<Sampler>            m_sampler;          /**< Sampler for taking samples. Currently not used. */
-    std::unique_ptr<PixelSample[]>      m_pixelSamples;     /**< Samples to take. Currently not used. */
+    unsigned int                        m_sampleOffset;     /**< Samples per pixel taken by previous passes. */
+    unsigned int                        m_sampleCnt;        /**< Samples per pixel to take in this pass. */
+    Sampler*                            m_sampler = nullptr;        /**< Sampler drawing all dimensions of pixel samples, owned by the worker. */
+    PixelSample*                        m_pixelSamples = nullptr;   /**< Samples to take, owned by the worker. */
+    std::unique_ptr<Spectrum[]>         m_tileRadiance;     /**< Radiance of the tile in this pass, flushed to the image sensor once. */
+    std::unique_ptr<float[]>            m_tileWeight;       /**< Weight to blend each pixel with previous passes. */
+    std::unique_ptr<float[]>            m_tileAov;          /**< AOVs of the tile in this pass, only allocated if there is any AOV. */
+    std::unique_ptr<FilteredTile>       m_filteredTile;     /**< Filtered samples of the tile in this pass, only allocated with a pixel filter. */
+    std::unique_ptr<BucketTile>         m_bucketTile;       /**< Samples of the tile in this pass split into buckets, only allocated with robust accumulation. */
+    AovSample                           m_aovSample;        /**< AOVs recorded by the sample being traced. */
+};
+
+//! @brief  Draft_Task renders a tile in a coarse pass of the resolution pyramid.
+//!
+//! Only one pixel in each block of 'level' by 'level' pixels is traced with one sample, the block is filled with it
+//! in the image. Pixels traced by coarser passes are not traced again and their samples are taken as the first
+//! sample of the pixels by the first full pass of the tile.
+class Draft_Task : public Render_Task {
+public:
+    //! @brief Constructor
+    //!
+    //! @param level        Number of pixels along each axis of the blocks, a power of two.
+    //! @param feedback     Feedback recording texture tiles not resident yet, they are not loaded by the coarse pass.
+    //! @param priority     New priority of the task.
+    Draft_Task( const Vector2i& ori , const Vector2i& size , const Scene& scene , int level ,
+                const std::shared_ptr<TextureFeedback>& feedback ,
+                const char* name , unsigned int priority , const Task::Task_Container& dependencies ) :
+                Render_Task( ori , size , scene , 0 , 1 , name , priority , dependencies ), m_level(level), m_feedback(feedback){}
+
+    //! @brief  Execute the task
+    void        Execute() override;
+
+private:
+    int                                 m_level;
+    std::shared_ptr<TextureFeedback>    m_feedback;
+};
+
+//! @brief  TexturePrefetch_Task loads the texture tiles the prepasses of a screen tile asked for.
+//!
+//! The full passes of the screen tile depend on it, so that none of its workers stalls on loading those texture tiles.
+class TexturePrefetch_Task : public Task {
+public:
+    //! @brief Constructor
+    //!
+    //! @param feedback     Texture tiles recorded by the prepasses of the screen tile.
+    //! @param priority     New priority of the task.
+    TexturePrefetch_Task( const std::shared_ptr<TextureFeedback>& feedback ,
+                          const char* name , unsigned int priority , const Task::Task_Container& dependencies ) :
+                          Task( name , priority , dependencies ), m_feedback(feedback){}
+
+    //! @brief  Execute the task
+    void        Execute() override;
+
+    //! @brief  Loading is mostly waiting for files.
+    TaskClass   GetTaskClass() const override {
+        return TaskClass::IO;
+    }
+
+    //! @brief  Texture tiles are not needed once rendering is cancelled.
+    bool        IsCancellable() const override { return true; }
+
+private:
+    std::shared_ptr<TextureFeedback>    m_feedback;
+};
+
+//! @brief  LightPath_Task traces a batch of light paths splatting radiance to the image sensor.
+//!
+//! Light paths don't belong to any tile, batches of the same size take about the same time no matter where the light
+//! lands in the image, which keeps the workers busy evenly.
+class LightPath_Task : public Task {
+public:
+    //! @brief Constructor
+    //!
+    //! @param first        Index of the first light path in the batch.
+    //! @param cnt          Number of light paths in the batch.
+    //! @param priority     New priority of the task.
+    LightPath_Task( const Scene& scene , unsigned long long first , unsigned int cnt ,
+                    const char* name , unsigned int priority , const Task::Task_Container& dependencies ) :
+                    Task( name , priority , dependencies ), m_scene(scene), m_first(first), m_cnt(cnt){}
+
+    //! @brief  Execute the task
+    void        Execute() override;
+
+    //! @brief  Light paths not traced yet are dropped once rendering is cancelled.
+    bool        IsCancellable() const override { return true; }
+
+private:
+    const Scene&        m_scene;
+    unsigned long long  m_first;
+    unsigned int        m_cnt;
 };
 
 //! @brief  PreRender_Task provides a chance for integrators to preprocess some data before rendering.
@@ -78,4 +353,69 @@ public:
 
 private:
     const Scene&   m_scene;
-};
\ No newline at end of file
+};
+
+//! @brief  TileCostPrepass_Task estimates the cost of a tile before it is rendered.
+//!
+//! A camera ray is traced through a few pixels of the tile with one sample each, the time it takes tells how expensive
+//! the tile is compared with others. Nothing is written in the image. Texture tiles not resident yet are recorded
+//! instead of being loaded, it measures shading instead of reading files.
+class TileCostPrepass_Task : public Task {
+public:
+    //! @brief Constructor
+    //!
+    //! @param tiles        All tiles to be rendered.
+    //! @param tileId       Index of the tile to be measured.
+    //! @param priority     New priority of the task.
+    TileCostPrepass_Task( const Scene& scene , const RenderTileList& tiles , unsigned int tileId ,
+                          const char* name , unsigned int priority , const Task::Task_Container& dependencies ) :
+                          Task( name , priority , dependencies ), m_scene(scene), m_tiles(tiles), m_tileId(tileId){}
+
+    //! @brief  Execute the task
+    void        Execute() override;
+
+    //! @brief  Costs of tiles are not needed once rendering is cancelled.
+    bool        IsCancellable() const override { return true; }
+
+private:
+    const Scene&    m_scene;
+    RenderTileList  m_tiles;
+    unsigned int    m_tileId;
+};
+
+//! @brief  TileScheduling_Task schedules the tiles once their costs are estimated.
+//!
+//! Expensive tiles are scheduled first, which is the longest processing time first rule. Cheap tiles fill the gaps at
+//! the end of rendering so that workers finish at about the same time.
+class TileScheduling_Task : public Task {
+public:
+    //! @brief Constructor
+    //!
+    //! @param tiles        All tiles to be rendered.
+    //! @param priority     New priority of the task.
+    TileScheduling_Task( const Scene& scene , const RenderTileList& tiles ,
+                         const char* name , unsigned int priority , const Task::Task_Container& dependencies ) :
+                         Task( name , priority , dependencies ), m_scene(scene), m_tiles(tiles){}
+
+    //! @brief  Execute the task
+    void        Execute() override;
+
+private:
+    const Scene&    m_scene;
+    RenderTileList  m_tiles;
+};
+
+//! @brief  PostProcess_Task post processes the image once all tiles are rendered.
+//!
+//! Post processing runs as a task so that heavy work in it, like denoising, could be forked to all worker threads.
+class PostProcess_Task : public Task {
+public:
+    //! @brief Constructor
+    //!
+    //! @param priority     New priority of the task.
+    PostProcess_Task( const char* name , unsigned int priority , const Task::Task_Container& dependencies ) :
+                      Task( name , priority , dependencies ){}
+
+    //! @brief  Execute the task
+    void        Execute() override;
+};
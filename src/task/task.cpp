@@ -15,34 +15,116 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
  */
 
+#include <algorithm>
 #include "task.h"
+#include "timeline.h"
 #include "core/sassert.h"
 #include "core/profile.h"
+#include "core/stats.h"
+#include "core/thread.h"
+#include "core/cpuinfo.h"
+#include "core/timer.h"
+#include "core/memory.h"
+#include "core/workercontext.h"
 
 thread_local static const Task* g_currentTask = nullptr;
 
 class UpdateCurrentTaskWrapper{
 public:
-    //! Update current task
-    UpdateCurrentTaskWrapper( const Task* task ){
+    //! Update current task, tasks can be executed inside other tasks when joining a task group.
+    UpdateCurrentTaskWrapper( const Task* task ) : m_previousTask(g_currentTask) {
         g_currentTask = task;
     }
 
-    //! There is no current on-going task any more.
+    //! Restore the task that was on-going before.
     ~UpdateCurrentTaskWrapper(){
-        g_currentTask = nullptr;
+        g_currentTask = m_previousTask;
     }
+
+private:
+    const Task* m_previousTask;
 };
 
+// A task forked in a task group.
+class Forked_Task : public Task{
+public:
+    Forked_Task( std::function<void()> func , std::atomic<unsigned int>& pendingCnt , TaskClass taskClass , const char* name , unsigned int priority , const Task::Task_Container& dependencies ) :
+        Task( name , priority , dependencies ) , m_func(std::move(func)) , m_pendingCnt(pendingCnt) , m_taskClass(taskClass) {}
+
+    void Execute() override {
+        m_func();
+
+        // the group could be gone right after this, it can't be touched anymore.
+        m_pendingCnt.fetch_sub( 1u , std::memory_order_acq_rel );
+    }
+
+private:
+    TaskClass GetTaskClass() const override {
+        return m_taskClass;
+    }
+
+private:
+    std::function<void()>       m_func;
+    std::atomic<unsigned int>&  m_pendingCnt;
+    const TaskClass             m_taskClass;
+};
+
+// Names of scheduling events in the timeline.
+static const std::string g_pickTaskEvent( "Pick Task" );
+static const std::string g_idleEvent( "Idle" );
+static const std::string g_joinEvent( "Join" );
+
+// Task ids are generated without any lock.
+static std::atomic<TaskID> g_taskId(0);
+
+// A sentinel indicating the task is finished and no dependent can be added anymore.
+static Task::Dependency g_retiredDependents;
+
+Task::Task( const char* name , unsigned int priority , const Task_Container& dependencies ):
+    m_dependencyCnt(dependencies.size()), m_dependents(nullptr), m_pendingDependencies(dependencies.size() + 1), m_refCnt(1),
+    m_priority(priority), m_name(name), m_taskId(++g_taskId) {
+    if( m_dependencyCnt > TASK_INLINE_DEPENDENCY_CNT )
+        m_extraDependencies = std::make_unique<Dependency[]>( m_dependencyCnt - TASK_INLINE_DEPENDENCY_CNT );
+
+    for( auto i = 0u ; i < m_dependencyCnt ; ++i ){
+        auto dependency = GetDependency(i);
+        dependency->m_dependency = dependencies[i];
+        dependency->m_dependent = this;
+    }
+}
+
+bool Task::AddDependent( Dependency* dependency ){
+    auto head = m_dependents.load( std::memory_order_acquire );
+    do{
+        if( head == &g_retiredDependents )
+            return false;
+        dependency->m_next = head;
+    }while( !m_dependents.compare_exchange_weak( head , dependency , std::memory_order_acq_rel , std::memory_order_acquire ) );
+    return true;
+}
+
+Task::Dependency* Task::RetireDependents(){
+    return m_dependents.exchange( &g_retiredDependents , std::memory_order_acq_rel );
+}
+
 void Task::ExecuteTask(){
     SORT_PROFILE(m_name);
+    SORT_STATS_SCOPE(m_name);
+    TimelineScope timeline( TimelineEvent::Task , m_name , m_taskId );
 
+    // tasks executed while joining a task group are already counted in the busy time of the joining task, I/O workers
+    // are not counted at all.
+    const auto outermost = IS_PTR_INVALID( g_currentTask ) && !GetWorkerContext().ioWorker;
+    const Timer timer;
     {
         UpdateCurrentTaskWrapper uctw( this );
 
-        // Execute the task.
-        Execute();
+        // Execute the task, unless it is flushed.
+        if( !IsCancellable() || !Scheduler::GetSingleton().IsFlushing() )
+            Execute();
     }
+    if( outermost )
+        Scheduler::GetSingleton().addBusyTime( (std::uint64_t)timer.GetElapsedTimeInMicroseconds() );
 
     // Upon termination of a task, release its dependents' dependencies on this task.
     Scheduler::GetSingleton().TaskFinished( this );
@@ -53,66 +135,317 @@ Scheduler::Task_Comp Scheduler::task_comp = []( const Task* t0 , const Task* t1
     return t0->GetPriority() < t1->GetPriority();
 };
 
-Task* Scheduler::Schedule( std::unique_ptr<Task> task ){
+void Scheduler::SetupWorkers( unsigned int workerCnt ){
+    sAssertMsg( 0 == m_unfinishedTaskCnt , TASK , "Workers can't be changed when there are tasks in the scheduler." );
+
+    m_queues.clear();
+    for( auto i = 0u ; i < std::max( 1u , workerCnt ) ; ++i )
+        m_queues.push_back( std::make_unique<WorkerQueue>() );
+
+    // Workers steal from the ones on the same NUMA node first, so that tasks and the memory they touch are more likely to
+    // stay on the node. Without NUMA awareness all workers are on the same node and it is simply a ring.
+    const auto queue_cnt = (unsigned int)m_queues.size();
+    m_stealOrders.clear();
+    m_stealOrders.resize( queue_cnt );
+    for( auto self = 0u ; self < queue_cnt ; ++self ){
+        auto& order = m_stealOrders[self];
+        const auto node = GetWorkerNumaNode( self );
+        for( auto i = 1u ; i < queue_cnt ; ++i ){
+            if( GetWorkerNumaNode( ( self + i ) % queue_cnt ) == node )
+                order.push_back( ( self + i ) % queue_cnt );
+        }
+        for( auto i = 1u ; i < queue_cnt ; ++i ){
+            if( GetWorkerNumaNode( ( self + i ) % queue_cnt ) != node )
+                order.push_back( ( self + i ) % queue_cnt );
+        }
+    }
+}
+
+Task* Scheduler::Schedule( Task* task ){
     if(IS_PTR_INVALID(task))
         return nullptr;
 
-    std::lock_guard<std::mutex> lock(m_mutex);
+    m_unfinishedTaskCnt.fetch_add( 1u , std::memory_order_relaxed );
 
-    auto taskID = task->GetTaskID();
-    m_tasks[taskID] = std::move(task);
+    // Register the task as a dependent of all its dependencies, dependencies that are already finished are removed right away.
+    for( auto i = 0u ; i < task->GetDependencyCnt() ; ++i ){
+        auto dependency = task->GetDependency(i);
+        auto no_const_dep = const_cast<Task*>(dependency->m_dependency);
+        if( !no_const_dep->AddDependent(dependency) )
+            task->RemoveDependency();
+    }
 
-    const auto task_ptr = m_tasks[taskID].get();
-    if(task_ptr->NoDependency() )
-        m_availbleTasks.push(task_ptr);
-    else{
-        auto dependencies = task_ptr->GetDependencies();
-        for (auto dep : dependencies) {
-            auto no_const_dep = const_cast<Task*>(dep);
-            no_const_dep->AddDependent(task_ptr);
-        }
-        m_backupTasks.insert(task_ptr);
+    // Release the extra dependency held during scheduling.
+    if( task->RemoveDependency() )
+        pushAvailableTask( task );
+
+    return task;
+}
+
+Task* Scheduler::TryPickTask(){
+    if( GetWorkerContext().ioWorker )
+        return popAvailableTask( m_ioQueue , m_availableIOTaskCnt );
+
+    const auto queue_cnt = (unsigned int)m_queues.size();
+    const auto self = (unsigned int)ThreadId() % queue_cnt;
+
+    // Pick the task with highest priority in its own queue first.
+    if( auto task = popAvailableTask( *m_queues[self] , m_availableTaskCnt ) )
+        return task;
+
+    // Try stealing tasks from other workers, the ones on the same NUMA node go first.
+    for( const auto victim : m_stealOrders[self] ){
+        if( auto task = popAvailableTask( *m_queues[victim] , m_availableTaskCnt ) )
+            return task;
     }
-    return task_ptr;
+
+    // I/O tasks are left to compute workers only if there is nobody else to execute them.
+    if( 0 == m_ioWorkerCnt.load( std::memory_order_acquire ) )
+        return popAvailableTask( m_ioQueue , m_availableIOTaskCnt );
+    return nullptr;
 }
 
 Task* Scheduler::PickTask(){
-    std::unique_lock<std::mutex> lock(m_mutex);
+    while( true ){
+        {
+            TimelineScope timeline( TimelineEvent::Wait , g_pickTaskEvent );
+            if( auto task = TryPickTask() )
+                return task;
+        }
+
+        // Return nullptr if there is no task available in the scheduler
+        if( 0 == m_unfinishedTaskCnt.load( std::memory_order_acquire ) )
+            return nullptr;
+
+        // Wait until this is at least one available task or all tasks are finished.
+        TimelineScope timeline( TimelineEvent::Idle , g_idleEvent );
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        if( GetWorkerContext().ioWorker ){
+            m_sleepingIOWorkerCnt.fetch_add( 1u );
+            m_ioCv.wait( lock , [&](){ return m_availableIOTaskCnt.load() > 0 || m_unfinishedTaskCnt.load() == 0; } );
+            m_sleepingIOWorkerCnt.fetch_sub( 1u );
+        }else{
+            m_sleepingWorkerCnt.fetch_add( 1u );
+            m_cv.wait( lock , [&](){
+                return m_availableTaskCnt.load() > 0 || m_unfinishedTaskCnt.load() == 0 ||
+                       ( m_availableIOTaskCnt.load() > 0 && m_ioWorkerCnt.load() == 0 );
+            } );
+            m_sleepingWorkerCnt.fetch_sub( 1u );
+        }
+    }
+}
+
+void Scheduler::TaskFinished( Task* task ){
+    // Starting remove all dependencies.
+    auto dependency = task->RetireDependents();
+    while( dependency ){
+        // The edge lives in the dependent, which could be destroyed in other threads once it is released.
+        const auto next = dependency->m_next;
+
+        // There is no dependent task of this 'dep' task anymore, push it into one of the queues.
+        if( dependency->m_dependent->RemoveDependency() )
+            pushAvailableTask( dependency->m_dependent );
+
+        dependency = next;
+    }
 
-    // Wait until this is at least one available task
-    while( !( (m_backupTasks.empty() && m_availbleTasks.empty()) || m_availbleTasks.size() ) )
-        m_cv.wait_for( lock , std::chrono::seconds(1) );
+    // Release the reference held by the scheduler, handles of the task could still keep it alive.
+    ReleaseTask( task );
 
-    // Return nullptr if there is no task available in the scheduler
-    if (m_backupTasks.empty() && m_availbleTasks.empty())
+    // Wake up all workers so that they can quit if this is the last task.
+    if( 1u == m_unfinishedTaskCnt.fetch_sub( 1u , std::memory_order_acq_rel ) )
+        wakeupWorkers( true );
+}
+
+void Scheduler::ReleaseTask( Task* task ){
+    if( !task->RemoveReference() )
+        return;
+    task->~Task();
+    m_taskPool.Deallocate( task );
+}
+
+void Scheduler::RegisterIOWorker(){
+    m_ioWorkerCnt.fetch_add( 1u );
+}
+
+void Scheduler::UnregisterIOWorker(){
+    // I/O tasks pushed while the last I/O worker is leaving are handed over to compute workers.
+    if( 1u == m_ioWorkerCnt.fetch_sub( 1u ) && m_availableIOTaskCnt.load() > 0 )
+        wakeupWorkers( true );
+}
+
+void Scheduler::pushAvailableTask( Task* task ){
+    if( task->GetTaskClass() == TaskClass::IO ){
+        {
+            std::lock_guard<spinlock_mutex> lock(m_ioQueue.m_mutex);
+            m_ioQueue.m_tasks.push( task );
+            m_ioQueue.m_taskCnt.fetch_add( 1u , std::memory_order_release );
+        }
+        m_availableIOTaskCnt.fetch_add( 1u );
+
+        if( m_ioWorkerCnt.load() > 0 )
+            wakeupIOWorker();
+        else
+            wakeupWorkers( false );
+        return;
+    }
+
+    auto& queue = *m_queues[m_nextQueue.fetch_add( 1u , std::memory_order_relaxed ) % m_queues.size()];
+    {
+        std::lock_guard<spinlock_mutex> lock(queue.m_mutex);
+        queue.m_tasks.push( task );
+        queue.m_taskCnt.fetch_add( 1u , std::memory_order_release );
+    }
+    m_availableTaskCnt.fetch_add( 1u );
+
+    // Notify one waiting thread to pick up task.
+    wakeupWorkers( false );
+}
+
+Task* Scheduler::popAvailableTask( WorkerQueue& queue , std::atomic<unsigned int>& available ){
+    // Avoid touching the lock at all if there is nothing in the queue.
+    if( 0 == queue.m_taskCnt.load( std::memory_order_acquire ) )
+        return nullptr;
+
+    std::lock_guard<spinlock_mutex> lock(queue.m_mutex);
+    if( queue.m_tasks.empty() )
         return nullptr;
 
     // Get the available task that is with highest priority
-    Task* ret = m_availbleTasks.top();
-    m_availbleTasks.pop();
+    Task* ret = queue.m_tasks.top();
+    queue.m_tasks.pop();
+    queue.m_taskCnt.fetch_sub( 1u , std::memory_order_relaxed );
+    available.fetch_sub( 1u );
     return ret;
 }
 
-void Scheduler::TaskFinished( const Task* task ){
-    std::lock_guard<std::mutex> lock(m_mutex);
+void Scheduler::wakeupWorkers( bool all ){
+    // The counters are updated before checking sleeping workers, a worker going to sleep will either be counted
+    // here or see the updated counters before waiting.
+    if( 0 == m_sleepingWorkerCnt.load() && ( !all || 0 == m_sleepingIOWorkerCnt.load() ) )
+        return;
 
-    // Starting remove all dependencies.
-    const auto& dependent = task->GetDependents();
-    for( auto dep : dependent ){
-        // Remove its dependencies.
-        dep->RemoveDependency( task );
-
-        // There is no dependent task of this 'dep' task anymore, push it into the heap and remove it from the backup tasks.
-        if( dep->NoDependency() ){
-            m_backupTasks.erase( dep );
-            m_availbleTasks.push( dep );
-
-            // Notify one waiting thread to pick up task.
-            m_cv.notify_one();
+    std::lock_guard<std::mutex> lock(m_sleepMutex);
+    if( all ){
+        m_cv.notify_all();
+        m_ioCv.notify_all();
+    }else{
+        m_cv.notify_one();
+    }
+}
+
+void Scheduler::wakeupIOWorker(){
+    if( 0 == m_sleepingIOWorkerCnt.load() )
+        return;
+
+    std::lock_guard<std::mutex> lock(m_sleepMutex);
+    m_ioCv.notify_one();
+}
+
+TaskMemoryPool::~TaskMemoryPool(){
+    for( auto block : m_allBlocks )
+        delete block;
+    TrackMemory( MemoryCategory::TaskGraph , -(long long)( m_allBlocks.size() * TASK_BLOCK_SIZE ) );
+}
+
+void* TaskMemoryPool::Allocate( size_t size , [[maybe_unused]] size_t alignment ){
+    sAssert( alignment <= TASK_HEADER_SIZE , TASK );
+
+    // Each allocation is prefixed with a header recording the block it belongs to.
+    const auto size_to_allocate = ( ( size + TASK_HEADER_SIZE - 1 ) / TASK_HEADER_SIZE + 1 ) * TASK_HEADER_SIZE;
+
+    Block* block = nullptr;
+    char* ret = nullptr;
+    if( UNLIKELY( size_to_allocate > TASK_BLOCK_SIZE ) ){
+        // Huge tasks barely exist, they are allocated individually.
+        // The size is kept after the block pointer in the header so that the memory could be accounted for later.
+        ret = new char[size_to_allocate];
+        *(size_t*)( ret + sizeof(Block*) ) = size_to_allocate;
+        TrackMemory( MemoryCategory::TaskGraph , (long long)size_to_allocate );
+    }else{
+        std::lock_guard<spinlock_mutex> lock(m_mutex);
+        if( IS_PTR_INVALID(m_current) || m_current->m_offset + size_to_allocate > TASK_BLOCK_SIZE ){
+            // The current block is not the current one anymore, it is recycled once all of its tasks are finished.
+            if( m_current )
+                release( m_current );
+
+            if( m_freeBlocks.empty() ){
+                m_current = new Block();
+                m_allBlocks.push_back( m_current );
+                TrackMemory( MemoryCategory::TaskGraph , TASK_BLOCK_SIZE );
+            }else{
+                m_current = m_freeBlocks.back();
+                m_freeBlocks.pop_back();
+            }
+            m_current->m_offset = 0;
+            m_current->m_aliveCnt = 1;
         }
+
+        block = m_current;
+        ret = block->m_data.get() + block->m_offset;
+        block->m_offset += size_to_allocate;
+        block->m_aliveCnt.fetch_add( 1u , std::memory_order_relaxed );
     }
 
-    m_tasks.erase(task->GetTaskID());
+    *(Block**)ret = block;
+    return ret + TASK_HEADER_SIZE;
+}
+
+void TaskMemoryPool::Deallocate( void* p ){
+    if( IS_PTR_INVALID(p) )
+        return;
+
+    auto header = (char*)p - TASK_HEADER_SIZE;
+    auto block = *(Block**)header;
+    if( IS_PTR_INVALID(block) ){
+        TrackMemory( MemoryCategory::TaskGraph , -(long long)*(size_t*)( header + sizeof(Block*) ) );
+        delete[] header;
+        return;
+    }
+
+    if( 1u == block->m_aliveCnt.fetch_sub( 1u , std::memory_order_acq_rel ) ){
+        std::lock_guard<spinlock_mutex> lock(m_mutex);
+        m_freeBlocks.push_back( block );
+    }
+}
+
+void TaskMemoryPool::release( Block* block ){
+    // This is only called with the lock acquired.
+    if( 1u == block->m_aliveCnt.fetch_sub( 1u , std::memory_order_acq_rel ) )
+        m_freeBlocks.push_back( block );
+}
+
+void TaskGroup::Fork( std::function<void()> func , const char* name , TaskClass taskClass ){
+    // forked tasks are picked before the others so that the joining task won't wait for too long
+    const auto current = GetCurrentTask();
+    const auto priority = current ? current->GetPriority() + 1 : DEFAULT_TASK_PRIORITY;
+
+    m_pendingCnt.fetch_add( 1u , std::memory_order_relaxed );
+    SCHEDULE_TASK<Forked_Task>( name , priority , {} , std::move(func) , m_pendingCnt , taskClass );
+}
+
+void TaskGroup::Join(){
+    // spinning for forked tasks executed by other workers is recorded as one event until something is picked
+    auto& timeline = Timeline::GetSingleton();
+    auto spin_begin = UINT64_MAX;
+    const auto record_spin = [&](){
+        if( spin_begin != UINT64_MAX )
+            timeline.Record( TimelineEvent::Wait , g_joinEvent , 0 , spin_begin , timeline.Now() );
+        spin_begin = UINT64_MAX;
+    };
+
+    while( m_pendingCnt.load( std::memory_order_acquire ) > 0 ){
+        // Instead of waiting, help executing available tasks.
+        if( auto task = Scheduler::GetSingleton().TryPickTask() ){
+            record_spin();
+            task->ExecuteTask();
+        }else{
+            if( spin_begin == UINT64_MAX && timeline.IsEnabled() )
+                spin_begin = timeline.Now();
+            std::this_thread::yield();
+        }
+    }
+    record_spin();
 }
 
 void    EXECUTING_TASKS(){
@@ -129,6 +462,13 @@ void    EXECUTING_TASKS(){
     }
 }
 
+void    EXECUTING_IO_TASKS(){
+    auto& scheduler = Scheduler::GetSingleton();
+    scheduler.RegisterIOWorker();
+    EXECUTING_TASKS();
+    scheduler.UnregisterIOWorker();
+}
+
 const Task* GetCurrentTask(){
     return g_currentTask;
 }
\ No newline at end of file
@@ -17,20 +17,118 @@
 
 #pragma once
 
-#include <unordered_set>
-#include <unordered_map>
 #include <queue>
+#include <algorithm>
 #include <memory>
 #include <mutex>
+#include <atomic>
+#include <vector>
 #include <functional>
+#include <initializer_list>
+#include <type_traits>
 #include <condition_variable>
+#include <cstdint>
 #include "core/singleton.h"
+#include "core/thread.h"
 
-// Default task priority is 100000.
 #define DEFAULT_TASK_PRIORITY       100000
 
 using TaskID = unsigned int;
 
+class Task;
+
+//! @brief  Handle keeping a scheduled task alive.
+/**
+ * A finished task is destroyed by the scheduler, which could happen right after it is scheduled if nothing holds it
+ * back. The handle returned by 'SCHEDULE_TASK' holds a reference of the task, so that it is safe to pass it as a
+ * dependency of tasks scheduled later, even from a worker while other workers are running. The memory of the task is
+ * only released once it is finished and the last handle is gone.
+ */
+class TaskHandle{
+public:
+    //! @brief  Default constructor, it refers to no task.
+    TaskHandle() = default;
+
+    //! @brief  Constructor adopting a reference of a task that is already taken.
+    //!
+    //! @param  task    The task to refer to.
+    explicit TaskHandle( Task* task ) : m_task(task) {}
+
+    //! @brief  Copy constructor, another reference of the task is taken.
+    TaskHandle( const TaskHandle& other );
+
+    //! @brief  Move constructor.
+    TaskHandle( TaskHandle&& other ) noexcept : m_task(other.m_task) {
+        other.m_task = nullptr;
+    }
+
+    //! @brief  Destructor releases the reference of the task.
+    ~TaskHandle(){
+        Reset();
+    }
+
+    //! @brief  Assignment, the task referred to before is released.
+    TaskHandle& operator =( TaskHandle other ){
+        std::swap( m_task , other.m_task );
+        return *this;
+    }
+
+    //! @brief  Release the reference of the task, the handle refers to no task after this.
+    void    Reset();
+
+    //! @brief  Get the task, it is only valid as long as the handle is alive.
+    SORT_FORCEINLINE Task* Get() const {
+        return m_task;
+    }
+
+    //! @brief  Handles are used wherever a task is taken as a dependency.
+    SORT_FORCEINLINE operator const Task*() const {
+        return m_task;
+    }
+
+private:
+    Task*   m_task = nullptr;   /**< The task referred to. */
+};
+
+//! @brief  Class of work done by a task, it decides which threads execute the task.
+enum class TaskClass{
+    Compute,    /**< Tasks keeping a core busy, they are executed by the compute workers. */
+    IO,         /**< Tasks mostly blocked on disk or network, they are executed by the oversubscribed I/O workers. */
+};
+
+//! @brief  A light-weight view of a list of tasks.
+//!
+//! It doesn't own the memory of the list. It is only used to pass dependencies to a task during its construction,
+//! the tasks will be recorded in the task itself. Since no memory allocation is involved, it is way cheaper than
+//! a hash container.
+class TaskList{
+public:
+    //! @brief  Constructor from an initializer list, this is the most common case.
+    TaskList( std::initializer_list<const Task*> tasks = {} ) : m_list(tasks), m_cnt((unsigned int)tasks.size()) {}
+
+    //! @brief  Constructor from a vector of tasks.
+    TaskList( const std::vector<const Task*>& tasks ) : m_tasks(tasks.data()), m_cnt((unsigned int)tasks.size()) {}
+
+    //! @brief  Constructor from a vector of handles of tasks.
+    TaskList( const std::vector<TaskHandle>& tasks ) : m_handles(tasks.data()), m_cnt((unsigned int)tasks.size()) {}
+
+    //! @brief  Get the number of tasks in the list.
+    SORT_FORCEINLINE unsigned int size() const {
+        return m_cnt;
+    }
+
+    //! @brief  Get the i-th task in the list.
+    SORT_FORCEINLINE const Task* operator []( unsigned int i ) const {
+        return m_tasks ? m_tasks[i] : m_handles ? m_handles[i].Get() : m_list.begin()[i];
+    }
+
+private:
+    std::initializer_list<const Task*>  m_list;                 /**< The tasks in the list if it comes from an initializer list. */
+    const Task* const*                  m_tasks = nullptr;      /**< The tasks in the list if it comes from a vector. */
+    const TaskHandle*                   m_handles = nullptr;    /**< The tasks in the list if it comes from a vector of handles. */
+    unsigned int                        m_cnt;                  /**< Number of tasks in the list. */
+};
+
 //! @brief  Basic unit task in SORT system.
 /**
  * SORT is driven by a graph based task system. The tasks form a directed acyclic graph (DAG).
@@ -39,23 +137,30 @@ using TaskID = unsigned int;
  * data from streams. Upon finishing of each task, it will remove its dependencies. Each task comes
  * with a priority number. Default priority is 100000, higher priority task will be executed earlier
  * than lower ones.
+ * Each edge of the graph is stored in the dependent task itself and linked in an intrusive list of its
+ * dependency, there is no extra memory allocation when tasks are connected in most cases.
  */
 class Task{
 public:
     // Dependency container for task
-    using Task_Container = std::unordered_set<const Task*>;
-    using DependentTask_Container = std::unordered_set<Task*>;
+    using Task_Container = TaskList;
+
+    //! @brief  An edge in the task graph.
+    //!
+    //! The edge lives in the dependent task and it is linked in the list of dependents of its dependency.
+    struct Dependency{
+        const Task*     m_dependency = nullptr;     /**< The task to be depended on. */
+        Task*           m_dependent = nullptr;      /**< The task that depends on the other one. */
+        Dependency*     m_next = nullptr;           /**< Next dependent of the same task. */
+    };
 
     //! @brief  Default constructor.
+    //!
+    //! The pending dependency counter starts with one extra count, which is only released after the task is
+    //! fully registered in the scheduler. This makes sure a task won't be picked before it is scheduled even
+    //! if all of its dependencies are finished in other threads in the middle of scheduling.
     Task(   const char* name  , unsigned int priority = DEFAULT_TASK_PRIORITY ,
-            const Task_Container& dependencies = {} ):
-            m_name(name), m_dependencies(dependencies),m_priority(priority) {
-        static std::mutex m;
-        static unsigned int taskId = 0;
-
-        std::lock_guard<std::mutex> lock(m);
-        m_taskId = (TaskID)++taskId;
-    }
+            const Task_Container& dependencies = {} );
 
     //! @brief  Virtual destructor.
     virtual             ~Task() {}
@@ -63,6 +168,19 @@ public:
     //! @brief  Execute the task
     virtual void        Execute() = 0;
 
+    //! @brief  Whether the task could be dropped without executing it once the scheduler is flushing.
+    //!
+    //! @return             Whether the task could be skipped.
+    virtual bool        IsCancellable() const { return false; }
+
+    //! @brief  Class of work done by the task.
+    //!
+    //! I/O tasks are executed by I/O workers so that a compute core is never parked on disk latency. Compute workers
+    //! only pick them when there is no I/O worker at all.
+    //!
+    //! @return             Class of the task.
+    virtual TaskClass   GetTaskClass() const { return TaskClass::Compute; }
+
     //! @brief  Execute the task, this also includes outputting profiling data and removing dependencies.
     void                ExecuteTask();
 
@@ -73,32 +191,68 @@ public:
         return m_priority;
     }
 
-    //! @brief  Remove dependency from task.
+    //! @brief  Take one more reference of the task.
+    //!
+    //! The scheduler holds one reference until the task is finished, each handle of the task holds another one.
+    SORT_FORCEINLINE void         AddReference() {
+        m_refCnt.fetch_add( 1u , std::memory_order_relaxed );
+    }
+
+    //! @brief  Release one reference of the task.
+    //!
+    //! @return True if this is the last reference, the task needs to be destroyed then.
+    SORT_FORCEINLINE bool         RemoveReference() {
+        return 1u == m_refCnt.fetch_sub( 1u , std::memory_order_acq_rel );
+    }
+
+    //! @brief  Remove one dependency from task.
     //!
     //! Upon the termination of any dependent task, it is necessary to remove it from its dependency.
-    SORT_FORCEINLINE void         RemoveDependency( const Task* taskid ) {
-        m_dependencies.erase( taskid );
+    //! There is no need to know which dependency is finished, an atomic counter is all it needs.
+    //!
+    //! @return True if this is the last pending dependency of the task.
+    SORT_FORCEINLINE bool         RemoveDependency() {
+        return 1u == m_pendingDependencies.fetch_sub( 1u , std::memory_order_acq_rel );
     }
 
     //! @brief  If there is no dependent task anymore.
     //!
     //! @return True if all dependent tasks are finished. Otherwise, return false.
     SORT_FORCEINLINE bool         NoDependency() const {
-        return m_dependencies.empty();
+        return 0u == m_pendingDependencies.load( std::memory_order_acquire );
     }
 
-    //! @brief  Get tasks depending on this task.
+    //! @brief  Add dependent.
+    //!
+    //! It is possible that the task is already finished by the time a dependent is added, in which case
+    //! the dependent is not recorded and it is up to the caller to release the dependency right away.
+    //!
+    //! @param  dependency  The edge to be linked in the dependents of this task.
+    //! @return False if the task is already finished.
+    bool                AddDependent( Dependency* dependency );
+
+    //! @brief  Mark the task as finished and retrieve all of its dependents.
+    //!
+    //! No dependent will be added to the task after this call. The returned list is linked through 'm_next'.
+    //! It is worth noting that the edge lives in the dependent task, 'm_next' needs to be read before the
+    //! dependent is released.
+    //!
+    //! @return The first edge connecting the task to its dependents.
+    Dependency*         RetireDependents();
+
+    //! @brief  Get the number of dependencies of the task.
     //!
-    //! @return Tasks this task depends on.
-    SORT_FORCEINLINE const DependentTask_Container& GetDependents() const  {
-        return m_dependents;
+    //! @return Number of dependencies of the task, finished ones are also counted.
+    SORT_FORCEINLINE unsigned int GetDependencyCnt() const {
+        return m_dependencyCnt;
     }
 
-    //! @brief  Add dependent.
+    //! @brief  Get the edge to one of the dependencies.
     //!
-    //! @param  Task to be added as a dependent.
-    SORT_FORCEINLINE void AddDependent( Task* task ){
-        m_dependents.insert( task );
+    //! @param  i   Index of the dependency.
+    //! @return The edge connecting this task to the dependency.
+    SORT_FORCEINLINE Dependency* GetDependency( unsigned int i ){
+        return i < TASK_INLINE_DEPENDENCY_CNT ? &m_inlineDependencies[i] : &m_extraDependencies[i - TASK_INLINE_DEPENDENCY_CNT];
     }
 
     //! @brief  Get the id of the task
@@ -108,33 +262,78 @@ public:
         return m_taskId;
     }
 
-    //! @brief  Get tasks this task depends on.
+private:
+    /**< Number of edges stored inside the task without extra memory allocation. */
+    static constexpr unsigned int TASK_INLINE_DEPENDENCY_CNT = 2;
+
+    Dependency                      m_inlineDependencies[TASK_INLINE_DEPENDENCY_CNT];   /**< Edges to the first few dependencies. */
+    std::unique_ptr<Dependency[]>   m_extraDependencies;                                /**< Edges to the rest of dependencies, rarely used. */
+    unsigned int                    m_dependencyCnt = 0;                                /**< Number of dependencies. */
+    std::atomic<Dependency*>        m_dependents;                                       /**< Intrusive list of edges to tasks depending on this task. */
+    std::atomic<unsigned int>       m_pendingDependencies;                              /**< Number of dependencies that are not finished yet. */
+    std::atomic<unsigned int>       m_refCnt;                                           /**< Number of references, one held by the scheduler until the task is finished. */
+    unsigned int                    m_priority;                                         /**< Priority of the task. */
+    const std::string               m_name;                                             /**< Name of the task. */
+    TaskID                          m_taskId;                                           /**< This is to identify the task with id. */
+};
+
+//! @brief  Memory pool for tasks.
+/**
+ * Tasks are allocated in big memory blocks instead of individual heap allocation. Each block keeps track of
+ * the number of alive tasks in it, it gets recycled once all of its tasks are finished. So the memory used
+ * by tasks is bounded by the number of tasks alive at the same time, instead of the number of tasks ever
+ * scheduled.
+ */
+class TaskMemoryPool{
+public:
+    //! @brief  Destructor.
+    ~TaskMemoryPool();
+
+    //! @brief  Allocate memory for a task.
     //!
-    //! @return Tasks this task depends on.
-    SORT_FORCEINLINE Task_Container& GetDependencies(){
-        return m_dependencies;
-    }
+    //! @param  size        Size of the task.
+    //! @param  alignment   Alignment of the task, it can't be larger than 16.
+    //! @return             Memory to hold the task.
+    void*   Allocate( size_t size , size_t alignment );
 
-    //! @brief  Get tasks this task depends on.
+    //! @brief  Release the memory of a task.
     //!
-    //! @return Tasks this task depends on.
-    SORT_FORCEINLINE const Task_Container& GetDependencies() const {
-        return m_dependencies;
-    }
+    //! @param  p           Memory allocated by this pool.
+    void    Deallocate( void* p );
 
 private:
-    Task_Container              m_dependencies;     /**< Tasks this task depends on. */
-    DependentTask_Container     m_dependents;       /**< Tasks depending on this task. */
-    unsigned int                m_priority;         /**< Priority of the task. */
-    const std::string           m_name;             /**< Name of the task. */
-    TaskID                      m_taskId;           /**< This is to identify the task with id. */
+    /**< Size of each memory block. */
+    static constexpr size_t TASK_BLOCK_SIZE = 64 * 1024;
+    /**< Size of the header before each allocation, it needs to be large enough to keep all tasks aligned. */
+    static constexpr size_t TASK_HEADER_SIZE = 16;
+
+    //! @brief  A memory block holding multiple tasks.
+    struct Block{
+        std::unique_ptr<char[]>     m_data = std::make_unique<char[]>(TASK_BLOCK_SIZE); /**< Memory of the block. */
+        size_t                      m_offset = 0;                                       /**< Current position of available memory. */
+        std::atomic<unsigned int>   m_aliveCnt = 1;                                     /**< Number of alive tasks, plus one if it is the current block. */
+    };
+
+    //! @brief  Release one reference of a block, it is recycled if there is no reference anymore.
+    void    release( Block* block );
+
+    spinlock_mutex          m_mutex;                /**< Spin lock protecting the pool. */
+    Block*                  m_current = nullptr;    /**< The block being used for allocation. */
+    std::vector<Block*>     m_freeBlocks;           /**< Recycled blocks. */
+    std::vector<Block*>     m_allBlocks;            /**< All blocks ever allocated. */
 };
 
-//! @brief  Scheduler for scheduling tasks.
+//! @brief  Task scheduler.
 /**
- * Scheduler will pick a task without any dependencies that has highest priority. If there are
- * multiple candidate tasks, a random one will be picked. Each task dependencies will only be
- * removed after it is fully finished, not after it gets started.
+ * Each worker thread owns a queue of available tasks and always picks the task with the highest priority
+ * from its own queue first. Only when its own queue is drained, it tries to steal tasks from the other
+ * workers. Tasks released by a finished task are spread across all worker queues. It is worth noting
+ * that priority is only respected inside each queue, it is a hint for execution order instead of a
+ * guaranteed global total order.
+ * Dependencies are tracked with atomic counters in tasks, there is no global lock involved in picking
+ * and finishing tasks. Idle workers go to sleep only if there is no available task at all.
+ * I/O tasks live in a separate queue shared by the I/O workers, which are not counted as workers and could outnumber
+ * the cores. They neither steal compute tasks nor get stolen from by compute workers, unless no I/O worker is running.
  * Scheduler is thread-safe, which means that multiple threads can retrieve tasks from scheduler
  * concurrently.
  */
@@ -145,60 +344,288 @@ class Scheduler : public Singleton<Scheduler>{
     static Task_Comp task_comp;
     /**< Task queue for available tasks is actually a heap. */
     using TaskQueue = std::priority_queue<Task*,std::vector<Task*>,decltype(task_comp)>;
-    /**< Task container for back-up tasks is just a hash container. */
-    using BackupTaskContainer = std::unordered_set<Task*>;
-    /**< Task container for keeping tasks alive. */
-    using TaskContainer = std::unordered_map<TaskID, std::unique_ptr<Task>>;
+
+    //! @brief  Queue of available tasks owned by a worker thread.
+    //!
+    //! It is aligned to cache line size so that different workers won't fight for the same cache line.
+    struct alignas(64) WorkerQueue{
+        WorkerQueue():m_tasks(task_comp){}
+
+        spinlock_mutex              m_mutex;            /**< Spin lock protecting the queue, only contended when tasks get stolen. */
+        TaskQueue                   m_tasks;            /**< Heap of available tasks. */
+        std::atomic<unsigned int>   m_taskCnt = 0;      /**< Number of tasks in the queue, it is checked before acquiring the lock. */
+        std::atomic<std::uint64_t>  m_busyTime = 0;     /**< Time spent by the worker executing tasks in microseconds. */
+        std::atomic<std::uint64_t>  m_rayCnt = 0;       /**< Number of rays traced by the worker. */
+    };
 
 public:
+    //! @brief  Setup the number of workers.
+    //!
+    //! This needs to be called before any task is scheduled. Each worker, including the main thread, owns
+    //! its own queue indexed by its thread id.
+    //!
+    //! @param  workerCnt   Number of workers, including the main thread.
+    void    SetupWorkers( unsigned int workerCnt );
+
+    //! @brief  Allocate memory for a task.
+    //!
+    //! Tasks need to be allocated through this interface before getting scheduled, it will be released by the
+    //! scheduler once it is finished. 'SCHEDULE_TASK' is the recommended way to create and schedule a task.
+    //!
+    //! @param  size        Size of the task.
+    //! @param  alignment   Alignment of the task.
+    //! @return             Memory to hold the task.
+    void*   AllocateTask( size_t size , size_t alignment ){
+        return m_taskPool.Allocate( size , alignment );
+    }
+
     //! @brief  Schedule a task.
     //!
-    //! @param  task        Task to be scheduled.
+    //! The scheduler takes one reference of the task, the task will be destroyed after it is finished unless there is
+    //! still a handle of it.
+    //!
+    //! @param  task        Task to be scheduled, it has to be allocated by 'AllocateTask'.
     //! @param              Raw pointer to the task.
-    Task*    Schedule( std::unique_ptr<Task> task );
+    Task*    Schedule( Task* task );
 
     //! @brief  Pick a task with highest priority, but no dependencies.
     //!
-    //! The scheduler will try picking a task with highest priority, but no dependencies.
-    //! If there is no such a task available for now, the scheduler will hang the thread
-    //! and share its CPU resources to other threads for executing. In the case of a cycle
-    //! graph tasks, it will hang forever. The task picked will be removed from the data
-    //! structures in scheduler.
+    //! The scheduler will try picking a task with highest priority in the queue of the current worker. If it
+    //! is empty, it will try stealing tasks from other workers. If there is no such a task available for now,
+    //! the scheduler will hang the thread until a task becomes available. In the case of a cycle graph tasks,
+    //! it will hang forever. The task picked will be removed from the data structures in scheduler.
     //! If there is no task in the scheduler, nullptr will be returned.
     //!
     //! @return    The task picked from scheduler.
     Task*   PickTask();
 
+    //! @brief  Pick a task with highest priority, but no dependencies, without waiting.
+    //!
+    //! Unlike 'PickTask', this won't hang the thread if there is no task available for now. I/O workers only pick
+    //! I/O tasks.
+    //!
+    //! @return    The task picked from scheduler, nullptr if there is no available task for now.
+    Task*   TryPickTask();
+
     //! @brief  Remove dependencies for a task.
     //!
     //! Upon finish of each task, it needs to update scheduler it is finished so that other
-    //! tasks depending on this task will get chance to be executed in the future.
+    //! tasks depending on this task will get chance to be executed in the future. The task
+    //! will be destroyed after this call.
     //!
     //! @param task     Task that is finished. This task should not be in the scheduler.
-    void    TaskFinished( const Task* task );
+    void    TaskFinished( Task* task );
+
+    //! @brief  Release one reference of a task, the task is destroyed if it is the last one.
+    //!
+    //! @param task     Task to be released.
+    void    ReleaseTask( Task* task );
+
+    //! @brief  Start or stop flushing pending tasks.
+    //!
+    //! Cancellable tasks picked while flushing are finished right away without being executed, their dependents are
+    //! still released so that the task graph drains as fast as it could. Tasks that can't be cancelled, like the
+    //! ones forked in a task group, are executed as usual.
+    //!
+    //! @param  flushing    Whether to flush pending tasks.
+    SORT_FORCEINLINE void SetFlushing( bool flushing ){
+        m_flushing.store( flushing , std::memory_order_relaxed );
+    }
+
+    //! @brief  Whether pending tasks are being flushed.
+    //!
+    //! Long running tasks could check it once in a while to stop halfway.
+    //!
+    //! @return    Whether pending tasks are being flushed.
+    SORT_FORCEINLINE bool IsFlushing() const {
+        return m_flushing.load( std::memory_order_relaxed );
+    }
+
+    //! @brief  Get the number of workers waiting for tasks.
+    //!
+    //! Workers only wait when there is no available task at all, running tasks could hand part of their work to them.
+    //!
+    //! @return    Number of idle workers.
+    SORT_FORCEINLINE unsigned int GetIdleWorkerCnt() const {
+        return m_sleepingWorkerCnt.load( std::memory_order_relaxed );
+    }
+
+    //! @brief  Get the number of workers, including the main thread.
+    //!
+    //! @return    Number of workers.
+    SORT_FORCEINLINE unsigned int GetWorkerCnt() const {
+        return (unsigned int)m_queues.size();
+    }
+
+    //! @brief  Register the current thread as a running I/O worker.
+    //!
+    //! I/O tasks are left to compute workers if no I/O worker is registered, a pending I/O task is always picked by
+    //! someone.
+    void    RegisterIOWorker();
+
+    //! @brief  Unregister the current thread as a running I/O worker.
+    void    UnregisterIOWorker();
+
+    //! @brief  Count rays traced by the current thread, they are only read by live telemetry.
+    //!
+    //! Unlike stats, the counter could be read while rendering. Each worker counts in its own cache line.
+    //!
+    //! @param  cnt     Number of rays traced.
+    SORT_FORCEINLINE void CountRays( unsigned int cnt ){
+        m_queues[ (unsigned int)ThreadId() % m_queues.size() ]->m_rayCnt.fetch_add( cnt , std::memory_order_relaxed );
+    }
+
+    //! @brief  Get the number of rays traced by a worker so far.
+    //!
+    //! @param  worker  Index of the worker.
+    //! @return         Number of rays traced by the worker.
+    SORT_FORCEINLINE std::uint64_t GetRayCnt( unsigned int worker ) const {
+        return m_queues[worker]->m_rayCnt.load( std::memory_order_relaxed );
+    }
+
+    //! @brief  Get the time spent by a worker executing tasks so far.
+    //!
+    //! @param  worker  Index of the worker.
+    //! @return         Busy time of the worker in microseconds.
+    SORT_FORCEINLINE std::uint64_t GetBusyTime( unsigned int worker ) const {
+        return m_queues[worker]->m_busyTime.load( std::memory_order_relaxed );
+    }
 
 private:
     //! @brief  Default constructor
-    Scheduler():m_availbleTasks(task_comp){}
+    Scheduler(){
+        SetupWorkers(1);
+    }
+
+    //! @brief  Count the time spent by the current thread executing a task.
+    //!
+    //! @param  time        Time spent in microseconds.
+    SORT_FORCEINLINE void addBusyTime( std::uint64_t time ){
+        m_queues[ (unsigned int)ThreadId() % m_queues.size() ]->m_busyTime.fetch_add( time , std::memory_order_relaxed );
+    }
 
-    TaskQueue                   m_availbleTasks;        /**< Heap of available tasks. */
-    BackupTaskContainer         m_backupTasks;          /**< Container for all tasks not direct available. */
-    std::mutex                  m_mutex;                /**< Mutex to make sure scheduler is thread-safe. */
-    std::condition_variable     m_cv;                   /**< Conditional variable for pick task. */
-    TaskContainer               m_tasks;                /**< This holds all tasks to keep them alive. */
+    //! @brief  Push a task without any dependency in one of the worker queues.
+    //!
+    //! @param  task        Task that is available for executing.
+    void    pushAvailableTask( Task* task );
+
+    //! @brief  Pop the task with highest priority from a worker queue.
+    //!
+    //! @param  queue       The queue to pop task from.
+    //! @param  available   The counter of available tasks the queue contributes to.
+    //! @return             The popped task, nullptr if the queue is empty.
+    Task*   popAvailableTask( WorkerQueue& queue , std::atomic<unsigned int>& available );
+
+    //! @brief  Wake up sleeping workers if there is any.
+    //!
+    //! @param  all         Whether to wake up all sleeping workers, I/O workers are also woken up in this case.
+    void    wakeupWorkers( bool all );
+
+    //! @brief  Wake up one sleeping I/O worker if there is any.
+    void    wakeupIOWorker();
+
+    std::vector<std::unique_ptr<WorkerQueue>>   m_queues;               /**< Per worker queues of available tasks. */
+    std::vector<std::vector<unsigned int>>      m_stealOrders;          /**< Per worker order of queues to steal tasks from. */
+    std::atomic<unsigned int>   m_nextQueue = 0;                        /**< Index of the next queue to push available task. */
+    std::atomic<unsigned int>   m_availableTaskCnt = 0;                 /**< Number of available tasks in all queues. */
+    std::atomic<unsigned int>   m_unfinishedTaskCnt = 0;                /**< Number of tasks that are not finished yet. */
+    std::atomic<unsigned int>   m_sleepingWorkerCnt = 0;                /**< Number of workers that are sleeping. */
+    std::atomic<bool>           m_flushing = false;                     /**< Whether cancellable tasks are dropped. */
+    std::mutex                  m_sleepMutex;                           /**< Mutex for sleeping workers. */
+    std::condition_variable     m_cv;                                   /**< Conditional variable to wake up sleeping workers. */
+    WorkerQueue                 m_ioQueue;                              /**< Queue of available I/O tasks shared by all I/O workers. */
+    std::atomic<unsigned int>   m_availableIOTaskCnt = 0;               /**< Number of available I/O tasks. */
+    std::atomic<unsigned int>   m_ioWorkerCnt = 0;                      /**< Number of running I/O workers. */
+    std::atomic<unsigned int>   m_sleepingIOWorkerCnt = 0;              /**< Number of I/O workers that are sleeping. */
+    std::condition_variable     m_ioCv;                                 /**< Conditional variable to wake up sleeping I/O workers. */
+    TaskMemoryPool              m_taskPool;                             /**< Memory pool holding all tasks alive. */
 
     friend class Singleton<Scheduler>;
+    friend class Task;
 };
 
+SORT_FORCEINLINE TaskHandle::TaskHandle( const TaskHandle& other ) : m_task(other.m_task) {
+    if( m_task )
+        m_task->AddReference();
+}
+
+SORT_FORCEINLINE void TaskHandle::Reset(){
+    if( m_task )
+        Scheduler::GetSingleton().ReleaseTask( m_task );
+    m_task = nullptr;
+}
+
 //! @brief      Schedule a task in task scheduler.
+//!
+//! @return     Handle of the task, the task stays alive as long as the handle does.
 template<class T, typename... Args>
-SORT_FORCEINLINE Task*  SCHEDULE_TASK( const char* name , unsigned int priority , const Task::Task_Container& dependencies , Args&&... args ){
-    auto ret = std::make_unique<T>(args..., name, priority, dependencies);
-    return Scheduler::GetSingleton().Schedule( std::move(ret) );
+SORT_FORCEINLINE TaskHandle  SCHEDULE_TASK( const char* name , unsigned int priority , const Task::Task_Container& dependencies , Args&&... args ){
+    static_assert( std::is_base_of<Task, T>::value , "Only tasks can be scheduled." );
+    auto& scheduler = Scheduler::GetSingleton();
+    auto task = new (scheduler.AllocateTask( sizeof(T) , alignof(T) )) T(args..., name, priority, dependencies);
+
+    // the reference of the handle is taken before the task is published, it could be finished right away
+    task->AddReference();
+    return TaskHandle( scheduler.Schedule( task ) );
+}
+
+//! @brief  A group of tasks forked inside another task.
+/**
+ * Tasks forked in a group are regular tasks without dependencies, idle workers pick them up like any other tasks.
+ * Joining a group doesn't put the worker to sleep, it keeps executing available tasks, including the forked ones,
+ * until all tasks in the group are finished. Tasks in a group can fork more tasks in the same group. This is mainly
+ * for parallelizing work that is too heavy to be done in one task, like building spatial data structures.
+ */
+class TaskGroup{
+public:
+    //! @brief  Destructor waits for all tasks in the group.
+    ~TaskGroup(){
+        Join();
+    }
+
+    //! @brief  Fork a function as a task in the group.
+    //!
+    //! @param  func        The function to be executed.
+    //! @param  name        Name of the task.
+    //! @param  taskClass   Class of work done by the function.
+    void    Fork( std::function<void()> func , const char* name = "Forked Task" , TaskClass taskClass = TaskClass::Compute );
+
+    //! @brief  Wait for all tasks in the group to be finished, available tasks are executed in the mean time.
+    void    Join();
+
+private:
+    std::atomic<unsigned int>   m_pendingCnt = 0;       /**< Number of tasks in the group that are not finished yet. */
+};
+
+//! @brief  Execute a function on ranges of indices in parallel.
+//!
+//! The range is divided into chunks of at least 'grain' indices, each of them is executed in a forked task.
+//! It returns only after all chunks are done.
+//!
+//! @param  begin       The first index.
+//! @param  end         The index after the last one.
+//! @param  grain       The minimum number of indices in a chunk.
+//! @param  func        The function executed on sub ranges [start, end).
+template<typename Func>
+void ParallelFor( unsigned int begin , unsigned int end , unsigned int grain , const Func& func ){
+    if( end - begin <= grain ){
+        func( begin , end );
+        return;
+    }
+
+    TaskGroup group;
+    for( auto start = begin ; start < end ; start += grain ){
+        const auto stop = std::min( end , start + grain );
+        group.Fork( [&func, start, stop](){ func( start , stop ); } , "Parallel For" );
+    }
+    group.Join();
 }
 
 //! @brief      Executing tasks. It will exit if there is no other tasks.
 void        EXECUTING_TASKS();
 
+//! @brief      Executing I/O tasks in an I/O worker. It will exit if there is no other tasks, including compute ones.
+void        EXECUTING_IO_TASKS();
+
 //! @brief      Get the current ongoing task.
-const Task* GetCurrentTask();
\ No newline at end of file
+const Task* GetCurrentTask();
@@ -0,0 +1,177 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include "telemetry.h"
+#include "task.h"
+#include "stream/socket.h"
+#include "core/globalconfig.h"
+#include "core/memory.h"
+#include "core/log.h"
+
+// Pending HTTP requests are checked this often in seconds while waiting for the next snapshot.
+static constexpr float TELEMETRY_POLL_TIME = 0.05f;
+
+// A client not sending its request in this many seconds is dropped.
+static constexpr float TELEMETRY_REQUEST_TIMEOUT = 1.0f;
+
+// Weight of the latest measurement in the smoothed rate of pixel samples, samples are only counted once a tile is done.
+static constexpr float TELEMETRY_RATE_SMOOTHING = 0.2f;
+
+std::string TelemetrySnapshot::ToJson() const{
+    char buffer[512];
+    snprintf( buffer , sizeof( buffer ) ,
+              "{\"elapsed\":%.3f,\"rays_per_second\":%.1f,\"samples_per_second\":%.1f,\"progress\":%.4f,\"remaining\":%.3f,"
+              "\"utilization\":%.4f,\"rays\":%llu,\"samples\":%llu,\"tile_passes\":%u,\"peak_memory\":%llu,\"workers\":[" ,
+              elapsedTime , rayPerSecond , samplePerSecond , progress , remainingTime , utilization ,
+              (unsigned long long)rayCnt , (unsigned long long)tracedSampleCnt , tilePassCnt , (unsigned long long)peakMemory );
+
+    std::string json( buffer );
+    for( auto i = 0u ; i < (unsigned int)workerUtilization.size() ; ++i ){
+        snprintf( buffer , sizeof( buffer ) , i ? ",%.4f" : "%.4f" , workerUtilization[i] );
+        json += buffer;
+    }
+    return json + "]}";
+}
+
+Telemetry::Telemetry( unsigned short port , float interval ) : m_port( port ), m_interval( interval ){
+}
+
+Telemetry::~Telemetry(){
+    Stop();
+}
+
+void Telemetry::Start(){
+    if( m_port > 0 ){
+        m_listener = std::make_unique<Socket>();
+        if( !m_listener->Listen( m_port ) ){
+            slog( WARNING , TASK , "Failed to listen to port %d, telemetry is not served through HTTP." , m_port );
+            m_listener = nullptr;
+        }
+    }
+
+    // the first snapshot only sets the base line of all rates
+    m_timer.Reset();
+    m_lastTime = 0;
+    takeSnapshot();
+
+    m_stop = false;
+    m_thread = std::thread( [this](){
+        const auto interval = (unsigned int)( m_interval * 1000.0f );
+        std::unique_lock<std::mutex> lock( m_mutex );
+        while( !m_stop ){
+            lock.unlock();
+            if( m_timer.GetElapsedTime() - m_lastTime >= interval )
+                takeSnapshot();
+
+            // waiting for requests doubles as sleeping until the next snapshot
+            if( m_listener ){
+                std::vector<bool> readable;
+                if( Socket::Wait( { m_listener.get() } , TELEMETRY_POLL_TIME , readable ) && readable[0] ){
+                    if( auto connection = m_listener->Accept() )
+                        serve( *connection );
+                }
+                lock.lock();
+            }else{
+                lock.lock();
+                m_cv.wait_for( lock , std::chrono::milliseconds( interval ) , [this](){ return m_stop; } );
+            }
+        }
+    });
+}
+
+void Telemetry::Stop(){
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    if( m_thread.joinable() )
+        m_thread.join();
+    m_listener = nullptr;
+}
+
+void Telemetry::takeSnapshot(){
+    const auto& scheduler = Scheduler::GetSingleton();
+    const auto now = m_timer.GetElapsedTime();
+    const auto elapsed = (float)std::max( 1u , now - m_lastTime ) / 1000.0f;
+    const auto first = m_lastBusyTime.empty();
+
+    auto& snapshot = m_snapshot;
+    snapshot.elapsedTime = (float)now / 1000.0f;
+
+    // workers only count their busy time once a task is done, long tasks could exceed the time between two snapshots
+    const auto worker_cnt = scheduler.GetWorkerCnt();
+    m_lastBusyTime.resize( worker_cnt , 0 );
+    snapshot.workerUtilization.resize( worker_cnt );
+    std::uint64_t ray_cnt = 0;
+    auto utilization = 0.0f;
+    for( auto i = 0u ; i < worker_cnt ; ++i ){
+        ray_cnt += scheduler.GetRayCnt( i );
+        const auto busy = scheduler.GetBusyTime( i );
+        const auto delta = busy > m_lastBusyTime[i] ? busy - m_lastBusyTime[i] : 0;
+        snapshot.workerUtilization[i] = first ? 0.0f : std::min( 1.0f , (float)delta / 1000000.0f / elapsed );
+        utilization += snapshot.workerUtilization[i];
+        m_lastBusyTime[i] = busy;
+    }
+    snapshot.utilization = worker_cnt > 0 ? utilization / (float)worker_cnt : 0.0f;
+    snapshot.rayPerSecond = first ? 0.0f : (float)( ray_cnt - std::min( ray_cnt , m_lastRayCnt ) ) / elapsed;
+    snapshot.rayCnt = ray_cnt;
+    m_lastRayCnt = ray_cnt;
+
+    // the sample count drops once a new frame starts in server mode
+    const auto sample_cnt = (std::uint64_t)( IS_PTR_VALID(g_imageSensor) ? g_imageSensor->GetTracedSampleCnt() : 0ull );
+    if( sample_cnt < m_lastSampleCnt ){
+        m_lastSampleCnt = 0;
+        snapshot.samplePerSecond = 0.0f;
+    }
+    const auto sample_rate = (float)( sample_cnt - m_lastSampleCnt ) / elapsed;
+    if( !first )
+        snapshot.samplePerSecond = snapshot.samplePerSecond > 0.0f ? snapshot.samplePerSecond + ( sample_rate - snapshot.samplePerSecond ) * TELEMETRY_RATE_SMOOTHING : sample_rate;
+    snapshot.tracedSampleCnt = sample_cnt;
+    m_lastSampleCnt = sample_cnt;
+
+    // adaptive sampling could stop early, the remaining time is an upper bound then
+    Vector2i region_min , region_max;
+    GlobalConfiguration::GetSingleton().GetRenderRegion( region_min , region_max );
+    const auto expected = (std::uint64_t)( region_max.x - region_min.x ) * ( region_max.y - region_min.y ) * g_samplePerPixel;
+    const auto done = std::min( sample_cnt , expected );
+    snapshot.progress = expected > 0 ? (float)( (double)done / (double)expected ) : 0.0f;
+    snapshot.remainingTime = snapshot.samplePerSecond > 0.0f ? (float)( expected - done ) / snapshot.samplePerSecond : -1.0f;
+
+    snapshot.tilePassCnt = IS_PTR_VALID(g_imageSensor) ? g_imageSensor->GetFinishedTilePassCnt() : 0u;
+    snapshot.peakMemory = GetPeakResidentMemory();
+    m_lastTime = now;
+
+    if( IS_PTR_VALID(g_imageSensor) )
+        g_imageSensor->UpdateTelemetry( snapshot );
+}
+
+void Telemetry::serve( Socket& socket ) const{
+    // whatever is requested, the latest snapshot is sent back
+    char request[1024];
+    socket.SetTimeOut( TELEMETRY_REQUEST_TIMEOUT );
+    if( 0 == socket.Receive( request , sizeof( request ) ) )
+        return;
+
+    const auto body = m_snapshot.ToJson();
+    const auto response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nAccess-Control-Allow-Origin: *\r\n"
+                          "Cache-Control: no-cache\r\nConnection: close\r\nContent-Length: " + std::to_string( body.size() ) + "\r\n\r\n" + body;
+    socket.Send( response.data() , response.size() );
+}
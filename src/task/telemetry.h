@@ -0,0 +1,104 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <condition_variable>
+#include "core/timer.h"
+
+class Socket;
+
+//! @brief  A snapshot of how the rendering is going, taken while rendering.
+struct TelemetrySnapshot{
+    float                       elapsedTime = 0.0f;         /**< Seconds since telemetry is started. */
+    float                       rayPerSecond = 0.0f;        /**< Rays traced per second since the last snapshot. */
+    float                       samplePerSecond = 0.0f;     /**< Pixel samples traced per second, smoothed over a few snapshots. */
+    float                       progress = 0.0f;            /**< Fraction of the pixel samples of the frame traced so far. */
+    float                       remainingTime = -1.0f;      /**< Estimated seconds to finish the frame, negative if it is unknown yet. */
+    float                       utilization = 0.0f;         /**< Average busy fraction of all workers since the last snapshot. */
+    std::uint64_t               rayCnt = 0;                 /**< Rays traced so far. */
+    std::uint64_t               tracedSampleCnt = 0;        /**< Pixel samples traced in the frame so far. */
+    std::uint32_t               tilePassCnt = 0;            /**< Passes of tiles merged in the frame so far. */
+    std::uint64_t               peakMemory = 0;             /**< Peak resident memory in bytes. */
+    std::vector<float>          workerUtilization;          /**< Busy fraction of each worker since the last snapshot. */
+
+    //! @brief  Serialize the snapshot in JSON.
+    //!
+    //! @return     The snapshot as a JSON object.
+    std::string ToJson() const;
+};
+
+//! @brief  Telemetry takes snapshots of the rendering periodically on a background thread.
+/**
+ * Stats are only merged once rendering is done, telemetry relies on counters that could be read at any time instead.
+ * Each worker counts rays and the time it spends executing tasks in its own cache line of the scheduler, the image
+ * sensor counts pixel samples and passes of tiles. Rates are measured between two snapshots, the remaining time is
+ * estimated from the rate of pixel samples.
+ *
+ * Snapshots are handed to the image sensor, Blender reads them through the shared memory. With a port, the latest
+ * snapshot is also served as JSON to any HTTP request, which is all a farm dashboard needs.
+ */
+class Telemetry{
+public:
+    //! @brief  Constructor.
+    //!
+    //! @param  port        Port serving snapshots through HTTP, 0 means there is no HTTP endpoint.
+    //! @param  interval    Seconds between two snapshots.
+    Telemetry( unsigned short port , float interval );
+
+    //! @brief  Destructor stops the background thread.
+    ~Telemetry();
+
+    //! @brief  Start taking snapshots on a background thread.
+    //!
+    //! Workers of the scheduler need to be set up already, they can't be changed until telemetry is stopped.
+    void    Start();
+
+    //! @brief  Stop taking snapshots.
+    void    Stop();
+
+private:
+    //! @brief  Take a snapshot, rates are measured since the last one.
+    void    takeSnapshot();
+
+    //! @brief  Answer an HTTP request with the latest snapshot.
+    //!
+    //! @param  socket      The connection of the request.
+    void    serve( Socket& socket ) const;
+
+    const unsigned short        m_port;               /**< Port of the HTTP endpoint, 0 if there is none. */
+    const float                 m_interval;           /**< Seconds between two snapshots. */
+
+    TelemetrySnapshot           m_snapshot;           /**< The latest snapshot. */
+    Timer                       m_timer;              /**< Clock of the snapshots, it starts along with telemetry. */
+    unsigned int                m_lastTime = 0;       /**< When the last snapshot is taken in milliseconds. */
+    std::uint64_t               m_lastRayCnt = 0;     /**< Rays traced by the time of the last snapshot. */
+    std::uint64_t               m_lastSampleCnt = 0;  /**< Pixel samples traced by the time of the last snapshot. */
+    std::vector<std::uint64_t>  m_lastBusyTime;       /**< Busy time of each worker by the time of the last snapshot. */
+
+    std::unique_ptr<Socket>     m_listener;           /**< The listening socket of the HTTP endpoint. */
+    std::thread                 m_thread;             /**< The thread taking snapshots. */
+    std::mutex                  m_mutex;              /**< Mutex protecting the stop flag. */
+    std::condition_variable     m_cv;                 /**< Wakes up the thread once it needs to stop. */
+    bool                        m_stop = false;       /**< Whether the thread needs to stop. */
+};
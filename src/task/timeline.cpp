@@ -0,0 +1,115 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include "timeline.h"
+#include "core/thread.h"
+#include "core/log.h"
+
+static const char* g_eventTypeNames[] = { "task" , "wait" , "idle" };
+
+void Timeline::Enable( unsigned int capacity ){
+    m_capacity = std::max( 1u , capacity );
+    m_start = std::chrono::steady_clock::now();
+    m_enabled = true;
+}
+
+void Timeline::Disable(){
+    m_enabled = false;
+
+    // timelines of threads are kept, workers still point to them
+    std::lock_guard<std::mutex> lock( m_mutex );
+    for( auto& timeline : m_threads ){
+        timeline->eventCnt = 0;
+        std::fill( std::begin( timeline->totalTime ) , std::end( timeline->totalTime ) , 0 );
+    }
+}
+
+Timeline::ThreadTimeline& Timeline::threadTimeline(){
+    thread_local static ThreadTimeline* timeline = nullptr;
+    if( timeline )
+        return *timeline;
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_threads.push_back( std::make_unique<ThreadTimeline>() );
+    timeline = m_threads.back().get();
+    timeline->tid = ThreadId();
+    timeline->events.resize( m_capacity );
+    return *timeline;
+}
+
+void Timeline::Record( TimelineEvent type , const std::string& name , unsigned int id , std::uint64_t begin , std::uint64_t end ){
+    auto& timeline = threadTimeline();
+    const auto duration = end > begin ? end - begin : 0;
+    timeline.totalTime[(int)type] += duration;
+
+    // picking a task is mostly way below a microsecond, these are only counted in the total time
+    if( type == TimelineEvent::Wait && duration == 0 )
+        return;
+
+    auto& event = timeline.events[ timeline.eventCnt++ % timeline.events.size() ];
+    event.name = &*timeline.names.insert( name ).first;
+    event.begin = begin;
+    event.duration = (std::uint32_t)std::min<std::uint64_t>( duration , UINT32_MAX );
+    event.id = id;
+    event.type = type;
+}
+
+bool Timeline::ExportChromeTrace( const std::string& path ) const{
+    std::ofstream file( path );
+    if( !file.is_open() ){
+        slog( WARNING , GENERAL , "Failed to export the timeline to %s." , path.c_str() );
+        return false;
+    }
+
+    // quotes and backslashes are not expected in names of tasks
+    std::lock_guard<std::mutex> lock( m_mutex );
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    auto first = true;
+    auto dropped = 0ull;
+    for( const auto& timeline : m_threads ){
+        file << ( first ? "" : "," ) << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << timeline->tid
+             << ",\"args\":{\"name\":\"Worker " << timeline->tid << "\"}}";
+        first = false;
+
+        // totals of the worker are attached to an instant event at the very end
+        auto last = 0ull;
+        const auto cnt = std::min<std::uint64_t>( timeline->eventCnt , timeline->events.size() );
+        for( auto i = timeline->eventCnt - cnt ; i < timeline->eventCnt ; ++i ){
+            const auto& event = timeline->events[ i % timeline->events.size() ];
+            file << ",\n{\"name\":\"" << *event.name << "\",\"cat\":\"" << g_eventTypeNames[(int)event.type]
+                 << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << timeline->tid << ",\"ts\":" << event.begin << ",\"dur\":" << event.duration;
+            if( event.type == TimelineEvent::Task )
+                file << ",\"args\":{\"task_id\":" << event.id << "}";
+            file << "}";
+            last = std::max<unsigned long long>( last , event.begin + event.duration );
+        }
+        file << ",\n{\"name\":\"Worker Summary\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":" << timeline->tid << ",\"ts\":" << last
+             << ",\"args\":{\"task_us\":" << timeline->totalTime[(int)TimelineEvent::Task]
+             << ",\"wait_us\":" << timeline->totalTime[(int)TimelineEvent::Wait]
+             << ",\"idle_us\":" << timeline->totalTime[(int)TimelineEvent::Idle]
+             << ",\"dropped_events\":" << timeline->eventCnt - cnt << "}}";
+        dropped += timeline->eventCnt - cnt;
+    }
+    file << "\n]}\n";
+
+    if( dropped )
+        slog( WARNING , GENERAL , "%llu events are dropped in the timeline, only the latest ones are kept." , dropped );
+    slog( INFO , GENERAL , "Timeline is exported to %s." , path.c_str() );
+    return true;
+}
@@ -0,0 +1,150 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <chrono>
+#include "core/singleton.h"
+
+//! @brief  Type of an event recorded in the timeline.
+enum class TimelineEvent : std::uint8_t{
+    Task = 0,       /**< A task being executed. */
+    Wait,           /**< A worker looking for a task, including stealing from other workers. */
+    Idle,           /**< A worker sleeping because there is no available task at all. */
+};
+
+//! @brief  Timeline records when each worker executes tasks and when it waits, exported as a Chrome trace.
+/**
+ * The profiler only exists in builds with easy_profiler, the timeline is always available and is enabled from the
+ * command line. Each worker records events in its own ring buffer without any lock, the oldest events are overwritten
+ * once a buffer is full so the memory is bounded no matter how long the rendering takes. Total time of each type is
+ * counted separately, it is exact even if events are dropped.
+ *
+ * The exported JSON could be opened in chrome://tracing or https://ui.perfetto.dev, serial phases, gaps between tasks
+ * and workers finishing late are obvious there.
+ */
+class Timeline : public Singleton<Timeline>{
+public:
+    //! @brief  Start recording events.
+    //!
+    //! @param  capacity    Maximum number of events kept per worker.
+    void    Enable( unsigned int capacity );
+
+    //! @brief  Stop recording events and drop the ones recorded so far.
+    //!
+    //! It should only be called when no worker is recording events anymore.
+    void    Disable();
+
+    //! @brief  Whether events are recorded.
+    //!
+    //! @return             Whether the timeline is enabled.
+    SORT_FORCEINLINE bool IsEnabled() const {
+        return m_enabled.load( std::memory_order_relaxed );
+    }
+
+    //! @brief  Current time of the timeline.
+    //!
+    //! @return             Microseconds since the timeline is enabled.
+    SORT_FORCEINLINE std::uint64_t Now() const {
+        return (std::uint64_t)std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - m_start ).count();
+    }
+
+    //! @brief  Record an event of the current thread.
+    //!
+    //! @param  type        Type of the event.
+    //! @param  name        Name of the event.
+    //! @param  id          ID of the task, 0 if the event is not a task.
+    //! @param  begin       When the event starts, in microseconds of the timeline.
+    //! @param  end         When the event ends, in microseconds of the timeline.
+    void    Record( TimelineEvent type , const std::string& name , unsigned int id , std::uint64_t begin , std::uint64_t end );
+
+    //! @brief  Export all recorded events in Chrome trace format.
+    //!
+    //! It should only be called when no worker is recording events anymore.
+    //!
+    //! @param  path        Full path of the JSON file.
+    //! @return             Whether the file is written.
+    bool    ExportChromeTrace( const std::string& path ) const;
+
+private:
+    //! @brief  A recorded event.
+    struct Event{
+        const std::string*  name;       /**< Name of the event, owned by the timeline of the thread. */
+        std::uint64_t   begin;          /**< Start of the event in microseconds. */
+        std::uint32_t   duration;       /**< Duration of the event in microseconds. */
+        std::uint32_t   id;             /**< ID of the task. */
+        TimelineEvent   type;           /**< Type of the event. */
+    };
+
+    //! @brief  Events of a worker.
+    struct ThreadTimeline{
+        int                 tid = 0;                /**< Thread id of the worker. */
+        std::vector<Event>  events;                 /**< Ring buffer of events. */
+        std::uint64_t       eventCnt = 0;           /**< Number of events recorded, including the overwritten ones. */
+        std::uint64_t       totalTime[3] = { 0 };   /**< Total time of each type of events in microseconds. */
+        std::unordered_set<std::string> names;      /**< Names of events, tasks are gone long before the timeline is exported. */
+    };
+
+    std::atomic<bool>                               m_enabled = false;  /**< Whether events are recorded. */
+    unsigned int                                    m_capacity = 0;     /**< Maximum number of events kept per worker. */
+    std::chrono::steady_clock::time_point           m_start;            /**< When the timeline is enabled. */
+    std::vector<std::unique_ptr<ThreadTimeline>>    m_threads;          /**< Events of all workers, they outlive the threads. */
+    mutable std::mutex                              m_mutex;            /**< Mutex protecting the list of workers. */
+
+    //! @brief  Get the timeline of the current thread, it is created the first time the thread records anything.
+    ThreadTimeline& threadTimeline();
+
+    friend class Singleton<Timeline>;
+};
+
+//! @brief  Record the scope as an event if the timeline is enabled.
+class TimelineScope{
+public:
+    //! @brief  Constructor marks the start of the event.
+    //!
+    //! @param  type        Type of the event.
+    //! @param  name        Name of the event, it needs to be alive until the scope ends.
+    //! @param  id          ID of the task, 0 if the event is not a task.
+    TimelineScope( TimelineEvent type , const std::string& name , unsigned int id = 0 ) : m_type( type ) , m_name( name ) , m_id( id ) {
+        auto& timeline = Timeline::GetSingleton();
+        m_enabled = timeline.IsEnabled();
+        if( m_enabled )
+            m_begin = timeline.Now();
+    }
+
+    //! @brief  Destructor marks the end of the event.
+    ~TimelineScope(){
+        if( m_enabled ){
+            auto& timeline = Timeline::GetSingleton();
+            timeline.Record( m_type , m_name , m_id , m_begin , timeline.Now() );
+        }
+    }
+
+private:
+    const TimelineEvent m_type;
+    const std::string&  m_name;
+    const unsigned int  m_id;
+    bool                m_enabled = false;
+    std::uint64_t       m_begin = 0;
+};
@@ -0,0 +1,656 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include "core/define.h"
+#ifdef SORT_IN_LINUX
+#include <unistd.h>
+#endif
+#include "thirdparty/gtest/gtest.h"
+#include "accel/accelerator.h"
+#include "entity/visual.h"
+#include "core/mesh.h"
+#include "core/primitive.h"
+#include "core/rand.h"
+#include "math/interaction.h"
+#include "material/matmanager.h"
+#include "scatteringevent/bssrdf/bssrdf.h"
+#include "stream/mstream.h"
+
+namespace {
+    static const char* g_accelerators[] = { "Bvh" , "Qbvh" , "Obvh" , "Hbvh" , "KDTree" , "OcTree" , "UniGrid" };
+
+    //! @brief  Spatial subdivisions clip rays against cells with epsilons, only the bounding volume hierarchies are expected to be watertight.
+    static const char* g_watertight_accelerators[] = { "Bvh" , "Qbvh" , "Obvh" , "Hbvh" };
+
+    //! @brief  Wide BVHs supporting quantized triangles in leaves.
+    static const char* g_quantized_accelerators[] = { "Qbvh" , "Obvh" , "Hbvh" };
+
+    //! @brief  Create a wide BVH with quantized triangles in leaves, the settings are streamed in the same way as they are exported.
+    std::unique_ptr<Accelerator> makeQuantizedAccelerator( const char* name , bool compress_nodes ){
+        auto accelerator = MakeUniqueInstance<Accelerator>( ResolveAcceleratorType( StringID( name ) ) );
+        if( IS_PTR_INVALID( accelerator ) )
+            return nullptr;
+
+        IMemoryStream settings;
+        settings << 28u << 16u << compress_nodes << 0.0f << true;
+        OMemoryStream stream( settings );
+        accelerator->Serialize( stream );
+        return accelerator;
+    }
+
+    //! @brief  A synthetic scene made of triangles only, it requires nothing but the mesh data.
+    struct TestScene{
+        //! @brief  Constructor.
+        //!
+        //! @param  name    Name of the scene in the reports.
+        TestScene( const char* name ) : m_name(name) {
+            m_visual.m_memory = std::make_unique<Mesh>();
+        }
+
+        //! @brief  Add a triangle in the scene.
+        void AddTriangle( const Point& p0 , const Point& p1 , const Point& p2 ){
+            auto& mesh = *m_visual.m_memory;
+            const auto n = normalize( cross( p1 - p0 , p2 - p0 ) );
+
+            MeshFaceIndex index;
+            for( auto i = 0 ; i < 3 ; ++i ){
+                MeshVertex vertex;
+                vertex.m_normal = n;
+                vertex.m_tangent = normalize( p1 - p0 );
+                index.m_id[i] = (int)mesh.m_positions.size();
+                mesh.m_positions.push_back( ( 0 == i ) ? p0 : ( ( 1 == i ) ? p1 : p2 ) );
+                mesh.m_vertices.push_back( vertex );
+            }
+            index.m_mat = MatManager::GetSingleton().GetDefaultMat();
+            mesh.m_indices.push_back( index );
+        }
+
+        //! @brief  Add an axis aligned quad in the scene.
+        void AddQuad( const Point& p0 , const Vector& e0 , const Vector& e1 ){
+            AddTriangle( p0 , p0 + e0 , p0 + e0 + e1 );
+            AddTriangle( p0 , p0 + e0 + e1 , p0 + e1 );
+        }
+
+        //! @brief  Create the primitives once all triangles are added.
+        void Finalize(){
+            for( const auto& primitive : m_visual.CreatePrimitives() ){
+                m_primitives.push_back( &primitive );
+                m_bbox.Union( primitive.GetBBox() );
+            }
+        }
+
+        const char*                     m_name;         /**< Name of the scene. */
+        MeshVisual                      m_visual;       /**< The mesh holding all triangles. */
+        std::vector<const Primitive*>   m_primitives;   /**< Primitives to build accelerators with. */
+        BBox                            m_bbox;         /**< Bounding box of the whole scene. */
+    };
+
+    //! @brief  A set of rays that are traced against every accelerator.
+    struct RaySet{
+        const char*         m_name;             /**< Name of the ray distribution. */
+        std::vector<Ray>    m_rays;             /**< Rays to be traced. */
+        bool                m_shadow = false;   /**< Whether they are shadow rays, only occlusion matters for them. */
+    };
+
+    Point randomPoint( const BBox& bbox ){
+        const auto d = bbox.m_Max - bbox.m_Min;
+        return bbox.m_Min + Vector( d.x * sort_canonical() , d.y * sort_canonical() , d.z * sort_canonical() );
+    }
+
+    Vector randomDirection(){
+        const auto z = 1.0f - 2.0f * sort_canonical();
+        const auto r = sqrt( std::max( 0.0f , 1.0f - z * z ) );
+        const auto phi = TWO_PI * sort_canonical();
+        return Vector( r * cos( phi ) , r * sin( phi ) , z );
+    }
+
+    // Triangles randomly scattered in a cube.
+    std::unique_ptr<TestScene> makeUniformScene( unsigned int cnt ){
+        auto scene = std::make_unique<TestScene>( "Uniform" );
+        const BBox box( Point( 0.0f ) , Point( 10.0f ) );
+        for( auto i = 0u ; i < cnt ; ++i ){
+            const auto p = randomPoint( box );
+            scene->AddTriangle( p , p + randomDirection() * 0.3f , p + randomDirection() * 0.3f );
+        }
+        scene->Finalize();
+        return scene;
+    }
+
+    // Most of triangles are densely packed in a tiny region of a huge room, which is known as 'teapot in a stadium'.
+    std::unique_ptr<TestScene> makeClusteredScene( unsigned int cnt ){
+        auto scene = std::make_unique<TestScene>( "Teapot in a stadium" );
+        const BBox box( Point( 48.0f ) , Point( 52.0f ) );
+        for( auto i = 0u ; i < cnt ; ++i ){
+            const auto p = randomPoint( box );
+            scene->AddTriangle( p , p + randomDirection() * 0.05f , p + randomDirection() * 0.05f );
+        }
+        scene->AddQuad( Point( 0.0f ) , Vector( 100.0f , 0.0f , 0.0f ) , Vector( 0.0f , 0.0f , 100.0f ) );
+        scene->AddQuad( Point( 0.0f ) , Vector( 0.0f , 0.0f , 100.0f ) , Vector( 0.0f , 100.0f , 0.0f ) );
+        scene->AddQuad( Point( 0.0f ) , Vector( 0.0f , 100.0f , 0.0f ) , Vector( 100.0f , 0.0f , 0.0f ) );
+        scene->Finalize();
+        return scene;
+    }
+
+    // Axis aligned walls and floors of a building, which is where KD-Tree usually shines.
+    std::unique_ptr<TestScene> makeArchitecturalScene( unsigned int cnt ){
+        auto scene = std::make_unique<TestScene>( "Architecture" );
+        const auto rooms = std::max( 1u , (unsigned int)sqrt( cnt / 6.0f ) );
+        const auto floors = 4u;
+        const auto size = 10.0f / rooms;
+        for( auto f = 0u ; f < floors ; ++f ){
+            const auto y = f * 3.0f;
+            for( auto i = 0u ; i < rooms ; ++i ){
+                for( auto j = 0u ; j < rooms / floors + 1 ; ++j ){
+                    const Point corner( i * size , y , j * size * floors );
+                    scene->AddQuad( corner , Vector( size , 0.0f , 0.0f ) , Vector( 0.0f , 0.0f , size * floors ) );
+                    // leave some doors so that rays don't always stop in the first room
+                    if( sort_canonical() > 0.3f )
+                        scene->AddQuad( corner , Vector( 0.0f , 3.0f , 0.0f ) , Vector( 0.0f , 0.0f , size * floors ) );
+                    if( sort_canonical() > 0.3f )
+                        scene->AddQuad( corner , Vector( size , 0.0f , 0.0f ) , Vector( 0.0f , 3.0f , 0.0f ) );
+                }
+            }
+        }
+        scene->Finalize();
+        return scene;
+    }
+
+    // Rays shot from a pinhole camera outside of the scene, neighbouring rays travel through similar nodes.
+    RaySet makeCoherentRays( const TestScene& scene , unsigned int res ){
+        RaySet ray_set{ "Coherent" };
+        const auto& bbox = scene.m_bbox;
+        const auto center = ( bbox.m_Min + bbox.m_Max ) * 0.5f;
+        const auto extent = bbox.m_Max - bbox.m_Min;
+        const auto eye = center + Vector( 0.3f , 0.4f , -1.2f ) * std::max( extent.x , std::max( extent.y , extent.z ) );
+        const auto forward = normalize( center - eye );
+        const auto right = normalize( cross( Vector( 0.0f , 1.0f , 0.0f ) , forward ) );
+        const auto up = cross( forward , right );
+        for( auto j = 0u ; j < res ; ++j ){
+            for( auto i = 0u ; i < res ; ++i ){
+                const auto u = ( i + 0.5f ) / res - 0.5f;
+                const auto v = ( j + 0.5f ) / res - 0.5f;
+                ray_set.m_rays.push_back( Ray( eye , normalize( forward + right * u + up * v ) ) );
+            }
+        }
+        return ray_set;
+    }
+
+    // Rays starting from random positions inside the scene with random directions, like the secondary rays of path tracing.
+    RaySet makeIncoherentRays( const TestScene& scene , unsigned int cnt ){
+        RaySet ray_set{ "Incoherent" };
+        for( auto i = 0u ; i < cnt ; ++i )
+            ray_set.m_rays.push_back( Ray( randomPoint( scene.m_bbox ) , randomDirection() ) );
+        return ray_set;
+    }
+
+    // Segments connecting two random positions inside the scene, like the shadow rays of next event estimation.
+    RaySet makeShadowRays( const TestScene& scene , unsigned int cnt ){
+        RaySet ray_set{ "Shadow" };
+        ray_set.m_shadow = true;
+        for( auto i = 0u ; i < cnt ; ++i ){
+            const auto p0 = randomPoint( scene.m_bbox );
+            const auto d = randomPoint( scene.m_bbox ) - p0;
+            const auto len = d.Length();
+            if( len > 0.0f )
+                ray_set.m_rays.push_back( Ray( p0 , d / len , 0 , 0.0f , len ) );
+        }
+        return ray_set;
+    }
+
+    // Whether the ray is blocked by anything.
+    bool isOccluded( const Accelerator& accelerator , const Ray& ray ){
+#ifdef ENABLE_TRANSPARENT_SHADOW
+        SurfaceInteraction intersection;
+        intersection.query_shadow = true;
+        return accelerator.GetIntersect( ray , intersection );
+#else
+        return accelerator.IsOccluded( ray );
+#endif
+    }
+
+    // Trace a ray against all primitives, this is the ground truth.
+    bool bruteForce( const TestScene& scene , const Ray& ray , SurfaceInteraction& intersection ){
+        ray.Prepare();
+
+        auto ret = false;
+        for( const auto primitive : scene.m_primitives )
+            ret |= primitive->GetIntersect( ray , &intersection );
+        return ret;
+    }
+
+    // Resident memory of the process in bytes, it is only available on Linux.
+    long long residentMemory(){
+#ifdef SORT_IN_LINUX
+        long long total = 0 , resident = 0;
+        std::ifstream statm( "/proc/self/statm" );
+        if( statm >> total >> resident )
+            return resident * sysconf( _SC_PAGESIZE );
+#endif
+        return -1;
+    }
+
+    std::vector<std::unique_ptr<TestScene>> makeScenes( unsigned int cnt ){
+        std::vector<std::unique_ptr<TestScene>> scenes;
+        scenes.push_back( makeUniformScene( cnt ) );
+        scenes.push_back( makeClusteredScene( cnt ) );
+        scenes.push_back( makeArchitecturalScene( cnt ) );
+        return scenes;
+    }
+
+    std::vector<RaySet> makeRaySets( const TestScene& scene , unsigned int cnt ){
+        std::vector<RaySet> ray_sets;
+        ray_sets.push_back( makeCoherentRays( scene , (unsigned int)sqrt( (float)cnt ) ) );
+        ray_sets.push_back( makeIncoherentRays( scene , cnt ) );
+        ray_sets.push_back( makeShadowRays( scene , cnt ) );
+        return ray_sets;
+    }
+}
+
+// All accelerators should find the same nearest intersections as testing all primitives does.
+TEST(ACCELERATOR, Consistency) {
+    for( const auto& scene : makeScenes( 2000 ) ){
+        const auto ray_sets = makeRaySets( *scene , 1024 );
+        for( const auto name : g_accelerators ){
+            auto accelerator = MakeUniqueInstance<Accelerator>( ResolveAcceleratorType( StringID( name ) ) );
+            ASSERT_NE( accelerator , nullptr );
+            accelerator->Build( scene->m_primitives , scene->m_bbox );
+
+            for( const auto& ray_set : ray_sets ){
+                for( const auto& ray : ray_set.m_rays ){
+                    SurfaceInteraction expected;
+                    const auto hit = bruteForce( *scene , ray , expected );
+                    if( ray_set.m_shadow ){
+                        EXPECT_EQ( hit , isOccluded( *accelerator , ray ) ) << name << " " << scene->m_name;
+                    }else{
+                        SurfaceInteraction intersection;
+                        EXPECT_EQ( hit , accelerator->GetIntersect( ray , intersection ) ) << name << " " << scene->m_name;
+                        if( hit ){
+                            EXPECT_NEAR( expected.t , intersection.t , 0.001f ) << name << " " << scene->m_name;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// BVHs built along a Morton curve trade quality for build time, they should still find the nearest intersections.
+TEST(ACCELERATOR, LinearBuild) {
+    for( const auto& scene : makeScenes( 2000 ) ){
+        const auto ray_sets = makeRaySets( *scene , 1024 );
+        for( const auto name : g_watertight_accelerators ){
+            auto accelerator = MakeUniqueInstance<Accelerator>( ResolveAcceleratorType( StringID( name ) ) );
+            ASSERT_NE( accelerator , nullptr );
+            accelerator->SetLinearBuild( true );
+            accelerator->Build( scene->m_primitives , scene->m_bbox );
+
+            for( const auto& ray_set : ray_sets ){
+                for( const auto& ray : ray_set.m_rays ){
+                    SurfaceInteraction expected;
+                    const auto hit = bruteForce( *scene , ray , expected );
+                    if( ray_set.m_shadow ){
+                        EXPECT_EQ( hit , isOccluded( *accelerator , ray ) ) << name << " " << scene->m_name;
+                    }else{
+                        SurfaceInteraction intersection;
+                        EXPECT_EQ( hit , accelerator->GetIntersect( ray , intersection ) ) << name << " " << scene->m_name;
+                        if( hit ){
+                            EXPECT_NEAR( expected.t , intersection.t , 0.001f ) << name << " " << scene->m_name;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// QBVH/OBVH collapsed from a restructured binary BVH have a different topology, they should still find the nearest intersections.
+TEST(ACCELERATOR, OptimizedBuild) {
+    for( const auto& scene : makeScenes( 2000 ) ){
+        const auto ray_sets = makeRaySets( *scene , 1024 );
+        for( const auto name : g_watertight_accelerators ){
+            auto accelerator = MakeUniqueInstance<Accelerator>( ResolveAcceleratorType( StringID( name ) ) );
+            ASSERT_NE( accelerator , nullptr );
+            accelerator->SetOptimizedBuild( true );
+            accelerator->Build( scene->m_primitives , scene->m_bbox );
+
+            for( const auto& ray_set : ray_sets ){
+                for( const auto& ray : ray_set.m_rays ){
+                    SurfaceInteraction expected;
+                    const auto hit = bruteForce( *scene , ray , expected );
+                    if( ray_set.m_shadow ){
+                        EXPECT_EQ( hit , isOccluded( *accelerator , ray ) ) << name << " " << scene->m_name;
+                    }else{
+                        SurfaceInteraction intersection;
+                        EXPECT_EQ( hit , accelerator->GetIntersect( ray , intersection ) ) << name << " " << scene->m_name;
+                        if( hit ){
+                            EXPECT_NEAR( expected.t , intersection.t , 0.001f ) << name << " " << scene->m_name;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// BVHs with the cost weighted by camera rays have a different topology, they should still find the nearest intersections.
+TEST(ACCELERATOR, CameraWeightedBuild) {
+    for( const auto& scene : makeScenes( 2000 ) ){
+        const auto ray_sets = makeRaySets( *scene , 1024 );
+
+        // a narrow cone looking at one corner of the scene from outside of it
+        RayDistribution rays;
+        rays.origin = scene->m_bbox.m_Min - ( scene->m_bbox.m_Max - scene->m_bbox.m_Min );
+        rays.dir = normalize( scene->m_bbox.m_Min - rays.origin );
+        rays.cosHalfAngle = 0.95f;
+        rays.weight = 4.0f;
+
+        for( const auto name : g_watertight_accelerators ){
+            auto accelerator = MakeUniqueInstance<Accelerator>( ResolveAcceleratorType( StringID( name ) ) );
+            ASSERT_NE( accelerator , nullptr );
+            accelerator->SetRayDistribution( rays );
+            accelerator->Build( scene->m_primitives , scene->m_bbox );
+
+            for( const auto& ray_set : ray_sets ){
+                for( const auto& ray : ray_set.m_rays ){
+                    SurfaceInteraction expected;
+                    const auto hit = bruteForce( *scene , ray , expected );
+                    if( ray_set.m_shadow ){
+                        EXPECT_EQ( hit , isOccluded( *accelerator , ray ) ) << name << " " << scene->m_name;
+                    }else{
+                        SurfaceInteraction intersection;
+                        EXPECT_EQ( hit , accelerator->GetIntersect( ray , intersection ) ) << name << " " << scene->m_name;
+                        if( hit ){
+                            EXPECT_NEAR( expected.t , intersection.t , 0.001f ) << name << " " << scene->m_name;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Packets of coherent rays and interleaved batches of incoherent rays should find the same intersections as single rays do.
+TEST(ACCELERATOR, Batches) {
+    for( const auto& scene : makeScenes( 2000 ) ){
+        const auto ray_sets = makeRaySets( *scene , 1024 );
+        for( const auto name : g_accelerators ){
+            auto accelerator = MakeUniqueInstance<Accelerator>( ResolveAcceleratorType( StringID( name ) ) );
+            ASSERT_NE( accelerator , nullptr );
+            accelerator->Build( scene->m_primitives , scene->m_bbox );
+
+            for( const auto& ray_set : ray_sets ){
+                if( ray_set.m_shadow )
+                    continue;
+
+                const auto cnt = (unsigned int)ray_set.m_rays.size();
+                std::vector<SurfaceInteraction> packet( cnt ) , interleaved( cnt );
+                accelerator->GetIntersect( ray_set.m_rays.data() , packet.data() , cnt );
+                accelerator->GetIntersectIncoherent( ray_set.m_rays.data() , interleaved.data() , cnt );
+                for( auto i = 0u ; i < cnt ; ++i ){
+                    SurfaceInteraction expected;
+                    const auto hit = accelerator->GetIntersect( ray_set.m_rays[i] , expected );
+                    EXPECT_EQ( hit , IS_PTR_VALID( packet[i].primitive ) ) << name << " " << scene->m_name << " " << ray_set.m_name;
+                    EXPECT_EQ( hit , IS_PTR_VALID( interleaved[i].primitive ) ) << name << " " << scene->m_name << " " << ray_set.m_name;
+                    if( hit ){
+                        EXPECT_NEAR( expected.t , packet[i].t , 0.001f ) << name << " " << scene->m_name << " " << ray_set.m_name;
+                        EXPECT_NEAR( expected.t , interleaved[i].t , 0.001f ) << name << " " << scene->m_name << " " << ray_set.m_name;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Batches laid out as structure of arrays should find the same hits as single rays do, masked rays are never reported.
+TEST(ACCELERATOR, BatchQueries) {
+    for( const auto& scene : makeScenes( 2000 ) ){
+        const auto ray_sets = makeRaySets( *scene , 1024 );
+        for( const auto name : g_accelerators ){
+            auto accelerator = MakeUniqueInstance<Accelerator>( ResolveAcceleratorType( StringID( name ) ) );
+            ASSERT_NE( accelerator , nullptr );
+            accelerator->Build( scene->m_primitives , scene->m_bbox );
+
+            for( const auto& ray_set : ray_sets ){
+                const auto cnt = (unsigned int)ray_set.m_rays.size();
+                std::vector<float> ori[3] , dir[3] , tmin( cnt ) , tmax( cnt );
+                std::vector<unsigned char> mask( cnt );
+                for( auto k = 0 ; k < 3 ; ++k ){
+                    ori[k].resize( cnt );
+                    dir[k].resize( cnt );
+                }
+                for( auto i = 0u ; i < cnt ; ++i ){
+                    const auto& ray = ray_set.m_rays[i];
+                    for( auto k = 0 ; k < 3 ; ++k ){
+                        ori[k][i] = ray.m_Ori[k];
+                        dir[k][i] = ray.m_Dir[k];
+                    }
+                    tmin[i] = ray.m_fMin;
+                    tmax[i] = ray.m_fMax;
+                    mask[i] = ( i % 3 ) != 0;
+                }
+
+                RayBatch batch;
+                for( auto k = 0 ; k < 3 ; ++k ){
+                    batch.ori[k] = ori[k].data();
+                    batch.dir[k] = dir[k].data();
+                }
+                batch.tmin = tmin.data();
+                batch.tmax = tmax.data();
+                batch.mask = mask.data();
+                batch.cnt = cnt;
+
+                std::vector<HitRecord> coherent( cnt ) , incoherent( cnt );
+                std::unique_ptr<bool[]> occluded( new bool[cnt] );
+                batch.coherent = true;
+                accelerator->IntersectBatch( batch , coherent.data() );
+                batch.coherent = false;
+                accelerator->IntersectBatch( batch , incoherent.data() );
+                accelerator->OccludedBatch( batch , occluded.get() );
+
+                for( auto i = 0u ; i < cnt ; ++i ){
+                    SurfaceInteraction expected;
+                    const auto hit = mask[i] && accelerator->GetIntersect( ray_set.m_rays[i] , expected );
+                    EXPECT_EQ( hit , IS_PTR_VALID( coherent[i].primitive ) ) << name << " " << scene->m_name << " " << ray_set.m_name;
+                    EXPECT_EQ( hit , IS_PTR_VALID( incoherent[i].primitive ) ) << name << " " << scene->m_name << " " << ray_set.m_name;
+                    EXPECT_EQ( mask[i] && accelerator->IsOccluded( ray_set.m_rays[i] ) , occluded[i] ) << name << " " << scene->m_name << " " << ray_set.m_name;
+                    if( hit ){
+                        EXPECT_NEAR( expected.t , coherent[i].t , 0.001f ) << name << " " << scene->m_name << " " << ray_set.m_name;
+                        EXPECT_NEAR( expected.t , incoherent[i].t , 0.001f ) << name << " " << scene->m_name << " " << ray_set.m_name;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Without a material filter, the multi-hit query should find the same nearest intersections as testing all primitives does.
+TEST(ACCELERATOR, MultipleIntersections) {
+    for( const auto& scene : makeScenes( 2000 ) ){
+        const auto ray_set = makeIncoherentRays( *scene , 256 );
+        for( const auto name : g_accelerators ){
+            auto accelerator = MakeUniqueInstance<Accelerator>( ResolveAcceleratorType( StringID( name ) ) );
+            ASSERT_NE( accelerator , nullptr );
+            accelerator->Build( scene->m_primitives , scene->m_bbox );
+
+            for( const auto& ray : ray_set.m_rays ){
+                ray.Prepare();
+
+                std::vector<float> expected;
+                for( const auto primitive : scene->m_primitives ){
+                    SurfaceInteraction intersection;
+                    if( primitive->GetIntersect( ray , &intersection ) )
+                        expected.push_back( intersection.t );
+                }
+                std::sort( expected.begin() , expected.end() );
+                expected.resize( std::min( expected.size() , (size_t)TOTAL_SSS_INTERSECTION_CNT ) );
+
+                BSSRDFIntersections intersections;
+                accelerator->GetIntersect( ray , intersections , INVALID_SID );
+                ASSERT_EQ( expected.size() , intersections.cnt ) << name << " " << scene->m_name;
+
+                std::vector<float> actual;
+                for( auto i = 0u ; i < intersections.cnt ; ++i )
+                    actual.push_back( intersections.intersections[i]->intersection.t );
+                std::sort( actual.begin() , actual.end() );
+                for( auto i = 0u ; i < actual.size() ; ++i )
+                    EXPECT_NEAR( expected[i] , actual[i] , 0.001f ) << name << " " << scene->m_name;
+            }
+        }
+    }
+}
+
+// Quantized leaves only cull triangles with conservative boxes, the triangles left are tested in full precision. Hits should be exactly
+// the same as the ones of the original triangles, rays grazing the edges included. Scenes come from a fixed seed so that the result
+// doesn't depend on the tests running before this one.
+TEST(ACCELERATOR, QuantizedLeaves) {
+    sort_seed( 0 , 0 , 0 , 141 );
+    for( const auto& scene : makeScenes( 2000 ) ){
+        const auto ray_sets = makeRaySets( *scene , 1024 );
+        for( const auto name : g_quantized_accelerators ){
+            for( const auto compress_nodes : { false , true } ){
+                auto accelerator = makeQuantizedAccelerator( name , compress_nodes );
+                ASSERT_NE( accelerator , nullptr );
+                accelerator->Build( scene->m_primitives , scene->m_bbox );
+
+                for( const auto& ray_set : ray_sets ){
+                    for( const auto& ray : ray_set.m_rays ){
+                        SurfaceInteraction expected;
+                        const auto hit = bruteForce( *scene , ray , expected );
+                        if( ray_set.m_shadow ){
+                            EXPECT_EQ( hit , isOccluded( *accelerator , ray ) ) << name << " " << scene->m_name;
+                        }else{
+                            SurfaceInteraction intersection;
+                            EXPECT_EQ( hit , accelerator->GetIntersect( ray , intersection ) ) << name << " " << scene->m_name;
+                            if( hit ){
+                                EXPECT_NEAR( expected.t , intersection.t , 0.001f ) << name << " " << scene->m_name;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+#ifndef SIMD_TRI_BALDWIN_WEBER
+// Rays aiming at the shared edges and the shared vertex of a closed triangle fan should never leak through it.
+TEST(ACCELERATOR, Watertight) {
+    TestScene scene( "Fan" );
+    const Point center( 1.3f , 0.7f , 2.1f );
+    const auto axis_u = normalize( Vector( 0.3f , 1.0f , -0.2f ) );
+    const auto axis_v = normalize( cross( axis_u , Vector( 0.7f , 0.1f , 0.9f ) ) );
+    const auto normal = cross( axis_u , axis_v );
+    constexpr auto fan_cnt = 24u;
+    std::vector<Point> rim;
+    for( auto i = 0u ; i < fan_cnt ; ++i ){
+        const auto phi = TWO_PI * i / fan_cnt;
+        rim.push_back( center + ( axis_u * cos( phi ) + axis_v * sin( phi ) ) * 2.0f );
+    }
+    for( auto i = 0u ; i < fan_cnt ; ++i )
+        scene.AddTriangle( center , rim[i] , rim[( i + 1 ) % fan_cnt] );
+    scene.Finalize();
+
+    std::vector<Ray> rays;
+    for( auto i = 0u ; i < fan_cnt ; ++i ){
+        for( auto j = 0u ; j < 64u ; ++j ){
+            const auto target = center + ( rim[i] - center ) * ( j / 64.0f );
+            const auto side = ( j % 2 ) ? 3.0f : -3.0f;
+            const auto origin = target + normal * side + randomDirection() * 2.0f;
+            rays.push_back( Ray( origin , normalize( target - origin ) ) );
+        }
+    }
+
+    for( const auto name : g_watertight_accelerators ){
+        auto accelerator = MakeUniqueInstance<Accelerator>( ResolveAcceleratorType( StringID( name ) ) );
+        ASSERT_NE( accelerator , nullptr );
+        accelerator->Build( scene.m_primitives , scene.m_bbox );
+
+        auto leaks = 0u;
+        for( const auto& ray : rays ){
+            SurfaceInteraction intersection;
+            if( !accelerator->GetIntersect( ray , intersection ) )
+                ++leaks;
+        }
+        EXPECT_EQ( 0u , leaks ) << name;
+    }
+
+    // triangles of the fan are spread across leaves with at most 16 primitives, the ones passing the boxes of quantized cells are tested in full precision
+    for( const auto name : g_quantized_accelerators ){
+        auto accelerator = makeQuantizedAccelerator( name , false );
+        ASSERT_NE( accelerator , nullptr );
+        accelerator->Build( scene.m_primitives , scene.m_bbox );
+
+        auto leaks = 0u;
+        for( const auto& ray : rays ){
+            SurfaceInteraction intersection;
+            if( !accelerator->GetIntersect( ray , intersection ) )
+                ++leaks;
+        }
+        EXPECT_EQ( 0u , leaks ) << name << " (Quantized)";
+    }
+}
+#endif
+
+// SORT has only one executable, the benchmark is a disabled unit test that is triggered explicitly by
+//   --unittest --gtest_also_run_disabled_tests --gtest_filter=ACCELERATOR.DISABLED_Benchmark
+TEST(ACCELERATOR, DISABLED_Benchmark) {
+    using clock = std::chrono::high_resolution_clock;
+
+    for( const auto& scene : makeScenes( 200000 ) ){
+        const auto ray_sets = makeRaySets( *scene , 1024 * 1024 );
+        slog( INFO , PERFORMANCE , "Scene '%s' with %d triangles." , scene->m_name , (int)scene->m_primitives.size() );
+
+        for( const auto name : g_accelerators ){
+            const auto memory = residentMemory();
+            const auto build_start = clock::now();
+            auto accelerator = MakeUniqueInstance<Accelerator>( ResolveAcceleratorType( StringID( name ) ) );
+            accelerator->Build( scene->m_primitives , scene->m_bbox );
+            const auto build_ms = std::chrono::duration<double, std::milli>( clock::now() - build_start ).count();
+            const auto memory_mb = ( memory < 0 ) ? -1.0 : ( residentMemory() - memory ) / ( 1024.0 * 1024.0 );
+
+            slog( INFO , PERFORMANCE , "  %-8s build %10.2f ms, resident memory growth %8.2f MB" , name , build_ms , memory_mb );
+
+            for( const auto& ray_set : ray_sets ){
+                auto hit = 0u;
+                const auto start = clock::now();
+                for( const auto& ray : ray_set.m_rays ){
+                    if( ray_set.m_shadow ){
+                        hit += isOccluded( *accelerator , ray );
+                    }else{
+                        SurfaceInteraction intersection;
+                        hit += accelerator->GetIntersect( ray , intersection );
+                    }
+                }
+                const auto seconds = std::chrono::duration<double>( clock::now() - start ).count();
+                slog( INFO , PERFORMANCE , "    %-10s %8.3f Mrays/s , %d hits" , ray_set.m_name , ray_set.m_rays.size() / seconds * 1e-6 , hit );
+
+                if( ray_set.m_shadow )
+                    continue;
+
+                // the same rays traced in interleaved batches
+                std::vector<SurfaceInteraction> intersections( ray_set.m_rays.size() );
+                const auto interleaved_start = clock::now();
+                accelerator->GetIntersectIncoherent( ray_set.m_rays.data() , intersections.data() , (unsigned int)ray_set.m_rays.size() );
+                const auto interleaved_seconds = std::chrono::duration<double>( clock::now() - interleaved_start ).count();
+                slog( INFO , PERFORMANCE , "    %-10s %8.3f Mrays/s (Interleaved)" , ray_set.m_name , ray_set.m_rays.size() / interleaved_seconds * 1e-6 );
+            }
+        }
+    }
+}
@@ -23,6 +23,7 @@
 #include "spectrum/spectrum.h"
 #include "core/thread.h"
 #include "core/samplemethod.h"
+#include "core/timer.h"
 #include "scatteringevent/bsdf/lambert.h"
 #include "scatteringevent/bsdf/orennayar.h"
 #include "scatteringevent/bsdf/phong.h"
@@ -32,6 +33,9 @@
 #include "scatteringevent/bsdf/dielectric.h"
 #include "scatteringevent/bsdf/hair.h"
 #include "scatteringevent/bsdf/fabric.h"
+#include "scatteringevent/bsdf/transparent.h"
+#include "scatteringevent/bsdf/energycompensation.h"
+#include "scatteringevent/scatteringevent.h"
 
 // A physically based BRDF should obey the rule of reciprocity
 void checkReciprocity(const Bxdf* bxdf) {
@@ -180,6 +184,79 @@ TEST(BXDF, Dielectric) {
     checkAll( &dielectric , false , false , true );
 }
 
+// Evaluating the bsdf and its pdf in a single pass should match evaluating them separately.
+TEST(BXDF, ScatteringEventSinglePass) {
+    SurfaceInteraction inter;
+    inter.normal = normalize( Vector( 0.3f , 1.0f , 0.2f ) );
+    inter.tangent = normalize( cross( inter.normal , Vector( 0.0f , 0.0f , 1.0f ) ) );
+
+    const Lambert lambert( WHITE_SPECTRUM , Spectrum( 0.3f ) , DIR_UP );
+    const OrenNayar orenNayar( WHITE_SPECTRUM , 0.5f , Spectrum( 0.5f ) , DIR_UP );
+    const Transparent transparent;
+
+    ScatteringEvent se( inter );
+    se.AddBxdf( &lambert );
+    se.AddBxdf( &orenNayar );
+    se.AddBxdf( &transparent );
+    EXPECT_TRUE( se.HasDeltaBxdf() );
+
+    for( auto i = 0 ; i < 1024 ; ++i ){
+        const auto wo = UniformSampleSphere( sort_canonical() , sort_canonical() );
+        const auto wi = UniformSampleSphere( sort_canonical() , sort_canonical() );
+
+        auto pdf = -1.0f;
+        const auto f = se.Evaluate_BSDF( wo , wi , &pdf );
+        const auto f_ref = se.Evaluate_BSDF( wo , wi );
+        EXPECT_NEAR( f.r , f_ref.r , 1e-6f );
+        EXPECT_NEAR( f.g , f_ref.g , 1e-6f );
+        EXPECT_NEAR( f.b , f_ref.b , 1e-6f );
+        EXPECT_NEAR( pdf , se.Pdf_BSDF( wo , wi ) , 1e-6f );
+    }
+}
+
+// Lobes are picked based on their albedo, the pdf of a sampled direction should still match what Pdf_BSDF returns.
+TEST(BXDF, ScatteringEventLobePicking) {
+    SurfaceInteraction inter;
+    inter.normal = DIR_UP;
+    inter.tangent = Vector( 1.0f , 0.0f , 0.0f );
+
+    const FresnelDielectric fresnel( 1.0f , 1.5f );
+    const GGX ggx( 0.3f , 0.3f );
+    const Lambert lambert( Spectrum( 0.8f ) , Spectrum( 0.5f ) , DIR_UP );
+    const MicroFacetReflection mf( WHITE_SPECTRUM , &fresnel , &ggx , Spectrum( 0.5f ) , DIR_UP );
+
+    ScatteringEvent se( inter );
+    se.AddBxdf( &lambert );
+    se.AddBxdf( &mf );
+
+    for( auto i = 0 ; i < 1024 ; ++i ){
+        const auto wo = CosSampleHemisphere( sort_canonical() , sort_canonical() );
+
+        Vector wi;
+        auto pdf = 0.0f;
+        se.Sample_BSDF( wo , wi , BsdfSample(true) , pdf );
+        if( pdf == 0.0f )
+            continue;
+        EXPECT_NEAR( pdf , se.Pdf_BSDF( wo , wi ) , pdf * 1e-3f );
+    }
+}
+
+// Single scattering and the compensated energy of a white GGX surface should add up to one.
+TEST(BXDF, GGXEnergyCompensation) {
+    constexpr auto N = 64u;
+    for( const auto roughness : { 0.2f , 0.5f , 1.0f } ){
+        for( const auto cos_o : { 0.2f , 0.6f , 1.0f } ){
+            // the multiple scattering term doesn't depend on azimuth, integrate it over the cosine of incident directions
+            auto ms = 0.0f;
+            for( auto i = 0u ; i < N ; ++i ){
+                const auto cos_i = ( i + 0.5f ) / N;
+                ms += GGXMultiScattering( WHITE_SPECTRUM , cos_o , cos_i , roughness ).GetIntensity() * TWO_PI / N;
+            }
+            EXPECT_NEAR( GGXAlbedo( cos_o , roughness ) + ms , 1.0f , 0.02f );
+        }
+    }
+}
+
 TEST(BXDF, DISABLED_DreamWork_Fabric) {
     auto test_fabric = []( const float roughness ){
         Fabric fabric( WHITE_SPECTRUM , roughness , FULL_WEIGHT , DIR_UP );
@@ -290,3 +367,26 @@ TEST(BXDF, DISABLED_HairSamplingConsistance) {
         }
     }
 }
+
+// Timing of evaluating all lobes of the hair bxdf, it is only for measuring performance.
+TEST(BXDF, DISABLED_HairPerformance) {
+    constexpr int DIR_CNT = 1024;
+    constexpr int CNT = 1024 * 1024;
+    Hair hair( Spectrum( 0.3f , 0.5f , 0.8f ) , 0.3f , 0.3f , 1.55f , FULL_WEIGHT );
+
+    Vector directions[DIR_CNT];
+    for( auto& w : directions )
+        w = UniformSampleSphere( sort_canonical() , sort_canonical() );
+
+    auto total = 0.0f;
+    Timer timer;
+    for( auto i = 0 ; i < CNT ; ++i ){
+        auto wo = directions[ i % DIR_CNT ];
+        wo.y = fabs( wo.y );
+        const auto& wi = directions[ ( i * 7 + 1 ) % DIR_CNT ];
+        total += hair.f( wo , wi ).GetIntensity() + hair.pdf( wo , wi );
+    }
+    const auto elapsed = timer.GetElapsedTime();
+    std::cout << "Evaluating hair bxdf and pdf " << CNT << " times costs " << elapsed << " ms." << std::endl;
+    EXPECT_GE( total , 0.0f );
+}
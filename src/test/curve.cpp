@@ -0,0 +1,99 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <vector>
+#include "thirdparty/gtest/gtest.h"
+#include "shape/curve.h"
+#include "core/rand.h"
+#include "math/interaction.h"
+
+namespace {
+    //! @brief  Evaluate a cubic Bezier segment in world space.
+    Point bezier( const Point* cp , const float u ){
+        const auto iu = 1.0f - u;
+        return cp[0] * ( iu * iu * iu ) + cp[1] * ( 3.0f * iu * iu * u ) + cp[2] * ( 3.0f * iu * u * u ) + cp[3] * ( u * u * u );
+    }
+
+    static const float g_v[CURVE_MAX_SEGMENTS + 1] = { 0.0f , 0.25f , 0.5f , 0.75f , 1.0f };
+}
+
+// A straight curve should behave like a line of constant width, the ribbon facing the ray.
+TEST(CURVE, Straight) {
+    const std::vector<Point> points = { Point( 0.0f , 0.0f , 0.0f ) , Point( 0.0f , 1.0f , 0.0f ) , Point( 0.0f , 2.0f , 0.0f ) , Point( 0.0f , 3.0f , 0.0f ) };
+    Curve curve( points , 0 , 1 , g_v , 0.1f , 0.1f , 0 );
+
+    SurfaceInteraction intersection;
+    EXPECT_TRUE( curve.GetIntersect( Ray( Point( 0.0f , 1.5f , -5.0f ) , Vector( 0.0f , 0.0f , 1.0f ) ) , &intersection ) );
+    EXPECT_NEAR( 5.0f , intersection.t , 0.0001f );
+    EXPECT_NEAR( 0.125f , intersection.v , 0.01f );
+    EXPECT_NEAR( 1.0f , fabs( intersection.tangent.y ) , 0.0001f );
+    EXPECT_NEAR( -1.0f , intersection.normal.z , 0.0001f );
+
+    EXPECT_TRUE( curve.GetIntersect( Ray( Point( 0.09f , 1.5f , -5.0f ) , Vector( 0.0f , 0.0f , 1.0f ) ) ) );
+    EXPECT_FALSE( curve.GetIntersect( Ray( Point( 0.11f , 1.5f , -5.0f ) , Vector( 0.0f , 0.0f , 1.0f ) ) ) );
+    EXPECT_FALSE( curve.GetIntersect( Ray( Point( 0.0f , 3.5f , -5.0f ) , Vector( 0.0f , 0.0f , 1.0f ) ) ) );
+    EXPECT_FALSE( curve.GetIntersect( Ray( Point( 0.0f , 1.5f , -5.0f ) , Vector( 0.0f , 0.0f , 1.0f ) , 0 , 0.0f , 4.0f ) ) );
+}
+
+// Rays aiming at a bent curve should hit it, rays passing by at the side should not.
+TEST(CURVE, Bent) {
+    // Consecutive segments share their tangents at the joints, just like the segments of a strand.
+    const Vector tangent( 0.33f , 0.8f , 0.3f );
+    std::vector<Point> points = { Point( 0.0f , 0.0f , 0.0f ) };
+    for( auto i = 0u ; i < CURVE_MAX_SEGMENTS ; ++i ){
+        const Point joint0( (float)i , 0.0f , 0.0f ) , joint1( (float)( i + 1 ) , 0.0f , 0.0f );
+        points.push_back( joint0 + tangent );
+        points.push_back( joint1 - tangent );
+        points.push_back( joint1 );
+    }
+    constexpr auto radius = 0.02f;
+    Curve curve( points , 0 , CURVE_MAX_SEGMENTS , g_v , radius , radius , 0 );
+
+    for( auto i = 0u ; i < 1024u ; ++i ){
+        const auto segment = sort_rand() % CURVE_MAX_SEGMENTS;
+        const auto u = sort_canonical();
+        const auto* cp = &points[3 * segment];
+        const auto target = bezier( cp , u );
+        const Point origin( target.x , target.y , -10.0f );
+
+        SurfaceInteraction intersection;
+        ASSERT_TRUE( curve.GetIntersect( Ray( origin , Vector( 0.0f , 0.0f , 1.0f ) ) , &intersection ) ) << segment << " " << u;
+        EXPECT_NEAR( target.z + 10.0f , intersection.t , radius );
+
+        // Passing by the curve perpendicular to its tangent in the xy plane.
+        const auto side = bezier( cp , std::min( u + 0.001f , 1.0f ) ) - bezier( cp , std::max( u - 0.001f , 0.0f ) );
+        const auto offset = normalize( Vector( -side.y , side.x , 0.0f ) ) * ( radius * 4.0f );
+        EXPECT_FALSE( curve.GetIntersect( Ray( origin + offset , Vector( 0.0f , 0.0f , 1.0f ) ) ) ) << segment << " " << u;
+    }
+}
+
+// The bounding box should contain the whole curve.
+TEST(CURVE, BoundingBox) {
+    const std::vector<Point> points = { Point( 0.0f , 0.0f , 0.0f ) , Point( 1.0f , 2.0f , 0.0f ) , Point( 2.0f , -2.0f , 1.0f ) , Point( 3.0f , 0.0f , 0.0f ) };
+    Curve curve( points , 0 , 1 , g_v , 0.1f , 0.05f , 0 );
+
+    const auto& bbox = curve.GetBBox();
+    for( auto i = 0u ; i <= 64u ; ++i ){
+        const auto p = bezier( points.data() , i / 64.0f );
+        for( auto axis = 0u ; axis < 3u ; ++axis ){
+            EXPECT_LE( bbox.m_Min[axis] , p[axis] - 0.05f );
+            EXPECT_GE( bbox.m_Max[axis] , p[axis] + 0.05f );
+        }
+    }
+    EXPECT_TRUE( curve.GetIntersect( bbox ) );
+    EXPECT_FALSE( curve.GetIntersect( BBox( Point( 10.0f , 10.0f , 10.0f ) , Point( 11.0f , 11.0f , 11.0f ) ) ) );
+}
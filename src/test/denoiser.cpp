@@ -0,0 +1,87 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+*/
+
+#include <cmath>
+#include "thirdparty/gtest/gtest.h"
+#include "unittest_common.h"
+#include "imagesensor/denoiser.h"
+
+// A flat image has nothing to be removed, it should stay the same with or without features.
+TEST(DENOISER, Flat) {
+    constexpr int W = 80;
+    constexpr int H = 50;
+
+    RenderTarget src( W , H );
+    for( auto y = 0 ; y < H ; ++y )
+        for( auto x = 0 ; x < W ; ++x )
+            src.SetColor( x , y , Spectrum( 0.2f , 0.4f , 0.8f ) );
+
+    auto aov = std::make_unique<float[]>( W * H * AOV_CHANNEL_CNT );
+    for( auto i = 0 ; i < W * H ; ++i ){
+        auto p = aov.get() + i * AOV_CHANNEL_CNT;
+        p[AovChannelOffset( AOV_ALBEDO )] = p[AovChannelOffset( AOV_ALBEDO ) + 1] = p[AovChannelOffset( AOV_ALBEDO ) + 2] = 0.5f;
+        p[AovChannelOffset( AOV_NORMAL ) + 2] = 1.0f;
+    }
+
+    BilateralDenoiser denoiser;
+    for( const auto features : { (const float*)nullptr , (const float*)aov.get() } ){
+        RenderTarget dst( W , H );
+        denoiser.Denoise( src , features , dst );
+        for( auto y = 0 ; y < H ; ++y ){
+            for( auto x = 0 ; x < W ; ++x ){
+                EXPECT_NEAR( dst.GetColor( x , y ).r , 0.2f , 1e-4f );
+                EXPECT_NEAR( dst.GetColor( x , y ).b , 0.8f , 1e-4f );
+            }
+        }
+    }
+}
+
+// Noise is reduced, while an edge of the albedo is kept sharp.
+TEST(DENOISER, EdgePreserving) {
+    constexpr int W = 64;
+    constexpr int H = 64;
+
+    auto aov = std::make_unique<float[]>( W * H * AOV_CHANNEL_CNT );
+    RenderTarget src( W , H );
+    auto error = 0.0f;
+    for( auto y = 0 ; y < H ; ++y ){
+        for( auto x = 0 ; x < W ; ++x ){
+            const auto albedo = x < W / 2 ? 0.1f : 0.9f;
+            auto p = aov.get() + ( y * W + x ) * AOV_CHANNEL_CNT;
+            p[AovChannelOffset( AOV_ALBEDO )] = p[AovChannelOffset( AOV_ALBEDO ) + 1] = p[AovChannelOffset( AOV_ALBEDO ) + 2] = albedo;
+            p[AovChannelOffset( AOV_NORMAL ) + 2] = 1.0f;
+
+            const auto noise = ( ( x * 7 + y * 13 ) % 5 - 2 ) * 0.1f;
+            src.SetColor( x , y , albedo * ( 1.0f + noise ) );
+            error += std::abs( albedo * noise );
+        }
+    }
+
+    RenderTarget dst( W , H );
+    BilateralDenoiser().Denoise( src , aov.get() , dst );
+
+    auto denoised_error = 0.0f;
+    for( auto y = 0 ; y < H ; ++y ){
+        for( auto x = 0 ; x < W ; ++x ){
+            const auto albedo = x < W / 2 ? 0.1f : 0.9f;
+            denoised_error += std::abs( dst.GetColor( x , y ).r - albedo );
+        }
+    }
+    EXPECT_LT( denoised_error , error * 0.5f );
+    EXPECT_NEAR( dst.GetColor( W / 2 - 1 , H / 2 ).r , 0.1f , 0.03f );
+    EXPECT_NEAR( dst.GetColor( W / 2 , H / 2 ).r , 0.9f , 0.2f );
+}
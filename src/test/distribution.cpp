@@ -49,6 +49,28 @@ void checkAll( const MicroFacetDistribution* dist ){
     checkDist( dist );
 }
 
+// Check the pdf of visible normals and the normals it samples
+void checkVisible( const MicroFacetDistribution* dist ){
+    const auto wo = normalize( Vector( 0.5f , 0.6f , 0.3f ) );
+
+    // the pdf integrates to one over the hemisphere
+    const auto total = ParrallReduction<double, 8>( [&](){
+            const auto h = UniformSampleHemisphere(sort_canonical(), sort_canonical());
+            return dist->PdfVisible( wo , h ) / UniformHemispherePdf();
+        } );
+    EXPECT_NEAR(total, 1.0f, 0.01f);
+
+    // the average cosine of the sampled normals matches the one weighted by the pdf
+    const auto sampled = ParrallReduction<double, 8>( [&](){
+            return cosTheta( dist->sample_visible( wo , BsdfSample(true) ) );
+        } );
+    const auto weighted = ParrallReduction<double, 8>( [&](){
+            const auto h = UniformSampleHemisphere(sort_canonical(), sort_canonical());
+            return cosTheta( h ) * dist->PdfVisible( wo , h ) / UniformHemispherePdf();
+        } );
+    EXPECT_NEAR(sampled, weighted, 0.01f);
+}
+
 // Somehow, this unit test always fails. Need to investigate.
 TEST(DISTRIBUTION, DISABLED_GGX) {
     const GGX ggx(0.5f,0.5f);
@@ -61,6 +83,16 @@ TEST(DISTRIBUTION, DISABLED_Beckmann) {
     checkAll(&beckmann);
 }
 
+TEST(DISTRIBUTION, GGX_VisibleNormals) {
+    const GGX ggx(0.5f,0.3f);
+    checkVisible(&ggx);
+}
+
+TEST(DISTRIBUTION, Beckmann_VisibleNormals) {
+    const Beckmann beckmann(0.5f,0.3f);
+    checkVisible(&beckmann);
+}
+
 // Somehow, this unit test always fails. Need to investigate.
 TEST(DISTRIBUTION, DISABLED_Blinn) {
     const Blinn blinn(0.5f,0.5f);
@@ -0,0 +1,61 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <string>
+#include <memory>
+#include "thirdparty/gtest/gtest.h"
+#include "core/flatmap.h"
+
+TEST(FlatSidMap, Insert_Find) {
+    FlatSidMap<int> map;
+    EXPECT_EQ( map.Find( SID("hello") ) , nullptr );
+    EXPECT_FALSE( map.Contains( SID("hello") ) );
+
+    map[SID("hello")] = 1;
+    map[SID("world")] = 2;
+    EXPECT_EQ( map.Size() , 2u );
+    EXPECT_EQ( *map.Find( SID("hello") ) , 1 );
+    EXPECT_EQ( *map.Find( StringID( std::string("world") ) ) , 2 );
+
+    // inserting an existing key doesn't add a new one
+    map[SID("hello")] = 3;
+    EXPECT_EQ( map.Size() , 2u );
+    EXPECT_EQ( *map.Find( SID("hello") ) , 3 );
+
+    // empty strings end up with the invalid id, it is still a valid key
+    map[SID("")] = 4;
+    EXPECT_EQ( *map.Find( StringID() ) , 4 );
+}
+
+TEST(FlatSidMap, Grow) {
+    // move-only values survive growing the table
+    FlatSidMap<std::unique_ptr<int>> map;
+    constexpr int N = 10000;
+    for( auto i = 0 ; i < N ; ++i )
+        map[StringID( "key_" + std::to_string(i) )] = std::make_unique<int>(i);
+    EXPECT_EQ( map.Size() , (unsigned)N );
+
+    for( auto i = 0 ; i < N ; ++i ){
+        const auto value = map.Find( StringID( "key_" + std::to_string(i) ) );
+        ASSERT_NE( value , nullptr );
+        EXPECT_EQ( **value , i );
+    }
+
+    auto cnt = 0u;
+    map.ForEach( [&]( const StringID , const std::unique_ptr<int>& v ){ cnt += ( v != nullptr ); } );
+    EXPECT_EQ( cnt , (unsigned)N );
+}
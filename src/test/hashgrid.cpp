@@ -0,0 +1,100 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include "thirdparty/gtest/gtest.h"
+#include "core/rand.h"
+#include "integrator/hashgrid.h"
+
+namespace {
+    // Points scattered in a box, with some of them outside of it.
+    std::vector<Point> makePoints( unsigned cnt ){
+        std::vector<Point> points( cnt );
+        for( auto& p : points )
+            p = Point( sort_canonical() * 12.0f - 1.0f , sort_canonical() * 3.0f , sort_canonical() * 10.0f );
+        return points;
+    }
+
+    // Indices of points within the radius found by the grid.
+    std::vector<unsigned> query( const HashGrid& grid , const std::vector<Point>& points , const Point& p ){
+        std::vector<unsigned> ret;
+        const auto sqr_radius = grid.GetRadius() * grid.GetRadius();
+        grid.Query( p , [&]( unsigned i ){
+            if( ( points[i] - p ).SquaredLength() <= sqr_radius )
+                ret.push_back( i );
+        });
+        std::sort( ret.begin() , ret.end() );
+        return ret;
+    }
+
+    // Indices of points within the radius found by brute force.
+    std::vector<unsigned> bruteForce( const std::vector<Point>& points , const Point& p , float radius ){
+        std::vector<unsigned> ret;
+        for( auto i = 0u ; i < points.size() ; ++i ){
+            if( ( points[i] - p ).SquaredLength() <= radius * radius )
+                ret.push_back( i );
+        }
+        return ret;
+    }
+
+    HashGrid makeGrid( const std::vector<Point>& points , float radius ){
+        HashGrid grid;
+        grid.Reset( BBox( Point( 0.0f ) , Point( 10.0f , 3.0f , 10.0f ) ) , radius , (unsigned)points.size() );
+        for( const auto& p : points )
+            grid.Count( p );
+        grid.FinishCounting();
+        for( auto i = 0u ; i < points.size() ; ++i )
+            grid.Insert( points[i] , i );
+        return grid;
+    }
+}
+
+// Every point within the radius should be visited exactly once.
+TEST(HashGrid, QueryMatchesBruteForce) {
+    const auto radius = 0.3f;
+    const auto points = makePoints( 20000 );
+    const auto grid = makeGrid( points , radius );
+
+    for( auto i = 0 ; i < 256 ; ++i ){
+        const auto p = Point( sort_canonical() * 12.0f - 1.0f , sort_canonical() * 3.0f , sort_canonical() * 10.0f );
+        EXPECT_EQ( bruteForce( points , p , radius ) , query( grid , points , p ) );
+    }
+}
+
+// Querying at the points themselves, which always finds at least the point.
+TEST(HashGrid, QueryAtPoints) {
+    const auto radius = 0.05f;
+    const auto points = makePoints( 4096 );
+    const auto grid = makeGrid( points , radius );
+
+    for( auto i = 0u ; i < points.size() ; i += 7 ){
+        const auto found = query( grid , points , points[i] );
+        EXPECT_TRUE( std::binary_search( found.begin() , found.end() , i ) );
+        EXPECT_EQ( bruteForce( points , points[i] , radius ) , found );
+    }
+}
+
+// An empty grid never visits anything.
+TEST(HashGrid, Empty) {
+    HashGrid grid;
+    grid.Reset( BBox( Point( 0.0f ) , Point( 1.0f ) ) , 0.1f , 0 );
+    grid.FinishCounting();
+
+    auto visited = 0;
+    grid.Query( Point( 0.5f ) , [&]( unsigned ){ ++visited; } );
+    EXPECT_EQ( 0 , visited );
+}
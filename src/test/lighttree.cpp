@@ -0,0 +1,152 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <memory>
+#include <vector>
+#include "thirdparty/gtest/gtest.h"
+#include "core/rand.h"
+#include "core/samplemethod.h"
+#include "light/light.h"
+#include "light/lighttree.h"
+
+namespace {
+    // A light with nothing but bounds, the light tree never emits anything.
+    class BoundedLight : public Light{
+    public:
+        BoundedLight( const LightBounds& bounds ) : m_bounds( bounds ) {}
+
+        Spectrum Power() const override {
+            return m_bounds.power;
+        }
+        float Pdf( const Point& p , const Vector& wi ) const override {
+            return 0.0f;
+        }
+        Spectrum sample_l( const Point& ip , const LightSample* ls , Vector& dirToLight , float* distance , float* pdfw , float* emissionPdf , float* cosAtLight , Visibility& visibility ) const override {
+            return 0.0f;
+        }
+        Spectrum sample_l( const LightSample& ls , Ray& r , float* pdfW , float* pdfA , float* cosAtLight ) const override {
+            return 0.0f;
+        }
+        bool GetBounds( LightBounds& bounds ) const override {
+            bounds = m_bounds;
+            return true;
+        }
+
+    private:
+        LightBounds m_bounds;
+    };
+
+    // Lights scattered in a city block, some of them are omni lights, the rest of them are facing random directions.
+    std::vector<std::unique_ptr<BoundedLight>> makeLights( unsigned cnt ){
+        std::vector<std::unique_ptr<BoundedLight>> lights;
+        for( auto i = 0u ; i < cnt ; ++i ){
+            const auto p = Point( sort_canonical() * 100.0f , sort_canonical() * 10.0f , sort_canonical() * 100.0f );
+            LightBounds bounds;
+            bounds.bbox = BBox( p , p + Vector( sort_canonical() , sort_canonical() , sort_canonical() ) );
+            bounds.power = 1.0f + sort_canonical() * 10.0f;
+            if( i % 2 ){
+                bounds.axis = UniformSampleSphere( sort_canonical() , sort_canonical() );
+                bounds.cos_theta_o = 1.0f;
+            }
+            lights.push_back( std::make_unique<BoundedLight>( bounds ) );
+        }
+        return lights;
+    }
+}
+
+// The pdf returned by sampling needs to match the one evaluated for the light
+TEST(LIGHTTREE, SamplePdf) {
+    const auto lights = makeLights( 1000 );
+    std::vector<const Light*> light_list;
+    for( const auto& light : lights )
+        light_list.push_back( light.get() );
+
+    LightTree tree;
+    tree.Build( light_list );
+    EXPECT_FALSE( tree.IsEmpty() );
+
+    for( auto i = 0 ; i < 1024 ; ++i ){
+        const auto p = Point( sort_canonical() * 120.0f - 10.0f , sort_canonical() * 20.0f - 5.0f , sort_canonical() * 120.0f - 10.0f );
+        const auto n = UniformSampleSphere( sort_canonical() , sort_canonical() );
+
+        auto pdf = 0.0f;
+        const auto light = tree.Sample( p , n , sort_canonical() , &pdf );
+        if( !light )
+            continue;
+        EXPECT_GT( pdf , 0.0f );
+        EXPECT_NEAR( pdf , tree.Pdf( p , n , light ) , pdf * 0.001f );
+    }
+}
+
+// The pdf of picking any light sums up to one, it is less than one if some lights don't lit the shading point at all
+TEST(LIGHTTREE, PdfSum) {
+    const auto lights = makeLights( 300 );
+    std::vector<const Light*> light_list , omni_list;
+    for( const auto& light : lights ){
+        LightBounds bounds;
+        light->GetBounds( bounds );
+        light_list.push_back( light.get() );
+        if( bounds.cos_theta_o < 0.0f )
+            omni_list.push_back( light.get() );
+    }
+
+    LightTree tree , omni_tree;
+    tree.Build( light_list );
+    omni_tree.Build( omni_list );
+
+    for( auto i = 0 ; i < 64 ; ++i ){
+        const auto p = Point( sort_canonical() * 100.0f , sort_canonical() * 10.0f , sort_canonical() * 100.0f );
+        const auto n = UniformSampleSphere( sort_canonical() , sort_canonical() );
+
+        auto total = 0.0f;
+        for( const auto light : light_list )
+            total += tree.Pdf( p , n , light );
+        EXPECT_LE( total , 1.001f );
+
+        // omni lights always lit shading points in media, which have no normal
+        auto omni_total = 0.0f;
+        for( const auto light : omni_list )
+            omni_total += omni_tree.Pdf( p , Vector() , light );
+        EXPECT_NEAR( omni_total , 1.0f , 0.001f );
+    }
+}
+
+// Close lights are more likely to be picked than far away lights of the same power
+TEST(LIGHTTREE, Importance) {
+    std::vector<std::unique_ptr<BoundedLight>> lights;
+    std::vector<const Light*> light_list;
+    for( auto i = 0 ; i < 16 ; ++i ){
+        const auto p = Point( (float)i * 10.0f , 0.0f , 0.0f );
+        LightBounds bounds;
+        bounds.bbox = BBox( p , p );
+        bounds.power = 1.0f;
+        lights.push_back( std::make_unique<BoundedLight>( bounds ) );
+        light_list.push_back( lights.back().get() );
+    }
+
+    LightTree tree;
+    tree.Build( light_list );
+
+    const auto p = Point( -1.0f , 1.0f , 0.0f );
+    for( auto i = 1u ; i < light_list.size() ; ++i )
+        EXPECT_GT( tree.Pdf( p , Vector() , light_list[0] ) , tree.Pdf( p , Vector() , light_list[i] ) );
+
+    // a light not in the tree is never picked
+    LightBounds bounds;
+    const BoundedLight other( bounds );
+    EXPECT_EQ( tree.Pdf( p , Vector() , &other ) , 0.0f );
+}
@@ -0,0 +1,134 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include <vector>
+#include "thirdparty/gtest/gtest.h"
+#include "stream/mstream.h"
+#include "medium/mediumdata.h"
+#include "core/rand.h"
+
+namespace {
+    // A density texture with random blobs, odd resolutions make bricks partially outside of the texture.
+    void makeDensity( MediumDensity& density , unsigned w , unsigned h , unsigned d ){
+        const auto bs = SparseTexture3D::BRICK_SIZE;
+        const unsigned res[3] = { ( w + bs - 1 ) / bs , ( h + bs - 1 ) / bs , ( d + bs - 1 ) / bs };
+
+        // a third of bricks are empty
+        IMemoryStream istream(0u);
+        std::vector<float> brick( SparseTexture3D::BRICK_TEXEL_CNT );
+        std::vector<unsigned> coords;
+        for( auto bz = 0u ; bz < res[2] ; ++bz )
+            for( auto by = 0u ; by < res[1] ; ++by )
+                for( auto bx = 0u ; bx < res[0] ; ++bx )
+                    if( ( bx + by + bz ) % 3 )
+                        coords.insert( coords.end() , { bx , by , bz } );
+
+        istream << w << h << d << (unsigned)VOLUME_QUANTIZATION_FLOAT << (unsigned)( coords.size() / 3 );
+        for( auto i = 0u ; i < coords.size() ; i += 3 ){
+            for( auto& t : brick )
+                t = sort_canonical() < 0.8f ? 0.0f : sort_canonical() * 4.0f;
+            brick[0] = 0.0f;
+            brick[1] = 1.0f;
+            istream << coords[i] << coords[i + 1] << coords[i + 2] << 0.0f << *std::max_element( brick.begin() , brick.end() );
+            istream.Write( (char*)brick.data() , (int)( sizeof(float) * brick.size() ) );
+        }
+
+        OMemoryStream ostream( istream );
+        density.Serialize( ostream );
+    }
+
+    Point randomPoint(){
+        return Point( sort_canonical() * 1.4f - 0.2f , sort_canonical() * 1.4f - 0.2f , sort_canonical() * 1.4f - 0.2f );
+    }
+}
+
+// Every trilinear sample along a ray should be bounded by the majorant of the segment it falls in.
+TEST(MAJORANT_GRID, Bound) {
+    MediumDensity density;
+    makeDensity( density , 37 , 20 , 29 );
+    const auto& grid = density.GetMajorantGrid();
+    ASSERT_TRUE( grid.IsValid() );
+
+    for( auto i = 0 ; i < 1024 ; ++i ){
+        const auto ori = randomPoint();
+        const auto dir = randomPoint() - ori;
+        grid.Traverse( ori , dir , 1.0f , [&]( float t0 , float t1 , float majorant ){
+            for( auto k = 0 ; k < 16 ; ++k ){
+                const auto t = t0 + ( t1 - t0 ) * sort_canonical();
+                EXPECT_LE( density.Sample( ori + dir * t ) , majorant + 1e-5f );
+            }
+            return true;
+        });
+    }
+}
+
+// Segments should be continuous and cover exactly the part of the ray inside the unit cube.
+TEST(MAJORANT_GRID, Traverse) {
+    MediumDensity density;
+    makeDensity( density , 16 , 33 , 9 );
+    const auto& grid = density.GetMajorantGrid();
+
+    for( auto i = 0 ; i < 1024 ; ++i ){
+        // axis aligned rays are also covered
+        const auto ori = randomPoint();
+        auto dir = randomPoint() - ori;
+        if( i % 4 == 0 )
+            dir[i % 3] = 0.0f;
+
+        auto first = -1.0f , last = -1.0f;
+        auto segments = 0;
+        grid.Traverse( ori , dir , 1.0f , [&]( float t0 , float t1 , float ){
+            if( first < 0.0f )
+                first = t0;
+            else
+                EXPECT_NEAR( last , t0 , 1e-5f );
+            EXPECT_LT( t0 , t1 );
+            last = t1;
+            ++segments;
+            return true;
+        });
+
+        // the segments should cover the whole part of the ray inside the unit cube
+        const auto inside = [&]( float t ){
+            const auto p = ori + dir * t;
+            return p.x > 0.0f && p.x < 1.0f && p.y > 0.0f && p.y < 1.0f && p.z > 0.0f && p.z < 1.0f;
+        };
+        for( auto k = 0 ; k < 64 ; ++k ){
+            const auto t = ( k + 0.5f ) / 64.0f;
+            if( inside( t ) ){
+                EXPECT_GT( segments , 0 );
+                EXPECT_LE( first , t + 1e-5f );
+                EXPECT_GE( last , t - 1e-5f );
+            }
+        }
+    }
+}
+
+// Stopping the traversal should stop visiting segments.
+TEST(MAJORANT_GRID, Stop) {
+    MediumDensity density;
+    makeDensity( density , 64 , 64 , 64 );
+    const auto& grid = density.GetMajorantGrid();
+
+    auto segments = 0;
+    grid.Traverse( Point( 0.0f , 0.5f , 0.5f ) , Vector( 1.0f , 0.0f , 0.0f ) , 1.0f , [&]( float , float , float ){
+        ++segments;
+        return false;
+    });
+    EXPECT_EQ( 1 , segments );
+}
@@ -16,9 +16,19 @@
 */
 
 #include <math.h>
+#include <vector>
 #include "core/define.h"
 #include "thirdparty/gtest/gtest.h"
 #include "math/exp.h"
+#include "math/fastmath.h"
+#include "imagesensor/pixelstats.h"
+#include "core/rand.h"
+#include "math/ray.h"
+#include "math/interaction.h"
+#include "math/transform.h"
+#include "math/bbox.h"
+#include "math/quantization.h"
+#include "unittest_common.h"
 
 SORT_FORCEINLINE void exp_accuracy_test( const double x ){
     const double e0 = exp( x );
@@ -46,4 +56,306 @@ TEST(MATH, EXP_NEGATIVE) {
     exp_accuracy_test( -4.0 );
     exp_accuracy_test( -128.0 );
     exp_accuracy_test( -256.0 );
-}
\ No newline at end of file
+}
+
+// Error of a single precision result in units of the last place of the exact result.
+static double ulp_error( const float v , const double exact ){
+    const auto r = std::fabs( (float)exact );
+    return std::fabs( v - exact ) / ( std::nextafter( r , INFINITY ) - r );
+}
+
+TEST(MATH, FAST_EXP) {
+    for( auto x = -87.0f ; x < 88.0f ; x += 0.0013f )
+        EXPECT_LE( ulp_error( FastExp( x ) , exp( (double)x ) ) , 1.0 );
+    EXPECT_EQ( FastExp( 0.0f ) , 1.0f );
+    EXPECT_EQ( FastExp( -100.0f ) , 0.0f );
+    EXPECT_TRUE( std::isinf( FastExp( 100.0f ) ) );
+}
+
+TEST(MATH, FAST_LOG) {
+    for( auto x = 1e-30f ; x < 1e30f ; x *= 1.0007f ){
+        const auto exact = log( (double)x );
+        if( std::fabs( exact ) > 1e-3 ){
+            EXPECT_LE( ulp_error( FastLog( x ) , exact ) , 1.0 );
+        }else{
+            EXPECT_NEAR( FastLog( x ) , exact , 1e-10 );
+        }
+    }
+    EXPECT_EQ( FastLog( 1.0f ) , 0.0f );
+    EXPECT_TRUE( std::isinf( FastLog( 0.0f ) ) && FastLog( 0.0f ) < 0.0f );
+    EXPECT_TRUE( std::isnan( FastLog( -1.0f ) ) );
+}
+
+TEST(MATH, FAST_POW) {
+    for( auto x = 0.01f ; x < 10.0f ; x += 0.0137f ){
+        for( auto y = -5.0f ; y < 5.0f ; y += 0.0531f ){
+            const auto bound = 3.0 * ( 1.0 + std::fabs( y * log( (double)x ) ) );
+            EXPECT_LE( ulp_error( FastPow( x , y ) , pow( (double)x , (double)y ) ) , bound );
+        }
+    }
+    EXPECT_EQ( FastPow( 0.0f , 2.0f ) , 0.0f );
+    EXPECT_EQ( FastPow( 0.0f , 0.0f ) , 1.0f );
+    EXPECT_EQ( FastPow( 3.0f , 0.0f ) , 1.0f );
+}
+
+TEST(MATH, FAST_SINCOS) {
+    for( auto x = -8192.0f ; x < 8192.0f ; x += 0.0071f ){
+        float s , c;
+        FastSinCos( x , s , c );
+        const auto es = sin( (double)x ) , ec = cos( (double)x );
+        if( std::fabs( es ) > 1e-3 ){
+            EXPECT_LE( ulp_error( s , es ) , 2.0 );
+        }
+        if( std::fabs( ec ) > 1e-3 ){
+            EXPECT_LE( ulp_error( c , ec ) , 2.0 );
+        }
+        EXPECT_NEAR( s , es , 1e-7 );
+        EXPECT_NEAR( c , ec , 1e-7 );
+    }
+}
+
+TEST(MATH, FAST_ATAN2) {
+    for( auto y = -3.0f ; y < 3.0f ; y += 0.013f ){
+        for( auto x = -3.0f ; x < 3.0f ; x += 0.0117f ){
+            const auto exact = atan2( (double)y , (double)x );
+            if( std::fabs( exact ) > 1e-3 ){
+                EXPECT_LE( ulp_error( FastAtan2( y , x ) , exact ) , 3.0 );
+            }
+        }
+    }
+    EXPECT_EQ( FastAtan2( 1.0f , 0.0f ) , FAST_HALF_PI );
+    EXPECT_EQ( FastAtan2( -1.0f , 0.0f ) , -FAST_HALF_PI );
+    EXPECT_EQ( FastAtan2( 0.0f , -1.0f ) , FAST_PI );
+}
+
+TEST(MATH, FAST_ERF) {
+    for( auto x = -6.0f ; x < 6.0f ; x += 0.0001f ){
+        const auto exact = erf( (double)x );
+        if( std::fabs( x ) < FAST_ERF_SPLIT ){
+            EXPECT_LE( ulp_error( FastErf( x ) , exact ) , 3.0 );
+        }
+        else
+            EXPECT_NEAR( FastErf( x ) , exact , 4e-7 );
+    }
+}
+
+TEST(MATH, WELFORD_VARIANCE) {
+    constexpr int N = 4096;
+    std::vector<float> samples(N);
+    PixelStats stats;
+    for( auto& x : samples ){
+        x = 10.0f + sort_canonical();
+        stats.Add( x );
+    }
+
+    double mean = 0.0 , var = 0.0;
+    for( const auto x : samples )
+        mean += x / (double)N;
+    for( const auto x : samples )
+        var += ( x - mean ) * ( x - mean ) / (double)( N - 1 );
+
+    EXPECT_EQ( stats.GetCnt() , (unsigned)N );
+    EXPECT_NEAR( stats.GetMean() , mean , 0.0001 * mean );
+    EXPECT_NEAR( stats.GetVariance() , var , 0.001 * var );
+    EXPECT_TRUE( stats.IsConverged( 16 , 0.01f ) );
+    EXPECT_FALSE( stats.IsConverged( N + 1 , 0.01f ) );
+}
+
+// Random numbers keyed by a pixel sample are reproducible, batch generation matches one by one generation.
+TEST(MATH, RANDOM_COUNTER_BASED) {
+    constexpr unsigned cnt = 67;
+    float scalar[cnt] , batch[cnt] , other[cnt];
+
+    sort_seed( 12 , 34 , 5 , 1 );
+    for( auto i = 0u ; i < cnt ; ++i )
+        scalar[i] = sort_canonical();
+
+    sort_seed( 12 , 34 , 5 , 1 );
+    sort_canonical( batch , 3 );
+    sort_canonical( batch + 3 , cnt - 3 );
+
+    sort_seed( 12 , 34 , 5 , 0 );
+    sort_canonical( other , cnt );
+
+    auto same = 0u;
+    for( auto i = 0u ; i < cnt ; ++i ){
+        EXPECT_EQ( scalar[i] , batch[i] );
+        EXPECT_GE( batch[i] , 0.0f );
+        EXPECT_LT( batch[i] , 1.0f );
+        same += scalar[i] == other[i];
+    }
+    EXPECT_LT( same , 2u );
+
+    // the sequence continues after batch generation
+    sort_seed( 12 , 34 , 5 , 1 );
+    sort_canonical( batch , cnt );
+    const auto next = sort_canonical();
+    sort_seed( 12 , 34 , 5 , 1 );
+    for( auto i = 0u ; i < cnt ; ++i )
+        sort_canonical();
+    EXPECT_EQ( next , sort_canonical() );
+}
+
+// A surface interaction on the plane of y = 0, with uv coordinate ( x , z ) / 2.
+static SurfaceInteraction plane_interaction( const Ray& r ){
+    SurfaceInteraction inter;
+    inter.t = -r.m_Ori.y / r.m_Dir.y;
+    inter.intersect = r( inter.t );
+    inter.normal = inter.gnormal = Vector( 0.0f , 1.0f , 0.0f );
+    inter.u = inter.intersect.x * 0.5f;
+    inter.v = inter.intersect.z * 0.5f;
+    inter.dpdu = Vector( 2.0f , 0.0f , 0.0f );
+    inter.dpdv = Vector( 0.0f , 0.0f , 2.0f );
+    inter.ComputeDifferentials( r );
+    return inter;
+}
+
+TEST(MATH, RAY_DIFFERENTIALS) {
+    Ray r( Point( 0.0f , 4.0f , 0.0f ) , normalize( Vector( 0.3f , -1.0f , 0.2f ) ) );
+    r.m_hasDifferentials = true;
+    r.m_rxOri = r.m_ryOri = r.m_Ori;
+    r.m_rxDir = normalize( r.m_Dir + Vector( 0.01f , 0.0f , 0.0f ) );
+    r.m_ryDir = normalize( r.m_Dir + Vector( 0.0f , 0.0f , 0.01f ) );
+
+    const auto inter = plane_interaction( r );
+
+    // the differentials match the intersections of the auxiliary rays with the plane
+    const auto px = r.m_rxOri + r.m_rxDir * ( -r.m_rxOri.y / r.m_rxDir.y );
+    const auto py = r.m_ryOri + r.m_ryDir * ( -r.m_ryOri.y / r.m_ryDir.y );
+    EXPECT_NEAR( inter.dudx , ( px.x - inter.intersect.x ) * 0.5f , 1e-5f );
+    EXPECT_NEAR( inter.dvdx , ( px.z - inter.intersect.z ) * 0.5f , 1e-5f );
+    EXPECT_NEAR( inter.dudy , ( py.x - inter.intersect.x ) * 0.5f , 1e-5f );
+    EXPECT_NEAR( inter.dvdy , ( py.z - inter.intersect.z ) * 0.5f , 1e-5f );
+
+    // a flat mirror reflects the auxiliary rays exactly
+    Ray reflected( inter.intersect , Vector( r.m_Dir.x , -r.m_Dir.y , r.m_Dir.z ) );
+    inter.SpawnDifferentials( r , reflected , 1.0f , true );
+    EXPECT_TRUE( reflected.m_hasDifferentials );
+    EXPECT_NEAR( reflected.m_rxDir.x , r.m_rxDir.x , 1e-5f );
+    EXPECT_NEAR( reflected.m_rxDir.y , -r.m_rxDir.y , 1e-5f );
+    EXPECT_NEAR( reflected.m_rxDir.z , r.m_rxDir.z , 1e-5f );
+    EXPECT_NEAR( reflected.m_rxOri.x , px.x , 1e-5f );
+    EXPECT_NEAR( reflected.m_rxOri.z , px.z , 1e-5f );
+
+    // refraction into a medium with an index of refraction of 1.5, the auxiliary rays follow Snell's law to first order
+    const auto refract = []( const Vector& d ){
+        const auto eta = 1.0f / 1.5f;
+        const auto cosI = -d.y;
+        const auto cosT = sqrt( 1.0f - eta * eta * ( 1.0f - cosI * cosI ) );
+        return normalize( eta * d + ( eta * cosI - cosT ) * Vector( 0.0f , 1.0f , 0.0f ) );
+    };
+    Ray refracted( inter.intersect , refract( r.m_Dir ) );
+    inter.SpawnDifferentials( r , refracted , 1.0f , true );
+    const auto rx = refract( r.m_rxDir );
+    EXPECT_NEAR( refracted.m_rxDir.x , rx.x , 1e-4f );
+    EXPECT_NEAR( refracted.m_rxDir.y , rx.y , 1e-4f );
+    EXPECT_NEAR( refracted.m_rxDir.z , rx.z , 1e-4f );
+
+    // a diffuse bounce spreads the auxiliary rays far wider than the camera does
+    Ray diffuse( inter.intersect , Vector( 0.0f , 1.0f , 0.0f ) );
+    inter.SpawnDifferentials( r , diffuse , INV_PI , false );
+    EXPECT_GT( ( diffuse.m_rxDir - diffuse.m_Dir ).Length() , 0.5f );
+    EXPECT_GT( ( diffuse.m_ryDir - diffuse.m_Dir ).Length() , 0.5f );
+}
+
+TEST(MATH, TRANSFORM_BATCH) {
+    const auto transform = Translate( 1.0f , 2.0f , 3.0f ) * RotateY( 0.3f ) * Scale( 2.0f , 0.5f , 1.5f );
+
+    // the count is not a multiple of any SIMD width so that the remainder is covered too
+    std::vector<Point> points( 37 );
+    std::vector<Vector> normals( 37 );
+    for( auto i = 0u ; i < points.size() ; ++i ){
+        points[i] = Point( sort_canonical() , sort_canonical() , sort_canonical() );
+        normals[i] = Vector( sort_canonical() , sort_canonical() , sort_canonical() );
+    }
+
+    auto batch_points = points;
+    auto batch_normals = normals;
+    transform.TransformPoints( batch_points.data() , (unsigned int)batch_points.size() );
+    transform.TransformNormals( batch_normals.data() , (unsigned int)batch_normals.size() );
+    for( auto i = 0u ; i < points.size() ; ++i ){
+        const auto p = transform.TransformPoint( points[i] );
+        const auto n = transform.invMatrix.Transpose().TransformVector( normals[i] );
+        for( auto j = 0 ; j < 3 ; ++j ){
+            EXPECT_NEAR( batch_points[i][j] , p[j] , 1e-5f );
+            EXPECT_NEAR( batch_normals[i][j] , n[j] , 1e-5f );
+        }
+    }
+
+    // the transformed bounding box is the same as the one of the eight transformed corners
+    const BBox bbox( Point( -1.0f , 0.5f , -2.0f ) , Point( 3.0f , 1.0f , 0.0f ) );
+    BBox expected;
+    for( auto i = 0 ; i < 8 ; ++i ){
+        expected.Union( transform.TransformPoint( Point( ( i & 1 ) ? bbox.m_Max.x : bbox.m_Min.x ,
+                                                         ( i & 2 ) ? bbox.m_Max.y : bbox.m_Min.y ,
+                                                         ( i & 4 ) ? bbox.m_Max.z : bbox.m_Min.z ) ) );
+    }
+    const auto transformed = transform.TransformBBox( bbox );
+    for( auto j = 0 ; j < 3 ; ++j ){
+        EXPECT_NEAR( transformed.m_Min[j] , expected.m_Min[j] , 1e-4f );
+        EXPECT_NEAR( transformed.m_Max[j] , expected.m_Max[j] , 1e-4f );
+    }
+}
+
+TEST(MATH, QUANTIZATION) {
+    // directions all over the sphere survive the octahedral encoding, including the ones on the axes and the seams
+    std::vector<Vector> directions = { Vector( 1.0f , 0.0f , 0.0f ) , Vector( -1.0f , 0.0f , 0.0f ) , Vector( 0.0f , 1.0f , 0.0f ) ,
+                                       Vector( 0.0f , -1.0f , 0.0f ) , Vector( 0.0f , 0.0f , 1.0f ) , Vector( 0.0f , 0.0f , -1.0f ) };
+    for( auto i = 0 ; i < 10000 ; ++i )
+        directions.push_back( normalize( Vector( sort_canonical() - 0.5f , sort_canonical() - 0.5f , sort_canonical() - 0.5f ) ) );
+    for( const auto& v : directions ){
+        const auto d = decodeOctahedral( encodeOctahedral( v ) );
+        EXPECT_LT( ( d - v ).Length() , 1e-4f );
+    }
+
+    // half precision keeps about three decimal digits
+    for( auto i = 0 ; i < 10000 ; ++i ){
+        const auto f = ( sort_canonical() - 0.5f ) * 100.0f;
+        EXPECT_NEAR( halfToFloat( floatToHalf( f ) ) , f , fabs( f ) * 1e-3f + 1e-6f );
+    }
+    EXPECT_EQ( halfToFloat( floatToHalf( 0.0f ) ) , 0.0f );
+    EXPECT_EQ( halfToFloat( floatToHalf( 1.0f ) ) , 1.0f );
+    EXPECT_EQ( halfToFloat( floatToHalf( 65504.0f ) ) , 65504.0f );
+    EXPECT_TRUE( std::isinf( halfToFloat( floatToHalf( 1e6f ) ) ) );
+}
+
+TEST(MATH, DISABLED_Benchmark) {
+    const auto transform = Translate( 1.0f , 2.0f , 3.0f ) * RotateY( 0.3f ) * Scale( 2.0f );
+
+    std::vector<Point> points( 1024 );
+    for( auto& p : points )
+        p = Point( sort_canonical() , sort_canonical() , sort_canonical() );
+    const Ray ray( Point( 0.0f ) , normalize( Vector( 1.0f , 2.0f , 3.0f ) ) );
+
+    slog( INFO , PERFORMANCE , "Transcendental functions." );
+    MeasureThroughput( "std::exp" , [&]( unsigned long long i ){
+        return std::exp( points[i & 1023].x );
+    });
+    MeasureThroughput( "FastExp" , [&]( unsigned long long i ){
+        return FastExp( points[i & 1023].x );
+    });
+    MeasureThroughput( "std::log" , [&]( unsigned long long i ){
+        return std::log( points[i & 1023].x );
+    });
+    MeasureThroughput( "FastLog" , [&]( unsigned long long i ){
+        return FastLog( points[i & 1023].x );
+    });
+
+    slog( INFO , PERFORMANCE , "Transform." );
+    MeasureThroughput( "Transform::TransformPoint" , [&]( unsigned long long i ){
+        return transform.TransformPoint( points[i & 1023] ).x;
+    });
+    MeasureThroughput( "Transform::TransformVector" , [&]( unsigned long long i ){
+        return transform.TransformVector( Vector( points[i & 1023].x , points[i & 1023].y , points[i & 1023].z ) ).x;
+    });
+    MeasureThroughput( "Transform::TransformNormal" , [&]( unsigned long long i ){
+        return transform.TransformNormal( Vector( points[i & 1023].x , points[i & 1023].y , points[i & 1023].z ) ).x;
+    });
+    MeasureThroughput( "Transform on Ray" , [&]( unsigned long long i ){
+        return transform( ray ).m_Ori.x;
+    });
+    MeasureThroughput( "Transform::TransformPoints, 1024 points" , [&]( unsigned long long i ){
+        transform.TransformPoints( points.data() , (unsigned int)points.size() );
+        return points[i & 1023].x;
+    });
+}
@@ -15,9 +15,11 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
 */
 
+#include <climits>
 #include "core/define.h"
 #include "thirdparty/gtest/gtest.h"
 #include "core/memory.h"
+#include "unittest_common.h"
 
 TEST(Memory, AlignedAllocation) {
     int i = 0;
@@ -47,4 +49,141 @@ TEST(Memory, AlignedAllocation_ZeroInput) {
 
     // this line should do nothing.
     free_aligned( ret );
-}
\ No newline at end of file
+}
+
+namespace {
+    struct alignas(32) SimdData {
+        float   data[8];
+    };
+}
+
+TEST(Memory, PoolAlignment) {
+    MemoryAllocator allocator;
+    for( auto i = 0 ; i < 1024 ; ++i ){
+        // odd sized allocation to break the alignment of the next one
+        allocator.Allocate<char>( 3 );
+
+        auto* data = allocator.Allocate<SimdData>();
+        EXPECT_EQ( ((uintptr_t)data) % alignof(SimdData) , (uintptr_t)0 );
+
+        auto* d = allocator.Allocate<double>( 5 );
+        EXPECT_EQ( ((uintptr_t)d) % alignof(double) , (uintptr_t)0 );
+    }
+    allocator.Reset();
+}
+
+TEST(Memory, PoolLargeAllocation) {
+    MemoryAllocator allocator;
+    for( auto k = 0 ; k < 4 ; ++k ){
+        // allocations way beyond the size of the first block
+        for( auto i = 0 ; i < 64 ; ++i ){
+            auto* p = allocator.Allocate<int>( 16 * 1024 );
+            p[0] = i;
+            p[16 * 1024 - 1] = i;
+            EXPECT_EQ( p[0] , i );
+        }
+
+        // a single allocation larger than the largest block
+        auto* large = allocator.Allocate<char>( MEM_BLOCK_MAX_SIZE * 2 );
+        EXPECT_NE( (void*)large , (void*)nullptr );
+        large[ MEM_BLOCK_MAX_SIZE * 2 - 1 ] = 1;
+
+        allocator.Reset();
+    }
+}
+
+TEST(Memory, PoolScope) {
+    MemoryAllocator allocator;
+    auto* outer = allocator.Allocate<int>( 4 );
+
+    void* first = nullptr;
+    {
+        MemoryScope scope( allocator );
+        first = allocator.Allocate<int>( 4 );
+
+        // nested scope spilling into new blocks and large allocations
+        {
+            MemoryScope nested( allocator );
+            for( auto i = 0 ; i < 256 ; ++i )
+                allocator.Allocate<char>( 4096 );
+            allocator.Allocate<char>( MEM_BLOCK_MAX_SIZE * 2 );
+        }
+
+        // memory of the nested scope is reused right after the first allocation
+        auto* next = allocator.Allocate<int>( 4 );
+        EXPECT_EQ( (void*)next , (void*)((int*)first + 4) );
+    }
+
+    // the same memory is handed out again once the scope is gone
+    EXPECT_EQ( (void*)allocator.Allocate<int>( 4 ) , first );
+    EXPECT_EQ( (void*)outer , (void*)((int*)first - 4) );
+}
+
+TEST(Memory, LargeAllocation) {
+    for( auto policy : { HugePagePolicy::Off , HugePagePolicy::Transparent , HugePagePolicy::Explicit } ){
+        SetHugePagePolicy( policy );
+
+        // small ones, ones on whole huge pages and ones with a partial huge page at the end
+        for( auto size : { (size_t)1000 , (size_t)MEM_HUGE_PAGE_SIZE , (size_t)MEM_HUGE_PAGE_SIZE * 3 + 17 } ){
+            auto* ret = (char*)malloc_large( size , 64 );
+            EXPECT_NE( (void*)ret , (void*)nullptr );
+            EXPECT_EQ( ((uintptr_t)ret) % 64 , (uintptr_t)0 );
+
+            // all memory should be accessible, no matter what pages it is on
+            ret[0] = 1;
+            ret[size - 1] = 1;
+            free_large( ret );
+        }
+    }
+    SetHugePagePolicy( HugePagePolicy::Transparent );
+
+    // elements are value initialized
+    auto data = make_large_array<float>( MEM_HUGE_PAGE_SIZE );
+    EXPECT_EQ( data[0] , 0.0f );
+    EXPECT_EQ( data[MEM_HUGE_PAGE_SIZE - 1] , 0.0f );
+}
+
+TEST(Memory, TrackedMemory) {
+    // other tests may have touched the category, only the difference matters
+    const auto base = GetTrackedMemory( MemoryCategory::Volume );
+    {
+        TrackedMemory tracked( MemoryCategory::Volume );
+        tracked.Set( 1000 );
+        EXPECT_EQ( GetTrackedMemory( MemoryCategory::Volume ) , base + 1000 );
+        tracked.Set( 400 );
+        EXPECT_EQ( GetTrackedMemory( MemoryCategory::Volume ) , base + 400 );
+        EXPECT_GE( GetPeakTrackedMemory( MemoryCategory::Volume ) , base + 1000 );
+
+        // copies don't own the memory of the original one
+        auto copy = tracked;
+        EXPECT_EQ( GetTrackedMemory( MemoryCategory::Volume ) , base + 400 );
+    }
+    EXPECT_EQ( GetTrackedMemory( MemoryCategory::Volume ) , base );
+
+    SetMemoryBudget( MemoryCategory::Volume , base + 1000 );
+    {
+        TrackedMemory tracked( MemoryCategory::Volume );
+        tracked.Set( 600 );
+        EXPECT_EQ( GetMemoryBudgetLeft( MemoryCategory::Volume ) , 400ull );
+        tracked.Set( 2000 );
+        EXPECT_EQ( GetMemoryBudgetLeft( MemoryCategory::Volume ) , 0ull );
+    }
+    SetMemoryBudget( MemoryCategory::Volume , 0 );
+    EXPECT_EQ( GetMemoryBudgetLeft( MemoryCategory::Volume ) , ULLONG_MAX );
+}
+
+TEST(Memory, DISABLED_Benchmark) {
+    MemoryAllocator allocator;
+
+    slog( INFO , PERFORMANCE , "Memory allocator." );
+    MeasureThroughput( "MemoryAllocator::Allocate" , [&]( unsigned long long i ){
+        // the pool is reset every once in a while to keep it warm in the cache
+        if( 0 == ( i & 1023 ) )
+            allocator.Reset();
+        return allocator.Allocate<float>( 4 ) != nullptr;
+    });
+    MeasureThroughput( "MemoryAllocator::Allocate in MemoryScope" , [&]( unsigned long long ){
+        MemoryScope scope( allocator );
+        return allocator.Allocate<float>( 4 ) != nullptr;
+    });
+}
@@ -0,0 +1,136 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "thirdparty/gtest/gtest.h"
+#include "core/mesh.h"
+
+namespace {
+    //! @brief  A flat grid in the XZ plane from zero to one, with 'res' quads along each axis.
+    void buildGrid( Mesh& mesh , unsigned res ){
+        for( auto z = 0u ; z <= res ; ++z ){
+            for( auto x = 0u ; x <= res ; ++x ){
+                mesh.m_positions.push_back( Point( (float)x / res , 0.0f , (float)z / res ) );
+                MeshVertex mv;
+                mv.m_normal = Vector( 0.0f , 1.0f , 0.0f );
+                mesh.m_vertices.push_back( mv );
+            }
+        }
+        for( auto z = 0u ; z < res ; ++z ){
+            for( auto x = 0u ; x < res ; ++x ){
+                const auto v = (int)( z * ( res + 1 ) + x );
+                MeshFaceIndex f0 , f1;
+                f0.m_id[0] = v; f0.m_id[1] = v + 1; f0.m_id[2] = v + (int)res + 1;
+                f1.m_id[0] = v + 1; f1.m_id[1] = v + (int)res + 2; f1.m_id[2] = v + (int)res + 1;
+                mesh.m_indices.push_back( f0 );
+                mesh.m_indices.push_back( f1 );
+            }
+        }
+    }
+}
+
+// Simplified meshes keep valid triangles in the same place with a lot fewer vertices.
+TEST(MESH, Simplify) {
+    Mesh mesh;
+    buildGrid( mesh , 64 );
+    const auto triangle_cnt = mesh.m_indices.size();
+
+    ASSERT_TRUE( mesh.Simplify( 1.0f / 8.0f ) );
+    EXPECT_LE( mesh.m_positions.size() , 9u * 9u );
+    EXPECT_EQ( mesh.m_positions.size() , mesh.m_vertices.size() );
+    EXPECT_LT( mesh.m_indices.size() , triangle_cnt / 16 );
+    EXPECT_GT( mesh.m_indices.size() , 0u );
+
+    for( const auto& mi : mesh.m_indices ){
+        for( auto k = 0 ; k < 3 ; ++k ){
+            ASSERT_GE( mi.m_id[k] , 0 );
+            ASSERT_LT( mi.m_id[k] , (int)mesh.m_positions.size() );
+        }
+        EXPECT_NE( mi.m_id[0] , mi.m_id[1] );
+        EXPECT_NE( mi.m_id[1] , mi.m_id[2] );
+        EXPECT_NE( mi.m_id[2] , mi.m_id[0] );
+    }
+    for( const auto& p : mesh.m_positions ){
+        EXPECT_GE( p.x , 0.0f );
+        EXPECT_LE( p.x , 1.0f );
+        EXPECT_EQ( p.y , 0.0f );
+    }
+    for( const auto& v : mesh.m_vertices )
+        EXPECT_NEAR( v.m_normal.y , 1.0f , 1e-5f );
+
+    // cells as fine as the vertices don't reduce anything, the mesh is kept as it is
+    Mesh fine;
+    buildGrid( fine , 16 );
+    EXPECT_FALSE( fine.Simplify( 1.0f / 64.0f ) );
+    EXPECT_EQ( fine.m_indices.size() , 16u * 16u * 2u );
+}
+
+// Preprocessed meshes drop zero area triangles and weld duplicated vertices, the rest of the triangles stay where they are.
+TEST(MESH, Preprocess) {
+    Mesh mesh;
+    buildGrid( mesh , 16 );
+    const auto vertex_cnt = mesh.m_positions.size();
+    const auto triangle_cnt = mesh.m_indices.size();
+
+    // every triangle gets its own copy of its vertices, as some exporters do
+    Mesh split;
+    for( const auto& mi : mesh.m_indices ){
+        MeshFaceIndex index = mi;
+        for( auto k = 0 ; k < 3 ; ++k ){
+            index.m_id[k] = (int)split.m_positions.size();
+            split.m_positions.push_back( mesh.m_positions[mi.m_id[k]] );
+            split.m_vertices.push_back( mesh.m_vertices[mi.m_id[k]] );
+        }
+        split.m_indices.push_back( index );
+    }
+
+    // a triangle with repeated indices and another one collapsed to a line
+    MeshFaceIndex repeated , collapsed;
+    repeated.m_id[0] = repeated.m_id[1] = repeated.m_id[2] = 0;
+    collapsed.m_id[0] = 0; collapsed.m_id[1] = 1; collapsed.m_id[2] = 2;
+    split.m_indices.push_back( repeated );
+    split.m_positions.push_back( Point( 0.0f , 0.0f , 0.0f ) );
+    split.m_positions.push_back( Point( 0.5f , 0.0f , 0.0f ) );
+    split.m_positions.push_back( Point( 1.0f , 0.0f , 0.0f ) );
+    split.m_vertices.resize( split.m_positions.size() );
+    for( auto k = 0 ; k < 3 ; ++k )
+        collapsed.m_id[k] = (int)split.m_positions.size() - 3 + k;
+    split.m_indices.push_back( collapsed );
+
+    auto area = 0.0f;
+    for( const auto& mi : split.m_indices )
+        area += cross( split.m_positions[mi.m_id[1]] - split.m_positions[mi.m_id[0]] , split.m_positions[mi.m_id[2]] - split.m_positions[mi.m_id[0]] ).Length();
+
+    ASSERT_TRUE( split.Preprocess() );
+    EXPECT_EQ( split.m_positions.size() , vertex_cnt );
+    EXPECT_EQ( split.m_vertices.size() , vertex_cnt );
+    EXPECT_EQ( split.m_indices.size() , triangle_cnt );
+
+    auto preprocessed_area = 0.0f;
+    for( const auto& mi : split.m_indices ){
+        for( auto k = 0 ; k < 3 ; ++k ){
+            ASSERT_GE( mi.m_id[k] , 0 );
+            ASSERT_LT( mi.m_id[k] , (int)split.m_positions.size() );
+        }
+        preprocessed_area += cross( split.m_positions[mi.m_id[1]] - split.m_positions[mi.m_id[0]] , split.m_positions[mi.m_id[2]] - split.m_positions[mi.m_id[0]] ).Length();
+    }
+    EXPECT_NEAR( area , preprocessed_area , 1e-4f );
+
+    // a clean mesh is only reordered
+    EXPECT_FALSE( mesh.Preprocess() );
+    EXPECT_EQ( mesh.m_positions.size() , vertex_cnt );
+    EXPECT_EQ( mesh.m_indices.size() , triangle_cnt );
+}
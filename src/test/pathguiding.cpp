@@ -0,0 +1,161 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cstdio>
+#include "thirdparty/gtest/gtest.h"
+#include "core/rand.h"
+#include "core/samplemethod.h"
+#include "integrator/pathguiding.h"
+
+namespace {
+    // A directional tree that learned most of its energy from a cone around the direction.
+    DTree makeTrainedTree( const Vector& dir ){
+        DTree tree;
+        for( auto iteration = 0 ; iteration < 4 ; ++iteration ){
+            for( auto i = 0 ; i < 4096 ; ++i ){
+                const auto wi = UniformSampleSphere( sort_canonical() , sort_canonical() );
+                tree.Record( wi , dot( wi , dir ) > 0.9f ? 10.0f : 0.1f );
+            }
+            tree.Build();
+            if( iteration < 3 )
+                tree = tree.Refine();
+        }
+        return tree;
+    }
+}
+
+// The pdf returned by sampling needs to match the one evaluated for the direction
+TEST(PATHGUIDING, DTreeSamplePdf) {
+    const auto tree = makeTrainedTree( normalize( Vector( 1.0f , 2.0f , 3.0f ) ) );
+    EXPECT_GT( tree.GetNodeCount() , 1u );
+
+    for( auto i = 0 ; i < 4096 ; ++i ){
+        auto pdf = 0.0f;
+        const auto wi = tree.Sample( sort_canonical() , sort_canonical() , &pdf );
+        EXPECT_NEAR( wi.Length() , 1.0f , 0.001f );
+        EXPECT_GT( pdf , 0.0f );
+        EXPECT_NEAR( pdf , tree.Pdf( wi ) , pdf * 0.001f );
+    }
+}
+
+// The pdf integrates to one over the sphere
+TEST(PATHGUIDING, DTreePdfIntegration) {
+    const auto tree = makeTrainedTree( Vector( 0.0f , 1.0f , 0.0f ) );
+
+    const auto N = 1024 * 256;
+    auto total = 0.0;
+    for( auto i = 0 ; i < N ; ++i )
+        total += tree.Pdf( UniformSampleSphere( sort_canonical() , sort_canonical() ) ) * FOUR_PI;
+    EXPECT_NEAR( total / N , 1.0 , 0.02 );
+}
+
+// Samples concentrate around where the energy comes from
+TEST(PATHGUIDING, DTreeLearnedDistribution) {
+    const auto dir = normalize( Vector( -1.0f , 0.5f , 0.2f ) );
+    const auto tree = makeTrainedTree( dir );
+
+    // the cone takes 5% of the sphere, but it has more than 80% of the energy
+    const auto N = 4096;
+    auto inside = 0;
+    for( auto i = 0 ; i < N ; ++i ){
+        const auto wi = tree.Sample( sort_canonical() , sort_canonical() , nullptr );
+        if( dot( wi , dir ) > 0.85f )
+            ++inside;
+    }
+    EXPECT_GT( inside , N / 2 );
+}
+
+// A tree without anything recorded samples the sphere uniformly
+TEST(PATHGUIDING, DTreeEmpty) {
+    DTree tree;
+    tree.Build();
+    for( auto i = 0 ; i < 64 ; ++i ){
+        auto pdf = 0.0f;
+        const auto wi = tree.Sample( sort_canonical() , sort_canonical() , &pdf );
+        EXPECT_NEAR( pdf , INV_FOUR_PI , 0.0001f );
+        EXPECT_NEAR( tree.Pdf( wi ) , INV_FOUR_PI , 0.0001f );
+    }
+}
+
+// Spatial leaves receiving a lot of samples get split in the next iteration
+TEST(PATHGUIDING, SDTreeRefine) {
+    const auto bbox = BBox( Point( 0.0f ) , Point( 1.0f ) );
+    SDTree tree( bbox );
+    EXPECT_EQ( tree.GetLeafCount() , 1u );
+
+    for( auto i = 0u ; i < SDTREE_SPLIT_THRESHOLD * 16 ; ++i ){
+        const auto p = Point( sort_canonical() , sort_canonical() , sort_canonical() );
+        tree.Record( p , UniformSampleSphere( sort_canonical() , sort_canonical() ) , 1.0f );
+    }
+    tree.Build();
+
+    const auto refined = tree.Refine( 1 );
+    EXPECT_GT( refined->GetLeafCount() , 1u );
+
+    // the refined tree is empty, it samples uniformly everywhere
+    for( auto i = 0 ; i < 64 ; ++i ){
+        const auto p = Point( sort_canonical() , sort_canonical() , sort_canonical() );
+        EXPECT_NEAR( refined->Pdf( p , UniformSampleSphere( sort_canonical() , sort_canonical() ) ) , INV_FOUR_PI , 0.0001f );
+    }
+}
+
+// A guiding structure saved after rendering is loaded as the sampling tree of the next rendering of the same scene
+TEST(PATHGUIDING, WarmStart) {
+    const auto bbox = BBox( Point( 0.0f ) , Point( 1.0f ) );
+    const auto dir = normalize( Vector( 1.0f , 1.0f , 0.0f ) );
+    const auto filename = "pathguiding_warmstart.cache";
+
+    // train four iterations, the last sampling tree is trained with 8 samples per pixel
+    PathGuiding guiding;
+    guiding.Initialize( bbox , 256 );
+    for( auto i = 0 ; i < 256 * 15 ; ++i ){
+        const auto p = Point( sort_canonical() , sort_canonical() , sort_canonical() );
+        const auto wi = UniformSampleSphere( sort_canonical() , sort_canonical() );
+        guiding.GetTrainingTree()->Record( p , wi , dot( wi , dir ) > 0.9f ? 10.0f : 0.1f );
+        guiding.FinishSample();
+    }
+    const auto trained = guiding.GetSamplingTree();
+    ASSERT_NE( trained , nullptr );
+    ASSERT_TRUE( guiding.SaveCache( filename , 1234 ) );
+
+    // nothing is loaded for another scene
+    PathGuiding other;
+    other.Initialize( bbox , 256 );
+    EXPECT_FALSE( other.LoadCache( filename , 4321 , 1.0f ) );
+    EXPECT_EQ( other.GetSamplingTree() , nullptr );
+
+    PathGuiding warm;
+    warm.Initialize( bbox , 256 );
+    ASSERT_TRUE( warm.LoadCache( filename , 1234 , 0.5f ) );
+    const auto loaded = warm.GetSamplingTree();
+    ASSERT_NE( loaded , nullptr );
+    EXPECT_EQ( loaded->GetLeafCount() , trained->GetLeafCount() );
+    for( auto i = 0 ; i < 256 ; ++i ){
+        const auto p = Point( sort_canonical() , sort_canonical() , sort_canonical() );
+        const auto wi = UniformSampleSphere( sort_canonical() , sort_canonical() );
+        EXPECT_NEAR( loaded->Pdf( p , wi ) , trained->Pdf( p , wi ) , 0.0001f );
+    }
+
+    // with half of its 8 samples per pixel counted, the loaded tree is replaced by a tree trained with 4 samples per pixel
+    for( auto i = 0 ; i < 256 * 4 - 1 ; ++i )
+        warm.FinishSample();
+    EXPECT_EQ( warm.GetSamplingTree() , loaded );
+    warm.FinishSample();
+    EXPECT_NE( warm.GetSamplingTree() , loaded );
+
+    std::remove( filename );
+}
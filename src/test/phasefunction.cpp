@@ -74,4 +74,39 @@ TEST(PHASE_FUNCTION, HenyeyGreenstein_PDF_Sample) {
         const auto hg_value = hg.P( wo , wi );
         EXPECT_NEAR( pdf , hg_value , 0.001f );
     } );
-}
\ No newline at end of file
+}
+
+TEST(PHASE_FUNCTION, MultiLobeHenyeyGreenstein_PDF_Sample) {
+    const auto u = sort_canonical();
+    const auto v = sort_canonical();
+    const auto wo = UniformSampleSphere( u , v );
+
+    // the pdf of the mixture is the mixture itself since each lobe is picked by its weight.
+    ParrallRun<8, 1024 * 1024>( [&](){
+        Vector wi;
+        auto pdf = 0.0f;
+        const float g[] = { sort_canonical() , -sort_canonical() , 0.0f , sort_canonical() * 2.0f - 1.0f };
+        const float w[] = { sort_canonical() , sort_canonical() , sort_canonical() , sort_canonical() };
+        const MultiLobeHenyeyGreenstein hg( g , w , 4 );
+        hg.Sample( wo , wi , pdf );
+
+        EXPECT_NEAR( pdf , hg.P( wo , wi ) , 0.001f );
+    } );
+}
+
+TEST(PHASE_FUNCTION, MultiLobeHenyeyGreenstein_Single_Lobe) {
+    const auto u = sort_canonical();
+    const auto v = sort_canonical();
+    const auto wo = UniformSampleSphere( u , v );
+
+    // a mixture with only one lobe of weight should match the single lobe version exactly.
+    ParrallRun<8, 1024 * 1024>( [&](){
+        const auto wi = UniformSampleSphere( sort_canonical() , sort_canonical() );
+        const float g[] = { sort_canonical() * 2.0f - 1.0f , 0.5f };
+        const float w[] = { 1.0f , 0.0f };
+        const MultiLobeHenyeyGreenstein mhg( g , w , 2 );
+        const HenyeyGreenstein hg( g[0] );
+
+        EXPECT_NEAR( mhg.P( wo , wi ) , hg.P( wo , wi ) , 0.001f );
+    } );
+}
@@ -0,0 +1,65 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "thirdparty/gtest/gtest.h"
+#include "unittest_common.h"
+#include "imagesensor/pixelfilter.h"
+
+// Tiles of a constant image are filtered and merged from multiple threads at the same time, aprons overlapping along
+// tile borders shouldn't lose any sample and the resolved image should stay constant.
+TEST(PIXELFILTER, ConstantImage) {
+    constexpr int W = 64;
+    constexpr int H = 48;
+    constexpr int TS = 16;
+    constexpr int TX = W / TS;
+    constexpr int TN = TX * ( H / TS );
+    constexpr int SPP = 4;
+
+    FilteredFilm film( W , H , std::make_unique<BlackmanHarrisFilter>() );
+    ParrallRun<TN, 1>( [&]( int tid ){
+        const Vector2i tl( tid % TX * TS , tid / TX * TS );
+        FilteredTile tile;
+        tile.Reset( tl , Vector2i( TS , TS ) , film.GetFilter() );
+        for( auto y = tl.y ; y < tl.y + TS ; ++y )
+            for( auto x = tl.x ; x < tl.x + TS ; ++x )
+                for( auto k = 0 ; k < SPP ; ++k )
+                    tile.AddSample( x + ( k % 2 + 0.5f ) * 0.5f , y + ( k / 2 + 0.5f ) * 0.5f , 2.0f , film.GetFilter() );
+        film.Merge( tile , tl , Vector2i( TS , TS ) );
+    } );
+
+    RenderTarget rt( W , H );
+    film.Resolve( rt , Vector2i( 0 , 0 ) , Vector2i( W , H ) );
+    for( auto y = 0 ; y < H ; ++y )
+        for( auto x = 0 ; x < W ; ++x )
+            EXPECT_NEAR( rt.GetColor( x , y ).r , 2.0f , 1e-4f );
+}
+
+// A single sample in the middle of a pixel weights the pixel the most and fades out in the neighbors.
+TEST(PIXELFILTER, Footprint) {
+    GaussianFilter filter;
+    FilteredTile tile;
+    tile.Reset( Vector2i( 4 , 4 ) , Vector2i( 8 , 8 ) , filter );
+    EXPECT_EQ( tile.apron , 1 );
+    tile.AddSample( 4.5f , 4.5f , 1.0f , filter );
+
+    const auto weight = [&]( int x , int y ){ return tile.weight[( y - tile.coord.y ) * tile.size.x + x - tile.coord.x]; };
+    EXPECT_GT( weight( 4 , 4 ) , weight( 3 , 4 ) );
+    EXPECT_GT( weight( 3 , 4 ) , weight( 3 , 3 ) );
+    EXPECT_GT( weight( 3 , 3 ) , 0.0f );
+    EXPECT_FLOAT_EQ( weight( 3 , 4 ) , weight( 5 , 4 ) );
+    EXPECT_EQ( weight( 6 , 4 ) , 0.0f );
+}
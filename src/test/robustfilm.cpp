@@ -0,0 +1,76 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "thirdparty/gtest/gtest.h"
+#include "unittest_common.h"
+#include "imagesensor/robustfilm.h"
+
+// A single firefly only shifts one bucket, the median of the bucket means ignores it while the plain average doesn't.
+TEST(ROBUSTFILM, RejectFirefly) {
+    constexpr unsigned int K = 8;
+    constexpr unsigned int SPP = 64;
+
+    BucketTile tile;
+    tile.Reset( Vector2i( 0 , 0 ) , Vector2i( 1 , 1 ) , K );
+    for( auto k = 0u ; k < SPP ; ++k )
+        tile.AddSample( 0 , 0 , k , k == 13 ? Spectrum( 1000.0f ) : Spectrum( 0.5f ) );
+
+    Spectrum mean;
+    const auto robust = MedianOfMeans( tile.radiance.data() , tile.cnt.data() , K , &mean );
+    EXPECT_NEAR( robust.GetIntensity() , 0.5f , 1e-5f );
+    EXPECT_NEAR( mean.GetIntensity() , ( 63.0f * 0.5f + 1000.0f ) / 64.0f , 1e-3f );
+}
+
+// Without outliers, the estimate converges to the average. Even number of buckets takes the two in the middle.
+TEST(ROBUSTFILM, Converge) {
+    constexpr unsigned int K = 4;
+    constexpr unsigned int SPP = 4096;
+
+    BucketTile tile;
+    tile.Reset( Vector2i( 0 , 0 ) , Vector2i( 1 , 1 ) , K );
+    for( auto k = 0u ; k < SPP ; ++k )
+        tile.AddSample( 0 , 0 , k , Spectrum( (float)( k % 7 ) / 6.0f ) );
+
+    Spectrum mean;
+    const auto robust = MedianOfMeans( tile.radiance.data() , tile.cnt.data() , K , &mean );
+    EXPECT_NEAR( robust.GetIntensity() , mean.GetIntensity() , 1e-3f );
+    EXPECT_NEAR( mean.GetIntensity() , 0.5f , 1e-3f );
+}
+
+// Passes of a tile keep accumulating in the same buckets, empty buckets of a pixel don't count.
+TEST(ROBUSTFILM, MergePasses) {
+    constexpr int W = 4;
+    constexpr int H = 2;
+    constexpr unsigned int K = 3;
+
+    RobustFilm film( W , H , K );
+    for( auto pass = 0u ; pass < 2u ; ++pass ){
+        BucketTile tile;
+        tile.Reset( Vector2i( 0 , 0 ) , Vector2i( W , H ) , K );
+        for( auto y = 0 ; y < H ; ++y )
+            for( auto x = 0 ; x < W ; ++x )
+                tile.AddSample( x , y , pass , Spectrum( (float)( x + pass ) ) );
+        film.Merge( tile , Vector2i( 0 , 0 ) , Vector2i( W , H ) );
+    }
+
+    for( auto x = 0 ; x < W ; ++x ){
+        Spectrum mean;
+        const auto robust = film.Resolve( x , 1 , &mean );
+        EXPECT_NEAR( robust.GetIntensity() , x + 0.5f , 1e-5f );
+        EXPECT_NEAR( mean.GetIntensity() , x + 0.5f , 1e-5f );
+    }
+}
@@ -0,0 +1,331 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "thirdparty/gtest/gtest.h"
+#include "unittest_common.h"
+#include "core/rand.h"
+#include "core/samplemethod.h"
+#include "stream/mstream.h"
+#include "sampler/sobol.h"
+#include "integrator/mlt.h"
+
+// Alias table picks each unit with the probability proportional to its weight
+TEST(SAMPLE_METHOD, AliasTable) {
+    const float weights[] = { 1.0f , 0.0f , 3.0f , 0.5f , 10.0f , 2.5f , 0.0f , 3.0f };
+    constexpr unsigned cnt = sizeof( weights ) / sizeof( weights[0] );
+    const AliasTable table( weights , cnt );
+    EXPECT_EQ( table.GetCount() , cnt );
+
+    const auto total = 20.0f;
+    unsigned hits[cnt] = { 0 };
+    constexpr unsigned sample_cnt = 1024 * 1024;
+    for( auto i = 0u ; i < sample_cnt ; ++i ){
+        auto pdf = 0.0f;
+        const auto id = table.SampleDiscrete( sort_canonical() , &pdf );
+        ASSERT_GE( id , 0 );
+        ASSERT_LT( id , (int)cnt );
+        EXPECT_EQ( pdf , table.GetProperty( id ) );
+        ++hits[id];
+    }
+
+    for( auto i = 0u ; i < cnt ; ++i ){
+        EXPECT_NEAR( table.GetProperty( i ) , weights[i] / total , 0.0001f );
+        EXPECT_NEAR( (float)hits[i] / (float)sample_cnt , weights[i] / total , 0.005f );
+    }
+}
+
+// Sampled directions are inside the spherical triangle and the pdf integrates to one
+TEST(SAMPLE_METHOD, SphericalTriangle) {
+    const auto p0 = Vector( -1.0f , 1.0f , -0.5f );
+    const auto p1 = Vector( 2.0f , 1.5f , 0.0f );
+    const auto p2 = Vector( 0.0f , 1.0f , 2.0f );
+    const auto a = normalize( p0 ) , b = normalize( p1 ) , c = normalize( p2 );
+    const auto area = SphericalTriangleArea( a , b , c );
+    EXPECT_GT( area , 0.0f );
+
+    // the plane of the triangle, every sampled direction hits the triangle
+    const auto n = normalize( cross( p1 - p0 , p2 - p0 ) );
+    for( auto i = 0 ; i < 4096 ; ++i ){
+        auto pdf = 0.0f;
+        const auto w = UniformSampleSphericalTriangle( a , b , c , sort_canonical() , sort_canonical() , &pdf );
+        EXPECT_NEAR( pdf , 1.0f / area , 0.0001f );
+        EXPECT_NEAR( w.Length() , 1.0f , 0.0001f );
+
+        const auto p = w * ( dot( p0 , n ) / dot( w , n ) );
+        const auto e0 = dot( cross( p1 - p0 , p - p0 ) , n );
+        const auto e1 = dot( cross( p2 - p1 , p - p1 ) , n );
+        const auto e2 = dot( cross( p0 - p2 , p - p2 ) , n );
+        EXPECT_GE( e0 , -0.001f );
+        EXPECT_GE( e1 , -0.001f );
+        EXPECT_GE( e2 , -0.001f );
+    }
+
+    // the solid angle matches the one estimated with uniformly sampled directions on the sphere
+    const auto estimated = ParrallReduction<double, 8, 1024 * 128>( [&](){
+        const auto w = UniformSampleSphere( sort_canonical() , sort_canonical() );
+        const auto d = dot( w , n );
+        if( d * dot( p0 , n ) <= 0.0f )
+            return 0.0f;
+        const auto p = w * ( dot( p0 , n ) / d );
+        const auto inside = dot( cross( p1 - p0 , p - p0 ) , n ) >= 0.0f && dot( cross( p2 - p1 , p - p1 ) , n ) >= 0.0f && dot( cross( p0 - p2 , p - p2 ) , n ) >= 0.0f;
+        return inside ? 1.0f / UniformSpherePdf() : 0.0f;
+    } );
+    EXPECT_NEAR( estimated , area , area * 0.02f );
+}
+
+// Samples in a regular polygon stay inside it and cover each wedge evenly
+TEST(SAMPLE_METHOD, UniformSamplePolygon) {
+    constexpr int n = 6;
+    const auto rotation = 0.3f;
+    const auto apothem = cos( PI / (float)n );
+
+    unsigned hits[n] = { 0 };
+    constexpr unsigned sample_cnt = 1024 * 256;
+    for( auto i = 0u ; i < sample_cnt ; ++i ){
+        auto x = 0.0f , y = 0.0f;
+        UniformSamplePolygon( sort_canonical() , sort_canonical() , n , rotation , x , y );
+
+        // the wedge the point falls in, measured from the first corner
+        auto phi = atan2( y , x ) - rotation;
+        while( phi < 0.0f )
+            phi += TWO_PI;
+        const auto k = std::min( (int)( phi / TWO_PI * (float)n ) , n - 1 );
+        ++hits[k];
+
+        // distance to the edge of the wedge
+        const auto mid = rotation + TWO_PI * ( (float)k + 0.5f ) / (float)n;
+        EXPECT_LE( x * cos( mid ) + y * sin( mid ) , apothem + 0.0001f );
+    }
+
+    for( auto k = 0 ; k < n ; ++k )
+        EXPECT_NEAR( (float)hits[k] / (float)sample_cnt , 1.0f / (float)n , 0.005f );
+    EXPECT_NEAR( PolygonArea( 4 ) , 2.0f , 0.0001f );
+}
+
+// Samples of the flat 2D distribution follow the data and match the pdf evaluation
+TEST(SAMPLE_METHOD, Distribution2D) {
+    constexpr unsigned nu = 4 , nv = 3;
+    const float data[nu * nv] = {   1.0f , 2.0f , 0.0f , 1.0f ,
+                                    0.0f , 0.0f , 0.0f , 0.0f ,
+                                    4.0f , 0.5f , 0.5f , 3.0f };
+    const Distribution2D distribution( data , nu , nv );
+
+    const auto total = 12.0f;
+    unsigned hits[nu * nv] = { 0 };
+    constexpr unsigned sample_cnt = 1024 * 1024;
+    for( auto i = 0u ; i < sample_cnt ; ++i ){
+        float uv[2] , pdf = 0.0f;
+        distribution.SampleContinuous( sort_canonical() , sort_canonical() , uv , &pdf );
+        ASSERT_GE( uv[0] , 0.0f );
+        ASSERT_LT( uv[0] , 1.0f );
+        ASSERT_GE( uv[1] , 0.0f );
+        ASSERT_LT( uv[1] , 1.0f );
+        EXPECT_NEAR( pdf , distribution.Pdf( uv[0] , uv[1] ) , 0.0001f );
+        ++hits[ (unsigned)( uv[1] * nv ) * nu + (unsigned)( uv[0] * nu ) ];
+    }
+
+    for( auto i = 0u ; i < nu * nv ; ++i ){
+        const auto u = ( (float)( i % nu ) + 0.5f ) / (float)nu;
+        const auto v = ( (float)( i / nu ) + 0.5f ) / (float)nv;
+        EXPECT_NEAR( distribution.Pdf( u , v ) , data[i] / total * (float)( nu * nv ) , 0.0001f );
+        EXPECT_NEAR( (float)hits[i] / (float)sample_cnt , data[i] / total , 0.005f );
+    }
+}
+
+// Sampling tables loaded from a cache behave exactly the same as the original ones
+TEST(SAMPLE_METHOD, Distribution2DCache) {
+    constexpr unsigned nu = 5 , nv = 3;
+    const float data[nu * nv] = {   1.0f , 2.0f , 0.0f , 1.0f , 7.0f ,
+                                    0.0f , 0.3f , 0.0f , 0.0f , 0.0f ,
+                                    4.0f , 0.5f , 0.5f , 3.0f , 1.0f };
+    const Distribution2D distribution( data , nu , nv );
+
+    IMemoryStream istream;
+    distribution.SaveCache( istream );
+    OMemoryStream ostream( istream ) , mismatched_stream( istream );
+
+    Distribution2D loaded;
+    EXPECT_FALSE( Distribution2D().LoadCache( mismatched_stream , nu + 1 , nv ) );
+    ASSERT_TRUE( loaded.LoadCache( ostream , nu , nv ) );
+
+    for( auto i = 0 ; i < 1024 ; ++i ){
+        const auto u = sort_canonical() , v = sort_canonical();
+        float uv0[2] , uv1[2] , pdf0 = 0.0f , pdf1 = 0.0f;
+        distribution.SampleContinuous( u , v , uv0 , &pdf0 );
+        loaded.SampleContinuous( u , v , uv1 , &pdf1 );
+        EXPECT_EQ( uv0[0] , uv1[0] );
+        EXPECT_EQ( uv0[1] , uv1[1] );
+        EXPECT_EQ( pdf0 , pdf1 );
+        EXPECT_EQ( distribution.Pdf( u , v ) , loaded.Pdf( u , v ) );
+    }
+}
+
+// Every dimension of a pixel in Sobol sampler is stratified in all elementary intervals.
+TEST(SAMPLE_METHOD, SobolStratification) {
+    constexpr unsigned log_cnt = 6;
+    constexpr unsigned cnt = 1u << log_cnt;
+
+    SobolSampler sampler;
+    for( auto dim = 0u ; dim < 4u ; ++dim ){
+        float u[cnt] , v[cnt];
+        for( auto i = 0u ; i < cnt ; ++i ){
+            sampler.StartPixelSample( 3 , 7 , i , dim );
+            sampler.Get2D( u[i] , v[i] );
+            ASSERT_GE( u[i] , 0.0f );
+            ASSERT_LT( u[i] , 1.0f );
+            ASSERT_GE( v[i] , 0.0f );
+            ASSERT_LT( v[i] , 1.0f );
+        }
+
+        for( auto k = 0u ; k <= log_cnt ; ++k ){
+            const auto nx = 1u << k;
+            const auto ny = cnt >> k;
+            unsigned hits[cnt] = { 0 };
+            for( auto i = 0u ; i < cnt ; ++i )
+                ++hits[ (unsigned)( v[i] * ny ) * nx + (unsigned)( u[i] * nx ) ];
+            for( auto i = 0u ; i < cnt ; ++i )
+                EXPECT_EQ( hits[i] , 1u );
+        }
+    }
+}
+
+// Stratified samples converge faster than random samples for a smooth integrand.
+TEST(SAMPLE_METHOD, SobolConvergence) {
+    constexpr unsigned cnt = 256;
+    constexpr unsigned pixel_cnt = 64;
+    const auto f = []( float u , float v ){ return u * v; };
+
+    SobolSampler sobol;
+    auto sobol_error = 0.0 , random_error = 0.0;
+    for( auto p = 0u ; p < pixel_cnt ; ++p ){
+        auto sobol_sum = 0.0 , random_sum = 0.0;
+        for( auto i = 0u ; i < cnt ; ++i ){
+            float u , v;
+            sobol.StartPixelSample( p , 0 , i );
+            sobol.Get1D();
+            sobol.Get2D( u , v );
+            sobol_sum += f( u , v );
+            random_sum += f( sort_canonical() , sort_canonical() );
+        }
+        sobol_error += fabs( sobol_sum / cnt - 0.25 );
+        random_error += fabs( random_sum / cnt - 0.25 );
+    }
+    EXPECT_LT( sobol_error , random_error * 0.25 );
+}
+
+// Interleaving suspended pixel samples doesn't change the samples drawn by any of them.
+TEST(SAMPLE_METHOD, SuspendSample) {
+    constexpr unsigned cnt = 8;
+    constexpr unsigned dim_cnt = 6;
+
+    SobolSampler sobol;
+    BindSampler( &sobol );
+
+    // samples drawn one after another
+    float expected[cnt][dim_cnt][2];
+    for( auto i = 0u ; i < cnt ; ++i ){
+        sobol.StartPixelSample( 5 , 9 , i );
+        sort_seed( 5 , 9 , i , 1 );
+        for( auto d = 0u ; d < dim_cnt ; ++d ){
+            expected[i][d][0] = sort_sample_1d();
+            expected[i][d][1] = sort_canonical();
+        }
+    }
+
+    // samples drawn one dimension at a time, taking turns
+    SampleCursor cursors[cnt];
+    for( auto i = 0u ; i < cnt ; ++i ){
+        cursors[i].x = 5;
+        cursors[i].y = 9;
+        cursors[i].index = i;
+        sobol.StartPixelSample( 5 , 9 , i );
+        sort_seed( 5 , 9 , i , 1 );
+        SuspendSample( cursors[i] );
+    }
+    for( auto d = 0u ; d < dim_cnt ; ++d ){
+        for( auto i = 0u ; i < cnt ; ++i ){
+            ResumeSample( cursors[i] );
+            EXPECT_EQ( sort_sample_1d() , expected[i][d][0] );
+            EXPECT_EQ( sort_canonical() , expected[i][d][1] );
+            SuspendSample( cursors[i] );
+        }
+    }
+
+    BindSampler( nullptr );
+}
+
+// The same key reproduces the same state, rejected mutations leave the state where it was
+TEST(SAMPLE_METHOD, MLTSampler) {
+    constexpr unsigned dim = 16;
+    const auto distance = []( float a , float b ){
+        const auto d = fabs( a - b );
+        return std::min( d , 1.0f - d );
+    };
+
+    // only small steps
+    MLTSampler sampler( 0.01f , 0.0f );
+    sampler.Reseed( 7 , 0 );
+    float state[dim];
+    for( auto d = 0u ; d < dim ; ++d ){
+        state[d] = sampler.Get1D();
+        EXPECT_GE( state[d] , 0.0f );
+        EXPECT_LT( state[d] , 1.0f );
+    }
+
+    MLTSampler other( 0.01f , 0.0f );
+    other.Reseed( 7 , 0 );
+    for( auto d = 0u ; d < dim ; ++d )
+        EXPECT_EQ( other.Get1D() , state[d] );
+
+    for( auto i = 0u ; i < 64 ; ++i ){
+        sampler.StartIteration();
+        for( auto d = 0u ; d < dim ; ++d ){
+            const auto value = sampler.Get1D();
+            EXPECT_GE( value , 0.0f );
+            EXPECT_LT( value , 1.0f );
+        }
+        sampler.Reject();
+    }
+
+    // the next small step starts from the state before all the rejected ones
+    sampler.StartIteration();
+    for( auto d = 0u ; d < dim ; ++d )
+        EXPECT_LT( distance( sampler.Get1D() , state[d] ) , 0.05f );
+    sampler.Accept();
+}
+
+TEST(SAMPLE_METHOD, DISABLED_Benchmark) {
+    constexpr unsigned cnt = 1024 * 64;
+    std::vector<float> weights( cnt );
+    for( auto& w : weights )
+        w = sort_canonical();
+    const Distribution1D distribution( weights.data() , cnt );
+
+    std::vector<float> u( 1024 );
+    for( auto& f : u )
+        f = sort_canonical();
+
+    slog( INFO , PERFORMANCE , "Distribution1D with %d buckets." , cnt );
+    MeasureThroughput( "Distribution1D::SampleDiscrete" , [&]( unsigned long long i ){
+        float pdf = 0.0f;
+        return distribution.SampleDiscrete( u[i & 1023] , &pdf ) + pdf;
+    });
+    MeasureThroughput( "Distribution1D::SampleContinuous" , [&]( unsigned long long i ){
+        float pdf = 0.0f;
+        return distribution.SampleContinuous( u[i & 1023] , &pdf ) + pdf;
+    });
+}
@@ -0,0 +1,69 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include "thirdparty/gtest/gtest.h"
+#include "core/sharedblob.h"
+
+// A published blob is mapped by anyone opening it with the same key, chunks are aligned
+TEST(SHAREDBLOB, PublishAndOpen) {
+    const std::string dir = "sharedblob_test";
+    std::filesystem::remove_all( dir );
+
+    EXPECT_EQ( SharedBlob::Open( dir , 42 ) , nullptr );
+
+    const std::vector<int>   ints = { 1 , 2 , 3 };
+    const std::vector<float> floats = { 0.5f , 1.5f };
+    const std::vector<SharedBlob::Chunk> chunks = { { ints.data() , sizeof( int ) * ints.size() } , { nullptr , 0 } , { floats.data() , sizeof( float ) * floats.size() } };
+    const auto published = SharedBlob::Publish( dir , 42 , chunks );
+    ASSERT_NE( published , nullptr );
+
+    const auto blob = SharedBlob::Open( dir , 42 );
+    ASSERT_NE( blob , nullptr );
+    EXPECT_EQ( blob->GetSize() , published->GetSize() );
+    for( auto i = 0u ; i < chunks.size() ; ++i )
+        EXPECT_EQ( SharedBlob::ChunkOffset( chunks , i ) % SharedBlob::SHARED_BLOB_ALIGNMENT , 0u );
+    EXPECT_EQ( (std::uintptr_t)blob->GetData() % SharedBlob::SHARED_BLOB_ALIGNMENT , 0u );
+
+    const auto mapped_ints = (const int*)( blob->GetData() + SharedBlob::ChunkOffset( chunks , 0 ) );
+    const auto mapped_floats = (const float*)( blob->GetData() + SharedBlob::ChunkOffset( chunks , 2 ) );
+    EXPECT_EQ( mapped_ints[2] , 3 );
+    EXPECT_EQ( mapped_floats[1] , 1.5f );
+
+    // other keys are not there
+    EXPECT_EQ( SharedBlob::Open( dir , 43 ) , nullptr );
+
+    std::filesystem::remove_all( dir );
+}
+
+// A truncated blob is never mapped
+TEST(SHAREDBLOB, Truncated) {
+    const std::string dir = "sharedblob_truncated";
+    std::filesystem::remove_all( dir );
+
+    const std::vector<char> data( 1000 , 7 );
+    ASSERT_NE( SharedBlob::Publish( dir , 7 , { { data.data() , data.size() } } ) , nullptr );
+
+    const auto filename = ( std::filesystem::path( dir ) / "0000000000000007.blob" ).string();
+    std::filesystem::resize_file( filename , std::filesystem::file_size( filename ) - 1 );
+    EXPECT_EQ( SharedBlob::Open( dir , 7 ) , nullptr );
+
+    std::filesystem::remove_all( dir );
+}
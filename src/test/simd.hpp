@@ -27,7 +27,23 @@
     #define SIMD_TEST       SIMD_SSE
 #endif
 
-#if defined( SIMD_AVX_IMPLEMENTATION ) || defined( SIMD_SSE_IMPLEMENTATION )
+#ifdef SIMD_AVX512_IMPLEMENTATION
+    #define SIMD_TEST       SIMD_AVX512
+#endif
+
+#if defined( SIMD_AVX_IMPLEMENTATION ) || defined( SIMD_SSE_IMPLEMENTATION ) || defined( SIMD_AVX512_IMPLEMENTATION )
+
+#define SIMD_BVH_IMPLEMENTATION
+#include "simd/simd_ray_utils.h"
+#include "simd/simd_bbox.h"
+#include "simd/simd_triangle.h"
+#include "simd/simd_line.h"
+#include "simd/simd_planar.h"
+#include "simd/simd_math.h"
+#include "core/mesh.h"
+#include "core/rand.h"
+#include "material/matmanager.h"
+#include "unittest_common.h"
 
 static constexpr float nan_unsigned = 0xffc00000;
 static constexpr float nan_float = *((float*)(&nan_unsigned));
@@ -49,6 +65,16 @@ TEST(SIMD_TEST, simd_set_ps) {
         EXPECT_EQ( simd_data[i] , data[i] );
 }
 
+TEST(SIMD_TEST, simd_set_u8_ps) {
+    unsigned char data[SIMD_CHANNEL];
+    for( auto i = 0 ; i < SIMD_CHANNEL ; ++i )
+        data[i] = (unsigned char)( 255 - 37 * i );
+
+    const auto simd_data = simd_set_u8_ps( data );
+    for( int i = 0 ; i < SIMD_CHANNEL ; ++i )
+        EXPECT_EQ( simd_data[i] , (float)data[i] );
+}
+
 TEST(SIMD_TEST, simd_set_mask) {
     bool data[SIMD_CHANNEL];
     for( auto i = 0 ; i < SIMD_CHANNEL ; ++i )
@@ -495,4 +521,311 @@ TEST(SIMD_TEST, simd_minreduction_ps) {
         EXPECT_EQ( reduction[0] , correct_reduction[0] );
 }
 
+TEST(SIMD_TEST, simd_floor_ps) {
+    float data[SIMD_CHANNEL];
+    for( auto i = 0 ; i < SIMD_CHANNEL ; ++i )
+        data[i] = 1.7f * ( (float)i - 5.5f );
+
+    const auto floored = simd_floor_ps( simd_set_ps( data ) );
+    for( auto i = 0 ; i < SIMD_CHANNEL ; ++i )
+        EXPECT_EQ( floored[i] , floor( data[i] ) );
+}
+
+TEST(SIMD_TEST, simd_exp2i_ps) {
+    float data[SIMD_CHANNEL];
+    for( auto i = 0 ; i < SIMD_CHANNEL ; ++i )
+        data[i] = (float)( 15 * i - 100 );
+
+    const auto e = simd_exp2i_ps( simd_set_ps( data ) );
+    for( auto i = 0 ; i < SIMD_CHANNEL ; ++i )
+        EXPECT_EQ( e[i] , ldexp( 1.0f , (int)data[i] ) );
+}
+
+TEST(SIMD_TEST, simd_frexp_ps) {
+    float data[SIMD_CHANNEL];
+    for( auto i = 0 ; i < SIMD_CHANNEL ; ++i )
+        data[i] = 0.37f * pow( 10.0f , (float)i - 5.0f );
+
+    simd_data e;
+    const auto m = simd_frexp_ps( simd_set_ps( data ) , e );
+    for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+        int exponent;
+        EXPECT_EQ( m[i] , frexp( data[i] , &exponent ) );
+        EXPECT_EQ( e[i] , (float)exponent );
+    }
+}
+
+// All lanes of the vectorized version should match the scalar version in 'math/fastmath.h', whose accuracy is tested
+// against the standard library already.
+template<class VF , class SF>
+static void fastmath_test( const float lo , const float hi , VF vf , SF sf ){
+    constexpr auto cnt = 4096;
+    for( auto k = 0 ; k < cnt ; k += SIMD_CHANNEL ){
+        float data[SIMD_CHANNEL];
+        for( auto i = 0 ; i < SIMD_CHANNEL ; ++i )
+            data[i] = lo + ( hi - lo ) * (float)( k + i ) / (float)cnt;
+
+        const simd_data ret = vf( simd_set_ps( data ) );
+        for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+            const auto expected = sf( data[i] );
+            EXPECT_NEAR( ret[i] , expected , 2e-7f * fabs( expected ) + 1e-7f );
+        }
+    }
+}
+
+TEST(SIMD_TEST, simd_exp_ps) {
+    fastmath_test( -87.0f , 88.0f , []( const simd_data& x ){ return simd_exp_ps( x ); } , []( float x ){ return FastExp( x ); } );
+
+    const auto ret = simd_exp_ps( simd_set_ps1( -100.0f ) );
+    EXPECT_EQ( ret[0] , 0.0f );
+}
+
+TEST(SIMD_TEST, simd_log_ps) {
+    fastmath_test( 1e-6f , 1e3f , []( const simd_data& x ){ return simd_log_ps( x ); } , []( float x ){ return FastLog( x ); } );
+
+    const auto zero = simd_log_ps( simd_zeros );
+    const auto negative = simd_log_ps( simd_neg_ones );
+    EXPECT_TRUE( std::isinf( zero[0] ) && zero[0] < 0.0f );
+    EXPECT_TRUE( std::isnan( negative[0] ) );
+}
+
+TEST(SIMD_TEST, simd_pow_ps) {
+    const auto exponent = 2.7f;
+    fastmath_test( 0.0f , 10.0f , [&]( const simd_data& x ){ return simd_pow_ps( x , simd_set_ps1( exponent ) ); } ,
+                                  [&]( float x ){ return FastPow( x , exponent ); } );
+}
+
+TEST(SIMD_TEST, simd_sincos_ps) {
+    fastmath_test( -100.0f , 100.0f , []( const simd_data& x ){ return simd_sin_ps( x ); } , []( float x ){ return FastSin( x ); } );
+    fastmath_test( -100.0f , 100.0f , []( const simd_data& x ){ return simd_cos_ps( x ); } , []( float x ){ return FastCos( x ); } );
+}
+
+TEST(SIMD_TEST, simd_atan2_ps) {
+    for( const auto x : { -2.0f , -0.5f , 0.0f , 0.5f , 2.0f } ){
+        fastmath_test( -3.0f , 3.0f , [&]( const simd_data& y ){ return simd_atan2_ps( y , simd_set_ps1( x ) ); } ,
+                                      [&]( float y ){ return FastAtan2( y , x ); } );
+    }
+}
+
+TEST(SIMD_TEST, simd_erf_ps) {
+    fastmath_test( -4.0f , 4.0f , []( const simd_data& x ){ return simd_erf_ps( x ); } , []( float x ){ return FastErf( x ); } );
+}
+
+// Throughput of the kernels tested against all primitives packed in a single data structure, it is the same in the
+// leaves of QBVH/OBVH/HBVH. The numbers of different ISAs are directly comparable, each call processes SIMD_CHANNEL
+// primitives.
+//! @brief  Quads and disks with random placements, one channel is left empty.
+static void createPlanars( std::vector<std::unique_ptr<Shape>>& shapes , std::vector<std::unique_ptr<Primitive>>& primitives , Simd_Planar& planars ){
+    for( auto i = 0 ; i < SIMD_CHANNEL - 1 ; ++i ){
+        const auto transform = Translate( sort_canonical() , sort_canonical() , sort_canonical() ) * RotateX( 360.0f * sort_canonical() ) * RotateZ( 360.0f * sort_canonical() );
+        if( i % 2 ){
+            auto disk = std::make_unique<Disk>();
+            disk->SetRadius( 0.1f + 0.2f * sort_canonical() );
+            shapes.push_back( std::move( disk ) );
+        }else{
+            auto quad = std::make_unique<Quad>();
+            quad->SetSizeX( 0.1f + 0.4f * sort_canonical() );
+            quad->SetSizeY( 0.1f + 0.4f * sort_canonical() );
+            shapes.push_back( std::move( quad ) );
+        }
+        shapes.back()->SetTransform( transform );
+        primitives.push_back( std::make_unique<Primitive>( nullptr , MatManager::GetSingleton().GetDefaultMat() , shapes.back().get() ) );
+        planars.PushPlanar( primitives.back().get() );
+    }
+    planars.PackData();
+}
+
+TEST(SIMD_TEST, intersectPlanar_SIMD) {
+    std::vector<std::unique_ptr<Shape>> shapes;
+    std::vector<std::unique_ptr<Primitive>> primitives;
+    auto planars = std::make_unique<Simd_Planar>();
+    createPlanars( shapes , primitives , *planars );
+
+    for( auto i = 0 ; i < 4096 ; ++i ){
+        const auto ori = Point( 2.0f * sort_canonical() - 0.5f , 2.0f * sort_canonical() - 0.5f , 2.0f * sort_canonical() - 0.5f );
+        const auto target = Point( sort_canonical() , sort_canonical() , sort_canonical() );
+        Ray ray( ori , normalize( target - ori ) );
+        ray.Prepare();
+        Simd_Ray_Data simd_ray;
+        resolveRayData( ray , simd_ray );
+
+        SurfaceInteraction expected;
+        auto hit = false;
+        for( const auto& primitive : primitives )
+            hit |= primitive->GetIntersect( ray , &expected );
+
+        SurfaceInteraction intersection;
+        EXPECT_EQ( hit , intersectPlanar_SIMD( ray , simd_ray , *planars , &intersection ) );
+        EXPECT_EQ( hit , intersectPlanarFast_SIMD( ray , simd_ray , *planars ) );
+        if( !hit )
+            continue;
+
+        EXPECT_EQ( expected.primitive , intersection.primitive );
+        EXPECT_NEAR( expected.t , intersection.t , 1e-4f );
+        EXPECT_NEAR( expected.normal.x , intersection.normal.x , 1e-4f );
+        EXPECT_NEAR( expected.normal.y , intersection.normal.y , 1e-4f );
+        EXPECT_NEAR( expected.normal.z , intersection.normal.z , 1e-4f );
+        EXPECT_NEAR( expected.tangent.x , intersection.tangent.x , 1e-4f );
+        EXPECT_NEAR( expected.tangent.y , intersection.tangent.y , 1e-4f );
+        EXPECT_NEAR( expected.tangent.z , intersection.tangent.z , 1e-4f );
+    }
+}
+
+TEST(SIMD_TEST, intersectTriangle_SIMD) {
+    MeshVisual visual;
+    visual.m_memory = std::make_unique<Mesh>();
+    for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+        MeshFaceIndex index;
+        for( auto k = 0 ; k < 3 ; ++k ){
+            MeshVertex vertex;
+            vertex.m_normal = normalize( Vector( sort_canonical() , 1.0f , sort_canonical() ) );
+            vertex.m_tangent = Vector( 1.0f , 0.0f , 0.0f );
+            vertex.m_texCoord = Vector2f( sort_canonical() , sort_canonical() );
+            index.m_id[k] = (int)visual.m_memory->m_positions.size();
+            visual.m_memory->m_positions.push_back( Point( sort_canonical() , sort_canonical() , sort_canonical() ) );
+            visual.m_memory->m_vertices.push_back( vertex );
+        }
+        index.m_mat = MatManager::GetSingleton().GetDefaultMat();
+        visual.m_memory->m_indices.push_back( index );
+    }
+    const auto& primitives = visual.CreatePrimitives();
+    auto triangles = std::make_unique<Simd_Triangle>();
+    for( const auto& primitive : primitives )
+        triangles->PushTriangle( &primitive );
+    triangles->PackData();
+
+    for( auto i = 0 ; i < 4096 ; ++i ){
+        const auto ori = Point( 2.0f * sort_canonical() - 0.5f , 2.0f * sort_canonical() - 0.5f , 2.0f * sort_canonical() - 0.5f );
+        const auto target = Point( sort_canonical() , sort_canonical() , sort_canonical() );
+        Ray ray( ori , normalize( target - ori ) );
+        ray.Prepare();
+        Simd_Ray_Data simd_ray;
+        resolveRayData( ray , simd_ray );
+
+        SurfaceInteraction expected;
+        auto hit = false;
+        for( const auto& primitive : primitives )
+            hit |= primitive.GetIntersect( ray , &expected );
+
+        // the hit only carries the distance and the barycentric coordinate until it is finalized
+        SurfaceInteraction intersection;
+        EXPECT_EQ( hit , intersectTriangle_SIMD( ray , simd_ray , *triangles , &intersection ) );
+        if( !hit )
+            continue;
+        EXPECT_TRUE( intersection.pending );
+        FinalizeInteraction( ray , intersection );
+
+        EXPECT_EQ( expected.primitive , intersection.primitive );
+        EXPECT_NEAR( expected.t , intersection.t , 1e-4f );
+        EXPECT_NEAR( expected.u , intersection.u , 1e-3f );
+        EXPECT_NEAR( expected.v , intersection.v , 1e-3f );
+        EXPECT_NEAR( expected.normal.x , intersection.normal.x , 1e-3f );
+        EXPECT_NEAR( expected.normal.y , intersection.normal.y , 1e-3f );
+        EXPECT_NEAR( expected.normal.z , intersection.normal.z , 1e-3f );
+        EXPECT_NEAR( expected.dpdu.x , intersection.dpdu.x , 1e-3f * ( 1.0f + fabs( expected.dpdu.x ) ) );
+        EXPECT_NEAR( expected.dpdv.y , intersection.dpdv.y , 1e-3f * ( 1.0f + fabs( expected.dpdv.y ) ) );
+    }
+}
+
+TEST(SIMD_TEST, DISABLED_Benchmark) {
+    constexpr unsigned ray_cnt = 1024;
+    constexpr unsigned ray_mask = ray_cnt - 1;
+
+    // rays are shot from a sphere around the unit cube toward its interior
+    std::vector<Ray> rays( ray_cnt );
+    std::vector<Simd_Ray_Data> simd_rays( ray_cnt );
+    for( auto i = 0u ; i < ray_cnt ; ++i ){
+        const auto z = 1.0f - 2.0f * sort_canonical();
+        const auto r = sqrt( std::max( 0.0f , 1.0f - z * z ) );
+        const auto phi = TWO_PI * sort_canonical();
+        const auto ori = Point( 0.5f ) + Vector( r * cos( phi ) , r * sin( phi ) , z ) * 2.0f;
+        const auto target = Point( sort_canonical() , sort_canonical() , sort_canonical() );
+        rays[i] = Ray( ori , normalize( target - ori ) );
+        rays[i].Prepare();
+        resolveRayData( rays[i] , simd_rays[i] );
+    }
+
+    float min_x[SIMD_CHANNEL] , min_y[SIMD_CHANNEL] , min_z[SIMD_CHANNEL];
+    float max_x[SIMD_CHANNEL] , max_y[SIMD_CHANNEL] , max_z[SIMD_CHANNEL];
+    bool  mask[SIMD_CHANNEL];
+    for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+        min_x[i] = 0.5f * sort_canonical(); max_x[i] = min_x[i] + 0.5f;
+        min_y[i] = 0.5f * sort_canonical(); max_y[i] = min_y[i] + 0.5f;
+        min_z[i] = 0.5f * sort_canonical(); max_z[i] = min_z[i] + 0.5f;
+        mask[i] = true;
+    }
+    Simd_BBox bbox;
+    bbox.m_min_x = simd_set_ps( min_x ); bbox.m_max_x = simd_set_ps( max_x );
+    bbox.m_min_y = simd_set_ps( min_y ); bbox.m_max_y = simd_set_ps( max_y );
+    bbox.m_min_z = simd_set_ps( min_z ); bbox.m_max_z = simd_set_ps( max_z );
+    bbox.m_mask = simd_set_mask( mask );
+
+    MeshVisual visual;
+    visual.m_memory = std::make_unique<Mesh>();
+    for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+        MeshFaceIndex index;
+        for( auto k = 0 ; k < 3 ; ++k ){
+            MeshVertex vertex;
+            vertex.m_normal = Vector( 0.0f , 1.0f , 0.0f );
+            vertex.m_tangent = Vector( 1.0f , 0.0f , 0.0f );
+            index.m_id[k] = (int)visual.m_memory->m_positions.size();
+            visual.m_memory->m_positions.push_back( Point( sort_canonical() , sort_canonical() , sort_canonical() ) );
+            visual.m_memory->m_vertices.push_back( vertex );
+        }
+        index.m_mat = MatManager::GetSingleton().GetDefaultMat();
+        visual.m_memory->m_indices.push_back( index );
+    }
+    auto triangles = std::make_unique<Simd_Triangle>();
+    for( const auto& primitive : visual.CreatePrimitives() )
+        triangles->PushTriangle( &primitive );
+    triangles->PackData();
+
+    std::vector<std::unique_ptr<Line>> line_shapes;
+    std::vector<std::unique_ptr<Primitive>> line_primitives;
+    auto lines = std::make_unique<Simd_Line>();
+    for( auto i = 0 ; i < SIMD_CHANNEL ; ++i ){
+        const auto p0 = Point( sort_canonical() , 0.0f , sort_canonical() );
+        const auto p1 = Point( sort_canonical() , 1.0f , sort_canonical() );
+        line_shapes.push_back( std::make_unique<Line>( p0 , p1 , 0.0f , 1.0f , 0.05f , 0.02f , 0 ) );
+        line_shapes.back()->SetTransform( Transform() );
+        line_primitives.push_back( std::make_unique<Primitive>( nullptr , MatManager::GetSingleton().GetDefaultMat() , line_shapes.back().get() ) );
+        lines->PushLine( line_primitives.back().get() );
+    }
+    lines->PackData();
+
+    std::vector<std::unique_ptr<Shape>> planar_shapes;
+    std::vector<std::unique_ptr<Primitive>> planar_primitives;
+    auto planars = std::make_unique<Simd_Planar>();
+    createPlanars( planar_shapes , planar_primitives , *planars );
+
+    slog( INFO , PERFORMANCE , "SIMD kernels with %d channels." , SIMD_CHANNEL );
+    MeasureThroughput( "IntersectBBox_SIMD" , [&]( unsigned long long i ){
+        simd_data f_min;
+        return IntersectBBox_SIMD( rays[i & ray_mask] , simd_rays[i & ray_mask] , bbox , f_min );
+    });
+    MeasureThroughput( "intersectTriangleFast_SIMD" , [&]( unsigned long long i ){
+        return intersectTriangleFast_SIMD( rays[i & ray_mask] , simd_rays[i & ray_mask] , *triangles );
+    });
+    MeasureThroughput( "intersectTriangle_SIMD" , [&]( unsigned long long i ){
+        SurfaceInteraction intersection;
+        return intersectTriangle_SIMD( rays[i & ray_mask] , simd_rays[i & ray_mask] , *triangles , &intersection );
+    });
+    MeasureThroughput( "intersectLineFast_SIMD" , [&]( unsigned long long i ){
+        return intersectLineFast_SIMD( rays[i & ray_mask] , simd_rays[i & ray_mask] , *lines );
+    });
+    MeasureThroughput( "intersectLine_SIMD" , [&]( unsigned long long i ){
+        SurfaceInteraction intersection;
+        return intersectLine_SIMD( rays[i & ray_mask] , simd_rays[i & ray_mask] , *lines , &intersection );
+    });
+    MeasureThroughput( "intersectPlanarFast_SIMD" , [&]( unsigned long long i ){
+        return intersectPlanarFast_SIMD( rays[i & ray_mask] , simd_rays[i & ray_mask] , *planars );
+    });
+    MeasureThroughput( "intersectPlanar_SIMD" , [&]( unsigned long long i ){
+        SurfaceInteraction intersection;
+        return intersectPlanar_SIMD( rays[i & ray_mask] , simd_rays[i & ray_mask] , *planars , &intersection );
+    });
+}
+
+#undef SIMD_BVH_IMPLEMENTATION
+
 #endif
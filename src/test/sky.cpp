@@ -0,0 +1,86 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "thirdparty/gtest/gtest.h"
+#include "unittest_common.h"
+#include "math/sky.h"
+#include "core/samplemethod.h"
+
+namespace {
+    // A daylight sky with a glossy lobe pointing close to the sun.
+    void makeSky( Sky& sky , VMFLobe& lobe , float sunStrength ){
+        SkyModel model;
+        model.sunDir = normalize( Vector( 0.3f , 0.8f , 0.2f ) );
+        model.sunStrength = sunStrength;
+        sky.Bake( model );
+
+        lobe.axis = normalize( Vector( 0.35f , 0.75f , 0.25f ) );
+        lobe.kappa = 200.0f;
+        lobe.weight = 1.0f;
+    }
+}
+
+// The pdf of product sampling needs to integrate to one over the sphere.
+TEST(SKY, ProductPdf) {
+    Sky sky;
+    VMFLobe lobe;
+    makeSky( sky , lobe , 0.0f );
+
+    // The lobe is too sharp for uniform random directions to converge quickly. The pdf is constant in each texel of the
+    // baked sky, which is 512 by 256, integrating it in cells aligned with the texels is exact.
+    constexpr int NU = 1024 , NV = 512;
+    auto total = 0.0;
+    for( auto i = 0 ; i < NV ; ++i ){
+        const auto theta = PI * ( (float)i + 0.5f ) / (float)NV;
+        const auto solid_angle = TWO_PI / (float)NU * ( cos( PI * (float)i / (float)NV ) - cos( PI * (float)( i + 1 ) / (float)NV ) );
+        for( auto j = 0 ; j < NU ; ++j ){
+            const auto phi = TWO_PI * ( (float)j + 0.5f ) / (float)NU;
+            total += sky.Pdf( sphericalVec( theta , phi ) , lobe ) * solid_angle;
+        }
+    }
+    EXPECT_NEAR( total , 1.0 , 0.001 );
+}
+
+// Directions sampled with the lobe need to be consistent with their pdf, which is the only way to be unbiased.
+TEST(SKY, ProductSampling) {
+    Sky sky;
+    VMFLobe lobe;
+    makeSky( sky , lobe , 1.0f );
+
+    // every direction is reachable, the expected inverse pdf is the area of the sphere
+    const auto area = ParrallReduction<double, 8, 1024 * 64>( [&](){
+        auto pdf = 0.0f;
+        const auto wi = sky.sample_v( sort_canonical() , sort_canonical() , lobe , &pdf );
+        if( pdf <= 0.0f )
+            return 0.0f;
+        EXPECT_NEAR( pdf , sky.Pdf( wi , lobe ) , pdf * 1e-4f );
+        return 1.0f / pdf;
+    } );
+    EXPECT_NEAR( area , 4.0 * PI , 0.04 * PI );
+
+    // the product of the sky and the lobe is estimated the same, no matter whether the lobe guides the samples
+    const auto product = [&]( bool guided ){
+        return ParrallReduction<double, 8, 1024 * 64>( [&](){
+            auto pdf = 0.0f;
+            const auto wi = guided ? sky.sample_v( sort_canonical() , sort_canonical() , lobe , &pdf ) :
+                                     sky.sample_v( sort_canonical() , sort_canonical() , &pdf , nullptr );
+            return pdf > 0.0f ? sky.Evaluate( wi ).GetIntensity() * lobe.Evaluate( wi ) / pdf : 0.0f;
+        } );
+    };
+    const auto expected = product( false );
+    EXPECT_NEAR( product( true ) , expected , expected * 0.02 );
+}
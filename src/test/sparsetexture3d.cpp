@@ -0,0 +1,259 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include "thirdparty/gtest/gtest.h"
+#include "stream/mstream.h"
+#include "texture/imagetexture3d.h"
+#include "texture/sparsetexture3d.h"
+#include "core/rand.h"
+
+namespace {
+    // Dense texture as the reference.
+    class DenseTexture3D : public ImageTexture3D<float> {
+    public:
+        DenseTexture3D( const std::vector<float>& texels , unsigned w , unsigned h , unsigned d ){
+            m_width = w;
+            m_height = h;
+            m_depth = d;
+            setTexels( texels.data() );
+        }
+    };
+
+    // Smoke-like density, a few blobs in an empty volume, with a constant block in the middle.
+    std::vector<float> makeTexels( unsigned w , unsigned h , unsigned d ){
+        std::vector<float> texels( w * h * d , 0.0f );
+        for( auto z = 0u ; z < d ; ++z )
+            for( auto y = 0u ; y < h ; ++y )
+                for( auto x = 0u ; x < w ; ++x ){
+                    const auto dx = x / (float)w - 0.3f , dy = y / (float)h - 0.4f , dz = z / (float)d - 0.5f;
+                    if( dx * dx + dy * dy + dz * dz < 0.04f )
+                        texels[ ( z * h + y ) * w + x ] = sort_canonical() * 3.0f;
+                    else if( x >= 24 && x < 32 && y >= 8 && y < 16 && z >= 16 && z < 24 )
+                        texels[ ( z * h + y ) * w + x ] = 0.5f;
+                }
+        return texels;
+    }
+
+    // Stream the texels in bricks, the same way the exporter does.
+    void makeSparseTexture( SparseTexture3D& tex , const std::vector<float>& texels , unsigned w , unsigned h , unsigned d , VolumeQuantization quantization ){
+        const auto bs = SparseTexture3D::BRICK_SIZE;
+        const unsigned res[3] = { ( w + bs - 1 ) / bs , ( h + bs - 1 ) / bs , ( d + bs - 1 ) / bs };
+
+        // gather the non-empty bricks first, the number of bricks goes before them
+        std::vector<std::vector<float>> bricks;
+        std::vector<unsigned> coords;
+        for( auto bz = 0u ; bz < res[2] ; ++bz )
+            for( auto by = 0u ; by < res[1] ; ++by )
+                for( auto bx = 0u ; bx < res[0] ; ++bx ){
+                    std::vector<float> brick;
+                    for( auto z = bz * bs ; z < ( bz + 1 ) * bs ; ++z )
+                        for( auto y = by * bs ; y < ( by + 1 ) * bs ; ++y )
+                            for( auto x = bx * bs ; x < ( bx + 1 ) * bs ; ++x )
+                                brick.push_back( ( x < w && y < h && z < d ) ? texels[ ( z * h + y ) * w + x ] : 0.0f );
+                    if( *std::max_element( brick.begin() , brick.end() ) == 0.0f )
+                        continue;
+                    bricks.push_back( brick );
+                    coords.insert( coords.end() , { bx , by , bz } );
+                }
+
+        IMemoryStream istream(0u);
+        istream << w << h << d << (unsigned)quantization << (unsigned)bricks.size();
+        for( auto i = 0u ; i < bricks.size() ; ++i ){
+            auto& brick = bricks[i];
+            const auto min_value = *std::min_element( brick.begin() , brick.end() );
+            const auto max_value = *std::max_element( brick.begin() , brick.end() );
+            istream << coords[3 * i] << coords[3 * i + 1] << coords[3 * i + 2] << min_value << max_value;
+            if( min_value < max_value )
+                istream.Write( (char*)brick.data() , (int)( sizeof(float) * brick.size() ) );
+        }
+
+        OMemoryStream ostream( istream );
+        tex.Serialize( ostream );
+    }
+
+    // A position inside the texture away from the border, where the dense texture doesn't clamp texels.
+    float interior( unsigned size ){
+        return ( 0.5f + sort_canonical() * ( size - 1.0f ) ) / size;
+    }
+
+    template<class T>
+    void put( std::vector<char>& data , size_t offset , T value ){
+        memcpy( data.data() + offset , &value , sizeof( T ) );
+    }
+
+    void putCoord( std::vector<char>& data , size_t offset , int x , int y , int z ){
+        put( data , offset , x );
+        put( data , offset + 4 , y );
+        put( data , offset + 8 , z );
+    }
+
+    // Write a NanoVDB file of a float grid with two leaves and a tile of the lower internal node, all in the first upper
+    // internal node. The layout is the same as NanoVDB 32.3, only fields read by the texture are filled.
+    void writeNanoVDB( const std::string& filename , const float (&leaves)[2][512] ){
+        const size_t tree = 672 , root = tree + 64 , upper = root + 64 + 32 , lower = upper + 270400 , leaf = lower + 33856;
+        std::vector<char> grid( leaf + 2 * 2144 , 0 );
+        put( grid , 0 , 0x304244566f6e614eull );
+        put( grid , 636 , 1u );
+
+        put( grid , tree , (std::uint64_t)( leaf - tree ) );
+        put( grid , tree + 8 , (std::uint64_t)( lower - tree ) );
+        put( grid , tree + 16 , (std::uint64_t)( upper - tree ) );
+        put( grid , tree + 24 , (std::uint64_t)( root - tree ) );
+        put( grid , tree + 32 , 2u );
+        put( grid , tree + 36 , 1u );
+        put( grid , tree + 40 , 1u );
+
+        // the root has one child, which is the upper internal node
+        putCoord( grid , root , 20 , 8 , 0 );
+        putCoord( grid , root + 12 , 39 , 31 , 23 );
+        put( grid , root + 24 , 1u );
+        put( grid , root + 64 + 8 , (std::int64_t)( upper - root ) );
+
+        putCoord( grid , upper , 20 , 8 , 0 );
+        put( grid , upper + 32 + 4096 , 1ull );
+
+        // leaves at (16,8,0) and (24,16,8), a tile of 0.5 at (32,24,16)
+        putCoord( grid , lower , 20 , 8 , 0 );
+        const unsigned children[2] = { ( 2 << 8 ) | ( 1 << 4 ) , ( 3 << 8 ) | ( 2 << 4 ) | 1 };
+        for( const auto n : children )
+            grid[lower + 32 + 512 + n / 8] |= (char)( 1 << ( n % 8 ) );
+        put( grid , lower + 1088 + 8 * ( ( 4 << 8 ) | ( 3 << 4 ) | 2 ) , 0.5f );
+
+        putCoord( grid , leaf , 20 , 8 , 0 );
+        putCoord( grid , leaf + 2144 , 24 , 16 , 8 );
+        for( auto k = 0 ; k < 2 ; ++k )
+            memcpy( grid.data() + leaf + 2144 * k + 96 , leaves[k] , sizeof( leaves[k] ) );
+
+        std::vector<char> header( 16 + 176 + 8 , 0 );
+        put( header , 0 , 0x304244566f6e614eull );
+        put( header , 8 , ( 32u << 21 ) | ( 3u << 10 ) | 3u );
+        put( header , 12 , (std::uint16_t)1 );
+        put( header , 16 , (std::uint64_t)grid.size() );
+        put( header , 16 + 8 , (std::uint64_t)grid.size() );
+        put( header , 16 + 32 , 1u );
+        put( header , 16 + 136 , 8u );
+        memcpy( header.data() + 16 + 176 , "density" , 8 );
+
+        std::ofstream file( filename , std::ios::binary );
+        file.write( header.data() , header.size() );
+        file.write( grid.data() , grid.size() );
+    }
+
+    void compare( VolumeQuantization quantization , float tolerance ){
+        const unsigned w = 45 , h = 30 , d = 38;
+        const auto texels = makeTexels( w , h , d );
+        const DenseTexture3D dense( texels , w , h , d );
+        SparseTexture3D sparse;
+        makeSparseTexture( sparse , texels , w , h , d , quantization );
+
+        for( auto z = 0 ; z < (int)d ; ++z )
+            for( auto y = 0 ; y < (int)h ; ++y )
+                for( auto x = 0 ; x < (int)w ; ++x )
+                    EXPECT_NEAR( dense.Sample( x , y , z ) , sparse.Sample( x , y , z ) , tolerance );
+
+        for( auto i = 0 ; i < 4096 ; ++i ){
+            const auto u = interior( w ) , v = interior( h ) , t = interior( d );
+            EXPECT_NEAR( dense.Sample( u , v , t ) , sparse.Sample( u , v , t ) , tolerance );
+        }
+
+        // out of range samples are always zero
+        EXPECT_EQ( 0.0f , sparse.Sample( -1 , 0 , 0 ) );
+        EXPECT_EQ( 0.0f , sparse.Sample( 0.5f , 1.0f , 0.5f ) );
+    }
+}
+
+TEST(SPARSE_TEXTURE3D, Float) {
+    compare( VOLUME_QUANTIZATION_FLOAT , 1e-6f );
+}
+
+TEST(SPARSE_TEXTURE3D, Half) {
+    // half floating point has 11 bits of precision, texels are below 4.0
+    compare( VOLUME_QUANTIZATION_HALF , 4.0f / 2048.0f );
+}
+
+TEST(SPARSE_TEXTURE3D, Byte) {
+    // texels are quantized in the range of each brick, which is at most 3.0
+    compare( VOLUME_QUANTIZATION_BYTE , 3.0f / 255.0f );
+}
+
+// Empty bricks and constant bricks don't take any texel memory.
+TEST(SPARSE_TEXTURE3D, Memory) {
+    const unsigned w = 64 , h = 64 , d = 64;
+    std::vector<float> texels( w * h * d , 0.0f );
+    for( auto z = 16u ; z < 24u ; ++z )
+        for( auto y = 8u ; y < 16u ; ++y )
+            for( auto x = 0u ; x < 8u ; ++x )
+                texels[ ( z * h + y ) * w + x ] = 2.0f;
+    texels[ ( 40 * h + 40 ) * w + 40 ] = 1.0f;
+
+    SparseTexture3D tex;
+    makeSparseTexture( tex , texels , w , h , d , VOLUME_QUANTIZATION_HALF );
+    EXPECT_EQ( SparseTexture3D::BRICK_TEXEL_CNT * sizeof( std::uint16_t ) , tex.GetTexelMemory() );
+    EXPECT_EQ( 2.0f , tex.Sample( 3 , 12 , 20 ) );
+    EXPECT_EQ( 1.0f , tex.Sample( 40 , 40 , 40 ) );
+    EXPECT_EQ( 0.0f , tex.Sample( 41 , 40 , 40 ) );
+
+    const auto brick_max = tex.GetBrickMaximum();
+    EXPECT_EQ( 2.0f , brick_max[ ( 2 * 8 + 1 ) * 8 + 0 ] );
+    EXPECT_EQ( 1.0f , brick_max[ ( 5 * 8 + 5 ) * 8 + 5 ] );
+    EXPECT_EQ( 0.0f , brick_max[ 0 ] );
+}
+
+// Leaves of NanoVDB are loaded as bricks, tiles become constant bricks.
+TEST(SPARSE_TEXTURE3D, NanoVDB) {
+    float leaves[2][512];
+    for( auto k = 0 ; k < 2 ; ++k )
+        for( auto n = 0 ; n < 512 ; ++n )
+            leaves[k][n] = ( n % 3 ) ? sort_canonical() * 2.0f : 0.0f;
+
+    const std::string filename = "sparse_texture3d_test.nvdb";
+    writeNanoVDB( filename , leaves );
+
+    SparseTexture3D tex;
+    ASSERT_TRUE( tex.LoadNanoVDB( filename , VOLUME_QUANTIZATION_FLOAT ) );
+    std::remove( filename.c_str() );
+
+    // the texture starts from (16,8,0), the minimum of the bounding box rounded down to a brick
+    for( auto i = 0 ; i < 3 ; ++i )
+        EXPECT_EQ( 3u , tex.GetBrickResolution( i ) );
+    EXPECT_TRUE( tex.IsValid() );
+    for( auto z = 0 ; z < 24 ; ++z )
+        for( auto y = 0 ; y < 24 ; ++y )
+            for( auto x = 0 ; x < 24 ; ++x ){
+                auto expected = 0.0f;
+                const auto n = ( ( x % 8 ) << 6 ) | ( ( y % 8 ) << 3 ) | ( z % 8 );
+                if( x < 8 && y < 8 && z < 8 )
+                    expected = leaves[0][n];
+                else if( x >= 8 && x < 16 && y >= 8 && y < 16 && z >= 8 && z < 16 )
+                    expected = leaves[1][n];
+                else if( x >= 16 && y >= 16 && z >= 16 )
+                    expected = 0.5f;
+                EXPECT_EQ( expected , tex.Sample( x , y , z ) );
+            }
+
+    // only the two leaves take texel memory
+    EXPECT_EQ( 2 * SparseTexture3D::BRICK_TEXEL_CNT * sizeof( float ) , tex.GetTexelMemory() );
+
+    SparseTexture3D missing;
+    EXPECT_FALSE( missing.LoadNanoVDB( filename , VOLUME_QUANTIZATION_FLOAT ) );
+    EXPECT_FALSE( missing.IsValid() );
+}
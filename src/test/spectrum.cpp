@@ -0,0 +1,108 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "thirdparty/gtest/gtest.h"
+#include "spectrum/spectrum.h"
+#include "spectrum/sampledspectrum.h"
+#include "core/rand.h"
+#include "unittest_common.h"
+
+// Arithmetic of the padded color has to match the plain per-channel math.
+TEST(SPECTRUM, RGB_ARITHMETIC) {
+    const RGBSpectrum a( 1.0f , 2.0f , 3.0f ) , b( 4.0f , 5.0f , 6.0f );
+    const auto c = ( a + b ) * 2.0f - a / b;
+    EXPECT_FLOAT_EQ( c.r , 10.0f - 0.25f );
+    EXPECT_FLOAT_EQ( c.g , 14.0f - 0.4f );
+    EXPECT_FLOAT_EQ( c.b , 18.0f - 0.5f );
+
+    auto d = a;
+    d *= b;
+    d += 1.0f;
+    EXPECT_FLOAT_EQ( d.r , 5.0f );
+    EXPECT_FLOAT_EQ( d.g , 11.0f );
+    EXPECT_FLOAT_EQ( d.b , 19.0f );
+
+    const auto e = RGBSpectrum( -1.0f , 0.5f , 3.0f ).Clamp( 0.0f , 1.0f );
+    EXPECT_EQ( e.r , 0.0f );
+    EXPECT_EQ( e.g , 0.5f );
+    EXPECT_EQ( e.b , 1.0f );
+    EXPECT_FLOAT_EQ( e.GetMaxComponent() , 1.0f );
+}
+
+// Exponential is accurate in the whole range and underflows to exact black.
+TEST(SPECTRUM, RGB_EXP) {
+    for( auto x = -80.0f ; x < 80.0f ; x += 0.37f ){
+        const auto e = RGBSpectrum( x , -x , 0.5f * x ).Exp();
+        EXPECT_NEAR( e.r , std::exp( x ) , 1e-6f * std::exp( x ) );
+        EXPECT_NEAR( e.g , std::exp( -x ) , 1e-6f * std::exp( -x ) );
+        EXPECT_NEAR( e.b , std::exp( 0.5f * x ) , 1e-6f * std::exp( 0.5f * x ) );
+    }
+    EXPECT_TRUE( RGBSpectrum( -200.0f ).Exp().IsBlack() );
+}
+
+// Hero wavelengths cover the visible range with a quarter of the range between each other.
+TEST(SPECTRUM, HERO_WAVELENGTHS) {
+    for( auto i = 0 ; i < 256 ; ++i ){
+        const auto wl = SampledWavelengths::SampleHero( sort_canonical() );
+        for( auto k = 0 ; k < SAMPLED_SPECTRUM_SAMPLE ; ++k ){
+            EXPECT_GE( wl.lambda[k] , SPECTRAL_LAMBDA_MIN );
+            EXPECT_LT( wl.lambda[k] , SPECTRAL_LAMBDA_MAX );
+        }
+        EXPECT_FLOAT_EQ( wl.pdf , 1.0f / ( SPECTRAL_LAMBDA_MAX - SPECTRAL_LAMBDA_MIN ) );
+    }
+}
+
+// Upsampling a color and estimating its color back should converge to the original color.
+TEST(SPECTRUM, SPECTRAL_ROUND_TRIP) {
+    constexpr int N = 1024 * 64;
+    const RGBSpectrum colors[] = { RGBSpectrum( 0.5f ) , RGBSpectrum( 1.0f ) , RGBSpectrum( 0.8f , 0.3f , 0.1f ) };
+    for( const auto& color : colors ){
+        RGBSpectrum sum;
+        for( auto i = 0 ; i < N ; ++i ){
+            const auto wl = SampledWavelengths::SampleHero( sort_canonical() );
+            sum += SampledSpectrum::FromRGB( color , wl ).ToRGB( wl );
+        }
+        sum /= (float)N;
+        EXPECT_NEAR( sum.r , color.r , 0.05f );
+        EXPECT_NEAR( sum.g , color.g , 0.05f );
+        EXPECT_NEAR( sum.b , color.b , 0.05f );
+    }
+}
+
+TEST(SPECTRUM, DISABLED_Benchmark) {
+    std::vector<RGBSpectrum> colors( 1024 );
+    for( auto& c : colors )
+        c = RGBSpectrum( sort_canonical() , sort_canonical() , sort_canonical() );
+    const auto wl = SampledWavelengths::SampleHero( 0.5f );
+
+    slog( INFO , PERFORMANCE , "Spectrum." );
+    MeasureThroughput( "RGBSpectrum arithmetic" , [&]( unsigned long long i ){
+        const auto& a = colors[i & 1023];
+        const auto& b = colors[( i + 1 ) & 1023];
+        return ( ( a + b ) * 2.0f - a * b ).GetMaxComponent();
+    });
+    MeasureThroughput( "RGBSpectrum::Exp" , [&]( unsigned long long i ){
+        return colors[i & 1023].Exp().GetIntensity();
+    });
+    MeasureThroughput( "SampledSpectrum::FromRGB" , [&]( unsigned long long i ){
+        return SampledSpectrum::FromRGB( colors[i & 1023] , wl ).Average();
+    });
+    MeasureThroughput( "SampledSpectrum arithmetic" , [&]( unsigned long long i ){
+        const auto s = SampledSpectrum::FromRGB( colors[i & 1023] , wl );
+        return ( s * s + s * 0.5f ).Average();
+    });
+}
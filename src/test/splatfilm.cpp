@@ -0,0 +1,55 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+*/
+
+#include "thirdparty/gtest/gtest.h"
+#include "unittest_common.h"
+#include "imagesensor/splatfilm.h"
+
+// Each thread splats to every pixel of its own replica, the resolved image should see all of them.
+TEST(SPLATFILM, Resolve) {
+    constexpr int W = 100;
+    constexpr int H = 70;
+    constexpr int TN = 8;
+    constexpr int N = 16;
+
+    SplatFilm film( W , H , TN );
+    ParrallRun<TN, N>( [&]( int tid ){
+        for( auto y = 0 ; y < H ; ++y )
+            for( auto x = 0 ; x < W ; ++x )
+                film.Splat( tid , x , y , 1.0f );
+    } );
+
+    RenderTarget rt( W , H );
+    rt.SetColor( 3 , 5 , 1.0f );
+    film.Resolve( rt , 0.5f );
+
+    for( auto y = 0 ; y < H ; ++y )
+        for( auto x = 0 ; x < W ; ++x )
+            EXPECT_EQ( rt.GetColor( x , y ).r , ( x == 3 && y == 5 ? 1.0f : 0.0f ) + 0.5f * TN * N );
+}
+
+// Untouched blocks are never allocated and leave the image unchanged.
+TEST(SPLATFILM, Sparse) {
+    SplatFilm film( 256 , 256 , 4 );
+    film.Splat( 2 , 200 , 17 , 2.0f );
+
+    RenderTarget rt( 256 , 256 );
+    film.Resolve( rt , 1.0f );
+
+    EXPECT_EQ( rt.GetColor( 200 , 17 ).r , 2.0f );
+    EXPECT_EQ( rt.GetColor( 17 , 200 ).r , 0.0f );
+}
@@ -17,12 +17,12 @@
 
 #include "core/define.h"
 
-#ifdef SSE_ENABLED
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
 #define SIMD_SSE_IMPLEMENTATION
 #endif
 
 #include "simd.hpp"
 
-#ifdef SSE_ENABLED
+#if defined(SSE_ENABLED) || defined(NEON_ENABLED)
 #undef SIMD_SSE_IMPLEMENTATION
 #endif
\ No newline at end of file
@@ -15,9 +15,14 @@
     this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
 */
 
+#include <thread>
 #include "thirdparty/gtest/gtest.h"
 #include "stream/fstream.h"
 #include "stream/mstream.h"
+#include "stream/mapstream.h"
+#include "stream/pstream.h"
+#include "stream/sstream.h"
+#include "core/strid.h"
 #include "core/rand.h"
 
 #define STREAM_SAMPLE_COUNT 10000
@@ -63,6 +68,191 @@ TEST(STREAM, FileStream) {
     }
 }
 
+TEST(STREAM, MappedFileStream) {
+    std::vector<float>           vec_f;
+    std::vector<int>             vec_i;
+    OFileStream ofile("test_mapped.bin");
+    std::string str = "this is a random string";
+    ofile<<str;
+    bool flag = true;
+    ofile<<flag;
+    std::string empty_str = "";
+    ofile<<empty_str;
+    for (unsigned i = 0; i < STREAM_SAMPLE_COUNT; ++i) {
+        vec_f.push_back( sort_canonical() );
+        vec_i.push_back( (int)( ( 2.0f * sort_canonical() - 1.0f ) * STREAM_SAMPLE_COUNT ) );
+        ofile << vec_f.back();
+    }
+    for (unsigned i = 0; i < STREAM_SAMPLE_COUNT; ++i)
+        ofile << vec_i[i];
+    ofile.Close();
+
+    IMappedFileStream ifile("test_mapped.bin");
+    EXPECT_TRUE( ifile.IsValid() );
+    std::string str_copy;
+    ifile>>str_copy;
+    EXPECT_EQ( str_copy , str );
+    bool flag_copy = false;
+    ifile>>flag_copy;
+    EXPECT_EQ( flag_copy , flag );
+    std::string empty_str_copy;
+    ifile>>empty_str_copy;
+    EXPECT_EQ( empty_str_copy , empty_str );
+
+    // bulk arrays are accessible without copying them
+    const auto floats = ifile.Fetch( sizeof( float ) * STREAM_SAMPLE_COUNT );
+    ASSERT_NE( floats , nullptr );
+    EXPECT_EQ( 0 , memcmp( floats , vec_f.data() , sizeof( float ) * STREAM_SAMPLE_COUNT ) );
+    std::vector<int> ints( STREAM_SAMPLE_COUNT );
+    ifile.LoadBulk( reinterpret_cast<char*>( ints.data() ) , sizeof( int ) * STREAM_SAMPLE_COUNT );
+    for (auto i = 0u; i < STREAM_SAMPLE_COUNT; ++i)
+        EXPECT_EQ(ints[i], vec_i[i]);
+
+    // reading beyond the end of file doesn't crash
+    EXPECT_EQ( ifile.Fetch( 1 ) , nullptr );
+    auto t = 1.0f;
+    ifile >> t;
+    EXPECT_EQ( t , 0.0f );
+}
+
+TEST(STREAM, MemoryViewStream) {
+    // the chunks are written the same way entities of a scene are, each of them is prefixed by its size
+    constexpr unsigned CHUNK_COUNT = 16;
+    OFileStream ofile("test_view.bin");
+    for (unsigned i = 0; i < CHUNK_COUNT; ++i) {
+        std::uint64_t size = sizeof( unsigned ) * ( i + 1 );
+        ofile.Write( reinterpret_cast<char*>( &size ) , sizeof( size ) );
+        for (unsigned j = 0; j <= i; ++j)
+            ofile << ( i * CHUNK_COUNT + j );
+    }
+    ofile.Close();
+
+    IMappedFileStream ifile("test_view.bin");
+    ASSERT_TRUE( ifile.IsValid() );
+    std::vector<std::pair<const char*, std::size_t>> chunks;
+    for (unsigned i = 0; i < CHUNK_COUNT; ++i) {
+        std::uint64_t size = 0;
+        ifile.Load( reinterpret_cast<char*>( &size ) , sizeof( size ) );
+        chunks.push_back( std::make_pair( ifile.Fetch( (std::size_t)size ) , (std::size_t)size ) );
+        ASSERT_NE( chunks.back().first , nullptr );
+    }
+
+    // views of different chunks are independent of each other
+    std::vector<std::thread> threads;
+    std::vector<int> result( CHUNK_COUNT , 0 );
+    for (unsigned i = 0; i < CHUNK_COUNT; ++i) {
+        threads.push_back( std::thread( [&, i](){
+            IMemoryViewStream view( chunks[i].first , chunks[i].second );
+            auto ret = 1;
+            for (unsigned j = 0; j <= i; ++j) {
+                auto v = 0u;
+                view >> v;
+                ret &= ( v == i * CHUNK_COUNT + j );
+            }
+            // nothing is left in the chunk
+            ret &= ( view.Fetch( 1 ) == nullptr );
+            result[i] = ret;
+        } ) );
+    }
+    for (auto& t : threads)
+        t.join();
+    for (unsigned i = 0; i < CHUNK_COUNT; ++i)
+        EXPECT_EQ( result[i] , 1 );
+}
+
+TEST(STREAM, PipeStream) {
+    std::vector<float>           vec_f;
+    FILE* pipe = tmpfile();
+    ASSERT_NE( pipe , nullptr );
+    const char str[] = "this is a random string";
+    fwrite( str , 1 , sizeof( str ) , pipe );
+    const bool flag = true;
+    fwrite( &flag , sizeof( flag ) , 1 , pipe );
+    for (unsigned i = 0; i < STREAM_SAMPLE_COUNT; ++i)
+        vec_f.push_back( sort_canonical() );
+    fwrite( vec_f.data() , sizeof( float ) , STREAM_SAMPLE_COUNT , pipe );
+    rewind( pipe );
+
+    IPipeStream ipipe( pipe );
+    std::string str_copy;
+    ipipe >> str_copy;
+    EXPECT_EQ( str_copy , std::string( str ) );
+    bool flag_copy = false;
+    ipipe >> flag_copy;
+    EXPECT_EQ( flag_copy , flag );
+
+    // fetched blocks stay alive after more data is read from the pipe
+    const auto first = ipipe.Fetch( sizeof( float ) * STREAM_SAMPLE_COUNT / 2 );
+    const auto second = ipipe.Fetch( sizeof( float ) * STREAM_SAMPLE_COUNT / 2 );
+    ASSERT_NE( first , nullptr );
+    ASSERT_NE( second , nullptr );
+    EXPECT_EQ( 0 , memcmp( first , vec_f.data() , sizeof( float ) * STREAM_SAMPLE_COUNT / 2 ) );
+    EXPECT_EQ( 0 , memcmp( second , vec_f.data() + STREAM_SAMPLE_COUNT / 2 , sizeof( float ) * STREAM_SAMPLE_COUNT / 2 ) );
+
+    // reading beyond the end of the pipe doesn't crash
+    EXPECT_EQ( ipipe.Fetch( 1 ) , nullptr );
+    auto t = 1.0f;
+    ipipe >> t;
+    EXPECT_EQ( t , 0.0f );
+    fclose( pipe );
+}
+
+TEST(STREAM, SocketStream) {
+    // find a free port on the loop back interface
+    Socket listener;
+    auto port = 0u;
+    for( auto p = 27000u ; p < 27100u && port == 0 ; ++p ){
+        if( listener.Listen( (unsigned short)p ) )
+            port = p;
+    }
+    ASSERT_NE( port , 0u );
+
+    Socket client;
+    ASSERT_TRUE( client.Connect( "127.0.0.1" , (unsigned short)port ) );
+    auto server = listener.Accept();
+    ASSERT_NE( server , nullptr );
+
+    std::vector<float> vec_f;
+    for (unsigned i = 0; i < STREAM_SAMPLE_COUNT; ++i)
+        vec_f.push_back( sort_canonical() );
+
+    // values are sent from another thread since the data is larger than what the socket buffers
+    std::thread sender( [&](){
+        OSocketStream osocket( client );
+        OStreamBase& ostream = osocket;
+        ostream << std::string( "this is a random string" ) << true;
+        for( const auto f : vec_f )
+            ostream << f;
+        ostream << SID( "End" );
+        ostream.Flush();
+        EXPECT_TRUE( osocket.IsValid() );
+    });
+
+    ISocketStream isocket( *server );
+    IStreamBase& istream = isocket;
+    std::string str_copy;
+    bool flag_copy = false;
+    istream >> str_copy >> flag_copy;
+    EXPECT_EQ( str_copy , std::string( "this is a random string" ) );
+    EXPECT_TRUE( flag_copy );
+    for (unsigned i = 0; i < STREAM_SAMPLE_COUNT; ++i){
+        auto t = 0.0f;
+        istream >> t;
+        EXPECT_EQ( t , vec_f[i] );
+    }
+    StringID end;
+    istream >> end;
+    EXPECT_EQ( end , SID( "End" ) );
+    sender.join();
+
+    // reading from a closed socket results in default values
+    client.Close();
+    auto t = 1.0f;
+    istream >> t;
+    EXPECT_EQ( t , 0.0f );
+    EXPECT_FALSE( isocket.IsValid() );
+}
+
 TEST(STREAM, MemoryStream) {
     std::vector<float>           vec_f;
     std::vector<int>             vec_i;
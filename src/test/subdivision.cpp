@@ -0,0 +1,87 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+#include <memory>
+#include <vector>
+#include "thirdparty/gtest/gtest.h"
+#include "shape/subdivision.h"
+#include "core/rand.h"
+#include "math/interaction.h"
+#include "math/utils.h"
+
+namespace {
+    //! @brief  Control mesh of a cube with half size of one around the origin.
+    void buildCube( SubdivisionMesh& mesh , unsigned level ){
+        for( auto i = 0u ; i < 8u ; ++i )
+            mesh.m_positions.push_back( Point( ( i & 1 ) ? 1.0f : -1.0f , ( i & 2 ) ? 1.0f : -1.0f , ( i & 4 ) ? 1.0f : -1.0f ) );
+
+        const unsigned faces[6][4] = { { 0 , 2 , 3 , 1 } , { 4 , 5 , 7 , 6 } , { 0 , 1 , 5 , 4 } , { 2 , 6 , 7 , 3 } , { 0 , 4 , 6 , 2 } , { 1 , 3 , 7 , 5 } };
+        mesh.m_faceOffsets.push_back( 0 );
+        for( const auto& face : faces ){
+            for( auto i = 0u ; i < 4u ; ++i ){
+                mesh.m_faceVertices.push_back( face[i] );
+                mesh.m_faceUVs.push_back( Vector2f( (float)( i & 1 ) , (float)( i >> 1 ) ) );
+            }
+            mesh.m_faceOffsets.push_back( (unsigned)mesh.m_faceVertices.size() );
+        }
+        mesh.m_level = level;
+        mesh.BuildAdjacency();
+    }
+}
+
+// Patches are tessellated independently, rays from inside of a closed surface should never leak through the seams.
+TEST(SUBDIVISION, Watertight) {
+    SubdivisionMesh mesh;
+    buildCube( mesh , 3 );
+
+    std::vector<std::unique_ptr<SubdivisionPatch>> patches;
+    for( auto f = 0u ; f < 6u ; ++f )
+        patches.push_back( std::make_unique<SubdivisionPatch>( mesh , f ) );
+
+    for( auto i = 0u ; i < 4096u ; ++i ){
+        const auto z = 1.0f - 2.0f * sort_canonical();
+        const auto r = sqrt( std::max( 0.0f , 1.0f - z * z ) );
+        const auto phi = TWO_PI * sort_canonical();
+        const Ray ray( Point( 0.01f , 0.02f , 0.03f ) , Vector( r * cos( phi ) , r * sin( phi ) , z ) );
+
+        SurfaceInteraction intersection;
+        auto hit = false;
+        for( const auto& patch : patches )
+            hit |= patch->GetIntersect( ray , &intersection );
+        ASSERT_TRUE( hit ) << i;
+
+        // the limit surface of the cube lies between the inscribed and circumscribed spheres of the cage
+        const auto distance = ( intersection.intersect - Point() ).Length();
+        EXPECT_GT( distance , 0.5f );
+        EXPECT_LT( distance , 1.0f );
+    }
+}
+
+// Bounding boxes of patches don't need any tessellation and they should cover the limit surface.
+TEST(SUBDIVISION, BoundingBox) {
+    SubdivisionMesh mesh;
+    buildCube( mesh , 2 );
+
+    for( auto f = 0u ; f < 6u ; ++f ){
+        SubdivisionPatch patch( mesh , f );
+        const auto& bbox = patch.GetBBox();
+        EXPECT_LE( bbox.m_Min.x , -1.0f );
+        EXPECT_GE( bbox.m_Max.x , 1.0f );
+
+        // a ray missing the bounding box never reaches the patch
+        EXPECT_FALSE( patch.GetIntersect( Ray( Point( 0.0f , 0.0f , -10.0f ) , Vector( 0.0f , 1.0f , 0.0f ) ) ) );
+    }
+}
@@ -0,0 +1,287 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <atomic>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include "thirdparty/gtest/gtest.h"
+#include "task/task.h"
+#include "task/timeline.h"
+#include "task/render_task.h"
+#include "core/thread.h"
+#include "core/workercontext.h"
+
+namespace {
+    // A task that records the order of its execution.
+    class Counting_Task : public Task {
+    public:
+        Counting_Task(std::atomic<int>& counter, int& order, const char* name, unsigned int priority, const Task::Task_Container& dependencies) :
+            Task(name, priority, dependencies), m_counter(counter), m_order(order) {}
+
+        void Execute() override {
+            m_order = m_counter++;
+        }
+
+    private:
+        std::atomic<int>&   m_counter;
+        int&                m_order;
+    };
+
+    // A task executing a function.
+    class Function_Task : public Task {
+    public:
+        Function_Task(std::function<void()> func, const char* name, unsigned int priority, const Task::Task_Container& dependencies) :
+            Task(name, priority, dependencies), m_func(func) {}
+
+        void Execute() override {
+            m_func();
+        }
+
+    private:
+        std::function<void()>   m_func;
+    };
+
+    // Execute all scheduled tasks with a number of worker threads, along with a number of I/O worker threads.
+    void ExecuteAllTasks(unsigned int workerCnt, unsigned int ioWorkerCnt = 0) {
+        std::vector<std::unique_ptr<WorkerThread>> threads;
+        for (auto i = 0u; i < workerCnt - 1; ++i)
+            threads.push_back(std::make_unique<WorkerThread>(i + 1));
+        for (auto i = 0u; i < ioWorkerCnt; ++i)
+            threads.push_back(std::make_unique<WorkerThread>(workerCnt + i, true));
+        for (auto& thread : threads)
+            thread->BeginThread();
+
+        EXECUTING_TASKS();
+
+        for (auto& thread : threads)
+            thread->Join();
+    }
+}
+
+// All tasks should be executed after their dependencies.
+TEST(TASK, Dependencies) {
+    constexpr unsigned int worker_cnt = 8;
+    constexpr int tile_cnt = 4096;
+
+    Scheduler::GetSingleton().SetupWorkers(worker_cnt);
+
+    std::atomic<int> counter(0);
+    int root_order = -1, middle_order = -1, last_order = -1;
+    std::vector<int> tile_orders(tile_cnt, -1);
+
+    auto root = SCHEDULE_TASK<Counting_Task>("root", DEFAULT_TASK_PRIORITY, {}, counter, root_order);
+    auto middle = SCHEDULE_TASK<Counting_Task>("middle", DEFAULT_TASK_PRIORITY, { root }, counter, middle_order);
+
+    std::vector<TaskHandle> tiles;
+    for (auto i = 0; i < tile_cnt; ++i)
+        tiles.push_back(SCHEDULE_TASK<Counting_Task>("tile", DEFAULT_TASK_PRIORITY - i, { middle }, counter, tile_orders[i]));
+    SCHEDULE_TASK<Counting_Task>("last", DEFAULT_TASK_PRIORITY, tiles, counter, last_order);
+
+    ExecuteAllTasks(worker_cnt);
+
+    EXPECT_EQ(counter, tile_cnt + 3);
+    EXPECT_EQ(root_order, 0);
+    EXPECT_EQ(middle_order, 1);
+    EXPECT_EQ(last_order, tile_cnt + 2);
+    for (auto order : tile_orders) {
+        EXPECT_GT(order, middle_order);
+        EXPECT_LT(order, last_order);
+    }
+
+    Scheduler::GetSingleton().SetupWorkers(1);
+}
+
+// Tasks depending on finished tasks should still be executed.
+TEST(TASK, FinishedDependencies) {
+    std::atomic<int> counter(0);
+    int first_order = -1, second_order = -1;
+
+    auto first = SCHEDULE_TASK<Counting_Task>("first", DEFAULT_TASK_PRIORITY, {}, counter, first_order);
+    auto first_picked = Scheduler::GetSingleton().PickTask();
+    EXPECT_EQ(first_picked, first);
+
+    // the task is still alive until it is finished, scheduling a dependent in the middle should be fine.
+    first_picked->Execute();
+    SCHEDULE_TASK<Counting_Task>("second", DEFAULT_TASK_PRIORITY, { first }, counter, second_order);
+    Scheduler::GetSingleton().TaskFinished(first_picked);
+
+    ExecuteAllTasks(1);
+
+    EXPECT_EQ(first_order, 0);
+    EXPECT_EQ(second_order, 1);
+}
+
+// Handles keep tasks alive, a chain scheduled by a task while the other workers are running is still executed in order.
+TEST(TASK, ScheduleChainInTask) {
+    constexpr unsigned int worker_cnt = 8;
+    constexpr int chain_len = 4096;
+
+    Scheduler::GetSingleton().SetupWorkers(worker_cnt);
+
+    std::atomic<int> counter(0);
+    std::vector<int> orders(chain_len, -1);
+    SCHEDULE_TASK<Function_Task>("root", DEFAULT_TASK_PRIORITY, {}, std::function<void()>([&]() {
+        auto previous = SCHEDULE_TASK<Counting_Task>("link", DEFAULT_TASK_PRIORITY, {}, counter, orders[0]);
+        for (auto i = 1; i < chain_len; ++i)
+            previous = SCHEDULE_TASK<Counting_Task>("link", DEFAULT_TASK_PRIORITY, { previous }, counter, orders[i]);
+    }));
+
+    ExecuteAllTasks(worker_cnt);
+
+    EXPECT_EQ(counter, chain_len);
+    for (auto i = 0; i < chain_len; ++i)
+        EXPECT_EQ(orders[i], i);
+
+    Scheduler::GetSingleton().SetupWorkers(1);
+}
+
+// Tasks forked in a group, including the nested ones, should all be finished after joining the group.
+TEST(TASK, ForkJoin) {
+    constexpr unsigned int worker_cnt = 8;
+    constexpr unsigned int total = 1024 * 1024;
+
+    Scheduler::GetSingleton().SetupWorkers(worker_cnt);
+
+    std::atomic<unsigned int> forked_sum(0);
+    std::atomic<unsigned long long> parallel_sum(0);
+    auto joined = false, dependent_after_join = false;
+
+    std::function<void(TaskGroup&, unsigned int, unsigned int)> split = [&](TaskGroup& group, unsigned int start, unsigned int end) {
+        if (end - start <= 1024) {
+            forked_sum += end - start;
+            return;
+        }
+        const auto mid = (start + end) / 2;
+        group.Fork([&, start, mid]() { split(group, start, mid); });
+        split(group, mid, end);
+    };
+
+    auto root = SCHEDULE_TASK<Function_Task>("root", DEFAULT_TASK_PRIORITY, {}, std::function<void()>([&]() {
+        TaskGroup group;
+        split(group, 0, total);
+        group.Join();
+        EXPECT_EQ(forked_sum, total);
+
+        ParallelFor(0u, total, 4096u, [&](unsigned int s, unsigned int e) {
+            unsigned long long local = 0;
+            for (auto i = s; i < e; ++i)
+                local += i;
+            parallel_sum += local;
+        });
+        EXPECT_EQ(parallel_sum, (unsigned long long)total * (total - 1) / 2);
+        joined = true;
+    }));
+    SCHEDULE_TASK<Function_Task>("dependent", DEFAULT_TASK_PRIORITY, { root }, std::function<void()>([&]() {
+        dependent_after_join = joined;
+    }));
+
+    ExecuteAllTasks(worker_cnt);
+
+    EXPECT_TRUE(joined);
+    EXPECT_TRUE(dependent_after_join);
+
+    Scheduler::GetSingleton().SetupWorkers(1);
+}
+
+// Compute tasks should never be executed by I/O workers, I/O tasks should be executed whether there are I/O workers or not.
+TEST(TASK, IOTasks) {
+    constexpr unsigned int worker_cnt = 4;
+    constexpr unsigned int task_cnt = 256;
+
+    Scheduler::GetSingleton().SetupWorkers(worker_cnt);
+
+    for (auto io_worker_cnt : { 0u, 2u }) {
+        std::atomic<unsigned int> io_executed(0), compute_executed(0), compute_on_io_worker(0);
+
+        SCHEDULE_TASK<Function_Task>("root", DEFAULT_TASK_PRIORITY, {}, std::function<void()>([&]() {
+            TaskGroup group;
+            for (auto i = 0u; i < task_cnt; ++i) {
+                group.Fork([&]() { ++io_executed; }, "io", TaskClass::IO);
+                group.Fork([&]() {
+                    ++compute_executed;
+                    if (GetWorkerContext().ioWorker)
+                        ++compute_on_io_worker;
+                }, "compute");
+            }
+            group.Join();
+        }));
+
+        ExecuteAllTasks(worker_cnt, io_worker_cnt);
+
+        EXPECT_EQ(task_cnt, io_executed.load());
+        EXPECT_EQ(task_cnt, compute_executed.load());
+        EXPECT_EQ(0u, compute_on_io_worker.load());
+    }
+
+    Scheduler::GetSingleton().SetupWorkers(1);
+}
+
+// Each executed task should show up in the exported timeline, along with the time workers spend looking for tasks.
+TEST(TASK, Timeline) {
+    constexpr unsigned int worker_cnt = 4;
+    constexpr int task_cnt = 64;
+
+    auto& timeline = Timeline::GetSingleton();
+    timeline.Enable( 4096 );
+    Scheduler::GetSingleton().SetupWorkers(worker_cnt);
+
+    std::atomic<int> counter(0);
+    for (auto i = 0; i < task_cnt; ++i)
+        SCHEDULE_TASK<Function_Task>("timeline", DEFAULT_TASK_PRIORITY, {}, [&]() { ++counter; });
+    ExecuteAllTasks(worker_cnt);
+    EXPECT_EQ(task_cnt, counter.load());
+
+    const std::string path = "timeline_test.json";
+    EXPECT_TRUE( timeline.ExportChromeTrace( path ) );
+
+    std::stringstream ss;
+    ss << std::ifstream( path ).rdbuf();
+    const auto json = ss.str();
+    auto cnt = 0;
+    for (auto pos = json.find("\"name\":\"timeline\""); pos != std::string::npos; pos = json.find("\"name\":\"timeline\"", pos + 1))
+        ++cnt;
+    EXPECT_EQ(task_cnt, cnt);
+    EXPECT_NE(std::string::npos, json.find("Worker Summary"));
+    std::remove( path.c_str() );
+
+    timeline.Disable();
+    Scheduler::GetSingleton().SetupWorkers(1);
+}
+
+// Tiles clipped by a region not aligned with the tiles should still go to the slots of the tiles they come from.
+TEST(TASK, TileSlotOfClippedTiles) {
+    constexpr int tile_size = 64;
+    constexpr int width = 160;
+    constexpr int height = 100;
+    const Vector2i region_min( 40 , 40 ) , region_max( 150 , 90 );
+
+    for (auto y = 0; y < height; y += tile_size) {
+        for (auto x = 0; x < width; x += tile_size) {
+            const Vector2i rtl( std::max( x , region_min.x ) , std::max( y , region_min.y ) );
+            const auto slot = TileSlot( rtl , tile_size , height );
+            EXPECT_EQ( x / tile_size , slot.x );
+            EXPECT_EQ( ( height - 1 - y ) / tile_size , slot.y );
+        }
+    }
+
+    // the top row of tiles is clipped at the 40th row, it still goes to the upper slot
+    EXPECT_EQ( 1 , TileSlot( region_min , tile_size , height ).y );
+    EXPECT_EQ( 0 , TileSlot( Vector2i( region_min.x , tile_size ) , tile_size , height ).y );
+    EXPECT_EQ( 2 , TileSlot( region_max - Vector2i( 1 , 1 ) , tile_size , height ).x );
+}
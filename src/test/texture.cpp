@@ -0,0 +1,64 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+#include "thirdparty/gtest/gtest.h"
+#include "texture/texturebase.h"
+
+namespace {
+    // A small texture with a different value in every texel.
+    class PatternTexture : public Texture2DBase {
+    public:
+        PatternTexture() : Texture2DBase( 4 , 4 ) {}
+
+        Spectrum GetColor( int x , int y ) const override {
+            texCoordFilter( x , y );
+            return Spectrum( (float)x , (float)y , (float)( ( x * 7 + y * 3 ) % 5 ) );
+        }
+
+        float GetAlpha( int x , int y ) const override {
+            texCoordFilter( x , y );
+            return (float)( x + y * 4 ) / 16.0f;
+        }
+
+        bool IsValid() const override {
+            return true;
+        }
+    };
+}
+
+// Single texel lookups average to bilinear filtering once the random numbers cover the unit interval evenly.
+TEST(TEXTURE, StochasticFiltering) {
+    const PatternTexture texture;
+    constexpr int N = 4096;
+    const float coords[][2] = { { 0.3f , 0.6f } , { 0.125f , 0.125f } , { 0.91f , 0.07f } , { 0.5f , 0.99f } };
+    for( const auto& uv : coords ){
+        Spectrum color;
+        auto alpha = 0.0f;
+        for( auto i = 0 ; i < N ; ++i ){
+            const auto rnd = ( i + 0.5f ) / N;
+            color += texture.GetColorFromUV( uv[0] , uv[1] , rnd );
+            alpha += texture.GetAlphaFromtUV( uv[0] , uv[1] , rnd );
+        }
+        color /= (float)N;
+        alpha /= (float)N;
+
+        const auto expected = texture.GetColorFromUV( uv[0] , uv[1] );
+        EXPECT_NEAR( color.r , expected.r , 1e-2f );
+        EXPECT_NEAR( color.g , expected.g , 1e-2f );
+        EXPECT_NEAR( color.b , expected.b , 1e-2f );
+        EXPECT_NEAR( alpha , texture.GetAlphaFromtUV( uv[0] , uv[1] ) , 1e-2f );
+    }
+}
@@ -0,0 +1,92 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cstdio>
+#include <vector>
+#include "thirdparty/gtest/gtest.h"
+#include "thirdparty/tiny_exr/tinyexr.h"
+#include "texture/udimtexture2d.h"
+#include "texture/texturefeedback.h"
+
+namespace {
+    // Write a tile of a single color.
+    void writeTile( const std::string& filename , float r , float g , float b ){
+        constexpr int size = 16;
+        std::vector<float> data;
+        for( auto i = 0 ; i < size * size ; ++i )
+            data.insert( data.end() , { r , g , b } );
+        ASSERT_GE( SaveEXR( data.data() , size , size , 3 , false , filename.c_str() ) , 0 );
+    }
+}
+
+// Lookups pick the tile by the integer part of the texture coordinate, tiles are not read until they are looked up.
+TEST(UDIM, LazyTiles) {
+    writeTile( "udim_test.1001.exr" , 1.0f , 0.0f , 0.0f );
+    writeTile( "udim_test.1012.exr" , 0.0f , 1.0f , 0.0f );
+    writeTile( "udim_test.1013.exr" , 0.0f , 0.0f , 1.0f );
+
+    UdimTexture2D texture;
+    EXPECT_TRUE( UdimTexture2D::IsUdim( "udim_test.<UDIM>.exr" ) );
+    ASSERT_TRUE( texture.LoadResource( "udim_test.<UDIM>.exr" ) );
+    EXPECT_TRUE( texture.IsValid() );
+
+    // the file is removed after the set is listed, the tile is missing since it is only read by the first lookup
+    std::remove( "udim_test.1013.exr" );
+
+    EXPECT_NEAR( texture.GetColorFromUV( 0.5f , 0.5f ).r , 1.0f , 1e-5f );
+    EXPECT_NEAR( texture.GetColorFromUV( 1.25f , 1.75f ).g , 1.0f , 1e-5f );
+    EXPECT_TRUE( texture.GetColorFromUV( 2.5f , 1.5f ).IsBlack() );
+    EXPECT_TRUE( texture.GetColorFromUV( 5.5f , 0.5f ).IsBlack() );
+    EXPECT_TRUE( texture.GetColorFromUV( -0.5f , 0.5f ).IsBlack() );
+    EXPECT_TRUE( texture.GetColorFromUV( 10.5f , 0.5f ).IsBlack() );
+    EXPECT_EQ( texture.GetAlphaFromtUV( 0.5f , 0.5f ) , 1.0f );
+
+    std::remove( "udim_test.1001.exr" );
+    std::remove( "udim_test.1012.exr" );
+}
+
+// Prepasses record the tiles not resident instead of loading them, they are loaded once the feedback is prefetched.
+TEST(UDIM, PrefetchFeedback) {
+    writeTile( "udim_feedback.1001.exr" , 1.0f , 0.0f , 0.0f );
+    writeTile( "udim_feedback.1002.exr" , 0.0f , 1.0f , 0.0f );
+
+    UdimTexture2D texture;
+    ASSERT_TRUE( texture.LoadResource( "udim_feedback.<UDIM>.exr" ) );
+
+    TextureFeedback feedback;
+    {
+        TextureFeedbackScope scope( &feedback );
+        EXPECT_TRUE( texture.GetColorFromUV( 0.5f , 0.5f ).IsBlack() );
+        EXPECT_TRUE( texture.GetColorFromUV( 0.25f , 0.75f ).IsBlack() );
+        EXPECT_TRUE( texture.GetColorFromUV( 5.5f , 0.5f ).IsBlack() );
+    }
+    EXPECT_EQ( feedback.GetRequestCnt() , 1u );
+
+    feedback.Prefetch();
+    EXPECT_EQ( feedback.GetRequestCnt() , 0u );
+    EXPECT_FALSE( texture.Prefetch( 0 ) );
+
+    // the prefetched tile is resident even for prepasses, the other one is still loaded by the first lookup
+    {
+        TextureFeedbackScope scope( &feedback );
+        EXPECT_NEAR( texture.GetColorFromUV( 0.5f , 0.5f ).r , 1.0f , 1e-5f );
+    }
+    EXPECT_NEAR( texture.GetColorFromUV( 1.5f , 0.5f ).g , 1.0f , 1e-5f );
+
+    std::remove( "udim_feedback.1001.exr" );
+    std::remove( "udim_feedback.1002.exr" );
+}
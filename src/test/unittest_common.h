@@ -17,9 +17,11 @@
 
 #pragma once
 
+#include <chrono>
 #include <functional>
 #include <thread>
 #include <vector>
+#include "core/log.h"
 
 // TN : thread number
 // N :  task number in each thread
@@ -75,4 +77,33 @@ void ParrallRun( std::function<void(int tid)> func ){
     // make sure all threads are finished
     for (int i = 0; i < TN; ++i)
         threads[i].join();
-}
\ No newline at end of file
+}
+
+// Micro benchmarks are disabled tests, they only run with
+//   --unittest --gtest_also_run_disabled_tests --gtest_filter=*DISABLED_Benchmark*
+//
+// 'func' takes the index of the iteration and returns something that can be accumulated in a float, so that the
+// compiler can't get rid of the measured code. It is warmed up first and then called for at least half a second.
+template<typename Func>
+void MeasureThroughput( const char* name , Func&& func ){
+    using clock = std::chrono::high_resolution_clock;
+    constexpr unsigned long long batch = 1024 * 16;
+    static volatile float sink = 0.0f;
+
+    auto acc = 0.0f;
+    for( auto i = 0ull ; i < batch ; ++i )
+        acc += (float)func( i );
+
+    auto cnt = 0ull;
+    auto seconds = 0.0;
+    const auto start = clock::now();
+    do{
+        for( auto i = 0ull ; i < batch ; ++i )
+            acc += (float)func( cnt + i );
+        cnt += batch;
+        seconds = std::chrono::duration<double>( clock::now() - start ).count();
+    }while( seconds < 0.5 );
+    sink = sink + acc;
+
+    slog( INFO , PERFORMANCE , "  %-40s %10.2f M/s , %8.3f ns each" , name , cnt / seconds * 1e-6 , seconds * 1e9 / cnt );
+}
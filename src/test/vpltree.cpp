@@ -0,0 +1,120 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "thirdparty/gtest/gtest.h"
+#include "core/rand.h"
+#include "math/utils.h"
+#include "integrator/vpltree.h"
+
+namespace {
+    // Squared distance is clamped the same way the error bound does.
+    static constexpr float MIN_SQR_DIST = 0.01f;
+
+    // Virtual point lights scattered in a room.
+    VirtualLightSources makeVPLs( unsigned cnt ){
+        VirtualLightSources vpls;
+        for( auto i = 0u ; i < cnt ; ++i ){
+            SurfaceInteraction inter;
+            inter.intersect = Point( sort_canonical() * 10.0f , sort_canonical() * 3.0f , sort_canonical() * 10.0f );
+            vpls.Add( inter , Vector( 0.0f , 1.0f , 0.0f ) , Spectrum( sort_canonical() , sort_canonical() , sort_canonical() ) , 1 + i % 3 );
+        }
+        return vpls;
+    }
+
+    // Lambertian scattering at both ends without any occlusion.
+    struct Lambertian{
+        const VirtualLightSources&  vpls;
+        const Point                 p;
+
+        Spectrum operator ()( unsigned i ) const {
+            const auto sqr_dist = ( vpls.position[i] - p ).SquaredLength();
+            return INV_PI * INV_PI / std::max( MIN_SQR_DIST , sqr_dist );
+        }
+    };
+
+    Spectrum bruteForce( const VirtualLightSources& vpls , const Point& p , int maxDepth ){
+        Spectrum total;
+        const Lambertian evaluate = { vpls , p };
+        for( auto i = 0u ; i < vpls.Size() ; ++i ){
+            if( vpls.depth[i] <= maxDepth )
+                total += evaluate( i ) * vpls.power[i];
+        }
+        return total;
+    }
+}
+
+// Without any error allowed, the cut goes all the way down to the leaves
+TEST(VPLTREE, ExactCut) {
+    const auto vpls = makeVPLs( 1000 );
+    VPLTree tree;
+    tree.Build( vpls );
+    EXPECT_EQ( tree.GetNodeCount() , 1999u );
+
+    for( auto i = 0 ; i < 16 ; ++i ){
+        const auto p = Point( sort_canonical() * 10.0f , sort_canonical() * 3.0f , sort_canonical() * 10.0f );
+        unsigned cut_size = 0;
+        const auto radiance = tree.Evaluate( p , 16 , MIN_SQR_DIST , 0.0f , 1u << 30 , Lambertian{ vpls , p } , &cut_size );
+        const auto expected = bruteForce( vpls , p , 16 );
+        EXPECT_EQ( cut_size , 1000u );
+        EXPECT_NEAR( radiance.GetIntensity() , expected.GetIntensity() , expected.GetIntensity() * 0.001f );
+    }
+}
+
+// Clusters are refined until the error is under control, far fewer than all lights are evaluated
+TEST(VPLTREE, ErrorControl) {
+    const auto vpls = makeVPLs( 4000 );
+    VPLTree tree;
+    tree.Build( vpls );
+
+    for( auto i = 0 ; i < 16 ; ++i ){
+        const auto p = Point( sort_canonical() * 10.0f , sort_canonical() * 3.0f , sort_canonical() * 10.0f );
+        unsigned cut_size = 0;
+        const auto radiance = tree.Evaluate( p , 16 , MIN_SQR_DIST , 0.02f , 1u << 30 , Lambertian{ vpls , p } , &cut_size );
+        const auto expected = bruteForce( vpls , p , 16 );
+        EXPECT_LT( cut_size , 4000u );
+        EXPECT_NEAR( radiance.GetIntensity() , expected.GetIntensity() , expected.GetIntensity() * 0.1f );
+    }
+}
+
+// The cut never goes beyond its budget
+TEST(VPLTREE, BoundedCut) {
+    const auto vpls = makeVPLs( 4000 );
+    VPLTree tree;
+    tree.Build( vpls );
+
+    const auto p = Point( 5.0f , 1.5f , 5.0f );
+    unsigned cut_size = 0;
+    const auto radiance = tree.Evaluate( p , 16 , MIN_SQR_DIST , 0.0f , 64 , Lambertian{ vpls , p } , &cut_size );
+    EXPECT_LE( cut_size , 64u );
+    EXPECT_GT( radiance.GetIntensity() , 0.0f );
+}
+
+// Lights with too many bounces are ignored
+TEST(VPLTREE, MaxDepth) {
+    const auto vpls = makeVPLs( 1000 );
+    VPLTree tree;
+    tree.Build( vpls );
+
+    const auto p = Point( 5.0f , 1.5f , 5.0f );
+    unsigned cut_size = 0;
+    const auto radiance = tree.Evaluate( p , 1 , MIN_SQR_DIST , 0.0f , 1u << 30 , Lambertian{ vpls , p } , &cut_size );
+    const auto expected = bruteForce( vpls , p , 1 );
+    EXPECT_EQ( cut_size , 334u );
+    EXPECT_NEAR( radiance.GetIntensity() , expected.GetIntensity() , expected.GetIntensity() * 0.001f );
+
+    EXPECT_EQ( tree.Evaluate( p , 0 , MIN_SQR_DIST , 0.0f , 1u << 30 , Lambertian{ vpls , p } ).GetIntensity() , 0.0f );
+}
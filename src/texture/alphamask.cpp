@@ -0,0 +1,47 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include "alphamask.h"
+#include "imagetexture2d.h"
+#include "core/stats.h"
+
+SORT_STATS_DEFINE_COUNTER(sAlphaMaskCnt)
+
+SORT_STATS_COUNTER("Material", "Alpha Masks Baked", sAlphaMaskCnt);
+
+void AlphaMask::Bake(){
+    m_bits.clear();
+    if( IS_PTR_INVALID(m_texture) || !m_texture->IsValid() )
+        return;
+
+    m_width = m_texture->GetWidth();
+    m_height = m_texture->GetHeight();
+    if( m_width <= 0 || m_height <= 0 )
+        return;
+
+    const auto texel_cnt = (std::size_t)m_width * m_height;
+    m_bits.resize( ( texel_cnt + 63 ) / 64 , 0 );
+    for( auto y = 0 ; y < m_height ; ++y ){
+        for( auto x = 0 ; x < m_width ; ++x ){
+            const auto i = (std::size_t)y * m_width + x;
+            if( m_texture->GetAlpha( x , y ) >= 0.5f )
+                m_bits[i >> 6] |= std::uint64_t(1) << ( i & 63 );
+        }
+    }
+
+    SORT_STATS(++sAlphaMaskCnt);
+}
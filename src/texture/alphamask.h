@@ -0,0 +1,74 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "core/define.h"
+
+class ImageTexture2D;
+
+//! @brief  Binary alpha mask baked from the alpha channel of an image texture.
+/**
+ * Leaves and other cut-out cards blend a transparent closure with an opaque one by the alpha of an image texture.
+ * Executing the shader for every hit candidate only to find out that the ray passes through is fairly expensive, one
+ * bit per texel is all it takes to tell it during traversal. Texels are looked up without filtering, the ones with
+ * alpha of at least a half are opaque, unless the mask is inverted.
+ */
+class AlphaMask{
+public:
+    //! @brief  Constructor of the alpha mask, nothing is baked until the texture is loaded.
+    //!
+    //! @param  texture     The image texture whose alpha channel is baked.
+    //! @param  tiling      Scaling of the texture coordinate before the texture is sampled.
+    //! @param  inverted    Whether texels with low alpha are the opaque ones.
+    AlphaMask( const ImageTexture2D* texture , float tiling , bool inverted ):
+        m_texture(texture), m_tiling(tiling), m_inverted(inverted){}
+
+    //! @brief  Bake the alpha channel of the texture into bits.
+    //!
+    //! It needs to be called once the texture is loaded, the mask is opaque everywhere before it is baked.
+    void    Bake();
+
+    //! @brief  Whether the mask is opaque at a texture coordinate.
+    //!
+    //! @param  u       U coordinate, the texture wraps around outside the unit square.
+    //! @param  v       V coordinate, the texture wraps around outside the unit square.
+    //! @return         Whether a ray hitting the coordinate is blocked.
+    SORT_FORCEINLINE bool IsOpaque( float u , float v ) const{
+        if( m_bits.empty() )
+            return true;
+
+        auto x = (int)std::floor( u * m_tiling * m_width ) % m_width;
+        auto y = (int)std::floor( v * m_tiling * m_height ) % m_height;
+        x += ( x < 0 ) * m_width;
+        y += ( y < 0 ) * m_height;
+
+        const auto i = (unsigned int)( y * m_width + x );
+        return ( ( m_bits[i >> 6] >> ( i & 63 ) ) & 1 ) != (std::uint64_t)m_inverted;
+    }
+
+private:
+    const ImageTexture2D*       m_texture = nullptr;    /**< The image texture whose alpha channel is baked. */
+    float                       m_tiling = 1.0f;        /**< Scaling of the texture coordinate. */
+    bool                        m_inverted = false;     /**< Whether texels with low alpha are the opaque ones. */
+    int                         m_width = 0;            /**< Width of the mask in texels. */
+    int                         m_height = 0;           /**< Height of the mask in texels. */
+    std::vector<std::uint64_t>  m_bits;                 /**< One bit per texel, set if the alpha is at least a half. */
+};
@@ -0,0 +1,130 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include <climits>
+#include "blockcompression.h"
+
+// Round a color of 8 bits per channel to 5:6:5.
+static std::uint16_t toRGB565( const int* rgb ){
+    const auto r = ( rgb[0] * 31 + 127 ) / 255;
+    const auto g = ( rgb[1] * 63 + 127 ) / 255;
+    const auto b = ( rgb[2] * 31 + 127 ) / 255;
+    return (std::uint16_t)( ( r << 11 ) | ( g << 5 ) | b );
+}
+
+void EncodeBC1( const unsigned char* texels , unsigned char* block ){
+    int lo[3] = { 255 , 255 , 255 } , hi[3] = { 0 , 0 , 0 };
+    int mean[3] = { 0 , 0 , 0 };
+    for( auto i = 0 ; i < 16 ; ++i ){
+        for( auto c = 0 ; c < 3 ; ++c ){
+            lo[c] = std::min( lo[c] , (int)texels[4 * i + c] );
+            hi[c] = std::max( hi[c] , (int)texels[4 * i + c] );
+            mean[c] += texels[4 * i + c];
+        }
+    }
+
+    // The bounding box has four diagonals, the one colors are spread along is picked by the covariance of the
+    // channels with the widest one.
+    auto widest = 0;
+    for( auto c = 1 ; c < 3 ; ++c )
+        widest = ( hi[c] - lo[c] > hi[widest] - lo[widest] ) ? c : widest;
+    for( auto c = 0 ; c < 3 ; ++c ){
+        if( c == widest )
+            continue;
+        auto covariance = 0;
+        for( auto i = 0 ; i < 16 ; ++i )
+            covariance += ( 16 * texels[4 * i + c] - mean[c] ) * ( 16 * texels[4 * i + widest] - mean[widest] );
+        if( covariance < 0 )
+            std::swap( lo[c] , hi[c] );
+    }
+
+    // the endpoints are inset a bit, extreme colors are rare and the rest of the texels benefit from a tighter range
+    int e0[3] , e1[3];
+    for( auto c = 0 ; c < 3 ; ++c ){
+        const auto inset = ( hi[c] - lo[c] ) / 16;
+        e0[c] = std::max( 0 , std::min( 255 , hi[c] - inset ) );
+        e1[c] = std::max( 0 , std::min( 255 , lo[c] + inset ) );
+    }
+
+    auto c0 = toRGB565( e0 );
+    auto c1 = toRGB565( e1 );
+
+    // the four color mode needs the first endpoint to be the larger one
+    if( c0 < c1 )
+        std::swap( c0 , c1 );
+    block[0] = (unsigned char)( c0 & 0xff );
+    block[1] = (unsigned char)( c0 >> 8 );
+    block[2] = (unsigned char)( c1 & 0xff );
+    block[3] = (unsigned char)( c1 >> 8 );
+    block[4] = block[5] = block[6] = block[7] = 0;
+    if( c0 == c1 )
+        return;
+
+    // the palette is built from the quantized endpoints, which is what the decoder sees
+    int palette[4][3];
+    expandRGB565( c0 , palette[0] );
+    expandRGB565( c1 , palette[1] );
+    for( auto c = 0 ; c < 3 ; ++c ){
+        palette[2][c] = ( 2 * palette[0][c] + palette[1][c] ) / 3;
+        palette[3][c] = ( palette[0][c] + 2 * palette[1][c] ) / 3;
+    }
+
+    for( auto i = 0 ; i < 16 ; ++i ){
+        auto best = 0 , best_dist = INT_MAX;
+        for( auto k = 0 ; k < 4 ; ++k ){
+            auto dist = 0;
+            for( auto c = 0 ; c < 3 ; ++c ){
+                const auto d = texels[4 * i + c] - palette[k][c];
+                dist += d * d;
+            }
+            if( dist < best_dist ){
+                best_dist = dist;
+                best = k;
+            }
+        }
+        block[4 + ( i >> 2 )] |= (unsigned char)( best << ( 2 * ( i & 3 ) ) );
+    }
+}
+
+void EncodeBC4( const unsigned char* texels , unsigned int channel , unsigned char* block ){
+    int lo = 255 , hi = 0;
+    for( auto i = 0 ; i < 16 ; ++i ){
+        lo = std::min( lo , (int)texels[4 * i + channel] );
+        hi = std::max( hi , (int)texels[4 * i + channel] );
+    }
+
+    // the eight value mode needs the first endpoint to be the larger one
+    block[0] = (unsigned char)hi;
+    block[1] = (unsigned char)lo;
+    std::uint64_t indices = 0;
+    if( hi > lo ){
+        int palette[8] = { hi , lo };
+        for( auto k = 2 ; k < 8 ; ++k )
+            palette[k] = ( ( 8 - k ) * hi + ( k - 1 ) * lo ) / 7;
+
+        for( auto i = 0 ; i < 16 ; ++i ){
+            const int v = texels[4 * i + channel];
+            auto best = 0;
+            for( auto k = 1 ; k < 8 ; ++k )
+                best = std::abs( v - palette[k] ) < std::abs( v - palette[best] ) ? k : best;
+            indices |= (std::uint64_t)best << ( 3 * i );
+        }
+    }
+    for( auto i = 0 ; i < 6 ; ++i )
+        block[2 + i] = (unsigned char)( ( indices >> ( 8 * i ) ) & 0xff );
+}
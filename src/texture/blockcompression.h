@@ -0,0 +1,99 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include "core/define.h"
+
+//! @brief  Size of a BC1 block in bytes, it holds 4x4 RGB texels.
+constexpr unsigned int BC1_BLOCK_SIZE = 8;
+
+//! @brief  Size of a BC4 block in bytes, it holds 4x4 texels of a single channel.
+constexpr unsigned int BC4_BLOCK_SIZE = 8;
+
+//! @brief  Compress 4x4 texels into a BC1 block, alpha is ignored.
+//!
+//! Endpoints are picked from the bounding box of the colors along the diagonal the colors are spread along, which is
+//! nowhere near the quality of an offline encoder, but it is fast enough to compress textures while loading them.
+//!
+//! @param  texels      16 texels row by row, 4 channels of 8 bits each.
+//! @param  block       The BC1 block.
+void    EncodeBC1( const unsigned char* texels , unsigned char* block );
+
+//! @brief  Compress one channel of 4x4 texels into a BC4 block.
+//!
+//! @param  texels      16 texels row by row, 4 channels of 8 bits each.
+//! @param  channel     The channel to be compressed.
+//! @param  block       The BC4 block.
+void    EncodeBC4( const unsigned char* texels , unsigned int channel , unsigned char* block );
+
+//! @brief  Expand a 5:6:5 color of a BC1 endpoint to 8 bits per channel.
+SORT_STATIC_FORCEINLINE void expandRGB565( const std::uint16_t c , int* rgb ){
+    const auto r = ( c >> 11 ) & 31;
+    const auto g = ( c >> 5 ) & 63;
+    const auto b = c & 31;
+    rgb[0] = ( r << 3 ) | ( r >> 2 );
+    rgb[1] = ( g << 2 ) | ( g >> 4 );
+    rgb[2] = ( b << 3 ) | ( b >> 2 );
+}
+
+//! @brief  Decode a texel of a BC1 block.
+//!
+//! @param  block       The BC1 block.
+//! @param  i           Index of the texel in the block, row by row.
+//! @param  rgb         The color of the texel in 8 bits per channel.
+SORT_STATIC_FORCEINLINE void DecodeBC1( const unsigned char* block , unsigned int i , int* rgb ){
+    const auto c0 = (std::uint16_t)( block[0] | ( block[1] << 8 ) );
+    const auto c1 = (std::uint16_t)( block[2] | ( block[3] << 8 ) );
+    const auto index = ( block[4 + ( i >> 2 )] >> ( 2 * ( i & 3 ) ) ) & 3;
+
+    int e0[3] , e1[3];
+    expandRGB565( c0 , e0 );
+    expandRGB565( c1 , e1 );
+    for( auto c = 0 ; c < 3 ; ++c ){
+        switch( index ){
+        case 0: rgb[c] = e0[c]; break;
+        case 1: rgb[c] = e1[c]; break;
+        case 2: rgb[c] = c0 > c1 ? ( 2 * e0[c] + e1[c] ) / 3 : ( e0[c] + e1[c] ) / 2; break;
+        default: rgb[c] = c0 > c1 ? ( e0[c] + 2 * e1[c] ) / 3 : 0; break;
+        }
+    }
+}
+
+//! @brief  Decode a texel of a BC4 block.
+//!
+//! @param  block       The BC4 block.
+//! @param  i           Index of the texel in the block, row by row.
+//! @return             The value of the texel in 8 bits.
+SORT_STATIC_FORCEINLINE int DecodeBC4( const unsigned char* block , unsigned int i ){
+    const int a0 = block[0];
+    const int a1 = block[1];
+
+    // 3 bits per texel packed in 48 bits
+    const auto bit = 3 * i;
+    const auto bits = block[2 + ( bit >> 3 )] | ( ( bit >> 3 ) + 3 < 8 ? block[3 + ( bit >> 3 )] << 8 : 0 );
+    const auto index = ( bits >> ( bit & 7 ) ) & 7;
+
+    if( index < 2 )
+        return index == 0 ? a0 : a1;
+    if( a0 > a1 )
+        return ( ( 8 - index ) * a0 + ( index - 1 ) * a1 ) / 7;
+    if( index >= 6 )
+        return index == 6 ? 0 : 255;
+    return ( ( 6 - index ) * a0 + ( index - 1 ) * a1 ) / 5;
+}
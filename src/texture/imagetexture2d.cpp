@@ -16,53 +16,257 @@
  */
 
 #include <regex>
+#include <cstring>
+#include <filesystem>
 #include "imagetexture2d.h"
 #include "core/sassert.h"
+#include "core/stats.h"
+#include "core/log.h"
+#include "core/globalconfig.h"
+#include "core/hash.h"
+#include "math/quantization.h"
+#include "task/task.h"
+#include "blockcompression.h"
 
-#define TINYEXR_IMPLEMENTATION
 #include "thirdparty/tiny_exr/tinyexr.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "thirdparty/stb_image/stb_image.h"
 
+SORT_STATS_DEFINE_COUNTER(sTextureMemory)
+SORT_STATS_DEFINE_COUNTER(sCompressedTextureCount)
+SORT_STATS_DEFINE_COUNTER(sSharedTextureCount)
+
+SORT_STATS_COUNTER("Statistics", "Image Texture Memory (Bytes)", sTextureMemory);
+SORT_STATS_COUNTER("Statistics", "Block Compressed Image Textures", sCompressedTextureCount);
+SORT_STATS_COUNTER("Statistics", "Image Textures Mapped from Other Processes", sSharedTextureCount);
+
+static const float INV_255 = 1.0f / 255.0f;
+
+// Largest finite value of half precision floats.
+static constexpr float HALF_MAX = 65504.0f;
+
+// Version of the layout of texels in the shared cache, it needs to be bumped once the layout changes.
+static constexpr unsigned int IMAGE_TEXTURE_SHARED_VERSION = 1;
+
+// Description of the texels in a shared blob, the arrays of texels follow it, absent ones take no space.
+struct SharedTexelInfo{
+    int             width;
+    int             height;
+    unsigned int    blockSize;
+    unsigned int    halfChannels;
+    unsigned int    hasAlpha;
+    float           average[3];
+    std::uint64_t   sizes[5];       /**< Sizes of the ldr, block, half, rgb and alpha arrays in bytes. */
+};
+
+// There is no mip chain of image textures, once the memory budget of textures runs out the finest levels are dropped
+// at load time instead. RGBA texels are box filtered to half of the resolution in place until the image fits.
+template<class T>
+static void fitTextureBudget( T* data , int& width , int& height , float texel_size , const std::string& name ){
+    const auto budget = GetMemoryBudgetLeft( MemoryCategory::Texture );
+    const auto orig_width = width;
+    const auto orig_height = height;
+    while( (double)width * height * texel_size > (double)budget && ( width > 1 || height > 1 ) ){
+        const auto w = std::max( 1 , width / 2 );
+        const auto h = std::max( 1 , height / 2 );
+        const auto sx = width > 1 ? 2 : 1;
+        const auto sy = height > 1 ? 2 : 1;
+        const auto rounding = std::is_integral<T>::value ? 0.5f : 0.0f;
+
+        // each texel written is never read again, it is safe to do it in place
+        for( auto y = 0 ; y < h ; ++y ){
+            for( auto x = 0 ; x < w ; ++x ){
+                for( auto c = 0 ; c < 4 ; ++c ){
+                    auto sum = 0.0f;
+                    for( auto j = 0 ; j < sy ; ++j )
+                        for( auto i = 0 ; i < sx ; ++i )
+                            sum += (float)data[ 4 * ( ( y * sy + j ) * width + x * sx + i ) + c ];
+                    data[ 4 * ( y * w + x ) + c ] = (T)( sum / (float)( sx * sy ) + rounding );
+                }
+            }
+        }
+        width = w;
+        height = h;
+    }
+
+    if( width != orig_width || height != orig_height )
+        slog( WARNING , IMAGE , "Texture %s is loaded at %dx%d instead of %dx%d, it exceeds the memory budget of textures." , name.c_str() , width , height , orig_width , orig_height );
+}
+
 Spectrum ImageTexture2D::GetColor( int x , int y ) const{
     // if there is no image, just crash
-    sAssertMsg(IS_PTR_VALID(m_memory) && IS_PTR_VALID(m_memory->m_rgb) , IMAGE , "Texture %s not loaded!" , m_name.c_str() );
+    sAssertMsg(IsValid() , IMAGE , "Texture %s not loaded!" , m_name.c_str() );
 
     // filter the texture coordinate
     texCoordFilter( x , y );
 
-    // get the offset
-    int offset = ( m_iTexHeight - 1 - y ) * m_iTexWidth + x;
-
-    // get the color
-    return m_memory->m_rgb[ offset ];
+    return texelColor( x , m_iTexHeight - 1 - y );
 }
 
 float ImageTexture2D::GetAlpha( int x , int y ) const{
     // if there is no image, just crash
-    sAssertMsg(IS_PTR_VALID(m_memory), IMAGE , "Texture %s not loaded!" , m_name.c_str() );
+    sAssertMsg(IsValid(), IMAGE , "Texture %s not loaded!" , m_name.c_str() );
 
     // in case of acquiring alpha value in a texture without this channel, 1.0 is returned by default.
-    if(IS_PTR_INVALID(m_memory->m_a))
+    if( !m_memory->m_hasAlpha )
         return 1.0f;
 
     // filter the texture coordinate
     texCoordFilter( x , y );
 
-    // get the offset
-    int offset = ( m_iTexHeight - 1 - y ) * m_iTexWidth + x;
+    return texelAlpha( x , m_iTexHeight - 1 - y );
+}
+
+Spectrum ImageTexture2D::texelColor( int x , int row ) const{
+    const auto& memory = *m_memory;
+    if( memory.m_blockTexels ){
+        unsigned int index;
+        const auto block = texelBlock( x , row , index );
+        int rgb[3];
+        DecodeBC1( block + ( memory.m_hasAlpha ? BC4_BLOCK_SIZE : 0 ) , index , rgb );
+        return Spectrum( rgb[0] * INV_255 , rgb[1] * INV_255 , rgb[2] * INV_255 );
+    }
+
+    const auto offset = texelOffset( x , row );
+    if( memory.m_ldrTexels ){
+        const auto texel = memory.m_ldrTexels + 4 * offset;
+        return Spectrum( texel[0] * INV_255 , texel[1] * INV_255 , texel[2] * INV_255 );
+    }
+    if( memory.m_halfTexels ){
+        const auto texel = memory.m_halfTexels + memory.m_halfChannels * offset;
+        return Spectrum( halfToFloat( texel[0] ) , halfToFloat( texel[1] ) , halfToFloat( texel[2] ) );
+    }
+    return memory.m_rgbTexels[ offset ];
+}
+
+float ImageTexture2D::texelAlpha( int x , int row ) const{
+    const auto& memory = *m_memory;
+    if( memory.m_blockTexels ){
+        unsigned int index;
+        const auto block = texelBlock( x , row , index );
+        return DecodeBC4( block , index ) * INV_255;
+    }
+
+    const auto offset = texelOffset( x , row );
+    if( memory.m_ldrTexels )
+        return memory.m_ldrTexels[ 4 * offset + 3 ] * INV_255;
+    if( memory.m_halfTexels )
+        return halfToFloat( memory.m_halfTexels[ memory.m_halfChannels * offset + 3 ] );
+    return memory.m_aTexels[ offset ];
+}
+
+void ImageTexture2D::compressBlocks( ImgMemory& memory , const unsigned char* data , bool alpha ) const{
+    const auto blocks_per_row = ( m_iTexWidth + 3 ) / 4;
+    const auto blocks_per_column = ( m_iTexHeight + 3 ) / 4;
+    memory.m_blockSize = alpha ? BC4_BLOCK_SIZE + BC1_BLOCK_SIZE : BC1_BLOCK_SIZE;
+    memory.m_blocks = make_large_array<unsigned char>( (size_t)blocks_per_row * blocks_per_column * memory.m_blockSize );
+
+    const auto compress = [&]( unsigned s , unsigned e ){
+        for( auto by = (int)s ; by < (int)e ; ++by ){
+            for( auto bx = 0 ; bx < blocks_per_row ; ++bx ){
+                // texels out of the image repeat the ones on the border
+                unsigned char texels[64];
+                for( auto i = 0 ; i < 16 ; ++i ){
+                    const auto x = std::min( bx * 4 + ( i & 3 ) , m_iTexWidth - 1 );
+                    const auto row = std::min( by * 4 + ( i >> 2 ) , m_iTexHeight - 1 );
+                    memcpy( texels + 4 * i , data + 4 * ( row * m_iTexWidth + x ) , 4 );
+                }
+
+                auto block = memory.m_blocks.get() + (size_t)( by * blocks_per_row + bx ) * memory.m_blockSize;
+                if( alpha ){
+                    EncodeBC4( texels , 3 , block );
+                    block += BC4_BLOCK_SIZE;
+                }
+                EncodeBC1( texels , block );
+            }
+        }
+    };
+    if( m_serialLoading )
+        compress( 0u , (unsigned)blocks_per_column );
+    else
+        ParallelFor( 0u , (unsigned)blocks_per_column , 1u , compress );
+
+    memory.m_tracked.Set( (size_t)blocks_per_row * blocks_per_column * memory.m_blockSize );
+    SORT_STATS(sTextureMemory += (StatsInt)blocks_per_row * blocks_per_column * memory.m_blockSize);
+    SORT_STATS(++sCompressedTextureCount);
+}
+
+void ImageTexture2D::storeHdr( ImgMemory& memory , const float* data , bool alpha ) const{
+    const auto total = m_iTexWidth * m_iTexHeight;
+    memory.m_hasAlpha = alpha;
+
+    // the sun in an environment map could easily be too bright for half precision
+    auto fits_half = true;
+    for( auto k = 0 ; k < total && fits_half ; ++k ){
+        for( auto c = 0 ; c < ( alpha ? 4 : 3 ) ; ++c )
+            fits_half &= fabs( data[4 * k + c] ) <= HALF_MAX;
+    }
+
+    if( fits_half ){
+        const auto channels = alpha ? 4u : 3u;
+        memory.m_halfChannels = channels;
+        memory.m_half = make_large_array<std::uint16_t>( (size_t)channels * total );
+        for (auto i = 0; i < m_iTexHeight; ++i) {
+            for (auto j = 0; j < m_iTexWidth; ++j) {
+                const auto k = i * m_iTexWidth + j;
+                auto texel = memory.m_half.get() + channels * texelOffset(j, i);
+                for (auto c = 0u; c < channels; ++c)
+                    texel[c] = floatToHalf(data[4 * k + c]);
+            }
+        }
+
+        memory.m_tracked.Set(sizeof(std::uint16_t) * channels * total);
+        SORT_STATS(sTextureMemory += sizeof(std::uint16_t) * channels * total);
+        return;
+    }
+
+    memory.m_rgb = make_large_array<Spectrum>(total);
+    for (auto i = 0; i < m_iTexHeight; ++i) {
+        for (auto j = 0; j < m_iTexWidth; ++j) {
+            const auto k = i * m_iTexWidth + j;
+            memory.m_rgb[texelOffset(j, i)] = Spectrum(data[4 * k], data[4 * k + 1], data[4 * k + 2]);
+        }
+    }
+
+    if( alpha ){
+        memory.m_a = make_large_array<float>(total);
+        for (auto i = 0; i < m_iTexHeight; ++i) {
+            for (auto j = 0; j < m_iTexWidth; ++j)
+                memory.m_a[texelOffset(j, i)] = data[4 * (i * m_iTexWidth + j) + 3];
+        }
+    }
 
-    // get the color
-    return m_memory->m_a[ offset ];
+    memory.m_tracked.Set((sizeof(Spectrum) + (alpha ? sizeof(float) : 0)) * total);
+    SORT_STATS(sTextureMemory += (sizeof(Spectrum) + (alpha ? sizeof(float) : 0)) * total);
 }
 
 // load image from file
 bool ImageTexture2D::LoadResource( const std::string str ){
+    auto memory = std::make_shared<ImgMemory>();
+    m_memory = memory;
+    m_name = str;
+
+    // texels decoded by another process on the same machine are mapped instead of being decoded again
+    const auto key = sharedKey();
+    if( key && mapShared( *memory , SharedBlob::Open( g_sharedCacheDir , key ) ) ){
+        SORT_STATS(++sSharedTextureCount);
+        return true;
+    }
+
+    if( !loadTexels( *memory ) )
+        return false;
+    bindTexels( *memory );
+    average();
+
+    if( key )
+        publishShared( *memory , key );
+    return true;
+}
+
+bool ImageTexture2D::loadTexels( ImgMemory& memory ){
     static const std::regex exr_reg(".*\\.exr$", std::regex_constants::icase);
 
-    m_memory = std::make_unique<ImgMemory>();
-    m_name = str;
     if (std::regex_match(m_name, exr_reg)) {
         float* out = nullptr;
         const char* err;
@@ -70,82 +274,235 @@ bool ImageTexture2D::LoadResource( const std::string str ){
         const auto ret = LoadEXR(&out, &m_iTexWidth, &m_iTexHeight, m_name.c_str(), &err);
 
         if (ret >= 0) {
-            const auto total = m_iTexWidth * m_iTexHeight;
-            m_memory->m_rgb = std::make_unique<Spectrum[]>(total);
-            for (auto i = 0; i < total; i++)
-                m_memory->m_rgb[i] = Spectrum(out[4 * i], out[4 * i + 1], out[4 * i + 2]);
+            fitTextureBudget(out, m_iTexWidth, m_iTexHeight, sizeof(std::uint16_t) * 3, m_name);
 
-            free(out);
+            // alpha of exr files is not taken
+            storeHdr(memory, out, false);
 
-            average();
+            free(out);
             return true;
         }
 
         return false;
     }
 
-    stbi_ldr_to_hdr_gamma(1.0f);
-    stbi_ldr_to_hdr_scale(1.0f);
-
     auto comp = 0;
-    const auto* data = stbi_loadf(m_name.c_str(), &m_iTexWidth, &m_iTexHeight, &comp, STBI_rgb_alpha);
 
-    if (data) {
-        if( m_iTexWidth > 0 && m_iTexHeight > 0 ){
-            m_memory->m_rgb = std::make_unique<Spectrum[]>(m_iTexWidth*m_iTexHeight);
-            for (auto i = 0; i < m_iTexHeight; ++i) {
-                for (auto j = 0; j < m_iTexWidth; ++j) {
-                    const auto k = i * m_iTexWidth + j;
+    // low dynamic range images only have 8 bits per channel, there is no need to expand them to floating point.
+    if (!stbi_is_hdr(m_name.c_str())) {
+        auto* data = stbi_load(m_name.c_str(), &m_iTexWidth, &m_iTexHeight, &comp, STBI_rgb_alpha);
+        if (!data)
+            return false;
 
-                    auto& color = m_memory->m_rgb[i * m_iTexWidth + j];
+        // there is alpha channel in the texture.
+        memory.m_hasAlpha = comp == STBI_rgb_alpha;
 
-                    color.r = data[4 * k];
-                    color.g = data[4 * k + 1];
-                    color.b = data[4 * k + 2];
+        if( m_iTexWidth > 0 && m_iTexHeight > 0 ){
+            if( g_textureCompression ){
+                // BC1 takes half a byte per texel, BC4 takes another half for alpha
+                fitTextureBudget(data, m_iTexWidth, m_iTexHeight, memory.m_hasAlpha ? 1.0f : 0.5f, m_name);
+                compressBlocks(memory, data, memory.m_hasAlpha);
+            }else{
+                fitTextureBudget(data, m_iTexWidth, m_iTexHeight, 4, m_name);
+
+                const auto total = m_iTexWidth * m_iTexHeight;
+                memory.m_ldr = make_large_array<unsigned char>(4 * total);
+                for (auto i = 0; i < m_iTexHeight; ++i) {
+                    for (auto j = 0; j < m_iTexWidth; ++j) {
+                        const auto k = i * m_iTexWidth + j;
+                        memcpy(memory.m_ldr.get() + 4 * texelOffset(j, i), data + 4 * k, 4);
+                    }
                 }
+
+                memory.m_tracked.Set(4 * total);
+                SORT_STATS(sTextureMemory += 4 * total);
             }
         }
 
-        // there is alpha channel in the texture.
-        if( comp == STBI_rgb_alpha ){
-            m_memory->m_a = std::make_unique<float[]>(m_iTexWidth*m_iTexHeight);
-            for (auto i = 0; i < m_iTexHeight; ++i) {
-                for (auto j = 0; j < m_iTexWidth; ++j) {
-                    const auto k = i * m_iTexWidth + j;
+        stbi_image_free((void*)data);
+        return true;
+    }
 
-                    auto& alpha = m_memory->m_a[i * m_iTexWidth + j];
+    stbi_ldr_to_hdr_gamma(1.0f);
+    stbi_ldr_to_hdr_scale(1.0f);
 
-                    alpha = data[4 * k + 3];
-                }
-            }
+    auto* data = stbi_loadf(m_name.c_str(), &m_iTexWidth, &m_iTexHeight, &comp, STBI_rgb_alpha);
+
+    if (data) {
+        if( m_iTexWidth > 0 && m_iTexHeight > 0 ){
+            const auto alpha = comp == STBI_rgb_alpha;
+            fitTextureBudget(data, m_iTexWidth, m_iTexHeight, sizeof(std::uint16_t) * ( alpha ? 4 : 3 ), m_name);
+            storeHdr(memory, data, alpha);
         }
 
         stbi_image_free((void*)data);
-
-        average();
         return true;
     }
     return false;
 }
 
+bool ImageTexture2D::LoadResourceSerially( const std::string& str ){
+    m_serialLoading = true;
+    const auto ret = LoadResource( str );
+    m_serialLoading = false;
+    return ret;
+}
+
 Spectrum ImageTexture2D::GetAverage() const{
     return m_average;
 }
 
+bool ImageTexture2D::ShareResource( const Resource& other ){
+    const auto texture = dynamic_cast<const ImageTexture2D*>( &other );
+    if( !texture || !texture->IsValid() )
+        return false;
+
+    m_memory = texture->m_memory;
+    m_iTexWidth = texture->m_iTexWidth;
+    m_iTexHeight = texture->m_iTexHeight;
+    m_average = texture->m_average;
+    m_name = texture->m_name;
+    return true;
+}
+
 void ImageTexture2D::average(){
     // if there is no image, just crash
-    if(IS_PTR_INVALID(m_memory) || IS_PTR_INVALID(m_memory->m_rgb))
+    if(IS_PTR_INVALID(m_memory) || m_iTexWidth <= 0 || m_iTexHeight <= 0 )
         return;
 
+    // texels are decoded one by one, whatever the format is
+    const auto total = m_iTexWidth * m_iTexHeight;
     Spectrum average;
     for (auto i = 0; i < m_iTexHeight; ++i) {
-        for (auto j = 0; j < m_iTexWidth; ++j) {
-            // get the offset
-            int offset = i * m_iTexWidth + j;
-            // get the color
-            average += m_memory->m_rgb[offset];
-        }
+        for (auto j = 0; j < m_iTexWidth; ++j)
+            average += texelColor( j , i );
     }
 
-    m_average = average / (float)( m_iTexWidth * m_iTexHeight );
+    m_average = average / (float)( total );
+}
+
+void ImageTexture2D::bindTexels( ImgMemory& memory ) const{
+    memory.m_ldrTexels = memory.m_ldr.get();
+    memory.m_blockTexels = memory.m_blocks.get();
+    memory.m_halfTexels = memory.m_half.get();
+    memory.m_rgbTexels = memory.m_rgb.get();
+    memory.m_aTexels = memory.m_a.get();
+}
+
+std::uint64_t ImageTexture2D::sharedKey() const{
+    if( g_sharedCacheDir.empty() )
+        return 0;
+
+    // the image file, instead of its content, identifies the texels so that hashing the whole image is not needed
+    std::error_code err;
+    const auto file_size = (std::uint64_t)std::filesystem::file_size( m_name , err );
+    if( err )
+        return 0;
+    const auto write_time = (std::int64_t)std::filesystem::last_write_time( m_name , err ).time_since_epoch().count();
+    const auto path = std::filesystem::absolute( m_name , err ).string();
+
+    // anything changing how texels are stored changes the key too
+    auto key = HashBytes( path.data() , path.size() );
+    key = HashValue( file_size , key );
+    key = HashValue( write_time , key );
+    key = HashValue( g_textureCompression , key );
+    key = HashValue( g_textureBudget , key );
+    key = HashValue( (unsigned int)sizeof( Spectrum ) , key );
+    key = HashValue( IMAGE_TEXTURE_SHARED_VERSION , key );
+    return std::max( key , (std::uint64_t)1 );
+}
+
+bool ImageTexture2D::mapShared( ImgMemory& memory , const std::shared_ptr<const SharedBlob>& blob ){
+    if( !blob || blob->GetSize() < sizeof( SharedTexelInfo ) )
+        return false;
+
+    SharedTexelInfo info;
+    memcpy( &info , blob->GetData() , sizeof( info ) );
+    if( info.width <= 0 || info.height <= 0 || info.hasAlpha > 1 )
+        return false;
+
+    // nothing in the blob is trusted, the arrays need to be exactly what one of the formats takes
+    const auto total = (std::uint64_t)info.width * info.height;
+    const auto blocks = (std::uint64_t)( ( info.width + 3 ) / 4 ) * ( ( info.height + 3 ) / 4 );
+    const auto block_size = info.hasAlpha ? BC4_BLOCK_SIZE + BC1_BLOCK_SIZE : BC1_BLOCK_SIZE;
+    const auto half_channels = info.hasAlpha ? 4u : 3u;
+    const std::uint64_t formats[][5] = {
+        { 4 * total , 0 , 0 , 0 , 0 },
+        { 0 , blocks * block_size , 0 , 0 , 0 },
+        { 0 , 0 , sizeof( std::uint16_t ) * half_channels * total , 0 , 0 },
+        { 0 , 0 , 0 , sizeof( Spectrum ) * total , info.hasAlpha ? sizeof( float ) * total : 0 },
+    };
+    auto valid = false;
+    for( const auto& format : formats )
+        valid |= std::equal( format , format + 5 , info.sizes );
+    if( !valid )
+        return false;
+
+    std::vector<SharedBlob::Chunk> chunks = { { nullptr , sizeof( info ) } };
+    for( const auto size : info.sizes )
+        chunks.push_back( { nullptr , (std::size_t)size } );
+    if( SharedBlob::ChunkOffset( chunks , chunks.size() - 1 ) + chunks.back().size > blob->GetSize() )
+        return false;
+
+    const auto array = [&]( unsigned i ){
+        return info.sizes[i] ? blob->GetData() + SharedBlob::ChunkOffset( chunks , i + 1 ) : nullptr;
+    };
+    memory.m_ldrTexels = (const unsigned char*)array( 0 );
+    memory.m_blockTexels = (const unsigned char*)array( 1 );
+    memory.m_halfTexels = (const std::uint16_t*)array( 2 );
+    memory.m_rgbTexels = (const Spectrum*)array( 3 );
+    memory.m_aTexels = (const float*)array( 4 );
+    memory.m_blockSize = memory.m_blockTexels ? block_size : 0;
+    memory.m_halfChannels = memory.m_halfTexels ? half_channels : 0;
+    memory.m_hasAlpha = info.hasAlpha != 0;
+    memory.m_shared = blob;
+    m_iTexWidth = info.width;
+    m_iTexHeight = info.height;
+    m_average = Spectrum( info.average[0] , info.average[1] , info.average[2] );
+    return true;
+}
+
+void ImageTexture2D::publishShared( ImgMemory& memory , std::uint64_t key ){
+    if( m_iTexWidth <= 0 || m_iTexHeight <= 0 )
+        return;
+
+    const auto total = (std::uint64_t)m_iTexWidth * m_iTexHeight;
+    const auto blocks = (std::uint64_t)( ( m_iTexWidth + 3 ) / 4 ) * ( ( m_iTexHeight + 3 ) / 4 );
+
+    SharedTexelInfo info;
+    memset( &info , 0 , sizeof( info ) );
+    info.width = m_iTexWidth;
+    info.height = m_iTexHeight;
+    info.blockSize = memory.m_blockSize;
+    info.halfChannels = memory.m_halfChannels;
+    info.hasAlpha = memory.m_hasAlpha ? 1 : 0;
+    info.average[0] = m_average.r;
+    info.average[1] = m_average.g;
+    info.average[2] = m_average.b;
+    info.sizes[0] = memory.m_ldr ? 4 * total : 0;
+    info.sizes[1] = memory.m_blocks ? blocks * memory.m_blockSize : 0;
+    info.sizes[2] = memory.m_half ? sizeof( std::uint16_t ) * memory.m_halfChannels * total : 0;
+    info.sizes[3] = memory.m_rgb ? sizeof( Spectrum ) * total : 0;
+    info.sizes[4] = memory.m_a ? sizeof( float ) * total : 0;
+
+    const std::vector<SharedBlob::Chunk> chunks = {
+        { &info , sizeof( info ) },
+        { memory.m_ldr.get() , (std::size_t)info.sizes[0] },
+        { memory.m_blocks.get() , (std::size_t)info.sizes[1] },
+        { memory.m_half.get() , (std::size_t)info.sizes[2] },
+        { memory.m_rgb.get() , (std::size_t)info.sizes[3] },
+        { memory.m_a.get() , (std::size_t)info.sizes[4] },
+    };
+
+    // the private copy is released once the texels are mapped from the shared cache
+    if( !mapShared( memory , SharedBlob::Publish( g_sharedCacheDir , key , chunks ) ) ){
+        bindTexels( memory );
+        return;
+    }
+    memory.m_ldr = nullptr;
+    memory.m_blocks = nullptr;
+    memory.m_half = nullptr;
+    memory.m_rgb = nullptr;
+    memory.m_a = nullptr;
+    memory.m_tracked.Set( 0 );
 }
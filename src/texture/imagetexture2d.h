@@ -18,12 +18,28 @@
 #pragma once
 
 #include <memory>
+#include <cstdint>
+#include <algorithm>
 #include "core/resource.h"
 #include "texturebase.h"
+#include "core/memory.h"
+#include "core/sharedblob.h"
+
+//! @brief  Size of a square tile of texels in image textures.
+constexpr int IMAGE_TEXTURE_TILE_SIZE = 64;
 
 //! @brief  Image texture.
 /**
  * Image texture is the most commonly used texture. It is just a two dimensional set of pixels.
+ * Texels are stored in tiles of 64x64, so that the four texels of a bilinear lookup and lookups of nearby shading points
+ * mostly hit the same cache lines. Tiles on the right and bottom border are packed tightly, no memory is wasted for
+ * textures whose size is not a multiple of the tile size.
+ * Low dynamic range images are kept in 8 bits per channel, which is exactly what is stored in the file. They could be
+ * compressed further in BC1 blocks, or BC3 blocks if there is alpha, which take 4 or 8 bits per texel. Blocks are
+ * decoded on every lookup, a texel only takes a few integer operations. High dynamic range images, like exr and hdr,
+ * are kept in half precision unless some texels are too bright for it, they are kept in floating point then.
+ * With a shared cache directory, texels decoded by one process are published there and mapped by all other processes on
+ * the same machine loading the same file, which keeps a single physical copy of them.
  * There is no mip-map solution for now.
  */
 class ImageTexture2D : public Texture2DBase, public Resource{
@@ -34,6 +50,21 @@ public:
     //! @return                 Whether the file has been loaded successfully.
     bool LoadResource(const std::string filename) override;
 
+    //! @brief  Load the resource from file without forking any task.
+    //!
+    //! Textures loaded lazily in the middle of rendering can't fork tasks, the worker joining them could pick a task
+    //! that waits for the very same texture.
+    //!
+    //! @param  filename        Name of the external file holding the data.
+    //! @return                 Whether the file has been loaded successfully.
+    bool LoadResourceSerially(const std::string& filename);
+
+    //! @brief  Share the texels of another image texture loaded from a file of the same content.
+    //!
+    //! @param  other           The image texture that has already been loaded.
+    //! @return                 Whether the texels are shared.
+    bool ShareResource(const Resource& other) override;
+
     //! @brief  Get the color at a specific position.
     //!
     //! @param  x           X coordinate. If out of range, it will be filtered.
@@ -63,12 +94,27 @@ public:
 private:
     class ImgMemory{
     public:
-        std::unique_ptr<Spectrum[]>     m_rgb = nullptr;   /**< RGB Channels. */
-        std::unique_ptr<float[]>        m_a  = nullptr;   /**< Alpha Channel. */
+        // Texels are looked up through these, they point either to the arrays below or to the shared blob.
+        const unsigned char*                m_ldrTexels = nullptr;
+        const unsigned char*                m_blockTexels = nullptr;
+        const std::uint16_t*                m_halfTexels = nullptr;
+        const Spectrum*                     m_rgbTexels = nullptr;
+        const float*                        m_aTexels = nullptr;
+
+        LargeArray<unsigned char>           m_ldr = nullptr;    /**< RGBA channels of low dynamic range images in 8 bits. */
+        LargeArray<unsigned char>           m_blocks = nullptr; /**< Compressed blocks of low dynamic range images, row by row. */
+        unsigned int                        m_blockSize = 0;    /**< Size of a compressed block in bytes, a BC4 block of alpha goes before the BC1 block if there is alpha. */
+        LargeArray<std::uint16_t>           m_half = nullptr;   /**< RGB channels of high dynamic range images in half precision, followed by alpha if there is. */
+        unsigned int                        m_halfChannels = 0; /**< Number of channels of each texel in half precision. */
+        LargeArray<Spectrum>                m_rgb = nullptr;    /**< RGB Channels of high dynamic range images too bright for half precision. */
+        LargeArray<float>                   m_a  = nullptr;     /**< Alpha Channel of high dynamic range images too bright for half precision. */
+        bool                                m_hasAlpha = false; /**< Whether there is alpha channel in the image. */
+        TrackedMemory                       m_tracked = TrackedMemory( MemoryCategory::Texture );  /**< Memory of the texels accounted in the memory of textures. */
+        std::shared_ptr<const SharedBlob>   m_shared = nullptr; /**< Texels shared by processes on the same machine, they are not accounted as they are paged by the OS. */
     };
 
-    // array saving the color of image
-    std::unique_ptr<ImgMemory>  m_memory = nullptr;
+    // array saving the color of image, textures loaded from identical files share it
+    std::shared_ptr<const ImgMemory>    m_memory = nullptr;
 
     // the average radiance of the texture
     Spectrum    m_average;
@@ -76,6 +122,49 @@ private:
     // texture name
     std::string m_name;
 
+    // whether the texture is loaded without forking any task
+    bool        m_serialLoading = false;
+
     // compute average radiance
     void    average();
+
+    // decode the texels from the file
+    bool    loadTexels( ImgMemory& memory );
+
+    // look up the texels in the arrays owned by the texture
+    void    bindTexels( ImgMemory& memory ) const;
+
+    // key of the texels in the shared cache, zero if they can't be shared
+    std::uint64_t   sharedKey() const;
+
+    // map the texels published by some process, the texels are published if nobody has done it
+    bool    mapShared( ImgMemory& memory , const std::shared_ptr<const SharedBlob>& blob );
+    void    publishShared( ImgMemory& memory , std::uint64_t key );
+
+    // color and alpha of a texel in any of the formats, 'row' counts from the top of the image
+    Spectrum    texelColor( int x , int row ) const;
+    float       texelAlpha( int x , int row ) const;
+
+    // compress texels of 8 bits per channel, row by row, into blocks
+    void    compressBlocks( ImgMemory& memory , const unsigned char* data , bool alpha ) const;
+
+    // keep texels of floating point, row by row, in half precision if possible
+    void    storeHdr( ImgMemory& memory , const float* data , bool alpha ) const;
+
+    // offset of the compressed block holding a texel and the index of the texel in the block
+    SORT_FORCEINLINE const unsigned char* texelBlock( int x , int row , unsigned int& index ) const{
+        const auto blocks_per_row = ( m_iTexWidth + 3 ) / 4;
+        index = ( ( row & 3 ) << 2 ) | ( x & 3 );
+        return m_memory->m_blockTexels + (size_t)( ( row >> 2 ) * blocks_per_row + ( x >> 2 ) ) * m_memory->m_blockSize;
+    }
+
+    // offset of a texel in the tiled storage, 'row' counts from the top of the image
+    SORT_FORCEINLINE int texelOffset( int x , int row ) const{
+        const auto tx = x / IMAGE_TEXTURE_TILE_SIZE;
+        const auto ty = row / IMAGE_TEXTURE_TILE_SIZE;
+        const auto tw = std::min( IMAGE_TEXTURE_TILE_SIZE , m_iTexWidth - tx * IMAGE_TEXTURE_TILE_SIZE );
+        const auto th = std::min( IMAGE_TEXTURE_TILE_SIZE , m_iTexHeight - ty * IMAGE_TEXTURE_TILE_SIZE );
+        return  ty * IMAGE_TEXTURE_TILE_SIZE * m_iTexWidth + tx * IMAGE_TEXTURE_TILE_SIZE * th +
+                ( row - ty * IMAGE_TEXTURE_TILE_SIZE ) * tw + ( x - tx * IMAGE_TEXTURE_TILE_SIZE );
+    }
 };
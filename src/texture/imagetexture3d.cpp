@@ -25,8 +25,23 @@ T ImageTexture3D<T>::Sample(int x, int y, int z) const {
     if (x < 0 || x >= (int)Texture3DBase<T>::m_width || y < 0 || y >= (int)Texture3DBase<T>::m_height || z < 0 || z >= (int)Texture3DBase<T>::m_depth)
         return 0.0f;
 
-    const auto offset = z * Texture3DBase<T>::m_width * Texture3DBase<T>::m_height + y * Texture3DBase<T>::m_width + x;
-    return m_memory->m_texel[offset];
+    return m_memory->m_texel[texelOffset(x, y, z)];
+}
+
+template<class T>
+void ImageTexture3D<T>::setTexels(const T* texels) {
+    const unsigned dim[3] = { Texture3DBase<T>::m_width , Texture3DBase<T>::m_height , Texture3DBase<T>::m_depth };
+    for (auto i = 0; i < 3; ++i)
+        m_brickRes[i] = (dim[i] + BRICK_SIZE - 1) / BRICK_SIZE;
+
+    m_memory = std::make_unique<ImgMemory<T>>();
+    const auto texel_cnt = (size_t)m_brickRes[0] * m_brickRes[1] * m_brickRes[2] * BRICK_TEXEL_CNT;
+    m_memory->m_texel = std::make_unique<T[]>(texel_cnt);
+    m_memory->m_tracked.Set(sizeof(T) * texel_cnt);
+    for (auto z = 0u; z < dim[2]; ++z)
+        for (auto y = 0u; y < dim[1]; ++y)
+            for (auto x = 0u; x < dim[0]; ++x)
+                m_memory->m_texel[texelOffset(x, y, z)] = texels[((size_t)z * dim[1] + y) * dim[0] + x];
 }
 
 template<class T>
@@ -53,20 +68,15 @@ T ImageTexture3D<T>::Sample(float u, float v, float w) const{
     const auto dy = fy - y;
     const auto dz = fz - z;
 
-    const auto slice_strand = width * height;
-    const auto offset00 = z * slice_strand + y * width + x;
-    const auto offset01 = (x < width - 1) ? offset00 + 1 : offset00;
-    const auto offset10 = (z < depth - 1) ? offset00 + slice_strand : offset00;
-    const auto offset11 = (x < width - 1) ? offset10 + 1 : offset10;
-    const auto offset20 = (y < height - 1) ? offset00 + width : offset00;
-    const auto offset21 = (x < width - 1) ? offset20 + 1 : offset20;
-    const auto offset30 = (z < depth - 1) ? offset20 + slice_strand : offset20;
-    const auto offset31 = (x < width - 1) ? offset30 + 1 : offset30;
-
-    const auto t0 = slerp(m_memory->m_texel[offset00], m_memory->m_texel[offset01], dx);
-    const auto t1 = slerp(m_memory->m_texel[offset10], m_memory->m_texel[offset11], dx);
-    const auto t2 = slerp(m_memory->m_texel[offset20], m_memory->m_texel[offset21], dx);
-    const auto t3 = slerp(m_memory->m_texel[offset30], m_memory->m_texel[offset31], dx);
+    const auto x1 = (x < width - 1) ? x + 1 : x;
+    const auto y1 = (y < height - 1) ? y + 1 : y;
+    const auto z1 = (z < depth - 1) ? z + 1 : z;
+
+    const auto& texel = m_memory->m_texel;
+    const auto t0 = slerp(texel[texelOffset(x, y, z)], texel[texelOffset(x1, y, z)], dx);
+    const auto t1 = slerp(texel[texelOffset(x, y, z1)], texel[texelOffset(x1, y, z1)], dx);
+    const auto t2 = slerp(texel[texelOffset(x, y1, z)], texel[texelOffset(x1, y1, z)], dx);
+    const auto t3 = slerp(texel[texelOffset(x, y1, z1)], texel[texelOffset(x1, y1, z1)], dx);
 
     const auto t02 = slerp(t0, t2, dy);
     const auto t13 = slerp(t1, t3, dy);
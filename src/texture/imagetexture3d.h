@@ -17,11 +17,16 @@
 
 #pragma once
 
+#include <memory>
 #include "texturebase.h"
+#include "core/memory.h"
 
 //! @brief  3D image texture.
 /**
  * 3D image texture is a three dimentional set of pixel data.
+ * Texels are stored in bricks of 4x4x4, the eight texels of a trilinear lookup are mostly in the same brick, which is
+ * only a few cache lines. With texels stored slice by slice, the two slices of a lookup are far apart in memory.
+ * Bricks on the border are padded.
  */
 template<class T>
 class ImageTexture3D : public Texture3DBase<T>{
@@ -44,12 +49,31 @@ public:
     T Sample(float u, float v, float w) const override;
 
 protected:
+    /**< Number of texels in a brick along an axis. */
+    static constexpr unsigned BRICK_SIZE = 4;
+    /**< Number of texels in a brick. */
+    static constexpr unsigned BRICK_TEXEL_CNT = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+
     template<class D>
     class ImgMemory {
     public:
         std::unique_ptr<D[]>     m_texel = nullptr;   /**< RGB Channels. */
+        TrackedMemory            m_tracked = TrackedMemory(MemoryCategory::Volume);    /**< Memory of the texels accounted in the memory of volumes. */
     };
 
     /**< 3d texture memory. */
     std::unique_ptr<ImgMemory<T>>  m_memory = nullptr;
+    /**< Number of bricks along each axis. */
+    unsigned                       m_brickRes[3] = { 0u , 0u , 0u };
+
+    //! @brief  Copy texels into bricks, the size of the texture needs to be set already.
+    //!
+    //! @param  texels  Texels ordered slice by slice, then row by row.
+    void    setTexels(const T* texels);
+
+    //! @brief  Offset of a texel in the bricked storage.
+    SORT_FORCEINLINE size_t texelOffset(unsigned x, unsigned y, unsigned z) const {
+        const auto brick = ((size_t)(z / BRICK_SIZE) * m_brickRes[1] + y / BRICK_SIZE) * m_brickRes[0] + x / BRICK_SIZE;
+        return brick * BRICK_TEXEL_CNT + ((z % BRICK_SIZE) * BRICK_SIZE + y % BRICK_SIZE) * BRICK_SIZE + x % BRICK_SIZE;
+    }
 };
\ No newline at end of file
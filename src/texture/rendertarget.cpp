@@ -27,10 +27,12 @@ void RenderTarget::SetColor( int x , int y , const Spectrum& color ){
     texCoordFilter( x , y );
 
     // get the offset
-    unsigned offset = y * m_iTexWidth + x;
+    const auto offset = ( (size_t)y * m_iTexWidth + x ) * 3;
 
     // set the color
-    m_pData[offset] = color;
+    m_pData[offset] = color.r;
+    m_pData[offset + 1] = color.g;
+    m_pData[offset + 2] = color.b;
 }
 
 Spectrum RenderTarget::GetColor( int x , int y ) const{
@@ -40,7 +42,7 @@ Spectrum RenderTarget::GetColor( int x , int y ) const{
     texCoordFilter( x , y );
 
     // get the offset
-    int offset = y * m_iTexWidth + x;
+    const auto offset = ( (size_t)y * m_iTexWidth + x ) * 3;
 
-    return m_pData[offset];
+    return Spectrum( m_pData[offset] , m_pData[offset + 1] , m_pData[offset + 2] );
 }
\ No newline at end of file
@@ -19,16 +19,18 @@
 
 #include <memory>
 #include "texturebase.h"
+#include "core/memory.h"
 
+// Pixels are packed in three floats each, a Spectrum takes four of them once it is padded for SSE.
 class   RenderTarget : public Texture2DBase{
 public:
     RenderTarget( int w , int h ) : Texture2DBase( w , h ){
-        m_pData = std::make_unique<Spectrum[]>( w * h );
+        m_pData = make_large_array<float>( (size_t)w * h * 3 );
     }
 
     void SetColor( int x , int y , const Spectrum& c );
     Spectrum GetColor( int x , int y ) const;
 
 private:
-    std::unique_ptr<Spectrum[]> m_pData;
+    LargeArray<float>           m_pData;
 };
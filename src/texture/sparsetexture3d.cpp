@@ -0,0 +1,543 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cstring>
+#include <fstream>
+#include "sparsetexture3d.h"
+#include "stream/stream.h"
+#include "core/sassert.h"
+#include "core/log.h"
+
+namespace {
+    // Unlike slerp, interpolating between two equal texels returns exactly the same value, constant regions stay constant.
+    SORT_FORCEINLINE float texelLerp( const float a , const float b , const float t ){
+        return a + ( b - a ) * t;
+    }
+
+    std::uint16_t floatToHalf( const float f ){
+        std::uint32_t x;
+        memcpy( &x , &f , sizeof( x ) );
+
+        const auto sign = ( x >> 16 ) & 0x8000;
+        const auto exp = (int)( ( x >> 23 ) & 0xff ) - 127 + 15;
+        auto mantissa = x & 0x7fffff;
+
+        // infinite and nan
+        if( ( ( x >> 23 ) & 0xff ) == 0xff )
+            return (std::uint16_t)( sign | 0x7c00 | ( mantissa ? 0x200 : 0 ) );
+        // overflow
+        if( exp >= 31 )
+            return (std::uint16_t)( sign | 0x7c00 );
+        // denormalized half, or zero if it is too small
+        if( exp <= 0 ){
+            if( exp < -10 )
+                return (std::uint16_t)sign;
+            mantissa |= 0x800000;
+            const auto shift = 14 - exp;
+            auto half = mantissa >> shift;
+            if( ( mantissa >> ( shift - 1 ) ) & 1 )
+                ++half;
+            return (std::uint16_t)( sign | half );
+        }
+
+        // rounding could carry into the exponent, which is still correct
+        auto half = sign | ( exp << 10 ) | ( mantissa >> 13 );
+        if( mantissa & 0x1000 )
+            ++half;
+        return (std::uint16_t)half;
+    }
+
+    float halfToFloat( const std::uint16_t h ){
+        const auto sign = (std::uint32_t)( h & 0x8000 ) << 16;
+        auto exp = (int)( ( h >> 10 ) & 0x1f );
+        auto mantissa = (std::uint32_t)( h & 0x3ff );
+
+        std::uint32_t x;
+        if( exp == 0 ){
+            if( mantissa == 0 ){
+                x = sign;
+            }else{
+                // normalize the denormalized half
+                exp = 1;
+                while( !( mantissa & 0x400 ) ){
+                    mantissa <<= 1;
+                    --exp;
+                }
+                mantissa &= 0x3ff;
+                x = sign | ( ( exp + 112 ) << 23 ) | ( mantissa << 13 );
+            }
+        }else if( exp == 31 ){
+            x = sign | 0x7f800000 | ( mantissa << 13 );
+        }else{
+            x = sign | ( ( exp + 112 ) << 23 ) | ( mantissa << 13 );
+        }
+
+        float f;
+        memcpy( &f , &x , sizeof( f ) );
+        return f;
+    }
+
+    // Layout of NanoVDB files of major version 32, only the fields used here are listed. Everything in a grid is
+    // addressed by byte offsets, so it is read in place once it is loaded.
+    constexpr std::uint64_t NANOVDB_MAGIC = 0x4244566f6e614eull;          // "NanoVDB", the last character differs across versions
+    constexpr std::uint64_t NANOVDB_MAGIC_MASK = 0xffffffffffffffull;
+    constexpr unsigned      NANOVDB_MAJOR_VERSION = 32;
+    constexpr unsigned      NANOVDB_GRID_TYPE_FLOAT = 1;
+    constexpr size_t        NANOVDB_FILE_HEADER_SIZE = 16;
+    constexpr size_t        NANOVDB_FILE_META_SIZE = 176;
+    constexpr size_t        NANOVDB_GRID_TYPE = 636;            // offset of the grid type in the grid
+    constexpr size_t        NANOVDB_TREE = 672;                 // offset of the tree, right after the grid
+    constexpr size_t        NANOVDB_TREE_SIZE = 64;
+    constexpr size_t        NANOVDB_ROOT_SIZE = 64;             // the table of tiles follows the root
+    constexpr size_t        NANOVDB_ROOT_TILE_SIZE = 32;
+    constexpr unsigned      NANOVDB_ROOT_CHILD_DIM = 4096;
+    constexpr size_t        NANOVDB_LEAF_VALUES = 96;
+    constexpr size_t        NANOVDB_LEAF_SIZE = 2144;
+
+    // Layout of an internal node of NanoVDB, it has 2^(3*log2dim) children or tiles.
+    struct NanoVDBNodeLayout {
+        unsigned    log2dim;        // number of children along an axis in log2
+        unsigned    child_dim;      // number of voxels covered by a child along an axis
+        size_t      child_mask;     // offset of the mask of children
+        size_t      table;          // offset of the table of children and tiles
+        size_t      size;           // size of the node
+    };
+
+    constexpr NanoVDBNodeLayout nanovdbNodeLayout( const unsigned log2dim , const unsigned child_dim ){
+        // bounding box and flags go first, followed by the masks of values and children, then the statistics
+        const size_t mask_size = ( (size_t)1 << ( 3 * log2dim ) ) / 8;
+        const size_t table = ( 32 + 2 * mask_size + 16 + 31 ) & ~(size_t)31;
+        return { log2dim , child_dim , 32 + mask_size , table , table + ( (size_t)8 << ( 3 * log2dim ) ) };
+    }
+
+    constexpr NanoVDBNodeLayout NANOVDB_LOWER = nanovdbNodeLayout( 4 , 8 );
+    constexpr NanoVDBNodeLayout NANOVDB_UPPER = nanovdbNodeLayout( 5 , 128 );
+
+    template<class T>
+    SORT_FORCEINLINE T fetch( const char* data , const size_t offset ){
+        T ret;
+        memcpy( &ret , data + offset , sizeof( T ) );
+        return ret;
+    }
+
+    SORT_FORCEINLINE unsigned texelSize( const VolumeQuantization quantization ){
+        switch( quantization ){
+        case VOLUME_QUANTIZATION_HALF:
+            return sizeof( std::uint16_t );
+        case VOLUME_QUANTIZATION_BYTE:
+            return sizeof( std::uint8_t );
+        default:
+            return sizeof( float );
+        }
+    }
+}
+
+float SparseTexture3D::Sample(int x, int y, int z) const {
+    if (x < 0 || x >= (int)m_width || y < 0 || y >= (int)m_height || z < 0 || z >= (int)m_depth)
+        return 0.0f;
+
+    const auto brick = getBrick(x / BRICK_SIZE, y / BRICK_SIZE, z / BRICK_SIZE);
+    if (IS_PTR_INVALID(brick))
+        return 0.0f;
+    if (brick->m_slot == INVALID)
+        return brick->m_min;
+
+    const auto local = ((z % BRICK_SIZE) * BRICK_SIZE + (y % BRICK_SIZE)) * BRICK_SIZE + (x % BRICK_SIZE);
+    const auto index = (size_t)brick->m_slot * BRICK_TEXEL_CNT + local;
+    switch (m_quantization) {
+    case VOLUME_QUANTIZATION_HALF:
+        return halfToFloat(((const std::uint16_t*)m_texels.data())[index]);
+    case VOLUME_QUANTIZATION_BYTE:
+        return brick->m_min + (brick->m_max - brick->m_min) * m_texels[index] * (1.0f / 255.0f);
+    default:
+        return ((const float*)m_texels.data())[index];
+    }
+}
+
+float SparseTexture3D::Sample(float u, float v, float w) const {
+    // Same as the dense 3D texture, out of range uvw returns 0.0, texels are clamped on the border.
+    if (u < 0.0f || u >= 1.0f || v < 0.0f || v >= 1.0f || w < 0.0f || w >= 1.0f)
+        return 0.0f;
+
+    const auto fx = u * m_width - 0.5f;
+    const auto fy = v * m_height - 0.5f;
+    const auto fz = w * m_depth - 0.5f;
+
+    const auto x = std::max(0, (int)floor(fx));
+    const auto y = std::max(0, (int)floor(fy));
+    const auto z = std::max(0, (int)floor(fz));
+
+    const auto dx = clamp(fx - x, 0.0f, 1.0f);
+    const auto dy = clamp(fy - y, 0.0f, 1.0f);
+    const auto dz = clamp(fz - z, 0.0f, 1.0f);
+
+    const auto x1 = std::min(x + 1, (int)m_width - 1);
+    const auto y1 = std::min(y + 1, (int)m_height - 1);
+    const auto z1 = std::min(z + 1, (int)m_depth - 1);
+
+    // Most of the time, all eight texels are in the same brick, it is only looked up once.
+    const auto bx = x / BRICK_SIZE, by = y / BRICK_SIZE, bz = z / BRICK_SIZE;
+    if (x1 / BRICK_SIZE == bx && y1 / BRICK_SIZE == by && z1 / BRICK_SIZE == bz) {
+        const auto brick = getBrick(bx, by, bz);
+        if (IS_PTR_INVALID(brick))
+            return 0.0f;
+        if (brick->m_slot == INVALID)
+            return brick->m_min;
+
+        const auto base = (size_t)brick->m_slot * BRICK_TEXEL_CNT + ((z % BRICK_SIZE) * BRICK_SIZE + (y % BRICK_SIZE)) * BRICK_SIZE + (x % BRICK_SIZE);
+        const size_t ox = x1 - x, oy = (y1 - y) * BRICK_SIZE, oz = (z1 - z) * BRICK_SIZE * BRICK_SIZE;
+        const size_t offsets[8] = { 0, ox, oz, ox + oz, oy, ox + oy, oy + oz, ox + oy + oz };
+
+        float texels[8];
+        switch (m_quantization) {
+        case VOLUME_QUANTIZATION_HALF:
+            for (auto i = 0; i < 8; ++i)
+                texels[i] = halfToFloat(((const std::uint16_t*)m_texels.data())[base + offsets[i]]);
+            break;
+        case VOLUME_QUANTIZATION_BYTE:
+            {
+                const auto scale = (brick->m_max - brick->m_min) * (1.0f / 255.0f);
+                for (auto i = 0; i < 8; ++i)
+                    texels[i] = brick->m_min + scale * m_texels[base + offsets[i]];
+            }
+            break;
+        default:
+            for (auto i = 0; i < 8; ++i)
+                texels[i] = ((const float*)m_texels.data())[base + offsets[i]];
+        }
+
+        const auto t0 = texelLerp(texels[0], texels[1], dx);
+        const auto t1 = texelLerp(texels[2], texels[3], dx);
+        const auto t2 = texelLerp(texels[4], texels[5], dx);
+        const auto t3 = texelLerp(texels[6], texels[7], dx);
+        return texelLerp(texelLerp(t0, t2, dy), texelLerp(t1, t3, dy), dz);
+    }
+
+    const auto t0 = texelLerp(Sample(x, y, z), Sample(x1, y, z), dx);
+    const auto t1 = texelLerp(Sample(x, y, z1), Sample(x1, y, z1), dx);
+    const auto t2 = texelLerp(Sample(x, y1, z), Sample(x1, y1, z), dx);
+    const auto t3 = texelLerp(Sample(x, y1, z1), Sample(x1, y1, z1), dx);
+
+    const auto t02 = texelLerp(t0, t2, dy);
+    const auto t13 = texelLerp(t1, t3, dy);
+
+    return texelLerp(t02, t13, dz);
+}
+
+void SparseTexture3D::Serialize(IStreamBase& stream) {
+    unsigned width = 0, height = 0, depth = 0, quantization = VOLUME_QUANTIZATION_FLOAT, brick_cnt = 0;
+    stream >> width >> height >> depth;
+    stream >> quantization >> brick_cnt;
+    reset(width, height, depth, quantization <= VOLUME_QUANTIZATION_BYTE ? (VolumeQuantization)quantization : VOLUME_QUANTIZATION_FLOAT);
+
+    std::vector<float> texels(BRICK_TEXEL_CNT);
+    for (auto i = 0u; i < brick_cnt; ++i) {
+        unsigned bx, by, bz;
+        float min_value, max_value;
+        stream >> bx >> by >> bz >> min_value >> max_value;
+
+        if (min_value < max_value)
+            stream.Load((char*)texels.data(), sizeof(float) * BRICK_TEXEL_CNT);
+
+        sAssert(bx < m_brickRes[0] && by < m_brickRes[1] && bz < m_brickRes[2], VOLUME);
+        setBrick(bx, by, bz, min_value, max_value, texels.data());
+    }
+    finalize();
+}
+
+bool SparseTexture3D::LoadNanoVDB(const std::string& filename, VolumeQuantization quantization) {
+    reset(0, 0, 0, quantization);
+
+    std::ifstream file(filename, std::ios::binary);
+    char header[NANOVDB_FILE_HEADER_SIZE];
+    if (!file.read(header, sizeof(header))) {
+        slog(WARNING, VOLUME, "Failed to load volume file %s.", filename.c_str());
+        return false;
+    }
+    if ((fetch<std::uint64_t>(header, 0) & NANOVDB_MAGIC_MASK) != NANOVDB_MAGIC || (fetch<std::uint32_t>(header, 8) >> 21) != NANOVDB_MAJOR_VERSION) {
+        slog(WARNING, VOLUME, "Volume file %s is not a NanoVDB file of version %d.", filename.c_str(), NANOVDB_MAJOR_VERSION);
+        return false;
+    }
+
+    // Meta data of all grids goes first, followed by the grids in the same order.
+    const auto grid_cnt = fetch<std::uint16_t>(header, 12);
+    std::uint64_t offset = 0, picked_offset = 0, picked_size = 0;
+    auto picked = false, picked_density = false;
+    for (auto i = 0u; i < grid_cnt; ++i) {
+        char meta[NANOVDB_FILE_META_SIZE];
+        if (!file.read(meta, sizeof(meta)))
+            break;
+        std::string name(fetch<std::uint32_t>(meta, 136), '\0');
+        if (!file.read(&name[0], name.size()))
+            break;
+
+        const auto grid_size = fetch<std::uint64_t>(meta, 0);
+        const auto file_size = fetch<std::uint64_t>(meta, 8);
+        const auto is_float = fetch<std::uint32_t>(meta, 32) == NANOVDB_GRID_TYPE_FLOAT && fetch<std::uint16_t>(meta, 168) == 0;
+        const auto is_density = strcmp(name.c_str(), "density") == 0;
+        if (is_float && (!picked || (is_density && !picked_density))) {
+            picked = true;
+            picked_density = is_density;
+            picked_offset = offset;
+            picked_size = grid_size;
+        }
+        offset += file_size;
+    }
+    if (!picked) {
+        slog(WARNING, VOLUME, "There is no uncompressed grid of floats in volume file %s.", filename.c_str());
+        return false;
+    }
+
+    std::vector<char> buffer((size_t)picked_size);
+    file.seekg(picked_offset, std::ios::cur);
+    if (buffer.size() < NANOVDB_TREE + NANOVDB_TREE_SIZE || !file.read(buffer.data(), buffer.size())) {
+        slog(WARNING, VOLUME, "Volume file %s is truncated.", filename.c_str());
+        return false;
+    }
+
+    const auto grid = buffer.data();
+    const auto tree = NANOVDB_TREE;
+    const auto leaves = tree + fetch<std::uint64_t>(grid, tree);
+    const auto lowers = tree + fetch<std::uint64_t>(grid, tree + 8);
+    const auto uppers = tree + fetch<std::uint64_t>(grid, tree + 16);
+    const auto root = tree + fetch<std::uint64_t>(grid, tree + 24);
+    const auto leaf_cnt = fetch<std::uint32_t>(grid, tree + 32);
+    const auto lower_cnt = fetch<std::uint32_t>(grid, tree + 36);
+    const auto upper_cnt = fetch<std::uint32_t>(grid, tree + 40);
+    const auto corrupted = (fetch<std::uint64_t>(grid, 0) & NANOVDB_MAGIC_MASK) != NANOVDB_MAGIC ||
+                           fetch<std::uint32_t>(grid, NANOVDB_GRID_TYPE) != NANOVDB_GRID_TYPE_FLOAT ||
+                           leaves + leaf_cnt * NANOVDB_LEAF_SIZE > buffer.size() ||
+                           lowers + lower_cnt * NANOVDB_LOWER.size > buffer.size() ||
+                           uppers + upper_cnt * NANOVDB_UPPER.size > buffer.size() ||
+                           root + NANOVDB_ROOT_SIZE > buffer.size() ||
+                           root + NANOVDB_ROOT_SIZE + fetch<std::uint32_t>(grid, root + 24) * NANOVDB_ROOT_TILE_SIZE > buffer.size();
+    if (corrupted) {
+        slog(WARNING, VOLUME, "Volume file %s is corrupted.", filename.c_str());
+        return false;
+    }
+
+    // The bounding box of the root is the bounding box of all active values in index space.
+    int origin[3];
+    unsigned dim[3];
+    for (auto i = 0; i < 3; ++i) {
+        const auto min_coord = fetch<int>(grid, root + 4 * i);
+        const auto max_coord = fetch<int>(grid, root + 12 + 4 * i);
+        if (min_coord > max_coord) {
+            slog(WARNING, VOLUME, "Volume file %s is empty.", filename.c_str());
+            return false;
+        }
+        origin[i] = min_coord & ~(int)(BRICK_SIZE - 1);
+        dim[i] = (unsigned)((long long)max_coord - origin[i] + 1);
+    }
+    reset(dim[0], dim[1], dim[2], quantization);
+
+    if (fetch<float>(grid, root + 28) != 0.0f)
+        slog(WARNING, VOLUME, "The background of volume file %s is not zero, it is ignored.", filename.c_str());
+
+    // Tiles are regions of the same value aligned to bricks, they are clipped by the texture.
+    const auto set_tile = [&](const int* coord, unsigned tile_dim, float value) {
+        if (value == 0.0f)
+            return;
+        unsigned lo[3], hi[3];
+        for (auto i = 0; i < 3; ++i) {
+            const auto begin = std::max((long long)coord[i] - origin[i], 0ll);
+            const auto end = std::min((long long)coord[i] + tile_dim - origin[i], (long long)m_brickRes[i] * BRICK_SIZE);
+            if (begin >= end)
+                return;
+            lo[i] = (unsigned)(begin / BRICK_SIZE);
+            hi[i] = (unsigned)((end + BRICK_SIZE - 1) / BRICK_SIZE);
+        }
+        for (auto bz = lo[2]; bz < hi[2]; ++bz)
+            for (auto by = lo[1]; by < hi[1]; ++by)
+                for (auto bx = lo[0]; bx < hi[0]; ++bx)
+                    setBrick(bx, by, bz, value, value, nullptr);
+    };
+
+    const auto tile_cnt = fetch<std::uint32_t>(grid, root + 24);
+    for (auto i = 0u; i < tile_cnt; ++i) {
+        const auto tile = root + NANOVDB_ROOT_SIZE + i * NANOVDB_ROOT_TILE_SIZE;
+        if (fetch<std::int64_t>(grid, tile + 8) != 0)
+            continue;
+
+        // the key packs the 21 most significant bits of each coordinate, x goes first
+        const auto key = fetch<std::uint64_t>(grid, tile);
+        const auto mask = (1ull << 21) - 1;
+        const int coord[3] = { (int)(std::uint32_t)(((key >> 42) & mask) << 12) , (int)(std::uint32_t)(((key >> 21) & mask) << 12) , (int)(std::uint32_t)((key & mask) << 12) };
+        set_tile(coord, NANOVDB_ROOT_CHILD_DIM, fetch<float>(grid, tile + 20));
+    }
+
+    const auto set_node_tiles = [&](size_t nodes, unsigned node_cnt, const NanoVDBNodeLayout& layout) {
+        const auto node_dim = 1u << layout.log2dim;
+        for (auto k = 0u; k < node_cnt; ++k) {
+            const auto node = nodes + k * layout.size;
+            int node_origin[3];
+            for (auto i = 0; i < 3; ++i)
+                node_origin[i] = fetch<int>(grid, node + 4 * i) & ~(int)(node_dim * layout.child_dim - 1);
+
+            for (auto n = 0u; n < (1u << (3 * layout.log2dim)); ++n) {
+                if ((fetch<std::uint64_t>(grid, node + layout.child_mask + 8 * (n >> 6)) >> (n & 63)) & 1)
+                    continue;
+
+                // x is the most significant in the index of a child
+                const int coord[3] = { node_origin[0] + (int)((n >> (2 * layout.log2dim)) * layout.child_dim) ,
+                                       node_origin[1] + (int)(((n >> layout.log2dim) & (node_dim - 1)) * layout.child_dim) ,
+                                       node_origin[2] + (int)((n & (node_dim - 1)) * layout.child_dim) };
+                set_tile(coord, layout.child_dim, fetch<float>(grid, node + layout.table + 8 * n));
+            }
+        }
+    };
+    set_node_tiles(uppers, upper_cnt, NANOVDB_UPPER);
+    set_node_tiles(lowers, lower_cnt, NANOVDB_LOWER);
+
+    // Leaves have the same size as bricks, only the order of texels differs.
+    std::vector<float> texels(BRICK_TEXEL_CNT);
+    for (auto k = 0u; k < leaf_cnt; ++k) {
+        const auto leaf = leaves + k * NANOVDB_LEAF_SIZE;
+        long long brick[3];
+        for (auto i = 0; i < 3; ++i)
+            brick[i] = ((long long)(fetch<int>(grid, leaf + 4 * i) & ~(int)(BRICK_SIZE - 1)) - origin[i]) / BRICK_SIZE;
+        if (brick[0] < 0 || brick[1] < 0 || brick[2] < 0)
+            continue;
+
+        auto min_value = FLT_MAX, max_value = -FLT_MAX;
+        for (auto n = 0u; n < BRICK_TEXEL_CNT; ++n) {
+            const auto value = fetch<float>(grid, leaf + NANOVDB_LEAF_VALUES + sizeof(float) * n);
+            texels[((n & 7) * BRICK_SIZE + ((n >> 3) & 7)) * BRICK_SIZE + (n >> 6)] = value;
+            min_value = std::min(min_value, value);
+            max_value = std::max(max_value, value);
+        }
+        setBrick((unsigned)brick[0], (unsigned)brick[1], (unsigned)brick[2], min_value, max_value, texels.data());
+    }
+    finalize();
+
+    return true;
+}
+
+std::vector<float> SparseTexture3D::GetBrickMaximum() const {
+    std::vector<float> ret(m_brickRes[0] * m_brickRes[1] * m_brickRes[2], 0.0f);
+    for (auto bz = 0u; bz < m_brickRes[2]; ++bz) {
+        for (auto by = 0u; by < m_brickRes[1]; ++by) {
+            for (auto bx = 0u; bx < m_brickRes[0]; ++bx) {
+                const auto brick = getBrick(bx, by, bz);
+                if (brick)
+                    ret[(bz * m_brickRes[1] + by) * m_brickRes[0] + bx] = brick->m_max;
+            }
+        }
+    }
+    return ret;
+}
+
+const SparseTexture3D::Brick* SparseTexture3D::getBrick(unsigned bx, unsigned by, unsigned bz) const {
+    const auto node = m_root[((bz / NODE_SIZE) * m_nodeRes[1] + by / NODE_SIZE) * m_nodeRes[0] + bx / NODE_SIZE];
+    if (node == INVALID)
+        return nullptr;
+
+    const auto brick = m_nodes[(size_t)node * NODE_SIZE * NODE_SIZE * NODE_SIZE + ((bz % NODE_SIZE) * NODE_SIZE + by % NODE_SIZE) * NODE_SIZE + bx % NODE_SIZE];
+    return brick == INVALID ? nullptr : &m_bricks[brick];
+}
+
+SparseTexture3D::Brick& SparseTexture3D::addBrick(unsigned bx, unsigned by, unsigned bz) {
+    auto& node = m_root[((bz / NODE_SIZE) * m_nodeRes[1] + by / NODE_SIZE) * m_nodeRes[0] + bx / NODE_SIZE];
+    if (node == INVALID) {
+        node = (unsigned)(m_nodes.size() / (NODE_SIZE * NODE_SIZE * NODE_SIZE));
+        m_nodes.resize(m_nodes.size() + NODE_SIZE * NODE_SIZE * NODE_SIZE, INVALID);
+    }
+
+    auto& brick = m_nodes[(size_t)node * NODE_SIZE * NODE_SIZE * NODE_SIZE + ((bz % NODE_SIZE) * NODE_SIZE + by % NODE_SIZE) * NODE_SIZE + bx % NODE_SIZE];
+    if (brick == INVALID) {
+        brick = (unsigned)m_bricks.size();
+        m_bricks.emplace_back();
+    }
+    return m_bricks[brick];
+}
+
+void SparseTexture3D::reset(unsigned width, unsigned height, unsigned depth, VolumeQuantization quantization) {
+    m_width = width;
+    m_height = height;
+    m_depth = depth;
+    m_quantization = quantization;
+
+    const unsigned dim[3] = { m_width , m_height , m_depth };
+    for (auto i = 0; i < 3; ++i) {
+        m_brickRes[i] = (dim[i] + BRICK_SIZE - 1) / BRICK_SIZE;
+        m_nodeRes[i] = (m_brickRes[i] + NODE_SIZE - 1) / NODE_SIZE;
+    }
+    m_root.assign((size_t)m_nodeRes[0] * m_nodeRes[1] * m_nodeRes[2], INVALID);
+    m_nodes.clear();
+    m_bricks.clear();
+    m_texels.clear();
+}
+
+void SparseTexture3D::setBrick(unsigned bx, unsigned by, unsigned bz, float min_value, float max_value, const float* texels) {
+    // out of range bricks and empty bricks don't need to be stored
+    if (bx >= m_brickRes[0] || by >= m_brickRes[1] || bz >= m_brickRes[2])
+        return;
+    const auto has_texels = min_value < max_value;
+    if (!has_texels && min_value == 0.0f)
+        return;
+
+    auto& brick = addBrick(bx, by, bz);
+    brick.m_min = min_value;
+    brick.m_max = max_value;
+    if (!has_texels) {
+        brick.m_slot = INVALID;
+        return;
+    }
+
+    const auto texel_size = texelSize(m_quantization);
+    if (brick.m_slot == INVALID) {
+        brick.m_slot = (unsigned)(m_texels.size() / (BRICK_TEXEL_CNT * texel_size));
+        m_texels.resize(m_texels.size() + BRICK_TEXEL_CNT * texel_size);
+    }
+    const auto offset = (size_t)brick.m_slot * BRICK_TEXEL_CNT;
+    switch (m_quantization) {
+    case VOLUME_QUANTIZATION_HALF:
+        {
+            auto dst = (std::uint16_t*)m_texels.data() + offset;
+            for (auto k = 0u; k < BRICK_TEXEL_CNT; ++k)
+                dst[k] = floatToHalf(texels[k]);
+
+            // the range of the brick needs to cover the rounded texels
+            brick.m_min = FLT_MAX;
+            brick.m_max = -FLT_MAX;
+            for (auto k = 0u; k < BRICK_TEXEL_CNT; ++k) {
+                const auto value = halfToFloat(dst[k]);
+                brick.m_min = std::min(brick.m_min, value);
+                brick.m_max = std::max(brick.m_max, value);
+            }
+        }
+        break;
+    case VOLUME_QUANTIZATION_BYTE:
+        {
+            const auto scale = 255.0f / (max_value - min_value);
+            auto dst = m_texels.data() + offset;
+            for (auto k = 0u; k < BRICK_TEXEL_CNT; ++k)
+                dst[k] = (std::uint8_t)clamp((int)((texels[k] - min_value) * scale + 0.5f), 0, 255);
+        }
+        break;
+    default:
+        memcpy(m_texels.data() + offset * sizeof(float), texels, sizeof(float) * BRICK_TEXEL_CNT);
+    }
+}
+
+void SparseTexture3D::finalize() {
+    m_texels.shrink_to_fit();
+    m_bricks.shrink_to_fit();
+    m_nodes.shrink_to_fit();
+
+    m_memory.Set(m_texels.capacity() + sizeof(Brick) * m_bricks.capacity() + sizeof(unsigned) * (m_nodes.capacity() + m_root.capacity()));
+}
@@ -0,0 +1,144 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "texturebase.h"
+#include "core/memory.h"
+
+class IStreamBase;
+
+//! @brief  How texels of a sparse 3D texture are stored.
+enum VolumeQuantization : unsigned {
+    VOLUME_QUANTIZATION_FLOAT = 0,      /**< 32 bits floating point, lossless. */
+    VOLUME_QUANTIZATION_HALF = 1,       /**< 16 bits floating point. */
+    VOLUME_QUANTIZATION_BYTE = 2,       /**< 8 bits quantized between the minimum and maximum of the brick. */
+};
+
+//! @brief  Sparse 3D texture of scalar values.
+/**
+ * Texels are grouped in bricks of 8x8x8. Bricks with the same value everywhere, which are mostly empty ones in smoke
+ * simulation, don't allocate any texel memory. Bricks are indexed by a two level tree, the root is a dense grid of nodes
+ * and each node covers 8x8x8 bricks. Nodes without any brick are not allocated either. Texels of bricks could further be
+ * quantized to half floating point or 8 bits to save memory.
+ *
+ * The minimum and maximum of each brick are kept, which gives a coarse bound of the texture for free.
+ */
+class SparseTexture3D : public Texture3DBase<float> {
+public:
+    /**< Number of texels in a brick along an axis. */
+    static constexpr unsigned BRICK_SIZE = 8;
+    /**< Number of texels in a brick. */
+    static constexpr unsigned BRICK_TEXEL_CNT = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+    /**< Number of bricks in a node along an axis. */
+    static constexpr unsigned NODE_SIZE = 8;
+
+    //! @brief  Take a sample in 3D texture given a position of texel.
+    //!
+    //! @param  x       X coordinate position.
+    //! @param  y       Y coordinate position.
+    //! @param  z       Z coordinate position.
+    float Sample(int x, int y, int z) const override;
+
+    //! @brief  Take a sample in 3D texture with trilinear interpolation.
+    //!
+    //! @param u        U coordinate.
+    //! @param v        V coordinate.
+    //! @param w        W coordinate.
+    float Sample(float u, float v, float w) const override;
+
+    //! @brief  Load the texture from a stream.
+    //!
+    //! The stream has the size of the texture, the quantization mode and the number of non-empty bricks, followed by
+    //! the bricks. Each brick has its brick coordinate, its minimum and maximum and, only if the two differ, all of its
+    //! texels in 32 bits floating point. Bricks not in the stream are all zero.
+    //!
+    //! @param  stream  Stream where the serialization data comes from.
+    void    Serialize(IStreamBase& stream);
+
+    //! @brief  Load the texture from a NanoVDB file.
+    //!
+    //! Only uncompressed grids of floats are supported, the grid named 'density' is picked if there is one, otherwise
+    //! the first grid of floats. Leaf nodes of NanoVDB have the same size as bricks, they are copied as bricks without
+    //! going through a dense grid, and tiles become constant bricks. The texture covers the bounding box of the grid in
+    //! index space, with its minimum rounded down to the boundary of a leaf node so that leaves line up with bricks.
+    //!
+    //! @param  filename    Full path of the NanoVDB file.
+    //! @param  quantization How texels are stored.
+    //! @return             Whether the texture is loaded.
+    bool    LoadNanoVDB(const std::string& filename, VolumeQuantization quantization);
+
+    //! @brief  Number of bricks along an axis, bricks on the border could be partially outside of the texture.
+    SORT_FORCEINLINE unsigned GetBrickResolution(int axis) const {
+        return m_brickRes[axis];
+    }
+
+    //! @brief  Maximum value of all texels of each brick, x goes first, then y and z.
+    //!
+    //! @return         Maximum of each brick.
+    std::vector<float> GetBrickMaximum() const;
+
+    //! @brief  Memory used by texels of bricks in bytes.
+    SORT_FORCEINLINE size_t GetTexelMemory() const {
+        return m_texels.size();
+    }
+
+protected:
+    //! @brief  A brick of texels.
+    struct Brick {
+        float       m_min = 0.0f;       /**< Minimum value of texels in the brick. */
+        float       m_max = 0.0f;       /**< Maximum value of texels in the brick. */
+        unsigned    m_slot = INVALID;   /**< Slot of the texels of the brick, it is invalid if all texels are the same. */
+    };
+
+    /**< An invalid index of nodes, bricks or slots. */
+    static constexpr unsigned INVALID = 0xffffffff;
+
+    unsigned                    m_brickRes[3] = { 0 , 0 , 0 };      /**< Number of bricks along each axis. */
+    unsigned                    m_nodeRes[3] = { 0 , 0 , 0 };       /**< Number of nodes along each axis. */
+    VolumeQuantization          m_quantization = VOLUME_QUANTIZATION_FLOAT;     /**< How texels are stored. */
+
+    std::vector<unsigned>       m_root;         /**< Index of the node in each cell of the root, invalid if there is no brick. */
+    std::vector<unsigned>       m_nodes;        /**< Index of the brick in each cell of each node, invalid if it is empty. */
+    std::vector<Brick>          m_bricks;       /**< All non-empty bricks. */
+    std::vector<std::uint8_t>   m_texels;       /**< Texels of bricks, each slot is a brick of texels in the quantized format. */
+    TrackedMemory               m_memory = TrackedMemory(MemoryCategory::Volume);  /**< Memory of the volume accounted in the memory of volumes. */
+
+    //! @brief  Find the brick covering a texel.
+    //!
+    //! @return         The brick, null if the brick is empty.
+    const Brick*    getBrick(unsigned bx, unsigned by, unsigned bz) const;
+
+    //! @brief  Add a brick, the node covering it is allocated if needed.
+    //!
+    //! @return         The brick added.
+    Brick&          addBrick(unsigned bx, unsigned by, unsigned bz);
+
+    //! @brief  Clear the texture and set its size and quantization mode.
+    void            reset(unsigned width, unsigned height, unsigned depth, VolumeQuantization quantization);
+
+    //! @brief  Set the texels of a brick in the quantized format, out of range bricks and empty bricks are skipped.
+    //!
+    //! @param  texels  All texels of the brick in 32 bits floating point, it is only read if the minimum and maximum differ.
+    void            setBrick(unsigned bx, unsigned by, unsigned bz, float min_value, float max_value, const float* texels);
+
+    //! @brief  Release the spare memory once all bricks are set.
+    void            finalize();
+};
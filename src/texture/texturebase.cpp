@@ -108,4 +108,35 @@ float Texture2DBase::GetAlphaFromtUV( float u , float v ) const{
 
     return  GetAlpha(iu, iv) * (1.0f - _fu) * (1.0f - _fv) + GetAlpha(iu + 1, iv) * _fu * (1.0f - _fv) +
             GetAlpha(iu, iv + 1) * (1.0f - _fu) * _fv + GetAlpha(iu + 1, iv + 1) * _fu * _fv;
+}
+
+Spectrum Texture2DBase::GetColorFromUV( float u , float v , float rnd ) const{
+    int x , y;
+    pickTexel( u , v , rnd , x , y );
+    return GetColor( x , y );
+}
+
+float Texture2DBase::GetAlphaFromtUV( float u , float v , float rnd ) const{
+    int x , y;
+    pickTexel( u , v , rnd , x , y );
+    return GetAlpha( x , y );
+}
+
+void Texture2DBase::pickTexel( float u , float v , float rnd , int& x , int& y ) const{
+    const auto fu = u * m_iTexWidth - 0.5f;
+    const auto fv = v * m_iTexHeight - 0.5f;
+    const auto _fu = fu - floor(fu);
+    const auto _fv = fv - floor(fv);
+    x = (int)( fu );
+    y = (int)( fv );
+
+    // the bilinear weights are separable, the column is picked first and the number is stretched back to [0, 1) for the row
+    if( rnd < _fu ){
+        ++x;
+        rnd /= _fu;
+    }else{
+        rnd = ( rnd - _fu ) / ( 1.0f - _fu );
+    }
+    if( rnd < _fv )
+        ++y;
 }
\ No newline at end of file
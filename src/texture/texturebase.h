@@ -88,6 +88,25 @@ public:
     //! @return             The alpha at the specific texture coordinate.
     virtual float GetAlphaFromtUV( float u , float v ) const;
 
+    //! @brief  Get the color given a texture coordinate with a single texel fetched.
+    //!
+    //! One of the four texels of bilinear filtering is picked with the probability of its weight, it matches bilinear
+    //! filtering in expectation while only touching one texel.
+    //!
+    //! @param  u           U coordinate. If out of range, it will be filtered.
+    //! @param  v           V coordinate. If out of range, it will be filtered.
+    //! @param  rnd         Canonical random number picking the texel.
+    //! @return             The color of the picked texel.
+    virtual Spectrum GetColorFromUV( float u , float v , float rnd ) const;
+
+    //! @brief  Get the alpha given a texture coordinate with a single texel fetched.
+    //!
+    //! @param  u           U coordinate. If out of range, it will be filtered.
+    //! @param  v           V coordinate. If out of range, it will be filtered.
+    //! @param  rnd         Canonical random number picking the texel.
+    //! @return             The alpha of the picked texel.
+    virtual float GetAlphaFromtUV( float u , float v , float rnd ) const;
+
     //! @brief  Get the width of the texture.
     //!
     //! @return             The width of the 2d texture.
@@ -122,6 +141,15 @@ protected:
     //! @return u       U coordinate.
     //! @return v       V coordinate.
     void texCoordFilter( int& u , int&v ) const;
+
+    //! @brief  Pick one of the four texels around a texture coordinate by its bilinear weight.
+    //!
+    //! @param  u           U coordinate.
+    //! @param  v           V coordinate.
+    //! @param  rnd         Canonical random number picking the texel.
+    //! @param  x           X coordinate of the picked texel.
+    //! @param  y           Y coordinate of the picked texel.
+    void pickTexel( float u , float v , float rnd , int& x , int& y ) const;
 };
 
 //! @brief  Base interface of 3D texture.
@@ -0,0 +1,63 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <algorithm>
+#include <mutex>
+#include "texturefeedback.h"
+#include "udimtexture2d.h"
+#include "core/workercontext.h"
+#include "core/stats.h"
+
+SORT_STATS_DEFINE_COUNTER(sTexturePrefetchCount)
+
+SORT_STATS_COUNTER("Statistics", "UDIM Tiles Prefetched", sTexturePrefetchCount);
+
+void TextureFeedback::Request( const UdimTexture2D* texture , int tile ){
+    // a prepass only touches a handful of tiles, a linear search is cheaper than any set
+    std::lock_guard<spinlock_mutex> lock( m_lock );
+    const auto request = std::make_pair( texture , tile );
+    if( std::find( m_requests.begin() , m_requests.end() , request ) == m_requests.end() )
+        m_requests.push_back( request );
+}
+
+void TextureFeedback::Prefetch(){
+    std::vector<std::pair<const UdimTexture2D*, int>> requests;
+    {
+        std::lock_guard<spinlock_mutex> lock( m_lock );
+        requests.swap( m_requests );
+    }
+
+    for( const auto& request : requests ){
+        if( request.first->Prefetch( request.second ) )
+            SORT_STATS(++sTexturePrefetchCount);
+    }
+}
+
+unsigned TextureFeedback::GetRequestCnt() const{
+    std::lock_guard<spinlock_mutex> lock( m_lock );
+    return (unsigned)m_requests.size();
+}
+
+TextureFeedbackScope::TextureFeedbackScope( TextureFeedback* feedback ){
+    auto& context = GetWorkerContext();
+    m_previous = context.textureFeedback;
+    context.textureFeedback = feedback;
+}
+
+TextureFeedbackScope::~TextureFeedbackScope(){
+    GetWorkerContext().textureFeedback = m_previous;
+}
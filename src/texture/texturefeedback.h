@@ -0,0 +1,72 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <vector>
+#include <utility>
+#include "core/thread.h"
+
+class UdimTexture2D;
+
+//! @brief  Texture tiles a prepass of a screen tile looked up before they were resident.
+/**
+ * Loading a UDIM tile on its first lookup stalls the worker rendering, along with all the other workers looking it up
+ * at the same moment. Coarse passes of a screen tile only need a rough look of it, while a feedback is bound to the
+ * worker, lookups in tiles not loaded yet are black and the tiles are recorded here instead of being loaded. An I/O
+ * worker loads them afterward, before the full passes of the same screen tile are started.
+ */
+class TextureFeedback{
+public:
+    //! @brief  Record a tile that is not resident yet, it could be called from any thread.
+    //!
+    //! @param  texture     The UDIM texture the tile belongs to.
+    //! @param  tile        Index of the tile in the texture.
+    void    Request( const UdimTexture2D* texture , int tile );
+
+    //! @brief  Load all tiles recorded so far, it is meant to be done by an I/O worker.
+    void    Prefetch();
+
+    //! @brief  Number of tiles recorded so far.
+    //!
+    //! @return             Number of distinct tiles recorded.
+    unsigned GetRequestCnt() const;
+
+private:
+    /**< Tiles recorded, each of them only once. */
+    std::vector<std::pair<const UdimTexture2D*, int>>   m_requests;
+    /**< Lock of the requests, prepasses of a screen tile could run on different workers. */
+    mutable spinlock_mutex                              m_lock;
+};
+
+//! @brief  Bind a feedback to the current worker in a scope.
+class TextureFeedbackScope{
+public:
+    //! @brief  Bind the feedback to the worker.
+    //!
+    //! @param  feedback    The feedback recording tiles not resident, nullptr makes lookups load them as usual.
+    explicit TextureFeedbackScope( TextureFeedback* feedback );
+
+    //! @brief  Restore the feedback bound before.
+    ~TextureFeedbackScope();
+
+    TextureFeedbackScope( const TextureFeedbackScope& ) = delete;
+    TextureFeedbackScope& operator =( const TextureFeedbackScope& ) = delete;
+
+private:
+    TextureFeedback*    m_previous;
+};
@@ -0,0 +1,163 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <filesystem>
+#include "udimtexture2d.h"
+#include "texturefeedback.h"
+#include "core/workercontext.h"
+#include "core/log.h"
+#include "core/stats.h"
+
+SORT_STATS_DEFINE_COUNTER(sUdimTileCount)
+SORT_STATS_DEFINE_COUNTER(sUdimTileLoadedCount)
+
+SORT_STATS_COUNTER("Statistics", "UDIM Tiles", sUdimTileCount);
+SORT_STATS_COUNTER("Statistics", "UDIM Tiles Loaded", sUdimTileLoadedCount);
+
+// the first tile of a UDIM set
+static constexpr int UDIM_FIRST_TILE = 1001;
+// UDIM numbers have four digits, the last tile is 9999
+static constexpr int UDIM_LAST_TILE = 9999;
+
+bool UdimTexture2D::LoadResource( const std::string filename ){
+    m_name = filename;
+    m_tiles = nullptr;
+    m_tileCnt = 0;
+
+    const auto token = filename.find( UDIM_TOKEN );
+    if( token == std::string::npos )
+        return false;
+
+    // only the names of the files are listed, none of them is opened
+    const std::filesystem::path pattern( filename );
+    const auto folder = pattern.has_parent_path() ? pattern.parent_path() : std::filesystem::path( "." );
+    const auto name = pattern.filename().string();
+    const auto name_token = name.find( UDIM_TOKEN );
+    const auto prefix = name.substr( 0 , name_token );
+    const auto suffix = name.substr( name_token + strlen( UDIM_TOKEN ) );
+
+    std::vector<std::pair<int, std::string>> found;
+    std::error_code err;
+    for( const auto& entry : std::filesystem::directory_iterator( folder , err ) ){
+        const auto file = entry.path().filename().string();
+        if( file.size() != prefix.size() + 4 + suffix.size() || file.compare( 0 , prefix.size() , prefix ) != 0 ||
+            file.compare( file.size() - suffix.size() , suffix.size() , suffix ) != 0 )
+            continue;
+
+        const auto digits = file.substr( prefix.size() , 4 );
+        if( !std::all_of( digits.begin() , digits.end() , []( char c ){ return c >= '0' && c <= '9'; } ) )
+            continue;
+        const auto udim = std::stoi( digits );
+        if( udim >= UDIM_FIRST_TILE && udim <= UDIM_LAST_TILE )
+            found.push_back( { udim - UDIM_FIRST_TILE , filename.substr( 0 , token ) + digits + filename.substr( token + strlen( UDIM_TOKEN ) ) } );
+    }
+
+    if( found.empty() ){
+        slog( WARNING , IMAGE , "There is no tile of the UDIM texture %s." , filename.c_str() );
+        return false;
+    }
+
+    for( const auto& tile : found )
+        m_tileCnt = std::max( m_tileCnt , tile.first + 1 );
+    m_tiles = std::make_unique<Tile[]>( m_tileCnt );
+    for( const auto& tile : found ){
+        m_tiles[tile.first].filename = tile.second;
+        m_tiles[tile.first].state = TileState::Unloaded;
+    }
+
+    SORT_STATS(sUdimTileCount += (StatsInt)found.size());
+    return true;
+}
+
+const ImageTexture2D* UdimTexture2D::getTile( float& u , float& v ) const{
+    const auto fu = std::floor( u );
+    const auto fv = std::floor( v );
+    if( fu < 0.0f || fu >= (float)UDIM_TILES_PER_ROW || fv < 0.0f )
+        return nullptr;
+    const auto index = (int)fv * UDIM_TILES_PER_ROW + (int)fu;
+    if( index >= m_tileCnt )
+        return nullptr;
+
+    auto& tile = m_tiles[index];
+    auto state = tile.state.load( std::memory_order_acquire );
+    if( UNLIKELY( state == TileState::Unloaded ) ){
+        // prepasses don't wait for the tile, it is loaded by an I/O worker before the full passes
+        if( const auto feedback = GetWorkerContext().textureFeedback ){
+            feedback->Request( this , index );
+            return nullptr;
+        }
+        loadTile( tile );
+        state = tile.state.load( std::memory_order_acquire );
+    }
+    if( state != TileState::Loaded )
+        return nullptr;
+
+    u -= fu;
+    v -= fv;
+    return tile.texture.get();
+}
+
+bool UdimTexture2D::Prefetch( int index ) const{
+    if( index < 0 || index >= m_tileCnt )
+        return false;
+    auto& tile = m_tiles[index];
+    return tile.state.load( std::memory_order_acquire ) == TileState::Unloaded && loadTile( tile );
+}
+
+bool UdimTexture2D::loadTile( Tile& tile ) const{
+    std::lock_guard<std::mutex> lock( tile.mutex );
+
+    // some other thread may have loaded it while this one was waiting for the lock
+    if( tile.state.load( std::memory_order_acquire ) != TileState::Unloaded )
+        return false;
+
+    // the thread is in the middle of rendering, the tile can't be loaded by forking tasks
+    auto texture = std::make_unique<ImageTexture2D>();
+    if( !texture->LoadResourceSerially( tile.filename ) || !texture->IsValid() ){
+        slog( WARNING , IMAGE , "Failed to load tile %s of the UDIM texture %s." , tile.filename.c_str() , m_name.c_str() );
+        tile.state.store( TileState::Failed , std::memory_order_release );
+        return false;
+    }
+
+    tile.texture = std::move( texture );
+    tile.state.store( TileState::Loaded , std::memory_order_release );
+    SORT_STATS(++sUdimTileLoadedCount);
+    return true;
+}
+
+Spectrum UdimTexture2D::GetColorFromUV( float u , float v ) const{
+    const auto tile = getTile( u , v );
+    return tile ? tile->GetColorFromUV( u , v ) : Spectrum( 0.0f );
+}
+
+float UdimTexture2D::GetAlphaFromtUV( float u , float v ) const{
+    const auto tile = getTile( u , v );
+    return tile ? tile->GetAlphaFromtUV( u , v ) : 1.0f;
+}
+
+Spectrum UdimTexture2D::GetColorFromUV( float u , float v , float rnd ) const{
+    const auto tile = getTile( u , v );
+    return tile ? tile->GetColorFromUV( u , v , rnd ) : Spectrum( 0.0f );
+}
+
+float UdimTexture2D::GetAlphaFromtUV( float u , float v , float rnd ) const{
+    const auto tile = getTile( u , v );
+    return tile ? tile->GetAlphaFromtUV( u , v , rnd ) : 1.0f;
+}
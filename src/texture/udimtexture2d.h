@@ -0,0 +1,141 @@
+/*
+    This file is a part of SORT(Simple Open Ray Tracing), an open-source cross
+    platform physically based renderer.
+
+    Copyright (c) 2011-2020 by Jiayin Cao - All rights reserved.
+
+    SORT is a free software written for educational purpose. Anyone can distribute
+    or modify it under the the terms of the GNU General Public License Version 3 as
+    published by the Free Software Foundation. However, there is NO warranty that
+    all components are functional in a perfect manner. Without even the implied
+    warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+    General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along with
+    this program. If not, see <http://www.gnu.org/licenses/gpl-3.0.html>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include "core/resource.h"
+#include "texturebase.h"
+#include "imagetexture2d.h"
+
+//! @brief  Number of UDIM tiles in a row, tile 1001 covers [0,1) of both u and v, tile 1011 is right above it.
+constexpr int UDIM_TILES_PER_ROW = 10;
+
+//! @brief  Token in the file name of a UDIM set, which is replaced by the number of each tile.
+constexpr const char* UDIM_TOKEN = "<UDIM>";
+
+//! @brief  A set of image textures laid out in UDIM tiles.
+/**
+ * Assets with lots of UDIM tiles rarely have all of them visible. Only the files of the tiles are listed when the set
+ * is loaded, a tile is not read until the first lookup in it. Memory and loading time scale with the tiles actually
+ * hit by rays, instead of the size of the asset.
+ * Tiles are loaded by the thread looking them up first, other threads looking up the same tile wait for it. Texels
+ * can only be looked up by texture coordinates, since the tile is decided by the integer part of them.
+ * With a TextureFeedback bound to the worker, lookups in tiles not loaded yet are black and the tiles are recorded in
+ * the feedback to be prefetched later.
+ */
+class UdimTexture2D : public Texture2DBase, public Resource{
+public:
+    //! @brief  List the tiles of the set, none of them is loaded yet.
+    //!
+    //! @param  filename        Name of the files with the UDIM token in place of the tile number.
+    //! @return                 Whether there is any tile of the set.
+    bool LoadResource(const std::string filename) override;
+
+    //! @brief  Texels can't be addressed without the tile, it is always black.
+    //!
+    //! @param  x           X coordinate.
+    //! @param  y           Y coordinate.
+    //! @return             Black.
+    Spectrum GetColor( int x , int y ) const override{
+        return 0.0f;
+    }
+
+    //! @brief  Get the color given a texture coordinate.
+    //!
+    //! @param  u           U coordinate, its integer part picks the column of the tile.
+    //! @param  v           V coordinate, its integer part picks the row of the tile.
+    //! @return             The color in the tile, black if there is no such a tile.
+    Spectrum GetColorFromUV( float u , float v ) const override;
+
+    //! @brief  Get the alpha given a texture coordinate.
+    //!
+    //! @param  u           U coordinate, its integer part picks the column of the tile.
+    //! @param  v           V coordinate, its integer part picks the row of the tile.
+    //! @return             The alpha in the tile, one if there is no such a tile.
+    float GetAlphaFromtUV( float u , float v ) const override;
+
+    //! @brief  Get the color given a texture coordinate with a single texel fetched.
+    //!
+    //! @param  u           U coordinate, its integer part picks the column of the tile.
+    //! @param  v           V coordinate, its integer part picks the row of the tile.
+    //! @param  rnd         Canonical random number picking the texel.
+    //! @return             The color of the picked texel, black if there is no such a tile.
+    Spectrum GetColorFromUV( float u , float v , float rnd ) const override;
+
+    //! @brief  Get the alpha given a texture coordinate with a single texel fetched.
+    //!
+    //! @param  u           U coordinate, its integer part picks the column of the tile.
+    //! @param  v           V coordinate, its integer part picks the row of the tile.
+    //! @param  rnd         Canonical random number picking the texel.
+    //! @return             The alpha of the picked texel, one if there is no such a tile.
+    float GetAlphaFromtUV( float u , float v , float rnd ) const override;
+
+    //! @brief  Whether the set has any tile.
+    //!
+    //! @return             True if there is at least one tile.
+    bool IsValid() const override {
+        return m_tileCnt > 0;
+    }
+
+    //! @brief  Whether a file name refers to a UDIM set.
+    //!
+    //! @param  filename    The name of the file.
+    //! @return             Whether the UDIM token is in the name.
+    static bool IsUdim( const std::string& filename ){
+        return filename.find( UDIM_TOKEN ) != std::string::npos;
+    }
+
+    //! @brief  Load a tile ahead of its lookups, it is mostly done by I/O workers.
+    //!
+    //! @param  index       Index of the tile, the UDIM number minus 1001.
+    //! @return             Whether the tile was loaded by this call.
+    bool Prefetch( int index ) const;
+
+private:
+    // state of a tile
+    enum class TileState : unsigned char{
+        Missing,        // there is no file of the tile
+        Unloaded,       // the file is not read yet
+        Loaded,         // the texture of the tile is ready
+        Failed,         // the file failed to load
+    };
+
+    // a tile of the set
+    struct Tile{
+        std::string                     filename;                           /**< File of the tile. */
+        std::atomic<TileState>          state = { TileState::Missing };     /**< State of the tile, it is only 'Loaded' once the texture is ready. */
+        std::mutex                      mutex;                              /**< Lock held while loading the tile. */
+        std::unique_ptr<ImageTexture2D> texture;                            /**< Texture of the tile. */
+    };
+
+    /**< All tiles up to the last one with a file, indexed by the UDIM number minus 1001. */
+    std::unique_ptr<Tile[]> m_tiles;
+    /**< Number of tiles in 'm_tiles'. */
+    int                     m_tileCnt = 0;
+    /**< Name of the set. */
+    std::string             m_name;
+
+    // get the loaded texture of the tile covering a texture coordinate, nullptr if there is no such a tile
+    const ImageTexture2D*   getTile( float& u , float& v ) const;
+
+    // load a tile, it is only called by the first thread looking it up. It returns whether this call loaded it.
+    bool    loadTile( Tile& tile ) const;
+};